@@ -0,0 +1,49 @@
+#!/bin/make -f
+
+####################################################################################
+# The bridles as libraries
+####################################################################################
+
+# A jockey that lists its bridles in BRIDLES links against the libraries that the
+# Makefile in bridles builds once for all jockeys, instead of compiling its own copy
+# of every bridle. It keeps the symlinks in its src directory for the headers, but
+# leaves them out of SUBDIRS. Include this file after BRIDLES is set:
+#
+#   BRIDLES=eth motor common
+#   include $(EQUID_PATH)/Mk/bridles.mk
+#
+# and build and link with:
+#
+#   $(TARGET): check-env bridles all
+#   	$(CXX) -o ../bin/$@ $(OBJS) $(CXXFLAGS) $(BRIDLES_LDFLAGS) $(LDFLAGS)
+
+BRIDLES_VERSION=1.0
+BRIDLES_PATH=$(EQUID_PATH)/bridles
+BRIDLES_LIB=$(BRIDLES_PATH)/lib/$(TARGET_PLATFORM)
+
+# Flags for the bridles on top of CXXFLAGS, the hot paths of all jockeys are in there.
+# The Blackfin toolchain has no link time optimization, for the other targets it can
+# be enabled with BRIDLES_LTO=true, the jockey is then linked with -flto as well
+BRIDLES_OPTFLAGS=-O3
+BRIDLES_AR=$(AR)
+ifeq ($(TARGET_PLATFORM),BLACKFIN)
+BRIDLES_OPTFLAGS+=-mcpu=bf561
+else
+ifeq ($(BRIDLES_LTO),true)
+BRIDLES_OPTFLAGS+=-flto
+BRIDLES_AR=$(COMPILER_PREFIX)gcc-ar
+LDFLAGS+=-flto -O3
+endif
+endif
+
+# The group lets the linker resolve the references between the bridles in any order
+BRIDLES_LDFLAGS=-L$(BRIDLES_LIB) -Wl,--start-group $(addprefix -lequids-,$(BRIDLES)) -Wl,--end-group
+
+.PHONY: bridles
+bridles:
+	$(MAKE) -C $(BRIDLES_PATH) $(BRIDLES)
+
+# This file is included before the target of the jockey, which stays the default
+ifeq ($(.DEFAULT_GOAL),bridles)
+.DEFAULT_GOAL:=
+endif
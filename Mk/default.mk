@@ -57,6 +57,10 @@ TARGET=
 
 ifeq ($(TARGET_PLATFORM),HOST)
 #$(warning Compiling for host)
+CXXFLAGS=-std=c++0x
+CFLAGS=
+RUNTIME_PATH=$(RUNTIME_PATH_ROOT)/host/usr
+CROSS_COMPILER_INCLUDE_PATH=/usr/local/include
 endif
 
 ####################################################################################
@@ -92,6 +96,11 @@ STACKSIZE=0x40000
 CFLAGS += -Wl,--defsym,__stacksize=$(STACKSIZE)
 CXXFLAGS += -Wl,--defsym,__stacksize=$(STACKSIZE)
 
+# The Blackfin has no floating point unit. With FIXED_POINT_MATH the odometry of the
+# motor bridle and the undistortion of cameradetection use the Q16.16 functions of
+# fixmath.h in common, the fixbench jockey reports their errors and their speed
+#CXXDEFINE+=-DFIXED_POINT_MATH
+
 endif
 
 ####################################################################################
@@ -159,6 +168,14 @@ MIDDLEWARE_LIBS=-L$(IROBOT_PATH)/lib -lirobot
 # end of irobot middleware
 endif
 
+# On the host there is no middleware, bridles/host has a stand-in for the part of
+# IRobot that the bridles use, the robot only moves in a virtual world, see its IRobot.h.
+# It is built as the library of the bridle host, link with -lequids-host
+ifeq ($(TARGET_PLATFORM),HOST)
+MIDDLEWARE_INCLUDES=-I$(abspath $(SELF_DIR)/../bridles/host)
+MIDDLEWARE_LIBS=
+endif
+
 ifeq ($(ZIGBEE),true)
 $(info ZigBee enabled)
 $(info WAPI_PATH=$(WAPI_PATH) )
@@ -179,6 +196,8 @@ endif
 
 CONTROLLER_LIBS=
 CONTROLLER_LIBS+=-lpthread
+# shm_open for the shared memory transport of the eth bridle and the shared pose of the motor bridle
+CONTROLLER_LIBS+=-lrt
 #CONTROLLER_LIBS+=-lv4l2 -lv4lconvert
 #CONTROLLER_LIBS+=-ljpeg 
 
@@ -191,6 +210,38 @@ CONTROLLER_LIBS+=-lpthread
 ####################################################################################
 
 DEBUGFLAGS=-O3
+# Keep the symbols and the frame pointers on the host, for perf and flame graphs
+ifeq ($(TARGET_PLATFORM),HOST)
+DEBUGFLAGS=-O2 -g -fno-omit-frame-pointer
+endif
+
+# PROFILE selects the kind of build, give it on the command line for the bridles and
+# the jockeys alike, for example "make PROFILE=release". The bridle libraries do not
+# notice a change of flags, run "make clean" in bridles when switching profiles.
+#   (empty)  the flags above
+#   debug    no optimisation, symbols, the asserts and every CLOG level
+#   release  -O3, the asserts and the CLOG messages below LOG_NOTICE compiled out
+ifeq ($(PROFILE),debug)
+DEBUGFLAGS=-O0 -g
+endif
+ifeq ($(PROFILE),release)
+DEBUGFLAGS=-O3 -DNDEBUG -DCLOG_LEVEL=LOG_NOTICE
+endif
+
+# Profile guided optimisation of the hot files, the objects that the Makefile of a
+# directory lists in PGO_OBJS, on top of the profile, normally a release:
+#   PGO=generate  instrument them, a run writes the .gcda files next to the objects
+#   PGO=use       optimise them with those .gcda files
+# The run is a replay harness on recorded data, "make pgo" in the top directory does
+# all steps. Counters of threads race, -fprofile-correction smooths that over
+ifeq ($(PGO),generate)
+PGO_FLAGS=-fprofile-generate
+PGO_LDFLAGS=-fprofile-generate
+endif
+ifeq ($(PGO),use)
+PGO_FLAGS=-fprofile-use -fprofile-correction
+endif
+
 CFLAGS+=$(DEBUGFLAGS) -Wno-error=unused-function
 CXXFLAGS+=$(CFLAGS)
 ASMFLAGS=
@@ -210,7 +261,8 @@ CXXFLAGS+=$(CXXINCLUDES)
 LDFLAGS=$(MIDDLEWARE_LIBS) \
 	$(CONTROLLER_LIBS) \
 	-L$(RUNTIME_PATH)/lib \
-	-L$(RUNTIME_PATH)/local/lib 
+	-L$(RUNTIME_PATH)/local/lib \
+	$(PGO_LDFLAGS)
 
 ####################################################################################
 # The shorthands for compiler, linker, assembler, etc. Use these in your Makefiles
@@ -37,20 +37,13 @@ extern "C" {
 #include <libcam2.h>
 }
 
-#include <CCamera.h>
-
-#define ASSERT(condition) { \
-		if(!(condition)){ \
-			std::cerr << "ASSERT FAILED: " << #condition << " @ " << __FILE__ << " (" << __LINE__ << ")" << std::endl; \
-			assert(condition); \
-		} \
-}
+#include <yuvconvert.h>
 
-#define ASSERT_EQUAL(x,y) \
-		if (x != y) { \
-			std::cout << #x << " != " << #y ", specifically: " << x << " != " << y << std::endl; \
-			assert(x == y); \
-		}
+#include <CCamera.h>
+#include <CStageStats.h>
+#include <CLog.h>
+#include <CLatencyTrace.h>
+#include <CSched.h>
 
 
 //-----------------------------------------------------------------------------
@@ -96,29 +89,54 @@ extern "C" {
 /**
  * Create a default camera device.
  */
-CCamera::CCamera(): width(DEFAULT_IMAGE_WIDTH), height(DEFAULT_IMAGE_HEIGHT),
-		defaultImage(CRawImage(DEFAULT_IMAGE_WIDTH,DEFAULT_IMAGE_HEIGHT,3))
+CCamera::CCamera(): width(DEFAULT_IMAGE_WIDTH), height(DEFAULT_IMAGE_HEIGHT)
 {
 	log_prefix = "CCamera: "; // call setLogPrefix with a string with you controller embedded
 	gain = exposition = 0;
 	loadFileIndex = 0;
 	saveFileIndex = 0;
 	dummy_mode = 0;
+	replay = NULL;
+	replay_speed = 1;
 	videoIn = 0;
 	brightness = 0;
 	initialized = false;
 	save_images = false;
+	save_format = SF_RAW;
 	camdevfd = -1;
 	pixel_format = V4L2_PIX_FMT_YUYV;
 	log_level = LOG_EMERG;
-	semaphore_set = false;
+	log_module = clogModule("camera", log_level);
+	streaming = false;
+	borrowed_index = -1;
 	flip_camera = false;
-	ASSERT_EQUAL(defaultImage.getwidth(), width);
+	measure_brightness = false;
+	memset(&frame_brightness, 0, sizeof(frame_brightness));
     stopped = true;
+	grabbing = false;
+	ring = NULL;
+	ring_depth = 0;
+	ring_format = CF_RGB;
+	grab_format = CF_RGB;
+	reading_index = -1;
+	frame_sequence = 0;
+	dropped_frames = 0;
+	pthread_mutex_init(&ring_mutex, NULL);
+	pthread_cond_init(&ring_cond, NULL);
+	shared = NULL;
+	shared_frame = NULL;
+	shared_id = 0;
+	shared_timestamp = 0;
+	served = NULL;
+	serving = false;
 }
 
 CCamera::~CCamera() {
 	Stop();
+	delete shared;
+	delete replay;
+	pthread_cond_destroy(&ring_cond);
+	pthread_mutex_destroy(&ring_mutex);
 }
 
 /**
@@ -156,6 +174,12 @@ int CCamera::Init(int width, int height)
 		printf("%sCamera will not be flipped\n", log_prefix.c_str());
 	}
 
+	// use an environmental variable CAMERA_SHARED to take the frames from the camera server, the value is the segment
+	char *str_shared = getenv("CAMERA_SHARED");
+	if (str_shared) {
+		sharedInit(*str_shared == '/' ? str_shared : SHARED_FRAMES_NAME);
+	}
+
 	// we will need to capture a few images to get rid of the greenish pictures in the beginning
 	// we cannot do that anymore, because we are not allowed to open the device on Init
 //	printf("%s We capture 10 images to get rid of greenish pictures in the beginning\n", log_prefix.c_str());
@@ -165,11 +189,6 @@ int CCamera::Init(int width, int height)
 	return 0;
 }
 
-void CCamera::setSemaphore(sem_t *cap_sem) {
-	capture_sem = cap_sem;
-	semaphore_set = true;
-}
-
 /**
  * Initialize the folder to get the dummy images from. It should have a bunch of images starting with "0000.bmp" and
  * incrementing from there, "0001.bmp", etc.
@@ -192,6 +211,47 @@ int CCamera::dummyInit(const char *directoryName, const char *prefixImage) {
 	return 0;
 }
 
+/**
+ * Use the frames of a log that is recorded with CStreamLog, on the robot or in the visualiser, as camera. The frames
+ * come at the rate they were recorded, so the jockey sees the same timing as in the field, or faster with speed > 1.
+ *
+ * @param path               path of the log without the segment number, as given to CStreamLog::open
+ * @param speed              1 for the original rate, 0 for as fast as the consumer can take them
+ * @return                   success (0), failure (-1)
+ */
+int CCamera::replayInit(const char *path, float speed) {
+	fprintf(stderr,"%sCamera type: replay of %s at speed %.1f\n", log_prefix.c_str(), path, speed);
+	delete replay;
+	replay = new CStreamReplay();
+	replay_speed = speed;
+	if (!replay->open(path)) {
+		delete replay;
+		replay = NULL;
+		return -1;
+	}
+	dummy_mode = 2;
+	return 0;
+}
+
+/**
+ * Several jockeys can look at the same camera if one of them, normally the cameraserver jockey, owns the device and
+ * serves its frames with startServing. A camera that is shared attaches to the frames of the server in Start() instead
+ * of opening the device, and converts them to the format and the region of interest it wants itself. It can also
+ * borrow a frame, that is the frame in shared memory then, or grab frames in the background. Stop() only detaches, so
+ * the other jockeys keep getting frames. Set the environmental variable CAMERA_SHARED to use it without changing the
+ * jockey.
+ *
+ * @param name               segment of the camera server, see CSharedFrames
+ * @return                   success (0), failure (-1)
+ */
+int CCamera::sharedInit(const char *name) {
+	fprintf(stderr,"%sCamera type: shared frames of %s\n", log_prefix.c_str(), name);
+	if (shared == NULL) shared = new CSharedFrames();
+	strncpy(shared_name, name, sizeof(shared_name) - 1);
+	shared_name[sizeof(shared_name) - 1] = 0;
+	return 0;
+}
+
 /**
  * Closes the file descriptor to the camera.
  */
@@ -203,7 +263,31 @@ void CCamera::Stop() {
 		printf("%sStop camera \n", log_prefix.c_str());
 	}
 
+	stopGrabbing();
+	stopServing();
+
+	if (shared != NULL) {
+		if (shared_frame != NULL) {
+			fprintf(stderr, "%sFrame is still borrowed while stopping the camera\n", log_prefix.c_str());
+			shared->release(shared_frame);
+			shared_frame = NULL;
+			borrowed_index = -1;
+		}
+		shared->detach();
+		stopped = true;
+		return;
+	}
+
 	if (camdevfd >= 0) {
+		if (streaming) {
+			if (borrowed_index >= 0) {
+				fprintf(stderr, "%sFrame is still borrowed while stopping the camera\n", log_prefix.c_str());
+				borrowed_index = -1;
+			}
+			stop_capturing(camdevfd);
+			uninit_mmap();
+			streaming = false;
+		}
 		cam_closedev(camdevfd);
 	} else {
 		printf("%sCould not stop camera, no proper device handler \n", log_prefix.c_str());
@@ -228,6 +312,30 @@ int CCamera::Start(const char *deviceName, int &devfd) {
 		printf("%sStart camera \n", log_prefix.c_str());
 	}
 
+	// a dummy camera never reads from the device
+	if (dummy_mode) {
+		stopped = false;
+		return 0;
+	}
+
+	if (shared != NULL) {
+		if (!shared->attach(shared_name)) {
+			fprintf(stderr, "%sThere is no camera server with %s\n", log_prefix.c_str(), shared_name);
+			return -1;
+		}
+		if (shared->getwidth() != width || shared->getheight() != height) {
+			fprintf(stderr, "%sThe camera server has frames of %ix%i instead of %ix%i\n", log_prefix.c_str(),
+					shared->getwidth(), shared->getheight(), width, height);
+			width = shared->getwidth();
+			height = shared->getheight();
+		}
+		pixel_format = shared->getPixelFormat();
+		shared_id = 0;
+		stopped = false;
+		devfd = -1;
+		return 0;
+	}
+
 	if (log_level >= LOG_INFO)
 		printf("%sOpen device %s\n", log_prefix.c_str(), deviceName);
 	stopped = false;
@@ -241,6 +349,10 @@ int CCamera::Start(const char *deviceName, int &devfd) {
 		if (log_level >= LOG_INFO)
 			printf("%sDevice %s opened\n", log_prefix.c_str(), deviceName);
 	}
+	// the frame rate of a profile that is set before the start
+	if (profile.fps > 0 && !cam_reformat(camdevfd, width, height, profile.fps)) {
+		fprintf(stderr, "%sCannot set the format of the device\n", log_prefix.c_str());
+	}
 	devfd = camdevfd;
 	return 0;
 }
@@ -261,80 +373,852 @@ int CCamera::Start(const char *deviceName, int &devfd) {
  */
 int CCamera::renewImage(CRawImage* image, bool convert, bool swap)
 {
-	if (semaphore_set) {
-		std::cout << "Wait for semaphore (from e.g. streaming thread)" << std::endl;
-		sem_wait(capture_sem);
+	if (grabbing) {
+		// the grabber thread owns the device, just copy its next frame
+		CRawImage *frame = waitNextFrame();
+		if (frame == NULL) return -1;
+		memcpy(image->data, frame->data, image->getsize());
+		memcpy(image->histogram, frame->histogram, sizeof(image->histogram));
+		image->histogramSamples = frame->histogramSamples;
+		markFrame(image, frame->corruptRows);
+		image->captured = frame->captured;
+		if (swap) rgb_finish(image->data, width, height, YUV_SWAP_RB, NULL);
+		return 0;
 	}
 
 	if (dummy_mode) return dummyImage(image);
 
 	size_t yuv_size = width*height*2;
-	if (log_level >= LOG_INFO)
-		printf("Size of YUVY is %i\n", (int)yuv_size);
+	CLOG(log_module, LOG_INFO, "Size of YUVY is %i\n", (int)yuv_size);
 	assert (yuv_size > 0);
 	unsigned char* buffer = NULL;
+	int index = -1;
 
+	CStageTimer capture_timer(STAGE_CAPTURE);
 #ifdef OLD
-	buffer = cam_capture(camdevfd, width, height);
+	if (shared != NULL) {
+		buffer = dequeueFrame(index, true);
+		if (buffer == NULL) return -1;
+	} else if (streaming) {
+		buffer = cam_stream(camdevfd);
+	} else {
+		buffer = cam_capture(camdevfd, width, height);
+	}
 #else
 	buffer = cam_stream(camdevfd);
 #endif
+	capture_timer.stop();
+	image->captured = captureTime();
 
-	if (log_level >= LOG_INFO)
-		printf("%sGrabbed frame, now copy to buffer in CRawImage\n", log_prefix.c_str());
-
-	if (save_images) {
-		char fileName[256];
-		sprintf(fileName, "%s%04i.jpg", "image", ++saveFileIndex);
-		//		yuyv_to_uyvy((unsigned char*)b.start, width, height); // jpeg function does not read YUYV format properly
-		fprintf(stderr, "%sRemoved jpeg support. Seems overkill on a robot.\n", log_prefix.c_str());
-		//		save_jpeg_image((unsigned char*)b.start, height, width, fileName);
-		//		yuyv_to_uyvy((unsigned char*)b.start, width, height); // transform back
-	}
+	CLOG(log_module, LOG_INFO, "%sGrabbed frame, now copy to buffer in CRawImage\n", log_prefix.c_str());
 
+	markFrame(image, repairFrame(buffer));
 	if (convert) {
-		yuv422_to_rgb(image->data, (unsigned char*)buffer, yuv_size);
+		CStageTimer convert_timer(STAGE_CONVERT);
+		convertRgb(image->data, buffer, swap);
+		countHistogram(image, buffer);
 	} else {
 		fprintf(stderr, "%sJust realize that you copied the original YUV formatted data.\n", log_prefix.c_str());
 		memcpy(image->data,buffer,yuv_size);
 	}
 
-	if(swap){
-		image->swap(CC_RED, CC_BLUE);
-	}
+	if (save_images) saveFrame(buffer, convert ? image : NULL);
 
+	if (index >= 0) requeueFrame(index);
+	traceHop(image->captured, TRACE_GRABBED);
 	return 0; 
 }
 
 /**
- * Denoise image by capturing another one and averaging over the two. This is of course a very blunt way with coping
- * with noisy images. The most typical noise is a sudden "green" horizontal line. Getting rid of the images that have
- * such lines will be most useful.
+ * Get a frame without copying it. The image will refer to the memory mapped driver buffer, which contains the frame in
+ * YUYV format, so the image has 2 bytes per pixel and the luminance of pixel i is at image->data[i*2]. The driver will
+ * not write into the buffer until releaseImage is called, so the buffer can be processed (and even be written to) in
+ * the meantime. Only one frame can be borrowed at a time.
+ *
+ * The first call switches the device to streaming mode, which is kept until Stop(). Flipping the camera is not possible
+ * without a copy, use renewImage in that case.
  *
- * @param image              image to be returned
- * @return                   success (0), or failure (<0)
+ * @param image              the image that will wrap the driver buffer
+ * @return                   success (0), failure (<0)
  */
-int CCamera::denoiseImageByCapturingAnother(CRawImage* image)
+int CCamera::borrowImage(CRawImage* image)
 {
 	if (dummy_mode) return dummyImage(image);
 
-	size_t yuv_size = width*height*2;
-	if (log_level >= LOG_INFO)
-		printf("Size is %i\n", (int)yuv_size);
-	assert (yuv_size > 0);
+	if (flip_camera) {
+		fprintf(stderr, "%sCannot borrow a frame from a flipped camera, use renewImage\n", log_prefix.c_str());
+		return -1;
+	}
+
+	if (grabbing) {
+		fprintf(stderr, "%sCannot borrow a frame while the grabber thread is running\n", log_prefix.c_str());
+		return -1;
+	}
+
+	if (borrowed_index >= 0) {
+		fprintf(stderr, "%sRelease the previously borrowed frame first\n", log_prefix.c_str());
+		return -1;
+	}
+
+	startStreaming();
+
+	int index;
+	CStageTimer capture_timer(STAGE_CAPTURE);
+	unsigned char* buffer = dequeueFrame(index);
+	capture_timer.stop();
+	if (buffer == NULL) {
+		CStageStats::stats().countDropped();
+		return -1;
+	}
+
+	CLOG(log_module, LOG_INFO, "%sBorrowed frame %i from driver\n", log_prefix.c_str(), index);
+
+	borrowed_index = index;
+	image->wrap(buffer, width, height, 2);
+	image->captured = captureTime();
+	markFrame(image, (shared == NULL) ? repairFrame(buffer) : 0);
+	countHistogram(image, buffer);
+	// there is no converted frame here, only raw frames can be saved
+	if (save_images) saveFrame(buffer, NULL);
+	traceHop(image->captured, TRACE_GRABBED);
+	return 0;
+}
+
+/**
+ * Give a frame obtained with borrowImage back to the driver. The image uses its own memory again afterwards.
+ *
+ * @param image              the image that wraps the driver buffer
+ */
+void CCamera::releaseImage(CRawImage* image)
+{
+	if (dummy_mode) return;
+
+	image->unwrap();
+
+	if (borrowed_index < 0) return;
+
+	requeueFrame(borrowed_index);
+	borrowed_index = -1;
+}
+
+/**
+ * Fill an image with a new frame in the requested format. Asking for CF_GREY directly takes the luminance from the
+ * YUYV frame, which is much cheaper than converting to RGB and making the image monochrome afterwards. The image is
+ * reallocated only if its dimensions or its number of bytes per pixel do not fit the format.
+ *
+ * @param image              the image to be returned
+ * @param format             the pixel layout of the returned image
+ * @return                   success (0), failure (<0)
+ */
+int CCamera::renewImage(CRawImage* image, CaptureFormat format)
+{
+	format = binnedFormat(format);
+	if (grabbing) {
+		if (format != ring_format) {
+			fprintf(stderr, "%sThe grabber captures in another format\n", log_prefix.c_str());
+			return -1;
+		}
+		CRawImage *frame = waitNextFrame();
+		if (frame == NULL) return -1;
+		fitImage(image, format);
+		memcpy(image->data, frame->data, image->getsize());
+		memcpy(image->histogram, frame->histogram, sizeof(image->histogram));
+		image->histogramSamples = frame->histogramSamples;
+		markFrame(image, frame->corruptRows);
+		image->captured = frame->captured;
+		return 0;
+	}
+
+	if (dummy_mode) {
+		int result = dummyImage(image);
+		if (format == CF_GREY || format == CF_GREY_HALF) image->makeMonochrome();
+		return result;
+	}
+
 	unsigned char* buffer = NULL;
-	buffer = cam_capture(camdevfd, width, height);
+	int index = -1;
+	CStageTimer capture_timer(STAGE_CAPTURE);
+	if (shared != NULL) {
+		buffer = dequeueFrame(index, true);
+	} else if (streaming) {
+		buffer = cam_stream_borrow(camdevfd, &index);
+	} else {
+		buffer = cam_capture(camdevfd, width, height);
+	}
+	capture_timer.stop();
+	if (buffer == NULL) {
+		CStageStats::stats().countDropped();
+		return -1;
+	}
+	image->captured = captureTime();
+
+	fitImage(image, format);
+	if (!profile.roi.empty()) image->setRoi(profile.roi);
+	{
+		CStageTimer convert_timer(STAGE_CONVERT);
+		convertFrame(image, buffer, format);
+	}
 
+	if (save_images) saveFrame(buffer, image);
+
+	if (index >= 0) requeueFrame(index);
+	traceHop(image->captured, TRACE_GRABBED);
+	return 0;
+}
+
+/**
+ * Raw is meant for experiments at the full frame rate: the driver frame is saved as it is, before any conversion. The
+ * other formats save the converted image, which should be full resolution RGB or grey for the bitmap. Frames that are
+ * not there in the requested form are skipped, like the driver frame of a dummy camera. The frame is only copied here,
+ * the CImageWriter thread writes it, so a slow SD card does not hold up the capture. If the disk does not keep up,
+ * frames are dropped and the numbers of the files have gaps.
+ */
+void CCamera::saveFrame(const unsigned char* buffer, CRawImage* image)
+{
+	char fileName[256];
+	bool result = false;
+	switch (save_format) {
+	case SF_RAW:
+		if (buffer == NULL) return;
+		sprintf(fileName, "%s%04i.yuv", "image", ++saveFileIndex);
+		result = CImageWriter::writer().save(buffer, width, height, 2, SF_RAW, fileName);
+		break;
+	case SF_PNM:
+		if (image == NULL) return;
+		sprintf(fileName, "%s%04i.%s", "image", ++saveFileIndex, image->isMonochrome() ? "pgm" : "ppm");
+		result = CImageWriter::writer().save(image, SF_PNM, fileName);
+		break;
+	case SF_BMP:
+		if (image == NULL) return;
+		sprintf(fileName, "%s%04i.bmp", "image", ++saveFileIndex);
+		result = CImageWriter::writer().save(image, SF_BMP, fileName);
+		break;
+	}
+	CLOG(log_module, LOG_INFO, "%s%s frame %s\n", log_prefix.c_str(), result ? "Queued" : "Dropped", fileName);
+}
+
+void CCamera::fitImage(CRawImage* image, CaptureFormat format)
+{
+	int w = width, h = height, bpp;
+	switch (format) {
+	case CF_YUYV: bpp = 2; break;
+	case CF_GREY: bpp = 1; break;
+	case CF_RGB_HALF: w /= 2; h /= 2; bpp = 3; break;
+	case CF_GREY_HALF: w /= 2; h /= 2; bpp = 1; break;
+	case CF_RGB: default: bpp = 3; break;
+	}
+	if (image->getwidth() != w || image->getheight() != h || image->getbpp() != bpp) {
+		image->setdimensions(w, h);
+		image->setbpp(bpp);
+	}
+}
+
+/**
+ * Only the full resolution RGB conversion supports a flipped camera and other byte orders than YUYV. If the image has a
+ * region of interest, only the rows and columns of that region are converted for the full resolution formats, the
+ * pixels outside of it keep their old values. The region is widened to whole YUYV macro pixels, so it starts at an even
+ * column and has an even width.
+ */
+void CCamera::convertFrame(CRawImage* image, unsigned char* buffer, CaptureFormat format)
+{
+	// the frames of a camera server are repaired by the server
+	markFrame(image, (shared == NULL) ? repairFrame(buffer) : 0);
+	bool plain_yuyv = (pixel_format == V4L2_PIX_FMT_YUYV && !flip_camera);
+	bool full_res = (format == CF_YUYV || format == CF_GREY || format == CF_RGB);
+	if (image->hasRoi() && full_res && (plain_yuyv || format != CF_RGB)) {
+		ImageRoi roi = image->getRoi();
+		int x0 = roi.x & ~1;
+		int x1 = std::min((roi.x + roi.width + 1) & ~1, width);
+		image->setRoi(ImageRoi(x0, roi.y, x1 - x0, roi.height));
+		int bpp = image->getbpp();
+		for (int y = roi.y; y < roi.y + roi.height; ++y) {
+			int offset = y * width + x0;
+			unsigned char *in = buffer + offset * 2;
+			unsigned char *out = image->data + offset * bpp;
+			switch (format) {
+			case CF_YUYV: memcpy(out, in, (x1 - x0) * 2); break;
+			case CF_GREY: yuyv_to_grey(out, in, x1 - x0, 1); break;
+			default: yuyv_to_rgb(out, in, x1 - x0, 1); break;
+			}
+		}
+		countHistogram(image, buffer);
+		return;
+	}
+
+	image->clearRoi();
+	switch (format) {
+	case CF_YUYV:
+		memcpy(image->data, buffer, width*height*2);
+		break;
+	case CF_GREY:
+		yuyv_to_grey(image->data, buffer, width, height);
+		break;
+	case CF_RGB_HALF:
+		yuyv_to_rgb_half(image->data, buffer, width, height);
+		break;
+	case CF_GREY_HALF:
+		yuyv_to_grey_half(image->data, buffer, width, height);
+		break;
+	case CF_RGB: default:
+		convertRgb(image->data, buffer, false);
+		break;
+	}
+	countHistogram(image, buffer);
+}
+
+/**
+ * The driver sometimes hands out a frame of which some rows are not filled, they show up as green lines. A corrupt
+ * row, see yuyv_row_corrupt, is replaced by the row above it, or by the first good row for the rows at the top, in the
+ * driver frame itself, so every format and every consumer gets the repaired frame. That costs a sampled check of every
+ * row and a copy of only the corrupt rows, where averaging with a second frame doubled the capture and blurred the
+ * image. With more than CAMERA_REPAIR_ROWS corrupt rows the check stops, the frame is not worth repairing.
+ *
+ * @param buffer             the YUYV frame, it is changed in place
+ * @return                   the number of corrupt rows, more than CAMERA_REPAIR_ROWS if the frame is corrupt
+ */
+int CCamera::repairFrame(unsigned char* buffer)
+{
+	int offset;
+	if (pixel_format == V4L2_PIX_FMT_YUYV) offset = 1;
+	else if (pixel_format == V4L2_PIX_FMT_UYVY) offset = 0;
+	else return 0;
+	int stride = width * 2;
+	int count = 0, good = -1;
+	for (int y = 0; y < height; ++y) {
+		unsigned char *row = buffer + stride * y;
+		if (!yuyv_row_corrupt(row + offset, width, CAMERA_CHECK_STEP)) {
+			for (int top = 0; good < 0 && top < y; ++top) memcpy(buffer + stride * top, row, stride);
+			good = y;
+			continue;
+		}
+		if (++count > CAMERA_REPAIR_ROWS) break;
+		if (good >= 0) memcpy(row, buffer + stride * good, stride);
+	}
+	if (count > 0) {
+		CLOG(log_module, LOG_INFO, "%sFrame with %i corrupt rows\n", log_prefix.c_str(), count);
+	}
+	return count;
+}
+
+/**
+ * A frame from the driver is converted, turned upside down for a flipped camera, its red and blue channel are swapped,
+ * and its brightness is measured in a single pass, see yuyv_to_rgb_fused. Only the rare other byte orders than YUYV
+ * take a second pass for the swap and the brightness.
+ */
+void CCamera::convertRgb(unsigned char *rgb, unsigned char *buffer, bool swap)
+{
+	int flags = (flip_camera ? YUV_FLIP_VERTICAL | YUV_FLIP_HORIZONTAL : 0) | (swap ? YUV_SWAP_RB : 0);
+	yuv_brightness *measured = measure_brightness ? &frame_brightness : NULL;
+	if (pixel_format == V4L2_PIX_FMT_YUYV) {
+		yuyv_to_rgb_fused(rgb, buffer, width, height, flags, measured);
+		return;
+	}
+	yuv422_to_rgb(rgb, buffer, width*height*2);
+	if (swap || measured != NULL) rgb_finish(rgb, width, height, flags & YUV_SWAP_RB, measured);
+}
+
+/**
+ * The same measure as CRawImage::getOverallBrightness on the converted frame, without going over the frame again.
+ */
+double CCamera::getFrameBrightness(bool upperHalf)
+{
+	int half = upperHalf ? 0 : 1;
+	int num = frame_brightness.pixels[half];
+	if (num == 0) return 0;
+	int mean = (int)(frame_brightness.sum[half] / num / 3);
+	return mean + (frame_brightness.saturated[half] - frame_brightness.dark[half]) * 100.0 / num;
+}
+
+/**
+ * The histogram is a by-product of the conversion, it lets the detector propose a threshold from the frame itself
+ * instead of trying one threshold per frame. It is counted in the driver frame, so it does not depend on the format
+ * of the image. The region of interest of a flipped camera is not where it is in the driver frame, so there the whole
+ * frame is counted.
+ */
+void CCamera::countHistogram(CRawImage* image, const unsigned char* buffer)
+{
+	memset(image->histogram, 0, sizeof(image->histogram));
+	image->histogramSamples = 0;
+	// with an even step only the first luminance of every macro pixel is read
+	if (pixel_format == V4L2_PIX_FMT_UYVY) buffer++;
+	else if (pixel_format != V4L2_PIX_FMT_YUYV && pixel_format != V4L2_PIX_FMT_YYUV) return;
+	ImageRoi roi = image->getRoi();
+	if (image->getwidth() != width || flip_camera) roi = ImageRoi(0, 0, width, height);
+	const unsigned char *start = buffer + (roi.y * width + (roi.x & ~1)) * 2;
+	yuyv_histogram(image->histogram, start, roi.width, roi.height, width * 2, CAMERA_HISTOGRAM_STEP);
+	int step = CAMERA_HISTOGRAM_STEP;
+	image->histogramSamples = ((roi.width + step - 1) / step) * ((roi.height + step - 1) / step);
+}
+
+/**
+ * The driver buffers are memory mapped only once, the device keeps streaming until Stop().
+ */
+void CCamera::startStreaming()
+{
+	if (streaming || shared != NULL) return;
+	init_mmap(camdevfd, NULL);
+	start_capturing(camdevfd);
+	streaming = true;
+}
+
+static void *grabber_thread_main(void *camera) {
+	schedThread("camera");
+	((CCamera*)camera)->grabLoop();
+	return NULL;
+}
+
+/**
+ * Start capturing in the background. The grabber thread converts every frame from the driver to RGB into a ring of
+ * "depth" frames, so capturing the next frame overlaps with processing the current one. If the consumer is too slow,
+ * the oldest frame that is not being read is overwritten. The camera should have been started with Start(). Use
+ * getLatestFrame() or waitNextFrame() to obtain frames, renewImage and borrowImage cannot be used while grabbing.
+ *
+ * @param depth              number of frames in the ring, at least 3 so the grabber never has to wait for the reader
+ * @param format             pixel layout of the frames in the ring
+ * @return                   success (0), failure (<0)
+ */
+int CCamera::startGrabbing(int depth, CaptureFormat format)
+{
+	if (grabbing) return 0;
+	if (stopped && !dummy_mode) {
+		fprintf(stderr, "%sStart the camera before grabbing\n", log_prefix.c_str());
+		return -1;
+	}
+	if (depth < 3) depth = 3;
+
+	ring_depth = depth;
+	grab_format = format;
+	ring_format = binnedFormat(format);
+	ring = new CaptureFrame[ring_depth];
+	for (int i = 0; i < ring_depth; ++i) {
+		ring[i].image = new CRawImage(width, height, 3);
+		fitImage(ring[i].image, ring_format);
+		ring[i].sequence = 0;
+		ring[i].state = FS_FREE;
+	}
+	reading_index = -1;
+	frame_sequence = 0;
+	dropped_frames = 0;
+	capture_roi = profile.roi;
+
+	if (!dummy_mode) startStreaming();
+
+	grabbing = true;
+	if (pthread_create(&grabber_thread, NULL, &grabber_thread_main, (void*)this) != 0) {
+		fprintf(stderr, "%sCould not create grabber thread\n", log_prefix.c_str());
+		grabbing = false;
+		stopGrabbing();
+		return -1;
+	}
 	if (log_level >= LOG_INFO)
-		printf("%sGrabbed frame, now copy to buffer in CRawImage\n", log_prefix.c_str());
+		printf("%sGrabbing into a ring of %i frames\n", log_prefix.c_str(), ring_depth);
+	return 0;
+}
+
+/**
+ * Stop the grabber thread. Frames returned by getLatestFrame() or waitNextFrame() are invalid afterwards.
+ */
+void CCamera::stopGrabbing()
+{
+	if (grabbing) {
+		grabbing = false;
+		pthread_join(grabber_thread, NULL);
+		// wake up a consumer in waitNextFrame
+		pthread_mutex_lock(&ring_mutex);
+		pthread_cond_broadcast(&ring_cond);
+		pthread_mutex_unlock(&ring_mutex);
+	}
+	if (ring == NULL) return;
 
-	yuv422_to_rgb(defaultImage.data, (unsigned char*)buffer, yuv_size);
+	pthread_mutex_lock(&ring_mutex);
+	for (int i = 0; i < ring_depth; ++i) {
+		delete ring[i].image;
+	}
+	delete [] ring;
+	ring = NULL;
+	ring_depth = 0;
+	reading_index = -1;
+	pthread_mutex_unlock(&ring_mutex);
+}
 
-	image->average(defaultImage);
+/**
+ * The grabber thread picks a free frame, or else drops the oldest ready frame, and fills it with a frame from the
+ * driver. The driver buffer is borrowed during the conversion, so the driver cannot overwrite it halfway.
+ */
+void CCamera::grabLoop()
+{
+	while (grabbing) {
+		pthread_mutex_lock(&ring_mutex);
+		int target = -1;
+		for (int i = 0; i < ring_depth; ++i) {
+			if (ring[i].state == FS_FREE) {
+				target = i;
+				break;
+			}
+		}
+		if (target < 0) {
+			for (int i = 0; i < ring_depth; ++i) {
+				if (ring[i].state != FS_READY) continue;
+				if (target < 0 || ring[i].sequence < ring[target].sequence) target = i;
+			}
+			if (target >= 0) {
+				dropped_frames++;
+				CStageStats::stats().countDropped();
+			}
+		}
+		if (target >= 0) ring[target].state = FS_WRITING;
+		pthread_mutex_unlock(&ring_mutex);
+
+		if (target < 0) {
+			// cannot happen with a depth of at least 3, but do not spin
+			usleep(1000);
+			continue;
+		}
+
+		CRawImage *image = ring[target].image;
+		pthread_mutex_lock(&ring_mutex);
+		image->setRoi(capture_roi);
+		pthread_mutex_unlock(&ring_mutex);
+		bool success = true;
+		if (dummy_mode) {
+			dummyImage(image);
+			if (ring_format == CF_GREY || ring_format == CF_GREY_HALF) image->makeMonochrome();
+			// a replay waits for the time of the next frame itself
+			if (replay == NULL) usleep(33000);
+		} else {
+			int index;
+			CStageTimer capture_timer(STAGE_CAPTURE);
+			unsigned char *buffer = dequeueFrame(index);
+			capture_timer.stop();
+			if (buffer == NULL) {
+				success = false;
+				CStageStats::stats().countDropped();
+			} else {
+				image->captured = captureTime();
+				CStageTimer convert_timer(STAGE_CONVERT);
+				convertFrame(image, buffer, ring_format);
+				convert_timer.stop();
+				if (save_images) saveFrame(buffer, image);
+				requeueFrame(index);
+			}
+		}
+
+		pthread_mutex_lock(&ring_mutex);
+		if (success) {
+			ring[target].sequence = ++frame_sequence;
+			ring[target].state = FS_READY;
+			pthread_cond_broadcast(&ring_cond);
+		} else {
+			ring[target].state = FS_FREE;
+		}
+		pthread_mutex_unlock(&ring_mutex);
+	}
+}
+
+/**
+ * A frame of the camera server is the next one this camera did not see yet, and with fresh it is also one the server
+ * got from the driver after the call, as a frame captured by renewImage without streaming would be. The laser scan
+ * needs that, its laser has to be on or off during the whole exposure.
+ */
+unsigned char* CCamera::dequeueFrame(int &index, bool fresh)
+{
+	if (shared == NULL) return cam_stream_borrow(camdevfd, &index);
+	shared_frame = shared->acquire(shared_id, fresh ? CSharedFrames::now() : 0, CAMERA_SHARED_TIMEOUT, &shared_id,
+			&shared_timestamp);
+	index = (shared_frame != NULL) ? 0 : -1;
+	return (unsigned char*)shared_frame;
+}
+
+/**
+ * The frame of a camera server was handed out by the driver of the server, its timestamp in the monotonic clock of the
+ * segment is moved to the clock of CStageStats::now().
+ */
+long long CCamera::captureTime()
+{
+	long long now = CStageStats::now();
+	if (shared == NULL || shared_frame == NULL) return now;
+	uint64_t monotonic = CSharedFrames::now();
+	return (monotonic > shared_timestamp) ? now - (long long)(monotonic - shared_timestamp) : now;
+}
+
+void CCamera::requeueFrame(int index)
+{
+	if (shared != NULL) {
+		shared->release(shared_frame);
+		shared_frame = NULL;
+	} else if (cam_stream_release(camdevfd, index) < 0) {
+		fprintf(stderr, "%sCould not requeue frame %i\n", log_prefix.c_str(), index);
+	}
+}
+
+static void *server_thread_main(void *camera) {
+	schedThread("camera");
+	((CCamera*)camera)->serveLoop();
+	return NULL;
+}
+
+CaptureFormat CCamera::binnedFormat(CaptureFormat format)
+{
+	if (profile.binning < 2) return format;
+	switch (format) {
+	case CF_RGB: return CF_RGB_HALF;
+	case CF_GREY: return CF_GREY_HALF;
+	default: return format;
+	}
+}
+
+/**
+ * Switch to another resolution, frame rate, binning or region without closing the device. Binning and the region only
+ * change the conversion. A new resolution or frame rate stops the stream, gives the buffers back to the driver, sets the
+ * format and maps new buffers, which takes a few frames instead of the reopening of the device by Stop() and Start().
+ * The grabber and the server threads are paused meanwhile, the grabber gets a new ring. The resolution of a camera
+ * server is fixed by its segment and a consumer of a server cannot change the device at all, both can still bin and
+ * limit the region, and the server can change the frame rate for all its consumers.
+ *
+ * @param next               the profile to switch to
+ * @return                   success (0), failure (<0), on failure the profile is not changed
+ */
+int CCamera::setProfile(const CaptureProfile & next)
+{
+	int w = (next.width > 0) ? next.width : width;
+	int h = (next.height > 0) ? next.height : height;
+	bool resize = (w != width || h != height);
+	bool reformat = resize || (next.fps > 0 && next.fps != profile.fps);
+	if (next.binning != 1 && next.binning != 2) {
+		fprintf(stderr, "%sOnly binning by 1 or 2 is supported\n", log_prefix.c_str());
+		return -1;
+	}
+	if ((reformat && shared != NULL) || (resize && serving)) {
+		fprintf(stderr, "%sThe resolution of the frames of a camera server cannot change\n", log_prefix.c_str());
+		return -1;
+	}
+	if (reformat && borrowed_index >= 0) {
+		fprintf(stderr, "%sRelease the borrowed frame before switching the profile\n", log_prefix.c_str());
+		return -1;
+	}
+
+	bool was_grabbing = grabbing;
+	int depth = ring_depth;
+	CaptureFormat format = grab_format;
+	bool failed = false;
+	if (reformat && camdevfd >= 0 && !stopped) {
+		stopGrabbing();
+		bool was_serving = serving;
+		if (serving) {
+			serving = false;
+			pthread_join(server_thread, NULL);
+		}
+		bool was_streaming = streaming;
+		if (streaming) {
+			stop_capturing(camdevfd);
+			uninit_mmap();
+			streaming = false;
+		}
+		failed = !cam_reformat(camdevfd, w, h, next.fps);
+		if (failed) {
+			fprintf(stderr, "%sThe device does not support %ix%i, stay at %ix%i\n", log_prefix.c_str(), w, h, width,
+					height);
+			cam_reformat(camdevfd, width, height, profile.fps);
+		} else {
+			width = w;
+			height = h;
+		}
+		if (was_streaming) startStreaming();
+		if (was_serving) {
+			serving = true;
+			if (pthread_create(&server_thread, NULL, &server_thread_main, (void*)this) != 0) {
+				fprintf(stderr, "%sCould not restart the server thread\n", log_prefix.c_str());
+				serving = false;
+			}
+		}
+	} else if (reformat) {
+		// the device is opened with this resolution by Start()
+		width = w;
+		height = h;
+	}
+
+	if (!failed) profile = next;
+	if (reformat && was_grabbing && startGrabbing(depth, format) < 0) return -1;
+	if (failed) return -1;
+	if (grabbing) {
+		// a new binning needs another ring
+		if (binnedFormat(grab_format) != ring_format) {
+			stopGrabbing();
+			return startGrabbing(depth, format);
+		}
+		setCaptureRoi(profile.roi);
+	}
+	if (log_level >= LOG_INFO)
+		printf("%sProfile %ix%i, binning %i, %i fps\n", log_prefix.c_str(), width, height, profile.binning, profile.fps);
+	return 0;
+}
 
+/**
+ * Serve the frames of the device to the jockeys that use sharedInit, this camera owns the device from now on. A thread
+ * copies every driver frame as it is into a free slot of the segment, that is the only copy, and the driver buffer goes
+ * back to the driver right away. This camera can still renew, borrow or grab frames itself, it gets them from the
+ * driver as before, but then the server thread and this camera take turns on the frames of the driver. So a server that
+ * also processes frames had better read them from the segment as well.
+ *
+ * @param name               segment for the frames, see CSharedFrames
+ * @param slots              frames in the segment, at least 2 more than the consumers that hold a frame at once
+ * @return                   success (0), failure (<0)
+ */
+int CCamera::startServing(const char *name, int slots)
+{
+	if (serving) return 0;
+	if (stopped || dummy_mode || shared != NULL) {
+		fprintf(stderr, "%sStart the camera on the device before serving\n", log_prefix.c_str());
+		return -1;
+	}
+	served = new CSharedFrames();
+	if (!served->create(name, width, height, 2, pixel_format, slots)) {
+		delete served;
+		served = NULL;
+		return -1;
+	}
+	startStreaming();
+	serving = true;
+	if (pthread_create(&server_thread, NULL, &server_thread_main, (void*)this) != 0) {
+		fprintf(stderr, "%sCould not create server thread\n", log_prefix.c_str());
+		serving = false;
+		stopServing();
+		return -1;
+	}
+	if (log_level >= LOG_INFO)
+		printf("%sServing frames of %ix%i in %s\n", log_prefix.c_str(), width, height, name);
 	return 0;
 }
 
+void CCamera::stopServing()
+{
+	if (serving) {
+		serving = false;
+		pthread_join(server_thread, NULL);
+	}
+	delete served;
+	served = NULL;
+}
+
+/**
+ * The timestamp is taken as soon as the driver hands out the frame, so consumers can tell how old it is.
+ */
+void CCamera::serveLoop()
+{
+	size_t size = width * height * 2;
+	while (serving) {
+		int index;
+		CStageTimer capture_timer(STAGE_CAPTURE);
+		unsigned char *buffer = cam_stream_borrow(camdevfd, &index);
+		capture_timer.stop();
+		if (buffer == NULL) {
+			CStageStats::stats().countDropped();
+			continue;
+		}
+		uint64_t timestamp = CSharedFrames::now();
+		uint8_t *frame = served->back();
+		if (frame != NULL) {
+			memcpy(frame, buffer, size);
+			repairFrame(frame);
+			served->publish(timestamp);
+		} else {
+			CStageStats::stats().countDropped();
+		}
+		if (save_images) saveFrame(buffer, NULL);
+		cam_stream_release(camdevfd, index);
+	}
+}
+
+/**
+ * Set the region the grabber converts for the coming frames. A frame from the ring carries the region it is converted
+ * with as its own region of interest, see CRawImage::getRoi(), so a consumer knows which pixels are fresh. Use this for
+ * example to only convert the surroundings of an object that is being tracked, and call it with an empty region as soon
+ * as the object is lost.
+ *
+ * @param region             the region of interest in pixels of the full frame
+ * @param margin             number of pixels to add at all sides of the region
+ */
+void CCamera::setCaptureRoi(const ImageRoi & region, int margin)
+{
+	pthread_mutex_lock(&ring_mutex);
+	capture_roi = region.empty() ? ImageRoi() : region.grow(margin);
+	pthread_mutex_unlock(&ring_mutex);
+}
+
+CRawImage* CCamera::takeNewestFrame()
+{
+	int newest = -1;
+	for (int i = 0; i < ring_depth; ++i) {
+		if (ring[i].state != FS_READY) continue;
+		if (newest < 0 || ring[i].sequence > ring[newest].sequence) newest = i;
+	}
+	if (newest < 0) return NULL;
+	if (reading_index >= 0) {
+		if (ring[newest].sequence < ring[reading_index].sequence) return NULL;
+		ring[reading_index].state = FS_FREE;
+	}
+	// frames older than the newest one will never be returned, so they can be overwritten
+	for (int i = 0; i < ring_depth; ++i) {
+		if (i != newest && ring[i].state == FS_READY) {
+			ring[i].state = FS_FREE;
+			dropped_frames++;
+			CStageStats::stats().countDropped();
+		}
+	}
+	ring[newest].state = FS_READING;
+	reading_index = newest;
+	traceHop(ring[newest].image->captured, TRACE_GRABBED);
+	return ring[newest].image;
+}
+
+/**
+ * Get the most recent frame without waiting. If no new frame arrived since the last call, the same frame is returned
+ * again. The frame is not touched by the grabber until the next call to getLatestFrame() or waitNextFrame().
+ *
+ * @return                   the frame, or NULL if nothing has been captured yet
+ */
+CRawImage* CCamera::getLatestFrame()
+{
+	if (ring == NULL) return NULL;
+	pthread_mutex_lock(&ring_mutex);
+	CRawImage* result = takeNewestFrame();
+	if (result == NULL && reading_index >= 0) {
+		result = ring[reading_index].image;
+	}
+	pthread_mutex_unlock(&ring_mutex);
+	return result;
+}
+
+/**
+ * Wait for a frame that has not been returned before. The frame is not touched by the grabber until the next call to
+ * getLatestFrame() or waitNextFrame().
+ *
+ * @param timeout_ms         maximum time to wait in milliseconds
+ * @return                   the frame, or NULL on a timeout or if the grabber is stopped
+ */
+CRawImage* CCamera::waitNextFrame(int timeout_ms)
+{
+	if (ring == NULL) return NULL;
+
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock(&ring_mutex);
+	CRawImage* result = takeNewestFrame();
+	while (result == NULL && grabbing) {
+		if (pthread_cond_timedwait(&ring_cond, &ring_mutex, &deadline) != 0) break;
+		result = takeNewestFrame();
+	}
+	pthread_mutex_unlock(&ring_mutex);
+	return result;
+}
+
 /**
  * Not always is it useful to use the camera, for example when it is broken, or when you compile this code on the host.
  * In that case, you can use this function to return a dummy image from a directory with images which simulates the
@@ -345,6 +1229,12 @@ int CCamera::denoiseImageByCapturingAnother(CRawImage* image)
  */
 int CCamera::dummyImage(CRawImage* image)
 {
+	// the frames from files are not converted, so they come without a histogram, and are not checked
+	image->clearHistogram();
+	markFrame(image, 0);
+	image->captured = CStageStats::now();
+	if (replay != NULL) return replayImage(image);
+
 	char fileName[1000];
 	sprintf(fileName,"%s/%s%04i.bmp",directory,loadFilePrefix,loadFileIndex);
 	printf("%sTries to load file %s as a dummy image\n", log_prefix.c_str(), fileName);
@@ -360,6 +1250,36 @@ int CCamera::dummyImage(CRawImage* image)
 	return 0;
 }
 
+/**
+ * Grey frames are spread over the three channels, consumers that want grey call makeMonochrome afterwards, just as
+ * with the images of a directory.
+ *
+ * @param image              next frame of the log
+ * @return                   success (0), failure (<0)
+ */
+int CCamera::replayImage(CRawImage* image)
+{
+	ImageFrameHeader header;
+	const uint8_t *pixels;
+	if (!replay->nextFrame(header, pixels, replay_speed)) {
+		replay->rewind();
+		if (!replay->nextFrame(header, pixels, replay_speed)) return -1;
+	}
+	if (image->getwidth() != header.width || image->getheight() != header.height || image->getbpp() != 3) {
+		image->setdimensions(header.width, header.height);
+		image->setbpp(3);
+	}
+	int count = header.width * header.height;
+	if (header.bpp == 3) {
+		memcpy(image->data, pixels, count * 3);
+	} else {
+		for (int i = 0; i < count; i++) {
+			image->data[3*i] = image->data[3*i+1] = image->data[3*i+2] = pixels[i];
+		}
+	}
+	return 0;
+}
+
 /**
  * According to: v4l2-ctl --list-formats on the robot itself:
     ioctl: VIDIOC_ENUM_FMT
@@ -378,8 +1298,16 @@ int CCamera::dummyImage(CRawImage* image)
  */
 void CCamera::yuv422_to_rgb(unsigned char * output_ptr, unsigned char * input_ptr, size_t width_times_height)
 {
-	if (log_level >= LOG_INFO)
-		printf("%sConvert yuv to rgb\n", log_prefix.c_str());
+	CLOG(log_module, LOG_INFO, "%sConvert yuv to rgb\n", log_prefix.c_str());
+
+	if (pixel_format == V4L2_PIX_FMT_YUYV && !flip_camera) {
+		yuyv_to_rgb(output_ptr, input_ptr, width_times_height / 2, 1);
+		return;
+	}
+	if (pixel_format == V4L2_PIX_FMT_YUYV && (int)width_times_height == width * height * 2) {
+		yuyv_to_rgb_fused(output_ptr, input_ptr, width, height, YUV_FLIP_VERTICAL | YUV_FLIP_HORIZONTAL, NULL);
+		return;
+	}
 
 	unsigned int i, size;
 	unsigned char Y0, Y1, U, V;
@@ -437,8 +1365,8 @@ void CCamera::yuv422_to_rgb(unsigned char * output_ptr, unsigned char * input_pt
 	if (flip_camera) {
 		assert((output_pt - output_ptr) == -1);
 	} else {
-		if (log_level >= LOG_INFO)
-			printf("%sCompare %i with %i\n", log_prefix.c_str(), (int)(output_pt - output_ptr), (int)(height*width*3));
+		CLOG(log_module, LOG_INFO, "%sCompare %i with %i\n", log_prefix.c_str(), (int)(output_pt - output_ptr),
+				(int)(height*width*3));
 		assert((output_pt - output_ptr) == height*width*3);
 	}
 }
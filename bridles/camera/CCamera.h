@@ -19,11 +19,63 @@
 #define __CCAMERA_H__
 
 #include "CRawImage.h"
+#include "CStreamLog.h"
+#include "CImageWriter.h"
+#include "CLog.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
-#include <semaphore.h>
+#include <pthread.h>
+
+#include <CSharedFrames.h>
+#include <yuvconvert.h>
+
+//! Milliseconds a consumer of a camera server waits for a frame
+#define CAMERA_SHARED_TIMEOUT 2000
+
+//! Every so many macro pixels of every row are checked for corruption, see repairFrame
+#ifndef CAMERA_CHECK_STEP
+#define CAMERA_CHECK_STEP 8
+#endif
+
+//! Most corrupt rows a frame can have to be repaired, a frame with more is marked as corrupt
+#ifndef CAMERA_REPAIR_ROWS
+#define CAMERA_REPAIR_ROWS 16
+#endif
+
+//! Every so many pixels of every so many rows are counted in the histogram of a frame, has to be even
+#ifndef CAMERA_HISTOGRAM_STEP
+#define CAMERA_HISTOGRAM_STEP 4
+#endif
+
+//! Pixel layout the driver frame is converted to, the half formats have half the width and half the height
+enum CaptureFormat { CF_YUYV, CF_RGB, CF_GREY, CF_RGB_HALF, CF_GREY_HALF };
+
+/**
+ * What a consumer needs from the camera, see CCamera::setProfile. A width or height of 0 keeps the resolution and an
+ * fps of 0 keeps the frame rate of the device. Binning by 2 gives the images of the full resolution formats at half
+ * the width and half the height, the region limits the conversion to the pixels that are needed.
+ */
+struct CaptureProfile {
+	int width, height;
+	int binning;
+	ImageRoi roi;
+	int fps;
+	CaptureProfile(): width(0), height(0), binning(1), fps(0) {};
+	CaptureProfile(int width, int height, int binning = 1, int fps = 0, const ImageRoi & roi = ImageRoi()):
+		width(width), height(height), binning(binning), roi(roi), fps(fps) {};
+};
+
+//! State of a frame in the capture ring of the grabber thread
+enum FrameState { FS_FREE, FS_WRITING, FS_READY, FS_READING };
+
+//! A frame in the capture ring, the sequence number increases with every captured frame
+struct CaptureFrame {
+	CRawImage *image;
+	long sequence;
+	FrameState state;
+};
 
 class CCamera {
 public:
@@ -38,12 +90,18 @@ public:
 	//! If you want to initialize a real camera, use Start after this
 	int Init(int width, int height);
 
-	//! Set semaphore if you want to get only a new image if e.g. streaming is successful
-	void setSemaphore(sem_t *cap_sem);
-
 	//! If you want to load images from a directory use this "dummy" camera
 	int dummyInit(const char *directoryName, const char *prefixImage);
 
+	//! Play the frames of a CStreamLog instead, at speed times the recorded rate (0 for as fast as possible)
+	int replayInit(const char *path, float speed = 1);
+
+	//! Take the frames from the camera server with this segment instead of from the device, see startServing
+	int sharedInit(const char *name = SHARED_FRAMES_NAME);
+
+	//! The frames come from a camera server
+	inline bool isShared() { return shared != NULL; }
+
 	//! Stop the camera, closes the /dev video device so other code can use this camera
 	void Stop();
 
@@ -53,14 +111,63 @@ public:
 	//! Start the camera, (re)opens the /dev video device
 	int Start(const char *deviceName, int &devfd);
 
-	//! This gets you a new image, by default it will convert it to RGB values
+	//! This gets you a new image, by default it will convert it to RGB values, swap gives BGR in the same pass
 	int renewImage(CRawImage* image, bool convert , bool swap=false);
 
-	//! Denoise image by capturing another image and averaging over the two
-	int denoiseImageByCapturingAnother(CRawImage* image);
+	//! Get a new image in the given format, the image is resized if its dimensions or bpp do not fit the format, if
+	//! the image has a region of interest only that region is converted
+	int renewImage(CRawImage* image, CaptureFormat format);
+
+	//! Let image refer to the YUYV frame in the driver buffer without copying, always call releaseImage afterwards
+	int borrowImage(CRawImage* image);
+
+	//! Hand the frame that is borrowed by image back to the driver
+	void releaseImage(CRawImage* image);
+
+	//! Start a thread that captures frames into a ring of the given depth, the camera has to be started already
+	int startGrabbing(int depth = 3, CaptureFormat format = CF_RGB);
+
+	//! Switch to another profile while the camera keeps running, see CaptureProfile
+	int setProfile(const CaptureProfile & profile);
+
+	//! The profile in use, with the actual resolution
+	inline CaptureProfile getProfile() { CaptureProfile p = profile; p.width = width; p.height = height; return p; }
+
+	//! Stop the grabber thread and free the ring
+	void stopGrabbing();
+
+	//! Check if the grabber thread is running
+	inline bool isGrabbing() { return grabbing; }
+
+	//! Become the camera server: a thread puts every driver frame in shared memory, the camera has to be started
+	int startServing(const char *name = SHARED_FRAMES_NAME, int slots = SHARED_FRAMES_SLOTS);
+
+	//! Stop the server thread and remove the segment, the consumers get no frames anymore
+	void stopServing();
+
+	//! Body of the server thread, do not call it yourself
+	void serveLoop();
+
+	//! Frames the server could not put in shared memory because the consumers held all slots
+	inline uint32_t getServerDropped() { return served ? served->getDropped() : 0; }
+
+	//! The most recent frame in the ring, stays valid until the next call to getLatestFrame or waitNextFrame
+	CRawImage* getLatestFrame();
+
+	//! Block until a frame arrives that has not been returned before, returns NULL on a timeout
+	CRawImage* waitNextFrame(int timeout_ms = 2000);
+
+	//! Only convert this region, plus a margin, of the next frames of the grabber, an empty region converts everything
+	void setCaptureRoi(const ImageRoi & region, int margin = 0);
+
+	//! Number of frames that are overwritten by the grabber before anybody looked at them
+	inline long getDroppedFrames() { return dropped_frames; }
+
+	//! Body of the grabber thread, do not call it yourself
+	void grabLoop();
 
 	//! Set verbosity
-	inline void setVerbosity(char verbosity) { log_level = verbosity; }
+	inline void setVerbosity(char verbosity) { log_level = verbosity; clogSetLevel(log_module, verbosity); }
 
 	//! Set prefix for log messages
 	inline void setLogPrefix(std::string log_prefix) {
@@ -77,19 +184,30 @@ public:
 	int getBrightness();
 	int setDeviceAutoExposure(const bool val);
 
+	//! Measure the brightness of every frame while it is converted to RGB, for exposure control without another pass
+	inline void measureBrightness(bool enable) { measure_brightness = enable; }
+
+	//! The brightness of the last frame that was converted to RGB, see CRawImage::getOverallBrightness
+	double getFrameBrightness(bool upperHalf);
+
 	void yuv422_to_rgb(unsigned char *output_ptr, unsigned char *input_ptr, size_t width_times_height);
 
 	void yuyv_to_uyvy(unsigned char *data, size_t width, size_t height);
 
-	inline void saveImages(bool save) { save_images = save; };
+	//! Write every captured frame to image0001.yuv (.pgm/.ppm, .bmp), ... in the working directory, see CImageWriter
+	inline void saveImages(bool save, SaveFormat format = SF_RAW) { save_images = save; save_format = format; };
 
 protected:
 	//! This gets you a dummy image
 	int dummyImage(CRawImage* image);
 
+	//! The next frame of the log, the log starts over at its end
+	int replayImage(CRawImage* image);
+
 private:
 	char dummy_mode;
-	CRawImage defaultImage;
+	CStreamReplay *replay;
+	float replay_speed;
 	int exposition;
 	int brightness;
 	int gain;
@@ -100,20 +218,117 @@ private:
 	struct vdIn *videoIn;
 	int width, height;
 	bool save_images;
+	SaveFormat save_format;
 	int camdevfd;
 
 	int pixel_format;
 
 	bool flip_camera;
 
-	bool semaphore_set;
+	//! Whether convertRgb measures frame_brightness
+	bool measure_brightness;
+	yuv_brightness frame_brightness;
+
+	//! The driver buffers are memory mapped and the device is streaming, see borrowImage
+	bool streaming;
+
+	//! Index of the driver buffer that is borrowed, -1 if none
+	int borrowed_index;
 
 	//! Debug state
 	char log_level;
 
+	//! The CLog module of the messages per frame
+	int log_module;
+
 	std::string log_prefix;
 
-	sem_t *capture_sem;
+	//! Convert a driver frame into image, which should already have the right dimensions for the format
+	void convertFrame(CRawImage* image, unsigned char* buffer, CaptureFormat format);
+
+	//! Convert a whole driver frame to RGB in its final orientation and channel order, in one pass
+	void convertRgb(unsigned char *rgb, unsigned char *buffer, bool swap);
+
+	//! Replace the corrupt rows of a driver frame, returns their number
+	int repairFrame(unsigned char* buffer);
+
+	//! Tell the image how many rows of its frame were corrupt
+	inline void markFrame(CRawImage* image, int corrupt_rows) {
+		image->corruptRows = corrupt_rows;
+		image->corrupt = (corrupt_rows > CAMERA_REPAIR_ROWS);
+	}
+
+	//! Count the luminance of the driver frame in the histogram of image, only within its region of interest
+	void countHistogram(CRawImage* image, const unsigned char* buffer);
+
+	//! Queue the frame for saveImages(), buffer is the driver frame, image the converted frame, either can be NULL
+	void saveFrame(const unsigned char* buffer, CRawImage* image);
+
+	//! Make sure image has the dimensions and bpp of the given format
+	void fitImage(CRawImage* image, CaptureFormat format);
+
+	//! Memory map the driver buffers and start streaming, if not done yet
+	void startStreaming();
+
+	//! Take the newest ready frame from the ring if it is newer than the one being read, call with ring_mutex locked
+	CRawImage* takeNewestFrame();
+
+	//! A frame from the driver or the camera server, fresh for one taken after the call, NULL if there is none
+	unsigned char* dequeueFrame(int &index, bool fresh = false);
+
+	//! Give a frame of dequeueFrame back
+	void requeueFrame(int index);
+
+	//! Time at which the frame of the last dequeueFrame was handed out by the driver, as CStageStats::now()
+	long long captureTime();
+
+	//! The segment of the camera server this camera reads from, NULL for the device
+	CSharedFrames *shared;
+
+	//! The frame of the camera server that is dequeued, and the id of the last one
+	const uint8_t *shared_frame;
+	uint32_t shared_id;
+	//! Time at which the server got the dequeued frame from its driver, as CSharedFrames::now()
+	uint64_t shared_timestamp;
+	char shared_name[32];
+
+	//! The segment this camera serves its frames in, NULL if it does not, see startServing
+	CSharedFrames *served;
+
+	volatile bool serving;
+
+	pthread_t server_thread;
+
+	//! The grabber thread is (supposed to be) running
+	volatile bool grabbing;
+
+	pthread_t grabber_thread;
+
+	//! The ring of frames filled by the grabber thread, protected by ring_mutex
+	CaptureFrame *ring;
+	int ring_depth;
+	CaptureFormat ring_format;
+
+	//! Region (including margin) the grabber converts, empty for the whole frame, protected by ring_mutex
+	ImageRoi capture_roi;
+
+	//! Format the grabber is started with, before binning
+	CaptureFormat grab_format;
+
+	CaptureProfile profile;
+
+	//! The half resolution format for a full resolution format if the profile bins
+	CaptureFormat binnedFormat(CaptureFormat format);
+
+	//! Index of the frame that is handed out to the consumer, -1 if none
+	int reading_index;
+
+	//! Sequence number of the last captured frame
+	long frame_sequence;
+	long dropped_frames;
+
+	pthread_mutex_t ring_mutex;
+	pthread_cond_t ring_cond;
 };
 
 #endif
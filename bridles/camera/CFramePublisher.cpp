@@ -0,0 +1,181 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Hand frames from the detection loop to network threads without making either of them wait for the other
+ * @file CFramePublisher.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 14, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#include <CFramePublisher.h>
+
+#include <errno.h>
+#include <string.h>
+#include <sys/time.h>
+
+static uint64_t publishTime() {
+	struct timeval time;
+	gettimeofday(&time, NULL);
+	return (uint64_t)time.tv_sec * 1000000 + time.tv_usec;
+}
+
+CFramePublisher::CFramePublisher(int width, int height, int bpp): back_frame(0), latest_frame(-1), frame_id(0),
+		width(width), height(height), bpp(bpp), closed(false) {
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&published, NULL);
+	clearImageOverlay(overlay, 0);
+	for (int i = 0; i < 3; i++) {
+		Frame frame;
+		frame.image = new CRawImage(width, height, bpp);
+		frame.readers = 0;
+		frame.id = 0;
+		frame.timestamp = 0;
+		frames.push_back(frame);
+	}
+}
+
+/**
+ * The readers should be done by now, call close() and join the network threads first.
+ */
+CFramePublisher::~CFramePublisher() {
+	for (int i = 0; i < (int)frames.size(); i++) {
+		delete frames[i].image;
+	}
+	pthread_cond_destroy(&published);
+	pthread_mutex_destroy(&mutex);
+}
+
+CRawImage* CFramePublisher::back() {
+	pthread_mutex_lock(&mutex);
+	CRawImage *image = frames[back_frame].image;
+	pthread_mutex_unlock(&mutex);
+	return image;
+}
+
+/**
+ * Only called with the mutex held. The back frame is never read, so it counts as taken as well.
+ */
+int CFramePublisher::freeFrame() {
+	for (int i = 0; i < (int)frames.size(); i++) {
+		if (i != back_frame && i != latest_frame && frames[i].readers == 0) return i;
+	}
+	Frame frame;
+	frame.image = new CRawImage(width, height, bpp);
+	frame.readers = 0;
+	frame.id = 0;
+	frame.timestamp = 0;
+	frames.push_back(frame);
+	return frames.size() - 1;
+}
+
+void CFramePublisher::publish() {
+	pthread_mutex_lock(&mutex);
+	frames[back_frame].id = ++frame_id;
+	if (frame_id == 0) frames[back_frame].id = frame_id = 1; // 0 means "no frame yet"
+	frames[back_frame].timestamp = publishTime();
+	latest_frame = back_frame;
+	back_frame = freeFrame();
+	pthread_cond_broadcast(&published);
+	pthread_mutex_unlock(&mutex);
+}
+
+void CFramePublisher::publish(CRawImage *image) {
+	CRawImage *frame = back();
+	int size = image->getsize() < frame->getsize() ? image->getsize() : frame->getsize();
+	memcpy(frame->data, image->data, size);
+	publish();
+}
+
+CRawImage* CFramePublisher::acquire(uint32_t after, int timeout, uint32_t *id, uint64_t *timestamp) {
+	struct timespec end;
+	if (timeout > 0) {
+		uint64_t deadline = publishTime() + (uint64_t)timeout * 1000;
+		end.tv_sec = deadline / 1000000;
+		end.tv_nsec = (deadline % 1000000) * 1000;
+	}
+	pthread_mutex_lock(&mutex);
+	int ret = 0;
+	while (!closed && (latest_frame < 0 || frames[latest_frame].id == after) && timeout != 0 && ret != ETIMEDOUT) {
+		if (timeout < 0) {
+			pthread_cond_wait(&published, &mutex);
+		} else {
+			ret = pthread_cond_timedwait(&published, &mutex, &end);
+		}
+	}
+	CRawImage *image = NULL;
+	if (!closed && latest_frame >= 0 && frames[latest_frame].id != after) {
+		Frame & frame = frames[latest_frame];
+		frame.readers++;
+		image = frame.image;
+		if (id != NULL) *id = frame.id;
+		if (timestamp != NULL) *timestamp = frame.timestamp;
+	}
+	pthread_mutex_unlock(&mutex);
+	return image;
+}
+
+void CFramePublisher::release(CRawImage *image) {
+	if (image == NULL) return;
+	pthread_mutex_lock(&mutex);
+	for (int i = 0; i < (int)frames.size(); i++) {
+		if (frames[i].image == image) {
+			frames[i].readers--;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+void CFramePublisher::publishOverlay(const ImageOverlay & overlay) {
+	pthread_mutex_lock(&mutex);
+	this->overlay.frame_id = overlay.frame_id;
+	this->overlay.count = overlay.count;
+	memcpy(this->overlay.primitives, overlay.primitives, overlay.count * sizeof(ImageOverlayPrimitive));
+	pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * An overlay that is older than the frame before id is not sent any more, it belongs to a detection that stopped.
+ */
+bool CFramePublisher::getOverlay(uint32_t id, ImageOverlay & overlay) {
+	pthread_mutex_lock(&mutex);
+	bool recent = (this->overlay.frame_id != 0 && (this->overlay.frame_id == id || this->overlay.frame_id + 1 == id));
+	if (recent) {
+		overlay.frame_id = this->overlay.frame_id;
+		overlay.count = this->overlay.count;
+		memcpy(overlay.primitives, this->overlay.primitives, this->overlay.count * sizeof(ImageOverlayPrimitive));
+	}
+	pthread_mutex_unlock(&mutex);
+	return recent;
+}
+
+uint32_t CFramePublisher::latest() {
+	pthread_mutex_lock(&mutex);
+	uint32_t id = (latest_frame < 0) ? 0 : frames[latest_frame].id;
+	pthread_mutex_unlock(&mutex);
+	return id;
+}
+
+void CFramePublisher::close() {
+	pthread_mutex_lock(&mutex);
+	closed = true;
+	pthread_cond_broadcast(&published);
+	pthread_mutex_unlock(&mutex);
+}
@@ -0,0 +1,123 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Hand frames from the detection loop to network threads without making either of them wait for the other
+ * @file CFramePublisher.h
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 14, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#ifndef CFRAMEPUBLISHER_H_
+#define CFRAMEPUBLISHER_H_
+
+#include <CRawImage.h>
+#include <imageStream.h>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * A triple buffer: the producer writes into the back frame, publish() swaps it with the latest frame, and readers take
+ * the latest frame by reference with acquire() and give it back with release(). The mutex is only held to swap
+ * pointers and to count references, never while a frame is filled or sent, so a slow WiFi client does not throttle the
+ * control loop and the control loop does not make a client wait for more than a swap. With one reader three frames are
+ * enough. Every extra reader that holds a frame at the moment of a publish() makes the publisher allocate another one,
+ * so with N readers at most N+2 frames exist.
+ */
+class CFramePublisher {
+public:
+	//! Frames of width x height x bpp, the same as the images of the producer
+	CFramePublisher(int width, int height, int bpp);
+
+	~CFramePublisher();
+
+	//! The frame the producer fills, it is not seen by any reader until publish()
+	CRawImage* back();
+
+	//! Make the back frame the latest one, the producer gets a free frame as back frame
+	void publish();
+
+	//! Copy image into the back frame and publish it, for producers that do not fill the back frame themselves
+	void publish(CRawImage *image);
+
+	/**
+	 * The latest frame, if it is newer than frame after. Waits timeout ms for such a frame, forever for timeout < 0.
+	 * The frame stays untouched until release(). Returns NULL on a timeout or after close().
+	 */
+	CRawImage* acquire(uint32_t after = 0, int timeout = 0, uint32_t *id = NULL, uint64_t *timestamp = NULL);
+
+	//! Give a frame obtained with acquire() back
+	void release(CRawImage *frame);
+
+	/**
+	 * Attach what the producer found in frame overlay.frame_id to it. The detection of a frame ends after the frame is
+	 * published, so this replaces the overlay of an earlier frame, the readers send it along with the next frame.
+	 */
+	void publishOverlay(const ImageOverlay & overlay);
+
+	//! Copy the overlay of frame id, or of the frame before it, into overlay, false if there is none that recent
+	bool getOverlay(uint32_t id, ImageOverlay & overlay);
+
+	//! Number of the latest frame, 0 if nothing is published yet
+	uint32_t latest();
+
+	//! Width of the frames in pixels
+	inline int getwidth() { return width; }
+
+	//! Height of the frames in pixels
+	inline int getheight() { return height; }
+
+	//! Bytes per pixel of the frames
+	inline int getbpp() { return bpp; }
+
+	//! Wake up all readers that wait in acquire(), they return NULL from now on
+	void close();
+
+private:
+	struct Frame {
+		CRawImage *image;
+		int readers;
+		uint32_t id;
+		uint64_t timestamp;
+	};
+
+	//! Index of a frame that is neither the latest one nor read by anybody, a new one if there is none
+	int freeFrame();
+
+	pthread_mutex_t mutex;
+	pthread_cond_t published;
+
+	std::vector<Frame> frames;
+
+	int back_frame;
+	int latest_frame;
+
+	uint32_t frame_id;
+
+	//! The last overlay, under mutex as well, a copy is a few hundred bytes for the handful of detections of a frame
+	ImageOverlay overlay;
+
+	int width, height, bpp;
+
+	bool closed;
+};
+
+#endif /* CFRAMEPUBLISHER_H_ */
@@ -27,6 +27,7 @@
 #include <CImageManip.h>
 
 #include <cassert>
+#include <algorithm>
 
 /**
  * Set besides the color space also two little arrays to go back and forth from channel index to color.
@@ -77,17 +78,21 @@ bool CImageManip::greater_than(CRawImage &img1, CRawImage &img2, int pos, Color
  *                           green and blue channels.
  */
 bool CImageManip::isMoreRed(CRawImage &img1, CRawImage &img2, int pos, int threshold, int diff_threshold) {
+	return isMoreRed(&img1.data[pos], &img2.data[pos], threshold, diff_threshold);
+}
+
+bool CImageManip::isMoreRed(const VALUE_TYPE *p1, const VALUE_TYPE *p2, int threshold, int diff_threshold) {
 	int c_red, c_green, c_blue;
 	switch (colorSpace) {
 	case CS_RGB:
-		c_red   = (int)img1.data[pos+0]-(int)img2.data[pos+0];
-		c_green = (int)img1.data[pos+1]-(int)img2.data[pos+1];
-		c_blue  = (int)img1.data[pos+2]-(int)img2.data[pos+2];
+		c_red   = (int)p1[0]-(int)p2[0];
+		c_green = (int)p1[1]-(int)p2[1];
+		c_blue  = (int)p1[2]-(int)p2[2];
 		break;
 	case CS_BGR:
-		c_blue   = (int)img1.data[pos+0]-(int)img2.data[pos+0];
-		c_green = (int)img1.data[pos+1]-(int)img2.data[pos+1];
-		c_red  = (int)img1.data[pos+2]-(int)img2.data[pos+2];
+		c_blue   = (int)p1[0]-(int)p2[0];
+		c_green = (int)p1[1]-(int)p2[1];
+		c_red  = (int)p1[2]-(int)p2[2];
 		break;
 	default:
 		fprintf(stderr, "Unknown colorSpace, should be RGB or BGR\n");
@@ -121,64 +126,47 @@ bool CImageManip::isMoreRed(CRawImage &img1, CRawImage &img2, int pos, int thres
  * line.
  */
 void CImageManip::diff_red(CRawImage* laserImage, CRawImage* noLaserImage, CRawImage* diffImage) {
+	assert (laserImage->getwidth() > 0);
+	assert (laserImage->getwidth() == noLaserImage->getwidth());
+	assert (laserImage->getheight() == noLaserImage->getheight());
+	diff_red(laserImage->getView(), noLaserImage->getView(), diffImage->getView());
+}
+
+void CImageManip::diff_red(const CImageView &laserImage, const CImageView &noLaserImage, const CImageView &diffImage) {
 
 	int threshold = 20;
 	int diff_threshold = 20;
 
-	int w = laserImage->getwidth();
+	int w = laserImage.width;
 	assert (w > 0);
-	int h = laserImage->getheight();
-	assert (w == noLaserImage->getwidth());
-	assert (h == noLaserImage->getheight());
-
-	VALUE_TYPE* im_diff = diffImage->data;
+	int h = laserImage.height;
+	assert (w == noLaserImage.width);
+	assert (h == noLaserImage.height);
+	assert (laserImage.bpp == 3 && noLaserImage.bpp == 3 && diffImage.bpp == 3);
 
 	int margin_left = 150;
 	int margin_right = 220;
+	int left = std::min(margin_left-1, w);
+	int right = std::max(w - margin_right - 1, 0);
 
 	// x over width, y over height
 	for (int y = 0; y < h; y++) {
-		int x, pos;
-		for (x = 0; x < margin_left-1; x++) {
-			pos = 3*(y*w+x);
-			im_diff[pos+0] = 0;
-			im_diff[pos+1] = 0;
-			im_diff[pos+2] = 0;
-		}
-		x = margin_left-1;
-		pos = 3*(y*w+x);
-		im_diff[pos+0] = 200;
-		im_diff[pos+1] = 200;
-		im_diff[pos+2] = 200;
-
-		for (x = margin_left; x < laserImage->getwidth() - margin_right; x++) {
-			bool d;
-			pos = 3*(y*w+x);
-			d = isMoreRed(*laserImage, *noLaserImage, pos, threshold, diff_threshold);
-
-			if (d) {
-				im_diff[pos+0] = 200;
-				im_diff[pos+1] = 200;
-				im_diff[pos+2] = 200;
-			} else {
-				im_diff[pos+0] = 0;
-				im_diff[pos+1] = 0;
-				im_diff[pos+2] = 0;
-			}
-		}
-		x = laserImage->getwidth() - margin_right - 1;
-		pos = 3*(y*w+x);
-		im_diff[pos+0] = 200;
-		im_diff[pos+1] = 200;
-		im_diff[pos+2] = 200;
-
-		for (x = laserImage->getwidth() - margin_right; x < laserImage->getwidth(); x++) {
-			pos = 3*(y*w+x);
-			im_diff[pos+0] = 0;
-			im_diff[pos+1] = 0;
-			im_diff[pos+2] = 0;
+		const VALUE_TYPE *im_laser = laserImage.row(y);
+		const VALUE_TYPE *im_no_laser = noLaserImage.row(y);
+		VALUE_TYPE *im_diff = diffImage.row(y);
+
+		memset(im_diff, 0, 3*left);
+		if (w - margin_right > margin_left) {
+			int pos = 3*margin_left;
+			kernels->red_mask(&im_diff[pos], &im_laser[pos], &im_no_laser[pos], w - margin_right - margin_left,
+					channel_index[C_RED], threshold, diff_threshold);
 		}
-}
+		memset(im_diff + 3*(right+1), 0, 3*(w-right-1));
+
+		// the borders of the area that is searched
+		if (left < w) memset(im_diff + 3*left, 200, 3);
+		memset(im_diff + 3*right, 200, 3);
+	}
 }
 
 /**
@@ -186,26 +174,146 @@ void CImageManip::diff_red(CRawImage* laserImage, CRawImage* noLaserImage, CRawI
  */
 void CImageManip::diff_rgb(CRawImage* laserImage, CRawImage* noLaserImage, CRawImage* diffImage)
 {
-	int threshold = 20;
-	int diff_threshold = 20;
+	assert (laserImage->getwidth() > 0);
+	assert (laserImage->getwidth() == noLaserImage->getwidth());
+	assert (laserImage->getheight() == noLaserImage->getheight());
+	diff_rgb(laserImage->getView(), noLaserImage->getView(), diffImage->getView());
+}
 
-	int w = laserImage->getwidth();
+/**
+ * Every row is handed to the diff_abs kernel in one go.
+ */
+void CImageManip::diff_rgb(const CImageView &laserImage, const CImageView &noLaserImage, const CImageView &diffImage)
+{
+	int w = laserImage.width;
 	assert (w > 0);
-	int h = laserImage->getheight();
-	assert (w == noLaserImage->getwidth());
-	assert (h == noLaserImage->getheight());
+	int h = laserImage.height;
+	assert (w == noLaserImage.width);
+	assert (h == noLaserImage.height);
 
-	VALUE_TYPE* im_diff = diffImage->data;
-
-	// x over width, y over height
+	int row_size = w * laserImage.bpp;
 	for (int y = 0; y < h; y++) {
-		for (int x = 0; x < w; x++) {
-			int pos = 3*(y*w+x);
-			im_diff[pos+0] = abs(laserImage->data[pos+0] - noLaserImage->data[pos+0]);
-			im_diff[pos+1] = abs(laserImage->data[pos+1] - noLaserImage->data[pos+1]);
-			im_diff[pos+2] = abs(laserImage->data[pos+2] - noLaserImage->data[pos+2]);
+		const VALUE_TYPE *im_laser = laserImage.row(y);
+		const VALUE_TYPE *im_no_laser = noLaserImage.row(y);
+		VALUE_TYPE *im_diff = diffImage.row(y);
+		kernels->diff_abs(im_diff, im_laser, im_no_laser, row_size);
+	}
+}
+
+/**
+ * Fused version of diff_red followed by a search for the first non-zero pixel in every row. Only the pixels up to the
+ * first red one in a row are compared, and no difference image is written.
+ *
+ * @param laserImage         image with the laser turned on
+ * @param noLaserImage       image with the laser turned off
+ * @param margin_left        number of columns at the left that are not searched
+ * @param margin_right       number of columns at the right that are not searched
+ * @param threshold          see isMoreRed
+ * @param diff_threshold     see isMoreRed
+ * @param vec                for every row the column of the first red pixel, or 0 if there is none, cleared first
+ */
+void CImageManip::red_vector(const CImageView &laserImage, const CImageView &noLaserImage, int margin_left,
+		int margin_right, int threshold, int diff_threshold, std::vector<int> & vec) {
+	vec.assign(laserImage.height, 0);
+	if (vec.empty()) return;
+	red_rows(laserImage, noLaserImage, margin_left, margin_right, threshold, diff_threshold, &vec[0]);
+}
+
+void CImageManip::red_rows(const CImageView &laserImage, const CImageView &noLaserImage, int margin_left,
+		int margin_right, int threshold, int diff_threshold, int *out) {
+	assert (laserImage.width == noLaserImage.width);
+	assert (laserImage.height == noLaserImage.height);
+	assert (laserImage.bpp == 3 && noLaserImage.bpp == 3);
+
+	int pixels = laserImage.width - margin_right - margin_left;
+	for (int y = 0; y < laserImage.height; y++) {
+		int p = 0;
+		if (pixels > 0) {
+			int first = kernels->first_red(laserImage.at(margin_left, y), noLaserImage.at(margin_left, y), pixels,
+					channel_index[C_RED], threshold, diff_threshold);
+			if (first >= 0) p = margin_left + first;
+		}
+		out[y] = p;
+	}
+}
+
+/**
+ * The first red column of a row is the edge of the laser line, its position jumps a whole pixel at a time. The peak of
+ * the red difference within LASER_PEAK_WIDTH columns after that edge is located with sub-pixel precision by the centre
+ * of mass of the columns around it that are above half of the peak, weighted by how much they are above it. A line
+ * that saturates the sensor has a flat top, for which this is more stable than a parabola through three columns. Only
+ * the few pixels around the line are read, so it is cheap compared to red_rows.
+ *
+ * @param laserImage         image with the laser turned on
+ * @param noLaserImage       image with the laser turned off
+ * @param margin_right       number of columns at the right that are not searched
+ * @param columns            the first red column in every row, as written by red_rows
+ * @param out                for every row the column of the peak, or 0 if there is no laser in that row
+ */
+void CImageManip::red_peaks(const CImageView &laserImage, const CImageView &noLaserImage, int margin_right,
+		const int *columns, float *out) {
+	assert (laserImage.width == noLaserImage.width);
+	assert (laserImage.height == noLaserImage.height);
+	assert (laserImage.bpp == 3 && noLaserImage.bpp == 3);
+
+	int red = channel_index[C_RED];
+	int limit = laserImage.width - margin_right;
+	for (int y = 0; y < laserImage.height; y++) {
+		out[y] = 0;
+		int first = columns[y];
+		if (first <= 0 || first >= limit) continue;
+		const VALUE_TYPE *a = laserImage.row(y) + red;
+		const VALUE_TYPE *b = noLaserImage.row(y) + red;
+		int end = std::min(first + LASER_PEAK_WIDTH, limit);
+		int peak = first;
+		int best = (int)a[3 * first] - b[3 * first];
+		for (int x = first + 1; x < end; ++x) {
+			int d = (int)a[3 * x] - b[3 * x];
+			if (d > best) {
+				best = d;
+				peak = x;
+			}
+		}
+		int level = best / 2;
+		int left = peak, right = peak;
+		while (left > 0 && left > first - 2 && (int)a[3 * (left - 1)] - b[3 * (left - 1)] > level) left--;
+		while (right + 1 < end && (int)a[3 * (right + 1)] - b[3 * (right + 1)] > level) right++;
+		int sum = 0, moment = 0;
+		for (int x = left; x <= right; ++x) {
+			int w = (int)a[3 * x] - b[3 * x] - level;
+			sum += w;
+			moment += w * x;
+		}
+		out[y] = (sum > 0) ? (float)moment / sum : peak;
+	}
+}
+
+/**
+ * The green channel is used, because it is hardly affected by a red laser, so an image with the laser turned on can be
+ * compared with one with the laser turned off. Only every step-th pixel of every step-th row is compared.
+ *
+ * @param image1             first image
+ * @param image2             second image of the same size
+ * @param step               distance between the pixels that are compared, in both directions
+ * @return                   mean absolute difference, between 0 and 255
+ */
+int CImageManip::motion(const CImageView &image1, const CImageView &image2, int step) {
+	assert (image1.width == image2.width);
+	assert (image1.height == image2.height);
+	assert (image1.bpp == 3 && image2.bpp == 3);
+	assert (step > 0);
+	int green = channel_index[C_GREEN];
+	long sum = 0;
+	int count = 0;
+	for (int y = 0; y < image1.height; y += step) {
+		const VALUE_TYPE *p1 = image1.row(y);
+		const VALUE_TYPE *p2 = image2.row(y);
+		for (int x = 0; x < image1.width * 3; x += step * 3) {
+			sum += abs((int)p1[x+green] - (int)p2[x+green]);
+			count++;
 		}
 	}
+	return count ? (int)(sum / count) : 0;
 }
 
 bool CImageManip::CheckIntegrity(CRawImage *img) {
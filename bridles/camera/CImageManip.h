@@ -28,6 +28,14 @@
 #define CIMAGEMANIP_H_
 
 #include <CRawImage.h>
+#include <laserdiff.h>
+
+#include <vector>
+
+//! Number of columns after the first red one in which red_peaks looks for the peak of the laser line
+#ifndef LASER_PEAK_WIDTH
+#define LASER_PEAK_WIDTH 12
+#endif
 
 enum ColorSpace { CS_RGB, CS_BGR};
 
@@ -40,6 +48,7 @@ class CImageManip {
 public:
 	CImageManip(ColorSpace colorSpace) {
 		setColorSpace(colorSpace);
+		kernels = laser_kernels_get();
 	}
 
 	~CImageManip() {};
@@ -56,6 +65,28 @@ public:
 	void diff_red(CRawImage* laserImage, CRawImage* noLaserImage, CRawImage* diffImage);
 	void diff_rgb(CRawImage* laserImage, CRawImage* noLaserImage, CRawImage* diffImage);
 
+	//! Same as above, but on views, so they can also be used on parts of images
+	void diff_red(const CImageView &laserImage, const CImageView &noLaserImage, const CImageView &diffImage);
+	void diff_rgb(const CImageView &laserImage, const CImageView &noLaserImage, const CImageView &diffImage);
+
+	//! For every row the first column between the margins that is more red, in one pass and without difference image
+	void red_vector(const CImageView &laserImage, const CImageView &noLaserImage, int margin_left, int margin_right,
+			int threshold, int diff_threshold, std::vector<int> & vec);
+
+	//! Same as red_vector, but writes one value for every row of the views to out, so it can be used on bands of rows
+	void red_rows(const CImageView &laserImage, const CImageView &noLaserImage, int margin_left, int margin_right,
+			int threshold, int diff_threshold, int *out);
+
+	//! Sub-pixel column of the laser line in the rows that red_rows found, 0 for rows without laser
+	void red_peaks(const CImageView &laserImage, const CImageView &noLaserImage, int margin_right,
+			const int *columns, float *out);
+
+	//! Mean absolute difference of the green channel on a grid of every step-th pixel, a cheap measure for motion
+	int motion(const CImageView &image1, const CImageView &image2, int step = 8);
+
+	//! Name of the kernels that are used, depends on the instruction set of the processor
+	inline const char *getKernelName() { return kernels->name; }
+
 	/**
 	 * Check the integrity of an image. Can be detection of the different types of noise. In this case for difference
 	 * images it is important that the difference image contains actual data, so it should have a sufficient number of
@@ -64,12 +95,18 @@ public:
 	bool CheckIntegrity(CRawImage *img);
 
 private:
+	//! Compare two pixels, see isMoreRed
+	bool isMoreRed(const VALUE_TYPE *p1, const VALUE_TYPE *p2, int threshold, int diff_threshold);
+
 	ColorSpace colorSpace;
 
 	Color channel_color[3];
 
 	char channel_index[3];
 
+	//! The (vectorized) implementation of the difference kernels
+	const laser_kernels *kernels;
+
 };
 
 
@@ -0,0 +1,136 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Pool of pixel buffers, so images do not need to go to the heap every frame
+ * @file CImagePool.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 14, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#include <CImagePool.h>
+#include <CMemStats.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * The pool is constructed on first use, so it also exists for images that are constructed statically.
+ */
+CImagePool & CImagePool::pool() {
+	static CImagePool instance;
+	return instance;
+}
+
+CImagePool::CImagePool(): hits(0), misses(0), overflows(0), free_bytes(0) {
+	pthread_mutex_init(&mutex, NULL);
+	memory = memModule("image");
+}
+
+CImagePool::~CImagePool() {
+	clear();
+	pthread_mutex_destroy(&mutex);
+}
+
+/**
+ * Take a free buffer of exactly this size if there is one, or allocate a new one otherwise. Buffers can be released
+ * with free() as well, but then they are lost for the pool of course.
+ *
+ * @param size               size of the buffer in bytes
+ * @param zero               set all bytes to zero, not needed if the caller overwrites the buffer anyway
+ * @return                   the buffer, or NULL if there is no memory left
+ */
+unsigned char* CImagePool::acquire(int size, bool zero) {
+	if (size <= 0) return NULL;
+	unsigned char *buffer = NULL;
+	pthread_mutex_lock(&mutex);
+	std::map<int, std::vector<unsigned char*> >::iterator it = free_buffers.find(size);
+	if (it != free_buffers.end() && !it->second.empty()) {
+		buffer = it->second.back();
+		it->second.pop_back();
+		free_bytes -= size;
+		hits++;
+	} else {
+		misses++;
+	}
+	pthread_mutex_unlock(&mutex);
+
+	if (buffer == NULL) {
+		void *memory = NULL;
+		if (posix_memalign(&memory, POOL_ALIGNMENT, size) != 0) {
+			fprintf(stderr, "CImagePool: Cannot allocate buffer of %i bytes\n", size);
+			return NULL;
+		}
+		buffer = (unsigned char*)memory;
+		memAllocated(this->memory, size);
+	}
+	if (zero) memset(buffer, 0, size);
+	return buffer;
+}
+
+/**
+ * Keep the buffer for a next acquire() of the same size. At most POOL_MAX_FREE_PER_SIZE buffers are kept per size, so
+ * the pool does not hold on to the memory of a burst of temporary images.
+ *
+ * @param buffer             a buffer from acquire()
+ * @param size               the size it was acquired with
+ */
+void CImagePool::release(unsigned char *buffer, int size) {
+	if (buffer == NULL) return;
+	pthread_mutex_lock(&mutex);
+	std::vector<unsigned char*> & buffers = free_buffers[size];
+	if ((int)buffers.size() < POOL_MAX_FREE_PER_SIZE) {
+		buffers.push_back(buffer);
+		free_bytes += size;
+		buffer = NULL;
+	} else {
+		overflows++;
+	}
+	pthread_mutex_unlock(&mutex);
+	if (buffer != NULL) {
+		free(buffer);
+		memFreed(memory, size);
+	}
+}
+
+void CImagePool::clear() {
+	pthread_mutex_lock(&mutex);
+	std::map<int, std::vector<unsigned char*> >::iterator it;
+	for (it = free_buffers.begin(); it != free_buffers.end(); ++it) {
+		for (size_t i = 0; i < it->second.size(); ++i) {
+			free(it->second[i]);
+			memFreed(memory, it->first);
+		}
+	}
+	free_buffers.clear();
+	free_bytes = 0;
+	pthread_mutex_unlock(&mutex);
+}
+
+void CImagePool::printStatistics(FILE *out) {
+	pthread_mutex_lock(&mutex);
+	fprintf(out, "CImagePool: %li hits, %li misses, %li overflows, %li bytes free\n", hits, misses, overflows,
+			free_bytes);
+	std::map<int, std::vector<unsigned char*> >::iterator it;
+	for (it = free_buffers.begin(); it != free_buffers.end(); ++it) {
+		if (it->second.empty()) continue;
+		fprintf(out, "CImagePool:   %i free buffers of %i bytes\n", (int)it->second.size(), it->first);
+	}
+	pthread_mutex_unlock(&mutex);
+}
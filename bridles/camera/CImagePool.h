@@ -0,0 +1,96 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Pool of pixel buffers, so images do not need to go to the heap every frame
+ * @file CImagePool.h
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 14, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#ifndef CIMAGEPOOL_H_
+#define CIMAGEPOOL_H_
+
+#include <pthread.h>
+#include <stdio.h>
+#include <map>
+#include <vector>
+
+//! Alignment in bytes of every buffer handed out by the pool
+#define POOL_ALIGNMENT 32
+
+//! Number of free buffers of a single size that are kept, more are given back to the heap
+#define POOL_MAX_FREE_PER_SIZE 4
+
+/**
+ * The buffers are grouped by their size in bytes, so (width, height, bpp) classes with the same number of bytes share
+ * their buffers. On a robot that runs for hours there are only a few of these classes (full frames, half frames, grey
+ * frames, patches), so after startup every acquire() is a hit and the small heap does not fragment anymore. The pool
+ * is shared by all images in the process and is thread-safe, the camera grabber and the image server use it from
+ * their own threads.
+ */
+class CImagePool {
+public:
+	//! The pool that is used by CRawImage, Patch, and CImageServer
+	static CImagePool & pool();
+
+	//! Get a buffer of size bytes, aligned at POOL_ALIGNMENT, zeroed if requested, NULL if out of memory
+	unsigned char* acquire(int size, bool zero = true);
+
+	//! Give a buffer obtained with acquire(size) back, NULL is ignored
+	void release(unsigned char *buffer, int size);
+
+	//! Give all free buffers back to the heap
+	void clear();
+
+	//! The number of acquire() calls that could be served from the pool
+	inline long getHits() { return hits; }
+
+	//! The number of acquire() calls that had to allocate from the heap
+	inline long getMisses() { return misses; }
+
+	//! The number of release() calls that returned the buffer to the heap because the pool was full
+	inline long getOverflows() { return overflows; }
+
+	//! The number of bytes in free buffers kept by the pool
+	inline long getFreeBytes() { return free_bytes; }
+
+	//! Print hits, misses, and the free buffers per size
+	void printStatistics(FILE *out = stdout);
+
+private:
+	CImagePool();
+
+	~CImagePool();
+
+	pthread_mutex_t mutex;
+
+	//! Free buffers per size in bytes
+	std::map<int, std::vector<unsigned char*> > free_buffers;
+
+	//! The module of CMemStats that counts the buffers allocated from the heap, whether they are free or in use
+	int memory;
+
+	long hits;
+	long misses;
+	long overflows;
+	long free_bytes;
+};
+
+#endif /* CIMAGEPOOL_H_ */
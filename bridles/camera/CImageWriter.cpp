@@ -0,0 +1,209 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Write images to disk on a thread of their own
+ * @file CImageWriter.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 14, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#include <CImageWriter.h>
+#include <CImagePool.h>
+#include <CRawImage.h>
+#include <CStageStats.h>
+
+#include <string.h>
+
+/**
+ * Constructed on first use, after the pool, so the pool is still there when the destructor writes the last images.
+ */
+CImageWriter & CImageWriter::writer() {
+	static CImageWriter instance;
+	return instance;
+}
+
+CImageWriter::CImageWriter(): running(false), stopping(false), busy(false), depth(IMAGE_WRITER_QUEUE),
+		policy(WRITER_DROP_NEWEST), queued(0), written(0), dropped(0), failed(0), bytes(0), peak(0), slowest(0) {
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&work_cond, NULL);
+	pthread_cond_init(&room_cond, NULL);
+	frame = new CRawImage(1, 1, 3);
+}
+
+CImageWriter::~CImageWriter() {
+	pthread_mutex_lock(&mutex);
+	stopping = true;
+	pthread_cond_broadcast(&work_cond);
+	pthread_mutex_unlock(&mutex);
+	if (running) pthread_join(thread, NULL);
+	delete frame;
+	pthread_cond_destroy(&room_cond);
+	pthread_cond_destroy(&work_cond);
+	pthread_mutex_destroy(&mutex);
+}
+
+/**
+ * The copy is made before the mutex is taken, so the thread that writes is never held up by a memcpy. If the image is
+ * dropped the copy was for nothing, but that only happens when the disk is slow anyway.
+ *
+ * @param pixels             the image data, with the rows directly after each other
+ * @param width              width in pixels
+ * @param height             height in pixels
+ * @param bpp                bytes per pixel, 1 or 3 for the PGM/PPM and bitmap formats
+ * @param format             the file format
+ * @param name               the name of the file
+ * @return                   queued (true), or dropped (false)
+ */
+bool CImageWriter::save(const unsigned char *pixels, int width, int height, int bpp, SaveFormat format,
+		const char *name) {
+	int size = width*height*bpp;
+	if (pixels == NULL || size <= 0) return false;
+
+	pthread_mutex_lock(&mutex);
+	if (!running && !stopping) {
+		running = (pthread_create(&thread, NULL, &CImageWriter::run, this) == 0);
+		if (!running) fprintf(stderr, "CImageWriter: Could not start the writer thread\n");
+	}
+	bool full = !running || (policy == WRITER_DROP_NEWEST && (int)queue.size() >= depth);
+	if (full) dropped++;
+	pthread_mutex_unlock(&mutex);
+	if (full) return false;
+
+	Job job;
+	job.data = CImagePool::pool().acquire(size, false);
+	if (job.data == NULL) return false;
+	memcpy(job.data, pixels, size);
+	job.width = width;
+	job.height = height;
+	job.bpp = bpp;
+	job.format = format;
+	job.name = name;
+
+	pthread_mutex_lock(&mutex);
+	if (policy == WRITER_BLOCK) {
+		while ((int)queue.size() >= depth && !stopping) pthread_cond_wait(&room_cond, &mutex);
+	}
+	unsigned char *drop = NULL;
+	int drop_size = 0;
+	if ((int)queue.size() >= depth) {
+		if (policy == WRITER_DROP_OLDEST) {
+			Job &oldest = queue.front();
+			drop = oldest.data;
+			drop_size = oldest.width*oldest.height*oldest.bpp;
+			queue.pop_front();
+		} else {
+			// the queue filled up while the pixels were copied
+			drop = job.data;
+			drop_size = size;
+		}
+		dropped++;
+	}
+	if (drop != job.data) {
+		queue.push_back(job);
+		queued++;
+		if ((int)queue.size() > peak) peak = queue.size();
+		pthread_cond_signal(&work_cond);
+	}
+	pthread_mutex_unlock(&mutex);
+	CImagePool::pool().release(drop, drop_size);
+	return (drop != job.data);
+}
+
+//! Only the region of interest is up to date, but the whole image is saved, like saveBmp() does
+bool CImageWriter::save(CRawImage *image, SaveFormat format, const char *name) {
+	if (image == NULL) return false;
+	return save(image->data, image->getwidth(), image->getheight(), image->getbpp(), format, name);
+}
+
+void CImageWriter::setQueue(int depth, WriterPolicy policy) {
+	pthread_mutex_lock(&mutex);
+	this->depth = (depth > 0) ? depth : 1;
+	this->policy = policy;
+	pthread_cond_broadcast(&room_cond);
+	pthread_mutex_unlock(&mutex);
+}
+
+void CImageWriter::flush() {
+	pthread_mutex_lock(&mutex);
+	while (running && (!queue.empty() || busy)) pthread_cond_wait(&room_cond, &mutex);
+	pthread_mutex_unlock(&mutex);
+}
+
+void* CImageWriter::run(void *writer) {
+	((CImageWriter*)writer)->writeLoop();
+	return NULL;
+}
+
+/**
+ * On stopping the queue is written first, so the last images of a run end up on disk as well.
+ */
+void CImageWriter::writeLoop() {
+	pthread_mutex_lock(&mutex);
+	while (true) {
+		while (queue.empty() && !stopping) pthread_cond_wait(&work_cond, &mutex);
+		if (queue.empty()) break;
+		Job job = queue.front();
+		queue.pop_front();
+		busy = true;
+		pthread_cond_broadcast(&room_cond);
+		pthread_mutex_unlock(&mutex);
+
+		long long start = CStageStats::now();
+		bool result = write(job);
+		long duration = (long)(CStageStats::now() - start);
+		int size = job.width*job.height*job.bpp;
+		CImagePool::pool().release(job.data, size);
+
+		pthread_mutex_lock(&mutex);
+		busy = false;
+		if (result) {
+			written++;
+			bytes += size;
+		} else {
+			failed++;
+		}
+		if (duration > slowest) slowest = duration;
+		pthread_cond_broadcast(&room_cond);
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * The pooled buffer is wrapped in an image, so the files are the same as when the image is saved directly.
+ */
+bool CImageWriter::write(Job &job) {
+	frame->wrap(job.data, job.width, job.height, job.bpp);
+	bool result = false;
+	switch (job.format) {
+	case SF_RAW: result = frame->saveRaw(job.name.c_str()); break;
+	case SF_PNM: result = frame->savePnm(job.name.c_str()); break;
+	case SF_BMP: result = frame->saveBmp(job.name.c_str()); break;
+	}
+	frame->unwrap();
+	return result;
+}
+
+void CImageWriter::printStatistics(FILE *out) {
+	pthread_mutex_lock(&mutex);
+	fprintf(out, "CImageWriter: %li queued, %li written, %li dropped, %li failed, %lli bytes\n", queued, written,
+			dropped, failed, bytes);
+	fprintf(out, "CImageWriter: at most %i images in the queue, slowest write %li us\n", peak, slowest);
+	pthread_mutex_unlock(&mutex);
+}
@@ -0,0 +1,134 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Write images to disk on a thread of their own
+ * @file CImageWriter.h
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 14, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#ifndef CIMAGEWRITER_H_
+#define CIMAGEWRITER_H_
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string>
+#include <deque>
+
+class CRawImage;
+
+//! How an image is written: the pixels as they are (YUYV for a driver frame), as PGM/PPM, or as bitmap
+enum SaveFormat { SF_RAW, SF_PNM, SF_BMP };
+
+//! What save() does with an image when the queue is full
+enum WriterPolicy {
+	WRITER_DROP_NEWEST,  //!< drop the image that is offered, the images in the queue are written
+	WRITER_DROP_OLDEST,  //!< drop the image that waits longest, so the files on disk are the most recent ones
+	WRITER_BLOCK         //!< wait until there is room, for tools that need every image and have no deadline
+};
+
+//! Number of images that can wait for the disk
+#define IMAGE_WRITER_QUEUE 8
+
+/**
+ * The control loop of a robot cannot wait for an SD card that takes a few hundred milliseconds for a write now and
+ * then. save() copies the pixels into a buffer of the CImagePool and puts it in a bounded queue, a thread writes the
+ * queue to disk. When the disk does not keep up the queue fills up and images are dropped, by default the newest, so
+ * the cost for the caller is a memcpy at most. The thread is started by the first save(), the destructor writes what
+ * is left in the queue.
+ */
+class CImageWriter {
+public:
+	//! The writer of this process
+	static CImageWriter & writer();
+
+	//! Queue the pixels of an image of the given dimensions, returns false if it is dropped
+	bool save(const unsigned char *pixels, int width, int height, int bpp, SaveFormat format, const char *name);
+
+	//! Queue a copy of the image, returns false if it is dropped
+	bool save(CRawImage *image, SaveFormat format, const char *name);
+
+	//! Set the maximum number of images in the queue and what to do when it is full
+	void setQueue(int depth, WriterPolicy policy = WRITER_DROP_NEWEST);
+
+	//! Wait until every queued image is written
+	void flush();
+
+	//! Images that were queued
+	inline long getQueued() { return queued; }
+
+	//! Images that went to disk
+	inline long getWritten() { return written; }
+
+	//! Images that were dropped because the queue was full
+	inline long getDropped() { return dropped; }
+
+	//! Images that could not be written
+	inline long getFailed() { return failed; }
+
+	//! Print the counters, the bytes written, the longest queue, and the slowest write
+	void printStatistics(FILE *out = stdout);
+
+private:
+	CImageWriter();
+
+	~CImageWriter();
+
+	struct Job {
+		unsigned char *data;
+		int width, height, bpp;
+		SaveFormat format;
+		std::string name;
+	};
+
+	static void* run(void *writer);
+
+	void writeLoop();
+
+	//! Write a single job to disk, without holding the mutex
+	bool write(Job &job);
+
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t room_cond;
+
+	pthread_t thread;
+	bool running;
+	bool stopping;
+	//! The thread is writing a job that is not in the queue anymore
+	bool busy;
+
+	std::deque<Job> queue;
+	int depth;
+	WriterPolicy policy;
+
+	//! Lets the pooled buffer of a job be saved with the functions of CRawImage, only used by the thread
+	CRawImage *frame;
+
+	long queued;
+	long written;
+	long dropped;
+	long failed;
+	long long bytes;
+	int peak;
+	long slowest;
+};
+
+#endif /* CIMAGEWRITER_H_ */
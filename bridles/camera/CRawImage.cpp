@@ -1,6 +1,8 @@
 #include "CRawImage.h"
+#include "CImageWriter.h"
 #include <cassert>
 #include <iostream>
+#include <algorithm>
 
 #define RGB_HEADER_SIZE      54
 #define PALETTE_SIZE         (256*4)
@@ -60,20 +62,37 @@ CRawImage::CRawImage(int wi, int he, int bpp): width(wi), height(he), bpp(bpp)
 {
 	ASSERT(width > 0);
 	size = bpp*width*height;
-	data = (VALUE_TYPE*)calloc(size,sizeof(VALUE_TYPE));
+	alloc_size = size;
+	data = CImagePool::pool().acquire(alloc_size);
 	updateHeader();
 	// default brush is red
 	brush.r = 255;
 	brush.g = 0;
 	brush.b = 0;
 	do_swap = false;
+	wrapped = false;
+	own_data = NULL;
+	histogramSamples = 0;
+	corruptRows = 0;
+	corrupt = false;
+	captured = 0;
 }
 
 CRawImage::CRawImage(const CRawImage & other): width(other.width), height(other.height),
 		size(other.size), bpp(other.bpp) {
-	data = (VALUE_TYPE*)calloc(size,sizeof(VALUE_TYPE));
+	alloc_size = size;
+	data = CImagePool::pool().acquire(alloc_size, false);
 	memcpy (data, other.data, other.size);
 	updateHeader();
+	do_swap = other.do_swap;
+	roi = other.roi;
+	wrapped = false;
+	own_data = NULL;
+	memcpy(histogram, other.histogram, sizeof(histogram));
+	histogramSamples = other.histogramSamples;
+	corruptRows = other.corruptRows;
+	corrupt = other.corrupt;
+	captured = other.captured;
 }
 
 //! Average two images, write result to this image
@@ -193,9 +212,8 @@ void CRawImage::setPatch(int p_x, int p_y, Patch &patch) {
 }
 
 /**
- * Get patch of size "patch.width * patch.length". This is more "bewerkelijk" than seems at first sight because the
- * array is stored in a linear fashion, to get a "square" of data out of it, you will need to jump all over the place.
- * That's why we now just check every individual element.
+ * Get patch of size "patch.width * patch.length". The array is stored in a linear fashion, so a "square" of data is
+ * copied row by row from a view on that part of the image. The patch is only allocated if it has no data yet.
  *
  * @param x                  index of patch in x-direction
  * @param y                  index of patch in y-direction
@@ -205,25 +223,29 @@ void CRawImage::setPatch(int p_x, int p_y, Patch &patch) {
  * @return                   side-effect, adjust patch by reference, and also allocate data in it!
  */
 void CRawImage::getPatch(int x, int y, Patch & patch) {
-	std::cout << "Get patch at " << x << ',' << y << std::endl;
 	assert (bpp == 3);
 	assert (x >= 0 && x < width);
 	assert (y >= 0 && y < height);
 	if (patch.data == NULL)
 		patch.init(patch.width, patch.height);
 
-	for (int i = 0; i < patch.width; ++i) {
-		for (int j = 0; j < patch.height; ++j) {
-			int base = ((y+j)*width+x+i)*3;
-			Pixel pixel;
-			pixel.b = data[base+0];
-			pixel.r = data[base+1];
-			pixel.g = data[base+2];
-			setPixel(i,j, patch, pixel);
-		}
+	CImageView src = getView(x, y, patch.width, patch.height);
+	CImageView dest = patch.view();
+	for (int j = 0; j < patch.height; ++j) {
+		memcpy(dest.row(j), src.row(j), patch.width*bpp);
 	}
 }
 
+/**
+ * A view on part of the image. The rectangle has to be inside of the image, nothing is copied, so the view becomes
+ * invalid if the image is reallocated.
+ */
+CImageView CRawImage::getView(int x, int y, int width, int height) {
+	ASSERT(x >= 0 && x + width <= this->width);
+	ASSERT(y >= 0 && y + height <= this->height);
+	return getView().sub(x, y, width, height);
+}
+
 CRawImage* CRawImage::patch2Img(Patch &patch) {
 	CRawImage *img = new CRawImage(patch.width, patch.height, 3);
 	memcpy(img->data, patch.data, patch.width*patch.height*3);
@@ -232,17 +254,74 @@ CRawImage* CRawImage::patch2Img(Patch &patch) {
 
 /**
  * Free internal data structures and reallocate new ones. This is only necessary if you change resolution, or the number
- * of bits per pixels for example. Else, just use clear().
+ * of bits per pixels for example. Else, just use clear(). The buffers come from and go back to the CImagePool, so
+ * switching back and forth between the same formats does not touch the heap.
  */
 void CRawImage::refresh() {
 	ASSERT(width > 0);
+	ASSERT(!wrapped);
 	size = bpp*width*height;
-	if (data != NULL) free(data);
-	data = (VALUE_TYPE*)calloc(size,sizeof(VALUE_TYPE));
+	roi = ImageRoi();
+	CImagePool::pool().release(data, alloc_size);
+	alloc_size = size;
+	data = CImagePool::pool().acquire(alloc_size);
 	std::cout << "Set size to " << width << '*' << height << '*' << bpp << std::endl;
 	updateHeader();
 }
 
+/**
+ * Refer to a buffer that is owned by someone else, for example a frame that is memory mapped from the v4l2 driver. The
+ * memory allocated by this image is kept aside and is used again after unwrap(). The caller is responsible for keeping
+ * the buffer valid until unwrap() is called. The bpp of a foreign buffer can be 2 for a YUYV frame. Functions that
+ * reallocate, like setbpp() and setdimensions(), are not allowed on a wrapped image.
+ */
+void CRawImage::wrap(VALUE_TYPE *buffer, int width, int height, int bpp) {
+	ASSERT(buffer != NULL);
+	ASSERT(width > 0);
+	if (!wrapped) {
+		own_data = data;
+		own_width = this->width;
+		own_height = this->height;
+		own_bpp = this->bpp;
+	}
+	wrapped = true;
+	data = buffer;
+	this->width = width;
+	this->height = height;
+	this->bpp = bpp;
+	size = bpp*width*height;
+	roi = ImageRoi();
+}
+
+/**
+ * Use the memory that is owned by the image again after a call to wrap(). Does nothing if no buffer is wrapped.
+ */
+void CRawImage::unwrap() {
+	if (!wrapped) return;
+	wrapped = false;
+	data = own_data;
+	width = own_width;
+	height = own_height;
+	bpp = own_bpp;
+	size = bpp*width*height;
+	roi = ImageRoi();
+	own_data = NULL;
+}
+
+/**
+ * Mark only a part of the image as valid. The region is clipped to the image. Whoever fills the image, like
+ * CCamera::renewImage, only has to update the region, and whoever reads from it, like a detector, only has to look
+ * within it (see getRoi() and getRoiData()). Reallocation, wrap() and unwrap() clear the region.
+ */
+void CRawImage::setRoi(const ImageRoi & region) {
+	int x0 = std::max(region.x, 0);
+	int y0 = std::max(region.y, 0);
+	int x1 = std::min(region.x + region.width, width);
+	int y1 = std::min(region.y + region.height, height);
+	roi = ImageRoi(x0, y0, x1 - x0, y1 - y0);
+	if (roi.empty()) roi = ImageRoi();
+}
+
 /**
  * Clear the data in the image. Set it to 0.
  */
@@ -258,85 +337,110 @@ void CRawImage::clear() {
 void CRawImage::compress(Patch &patch) {
 	assert (patch.width == width / 2); // for now only accept an image that is 4-times smaller
 	assert (patch.height == height / 2);
+	compress(patch.view(bpp));
+}
 
-	for (int x = 0; x < width; x+=2) {
-		for (int y = 0; y < height; y+=2) {
-
+/**
+ * Subsample (or average if AVERAGE is defined) every 2x2 block of pixels into a single pixel of the resulting view,
+ * which may be part of a larger image.
+ */
+void CRawImage::compress(const CImageView &result) {
 #ifdef AVERAGE
-			Pixel sum; // initialised as zeros
-			Pixel p[4];
-			p[0] = getPixel(x,y) / 4;
-			p[1] = getPixel(x+1,y) / 4;
-			p[2] = getPixel(x,y+1) / 4;
-			p[3] = getPixel(x+1,y+1) / 4;
-
-			for (int i = 0; i < 4; ++i) {
-				sum = sum + p[i];
-			}
-			setPixel(x/2,y/2,patch,sum);
+	compress(result, true);
 #else
-			// just subsample
-			setPixel(x/2,y/2,patch,getPixel(x,y));
+	compress(result, false);
 #endif
-		}
-	}
 }
 
 /**
- * Update the standard BMP header, see above for the exact format. It will not contain any color palette, compression
- * information, or other sophisticated information. It just has information about size, width, height, bits per pixel,
- * and other basic info.
+ * The average is rounded to the nearest value. For a grey image the inner loop runs over consecutive bytes, which the
+ * compiler can vectorize. For a YUYV frame the luminance is averaged correctly, the chrominance of the two pixels is
+ * mixed, which is fine for whoever only needs the brightness.
  */
-void CRawImage::updateHeader() {
-	ASSERT(width > 0);
-	int s;
-	if (bpp == 3)
-		s = height*width*bpp+RGB_HEADER_SIZE;
-	else
-		s = height*width*bpp+GRAY_HEADER_SIZE;
-
-	header[2] = (VALUE_TYPE)s;
-	header[3] = (VALUE_TYPE)(s >> 8);
-	header[4] = (VALUE_TYPE)(s >> 16);
-
-	if (bpp == 3) {
-		header[10] = (VALUE_TYPE)RGB_HEADER_SIZE;
-		header[11] = (VALUE_TYPE)(RGB_HEADER_SIZE >> 8);
-	} else {
-		// we make it plus 4*256 values for color pallete in grayscale case
-		header[10] = (VALUE_TYPE)GRAY_HEADER_SIZE;
-		header[11] = (VALUE_TYPE)(GRAY_HEADER_SIZE >> 8);
+void CRawImage::compress(const CImageView &result, bool average) {
+	assert (result.width == width / 2);
+	assert (result.height == height / 2);
+	assert (result.bpp == bpp);
+
+	CImageView src = getView();
+	for (int y = 0; y < result.height; ++y) {
+		const VALUE_TYPE *in0 = src.row(2*y);
+		const VALUE_TYPE *in1 = src.row(2*y+1);
+		VALUE_TYPE *out = result.row(y);
+		if (!average) {
+			// just subsample
+			for (int x = 0; x < result.width*bpp; x += bpp) {
+				for (int c = 0; c < bpp; ++c) {
+					out[x+c] = in0[2*x+c];
+				}
+			}
+		} else if (bpp == 1) {
+			for (int x = 0; x < result.width; ++x) {
+				out[x] = (in0[2*x] + in0[2*x+1] + in1[2*x] + in1[2*x+1] + 2) >> 2;
+			}
+		} else {
+			for (int x = 0; x < result.width*bpp; x += bpp) {
+				for (int c = 0; c < bpp; ++c) {
+					out[x+c] = (in0[2*x+c] + in0[2*x+bpp+c] + in1[2*x+c] + in1[2*x+bpp+c] + 2) >> 2;
+				}
+			}
+		}
 	}
+}
 
-	header[18] = width%256;
-	header[19] = width/256;
-	//		header[18] = 255;
-	//		header[19] = 255;
+/**
+ * Fill in the standard BMP header, see above for the exact format, in result, which has room for RGB_HEADER_SIZE bytes.
+ * It will not contain any color palette, compression information, or other sophisticated information. It just has
+ * information about size, width, height, bits per pixel, and other basic info. The rows of a BMP file are padded to a
+ * multiple of 4 bytes, which the sizes take into account.
+ */
+static void fillHeader(VALUE_TYPE *result, int width, int height, int bpp) {
+	memcpy(result, header, RGB_HEADER_SIZE);
+	int offset = (bpp == 3) ? RGB_HEADER_SIZE : GRAY_HEADER_SIZE;
+	int s = ((width*bpp + 3) & ~3) * height;
+
+	result[2] = (VALUE_TYPE)(s + offset);
+	result[3] = (VALUE_TYPE)((s + offset) >> 8);
+	result[4] = (VALUE_TYPE)((s + offset) >> 16);
+	result[5] = (VALUE_TYPE)((s + offset) >> 24);
+
+	// we make it plus 4*256 values for color pallete in grayscale case
+	result[10] = (VALUE_TYPE)offset;
+	result[11] = (VALUE_TYPE)(offset >> 8);
+
+	result[18] = width%256;
+	result[19] = width/256;
 	// image height 22,23, 24, 25
-	header[22] = height%256;
-	header[23] = height/256;
+	result[22] = height%256;
+	result[23] = height/256;
 	// planes, 26,27
 	// bits (not bytes) per pixel 28,29
-	header[28] = (bpp*8)%256;
-	header[29] = (bpp*8)/256;
+	result[28] = (bpp*8)%256;
+	result[29] = (bpp*8)/256;
 	// compression 30,31,32,33
 	//  size of the raw data, 34,35,36,37
-	s = height*width*bpp;
-	header[34] = s%256;
-	header[35] = s >> 8;
-	header[36] = s >> 16;
+	result[34] = s%256;
+	result[35] = s >> 8;
+	result[36] = s >> 16;
 	// horizontal resolution
 	if (bpp == 1) {
-		//		header[38] = 18;
-		//		header[42] = 18;
 		for (int i = 44; i < RGB_HEADER_SIZE; ++i) {
-			header[i] = 0;
+			result[i] = 0;
 		}
-		header[47] = 1;
-		header[51] = 1;
+		result[47] = 1;
+		result[51] = 1;
 	}
 }
 
+/**
+ * Update the header that is kept with the images, saveBmp() does not need it anymore, it makes its own for the
+ * dimensions the image has at that moment.
+ */
+void CRawImage::updateHeader() {
+	ASSERT(width > 0);
+	fillHeader(header, width, height, bpp);
+}
+
 int CRawImage::getSaveNumber()
 {
 	char name[100];
@@ -353,9 +457,8 @@ int CRawImage::getSaveNumber()
 CRawImage::~CRawImage()
 {
 	printf("CRawImage: Deallocate image of size %i\n", size);
-	if (data != NULL) {
-		free(data);
-	}
+	unwrap();
+	CImagePool::pool().release(data, alloc_size);
 	data = NULL;
 }
 
@@ -366,14 +469,15 @@ void CRawImage::makeMonochrome() {
 	//	printf("%s(): Size is %i\n", __func__, size);
 	swap(CC_RED, CC_BLUE);
 
-	VALUE_TYPE* newData = (VALUE_TYPE*)calloc(width*height,sizeof(VALUE_TYPE));
+	int newSize = width*height;
+	VALUE_TYPE* newData = CImagePool::pool().acquire(newSize, false);
 	for (int i = 0; i < width*height; ++i) {
 		int temp = data[i*3]*30 + data[i*3+1]*59 + data[i*3+2]*11;
 		newData[i] = temp / (100);
 	}
 	setbpp(1);
 	memcpy(data,newData,size);
-	if (newData != NULL) free(newData);
+	CImagePool::pool().release(newData, newSize);
 }
 
 void CRawImage::makeMonochrome(CRawImage *result) {
@@ -414,7 +518,7 @@ void CRawImage::swap(const ColorChannel channel1, const ColorChannel channel2)
 
 	if (data == NULL) return;
 	printf("%s(): performing a computationally expensive swap\n", __func__);
-	VALUE_TYPE* newData = (VALUE_TYPE*)calloc(size,sizeof(VALUE_TYPE));
+	VALUE_TYPE* newData = CImagePool::pool().acquire(size, false);
 	int span = width*bpp;
 	for (int j = 0;j<height;j++){
 		memcpy(&newData[span*j],&data[span*(height-1-j)],span);
@@ -425,7 +529,7 @@ void CRawImage::swap(const ColorChannel channel1, const ColorChannel channel2)
 		}
 	}
 	memcpy(data,newData,size);
-	if (newData != NULL) free(newData);
+	CImagePool::pool().release(newData, size);
 }
 
 //! Flip vertically or horizontally
@@ -434,13 +538,13 @@ void CRawImage::flip(const Orientation orientation) {
 
 	switch (orientation) {
 	case O_VERTICAL: {
-		VALUE_TYPE* newData = (VALUE_TYPE*)calloc(size,sizeof(VALUE_TYPE));
+		VALUE_TYPE* newData = CImagePool::pool().acquire(size, false);
 		int span = width*bpp;
 		for (int j = 0; j < height; j++){
 			memcpy(&newData[span*j],&data[span*(height-1-j)],span);
 		}
 		memcpy(data,newData,size);
-		if (newData != NULL) free(newData);
+		CImagePool::pool().release(newData, size);
 		break;
 	} case O_HORIZONTAL: {
 		for (int j = 0; j < height; j++) {
@@ -454,27 +558,103 @@ void CRawImage::flip(const Orientation orientation) {
 }
 
 
-void CRawImage::saveBmp(const char* inName)
+/**
+ * The file is assembled in one buffer and written in one go. A BMP file starts with the bottom row and has the blue
+ * channel first, so every row is taken from the other end of the image and has its red and blue channel exchanged on
+ * the way, the image itself is not touched. Only images with 1 or 3 bytes per pixel can be saved as bitmap.
+ */
+bool CRawImage::saveBmp(const char* inName)
 {
 	ASSERT(size > 0);
-//	updateHeader();
-	FILE* file = fopen(inName, "wb");
-	swap(CC_RED, CC_BLUE);
-	fwrite(header,54,1,file);
+	if (bpp != 1 && bpp != 3) {
+		fprintf(stderr, "Cannot save an image with %i bytes per pixel as bitmap %s\n", bpp, inName);
+		return false;
+	}
+	int span = width*bpp;
+	int row = (span + 3) & ~3;
+	int offset = (bpp == 3) ? RGB_HEADER_SIZE : GRAY_HEADER_SIZE;
+	int file_size = offset + row*height;
+	VALUE_TYPE *buffer = CImagePool::pool().acquire(file_size, false);
+
+	fillHeader(buffer, width, height, bpp);
 	if (bpp == 1) {
-		VALUE_TYPE *temp_palette = (VALUE_TYPE*)calloc(PALETTE_SIZE, sizeof(VALUE_TYPE));
 		// you'll need a color palette for grayscale images.
+		VALUE_TYPE *palette = buffer + RGB_HEADER_SIZE;
 		for (int i = 0; i < PALETTE_SIZE / 4; ++i) {
-			temp_palette[i*4] = temp_palette[i*4+1] = temp_palette[i*4+2] = i;
-			temp_palette[i*4+3] = 0;
+			palette[i*4] = palette[i*4+1] = palette[i*4+2] = i;
+			palette[i*4+3] = 0;
 		}
-		fwrite(temp_palette, PALETTE_SIZE, 1, file);
-		if (temp_palette != NULL) free(temp_palette);
 	}
-	fwrite(data,size,1,file);
-	swap(CC_RED, CC_BLUE);
+	for (int j = 0; j < height; ++j) {
+		const VALUE_TYPE *src = &data[span*(height-1-j)];
+		VALUE_TYPE *dst = &buffer[offset + row*j];
+		if (bpp == 3) {
+			for (int i = 0; i < span; i += 3) {
+				dst[i] = src[i+2];
+				dst[i+1] = src[i+1];
+				dst[i+2] = src[i];
+			}
+		} else {
+			memcpy(dst, src, span);
+		}
+		for (int i = span; i < row; ++i) dst[i] = 0;
+	}
+
+	bool result = false;
+	FILE* file = fopen(inName, "wb");
+	if (file == NULL) {
+		fprintf(stderr, "Could not open bitmap file %s for writing\n", inName);
+	} else {
+		result = (fwrite(buffer, file_size, 1, file) == 1);
+		if (!result) fprintf(stderr, "Could not write %i bytes to %s\n", file_size, inName);
+		fclose(file);
+		std::cout << __func__ << ": saved \"" << inName << "\"" << std::endl;
+	}
+	CImagePool::pool().release(buffer, file_size);
+	return result;
+}
+
+/**
+ * Nothing but the pixels, row after row as they are in memory, so a frame costs one write and nothing else. The reader
+ * has to know width, height and bpp, so the file name is a good place to put them. A wrapped YUYV frame is dumped as
+ * YUYV.
+ */
+bool CRawImage::saveRaw(const char* name)
+{
+	ASSERT(size > 0);
+	FILE* file = fopen(name, "wb");
+	if (file == NULL) {
+		fprintf(stderr, "Could not open raw file %s for writing\n", name);
+		return false;
+	}
+	bool result = (fwrite(data, size, 1, file) == 1);
+	if (!result) fprintf(stderr, "Could not write %i bytes to %s\n", size, name);
+	fclose(file);
+	return result;
+}
+
+/**
+ * A grey image is written as binary PGM (P5), a color image as binary PPM (P6). These formats store the rows top down
+ * and the channels as RGB, just like the image, so the pixels are written as they are after a short text header, which
+ * makes the file readable by most tools without the cost of saveBmp().
+ */
+bool CRawImage::savePnm(const char* name)
+{
+	ASSERT(size > 0);
+	if (bpp != 1 && bpp != 3) {
+		fprintf(stderr, "Cannot save an image with %i bytes per pixel as PGM/PPM %s\n", bpp, name);
+		return false;
+	}
+	FILE* file = fopen(name, "wb");
+	if (file == NULL) {
+		fprintf(stderr, "Could not open file %s for writing\n", name);
+		return false;
+	}
+	fprintf(file, "P%i\n%i %i\n255\n", (bpp == 1) ? 5 : 6, width, height);
+	bool result = (fwrite(data, size, 1, file) == 1);
+	if (!result) fprintf(stderr, "Could not write %i bytes to %s\n", size, name);
 	fclose(file);
-	std::cout << __func__ << ": saved \"" << inName << "\"" << std::endl;
+	return result;
 }
 
 void CRawImage::saveNumberedBmp(const char *name, bool increment)
@@ -482,7 +662,7 @@ void CRawImage::saveNumberedBmp(const char *name, bool increment)
 	if (increment) numSaved++;
 	char nameext[100];
 	sprintf(nameext,"%s%04i.bmp",name,numSaved);
-	saveBmp(nameext);
+	CImageWriter::writer().save(this, SF_BMP, nameext);
 	if (increment) numSaved++;
 }
 
@@ -494,37 +674,76 @@ bool CRawImage::loadNumberedBmp(const char *name, bool increment) {
 }
 
 /**
- * A bitmap image is loaded from a file. The header file is not read, only the size of the image, which is assumed to be
- * at byte position 54.
+ * A bitmap image is loaded from a file. The dimensions and the offset of the pixels are taken from the header, the
+ * image is reallocated if it has other dimensions. The pixel array is read in one go and every row is put at the other
+ * end of the image with its red and blue channel exchanged, the inverse of saveBmp(). The image has 3 bytes per pixel
+ * afterwards, also for grayscale bitmaps, of which the palette is assumed to be the gray scale of saveBmp().
  */
 bool CRawImage::loadBmp(const char* inName)
 {
 	printf("Open file %s\n", inName);
 
-	// we assume that the image to be loaded has 3 bytes per pixel, if
-	// currently at bpp = 1, we adjust
-	if (bpp == 1) setbpp(3);
-
 	FILE* file = fopen(inName,"rb");
-	if (file!=NULL) {
-		size_t n = fread(data,54,1,file);
-		if (n == 0) {
-			fprintf(stderr, "Could read image header, but subsequent value indicates a size of 0 in %s\n", inName);
-			return false;
-		}
-		n = fread(data,size,1,file);
-		if (n == 0) {
-			fprintf(stderr, "Attempted to read %i bytes, but get nothing in %s\n", size, inName);
-			return false;
-		}
-		fclose(file);
-		swap(CC_RED, CC_BLUE);
-		fprintf(stdout, "Read %i bytes from %s\n", size, inName);
-		return true;
-	} else {
+	if (file == NULL) {
 		fprintf(stderr, "Could not load bitmap file %s\n", inName);
+		return false;
+	}
+	VALUE_TYPE head[RGB_HEADER_SIZE];
+	if (fread(head, RGB_HEADER_SIZE, 1, file) != 1 || head[0] != 'B' || head[1] != 'M') {
+		fprintf(stderr, "No bitmap header in %s\n", inName);
+		fclose(file);
+		return false;
+	}
+	int offset = head[10] | (head[11] << 8) | (head[12] << 16) | (head[13] << 24);
+	int w = head[18] | (head[19] << 8) | (head[20] << 16) | (head[21] << 24);
+	int h = head[22] | (head[23] << 8) | (head[24] << 16) | (head[25] << 24);
+	int file_bpp = (head[28] | (head[29] << 8)) / 8;
+	// a negative height means the rows are stored top down
+	bool bottom_up = (h > 0);
+	if (!bottom_up) h = -h;
+	if (w <= 0 || h <= 0 || (file_bpp != 1 && file_bpp != 3) || offset < RGB_HEADER_SIZE) {
+		fprintf(stderr, "Unsupported bitmap of %i*%i*%i in %s\n", w, h, file_bpp, inName);
+		fclose(file);
+		return false;
+	}
+
+	if (w != width || h != height || bpp != 3) {
+		width = w;
+		height = h;
+		bpp = 3;
+		refresh();
+	}
+
+	int row = (w*file_bpp + 3) & ~3;
+	int pixels = row*h;
+	VALUE_TYPE *buffer = CImagePool::pool().acquire(pixels, false);
+	bool result = (fseek(file, offset, SEEK_SET) == 0 && fread(buffer, pixels, 1, file) == 1);
+	fclose(file);
+	if (!result) {
+		fprintf(stderr, "Attempted to read %i bytes, but get nothing in %s\n", pixels, inName);
+		CImagePool::pool().release(buffer, pixels);
+		return false;
+	}
+
+	int span = width*3;
+	for (int j = 0; j < height; ++j) {
+		const VALUE_TYPE *src = &buffer[row*(bottom_up ? height-1-j : j)];
+		VALUE_TYPE *dst = &data[span*j];
+		if (file_bpp == 3) {
+			for (int i = 0; i < span; i += 3) {
+				dst[i] = src[i+2];
+				dst[i+1] = src[i+1];
+				dst[i+2] = src[i];
+			}
+		} else {
+			for (int i = 0; i < width; ++i) {
+				dst[i*3] = dst[i*3+1] = dst[i*3+2] = src[i];
+			}
+		}
 	}
-	return false;
+	CImagePool::pool().release(buffer, pixels);
+	fprintf(stdout, "Read %i bytes from %s\n", pixels, inName);
+	return true;
 }
 
 void CRawImage::plotCenter()
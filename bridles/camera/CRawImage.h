@@ -18,18 +18,26 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <CImagePool.h>
+
 /**
  * We do not want to use C++ templates, but on the other hand we want to change type at once.
  */
 typedef unsigned char VALUE_TYPE;
 
+//! Alignment in bytes of the pixel data of a CRawImage, enough for 256-bit vector loads
+#define IMAGE_ALIGNMENT POOL_ALIGNMENT
+
+//! Number of bins of the luminance histogram of a frame, each bin covers 4 grey values
+#define IMAGE_HISTOGRAM_BINS 64
+
 enum ColorChannel { CC_RED = 0, CC_GREEN = 1, CC_BLUE = 2};
 
 enum Orientation { O_VERTICAL, O_HORIZONTAL };
 
 /**
  * This is a very basic implementation of an image. It just uses three char's, one for each of the color channels.
- * Nothing fancy, no padding. Moreover, this struct is only used for communication with the user. The internal structure
+ * Nothing fancy, no padding between the rows, but the rows start at an aligned address (see CRawImage). Moreover, this struct is only used for communication with the user. The internal structure
  * is a (linear) array with RGB values or monochrome values.
  */
 struct Pixel {
@@ -52,6 +60,31 @@ struct Pixel {
 	}
 };
 
+/**
+ * A view on pixels that are owned by someone else, an image or a patch. Nothing is allocated or copied. Row y starts at
+ * data + y*stride, so a view can refer to a rectangle within a larger image, and kernels can just walk over rows.
+ */
+struct CImageView {
+	VALUE_TYPE *data;
+	int width;
+	int height;
+	int bpp;
+	int stride;
+	CImageView(): data(NULL), width(0), height(0), bpp(0), stride(0) {};
+	CImageView(VALUE_TYPE *data, int width, int height, int bpp):
+		data(data), width(width), height(height), bpp(bpp), stride(width*bpp) {};
+	CImageView(VALUE_TYPE *data, int width, int height, int bpp, int stride):
+		data(data), width(width), height(height), bpp(bpp), stride(stride) {};
+	//! First byte of row y
+	inline VALUE_TYPE* row(int y) const { return data + y * stride; }
+	//! First byte of pixel [x,y]
+	inline VALUE_TYPE* at(int x, int y) const { return data + y * stride + x * bpp; }
+	//! A rectangle within this view that starts at pixel [x,y], it has the same stride
+	inline CImageView sub(int x, int y, int width, int height) const {
+		return CImageView(at(x, y), width, height, bpp, stride);
+	}
+};
+
 /**
  * The patch is another convenient struct for the user. It allows you to get a patch with data from the image. It is
  * not meant to be super fast, it is just simple. It requires you to set a width and height beforehand, and then it
@@ -62,28 +95,67 @@ struct Patch {
 	VALUE_TYPE *data;
 	int width;
 	int height;
-	Patch(): data(NULL), width(0), height(0) {};
+	//! Number of bytes allocated, init() only allocates if it needs more
+	int capacity;
+	Patch(): data(NULL), width(0), height(0), capacity(0) {};
 	Patch(int width, int height) {
 		data = NULL;
+		capacity = 0;
 		init(width, height);
 	}
 	void init(int width, int height, int bpp=3) {
-		printf("%s(): initialize patch of size %i\n", __func__, width*height*bpp);
 		this->width = width;
 		this->height = height;
-		printf("%s(): what is weird about new or calloc here?\n", __func__);
-		data = new VALUE_TYPE[width*height*bpp];
-		printf("%s(): initialized patch of size %i\n", __func__, width*height*bpp);
+		if (data != NULL && capacity >= width*height*bpp) return;
+		free();
+		capacity = width*height*bpp;
+		data = CImagePool::pool().acquire(capacity, false);
 	}
 	void free() {
-		if (data != NULL) delete [] data;
+		CImagePool::pool().release(data, capacity);
+		data = NULL;
+		capacity = 0;
 	}
+	//! The patch as a view, for the functions that work on views
+	inline CImageView view(int bpp=3) { return CImageView(data, width, height, bpp); }
 	~Patch() {
 		free();
 	}
 };
 
 /**
+ * A rectangular region of interest. It does not own any memory, it is a view on the buffer of the image it is set on,
+ * which starts at pixel [x,y] and has a stride of one image row. Only the pixels within the region are guaranteed to be
+ * up to date, for example when the camera converted only the part of the frame around a tracked object.
+ */
+struct ImageRoi {
+	int x;
+	int y;
+	int width;
+	int height;
+	ImageRoi(): x(0), y(0), width(0), height(0) {};
+	ImageRoi(int x, int y, int width, int height): x(x), y(y), width(width), height(height) {};
+	inline bool empty() const { return (width <= 0 || height <= 0); }
+	//! Larger region with a margin of the given number of pixels at all sides, not clipped to the image
+	inline ImageRoi grow(int margin) const {
+		return ImageRoi(x - margin, y - margin, width + 2 * margin, height + 2 * margin);
+	}
+	//! The part of the region that lies within the other region, empty if they do not overlap
+	inline ImageRoi intersect(const ImageRoi & other) const {
+		int x0 = (x > other.x) ? x : other.x;
+		int y0 = (y > other.y) ? y : other.y;
+		int x1 = (x + width < other.x + other.width) ? x + width : other.x + other.width;
+		int y1 = (y + height < other.y + other.height) ? y + height : other.y + other.height;
+		if (x1 <= x0 || y1 <= y0) return ImageRoi();
+		return ImageRoi(x0, y0, x1 - x0, y1 - y0);
+	}
+};
+
+/**
+ * The rows of the image are packed, so the stride is width*bpp, but the buffer itself is aligned at IMAGE_ALIGNMENT
+ * bytes. With the usual widths (a multiple of 16 pixels) every row starts at an aligned address, which allows kernels
+ * that walk over rows to use aligned vector loads.
+ *
  * @author Tom Krajnik
  * @author Anne C. van Rossum
  */
@@ -133,25 +205,71 @@ public:
 	//! Set the patch
 	void setPatch(int p_x, int p_y, Patch &patch);
 
-	//! Get the patch itself (requires a malloc op)
+	//! Get the patch itself (requires a malloc op the first time the patch is used)
 	void getPatch(int x, int y, Patch & patch);
 
+	//! The whole image as a view
+	inline CImageView getView() { return CImageView(data, width, height, bpp, getstride()); }
+
+	//! A view on the rectangle of the given size that starts at [x,y], nothing is copied
+	CImageView getView(int x, int y, int width, int height);
+
 	//! Add header information etc. required to make a full-fledged CRawImage from a Patch struct
 	CRawImage* patch2Img(Patch &patch);
 
 	//! Get a patch the size of the picture divided by some factor
 	void compress(Patch &patch);
 
+	//! Subsample the image into a view of half the width and half the height
+	void compress(const CImageView &result);
+
+	//! Same, but average every 2x2 block of pixels if average is set, which is a box filter
+	void compress(const CImageView &result, bool average);
+
 	//! Clear all pixels (set them to zero), does not allocate or deallocate anything
 	void clear();
 
 	//! Reallocate internal data structures if necessary
 	void refresh();
 
-	//! Save to file, filename will automatically be appended by index
-	void saveBmp(const char* name);
+	//! Let the image refer to memory that is not owned by it, e.g. a driver buffer, nothing is copied
+	void wrap(VALUE_TYPE *buffer, int width, int height, int bpp);
+
+	//! Stop referring to the foreign buffer and use the memory owned by the image again
+	void unwrap();
+
+	//! Check if the image currently refers to foreign memory
+	inline bool isWrapped() { return wrapped; }
+
+	//! Restrict the valid part of the image to a region, it is clipped to the image, an empty region clears it
+	void setRoi(const ImageRoi & region);
+
+	//! The whole image is valid again
+	inline void clearRoi() { roi = ImageRoi(); }
+
+	//! Check if only a region of the image is valid
+	inline bool hasRoi() { return !roi.empty(); }
+
+	//! The region of interest, or the whole image if there is none
+	inline ImageRoi getRoi() { return hasRoi() ? roi : ImageRoi(0, 0, width, height); }
+
+	//! Get the number of bytes between the starts of two rows
+	const inline int getstride() { return width*bpp; }
+
+	//! Get the first byte of the region of interest, the next row of the region starts getstride() bytes further
+	inline VALUE_TYPE* getRoiData() { ImageRoi r = getRoi(); return data + (r.y * width + r.x) * bpp; }
+
+	//! Save as bitmap in one pass over the pixels, the image is not modified on the way
+	bool saveBmp(const char* name);
+
+	//! Dump the pixels without a header, the fastest way to get a frame on disk
+	bool saveRaw(const char* name);
 
-	//! With instances of class CRawImage across multiple binaries, the images will overwrite each other
+	//! Save as PGM (bpp=1) or PPM (bpp=3), only a short header in front of the pixels as they are in memory
+	bool savePnm(const char* name);
+
+	//! With instances of class CRawImage across multiple binaries, the images will overwrite each other, the file is
+	//! written by the CImageWriter thread, use CImageWriter::flush() before reading it back
 	void saveNumberedBmp(const char* name, bool increment = true);
 
 	//! Load the saved images
@@ -175,7 +293,7 @@ public:
 	//! Flip vertically or horizontally
 	void flip(const Orientation orientation);
 
-	//! Set the right BMP header, depends on dimensions, bpp, etc.
+	//! Set the right BMP header, depends on dimensions, bpp, etc., saveBmp() makes its own
 	void updateHeader();
 
 	//! Plot a vertical line through x (not entirely trivial if bpp > 1)
@@ -211,6 +329,28 @@ public:
 	//! Just show the data to the user, if you screw up, it's your own responsibility
 	VALUE_TYPE* data;
 
+	//! Luminance histogram of a frame from the camera, counted while the frame is converted, see CCamera::convertFrame
+	unsigned int histogram[IMAGE_HISTOGRAM_BINS];
+
+	//! Number of pixels counted in the histogram, zero if the image has no histogram
+	unsigned int histogramSamples;
+
+	//! Forget the histogram, e.g. after the pixels are changed
+	inline void clearHistogram() { histogramSamples = 0; }
+
+	//! Check if the histogram belongs to the current pixels
+	inline bool hasHistogram() { return histogramSamples > 0; }
+
+	//! Number of rows of the frame from the camera that were corrupt, they are repaired if there are not too many
+	int corruptRows;
+
+	//! Too many rows were corrupt to repair them, detectors skip the frame, see CCamera::repairFrame
+	bool corrupt;
+
+	//! Time at which the camera handed out the frame, in microseconds as CStageStats::now(), 0 if unknown, it traces
+	//! the frame through the jockeys, see CLatencyTrace.h
+	long long captured;
+
 	//! Reallocate the internal data structure on changing the number of bytes per pixel
 	void setbpp(int bpp) { this->bpp = bpp; refresh(); }
 
@@ -225,6 +365,9 @@ public:
 
 	//! Get the size in memory (pixels times the bytes per pixel)
 	const inline int getsize() { return size; };
+
+	//! Get the number of bytes per pixel (2 for a wrapped YUYV buffer)
+	const inline int getbpp() { return bpp; };
 private:
 	//! Width of image in pixels
 	int width;
@@ -234,12 +377,24 @@ private:
 	int bpp;
 	//! Size of data structure (pixels times the bytes per pixel)
 	int size;
+	//! Size of the buffer that is owned by the image and acquired from the pool
+	int alloc_size;
 
 	//! Brush with this color
 	Pixel brush;
 
 	//! To swap the color channels, or not
 	bool do_swap;
+
+	//! The valid region of the image, empty if the whole image is valid
+	ImageRoi roi;
+
+	//! The data field refers to a foreign buffer, see wrap()
+	bool wrapped;
+
+	//! The memory owned by this image, and its layout, while a foreign buffer is wrapped
+	VALUE_TYPE *own_data;
+	int own_width, own_height, own_bpp;
 };
 
 #endif
@@ -0,0 +1,253 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Frames of one camera in shared memory, for all jockeys that want to look at them at the same time
+ * @file CSharedFrames.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#include <CSharedFrames.h>
+#include <CRobotIndex.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef SYS_futex
+#include <linux/futex.h>
+#endif
+
+//! The frames start at the first multiple of 64 bytes after the header
+#define SHARED_FRAMES_OFFSET ((sizeof(SharedFramesHeader) + 63) & ~(size_t)63)
+
+CSharedFrames::CSharedFrames(): header(NULL), base(NULL), size(0), owner(false), writing(-1) {
+	name[0] = 0;
+}
+
+CSharedFrames::~CSharedFrames() {
+	detach();
+}
+
+uint64_t CSharedFrames::now() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (uint64_t)time.tv_sec * 1000000 + time.tv_nsec / 1000;
+}
+
+uint8_t* CSharedFrames::frame(int slot) {
+	return base + SHARED_FRAMES_OFFSET + (size_t)slot * header->frame_stride;
+}
+
+//! The segment of a virtual robot has its index in the name, see CRobotIndex.h
+bool CSharedFrames::map(const char *base_name, bool create, size_t size) {
+	segmentName(base_name, this->name, sizeof(this->name));
+	const char *name = this->name;
+	if (create) shm_unlink(name);
+	int fd = shm_open(name, create ? (O_RDWR | O_CREAT | O_EXCL) : O_RDWR, 0600);
+	if (fd < 0) {
+		if (create) fprintf(stderr, "CSharedFrames: cannot create %s, %s\n", name, strerror(errno));
+		return false;
+	}
+	if (create) {
+		if (ftruncate(fd, size) < 0) {
+			fprintf(stderr, "CSharedFrames: cannot size %s, %s\n", name, strerror(errno));
+			close(fd);
+			shm_unlink(name);
+			return false;
+		}
+	} else {
+		struct stat status;
+		if (fstat(fd, &status) < 0 || (size_t)status.st_size < SHARED_FRAMES_OFFSET) {
+			close(fd);
+			return false;
+		}
+		size = status.st_size;
+	}
+	void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ptr == MAP_FAILED) {
+		fprintf(stderr, "CSharedFrames: cannot map %s, %s\n", name, strerror(errno));
+		if (create) shm_unlink(name);
+		return false;
+	}
+	base = (uint8_t*)ptr;
+	header = (SharedFramesHeader*)ptr;
+	this->size = size;
+	owner = create;
+	return true;
+}
+
+bool CSharedFrames::create(const char *name, int width, int height, int bpp, uint32_t pixel_format, int slots) {
+	detach();
+	if (slots < 3) slots = 3;
+	if (slots > SHARED_FRAMES_MAX_SLOTS) slots = SHARED_FRAMES_MAX_SLOTS;
+	uint32_t frame_size = width * height * bpp;
+	uint32_t frame_stride = (frame_size + 63) & ~63;
+	if (!map(name, true, SHARED_FRAMES_OFFSET + (size_t)slots * frame_stride)) return false;
+	memset(header, 0, sizeof(SharedFramesHeader));
+	header->width = width;
+	header->height = height;
+	header->bpp = bpp;
+	header->pixel_format = pixel_format;
+	header->slots = slots;
+	header->frame_size = frame_size;
+	header->frame_stride = frame_stride;
+	header->latest = 0;
+	// consumers only look at a segment once the magic is there
+	__sync_synchronize();
+	header->magic = SHARED_FRAMES_MAGIC;
+	writing = -1;
+	return true;
+}
+
+bool CSharedFrames::attach(const char *name) {
+	detach();
+	if (!map(name, false, 0)) return false;
+	if (header->magic != SHARED_FRAMES_MAGIC || header->closed ||
+			size < SHARED_FRAMES_OFFSET + (size_t)header->slots * header->frame_stride) {
+		detach();
+		return false;
+	}
+	return true;
+}
+
+void CSharedFrames::detach() {
+	if (header == NULL) return;
+	if (owner) {
+		header->closed = 1;
+		__sync_synchronize();
+		header->seq++;
+#ifdef SYS_futex
+		syscall(SYS_futex, &header->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
+		shm_unlink(name);
+	}
+	munmap(base, size);
+	header = NULL;
+	base = NULL;
+	size = 0;
+	owner = false;
+	writing = -1;
+}
+
+/**
+ * The latest frame is never written, so a consumer always finds a complete frame. A slot of which the count is 0 is
+ * taken by setting it to -1, from then on a consumer cannot start to read it.
+ */
+uint8_t* CSharedFrames::back() {
+	if (header == NULL || !owner) return NULL;
+	if (writing >= 0) return frame(writing);
+	for (uint32_t i = 0; i < header->slots; ++i) {
+		if (header->seq != 0 && i == header->latest) continue;
+		if (__sync_bool_compare_and_swap(&header->slot[i].readers, 0, -1)) {
+			writing = i;
+			return frame(i);
+		}
+	}
+	header->dropped++;
+	return NULL;
+}
+
+void CSharedFrames::publish(uint64_t timestamp) {
+	if (header == NULL || writing < 0) return;
+	SharedFrameSlot &slot = header->slot[writing];
+	int32_t id = header->seq + 1;
+	slot.id = id;
+	slot.timestamp = timestamp;
+	// the pixels and the id have to be there before a consumer can take the slot
+	__sync_synchronize();
+	slot.readers = 0;
+	header->latest = writing;
+	__sync_synchronize();
+	header->seq = id;
+	__sync_synchronize();
+	writing = -1;
+#ifdef SYS_futex
+	if (header->sleeping) syscall(SYS_futex, &header->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
+}
+
+/**
+ * The consumer announces that it sleeps before it looks at the sequence for the last time, the server looks at the
+ * count after it changed the sequence, so at least one of them sees the other.
+ */
+void CSharedFrames::wait(int32_t seq, int timeout) {
+	if (timeout < 0 || timeout > SHARED_FRAMES_TIMEOUT) timeout = SHARED_FRAMES_TIMEOUT;
+	__sync_fetch_and_add(&header->sleeping, 1);
+	if (header->seq == seq) {
+#ifdef SYS_futex
+		struct timespec time;
+		time.tv_sec = timeout / 1000;
+		time.tv_nsec = (timeout % 1000) * 1000000L;
+		syscall(SYS_futex, &header->seq, FUTEX_WAIT, seq, &time, NULL, 0);
+#else
+		usleep(1000);
+#endif
+	}
+	__sync_fetch_and_sub(&header->sleeping, 1);
+}
+
+/**
+ * A slot of the latest frame is taken by incrementing its count, unless the server got it in the meantime because a
+ * newer frame came in, then the newer frame is tried.
+ */
+const uint8_t* CSharedFrames::acquire(uint32_t after, uint64_t since, int timeout, uint32_t *id, uint64_t *timestamp) {
+	if (header == NULL) return NULL;
+	uint64_t end = now() + (uint64_t)(timeout > 0 ? timeout : 0) * 1000;
+	while (!header->closed) {
+		int32_t seq = header->seq;
+		__sync_synchronize();
+		if (seq != 0) {
+			uint32_t latest = header->latest;
+			SharedFrameSlot &slot = header->slot[latest];
+			int32_t readers = slot.readers;
+			if (readers < 0) continue;
+			if (!__sync_bool_compare_and_swap(&slot.readers, readers, readers + 1)) continue;
+			if (slot.id > after && slot.timestamp >= since) {
+				if (id != NULL) *id = slot.id;
+				if (timestamp != NULL) *timestamp = slot.timestamp;
+				return frame(latest);
+			}
+			__sync_fetch_and_sub(&slot.readers, 1);
+		}
+		int left = -1;
+		if (timeout >= 0) {
+			uint64_t time = now();
+			if (time >= end) return NULL;
+			left = (end - time + 999) / 1000;
+		}
+		wait(seq, left);
+	}
+	return NULL;
+}
+
+void CSharedFrames::release(const uint8_t *frame) {
+	if (header == NULL || frame == NULL) return;
+	int slot = (frame - base - SHARED_FRAMES_OFFSET) / header->frame_stride;
+	if (slot < 0 || slot >= (int)header->slots) return;
+	__sync_fetch_and_sub(&header->slot[slot].readers, 1);
+}
@@ -0,0 +1,148 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Frames of one camera in shared memory, for all jockeys that want to look at them at the same time
+ * @file CSharedFrames.h
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#ifndef CSHAREDFRAMES_H_
+#define CSHAREDFRAMES_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+//! The segment of the camera server, see CCamera::startServing and CCamera::sharedInit
+#define SHARED_FRAMES_NAME "/equids_camera"
+//! Frames in the segment, every consumer that holds a frame keeps one of them from the server
+#ifndef SHARED_FRAMES_SLOTS
+#define SHARED_FRAMES_SLOTS 8
+#endif
+#define SHARED_FRAMES_MAX_SLOTS 16
+#define SHARED_FRAMES_MAGIC 0x53465231
+//! Milliseconds a consumer sleeps at most before it looks again whether the server is still there
+#define SHARED_FRAMES_TIMEOUT 100
+
+//! A frame in the segment, readers is -1 while the server writes it
+struct SharedFrameSlot {
+	volatile int32_t readers;
+	volatile uint32_t id;
+	//! Monotonic time in us at which the server got the frame from the driver
+	volatile uint64_t timestamp;
+};
+
+struct SharedFramesHeader {
+	uint32_t magic;
+	uint32_t width;
+	uint32_t height;
+	uint32_t bpp;
+	//! The V4L2 pixel format of the frames, consumers convert them themselves
+	uint32_t pixel_format;
+	uint32_t slots;
+	//! Bytes of a frame, the frames follow the header, each at a multiple of 64 bytes
+	uint32_t frame_size;
+	uint32_t frame_stride;
+	//! The slot of the latest frame, only changed by the server
+	volatile uint32_t latest;
+	//! The id of the latest frame, the consumers sleep on it with a futex
+	volatile int32_t seq;
+	volatile int32_t sleeping;
+	volatile uint32_t closed;
+	//! Frames the server could not write because every slot was held by a consumer
+	volatile uint32_t dropped;
+	SharedFrameSlot slot[SHARED_FRAMES_MAX_SLOTS];
+};
+
+/**
+ * The frames of one camera in a POSIX shared memory segment. One process, the camera server, owns the device and
+ * writes every driver frame into a free slot, any number of other processes read the latest frame in place, without
+ * copying it. The server never waits for a consumer and a consumer never waits for the server, except for the next
+ * frame: a slot is taken with a compare-and-swap of its reader count, the server only writes into a slot nobody reads
+ * and that is not the latest one. A consumer that holds a frame for a long time only keeps that slot from the server,
+ * with more consumers than SHARED_FRAMES_SLOTS - 2 that hold frames at the same time the server drops frames.
+ *
+ * The frames are stored as they come from the driver, so every consumer converts them to the format and the region of
+ * interest it wants itself, see CCamera::sharedInit.
+ */
+class CSharedFrames {
+public:
+	CSharedFrames();
+
+	//! Detaches, the server also removes the segment and wakes the consumers
+	~CSharedFrames();
+
+	//! Create the segment as server, an old segment with the same name is removed, false if that is not possible
+	bool create(const char *name, int width, int height, int bpp, uint32_t pixel_format,
+			int slots = SHARED_FRAMES_SLOTS);
+
+	//! Attach to the segment of a server as consumer, false if there is none
+	bool attach(const char *name);
+
+	//! Unmap the segment, the server removes it
+	void detach();
+
+	inline bool isAttached() { return header != NULL; }
+
+	//! A free slot to write a frame into, NULL if every slot is held by a consumer, server only
+	uint8_t* back();
+
+	//! Make the frame written into back() the latest one and wake the consumers, server only
+	void publish(uint64_t timestamp);
+
+	/**
+	 * The latest frame, if its id is larger than after and it is not older than the monotonic time since in us. Waits
+	 * timeout ms for such a frame, forever for timeout < 0. The server does not touch the frame until release(),
+	 * returns NULL on a timeout or when the server is gone.
+	 */
+	const uint8_t* acquire(uint32_t after = 0, uint64_t since = 0, int timeout = -1, uint32_t *id = NULL,
+			uint64_t *timestamp = NULL);
+
+	//! Give the frame of acquire() back to the server
+	void release(const uint8_t *frame);
+
+	inline int getwidth() { return header ? header->width : 0; }
+	inline int getheight() { return header ? header->height : 0; }
+	inline int getbpp() { return header ? header->bpp : 0; }
+	inline uint32_t getPixelFormat() { return header ? header->pixel_format : 0; }
+	inline uint32_t getDropped() { return header ? header->dropped : 0; }
+
+	//! Monotonic time in us, the time base of the timestamps of the frames
+	static uint64_t now();
+
+private:
+	bool map(const char *name, bool create, size_t size);
+
+	//! Sleep until the latest frame is not seq anymore, or at most SHARED_FRAMES_TIMEOUT ms
+	void wait(int32_t seq, int timeout);
+
+	uint8_t* frame(int slot);
+
+	SharedFramesHeader *header;
+	uint8_t *base;
+	size_t size;
+	bool owner;
+	char name[32];
+
+	//! The slot the server writes into, -1 if none
+	int writing;
+};
+
+#endif /* CSHAREDFRAMES_H_ */
@@ -0,0 +1,166 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Latency histograms for the stages of the vision pipeline
+ * @file CStageStats.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 14, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#include <CStageStats.h>
+
+#include <string.h>
+#include <sys/time.h>
+
+static const char* StrPipelineStage[] = {
+		"capture",
+		"convert",
+		"detect",
+		"transform",
+		"send"
+};
+
+CStageStats & CStageStats::stats() {
+	static CStageStats instance;
+	return instance;
+}
+
+CStageStats::CStageStats(): enabled(false) {
+	pthread_mutex_init(&mutex, NULL);
+	reset();
+}
+
+CStageStats::~CStageStats() {
+	pthread_mutex_destroy(&mutex);
+}
+
+long long CStageStats::now() {
+	struct timeval time;
+	gettimeofday(&time, NULL);
+	return (long long)time.tv_sec * 1000000 + time.tv_usec;
+}
+
+/**
+ * Enabling starts with empty histograms, so a statistics request after enabling only covers the frames since then.
+ */
+void CStageStats::setEnabled(bool enable) {
+	if (enable && !enabled) reset();
+	enabled = enable;
+}
+
+void CStageStats::reset() {
+	pthread_mutex_lock(&mutex);
+	memset(histogram, 0, sizeof(histogram));
+	memset(count, 0, sizeof(count));
+	memset(maximum, 0, sizeof(maximum));
+	frames = 0;
+	dropped = 0;
+	pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * Below STATS_LINEAR_BUCKETS every microsecond has its own bucket. Above it the three bits below the highest set bit
+ * select one of the STATS_SUB_BUCKETS buckets of that power of two.
+ */
+int CStageStats::bucket(long usec) {
+	if (usec < 0) return 0;
+	if (usec < STATS_LINEAR_BUCKETS) return (int)usec;
+	int octave = (int)(sizeof(unsigned long) * 8 - 1) - __builtin_clzl((unsigned long)usec);
+	if (octave > STATS_MAX_OCTAVE) return STATS_BUCKETS - 1;
+	int sub = (int)((usec >> (octave - 3)) & (STATS_SUB_BUCKETS - 1));
+	return STATS_LINEAR_BUCKETS + (octave - 4) * STATS_SUB_BUCKETS + sub;
+}
+
+long CStageStats::upperBound(int bucket) {
+	if (bucket < STATS_LINEAR_BUCKETS) return bucket;
+	int octave = 4 + (bucket - STATS_LINEAR_BUCKETS) / STATS_SUB_BUCKETS;
+	int sub = (bucket - STATS_LINEAR_BUCKETS) % STATS_SUB_BUCKETS;
+	return ((long)(STATS_SUB_BUCKETS + sub + 1) << (octave - 3)) - 1;
+}
+
+void CStageStats::record(PipelineStage stage, long usec) {
+	if (!enabled || stage < 0 || stage >= PIPELINE_STAGES) return;
+	int index = bucket(usec);
+	pthread_mutex_lock(&mutex);
+	histogram[stage][index]++;
+	count[stage]++;
+	if (usec > maximum[stage]) maximum[stage] = usec;
+	pthread_mutex_unlock(&mutex);
+}
+
+void CStageStats::countFrame() {
+	if (!enabled) return;
+	pthread_mutex_lock(&mutex);
+	frames++;
+	pthread_mutex_unlock(&mutex);
+}
+
+void CStageStats::countDropped(long frames) {
+	if (!enabled) return;
+	pthread_mutex_lock(&mutex);
+	dropped += frames;
+	pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * The smallest bucket that contains at least permille/1000 of the samples, call with the mutex locked.
+ */
+long CStageStats::percentile(PipelineStage stage, int permille) {
+	if (count[stage] == 0) return 0;
+	long long target = ((long long)count[stage] * permille + 999) / 1000;
+	long long cumulative = 0;
+	for (int i = 0; i < STATS_BUCKETS; ++i) {
+		cumulative += histogram[stage][i];
+		if (cumulative >= target) {
+			long bound = upperBound(i);
+			return (bound < maximum[stage]) ? bound : maximum[stage];
+		}
+	}
+	return maximum[stage];
+}
+
+void CStageStats::getSummary(PipelineStage stage, StageSummary & summary) {
+	memset(&summary, 0, sizeof(summary));
+	if (stage < 0 || stage >= PIPELINE_STAGES) return;
+	pthread_mutex_lock(&mutex);
+	summary.count = count[stage];
+	summary.p50 = percentile(stage, 500);
+	summary.p95 = percentile(stage, 950);
+	summary.p99 = percentile(stage, 990);
+	summary.max = maximum[stage];
+	pthread_mutex_unlock(&mutex);
+}
+
+const char* CStageStats::getStageName(PipelineStage stage) {
+	if (stage < 0 || stage >= PIPELINE_STAGES) return "unknown";
+	return StrPipelineStage[stage];
+}
+
+void CStageStats::printStatistics(FILE *out) {
+	if (!enabled) return;
+	fprintf(out, "CStageStats: %li frames, %li dropped\n", frames, dropped);
+	for (int i = 0; i < PIPELINE_STAGES; ++i) {
+		StageSummary summary;
+		getSummary((PipelineStage)i, summary);
+		if (summary.count == 0) continue;
+		fprintf(out, "CStageStats: %-9s %8li samples, p50 %li us, p95 %li us, p99 %li us, max %li us\n",
+				getStageName((PipelineStage)i), summary.count, summary.p50, summary.p95, summary.p99, summary.max);
+	}
+}
@@ -0,0 +1,155 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Latency histograms for the stages of the vision pipeline
+ * @file CStageStats.h
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 14, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#ifndef CSTAGESTATS_H_
+#define CSTAGESTATS_H_
+
+#include <pthread.h>
+#include <stdio.h>
+
+//! Latencies below this number of microseconds get a bucket of their own
+#define STATS_LINEAR_BUCKETS 16
+
+//! Every power of two above the linear range is split in this many buckets, so a percentile is at most 12.5% too high
+#define STATS_SUB_BUCKETS 8
+
+//! Latencies above 2^STATS_MAX_OCTAVE microseconds (about 17 minutes) end up in the last bucket
+#define STATS_MAX_OCTAVE 30
+
+#define STATS_BUCKETS (STATS_LINEAR_BUCKETS + (STATS_MAX_OCTAVE - 3) * STATS_SUB_BUCKETS)
+
+//! The stages of the vision pipelines of cameradetection and laserscan
+enum PipelineStage {
+	STAGE_CAPTURE = 0,   //!< waiting for a frame of the driver or the grabber thread
+	STAGE_CONVERT,       //!< converting a YUYV frame into the requested format
+	STAGE_DETECT,        //!< finding the pattern, or the laser line
+	STAGE_TRANSFORM,     //!< from image coordinates to a position or distance
+	STAGE_SEND,          //!< sending the result or the image to other processes
+	PIPELINE_STAGES
+};
+
+//! Percentiles in microseconds of a single stage
+struct StageSummary {
+	long count;
+	long p50;
+	long p95;
+	long p99;
+	long max;
+};
+
+/**
+ * Every sample goes into a fixed bucket of a histogram with logarithmically growing buckets, so recording is cheap,
+ * never allocates, and the memory use does not depend on the run time. The percentiles are the upper bounds of their
+ * buckets, the maximum is exact. The statistics are disabled by default, then a CStageTimer only checks a flag. The
+ * grabber thread of the camera and the main thread of a jockey record concurrently, so the histograms are protected by
+ * a mutex.
+ */
+class CStageStats {
+public:
+	//! The statistics of this process
+	static CStageStats & stats();
+
+	//! Start or stop recording, enabling resets all histograms and counters
+	void setEnabled(bool enable);
+
+	inline bool isEnabled() { return enabled; }
+
+	//! Add a latency in microseconds to the histogram of a stage
+	void record(PipelineStage stage, long usec);
+
+	//! Count a frame that went through the entire pipeline
+	void countFrame();
+
+	//! Count frames that were captured, but never processed, or that could not be captured
+	void countDropped(long frames = 1);
+
+	inline long getFrames() { return frames; }
+
+	inline long getDropped() { return dropped; }
+
+	//! Get the percentiles of a stage
+	void getSummary(PipelineStage stage, StageSummary & summary);
+
+	//! Clear all histograms and counters
+	void reset();
+
+	//! Print the summary of every stage that has samples
+	void printStatistics(FILE *out = stdout);
+
+	//! The name of a stage, for printing
+	static const char* getStageName(PipelineStage stage);
+
+	//! Time in microseconds, 64 bits because 32 bits would wrap around after 35 minutes
+	static long long now();
+
+private:
+	CStageStats();
+
+	~CStageStats();
+
+	static int bucket(long usec);
+
+	static long upperBound(int bucket);
+
+	long percentile(PipelineStage stage, int permille);
+
+	pthread_mutex_t mutex;
+
+	volatile bool enabled;
+
+	long histogram[PIPELINE_STAGES][STATS_BUCKETS];
+	long count[PIPELINE_STAGES];
+	long maximum[PIPELINE_STAGES];
+
+	long frames;
+	long dropped;
+};
+
+/**
+ * Measures the time between construction and destruction, or an earlier call to stop(), in a stage:
+ *   { CStageTimer timer(STAGE_DETECT); segment = detector->findSegment(image, last); }
+ * If the statistics are disabled at construction nothing is recorded.
+ */
+class CStageTimer {
+public:
+	CStageTimer(PipelineStage stage): stage(stage) {
+		start = CStageStats::stats().isEnabled() ? CStageStats::now() : -1;
+	}
+
+	~CStageTimer() { stop(); }
+
+	//! Record the time up to now, the destructor will not record anything anymore
+	inline void stop() {
+		if (start < 0) return;
+		CStageStats::stats().record(stage, (long)(CStageStats::now() - start));
+		start = -1;
+	}
+private:
+	PipelineStage stage;
+	long long start;
+};
+
+#endif /* CSTAGESTATS_H_ */
@@ -0,0 +1,203 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Record frames, messages and laser vectors of a run in one log and play them back later
+ * @file CStreamLog.h
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 14, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#ifndef CSTREAMLOG_H_
+#define CSTREAMLOG_H_
+
+#include "imageStream.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+ * A log is a number of segments, path.0000, path.0001, ..., and an index, path.idx. A segment is created at its full
+ * size and memory mapped, so appending a record is a memcpy, the kernel writes the pages back when it suits it. When a
+ * record does not fit anymore the segment is cut to what is used and the next one is started. Every record is a
+ * StreamLogRecord followed by the payload, padded to 8 bytes. The index has a StreamLogIndex per record, it is written
+ * every STREAM_LOG_INDEX_FLUSH records, after a crash the replay finds the records that are missing in the index by
+ * walking the segments.
+ *
+ * The payload of a frame is a packed ImageFrameHeader (raw encoding) followed by the pixels, of a message its data,
+ * with the message type as channel, and of a laser scan what packLaserScan makes of it. Fields are in host order, the
+ * robots and the laptops are all little-endian. This file is shared as-is with the visualiser (common/CStreamLog.h).
+ */
+
+#define STREAM_LOG_MAGIC 0x524C5145 // "EQLR"
+#define STREAM_LOG_SEGMENT_SIZE (64 << 20)
+#define STREAM_LOG_INDEX_FLUSH 64
+
+typedef enum {
+	STREAM_LOG_FRAME = 1,
+	STREAM_LOG_MESSAGE,
+	STREAM_LOG_SCAN
+} EStreamLogType;
+
+//! The record went out of the process that made the log, otherwise it came in
+#define STREAM_LOG_OUTGOING 0x01
+
+struct StreamLogRecord {
+	uint32_t magic;
+	uint8_t type;
+	uint8_t channel; // message type, or the robot for the frames of the visualiser
+	uint16_t flags;
+	uint32_t length; // payload without the padding
+	uint32_t sequence;
+	uint64_t timestamp; // us since the epoch
+};
+
+struct StreamLogIndex {
+	uint64_t timestamp;
+	uint32_t segment;
+	uint32_t offset; // of the StreamLogRecord in the segment
+	uint32_t length;
+	uint8_t type;
+	uint8_t channel;
+	uint16_t flags;
+};
+
+//! A record as the replay hands it out, data points into the mapped segment and stays valid until close()
+struct StreamLogEntry {
+	uint8_t type;
+	uint8_t channel;
+	uint16_t flags;
+	uint32_t length;
+	uint64_t timestamp;
+	const uint8_t *data;
+};
+
+//! Microseconds since the epoch, the clock of the timestamps in the log
+uint64_t streamLogTime();
+
+/**
+ * Appends records to a log. The frame loop, the IPC threads and the image receivers all record into the same log, so
+ * append() takes a mutex, but only for as long as the copy into the mapped segment takes.
+ */
+class CStreamLog {
+public:
+	CStreamLog();
+
+	~CStreamLog();
+
+	//! Start a new log, old segments with the same path are overwritten
+	bool open(const char *path, uint32_t segment_size = STREAM_LOG_SEGMENT_SIZE);
+
+	//! Cut the last segment and write the rest of the index
+	void close();
+
+	inline bool isOpen() { return map != NULL; }
+
+	//! Append a record, a timestamp of 0 is now
+	bool append(uint8_t type, uint8_t channel, const void *data, uint32_t length, uint64_t timestamp = 0,
+			uint16_t flags = 0);
+
+	//! Append a raw frame with its dimensions, so the replay does not have to know them
+	bool appendFrame(uint8_t channel, const uint8_t *pixels, int width, int height, int bpp, uint32_t frame_id = 0,
+			uint64_t timestamp = 0);
+
+	//! Number of records written so far
+	inline uint32_t records() { return sequence; }
+
+private:
+	bool append(uint8_t type, uint8_t channel, const void *head, uint32_t head_length, const void *data,
+			uint32_t length, uint64_t timestamp, uint16_t flags);
+
+	//! Map a new segment of at least needed bytes
+	bool newSegment(uint32_t needed);
+
+	void closeSegment();
+
+	void flushIndex();
+
+	pthread_mutex_t mutex;
+
+	std::string path;
+	uint32_t segment_size;
+
+	int segment;
+	int segment_fd;
+	uint8_t *map;
+	uint32_t mapped;
+	uint32_t used;
+
+	int index_fd;
+	std::vector<StreamLogIndex> index;
+
+	uint32_t sequence;
+};
+
+/**
+ * Plays a log back in the order it was recorded, at the original speed, faster, or as fast as possible.
+ */
+class CStreamReplay {
+public:
+	CStreamReplay();
+
+	~CStreamReplay();
+
+	bool open(const char *path);
+
+	void close();
+
+	/**
+	 * The next record of the given type (any type for -1). With speed 1 it waits until as much time has passed since
+	 * the first record as passed during the recording, with speed 2 half of that, with speed 0 it does not wait.
+	 * Returns false at the end of the log.
+	 */
+	bool next(StreamLogEntry &entry, float speed = 1, int type = -1);
+
+	//! The next frame, its pixels directly follow the header in the log
+	bool nextFrame(ImageFrameHeader &header, const uint8_t *&pixels, float speed = 1);
+
+	//! Start again at the first record, the clock of the replay starts again as well
+	void rewind();
+
+	//! Continue at the first record at or after the timestamp
+	void seek(uint64_t timestamp);
+
+	inline int records() { return index.size(); }
+
+private:
+	//! Add the records from segment and offset onwards to the index, for the part the writer did not flush
+	void scan(uint32_t segment, uint32_t offset);
+
+	const uint8_t* mapSegment(uint32_t segment, uint32_t &size);
+
+	std::string path;
+
+	std::vector<StreamLogIndex> index;
+	std::vector<const uint8_t*> maps;
+	std::vector<uint32_t> sizes;
+
+	int position;
+
+	bool started;
+	uint64_t start_time;
+	uint64_t start_timestamp;
+};
+
+#endif /* CSTREAMLOG_H_ */
@@ -36,6 +36,38 @@ int cam_format(int fd, int width, int height, int format)
 	return 1;
 }
 
+/**
+ * The driver only accepts another format when it has no buffers, so they are released first and requested again
+ * afterwards, the same number as cam_opendev requests. The buffers have to be mapped again with init_mmap before
+ * streaming. Not every driver supports VIDIOC_S_PARM, then the frame rate stays as it is.
+ */
+int cam_reformat(int fd, int width, int height, int fps)
+{
+	struct v4l2_requestbuffers req;
+	CLEAR(req);
+	req.count = 0;
+	req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	req.memory = V4L2_MEMORY_MMAP;
+	xioctl(fd, VIDIOC_REQBUFS, &req);
+
+	int result = cam_format(fd, width, height, 1);
+
+	if (fps > 0) {
+		struct v4l2_streamparm parm;
+		CLEAR(parm);
+		parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		parm.parm.capture.timeperframe.numerator = 1;
+		parm.parm.capture.timeperframe.denominator = fps;
+		if (-1 == xioctl(fd, VIDIOC_S_PARM, &parm))
+			fprintf(stderr, "cannot set the frame rate to %d fps\n", fps);
+	}
+
+	req.count = CAM_NUM_BUFFERS;
+	if (-1 == xioctl(fd, VIDIOC_REQBUFS, &req))
+		return 0;
+	return result;
+}
+
 unsigned char* cam_capture(int fd, int width, int height)
 {
 	unsigned int i, n_buffers=0;
@@ -115,10 +147,12 @@ unsigned char* cam_capture(int fd, int width, int height)
 	return (unsigned char*)buffers->start;
 }
 
-unsigned char *cam_stream(int fd) {
+/**
+ * Wait for the driver to fill a buffer and dequeue it. The buffer is not queued again, so the driver will not write
+ * into it until cam_stream_release is called with the returned index.
+ */
+unsigned char *cam_stream_borrow(int fd, int *index) {
 	struct v4l2_buffer buf;
-	unsigned int i;
-	int n_buffers = 2;
 
 	fd_set fds;
 	struct timeval tv;
@@ -164,19 +198,46 @@ unsigned char *cam_stream(int fd) {
 		}
 	}
 
-	assert(buf.index < n_buffers);
+	assert(buf.index < CAM_NUM_BUFFERS);
+
+	*index = buf.index;
+	return gBuffers[buf.index].start;
+}
+
+/**
+ * Hand a buffer obtained by cam_stream_borrow back to the driver.
+ */
+int cam_stream_release(int fd, int index) {
+	struct v4l2_buffer buf;
 
-	//process_image(buffers[buf.index].start, buf.bytesused);
+	assert(index >= 0 && index < CAM_NUM_BUFFERS);
 
-	if (-1 == xioctl(fd, VIDIOC_QBUF, &buf))
+	CLEAR(buf);
+	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buf.memory = V4L2_MEMORY_MMAP;
+	buf.index = index;
+
+	return xioctl(fd, VIDIOC_QBUF, &buf);
+}
+
+/**
+ * Dequeue a frame and queue it immediately again. The returned buffer can be overwritten by the driver at any moment,
+ * use cam_stream_borrow and cam_stream_release if the frame has to stay intact during processing.
+ */
+unsigned char *cam_stream(int fd) {
+	int index;
+	unsigned char *frame = cam_stream_borrow(fd, &index);
+	if (frame == NULL) return NULL;
+
+	if (-1 == cam_stream_release(fd, index))
 		errno_exit("VIDIOC_QBUF");
 
-	return gBuffers[buf.index].start;
+	return frame;
 }
 
 void start_capturing(int fd)
 {
-	int n_buffers = 2;
+	int n_buffers = CAM_NUM_BUFFERS;
 	unsigned int i;
 	enum v4l2_buf_type type;
 
@@ -211,9 +272,9 @@ void stop_capturing(int fd)
  */
 void init_mmap(int fd, const char* dev_name)
 {
-	int n_buffers = 2;
+	int n_buffers;
 
-	int req_count = 2; // see libcam2.c cam_opendev with VIDIOC_REQBUFS
+	int req_count = CAM_NUM_BUFFERS; // see libcam2.c cam_opendev with VIDIOC_REQBUFS
 
 	gBuffers = calloc(req_count, sizeof(*gBuffers));
 
@@ -246,3 +307,18 @@ void init_mmap(int fd, const char* dev_name)
 			errno_exit("mmap");
 	}
 }
+
+void uninit_mmap()
+{
+	int i;
+
+	if (!gBuffers) return;
+
+	for (i = 0; i < CAM_NUM_BUFFERS; ++i) {
+		if (-1 == munmap(gBuffers[i].start, gBuffers[i].length))
+			errno_exit("munmap");
+	}
+
+	free(gBuffers);
+	gBuffers = NULL;
+}
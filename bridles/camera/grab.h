@@ -10,19 +10,36 @@
 extern "C" {
 #endif
 
+//! Number of buffers requested from the driver, see VIDIOC_REQBUFS in cam_opendev
+#define CAM_NUM_BUFFERS 2
+
 //! Set camera format
 int cam_format(int fd, int width, int height, int format);
 
+//! Change the resolution and the frame rate (0 keeps it) of a device that is not streaming, 0 if it is not possible
+int cam_reformat(int fd, int width, int height, int fps);
+
 //! Capture image from camera
 unsigned char* cam_capture(int fd, int width, int height);
 
 unsigned char* cam_stream(int fd);
 
+//! Dequeue a frame without handing it back to the driver, the index is required for cam_stream_release
+unsigned char* cam_stream_borrow(int fd, int *index);
+
+//! Queue a borrowed frame again, so the driver can fill it with a new image
+int cam_stream_release(int fd, int index);
+
 //! In case cam_stream is used, use this too, after cam_opendev
 void init_mmap(int fd, const char* dev_name);
 
+//! Unmap the buffers that are mapped by init_mmap
+void uninit_mmap();
+
 void start_capturing(int fd);
 
+void stop_capturing(int fd);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,369 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Wire format and codec of the video stream of CImageServer
+ * @file imageStream.h
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 14, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#ifndef IMAGESTREAM_H_
+#define IMAGESTREAM_H_
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * The image port of a robot is used by the visualiser, which sits on the same WiFi as several other robots. A raw frame
+ * of 640x480x3 is 900 KB, so next to the old request/response (CM_GET, one raw frame per request byte, of a size the
+ * client has to know) and its framed version (CM_FRAME, one raw frame with an ImageFrameHeader) the client can ask for
+ * a stream (CM_STREAM followed by an ImageStreamRequest). The server then pushes frames at the negotiated rate
+ * until it receives CM_STOP, CM_QUIT, or the connection drops. Every frame is an ImageFrameHeader followed by the
+ * payload. The frames are decimated (box filter) and optionally grey, and with IMAGE_ENCODING_DELTA_RLE every frame is
+ * the byte-wise difference with the previous frame, run-length encoded, so a static scene costs a few hundred bytes.
+ * The first frame of a stream is a key frame, its difference is taken with a black frame. TCP does not lose frames,
+ * so a client that decodes every frame stays in sync.
+ *
+ * Since version 2 a frame can carry an overlay after its payload: lines, crosses, boxes and numbers that the robot
+ * found in the frame, in pixels of the camera. The visualiser draws them over the frame, so the detection does not
+ * paint its debug output into the image that the other consumers of the frame get. A server only sends them to a
+ * client that asked for version 2 or later, the frames of a version 1 stream are exactly what they used to be.
+ *
+ * All multi-byte fields are little-endian, this file is shared as-is with the visualiser (common/imageStream.h).
+ */
+
+//! The first byte of every request on the image port
+typedef enum {
+	CM_GET = 0,
+	CM_QUIT,
+	CM_STREAM,
+	CM_STOP,
+	CM_FRAME
+} ECameraMessage;
+
+typedef enum {
+	IMAGE_ENCODING_RAW = 0,
+	IMAGE_ENCODING_DELTA_RLE,
+	IMAGE_ENCODING_COUNT
+} EImageEncoding;
+
+#define IMAGE_STREAM_VERSION 2
+//! The first version in which frames carry an ImageOverlay
+#define IMAGE_STREAM_OVERLAY_VERSION 2
+#define IMAGE_STREAM_MAGIC 0x53495145 // "EQIS"
+
+#define IMAGE_STREAM_MAX_FPS 30
+#define IMAGE_STREAM_MAX_DECIMATION 8
+
+//! The frame is a key frame, the delta is with respect to a black frame
+#define IMAGE_FRAME_KEY 0x01
+//! The payload is followed by an ImageOverlay of ImageFrameHeader::overlay bytes
+#define IMAGE_FRAME_OVERLAY 0x02
+
+#define IMAGE_STREAM_REQUEST_LENGTH 5
+#define IMAGE_FRAME_HEADER_LENGTH 32
+
+//! Primitives beyond this are dropped, a detection that needs more has nothing left to show in a frame anyway
+#define IMAGE_OVERLAY_MAX_PRIMITIVES 128
+#define IMAGE_OVERLAY_HEADER_LENGTH 6
+#define IMAGE_OVERLAY_PRIMITIVE_LENGTH 10
+#define IMAGE_OVERLAY_MAX_LENGTH (IMAGE_OVERLAY_HEADER_LENGTH + IMAGE_OVERLAY_MAX_PRIMITIVES * \
+		IMAGE_OVERLAY_PRIMITIVE_LENGTH)
+
+//! What the client asks for, the server clamps it to what it can do and reports the result in every frame header
+struct ImageStreamRequest {
+	uint8_t version;
+	uint8_t fps;
+	uint8_t encoding;
+	uint8_t decimation;
+	uint8_t bpp; // 1 for grey, 3 for colour
+};
+
+struct ImageFrameHeader {
+	uint32_t magic;
+	uint8_t version;
+	uint8_t encoding;
+	uint8_t flags;
+	uint8_t bpp;
+	uint32_t frame_id;
+	uint64_t timestamp; // us since the epoch, when the frame was copied from the camera
+	uint16_t width;
+	uint16_t height;
+	uint32_t length; // payload in bytes
+	uint8_t fps;
+	uint8_t decimation;
+	uint16_t overlay; // bytes of the ImageOverlay after the payload, with IMAGE_FRAME_OVERLAY
+};
+
+/**
+ * The coordinates are pixels of the camera, also in a decimated stream. A line goes from (x0, y0) to (x1, y1), a box
+ * has these as opposite corners, a cross is centred on (x0, y0) with arms of x1 pixels, and a number is the value x1
+ * written with its top left corner at (x0, y0).
+ */
+typedef enum {
+	OVERLAY_LINE = 0,
+	OVERLAY_CROSS,
+	OVERLAY_BOX,
+	OVERLAY_NUMBER,
+	OVERLAY_COUNT
+} EOverlayPrimitive;
+
+//! A few colours that stand out in a camera image, the visualiser picks the actual shades
+typedef enum {
+	OVERLAY_RED = 0,
+	OVERLAY_GREEN,
+	OVERLAY_BLUE,
+	OVERLAY_YELLOW,
+	OVERLAY_CYAN,
+	OVERLAY_MAGENTA,
+	OVERLAY_WHITE,
+	OVERLAY_COLOR_COUNT
+} EOverlayColor;
+
+struct ImageOverlayPrimitive {
+	uint8_t type;
+	uint8_t color;
+	int16_t x0, y0;
+	int16_t x1, y1;
+};
+
+/**
+ * What the robot found in a frame. The detection of a frame ends after the frame is published, so the overlay that
+ * goes along with a frame can be the one of the frame before it, frame_id tells which one it is.
+ */
+struct ImageOverlay {
+	uint32_t frame_id;
+	uint16_t count;
+	ImageOverlayPrimitive primitives[IMAGE_OVERLAY_MAX_PRIMITIVES];
+};
+
+static inline void clearImageOverlay(ImageOverlay &overlay, uint32_t frame_id) {
+	overlay.frame_id = frame_id;
+	overlay.count = 0;
+}
+
+//! Add a primitive, false if the overlay is full
+static inline bool addImageOverlay(ImageOverlay &overlay, uint8_t type, uint8_t color, int x0, int y0, int x1,
+		int y1) {
+	if (overlay.count >= IMAGE_OVERLAY_MAX_PRIMITIVES) return false;
+	ImageOverlayPrimitive &primitive = overlay.primitives[overlay.count++];
+	primitive.type = type;
+	primitive.color = color;
+	primitive.x0 = (int16_t)x0;
+	primitive.y0 = (int16_t)y0;
+	primitive.x1 = (int16_t)x1;
+	primitive.y1 = (int16_t)y1;
+	return true;
+}
+
+static inline void imageStreamPut(uint8_t *buffer, uint64_t value, int bytes) {
+	for (int i = 0; i < bytes; ++i) buffer[i] = (uint8_t)(value >> (8 * i));
+}
+
+static inline uint64_t imageStreamGet(const uint8_t *buffer, int bytes) {
+	uint64_t value = 0;
+	for (int i = 0; i < bytes; ++i) value |= (uint64_t)buffer[i] << (8 * i);
+	return value;
+}
+
+static inline void packImageStreamRequest(const ImageStreamRequest &request, uint8_t *buffer) {
+	buffer[0] = request.version;
+	buffer[1] = request.fps;
+	buffer[2] = request.encoding;
+	buffer[3] = request.decimation;
+	buffer[4] = request.bpp;
+}
+
+/**
+ * Unpack and clamp a request, unknown values fall back to a grey half-size delta stream at 5 fps. A client of a newer
+ * version gets the frames of the newest version this side knows, the server answers in the version of the request.
+ */
+static inline void unpackImageStreamRequest(const uint8_t *buffer, ImageStreamRequest &request) {
+	request.version = buffer[0];
+	if (request.version == 0) request.version = 1;
+	if (request.version > IMAGE_STREAM_VERSION) request.version = IMAGE_STREAM_VERSION;
+	request.fps = buffer[1];
+	if (request.fps == 0) request.fps = 5;
+	if (request.fps > IMAGE_STREAM_MAX_FPS) request.fps = IMAGE_STREAM_MAX_FPS;
+	request.encoding = buffer[2];
+	if (request.encoding >= IMAGE_ENCODING_COUNT) request.encoding = IMAGE_ENCODING_DELTA_RLE;
+	request.decimation = buffer[3];
+	if (request.decimation == 0) request.decimation = 2;
+	if (request.decimation > IMAGE_STREAM_MAX_DECIMATION) request.decimation = IMAGE_STREAM_MAX_DECIMATION;
+	request.bpp = (buffer[4] == 3) ? 3 : 1;
+}
+
+static inline void packImageFrameHeader(const ImageFrameHeader &header, uint8_t *buffer) {
+	imageStreamPut(buffer, header.magic, 4);
+	buffer[4] = header.version;
+	buffer[5] = header.encoding;
+	buffer[6] = header.flags;
+	buffer[7] = header.bpp;
+	imageStreamPut(buffer + 8, header.frame_id, 4);
+	imageStreamPut(buffer + 12, header.timestamp, 8);
+	imageStreamPut(buffer + 20, header.width, 2);
+	imageStreamPut(buffer + 22, header.height, 2);
+	imageStreamPut(buffer + 24, header.length, 4);
+	buffer[28] = header.fps;
+	buffer[29] = header.decimation;
+	imageStreamPut(buffer + 30, header.overlay, 2);
+}
+
+//! Unpack a frame header, false if it is not a frame of a stream this side understands
+static inline bool unpackImageFrameHeader(const uint8_t *buffer, ImageFrameHeader &header) {
+	header.magic = imageStreamGet(buffer, 4);
+	header.version = buffer[4];
+	header.encoding = buffer[5];
+	header.flags = buffer[6];
+	header.bpp = buffer[7];
+	header.frame_id = imageStreamGet(buffer + 8, 4);
+	header.timestamp = imageStreamGet(buffer + 12, 8);
+	header.width = imageStreamGet(buffer + 20, 2);
+	header.height = imageStreamGet(buffer + 22, 2);
+	header.length = imageStreamGet(buffer + 24, 4);
+	header.fps = buffer[28];
+	header.decimation = buffer[29];
+	header.overlay = imageStreamGet(buffer + 30, 2);
+	return header.magic == IMAGE_STREAM_MAGIC && header.version >= 1 && header.version <= IMAGE_STREAM_VERSION &&
+			header.encoding < IMAGE_ENCODING_COUNT && (header.bpp == 1 || header.bpp == 3);
+}
+
+//! Pack overlay into buffer, which should hold IMAGE_OVERLAY_MAX_LENGTH bytes, returns the length
+static inline int packImageOverlay(const ImageOverlay &overlay, uint8_t *buffer) {
+	imageStreamPut(buffer, overlay.frame_id, 4);
+	imageStreamPut(buffer + 4, overlay.count, 2);
+	uint8_t *out = buffer + IMAGE_OVERLAY_HEADER_LENGTH;
+	for (int i = 0; i < overlay.count; ++i, out += IMAGE_OVERLAY_PRIMITIVE_LENGTH) {
+		const ImageOverlayPrimitive &primitive = overlay.primitives[i];
+		out[0] = primitive.type;
+		out[1] = primitive.color;
+		imageStreamPut(out + 2, (uint16_t)primitive.x0, 2);
+		imageStreamPut(out + 4, (uint16_t)primitive.y0, 2);
+		imageStreamPut(out + 6, (uint16_t)primitive.x1, 2);
+		imageStreamPut(out + 8, (uint16_t)primitive.y1, 2);
+	}
+	return IMAGE_OVERLAY_HEADER_LENGTH + overlay.count * IMAGE_OVERLAY_PRIMITIVE_LENGTH;
+}
+
+//! Unpack an overlay of length bytes, false if the length does not match, primitives of an unknown type are skipped
+static inline bool unpackImageOverlay(const uint8_t *buffer, int length, ImageOverlay &overlay) {
+	overlay.count = 0;
+	if (length < IMAGE_OVERLAY_HEADER_LENGTH) return false;
+	overlay.frame_id = imageStreamGet(buffer, 4);
+	int count = imageStreamGet(buffer + 4, 2);
+	if (length != IMAGE_OVERLAY_HEADER_LENGTH + count * IMAGE_OVERLAY_PRIMITIVE_LENGTH) return false;
+	const uint8_t *in = buffer + IMAGE_OVERLAY_HEADER_LENGTH;
+	for (int i = 0; i < count; ++i, in += IMAGE_OVERLAY_PRIMITIVE_LENGTH) {
+		if (in[0] >= OVERLAY_COUNT) continue;
+		addImageOverlay(overlay, in[0], in[1], (int16_t)imageStreamGet(in + 2, 2), (int16_t)imageStreamGet(in + 4, 2),
+				(int16_t)imageStreamGet(in + 6, 2), (int16_t)imageStreamGet(in + 8, 2));
+	}
+	return true;
+}
+
+//! The largest payload of a frame of size bytes, the run-length code adds one byte per 128 literals
+static inline int imageStreamMaxPayload(int size) {
+	return size + size / 128 + 1;
+}
+
+/**
+ * Shrink an image with bpp bytes per pixel by decimation in both directions, averaging every block of pixels. With
+ * out_bpp 1 the result is grey, (r+2g+b)/4 does not care whether the camera delivers RGB or BGR.
+ */
+static inline void decimateImage(const uint8_t *src, int width, int height, int bpp, int decimation, int out_bpp,
+		uint8_t *dst) {
+	int out_width = width / decimation;
+	int out_height = height / decimation;
+	int count = decimation * decimation;
+	for (int y = 0; y < out_height; ++y) {
+		for (int x = 0; x < out_width; ++x) {
+			int sum[3] = {0, 0, 0};
+			for (int j = 0; j < decimation; ++j) {
+				const uint8_t *pixel = src + ((y * decimation + j) * width + x * decimation) * bpp;
+				for (int i = 0; i < decimation; ++i, pixel += bpp) {
+					for (int c = 0; c < 3 && c < bpp; ++c) sum[c] += pixel[c];
+				}
+			}
+			if (bpp < 3) sum[1] = sum[2] = sum[0];
+			if (out_bpp == 1) {
+				*dst++ = (sum[0] + 2 * sum[1] + sum[2]) / (4 * count);
+			} else {
+				for (int c = 0; c < 3; ++c) *dst++ = sum[c] / count;
+			}
+		}
+	}
+}
+
+/**
+ * Encode the difference of frame with previous (NULL for a key frame) as runs: a control byte c < 128 is followed by
+ * c+1 literal bytes, a control byte c >= 128 by one byte that repeats c-126 times. Returns the length in out, which
+ * should hold imageStreamMaxPayload(size) bytes.
+ */
+static inline int encodeDeltaRLE(const uint8_t *frame, const uint8_t *previous, int size, uint8_t *out) {
+	int length = 0;
+	int literals = 0; // start of the pending literals in out
+	int i = 0;
+#define DELTA(k) ((uint8_t)(previous != NULL ? frame[k] - previous[k] : frame[k]))
+	while (i < size) {
+		uint8_t value = DELTA(i);
+		int run = 1;
+		while (i + run < size && run < 129 && DELTA(i + run) == value) run++;
+		// a run of two saves nothing and would break a block of literals
+		if (run >= 3) {
+			out[length++] = (uint8_t)(run + 126);
+			out[length++] = value;
+			literals = length;
+		} else {
+			if (length == literals || out[literals] == 127) {
+				literals = length;
+				out[length++] = 0xFF; // placeholder, becomes the number of literals minus one
+			}
+			out[length++] = value;
+			out[literals] = (uint8_t)(out[literals] + 1);
+			run = 1;
+		}
+		i += run;
+	}
+#undef DELTA
+	return length;
+}
+
+//! Apply an encoded difference to frame, which holds the previous frame (or is ignored for a key frame)
+static inline bool decodeDeltaRLE(const uint8_t *in, int length, uint8_t *frame, int size, bool key) {
+	int i = 0;
+	int k = 0;
+	while (k < length) {
+		uint8_t control = in[k++];
+		if (control < 128) {
+			int count = control + 1;
+			if (k + count > length || i + count > size) return false;
+			for (int n = 0; n < count; ++n, ++i) frame[i] = key ? in[k + n] : (uint8_t)(frame[i] + in[k + n]);
+			k += count;
+		} else {
+			int count = control - 126;
+			if (k >= length || i + count > size) return false;
+			uint8_t value = in[k++];
+			for (int n = 0; n < count; ++n, ++i) frame[i] = key ? value : (uint8_t)(frame[i] + value);
+		}
+	}
+	return i == size;
+}
+
+#endif /* IMAGESTREAM_H_ */
@@ -0,0 +1,294 @@
+#include "laserdiff.h"
+
+#include <stdlib.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <tmmintrin.h>
+#define LASER_SSSE3
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define LASER_NEON
+#endif
+
+/***********************************************************************************************************************
+ * Scalar implementation, this is also used for the pixels at the end of a row that do not fill a whole vector
+ **********************************************************************************************************************/
+
+static inline int more_red(const unsigned char *a, const unsigned char *b, int red, int threshold, int diff_threshold) {
+	int c_red = (int)a[red] - (int)b[red];
+	int c_green = (int)a[1] - (int)b[1];
+	int c_blue = (int)a[2 - red] - (int)b[2 - red];
+	if (c_red <= threshold) return 0;
+	if (abs(c_green) > diff_threshold || abs(c_blue) > diff_threshold) return 0;
+	return (abs(abs(c_blue) - abs(c_red)) > diff_threshold) && (abs(abs(c_green) - abs(c_red)) > diff_threshold);
+}
+
+static void diff_abs_scalar(unsigned char *out, const unsigned char *a, const unsigned char *b, int bytes) {
+	int i;
+	for (i = 0; i < bytes; ++i) {
+		out[i] = (unsigned char)abs((int)a[i] - (int)b[i]);
+	}
+}
+
+static void red_mask_scalar(unsigned char *out, const unsigned char *a, const unsigned char *b, int pixels, int red,
+		int threshold, int diff_threshold) {
+	int i;
+	for (i = 0; i < 3 * pixels; i += 3) {
+		unsigned char d = more_red(a + i, b + i, red, threshold, diff_threshold) ? 200 : 0;
+		out[i] = out[i + 1] = out[i + 2] = d;
+	}
+}
+
+static int first_red_scalar(const unsigned char *a, const unsigned char *b, int pixels, int red, int threshold,
+		int diff_threshold) {
+	int i;
+	for (i = 0; i < pixels; ++i) {
+		if (more_red(a + 3 * i, b + 3 * i, red, threshold, diff_threshold)) return i;
+	}
+	return -1;
+}
+
+static const laser_kernels kernels_scalar = { diff_abs_scalar, red_mask_scalar, first_red_scalar, "scalar" };
+
+const laser_kernels* laser_kernels_scalar() {
+	return &kernels_scalar;
+}
+
+#ifdef LASER_SSSE3
+
+/***********************************************************************************************************************
+ * SSSE3 implementation, 16 pixels (three registers) at a time, pshufb splits them in the three channels
+ **********************************************************************************************************************/
+
+//! Shuffles that pick channel c out of register r of 16 pixels, and that spread one byte per pixel over three registers
+static unsigned char split_mask[3][3][16];
+static unsigned char merge_mask[3][16];
+
+static void init_masks() {
+	int c, r, k, i;
+	for (c = 0; c < 3; ++c) {
+		for (r = 0; r < 3; ++r) {
+			for (k = 0; k < 16; ++k) {
+				int byte = 3 * k + c;
+				split_mask[c][r][k] = (byte / 16 == r) ? (unsigned char)(byte % 16) : 0x80;
+			}
+		}
+	}
+	for (r = 0; r < 3; ++r) {
+		for (i = 0; i < 16; ++i) {
+			merge_mask[r][i] = (unsigned char)((16 * r + i) / 3);
+		}
+	}
+}
+
+typedef struct {
+	__m128i split[3][3];
+	__m128i threshold;
+	__m128i diff_threshold;
+} ssse3_state;
+
+__attribute__((target("ssse3")))
+static inline void ssse3_init(ssse3_state *state, int threshold, int diff_threshold) {
+	int c, r;
+	for (c = 0; c < 3; ++c) {
+		for (r = 0; r < 3; ++r) {
+			state->split[c][r] = _mm_loadu_si128((const __m128i*)split_mask[c][r]);
+		}
+	}
+	state->threshold = _mm_set1_epi16((short)threshold);
+	state->diff_threshold = _mm_set1_epi16((short)diff_threshold);
+}
+
+__attribute__((target("ssse3")))
+static inline __m128i ssse3_channel(const __m128i *v, const __m128i *split) {
+	return _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v[0], split[0]), _mm_shuffle_epi8(v[1], split[1])),
+			_mm_shuffle_epi8(v[2], split[2]));
+}
+
+//! The more_red test on 8 pixels in 16-bit lanes, returns 0xFFFF for each pixel that passes
+__attribute__((target("ssse3")))
+static inline __m128i ssse3_test(__m128i c_red, __m128i c_green, __m128i c_blue, const ssse3_state *state) {
+	__m128i abs_red = _mm_abs_epi16(c_red);
+	__m128i abs_green = _mm_abs_epi16(c_green);
+	__m128i abs_blue = _mm_abs_epi16(c_blue);
+	__m128i m = _mm_cmpgt_epi16(c_red, state->threshold);
+	m = _mm_andnot_si128(_mm_cmpgt_epi16(abs_green, state->diff_threshold), m);
+	m = _mm_andnot_si128(_mm_cmpgt_epi16(abs_blue, state->diff_threshold), m);
+	m = _mm_and_si128(m, _mm_cmpgt_epi16(_mm_abs_epi16(_mm_sub_epi16(abs_blue, abs_red)), state->diff_threshold));
+	m = _mm_and_si128(m, _mm_cmpgt_epi16(_mm_abs_epi16(_mm_sub_epi16(abs_green, abs_red)), state->diff_threshold));
+	return m;
+}
+
+//! One byte per pixel for 16 pixels, 0xFF if the pixel is more red
+__attribute__((target("ssse3")))
+static inline __m128i ssse3_red16(const unsigned char *a, const unsigned char *b, int red, const ssse3_state *state) {
+	const __m128i zero = _mm_setzero_si128();
+	__m128i va[3], vb[3];
+	int r;
+	for (r = 0; r < 3; ++r) {
+		va[r] = _mm_loadu_si128((const __m128i*)(a + 16 * r));
+		vb[r] = _mm_loadu_si128((const __m128i*)(b + 16 * r));
+	}
+	__m128i ar = ssse3_channel(va, state->split[red]), br = ssse3_channel(vb, state->split[red]);
+	__m128i ag = ssse3_channel(va, state->split[1]), bg = ssse3_channel(vb, state->split[1]);
+	__m128i ab = ssse3_channel(va, state->split[2 - red]), bb = ssse3_channel(vb, state->split[2 - red]);
+
+	__m128i lo = ssse3_test(
+			_mm_sub_epi16(_mm_unpacklo_epi8(ar, zero), _mm_unpacklo_epi8(br, zero)),
+			_mm_sub_epi16(_mm_unpacklo_epi8(ag, zero), _mm_unpacklo_epi8(bg, zero)),
+			_mm_sub_epi16(_mm_unpacklo_epi8(ab, zero), _mm_unpacklo_epi8(bb, zero)), state);
+	__m128i hi = ssse3_test(
+			_mm_sub_epi16(_mm_unpackhi_epi8(ar, zero), _mm_unpackhi_epi8(br, zero)),
+			_mm_sub_epi16(_mm_unpackhi_epi8(ag, zero), _mm_unpackhi_epi8(bg, zero)),
+			_mm_sub_epi16(_mm_unpackhi_epi8(ab, zero), _mm_unpackhi_epi8(bb, zero)), state);
+	return _mm_packs_epi16(lo, hi);
+}
+
+__attribute__((target("ssse3")))
+static void diff_abs_ssse3(unsigned char *out, const unsigned char *a, const unsigned char *b, int bytes) {
+	int i = 0;
+	for (; i + 16 <= bytes; i += 16) {
+		__m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+		__m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+		_mm_storeu_si128((__m128i*)(out + i), _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va)));
+	}
+	diff_abs_scalar(out + i, a + i, b + i, bytes - i);
+}
+
+__attribute__((target("ssse3")))
+static void red_mask_ssse3(unsigned char *out, const unsigned char *a, const unsigned char *b, int pixels, int red,
+		int threshold, int diff_threshold) {
+	ssse3_state state;
+	ssse3_init(&state, threshold, diff_threshold);
+	__m128i merge[3];
+	int i = 0, r;
+	for (r = 0; r < 3; ++r) merge[r] = _mm_loadu_si128((const __m128i*)merge_mask[r]);
+	const __m128i value = _mm_set1_epi8((char)200);
+	for (; i + 16 <= pixels; i += 16) {
+		__m128i m = _mm_and_si128(ssse3_red16(a + 3 * i, b + 3 * i, red, &state), value);
+		for (r = 0; r < 3; ++r) {
+			_mm_storeu_si128((__m128i*)(out + 3 * i + 16 * r), _mm_shuffle_epi8(m, merge[r]));
+		}
+	}
+	red_mask_scalar(out + 3 * i, a + 3 * i, b + 3 * i, pixels - i, red, threshold, diff_threshold);
+}
+
+__attribute__((target("ssse3")))
+static int first_red_ssse3(const unsigned char *a, const unsigned char *b, int pixels, int red, int threshold,
+		int diff_threshold) {
+	ssse3_state state;
+	ssse3_init(&state, threshold, diff_threshold);
+	int i = 0;
+	for (; i + 16 <= pixels; i += 16) {
+		int bits = _mm_movemask_epi8(ssse3_red16(a + 3 * i, b + 3 * i, red, &state));
+		if (bits) return i + __builtin_ctz(bits);
+	}
+	int p = first_red_scalar(a + 3 * i, b + 3 * i, pixels - i, red, threshold, diff_threshold);
+	return (p < 0) ? -1 : i + p;
+}
+
+static const laser_kernels kernels_ssse3 = { diff_abs_ssse3, red_mask_ssse3, first_red_ssse3, "ssse3" };
+
+#endif
+
+#ifdef LASER_NEON
+
+/***********************************************************************************************************************
+ * NEON implementation, 16 pixels at a time, the structured loads and stores split and merge the channels for free
+ **********************************************************************************************************************/
+
+static inline uint16x8_t neon_test(int16x8_t c_red, int16x8_t c_green, int16x8_t c_blue, int16x8_t threshold,
+		int16x8_t diff_threshold) {
+	int16x8_t abs_red = vabsq_s16(c_red);
+	int16x8_t abs_green = vabsq_s16(c_green);
+	int16x8_t abs_blue = vabsq_s16(c_blue);
+	uint16x8_t m = vcgtq_s16(c_red, threshold);
+	m = vbicq_u16(m, vcgtq_s16(abs_green, diff_threshold));
+	m = vbicq_u16(m, vcgtq_s16(abs_blue, diff_threshold));
+	m = vandq_u16(m, vcgtq_s16(vabsq_s16(vsubq_s16(abs_blue, abs_red)), diff_threshold));
+	m = vandq_u16(m, vcgtq_s16(vabsq_s16(vsubq_s16(abs_green, abs_red)), diff_threshold));
+	return m;
+}
+
+static inline int16x8_t neon_sub(uint8x8_t a, uint8x8_t b) {
+	return vreinterpretq_s16_u16(vsubl_u8(a, b));
+}
+
+static inline uint8x16_t neon_red16(const unsigned char *a, const unsigned char *b, int red, int16x8_t threshold,
+		int16x8_t diff_threshold) {
+	uint8x16x3_t va = vld3q_u8(a);
+	uint8x16x3_t vb = vld3q_u8(b);
+	uint8x16_t ar = red ? va.val[2] : va.val[0], br = red ? vb.val[2] : vb.val[0];
+	uint8x16_t ab = red ? va.val[0] : va.val[2], bb = red ? vb.val[0] : vb.val[2];
+	uint16x8_t lo = neon_test(neon_sub(vget_low_u8(ar), vget_low_u8(br)),
+			neon_sub(vget_low_u8(va.val[1]), vget_low_u8(vb.val[1])),
+			neon_sub(vget_low_u8(ab), vget_low_u8(bb)), threshold, diff_threshold);
+	uint16x8_t hi = neon_test(neon_sub(vget_high_u8(ar), vget_high_u8(br)),
+			neon_sub(vget_high_u8(va.val[1]), vget_high_u8(vb.val[1])),
+			neon_sub(vget_high_u8(ab), vget_high_u8(bb)), threshold, diff_threshold);
+	return vcombine_u8(vmovn_u16(lo), vmovn_u16(hi));
+}
+
+static void diff_abs_neon(unsigned char *out, const unsigned char *a, const unsigned char *b, int bytes) {
+	int i = 0;
+	for (; i + 16 <= bytes; i += 16) {
+		vst1q_u8(out + i, vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i)));
+	}
+	diff_abs_scalar(out + i, a + i, b + i, bytes - i);
+}
+
+static void red_mask_neon(unsigned char *out, const unsigned char *a, const unsigned char *b, int pixels, int red,
+		int threshold, int diff_threshold) {
+	int16x8_t t = vdupq_n_s16((short)threshold), d = vdupq_n_s16((short)diff_threshold);
+	int i = 0;
+	for (; i + 16 <= pixels; i += 16) {
+		uint8x16_t m = vandq_u8(neon_red16(a + 3 * i, b + 3 * i, red, t, d), vdupq_n_u8(200));
+		uint8x16x3_t o;
+		o.val[0] = o.val[1] = o.val[2] = m;
+		vst3q_u8(out + 3 * i, o);
+	}
+	red_mask_scalar(out + 3 * i, a + 3 * i, b + 3 * i, pixels - i, red, threshold, diff_threshold);
+}
+
+static int first_red_neon(const unsigned char *a, const unsigned char *b, int pixels, int red, int threshold,
+		int diff_threshold) {
+	int16x8_t t = vdupq_n_s16((short)threshold), d = vdupq_n_s16((short)diff_threshold);
+	unsigned char lanes[16];
+	int i = 0, k;
+	for (; i + 16 <= pixels; i += 16) {
+		uint8x16_t m = neon_red16(a + 3 * i, b + 3 * i, red, t, d);
+		uint8x8_t any = vorr_u8(vget_low_u8(m), vget_high_u8(m));
+		if (vget_lane_u64(vreinterpret_u64_u8(any), 0) == 0) continue;
+		vst1q_u8(lanes, m);
+		for (k = 0; k < 16; ++k) {
+			if (lanes[k]) return i + k;
+		}
+	}
+	int p = first_red_scalar(a + 3 * i, b + 3 * i, pixels - i, red, threshold, diff_threshold);
+	return (p < 0) ? -1 : i + p;
+}
+
+static const laser_kernels kernels_neon = { diff_abs_neon, red_mask_neon, first_red_neon, "neon" };
+
+#endif
+
+/**
+ * On x86 the processor is asked whether it supports SSSE3, on ARM NEON is used if the compiler targets it. Anything
+ * else, like the Blackfin, gets the scalar kernels.
+ */
+const laser_kernels* laser_kernels_get() {
+	static const laser_kernels *selected = NULL;
+	if (selected != NULL) return selected;
+	const laser_kernels *kernels = &kernels_scalar;
+#if defined(LASER_SSSE3)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("ssse3")) {
+		init_masks();
+		kernels = &kernels_ssse3;
+	}
+#elif defined(LASER_NEON)
+	kernels = &kernels_neon;
+#endif
+	selected = kernels;
+	return selected;
+}
@@ -0,0 +1,68 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Kernels that compare an image with the laser turned on against one with the laser turned off
+ * @file laserdiff.h
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 14, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#ifndef LASERDIFF_H
+#define LASERDIFF_H
+
+/**
+ * All kernels work on a single row of packed 3-byte pixels. The "red" parameter is the index of the red channel within
+ * a pixel, 0 for RGB and 2 for BGR, green is always the middle byte. A pixel is "more red" exactly as defined by
+ * CImageManip::isMoreRed: the red channel went up by more than threshold, the green and blue channel did not change by
+ * more than diff_threshold, and the change in red differs by more than diff_threshold from the changes in green and
+ * blue. The threshold should not be negative.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+	//! Absolute difference of every byte, out[i] = |a[i] - b[i]|
+	void (*diff_abs)(unsigned char *out, const unsigned char *a, const unsigned char *b, int bytes);
+
+	//! All three bytes of a pixel become 200 if the pixel is more red in a than in b, and 0 otherwise
+	void (*red_mask)(unsigned char *out, const unsigned char *a, const unsigned char *b, int pixels, int red,
+			int threshold, int diff_threshold);
+
+	//! Index of the first pixel that is more red in a than in b, or -1 if there is none
+	int (*first_red)(const unsigned char *a, const unsigned char *b, int pixels, int red, int threshold,
+			int diff_threshold);
+
+	//! Name of the implementation, for the log
+	const char *name;
+} laser_kernels;
+
+//! The fastest implementation the processor supports, this is decided once at the first call
+const laser_kernels* laser_kernels_get();
+
+//! The plain C implementation, available everywhere
+const laser_kernels* laser_kernels_scalar();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
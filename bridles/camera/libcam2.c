@@ -1,4 +1,5 @@
 #include "libcam2.h"
+#include "grab.h"
 
 struct v4l2_queryctrl queryctrl;
 struct v4l2_control control;
@@ -32,7 +33,7 @@ int cam_opendev(const char *dev_name, int width, int height, int format)
 
 	struct v4l2_requestbuffers req;
 	CLEAR(req);
-	req.count = 2;
+	req.count = CAM_NUM_BUFFERS;
 	req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 	req.memory = V4L2_MEMORY_MMAP;
 	xioctl(fd, VIDIOC_REQBUFS, &req);
@@ -0,0 +1,321 @@
+#include "yuvconvert.h"
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define YUV_SSE2
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define YUV_NEON
+#endif
+
+/**
+ * The coefficients of the conversion are multiplied by 256. To stay within 16 bits in the vector paths they are split
+ * in a multiple of 256 and a remainder, for example 298*C = 256*C + 42*C. Because the multiple of 256 does not take
+ * part in the rounding, floor((298*C + 128) / 256) = C + floor((42*C + 128) / 256), so the results are identical.
+ */
+
+static inline unsigned char clamp255(int value) {
+	return (unsigned char)(value < 0 ? 0 : (value > 255 ? 255 : value));
+}
+
+static inline void yuv_pixel(unsigned char *rgb, int y, int u, int v) {
+	int c = y - 16, d = u - 128, e = v - 128;
+	rgb[0] = clamp255((298 * c           + 409 * e + 128) >> 8);
+	rgb[1] = clamp255((298 * c - 100 * d - 208 * e + 128) >> 8);
+	rgb[2] = clamp255((298 * c + 516 * d           + 128) >> 8);
+}
+
+static inline unsigned char yuv_grey(int y) {
+	return clamp255((298 * (y - 16) + 128) >> 8);
+}
+
+#ifdef YUV_SSE2
+
+/**
+ * Convert 8 pixels at a time. The YUYV bytes are read as 16-bit lanes, so the luminance is the low byte and the
+ * chrominance alternates between U and V in the high byte. Returns the number of pixels that are converted.
+ */
+static int yuyv_to_rgb_simd(unsigned char *rgb, const unsigned char *yuyv, int pixels) {
+	const __m128i low_byte = _mm_set1_epi16(0x00FF);
+	const __m128i low_word = _mm_set1_epi32(0x0000FFFF);
+	const __m128i offset_y = _mm_set1_epi16(16);
+	const __m128i offset_uv = _mm_set1_epi16(128);
+	const __m128i round = _mm_set1_epi16(128);
+	const __m128i k42 = _mm_set1_epi16(42);
+	const __m128i k153 = _mm_set1_epi16(153);
+	const __m128i k100 = _mm_set1_epi16(100);
+	const __m128i k48 = _mm_set1_epi16(48);
+	unsigned char rg[16], b[16];
+	int n = 0, i;
+	for (; n + 8 <= pixels; n += 8) {
+		__m128i in = _mm_loadu_si128((const __m128i*)(yuyv + 2 * n));
+		__m128i y = _mm_and_si128(in, low_byte);
+		__m128i uv = _mm_srli_epi16(in, 8);
+		__m128i u = _mm_and_si128(uv, low_word);
+		__m128i v = _mm_srli_epi32(uv, 16);
+		u = _mm_or_si128(u, _mm_slli_epi32(u, 16));
+		v = _mm_or_si128(v, _mm_slli_epi32(v, 16));
+
+		__m128i c = _mm_sub_epi16(y, offset_y);
+		__m128i d = _mm_sub_epi16(u, offset_uv);
+		__m128i e = _mm_sub_epi16(v, offset_uv);
+		__m128i c42 = _mm_add_epi16(_mm_mullo_epi16(c, k42), round);
+
+		__m128i r16 = _mm_add_epi16(_mm_add_epi16(c, e),
+				_mm_srai_epi16(_mm_add_epi16(c42, _mm_mullo_epi16(e, k153)), 8));
+		__m128i g16 = _mm_add_epi16(_mm_sub_epi16(c, e),
+				_mm_srai_epi16(_mm_add_epi16(_mm_sub_epi16(c42, _mm_mullo_epi16(d, k100)),
+						_mm_mullo_epi16(e, k48)), 8));
+		__m128i b16 = _mm_add_epi16(_mm_add_epi16(c, _mm_add_epi16(d, d)),
+				_mm_srai_epi16(_mm_add_epi16(c42, _mm_slli_epi16(d, 2)), 8));
+
+		_mm_storeu_si128((__m128i*)rg, _mm_packus_epi16(r16, g16));
+		_mm_storeu_si128((__m128i*)b, _mm_packus_epi16(b16, b16));
+		for (i = 0; i < 8; ++i) {
+			rgb[3 * (n + i) + 0] = rg[i];
+			rgb[3 * (n + i) + 1] = rg[i + 8];
+			rgb[3 * (n + i) + 2] = b[i];
+		}
+	}
+	return n;
+}
+
+static inline __m128i grey_epi16(__m128i y) {
+	__m128i c = _mm_sub_epi16(y, _mm_set1_epi16(16));
+	__m128i t = _mm_add_epi16(_mm_mullo_epi16(c, _mm_set1_epi16(42)), _mm_set1_epi16(128));
+	return _mm_add_epi16(c, _mm_srai_epi16(t, 8));
+}
+
+//! Convert 16 pixels at a time, returns the number of pixels that are converted
+static int yuyv_to_grey_simd(unsigned char *grey, const unsigned char *yuyv, int pixels) {
+	const __m128i low_byte = _mm_set1_epi16(0x00FF);
+	int n = 0;
+	for (; n + 16 <= pixels; n += 16) {
+		__m128i y0 = _mm_and_si128(_mm_loadu_si128((const __m128i*)(yuyv + 2 * n)), low_byte);
+		__m128i y1 = _mm_and_si128(_mm_loadu_si128((const __m128i*)(yuyv + 2 * n + 16)), low_byte);
+		_mm_storeu_si128((__m128i*)(grey + n), _mm_packus_epi16(grey_epi16(y0), grey_epi16(y1)));
+	}
+	return n;
+}
+
+#elif defined(YUV_NEON)
+
+static inline uint8x8_t neon_channel(int16x8_t c, int16x8_t base, int16x8_t chroma) {
+	int16x8_t t = vaddq_s16(vaddq_s16(vmulq_n_s16(c, 42), chroma), vdupq_n_s16(128));
+	return vqmovun_s16(vaddq_s16(vaddq_s16(c, base), vshrq_n_s16(t, 8)));
+}
+
+/**
+ * Convert 16 pixels at a time. The structured load splits the frame in even luminance, U, odd luminance, and V, the
+ * even and odd pixels are zipped together again before the interleaved store. Returns the number of pixels converted.
+ */
+static int yuyv_to_rgb_simd(unsigned char *rgb, const unsigned char *yuyv, int pixels) {
+	int n = 0;
+	for (; n + 16 <= pixels; n += 16) {
+		uint8x8x4_t in = vld4_u8(yuyv + 2 * n);
+		int16x8_t c0 = vreinterpretq_s16_u16(vsubl_u8(in.val[0], vdup_n_u8(16)));
+		int16x8_t c1 = vreinterpretq_s16_u16(vsubl_u8(in.val[2], vdup_n_u8(16)));
+		int16x8_t d = vreinterpretq_s16_u16(vsubl_u8(in.val[1], vdup_n_u8(128)));
+		int16x8_t e = vreinterpretq_s16_u16(vsubl_u8(in.val[3], vdup_n_u8(128)));
+
+		int16x8_t chroma_r = vmulq_n_s16(e, 153);
+		int16x8_t chroma_g = vsubq_s16(vmulq_n_s16(e, 48), vmulq_n_s16(d, 100));
+		int16x8_t chroma_b = vshlq_n_s16(d, 2);
+		int16x8_t base_r = e;
+		int16x8_t base_g = vnegq_s16(e);
+		int16x8_t base_b = vaddq_s16(d, d);
+
+		uint8x8x2_t r = vzip_u8(neon_channel(c0, base_r, chroma_r), neon_channel(c1, base_r, chroma_r));
+		uint8x8x2_t g = vzip_u8(neon_channel(c0, base_g, chroma_g), neon_channel(c1, base_g, chroma_g));
+		uint8x8x2_t b = vzip_u8(neon_channel(c0, base_b, chroma_b), neon_channel(c1, base_b, chroma_b));
+
+		uint8x16x3_t out;
+		out.val[0] = vcombine_u8(r.val[0], r.val[1]);
+		out.val[1] = vcombine_u8(g.val[0], g.val[1]);
+		out.val[2] = vcombine_u8(b.val[0], b.val[1]);
+		vst3q_u8(rgb + 3 * n, out);
+	}
+	return n;
+}
+
+static inline uint8x8_t neon_grey(uint8x8_t y) {
+	int16x8_t c = vreinterpretq_s16_u16(vsubl_u8(y, vdup_n_u8(16)));
+	int16x8_t t = vaddq_s16(vmulq_n_s16(c, 42), vdupq_n_s16(128));
+	return vqmovun_s16(vaddq_s16(c, vshrq_n_s16(t, 8)));
+}
+
+//! Convert 16 pixels at a time, returns the number of pixels that are converted
+static int yuyv_to_grey_simd(unsigned char *grey, const unsigned char *yuyv, int pixels) {
+	int n = 0;
+	for (; n + 16 <= pixels; n += 16) {
+		uint8x16x2_t in = vld2q_u8(yuyv + 2 * n);
+		vst1q_u8(grey + n, vcombine_u8(neon_grey(vget_low_u8(in.val[0])), neon_grey(vget_high_u8(in.val[0]))));
+	}
+	return n;
+}
+
+#else
+
+/**
+ * Without vector unit nothing is done here and everything is left to the scalar loops. On the Blackfin these loops are
+ * plain 32-bit multiply-accumulates, which the compiler can schedule on the two MAC units.
+ */
+static int yuyv_to_rgb_simd(unsigned char *rgb, const unsigned char *yuyv, int pixels) {
+	return 0;
+}
+
+static int yuyv_to_grey_simd(unsigned char *grey, const unsigned char *yuyv, int pixels) {
+	return 0;
+}
+
+#endif
+
+void yuyv_to_rgb(unsigned char *rgb, const unsigned char *yuyv, int width, int height) {
+	int pixels = width * height;
+	int n = yuyv_to_rgb_simd(rgb, yuyv, pixels);
+	for (; n < pixels; n += 2) {
+		const unsigned char *p = yuyv + 2 * n;
+		yuv_pixel(rgb + 3 * n, p[0], p[1], p[3]);
+		yuv_pixel(rgb + 3 * n + 3, p[2], p[1], p[3]);
+	}
+}
+
+void yuyv_to_grey(unsigned char *grey, const unsigned char *yuyv, int width, int height) {
+	int pixels = width * height;
+	int n = yuyv_to_grey_simd(grey, yuyv, pixels);
+	for (; n < pixels; ++n) {
+		grey[n] = yuv_grey(yuyv[2 * n]);
+	}
+}
+
+static inline void put_pixel(unsigned char *p, unsigned char r, unsigned char g, unsigned char b, int swap) {
+	p[0] = swap ? b : r;
+	p[1] = g;
+	p[2] = swap ? r : b;
+}
+
+/**
+ * Count every YUV_BRIGHTNESS_STEP-th pixel of the row, the row is sampled if it is a multiple of that step from the top
+ * of its half. This gives the same result as CRawImage::getOverallBrightness for the same step.
+ */
+static void count_row(const unsigned char *row, int width, struct yuv_brightness *brightness, int half) {
+	int i;
+	for (i = 0; i < width; i += YUV_BRIGHTNESS_STEP) {
+		const unsigned char *p = row + 3 * i;
+		brightness->sum[half] += p[0] + p[1] + p[2];
+		brightness->saturated[half] += (p[0] >= 250 && p[1] >= 250 && p[2] >= 250);
+		brightness->dark[half] += (p[0] <= 25 && p[1] <= 25 && p[2] <= 25);
+		brightness->pixels[half]++;
+	}
+}
+
+/**
+ * Mirror the row and swap the channels in place. With a mirror the pixels are swapped in pairs from both ends, so every
+ * pixel is read and written once.
+ */
+static void finish_row(unsigned char *row, int width, int flags) {
+	int swap = (flags & YUV_SWAP_RB) != 0;
+	int i;
+	if (flags & YUV_FLIP_HORIZONTAL) {
+		for (i = 0; i < width / 2; ++i) {
+			unsigned char *p = row + 3 * i, *q = row + 3 * (width - 1 - i);
+			unsigned char r = p[0], g = p[1], b = p[2];
+			put_pixel(p, q[0], q[1], q[2], swap);
+			put_pixel(q, r, g, b, swap);
+		}
+		if (swap && (width & 1)) put_pixel(row + 3 * i, row[3 * i], row[3 * i + 1], row[3 * i + 2], 1);
+	} else if (swap) {
+		for (i = 0; i < width; ++i) {
+			unsigned char *p = row + 3 * i;
+			unsigned char r = p[0];
+			p[0] = p[2];
+			p[2] = r;
+		}
+	}
+}
+
+//! Finish row y of the output and count it if it is sampled
+static void finish_output_row(unsigned char *row, int y, int width, int height, int flags,
+		struct yuv_brightness *brightness) {
+	int half = (y >= height / 2);
+	finish_row(row, width, flags);
+	if (brightness != NULL && y < 2 * (height / 2) && (y - half * (height / 2)) % YUV_BRIGHTNESS_STEP == 0)
+		count_row(row, width, brightness, half);
+}
+
+void yuyv_to_rgb_fused(unsigned char *rgb, const unsigned char *yuyv, int width, int height, int flags,
+		struct yuv_brightness *brightness) {
+	int y;
+	if (brightness != NULL) memset(brightness, 0, sizeof(*brightness));
+	for (y = 0; y < height; ++y) {
+		int out = (flags & YUV_FLIP_VERTICAL) ? height - 1 - y : y;
+		unsigned char *row = rgb + 3 * width * out;
+		yuyv_to_rgb(row, yuyv + 2 * width * y, width, 1);
+		finish_output_row(row, out, width, height, flags, brightness);
+	}
+}
+
+void rgb_finish(unsigned char *rgb, int width, int height, int flags, struct yuv_brightness *brightness) {
+	int y;
+	if (brightness != NULL) memset(brightness, 0, sizeof(*brightness));
+	for (y = 0; y < height; ++y) {
+		finish_output_row(rgb + 3 * width * y, y, width, height, flags, brightness);
+	}
+}
+
+/**
+ * Every YUYV macro pixel of the even rows becomes one RGB pixel with the average luminance of the two pixels. The odd
+ * rows are never read, which halves the memory traffic.
+ */
+void yuyv_to_rgb_half(unsigned char *rgb, const unsigned char *yuyv, int width, int height) {
+	int half_width = width / 2;
+	int x, y;
+	for (y = 0; y < height / 2; ++y) {
+		const unsigned char *p = yuyv + 2 * width * (2 * y);
+		unsigned char *out = rgb + 3 * half_width * y;
+		for (x = 0; x < half_width; ++x, p += 4, out += 3) {
+			yuv_pixel(out, (p[0] + p[2] + 1) >> 1, p[1], p[3]);
+		}
+	}
+}
+
+void yuyv_to_grey_half(unsigned char *grey, const unsigned char *yuyv, int width, int height) {
+	int half_width = width / 2;
+	int x, y;
+	for (y = 0; y < height / 2; ++y) {
+		const unsigned char *p = yuyv + 2 * width * (2 * y);
+		unsigned char *out = grey + half_width * y;
+		for (x = 0; x < half_width; ++x, p += 4) {
+			out[x] = yuv_grey((p[0] + p[2] + 1) >> 1);
+		}
+	}
+}
+
+/**
+ * The histogram only samples the frame, so it adds little to the conversion it follows. It reads the luminance bytes
+ * of the YUYV buffer while they are still in the cache.
+ */
+void yuyv_histogram(unsigned int *bins, const unsigned char *yuyv, int width, int height, int stride, int step) {
+	int x, y;
+	for (y = 0; y < height; y += step) {
+		const unsigned char *p = yuyv + stride * y;
+		for (x = 0; x < width; x += step) {
+			bins[yuv_grey(p[2 * x]) >> YUV_HISTOGRAM_SHIFT]++;
+		}
+	}
+}
+
+/**
+ * The green of a corrupt row is as saturated as a colour gets, a real scene hardly gives a row of it. Seven out of
+ * eight samples have to be without chrominance, so a few samples of noise do not hide a corrupt row.
+ */
+int yuyv_row_corrupt(const unsigned char *chroma, int width, int step) {
+	int samples = 0, empty = 0;
+	int x;
+	for (x = 0; x < width / 2; x += step, ++samples) {
+		empty += (chroma[4 * x] < YUV_CORRUPT_CHROMA && chroma[4 * x + 2] < YUV_CORRUPT_CHROMA);
+	}
+	return samples > 0 && 8 * empty >= 7 * samples;
+}
@@ -0,0 +1,105 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Conversion kernels from the YUYV frames of the camera driver
+ * @file yuvconvert.h
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 14, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#ifndef YUVCONVERT_H
+#define YUVCONVERT_H
+
+/**
+ * All kernels expect the Y0 U Y1 V byte order of V4L2_PIX_FMT_YUYV and use the same fixed-point coefficients as the
+ * YUV2R, YUV2G, and YUV2B macros in CCamera.cpp, so the vectorized paths (SSE2 or NEON, if the compiler targets them)
+ * give exactly the same values as the scalar path. The grey value is the full-range luminance, which is the value an
+ * RGB pixel would get for U = V = 128. The width has to be even.
+ */
+
+//! Flags of yuyv_to_rgb_fused, both flips together turn the frame upside down as FLIP_CAMERA does
+#define YUV_FLIP_VERTICAL   0x01
+#define YUV_FLIP_HORIZONTAL 0x02
+#define YUV_SWAP_RB         0x04
+
+//! Every so many pixels of every so many rows are counted in the brightness, as in CRawImage::getOverallBrightness
+#define YUV_BRIGHTNESS_STEP 5
+
+/**
+ * Brightness of the converted pixels, the same measure as CRawImage::getOverallBrightness, separately for the upper
+ * (index 0) and the lower half (index 1) of the output.
+ */
+struct yuv_brightness {
+	//! Sum of red, green and blue of the pixels that are counted
+	long long sum[2];
+	int pixels[2];
+	//! Pixels with all channels at or above 250
+	int saturated[2];
+	//! Pixels with all channels at or below 25
+	int dark[2];
+};
+
+//! Chrominance below which a sample counts as zero, a corrupt row has U = V = 0 and turns into a green line
+#define YUV_CORRUPT_CHROMA 8
+
+//! The grey values are shifted by this to get the bin of a histogram, so a histogram has 64 bins of 4 grey values
+#define YUV_HISTOGRAM_SHIFT 2
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//! Convert to RGB, 3 bytes per pixel
+void yuyv_to_rgb(unsigned char *rgb, const unsigned char *yuyv, int width, int height);
+
+/**
+ * Convert to RGB, flip and swap the channels according to the flags, and measure the brightness if it is not NULL, in
+ * one pass over the frame. Every row is converted straight to its final place and finished while it is in the cache.
+ */
+void yuyv_to_rgb_fused(unsigned char *rgb, const unsigned char *yuyv, int width, int height, int flags,
+		struct yuv_brightness *brightness);
+
+//! The same flip, swap and measurement on an RGB image that is already converted, except YUV_FLIP_VERTICAL
+void rgb_finish(unsigned char *rgb, int width, int height, int flags, struct yuv_brightness *brightness);
+
+//! Only take the luminance, 1 byte per pixel
+void yuyv_to_grey(unsigned char *grey, const unsigned char *yuyv, int width, int height);
+
+//! Convert to RGB at half the width and half the height, the output has (width/2)*(height/2) pixels
+void yuyv_to_rgb_half(unsigned char *rgb, const unsigned char *yuyv, int width, int height);
+
+//! Only take the luminance at half the width and half the height
+void yuyv_to_grey_half(unsigned char *grey, const unsigned char *yuyv, int width, int height);
+
+/**
+ * Check if nearly all sampled macro pixels of a row have no chrominance, which is what a row that the driver did not
+ * fill looks like, see YUV_CORRUPT_CHROMA. The chroma pointer points at the U of the first macro pixel of the row, so
+ * 1 byte after the start of a YUYV row. Every step-th macro pixel is sampled.
+ */
+int yuyv_row_corrupt(const unsigned char *chroma, int width, int step);
+
+//! Add the grey value of every step-th pixel of every step-th row to the bins, stride is the number of bytes per row
+void yuyv_histogram(unsigned int *bins, const unsigned char *yuyv, int width, int height, int stride, int step);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,205 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Record sensor frames, motor commands and detections at full rate into a ring that a thread writes to a file
+ * @file CFrameLog.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#include "CFrameLog.h"
+
+#include <iostream>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+uint64_t frameLogTime() {
+	struct timeval time;
+	gettimeofday(&time, NULL);
+	return (uint64_t) time.tv_sec * 1000000 + time.tv_usec;
+}
+
+CFrameLog::CFrameLog(int records) {
+	file = NULL;
+	running = false;
+	capacity = records;
+	ring.resize(capacity * FRAME_LOG_RECORD_SIZE, 0);
+	complete = new uint32_t[capacity];
+	for (int i = 0; i < capacity; i++) complete[i] = 0;
+	sequence = 0;
+	head = 0;
+	tail = 0;
+	drops = 0;
+}
+
+CFrameLog::~CFrameLog() {
+	close();
+	delete [] complete;
+}
+
+bool CFrameLog::open(const char *path) {
+	close();
+	file = fopen(path, "wb");
+	if (file == NULL) {
+		std::cerr << "CFrameLog: can not open " << path << std::endl;
+		return false;
+	}
+	FrameLogFileHeader header;
+	header.magic = FRAME_LOG_MAGIC;
+	header.version = FRAME_LOG_VERSION;
+	header.record_size = FRAME_LOG_RECORD_SIZE;
+	fwrite(&header, sizeof(header), 1, file);
+
+	running = true;
+	if (pthread_create(&thread, NULL, &CFrameLog::flushThread, this) != 0) {
+		std::cerr << "CFrameLog: can not start the thread that writes " << path << std::endl;
+		running = false;
+		fclose(file);
+		file = NULL;
+		return false;
+	}
+	return true;
+}
+
+void CFrameLog::close() {
+	if (file == NULL) return;
+	running = false;
+	pthread_join(thread, NULL);
+	// the appends that were under way when the thread stopped are complete by now
+	usleep(1000);
+	flush();
+	if (drops) std::cerr << "CFrameLog: dropped " << drops << " of " << sequence << " records" << std::endl;
+	fclose(file);
+	file = NULL;
+}
+
+/**
+ * The slot is claimed only if the thread wrote the record that was in it before, otherwise the record is dropped. The
+ * record is complete when the sequence is in its slot, the thread does not write it before.
+ */
+bool CFrameLog::append(uint8_t type, const void *data, uint16_t length, uint64_t timestamp) {
+	if (file == NULL) return false;
+	uint32_t number = __sync_fetch_and_add(&sequence, 1);
+	if (length > FRAME_LOG_PAYLOAD) length = FRAME_LOG_PAYLOAD;
+	uint32_t claimed;
+	do {
+		claimed = head;
+		if (claimed - tail >= (uint32_t)capacity) {
+			__sync_fetch_and_add(&drops, 1);
+			return false;
+		}
+	} while (!__sync_bool_compare_and_swap(&head, claimed, claimed + 1));
+
+	int slot = claimed % capacity;
+	uint8_t *record = &ring[slot * FRAME_LOG_RECORD_SIZE];
+	FrameLogRecordHeader header;
+	header.timestamp = timestamp ? timestamp : frameLogTime();
+	header.sequence = number;
+	header.type = type;
+	header.reserved = 0;
+	header.length = length;
+	memcpy(record, &header, sizeof(header));
+	memcpy(record + sizeof(header), data, length);
+	memset(record + sizeof(header) + length, 0, FRAME_LOG_PAYLOAD - length);
+	__sync_synchronize();
+	complete[slot] = claimed + 1;
+	return true;
+}
+
+void *CFrameLog::flushThread(void *log) {
+	CFrameLog *frameLog = (CFrameLog*) log;
+	while (frameLog->running) {
+		usleep(FRAME_LOG_FLUSH_PERIOD);
+		frameLog->flush();
+	}
+	return NULL;
+}
+
+/**
+ * The complete slots from the tail on are written in one go, up to the end of the ring, the rest in the next go. Only
+ * then the tail moves on and the slots can be claimed again.
+ */
+int CFrameLog::flush() {
+	int written = 0;
+	while (true) {
+		uint32_t first = tail;
+		uint32_t last = first;
+		while (last != head && complete[last % capacity] == last + 1 && (last == first || last % capacity != 0)) {
+			last++;
+		}
+		if (last == first) break;
+		__sync_synchronize();
+		int count = last - first;
+		fwrite(&ring[(first % capacity) * FRAME_LOG_RECORD_SIZE], FRAME_LOG_RECORD_SIZE, count, file);
+		written += count;
+		__sync_synchronize();
+		tail = last;
+	}
+	if (written) fflush(file);
+	return written;
+}
+
+CFrameLogReader::CFrameLogReader() {
+	file = NULL;
+	record_size = 0;
+}
+
+CFrameLogReader::~CFrameLogReader() {
+	close();
+}
+
+bool CFrameLogReader::open(const char *path) {
+	close();
+	file = fopen(path, "rb");
+	if (file == NULL) {
+		std::cerr << "CFrameLogReader: can not open " << path << std::endl;
+		return false;
+	}
+	FrameLogFileHeader header;
+	if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != FRAME_LOG_MAGIC ||
+			header.record_size < sizeof(FrameLogRecordHeader)) {
+		std::cerr << "CFrameLogReader: " << path << " is not a frame log" << std::endl;
+		close();
+		return false;
+	}
+	if (header.version != FRAME_LOG_VERSION) {
+		std::cerr << "CFrameLogReader: " << path << " has version " << header.version << ", expected " <<
+				FRAME_LOG_VERSION << std::endl;
+		close();
+		return false;
+	}
+	record_size = header.record_size;
+	record.resize(record_size);
+	return true;
+}
+
+void CFrameLogReader::close() {
+	if (file != NULL) fclose(file);
+	file = NULL;
+}
+
+bool CFrameLogReader::next(FrameLogRecordHeader &header, const uint8_t *&payload) {
+	if (file == NULL || fread(&record[0], record_size, 1, file) != 1) return false;
+	memcpy(&header, &record[0], sizeof(header));
+	if (header.length > record_size - sizeof(header)) header.length = record_size - sizeof(header);
+	payload = &record[sizeof(header)];
+	return true;
+}
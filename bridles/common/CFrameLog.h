@@ -0,0 +1,181 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Record sensor frames, motor commands and detections at full rate into a ring that a thread writes to a file
+ * @file CFrameLog.h
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#ifndef CFRAMELOG_H_
+#define CFRAMELOG_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+/**
+ * The file starts with a FrameLogFileHeader, followed by records of FRAME_LOG_RECORD_SIZE bytes, each a
+ * FrameLogRecordHeader and the payload, zero padded. A record that did not fit in the ring is not written, it leaves a
+ * gap in the sequence numbers. Fields are in host order, the robots and the laptops are all little-endian. The
+ * framelogcsv jockey turns a log into CSV files.
+ */
+
+#define FRAME_LOG_MAGIC 0x4C465145 // "EQFL"
+#define FRAME_LOG_VERSION 1
+#define FRAME_LOG_RECORD_SIZE 256
+//! Records the ring holds before the ones that come in are dropped
+#define FRAME_LOG_RECORDS 2048
+//! Period in us of the thread that writes the ring to the file
+#define FRAME_LOG_FLUSH_PERIOD 200000
+//! Infrared leds in a FrameLogIR
+#define FRAME_LOG_IR_COUNT 8
+
+typedef enum {
+	FRAME_LOG_IR = 1,
+	FRAME_LOG_MOTOR,
+	FRAME_LOG_DETECTION
+} EFrameLogType;
+
+struct FrameLogFileHeader {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t record_size;
+};
+
+struct FrameLogRecordHeader {
+	uint64_t timestamp; // us since the epoch
+	uint32_t sequence;
+	uint8_t type;
+	uint8_t reserved;
+	uint16_t length; // of the payload
+};
+
+#define FRAME_LOG_PAYLOAD (FRAME_LOG_RECORD_SIZE - sizeof(FrameLogRecordHeader))
+
+//! A frame of CLeds, the readings with the offsets subtracted and the averages of the modes that are enabled
+struct FrameLogIR {
+	int32_t reflective[FRAME_LOG_IR_COUNT];
+	int32_t ambient[FRAME_LOG_IR_COUNT];
+	int32_t proximity[FRAME_LOG_IR_COUNT];
+	int32_t average_reflective[FRAME_LOG_IR_COUNT];
+	int32_t average_ambient[FRAME_LOG_IR_COUNT];
+	int32_t average_proximity[FRAME_LOG_IR_COUNT];
+};
+
+//! The speeds CMotors sent to the wheels, with the pose of the odometry at that time in m and rad
+struct FrameLogMotor {
+	int32_t speed[3];
+	int32_t reserved;
+	double pose[3];
+};
+
+//! A detection of the camera, a frame without any gives one record with count 0
+struct FrameLogDetection {
+	uint32_t frame;
+	uint16_t count;
+	uint16_t index;
+	float x;
+	float y;
+	float z;
+	float phi;
+	float size;
+	float confidence;
+};
+
+//! Microseconds since the epoch, the clock of the timestamps in the log
+uint64_t frameLogTime();
+
+/**
+ * The sampler thread of the leds, the odometry thread of the motors and the main loop of a jockey all append to the
+ * same log. append() claims a slot of the ring with a compare-and-swap and copies the record into it, it does not take
+ * a lock or touch the file, and when the ring is full it drops the record instead of waiting. The thread of the log
+ * writes the slots that are complete every FRAME_LOG_FLUSH_PERIOD.
+ */
+class CFrameLog {
+public:
+	CFrameLog(int records = FRAME_LOG_RECORDS);
+
+	~CFrameLog();
+
+	//! Start a new log, an old file with the same path is overwritten
+	bool open(const char *path);
+
+	//! Write what is left in the ring and close the file
+	void close();
+
+	inline bool isOpen() const { return file != NULL; }
+
+	//! Append a record of at most FRAME_LOG_PAYLOAD bytes, a timestamp of 0 is now, false if it is dropped
+	bool append(uint8_t type, const void *data, uint16_t length, uint64_t timestamp = 0);
+
+	//! Records appended so far, the dropped ones included
+	inline uint32_t records() const { return sequence; }
+
+	inline uint32_t dropped() const { return drops; }
+
+private:
+	static void *flushThread(void *log);
+
+	//! Write the complete slots from tail on, returns the number written
+	int flush();
+
+	FILE *file;
+
+	pthread_t thread;
+	volatile bool running;
+
+	int capacity;
+	std::vector<uint8_t> ring;
+	//! Per slot the sequence of its record plus one, once the record is complete
+	volatile uint32_t *complete;
+
+	//! Counts every append(), so the records after a dropped one show the gap
+	volatile uint32_t sequence;
+	//! Slots claimed, and slots written to the file
+	volatile uint32_t head;
+	volatile uint32_t tail;
+	volatile uint32_t drops;
+};
+
+/**
+ * Reads a log record by record.
+ */
+class CFrameLogReader {
+public:
+	CFrameLogReader();
+
+	~CFrameLogReader();
+
+	bool open(const char *path);
+
+	void close();
+
+	//! The next record, payload stays valid until the next call, false at the end of the log
+	bool next(FrameLogRecordHeader &header, const uint8_t *&payload);
+
+private:
+	FILE *file;
+	uint16_t record_size;
+	std::vector<uint8_t> record;
+};
+
+#endif /* CFRAMELOG_H_ */
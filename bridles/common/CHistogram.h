@@ -28,79 +28,136 @@
 #define CHISTOGRAM_H_
 
 #include <vector>
-#include <functional>
-#include <numeric>
+#include <iostream>
 
-#include <dim1algebra.hpp>
+//! Kahan summation of x into sum, for integer types the compensation stays zero
+template <typename S>
+static inline void kahan_add(S & sum, S & compensation, S x) {
+	S y = x - compensation;
+	S t = sum + y;
+	compensation = (t - sum) - y;
+	sum = t;
+}
 
 /**
- * Histogram
+ * Histogram over a sliding window. The window is a ring, a push over a full window overwrites the oldest item, and
+ * the sum and the sum of squares are kept running, so push(), average() and variance() do not depend on the size of
+ * the window. The running sums use Kahan summation, for floating point items subtracting what leaves the window would
+ * otherwise let them drift away from the items that are in it. The squares are of the distance to the first item, so
+ * that the variance of items far from zero does not cancel out.
  */
 template <typename T, typename R>
 class CHistogram {
 public:
 	CHistogram() {
 		window_size = -1;
+		clear();
 	}
 
 	~CHistogram() {}
 
+	//! Set size of sliding window (-1 is no sliding window at all), the newest items are kept
 	void set_sliding_window(int window_size) {
-		if (data.size() > window_size) {
-			size_t remainder = data.size() - window_size;
-			data.erase(data.begin(), data.end() - remainder);
+		std::vector<T> items;
+		items.reserve(count);
+		for (size_t i = 0; i < count; ++i) {
+			items.push_back(at(i));
+		}
+		if (window_size >= 0 && items.size() > (size_t)window_size) {
+			items.erase(items.begin(), items.end() - window_size);
 		}
 		this->window_size = window_size;
+		clear();
+		data.reserve(window_size > 0 ? window_size : items.size());
+		for (size_t i = 0; i < items.size(); ++i) {
+			push(items[i]);
+		}
 	}
 
 	void push(T item) {
-		if (window_size == data.size()) {
-			dobots::pushpop(data.begin(), data.end(), item);
+		if (window_size == 0) return;
+		if (window_size > 0 && count == (size_t)window_size) {
+			T oldest = data[head];
+			accumulate(oldest, -1);
+			data[head] = item;
+			head = (head + 1) % count;
 		} else {
+			if (count == 0) shift = (double)item;
 			data.push_back(item);
+			count++;
 		}
+		accumulate(item, 1);
 	}
 
 	R average() {
 		if (empty()) return (R)0;
-		return (sum() / (R)data.size());
+		return (sum() / (R)count);
 	}
 
+	//! The sum of the squared deviations from the average, not divided by the number of items
 	R variance() {
 		if (empty()) return (R)0;
-		R avg = average();
-		R variance = R(0);
-		for (int i = 0; i < data.size(); ++i) {
-			variance += (data[i] - avg) * (data[i] - avg);
-		}
-		return variance;
+		double deviations = squares - shifted * shifted / count;
+		return deviations > 0 ? (R)deviations : (R)0;
 	}
 
 	T sum() {
-		T sum = T(0);
-		sum = std::accumulate(data.begin(), data.end(), sum);
-		return sum;
+		return sum_data;
 	}
 
 	bool empty() {
-		return data.size() == 0;
+		return count == 0;
 	}
 
 	void clear() {
-		data.erase(data.begin(), data.end());
+		data.clear();
+		head = 0;
+		count = 0;
+		sum_data = T(0);
+		sum_compensation = T(0);
+		shift = 0;
+		shifted = shifted_compensation = 0;
+		squares = squares_compensation = 0;
 	}
 
+	//! The items from the oldest to the newest
 	void print() {
-		std::cout << "histogram [" << data.size() << "]: ";
-		for (int i = 0; i < data.size(); ++i) {
-			std::cout << data[i] << ' ';
+		std::cout << "histogram [" << count << "]: ";
+		for (size_t i = 0; i < count; ++i) {
+			std::cout << at(i) << ' ';
 		}
 		std::cout << std::endl;
 	}
 private:
+	//! The ring, it only grows until it holds window_size items
 	std::vector<T> data;
+	//! Index of the oldest item, once the ring is full
+	size_t head;
+	size_t count;
 
 	int window_size;
+
+	T sum_data;
+	T sum_compensation;
+	//! The sums of the distances of the items to shift and of their squares
+	double shift;
+	double shifted;
+	double shifted_compensation;
+	double squares;
+	double squares_compensation;
+
+	//! Item i of the window, 0 is the oldest
+	inline T at(size_t i) const {
+		return data[(head + i) % count];
+	}
+
+	//! Add an item to the running sums with sign 1, or take it out of them with sign -1
+	inline void accumulate(T item, int sign) {
+		kahan_add(sum_data, sum_compensation, sign > 0 ? item : -item);
+		double d = (double)item - shift;
+		kahan_add(shifted, shifted_compensation, sign * d);
+		kahan_add(squares, squares_compensation, sign * d * d);
+	}
 };
 
 /**
@@ -0,0 +1,104 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Latency of a camera frame at every hop from the capture to the motor command it leads to
+ * @file CLatencyTrace.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+
+#include "CLatencyTrace.h"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/time.h>
+
+static TraceRecord trace_ring[TRACE_RING_SIZE];
+//! Number of records ever written, the next one goes to trace_count % TRACE_RING_SIZE
+static uint32_t trace_count = 0;
+//! The frame the actions follow from, and the last frame for which an action was recorded
+static uint64_t trace_followed = 0;
+static uint64_t trace_acted = 0;
+//! 64-bit atomics are not available on every robot, a lock is cheap at the rate of frames
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *trace_hop_names[TRACE_HOPS] = { "grabbed", "detected", "sent", "forwarded", "received", "used",
+		"motor" };
+
+uint64_t traceNow() {
+	struct timeval time;
+	gettimeofday(&time, NULL);
+	return (uint64_t)time.tv_sec * 1000000 + time.tv_usec;
+}
+
+static void traceAppend(uint64_t capture, int hop, uint64_t time) {
+	TraceRecord & record = trace_ring[trace_count % TRACE_RING_SIZE];
+	record.capture = capture;
+	record.time = time;
+	record.hop = hop;
+	trace_count++;
+}
+
+void traceHop(uint64_t capture, int hop) {
+	if (capture == 0 || hop < 0 || hop >= TRACE_HOPS) return;
+	uint64_t time = traceNow();
+	pthread_mutex_lock(&trace_mutex);
+	traceAppend(capture, hop, time);
+	pthread_mutex_unlock(&trace_mutex);
+}
+
+void traceFollow(uint64_t capture) {
+	if (capture == 0) return;
+	uint64_t time = traceNow();
+	pthread_mutex_lock(&trace_mutex);
+	trace_followed = capture;
+	traceAppend(capture, TRACE_USED, time);
+	pthread_mutex_unlock(&trace_mutex);
+}
+
+/**
+ * A consumer sets the speeds many times per detection, only the first time tells how long the frame took to act on.
+ */
+void traceAction(int hop) {
+	if (hop < 0 || hop >= TRACE_HOPS) return;
+	uint64_t time = traceNow();
+	pthread_mutex_lock(&trace_mutex);
+	if (trace_followed != 0 && trace_followed != trace_acted) {
+		trace_acted = trace_followed;
+		traceAppend(trace_followed, hop, time);
+	}
+	pthread_mutex_unlock(&trace_mutex);
+}
+
+int traceRecords(TraceRecord *records, int max) {
+	pthread_mutex_lock(&trace_mutex);
+	uint32_t count = (trace_count < TRACE_RING_SIZE) ? trace_count : TRACE_RING_SIZE;
+	if (max < 0) max = 0;
+	if (count > (uint32_t)max) count = max;
+	for (uint32_t i = 0; i < count; ++i) records[i] = trace_ring[(trace_count - count + i) % TRACE_RING_SIZE];
+	pthread_mutex_unlock(&trace_mutex);
+	return count;
+}
+
+const char *traceHopName(int hop) {
+	if (hop < 0 || hop >= TRACE_HOPS) return "unknown";
+	return trace_hop_names[hop];
+}
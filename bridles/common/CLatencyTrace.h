@@ -0,0 +1,87 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Latency of a camera frame at every hop from the capture to the motor command it leads to
+ * @file CLatencyTrace.h
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+
+#ifndef CLATENCYTRACE_H_
+#define CLATENCYTRACE_H_
+
+#include <stdint.h>
+
+/**
+ * A frame is traced by the time at which the camera handed it out, see CRawImage::captured. That time travels with
+ * the detections in the timestamp of DetectedBlobWSize, DetectedBlobWSizeArray and DetectionBatchHeader, so every
+ * process on the way records the hops it sees with it, and the records of the processes are joined on it:
+ *
+ *   cameradetection   TRACE_GRABBED, TRACE_DETECTED, TRACE_SENT
+ *   controller        TRACE_FORWARDED, when CJockey redirects or publishes the detection to another jockey
+ *   consumer          TRACE_RECEIVED in its receiving thread, TRACE_USED when its loop reads the detection and
+ *                     TRACE_MOTOR at the first CMotors::setSpeeds after that, see traceFollow()
+ *
+ * Every process keeps its last TRACE_RING_SIZE records in a ring, a MSG_TRACE_DUMP without payload asks a jockey, or
+ * the controller, for them. The times are in microseconds of the clock of gettimeofday, as CStageStats::now(), which
+ * all processes of a robot share. Recording takes a lock that is only held for a copy of the record.
+ */
+
+#ifndef TRACE_RING_SIZE
+#define TRACE_RING_SIZE 256
+#endif
+
+enum TraceHop {
+	TRACE_GRABBED = 0, //!< The camera converted the frame and handed it to its caller
+	TRACE_DETECTED, //!< The detector is done with the frame
+	TRACE_SENT, //!< The detections of the frame are sent
+	TRACE_FORWARDED, //!< The controller passed the detections on to another jockey
+	TRACE_RECEIVED, //!< The receiving thread of the consumer got the detections
+	TRACE_USED, //!< The loop of the consumer read the detections
+	TRACE_MOTOR, //!< The first speed set after the detections were used
+	TRACE_HOPS
+};
+
+struct TraceRecord {
+	uint64_t capture; //!< Time at which the frame was captured, the trace it belongs to
+	uint64_t time; //!< Time at which the hop was reached
+	uint8_t hop; //!< A TraceHop
+};
+
+//! Time in microseconds, the clock of all records
+uint64_t traceNow();
+
+//! Record that the frame captured at capture reached hop now, a capture of 0 is not traced
+void traceHop(uint64_t capture, int hop);
+
+//! Record TRACE_USED for the frame captured at capture, the actions of this process follow from it from now on
+void traceFollow(uint64_t capture);
+
+//! Record hop for the frame that is followed, only for the first action after traceFollow()
+void traceAction(int hop);
+
+//! Copy the newest records, at most max, the oldest first, returns how many were copied
+int traceRecords(TraceRecord *records, int max);
+
+//! Short name of a hop for printing
+const char *traceHopName(int hop);
+
+#endif /* CLATENCYTRACE_H_ */
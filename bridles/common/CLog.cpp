@@ -0,0 +1,175 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Assertions and logging that can be left out at compile time
+ * @file CLog.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#include "CLog.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define CLOG_NAME_SIZE 16
+
+struct ClogSlot {
+	//! The number of the message plus one, once it is complete
+	volatile uint32_t complete;
+	uint8_t module;
+	uint8_t level;
+	uint64_t time;
+	char text[CLOG_MESSAGE_SIZE];
+};
+
+volatile int clog_levels[CLOG_MODULES];
+
+static char clog_names[CLOG_MODULES][CLOG_NAME_SIZE];
+static int clog_module_count = 0;
+static pthread_mutex_t clog_module_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static ClogSlot clog_ring[CLOG_RING];
+static volatile uint32_t clog_head = 0;
+static volatile uint32_t clog_tail = 0;
+static volatile uint32_t clog_dropped = 0;
+//! Held while the ring is written out, by the thread or by clogFlush()
+static pthread_mutex_t clog_drain_mutex = PTHREAD_MUTEX_INITIALIZER;
+static FILE *clog_sink = NULL;
+
+static pthread_once_t clog_once = PTHREAD_ONCE_INIT;
+static pthread_t clog_thread;
+
+static const char *clog_level_names[] = { "emerg", "alert", "crit", "error", "warning", "notice", "info", "debug" };
+
+static void *clogThread(void *) {
+	while (true) {
+		usleep(CLOG_FLUSH_PERIOD);
+		clogFlush();
+	}
+	return NULL;
+}
+
+static void clogStart() {
+	char *path = getenv("CLOG_FILE");
+	if (path != NULL) clog_sink = fopen(path, "a");
+	if (clog_sink == NULL) clog_sink = stdout;
+	atexit(clogFlush);
+	if (pthread_create(&clog_thread, NULL, clogThread, NULL) != 0) {
+		std::cerr << "CLog: could not start the thread, messages are written when clogFlush() is called" << std::endl;
+	} else {
+		pthread_detach(clog_thread);
+	}
+}
+
+//! The level CLOG_LEVELS gives the module, or -1
+static int clogEnvironmentLevel(const char *name) {
+	char *levels = getenv("CLOG_LEVELS");
+	if (levels == NULL) return -1;
+	size_t length = strlen(name);
+	for (char *item = levels; item != NULL && *item; item = strchr(item, ',')) {
+		if (*item == ',') item++;
+		if (strncmp(item, name, length) == 0 && item[length] == '=') return atoi(item + length + 1);
+	}
+	return -1;
+}
+
+int clogModule(const char *name, int level) {
+	pthread_once(&clog_once, clogStart);
+	pthread_mutex_lock(&clog_module_mutex);
+	int module = 0;
+	while (module < clog_module_count && strncmp(clog_names[module], name, CLOG_NAME_SIZE - 1) != 0) module++;
+	if (module == clog_module_count) {
+		if (clog_module_count < CLOG_MODULES) {
+			clog_module_count++;
+			strncpy(clog_names[module], name, CLOG_NAME_SIZE - 1);
+			int environment = clogEnvironmentLevel(name);
+			clog_levels[module] = (environment >= 0) ? environment : level;
+		} else {
+			// the modules that do not fit share the last one
+			module = CLOG_MODULES - 1;
+		}
+	}
+	pthread_mutex_unlock(&clog_module_mutex);
+	return module;
+}
+
+void clogSetLevel(int module, int level) {
+	if (module >= 0 && module < CLOG_MODULES) clog_levels[module] = level;
+}
+
+void clogWrite(int module, int level, const char *format, ...) {
+	uint32_t claimed;
+	do {
+		claimed = clog_head;
+		if (claimed - clog_tail >= CLOG_RING) {
+			__sync_fetch_and_add(&clog_dropped, 1);
+			return;
+		}
+	} while (!__sync_bool_compare_and_swap(&clog_head, claimed, claimed + 1));
+
+	ClogSlot &slot = clog_ring[claimed % CLOG_RING];
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	slot.time = (uint64_t) now.tv_sec * 1000000 + now.tv_usec;
+	slot.module = module;
+	slot.level = level;
+	va_list arguments;
+	va_start(arguments, format);
+	vsnprintf(slot.text, CLOG_MESSAGE_SIZE, format, arguments);
+	va_end(arguments);
+	__sync_synchronize();
+	slot.complete = claimed + 1;
+}
+
+/**
+ * Writes the messages from the tail on up to the first one that is still being formatted, that one and the ones after
+ * it are written the next time.
+ */
+void clogFlush() {
+	pthread_mutex_lock(&clog_drain_mutex);
+	FILE *sink = (clog_sink != NULL) ? clog_sink : stdout;
+	uint32_t dropped = clog_dropped;
+	if (dropped) {
+		__sync_fetch_and_sub(&clog_dropped, dropped);
+		fprintf(sink, "CLog: dropped %u messages\n", dropped);
+	}
+	uint32_t tail = clog_tail;
+	while (tail != clog_head) {
+		ClogSlot &slot = clog_ring[tail % CLOG_RING];
+		if (slot.complete != tail + 1) break;
+		__sync_synchronize();
+		const char *level = (slot.level < 8) ? clog_level_names[slot.level] : "?";
+		size_t length = strlen(slot.text);
+		const char *newline = (length > 0 && slot.text[length - 1] == '\n') ? "" : "\n";
+		fprintf(sink, "%llu.%06llu %s %s: %s%s", (unsigned long long)(slot.time / 1000000),
+				(unsigned long long)(slot.time % 1000000), clog_names[slot.module], level, slot.text, newline);
+		tail++;
+		__sync_synchronize();
+		clog_tail = tail;
+	}
+	fflush(sink);
+	pthread_mutex_unlock(&clog_drain_mutex);
+}
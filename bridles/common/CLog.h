@@ -1,7 +1,7 @@
 /**
  * 456789------------------------------------------------------------------------------------------------------------120
  *
- * @brief ...
+ * @brief Assertions and logging that can be left out at compile time
  * @file CLog.h
  * 
  * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
@@ -27,19 +27,82 @@
 #ifndef CLOG_H_
 #define CLOG_H_
 
+#include <cassert>
+#include <iostream>
+#include <stdint.h>
+#include <syslog.h> // log-levels
+
+/**
+ * Logging for loops that run for every frame or sample. A message above CLOG_LEVEL is not compiled in at all, define it
+ * in CXXDEFINE of a jockey, for example -DCLOG_LEVEL=LOG_NOTICE for a robot in production. Above the level of its
+ * module, which can be changed while running, a message costs one comparison. Otherwise it is formatted into a slot
+ * of a ring, claimed with a compare-and-swap, and a thread writes the ring to stdout, or to the file in the environment
+ * variable CLOG_FILE, every CLOG_FLUSH_PERIOD. When the ring is full the message is dropped, the thread writes how
+ * many were.
+ *
+ *   static int camera_log = clogModule("camera");
+ *   CLOG(camera_log, LOG_DEBUG, "Borrowed frame %i", index);
+ */
+
+#ifndef CLOG_LEVEL
+#define CLOG_LEVEL LOG_DEBUG
+#endif
+
+//! Modules that can be registered
+#define CLOG_MODULES 32
+//! Messages in the ring, and the length of a message, a longer one is cut
+#define CLOG_RING 256
+#define CLOG_MESSAGE_SIZE 120
+//! Period in us of the thread that writes the ring
+#define CLOG_FLUSH_PERIOD 50000
+
+//! The runtime level of every module, messages above it are not written
+extern volatile int clog_levels[CLOG_MODULES];
+
+/**
+ * The module with this name, the same name gives the same module. It starts at level, unless the environment variable
+ * CLOG_LEVELS sets it, for example CLOG_LEVELS=camera=7,leds=6.
+ */
+int clogModule(const char *name, int level = LOG_NOTICE);
+
+void clogSetLevel(int module, int level);
+
+static inline bool clogEnabled(int module, int level) { return level <= clog_levels[module]; }
+
+//! Use CLOG() instead, so the message is left out at compile time
+void clogWrite(int module, int level, const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+//! Write what is in the ring now, without waiting for the thread
+void clogFlush();
+
+#define CLOG(module, level, ...) do { \
+	if ((level) <= CLOG_LEVEL && clogEnabled(module, level)) clogWrite(module, level, __VA_ARGS__); \
+	} while (0)
+
+//! dim1algebra.hpp has the same one, both are left out with NDEBUG, as in a release
+#ifndef ASSERT
+#ifdef NDEBUG
+#define ASSERT(condition) {}
+#else
 #define ASSERT(condition) { \
 	if(!(condition)){ \
 		std::cerr << "ASSERT FAILED: " << #condition << " @ " << __FILE__ << " (" << __LINE__ << ")" << std::endl; \
 		assert(condition); \
 	} \
 	}
+#endif
+#endif
 
+#ifdef NDEBUG
+#define ASSERT_EQUAL(x,y)
+#else
 #define ASSERT_EQUAL(x,y) \
 	if (x != y) { \
 		std::cerr << "ASSERT FAILED: " << #x << " != " << #y ", specifically: " << x << " != " << y << " @ "  \
 		<< __FILE__ << " (" << __LINE__ << ")" << std::endl; \
 		assert(x == y); \
 	}
+#endif
 
 
 #endif /* CLOG_H_ */
@@ -0,0 +1,155 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Memory accounted per subsystem, and the resident size of the process
+ * @file CMemStats.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#include "CMemStats.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct MemModule {
+	char name[MEM_NAME_SIZE];
+	volatile uint32_t current;
+	volatile uint32_t peak;
+	volatile uint32_t allocations;
+	volatile uint32_t budget;
+	volatile uint32_t over_budget;
+};
+
+static MemModule mem_modules[MEM_MODULES];
+static int mem_module_count = 0;
+static pthread_mutex_t mem_module_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+//! The highest resident size of all samples, in kB
+static volatile uint32_t mem_peak_rss = 0;
+
+//! A number in kB, or in bytes for a module, from the environment variable, or 0
+static uint32_t memEnvironmentBudget(const char *variable, const char *name) {
+	char *budgets = getenv(variable);
+	if (budgets == NULL) return 0;
+	if (name == NULL) return strtoul(budgets, NULL, 10);
+	size_t length = strlen(name);
+	for (char *item = budgets; item != NULL && *item; item = strchr(item, ',')) {
+		if (*item == ',') item++;
+		if (strncmp(item, name, length) == 0 && item[length] == '=') return strtoul(item + length + 1, NULL, 10);
+	}
+	return 0;
+}
+
+int memModule(const char *name) {
+	pthread_mutex_lock(&mem_module_mutex);
+	int module = 0;
+	while (module < mem_module_count && strncmp(mem_modules[module].name, name, MEM_NAME_SIZE - 1) != 0) module++;
+	if (module == mem_module_count) {
+		if (mem_module_count < MEM_MODULES) {
+			strncpy(mem_modules[module].name, name, MEM_NAME_SIZE - 1);
+			mem_modules[module].budget = memEnvironmentBudget("MEM_BUDGETS", name);
+			mem_module_count++;
+		} else {
+			// the modules that do not fit share the last one
+			module = MEM_MODULES - 1;
+		}
+	}
+	pthread_mutex_unlock(&mem_module_mutex);
+	return module;
+}
+
+void memAllocated(int module, uint32_t size) {
+	if (module < 0 || module >= MEM_MODULES) return;
+	MemModule &m = mem_modules[module];
+	__sync_fetch_and_add(&m.allocations, 1);
+	uint32_t current = __sync_add_and_fetch(&m.current, size);
+	uint32_t peak;
+	do {
+		peak = m.peak;
+	} while (current > peak && !__sync_bool_compare_and_swap(&m.peak, peak, current));
+	if (m.budget && current > m.budget) {
+		if (__sync_fetch_and_add(&m.over_budget, 1) == 0) {
+			fprintf(stderr, "CMemStats: %s is over its budget with %u of %u bytes\n", m.name, current, m.budget);
+		}
+	}
+	if (size >= MEM_SAMPLE_SIZE) {
+		MemProcessStats stats;
+		memSampleProcess(stats);
+	}
+}
+
+void memFreed(int module, uint32_t size) {
+	if (module < 0 || module >= MEM_MODULES) return;
+	__sync_fetch_and_sub(&mem_modules[module].current, size);
+}
+
+void memSetBudget(int module, uint32_t budget) {
+	if (module >= 0 && module < MEM_MODULES) mem_modules[module].budget = budget;
+}
+
+int memStats(MemModuleStats *stats, int max) {
+	pthread_mutex_lock(&mem_module_mutex);
+	int count = (mem_module_count < max) ? mem_module_count : max;
+	for (int i = 0; i < count; ++i) {
+		MemModule &m = mem_modules[i];
+		memcpy(stats[i].name, m.name, MEM_NAME_SIZE);
+		stats[i].current = m.current;
+		stats[i].peak = m.peak;
+		stats[i].allocations = m.allocations;
+		stats[i].budget = m.budget;
+		stats[i].over_budget = m.over_budget;
+	}
+	pthread_mutex_unlock(&mem_module_mutex);
+	return count;
+}
+
+/**
+ * The kernel keeps the peak of the resident size itself as VmHWM, the peak of the samples is only needed on kernels
+ * that do not have it.
+ */
+void memSampleProcess(MemProcessStats & stats) {
+	memset(&stats, 0, sizeof(stats));
+	static uint32_t budget = memEnvironmentBudget("MEM_BUDGET", NULL);
+	stats.budget_kb = budget;
+	FILE *status = fopen("/proc/self/status", "r");
+	if (status == NULL) return;
+	char line[128];
+	unsigned int value;
+	while (fgets(line, sizeof(line), status) != NULL) {
+		if (sscanf(line, "VmRSS: %u", &value) == 1) stats.rss_kb = value;
+		else if (sscanf(line, "VmHWM: %u", &value) == 1) stats.peak_rss_kb = value;
+		else if (sscanf(line, "VmSize: %u", &value) == 1) stats.vm_kb = value;
+	}
+	fclose(status);
+	uint32_t peak;
+	do {
+		peak = mem_peak_rss;
+	} while (stats.rss_kb > peak && !__sync_bool_compare_and_swap(&mem_peak_rss, peak, stats.rss_kb));
+	if (stats.peak_rss_kb < mem_peak_rss) stats.peak_rss_kb = mem_peak_rss;
+	if (budget && stats.rss_kb > budget) {
+		static volatile uint32_t warned = 0;
+		if (__sync_fetch_and_add(&warned, 1) == 0) {
+			fprintf(stderr, "CMemStats: the process is over its budget with %u of %u kB\n", stats.rss_kb, budget);
+		}
+	}
+}
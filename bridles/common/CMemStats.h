@@ -0,0 +1,94 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Memory accounted per subsystem, and the resident size of the process
+ * @file CMemStats.h
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#ifndef CMEMSTATS_H_
+#define CMEMSTATS_H_
+
+#include <stdint.h>
+
+/**
+ * Counters of the large buffers of a subsystem, such as the detector of cameradetection, the image pool, or the
+ * buffers of the IPC connections. Only the buffers that matter are counted, where they are allocated and freed, so the
+ * cost is two atomic additions per buffer. Next to it the resident size of the process is read from /proc, this also
+ * covers the static arrays and the libraries. A jockey answers MSG_MEM_STATS with both.
+ *
+ *   static int detect_memory = memModule("detect");
+ *   buffer = (int*)malloc(size);
+ *   memAllocated(detect_memory, size);
+ *
+ * A budget in bytes per module can be given with the environment variable MEM_BUDGETS, for example
+ * MEM_BUDGETS=detect=2000000,image=8000000, and one in kB for the resident size of the process with MEM_BUDGET. Going
+ * over a budget is counted and written to stderr the first time, nothing is refused.
+ */
+
+//! Modules that can be registered
+#define MEM_MODULES 16
+#define MEM_NAME_SIZE 16
+//! Allocations of this many bytes or more also sample the resident size, so its peak is not missed
+#define MEM_SAMPLE_SIZE 65536
+
+struct MemModuleStats {
+	char name[MEM_NAME_SIZE];
+	//! Bytes that are allocated now, and the most that were
+	uint32_t current;
+	uint32_t peak;
+	//! The number of memAllocated() calls
+	uint32_t allocations;
+	//! Bytes, 0 if there is no budget
+	uint32_t budget;
+	//! The number of allocations after which current was over the budget
+	uint32_t over_budget;
+};
+
+struct MemProcessStats {
+	//! Resident size now, and the most seen by the kernel or by a sample, in kB
+	uint32_t rss_kb;
+	uint32_t peak_rss_kb;
+	//! Virtual size in kB
+	uint32_t vm_kb;
+	//! Budget of the resident size in kB, 0 if there is none
+	uint32_t budget_kb;
+};
+
+/**
+ * The module with this name, the same name gives the same module. Its budget is taken from MEM_BUDGETS, or 0.
+ */
+int memModule(const char *name);
+
+void memAllocated(int module, uint32_t size);
+
+void memFreed(int module, uint32_t size);
+
+//! Set the budget of a module in bytes, 0 to have none
+void memSetBudget(int module, uint32_t budget);
+
+//! Copy the statistics of at most max modules, returns how many were copied
+int memStats(MemModuleStats *stats, int max);
+
+//! Read the resident size of the process, on a system without /proc the sizes are 0
+void memSampleProcess(MemProcessStats & stats);
+
+#endif /* CMEMSTATS_H_ */
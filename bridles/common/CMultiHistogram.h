@@ -33,37 +33,36 @@
  * A histogram is a nice object to use to smooth for example the subsequent sensor inputs of a given sensor. However, if
  * there are multiple sensors, it is convenient to have an object that contains a bunch of these histograms and which
  * can be used to set configuration options for all of them at once.
+ *
+ * The histograms are the rows of one matrix of channels times the sliding window, every row is a ring like the one of
+ * CHistogram, with its running sums next to those of the other rows. So a frame of all sensors is pushed with one
+ * call, and the averages of all of them are one pass over an array. Without a sliding window the items are not kept,
+ * only their sums, a later set_sliding_window() then starts from empty histograms.
  */
 template <typename T, typename R>
 class CMultiHistogram {
 public:
 	//! Construct a collection of histograms, the sliding window has to be set still
-	CMultiHistogram(): window_size(-1) {}
+	CMultiHistogram(): channels(0), window_size(-1) {}
 
 	//! Construct a collection of histograms with given sliding window
-	CMultiHistogram(int sliding_window) {
-		set_sliding_window(window_size);
+	CMultiHistogram(int sliding_window): channels(0), window_size(-1) {
+		set_sliding_window(sliding_window);
 	}
 
-	//! The deconstructor deletes the collection including the allocated histograms themselves
-	~CMultiHistogram() {
-		for (int i = 0; i < histograms.size(); ++i)
-			delete histograms[i];
-		histograms.clear();
-	}
+	~CMultiHistogram() {}
 
 	//! Add histogram
 	void add(int n = 1) {
-		for (int i = 0; i < n; ++i)
-			histograms.push_back(new CHistogram<T,R>());
+		resize(channels + n, window_size);
 	}
 
-	//! Set size of sliding window (-1 is no sliding window at all, risking overflow)
+	//! Number of histograms
+	inline int size() const { return channels; }
+
+	//! Set size of sliding window (-1 is no sliding window at all, risking overflow), the newest items are kept
 	void set_sliding_window(int window_size) {
-		this->window_size = window_size;
-		for (int i = 0; i < histograms.size(); ++i) {
-			histograms[i]->set_sliding_window(window_size);
-		}
+		resize(channels, window_size);
 	}
 
 	//! Gets size of sliding window
@@ -71,25 +70,63 @@ public:
 
 	//! Push an item unto histogram i
 	void push(int i, T item) {
-		histograms[i]->push(item);
+		if (window_size == 0) return;
+		if (window_size > 0) {
+			T *row = &data[i * window_size];
+			if (count[i] == window_size) {
+				accumulate(i, row[head[i]], -1);
+				row[head[i]] = item;
+				if (++head[i] == window_size) head[i] = 0;
+			} else {
+				row[count[i]] = item;
+				count[i]++;
+			}
+		} else {
+			count[i]++;
+		}
+		if (count[i] == 1) shift[i] = (double)item;
+		accumulate(i, item, 1);
+	}
+
+	/**
+	 * Push a frame with an item for every histogram, in the order of the histograms.
+	 *
+	 * @template InputIterator         any iterator that defines the ++ operator
+	 * @param frame                    pointer to the item of the first histogram
+	 * @return                         pointer to entry beyond the item of the last histogram
+	 */
+	template<typename InputIterator>
+	InputIterator push(InputIterator frame) {
+		for (int i = 0; i < channels; ++i, ++frame) {
+			push(i, *frame);
+		}
+		return frame;
 	}
 
 	//! Get average of histogram i
 	R average(int i) {
-		return histograms[i]->average();
+		if (count[i] == 0) return (R)0;
+		return (sums[i] / (R)count[i]);
 	}
 
+	//! The sum of the squared deviations from the average of histogram i, not divided by the number of items
 	R variance(int i) {
-		return histograms[i]->variance();
+		if (count[i] == 0) return (R)0;
+		double deviations = squares[i] - shifted[i] * shifted[i] / count[i];
+		return deviations > 0 ? (R)deviations : (R)0;
 	}
 
 	//! Get sum of histogram i
 	T sum(int i) {
-		return histograms[i].sum();
+		return sums[i];
 	}
 
 	void clear(int i) {
-		histograms[i]->clear();
+		head[i] = 0;
+		count[i] = 0;
+		sums[i] = sum_compensation[i] = T(0);
+		shift[i] = shifted[i] = shifted_compensation[i] = 0;
+		squares[i] = squares_compensation[i] = 0;
 	}
 
 	/**
@@ -104,18 +141,80 @@ public:
 	 */
 	template<typename OutputIterator>
 	OutputIterator average(OutputIterator result) {
-		for (int i = 0; i < histograms.size(); ++i, ++result) {
-			*result = histograms[i]->average();
+		for (int i = 0; i < channels; ++i, ++result) {
+			*result = count[i] == 0 ? (R)0 : (R)(sums[i] / (R)count[i]);
 		}
 		return result;
 	}
 
 private:
-	//! Internally, we use a vector of pointers to histograms
-	std::vector<CHistogram<T,R>* > histograms;
+	int channels;
 
 	//! Window size is defined across all histograms
 	int window_size;
+
+	//! The rings, row i of window_size items is histogram i
+	std::vector<T> data;
+	//! Per histogram the index of its oldest item, once its ring is full, and the number of items
+	std::vector<int> head;
+	std::vector<int> count;
+	//! Per histogram the running sums, see CHistogram
+	std::vector<T> sums;
+	std::vector<T> sum_compensation;
+	std::vector<double> shift;
+	std::vector<double> shifted;
+	std::vector<double> shifted_compensation;
+	std::vector<double> squares;
+	std::vector<double> squares_compensation;
+
+	//! Add an item to the running sums of histogram i with sign 1, or take it out of them with sign -1
+	inline void accumulate(int i, T item, int sign) {
+		kahan_add(sums[i], sum_compensation[i], sign > 0 ? item : -item);
+		double d = (double)item - shift[i];
+		kahan_add(shifted[i], shifted_compensation[i], sign * d);
+		kahan_add(squares[i], squares_compensation[i], sign * d * d);
+	}
+
+	//! Change the number of histograms or the sliding window, the newest items of the histograms are pushed again
+	void resize(int channels, int window_size) {
+		if (window_size < 0 && this->window_size < 0) {
+			// nothing is kept but the sums, new histograms are empty
+			int old = this->channels;
+			this->channels = channels;
+			head.resize(channels);
+			count.resize(channels);
+			sums.resize(channels);
+			sum_compensation.resize(channels);
+			shift.resize(channels);
+			shifted.resize(channels);
+			shifted_compensation.resize(channels);
+			squares.resize(channels);
+			squares_compensation.resize(channels);
+			for (int i = old; i < channels; ++i) clear(i);
+			return;
+		}
+		std::vector<std::vector<T> > items(channels);
+		if (this->window_size > 0) {
+			for (int i = 0; i < this->channels && i < channels; ++i) {
+				int n = count[i];
+				if (window_size >= 0 && n > window_size) n = window_size;
+				const T *row = &data[i * this->window_size];
+				for (int j = count[i] - n; j < count[i]; ++j) {
+					items[i].push_back(row[(head[i] + j) % this->window_size]);
+				}
+			}
+		}
+		this->channels = 0;
+		this->window_size = -1;
+		resize(channels, -1);
+		this->window_size = window_size;
+		data.assign(window_size > 0 ? channels * window_size : 0, T(0));
+		for (int i = 0; i < channels; ++i) {
+			for (size_t j = 0; j < items[i].size(); ++j) {
+				push(i, items[i][j]);
+			}
+		}
+	}
 };
 
 #endif /* CMULTIHISTOGRAM_H_ */
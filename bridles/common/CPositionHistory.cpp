@@ -0,0 +1,170 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Timestamped history of position fixes that can be read without locks
+ * @file CPositionHistory.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+
+#include "CPositionHistory.h"
+
+#include <string.h>
+
+//! Fence the copy of the reader, a full barrier, also for the compiler
+#define POSITION_BARRIER() __sync_synchronize()
+
+CPositionHistory::CPositionHistory(): sequence(0), count(0), velocityKnown(false) {
+	memset(fixes, 0, sizeof(fixes));
+	memset(velocity, 0, sizeof(velocity));
+}
+
+void CPositionHistory::push(float x, float y, float z, int64_t time, uint32_t stamp) {
+	__sync_fetch_and_add(&sequence, 1);
+	PositionFix & fix = fixes[count % POSITION_HISTORY_SIZE];
+	fix.x = x;
+	fix.y = y;
+	fix.z = z;
+	fix.time = time;
+	fix.stamp = stamp;
+	count++;
+	fitVelocity();
+	__sync_fetch_and_add(&sequence, 1);
+}
+
+void CPositionHistory::clear() {
+	__sync_fetch_and_add(&sequence, 1);
+	count = 0;
+	velocityKnown = false;
+	__sync_fetch_and_add(&sequence, 1);
+}
+
+/**
+ * The times are taken relative to the last fix, in seconds, so the sums do not lose the precision of a float.
+ */
+void CPositionHistory::fitVelocity() {
+	const PositionFix & last = fixes[(count - 1) % POSITION_HISTORY_SIZE];
+	int n = 0;
+	double st = 0, stt = 0, sp[3] = { 0, 0, 0 }, stp[3] = { 0, 0, 0 };
+	uint32_t available = (count < POSITION_HISTORY_SIZE) ? count : POSITION_HISTORY_SIZE;
+	for (uint32_t i = 0; i < available; ++i) {
+		const PositionFix & fix = fixes[(count - 1 - i) % POSITION_HISTORY_SIZE];
+		if (last.time - fix.time > POSITION_VELOCITY_WINDOW) break;
+		double t = (fix.time - last.time) / 1e9;
+		double p[3] = { fix.x, fix.y, fix.z };
+		st += t;
+		stt += t * t;
+		for (int k = 0; k < 3; ++k) {
+			sp[k] += p[k];
+			stp[k] += t * p[k];
+		}
+		n++;
+	}
+	double denominator = n * stt - st * st;
+	velocityKnown = (n >= 2 && denominator > 1e-9);
+	for (int k = 0; k < 3; ++k) {
+		velocity[k] = velocityKnown ? (float) ((n * stp[k] - st * sp[k]) / denominator) : 0;
+	}
+}
+
+bool CPositionHistory::getLatest(PositionFix & result) {
+	uint32_t begin;
+	bool known;
+	do {
+		begin = sequence;
+		POSITION_BARRIER();
+		known = (count > 0);
+		if (known) result = fixes[(count - 1) % POSITION_HISTORY_SIZE];
+		POSITION_BARRIER();
+	} while ((begin & 1) || begin != sequence);
+	return known;
+}
+
+bool CPositionHistory::getVelocity(float & vx, float & vy, float & vz) {
+	uint32_t begin;
+	bool known;
+	do {
+		begin = sequence;
+		POSITION_BARRIER();
+		known = velocityKnown;
+		vx = velocity[0];
+		vy = velocity[1];
+		vz = velocity[2];
+		POSITION_BARRIER();
+	} while ((begin & 1) || begin != sequence);
+	return known;
+}
+
+uint32_t CPositionHistory::getCount() {
+	return sequence / 2;
+}
+
+/**
+ * Before the oldest fix that is kept the oldest one is returned. Past the last fix the position moves on with the
+ * fitted velocity, for at most POSITION_MAX_EXTRAPOLATION.
+ */
+bool CPositionHistory::getPositionAt(int64_t time, PositionFix & result) {
+	uint32_t begin;
+	bool known;
+	PositionFix before, after;
+	bool bracketed;
+	float v[3] = { 0, 0, 0 };
+	memset(&before, 0, sizeof(before));
+	memset(&after, 0, sizeof(after));
+	do {
+		begin = sequence;
+		POSITION_BARRIER();
+		known = (count > 0);
+		bracketed = false;
+		if (known) {
+			uint32_t available = (count < POSITION_HISTORY_SIZE) ? count : POSITION_HISTORY_SIZE;
+			after = fixes[(count - 1) % POSITION_HISTORY_SIZE];
+			before = after;
+			for (uint32_t i = 1; i < available && before.time > time; ++i) {
+				after = before;
+				before = fixes[(count - 1 - i) % POSITION_HISTORY_SIZE];
+				bracketed = true;
+			}
+			v[0] = velocityKnown ? velocity[0] : 0;
+			v[1] = velocityKnown ? velocity[1] : 0;
+			v[2] = velocityKnown ? velocity[2] : 0;
+		}
+		POSITION_BARRIER();
+	} while ((begin & 1) || begin != sequence);
+	if (!known) return false;
+
+	result = before;
+	result.time = time;
+	if (bracketed && before.time <= time && after.time > before.time) {
+		float f = (float) (time - before.time) / (float) (after.time - before.time);
+		result.x = before.x + f * (after.x - before.x);
+		result.y = before.y + f * (after.y - before.y);
+		result.z = before.z + f * (after.z - before.z);
+	} else if (!bracketed && time > before.time) {
+		int64_t ahead = time - before.time;
+		if (ahead > POSITION_MAX_EXTRAPOLATION) ahead = POSITION_MAX_EXTRAPOLATION;
+		float dt = ahead / 1e9f;
+		result.x = before.x + v[0] * dt;
+		result.y = before.y + v[1] * dt;
+		result.z = before.z + v[2] * dt;
+	}
+	return true;
+}
@@ -0,0 +1,102 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Timestamped history of position fixes that can be read without locks
+ * @file CPositionHistory.h
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+
+#ifndef CPOSITIONHISTORY_H_
+#define CPOSITIONHISTORY_H_
+
+#include <stdint.h>
+
+//! Number of fixes that are kept, a fix at 4 Hz is then about 4 seconds old before it is overwritten
+#ifndef POSITION_HISTORY_SIZE
+#define POSITION_HISTORY_SIZE 16
+#endif
+
+//! The velocity is fitted through the fixes of this last period in ns
+#ifndef POSITION_VELOCITY_WINDOW
+#define POSITION_VELOCITY_WINDOW 1000000000LL
+#endif
+
+//! A position is not extrapolated further than this in ns past the last fix, a lost tag does not drift away
+#ifndef POSITION_MAX_EXTRAPOLATION
+#define POSITION_MAX_EXTRAPOLATION 1000000000LL
+#endif
+
+//! A position in m at a time in ns on the monotonic clock, see CTimer::now(), stamp is the time stamp of the source
+struct PositionFix {
+	float x;
+	float y;
+	float z;
+	int64_t time;
+	uint32_t stamp;
+};
+
+/**
+ * The history of the last POSITION_HISTORY_SIZE fixes of a position sensor such as Ubisense. One thread adds the fixes
+ * as they come in, any number of threads read them without a lock: the fixes are guarded by a sequence counter that is
+ * odd while a fix is written, a reader copies what it needs and tries again when the counter changed meanwhile. So a
+ * reader never blocks the thread that receives the fixes and the other way around.
+ *
+ * The fixes are stamped with the time they are received on this robot, so they can be compared to the odometry and the
+ * camera. getPositionAt() interpolates between the two fixes around a time, or extrapolates with the velocity beyond
+ * the last one, which is the best estimate of where the robot is now given the fixes arrive late and seldom. It costs
+ * at most POSITION_HISTORY_SIZE steps, whatever the time asked for.
+ */
+class CPositionHistory {
+public:
+	CPositionHistory();
+
+	//! Add a fix, only from a single thread, the fixes come in order of time
+	void push(float x, float y, float z, int64_t time, uint32_t stamp = 0);
+
+	//! Forget all fixes, from the thread that pushes
+	void clear();
+
+	//! The last fix, false if there is none
+	bool getLatest(PositionFix & fix);
+
+	//! The velocity in m/s fitted through the last fixes, false if there are not enough of them
+	bool getVelocity(float & vx, float & vy, float & vz);
+
+	//! The estimate of the position at a time in ns, false if there is no fix yet
+	bool getPositionAt(int64_t time, PositionFix & fix);
+
+	//! Goes up with every fix that is pushed, so a reader can see whether a new one came in
+	uint32_t getCount();
+
+private:
+	//! Least squares fit of the velocity through the fixes of the last POSITION_VELOCITY_WINDOW, by the writer
+	void fitVelocity();
+
+	volatile uint32_t sequence;
+
+	PositionFix fixes[POSITION_HISTORY_SIZE];
+	uint32_t count;
+	bool velocityKnown;
+	float velocity[3];
+};
+
+#endif /* CPOSITIONHISTORY_H_ */
@@ -0,0 +1,62 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Index of the virtual robot a process belongs to, so several robots can share one host
+ * @file CRobotIndex.h
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Testing
+ */
+
+
+#ifndef CROBOTINDEX_H_
+#define CROBOTINDEX_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * A virtual robot is a CEquids with its jockeys on a host that runs more of them, see bridles/host/CVirtualWorld.h.
+ * Its processes get its index in the environment variable EQUIDS_ROBOT, so they take ports and shared memory segments
+ * of their own: the jockeys of robot n listen on the ports from 50000 + n * ROBOT_PORT_STRIDE on, and a segment such
+ * as /equids_pose is called /equids_pose_n. On a real robot the variable is not set, the index is 0 and nothing
+ * changes.
+ */
+
+//! Ports of one robot, more than the MAX_JOCKEYS of CEquids
+#define ROBOT_PORT_STRIDE 100
+
+//! The first port of the jockeys of a robot
+#define ROBOT_PORT_BASE 50000
+
+//! Index of the virtual robot from EQUIDS_ROBOT, 0 on a real robot
+static inline int robotIndex() {
+	const char *text = getenv("EQUIDS_ROBOT");
+	return (text != NULL) ? atoi(text) : 0;
+}
+
+//! The name of a shared memory segment of this robot, written into name which holds size bytes, returns name
+static inline const char *segmentName(const char *base, char *name, size_t size) {
+	int robot = robotIndex();
+	if (robot > 0) snprintf(name, size, "%s_%i", base, robot);
+	else snprintf(name, size, "%s", base);
+	return name;
+}
+
+#endif /* CROBOTINDEX_H_ */
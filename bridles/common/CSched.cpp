@@ -0,0 +1,151 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Cores, scheduling class and priority of processes and threads
+ * @file CSched.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#include "CSched.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+//! Longest setting in THREAD_SCHED
+#define SCHED_TEXT_SIZE 64
+
+//! Parse cores such as 1, 2-3 or 0+2, up to the end or a ':'
+static bool schedParseCpus(const char *text, cpu_set_t & cpus) {
+	CPU_ZERO(&cpus);
+	if (*text == '*') {
+		for (int i = 0; i < CPU_SETSIZE; ++i) CPU_SET(i, &cpus);
+		return true;
+	}
+	while (*text && *text != ':') {
+		char *end;
+		long first = strtol(text, &end, 10);
+		if (end == text || first < 0 || first >= CPU_SETSIZE) return false;
+		long last = first;
+		if (*end == '-') {
+			text = end + 1;
+			last = strtol(text, &end, 10);
+			if (end == text || last < first || last >= CPU_SETSIZE) return false;
+		}
+		for (long i = first; i <= last; ++i) CPU_SET(i, &cpus);
+		text = end;
+		if (*text == '+') text++;
+		else if (*text && *text != ':') return false;
+	}
+	return CPU_COUNT(&cpus) > 0;
+}
+
+static bool schedParseClass(const char *text, size_t length, int & policy) {
+	static const char *names[] = { "other", "batch", "idle", "fifo", "rr" };
+#ifdef SCHED_IDLE
+	static const int policies[] = { SCHED_OTHER, SCHED_BATCH, SCHED_IDLE, SCHED_FIFO, SCHED_RR };
+#else
+	static const int policies[] = { SCHED_OTHER, SCHED_OTHER, SCHED_OTHER, SCHED_FIFO, SCHED_RR };
+#endif
+	for (int i = 0; i < 5; ++i) {
+		if (strlen(names[i]) == length && strncmp(text, names[i], length) == 0) {
+			policy = policies[i];
+			return true;
+		}
+	}
+	return false;
+}
+
+bool schedParse(const char *text, SchedSetting & setting) {
+	memset(&setting, 0, sizeof(setting));
+	const char *colon = strchr(text, ':');
+	if (colon != text && *text) {
+		if (!schedParseCpus(text, setting.cpus)) return false;
+		setting.has_cpus = true;
+	}
+	if (colon == NULL) return true;
+	text = colon + 1;
+	colon = strchr(text, ':');
+	size_t length = (colon != NULL) ? (size_t)(colon - text) : strlen(text);
+	if (length > 0) {
+		if (!schedParseClass(text, length, setting.policy)) return false;
+		setting.has_class = true;
+	}
+	if (colon == NULL || !colon[1]) return true;
+	char *end;
+	setting.priority = strtol(colon + 1, &end, 10);
+	if (*end) return false;
+	setting.has_priority = true;
+	return true;
+}
+
+/**
+ * Linux applies affinity, class and nice value to a single thread, so a process that did not start any thread yet, as
+ * a jockey right after it is started, passes them on to all threads it starts later.
+ */
+bool schedApply(pid_t tid, const SchedSetting & setting, const char *name) {
+	bool success = true;
+	if (setting.has_cpus && sched_setaffinity(tid, sizeof(setting.cpus), &setting.cpus) != 0) {
+		fprintf(stderr, "CSched: cannot set the cores of %s, %s\n", name, strerror(errno));
+		success = false;
+	}
+	bool realtime = setting.has_class && (setting.policy == SCHED_FIFO || setting.policy == SCHED_RR);
+	if (setting.has_class) {
+		struct sched_param param;
+		param.sched_priority = (realtime && setting.has_priority) ? setting.priority : (realtime ? 1 : 0);
+		if (sched_setscheduler(tid, setting.policy, &param) != 0) {
+			fprintf(stderr, "CSched: cannot set the scheduling class of %s, %s\n", name, strerror(errno));
+			success = false;
+		}
+	}
+	if (setting.has_priority && !realtime && setpriority(PRIO_PROCESS, tid, setting.priority) != 0) {
+		fprintf(stderr, "CSched: cannot set the nice value of %s, %s\n", name, strerror(errno));
+		success = false;
+	}
+	return success;
+}
+
+void schedThread(const char *name) {
+	const char *settings = getenv("THREAD_SCHED");
+	if (settings == NULL) return;
+	size_t length = strlen(name);
+	for (const char *item = settings; item != NULL; item = strchr(item, ';')) {
+		if (*item == ';') item++;
+		if (strncmp(item, name, length) != 0 || item[length] != '=') continue;
+		char text[SCHED_TEXT_SIZE];
+		const char *end = strchr(item, ';');
+		size_t size = (end != NULL) ? (size_t)(end - item) - length - 1 : strlen(item + length + 1);
+		if (size >= sizeof(text)) size = sizeof(text) - 1;
+		memcpy(text, item + length + 1, size);
+		text[size] = 0;
+		SchedSetting setting;
+		if (!schedParse(text, setting)) {
+			fprintf(stderr, "CSched: the setting %s of thread %s is not valid\n", text, name);
+			return;
+		}
+		schedApply(syscall(SYS_gettid), setting, name);
+		return;
+	}
+}
@@ -0,0 +1,70 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Cores, scheduling class and priority of processes and threads
+ * @file CSched.h
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#ifndef CSCHED_H_
+#define CSCHED_H_
+
+#include <sched.h>
+#include <sys/types.h>
+
+/**
+ * A setting is written as cpus:class:priority, each part can be left out or empty:
+ *
+ *   2-3:fifo:20     on core 2 or 3, SCHED_FIFO with priority 20
+ *   0+2             on core 0 or 2, the class is not changed
+ *   :other:-5       SCHED_OTHER with nice value -5, on any core
+ *   *:idle          on any core, SCHED_IDLE
+ *
+ * The classes are other, batch, idle, fifo and rr. The priority is the real-time priority for fifo and rr, the nice
+ * value for the others. Cores are separated by a '+' because the jockey file separates its arguments by commas.
+ *
+ * CEquids applies a "sched=" argument in the jockey file to the whole process when it starts the jockey, and passes
+ * the "sched.<thread>=" arguments in the environmental variable THREAD_SCHED, for example
+ * THREAD_SCHED=camera=2-3:fifo:10;ipc=0. The threads of the bridles call schedThread() with their name when they start:
+ * camera for the grabber and the camera server, ipc for the threads of the connections, odometry for the odometry of
+ * the motors, leds for the sampler of the infrared sensors, watchdog for the watchdog of CEquids and pool for the
+ * workers of CTaskPool. A thread that is not mentioned keeps the setting of the process.
+ */
+
+struct SchedSetting {
+	bool has_cpus;
+	cpu_set_t cpus;
+	bool has_class;
+	int policy;
+	bool has_priority;
+	int priority;
+};
+
+//! Parse a setting, false if it is not valid
+bool schedParse(const char *text, SchedSetting & setting);
+
+//! Apply a setting to a thread (its tid) or a process (its pid, only the thread with that id), 0 is the calling thread
+bool schedApply(pid_t tid, const SchedSetting & setting, const char *name);
+
+//! Apply the setting for this name in THREAD_SCHED to the calling thread, if there is one
+void schedThread(const char *name);
+
+#endif /* CSCHED_H_ */
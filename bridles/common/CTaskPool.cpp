@@ -0,0 +1,228 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Work-stealing pool of threads that is shared by the compute kernels of a process
+ * @file CTaskPool.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#include "CTaskPool.h"
+#include "CSched.h"
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+//! The pool and the queue of the worker that runs in this thread, NULL for threads outside of any pool
+static __thread CTaskPool *currentPool = NULL;
+static __thread int currentQueue = 0;
+
+static pthread_once_t sharedOnce = PTHREAD_ONCE_INIT;
+static CTaskPool *sharedPool = NULL;
+
+//! Never deleted, the workers may still run tasks of other static objects when the process exits
+static void createShared() {
+	int threads = -1;
+	const char *text = getenv("TASK_POOL_THREADS");
+	if (text != NULL) threads = atoi(text);
+	if (threads < 0) {
+		cpu_set_t cpus;
+		int cores = 1;
+		if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0) cores = CPU_COUNT(&cpus);
+		threads = cores - 1;
+	}
+	sharedPool = new CTaskPool(threads);
+}
+
+CTaskPool & CTaskPool::shared() {
+	pthread_once(&sharedOnce, createShared);
+	return *sharedPool;
+}
+
+CTaskPool::CTaskPool(int threads): numThreads(0), pending(0), waiters(0), quit(false) {
+	if (threads < 0) threads = 0;
+	pthread_mutex_init(&sleepMutex, NULL);
+	pthread_cond_init(&workCond, NULL);
+	pthread_cond_init(&doneCond, NULL);
+	queues = new Queue[threads + 1];
+	for (int i = 0; i <= threads; ++i) pthread_mutex_init(&queues[i].mutex, NULL);
+	workers = new Worker[threads];
+	for (int i = 0; i < threads; ++i) {
+		workers[i].pool = this;
+		workers[i].index = i;
+		if (pthread_create(&workers[i].thread, NULL, &CTaskPool::worker, &workers[i]) != 0) {
+			fprintf(stderr, "CTaskPool: cannot start worker %i, continue with %i\n", i, i);
+			break;
+		}
+		numThreads++;
+	}
+}
+
+CTaskPool::~CTaskPool() {
+	pthread_mutex_lock(&sleepMutex);
+	quit = true;
+	pthread_cond_broadcast(&workCond);
+	pthread_mutex_unlock(&sleepMutex);
+	for (int i = 0; i < numThreads; ++i) pthread_join(workers[i].thread, NULL);
+	delete [] workers;
+	for (int i = 0; i <= numThreads; ++i) pthread_mutex_destroy(&queues[i].mutex);
+	delete [] queues;
+	pthread_cond_destroy(&doneCond);
+	pthread_cond_destroy(&workCond);
+	pthread_mutex_destroy(&sleepMutex);
+}
+
+void *CTaskPool::worker(void *arg) {
+	Worker *self = (Worker*) arg;
+	CTaskPool *pool = self->pool;
+	currentPool = pool;
+	currentQueue = self->index;
+	schedThread("pool");
+	while (true) {
+		if (pool->runOne(self->index)) continue;
+		pthread_mutex_lock(&pool->sleepMutex);
+		while (!pool->quit && pool->pending == 0) pthread_cond_wait(&pool->workCond, &pool->sleepMutex);
+		bool stop = pool->quit;
+		pthread_mutex_unlock(&pool->sleepMutex);
+		if (stop) break;
+	}
+	return NULL;
+}
+
+/**
+ * A worker puts the task at the back of its own queue, any other thread in the shared queue of the threads outside the
+ * pool. Without workers the task is queued as well, and runs in the thread that waits for it.
+ */
+void CTaskPool::submit(CTask & task) {
+	task.done = 0;
+	int queue = (currentPool == this) ? currentQueue : numThreads;
+	pthread_mutex_lock(&queues[queue].mutex);
+	queues[queue].tasks.push_back(&task);
+	pthread_mutex_unlock(&queues[queue].mutex);
+	__sync_fetch_and_add(&pending, 1);
+	pthread_mutex_lock(&sleepMutex);
+	pthread_cond_signal(&workCond);
+	if (waiters > 0) pthread_cond_broadcast(&doneCond);
+	pthread_mutex_unlock(&sleepMutex);
+}
+
+/**
+ * The own queue is used as a stack, the most recent task first, because its data is most likely still in the cache.
+ * The queues of the others are used in order, the oldest task first, which is the one their owner would reach last.
+ */
+bool CTaskPool::runOne(int self) {
+	if (__sync_fetch_and_add(&pending, 0) == 0) return false;
+	int queues_count = numThreads + 1;
+	for (int i = 0; i < queues_count; ++i) {
+		int q = (self + i) % queues_count;
+		CTask *task = NULL;
+		pthread_mutex_lock(&queues[q].mutex);
+		if (!queues[q].tasks.empty()) {
+			if (i == 0 && self < numThreads) {
+				task = queues[q].tasks.back();
+				queues[q].tasks.pop_back();
+			} else {
+				task = queues[q].tasks.front();
+				queues[q].tasks.pop_front();
+			}
+		}
+		pthread_mutex_unlock(&queues[q].mutex);
+		if (task == NULL) continue;
+		__sync_fetch_and_sub(&pending, 1);
+		run(task);
+		return true;
+	}
+	return false;
+}
+
+void CTaskPool::run(CTask *task) {
+	task->function(task->arg);
+	__sync_lock_test_and_set(&task->done, 1);
+	__sync_synchronize();
+	if (waiters == 0) return;
+	pthread_mutex_lock(&sleepMutex);
+	pthread_cond_broadcast(&doneCond);
+	pthread_mutex_unlock(&sleepMutex);
+}
+
+void CTaskPool::wait(CTask & task) {
+	int self = (currentPool == this) ? currentQueue : numThreads;
+	while (!task.isDone()) {
+		if (runOne(self)) continue;
+		// the task runs in another thread, sleep until a task is done or a new one is submitted
+		pthread_mutex_lock(&sleepMutex);
+		__sync_fetch_and_add(&waiters, 1);
+		while (!task.isDone() && __sync_fetch_and_add(&pending, 0) == 0)
+			pthread_cond_wait(&doneCond, &sleepMutex);
+		__sync_fetch_and_sub(&waiters, 1);
+		pthread_mutex_unlock(&sleepMutex);
+	}
+}
+
+//! A chunk of the range of parallelFor
+struct RangeTask {
+	RangeFunction function;
+	void *arg;
+	int begin, end;
+};
+
+static void runRange(void *arg) {
+	RangeTask *range = (RangeTask*) arg;
+	range->function(range->arg, range->begin, range->end);
+}
+
+/**
+ * The range is split in about TASK_POOL_CHUNKS_PER_THREAD chunks per thread, but never in chunks of less than grain
+ * items. The first chunk is run by the calling thread, which then helps with the others until all are done. Without
+ * workers, or with a single chunk, the function is called once for the whole range.
+ *
+ * @param begin              first item of the range
+ * @param end                the item after the last one
+ * @param grain              fewest items in a chunk, so the overhead of a task stays small compared to its work
+ * @param function           called with arg and the bounds of every chunk, from several threads at the same time
+ * @param arg                passed to function
+ */
+void CTaskPool::parallelFor(int begin, int end, int grain, RangeFunction function, void *arg) {
+	int items = end - begin;
+	if (items <= 0) return;
+	if (grain < 1) grain = 1;
+	int chunks = (items + grain - 1) / grain;
+	int most = (numThreads + 1) * TASK_POOL_CHUNKS_PER_THREAD;
+	if (most > TASK_POOL_MAX_CHUNKS) most = TASK_POOL_MAX_CHUNKS;
+	if (chunks > most) chunks = most;
+	if (numThreads == 0 || chunks <= 1) {
+		function(arg, begin, end);
+		return;
+	}
+	RangeTask ranges[TASK_POOL_MAX_CHUNKS];
+	CTask tasks[TASK_POOL_MAX_CHUNKS];
+	for (int c = 0; c < chunks; ++c) {
+		ranges[c].function = function;
+		ranges[c].arg = arg;
+		ranges[c].begin = begin + (int)((long long)items * c / chunks);
+		ranges[c].end = begin + (int)((long long)items * (c + 1) / chunks);
+		tasks[c] = CTask(runRange, &ranges[c]);
+	}
+	// submit the later chunks first, so the caller pops the early ones from its own queue if it is a worker
+	for (int c = chunks - 1; c > 0; --c) submit(tasks[c]);
+	runRange(&ranges[0]);
+	for (int c = 1; c < chunks; ++c) wait(tasks[c]);
+}
@@ -0,0 +1,135 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Work-stealing pool of threads that is shared by the compute kernels of a process
+ * @file CTaskPool.h
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#ifndef CTASKPOOL_H_
+#define CTASKPOOL_H_
+
+#include <pthread.h>
+#include <deque>
+
+//! Most tasks a range of parallelFor is split in
+#define TASK_POOL_MAX_CHUNKS 64
+
+//! Tasks per thread a range of parallelFor is split in, so a thread that is done early can steal from the others
+#define TASK_POOL_CHUNKS_PER_THREAD 4
+
+//! A function that a task runs, with the argument of the task
+typedef void (*TaskFunction)(void *arg);
+
+//! A function that runs the items [begin,end) of a range, with the argument of parallelFor
+typedef void (*RangeFunction)(void *arg, int begin, int end);
+
+/**
+ * A task is its own future: it is submitted to a pool, and CTaskPool::wait returns as soon as it has run. The task has
+ * to stay alive until then, the pool does not copy it.
+ */
+class CTask {
+public:
+	CTask(): function(NULL), arg(NULL), done(1) {}
+
+	CTask(TaskFunction function, void *arg): function(function), arg(arg), done(1) {}
+
+	//! Check if the task has run, without waiting
+	inline bool isDone() { return __sync_fetch_and_add(&done, 0) != 0; }
+private:
+	friend class CTaskPool;
+	TaskFunction function;
+	void *arg;
+	volatile int done;
+};
+
+/**
+ * Every worker has a queue of its own. A task that a worker submits goes to the back of its own queue and the worker
+ * takes its next task from there, so nested work stays on the same core. A worker without work steals from the front
+ * of the queues of the others. Tasks of threads outside the pool go to a queue of their own, from which all workers
+ * steal. A thread that waits for a task runs the tasks of the pool meanwhile, so waiting for a task, also from within
+ * a task, never blocks a core.
+ *
+ * Compute kernels use the pool of the process, see shared(), instead of threads of their own, so they do not start
+ * more threads than there are cores when they run at the same time. Its workers name themselves "pool" for
+ * THREAD_SCHED, see CSched.h.
+ */
+class CTaskPool {
+public:
+	//! A pool with the given number of workers, 0 runs every task in the thread that waits for it
+	CTaskPool(int threads);
+
+	//! Stops the workers, the tasks that are still queued are not run
+	~CTaskPool();
+
+	/**
+	 * The pool of the process, created on first use. It has TASK_POOL_THREADS workers, or by default one less than the
+	 * number of cores the process may run on, because the thread that waits for the tasks runs them as well.
+	 */
+	static CTaskPool & shared();
+
+	//! Queue a task, it has to stay alive until it is done
+	void submit(CTask & task);
+
+	//! Return when the task is done, run the tasks of the pool meanwhile
+	void wait(CTask & task);
+
+	//! Run function over [begin,end) in chunks of at least grain items on the workers and the calling thread
+	void parallelFor(int begin, int end, int grain, RangeFunction function, void *arg);
+
+	//! Number of workers, without the threads that wait for tasks
+	inline int getThreads() { return numThreads; }
+private:
+	struct Queue {
+		pthread_mutex_t mutex;
+		std::deque<CTask*> tasks;
+	};
+
+	struct Worker {
+		CTaskPool *pool;
+		int index;
+		pthread_t thread;
+	};
+
+	//! Run a task of the own queue, or one that is stolen from another queue, false if there is none
+	bool runOne(int self);
+
+	//! Run the task and wake up the threads that wait for it
+	void run(CTask *task);
+
+	static void *worker(void *arg);
+
+	int numThreads;
+	//! A queue for every worker and one for the threads outside the pool, the last one
+	Queue *queues;
+	Worker *workers;
+
+	//! Number of tasks in all queues
+	volatile int pending;
+	//! Number of threads in wait that sleep
+	volatile int waiters;
+	bool quit;
+	pthread_mutex_t sleepMutex;
+	pthread_cond_t workCond;
+	pthread_cond_t doneCond;
+};
+
+#endif /* CTASKPOOL_H_ */
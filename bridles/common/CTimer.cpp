@@ -17,14 +17,18 @@
 
 #include "CTimer.h"
 
+#include <errno.h>
 #include <stdio.h>
 #include <unistd.h>
 
+#define NS_PER_MS 1000000LL
+#define NS_PER_S 1000000000LL
+
 CTimer::CTimer(int timeout)
 {
   reset();
   timeoutInterval = timeout;
-  lastTick = getRealTime();
+  nextTick = 0;
   period = 1000;
   pause();
 }
@@ -35,30 +39,39 @@ CTimer::~CTimer()
 void CTimer::reset(int timeout)
 {
   timeoutInterval = timeout;
-  startTime = getRealTime();
+  startTime = now();
   pauseTime = startTime;
 }
 
-//! Get current time in milliseconds
-int CTimer::getRealTime()
+//! Get the monotonic time in nanoseconds
+int64_t CTimer::now()
 {
-  struct  timeval currentTime;
-  gettimeofday(&currentTime, NULL);
-  return currentTime.tv_sec*1000 + currentTime.tv_usec/1000;
+  struct timespec currentTime;
+  clock_gettime(CLOCK_MONOTONIC, &currentTime);
+  return (int64_t)currentTime.tv_sec*NS_PER_S + currentTime.tv_nsec;
 }
 
-int CTimer::getTime()
+void CTimer::sleepUntil(int64_t time)
+{
+  struct timespec until;
+  until.tv_sec = time / NS_PER_S;
+  until.tv_nsec = time % NS_PER_S;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR);
+}
+
+int64_t CTimer::getTimeNs()
 {
-  int result;
   if (running)
   {
-    result = getRealTime() - startTime;
-  }
-  else
-  {
-    result = pauseTime - startTime;
+    return now() - startTime;
   }
-  return result;
+  return pauseTime - startTime;
+}
+
+//! Get the time since start in milliseconds
+int CTimer::getTime()
+{
+  return (int)(getTimeNs() / NS_PER_MS);
 }
 
 bool CTimer::timeOut()
@@ -74,12 +87,13 @@ bool CTimer::paused()
 int CTimer::pause()
 {
   running = false;
-  return pauseTime = getRealTime();
+  pauseTime = now();
+  return (int)(pauseTime / NS_PER_MS);
 }
 
 int CTimer::start()
 {
-  startTime += (getRealTime() - pauseTime);
+  startTime += (now() - pauseTime);
   running = true;
 
   return getTime();
@@ -104,17 +118,63 @@ void CTimer::setPeriod(int period) {
 }
 
 /**
- * An inaccurate tick. It sleeps a while defined previously by setFreq.
- * There is a cap on sleeping for maximum 5 second.
+ * Sleeps until the next tick, a period defined previously by setFreq or setPeriod after the last one. The ticks are
+ * multiples of the period, so the time spent in between does not make the frequency drift. There is a cap on sleeping
+ * for maximum 5 second.
  */
 void CTimer::tick() {
-	int timePassed = getRealTime() - lastTick;
-	int timeToSleep = period - timePassed;
-//	fprintf(stdout, "Time passed %i and time to sleep %i\n", timePassed, timeToSleep);
-	if (timeToSleep > 5000) {
-		sleep(5);
-	} else if (timeToSleep > 0) {
-		usleep(timeToSleep * 1000);
+	int64_t time = now();
+	int64_t periodNs = period * NS_PER_MS;
+	if (nextTick == 0 || time - nextTick > TIMER_MAX_BEHIND * periodNs) {
+		nextTick = time;
+	}
+	nextTick += periodNs;
+	if (nextTick - time > 5 * NS_PER_S) {
+		nextTick = time + 5 * NS_PER_S;
+	}
+	sleepUntil(nextTick);
+}
+
+CPeriodic::CPeriodic(int64_t period) {
+	this->period = period;
+	start();
+}
+
+void CPeriodic::start() {
+	deadline = CTimer::now();
+	resetStats();
+}
+
+void CPeriodic::setPeriod(int64_t period) {
+	this->period = period;
+}
+
+int64_t CPeriodic::wait() {
+	deadline += period;
+	int64_t time = CTimer::now();
+	if (time - deadline > TIMER_MAX_BEHIND * period) {
+		overruns++;
+		deadline = time;
+		return 0;
 	}
-	lastTick = getRealTime();
+	if (time < deadline) {
+		CTimer::sleepUntil(deadline);
+		time = CTimer::now();
+	}
+	int64_t lateness = time - deadline;
+	wakeups++;
+	totalLateness += lateness;
+	if (lateness > maxLateness) maxLateness = lateness;
+	return lateness;
+}
+
+int64_t CPeriodic::getMeanLateness() {
+	return wakeups ? totalLateness / wakeups : 0;
+}
+
+void CPeriodic::resetStats() {
+	wakeups = 0;
+	overruns = 0;
+	totalLateness = 0;
+	maxLateness = 0;
 }
@@ -20,9 +20,14 @@
 
 #include <sys/time.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
 
 #define TIMEOUT_INTERVAL 40000
 
+//! A periodic loop that is behind by more than this many periods skips them instead of catching up
+#define TIMER_MAX_BEHIND 10
+
 class CTimer
 {
 	public:
@@ -43,17 +48,62 @@ class CTimer
 		// Set period (use this or setFreq) if you want to use tick()
 		void setPeriod(int period);
 
-		// This function can be used to obtain a frequency (calls usleep)
+		// This function can be used to obtain a frequency, it sleeps until the next multiple of the period
 		void tick();
-	private:
-		int getRealTime();
 
-		int startTime;
-		int pauseTime;
+		// Time since start in ns, it does not overflow like getTime() in ms does
+		int64_t getTimeNs();
+
+		// Monotonic time in ns, not affected by changes of the clock of the system
+		static int64_t now();
+
+		// Sleep until the monotonic time in ns, also when a signal comes in
+		static void sleepUntil(int64_t time);
+	private:
+		int64_t startTime;
+		int64_t pauseTime;
 		bool running;
 		int timeoutInterval;
 		int period;
-		int lastTick;
+		int64_t nextTick;
+};
+
+/**
+ * Runs a loop at a fixed rate. The deadlines are multiples of the period from start(), so the time the loop itself
+ * takes does not add up to a drift, and wait() sleeps until the next one with clock_nanosleep on the monotonic clock.
+ * How late the wakeups are is kept as a measure of the jitter.
+ */
+class CPeriodic
+{
+	public:
+		// Period in ns
+		CPeriodic(int64_t period);
+
+		// The first deadline is one period from now
+		void start();
+
+		// Sleep until the next deadline, returns how late in ns it woke up, a loop that is behind by more than
+		// TIMER_MAX_BEHIND periods starts over from now and counts an overrun
+		int64_t wait();
+
+		inline int64_t getPeriod() { return period; }
+
+		void setPeriod(int64_t period);
+
+		// Lateness of the wakeups in ns, since start() or resetStats()
+		int64_t getMeanLateness();
+		inline int64_t getMaxLateness() { return maxLateness; }
+		inline long getWakeups() { return wakeups; }
+		inline long getOverruns() { return overruns; }
+
+		void resetStats();
+	private:
+		int64_t period;
+		int64_t deadline;
+		long wakeups;
+		long overruns;
+		int64_t totalLateness;
+		int64_t maxLateness;
 };
 
 #endif
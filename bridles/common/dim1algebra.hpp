@@ -36,6 +36,7 @@
 #include <numeric>
 #include <iostream>
 #include <cmath>
+#include <cstdlib>
 #include <iterator>
 
 #include <sstream>
@@ -81,6 +82,17 @@
 
 namespace dobots {
 
+// A release (PROFILE=release in Mk/default.mk) defines NDEBUG, then the conditions are not even evaluated
+#ifdef NDEBUG
+#define ASSERT(condition) {}
+#define ASSERT_EQ(x,y)
+#define ASSERT_NEQ(x,y)
+#define ASSERT_LT(x,y)
+#define ASSERT_LEQ(x,y)
+#define ASSERT_GT(x,y)
+#define ASSERT_GEQ(x,y)
+#else
+
 //! Helper function for printing asserts
 #define ASSERT(condition) { \
 	if(!(condition)){ \
@@ -132,6 +144,8 @@ namespace dobots {
 		assert(x >= y); \
 	}
 
+#endif
+
 /**
  * For an explanation of the different metrics, see the "distance" function below. This distance function does really
  * calculate a distance between two containers, say two vectors, and is not the std::distance function that just returns
@@ -616,6 +630,148 @@ inner_product(InputIterator1 first1, InputIterator1 last1, InputIterator2 first2
 	return std::inner_product(first1, last1, first2, init, std::plus<T>(), binary_op);
 }
 
+/***********************************************************************************************************************
+ * Unrolled kernels for random access ranges
+ **********************************************************************************************************************/
+
+/**
+ * The element-wise operations of the distances as function objects, so they are inlined in the kernels below, which a
+ * function pointer like taxicab<T> is not.
+ */
+template<typename T>
+struct op_squared_difference : public std::binary_function<T, T, T> {
+	T operator()(const T & x, const T & y) const { T d = x - y; return d * d; }
+};
+
+template<typename T>
+struct op_absolute_difference : public std::binary_function<T, T, T> {
+	T operator()(const T & x, const T & y) const { return std::abs(x - y); }
+};
+
+template<typename T>
+struct op_square : public std::unary_function<T, T> {
+	T operator()(const T & x) const { return x * x; }
+};
+
+template<typename T>
+struct op_absolute : public std::unary_function<T, T> {
+	T operator()(const T & x) const { return std::abs(x); }
+};
+
+/**
+ * The std::inner_product of a vector or an array with four independent accumulators. The combinations do not have to
+ * wait for each other, and a compiler can map the four lanes on vector instructions where the processor has them. The
+ * combination has to be associative, like addition or maximum, and T(0) has to be neutral for it on the values that
+ * binary_op returns.
+ */
+template<typename T, typename RandomAccessIterator1, typename RandomAccessIterator2, typename Combine,
+		typename BinaryOperation>
+T inner_product_impl(RandomAccessIterator1 first1, RandomAccessIterator1 last1, RandomAccessIterator2 first2, T init,
+		Combine combine, BinaryOperation binary_op, std::random_access_iterator_tag, std::random_access_iterator_tag) {
+	T acc[4] = { init, T(0), T(0), T(0) };
+	size_t n = last1 - first1;
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		acc[0] = combine(acc[0], binary_op(first1[i], first2[i]));
+		acc[1] = combine(acc[1], binary_op(first1[i+1], first2[i+1]));
+		acc[2] = combine(acc[2], binary_op(first1[i+2], first2[i+2]));
+		acc[3] = combine(acc[3], binary_op(first1[i+3], first2[i+3]));
+	}
+	for (; i < n; ++i) {
+		acc[0] = combine(acc[0], binary_op(first1[i], first2[i]));
+	}
+	return combine(combine(acc[0], acc[1]), combine(acc[2], acc[3]));
+}
+
+//! The generic fallback for other iterators
+template<typename T, typename InputIterator1, typename InputIterator2, typename Combine, typename BinaryOperation>
+T inner_product_impl(InputIterator1 first1, InputIterator1 last1, InputIterator2 first2, T init,
+		Combine combine, BinaryOperation binary_op, std::input_iterator_tag, std::input_iterator_tag) {
+	return std::inner_product(first1, last1, first2, init, combine, binary_op);
+}
+
+/**
+ * Like std::inner_product, but unrolled when both ranges are random access, see inner_product_impl.
+ */
+template<typename T, typename InputIterator1, typename InputIterator2, typename Combine, typename BinaryOperation>
+inline T fast_inner_product(InputIterator1 first1, InputIterator1 last1, InputIterator2 first2, T init,
+		Combine combine, BinaryOperation binary_op) {
+	return inner_product_impl(first1, last1, first2, init, combine, binary_op,
+			typename std::iterator_traits<InputIterator1>::iterator_category(),
+			typename std::iterator_traits<InputIterator2>::iterator_category());
+}
+
+template<typename T, typename RandomAccessIterator, typename Combine, typename UnaryOperation>
+T accumulate_impl(RandomAccessIterator first, RandomAccessIterator last, T init, Combine combine,
+		UnaryOperation unary_op, std::random_access_iterator_tag) {
+	T acc[4] = { init, T(0), T(0), T(0) };
+	size_t n = last - first;
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		acc[0] = combine(acc[0], unary_op(first[i]));
+		acc[1] = combine(acc[1], unary_op(first[i+1]));
+		acc[2] = combine(acc[2], unary_op(first[i+2]));
+		acc[3] = combine(acc[3], unary_op(first[i+3]));
+	}
+	for (; i < n; ++i) {
+		acc[0] = combine(acc[0], unary_op(first[i]));
+	}
+	return combine(combine(acc[0], acc[1]), combine(acc[2], acc[3]));
+}
+
+template<typename T, typename InputIterator, typename Combine, typename UnaryOperation>
+T accumulate_impl(InputIterator first, InputIterator last, T init, Combine combine, UnaryOperation unary_op,
+		std::input_iterator_tag) {
+	for (; first != last; ++first)
+		init = combine(init, unary_op(*first));
+	return init;
+}
+
+/**
+ * Like the accumulate with a unary operation below, but unrolled when the range is random access, with the same
+ * requirements on the combination as fast_inner_product.
+ */
+template<typename T, typename InputIterator, typename Combine, typename UnaryOperation>
+inline T fast_accumulate(InputIterator first, InputIterator last, T init, Combine combine, UnaryOperation unary_op) {
+	return accumulate_impl(first, last, init, combine, unary_op,
+			typename std::iterator_traits<InputIterator>::iterator_category());
+}
+
+/**
+ * The smallest and the largest value of a range that is not empty, unrolled into four lanes for a vector or an array.
+ * Use min_max_element instead for where they are.
+ *
+ * @param first              start of container
+ * @param last               end of container, not equal to first
+ * @param min                smallest value
+ * @param max                largest value
+ */
+template<typename RandomAccessIterator, typename T>
+void min_max_value(RandomAccessIterator first, RandomAccessIterator last, T & min, T & max) {
+	__glibcxx_function_requires(_RandomAccessIteratorConcept<RandomAccessIterator>);
+	__glibcxx_requires_valid_range(first, last);
+	assert (first != last);
+
+	T lo[4], hi[4];
+	for (int j = 0; j < 4; ++j) lo[j] = hi[j] = T(*first);
+	size_t n = last - first;
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		for (int j = 0; j < 4; ++j) {
+			T x = T(first[i+j]);
+			lo[j] = (x < lo[j]) ? x : lo[j];
+			hi[j] = (hi[j] < x) ? x : hi[j];
+		}
+	}
+	for (; i < n; ++i) {
+		T x = T(first[i]);
+		lo[0] = (x < lo[0]) ? x : lo[0];
+		hi[0] = (hi[0] < x) ? x : hi[0];
+	}
+	min = std::min(std::min(lo[0], lo[1]), std::min(lo[2], lo[3]));
+	max = std::max(std::max(hi[0], hi[1]), std::max(hi[2], hi[3]));
+}
+
 /**
  * This function tells something about the "size" or "length" of a container, mathematically called "norm".
  * There are currently several norms implemented:
@@ -634,12 +790,12 @@ T norm(InputIterator first, InputIterator last, Norm norm) {
 
 	switch (norm) {
 	case N_EUCLIDEAN:
-		return std::sqrt(accumulate(first, last, T(0), std::plus<T>(), square<T> ) );
+		return std::sqrt(fast_accumulate(first, last, T(0), std::plus<T>(), op_square<T>()));
 	case N_TAXICAB:
-		return accumulate(first, last, T(0), std::plus<T>(), absolute<T>);
+		return fast_accumulate(first, last, T(0), std::plus<T>(), op_absolute<T>());
 	case N_MAXIMUM:
 		if (std::distance(first,last) == 0) return T(0);
-		return *max_element(first, last, absolute<T>);
+		return *dobots::max_element(first, last, op_absolute<T>());
 	default:
 		std::cerr << "Unknown norm" << std::endl;
 		return T(-1);
@@ -751,18 +907,19 @@ T distance(InputIterator1 first1, InputIterator1 last1, InputIterator2 first2, I
 	}
 	switch (metric) {
 	case DM_DOTPRODUCT:
-		return std::inner_product(first1, last1, first2, T(0));
+		return fast_inner_product(first1, last1, first2, T(0), std::plus<T>(), std::multiplies<T>());
 	case DM_EUCLIDEAN:
-		return std::sqrt(std::inner_product(first1, last1, first2, T(0), std::plus<T>(), euclidean<T>));
+		return std::sqrt(fast_inner_product(first1, last1, first2, T(0), std::plus<T>(),
+				op_squared_difference<T>()));
 	case DM_BHATTACHARYYA:
 		return -std::log(std::inner_product(first1, last1, first2, T(0), std::plus<T>(), battacharyya<T>));
 	case DM_HELLINGER:
 		return (std::sqrt(std::inner_product(first1, last1, first2, T(0), std::plus<T>(), hellinger<T>))) /
 				std::sqrt(2);
 	case DM_CHEBYSHEV:
-		return std::inner_product(first1, last1, first2, T(0), max<T>(), taxicab<T>);
+		return fast_inner_product(first1, last1, first2, T(0), max<T>(), op_absolute_difference<T>());
 	case DM_MANHATTAN:
-		return std::inner_product(first1, last1, first2, T(0), std::plus<T>(), taxicab<T>);
+		return fast_inner_product(first1, last1, first2, T(0), std::plus<T>(), op_absolute_difference<T>());
 	case DM_BHATTACHARYYA_COEFFICIENT:
 		return std::inner_product(first1, last1, first2, T(0), std::plus<T>(), battacharyya<T>);
 	case DM_SQUARED_HELLINGER:
@@ -812,6 +969,204 @@ T expectation(InputIterator1 first1, InputIterator1 last1, InputIterator2 first2
 	return std::inner_product(first1, last1, first2, T(0));
 }
 
+/***********************************************************************************************************************
+ * Fused reductions, several statistics in a single pass
+ **********************************************************************************************************************/
+
+/**
+ * The type in which values are summed. Integers are summed in 64 bits, so the sum and the sum of squares are exact, and
+ * other types are summed in their own type.
+ */
+template<typename T> struct sum_type { typedef T type; };
+template<> struct sum_type<char> { typedef long long type; };
+template<> struct sum_type<unsigned char> { typedef long long type; };
+template<> struct sum_type<short> { typedef long long type; };
+template<> struct sum_type<unsigned short> { typedef long long type; };
+template<> struct sum_type<int> { typedef long long type; };
+template<> struct sum_type<unsigned int> { typedef long long type; };
+
+/**
+ * The sums of a single pass over a range. The values are summed as the difference with the first value, the shift, so
+ * the variance of values far from zero does not cancel out when it is calculated from the sums.
+ */
+template<typename S>
+struct moments {
+	size_t count;
+	S shift;
+	S sum;
+	S sum_squares;
+	moments(): count(0), shift(0), sum(0), sum_squares(0) {}
+};
+
+template<typename InputIterator, typename S>
+void moments_impl(InputIterator first, InputIterator last, moments<S> & m, std::input_iterator_tag) {
+	for (; first != last; ++first) {
+		S d = S(*first) - m.shift;
+		m.sum += d;
+		m.sum_squares += d * d;
+		m.count++;
+	}
+}
+
+/**
+ * On a random access range the loop is unrolled into four independent sums, the additions do not have to wait for each
+ * other, which a compiler can turn into vector instructions where the processor has them.
+ */
+template<typename RandomAccessIterator, typename S>
+void moments_impl(RandomAccessIterator first, RandomAccessIterator last, moments<S> & m,
+		std::random_access_iterator_tag) {
+	S sum[4] = { S(0), S(0), S(0), S(0) };
+	S squares[4] = { S(0), S(0), S(0), S(0) };
+	size_t n = last - first;
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		for (int j = 0; j < 4; ++j) {
+			S d = S(first[i+j]) - m.shift;
+			sum[j] += d;
+			squares[j] += d * d;
+		}
+	}
+	for (; i < n; ++i) {
+		S d = S(first[i]) - m.shift;
+		sum[0] += d;
+		squares[0] += d * d;
+	}
+	m.sum += (sum[0] + sum[1]) + (sum[2] + sum[3]);
+	m.sum_squares += (squares[0] + squares[1]) + (squares[2] + squares[3]);
+	m.count += n;
+}
+
+/**
+ * Calculate the average and the variance of a range in one pass, rather than the average first and the deviations from
+ * it in a second pass. The variance is the population variance, the sum of the squared deviations divided by the number
+ * of elements.
+ *
+ * @param first              start of container
+ * @param last               end of container
+ * @param mean               average, 0 for an empty container
+ * @param variance           variance, 0 for an empty container
+ * @return                   number of elements
+ */
+template<typename InputIterator, typename T>
+size_t mean_variance(InputIterator first, InputIterator last, T & mean, T & variance) {
+	typedef typename std::iterator_traits<InputIterator>::value_type ValueType;
+	typedef typename sum_type<ValueType>::type S;
+
+	__glibcxx_function_requires(_InputIteratorConcept<InputIterator>);
+	__glibcxx_requires_valid_range(first, last);
+
+	mean = variance = T(0);
+	if (first == last) return 0;
+	moments<S> m;
+	m.shift = S(*first);
+	moments_impl(first, last, m, typename std::iterator_traits<InputIterator>::iterator_category());
+	T n = T(m.count);
+	mean = T(m.shift) + T(m.sum) / n;
+	variance = (T(m.sum_squares) - T(m.sum) * T(m.sum) / n) / n;
+	return m.count;
+}
+
+/**
+ * The same as mean_variance, but only over the elements for which the predicate holds, for example only the non-zero
+ * ones.
+ *
+ * @return                   number of elements for which the predicate holds
+ */
+template<typename InputIterator, typename T, typename Predicate>
+size_t mean_variance_if(InputIterator first, InputIterator last, T & mean, T & variance, Predicate pred) {
+	typedef typename std::iterator_traits<InputIterator>::value_type ValueType;
+	typedef typename sum_type<ValueType>::type S;
+
+	__glibcxx_function_requires(_InputIteratorConcept<InputIterator>);
+	__glibcxx_requires_valid_range(first, last);
+
+	mean = variance = T(0);
+	moments<S> m;
+	for (; first != last; ++first) {
+		if (!pred(*first)) continue;
+		if (!m.count) m.shift = S(*first);
+		S d = S(*first) - m.shift;
+		m.sum += d;
+		m.sum_squares += d * d;
+		m.count++;
+	}
+	if (!m.count) return 0;
+	T n = T(m.count);
+	mean = T(m.shift) + T(m.sum) / n;
+	variance = (T(m.sum_squares) - T(m.sum) * T(m.sum) / n) / n;
+	return m.count;
+}
+
+/**
+ * Find the smallest and the largest element of a range in one pass, instead of a std::min_element and a
+ * std::max_element. Like those, it returns the first instance of each, the argmin is std::distance(first, min).
+ *
+ * @param first              start of container
+ * @param last               end of container
+ * @param min                the smallest element, last for an empty container
+ * @param max                the largest element, last for an empty container
+ */
+template<typename ForwardIterator>
+void min_max_element(ForwardIterator first, ForwardIterator last, ForwardIterator & min, ForwardIterator & max) {
+	__glibcxx_function_requires(_ForwardIteratorConcept<ForwardIterator>);
+	__glibcxx_requires_valid_range(first, last);
+
+	min = max = first;
+	if (first == last) return;
+	while (++first != last) {
+		if (*first < *min) min = first;
+		else if (*max < *first) max = first;
+	}
+}
+
+/**
+ * The sum of the absolute differences between two ranges of the same size, the taxicab distance, without the function
+ * object per element of the general distance() function. Unrolled on random access ranges, see fast_inner_product.
+ *
+ * @param first1             start of first container
+ * @param last1              end of first container
+ * @param first2             start of second container
+ * @param init               value to add the differences to, its type is the one they are calculated in
+ * @return                   init plus the sum of the absolute differences
+ */
+template<typename InputIterator1, typename InputIterator2, typename T>
+T sum_abs_diff(InputIterator1 first1, InputIterator1 last1, InputIterator2 first2, T init) {
+	__glibcxx_function_requires(_InputIteratorConcept<InputIterator1>);
+	__glibcxx_function_requires(_InputIteratorConcept<InputIterator2>);
+	__glibcxx_requires_valid_range(first1, last1);
+
+	return fast_inner_product(first1, last1, first2, init, std::plus<T>(), op_absolute_difference<T>());
+}
+
+/**
+ * Count the values of a range into bins of equal width, the first one starting at min. Values outside of the bins are
+ * not counted. The bins are not cleared beforehand, so several ranges can be counted into the same bins.
+ *
+ * @param first              start of container
+ * @param last               end of container
+ * @param bins               start of the bins, incremented for every value that falls in them
+ * @param bin_count          number of bins
+ * @param min                lowest value of the first bin
+ * @param width              width of a bin
+ * @return                   number of values that are counted
+ */
+template<typename InputIterator, typename OutputIterator, typename T>
+size_t histogram(InputIterator first, InputIterator last, OutputIterator bins, size_t bin_count, T min, T width) {
+	__glibcxx_function_requires(_InputIteratorConcept<InputIterator>);
+	__glibcxx_requires_valid_range(first, last);
+	assert (width > T(0));
+
+	size_t counted = 0;
+	for (; first != last; ++first) {
+		if (T(*first) < min) continue;
+		size_t bin = size_t((T(*first) - min) / width);
+		if (bin >= bin_count) continue;
+		++bins[bin];
+		++counted;
+	}
+	return counted;
+}
+
 
 /***********************************************************************************************************************
  * Entropies
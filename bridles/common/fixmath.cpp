@@ -0,0 +1,130 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Fixed-point math for processors without a floating point unit
+ * @file fixmath.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#include "fixmath.h"
+
+#include <math.h>
+
+//! The sine from 0 to pi/2, and the arctangent from 0 to 1, with one entry extra for the interpolation of the last one
+static q16_t sin_table[FIXMATH_TABLE + 1];
+static q16_t atan_table[FIXMATH_TABLE + 1];
+
+//! Fills the tables before main(), with the floating point functions, which is done only this once
+static struct FixmathTables {
+	FixmathTables() {
+		for (int i = 0; i <= FIXMATH_TABLE; i++) {
+			sin_table[i] = q16_from_double(sin(M_PI_2 * i / FIXMATH_TABLE));
+			atan_table[i] = q16_from_double(atan((double)i / FIXMATH_TABLE));
+		}
+	}
+} fixmath_tables;
+
+//! Interpolate in a table, index is in Q16 and within the table
+static inline q16_t interpolate(const q16_t *table, uint32_t index) {
+	uint32_t i = index >> 16;
+	q16_t fraction = index & 0xFFFF;
+	return table[i] + q16_mul(table[i + 1] - table[i], fraction);
+}
+
+/**
+ * The square root of the value shifted up by 16 bits is the square root in Q16. It is calculated bit by bit, from the
+ * highest bit of the result down, without a single multiplication.
+ */
+static uint32_t isqrt64(uint64_t value) {
+	if (value == 0) return 0;
+	uint64_t result = 0;
+	// the highest power of four that is not larger than the value
+	uint64_t bit = (uint64_t)1 << ((63 - __builtin_clzll(value)) & ~1);
+	while (bit) {
+		if (value >= result + bit) {
+			value -= result + bit;
+			result = (result >> 1) + bit;
+		} else {
+			result >>= 1;
+		}
+		bit >>= 2;
+	}
+	return (uint32_t)result;
+}
+
+q16_t q16_sqrt(q16_t value) {
+	if (value <= 0) return 0;
+	return (q16_t)isqrt64((uint64_t)value << 16);
+}
+
+q16_t q16_hypot(q16_t x, q16_t y) {
+	uint64_t sum = (uint64_t)((int64_t)x * x) + (uint64_t)((int64_t)y * y);
+	// the sum is in Q32, its square root in Q16
+	return (q16_t)isqrt64(sum);
+}
+
+//! Position on the circle in Q16 quarters of FIXMATH_TABLE entries, from 0 to 4 * FIXMATH_TABLE
+static inline uint32_t phase(q16_t angle) {
+	angle %= Q16_TWO_PI;
+	if (angle < 0) angle += Q16_TWO_PI;
+	// entries per radian, 4 * FIXMATH_TABLE / (2 pi), in Q16
+	static const int64_t scale = (int64_t)(4 * FIXMATH_TABLE * 65536.0 / (2 * M_PI) + 0.5);
+	return (uint32_t)(((int64_t)angle * scale) >> 16);
+}
+
+static inline q16_t sin_phase(uint32_t p) {
+	static const uint32_t quarter = FIXMATH_TABLE << 16;
+	uint32_t q = (p / quarter) & 3;
+	uint32_t r = p % quarter;
+	switch (q) {
+	case 0: return interpolate(sin_table, r);
+	case 1: return interpolate(sin_table, quarter - r);
+	case 2: return -interpolate(sin_table, r);
+	default: return -interpolate(sin_table, quarter - r);
+	}
+}
+
+q16_t q16_sin(q16_t angle) {
+	return sin_phase(phase(angle));
+}
+
+q16_t q16_cos(q16_t angle) {
+	return sin_phase(phase(angle) + (FIXMATH_TABLE << 16));
+}
+
+void q16_sincos(q16_t angle, q16_t & sin, q16_t & cos) {
+	uint32_t p = phase(angle);
+	sin = sin_phase(p);
+	cos = sin_phase(p + (FIXMATH_TABLE << 16));
+}
+
+q16_t q16_atan2(q16_t y, q16_t x) {
+	if (x == 0 && y == 0) return 0;
+	int64_t ax = (x < 0) ? -(int64_t)x : x;
+	int64_t ay = (y < 0) ? -(int64_t)y : y;
+	bool steep = ax < ay;
+	// the smaller over the larger coordinate, in Q16 entries of the table
+	uint32_t index = steep ? (uint32_t)((ax * FIXMATH_TABLE << 16) / ay) : (uint32_t)((ay * FIXMATH_TABLE << 16) / ax);
+	q16_t angle = interpolate(atan_table, index >= (FIXMATH_TABLE << 16) ? (FIXMATH_TABLE << 16) - 1 : index);
+	if (steep) angle = Q16_HALF_PI - angle;
+	if (x < 0) angle = Q16_PI - angle;
+	return (y < 0) ? -angle : angle;
+}
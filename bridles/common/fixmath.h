@@ -0,0 +1,107 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Fixed-point math for processors without a floating point unit
+ * @file fixmath.h
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#ifndef FIXMATH_H_
+#define FIXMATH_H_
+
+#include <stdint.h>
+
+/**
+ * The Blackfin has no floating point unit, every float or double operation is emulated in software and a sin() or a
+ * sqrt() takes thousands of cycles. These functions work on integers instead:
+ *   q16_t  Q16.16, 16 bits integer part and 16 bits fraction, from -32768 to 32768 in steps of 1/65536
+ *   q15_t  Q1.15, from -1 to 1 in steps of 1/32768, for sines, cosines and other factors of at most 1
+ * Products are calculated in 64 bits, so they only overflow when the result does not fit.
+ *
+ * The sine, the cosine and the arctangent interpolate in tables that are filled once at startup. The jockey fixbench
+ * reports the errors and the speed against the floating point functions, on the host the errors are about:
+ *   q16_mul, q16_div     rounded down to 1/65536
+ *   q16_sqrt             1/65536
+ *   q16_sin, q16_cos     3e-5
+ *   q16_atan2            4e-5 rad
+ *
+ * Compile with -DFIXED_POINT_MATH, see Mk/default.mk, to let the odometry of CMotors and the undistortion of
+ * CTransformation use them.
+ */
+
+typedef int32_t q16_t;
+typedef int16_t q15_t;
+
+#define Q16_ONE 65536
+#define Q15_ONE 32767
+#define Q16_PI 205887
+#define Q16_HALF_PI 102944
+#define Q16_TWO_PI 411775
+
+//! Entries of the sine table per quarter of a circle, and of the arctangent table from 0 to 1
+#define FIXMATH_TABLE 256
+
+inline q16_t q16_from_int(int value) { return value << 16; }
+
+inline q16_t q16_from_float(float value) { return (q16_t)(value * Q16_ONE + (value < 0 ? -0.5f : 0.5f)); }
+
+inline q16_t q16_from_double(double value) { return (q16_t)(value * Q16_ONE + (value < 0 ? -0.5 : 0.5)); }
+
+//! Rounded to the nearest integer
+inline int q16_to_int(q16_t value) { return (value + (Q16_ONE >> 1)) >> 16; }
+
+inline float q16_to_float(q16_t value) { return value / (float)Q16_ONE; }
+
+inline double q16_to_double(q16_t value) { return value / (double)Q16_ONE; }
+
+inline q16_t q16_mul(q16_t a, q16_t b) { return (q16_t)(((int64_t)a * b) >> 16); }
+
+inline q16_t q16_div(q16_t a, q16_t b) { return (q16_t)(((int64_t)a << 16) / b); }
+
+inline q15_t q15_from_q16(q16_t value) {
+	return (q15_t)(value >= Q16_ONE ? Q15_ONE : (value <= -Q16_ONE ? -Q15_ONE : value >> 1));
+}
+
+inline q16_t q16_from_q15(q15_t value) { return (q16_t)value << 1; }
+
+inline q15_t q15_mul(q15_t a, q15_t b) { return (q15_t)(((int32_t)a * b) >> 15); }
+
+//! A q16_t times a q15_t, the result is a q16_t
+inline q16_t q16_mul_q15(q16_t a, q15_t b) { return (q16_t)(((int64_t)a * b) >> 15); }
+
+//! The square root of a value that is not negative, 0 for a negative one
+q16_t q16_sqrt(q16_t value);
+
+//! The length of (x,y), the squares are summed in 64 bits so they do not overflow
+q16_t q16_hypot(q16_t x, q16_t y);
+
+//! The sine of an angle in radians, any angle, it is reduced to one circle first
+q16_t q16_sin(q16_t angle);
+
+q16_t q16_cos(q16_t angle);
+
+//! Both at once, with the reduction of the angle done only once
+void q16_sincos(q16_t angle, q16_t & sin, q16_t & cos);
+
+//! The angle of (x,y) from -pi to pi, 0 for the origin
+q16_t q16_atan2(q16_t y, q16_t x);
+
+#endif /* FIXMATH_H_ */
@@ -26,7 +26,12 @@
 
 #include <CController.h>
 
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
 #include <syslog.h> // LOG_EMERG
+#include <time.h>
 
 //! The name of the controller can be used for controller selection
 static const std::string NAME = "CController";
@@ -35,9 +40,15 @@ static const std::string NAME = "CController";
 #define DEBUG NAME << '[' << getpid() << "] " << __func__ << "(): "
 
 CController::CController(): port(""), server(NULL), robot(NULL), robot_type(RobotBase::UNKNOWN), robot_id(-1),
-log_level(LOG_EMERG), initialized_robot(false), initialized_server(false) {}
+log_level(LOG_EMERG), initialized_robot(false), initialized_server(false), cycle_period(CONTROLLER_POLL_PERIOD),
+running(false), standby(false), looping(false) {
+	sem_init(&event, 0, 0);
+	resetCycleStats();
+}
 
-CController::~CController() { }
+CController::~CController() {
+	sem_destroy(&event);
+}
 
 //! First get the port of the jockey
 void CController::parsePort(int argc, char **argv) {
@@ -93,4 +104,191 @@ void CController::start() {
 	usleep(10000);
 }
 
+/***********************************************************************************************************************
+ * Main loop
+ **********************************************************************************************************************/
+
+//! Monotonic time in us, the eth bridle does not depend on CTimer of the common one
+static int64_t monotonicTime() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (int64_t)time.tv_sec * 1000000 + time.tv_nsec / 1000;
+}
+
+static void sleepUntil(int64_t time) {
+	struct timespec until;
+	until.tv_sec = time / 1000000;
+	until.tv_nsec = (time % 1000000) * 1000;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR);
+}
+
+bool CController::setRealtimePriority(int priority) {
+	struct sched_param param;
+	param.sched_priority = priority;
+	int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if (error) {
+		std::cerr << DEBUG << "Can not run with SCHED_FIFO priority " << priority << ": " << strerror(error) << std::endl;
+		return false;
+	}
+	if (log_level >= LOG_INFO) {
+		std::cout << DEBUG << "Run with SCHED_FIFO priority " << priority << std::endl;
+	}
+	return true;
+}
+
+void CController::notify() {
+	sem_post(&event);
+}
+
+void CController::resetCycleStats() {
+	memset(&stats, 0, sizeof(stats));
+}
+
+void CController::printCycleStats() {
+	long cycles = stats.cycles ? stats.cycles : 1;
+	std::cout << DEBUG << stats.cycles << " cycles, tick() took " << stats.total_work / cycles << "us on average and "
+			<< stats.max_work << "us at most, " << stats.overruns << " overruns, " << stats.skipped
+			<< " periods skipped, started " << stats.total_lateness / cycles << "us late on average and "
+			<< stats.max_lateness << "us at most" << std::endl;
+}
 
+void CController::onInit() {
+	initRobot();
+	initRobotPeriphery();
+	pause();
+}
+
+void CController::onStart() {
+	start();
+}
+
+void CController::onStop() {
+	pause();
+}
+
+/**
+ * MSG_INIT normally came first already, then there is nothing left to do for a controller that opens its devices in
+ * start().
+ */
+void CController::onStandby() {
+	if (!initialized_robot) onInit();
+}
+
+void CController::onCalibrate() {
+}
+
+void CController::onQuit() {
+	pause();
+}
+
+void CController::onMessage(const CMessage & message) {
+}
+
+void CController::onParams() {
+}
+
+bool CController::dispatch(const CMessage & message) {
+	if (message.type != MSG_NONE && log_level >= LOG_DEBUG) {
+		std::cout << DEBUG << "Got command: \"" << StrMessage[message.type] << "\" of length " << message.len << std::endl;
+	}
+	switch (message.type) {
+	case MSG_NONE:
+		return true;
+	case MSG_INIT:
+		onInit();
+		break;
+	case MSG_START:
+		onStart();
+		running = true;
+		break;
+	case MSG_STOP:
+		running = false;
+		onStop();
+		break;
+	case MSG_CALIBRATE:
+		onCalibrate();
+		break;
+	case MSG_STANDBY:
+		standby = (message.len < 1 || message.data[0] != 0);
+		if (standby) onStandby();
+		break;
+	case MSG_QUIT:
+		running = false;
+		onQuit();
+		acknowledge();
+		return false;
+	default:
+		onMessage(message);
+		return true;
+	}
+	acknowledge();
+	return true;
+}
+
+/**
+ * Every cycle first handles the message that came in, if any, and picks up changed parameters, then ticks if the jockey
+ * is started. A cycle starts at its deadline, or as soon as possible after it when the previous tick() took longer than
+ * a period.
+ */
+int CController::run() {
+	assert (server != NULL);
+	looping = true;
+	if (params.attach() && log_level >= LOG_INFO) {
+		std::cout << DEBUG << "Use the parameters of CEquids, version " << params.getVersion() << std::endl;
+	}
+	int64_t deadline = monotonicTime();
+	while (looping) {
+		server->heartbeat(running, stats.cycles, stats.overruns);
+		if (!dispatch(getMessage())) break;
+		if (!looping) break;
+		if (params.update()) onParams();
+
+		if (!running) {
+			usleep(standby ? STANDBY_POLL_PERIOD : CONTROLLER_POLL_PERIOD);
+			deadline = monotonicTime();
+			continue;
+		}
+
+		if (cycle_period == 0) {
+			// wait for notify(), but look for messages every poll period
+			struct timespec timeout;
+			clock_gettime(CLOCK_REALTIME, &timeout);
+			timeout.tv_nsec += CONTROLLER_POLL_PERIOD * 1000;
+			timeout.tv_sec += timeout.tv_nsec / 1000000000;
+			timeout.tv_nsec %= 1000000000;
+			if (sem_timedwait(&event, &timeout) != 0) continue;
+			// one tick for all the notifications so far
+			while (sem_trywait(&event) == 0);
+			deadline = monotonicTime();
+		}
+
+		int64_t begin = monotonicTime();
+		int64_t lateness = begin - deadline;
+		tick();
+		int64_t end = monotonicTime();
+
+		stats.cycles++;
+		stats.total_work += end - begin;
+		if (end - begin > stats.max_work) stats.max_work = end - begin;
+		stats.total_lateness += lateness;
+		if (lateness > stats.max_lateness) stats.max_lateness = lateness;
+
+		if (cycle_period > 0) {
+			deadline += cycle_period;
+			if (end > deadline) {
+				stats.overruns++;
+				if (end - deadline > CONTROLLER_MAX_BEHIND * cycle_period) {
+					stats.skipped += (end - deadline) / cycle_period;
+					deadline = end;
+				}
+			} else {
+				sleepUntil(deadline);
+			}
+		}
+	}
+	looping = false;
+	if (log_level >= LOG_INFO) {
+		printCycleStats();
+	}
+	return EXIT_SUCCESS;
+}
@@ -29,8 +29,30 @@
 
 #include <string>
 #include <CMessageServer.h>
+#include <CParams.h>
 #include <IRobot.h>
 #include <cassert>
+#include <semaphore.h>
+#include <stdint.h>
+
+//! Period in us at which run() looks for messages while stopped, or while it waits for notify()
+#define CONTROLLER_POLL_PERIOD 50000
+//! A loop that is behind by more than this many periods skips them instead of catching up
+#define CONTROLLER_MAX_BEHIND 10
+
+//! Timing of the cycles of run(), in us
+struct CycleStats {
+	long cycles;
+	//! Cycles in which tick() took longer than the period
+	long overruns;
+	//! Periods skipped because the loop was behind by more than CONTROLLER_MAX_BEHIND
+	long skipped;
+	int64_t total_work;
+	int64_t max_work;
+	//! How late the cycles started with respect to their deadline
+	int64_t total_lateness;
+	int64_t max_lateness;
+};
 
 /**
  * Controller base class to be used in jockey framework. Functions that require implementation are initRobotPeriphery()
@@ -38,6 +60,14 @@
  * work. Of course subclasses can have other specialized functions.
  *
  * The controller has a CMessageServer instance, to connect to it use a CMessageClient.
+ *
+ * Instead of a main loop of its own a jockey can call run(). It handles the messages of the jockey framework with the
+ * on...() functions and calls tick() while started, every period of setCycle() or after every notify(). The deadlines
+ * of the cycles are absolute, so they do not drift, and getCycleStats() tells how long the ticks took and how late
+ * they started. Before every tick() it picks up the parameters CEquids changed, and calls onParams() if any did.
+ *
+ * While it runs, run() sends CEquids a MSG_HEARTBEAT every HEARTBEAT_PERIOD, also while it is stopped, so the watchdog
+ * of CEquids notices when a tick() or a handler hangs and restarts the jockey.
  */
 class CController {
 public:
@@ -58,14 +88,17 @@ public:
 	virtual void initRobotPeriphery() = 0;
 
 	//! Pause in jockey framework
-	void pause();
+	virtual void pause();
 
 	//! Start in jockey framework
-	void start();
+	virtual void start();
 
 	//! Ack in jockey framework
 	void acknowledge();
 
+	//! Got MSG_STANDBY, CEquids may start the jockey any moment
+	inline bool inStandby() { return standby; }
+
 	//! Controller specific code
 	virtual void tick() = 0;
 
@@ -83,7 +116,46 @@ public:
 		log_level = verbosity;
 	}
 
+	//! Call tick() every period us in run(), or with a period of 0 only after notify()
+	inline void setCycle(int period) { cycle_period = period; }
+
+	//! Run the calling thread and the threads it starts later on with SCHED_FIFO, false if that is not permitted
+	bool setRealtimePriority(int priority);
+
+	//! Handle messages and tick until MSG_QUIT or stopLoop()
+	int run();
+
+	//! Let run() return after the current cycle, safe from a signal handler
+	inline void stopLoop() { looping = false; }
+
+	//! Wake run() for a tick when the cycle is event-driven, safe from other threads and from a signal handler
+	void notify();
+
+	inline const CycleStats & getCycleStats() { return stats; }
+
+	void resetCycleStats();
+
+	void printCycleStats();
+
 protected:
+	//! Handlers of run() for the messages of the jockey framework, run() acknowledges the message afterwards
+	virtual void onInit();
+	virtual void onStart();
+	virtual void onStop();
+	//! Get everything ready for onStart() that does not take the camera or the motors from the running jockey
+	virtual void onStandby();
+	virtual void onCalibrate();
+	virtual void onQuit();
+
+	//! Other messages that come in during run(), by default they are ignored
+	virtual void onMessage(const CMessage & message);
+
+	//! The shared parameters changed, the pointers of params.bind() already give the new values
+	virtual void onParams();
+
+	//! Parameters served by CEquids, run() attaches to them and updates them at every cycle boundary
+	CParams params;
+
 	//! Port of jockey framework
 	std::string port;
 
@@ -106,6 +178,26 @@ protected:
 	bool initialized_robot;
 
 	bool initialized_server;
+
+	//! Period in us of the cycle of run(), 0 for event-driven
+	int cycle_period;
+
+	//! While run() is started, it calls tick()
+	bool running;
+
+	//! Look for messages every STANDBY_POLL_PERIOD while stopped
+	bool standby;
+
+	volatile bool looping;
+
+	//! Posted by notify()
+	sem_t event;
+
+	CycleStats stats;
+
+private:
+	//! Calls the handler of a message and acknowledges it, false if the message was MSG_QUIT
+	bool dispatch(const CMessage & message);
 };
 
 
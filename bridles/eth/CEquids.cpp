@@ -1,8 +1,14 @@
 #include "CEquids.h"
+#include <CRobotIndex.h>
+#include <CSched.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <iostream>
+#include <algorithm>
 
 #define MAX_BUFFER 1024
 
@@ -13,14 +19,29 @@
 CEquids::CEquids() {
 	num_jockeys = 0;
 	runningJockey = -1;
+	sem_init(&subscribeSem, 0, 1);
+	arrived = 0;
+	anyNext = 0;
+	watching = false;
+	pthread_mutex_init(&arrivalMutex, NULL);
+	pthread_cond_init(&arrivalCond, NULL);
 }
 
 CEquids::~CEquids() {
 	//   quit();
+	stopWatchdog();
+	pthread_cond_destroy(&arrivalCond);
+	pthread_mutex_destroy(&arrivalMutex);
 }
 
 /**
- * Read the jockeys from file.
+ * Read the jockeys from file. The argument "transport=shm" is not passed on to the jockey, it makes CEquids talk to it
+ * over shared memory instead of TCP. The argument "queue=<policy>" sets what happens with a message that arrives when
+ * the queue of the jockey is full, see CMessageQueue::parsePolicy. The argument "timeout=<ms>" sets how long start
+ * waits for the jockey to acknowledge MSG_INIT. The argument "standby" puts the jockey in standby after MSG_INIT, see
+ * standbyJockey. The argument "sched=<cpus>:<class>:<priority>" sets the cores, scheduling class and priority of the
+ * jockey, "sched.<thread>=" those of a thread of it, such as sched.camera=2-3:fifo:10, see CSched.h. The argument
+ * "watchdog=<ms>" sets how long the jockey may go without a heartbeat before it is restarted, 0 never restarts it.
  */
 int CEquids::analyze(char *buf, FILE *fd) {
 	int ret = 1;
@@ -41,7 +62,7 @@ int CEquids::analyze(char *buf, FILE *fd) {
 		} else if (p==1) {
 			// second argument is the port, will always be added
 			j->argv[0] = strdup(tmp);
-			j->port_num = 50000+num_jockeys;
+			j->port_num = ROBOT_PORT_BASE + ROBOT_PORT_STRIDE * robotIndex() + num_jockeys;
 			sprintf(port_str,"%i",j->port_num);
 			j->argv[1] = strdup(port_str);
 			p++;
@@ -53,6 +74,38 @@ int CEquids::analyze(char *buf, FILE *fd) {
 			}
 			if (strlen(tmp)>0) {
 				tmp[ptr+1]=0;
+				TOverflowPolicy policy;
+				if (!strcmp(tmp, "transport=shm")) {
+					j->shared = true;
+					tmp = strtok(NULL, " ,");
+					continue;
+				} else if (!strncmp(tmp, "queue=", 6) && CMessageQueue::parsePolicy(tmp + 6, policy)) {
+					j->getQueue().setPolicy(policy);
+					tmp = strtok(NULL, " ,");
+					continue;
+				} else if (!strncmp(tmp, "timeout=", 8) && atoi(tmp + 8) > 0) {
+					j->init_timeout = atoi(tmp + 8);
+					tmp = strtok(NULL, " ,");
+					continue;
+				} else if (!strcmp(tmp, "standby")) {
+					j->standby = true;
+					tmp = strtok(NULL, " ,");
+					continue;
+				} else if (!strncmp(tmp, "sched=", 6)) {
+					j->sched = tmp + 6;
+					tmp = strtok(NULL, " ,");
+					continue;
+				} else if (!strncmp(tmp, "watchdog=", 9)) {
+					j->watchdog_deadline = atoi(tmp + 9);
+					j->watched = j->watchdog_deadline > 0;
+					tmp = strtok(NULL, " ,");
+					continue;
+				} else if (!strncmp(tmp, "sched.", 6) && strchr(tmp, '=') != NULL) {
+					if (!j->thread_sched.empty()) j->thread_sched += ';';
+					j->thread_sched += tmp + 6;
+					tmp = strtok(NULL, " ,");
+					continue;
+				}
 				j->argv[p] = strdup(tmp);
 				printf("Parse argument for %s: %s\n", j->name, tmp);
 				p++;
@@ -72,47 +125,116 @@ int CEquids::analyze(char *buf, FILE *fd) {
 	return ret;
 } 
 
+/**
+ * The child of vfork shares the memory of this process until it calls exec, so it can report a failed exec in error.
+ */
+bool CEquids::spawn(int i) {
+	volatile bool error = false;
+	char exe[128];
+	// the child of vfork borrows the environment of this process until it calls exec
+	std::string environment;
+	char *previous = getenv("THREAD_SCHED");
+	if (previous != NULL) environment = previous;
+	if (!jockeys[i].thread_sched.empty()) setenv("THREAD_SCHED", jockeys[i].thread_sched.c_str(), 1);
+	int pid = vfork();
+	if (pid==0) {
+		fprintf(stdout, "Starting process %s with %s ", jockeys[i].argv[0], jockeys[i].argv[1]);
+		char *a; int j = 2;
+		while ((a = jockeys[i].argv[j]) != NULL) {
+			printf("%s ", a);
+			j++;
+		}
+		printf("\n");
+		if (execvp(jockeys[i].argv[0], jockeys[i].argv)<0) {
+			sprintf(exe,"%s", jockeys[i].argv[0]);
+			fprintf(stderr, "Cannot exec process %s\n", exe);
+			error = true;
+		}
+		exit(1);
+	} else if (pid>0) {
+		jockeys[i].pid = pid;
+		// the first heartbeat may take as long as MSG_INIT
+		jockeys[i].heartbeat_at = CJockey::now() + (long long)jockeys[i].init_timeout * 1000;
+		applySched(i);
+	} else {
+		fprintf(stderr, "Cannot fork new process. Error %i\n",pid);
+		error = true;
+	}
+	if (!jockeys[i].thread_sched.empty()) {
+		if (previous != NULL) setenv("THREAD_SCHED", environment.c_str(), 1);
+		else unsetenv("THREAD_SCHED");
+	}
+	return !error;
+}
+
 bool CEquids::start() {
-	int i;
-	int pid;
 	bool error = false;
-	char exe[128];
 
 	for (int i=0; i<num_jockeys; i++) {
-		pid = vfork();
-		if (pid==0) {
-			fprintf(stdout, "Starting process %s with %s ", jockeys[i].argv[0], jockeys[i].argv[1]);
-			char *a; int j = 2;
-			while ((a = jockeys[i].argv[j]) != NULL) {
-				printf("%s ", a);
-				j++;
-			}
-			printf("\n");
-			if (execvp(jockeys[i].argv[0], jockeys[i].argv)<0) {
-				sprintf(exe,"%s", jockeys[i].argv[0]);
-				fprintf(stderr, "Cannot exec process %s\n", exe);
-				error = true;
-			}
-			exit(1);
-		} else if (pid>0) {
-			jockeys[i].init(pid,this);
-			jockeys[i].SendMessage(MSG_INIT, NULL, 0);
-			while (jockeys[i].acknowledge==0) {
-				usleep(10000);
-			}
-		} else {
-			fprintf(stderr, "Cannot fork new process. Error %i\n",pid);
+		// the segment has to exist before the jockey starts its server
+		if (jockeys[i].shared && !jockeys[i].jockey_IPC.CreateShared(jockeys[i].port_num)) {
+			fprintf(stderr, "No shared memory for %s, use TCP\n", jockeys[i].name);
+			jockeys[i].shared = false;
+		}
+		if (!spawn(i)) error = true;
+	}
+
+	// all jockeys boot at the same time, connect to them and send every one MSG_INIT before waiting for any
+	long long begin = CJockey::now();
+	for (int i=0; i<num_jockeys; i++) {
+		if (jockeys[i].pid <= 0) continue;
+		jockeys[i].init(jockeys[i].pid,this);
+		jockeys[i].SendMessage(MSG_INIT, NULL, 0);
+	}
+	for (int i=0; i<num_jockeys; i++) {
+		if (jockeys[i].pid <= 0) continue;
+		long long deadline = jockeys[i].requested_at + (long long)jockeys[i].init_timeout * 1000;
+		long long left = deadline - CJockey::now();
+		if (!jockeys[i].waitForAck(left > 0 ? (int)(left / 1000) : 0)) {
+			fprintf(stderr, "Jockey %s did not acknowledge MSG_INIT within %i ms\n", jockeys[i].name,
+					jockeys[i].init_timeout);
 			error = true;
+		} else {
+			std::cout << DEBUG << "Jockey " << jockeys[i].name << " ready after " <<
+					(jockeys[i].acknowledged_at - begin) / 1000 << " ms" << std::endl;
 		}
 	}
+	for (int i=0; i<num_jockeys; i++) {
+		if (jockeys[i].pid > 0 && jockeys[i].standby) standbyJockey(i);
+	}
+	startWatchdog();
 	return !error;
 }
 
+/**
+ * The jockey did not start any thread yet when vfork returns, because the parent only continues after the exec, so the
+ * threads it starts later get the same setting.
+ */
+void CEquids::applySched(int j) {
+	if (jockeys[j].sched.empty()) return;
+	SchedSetting setting;
+	if (!schedParse(jockeys[j].sched.c_str(), setting)) {
+		fprintf(stderr, "The setting sched=%s of %s is not valid\n", jockeys[j].sched.c_str(), jockeys[j].name);
+		return;
+	}
+	if (schedApply(jockeys[j].pid, setting, jockeys[j].name)) {
+		std::cout << DEBUG << "Jockey " << jockeys[j].name << " runs with sched=" << jockeys[j].sched << std::endl;
+	}
+}
+
+bool CEquids::serveParams(const char *filename) {
+	if (!params.load(filename)) return false;
+	return params.watch();
+}
+
 bool CEquids::init(const char *filename) {
 	bool result = false;
 	bool error = false;
 	char buf[MAX_BUFFER];
 
+	char *parameters = getenv("EQUIDS_PARAMS");
+	if (parameters != NULL) serveParams(parameters);
+
 	FILE *fp = fopen(filename, "r");
 	if (fp) {
 		while (fgets(buf, MAX_BUFFER, fp)!=NULL && !error && num_jockeys<(MAX_JOCKEYS-1)) {
@@ -132,7 +254,6 @@ bool CEquids::init(const char *filename) {
 }
 //permanently means that it is not stored in runnigng jockey
 void CEquids::initJockey(int j, bool permanently) {
-	usleep(500000);
 	if(!jockeys[j].started){
 		if (j>=0 && j<num_jockeys) {
 			if(!permanently) {
@@ -140,9 +261,7 @@ void CEquids::initJockey(int j, bool permanently) {
 			}
 			std::cout << DEBUG << "Send MSG_START to jockey " << jockeys[j].name << std::endl;
 			jockeys[j].SendMessage(MSG_START, NULL, 0);
-			while (jockeys[j].acknowledge==0) {
-				usleep(10000);
-			}
+			jockeys[j].waitForAck();
 			std::cout << DEBUG << "Got acknowledgment from jockey " << jockeys[j].name << " for MSG_START" << std::endl;
 			jockeys[j].started = true;
 		} else {
@@ -156,6 +275,144 @@ void CEquids::initJockey(int j, bool permanently) {
 	}
 }
 
+/**
+ * A jockey in standby is initialized and looks for messages every few milliseconds instead of every poll period of a
+ * paused jockey, so switchToJockey only waits for the running jockey to give up the camera and the motors, and for the
+ * next one to take them. A jockey stays in standby after MSG_STOP, so switching back to it is fast as well.
+ */
+bool CEquids::standbyJockey(int j, bool enable) {
+	if (j<0 || j>=num_jockeys) {
+		fprintf(stderr, "Error! This jockey does not exist!\n");
+		return false;
+	}
+	uint8_t value = enable;
+	jockeys[j].SendMessage(MSG_STANDBY, &value, sizeof(value));
+	if (!jockeys[j].waitForAck(jockeys[j].init_timeout)) {
+		fprintf(stderr, "Jockey %s did not acknowledge MSG_STANDBY within %i ms\n", jockeys[j].name,
+				jockeys[j].init_timeout);
+		jockeys[j].standby = false;
+		return false;
+	}
+	jockeys[j].standby = enable;
+	std::cout << DEBUG << "Jockey " << jockeys[j].name << (enable ? " is in standby" : " left standby") << std::endl;
+	return true;
+}
+
+/**
+ * The connection of the jockey dials the new process on the same port by itself, MSG_INIT is sent once it is back.
+ * The jockey goes through the same steps as at the start: MSG_INIT, MSG_STANDBY if it was in standby, which gets it
+ * ready within milliseconds, and MSG_START if it was started. A scenario that waits for an acknowledgment of the jockey
+ * meanwhile gets one of the restart, instead of waiting forever.
+ */
+bool CEquids::restartJockey(int j) {
+	if (j<0 || j>=num_jockeys) {
+		fprintf(stderr, "Error! This jockey does not exist!\n");
+		return false;
+	}
+	CJockey & jockey = jockeys[j];
+	bool started = jockey.started;
+	if (jockey.pid > 0) {
+		kill(jockey.pid, SIGKILL);
+		waitpid(jockey.pid, NULL, 0);
+		jockey.pid = -1;
+	}
+	jockey.restarts++;
+	long long begin = CJockey::now();
+	long long end = begin + (long long)jockey.init_timeout * 1000;
+	unsigned int reconnects = jockey.jockey_IPC.Reconnects();
+	if (!spawn(j)) {
+		// tried again after a deadline
+		if (jockey.pid > 0) waitpid(jockey.pid, NULL, 0);
+		jockey.pid = -1;
+		jockey.heartbeat_at = CJockey::now();
+		return false;
+	}
+	while (!jockey.shared && jockey.jockey_IPC.Reconnects() == reconnects && CJockey::now() < end) {
+		usleep(CEQUIDS_WATCHDOG_PERIOD * 100);
+	}
+	jockey.SendMessage(MSG_INIT, NULL, 0);
+	long long left = end - CJockey::now();
+	if (!jockey.waitForAck(left > 0 ? (int)(left / 1000) : 0)) {
+		fprintf(stderr, "Jockey %s did not acknowledge MSG_INIT within %i ms after a restart\n", jockey.name,
+				jockey.init_timeout);
+		return false;
+	}
+	if (jockey.standby && !standbyJockey(j)) return false;
+	if (started) {
+		jockey.SendMessage(MSG_START, NULL, 0);
+		if (!jockey.waitForAck(jockey.init_timeout)) {
+			fprintf(stderr, "Jockey %s did not acknowledge MSG_START within %i ms after a restart\n", jockey.name,
+					jockey.init_timeout);
+			return false;
+		}
+	}
+	std::cout << DEBUG << "Restarted jockey " << jockey.name << (started ? " and started it" : "") << " in " <<
+			(CJockey::now() - begin) / 1000 << " ms" << std::endl;
+	return true;
+}
+
+bool CEquids::startWatchdog() {
+	if (watching) return true;
+	watching = true;
+	if (pthread_create(&watchdogThread, NULL, &CEquids::runWatchdog, this) != 0) {
+		fprintf(stderr, "Could not start the watchdog\n");
+		watching = false;
+		return false;
+	}
+	return true;
+}
+
+void CEquids::stopWatchdog() {
+	if (!watching) return;
+	watching = false;
+	pthread_join(watchdogThread, NULL);
+}
+
+void* CEquids::runWatchdog(void *equids) {
+	schedThread("watchdog");
+	((CEquids*) equids)->watch();
+	return NULL;
+}
+
+/**
+ * A jockey whose process exited is restarted at once, one that is silent for longer than its deadline is killed and
+ * restarted. A jockey that cannot be restarted is tried again after another deadline, up to CEQUIDS_MAX_RESTARTS.
+ */
+void CEquids::watch() {
+	while (watching) {
+		usleep(CEQUIDS_WATCHDOG_PERIOD * 1000);
+		for (int j = 0; j < num_jockeys && watching; ++j) {
+			CJockey & jockey = jockeys[j];
+			if (!jockey.watched) continue;
+			bool exited = jockey.pid > 0 && waitpid(jockey.pid, NULL, WNOHANG) == jockey.pid;
+			long long silent = CJockey::now() - jockey.heartbeat_at;
+			if (!exited && silent <= (long long)jockey.watchdog_deadline * 1000) continue;
+			if (exited) {
+				jockey.pid = -1;
+				fprintf(stderr, "Jockey %s exited\n", jockey.name);
+			} else if (jockey.pid > 0) {
+				jockey.missed_deadlines++;
+				fprintf(stderr, "Jockey %s sent no heartbeat for %lld ms\n", jockey.name, silent / 1000);
+			}
+			if (jockey.restarts >= CEQUIDS_MAX_RESTARTS) {
+				fprintf(stderr, "Jockey %s was restarted %ld times, it is not watched anymore\n", jockey.name,
+						jockey.restarts);
+				jockey.watched = false;
+				continue;
+			}
+			restartJockey(j);
+		}
+	}
+}
+
+void CEquids::printWatchdogStats() {
+	for (int i = 0; i < num_jockeys; ++i) {
+		if (!jockeys[i].watched && jockeys[i].restarts == 0) continue;
+		std::cout << DEBUG << "Jockey " << jockeys[i].name << ": " << jockeys[i].heartbeats << " heartbeats, " <<
+				jockeys[i].missed_deadlines << " missed deadlines, " << jockeys[i].restarts << " restarts" << std::endl;
+	}
+}
+
 //! Returns identifiers, not indices!
 void CEquids::getAllRunningJockeys(std::vector<vocab_t> &jockeyIds) {
 	jockeyIds.clear();
@@ -176,12 +433,11 @@ void CEquids::switchToJockey(int j) {
 			std::cout << DEBUG << "Switch from jockey " << jockeys[runningJockey].name << " to jockey " << jockeys[j].name << std::endl;
 	}
 
+	long long begin = CJockey::now();
 	if (runningJockey>=0 && runningJockey<num_jockeys) {
 		std::cout << DEBUG << "Send MSG_STOP to jockey " << jockeys[runningJockey].name << std::endl;
 		jockeys[runningJockey].SendMessage(MSG_STOP, NULL, 0);
-		while (jockeys[runningJockey].acknowledge==0) {
-			usleep(10000);
-		}
+		jockeys[runningJockey].waitForAck();
 		std::cout << DEBUG << "Got acknowledgment from jockey " << jockeys[runningJockey].name << " for MSG_STOP" << std::endl;
 		jockeys[runningJockey].started = false;
 	}
@@ -189,11 +445,11 @@ void CEquids::switchToJockey(int j) {
 		runningJockey = j;
 		std::cout << DEBUG << "Send MSG_START to jockey " << jockeys[j].name << std::endl;
 		jockeys[j].SendMessage(MSG_START, NULL, 0);
-		while (jockeys[j].acknowledge==0) {
-			usleep(10000);
-		}
+		jockeys[j].waitForAck();
 		std::cout << DEBUG << "Got acknowledgment from jockey " << jockeys[j].name << " for MSG_START" << std::endl;
 		jockeys[runningJockey].started = true;
+		std::cout << DEBUG << "Switched to jockey " << jockeys[j].name << (jockeys[j].standby ? " in standby" : "") <<
+				" in " << (jockeys[j].acknowledged_at - begin) / 1000 << " ms" << std::endl;
 	}
 }
 
@@ -209,6 +465,68 @@ void CEquids::sendMessage(int jockey,int type, void *data, int len){
 	}
 }
 
+unsigned int CEquids::arrivals() {
+	pthread_mutex_lock(&arrivalMutex);
+	unsigned int count = arrived;
+	pthread_mutex_unlock(&arrivalMutex);
+	return count;
+}
+
+bool CEquids::waitForArrival(unsigned int seen, int timeout) {
+	long long end = CJockey::now() + (long long)timeout * 1000;
+	struct timespec deadline;
+	deadline.tv_sec = end / 1000000;
+	deadline.tv_nsec = (end % 1000000) * 1000;
+	pthread_mutex_lock(&arrivalMutex);
+	int ret = 0;
+	while (arrived == seen && ret != ETIMEDOUT) {
+		if (timeout < 0) {
+			pthread_cond_wait(&arrivalCond, &arrivalMutex);
+		} else {
+			ret = pthread_cond_timedwait(&arrivalCond, &arrivalMutex, &deadline);
+		}
+	}
+	bool any = (arrived != seen);
+	pthread_mutex_unlock(&arrivalMutex);
+	return any;
+}
+
+void CEquids::notifyArrival() {
+	pthread_mutex_lock(&arrivalMutex);
+	arrived++;
+	pthread_cond_broadcast(&arrivalCond);
+	pthread_mutex_unlock(&arrivalMutex);
+}
+
+int CEquids::waitAny(const std::vector<int> & jockeySet, int timeout, CMessage & message) {
+	message.type = MSG_NONE;
+	if (jockeySet.empty()) {
+		// nothing can arrive, only the timeout is left
+		if (timeout > 0) usleep(timeout * 1000);
+		return -1;
+	}
+	long long end = CJockey::now() + (long long)timeout * 1000;
+	unsigned int count = jockeySet.size();
+	while (true) {
+		unsigned int seen = arrivals();
+		for (unsigned int i = 0; i < count; ++i) {
+			int j = jockeySet[(anyNext + i) % count];
+			message = getMessage(j);
+			if (message.type != MSG_NONE) {
+				anyNext = (anyNext + i + 1) % count;
+				return j;
+			}
+		}
+		int left = -1;
+		if (timeout >= 0) {
+			long long now = CJockey::now();
+			if (now >= end) return -1;
+			left = (int)((end - now + 999) / 1000);
+		}
+		waitForArrival(seen, left);
+	}
+}
+
 CMessage CEquids::getMessage(int j) {
 	CMessage message;
 	if (j >= 0 && j < num_jockeys) {
@@ -222,9 +540,61 @@ CMessage CEquids::getMessage(int j) {
 }
 
 void CEquids::sendMessageToALL(int type, void *data, int len){
+	int size = IPC::IPC::SerializedSize(len);
+	uint8_t bytes[size];
+	IPC::IPC::Serialize(type, (const uint8_t*)data, len, bytes);
 	for (int var = 0; var < num_jockeys; ++var) {
-		jockeys[var].SendMessage(type, data, len);
+		jockeys[var].ForwardMessage(bytes, size, type, data, len);
+	}
+}
+
+void CEquids::subscribe(int jockey, TMessageType type) {
+	if (jockey < 0 || jockey >= num_jockeys || type >= TOTAL_NUMBER_OF_MESSAGES) return;
+	sem_wait(&subscribeSem);
+	std::vector<int> & list = subscribers[type];
+	if (std::find(list.begin(), list.end(), jockey) == list.end()) {
+		list.push_back(jockey);
+		std::cout << DEBUG << "Jockey " << jockeys[jockey].name << " subscribed to " << StrMessage[type] << std::endl;
 	}
+	sem_post(&subscribeSem);
+}
+
+void CEquids::unsubscribe(int jockey, TMessageType type) {
+	if (type >= TOTAL_NUMBER_OF_MESSAGES) return;
+	sem_wait(&subscribeSem);
+	std::vector<int> & list = subscribers[type];
+	list.erase(std::remove(list.begin(), list.end(), jockey), list.end());
+	sem_post(&subscribeSem);
+}
+
+void CEquids::unsubscribeAll(int jockey) {
+	sem_wait(&subscribeSem);
+	for (int i = 0; i < TOTAL_NUMBER_OF_MESSAGES; ++i) {
+		subscribers[i].erase(std::remove(subscribers[i].begin(), subscribers[i].end(), jockey), subscribers[i].end());
+	}
+	sem_post(&subscribeSem);
+}
+
+/**
+ * The message is serialized only once and the same bytes are queued on the connection of every subscriber.
+ */
+bool CEquids::publish(int type, const void *data, int len, int source) {
+	if (type < 0 || type >= TOTAL_NUMBER_OF_MESSAGES) return false;
+	sem_wait(&subscribeSem);
+	const std::vector<int> & list = subscribers[type];
+	bool published = false;
+	if (!list.empty()) {
+		int size = IPC::IPC::SerializedSize(len);
+		uint8_t bytes[size];
+		IPC::IPC::Serialize(type, (const uint8_t*)data, len, bytes);
+		for (unsigned int i = 0; i < list.size(); ++i) {
+			if (list[i] == source) continue;
+			jockeys[list[i]].ForwardMessage(bytes, size, type, data, len);
+			published = true;
+		}
+	}
+	sem_post(&subscribeSem);
+	return published;
 }
 
 int CEquids::find(const char *name, vocab_t vocab_id) {
@@ -243,18 +613,20 @@ void CEquids::quit() {
 	int ptr=0;
 	int st=0;
 
+	// the jockeys are about to exit, that is not for the watchdog to repair
+	stopWatchdog();
+	printWatchdogStats();
+
 	if (runningJockey>=0 && runningJockey<num_jockeys) {
 		jockeys[runningJockey].SendMessage(MSG_STOP, NULL, 0);
-		while (jockeys[runningJockey].acknowledge==0) {
-			usleep(10000);
-		}
+		jockeys[runningJockey].waitForAck();
 	}
 	for (int i=0; i<num_jockeys; i++) {
 		jockeys[i].quit();
 	}
 	sleep(1);
 	while(ptr<num_jockeys) {
-		wait();
+		wait(NULL);
 		fprintf(stdout, "finished process \n");
 		ptr++;
 	}
@@ -8,22 +8,53 @@
 #define __CEQUIDS_H__
 
 #include "CJockey.h"
+#include "CParams.h"
 #include <stdio.h>
 #include <vector>
 
 #include <CMessage.h>
+#include <pthread.h>
+#include <semaphore.h>
 
 #define MAX_JOCKEYS 20
 
+//! Period in ms at which the watchdog looks at the heartbeats of the jockeys
+#ifndef CEQUIDS_WATCHDOG_PERIOD
+#define CEQUIDS_WATCHDOG_PERIOD 250
+#endif
+//! Restarts of a jockey after which the watchdog gives up on it
+#ifndef CEQUIDS_MAX_RESTARTS
+#define CEQUIDS_MAX_RESTARTS 10
+#endif
+
 
 class CEquids
 {
 	CJockey jockeys[MAX_JOCKEYS];
 	int analyze(char *line, FILE *fp);
 	bool start();
+	//! Start the process of a jockey, with its arguments and settings of the configuration file
+	bool spawn(int j);
+	//! Apply "sched=" of the configuration file to a jockey that was just started
+	void applySched(int j);
+	//! Restarts jockeys whose heartbeat stopped or whose process exited
+	pthread_t watchdogThread;
+	volatile bool watching;
+	static void* runWatchdog(void *equids);
+	void watch();
 	int num_jockeys;
 	int runningJockey;
 	int message;
+	//! The jockeys that subscribed to every message type
+	std::vector<int> subscribers[TOTAL_NUMBER_OF_MESSAGES];
+	sem_t subscribeSem;
+	CParamServer params;
+	//! Messages queued at any jockey so far, see waitForArrival
+	unsigned int arrived;
+	pthread_mutex_t arrivalMutex;
+	pthread_cond_t arrivalCond;
+	//! Where waitAny starts reading the next time
+	unsigned int anyNext;
 public:
 	CEquids();
 	~CEquids();
@@ -33,13 +64,49 @@ public:
 	void getAllRunningJockeys(std::vector<vocab_t> &jockeyIds);
 	CJockey* getJockey(int jockeyNumber){return &this->jockeys[jockeyNumber];};
 	bool init(const char *filename);
+	//! Parse a parameter file once for all jockeys and watch it for changes, see CParams.h. Call it before init(), or
+	//! set EQUIDS_PARAMS to the file, so the jockeys find the parameters when they start
+	bool serveParams(const char *filename);
+	inline CParamServer & getParams() { return params; }
 	// permanently means that jockey do not stores its id to running_jockey parameter
 	void initJockey(int j,bool permanently=false);
+	//! Switch the running jockey, the stopped jockey acknowledges before the next one is started
 	void switchToJockey(int j);
+	//! Let a jockey get ready to be started, or not anymore, so a switch to it takes milliseconds instead of a poll period
+	bool standbyJockey(int j, bool enable = true);
+	//! Kill a jockey and start it again up to where it was: initialized, in standby and started, as it was before
+	bool restartJockey(int j);
+	//! The watchdog runs from init() until quit(), see CJockey::watchdog_deadline
+	bool startWatchdog();
+	void stopWatchdog();
+	//! Print the heartbeats, missed deadlines and restarts of every jockey that is watched
+	void printWatchdogStats();
 	void sendMessage(int jockey, CMessage &m);
 	void sendMessage(int jockey, int type, void *data, int len);
 	void sendMessageToALL(int type, void *data, int len);
+
+	//! Deliver messages of this type from any other jockey to a jockey, they are not queued at the sender anymore.
+	//! A jockey can also subscribe itself with MSG_SUBSCRIBE.
+	void subscribe(int jockey, TMessageType type);
+	void unsubscribe(int jockey, TMessageType type);
+	void unsubscribeAll(int jockey);
+	//! Send the message to all subscribers of its type except source, serialized once, false if there are none
+	bool publish(int type, const void *data, int len, int source = -1);
+	inline int indexOf(const CJockey *jockey) { return jockey - jockeys; }
 	CMessage getMessage(int j);
+
+	//! Number of messages queued at all jockeys so far, take it before reading the queues and pass it to
+	//! waitForArrival, so a message that arrives in between is not missed
+	unsigned int arrivals();
+	//! Sleep until a message is queued at any jockey after arrivals() returned seen, false after timeout ms (-1 is
+	//! forever). Instead of polling every jockey, a scenario waits here for all of them at once.
+	bool waitForArrival(unsigned int seen, int timeout = -1);
+	//! Called by a jockey after it queued a message
+	void notifyArrival();
+	//! Take the first message queued at one of the jockeys in the set and return the index of that jockey, or sleep
+	//! until one arrives, -1 after timeout ms (-1 is forever). The jockeys are read in turn, starting after the one of
+	//! the last call, so a busy jockey does not hide the others.
+	int waitAny(const std::vector<int> & jockeySet, int timeout, CMessage & message);
 	int getNum_jockeys(){return num_jockeys;};
 
 	//! Find now uses a unique identifier "vocab_id" that you have to set in CMessage.h
@@ -1,5 +1,12 @@
 #include "CJockey.h"
 #include "CEquids.h"
+#include "messageSchema.h"
+#include <CLatencyTrace.h>
+#include <CMemStats.h>
+#include <unistd.h>
+#include <algorithm>
+#include <sys/time.h>
+#include <errno.h>
 
 CJockey::CJockey() {
 	pid = -1;
@@ -7,7 +14,19 @@ CJockey::CJockey() {
 	sprintf(name, "Not defined");
 	argv[0] = NULL;
 	started = false;
-	sem_init(&messSem, 0, 1);
+	standby = false;
+	shared = false;
+	sem_init(&redirectSem, 0, 1);
+	pthread_mutex_init(&ackMutex, NULL);
+	pthread_cond_init(&ackCond, NULL);
+	acknowledge = 0;
+	init_timeout = 10000;
+	requested_at = acknowledged_at = 0;
+	watchdog_deadline = CEQUIDS_WATCHDOG_DEADLINE;
+	watched = false;
+	heartbeat_at = 0;
+	heartbeats = missed_deadlines = restarts = 0;
+	memset(received, 0, sizeof(received));
    actual_position.time_stamp = -1;
 }
 
@@ -29,45 +48,80 @@ bool CJockey::addMessage(const ELolMessage *msg) {
 	if (msg->command == MSG_QUIT) {
 		quit();
 	} else if (msg->command == MSG_ACKNOWLEDGE) {
+		pthread_mutex_lock(&ackMutex);
+		acknowledged_at = now();
 		acknowledge = 1;
+		pthread_mutex_unlock(&ackMutex);
+	} else if (msg->command == MSG_HEARTBEAT) {
+		heartbeat_at = now();
+		heartbeats++;
+		if (watchdog_deadline > 0) watched = true;
+	} else if (msg->command == MSG_IPC_STATS && msg->length == 0) {
+		// the jockey asks how its connection looks from this side
+		std::vector<IPC::ConnectionStats> stats;
+		jockey_IPC.Stats(stats);
+		uint8_t buffer[IPC_STATS_MAX_LENGTH];
+		int len = packIPCStats(stats.empty() ? NULL : &stats[0], stats.size(), jockey_IPC.Reconnects(), buffer);
+		jockey_IPC.SendData(MSG_IPC_STATS, buffer, len);
+	} else if (msg->command == MSG_MEM_STATS && msg->length == 0) {
+		// the jockey asks for the memory of the controller, which shares the robot with it
+		MemProcessStats process;
+		memSampleProcess(process);
+		MemModuleStats stats[MEM_MODULES];
+		int count = memStats(stats, MEM_MODULES);
+		uint8_t buffer[MEM_STATS_MAX_LENGTH];
+		int len = packMemStats(process, stats, count, getpid(), buffer);
+		jockey_IPC.SendData(MSG_MEM_STATS, buffer, len);
+	} else if (msg->command == MSG_TRACE_DUMP && msg->length == 0) {
+		// the records of the controller hold the forwarding of the detections
+		TraceRecord records[TRACE_DUMP_MAX_RECORDS];
+		int count = traceRecords(records, TRACE_DUMP_MAX_RECORDS);
+		uint8_t buffer[TRACE_DUMP_MAX_LENGTH];
+		int len = packTraceDump(records, count, getpid(), traceNow(), buffer);
+		jockey_IPC.SendData(MSG_TRACE_DUMP, buffer, len);
+	} else if (msg->command == MSG_SUBSCRIBE || msg->command == MSG_UNSUBSCRIBE) {
+		for (uint32_t i = 0; i < msg->length; ++i) {
+			if (msg->command == MSG_SUBSCRIBE) {
+				equids->subscribe(equids->indexOf(this), (TMessageType)msg->data[i]);
+			} else {
+				equids->unsubscribe(equids->indexOf(this), (TMessageType)msg->data[i]);
+			}
+		}
 	} else if (redirection(msg)) {
 //redirection already done inside redirection(msg)
+		traceHop(detectionCapture(msg->command, msg->data, msg->length), TRACE_FORWARDED);
+	} else if (equids->publish(msg->command, msg->data, msg->length, equids->indexOf(this))) {
+//published to the subscribers of this type
+		traceHop(detectionCapture(msg->command, msg->data, msg->length), TRACE_FORWARDED);
 	} else {
-		sem_wait(&messSem);
-		if (incomingMessages.size() > 50) {
-			printf(
-					"%s incoming message buffer overfull - delete 10 oldes messages\n",name);
-			incomingMessages.erase(incomingMessages.begin(),
-					incomingMessages.begin() + 10);
+		if (!incomingMessages.push(msg)) {
+			CMessageQueueStats stats = incomingMessages.getStats();
+			if (stats.dropped % 50 == 1) {
+				printf("%s incoming message buffer overfull - dropped %u, coalesced %u messages\n", name,
+						stats.dropped, stats.coalesced);
+			}
 		}
-		CMessage message;
-		message.set(msg);
-		incomingMessages.push_back(message);
-		sem_post(&messSem);
+		equids->notifyArrival();
+	}
+	// counted after the message is queued, so waitForMessage never wakes up before getMessage can return it
+	if (msg->command < TOTAL_NUMBER_OF_MESSAGES) {
+		pthread_mutex_lock(&ackMutex);
+		received[msg->command]++;
+		pthread_cond_broadcast(&ackCond);
+		pthread_mutex_unlock(&ackMutex);
 	}
 	return true;
 }
 
 CMessage CJockey::getMessage() {
 	CMessage message;
-	sem_wait(&messSem);
-	//printf("num incoming messages %d \n",incomingMessages.size());
-	//usleep(1000000);
-	if (incomingMessages.size() > 0) {
-		//if(incomingMessages[0].type==MSG_)
-		message = incomingMessages[0];
-		message.len=incomingMessages[0].len;
-		uint8_t* newdata = new uint8_t[message.len];
-		memcpy(newdata,incomingMessages[0].data,message.len);
-		message.data = newdata;
-		incomingMessages.erase(incomingMessages.begin());
-	} else {
+	// shares the payload, it is freed when the caller is done with the message
+	if (!incomingMessages.pop(message)) {
 		message.type = MSG_NONE;
 		message.valid = false;
 		message.data = NULL;
 		message.len = 0;
 	}
-	sem_post(&messSem);
 	return message;
 }
 
@@ -78,49 +132,130 @@ bool CJockey::init(int my_pid, CEquids *master) {
 	jockey_IPC.SetCallback(getMessageCallback, this);
 	sprintf(name_IPC, "%s_IPC", name);
 	jockey_IPC.Name(name_IPC);
-	jockey_IPC.Start("localhost", port_num, false);
+	// CEquids keeps a client for every jockey, each of them gets a single thread instead of two per connection
+	jockey_IPC.SetReactor(true);
+	// a jockey that drops its connection, or is restarted on the same port, is connected again by the same thread
+	jockey_IPC.SetReconnect(true);
+	for (int type = 0; type < TOTAL_NUMBER_OF_MESSAGES; type++) {
+		IPC::IPC::SetPriority(type, isControlMessage(type) ? IPC::PRIORITY_CONTROL : IPC::PRIORITY_BULK);
+	}
+	return jockey_IPC.Start("localhost", port_num, false);
 }
 
 void CJockey::quit() {
+	watched = false;
+	// the jockey closes the connection when it quits
+	jockey_IPC.SetReconnect(false);
 	jockey_IPC.SendData(MSG_QUIT, NULL, 0);
 }
 
 void CJockey::stop(bool wait_acknow) {
-	jockey_IPC.SendData(MSG_STOP, NULL, 0);
+	SendMessage(MSG_STOP, NULL, 0);
 	this->started = false;
 	if (wait_acknow) {
-		while (this->acknowledge == 0) {
-			usleep(10000);
-		}
+		waitForAck();
 	}
-//	this->redirectinTable.clear();
+//	this->removeAllRedirections();
 //	this->incomingMessages.clear();
 }
 
+/**
+ * A message is serialized once, however many jockeys it is redirected to.
+ */
+long long CJockey::now() {
+	struct timeval time;
+	gettimeofday(&time, NULL);
+	return (long long)time.tv_sec * 1000000 + time.tv_usec;
+}
+
+struct timespec CJockey::deadline(int timeout) {
+	struct timespec time;
+	long long end = now() + (long long)timeout * 1000;
+	time.tv_sec = end / 1000000;
+	time.tv_nsec = (end % 1000000) * 1000;
+	return time;
+}
+
+bool CJockey::waitForAck(int timeout) {
+	struct timespec end = deadline(timeout);
+	pthread_mutex_lock(&ackMutex);
+	int ret = 0;
+	while (acknowledge == 0 && ret != ETIMEDOUT) {
+		if (timeout < 0) {
+			pthread_cond_wait(&ackCond, &ackMutex);
+		} else {
+			ret = pthread_cond_timedwait(&ackCond, &ackMutex, &end);
+		}
+	}
+	bool acknowledged = (acknowledge != 0);
+	pthread_mutex_unlock(&ackMutex);
+	return acknowledged;
+}
+
+int CJockey::messageCount(int type) {
+	if (type < 0 || type >= TOTAL_NUMBER_OF_MESSAGES) return 0;
+	pthread_mutex_lock(&ackMutex);
+	int count = received[type];
+	pthread_mutex_unlock(&ackMutex);
+	return count;
+}
+
+bool CJockey::waitForMessage(int type, int timeout, int count) {
+	if (type < 0 || type >= TOTAL_NUMBER_OF_MESSAGES) return false;
+	struct timespec end = deadline(timeout);
+	pthread_mutex_lock(&ackMutex);
+	if (count < 0) count = received[type];
+	int ret = 0;
+	while (received[type] == count && ret != ETIMEDOUT) {
+		if (timeout < 0) {
+			pthread_cond_wait(&ackCond, &ackMutex);
+		} else {
+			ret = pthread_cond_timedwait(&ackCond, &ackMutex, &end);
+		}
+	}
+	bool arrived = (received[type] != count);
+	pthread_mutex_unlock(&ackMutex);
+	return arrived;
+}
+
 bool CJockey::redirection(const ELolMessage *msg) {
-	bool isredirected=false;
-	for (int var = 0; var < redirectinTable.size(); ++var) {
-			if(redirectinTable[var].messagetype == msg->command){
-				//printf("try redirecting %d to %d\n",msg->command,redirectinTable[var].toJockey);
-				equids->getJockey(redirectinTable[var].toJockey)->SendMessage(msg->command,(void*) msg->data, msg->length);
-				//printf("redirecting %d to %d\n",msg->command,redirectinTable[var].toJockey);
-				isredirected=true;
-				break;
-			}
+	if (msg->command >= TOTAL_NUMBER_OF_MESSAGES) return false;
+	sem_wait(&redirectSem);
+	const std::vector<int> & targets = redirections[msg->command];
+	bool isredirected = !targets.empty();
+	if (isredirected) {
+		int size = IPC::IPC::SerializedSize(msg->length);
+		uint8_t bytes[size];
+		IPC::IPC::Serialize(msg->command, msg->data, msg->length, bytes);
+		for (unsigned int i = 0; i < targets.size(); ++i) {
+			//printf("redirecting %d to %d\n",msg->command,targets[i]);
+			equids->getJockey(targets[i])->ForwardMessage(bytes, size, msg->command, msg->data, msg->length);
 		}
+	}
+	sem_post(&redirectSem);
 	return isredirected;
 }
 
 void CJockey::addRedirection(int redirectTo, TMessageType redirectedMessT) {
-	Redirection red = { redirectTo, redirectedMessT };
-	redirectinTable.push_back(red);
+	sem_wait(&redirectSem);
+	std::vector<int> & targets = redirections[redirectedMessT];
+	if (std::find(targets.begin(), targets.end(), redirectTo) == targets.end()) {
+		targets.push_back(redirectTo);
+	}
+	sem_post(&redirectSem);
 }
 
 void CJockey::removeRedirection(int redirectTo, TMessageType redirectedMessT) {
-	for (int var = 0; var < redirectinTable.size(); ++var) {
-		if(redirectinTable[var].toJockey == redirectTo && redirectinTable[var].messagetype == redirectedMessT){
-			redirectinTable.erase (redirectinTable.begin()+var);
-		}
-	}
+	sem_wait(&redirectSem);
+	std::vector<int> & targets = redirections[redirectedMessT];
+	targets.erase(std::remove(targets.begin(), targets.end(), redirectTo), targets.end());
+	sem_post(&redirectSem);
 }
 
+void CJockey::removeAllRedirections() {
+	sem_wait(&redirectSem);
+	for (int i = 0; i < TOTAL_NUMBER_OF_MESSAGES; ++i) {
+		redirections[i].clear();
+	}
+	sem_post(&redirectSem);
+}
@@ -11,10 +11,18 @@
 #define MAX_NAME_LEN 50
 #define MAX_DATA 128
 
+//! Default of the time in ms the watchdog of CEquids allows between two heartbeats of a jockey, see watchdog_deadline
+#ifndef CEQUIDS_WATCHDOG_DEADLINE
+#define CEQUIDS_WATCHDOG_DEADLINE 5000
+#endif
+
 #include "ipc.hh"
 #include <CMessage.h>
+#include <CMessageQueue.h>
 #include <messageDataType.h>
 #include <semaphore.h>
+#include <pthread.h>
+#include <string>
 #include <vector>
 
 
@@ -22,11 +30,6 @@ class CEquids;
 class CJockey
 {
 
-struct Redirection{
-int toJockey;
-TMessageType messagetype;
-};
-
 public:
 	IPC::IPC jockey_IPC;
 	char name[MAX_NAME_LEN];
@@ -34,6 +37,27 @@ public:
 	int port_num;
 	int pid;
 	int acknowledge;
+	//! Milliseconds to wait for the MSG_ACKNOWLEDGE of MSG_INIT, set by "timeout=<ms>" in the configuration file
+	int init_timeout;
+	//! Cores, class and priority of the process and of its threads, set by "sched=" and "sched.<thread>=", see CSched.h
+	std::string sched;
+	std::string thread_sched;
+	//! Time the last message that expects an acknowledgment was sent and when it was acknowledged, in microseconds
+	long long requested_at;
+	long long acknowledged_at;
+	/**
+	 * Milliseconds the watchdog of CEquids allows between two MSG_HEARTBEAT, set by "watchdog=<ms>" in the
+	 * configuration file, 0 switches it off. A jockey is watched from its first heartbeat or from the start if it has
+	 * the argument, so a jockey with a loop of its own that sends none is left alone.
+	 */
+	int watchdog_deadline;
+	bool watched;
+	//! When the last MSG_HEARTBEAT arrived in microseconds, after a (re)start the time for MSG_INIT is added to now
+	long long heartbeat_at;
+	long heartbeats;
+	//! Heartbeats that did not come in time and restarts of the jockey by the watchdog, also after it exited
+	long missed_deadlines;
+	long restarts;
 	vocab_t vocab_id;
    struct UbiPosition actual_position;
 
@@ -43,26 +67,63 @@ public:
 	bool addMessage(const ELolMessage *msg);
 	void SendMessage(CMessage &msg) {
 		acknowledge = 0;
+		requested_at = now();
 		jockey_IPC.SendData(msg.type, (uint8_t*) msg.data, msg.len);
 	}
-	void SendMessage(int type, void *data, int len) {
+	void SendMessage(int type, const void *data, int len) {
 		acknowledge = 0;
+		requested_at = now();
 		jockey_IPC.SendData(type, (uint8_t*) data, len);
 	}
+	//! Sleep until the jockey acknowledged the last message, false if that takes more than timeout ms (-1 is forever)
+	bool waitForAck(int timeout = -1);
+	//! Sleep until a message of this type arrives, false after timeout ms (-1 is forever). To not miss a reply that
+	//! arrives before the wait, take messageCount(type) before the request and pass it as count.
+	bool waitForMessage(int type, int timeout = -1, int count = -1);
+	//! Number of messages of this type received from the jockey so far
+	int messageCount(int type);
+	//! Ask the jockey for the counters of its IPC, the answer is a MSG_IPC_STATS in the queue, see ipcStatsView
+	void requestIPCStats() {
+		jockey_IPC.SendData(MSG_IPC_STATS, NULL, 0);
+	}
+	//! Ask the jockey for its resident size and the buffers of its subsystems, answered with a MSG_MEM_STATS, see
+	//! memStatsView
+	void requestMemStats() {
+		jockey_IPC.SendData(MSG_MEM_STATS, NULL, 0);
+	}
+	static long long now();
+	//! Send a message that is serialized already with IPC::Serialize, used to send it to several jockeys
+	void ForwardMessage(const uint8_t *bytes, int size, int type, const void *data, int len) {
+		acknowledge = 0;
+		jockey_IPC.SendSerialized(bytes, size, type, (uint8_t*) data, len);
+	}
 	void quit();
 	void stop(bool wait_acknow);
 	void addRedirection(int redirectTo, TMessageType redirectedMessT);
 	void removeRedirection(int redirectTo, TMessageType redirectedMessT);
-	void removeAllRedirections(){redirectinTable.clear();};
+	void removeAllRedirections();
 	bool started;
+	//! The jockey got MSG_STANDBY, so it is initialized and picks up MSG_START within milliseconds
+	bool standby;
+	//! Talk to the jockey over shared memory, set by "transport=shm" in the configuration file
+	bool shared;
 	CMessage getMessage();
+	//! The queue of received messages, set its overflow policy with "queue=coalesce" etc. in the configuration file
+	inline CMessageQueue & getQueue() { return incomingMessages; }
 private:
 	CMessage message;
 	CEquids* equids;
-	sem_t messSem;
 	bool redirection(const ELolMessage *msg);
-	std::vector<Redirection> redirectinTable;
-	std::vector<CMessage> incomingMessages;
+	//! The jockeys every message type is redirected to, instead of being queued
+	std::vector<int> redirections[TOTAL_NUMBER_OF_MESSAGES];
+	sem_t redirectSem;
+	pthread_mutex_t ackMutex;
+	pthread_cond_t ackCond;
+	//! Messages received per type, guarded by ackMutex, see waitForMessage
+	int received[TOTAL_NUMBER_OF_MESSAGES];
+	//! Deadline for pthread_cond_timedwait, timeout ms from now
+	static struct timespec deadline(int timeout);
+	CMessageQueue incomingMessages;
 
 };
 
@@ -1,4 +1,7 @@
 #include "CMessage.h"
+#include "messageDataType.h"
+#include <pthread.h>
+#include <stddef.h>
 
 const char* StrMessage[] = {
 		"None", // line 41 in CMessage.h
@@ -62,23 +65,203 @@ const char* StrMessage[] = {
 		"I can help to create organism",
 		"Help accepted",
 		"My ZigBee Identity",
+		"Pipeline statistics REQ",
+		"Pipeline statistics",
+		"Camera batch mode",
+		"Camera detected batch",
+		"Laser odometry REQ",
+		"Laser odometry",
+		"Laser scan stream",
+		"Laser scan",
+		"Subscribe",
+		"Unsubscribe",
+		"Map snapshot REQ",
+		"Map snapshot",
+		"Ping",
+		"Pong",
+		"IPC stats",
+		"Fusion object",
+		"Motor calibration report",
+		"Memory stats",
+		"Standby",
+		"OrgState",
+		"OrganismCommand",
+		"Heartbeat",
+		"Trace dump",
+		"Occupancy request",
+		"Occupancy",
+		"Frontier request",
+		"Frontier",
 		"MSG_NUMBER"
 };
 
+//! Add a type here if a consumer that lags behind only needs the last one, not every one in between
+static const TMessageType LatestValueMessages[] = {
+		MSG_SPEED,
+		MSG_POS,
+		MSG_CAM_DETECTED_BLOB,
+		MSG_CAM_DETECTED_BLOB_ARRAY,
+		MSG_UBISENCE_POSITION,
+		MSG_STATS,
+		MSG_LASER_ODOMETRY,
+		MSG_LASER_SCAN
+};
+
+bool isLatestValue(int type) {
+	for (unsigned int i = 0; i < sizeof(LatestValueMessages) / sizeof(LatestValueMessages[0]); ++i) {
+		if (LatestValueMessages[i] == type) return true;
+	}
+	return false;
+}
+
+//! Every command that changes what a jockey does is in here, so a MSG_STOP can not overtake the MSG_START before it
+static const TMessageType ControlMessages[] = {
+		MSG_START,
+		MSG_STOP,
+		MSG_RESET,
+		MSG_QUIT,
+		MSG_SPEED,
+		MSG_COLLISION_DETECTED,
+		MSG_ORGANISM_COMMAND,
+		MSG_HEARTBEAT
+};
+
+bool isControlMessage(int type) {
+	for (unsigned int i = 0; i < sizeof(ControlMessages) / sizeof(ControlMessages[0]); ++i) {
+		if (ControlMessages[i] == type) return true;
+	}
+	return false;
+}
+
+uint64_t detectionCapture(int type, const uint8_t *data, int len) {
+	size_t offset;
+	switch (type) {
+	case MSG_CAM_DETECTED_BLOB: offset = offsetof(DetectedBlobWSize, timestamp); break;
+	case MSG_CAM_DETECTED_BLOB_ARRAY: offset = offsetof(DetectedBlobWSizeArray, timestamp); break;
+	case MSG_CAM_DETECTED_BATCH: offset = offsetof(DetectionBatchHeader, timestamp); break;
+	default: return 0;
+	}
+	if (data == NULL || len < (int)(offset + sizeof(uint64_t))) return 0;
+	uint64_t capture;
+	memcpy(&capture, data + offset, sizeof(capture));
+	return capture;
+}
+
+//! The references of all payloads, copies of a message are made by different threads (e.g. CJockey::addMessage)
+static pthread_mutex_t mutex_buffers = PTHREAD_MUTEX_INITIALIZER;
+
+//! Payloads of up to 64 << (CMESSAGE_SIZE_CLASSES - 1) bytes come from a free list per power of two
+#define CMESSAGE_SIZE_CLASSES 11
+//! Free buffers that are kept per size class, the rest goes back to the heap
+#define CMESSAGE_POOL_DEPTH 32
+static CMessageBuffer *pool[CMESSAGE_SIZE_CLASSES];
+static int pooled[CMESSAGE_SIZE_CLASSES];
+
+static int sizeClass(int length) {
+	int size_class = 0;
+	while (size_class < CMESSAGE_SIZE_CLASSES && (64 << size_class) < length) size_class++;
+	return (size_class < CMESSAGE_SIZE_CLASSES) ? size_class : -1;
+}
+
+//! Called with mutex_buffers locked
+CMessageBuffer *CMessage::allocate(int length) {
+	int size_class = sizeClass(length);
+	CMessageBuffer *result = NULL;
+	if (size_class >= 0 && pool[size_class] != NULL) {
+		result = pool[size_class];
+		pool[size_class] = result->next;
+		pooled[size_class]--;
+	} else {
+		int capacity = (size_class >= 0) ? (64 << size_class) : length;
+		result = (CMessageBuffer*)new uint8_t[sizeof(CMessageBuffer) + capacity];
+		result->size_class = size_class;
+	}
+	result->refs = 1;
+	result->len = length;
+	result->next = NULL;
+	return result;
+}
+
+//! Called with mutex_buffers locked
+void CMessage::recycle(CMessageBuffer *buffer) {
+	int size_class = buffer->size_class;
+	if (size_class >= 0 && pooled[size_class] < CMESSAGE_POOL_DEPTH) {
+		buffer->next = pool[size_class];
+		pool[size_class] = buffer;
+		pooled[size_class]++;
+	} else {
+		delete [] (uint8_t*)buffer;
+	}
+}
+
 CMessage::CMessage()
 {
 	type = MSG_NONE;
 	data = NULL;
 	len = 0;
+	buffer = NULL;
+}
+
+CMessage::CMessage(const CMessage &msg)
+{
+	type = msg.type;
+	len = msg.len;
+	valid = msg.valid;
+	data = msg.data;
+	buffer = msg.buffer;
+	if (buffer != NULL) {
+		pthread_mutex_lock(&mutex_buffers);
+		buffer->refs++;
+		pthread_mutex_unlock(&mutex_buffers);
+	}
+}
+
+CMessage & CMessage::operator=(const CMessage &msg)
+{
+	if (this == &msg) return *this;
+	if (msg.buffer != NULL) {
+		pthread_mutex_lock(&mutex_buffers);
+		msg.buffer->refs++;
+		pthread_mutex_unlock(&mutex_buffers);
+	}
+	release();
+	type = msg.type;
+	len = msg.len;
+	valid = msg.valid;
+	data = msg.data;
+	buffer = msg.buffer;
+	return *this;
 }
 
 CMessage::~CMessage()
 {
-	/*if (data!=NULL) {
-      delete[] data;
-      data = NULL;
-   }
-	 */
+	release();
+}
+
+void CMessage::take(CMessage &msg)
+{
+	release();
+	type = msg.type;
+	len = msg.len;
+	valid = msg.valid;
+	data = msg.data;
+	buffer = msg.buffer;
+	msg.buffer = NULL;
+	msg.data = NULL;
+	msg.len = 0;
+}
+
+void CMessage::release()
+{
+	if (buffer == NULL) return;
+	pthread_mutex_lock(&mutex_buffers);
+	if (--buffer->refs == 0) {
+		recycle(buffer);
+	}
+	pthread_mutex_unlock(&mutex_buffers);
+	buffer = NULL;
+	data = NULL;
+	len = 0;
 }
 
 const char * CMessage::getStrType()
@@ -88,51 +271,93 @@ const char * CMessage::getStrType()
 
 void CMessage::set(const ELolMessage*msg) {
 	type = (TMessageType)msg->command;
-	len = msg->length;
-	if (len>0) {
-		data = new uint8_t[len];
-		memcpy(data,msg->data,msg->length);
-	} else {
-		data = NULL;
-	}
+	setData(msg->data, msg->length);
 }
 
 void CMessage::set(const CMessage *msg) {
 	type = (TMessageType)msg->type;
-	len = msg->len;
-	if (len>0) {
-		data = new uint8_t[len];
-		memcpy(data,msg->data,msg->len);
-	} else {
+	setData(msg->data, msg->len);
+}
+
+/**
+ * This is the only copy of a received payload. A message that is overwritten while a copy of it is still in use gets a
+ * new buffer, so the copy is not changed underneath its reader. Buffers come from the pool of their size class and
+ * go back to it with the last copy, so a long running jockey stops allocating once its pools are warm.
+ */
+void CMessage::setData(const uint8_t *bytes, int length) {
+	reserve(length);
+	if (len > 0) {
+		memcpy(data,bytes,len);
+	}
+}
+
+void CMessage::reserve(int length) {
+	bool reuse = false;
+	if (buffer != NULL && length > 0 && sizeClass(length) == buffer->size_class && (buffer->size_class >= 0 || buffer->len == length)) {
+		pthread_mutex_lock(&mutex_buffers);
+		reuse = (buffer->refs == 1);
+		pthread_mutex_unlock(&mutex_buffers);
+		if (reuse) buffer->len = length;
+	}
+	if (!reuse) {
+		release();
 		data = NULL;
+		if (length > 0) {
+			pthread_mutex_lock(&mutex_buffers);
+			buffer = allocate(length);
+			pthread_mutex_unlock(&mutex_buffers);
+			data = (uint8_t*)(buffer + 1);
+		}
 	}
+	len = length;
 }
 
-CMessage CMessage::packToZBMessage(uint64_t ubitag, int type, void *data,
-		int len) {
-	//printf("packing to ZB message \n");
+/**
+ * The envelope is read with memcpy, the payload of a CMessage has no alignment beyond that of its buffer. The payload
+ * is not copied, so a jockey that receives a message over ZigBee and hands it on does not allocate for it.
+ */
+bool CMessage::viewZBMessage(ZBEnvelope &envelope) const {
+	if (data == NULL || len < (int)ZB_ENVELOPE_HEADER) {
+		envelope.ubitag = 0;
+		envelope.type = MSG_NONE;
+		envelope.data = NULL;
+		envelope.len = 0;
+		return false;
+	}
+	int type;
+	memcpy(&envelope.ubitag, data, sizeof(uint64_t));
+	memcpy(&type, data + sizeof(uint64_t), sizeof(int));
+	envelope.type = (TMessageType)type;
+	envelope.len = len - ZB_ENVELOPE_HEADER;
+	envelope.data = (envelope.len > 0) ? data + ZB_ENVELOPE_HEADER : NULL;
+	return true;
+}
+
+void CMessage::packZBHeader(uint8_t *buffer, uint64_t ubitag, int type) {
+	memcpy(buffer, &ubitag, sizeof(uint64_t));
+	memcpy(buffer + sizeof(uint64_t), &type, sizeof(int));
+}
+
+uint8_t *CMessage::reserveZBMessage(uint64_t ubitag, int type, int len) {
+	this->type = MSG_ZIGBEE_MSG;
+	reserve(ZB_ENVELOPE_HEADER + len);
+	packZBHeader(data, ubitag, type);
+	return data + ZB_ENVELOPE_HEADER;
+}
+
+CMessage CMessage::packToZBMessage(uint64_t ubitag, int type, const void *data, int len) {
 	CMessage message;
-	message.len = sizeof(uint64_t) + sizeof(int) + len;
-	message.data = new uint8_t[message.len];
-	message.type = MSG_ZIGBEE_MSG;
-	memcpy(message.data, &ubitag, sizeof(uint64_t));
-	memcpy(message.data + sizeof(uint64_t), &type, sizeof(int));
-	memcpy(message.data + sizeof(uint64_t) + sizeof(int), data, len);
+	uint8_t *payload = message.reserveZBMessage(ubitag, type, len);
+	if (len > 0) memcpy(payload, data, len);
 	return message;
 }
 
-CMessage CMessage::unpackZBMessage(CMessage ZBmessage) {
+CMessage CMessage::unpackZBMessage(const CMessage &ZBmessage) {
 	CMessage message;
-	message.len = ZBmessage.len - sizeof(uint64_t) - sizeof(int);
-	//printf("whole zigbee size is : %d \n", message.len);
-	if (message.len > 0) {
-		message.data = new uint8_t[message.len];
-		memcpy(message.data, ZBmessage.data + sizeof(uint64_t) + sizeof(int),
-				message.len);
-	} else {
-		message.data = NULL;
+	ZBEnvelope envelope;
+	if (ZBmessage.viewZBMessage(envelope)) {
+		message.type = envelope.type;
+		message.setData(envelope.data, envelope.len);
 	}
-	memcpy(&message.type, ZBmessage.data + sizeof(uint64_t), sizeof(int));
-	//printf("type is : %d \n", message.type);
 	return message;
 }
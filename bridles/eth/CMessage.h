@@ -99,25 +99,116 @@ typedef enum
 	MSG_HELP_ORG,
 	MSG_HELP_ACP,
 	MSG_MY_ZIGBEE_ID,
+	MSG_STATS_REQ, // optional payload of one byte, 1 to enable and 0 to disable the latency statistics
+	MSG_STATS, // payload is PipelineStats
+	MSG_CAM_BATCH_MODE, // payload of one byte, 1 to send MSG_CAM_DETECTED_BATCH instead of the blob messages
+	MSG_CAM_DETECTED_BATCH, // payload is a DetectionBatchHeader with its arrays, see packDetectionBatch
+	MSG_LASER_ODOMETRY_REQ, // optional payload of one byte, 1 to send MSG_LASER_ODOMETRY after every scan, 0 to stop
+	MSG_LASER_ODOMETRY, // payload is LaserOdometry
+	MSG_LASER_SCAN_STREAM, // payload of one byte, 1 to send MSG_LASER_SCAN after every scan, 0 to stop
+	MSG_LASER_SCAN, // payload is a LaserScanHeader with the delta-encoded laser vector, see packLaserScan
+	MSG_SUBSCRIBE, // payload is one byte per message type that CEquids should publish to the sender
+	MSG_UNSUBSCRIBE, // payload is one byte per message type to stop publishing to the sender
+	MSG_MAP_SNAPSHOT_REQ, // payload is a MapSnapshotRequestWire, answered with MSG_MAP_SNAPSHOT
+	MSG_MAP_SNAPSHOT, // payload is a MapSnapshotHeaderWire with its objects, see packMapSnapshot
+	MSG_PING, // any payload, a jockey that understands it answers with a MSG_PONG with the same payload
+	MSG_PONG, // the payload of the MSG_PING it answers
+	MSG_IPC_STATS, // no payload asks for the counters of the IPC connections, the answer has the same type, see IPCStatsHeaderWire
+	MSG_FUSION_OBJECT, // payload is a FusionObject, a laser scan and a camera frame of the same moment classified by CFusion
+	MSG_MOTOR_CALIBRATION_REPORT, // payload is a MotorCalibReportWire, a calibration of the odometry and its test drive
+	MSG_MEM_STATS, // no payload asks for the memory of the process and its subsystems, answered with a MemStatsHeaderWire
+	MSG_STANDBY, // get ready to be started within milliseconds, optional uint8_t 0 leaves the standby again
+	MSG_ORG_STATE, // payload is an OrganismStateHeaderWire with its entries, the recruitment table, see CRecruitment
+	MSG_ORGANISM_COMMAND, // payload is an OrganismCommandHeaderWire with its setpoints, one for all modules of an organism
+	MSG_HEARTBEAT, // payload is a HeartbeatWire, sent by CController::run(), CEquids restarts a jockey that stops it
+	MSG_TRACE_DUMP, // no payload asks for the latency records of the process, answered with a TraceDumpHeaderWire
+	MSG_OCCUPANCY_REQ, // payload is an OccupancyRequestWire, answered with MSG_OCCUPANCY
+	MSG_OCCUPANCY, // payload is an OccupancyHeaderWire with its tiles, see occupancyTile
+	MSG_FRONTIER_REQ, // no payload asks the mapping jockey where to explore next, answered with MSG_FRONTIER
+	MSG_FRONTIER, // payload is a FrontierWire, the next target to explore
 	TOTAL_NUMBER_OF_MESSAGES // for debugging
 } TMessageType;
 
 extern const char* StrMessage[];
 
+//! State updates of which only the newest one matters, a queue keeps a single instance of them (see CMessageQueue)
+bool isLatestValue(int type);
+
+//! Commands that go ahead of bulk data over an IPC (see IPC::SetPriority), they keep their order among each other
+bool isControlMessage(int type);
+
+//! Capture time of the frame that detections of this type came from, the trace of CLatencyTrace, 0 if unknown
+uint64_t detectionCapture(int type, const uint8_t *data, int len);
+
+//! Header of a payload that is shared by copies of a CMessage, the payload follows it in the same allocation
+struct CMessageBuffer
+{
+	int refs;
+	int len;
+	//! Pool the buffer returns to, see CMessage::setData, -1 for a payload that is too big to be pooled
+	int size_class;
+	CMessageBuffer *next;
+};
+
+//! Bytes in front of the inner message of a MSG_ZIGBEE_MSG: the Ubitag of the other robot and the inner type as int
+#define ZB_ENVELOPE_HEADER (sizeof(uint64_t) + sizeof(int))
+
+/**
+ * The inner message of a MSG_ZIGBEE_MSG as it is in the received buffer, nothing is copied or owned, so it is only
+ * valid as long as the CMessage it is a view of. The ubitag is the source of a received message and the destination
+ * of one that is sent, -1 for all robots.
+ */
+struct ZBEnvelope
+{
+	uint64_t ubitag;
+	TMessageType type;
+	const uint8_t *data;
+	int len;
+};
+
 class CMessage
 {
 public:
 	CMessage();
+	//! Copies share the payload of a message that is filled with set, it is freed with the last of them
+	CMessage(const CMessage &msg);
+	CMessage & operator=(const CMessage &msg);
+#if __cplusplus >= 201103L || defined(__GXX_EXPERIMENTAL_CXX0X__)
+	CMessage(CMessage &&msg) : buffer(NULL) { take(msg); }
+	CMessage & operator=(CMessage &&msg) { if (this != &msg) take(msg); return *this; }
+#endif
 	~CMessage();
+	//! Move the payload of msg into this message without touching its reference count, msg is left empty
+	void take(CMessage &msg);
+	//! Copy the payload, the buffer is reused if it has the same size and no other copy uses it
 	void set(const ELolMessage*msg);
 	void set(const CMessage *msg);
+	//! Drop the payload that is filled with set, data that is assigned directly is left alone
+	void release();
 	const char* getStrType();
-	static CMessage unpackZBMessage(CMessage ZBmessage);
-	static CMessage packToZBMessage(uint64_t ubitag, int type, void *data,	int len);
+	//! View the inner message of a MSG_ZIGBEE_MSG without a copy, false if it is shorter than its envelope
+	bool viewZBMessage(ZBEnvelope &envelope) const;
+	/**
+	 * Make this a MSG_ZIGBEE_MSG of len bytes of payload, with the envelope written in front of it. Returns where the
+	 * payload goes, so it is built in place instead of copied behind the envelope.
+	 */
+	uint8_t *reserveZBMessage(uint64_t ubitag, int type, int len);
+	//! Write the envelope into the first ZB_ENVELOPE_HEADER bytes of a buffer that has the payload behind them
+	static void packZBHeader(uint8_t *buffer, uint64_t ubitag, int type);
+	//! A copy of the inner message, use viewZBMessage where the payload is only read
+	static CMessage unpackZBMessage(const CMessage &ZBmessage);
+	static CMessage packToZBMessage(uint64_t ubitag, int type, const void *data, int len);
 	TMessageType type;
 	int len;
 	bool valid;
 	uint8_t *data;
+private:
+	void setData(const uint8_t *bytes, int length);
+	//! A payload of length bytes that only this message uses, the old one is reused if it can be, see setData
+	void reserve(int length);
+	static CMessageBuffer *allocate(int length);
+	static void recycle(CMessageBuffer *buffer);
+	CMessageBuffer *buffer;
 };
 
 #endif
@@ -26,21 +26,9 @@ static void addMessage(const ELolMessage *msg, void * connection, void * serv) {
 		for (int var = 0; var < server->lastMessages.size(); ++var) {
 			if (server->lastMessages[var]->type
 					== (TMessageType) msg->command) {
-				if (server->lastMessages[var]->len != msg->length) {
-               delete server->lastMessages[var];
-					server->lastMessages.erase(
-							server->lastMessages.begin() + var);
-					CMessage* message = new CMessage();
-					message->set(msg);
-               message->valid = true;
-					server->lastMessages.push_back(message);
-				} else {
-               if (msg->length>0) {
-					   memcpy(server->lastMessages[var]->data, msg->data,
-							msg->length);
-               }
-               server->lastMessages[var]->valid = true;
-				}
+				// overwrites the payload in place unless getMessage still shares it
+				server->lastMessages[var]->set(msg);
+				server->lastMessages[var]->valid = true;
 				found = true;
 				break;
 			}
@@ -73,11 +61,7 @@ const CMessage & CMessageClient::getMessage() {
 
    sem_wait(&dataSem);
 
-   if (mm.data!=NULL) {
-
-      delete[] mm.data;
-      mm.data = NULL;
-   }
+   mm.release();
 
    if (last_ptr>=lastMessages.size()) {
       last_ptr=0;
@@ -97,7 +81,7 @@ const CMessage & CMessageClient::getMessage() {
 	}
 
 	if (last_ptr< lastMessages.size()) {
-	   mm.set(lastMessages[last_ptr]);
+	   mm = *lastMessages[last_ptr];
       lastMessages[last_ptr]->valid = false;
 	   last_ptr++;
 	   if (last_ptr>=lastMessages.size()) {
@@ -0,0 +1,124 @@
+#include "CMessageQueue.h"
+#include <sys/time.h>
+#include <string.h>
+
+CMessageQueue::CMessageQueue(int capacity, TOverflowPolicy policy):
+		slots(capacity), pushed_at(capacity, 0), capacity(capacity), first(0), count(0), policy(policy) {
+	memset(&stats, 0, sizeof(stats));
+	sem_init(&sem, 0, 1);
+}
+
+CMessageQueue::~CMessageQueue() {
+	sem_destroy(&sem);
+}
+
+long long CMessageQueue::now() {
+	struct timeval time;
+	gettimeofday(&time, NULL);
+	return (long long)time.tv_sec * 1000000 + time.tv_usec;
+}
+
+bool CMessageQueue::push(const ELolMessage *msg) {
+	bool complete = true;
+	long long time = now();
+	sem_wait(&sem);
+	stats.pushed++;
+	int slot = -1;
+	if (isLatestValue(msg->command) || (count == capacity && policy == QUEUE_COALESCE)) {
+		slot = find(msg->command);
+	}
+	if (slot >= 0) {
+		// keeps its place in the queue and the time it has been waiting
+		slots[slot].set(msg);
+		stats.coalesced++;
+		sem_post(&sem);
+		return true;
+	}
+	if (count == capacity) {
+		stats.dropped++;
+		if (policy == QUEUE_DROP_NEWEST) {
+			sem_post(&sem);
+			return false;
+		}
+		slots[first].release();
+		first = (first + 1) % capacity;
+		count--;
+		complete = false;
+	}
+	int last = (first + count) % capacity;
+	slots[last].set(msg);
+	slots[last].valid = true;
+	pushed_at[last] = time;
+	count++;
+	stats.depth = count;
+	if (count > stats.max_depth) stats.max_depth = count;
+	sem_post(&sem);
+	return complete;
+}
+
+int CMessageQueue::find(int type) {
+	for (int i = count - 1; i >= 0; --i) {
+		int s = (first + i) % capacity;
+		if (slots[s].type == (TMessageType)type) return s;
+	}
+	return -1;
+}
+
+bool CMessageQueue::pop(CMessage &message) {
+	long long time = now();
+	sem_wait(&sem);
+	if (count == 0) {
+		sem_post(&sem);
+		return false;
+	}
+	// shares the payload, the slot lets go of it so it is freed with the last copy of the caller
+	// the slot hands its payload over, so the reference count is not touched
+	message.take(slots[first]);
+	long long wait = time - pushed_at[first];
+	first = (first + 1) % capacity;
+	count--;
+	stats.popped++;
+	stats.depth = count;
+	stats.wait_total += wait;
+	if (wait > stats.wait_max) stats.wait_max = wait;
+	sem_post(&sem);
+	return true;
+}
+
+int CMessageQueue::size() {
+	sem_wait(&sem);
+	int result = count;
+	sem_post(&sem);
+	return result;
+}
+
+CMessageQueueStats CMessageQueue::getStats() {
+	sem_wait(&sem);
+	CMessageQueueStats result = stats;
+	sem_post(&sem);
+	return result;
+}
+
+void CMessageQueue::clear() {
+	sem_wait(&sem);
+	for (int i = 0; i < count; ++i) {
+		slots[(first + i) % capacity].release();
+	}
+	first = 0;
+	count = 0;
+	stats.depth = 0;
+	sem_post(&sem);
+}
+
+bool CMessageQueue::parsePolicy(const char *str, TOverflowPolicy &policy) {
+	if (!strcmp(str, "drop_oldest")) {
+		policy = QUEUE_DROP_OLDEST;
+	} else if (!strcmp(str, "drop_newest")) {
+		policy = QUEUE_DROP_NEWEST;
+	} else if (!strcmp(str, "coalesce")) {
+		policy = QUEUE_COALESCE;
+	} else {
+		return false;
+	}
+	return true;
+}
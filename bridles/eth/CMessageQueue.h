@@ -0,0 +1,84 @@
+/*
+ * File name: CMessageQueue.h
+ * Date:      2013/10/14
+ * Author:    Anne C. van Rossum
+ */
+
+#ifndef __CMESSAGEQUEUE_H__
+#define __CMESSAGEQUEUE_H__
+
+#include <CMessage.h>
+#include <semaphore.h>
+#include <vector>
+
+//! What to do with a message that arrives when the queue is full
+typedef enum
+{
+	QUEUE_DROP_OLDEST = 0,
+	QUEUE_DROP_NEWEST,
+	//! Overwrite the queued message of the same type, drop the oldest if there is none
+	QUEUE_COALESCE
+} TOverflowPolicy;
+
+struct CMessageQueueStats
+{
+	unsigned int pushed;
+	unsigned int popped;
+	unsigned int dropped;
+	unsigned int coalesced;
+	int depth;
+	int max_depth;
+	//! Time between push and pop in microseconds, summed over all popped messages
+	long long wait_total;
+	long long wait_max;
+};
+
+/**
+ * Bounded ring of received messages, pushed by the receiving thread of an IPC and popped by the user of the jockey.
+ * Push and pop are constant time, only coalescing looks at the queued messages. A message of a type for which
+ * isLatestValue holds always replaces the queued one of that type, whatever the overflow policy.
+ */
+class CMessageQueue
+{
+public:
+	CMessageQueue(int capacity = 50, TOverflowPolicy policy = QUEUE_DROP_OLDEST);
+	~CMessageQueue();
+
+	//! Copy the message into the queue, false if it or the oldest message is dropped because the queue is full
+	bool push(const ELolMessage *msg);
+
+	//! Take the oldest message, false if the queue is empty
+	bool pop(CMessage &message);
+
+	int size();
+
+	inline void setPolicy(TOverflowPolicy policy) { this->policy = policy; }
+
+	inline TOverflowPolicy getPolicy() { return policy; }
+
+	//! Parse "drop_oldest", "drop_newest" or "coalesce", false for anything else
+	static bool parsePolicy(const char *str, TOverflowPolicy &policy);
+
+	CMessageQueueStats getStats();
+
+	void clear();
+private:
+	static long long now();
+
+	//! The newest queued slot with a message of this type, -1 if there is none
+	int find(int type);
+
+	std::vector<CMessage> slots;
+	//! Time at which every slot was pushed
+	std::vector<long long> pushed_at;
+	int capacity;
+	int first;
+	int count;
+	TOverflowPolicy policy;
+	CMessageQueueStats stats;
+	sem_t sem;
+};
+
+#endif
+
+/* end of CMessageQueue.h */
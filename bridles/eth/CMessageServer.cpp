@@ -1,4 +1,9 @@
 #include "CMessageServer.h"
+#include "messageSchema.h"
+#include <CLatencyTrace.h>
+#include <CMemStats.h>
+#include <time.h>
+#include <unistd.h>
 
 #ifdef CVUT_DEBUG
 #include "wapi/wapi.h"
@@ -10,6 +15,10 @@ CMessageServer::CMessageServer() {
 	sem_init(&dataSem, 0, 1);
 	sem_init(&connectSem, 0, 1);
 	last_ptr = 0;
+	tap = NULL;
+	tap_arg = NULL;
+	heartbeats = 0;
+	heartbeat_at = 0;
 	mm.type = MSG_NONE;
 	mm.data = NULL;
 #ifdef CVUT_DEBUG
@@ -20,30 +29,85 @@ CMessageServer::CMessageServer() {
 CMessageServer::~CMessageServer() {
 }
 
+/**
+ * The heartbeats go by the monotonic clock, a change of the time of day does not make them come too late for CEquids.
+ */
+void CMessageServer::heartbeat(bool running, uint32_t cycles, uint32_t overruns) {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	long long now = (long long)time.tv_sec * 1000000 + time.tv_nsec / 1000;
+	if (heartbeats > 0 && now - heartbeat_at < HEARTBEAT_PERIOD) return;
+	HeartbeatWire wire;
+	wire.version = HeartbeatWire::VERSION;
+	wire.running = running;
+	wire.sequence = ++heartbeats;
+	wire.cycles = cycles;
+	wire.overruns = overruns;
+	sendMessage(MSG_HEARTBEAT, &wire, sizeof(wire));
+	heartbeat_at = now;
+}
+
+//! Answer an empty MSG_IPC_STATS from the receiving thread, without waiting for the jockey to read its messages
+static void sendIPCStats(IPC::IPC & ipc, void * connection) {
+	std::vector<IPC::ConnectionStats> stats;
+	ipc.Stats(stats);
+	uint8_t buffer[IPC_STATS_MAX_LENGTH];
+	int len = packIPCStats(stats.empty() ? NULL : &stats[0], stats.size(), ipc.Reconnects(), buffer);
+	if (connection != NULL) {
+		((IPC::Connection*) connection)->SendData(MSG_IPC_STATS, buffer, len);
+	} else {
+		ipc.SendData(MSG_IPC_STATS, buffer, len);
+	}
+}
+
+//! Answer an empty MSG_MEM_STATS from the receiving thread as well, it is asked for when the robot runs out of memory
+static void sendMemStats(IPC::IPC & ipc, void * connection) {
+	MemProcessStats process;
+	memSampleProcess(process);
+	MemModuleStats stats[MEM_MODULES];
+	int count = memStats(stats, MEM_MODULES);
+	uint8_t buffer[MEM_STATS_MAX_LENGTH];
+	int len = packMemStats(process, stats, count, getpid(), buffer);
+	if (connection != NULL) {
+		((IPC::Connection*) connection)->SendData(MSG_MEM_STATS, buffer, len);
+	} else {
+		ipc.SendData(MSG_MEM_STATS, buffer, len);
+	}
+}
+
+//! Answer an empty MSG_TRACE_DUMP from the receiving thread, so the dump does not wait behind the detections it traces
+static void sendTraceDump(IPC::IPC & ipc, void * connection) {
+	TraceRecord records[TRACE_DUMP_MAX_RECORDS];
+	int count = traceRecords(records, TRACE_DUMP_MAX_RECORDS);
+	uint8_t buffer[TRACE_DUMP_MAX_LENGTH];
+	int len = packTraceDump(records, count, getpid(), traceNow(), buffer);
+	if (connection != NULL) {
+		((IPC::Connection*) connection)->SendData(MSG_TRACE_DUMP, buffer, len);
+	} else {
+		ipc.SendData(MSG_TRACE_DUMP, buffer, len);
+	}
+}
+
 static void addMessage(const ELolMessage *msg, void * connection, void * serv) {
 	CMessageServer* server = (CMessageServer*) serv;
 
-	if (server != NULL) {
+	if (server != NULL && msg->command == MSG_IPC_STATS && msg->length == 0) {
+		sendIPCStats(server->jockey_IPC, connection);
+	} else if (server != NULL && msg->command == MSG_MEM_STATS && msg->length == 0) {
+		sendMemStats(server->jockey_IPC, connection);
+	} else if (server != NULL && msg->command == MSG_TRACE_DUMP && msg->length == 0) {
+		sendTraceDump(server->jockey_IPC, connection);
+	} else if (server != NULL) {
+		traceHop(detectionCapture(msg->command, msg->data, msg->length), TRACE_RECEIVED);
+		if (server->tap != NULL) server->tap(msg->command, msg->data, msg->length, false, server->tap_arg);
 		sem_wait(&server->dataSem);
 		bool found = false;
 		for (int var = 0; var < server->lastMessages.size(); ++var) {
 			if (server->lastMessages[var]->type
 					== (TMessageType) msg->command) {
-				if (server->lastMessages[var]->len != msg->length) {
-					delete server->lastMessages[var];
-					server->lastMessages.erase(
-							server->lastMessages.begin() + var);
-					CMessage* message = new CMessage();
-					message->set(msg);
-					message->valid = true;
-					server->lastMessages.push_back(message);
-				} else {
-					if (msg->length>0) {
-						memcpy(server->lastMessages[var]->data, msg->data,
-								msg->length);
-					}
-					server->lastMessages[var]->valid = true;
-				}
+				// overwrites the payload in place unless getMessage still shares it
+				server->lastMessages[var]->set(msg);
+				server->lastMessages[var]->valid = true;
 				found = true;
 				break;
 			}
@@ -66,6 +130,10 @@ int CMessageServer::initServer(const char* port) {
 
 	jockey_IPC.Name("jockey IPC");
 
+	for (int type = 0; type < TOTAL_NUMBER_OF_MESSAGES; type++) {
+		IPC::IPC::SetPriority(type, isControlMessage(type) ? IPC::PRIORITY_CONTROL : IPC::PRIORITY_BULK);
+	}
+
 	jockey_IPC.Start("localhost", atoi(port), true);
 
 	return 0;
@@ -76,10 +144,7 @@ const CMessage & CMessageServer::getMessage() {
 
 	sem_wait(&dataSem);
 
-	if (mm.data!=NULL) {
-		delete[] mm.data;
-		mm.data = NULL;
-	}
+	mm.release();
 
 	if (last_ptr>=lastMessages.size()) {
 		last_ptr=0;
@@ -100,7 +165,7 @@ const CMessage & CMessageServer::getMessage() {
 	}
 
 	if (last_ptr< lastMessages.size()) { 
-		mm.set(lastMessages[last_ptr]);
+		mm = *lastMessages[last_ptr];
 		lastMessages[last_ptr]->valid = false;
 		last_ptr++;
 		if (last_ptr>=lastMessages.size()) {
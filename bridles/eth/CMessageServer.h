@@ -24,6 +24,14 @@
 #include <pthread.h>
 
 #define NUM_CONNECTIONS 100
+//! Period in us at which a stopped jockey in standby looks for messages, so MSG_START is picked up in a few ms
+#ifndef STANDBY_POLL_PERIOD
+#define STANDBY_POLL_PERIOD 2000
+#endif
+//! Period in us of MSG_HEARTBEAT, a loop that takes longer per round sends them less often
+#ifndef HEARTBEAT_PERIOD
+#define HEARTBEAT_PERIOD 500000
+#endif
 typedef struct 
 {
 	bool write,odometry,rotation,buttons,ir;
@@ -35,12 +43,16 @@ typedef struct
 
 void* serverLoop(void* serv);
 
+//! Sees every message of a jockey, the incoming ones on the IPC thread, the outgoing ones on the thread that sends them
+typedef void (*MessageTap)(int type, const void *data, int len, bool outgoing, void *arg);
+
 class CMessageServer {
 
-	IPC::IPC  jockey_IPC;
 	CMessage mm;
 
 public:
+	//! Public for the callback, which answers MSG_IPC_STATS with the counters of its connections
+	IPC::IPC  jockey_IPC;
 
 	CMessageServer();
 	~CMessageServer();
@@ -53,14 +65,39 @@ public:
 
 	//! Send a new message, you have to deallocate msg.data yourself. This can immediately be done on returning
 	void sendMessage(CMessage &msg) {
+		if (tap != NULL) tap(msg.type, msg.data, msg.len, true, tap_arg);
 		jockey_IPC.SendData(msg.type, (uint8_t*)msg.data, msg.len);
 	}
 
 	//! Send a new message, you have to deallocate data yourself.
 	void sendMessage(int type, const void *data, int len) {
+		if (tap != NULL) tap(type, data, len, true, tap_arg);
 		jockey_IPC.SendData(type, (uint8_t*)data, len);
 	}
 
+	//! Record or trace the messages of the jockey, for example into a CStreamLog, NULL to stop
+	void setTap(MessageTap tap, void *arg) {
+		tap_arg = arg;
+		this->tap = tap;
+	}
+
+	//! Ask CEquids to publish messages of this type from other jockeys to this one
+	void subscribe(TMessageType type) {
+		uint8_t t = type;
+		jockey_IPC.SendData(MSG_SUBSCRIBE, &t, 1);
+	}
+
+	void unsubscribe(TMessageType type) {
+		uint8_t t = type;
+		jockey_IPC.SendData(MSG_UNSUBSCRIBE, &t, 1);
+	}
+
+	/**
+	 * Send a MSG_HEARTBEAT if the last one is HEARTBEAT_PERIOD ago. Call it every round of the main loop of the jockey,
+	 * not from a thread of its own, so the watchdog of CEquids restarts the jockey when the loop hangs.
+	 */
+	void heartbeat(bool running, uint32_t cycles = 0, uint32_t overruns = 0);
+
 	//bool getClientInfo(int socket,bool data[]);
 	//CMessage checkForMessage();
 	//int sendPosition(int socket,double buffer[]);
@@ -79,6 +116,11 @@ public:
 	//int ir[4];
 	int last_ptr;
 	std::vector<CMessage *> lastMessages;
+	MessageTap tap;
+	void *tap_arg;
+	//! Number of the last MSG_HEARTBEAT and when it was sent, in us
+	uint32_t heartbeats;
+	long long heartbeat_at;
 };
 
 #endif
@@ -0,0 +1,331 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Parameters that CEquids parses once and shares with its jockeys, and that can be tuned while they run
+ * @file CParams.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#include <CParams.h>
+#include <CRobotIndex.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PARAMS_LINE 256
+//! Times update() tries to get a copy that the server did not write to in the meantime
+#define PARAMS_TRIES 100
+
+//! Prefix of the messages
+static const std::string NAME = "CParams";
+
+//! Convenience function for printing to standard out
+#define DEBUG NAME << '[' << getpid() << "] " << __func__ << "(): "
+
+//! PARAMS_SEGMENT of this robot, see CRobotIndex.h
+static const char *paramsSegment() {
+	static char name[64] = "";
+	if (!name[0]) segmentName(PARAMS_SEGMENT, name, sizeof(name));
+	return name;
+}
+
+/***********************************************************************************************************************
+ * Server
+ **********************************************************************************************************************/
+
+CParamServer::CParamServer(): block(NULL), watching(false) {
+	pthread_mutex_init(&mutex, NULL);
+}
+
+CParamServer::~CParamServer() {
+	stop();
+	if (block != NULL) {
+		munmap(block, sizeof(ParamBlock));
+		shm_unlink(paramsSegment());
+	}
+	pthread_mutex_destroy(&mutex);
+}
+
+bool CParamServer::create() {
+	if (block != NULL) return true;
+	shm_unlink(paramsSegment());
+	int fd = shm_open(paramsSegment(), O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0) {
+		std::cerr << DEBUG << "No shared parameters, " << strerror(errno) << std::endl;
+		return false;
+	}
+	if (ftruncate(fd, sizeof(ParamBlock)) < 0) {
+		std::cerr << DEBUG << "Shared parameters can not be sized, " << strerror(errno) << std::endl;
+		close(fd);
+		shm_unlink(paramsSegment());
+		return false;
+	}
+	void *ptr = mmap(NULL, sizeof(ParamBlock), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ptr == MAP_FAILED) {
+		std::cerr << DEBUG << "Shared parameters can not be mapped, " << strerror(errno) << std::endl;
+		shm_unlink(paramsSegment());
+		return false;
+	}
+	block = (ParamBlock*) ptr;
+	memset(block, 0, sizeof(ParamBlock));
+	__sync_synchronize();
+	block->magic = PARAMS_MAGIC;
+	return true;
+}
+
+void CParamServer::beginWrite() {
+	block->sequence++;
+	__sync_synchronize();
+}
+
+void CParamServer::endWrite(bool changed) {
+	__sync_synchronize();
+	if (changed) block->version++;
+	block->sequence++;
+}
+
+bool CParamServer::write(const char *name, const char *text) {
+	uint32_t i = 0;
+	while (i < block->count && strncmp(block->entries[i].name, name, PARAMS_NAME_SIZE) != 0) i++;
+	ParamEntry &entry = block->entries[i];
+	if (i < block->count) {
+		if (strncmp(entry.text, text, PARAMS_TEXT_SIZE - 1) == 0) return false;
+	} else if (i == PARAMS_MAX) {
+		std::cerr << DEBUG << "No room for parameter " << name << ", there are " << PARAMS_MAX << std::endl;
+		return false;
+	} else {
+		strncpy(entry.name, name, PARAMS_NAME_SIZE - 1);
+		entry.name[PARAMS_NAME_SIZE - 1] = 0;
+	}
+	strncpy(entry.text, text, PARAMS_TEXT_SIZE - 1);
+	entry.text[PARAMS_TEXT_SIZE - 1] = 0;
+	entry.value = atof(text);
+	// a new slot is only counted once it is filled in
+	if (i == block->count) block->count++;
+	return true;
+}
+
+bool CParamServer::parse(const char *filename) {
+	FILE *file = fopen(filename, "r");
+	if (file == NULL) {
+		std::cerr << DEBUG << "Can not read parameters from " << filename << std::endl;
+		return false;
+	}
+	bool changed = false;
+	char line[PARAMS_LINE];
+	while (fgets(line, PARAMS_LINE, file) != NULL) {
+		char *comment = strchr(line, '#');
+		if (comment != NULL) *comment = 0;
+		if (strpbrk(line, "()[]") != NULL) continue;
+		char *name = line;
+		while (isspace(*name)) name++;
+		char *end = name;
+		while (*end && !isspace(*end) && *end != '=') end++;
+		if (end == name || end - name >= PARAMS_NAME_SIZE) continue;
+		char *text = end;
+		while (isspace(*text) || *text == '=') text++;
+		*end = 0;
+		size_t length = strlen(text);
+		while (length > 0 && isspace(text[length - 1])) text[--length] = 0;
+		if (length >= 2 && text[0] == '"' && text[length - 1] == '"') {
+			text[length - 1] = 0;
+			text++;
+		}
+		if (!*text) continue;
+		if (write(name, text)) changed = true;
+	}
+	fclose(file);
+	return changed;
+}
+
+bool CParamServer::load(const char *filename) {
+	if (block == NULL && !create()) return false;
+	struct stat status;
+	if (stat(filename, &status) != 0) {
+		std::cerr << DEBUG << "Can not read parameters from " << filename << std::endl;
+		return false;
+	}
+	pthread_mutex_lock(&mutex);
+	WatchedFile watched;
+	watched.name = filename;
+	watched.modified = status.st_mtime;
+	watched.size = status.st_size;
+	files.push_back(watched);
+	beginWrite();
+	bool changed = parse(filename);
+	endWrite(changed);
+	pthread_mutex_unlock(&mutex);
+	std::cout << DEBUG << "Serve " << block->count << " parameters, version " << block->version << std::endl;
+	return true;
+}
+
+bool CParamServer::set(const char *name, const char *text) {
+	if (block == NULL && !create()) return false;
+	pthread_mutex_lock(&mutex);
+	beginWrite();
+	bool changed = write(name, text);
+	endWrite(changed);
+	pthread_mutex_unlock(&mutex);
+	return changed;
+}
+
+/**
+ * A file that changed is parsed in full again, the parameters of the other files keep their values. The whole poll is
+ * one write of the seqlock, so a jockey gets all the changes of an edit at once.
+ */
+bool CParamServer::poll() {
+	if (block == NULL) return false;
+	bool changed = false;
+	pthread_mutex_lock(&mutex);
+	beginWrite();
+	for (unsigned int i = 0; i < files.size(); ++i) {
+		struct stat status;
+		if (stat(files[i].name.c_str(), &status) != 0) continue;
+		if (status.st_mtime == files[i].modified && status.st_size == files[i].size) continue;
+		files[i].modified = status.st_mtime;
+		files[i].size = status.st_size;
+		if (parse(files[i].name.c_str())) changed = true;
+	}
+	endWrite(changed);
+	pthread_mutex_unlock(&mutex);
+	if (changed) {
+		std::cout << DEBUG << "Parameters changed, version " << block->version << std::endl;
+	}
+	return changed;
+}
+
+void *CParamServer::watchThread(void *server) {
+	CParamServer *self = (CParamServer*) server;
+	while (self->watching) {
+		usleep(PARAMS_WATCH_PERIOD);
+		self->poll();
+	}
+	return NULL;
+}
+
+bool CParamServer::watch() {
+	if (watching) return true;
+	watching = true;
+	if (pthread_create(&thread, NULL, watchThread, this) != 0) {
+		std::cerr << DEBUG << "Can not start the thread that watches the parameter files" << std::endl;
+		watching = false;
+		return false;
+	}
+	return true;
+}
+
+void CParamServer::stop() {
+	if (!watching) return;
+	watching = false;
+	pthread_join(thread, NULL);
+}
+
+/***********************************************************************************************************************
+ * Jockey
+ **********************************************************************************************************************/
+
+CParams::CParams(): block(NULL), count(0), version(0) {
+}
+
+CParams::~CParams() {
+	if (block != NULL) munmap((void*) block, sizeof(ParamBlock));
+}
+
+bool CParams::attach() {
+	if (block != NULL) return true;
+	int fd = shm_open(paramsSegment(), O_RDONLY, 0);
+	if (fd < 0) return false;
+	struct stat status;
+	if (fstat(fd, &status) != 0 || status.st_size < (off_t) sizeof(ParamBlock)) {
+		close(fd);
+		return false;
+	}
+	void *ptr = mmap(NULL, sizeof(ParamBlock), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ptr == MAP_FAILED) return false;
+	const ParamBlock *shared = (const ParamBlock*) ptr;
+	if (shared->magic != PARAMS_MAGIC) {
+		munmap(ptr, sizeof(ParamBlock));
+		return false;
+	}
+	block = shared;
+	update();
+	return true;
+}
+
+/**
+ * The copy is made into a scratch buffer first, so the values the jockey reads are never a torn copy, also not when
+ * the server keeps on writing and every try fails.
+ */
+bool CParams::update() {
+	if (block == NULL || block->version == version) return false;
+	for (int tries = 0; tries < PARAMS_TRIES; ++tries) {
+		uint32_t begin = block->sequence;
+		if (begin & 1) {
+			sched_yield();
+			continue;
+		}
+		__sync_synchronize();
+		uint32_t latest = block->version;
+		uint32_t n = block->count;
+		if (n > PARAMS_MAX) n = PARAMS_MAX;
+		memcpy(scratch, (const void*) block->entries, n * sizeof(ParamEntry));
+		__sync_synchronize();
+		if (block->sequence != begin) continue;
+		memcpy(entries, scratch, n * sizeof(ParamEntry));
+		count = n;
+		version = latest;
+		return true;
+	}
+	return false;
+}
+
+int CParams::find(const char *name) {
+	for (uint32_t i = 0; i < count; ++i) {
+		if (strncmp(entries[i].name, name, PARAMS_NAME_SIZE) == 0) return i;
+	}
+	return -1;
+}
+
+const double *CParams::bind(const char *name) {
+	int i = find(name);
+	return (i < 0) ? NULL : &entries[i].value;
+}
+
+double CParams::get(const char *name, double value) {
+	int i = find(name);
+	return (i < 0) ? value : entries[i].value;
+}
+
+std::string CParams::getText(const char *name, const std::string &value) {
+	int i = find(name);
+	return (i < 0) ? value : std::string(entries[i].text);
+}
@@ -0,0 +1,162 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Parameters that CEquids parses once and shares with its jockeys, and that can be tuned while they run
+ * @file CParams.h
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#ifndef CPARAMS_H_
+#define CPARAMS_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+#define PARAMS_SEGMENT "/equids_params"
+#define PARAMS_MAGIC 0x50515145 // "EQQP"
+#define PARAMS_MAX 128
+#define PARAMS_NAME_SIZE 32
+#define PARAMS_TEXT_SIZE 32
+//! Period in us at which the server looks whether its files changed
+#define PARAMS_WATCH_PERIOD 1000000
+
+struct ParamEntry {
+	char name[PARAMS_NAME_SIZE];
+	//! The value as it is in the file, and parsed with atof()
+	char text[PARAMS_TEXT_SIZE];
+	double value;
+};
+
+/**
+ * The segment is a seqlock: the server makes sequence odd while it writes and even again afterwards, and counts up
+ * version with every change. A parameter keeps its slot once it has one, also when it disappears from the file.
+ */
+struct ParamBlock {
+	uint32_t magic;
+	volatile uint32_t sequence;
+	volatile uint32_t version;
+	volatile uint32_t count;
+	ParamEntry entries[PARAMS_MAX];
+};
+
+/**
+ * Hosted by CEquids. Parses the files with lines "name = value" or "name value", a # starts a comment and lines with
+ * tuples or entities, as in the worldfiles of the option files, are skipped. A thread reads a file again when it
+ * changed, so a threshold can be tuned by editing the file on the robot while the jockeys run.
+ */
+class CParamServer {
+public:
+	CParamServer();
+
+	~CParamServer();
+
+	//! Create the segment, an old one is removed, before the jockeys are started
+	bool create();
+
+	//! Parse a file and publish its parameters, the file is watched from then on
+	bool load(const char *filename);
+
+	//! Publish a single parameter
+	bool set(const char *name, const char *text);
+
+	//! Read the files that changed since they were loaded again, true if any did
+	bool poll();
+
+	//! Start the thread that calls poll() every PARAMS_WATCH_PERIOD
+	bool watch();
+
+	void stop();
+
+	inline uint32_t getVersion() const { return block ? block->version : 0; }
+
+private:
+	static void *watchThread(void *server);
+
+	//! Parse a file into the segment, with the sequence odd
+	bool parse(const char *filename);
+
+	//! Write one value, with the sequence odd, false if there is no free slot
+	bool write(const char *name, const char *text);
+
+	void beginWrite();
+
+	void endWrite(bool changed);
+
+	ParamBlock *block;
+
+	struct WatchedFile {
+		std::string name;
+		time_t modified;
+		off_t size;
+	};
+	std::vector<WatchedFile> files;
+
+	//! load(), set() and the thread of watch() all write, the segment has a single writer
+	pthread_mutex_t mutex;
+	pthread_t thread;
+	volatile bool watching;
+};
+
+/**
+ * The jockey side. update() copies the segment into the jockey when its version changed, without a lock, so call it at
+ * a cycle boundary, CController::run() does before every tick(). The pointers of bind() point into that copy, reading
+ * them is a pointer read and they do not change in the middle of a tick.
+ */
+class CParams {
+public:
+	CParams();
+
+	~CParams();
+
+	//! Map the segment of CEquids, false if it does not serve parameters
+	bool attach();
+
+	inline bool attached() const { return block != NULL; }
+
+	//! Copy the parameters if they changed since the last time, true if they did
+	bool update();
+
+	//! The value of a parameter, stays valid, NULL if it does not exist (yet)
+	const double *bind(const char *name);
+
+	double get(const char *name, double value);
+
+	//! The value as text, a copy because the next update() may change it
+	std::string getText(const char *name, const std::string &value);
+
+	inline uint32_t getVersion() const { return version; }
+
+private:
+	int find(const char *name);
+
+	const ParamBlock *block;
+
+	ParamEntry entries[PARAMS_MAX];
+	//! Where update() copies the segment to before it knows that the copy is consistent
+	ParamEntry scratch[PARAMS_MAX];
+	uint32_t count;
+	uint32_t version;
+};
+
+#endif /* CPARAMS_H_ */
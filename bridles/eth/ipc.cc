@@ -5,18 +5,28 @@
  */
 #include <pthread.h>
 #include <string.h>
+#include <stdlib.h>
 #include <stdio.h>
 #include <arpa/inet.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/time.h> //FD_SET, FD_ISSET, FD_ZERO macros
+#include <sys/uio.h>
 #include <netdb.h>
 #include <unistd.h>
 #include <sstream>
 #include <iostream>
 #include <errno.h>
+#include <fcntl.h>
+#include <time.h>
 #include "ipc.hh"
+#include "shmipc.hh"
+#include "crc8.h"
+#include "lzcodec.h"
+#include <CMemStats.h>
+#include <CSched.h>
 
 #include <assert.h>
 
@@ -29,6 +39,63 @@ namespace IPC{
     fd=-1;}\
 }
 
+/**
+ * CRC-8 over 8 bytes at once (slicing-by-8). The CRC is linear, so the checksum after 8 bytes is the xor of the effect
+ * of every byte followed by the bytes after it, and the effect of a byte followed by k - 1 zeros is in crc8_slices[k - 1].
+ */
+static uint8_t crc8_slices[8][256];
+static pthread_once_t crc8_slices_once = PTHREAD_ONCE_INIT;
+
+static void Crc8Slices()
+{
+    for(int x = 0; x < 256; x++)
+    {
+        crc8_slices[0][x] = crc8_table[x];
+        for(int k = 1; k < 8; k++)
+            crc8_slices[k][x] = crc8_table[crc8_slices[k - 1][x]];
+    }
+}
+
+static uint8_t Crc8Block(uint8_t crc, const uint8_t *data, uint32_t len)
+{
+    pthread_once(&crc8_slices_once, Crc8Slices);
+    while(len >= 8)
+    {
+        crc = crc8_slices[7][crc ^ data[0]] ^ crc8_slices[6][data[1]] ^ crc8_slices[5][data[2]] ^
+            crc8_slices[4][data[3]] ^ crc8_slices[3][data[4]] ^ crc8_slices[2][data[5]] ^
+            crc8_slices[1][data[6]] ^ crc8_slices[0][data[7]];
+        data += 8;
+        len -= 8;
+    }
+    while(len--)
+        crc = crc8_byte(crc, *data++);
+    return crc;
+}
+
+//monotonic time in microseconds
+static long long Now()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (long long)time.tv_sec * 1000000 + time.tv_nsec / 1000;
+}
+
+//no Nagle delay for the small messages, and a peer that is gone without closing the connection is noticed
+static void Tune(int fd)
+{
+    int flag = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &flag, sizeof(flag));
+#ifdef TCP_KEEPIDLE
+    int idle = IPCKEEPALIVEIDLE;
+    int interval = 1;
+    int count = IPCKEEPALIVECOUNT;
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+#endif
+}
+
 #define Shutdown(fd, val){\
     if(fd>=0){\
     printf("\tshutdown socket %d (line %d)\n", fd, __LINE__);\
@@ -40,41 +107,230 @@ namespace IPC{
 }
 
 
+//the buffers of the connections
+static int IPCMemory()
+{
+    static int module = memModule("ipc");
+    return module;
+}
+
 Connection::Connection()
 {
     ipc = NULL;
     callback = NULL;
     connected = true;
-    BQInit(&txq, txbuffer, IPCTXBUFFERSIZE);
+    parseContext.buf = NULL;
+    txbuffersize = IPC::TxBufferSize();
+    txbuffer = new uint8_t[txbuffersize];
+    memAllocated(IPCMemory(), txbuffersize);
+    BQInit(&txq[PRIORITY_BULK], txbuffer, txbuffersize);
+    BQInit(&txq[PRIORITY_CONTROL], controlbuffer, IPCCONTROLBUFFERSIZE);
+    txstarted = -1;
     pthread_mutex_init(&mutex_txq, NULL);
+    pthread_cond_init(&cond_txq, NULL);
     user_data = NULL;
     transmiting_thread_running = false;
     receiving_thread_running = false;
+    transmiting_thread_started = false;
+    redialing = false;
+    dropped = 0;
+    bytes_out = 0;
+    messages_out = 0;
+    max_queued = 0;
+    max_latency = 0;
+    bytes_in = 0;
+    messages_in = 0;
+    parse_errors = 0;
+    wakefd = -1;
+    peer_inflates = false;
+    pthread_mutex_init(&mutex_deflate, NULL);
+    deflatebuffer = NULL;
+    deflatesize = 0;
+    deflatetable = NULL;
+    inflatebuffer = NULL;
+    inflatesize = 0;
 }
 Connection::~Connection()
 {
     //clean up
+    pthread_mutex_lock(&mutex_txq);
     connected = false;
+    redialing = false;
+    pthread_cond_broadcast(&cond_txq);
+    pthread_mutex_unlock(&mutex_txq);
+    if(transmiting_thread_started)
+    {
+        Shutdown(sockfds, 2); //a transmiting thread blocked in writev returns with an error
+        pthread_join(transmiting_thread, NULL);
+    }
     Close(sockfds);
+    pthread_cond_destroy(&cond_txq);
+    pthread_mutex_destroy(&mutex_txq);
+    delete [] txbuffer;
+    memFreed(IPCMemory(), txbuffersize);
+    if(parseContext.buf != NULL)
+    {
+        delete [] parseContext.buf;
+        memFreed(IPCMemory(), parseContext.bufLength);
+    }
+    if(deflatetable != NULL)
+    {
+        delete [] deflatetable;
+        memFreed(IPCMemory(), LZ_HASH_SIZE * sizeof(int32_t));
+    }
+    delete [] deflatebuffer;
+    memFreed(IPCMemory(), deflatesize);
+    delete [] inflatebuffer;
+    memFreed(IPCMemory(), inflatesize);
+    pthread_mutex_destroy(&mutex_deflate);
 }
 
 bool Connection::Start()
 {
+    int rxbuffersize = IPC::RxBufferSize();
+    ElolmsgParseInit(&parseContext, new uint8_t[rxbuffersize], rxbuffersize);
+    memAllocated(IPCMemory(), rxbuffersize);
+    if(wakefd >= 0)
+    {
+        //served by the reactor of the IPC, which must never block on this socket
+        fcntl(sockfds, F_SETFL, fcntl(sockfds, F_GETFL, 0) | O_NONBLOCK);
+        return true;
+    }
     pthread_create(&receiving_thread, 0, Receiving, this);
-    //pthread_create(&transmiting_thread, 0, Transmiting, this);
+    transmiting_thread_started = (pthread_create(&transmiting_thread, 0, Transmiting, this) == 0);
     return true;
 }
 
 void Connection::Disconnect()
 {
-    connected = false;
+    Lost(false);
+    if(wakefd >= 0)
+        write(wakefd, "", 1);
     Shutdown(sockfds, 2); //this will stops each connections, so their transmit and receiver thread will quit
 }
 
+int Connection::Pending()
+{
+    pthread_mutex_lock(&mutex_txq);
+    int count = Queued();
+    pthread_mutex_unlock(&mutex_txq);
+    return count;
+}
+
+int Connection::Queued()
+{
+    int count = 0;
+    for(int lane = 0; lane < PRIORITIES; lane++)
+        count += BQCount(&txq[lane]);
+    return count;
+}
+
+void Connection::Sent(long long queued)
+{
+    long long latency = Now() - queued;
+    if(latency > max_latency)
+        max_latency = (latency > 0xFFFFFFFFLL) ? 0xFFFFFFFF : (uint32_t)latency;
+}
+
+void Connection::Stats(ConnectionStats &stats)
+{
+    memset(&stats, 0, sizeof(stats));
+    stats.address = addr.sin_addr.s_addr;
+    stats.port = ntohs(addr.sin_port);
+    stats.shared = false;
+    stats.connected = connected;
+    stats.bytes_in = bytes_in;
+    stats.messages_in = messages_in;
+    stats.parse_errors = parse_errors;
+    pthread_mutex_lock(&mutex_txq);
+    stats.bytes_out = bytes_out;
+    stats.messages_out = messages_out;
+    stats.dropped = dropped;
+    stats.queued_bytes = Queued();
+    for(int lane = 0; lane < PRIORITIES; lane++)
+        stats.queued_messages += txmessages[lane].size();
+    stats.max_queued_bytes = max_queued;
+    stats.max_send_latency = max_latency;
+    pthread_mutex_unlock(&mutex_txq);
+}
+
+void Connection::Lost(bool redial)
+{
+    pthread_mutex_lock(&mutex_txq);
+    connected = false;
+    redialing = redial && ipc && ((IPC*)ipc)->Redials();
+    //the other thread may still wait in read or writev on the socket
+    if(redialing && sockfds >= 0)
+        shutdown(sockfds, SHUT_RDWR);
+    pthread_cond_broadcast(&cond_txq);
+    pthread_mutex_unlock(&mutex_txq);
+}
+
+bool Connection::Redial()
+{
+    IPC *owner = (IPC*)ipc;
+    while(redialing)
+    {
+        if(!owner->Redials())
+        {
+            pthread_mutex_lock(&mutex_txq);
+            redialing = false;
+            pthread_cond_broadcast(&cond_txq);
+            pthread_mutex_unlock(&mutex_txq);
+            return false;
+        }
+        if(owner->Redial(this, true))
+            return true;
+    }
+    return false;
+}
+
+/**
+ * A message that was partly written to the lost socket can not be finished on the new one, and the peer that comes
+ * back is usually a restarted jockey that would not understand the rest of it, so the queue starts empty.
+ */
+void Connection::Reset(int fd)
+{
+    Tune(fd);
+    if(wakefd >= 0)
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    parseContext.state = (EParseState)0;
+    //the peer that comes back may be an older one
+    peer_inflates = false;
+    pthread_mutex_lock(&mutex_txq);
+    int old = sockfds;
+    sockfds = fd;
+    for(int lane = 0; lane < PRIORITIES; lane++)
+    {
+        BQClear(&txq[lane]);
+        txmessages[lane].clear();
+    }
+    txstarted = -1;
+    connected = true;
+    redialing = false;
+    if(wakefd >= 0)
+        receiving_thread_running = transmiting_thread_running = true;
+    pthread_cond_broadcast(&cond_txq);
+    pthread_mutex_unlock(&mutex_txq);
+    if(old != fd)
+        Close(old);
+}
+
 
 IPC::IPC()
 {
     name = strdup("default");
+    reactor = false;
+    wake[0] = wake[1] = -1;
+    shared = NULL;
+    connects = 0;
+    reconnects = 0;
+    reconnect = false;
+    dialing = false;
+    memset(&peer, 0, sizeof(peer));
+    redial_delay = IPCREDIALMIN;
+    redial_at = 0;
+    lost_at = 0;
     sockfd = -1;
     port = 10000;
     host = NULL;
@@ -88,6 +344,9 @@ IPC::~IPC()
 {
     free(name);
     //cleanup
+    delete shared;
+    Close(wake[0]);
+    Close(wake[1]);
 }
 
 bool IPC::Start(uint32_t ip, int p, bool s)
@@ -107,8 +366,21 @@ bool IPC::Start(const char* h, int p, bool s)
         return false;
     }
 
+    //the connection that is lost is dialed again already, with its own threads
+    for(unsigned int i=0; !s && i< connections.size(); i++)
+    {
+        if(connections[i] && connections[i]->redialing && port == p && Redials())
+        {
+            printf("IPC %s reconnects to %s:%d already\n", name, h, p);
+            return true;
+        }
+    }
+
     printf("Restart IPC %s to %s:%d\n", name, h, p);
     port = p;
+    dialing = true;
+    redial_delay = IPCREDIALMIN;
+    redial_at = 0;
     server = s;
     if(h)
         host=strdup(h);
@@ -125,11 +397,36 @@ bool IPC::Start(const char* h, int p, bool s)
         for(int i=0;i<connections.size();i++)
             printf("\t connection from %s:%d\n", inet_ntoa(connections[i]->addr.sin_addr), ntohs(connections[i]->addr.sin_port));
     }
+    if (reactor && wake[0] < 0) {
+        if (pipe(wake) < 0) {
+            perror("Reactor pipe failed:");
+            reactor = false;
+        } else {
+            fcntl(wake[0], F_SETFL, O_NONBLOCK);
+            fcntl(wake[1], F_SETFL, O_NONBLOCK);
+        }
+    }
+    //a jockey that is started by CEquids with transport=shm finds its segment, TCP is still served for the others
+    if (s && !shared) {
+        SharedChannel *channel = new SharedChannel;
+        if (channel->Attach(port))
+            shared = channel;
+        else
+            delete channel;
+    }
+    if (shared && !shared->Start(callback, user_data))
+        ret = false;
     //create monitoring thread
     if (s) {
         pthread_create(&monitor_thread, 0, Monitoring, this);
+    } else if (shared) {
+        printf("%s uses shared memory instead of a connection to %s:%d\n", name, h, p);
     } else {
         ret = ConnectToServer(host, port);
+        if (ret && reactor) {
+            monitoring_thread_running = true;
+            pthread_create(&monitor_thread, 0, Reacting, this);
+        }
     }
     return ret;
 }
@@ -137,6 +434,7 @@ bool IPC::Start(const char* h, int p, bool s)
 void * IPC::Monitoring(void * ptr)
 {
     IPC* ipc = (IPC*)ptr;
+    schedThread("ipc");
 
     ipc->monitoring_thread_running = true;
 
@@ -152,44 +450,121 @@ void * IPC::Monitoring(void * ptr)
     return NULL;
 }
 
-void * Connection::Receiving(void * p)
+void * IPC::Reacting(void * ptr)
 {
+    IPC* ipc = (IPC*)ptr;
+    schedThread("ipc");
 
-    Connection * ptr = (Connection*)p;
-    printf(" (%d) %s create receiving thread for %s:%d\n",ptr->sockfds, ((IPC*)ptr->ipc)->Name(),inet_ntoa(ptr->addr.sin_addr), ntohs(ptr->addr.sin_port));
+    ipc->React();
 
-    //main loop, keep reading
-    unsigned char rx_buffer[IPCBLOCKSIZE];
+    ipc->monitoring_thread_running = false;
 
-    ElolmsgParseInit(&ptr->parseContext, new uint8_t[IPCLOLBUFFERSIZE], IPCLOLBUFFERSIZE);
-    ptr->receiving_thread_running = true;
+    printf("------ exit reactor thread %s-----\n",ipc->Name());
+    return NULL;
+}
 
-    while(ptr->connected)
+/**
+ * One thread for the listening socket and all connections instead of a monitoring thread and two threads per
+ * connection. SendData writes to the wake pipe when a queue gets its first bytes, so poll also returns to write them.
+ * A client stops when its last connection is lost, unless it reconnects, then poll waits until it is time to dial.
+ */
+void IPC::React()
+{
+    std::vector<struct pollfd> fds;
+    std::vector<Connection*> polled;
+    uint8_t rx_buffer[IPCBLOCKSIZE];
+    struct pollfd pfd;
+
+    printf("%s reactor serves all connections\n", name);
+    while(monitoring_thread_running)
     {
-        //reading
-        memset(rx_buffer, 0, IPCBLOCKSIZE);
-        int received = read(ptr->sockfds,rx_buffer, IPCBLOCKSIZE);
-        if (received <= 0) 
+        fds.clear();
+        polled.clear();
+        pfd.fd = wake[0];
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        fds.push_back(pfd);
+        if(server && sockfd >= 0)
+        {
+            pfd.fd = sockfd;
+            fds.push_back(pfd);
+        }
+        int first = fds.size();
+        for(unsigned int i=0; i< connections.size(); i++)
+        {
+            Connection *conn = connections[i];
+            if(!conn || !conn->connected || conn->sockfds < 0)
+                continue;
+            pfd.fd = conn->sockfds;
+            pfd.events = POLLIN | ((conn->Pending() > 0) ? POLLOUT : 0);
+            fds.push_back(pfd);
+            polled.push_back(conn);
+        }
+        int timeout = -1;
+        if(!server && polled.empty())
+        {
+            Connection *lost = NULL;
+            for(unsigned int i=0; i< connections.size(); i++)
+                if(connections[i] && connections[i]->redialing)
+                    lost = connections[i];
+            if(!lost || !Redials())
+                break;
+            if(Redial(lost, false))
+                continue;
+            long long left = redial_at - Now();
+            timeout = (left > 0) ? (int)(left / 1000) + 1 : 0;
+        }
+
+        if(poll(&fds[0], fds.size(), timeout) < 0)
         {
-            printf("Connection lost %d : %d -- terminating\n",ptr->sockfds, received);
-            ptr->connected = false;
+            if(errno == EINTR)
+                continue;
+            perror("poll failed:");
             break;
         }
-        else
+
+        if(fds[0].revents & POLLIN)
+        {
+            char drain[64];
+            while(read(wake[0], drain, sizeof(drain)) > 0);
+        }
+        if(first > 1 && (fds[1].revents & POLLIN))
+            Accept();
+        for(unsigned int i=0; i< polled.size(); i++)
         {
-            int parsed = 0;
-            while (parsed < received)
+            Connection *conn = polled[i];
+            short revents = fds[first + i].revents;
+            if(revents & (POLLIN | POLLERR | POLLHUP))
+                conn->Receive(rx_buffer);
+            if(conn->connected && (revents & POLLOUT))
+                conn->Flush();
+            if(!conn->connected)
             {
-                parsed += ElolmsgParse(&ptr->parseContext, rx_buffer + parsed, received - parsed);
-                ELolMessage* msg = ElolmsgParseDone(&ptr->parseContext);
-                if(msg!=NULL && ptr->callback)
-                {
-                    // printf("received data from %s : %d\n",inet_ntoa(ptr->addr.sin_addr),ntohs(ptr->addr.sin_port));
-                    ptr->callback(msg, ptr, ptr->user_data);
-                }
+                conn->receiving_thread_running = false;
+                conn->transmiting_thread_running = false;
+                Close(conn->sockfds);
             }
         }
     }
+}
+
+void * Connection::Receiving(void * p)
+{
+
+    Connection * ptr = (Connection*)p;
+    schedThread("ipc");
+    printf(" (%d) %s create receiving thread for %s:%d\n",ptr->sockfds, ((IPC*)ptr->ipc)->Name(),inet_ntoa(ptr->addr.sin_addr), ntohs(ptr->addr.sin_port));
+
+    //main loop, keep reading
+    unsigned char rx_buffer[IPCBLOCKSIZE];
+
+    ptr->receiving_thread_running = true;
+
+    //a client that reconnects continues with the new socket
+    do
+    {
+        while(ptr->connected && ptr->Receive(rx_buffer));
+    } while(ptr->Redial());
 
     printf(" (%d) %s exit receiving thread for %s:%d\n",ptr->sockfds, ((IPC*)ptr->ipc)->Name(),  inet_ntoa(ptr->addr.sin_addr), ntohs(ptr->addr.sin_port));
     ptr->receiving_thread_running = false;
@@ -203,30 +578,31 @@ void * Connection::Receiving(void * p)
 void * Connection::Transmiting(void *p)
 {
     Connection * ptr = (Connection*)p;
+    schedThread("ipc");
     printf(" (%d) %s create transmiting thread for  %s:%d\n", ptr->sockfds, ((IPC*)ptr->ipc)->Name(), inet_ntoa(ptr->addr.sin_addr), ntohs(ptr->addr.sin_port));
-    uint8_t txBuf[IPCBLOCKSIZE];
-
     ptr->transmiting_thread_running = true;
 
-    while(ptr->connected)
+    while(true)
     {
         pthread_mutex_lock(&ptr->mutex_txq);
-        if(BQCount(&ptr->txq) > 0 )
-        {
-            register int byteCount = BQPopBytes(&ptr->txq, txBuf, IPCBLOCKSIZE);
-
-            int n = write(ptr->sockfds, txBuf, byteCount);
-            if(n<0)
-            {
-                ptr->connected = false;
-                printf("write error %d\n", n);
-                break;
-            }
-        }
+        while(ptr->redialing || (ptr->connected && ptr->Queued() == 0))
+            pthread_cond_wait(&ptr->cond_txq, &ptr->mutex_txq);
+        bool connected = ptr->connected;
         pthread_mutex_unlock(&ptr->mutex_txq);
 
-        usleep(100000);
+        //after an error Flush marks the connection as lost, and it waits above while it is dialed again
+        if(!connected)
+            break;
+        ptr->Flush();
     }
+    pthread_mutex_lock(&ptr->mutex_txq);
+    for(int lane = 0; lane < PRIORITIES; lane++)
+    {
+        BQClear(&ptr->txq[lane]);
+        ptr->txmessages[lane].clear();
+    }
+    ptr->txstarted = -1;
+    pthread_mutex_unlock(&ptr->mutex_txq);
 
     printf(" (%d) %s exit transmiting thread for %s:%d\n",ptr->sockfds, ((IPC*)ptr->ipc)->Name(),  inet_ntoa(ptr->addr.sin_addr), ntohs(ptr->addr.sin_port));
     ptr->transmiting_thread_running = false;
@@ -237,6 +613,180 @@ void * Connection::Transmiting(void *p)
     pthread_exit(NULL);
 }
 
+bool Connection::Receive(uint8_t *rx_buffer)
+{
+    int received = read(sockfds, rx_buffer, IPCBLOCKSIZE);
+    if (received < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+        return true;
+    if (received <= 0)
+    {
+        printf("Connection lost %d : %d -- terminating\n",sockfds, received);
+        Lost();
+        return false;
+    }
+    bytes_in += received;
+
+    int parsed = 0;
+    while (parsed < received)
+    {
+        parsed += Parse(rx_buffer + parsed, received - parsed);
+        if(parseContext.state == ELOLPARSE_ERR_CHECKSUM || parseContext.state == ELOLPARSE_ERR_BUFTOOSMALL)
+        {
+            if((parse_errors++ % 100) == 0)
+                printf("%s dropped %u corrupt messages from %s:%d\n", ((IPC*)ipc)->Name(), parse_errors,
+                        inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+            continue;
+        }
+        ELolMessage* msg = ElolmsgParseDone(&parseContext);
+        if(msg == NULL)
+            continue;
+        if(msg->counter & IPCFLAGINFLATES)
+            peer_inflates = true;
+        ELolMessage inflated;
+        if(msg->counter & IPCFLAGCOMPRESSED)
+        {
+            if(!Inflate(msg, inflated))
+            {
+                if((parse_errors++ % 100) == 0)
+                    printf("%s dropped %u corrupt messages from %s:%d\n", ((IPC*)ipc)->Name(), parse_errors,
+                            inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+                continue;
+            }
+            msg = &inflated;
+        }
+        messages_in++;
+        if(callback)
+        {
+            // printf("received data from %s : %d\n",inet_ntoa(addr.sin_addr),ntohs(addr.sin_port));
+            callback(msg, this, user_data);
+        }
+    }
+    return true;
+}
+
+/**
+ * The block is only decompressed when the whole of it is received and its checksum is right, into a buffer of the
+ * connection that is kept for the next compressed message, so a stream of maps does not allocate per message.
+ */
+bool Connection::Inflate(const ELolMessage *msg, ELolMessage &inflated)
+{
+    if(msg->length < 4)
+        return false;
+    const uint8_t *data = msg->data;
+    uint32_t size = data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+    if(size > (uint32_t)IPC::RxBufferSize())
+        return false;
+    if(inflatesize < (int)size)
+    {
+        delete [] inflatebuffer;
+        memFreed(IPCMemory(), inflatesize);
+        inflatebuffer = new uint8_t[size];
+        inflatesize = size;
+        memAllocated(IPCMemory(), inflatesize);
+    }
+    if(lzDecompress(data + 4, msg->length - 4, inflatebuffer, size) != (int)size)
+        return false;
+    inflated = *msg;
+    inflated.counter = msg->counter & ~IPCFLAGCOMPRESSED;
+    inflated.length = size;
+    inflated.data = inflatebuffer;
+    return true;
+}
+
+/**
+ * ElolmsgParse goes through its state machine for every byte. Only the header is handed to it, byte by byte so it
+ * stops where the payload starts. The payload is copied with a single memcpy and its checksum is computed 8 bytes at a
+ * time. The final checksum byte is left to ElolmsgParse again, which completes the message.
+ */
+int Connection::Parse(uint8_t *bytes, int len)
+{
+    if(parseContext.state != ELOLPARSE_VARIABLE_PL)
+        return ElolmsgParse(&parseContext, bytes, 1);
+
+    ELolMessage *msg = (ELolMessage*)parseContext.buf;
+    uint32_t end = (msg->data - parseContext.buf) + msg->length;
+    uint32_t n = end - parseContext.pos;
+    if(n == 0)
+        return ElolmsgParse(&parseContext, bytes, len);
+    if(n > (uint32_t)len)
+        n = len;
+    memcpy(parseContext.buf + parseContext.pos, bytes, n);
+    parseContext.checksum = Crc8Block(parseContext.checksum, bytes, n);
+    parseContext.pos += n;
+    return n;
+}
+
+/**
+ * Writes the highest lane that holds something, so a control message waits at most for the rest of the one bulk
+ * message that is partly on the wire. That message is finished first, the messages of a connection can not be
+ * interleaved in the stream.
+ */
+int Connection::Flush()
+{
+    struct iovec iov[2];
+
+    pthread_mutex_lock(&mutex_txq);
+    int lane = PRIORITIES - 1;
+    while(lane >= 0 && BQCount(&txq[lane]) == 0)
+        lane--;
+    if(lane < 0)
+    {
+        pthread_mutex_unlock(&mutex_txq);
+        return 0;
+    }
+    if(txstarted >= 0 && txstarted != lane)
+        lane = txstarted;
+    ByteQueue *queue = &txq[lane];
+    int count = BQCount(queue);
+    //write only up to the end of the started message when a higher lane waits for it
+    if(lane == txstarted && lane < PRIORITIES - 1 && Queued() > count)
+        count = txmessages[lane].front().length;
+    //everything that is queued is at most two parts of the ring, write them with a single call
+    int head = queue->end - queue->read;
+    iov[0].iov_base = queue->read;
+    iov[0].iov_len = (count < head) ? count : head;
+    iov[1].iov_base = queue->buffer;
+    iov[1].iov_len = count - iov[0].iov_len;
+    pthread_mutex_unlock(&mutex_txq);
+
+    //SendData only appends behind these bytes, so they are written without holding the lock
+    int n = writev(sockfds, iov, (iov[1].iov_len > 0) ? 2 : 1);
+    if(n<0)
+    {
+        if(errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+            return count;
+        printf("write error %d, %i is %s\n", n, errno, strerror(errno));
+        Lost();
+        return -1;
+    }
+
+    pthread_mutex_lock(&mutex_txq);
+    BQRemove(queue, n);
+    bytes_out += n;
+    bool partial = (txstarted == lane);
+    std::deque<TxMessage> & messages = txmessages[lane];
+    while(n > 0 && !messages.empty())
+    {
+        if(n >= messages.front().length)
+        {
+            n -= messages.front().length;
+            Sent(messages.front().queued);
+            messages.pop_front();
+            partial = false;
+        }
+        else
+        {
+            messages.front().length -= n;
+            n = 0;
+            partial = true;
+        }
+    }
+    txstarted = partial ? lane : -1;
+    count = Queued();
+    pthread_mutex_unlock(&mutex_txq);
+    return count;
+}
+
 bool IPC::StartServer(int port)
 {
     printf("Start Server @ port: %d\n", port);
@@ -283,33 +833,18 @@ bool IPC::StartServer(int port)
 
     printf("%d Listening on port %d\n",sockfd, port);
 
-    socklen_t clilen;
     //listening for connection
     listen(sockfd,10);
 
-    while(monitoring_thread_running)
+    if(reactor)
     {
-        struct sockaddr_in client;
-        clilen = sizeof(client);
-        int clientsockfd = accept(sockfd, (struct sockaddr *) &client, &clilen);
-
-        if (clientsockfd < 0) 
-        {
-            printf("ERROR on accept %d\n", clientsockfd);
-        }
-        else
-        {
-            printf("accept connection from %s:%d\n", inet_ntoa(client.sin_addr), ntohs(client.sin_port));
-            Connection *conn = new Connection;
-            conn->sockfds = clientsockfd;
-            conn->addr = client;
-            conn->ipc = this;
-            conn->connected = true;
-            conn->SetCallback(callback, user_data);
-            connections.push_back(conn);
-            conn->Start();
-        }
-
+        fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL, 0) | O_NONBLOCK);
+        React();
+    }
+    else
+    {
+        while(monitoring_thread_running)
+            Accept();
     }
 
     Close(sockfd);
@@ -317,47 +852,86 @@ bool IPC::StartServer(int port)
     return true;
 }
 
+bool IPC::Accept()
+{
+    struct sockaddr_in client;
+    socklen_t clilen = sizeof(client);
+    int clientsockfd = accept(sockfd, (struct sockaddr *) &client, &clilen);
+
+    if (clientsockfd < 0) 
+    {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            printf("ERROR on accept %d\n", clientsockfd);
+        return false;
+    }
+    printf("accept connection from %s:%d\n", inet_ntoa(client.sin_addr), ntohs(client.sin_port));
+    AddConnection(clientsockfd, client);
+    return true;
+}
+
+Connection * IPC::AddConnection(int fd, const sockaddr_in & addr)
+{
+    //a client only has the connection of its last Start, a server keeps the lost ones until it is restarted
+    bool again = !server && connects > 0;
+    for(unsigned int i=0; i< connections.size() && !again; i++)
+        if(connections[i] && !connections[i]->connected && connections[i]->addr.sin_addr.s_addr == addr.sin_addr.s_addr)
+            again = true;
+    connects++;
+    if(again)
+        reconnects++;
+    Tune(fd);
+    Connection *conn = new Connection;
+    conn->sockfds = fd;
+    conn->addr = addr;
+    conn->ipc = this;
+    conn->connected = true;
+    if(reactor)
+        conn->wakefd = wake[1];
+    conn->SetCallback(callback, user_data);
+    connections.push_back(conn);
+    conn->Start();
+    return conn;
+}
+
+/**
+ * The jockey may still be starting, so the first attempts follow each other quickly and the wait doubles up to
+ * IPCREDIALMAX, until IPCCONNECTTIMEOUT has passed.
+ */
 bool IPC::ConnectToServer(const char * host, int port)
 {
-    struct sockaddr_in serv_addr;
     struct hostent *server;
-    int err;
-    int num=0;
     server = gethostbyname(host);
 
     printf("Trying to connect to Server [%s:%d]\n", host, port);
 
-    int clientsockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (clientsockfd < 0) 
+    if (server == NULL)
     {
-        printf("ERROR opening socket, exit monitor thread\n");
+        printf("ERROR unknown host %s\n", host);
         return false;
     }
-    bzero((char *) &serv_addr, sizeof(serv_addr));
-    serv_addr.sin_family = AF_INET;
-    bcopy((char *)server->h_addr, (char *)&serv_addr.sin_addr.s_addr, server->h_length);
-    serv_addr.sin_port = htons(port);
-    err=connect(clientsockfd,(struct sockaddr *) &serv_addr,sizeof(serv_addr));
-    while (err<0 && num++<10) {
+    bzero((char *) &peer, sizeof(peer));
+    peer.sin_family = AF_INET;
+    bcopy((char *)server->h_addr, (char *)&peer.sin_addr.s_addr, server->h_length);
+    peer.sin_port = htons(port);
+
+    int delay = IPCREDIALMIN;
+    int waited = 0;
+    int clientsockfd = Dial();
+    while (clientsockfd < 0 && waited < IPCCONNECTTIMEOUT) {
        printf("ERROR connecting, %i = %s\n", errno, strerror(errno));
-       sleep(1);
-       err=connect(clientsockfd,(struct sockaddr *) &serv_addr,sizeof(serv_addr));
+       usleep(delay * 1000);
+       waited += delay;
+       delay = (delay * 2 < IPCREDIALMAX) ? delay * 2 : IPCREDIALMAX;
+       clientsockfd = Dial();
     }
-    if (err < 0) 
+    if (clientsockfd < 0) 
     {
         printf("ERROR connecting, abort %i is %s\n", errno, strerror(errno));
         return false;
     }
     printf("Success to connect to Server [%s:%d] @ %d\n", host, port, clientsockfd);
 
-    Connection *conn = new Connection;
-    conn->ipc = this;
-    conn->sockfds = clientsockfd;
-    conn->addr = serv_addr;
-    conn->connected = true;
-    conn->SetCallback(callback, user_data);
-    connections.push_back(conn);
-    conn->Start();
+    Connection *conn = AddConnection(clientsockfd, peer);
     conn->transmiting_thread_running = true;
     conn->receiving_thread_running = true;
 
@@ -378,46 +952,367 @@ bool IPC::ConnectToServer(const char * host, int port)
     return true;
 }
 
+int IPC::Dial()
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *) &peer, sizeof(peer)) < 0)
+    {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+bool IPC::Redial(Connection *conn, bool wait)
+{
+    long long now = Now();
+    if(redial_at == 0)
+    {
+        lost_at = now;
+        redial_at = now + redial_delay * 1000LL;
+    }
+    if(now < redial_at)
+    {
+        if(!wait)
+            return false;
+        usleep(redial_at - now);
+    }
+    int fd = Dial();
+    if(fd < 0)
+    {
+        redial_delay = (redial_delay * 2 < IPCREDIALMAX) ? redial_delay * 2 : IPCREDIALMAX;
+        redial_at = Now() + redial_delay * 1000LL;
+        return false;
+    }
+    printf("%s reconnected to %s:%d after %lld ms\n", name, inet_ntoa(peer.sin_addr), ntohs(peer.sin_port),
+            (Now() - lost_at) / 1000);
+    redial_delay = IPCREDIALMIN;
+    redial_at = 0;
+    reconnects++;
+    conn->Reset(fd);
+    return true;
+}
+
+//the loopback is faster than the compression
+static bool Remote(const sockaddr_in & addr)
+{
+    return (ntohl(addr.sin_addr.s_addr) >> 24) != 127;
+}
+
 bool Connection::SendData(const uint8_t type, uint8_t *data, int data_size)
 {
 //    printf("Send data [%i] of size %i to %s:%d\n", type, data_size, inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+    int compress = IPC::Compression();
+    if(compress > 0 && data_size >= compress && peer_inflates && Remote(addr))
+    {
+        pthread_mutex_lock(&mutex_deflate);
+        int deflated = Deflate(type, data, data_size);
+        pthread_mutex_unlock(&mutex_deflate);
+        if(deflated >= 0)
+            return deflated > 0;
+    }
+    uint8_t header[IPCHEADERSIZE];
+    uint8_t checksum = IPC::Checksum(data, data_size);
+    struct iovec iov[3];
+    iov[0].iov_base = header;
+    iov[0].iov_len = IPC::SerializeHeader(type, data_size, header, (compress > 0) ? IPCFLAGINFLATES : 0);
+    iov[1].iov_base = data;
+    iov[1].iov_len = data_size;
+    iov[2].iov_base = &checksum;
+    iov[2].iov_len = 1;
+    return SendVector(iov, 3, IPC::GetPriority(type));
+}
+
+/**
+ * A message is only sent compressed if that saves at least an eighth of it, a frame of noise or a JPEG costs a pass of
+ * the compressor but no time on the decompression of the peer. Called with mutex_deflate locked.
+ */
+int Connection::Deflate(const uint8_t type, const uint8_t *data, int data_size)
+{
+    int size = 4 + lzBound(data_size);
+    if(deflatesize < size)
+    {
+        delete [] deflatebuffer;
+        memFreed(IPCMemory(), deflatesize);
+        deflatebuffer = new uint8_t[size];
+        deflatesize = size;
+        memAllocated(IPCMemory(), deflatesize);
+    }
+    if(deflatetable == NULL)
+    {
+        deflatetable = new int32_t[LZ_HASH_SIZE];
+        memAllocated(IPCMemory(), LZ_HASH_SIZE * sizeof(int32_t));
+    }
+    int len = lzCompress(data, data_size, deflatebuffer + 4, data_size - data_size / 8 - 4, deflatetable);
+    if(len <= 0)
+        return -1;
+    for(int i = 0; i < 4; i++)
+        deflatebuffer[i] = (data_size >> (8 * i)) & 0xFF;
+    len += 4;
+    uint8_t header[IPCHEADERSIZE];
+    uint8_t checksum = IPC::Checksum(deflatebuffer, len);
+    struct iovec iov[3];
+    iov[0].iov_base = header;
+    iov[0].iov_len = IPC::SerializeHeader(type, len, header, IPCFLAGCOMPRESSED | IPCFLAGINFLATES);
+    iov[1].iov_base = deflatebuffer;
+    iov[1].iov_len = len;
+    iov[2].iov_base = &checksum;
+    iov[2].iov_len = 1;
+    return SendVector(iov, 3, IPC::GetPriority(type)) ? 1 : 0;
+}
+
+bool Connection::SendBytes(const uint8_t *buf, int len)
+{
+    struct iovec iov;
+    iov.iov_base = (void*)buf;
+    iov.iov_len = len;
+    //the command follows the start flag and the counter, see IPC::SerializeHeader
+    return SendVector(&iov, 1, (len >= IPCHEADERSIZE) ? IPC::GetPriority(buf[2]) : PRIORITY_BULK);
+}
+
+int Connection::Write(struct iovec *iov, int count, int len, bool wait)
+{
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    int written = 0;
+    while(written < len)
+    {
+        //skip the parts that are written already
+        while(count > 0 && iov->iov_len == 0)
+        {
+            iov++;
+            count--;
+        }
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+        int n = sendmsg(sockfds, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if(n < 0)
+        {
+            if(errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)
+                break;
+            if(!wait)
+                break;
+            struct pollfd fd;
+            fd.fd = sockfds;
+            fd.events = POLLOUT;
+            poll(&fd, 1, 100);
+            continue;
+        }
+        written += n;
+        bytes_out += n;
+        for(int i = 0; i < count && n > 0; i++)
+        {
+            int part = ((size_t)n < iov[i].iov_len) ? n : iov[i].iov_len;
+            iov[i].iov_base = (uint8_t*)iov[i].iov_base + part;
+            iov[i].iov_len -= part;
+            n -= part;
+        }
+        if(!wait)
+            break;
+    }
+    return written;
+}
+
+/**
+ * Small messages are copied into the queue and never block the caller, the transmiting thread or the reactor writes
+ * them. A big message that finds the queue empty is written from the caller with a single sendmsg of all its parts,
+ * so it is not copied at all. The part the socket does not take is queued, and only if that does not fit either the
+ * caller waits, because a message that is partly on the wire can not be dropped anymore. A message that is bigger than
+ * the queue always waits for the socket. A control message that does not fit in its lane goes with the bulk.
+ */
+bool Connection::SendVector(struct iovec *iov, int count, int priority)
+{
+    int len = 0;
+    for(int i = 0; i < count; i++)
+        len += iov[i].iov_len;
+    int lane = (priority > PRIORITY_BULK && len <= IPCCONTROLBUFFERSIZE) ? PRIORITY_CONTROL : PRIORITY_BULK;
+    ByteQueue *queue = &txq[lane];
+
+    long long start = Now();
+    pthread_mutex_lock(&mutex_txq);
+    int written = 0;
+    bool empty = (Queued() == 0);
+    if(connected && empty && len >= IPCBLOCKSIZE)
+    {
+        written = Write(iov, count, len, false);
+        int left = len - written;
+        if((written > 0 || len > (int)BQSize(queue)) && left > (int)BQSize(queue))
+            written += Write(iov, count, left, true);
+    }
+    bool queued = connected && (len - written) <= (int)(BQSize(queue) - BQCount(queue));
+    if(queued)
+        messages_out++;
+    if(queued && written == len)
+    {
+        //the socket took everything
+        Sent(start);
+    }
+    else if(queued)
+    {
+        for(int i = 0; i < count; i++)
+            if(iov[i].iov_len > 0)
+                BQPushBytes(queue, iov[i].iov_base, iov[i].iov_len);
+        TxMessage message;
+        message.length = len - written;
+        message.queued = start;
+        txmessages[lane].push_back(message);
+        if((uint32_t)Queued() > max_queued)
+            max_queued = Queued();
+        //the rest of a message that is partly on the wire goes first, whatever waits in the other lanes
+        if(written > 0)
+            txstarted = lane;
+        pthread_cond_signal(&cond_txq);
+        if(empty && wakefd >= 0)
+            write(wakefd, "", 1);
+    }
+    else if(connected && (dropped++ % 100) == 0)
+    {
+        printf("tx queue full (%i bytes pending), dropped %u messages to %s:%d\n", Queued(), dropped,
+                inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+    }
+    pthread_mutex_unlock(&mutex_txq);
+    return queued;
+}
+
+int IPC::SerializedSize(int data_size)
+{
+    ELolMessage msg;
+#ifdef IPC_TEST
+    ElolmsgInit(&msg, 0, 0, NULL, data_size);
+#else
+    ElolmsgInit(&msg, 0, NULL, data_size);
+#endif
+    return ElolmsgSerializedSize(&msg);
+}
+
+int IPC::Serialize(const uint8_t type, const uint8_t *data, int data_size, uint8_t *buf)
+{
     ELolMessage msg;
 #ifdef IPC_TEST
     ElolmsgInit(&msg, 0, type, data, data_size);
 #else
     ElolmsgInit(&msg, type, data, data_size);
 #endif
-    int len = ElolmsgSerializedSize(&msg);
-//    printf("Serialize msg into total size %i\n", len);
-    uint8_t buf[len];
-    ElolmsgSerialize(&msg, buf);
+    return ElolmsgSerialize(&msg, buf);
+}
 
-    /*
-     pthread_mutex_lock(&mutex_txq);
-    int write = BQSize(&txq) - BQCount(&txq);
-    if (len < write)
-        write = len;
-    BQPushBytes(&txq, buf, write);       
+int IPC::SerializeHeader(const uint8_t type, int data_size, uint8_t *buf, uint8_t flags)
+{
+    //the start flag, counter, command and length of ElolmsgSerialize with the checksum over them
+    buf[0] = 0x77;
+    buf[1] = flags;
+    buf[2] = type;
+    buf[3] = (data_size >> 24) & 0xFF;
+    buf[4] = (data_size >> 16) & 0xFF;
+    buf[5] = (data_size >> 8) & 0xFF;
+    buf[6] = data_size & 0xFF;
+    uint8_t checksum = CRC8_INIT;
+    for(int i = 0; i < IPCHEADERSIZE - 1; i++)
+        checksum = crc8_byte(checksum, buf[i]);
+    buf[IPCHEADERSIZE - 1] = checksum;
+    return IPCHEADERSIZE;
+}
 
-    pthread_mutex_unlock(&mutex_txq);
-    */
-    int n = write(sockfds, buf, len);
-    if(n<0) {
-       connected = false;
-       printf("write error %d, %i is %s\n", n, errno, strerror(errno));
+uint8_t IPC::Checksum(const uint8_t *data, int data_size)
+{
+    return Crc8Block(CRC8_INIT, data, data_size);
+}
+
+//lane per message type, zero is PRIORITY_BULK
+static uint8_t priorities[256];
+
+void IPC::SetPriority(const uint8_t type, int priority)
+{
+    priorities[type] = (priority < 0) ? 0 : (priority >= PRIORITIES) ? PRIORITIES - 1 : priority;
+}
+
+int IPC::GetPriority(const uint8_t type)
+{
+    return priorities[type];
+}
+
+//0 until they are set or read for the first time
+static int tx_buffer_size = 0;
+static int rx_buffer_size = 0;
+
+static void InitBufferSizes()
+{
+    if(tx_buffer_size > 0)
+        return;
+    int tx = IPCTXBUFFERSIZE, rx = IPCLOLBUFFERSIZE;
+    char *sizes = getenv("IPC_BUFFERS");
+    if(sizes != NULL)
+        sscanf(sizes, "%d,%d", &tx, &rx);
+    IPC::SetBufferSizes(tx, rx);
+}
+
+void IPC::SetBufferSizes(int tx, int rx)
+{
+    //the queue holds at least a control message, a message can hold at least its header
+    tx_buffer_size = (tx < IPCCONTROLBUFFERSIZE) ? IPCCONTROLBUFFERSIZE : tx;
+    rx_buffer_size = (rx < IPCHEADERSIZE + 1) ? IPCHEADERSIZE + 1 : rx;
+}
+
+int IPC::TxBufferSize()
+{
+    InitBufferSizes();
+    return tx_buffer_size;
+}
+
+int IPC::RxBufferSize()
+{
+    InitBufferSizes();
+    return rx_buffer_size;
+}
+
+//-1 until it is set or read for the first time
+static int compress_min = -1;
+
+void IPC::SetCompression(int min)
+{
+    //a block smaller than the lengths and offsets it needs does not get smaller anyway
+    compress_min = (min <= 0) ? 0 : (min < 64) ? 64 : min;
+}
+
+int IPC::Compression()
+{
+    if(compress_min < 0)
+    {
+        char *min = getenv("IPC_COMPRESS");
+        SetCompression((min != NULL) ? atoi(min) : IPCCOMPRESSMIN);
+    }
+    return compress_min;
+}
+
+bool IPC::SendSerialized(const uint8_t *bytes, int size, const uint8_t type, uint8_t *data, int data_size)
+{
+    bool ret = true;
+    for(unsigned int i=0; i< connections.size(); i++)
+    {
+        if(connections[i] && connections[i]->connected)
+            ret = connections[i]->SendBytes(bytes, size) && ret;
     }
-    return n == len;
+    if(shared)
+        ret = shared->SendData(type, data, data_size) && ret;
+    return ret;
 }
 
 bool IPC::SendData(const uint8_t type, uint8_t *data, int data_size)
 {
 	if (data_size > 0) assert (data != NULL);
+    bool ret = true;
     for(unsigned int i=0; i< connections.size(); i++)
     {
         if(connections[i] && connections[i]->connected)
-            connections[i]->SendData(type, data, data_size);
+            ret = connections[i]->SendData(type, data, data_size) && ret;
     }
-    return true;
+    if(shared)
+        ret = shared->SendData(type, data, data_size) && ret;
+    return ret;
 }
 
 bool IPC::SendData(const uint32_t dest, const uint8_t type, uint8_t * data, int data_size)
@@ -470,9 +1365,49 @@ int IPC::BrokenConnections()
     return count;
 }
 
+int IPC::Stats(std::vector<ConnectionStats> &stats)
+{
+    int count = 0;
+    ConnectionStats entry;
+    for(unsigned int i=0; i< connections.size(); i++)
+    {
+        if(!connections[i])
+            continue;
+        connections[i]->Stats(entry);
+        stats.push_back(entry);
+        count++;
+    }
+    if(shared)
+    {
+        shared->Stats(entry);
+        entry.port = port;
+        stats.push_back(entry);
+        count++;
+    }
+    return count;
+}
+
+bool IPC::CreateShared(int port)
+{
+    SharedChannel *channel = new SharedChannel;
+    if(!channel->Create(port))
+    {
+        delete channel;
+        return false;
+    }
+    delete shared;
+    shared = channel;
+    return true;
+}
+
 void IPC::Stop()
 {
     monitoring_thread_running = false;
+    dialing = false;
+    if(shared)
+        shared->Stop();
+    if(wake[1] >= 0)
+        write(wake[1], "", 1); //the reactor returns from poll and quits
     if(sockfd >=0)
     {
         Shutdown(sockfd, 2); //this will stops all connections, so monitor thread will quit
@@ -17,18 +17,74 @@
 #include <unistd.h>
 #include <sstream>
 #include <vector>
+#include <deque>
+#include <poll.h>
 #include "ethlolmsg.h"
 #include "bytequeue.h"
 
+//default sizes of the receive buffer, the longest message that can be received, and of the transmit queue of every
+//connection, they can be set with -D, or while running with IPC::SetBufferSizes or IPC_BUFFERS=tx,rx in the environment
+#ifndef IPCLOLBUFFERSIZE
 #define IPCLOLBUFFERSIZE 65535 
+#endif
+#ifndef IPCTXBUFFERSIZE
 #define IPCTXBUFFERSIZE 65535 
+#endif
+//queue of the control lane, control messages are small
+#define IPCCONTROLBUFFERSIZE 4096
 #define IPCBLOCKSIZE 10240 
+//bytes in front of the payload of a variable message, see IPC::SerializeHeader
+#define IPCHEADERSIZE 8
+//flags in the counter byte of the header of a variable message, which is 0 from an old peer and ignored by it
+//the payload is compressed, see lzcodec.h, its first 4 bytes are the size of the message, little-endian
+#define IPCFLAGCOMPRESSED 0x01
+//the sender takes compressed messages, a connection only compresses for a peer that sent this flag
+#define IPCFLAGINFLATES 0x02
+//payloads from this size on are compressed for a remote peer, it can be set with -D, or while running with
+//IPC::SetCompression or IPC_COMPRESS=size in the environment, 0 switches compression off in both directions
+#ifndef IPCCOMPRESSMIN
+#define IPCCOMPRESSMIN 1024
+#endif
+//a client dials again after this many milliseconds, the wait doubles after every failure up to IPCREDIALMAX
+#define IPCREDIALMIN 10
+#define IPCREDIALMAX 1000
+//ConnectToServer gives up after this many milliseconds
+#define IPCCONNECTTIMEOUT 10000
+//a silent peer is probed after this many seconds, it is lost when IPCKEEPALIVECOUNT probes a second apart fail
+#define IPCKEEPALIVEIDLE 2
+#define IPCKEEPALIVECOUNT 3
 
 namespace IPC{
 
+//lanes of the transmit queue, a lane is only written when every higher one is empty, see IPC::SetPriority
+enum Priority {PRIORITY_BULK = 0, PRIORITY_CONTROL, PRIORITIES};
+
 class Connection;
+class SharedChannel;
 typedef void (*Callback)(const ELolMessage *msg, void * connection, void * user_ptr);
 
+//counters of a connection since it was created, see IPC::Stats
+struct ConnectionStats
+{
+    uint32_t address; //network byte order, 0 for the shared memory channel
+    uint16_t port;
+    bool shared;
+    bool connected;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint32_t messages_in;
+    uint32_t messages_out;
+    //messages that did not fit in the queue
+    uint32_t dropped;
+    //messages received with a wrong checksum or a length beyond the receive buffer
+    uint32_t parse_errors;
+    uint32_t queued_bytes;
+    uint32_t queued_messages;
+    uint32_t max_queued_bytes;
+    //longest time in microseconds from SendData until the last byte of a message was written
+    uint32_t max_send_latency;
+};
+
 class Connection
 {
     public:
@@ -37,7 +93,18 @@ class Connection
         inline void SetCallback(Callback c, void * u) {callback = c; user_data = u;}
         bool connected;
 
+        //queue the message for the transmiting thread, false if it does not fit in the queue
         bool SendData(const uint8_t type, uint8_t *data, int len);
+        //queue a message that is serialized already, see IPC::Serialize
+        bool SendBytes(const uint8_t *buf, int len);
+        //queue the parts of a message as one in the lane of the priority, big messages are written directly when nothing is queued
+        bool SendVector(struct iovec *iov, int count, int priority = PRIORITY_BULK);
+        //bytes queued but not yet written to the socket
+        int Pending();
+        //messages that did not fit in the queue since the connection was created
+        inline unsigned int Dropped() {return dropped;}
+        //a copy of the counters, the queue is locked only to read its depth
+        void Stats(ConnectionStats &stats);
         bool Start();
         void Disconnect();
         
@@ -49,16 +116,79 @@ class Connection
         bool receiving_thread_running;
 
     private:
+        friend class IPC;
         pthread_t receiving_thread;
         pthread_t transmiting_thread;
         static void * Receiving(void *ptr);
         static void * Transmiting(void *ptr);
+        //read once and dispatch every complete message, false if the connection is lost
+        bool Receive(uint8_t *rx_buffer);
+        //feed received bytes to the parse context, returns how many are used
+        int Parse(uint8_t *bytes, int len);
+        //write as much of the queue as the socket takes, returns the bytes still queued or -1 on error
+        int Flush();
+        //write the parts from the calling thread, without blocking when wait is false, returns the bytes written
+        int Write(struct iovec *iov, int count, int len, bool wait);
+        //the socket can not be used anymore, the connection of a client that reconnects is dialed again if redial is set
+        void Lost(bool redial = true);
+        //dial until the connection is back, false if its IPC stopped reconnecting, called by the receiving thread
+        bool Redial();
+        //continue on a new socket, what was queued for the lost one is dropped, called by the receiving side
+        void Reset(int fd);
+        //bytes queued in all lanes, called with mutex_txq locked
+        int Queued();
+        //a message that is completely written, called with mutex_txq locked
+        void Sent(long long queued);
+        //send the message compressed, 1 if it is queued, 0 if it is dropped, -1 if it does not get smaller
+        int Deflate(const uint8_t type, const uint8_t *data, int data_size);
+        //decompress a message that arrived compressed, false if it is corrupt
+        bool Inflate(const ELolMessage *msg, ELolMessage &inflated);
         ELolParseContext parseContext;
         Callback callback;
         void * user_data;
-        ByteQueue txq;
-        uint8_t txbuffer[IPCTXBUFFERSIZE];
+        ByteQueue txq[PRIORITIES];
+        //IPC::TxBufferSize bytes, allocated with the connection
+        uint8_t *txbuffer;
+        int txbuffersize;
+        uint8_t controlbuffer[IPCCONTROLBUFFERSIZE];
+        struct TxMessage
+        {
+            //bytes of the message that are not written yet
+            int length;
+            //when SendVector got it, for the send latency
+            long long queued;
+        };
+        //the queued messages per lane, the lanes may only switch between messages
+        std::deque<TxMessage> txmessages[PRIORITIES];
+        //lane of which the first message is partly written, -1 if none
+        int txstarted;
         pthread_mutex_t mutex_txq;
+        pthread_cond_t cond_txq;
+        bool transmiting_thread_started;
+        //lost but dialed again, the transmiting thread waits for the new socket instead of quitting
+        bool redialing;
+        unsigned int dropped;
+        //written with mutex_txq locked
+        uint64_t bytes_out;
+        uint32_t messages_out;
+        uint32_t max_queued;
+        uint32_t max_latency;
+        //written by the receiving thread or the reactor only
+        uint64_t bytes_in;
+        uint32_t messages_in;
+        uint32_t parse_errors;
+        //write end of the pipe that wakes up the reactor of the IPC, -1 if the connection has its own threads
+        int wakefd;
+        //the peer sent IPCFLAGINFLATES, written by the receiving thread or the reactor only
+        bool peer_inflates;
+        //the buffers of the compression, allocated with the first compressed message and kept for the next ones,
+        //the ones for sending are shared by the threads that send under mutex_deflate
+        pthread_mutex_t mutex_deflate;
+        uint8_t *deflatebuffer;
+        int deflatesize;
+        int32_t *deflatetable;
+        uint8_t *inflatebuffer;
+        int inflatesize;
 
 };
 
@@ -74,8 +204,38 @@ class IPC
         inline bool Running() {return monitoring_thread_running;}
         bool SendData(const uint8_t type, uint8_t *data, int len);
         bool SendData(const uint32_t dest, const uint8_t type, uint8_t * data, int len);
+        //serialize a message once to send it to several IPCs with SendSerialized, buf holds SerializedSize(len) bytes
+        static int SerializedSize(int len);
+        static int Serialize(const uint8_t type, const uint8_t *data, int len, uint8_t *buf);
+        //the IPCHEADERSIZE bytes in front of the payload and the checksum behind it, the payload is not copied
+        static int SerializeHeader(const uint8_t type, int len, uint8_t *buf, uint8_t flags = 0);
+        static uint8_t Checksum(const uint8_t *data, int len);
+        //lane of the messages of a type on every connection, PRIORITY_BULK by default
+        static void SetPriority(const uint8_t type, int priority);
+        static int GetPriority(const uint8_t type);
+        //bytes of the transmit queue and of the receive buffer of the connections made after the call, see IPCTXBUFFERSIZE
+        static void SetBufferSizes(int tx, int rx);
+        static int TxBufferSize();
+        static int RxBufferSize();
+        //smallest payload that is compressed on the connections to a remote peer that takes it, 0 for none
+        static void SetCompression(int min);
+        static int Compression();
+        //send serialized bytes over TCP, the shared memory channel takes the message itself
+        bool SendSerialized(const uint8_t *bytes, int size, const uint8_t type, uint8_t *data, int len);
         int BrokenConnections();
+        //the counters of every connection and of the shared memory channel, returns how many are added to stats
+        int Stats(std::vector<ConnectionStats> &stats);
+        //connections that were made again after the one to the same peer was lost
+        inline unsigned int Reconnects() {return reconnects;}
         inline void SetCallback(Callback c, void * u) {callback = c; user_data = u;}
+        //a client dials again when its connection is lost, with the threads and the queue of the connection it had
+        inline void SetReconnect(bool r) {reconnect = r;}
+        //serve the listening socket and all connections from a single thread with poll, set before Start
+        inline void SetReactor(bool r) {reactor = r;}
+        inline bool Reactor() {return reactor;}
+        //use shared memory instead of TCP for the jockey on this port, call before the jockey is started and before Start
+        bool CreateShared(int port);
+        inline bool Shared() {return shared != NULL;}
         inline bool Server(){return server;}
         std::vector<Connection*> *Connections(){ return &connections;}
 
@@ -83,12 +243,22 @@ class IPC
         const char * Name(){return name;};
 
     private:
+        friend class Connection;
         char * name;
 
         static void * Monitoring(void *ptr);
         static void * Listening(void *ptr);
+        static void * Reacting(void *ptr);
         bool StartServer(int port);
+        void React();
+        bool Accept();
+        Connection * AddConnection(int fd, const sockaddr_in & addr);
         bool ConnectToServer(const char * host, int port);
+        //a single attempt to connect to peer, returns the socket or -1
+        int Dial();
+        //dial again for the lost connection of a client when it is time, wait sleeps until then, true if it is back
+        bool Redial(Connection *conn, bool wait);
+        inline bool Redials() {return !server && reconnect && dialing;}
         int RemoveBrokenConnections();
 
         int sockfd;
@@ -99,6 +269,19 @@ class IPC
         pthread_t listening_thread;
         std::vector<Connection*> connections;
         bool monitoring_thread_running;
+        bool reactor;
+        int wake[2];
+        SharedChannel *shared;
+        unsigned int connects;
+        unsigned int reconnects;
+        //set by SetReconnect, dialing is cleared by Stop
+        bool reconnect;
+        bool dialing;
+        sockaddr_in peer;
+        //milliseconds before the next attempt and when it is due, 0 if none is scheduled
+        int redial_delay;
+        long long redial_at;
+        long long lost_at;
         
         Callback callback;
         void * user_data;
@@ -0,0 +1,172 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Fast block compression of the bulk messages of the IPC
+ * @file lzcodec.h
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#ifndef LZCODEC_H_
+#define LZCODEC_H_
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * A block is a series of sequences in the layout of LZ4: a token with the number of literals in its high nibble and the
+ * length of the match minus LZ_MIN_MATCH in its low nibble, a nibble of 15 continues in bytes that are added up to the
+ * first one below 255, then the literals, then the offset of the match backwards as 16 bits little-endian. The last
+ * sequence has only literals. The compressor finds matches with a hash table of the positions of 4-byte sequences and
+ * takes the first one that it finds, so it is a single pass over the input without any search, which makes it cheap
+ * enough for the Blackfin. The maps, scans and raw frames it is meant for are mostly runs and repeated rows.
+ *
+ * The decompressor checks every length and offset against the input and the output, a corrupt block is refused instead
+ * of read or written beyond them. This file is shared as-is with the visualiser (common/lzcodec.h).
+ */
+
+#define LZ_MIN_MATCH 4
+//! Matches can not start in the last bytes, which are always literals, so a match never reads beyond the input
+#define LZ_LAST_LITERALS 5
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 12
+#define LZ_HASH_SIZE (1 << LZ_HASH_BITS)
+//! After every 2^LZ_SKIP_SHIFT bytes without a match the compressor steps a byte further, data that does not compress
+//! is passed quickly
+#define LZ_SKIP_SHIFT 6
+
+//! The most a block of len bytes can grow, for a buffer that always holds the block
+static inline int lzBound(int len) {
+	return len + len / 255 + 16;
+}
+
+static inline uint32_t lzRead32(const uint8_t *p) {
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline uint32_t lzHash(uint32_t sequence) {
+	return (sequence * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+//! Write a length that does not fit in its nibble, returns the position after it
+static inline uint8_t *lzPutLength(uint8_t *op, int length) {
+	while (length >= 255) {
+		*op++ = 255;
+		length -= 255;
+	}
+	*op++ = (uint8_t) length;
+	return op;
+}
+
+/**
+ * Compress len bytes of src into dst, with table a scratch of LZ_HASH_SIZE entries that is kept by the caller so it is
+ * not on the stack. Returns the size of the block, or 0 if it does not fit in capacity, so a caller that gives a
+ * capacity below len only gets a block that is smaller than the input.
+ */
+static inline int lzCompress(const uint8_t *src, int len, uint8_t *dst, int capacity, int32_t *table) {
+	const uint8_t *ip = src, *anchor = src, *end = src + len;
+	const uint8_t *limit = end - LZ_LAST_LITERALS;
+	uint8_t *op = dst, *oend = dst + capacity;
+	for (int i = 0; i < LZ_HASH_SIZE; ++i) table[i] = -1;
+	while (len > LZ_LAST_LITERALS && ip + LZ_MIN_MATCH <= limit) {
+		uint32_t sequence = lzRead32(ip);
+		uint32_t h = lzHash(sequence);
+		int32_t ref = table[h];
+		table[h] = (int32_t) (ip - src);
+		if (ref < 0 || (ip - src) - ref > LZ_MAX_OFFSET || lzRead32(src + ref) != sequence) {
+			ip += 1 + ((ip - anchor) >> LZ_SKIP_SHIFT);
+			continue;
+		}
+		const uint8_t *match = src + ref;
+		int length = LZ_MIN_MATCH;
+		while (ip + length < limit && ip[length] == match[length]) length++;
+		int literals = ip - anchor;
+		// the token, the lengths beyond their nibble, the literals and the offset
+		if (oend - op < 1 + literals / 255 + 1 + literals + 2 + length / 255 + 1) return 0;
+		uint8_t *token = op++;
+		*token = (uint8_t) (((literals < 15) ? literals : 15) << 4);
+		if (literals >= 15) op = lzPutLength(op, literals - 15);
+		memcpy(op, anchor, literals);
+		op += literals;
+		int offset = ip - match;
+		*op++ = (uint8_t) (offset & 0xFF);
+		*op++ = (uint8_t) (offset >> 8);
+		int rest = length - LZ_MIN_MATCH;
+		*token |= (uint8_t) ((rest < 15) ? rest : 15);
+		if (rest >= 15) op = lzPutLength(op, rest - 15);
+		ip += length;
+		anchor = ip;
+	}
+	int literals = end - anchor;
+	if (oend - op < 1 + literals / 255 + 1 + literals) return 0;
+	*op++ = (uint8_t) (((literals < 15) ? literals : 15) << 4);
+	if (literals >= 15) op = lzPutLength(op, literals - 15);
+	memcpy(op, anchor, literals);
+	op += literals;
+	return op - dst;
+}
+
+//! Read a length that continues beyond its nibble, false if the block ends within it
+static inline bool lzGetLength(const uint8_t *& ip, const uint8_t *iend, int & length) {
+	int byte;
+	do {
+		if (ip >= iend) return false;
+		byte = *ip++;
+		length += byte;
+	} while (byte == 255);
+	return true;
+}
+
+//! Decompress a block of len bytes into dst, returns the size of the output or -1 if the block is corrupt or too big
+static inline int lzDecompress(const uint8_t *src, int len, uint8_t *dst, int capacity) {
+	const uint8_t *ip = src, *iend = src + len;
+	uint8_t *op = dst, *oend = dst + capacity;
+	while (ip < iend) {
+		int token = *ip++;
+		int literals = token >> 4;
+		if (literals == 15 && !lzGetLength(ip, iend, literals)) return -1;
+		if (literals > iend - ip || literals > oend - op) return -1;
+		memcpy(op, ip, literals);
+		op += literals;
+		ip += literals;
+		if (ip == iend) break;
+		if (iend - ip < 2) return -1;
+		int offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > op - dst) return -1;
+		int length = token & 15;
+		if (length == 15 && !lzGetLength(ip, iend, length)) return -1;
+		length += LZ_MIN_MATCH;
+		if (length > oend - op) return -1;
+		const uint8_t *match = op - offset;
+		if (offset >= length) {
+			memcpy(op, match, length);
+			op += length;
+		} else {
+			// the match overlaps the output, a run repeats the last offset bytes
+			for (int i = 0; i < length; ++i) *op++ = *match++;
+		}
+	}
+	return op - dst;
+}
+
+#endif /* LZCODEC_H_ */
@@ -1,6 +1,7 @@
 #ifndef __MESSAGEDATATYPE_H__
 #define __MESSAGEDATATYPE_H__
 #include <stdint.h>
+#include <string.h>
 #define MAX_DOCKING_PATTERNS 2
 
 struct DetectedBlob {
@@ -31,11 +32,13 @@ typedef enum {
 struct DetectedBlobWSize {
 	uint8_t size;
 	DetectedBlob detectedBlob;
+	uint64_t timestamp; //!< Time at which the frame was captured, in microseconds, 0 if unknown
 };
 
 struct DetectedBlobWSizeArray {
 	uint8_t size;
 	DetectedBlob detectedBlobArray[MAX_DOCKING_PATTERNS];
+	uint64_t timestamp; //!< Time at which the frame was captured, in microseconds, 0 if unknown
 };
 
 struct MotorCalibResult { //same meaning as for motors
@@ -45,6 +48,34 @@ struct MotorCalibResult { //same meaning as for motors
 	int calibratedSpeed;
 };
 
+//! How the coefficients of a MotorCalibReport were obtained
+enum MotorCalibMethod {
+	CALIB_ONLINE = 0, //!< The stops of CMotorsCalib
+	CALIB_FIT, //!< The least squares fit of COdometryFit
+	CALIB_STORED //!< Read from the calibration file of an earlier run
+};
+
+/**
+ * MSG_MOTOR_CALIBRATION_REPORT, a calibration and the test drive with it. The landmark seen during the test drive is
+ * put into the world by the odometry, with a perfect odometry it stays where it is. Distances in m, angles in rad.
+ */
+struct MotorCalibReport {
+	int robot; //!< sr_id of the robot, -1 if unknown
+	int robot_type; //!< A RobotBase::RobotType
+	int method; //!< A MotorCalibMethod
+	MotorCalibResult result;
+	float fit_residual; //!< Of COdometryFit::getResidual(), 0 for the other methods
+	int observations; //!< Measurements of the landmark during the test drive
+	float residual; //!< Root mean square distance of the landmark in the world from its mean
+	float max_residual;
+	float angle_residual; //!< Root mean square of the angle of the landmark in the world around its mean
+	float distance; //!< Driven in the test drive
+	float rotation; //!< Turned in the test drive
+	float drift; //!< How far the landmark moved in the world from the start to the end of the test drive, per m driven
+	float angle_drift; //!< How far the landmark turned in the world, per rad turned
+	uint64_t timestamp; //!< End of the test drive in microseconds
+};
+
 struct UbiPosition {
 	float x; //!< The x coordinate
 	float y; //!< The y coordinate
@@ -89,6 +120,7 @@ struct MappedObjectPosition {
 	float yUncertainty; //!< The y coordinate Uncertainty
 	float zUncertainty; //!< The z coordinate Uncertainty
 	float phiUncertainty; //!< The phi coordinate Uncertainty
+	uint64_t timestamp; //!< Time at which the object was measured, in microseconds, 0 for an object of a map
 };
 
 struct NearestObjectOfTypeToThisPosition{
@@ -133,6 +165,174 @@ struct RemoteControlData {
 	RemoteRobotAction action;
 };
 
+//! Number of stages in PipelineStats: capture, convert, detect, transform, and send (see CStageStats.h)
+#define STATS_PIPELINE_STAGES 5
+
+//! Latencies of a pipeline stage in microseconds
+struct StageLatency {
+	int32_t count;
+	int32_t p50;
+	int32_t p95;
+	int32_t p99;
+	int32_t max;
+};
+
+//! Reply to MSG_STATS_REQ, all zero if the statistics are disabled
+struct PipelineStats {
+	uint8_t enabled;
+	int32_t frames; //!< Frames that went through the entire pipeline
+	int32_t dropped; //!< Frames that were captured but never processed, or could not be captured
+	StageLatency stages[STATS_PIPELINE_STAGES];
+} __attribute__((packed));
+
+//! Maximum number of detections in one MSG_CAM_DETECTED_BATCH
+#define MAX_BATCH_DETECTIONS 32
+
+//! The arrays of a DetectionBatch, in the order in which they follow the header in the message
+enum DetectionBatchField {
+	BATCH_X = 0,
+	BATCH_Y,
+	BATCH_Z,
+	BATCH_PHI,
+	BATCH_SIZE, //!< Area of the pattern in pixels
+	BATCH_CONFIDENCE, //!< From 0 to 1, how circular the pattern is within the tolerance of the detector
+	BATCH_FIELDS
+};
+
+//! Header of MSG_CAM_DETECTED_BATCH, it is followed by BATCH_FIELDS arrays of count floats
+struct DetectionBatchHeader {
+	uint64_t timestamp; //!< Time at which the frame was captured, in microseconds
+	uint32_t frame; //!< Number of the frame, counted by the sender
+	uint16_t count;
+	uint16_t reserved;
+} __attribute__((packed));
+
+//! All detections in a frame as struct of arrays, only the first count items of every array are sent
+struct DetectionBatch {
+	DetectionBatchHeader header;
+	float field[BATCH_FIELDS][MAX_BATCH_DETECTIONS];
+};
+
+//! Length of a MSG_CAM_DETECTED_BATCH with count detections
+static inline int detectionBatchLength(int count) {
+	return sizeof(DetectionBatchHeader) + BATCH_FIELDS * count * sizeof(float);
+}
+
+//! Write the batch into buffer in the layout of the message, returns the length of the message
+static inline int packDetectionBatch(const DetectionBatch & batch, uint8_t *buffer) {
+	int count = batch.header.count;
+	memcpy(buffer, &batch.header, sizeof(DetectionBatchHeader));
+	uint8_t *array = buffer + sizeof(DetectionBatchHeader);
+	for (int f = 0; f < BATCH_FIELDS; f++, array += count * sizeof(float))
+		memcpy(array, batch.field[f], count * sizeof(float));
+	return detectionBatchLength(count);
+}
+
+//! Read a MSG_CAM_DETECTED_BATCH, false if its length does not match the count in its header
+static inline bool unpackDetectionBatch(const uint8_t *buffer, int len, DetectionBatch & batch) {
+	if (len < (int) sizeof(DetectionBatchHeader)) return false;
+	memcpy(&batch.header, buffer, sizeof(DetectionBatchHeader));
+	int count = batch.header.count;
+	if (count > MAX_BATCH_DETECTIONS || len != detectionBatchLength(count)) return false;
+	const uint8_t *array = buffer + sizeof(DetectionBatchHeader);
+	for (int f = 0; f < BATCH_FIELDS; f++, array += count * sizeof(float))
+		memcpy(batch.field[f], array, count * sizeof(float));
+	return true;
+}
+
+//! Reply to MSG_LASER_ODOMETRY_REQ, the motion between the last two laser scans
+struct LaserOdometry {
+	uint64_t timestamp; //!< Time at which the last scan was captured, in microseconds
+	uint32_t scan; //!< Number of the scan since the odometry was enabled
+	float forward; //!< Motion towards the surface in front of the laser since the previous scan, in cm
+	float total; //!< Sum of all valid forward motions since the odometry was enabled, in cm
+	float residual; //!< Mean absolute difference of the matched rows after the correction, in cm
+	uint16_t matches; //!< Number of rows the estimate is based on, 0 if forward is not valid
+	uint16_t reserved;
+} __attribute__((packed));
+
+//! Maximum number of rows of the laser vector in a MSG_LASER_SCAN
+#define MAX_LASER_SCAN_ROWS 640
+
+//! A delta that does not fit in a byte is sent as this byte followed by the column as int16
+#define LASER_SCAN_ESCAPE -128
+
+//! Header of MSG_LASER_SCAN, it is followed by the column of every row, each as the difference with the row before
+struct LaserScanHeader {
+	uint64_t timestamp; //!< Time at which the scan was captured, in microseconds
+	uint32_t scan; //!< Number of the scan, counted by the sender
+	int32_t object; //!< Last object type recognized by the laser scan, a vocab such as 'wall' or 'step'
+	int16_t distance; //!< Distance in cm, -1 if too noisy, 255 if nothing is seen
+	uint16_t rows;
+	float robustness; //!< Fraction of the rows within the limits that see the laser
+} __attribute__((packed));
+
+//! Upper bound of the length of a MSG_LASER_SCAN with the given number of rows
+static inline int laserScanMaxLength(int rows) {
+	return sizeof(LaserScanHeader) + 3 * rows;
+}
+
+/**
+ * Write the header and the columns into buffer in the layout of the message, returns the length of the message. The
+ * laser line is mostly continuous, so almost every row takes a single byte.
+ */
+static inline int packLaserScan(const LaserScanHeader & header, const int16_t *columns, uint8_t *buffer) {
+	memcpy(buffer, &header, sizeof(LaserScanHeader));
+	int len = sizeof(LaserScanHeader);
+	int16_t previous = 0;
+	for (int i = 0; i < header.rows; i++) {
+		int delta = columns[i] - previous;
+		if (delta > LASER_SCAN_ESCAPE && delta <= 127) {
+			buffer[len++] = (uint8_t)(int8_t)delta;
+		} else {
+			buffer[len++] = (uint8_t)(int8_t)LASER_SCAN_ESCAPE;
+			memcpy(buffer + len, &columns[i], sizeof(int16_t));
+			len += sizeof(int16_t);
+		}
+		previous = columns[i];
+	}
+	return len;
+}
+
+//! Read a MSG_LASER_SCAN, false if the vector is too long or its length does not match the number of rows
+static inline bool unpackLaserScan(const uint8_t *buffer, int len, LaserScanHeader & header, int16_t *columns) {
+	if (len < (int) sizeof(LaserScanHeader)) return false;
+	memcpy(&header, buffer, sizeof(LaserScanHeader));
+	if (header.rows > MAX_LASER_SCAN_ROWS) return false;
+	int pos = sizeof(LaserScanHeader);
+	int16_t previous = 0;
+	for (int i = 0; i < header.rows; i++) {
+		if (pos >= len) return false;
+		int8_t delta = (int8_t)buffer[pos++];
+		if (delta == LASER_SCAN_ESCAPE) {
+			if (pos + (int) sizeof(int16_t) > len) return false;
+			memcpy(&columns[i], buffer + pos, sizeof(int16_t));
+			pos += sizeof(int16_t);
+		} else {
+			columns[i] = previous + delta;
+		}
+		previous = columns[i];
+	}
+	return pos == len;
+}
+
+//! Payload of MSG_FUSION_OBJECT, one per detection of the camera frame that is paired with a laser scan
+struct FusionObject {
+	uint64_t timestamp; //!< Time at which the laser scan was captured, in microseconds
+	uint32_t scan; //!< Number of the laser scan, as in its LaserScanHeader
+	uint32_t frame; //!< Number of the camera frame, as in its DetectionBatchHeader
+	int32_t skew; //!< Capture time of the frame minus that of the scan, in microseconds
+	int16_t detection; //!< Index of the detection in the frame, -1 if the frame has none
+	int16_t distance; //!< Distance of the laser scan in cm, as in its LaserScanHeader
+	int16_t laserClass; //!< Category of the laser network, -1 if there is none
+	int16_t blobClass; //!< Category of the blob network, -1 if there is none
+	int16_t rewardClass; //!< Category of the reward network, -1 if there is none
+	uint8_t isObject; //!< 1 if the reward category marks an object
+	uint8_t reserved;
+	float x, y, z, phi; //!< Position of the detection, as in the batch, 0 without a detection
+	float confidence; //!< Of the detection, as in the batch, 0 without a detection
+} __attribute__((packed));
+
 union IP_rob {
     unsigned int ip;
     struct {
@@ -0,0 +1,752 @@
+/*
+ * File name: messageSchema.h
+ * Date:      2013/10/14
+ * Author:    Anne C. van Rossum
+ *
+ * Wire layouts of the payloads that travel between robots, which may run different firmware. The structs of
+ * messageDataType.h are copied with memcpy, so their padding and the size of their enums depend on the compiler. The
+ * layouts here are packed, little endian and start with a version byte. A view reads the fields in place from the
+ * received buffer, without copying the message into a struct first.
+ *
+ * A new version of a layout only appends fields and increments VERSION. A reader accepts every version from its own
+ * on, as long as the message is long enough for the fields it knows.
+ */
+
+#ifndef __MESSAGESCHEMA_H__
+#define __MESSAGESCHEMA_H__
+
+#include "messageDataType.h"
+
+//! A field of a wire layout, stored little endian whatever the byte order of the robot
+template <typename T>
+struct le {
+	uint8_t bytes[sizeof(T)];
+
+	operator T() const {
+		T value;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		uint8_t *p = (uint8_t*)&value;
+		for (unsigned int i = 0; i < sizeof(T); i++) p[i] = bytes[sizeof(T) - 1 - i];
+#else
+		memcpy(&value, bytes, sizeof(T));
+#endif
+		return value;
+	}
+
+	le & operator=(T value) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		const uint8_t *p = (const uint8_t*)&value;
+		for (unsigned int i = 0; i < sizeof(T); i++) bytes[i] = p[sizeof(T) - 1 - i];
+#else
+		memcpy(bytes, &value, sizeof(T));
+#endif
+		return *this;
+	}
+} __attribute__((packed));
+
+//! The layout of a payload in place, NULL if it is too short or older than the layout that is compiled in
+template <typename W>
+static inline const W *wireView(const uint8_t *data, int len) {
+	if (data == NULL || len < (int) sizeof(W)) return NULL;
+	const W *view = (const W*) data;
+	if (view->version < W::VERSION) return NULL;
+	return view;
+}
+
+//! MSG_MAP_DATA
+struct MappedObjectPositionWire {
+	enum { VERSION = 2 };
+	uint8_t version;
+	le<int32_t> mappedBy;
+	le<int32_t> type; //!< A MapObjectType
+	le<int32_t> map_id;
+	le<float> xPosition;
+	le<float> yPosition;
+	le<float> zPosition;
+	le<float> phiPosition;
+	le<float> xUncertainty;
+	le<float> yUncertainty;
+	le<float> zUncertainty;
+	le<float> phiUncertainty;
+	le<uint64_t> timestamp; //!< Since version 2
+} __attribute__((packed));
+
+struct DetectedBlobWire {
+	le<float> x;
+	le<float> y;
+	le<float> z;
+	le<float> phi;
+} __attribute__((packed));
+
+struct DetectedBlobWSizeArrayWire {
+	enum { VERSION = 2 };
+	uint8_t version;
+	uint8_t size;
+	DetectedBlobWire detectedBlobArray[MAX_DOCKING_PATTERNS];
+	le<uint64_t> timestamp; //!< Since version 2
+} __attribute__((packed));
+
+//! MSG_REMOTE_CONTROL
+struct RemoteControlDataWire {
+	enum { VERSION = 1 };
+	uint8_t version;
+	int8_t speed1;
+	int8_t speed2;
+	int8_t speed3;
+	uint8_t directMotorSpeed;
+	int8_t hingeAngle;
+	int8_t dockingAngleLeft;
+	int8_t dockingAngleRight;
+	uint8_t source;
+	uint8_t ledcolor;
+	le<int32_t> action; //!< A RemoteRobotAction
+} __attribute__((packed));
+
+//! Write the position into buffer, which holds sizeof(MappedObjectPositionWire) bytes, returns the length
+static inline int packMappedObjectPosition(const MappedObjectPosition & position, uint8_t *buffer) {
+	MappedObjectPositionWire *wire = (MappedObjectPositionWire*) buffer;
+	wire->version = MappedObjectPositionWire::VERSION;
+	wire->mappedBy = position.mappedBy;
+	wire->type = (int32_t) position.type;
+	wire->map_id = position.map_id;
+	wire->xPosition = position.xPosition;
+	wire->yPosition = position.yPosition;
+	wire->zPosition = position.zPosition;
+	wire->phiPosition = position.phiPosition;
+	wire->xUncertainty = position.xUncertainty;
+	wire->yUncertainty = position.yUncertainty;
+	wire->zUncertainty = position.zUncertainty;
+	wire->phiUncertainty = position.phiUncertainty;
+	wire->timestamp = position.timestamp;
+	return sizeof(MappedObjectPositionWire);
+}
+
+//! Read a MSG_MAP_DATA, false if it is not a MappedObjectPositionWire this robot understands
+static inline bool unpackMappedObjectPosition(const uint8_t *buffer, int len, MappedObjectPosition & position) {
+	const MappedObjectPositionWire *wire = wireView<MappedObjectPositionWire>(buffer, len);
+	if (wire == NULL) return false;
+	position.mappedBy = wire->mappedBy;
+	position.type = (MapObjectType) (int32_t) wire->type;
+	position.map_id = wire->map_id;
+	position.xPosition = wire->xPosition;
+	position.yPosition = wire->yPosition;
+	position.zPosition = wire->zPosition;
+	position.phiPosition = wire->phiPosition;
+	position.xUncertainty = wire->xUncertainty;
+	position.yUncertainty = wire->yUncertainty;
+	position.zUncertainty = wire->zUncertainty;
+	position.phiUncertainty = wire->phiUncertainty;
+	position.timestamp = wire->timestamp;
+	return true;
+}
+
+static inline int packDetectedBlobWSizeArray(const DetectedBlobWSizeArray & blobs, uint8_t *buffer) {
+	DetectedBlobWSizeArrayWire *wire = (DetectedBlobWSizeArrayWire*) buffer;
+	wire->version = DetectedBlobWSizeArrayWire::VERSION;
+	wire->size = blobs.size;
+	for (int i = 0; i < MAX_DOCKING_PATTERNS; i++) {
+		wire->detectedBlobArray[i].x = blobs.detectedBlobArray[i].x;
+		wire->detectedBlobArray[i].y = blobs.detectedBlobArray[i].y;
+		wire->detectedBlobArray[i].z = blobs.detectedBlobArray[i].z;
+		wire->detectedBlobArray[i].phi = blobs.detectedBlobArray[i].phi;
+	}
+	wire->timestamp = blobs.timestamp;
+	return sizeof(DetectedBlobWSizeArrayWire);
+}
+
+static inline bool unpackDetectedBlobWSizeArray(const uint8_t *buffer, int len, DetectedBlobWSizeArray & blobs) {
+	const DetectedBlobWSizeArrayWire *wire = wireView<DetectedBlobWSizeArrayWire>(buffer, len);
+	if (wire == NULL || wire->size > MAX_DOCKING_PATTERNS) return false;
+	blobs.size = wire->size;
+	for (int i = 0; i < MAX_DOCKING_PATTERNS; i++) {
+		blobs.detectedBlobArray[i].x = wire->detectedBlobArray[i].x;
+		blobs.detectedBlobArray[i].y = wire->detectedBlobArray[i].y;
+		blobs.detectedBlobArray[i].z = wire->detectedBlobArray[i].z;
+		blobs.detectedBlobArray[i].phi = wire->detectedBlobArray[i].phi;
+	}
+	blobs.timestamp = wire->timestamp;
+	return true;
+}
+
+static inline int packRemoteControlData(const RemoteControlData & data, uint8_t *buffer) {
+	RemoteControlDataWire *wire = (RemoteControlDataWire*) buffer;
+	wire->version = RemoteControlDataWire::VERSION;
+	wire->speed1 = data.speed1;
+	wire->speed2 = data.speed2;
+	wire->speed3 = data.speed3;
+	wire->directMotorSpeed = data.directMotorSpeed ? 1 : 0;
+	wire->hingeAngle = data.hingeAngle;
+	wire->dockingAngleLeft = data.dockingAngleLeft;
+	wire->dockingAngleRight = data.dockingAngleRight;
+	wire->source = data.source;
+	wire->ledcolor = data.ledcolor;
+	wire->action = (int32_t) data.action;
+	return sizeof(RemoteControlDataWire);
+}
+
+static inline bool unpackRemoteControlData(const uint8_t *buffer, int len, RemoteControlData & data) {
+	const RemoteControlDataWire *wire = wireView<RemoteControlDataWire>(buffer, len);
+	if (wire == NULL) return false;
+	data.speed1 = wire->speed1;
+	data.speed2 = wire->speed2;
+	data.speed3 = wire->speed3;
+	data.directMotorSpeed = (wire->directMotorSpeed != 0);
+	data.hingeAngle = wire->hingeAngle;
+	data.dockingAngleLeft = wire->dockingAngleLeft;
+	data.dockingAngleRight = wire->dockingAngleRight;
+	data.source = wire->source;
+	data.ledcolor = wire->ledcolor;
+	data.action = (RemoteRobotAction) (int32_t) wire->action;
+	return true;
+}
+
+//! The snapshot holds every object of the map of the robot, objects of that robot that are not in it are gone
+#define MAP_SNAPSHOT_FULL 0x01
+//! The objects are followed by their covariances, see MapCovarianceWire
+#define MAP_SNAPSHOT_COVARIANCE 0x02
+//! The snapshot ends with the pose of the robot that owns the map, see MapPoseWire
+#define MAP_SNAPSHOT_POSE 0x04
+
+//! MSG_MAP_SNAPSHOT_REQ, ask for the objects that changed since a version of the map, 0 for all of them
+struct MapSnapshotRequestWire {
+	enum { VERSION = 1 };
+	uint8_t version;
+	uint8_t flags; //!< MAP_SNAPSHOT_COVARIANCE and MAP_SNAPSHOT_POSE to get the covariances and the pose as well
+	le<uint32_t> since;
+} __attribute__((packed));
+
+/**
+ * MSG_MAP_SNAPSHOT, the objects of a map in a single message. The header is followed by count MappedObjectPositionWire
+ * entries and, with MAP_SNAPSHOT_COVARIANCE, by count MapCovarianceWire entries in the same order. With
+ * MAP_SNAPSHOT_POSE every part ends with a MapPoseWire, a reader that does not know the flag does not look beyond
+ * the objects. A map that does not fit in one message is sent in parts, first is the index of the first object of
+ * this part.
+ */
+struct MapSnapshotHeaderWire {
+	enum { VERSION = 1 };
+	uint8_t version;
+	uint8_t flags;
+	le<int32_t> robot; //!< Robot that owns the map
+	le<uint32_t> map_version; //!< Version of the map, ask for changes since this one next time
+	le<uint32_t> since; //!< The objects changed after this version, 0 in a full snapshot
+	le<uint16_t> first;
+	le<uint16_t> count;
+	le<uint16_t> total; //!< Objects in all parts together
+} __attribute__((packed));
+
+//! The 4x4 covariance of x, y, phi and z of an object, it is symmetric so only the upper triangle is sent row by row
+struct MapCovarianceWire {
+	le<float> upper[10];
+} __attribute__((packed));
+
+//! The pose of the robot when the snapshot was taken, x and y in m, phi in rad, and their variances
+struct MapPoseWire {
+	le<float> x;
+	le<float> y;
+	le<float> phi;
+	le<float> variance[3];
+} __attribute__((packed));
+
+static inline int mapSnapshotLength(int count, uint8_t flags) {
+	return sizeof(MapSnapshotHeaderWire) + count * sizeof(MappedObjectPositionWire)
+			+ ((flags & MAP_SNAPSHOT_COVARIANCE) ? count * sizeof(MapCovarianceWire) : 0)
+			+ ((flags & MAP_SNAPSHOT_POSE) ? sizeof(MapPoseWire) : 0);
+}
+
+//! The i-th object of the snapshot in buffer
+static inline uint8_t *mapSnapshotObject(uint8_t *buffer, int i) {
+	return buffer + sizeof(MapSnapshotHeaderWire) + i * sizeof(MappedObjectPositionWire);
+}
+
+static inline const uint8_t *mapSnapshotObject(const uint8_t *buffer, int i) {
+	return buffer + sizeof(MapSnapshotHeaderWire) + i * sizeof(MappedObjectPositionWire);
+}
+
+//! The covariance of the i-th object of a snapshot with count objects and MAP_SNAPSHOT_COVARIANCE
+static inline MapCovarianceWire *mapSnapshotCovariance(uint8_t *buffer, int count, int i) {
+	return (MapCovarianceWire*) (mapSnapshotObject(buffer, count) + i * sizeof(MapCovarianceWire));
+}
+
+static inline const MapCovarianceWire *mapSnapshotCovariance(const uint8_t *buffer, int count, int i) {
+	return (const MapCovarianceWire*) (mapSnapshotObject(buffer, count) + i * sizeof(MapCovarianceWire));
+}
+
+//! The pose of a snapshot with count objects and MAP_SNAPSHOT_POSE
+static inline MapPoseWire *mapSnapshotPose(uint8_t *buffer, int count, uint8_t flags) {
+	return (MapPoseWire*) (buffer + mapSnapshotLength(count, flags & ~MAP_SNAPSHOT_POSE));
+}
+
+static inline const MapPoseWire *mapSnapshotPose(const uint8_t *buffer, int count, uint8_t flags) {
+	return (const MapPoseWire*) (buffer + mapSnapshotLength(count, flags & ~MAP_SNAPSHOT_POSE));
+}
+
+//! The header of a MSG_MAP_SNAPSHOT, NULL if the message is too short for the objects it announces
+static inline const MapSnapshotHeaderWire *mapSnapshotView(const uint8_t *buffer, int len) {
+	const MapSnapshotHeaderWire *header = wireView<MapSnapshotHeaderWire>(buffer, len);
+	if (header == NULL || len < mapSnapshotLength(header->count, header->flags)) return NULL;
+	return header;
+}
+
+//! MSG_IPC_STATS, the answer of an IPC, the header is followed by count IPCConnectionStatsWire entries
+struct IPCStatsHeaderWire {
+	enum { VERSION = 1 };
+	uint8_t version;
+	uint8_t count;
+	le<uint32_t> reconnects; //!< Connections that were made again after the one to the same peer was lost
+} __attribute__((packed));
+
+//! The counters of a connection since it was made, see IPC::ConnectionStats
+struct IPCConnectionStatsWire {
+	le<uint32_t> address; //!< Network byte order, 0 for the shared memory channel
+	le<uint16_t> port;
+	uint8_t shared;
+	uint8_t connected;
+	le<uint64_t> bytes_in;
+	le<uint64_t> bytes_out;
+	le<uint32_t> messages_in;
+	le<uint32_t> messages_out;
+	le<uint32_t> dropped; //!< Messages that did not fit in the transmit queue
+	le<uint32_t> parse_errors; //!< Messages received with a wrong checksum
+	le<uint32_t> queued_bytes;
+	le<uint32_t> queued_messages;
+	le<uint32_t> max_queued_bytes;
+	le<uint32_t> max_send_latency; //!< Microseconds from SendData until a message was written completely
+} __attribute__((packed));
+
+//! Connections that fit in a MSG_IPC_STATS
+#define IPC_STATS_MAX_CONNECTIONS 32
+#define IPC_STATS_MAX_LENGTH (sizeof(IPCStatsHeaderWire) + IPC_STATS_MAX_CONNECTIONS * sizeof(IPCConnectionStatsWire))
+
+static inline int ipcStatsLength(int count) {
+	return sizeof(IPCStatsHeaderWire) + count * sizeof(IPCConnectionStatsWire);
+}
+
+static inline const IPCConnectionStatsWire *ipcStatsConnection(const uint8_t *buffer, int i) {
+	return (const IPCConnectionStatsWire*) (buffer + sizeof(IPCStatsHeaderWire) + i * sizeof(IPCConnectionStatsWire));
+}
+
+//! The header of a MSG_IPC_STATS, NULL if the message is too short for the connections it announces
+static inline const IPCStatsHeaderWire *ipcStatsView(const uint8_t *buffer, int len) {
+	const IPCStatsHeaderWire *header = wireView<IPCStatsHeaderWire>(buffer, len);
+	if (header == NULL || len < ipcStatsLength(header->count)) return NULL;
+	return header;
+}
+
+/**
+ * Write the counters of the connections of an IPC into buffer, which holds IPC_STATS_MAX_LENGTH bytes, returns the
+ * length. S is IPC::ConnectionStats, which is not known where the message is only read.
+ */
+template <typename S>
+static inline int packIPCStats(const S *stats, int count, uint32_t reconnects, uint8_t *buffer) {
+	if (count > IPC_STATS_MAX_CONNECTIONS) count = IPC_STATS_MAX_CONNECTIONS;
+	IPCStatsHeaderWire *header = (IPCStatsHeaderWire*) buffer;
+	header->version = IPCStatsHeaderWire::VERSION;
+	header->count = count;
+	header->reconnects = reconnects;
+	for (int i = 0; i < count; i++) {
+		IPCConnectionStatsWire *wire = (IPCConnectionStatsWire*) ipcStatsConnection(buffer, i);
+		wire->address = stats[i].address;
+		wire->port = stats[i].port;
+		wire->shared = stats[i].shared ? 1 : 0;
+		wire->connected = stats[i].connected ? 1 : 0;
+		wire->bytes_in = stats[i].bytes_in;
+		wire->bytes_out = stats[i].bytes_out;
+		wire->messages_in = stats[i].messages_in;
+		wire->messages_out = stats[i].messages_out;
+		wire->dropped = stats[i].dropped;
+		wire->parse_errors = stats[i].parse_errors;
+		wire->queued_bytes = stats[i].queued_bytes;
+		wire->queued_messages = stats[i].queued_messages;
+		wire->max_queued_bytes = stats[i].max_queued_bytes;
+		wire->max_send_latency = stats[i].max_send_latency;
+	}
+	return ipcStatsLength(count);
+}
+
+//! MSG_MEM_STATS, the answer of a jockey, the header is followed by count MemModuleStatsWire entries
+struct MemStatsHeaderWire {
+	enum { VERSION = 1 };
+	uint8_t version;
+	uint8_t count;
+	le<uint32_t> pid;
+	le<uint32_t> rss_kb; //!< Resident size of the process
+	le<uint32_t> peak_rss_kb;
+	le<uint32_t> vm_kb;
+	le<uint32_t> budget_kb; //!< 0 if the process has no budget
+} __attribute__((packed));
+
+//! The buffers of a subsystem, see MemModuleStats
+struct MemModuleStatsWire {
+	char name[16];
+	le<uint32_t> current;
+	le<uint32_t> peak;
+	le<uint32_t> allocations;
+	le<uint32_t> budget;
+	le<uint32_t> over_budget;
+} __attribute__((packed));
+
+//! Modules that fit in a MSG_MEM_STATS
+#define MEM_STATS_MAX_MODULES 16
+#define MEM_STATS_MAX_LENGTH (sizeof(MemStatsHeaderWire) + MEM_STATS_MAX_MODULES * sizeof(MemModuleStatsWire))
+
+static inline int memStatsLength(int count) {
+	return sizeof(MemStatsHeaderWire) + count * sizeof(MemModuleStatsWire);
+}
+
+static inline const MemModuleStatsWire *memStatsModule(const uint8_t *buffer, int i) {
+	return (const MemModuleStatsWire*) (buffer + sizeof(MemStatsHeaderWire) + i * sizeof(MemModuleStatsWire));
+}
+
+//! The header of a MSG_MEM_STATS, NULL if the message is too short for the modules it announces
+static inline const MemStatsHeaderWire *memStatsView(const uint8_t *buffer, int len) {
+	const MemStatsHeaderWire *header = wireView<MemStatsHeaderWire>(buffer, len);
+	if (header == NULL || len < memStatsLength(header->count)) return NULL;
+	return header;
+}
+
+/**
+ * Write the memory of a process and its modules into buffer, which holds MEM_STATS_MAX_LENGTH bytes, returns the
+ * length. P and S are MemProcessStats and MemModuleStats of the common bridle, which is not needed where the message
+ * is only read.
+ */
+template <typename P, typename S>
+static inline int packMemStats(const P & process, const S *stats, int count, uint32_t pid, uint8_t *buffer) {
+	if (count > MEM_STATS_MAX_MODULES) count = MEM_STATS_MAX_MODULES;
+	MemStatsHeaderWire *header = (MemStatsHeaderWire*) buffer;
+	header->version = MemStatsHeaderWire::VERSION;
+	header->count = count;
+	header->pid = pid;
+	header->rss_kb = process.rss_kb;
+	header->peak_rss_kb = process.peak_rss_kb;
+	header->vm_kb = process.vm_kb;
+	header->budget_kb = process.budget_kb;
+	for (int i = 0; i < count; i++) {
+		MemModuleStatsWire *wire = (MemModuleStatsWire*) memStatsModule(buffer, i);
+		memset(wire->name, 0, sizeof(wire->name));
+		strncpy(wire->name, stats[i].name, sizeof(wire->name) - 1);
+		wire->current = stats[i].current;
+		wire->peak = stats[i].peak;
+		wire->allocations = stats[i].allocations;
+		wire->budget = stats[i].budget;
+		wire->over_budget = stats[i].over_budget;
+	}
+	return memStatsLength(count);
+}
+
+//! MSG_TRACE_DUMP, the answer of a process, the header is followed by count TraceRecordWire entries, the oldest first
+struct TraceDumpHeaderWire {
+	enum { VERSION = 1 };
+	uint8_t version;
+	le<uint16_t> count;
+	le<uint32_t> pid;
+	le<uint64_t> now; //!< Time at which the dump was taken, so records can be aged without the clock of the robot
+} __attribute__((packed));
+
+//! A frame that reached a hop, see TraceRecord
+struct TraceRecordWire {
+	le<uint64_t> capture;
+	le<uint64_t> time;
+	uint8_t hop; //!< A TraceHop
+} __attribute__((packed));
+
+//! Records that fit in a MSG_TRACE_DUMP
+#define TRACE_DUMP_MAX_RECORDS 256
+#define TRACE_DUMP_MAX_LENGTH (sizeof(TraceDumpHeaderWire) + TRACE_DUMP_MAX_RECORDS * sizeof(TraceRecordWire))
+
+static inline int traceDumpLength(int count) {
+	return sizeof(TraceDumpHeaderWire) + count * sizeof(TraceRecordWire);
+}
+
+static inline const TraceRecordWire *traceDumpRecord(const uint8_t *buffer, int i) {
+	return (const TraceRecordWire*) (buffer + sizeof(TraceDumpHeaderWire) + i * sizeof(TraceRecordWire));
+}
+
+//! The header of a MSG_TRACE_DUMP, NULL if the message is too short for the records it announces
+static inline const TraceDumpHeaderWire *traceDumpView(const uint8_t *buffer, int len) {
+	const TraceDumpHeaderWire *header = wireView<TraceDumpHeaderWire>(buffer, len);
+	if (header == NULL || len < traceDumpLength(header->count)) return NULL;
+	return header;
+}
+
+/**
+ * Write the records into buffer, which holds TRACE_DUMP_MAX_LENGTH bytes, returns the length. R is the TraceRecord of
+ * the common bridle, which is not needed where the message is only read.
+ */
+template <typename R>
+static inline int packTraceDump(const R *records, int count, uint32_t pid, uint64_t now, uint8_t *buffer) {
+	if (count > TRACE_DUMP_MAX_RECORDS) count = TRACE_DUMP_MAX_RECORDS;
+	TraceDumpHeaderWire *header = (TraceDumpHeaderWire*) buffer;
+	header->version = TraceDumpHeaderWire::VERSION;
+	header->count = count;
+	header->pid = pid;
+	header->now = now;
+	for (int i = 0; i < count; i++) {
+		TraceRecordWire *wire = (TraceRecordWire*) traceDumpRecord(buffer, i);
+		wire->capture = records[i].capture;
+		wire->time = records[i].time;
+		wire->hop = records[i].hop;
+	}
+	return traceDumpLength(count);
+}
+
+//! MSG_MOTOR_CALIBRATION_REPORT, small enough for a single ZigBee frame
+struct MotorCalibReportWire {
+	enum { VERSION = 1 };
+	uint8_t version;
+	uint8_t robot_type; //!< A RobotBase::RobotType
+	uint8_t method; //!< A MotorCalibMethod
+	le<int16_t> robot;
+	le<float> odometry_koef1;
+	le<float> odometry_koef2;
+	le<float> odometry_koef3;
+	le<int16_t> calibratedSpeed;
+	le<float> fit_residual;
+	le<uint16_t> observations;
+	le<float> residual;
+	le<float> max_residual;
+	le<float> angle_residual;
+	le<float> distance;
+	le<float> rotation;
+	le<float> drift;
+	le<float> angle_drift;
+	le<uint64_t> timestamp;
+} __attribute__((packed));
+
+static inline int packMotorCalibReport(const MotorCalibReport & report, uint8_t *buffer) {
+	MotorCalibReportWire *wire = (MotorCalibReportWire*) buffer;
+	wire->version = MotorCalibReportWire::VERSION;
+	wire->robot_type = report.robot_type;
+	wire->method = report.method;
+	wire->robot = report.robot;
+	wire->odometry_koef1 = report.result.odometry_koef1;
+	wire->odometry_koef2 = report.result.odometry_koef2;
+	wire->odometry_koef3 = report.result.odometry_koef3;
+	wire->calibratedSpeed = report.result.calibratedSpeed;
+	wire->fit_residual = report.fit_residual;
+	wire->observations = report.observations;
+	wire->residual = report.residual;
+	wire->max_residual = report.max_residual;
+	wire->angle_residual = report.angle_residual;
+	wire->distance = report.distance;
+	wire->rotation = report.rotation;
+	wire->drift = report.drift;
+	wire->angle_drift = report.angle_drift;
+	wire->timestamp = report.timestamp;
+	return sizeof(MotorCalibReportWire);
+}
+
+static inline bool unpackMotorCalibReport(const uint8_t *buffer, int len, MotorCalibReport & report) {
+	const MotorCalibReportWire *wire = wireView<MotorCalibReportWire>(buffer, len);
+	if (wire == NULL) return false;
+	report.robot_type = wire->robot_type;
+	report.method = wire->method;
+	report.robot = wire->robot;
+	report.result.odometry_koef1 = wire->odometry_koef1;
+	report.result.odometry_koef2 = wire->odometry_koef2;
+	report.result.odometry_koef3 = wire->odometry_koef3;
+	report.result.calibratedSpeed = wire->calibratedSpeed;
+	report.fit_residual = wire->fit_residual;
+	report.observations = wire->observations;
+	report.residual = wire->residual;
+	report.max_residual = wire->max_residual;
+	report.angle_residual = wire->angle_residual;
+	report.distance = wire->distance;
+	report.rotation = wire->rotation;
+	report.drift = wire->drift;
+	report.angle_drift = wire->angle_drift;
+	report.timestamp = wire->timestamp;
+	return true;
+}
+
+//! MSG_ORG_STATE, a broadcast of the recruitment table, the header is followed by count OrganismEntryWire entries
+struct OrganismStateHeaderWire {
+	enum { VERSION = 1 };
+	uint8_t version;
+	uint8_t sender;
+	uint8_t count;
+} __attribute__((packed));
+
+//! What a robot does in the recruitment, see CRecruitment
+enum OrganismRole {
+	ORG_FREE = 0,
+	ORG_SEED, //!< Recruits need_count robots of need_type
+	ORG_JOINING //!< Drives to the robot seed to dock
+};
+
+//! The state of a robot as it announced it, only that robot changes it and increments its version
+struct OrganismEntryWire {
+	uint8_t robot;
+	uint8_t robot_type; //!< A RobotBase::RobotType
+	uint8_t role; //!< An OrganismRole
+	uint8_t seed; //!< The seed it joins, for ORG_JOINING
+	uint8_t need_type; //!< For ORG_SEED
+	uint8_t need_count;
+	le<uint16_t> revision; //!< Incremented by the robot with each change, wraps around
+	le<int16_t> x; //!< In cm
+	le<int16_t> y;
+} __attribute__((packed));
+
+//! Entries that fit in a MSG_ORG_STATE, so it fits in a single ZigBee frame
+#define ORG_STATE_MAX_ENTRIES 6
+#define ORG_STATE_MAX_LENGTH (sizeof(OrganismStateHeaderWire) + ORG_STATE_MAX_ENTRIES * sizeof(OrganismEntryWire))
+
+static inline int orgStateLength(int count) {
+	return sizeof(OrganismStateHeaderWire) + count * sizeof(OrganismEntryWire);
+}
+
+static inline OrganismEntryWire *orgStateEntry(uint8_t *buffer, int i) {
+	return (OrganismEntryWire*) (buffer + sizeof(OrganismStateHeaderWire) + i * sizeof(OrganismEntryWire));
+}
+
+static inline const OrganismEntryWire *orgStateEntry(const uint8_t *buffer, int i) {
+	return (const OrganismEntryWire*) (buffer + sizeof(OrganismStateHeaderWire) + i * sizeof(OrganismEntryWire));
+}
+
+//! The header of a MSG_ORG_STATE, NULL if the message is too short for the entries it announces
+static inline const OrganismStateHeaderWire *orgStateView(const uint8_t *buffer, int len) {
+	const OrganismStateHeaderWire *header = wireView<OrganismStateHeaderWire>(buffer, len);
+	if (header == NULL || len < orgStateLength(header->count)) return NULL;
+	return header;
+}
+
+//! MSG_ORGANISM_COMMAND, the setpoints of all modules of an organism, the header is followed by count setpoints
+struct OrganismCommandHeaderWire {
+	enum { VERSION = 1 };
+	uint8_t version;
+	uint8_t count;
+	le<uint16_t> sequence; //!< A module applies a sequence once, however often the command reaches it
+	le<int64_t> sent; //!< Time of day in us at the sender
+	le<uint32_t> lead; //!< The setpoints start this many us after sent
+} __attribute__((packed));
+
+//! A setpoint for all modules that have none of their own
+#define ORG_MODULE_ALL 0xFF
+
+//! The speeds of a setpoint are those of the wheels, otherwise forward and turn as for CMotors::setSpeeds
+#define ORG_SETPOINT_DIRECT 0x01
+
+/**
+ * The speeds a module holds from delay to delay + duration after the activation. A module takes its own setpoints, in
+ * the order of the message, or those of ORG_MODULE_ALL if it has none. The wheels stop between setpoints.
+ */
+struct OrganismSetpointWire {
+	uint8_t module; //!< The position of the module in the organism, or ORG_MODULE_ALL
+	uint8_t flags;
+	int8_t speed[3];
+	le<uint16_t> delay; //!< In ms after the activation
+	le<uint16_t> duration; //!< In ms
+} __attribute__((packed));
+
+#define ORG_COMMAND_MAX_SETPOINTS 8
+#define ORG_COMMAND_MAX_LENGTH \
+	(sizeof(OrganismCommandHeaderWire) + ORG_COMMAND_MAX_SETPOINTS * sizeof(OrganismSetpointWire))
+
+static inline int orgCommandLength(int count) {
+	return sizeof(OrganismCommandHeaderWire) + count * sizeof(OrganismSetpointWire);
+}
+
+static inline OrganismSetpointWire *orgCommandSetpoint(uint8_t *buffer, int i) {
+	return (OrganismSetpointWire*) (buffer + sizeof(OrganismCommandHeaderWire) + i * sizeof(OrganismSetpointWire));
+}
+
+static inline const OrganismSetpointWire *orgCommandSetpoint(const uint8_t *buffer, int i) {
+	return (const OrganismSetpointWire*) (buffer + sizeof(OrganismCommandHeaderWire) +
+			i * sizeof(OrganismSetpointWire));
+}
+
+//! The header of a MSG_ORGANISM_COMMAND, NULL if the message is too short for the setpoints it announces
+static inline const OrganismCommandHeaderWire *orgCommandView(const uint8_t *buffer, int len) {
+	const OrganismCommandHeaderWire *header = wireView<OrganismCommandHeaderWire>(buffer, len);
+	if (header == NULL || header->count > ORG_COMMAND_MAX_SETPOINTS || len < orgCommandLength(header->count)) {
+		return NULL;
+	}
+	return header;
+}
+
+//! MSG_HEARTBEAT, sent from the loop of CController::run() itself, so it stops when a tick() or a handler hangs
+struct HeartbeatWire {
+	enum { VERSION = 1 };
+	uint8_t version;
+	uint8_t running; //!< The jockey is started
+	le<uint32_t> sequence;
+	le<uint32_t> cycles; //!< Of run(), see CycleStats
+	le<uint32_t> overruns;
+} __attribute__((packed));
+
+//! The message holds every tile of the occupancy grid, the tiles that are not in it are unknown
+#define OCCUPANCY_FULL 0x01
+
+//! MSG_OCCUPANCY_REQ, ask for the tiles of the occupancy grid that changed since a version, 0 for all of them
+struct OccupancyRequestWire {
+	enum { VERSION = 1 };
+	uint8_t version;
+	le<uint32_t> since;
+} __attribute__((packed));
+
+/**
+ * MSG_OCCUPANCY, tiles of the occupancy grid of the mapping jockey, in the frame of its odometry. The header is
+ * followed by count OccupancyTileWire entries. The cells are log-odds of an obstacle, 0 is unknown. Tiles that do not
+ * fit in one message are sent in parts, first is the index of the first tile of this part.
+ */
+struct OccupancyHeaderWire {
+	enum { VERSION = 1 };
+	uint8_t version;
+	uint8_t flags;
+	le<int32_t> robot;
+	le<uint32_t> grid_version; //!< Version of the grid, ask for changes since this one next time
+	le<uint32_t> since; //!< The tiles changed after this version, 0 with OCCUPANCY_FULL
+	le<uint16_t> cell_mm; //!< Side of a cell
+	le<uint16_t> first;
+	le<uint16_t> count;
+	le<uint16_t> total; //!< Tiles in all parts together
+} __attribute__((packed));
+
+//! Cells along the side of a tile
+#define OCCUPANCY_WIRE_TILE 16
+
+//! A tile of the grid, its cells row by row, the first cell is at tx * OCCUPANCY_WIRE_TILE, ty * OCCUPANCY_WIRE_TILE
+struct OccupancyTileWire {
+	le<int16_t> tx;
+	le<int16_t> ty;
+	int8_t cells[OCCUPANCY_WIRE_TILE * OCCUPANCY_WIRE_TILE];
+} __attribute__((packed));
+
+//! Tiles in one MSG_OCCUPANCY, a part stays at about 4kB
+#define OCCUPANCY_MAX_TILES 16
+
+static inline int occupancyLength(int count) {
+	return sizeof(OccupancyHeaderWire) + count * sizeof(OccupancyTileWire);
+}
+
+static inline OccupancyTileWire *occupancyTile(uint8_t *buffer, int i) {
+	return (OccupancyTileWire*) (buffer + sizeof(OccupancyHeaderWire) + i * sizeof(OccupancyTileWire));
+}
+
+static inline const OccupancyTileWire *occupancyTile(const uint8_t *buffer, int i) {
+	return (const OccupancyTileWire*) (buffer + sizeof(OccupancyHeaderWire) + i * sizeof(OccupancyTileWire));
+}
+
+//! The header of a MSG_OCCUPANCY, NULL if the message is too short for the tiles it announces
+static inline const OccupancyHeaderWire *occupancyView(const uint8_t *buffer, int len) {
+	const OccupancyHeaderWire *header = wireView<OccupancyHeaderWire>(buffer, len);
+	if (header == NULL || len < occupancyLength(header->count)) return NULL;
+	return header;
+}
+
+/**
+ * MSG_FRONTIER, the frontier between the free and the unknown space of the occupancy grid that is the best one to drive
+ * to, in m in the frame of the odometry of the mapping jockey, as the position for MSG_MOVETOPOSITION
+ */
+struct FrontierWire {
+	enum { VERSION = 1 };
+	uint8_t version;
+	uint8_t found; //!< 0 if there is no frontier left, the grid is explored
+	le<int32_t> robot;
+	le<float> x;
+	le<float> y;
+	le<float> phi; //!< Heading from the robot to the target, the laser faces the unknown space on arrival
+	le<uint16_t> gain; //!< Frontier cells at the target
+	le<uint16_t> clusters; //!< Frontiers left
+} __attribute__((packed));
+
+#endif /* __MESSAGESCHEMA_H__ */
@@ -0,0 +1,281 @@
+/*
+ * File name: shmipc.cc
+ * Date:      2013/10/14
+ * Author:    Anne C. van Rossum
+ */
+#include <pthread.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#ifdef SYS_futex
+#include <linux/futex.h>
+#endif
+#include "shmipc.hh"
+#include <CSched.h>
+
+namespace IPC{
+
+#define SHMIPCMAGIC 0x45514d53
+#define SHMIPCMASK (SHMIPCRINGSIZE - 1)
+//the reader checks for Stop at least this often, in milliseconds
+#define SHMIPCTIMEOUT 100
+
+static inline uint32_t RecordSize(uint32_t length)
+{
+    return sizeof(SharedRecord) + ((length + 7) & ~7);
+}
+
+SharedChannel::SharedChannel()
+{
+    segment = NULL;
+    tx = rx = NULL;
+    owner = false;
+    name[0] = 0;
+    running = false;
+    callback = NULL;
+    user_data = NULL;
+    counter = 0;
+    dropped = 0;
+    bytes_out = 0;
+    messages_out = 0;
+    max_queued = 0;
+    bytes_in = 0;
+    messages_in = 0;
+    pthread_mutex_init(&mutex_tx, NULL);
+}
+
+SharedChannel::~SharedChannel()
+{
+    Stop();
+    if(segment)
+        munmap(segment, sizeof(SharedSegment));
+    if(owner)
+        shm_unlink(name);
+    pthread_mutex_destroy(&mutex_tx);
+}
+
+bool SharedChannel::Create(int port)
+{
+    return Map(port, true);
+}
+
+bool SharedChannel::Attach(int port)
+{
+    return Map(port, false);
+}
+
+bool SharedChannel::Map(int port, bool create)
+{
+    snprintf(name, sizeof(name), SHMIPCNAME, port);
+    if(create)
+        shm_unlink(name);
+    int fd = shm_open(name, create ? (O_RDWR | O_CREAT | O_EXCL) : O_RDWR, 0600);
+    if(fd < 0)
+    {
+        if(create || errno != ENOENT)
+            printf("shared memory %s failed, %i is %s\n", name, errno, strerror(errno));
+        return false;
+    }
+    if(create && ftruncate(fd, sizeof(SharedSegment)) < 0)
+    {
+        printf("shared memory %s can not be sized, %i is %s\n", name, errno, strerror(errno));
+        close(fd);
+        shm_unlink(name);
+        return false;
+    }
+    void *ptr = mmap(NULL, sizeof(SharedSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(ptr == MAP_FAILED)
+    {
+        printf("shared memory %s can not be mapped, %i is %s\n", name, errno, strerror(errno));
+        if(create)
+            shm_unlink(name);
+        return false;
+    }
+    segment = (SharedSegment*)ptr;
+    if(create)
+    {
+        memset(segment, 0, sizeof(SharedSegment));
+        segment->magic = SHMIPCMAGIC;
+    }
+    else if(segment->magic != SHMIPCMAGIC)
+    {
+        printf("shared memory %s is not a channel\n", name);
+        munmap(segment, sizeof(SharedSegment));
+        segment = NULL;
+        return false;
+    }
+    owner = create;
+    tx = &segment->ring[create ? 0 : 1];
+    rx = &segment->ring[create ? 1 : 0];
+    printf("%s shared memory %s\n", create ? "Created" : "Attached to", name);
+    return true;
+}
+
+bool SharedChannel::Start(Callback c, void * u)
+{
+    if(!segment || running)
+        return false;
+    callback = c;
+    user_data = u;
+    running = true;
+    if(pthread_create(&receiving_thread, 0, Receiving, this) != 0)
+    {
+        running = false;
+        return false;
+    }
+    return true;
+}
+
+void SharedChannel::Stop()
+{
+    if(!running)
+        return;
+    running = false;
+    pthread_join(receiving_thread, NULL);
+}
+
+/**
+ * A record that does not fit before the end of the ring is preceded by a skip record over the rest of the ring, so the
+ * reader can hand out every payload in place.
+ */
+bool SharedChannel::SendData(const uint8_t type, const uint8_t *data, int len)
+{
+    if(!segment)
+        return false;
+    uint32_t size = RecordSize(len);
+
+    pthread_mutex_lock(&mutex_tx);
+    uint32_t head = tx->head;
+    uint32_t offset = head & SHMIPCMASK;
+    uint32_t contiguous = SHMIPCRINGSIZE - offset;
+    uint32_t needed = size + ((contiguous < size) ? contiguous : 0);
+    if(size > SHMIPCRINGSIZE / 2 || needed > SHMIPCRINGSIZE - (head - tx->tail))
+    {
+        if((dropped++ % 100) == 0)
+            printf("%s full, dropped %u messages\n", name, dropped);
+        pthread_mutex_unlock(&mutex_tx);
+        return false;
+    }
+    if(contiguous < size)
+    {
+        SharedRecord *skip = (SharedRecord*)(tx->data + offset);
+        skip->length = contiguous - sizeof(SharedRecord);
+        skip->skip = 1;
+        head += contiguous;
+        offset = 0;
+    }
+    SharedRecord *record = (SharedRecord*)(tx->data + offset);
+    record->length = len;
+    record->command = type;
+    record->counter = counter++;
+    record->skip = 0;
+    if(len > 0)
+        memcpy(record + 1, data, len);
+
+    //the record has to be complete before the reader sees the new head
+    __sync_synchronize();
+    tx->head = head + size;
+    tx->seq++;
+    __sync_synchronize();
+    bytes_out += size;
+    messages_out++;
+    if(tx->head - tx->tail > max_queued)
+        max_queued = tx->head - tx->tail;
+#ifdef SYS_futex
+    if(tx->sleeping)
+        syscall(SYS_futex, &tx->seq, FUTEX_WAKE, 1, NULL, NULL, 0);
+#endif
+    pthread_mutex_unlock(&mutex_tx);
+    return true;
+}
+
+void SharedChannel::Stats(ConnectionStats &stats)
+{
+    memset(&stats, 0, sizeof(stats));
+    stats.shared = true;
+    stats.connected = (segment != NULL);
+    stats.bytes_in = bytes_in;
+    stats.messages_in = messages_in;
+    pthread_mutex_lock(&mutex_tx);
+    stats.bytes_out = bytes_out;
+    stats.messages_out = messages_out;
+    stats.dropped = dropped;
+    stats.max_queued_bytes = max_queued;
+    if(segment)
+        stats.queued_bytes = tx->head - tx->tail;
+    pthread_mutex_unlock(&mutex_tx);
+}
+
+/**
+ * The reader announces that it sleeps before it checks the ring for the last time, the writer checks the flag after it
+ * moved the head, so at least one of them sees the other.
+ */
+void SharedChannel::Wait()
+{
+    int32_t seq = rx->seq;
+    rx->sleeping = 1;
+    __sync_synchronize();
+    if(rx->head == rx->tail)
+    {
+#ifdef SYS_futex
+        struct timespec timeout;
+        timeout.tv_sec = 0;
+        timeout.tv_nsec = SHMIPCTIMEOUT * 1000000L;
+        syscall(SYS_futex, &rx->seq, FUTEX_WAIT, seq, &timeout, NULL, 0);
+#else
+        usleep(1000);
+#endif
+    }
+    rx->sleeping = 0;
+}
+
+void * SharedChannel::Receiving(void *p)
+{
+    SharedChannel * ptr = (SharedChannel*)p;
+    SharedRing * rx = ptr->rx;
+    schedThread("ipc");
+    printf("create receiving thread for %s\n", ptr->name);
+
+    while(ptr->running)
+    {
+        uint32_t tail = rx->tail;
+        if(rx->head == tail)
+        {
+            ptr->Wait();
+            continue;
+        }
+        __sync_synchronize();
+
+        SharedRecord *record = (SharedRecord*)(rx->data + (tail & SHMIPCMASK));
+        if(!record->skip && ptr->callback)
+        {
+            ELolMessage msg;
+            msg.command = record->command;
+            msg.counter = record->counter;
+            msg.length = record->length;
+            msg.data = (uint8_t*)(record + 1);
+            ptr->callback(&msg, NULL, ptr->user_data);
+        }
+        if(!record->skip)
+        {
+            ptr->bytes_in += RecordSize(record->length);
+            ptr->messages_in++;
+        }
+
+        //the payload is used in place, so the writer may only reuse it after the callback
+        __sync_synchronize();
+        rx->tail = tail + RecordSize(record->length);
+    }
+
+    printf("exit receiving thread for %s\n", ptr->name);
+    return NULL;
+}
+
+}//end of namespace
@@ -0,0 +1,100 @@
+/*
+ * File name: shmipc.hh
+ * Date:      2013/10/14
+ * Author:    Anne C. van Rossum
+ *
+ * Shared memory transport between CEquids and a jockey on the same robot. Every direction is a single producer, single
+ * consumer ring in a POSIX shared memory segment, the reader sleeps on a futex in the segment when its ring is empty.
+ */
+#ifndef SHMIPC_HH
+#define SHMIPC_HH
+
+#include <pthread.h>
+#include <stdint.h>
+#include "ipc.hh"
+
+//! Bytes in the ring of each direction, must be a power of two
+#define SHMIPCRINGSIZE 65536
+//! The segment of the jockey that listens on a port, see SharedChannel::Create
+#define SHMIPCNAME "/equids_%d"
+
+namespace IPC{
+
+//! One direction of the channel, only the writer changes head and seq, only the reader changes tail and sleeping
+struct SharedRing
+{
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    volatile int32_t seq;
+    volatile int32_t sleeping;
+    uint8_t data[SHMIPCRINGSIZE];
+};
+
+struct SharedSegment
+{
+    uint32_t magic;
+    //ring 0 is written by the creator (CEquids), ring 1 by the jockey that attached
+    SharedRing ring[2];
+};
+
+//! Header of every message in a ring, the payload follows and is padded to 8 bytes, a record never wraps around
+struct SharedRecord
+{
+    uint32_t length;
+    uint8_t command;
+    uint8_t counter;
+    uint8_t skip;
+    uint8_t reserved;
+};
+
+class SharedChannel
+{
+    public:
+        SharedChannel();
+        ~SharedChannel();
+
+        //create the segment for the jockey on this port, before the jockey is started, an old one is removed
+        bool Create(int port);
+        //attach to the segment that is created for this port, false if there is none
+        bool Attach(int port);
+        //start the thread that dispatches received messages to the callback, the connection argument is NULL
+        bool Start(Callback c, void * u);
+        void Stop();
+
+        //copy the message into the ring, false if it does not fit, the caller never waits for the reader
+        bool SendData(const uint8_t type, const uint8_t *data, int len);
+        //messages that did not fit in the ring
+        inline unsigned int Dropped() {return dropped;}
+        //the counters of both directions and the bytes waiting in the ring of this side
+        void Stats(ConnectionStats &stats);
+
+    private:
+        static void * Receiving(void *ptr);
+        bool Map(int port, bool create);
+        void Wait();
+
+        SharedSegment *segment;
+        SharedRing *tx;
+        SharedRing *rx;
+        bool owner;
+        char name[32];
+
+        pthread_t receiving_thread;
+        bool running;
+        Callback callback;
+        void * user_data;
+
+        //CJockey and the reactor can both send, the ring only has a single writer
+        pthread_mutex_t mutex_tx;
+        uint8_t counter;
+        unsigned int dropped;
+        uint64_t bytes_out;
+        uint32_t messages_out;
+        uint32_t max_queued;
+        //written by the receiving thread only
+        uint64_t bytes_in;
+        uint32_t messages_in;
+};
+
+}//end of namespace
+#endif
@@ -0,0 +1,57 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief A typed handle to a parameter of a configuration file
+ * @file Param.hpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#ifndef PARAM_HPP_
+#define PARAM_HPP_
+
+#include <stddef.h>
+
+/**
+ * ConfigFile::bind() and Worldfile::BindInt() and BindFloat() return a handle to the value they parsed when the file
+ * was loaded, so reading a parameter in a loop is a pointer read instead of a lookup of its name and a conversion of
+ * its text. A reload of the file updates the value the handle points to. A parameter that is not in the file gives
+ * the default it was bound with.
+ */
+template<class T>
+class Param {
+public:
+	Param(): value(NULL), fallback() {}
+
+	Param(const T *value, const T &fallback = T()): value(value), fallback(fallback) {}
+
+	inline T get() const { return (value != NULL) ? *value : fallback; }
+
+	inline operator T() const { return get(); }
+
+	//! False if the parameter was not in the file and this gives its default
+	inline bool bound() const { return value != NULL; }
+
+private:
+	const T *value;
+	T fallback;
+};
+
+#endif /* PARAM_HPP_ */
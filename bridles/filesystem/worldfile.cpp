@@ -37,30 +37,31 @@
 #include <unistd.h>
 #include <math.h>
 #include <libgen.h>
+#include <sys/stat.h>
 
 //#define DEBUG
 #define VAR(V,init) __typeof(init) V=(init)
 #define FOR_EACH(I,C) for(VAR(I,(C).begin()),ite=(C).end();(I)!=ite;++(I))
-#define PRINT_ERR(m) fprintf( stderr, "\033[41merr\033[0m: "m" (%s %s)\n", __FILE__, __FUNCTION__)
-#define PRINT_ERR1(m,a) fprintf( stderr, "\033[41merr\033[0m: "m" (%s %s)\n", a, __FILE__, __FUNCTION__)    
-#define PRINT_ERR2(m,a,b) fprintf( stderr, "\033[41merr\033[0m: "m" (%s %s)\n", a, b, __FILE__, __FUNCTION__) 
-#define PRINT_ERR3(m,a,b,c) fprintf( stderr, "\033[41merr\033[0m: "m" (%s %s)\n", a, b, c, __FILE__, __FUNCTION__)
-#define PRINT_ERR4(m,a,b,c,d) fprintf( stderr, "\033[41merr\033[0m: "m" (%s %s)\n", a, b, c, d, __FILE__, __FUNCTION__)
-#define PRINT_ERR5(m,a,b,c,d,e) fprintf( stderr, "\033[41merr\033[0m: "m" (%s %s)\n", a, b, c, d, e, __FILE__, __FUNCTION__)
+#define PRINT_ERR(m) fprintf( stderr, "\033[41merr\033[0m: " m " (%s %s)\n", __FILE__, __FUNCTION__)
+#define PRINT_ERR1(m,a) fprintf( stderr, "\033[41merr\033[0m: " m " (%s %s)\n", a, __FILE__, __FUNCTION__)    
+#define PRINT_ERR2(m,a,b) fprintf( stderr, "\033[41merr\033[0m: " m " (%s %s)\n", a, b, __FILE__, __FUNCTION__) 
+#define PRINT_ERR3(m,a,b,c) fprintf( stderr, "\033[41merr\033[0m: " m " (%s %s)\n", a, b, c, __FILE__, __FUNCTION__)
+#define PRINT_ERR4(m,a,b,c,d) fprintf( stderr, "\033[41merr\033[0m: " m " (%s %s)\n", a, b, c, d, __FILE__, __FUNCTION__)
+#define PRINT_ERR5(m,a,b,c,d,e) fprintf( stderr, "\033[41merr\033[0m: " m " (%s %s)\n", a, b, c, d, e, __FILE__, __FUNCTION__)
 // Warning macros
-#define PRINT_WARN(m) printf( "\033[44mwarn\033[0m: "m" (%s %s)\n", __FILE__, __FUNCTION__)
-#define PRINT_WARN1(m,a) printf( "\033[44mwarn\033[0m: "m" (%s %s)\n", a, __FILE__, __FUNCTION__)    
-#define PRINT_WARN2(m,a,b) printf( "\033[44mwarn\033[0m: "m" (%s %s)\n", a, b, __FILE__, __FUNCTION__) 
-#define PRINT_WARN3(m,a,b,c) printf( "\033[44mwarn\033[0m: "m" (%s %s)\n", a, b, c, __FILE__, __FUNCTION__)
-#define PRINT_WARN4(m,a,b,c,d) printf( "\033[44mwarn\033[0m: "m" (%s %s)\n", a, b, c, d, __FILE__, __FUNCTION__)
-#define PRINT_WARN5(m,a,b,c,d,e) printf( "\033[44mwarn\033[0m: "m" (%s %s)\n", a, b, c, d, e, __FILE__, __FUNCTION__)
+#define PRINT_WARN(m) printf( "\033[44mwarn\033[0m: " m " (%s %s)\n", __FILE__, __FUNCTION__)
+#define PRINT_WARN1(m,a) printf( "\033[44mwarn\033[0m: " m " (%s %s)\n", a, __FILE__, __FUNCTION__)    
+#define PRINT_WARN2(m,a,b) printf( "\033[44mwarn\033[0m: " m " (%s %s)\n", a, b, __FILE__, __FUNCTION__) 
+#define PRINT_WARN3(m,a,b,c) printf( "\033[44mwarn\033[0m: " m " (%s %s)\n", a, b, c, __FILE__, __FUNCTION__)
+#define PRINT_WARN4(m,a,b,c,d) printf( "\033[44mwarn\033[0m: " m " (%s %s)\n", a, b, c, d, __FILE__, __FUNCTION__)
+#define PRINT_WARN5(m,a,b,c,d,e) printf( "\033[44mwarn\033[0m: " m " (%s %s)\n", a, b, c, d, e, __FILE__, __FUNCTION__)
 // Message macros
-#define PRINT_MSG(m) printf( "Stage: "m"\n" )
-#define PRINT_MSG1(m,a) printf( "Stage: "m"\n", a)
-#define PRINT_MSG2(m,a,b) printf( "Stage: "m"\n,", a, b )
-#define PRINT_MSG3(m,a,b,c) printf( "Stage: "m"\n", a, b, c )
-#define PRINT_MSG4(m,a,b,c,d) printf( "Stage: "m"\n", a, b, c, d )
-#define PRINT_MSG5(m,a,b,c,d,e) printf( "Stage: "m"\n", a, b, c, d, e )
+#define PRINT_MSG(m) printf( "Stage: " m "\n" )
+#define PRINT_MSG1(m,a) printf( "Stage: " m "\n", a)
+#define PRINT_MSG2(m,a,b) printf( "Stage: " m "\n,", a, b )
+#define PRINT_MSG3(m,a,b,c) printf( "Stage: " m "\n", a, b, c )
+#define PRINT_MSG4(m,a,b,c,d) printf( "Stage: " m "\n", a, b, c, d )
+#define PRINT_MSG5(m,a,b,c,d,e) printf( "Stage: " m "\n", a, b, c, d, e )
 // DEBUG macros
 #define PRINT_DEBUG(m)
 #define PRINT_DEBUG1(m,a)
@@ -96,6 +97,11 @@ Worldfile::Worldfile() :
     macros(),
     entities(),
     properties(),
+    retired(),
+    index(),
+    indexed(0),
+    modified(0),
+    size(0),
     filename(),
     unit_length( 1.0 ),
     unit_angle( M_PI / 180.0 )
@@ -108,6 +114,8 @@ Worldfile::Worldfile() :
 Worldfile::~Worldfile()
 {
     ClearProperties();
+    FOR_EACH( it, retired )
+        delete it->second;
     ClearMacros();
     ClearEntities();
     ClearTokens();
@@ -196,8 +204,8 @@ bool Worldfile::Load(const std::string& filename )
     }
 
     // Work out what the length units are
-    const std::string& unitl = ReadString(0, "unit_length", "m");
-    if(  unitl == "m")
+    const std::string& unitl = ReadString(0, "unit_length", " m ");
+    if(  unitl == " m ")
         this->unit_length = 1.0;
     else if( unitl == "cm")
         this->unit_length = 0.01;
@@ -213,10 +221,38 @@ bool Worldfile::Load(const std::string& filename )
 
     //printf( "f: %s\n", this->filename.c_str() );
 
+    Changed();
     return true;
 }
 
 
+///////////////////////////////////////////////////////////////////////////
+// Check whether the file was modified since it was loaded, and remember its
+// current state
+bool Worldfile::Changed()
+{
+    struct stat st;
+    if (stat(this->filename.c_str(), &st) != 0)
+        return false;
+    bool changed = (st.st_mtime != this->modified || st.st_size != this->size);
+    this->modified = st.st_mtime;
+    this->size = st.st_size;
+    return changed;
+}
+
+
+///////////////////////////////////////////////////////////////////////////
+// Load the file again if it was modified
+bool Worldfile::Reload()
+{
+    if (!Changed())
+        return false;
+    // copy, Load() assigns to this->filename
+    std::string name = this->filename;
+    return Load(name);
+}
+
+
 ///////////////////////////////////////////////////////////////////////////
 // Save world to file
 bool Worldfile::Save(const std::string& filename )
@@ -1286,11 +1322,14 @@ void Worldfile::DumpEntities()
 
 ///////////////////////////////////////////////////////////////////////////
 // Clear the property list
+// The properties are retired instead of deleted, so a reload can reuse them
 void Worldfile::ClearProperties()
 {
     FOR_EACH( it, properties )
-        delete it->second;	
+        retired[ it->first ] = it->second;
     properties.clear();
+    index.clear();
+    indexed = 0;
 }
 
 
@@ -1301,14 +1340,82 @@ CProperty* Worldfile::AddProperty(int entity, const char *name, int line)
     char key[128];
     snprintf( key, 127, "%d%s", entity, name );
 
-    CProperty *property = new CProperty( entity, name, line );
+    CProperty *property;
+    std::map<std::string,CProperty*>::iterator it = properties.find( key );
+    std::map<std::string,CProperty*>::iterator old = retired.find( key );
+    if( it != properties.end() ) // repeated in the file, the last one counts
+    {
+        property = it->second;
+    }
+    else if( old != retired.end() ) // loaded before, keep its handles valid
+    {
+        property = old->second;
+        retired.erase( old );
+    }
+    else
+    {
+        property = new CProperty( entity, name, line );
+    }
+    property->line = line;
+    property->used = false;
+    property->values.clear();
 
     properties[ key ] = property;
+    IndexProperty( property );
 
     return property;
 }
 
 
+///////////////////////////////////////////////////////////////////////////
+// Hash of the entity and the name of a property, FNV-1a
+uint32_t Worldfile::HashProperty(int entity, const char *name)
+{
+    uint32_t hash = 2166136261u ^ (uint32_t)entity;
+    hash *= 16777619u;
+    for( ; *name; name++ )
+    {
+        hash ^= (uint8_t)*name;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+
+///////////////////////////////////////////////////////////////////////////
+// Put a property in the hash index
+void Worldfile::IndexProperty(CProperty* property)
+{
+    if( 2 * (indexed + 1) > (int)index.size() )
+    {
+        // grow and put the properties in again
+        std::vector<CProperty*> old;
+        old.swap( index );
+        index.assign( old.empty() ? 64 : 2 * old.size(), (CProperty*)NULL );
+        indexed = 0;
+        FOR_EACH( it, old )
+            if( *it != NULL )
+                IndexProperty( *it );
+    }
+
+    uint32_t mask = index.size() - 1;
+    uint32_t i = HashProperty( property->entity, property->name.c_str() ) & mask;
+    while( index[i] != NULL )
+    {
+        if( index[i] == property )
+            return;
+        if( index[i]->entity == property->entity && index[i]->name == property->name )
+        {
+            index[i] = property;
+            return;
+        }
+        i = (i + 1) & mask;
+    }
+    index[i] = property;
+    indexed++;
+}
+
+
 ///////////////////////////////////////////////////////////////////////////
 // Add an property value
 void Worldfile::AddPropertyValue( CProperty* property, int index, int value_token)
@@ -1321,36 +1428,42 @@ void Worldfile::AddPropertyValue( CProperty* property, int index, int value_toke
         property->values.resize( index+1 );
 
     property->values[index] = value_token;
+    CacheValue( property, index, GetTokenValue( value_token ) );
 }
 
 
-
 ///////////////////////////////////////////////////////////////////////////
-// Get an property
-CProperty* Worldfile::GetProperty(int entity, const char *name)
+// Parse a value that is loaded or written, a tuple that becomes shorter keeps
+// the values after its end
+void Worldfile::CacheValue(CProperty* property, int index, const char *value)
 {
-    char key[128];
-    snprintf( key, 127, "%d%s", entity, name );
+    if( index >= (int)property->reals.size() )
+    {
+        property->reals.resize( index+1 );
+        property->integers.resize( index+1 );
+    }
+    property->reals[index] = atof( value );
+    property->integers[index] = atoi( value );
+}
 
-    //printf( "looking up key %s for entity %d name %s\n", key, entity, name );
 
-    static char cache_key[128] = { 0 }; 
-    static CProperty* cache_property = NULL;
 
-    if( strncmp( key, cache_key, 128 ) != 0 ) // different to last time
-    {		
-        strncpy( cache_key, key, 128 ); // remember for next time		
+///////////////////////////////////////////////////////////////////////////
+// Get an property
+CProperty* Worldfile::GetProperty(int entity, const char *name)
+{
+    if( index.empty() )
+        return NULL;
 
-        std::map<std::string,CProperty*>::iterator it = properties.find( key );	
-        if( it == properties.end() ) // not found
-            cache_property = NULL;
-        else
-            cache_property = it->second;		
+    uint32_t mask = index.size() - 1;
+    uint32_t i = HashProperty( entity, name ) & mask;
+    while( index[i] != NULL )
+    {
+        if( index[i]->entity == entity && index[i]->name == name )
+            return index[i];
+        i = (i + 1) & mask;
     }
-    //else
-    // printf( "cache hit with %s\n", cache_key );
-
-    return cache_property;
+    return NULL;
 }
 
 bool Worldfile::PropertyExists( int section, const char* token )
@@ -1370,6 +1483,7 @@ void Worldfile::SetPropertyValue( CProperty* property, int index, const char *va
     assert(index >= 0 && index < (int)property->values.size() );
     // Set the relevant value
     SetTokenValue( property->values[index], value);
+    CacheValue( property, index, value );
 }
 
 ///////////////////////////////////////////////////////////////////////////
@@ -1432,7 +1546,8 @@ int Worldfile::ReadInt(int entity, const char *name, int value)
     CProperty* property = GetProperty(entity, name);
     if (property == NULL )
         return value;
-    return atoi(GetPropertyValue(property, 0));
+    property->used = true;
+    return property->integers[0];
 }
 
 
@@ -1468,7 +1583,8 @@ double Worldfile::ReadFloat(int entity, const char *name, double value)
     CProperty* property = GetProperty(entity, name);
     if (property == NULL )
         return value;
-    return atof(GetPropertyValue(property, 0));
+    property->used = true;
+    return property->reals[0];
 }
 
 
@@ -1479,7 +1595,8 @@ double Worldfile::ReadLength(int entity, const char *name, double value)
     CProperty* property = GetProperty(entity, name);
     if (property == NULL )
         return value;
-    return atof(GetPropertyValue(property, 0)) * this->unit_length;
+    property->used = true;
+    return property->reals[0] * this->unit_length;
 }
 
 ///////////////////////////////////////////////////////////////////////////
@@ -1507,7 +1624,8 @@ double Worldfile::ReadAngle(int entity, const char *name, double value)
     CProperty* property = GetProperty(entity, name);
     if (property == NULL )
         return value;
-    return atof(GetPropertyValue(property, 0)) * this->unit_angle;
+    property->used = true;
+    return property->reals[0] * this->unit_angle;
 }
 
 ///////////////////////////////////////////////////////////////////////////
@@ -1608,7 +1726,8 @@ double Worldfile::ReadTupleFloat(int entity, const char *name,
     CProperty* property = GetProperty(entity, name);
     if (property == NULL )
         return value;
-    return atof(GetPropertyValue(property, index));
+    property->used = true;
+    return property->reals[index];
 }
 
 
@@ -1636,7 +1755,8 @@ double Worldfile::ReadTupleLength(int entity, const char *name,
     CProperty* property = GetProperty(entity, name);
     if (property == NULL )
         return value;
-    return atof(GetPropertyValue(property, index)) * this->unit_length;
+    property->used = true;
+    return property->reals[index] * this->unit_length;
 }
 
 
@@ -1667,7 +1787,8 @@ double Worldfile::ReadTupleAngle(int entity, const char *name,
     CProperty* property = GetProperty(entity, name);
     if (property == NULL)
         return value;
-    return atof(GetPropertyValue(property, index)) * this->unit_angle;
+    property->used = true;
+    return property->reals[index] * this->unit_angle;
 }
 
 
@@ -1689,6 +1810,25 @@ void Worldfile::WriteTupleAngle(int entity, const char *name,
 }
 
 
+///////////////////////////////////////////////////////////////////////////
+// Bind a handle to an int, it gives the default if the property does not exist
+Param<int> Worldfile::BindInt(int entity, const char *name, int value, int index)
+{
+    CProperty* property = GetProperty(entity, name);
+    if (property == NULL || index >= (int)property->integers.size())
+        return Param<int>(NULL, value);
+    property->used = true;
+    return Param<int>(&property->integers[index], value);
+}
 
 
-
+///////////////////////////////////////////////////////////////////////////
+// Bind a handle to a float, without unit conversion
+Param<double> Worldfile::BindFloat(int entity, const char *name, double value, int index)
+{
+    CProperty* property = GetProperty(entity, name);
+    if (property == NULL || index >= (int)property->reals.size())
+        return Param<double>(NULL, value);
+    property->used = true;
+    return Param<double>(&property->reals[index], value);
+}
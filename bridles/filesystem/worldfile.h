@@ -33,7 +33,11 @@
 #include <map>
 #include <string>
 #include <algorithm>
+#include <deque>
 #include <vector>
+#include <sys/types.h>
+
+#include "Param.hpp"
 
 /**
  * This code is from the Player/Stage simulator and is "contagious" license-wise. So, do not use it if you want to keep
@@ -60,13 +64,21 @@
 
     /// Flag set if property has been used
     bool used;
+
+    /// The values parsed with atof() and atoi() when they are loaded or written. A deque
+    /// does not move its elements when it grows, so the handles of BindFloat() and
+    /// BindInt() stay valid when a reload makes a tuple longer
+	 std::deque<double> reals;
+	 std::deque<int> integers;
 		
 	 CProperty( int entity, const char* name, int line ) :
 		entity(entity), 
 		name(name),
 		values(),
 		line(line),
-		used(false) {}
+		used(false),
+		reals(),
+		integers() {}
   };
 
 
@@ -94,6 +106,18 @@
 
 	 // Check for unused properties and print warnings
   public: bool WarnUnused();
+
+	 // Check whether the file was modified since it was loaded
+  public: bool Changed();
+
+	 // Load the file again if it was modified, returns true if it was. Handles
+	 // of BindInt() and BindFloat() then give the new values
+  public: bool Reload();
+
+	 // Bind a handle to a value, after which reading it is a pointer read
+  public: Param<int> BindInt(int entity, const char *name, int value, int index = 0);
+
+  public: Param<double> BindFloat(int entity, const char *name, double value, int index = 0);
 	 
 	 // Read a string
   public: const std::string ReadString(int entity, const char* name, const std::string& value);
@@ -275,6 +299,15 @@
   private: CProperty* AddProperty(int entity, const char *name, int line);
 	 // Add an property value.
   private: void AddPropertyValue( CProperty* property, int index, int value_token);
+
+	 // Hash of the entity and the name of a property
+  private: static uint32_t HashProperty(int entity, const char *name);
+
+	 // Put a property in the hash index, replacing one with the same entity and name
+  private: void IndexProperty(CProperty* property);
+
+	 // Parse a value that is loaded or written
+  private: void CacheValue(CProperty* property, int index, const char *value);
   
 	 // Get an property
   public: CProperty* GetProperty(int entity, const char *name);
@@ -373,6 +406,19 @@
 	 
 	 // Property list
   private: std::map<std::string,CProperty*> properties;	
+
+	 // Properties of the previous load, reused by a reload so handles to their
+	 // values stay valid, and kept until the destructor if they are gone
+  private: std::map<std::string,CProperty*> retired;
+
+	 // Hash index of the properties, open addressing with linear probing, the
+	 // size is a power of two and at least twice the number of properties
+  private: std::vector<CProperty*> index;
+  private: int indexed;
+
+	 // State of the file when it was loaded, to see whether it changed
+  private: time_t modified;
+  private: off_t size;
 	 
 	 // Name of the file we loaded
   public: std::string filename;
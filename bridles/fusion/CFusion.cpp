@@ -48,9 +48,7 @@ CFusion::CFusion(): d_artFeatureA(false, true, true),
 	d_artReward.setNetworkReliability(0.9);
 
 	/***** Fusion *****/
-	d_artVectorLaserBlob[0] = &d_artFeatureA;
-	d_artVectorLaserBlob[1] = &d_artFeatureB;
-	d_artVectorLaserBlob[2]	= &d_artReward;
+	linkNetworks();
 
 	/***** Learn input *****/
 //	d_wallInput = "wall.vec";
@@ -59,12 +57,50 @@ CFusion::CFusion(): d_artFeatureA(false, true, true),
 //	d_blobRobotInput = "blobRobot.vec";
 }
 
+/**
+ * The networks and the map field are copied by value. Assigning to a snapshot that was used before keeps the memory of
+ * its prototypes, so publishing a learned model to the same snapshot does not allocate once it stopped growing.
+ */
+CFusion::CFusion(const CFusion &other): d_artFeatureA(other.d_artFeatureA),
+		d_artFeatureB(other.d_artFeatureB),
+		d_artReward(other.d_artReward),
+		d_fusionArtMap(other.d_fusionArtMap),
+		d_artVectorLaserBlob(3)
+{
+	linkNetworks();
+}
+
+CFusion & CFusion::operator=(const CFusion &other)
+{
+	if (this == &other) return *this;
+	d_artFeatureA = other.d_artFeatureA;
+	d_artFeatureB = other.d_artFeatureB;
+	d_artReward = other.d_artReward;
+	d_fusionArtMap = other.d_fusionArtMap;
+	linkNetworks();
+	return *this;
+}
+
+void CFusion::linkNetworks()
+{
+	d_artVectorLaserBlob[0] = &d_artFeatureA;
+	d_artVectorLaserBlob[1] = &d_artFeatureB;
+	d_artVectorLaserBlob[2]	= &d_artReward;
+	d_fusionArtMap.setArtNetworks(&d_artVectorLaserBlob);
+}
+
 void CFusion::setVigilance(float featureA_vigilance, float featureB_vigilance)
 {
 	d_artFeatureA.setVigilance(featureA_vigilance);
 	d_artFeatureB.setVigilance(featureB_vigilance);
 }
 
+int CFusion::getMemoryUsage() const
+{
+	return d_artFeatureA.getMemoryUsage() + d_artFeatureB.getMemoryUsage() + d_artReward.getMemoryUsage() +
+			d_fusionArtMap.getMemoryUsage();
+}
+
 /**
  * Classification of an object using two types of sensor data available. The "happinessVector"
  * can be used for supervised or unsupervised learning. For example, if it is somehow
@@ -124,6 +160,8 @@ ART_DISTRIBUTED_CLASSES* CFusion::classify(ART_ASPECT* featureA,
 		output->push_back(in0);
 		output->push_back(in1);
 		output->push_back(in2);
+		// every recognition of the fusion stage takes this path, the classes were never freed
+		delete &classes;
 		// set vigilance back, 0?
 		d_artFeatureB.setVigilance(featureB_vig);
 		d_artFeatureA.setVigilance(featureA_vig);
@@ -136,6 +174,29 @@ ART_DISTRIBUTED_CLASSES* CFusion::classify(ART_ASPECT* featureA,
 	return output;
 }
 
+void CFusion::classifyBatch(const ART_TYPE *featuresA, int sizeA, const ART_TYPE *featuresB, int sizeB,
+		const ART_TYPE *rewards, int sizeRewards, int count, bool search, int *classes)
+{
+	ART_ASPECT featureA(sizeA), featureB(sizeB), reward(sizeRewards);
+	for (int x = 0; x < count; ++x)
+	{
+		copy(featuresA + x * sizeA, featuresA + (x + 1) * sizeA, featureA.begin());
+		copy(featuresB + x * sizeB, featuresB + (x + 1) * sizeB, featureB.begin());
+		if(rewards != NULL)
+			copy(rewards + x * sizeRewards, rewards + (x + 1) * sizeRewards, reward.begin());
+
+		ART_DISTRIBUTED_CLASSES* output = classify(&featureA, &featureB, rewards != NULL ? &reward : NULL, search);
+		for (int i = 0; i < 3; ++i)
+		{
+			ART_DISTRIBUTED_CLASS *artClass = (i < output->size()) ? (*output)[i] : NULL;
+			classes[3 * x + i] = (artClass != NULL && !artClass->empty()) ? (int)artClass->at(0) : -1;
+		}
+		for (int i = 0; i < output->size(); ++i)
+			delete (*output)[i];
+		delete output;
+	}
+}
+
 bool CFusion::isObject(vector<ART_TYPE>* featureA, vector<ART_TYPE>* featureB,
 		vector<ART_TYPE>* rewards, bool search)
 {
@@ -172,12 +233,13 @@ bool CFusion::isObject(vector<ART_TYPE>* featureA, vector<ART_TYPE>* featureB,
 		output->push_back(in0);
 		output->push_back(in1);
 		output->push_back(in2);
+		delete classes;
 		d_artFeatureB.setVigilance(featureB_vig);
 		d_artFeatureA.setVigilance(featureA_vig);
 	}
 	else
 		output = d_fusionArtMap.classify(inputVector);
-	bool isObject = d_artReward.getPrototype((int)output->at(2)->at(0))->at(0)==1;
+	bool isObject = d_artReward.getPrototype((int)output->at(2)->at(0))[0]==1;
 	for (int x = 0; x < output->size(); ++x)
 		delete (*output)[x];
 	delete output;
@@ -225,7 +287,7 @@ void CFusion::learn(int imgWidth, int imgHeight)
 	fprintf(stdout,"BlobWallvector size:%i\n",blobWallVector->size());
 	happynessVector->push_back(0);
 	vector<vector<ART_TYPE>*>* output = classify(wallVector,  blobWallVector,  happynessVector,  search);
-	printf("Is Object: %s\n", d_artReward.getPrototype((int)output->at(2)->at(0))->at(0)==0?"no":"yes");
+	printf("Is Object: %s\n", d_artReward.getPrototype((int)output->at(2)->at(0))[0]==0?"no":"yes");
 	for (int x = 0; x < output->size(); ++x)
 		delete (*output)[x];
 	delete output;
@@ -243,7 +305,7 @@ void CFusion::learn(int imgWidth, int imgHeight)
 	(*happynessVector)[0] = 1;
 
 	output = classify(robotVector,  blobRobotVector,  happynessVector,  search);
-	printf("Is Object: %s\n", d_artReward.getPrototype((int)output->at(2)->at(0))->at(0)==0?"no":"yes");
+	printf("Is Object: %s\n", d_artReward.getPrototype((int)output->at(2)->at(0))[0]==0?"no":"yes");
 	for (int x = 0; x < output->size(); ++x)
 		delete (*output)[x];
 	delete output;
@@ -252,7 +314,7 @@ void CFusion::learn(int imgWidth, int imgHeight)
 	happynessVector = NULL;
 
 	output = classify(robotVector,  blobRobotVector,  happynessVector,  true);
-	//printf("Test Is Object: %s\n", d_artHappyness.getPrototype((int)output->at(2)->at(0))->at(0)==0?"no":"yes");
+	//printf("Test Is Object: %s\n", d_artHappyness.getPrototype((int)output->at(2)->at(0))[0]==0?"no":"yes");
 	for (int x = 0; x < output->size(); ++x)
 		delete (*output)[x];
 	delete output;
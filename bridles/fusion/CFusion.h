@@ -36,6 +36,10 @@ class CFusion {
 public:
 	CFusion();
 
+	//! A copy of all networks, a snapshot that classifies while the original learns (see CFusionStage)
+	CFusion(const CFusion &other);
+	CFusion & operator=(const CFusion &other);
+
 	/**
 	 * Using three given vectors, the first two will be used as the input pattern, while the last one
 	 * will be used as the output pattern. The "search" operator defines if there will only be searched
@@ -54,6 +58,25 @@ public:
 	 */
 	ART_VIEW* classify(ART_ASPECT* featureA, ART_ASPECT* featureB, ART_ASPECT* rewards, bool search);
 
+	/**
+	 * Calls classify() for count samples, for example recorded laser and blob features for offline training. The
+	 * features of sample i start at featuresA + i*sizeA, featuresB + i*sizeB and rewards + i*sizeRewards, rewards
+	 * can be NULL. The classes of the three networks of sample i are written to classes[3*i] up to classes[3*i+2],
+	 * -1 if a network did not return one. The samples go one after the other through the map field, to evaluate
+	 * only one of the feature networks on many cores see Art::classifyBatch().
+	 */
+	void classifyBatch(const ART_TYPE *featuresA, int sizeA, const ART_TYPE *featuresB, int sizeB,
+			const ART_TYPE *rewards, int sizeRewards, int count, bool search, int *classes);
+
+	//! The networks of featureA, featureB and the rewards
+	inline Art& getFeatureA() 	{ return d_artFeatureA; }
+	inline Art& getFeatureB() 	{ return d_artFeatureB; }
+	inline Art& getRewards() 	{ return d_artReward; }
+	inline ArtMap& getArtMap() 	{ return d_fusionArtMap; }
+
+	//! Bytes of the prototypes of the three networks and of the map field
+	int getMemoryUsage() const;
+
 	/**
 	 * Set vigilance, first laser, than blob. The happiness vector does not need a vigilance setting,
 	 * because it is used as teaching signal.
@@ -67,7 +90,7 @@ public:
 	void loadMemory(std::string filename);
 
 	//! Make happiness network available
-	inline PROTOTYPE *getHappinessPrototype(int id) { return d_artReward.getPrototype(id); };
+	inline const ART_TYPE *getHappinessPrototype(int id) { return d_artReward.getPrototype(id); };
 protected:
 	bool isObject(std::vector<ART_TYPE>* featureA, std::vector<ART_TYPE>* featureB, std::vector<ART_TYPE>* rewards,
 			bool search);
@@ -75,6 +98,9 @@ protected:
 	//! Read a network from file
 	void readInput(std::string filenameInput, std::vector<ART_TYPE>* inputVector);
 
+	//! Let the map field refer to the networks of this CFusion
+	void linkNetworks();
+
 //	void learn(int imgWidth, int imgHeight);
 
 	Art d_artFeatureA;
@@ -9,6 +9,9 @@
  */
 
 #include "art.h"
+#include "artFile.h"
+#include <cstdio>
+#include <cstring>
 
 using namespace std;
 
@@ -21,8 +24,20 @@ using namespace std;
  */
 Art::Art(bool matchTrack, bool useInputComplement, bool useWTA ): d_F1(0),
 		d_F2(0),
-		d_vigilanceHist(0)
+		d_F2Stride(ART_ROW_ALIGN),
+		d_F2Size(0),
+		d_F2Norm(0),
+		d_vigilanceHist(0),
+		d_curPTActCount(0),
+		d_resonance(0),
+		d_pruned(false),
+		d_prunedAt(0),
+		d_searched(false),
+		d_pruning(false),
+		d_F2UniformSize(0)
 {
+	d_indexDim[0] = 0;
+	d_indexDim[1] = 1;
 	d_matchTrack 			= matchTrack;			// Match-tracking for the use in an ARTMAP
 	d_useInputComplement 	= useInputComplement;	// Complement input coding or single input vector
 	d_useWTA				= true;					// Distributed / Winner Take All output class
@@ -60,6 +75,104 @@ ART_DISTRIBUTED_CLASS* Art::classifyInput(ART_ASPECT &input)
 	return output;
 }
 
+/**
+ * Without learning, so while only testing for a match, the network is the same for every input and the inputs are
+ * spread over the threads. While learning every input changes the network for the next, then they are classified one
+ * after the other with classifyInput().
+ */
+void Art::classifyBatch(const ART_TYPE *inputs, int count, int size, int *choices, ART_TYPE *resonances, int threads)
+{
+	if(!d_testMatch)
+	{
+		std::vector<ART_TYPE> input(size, 0);
+		for (int x = 0; x < count; ++x)
+		{
+			copy(inputs + x * size, inputs + (x + 1) * size, input.begin());
+			ART_DISTRIBUTED_CLASS* output = classifyInput(input);
+			choices[x] = (output != NULL && !output->empty()) ? (int)output->at(0) : -1;
+			if(resonances != NULL)
+				resonances[x] = (output != NULL) ? d_resonance : 0;
+			delete output;
+		}
+		return;
+	}
+
+	// the vigilance matchTrack() uses for a first search
+	float vigilance = searchVigilance();
+
+	if(threads > count)
+		threads = count;
+	if(threads < 1)
+		threads = 1;
+	std::vector<BatchRange> ranges(threads);
+	for (int t = 0; t < threads; ++t)
+	{
+		BatchRange &range 	= ranges[t];
+		range.art 			= this;
+		range.inputs 		= inputs;
+		range.size 			= size;
+		range.first 		= (long long)count * t / threads;
+		range.last 			= (long long)count * (t + 1) / threads;
+		range.vigilance 	= vigilance;
+		range.choices 		= choices;
+		range.resonances 	= resonances;
+		range.started 		= false;
+	}
+	// the first range is done by the caller
+	for (int t = 1; t < threads; ++t)
+		ranges[t].started = pthread_create(&ranges[t].thread, NULL, &Art::searchBatchThread, &ranges[t]) == 0;
+	searchBatchThread(&ranges[0]);
+	for (int t = 1; t < threads; ++t)
+	{
+		if(ranges[t].started)
+			pthread_join(ranges[t].thread, NULL);
+		else
+			searchBatchThread(&ranges[t]);
+	}
+}
+
+void* Art::searchBatchThread(void *batch)
+{
+	BatchRange *range = (BatchRange*)batch;
+	range->art->searchBatch(*range);
+	return NULL;
+}
+
+//! What matchTrack() does while only testing for a match, for the inputs of the range
+void Art::searchBatch(const BatchRange &range) const
+{
+	std::vector<ART_TYPE> input;
+	std::vector<PROTOTYPE_Activation> activations;
+	std::vector<int> candidates;
+	for (int x = range.first; x < range.last; ++x)
+	{
+		createF1(range.inputs + x * range.size, range.size, input);
+		float inputSize = range.size;
+		activations.clear();
+		computeActivations(input, inputSize, activations, candidates, range.vigilance);
+
+		int choice = -1;
+		ART_TYPE resonance = 0;
+		if(d_useWTA)
+		{
+			make_heap(activations.begin(), activations.end(), ComparePrototype());
+			for (int left = activations.size(); left > 0; --left)
+			{
+				if(activations[0].resonance >= range.vigilance)
+				{
+					choice = activations[0].id;
+					resonance = activations[0].resonance;
+					break;
+				}
+				pop_heap(activations.begin(), activations.begin() + left, ComparePrototype());
+			}
+		}
+		range.choices[x] = choice;
+		if(range.resonances != NULL)
+			range.resonances[x] = resonance;
+	}
+}
+
 /**
  * Basically just copies the input vector to F1. However, in the case of complement
  * encoding, F1 is made twice as large in this way:
@@ -70,14 +183,56 @@ ART_DISTRIBUTED_CLASS* Art::classifyInput(ART_ASPECT &input)
  */
 void Art::createF1(std::vector<ART_TYPE> &input)
 {
-	d_F1.clear();
+	createF1(input.empty() ? NULL : &input[0], input.size(), d_F1);
+}
+
+void Art::createF1(const ART_TYPE *input, int size, std::vector<ART_TYPE> &F1) const
+{
+	F1.clear();
 
-	for (int x = 0; x < input.size(); ++x)
-		d_F1.push_back(input[x]);
+	for (int x = 0; x < size; ++x)
+		F1.push_back(input[x]);
 
 	if(d_useInputComplement)
-		for (int x = 0; x < input.size(); ++x)
-			d_F1.push_back(1-input[x]);
+		for (int x = 0; x < size; ++x)
+			F1.push_back(1-input[x]);
+}
+
+/**
+ * The fuzzy intersection |A n W| of n values, with four partial sums so the compiler can keep them in the lanes of a
+ * vector register, it is the inner loop of signalToProtoType().
+ */
+static inline ART_TYPE fuzzyAnd(const ART_TYPE *A, const ART_TYPE *W, int n)
+{
+	ART_TYPE sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0;
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		sum0 += fabs(min(A[i], W[i]));
+		sum1 += fabs(min(A[i+1], W[i+1]));
+		sum2 += fabs(min(A[i+2], W[i+2]));
+		sum3 += fabs(min(A[i+3], W[i+3]));
+	}
+	for (; i < n; ++i)
+		sum0 += fabs(min(A[i], W[i]));
+	return (sum0 + sum1) + (sum2 + sum3);
+}
+
+//! As fuzzyAnd() with the complement 1-A of the input, computed on the fly
+static inline ART_TYPE fuzzyAndComplement(const ART_TYPE *A, const ART_TYPE *W, int n)
+{
+	ART_TYPE sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0;
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		sum0 += fabs(min(1 - A[i], W[i]));
+		sum1 += fabs(min(1 - A[i+1], W[i+1]));
+		sum2 += fabs(min(1 - A[i+2], W[i+2]));
+		sum3 += fabs(min(1 - A[i+3], W[i+3]));
+	}
+	for (; i < n; ++i)
+		sum0 += fabs(min(1 - A[i], W[i]));
+	return (sum0 + sum1) + (sum2 + sum3);
 }
 
 /* The Signals to the prototype (or committed coding node)
@@ -101,96 +256,320 @@ void Art::createF1(std::vector<ART_TYPE> &input)
 void Art::signalToProtoType()
 {
 	// Clear previous activations
-	while (!d_curPTAct.empty())
+	clearActivations();
+	d_prunedAt = searchVigilance();
+	d_pruned = computeActivations(d_F1, d_inputSize, d_curPTAct, d_candidates, d_prunedAt);
+	d_curPTActCount = d_curPTAct.size();
+	make_heap(d_curPTAct.begin(), d_curPTAct.end(), ComparePrototype());
+}
+
+/**
+ * The pass of signalToProtoType() over F2 for one F1, it does not change the network, so classifyBatch() runs it for
+ * several inputs at the same time. The input size can grow, as d_inputSize does for prototypes larger than the input.
+ * Returns true if the prototypes were pruned for the given vigilance, then the ones that cannot reach it are missing.
+ */
+bool Art::computeActivations(const std::vector<ART_TYPE> &input, float &inputSize,
+		std::vector<PROTOTYPE_Activation> &activations, std::vector<int> &candidates, float vigilance) const
+{
+	const ART_TYPE *F1 = input.empty() ? NULL : &input[0];
+	int sizeF1 = input.size();
+
+	if(canPrune(input, vigilance))
 	{
-		delete d_curPTAct.top();
-		d_curPTAct.pop();
+		pruneCandidates(F1, sizeF1/2, vigilance, candidates);
+		for (int c = 0; c < candidates.size(); ++c)
+			evaluatePrototype(candidates[c], F1, sizeF1, inputSize, activations);
+		return true;
 	}
 
 	// iterate over all high-level nodes in F2
-	for (int x = 0; x < d_F2.size(); ++x)
-	{
-		// monkey out of the sleeve: a node d_F2[i] IS its weight vector
-		std::vector<ART_TYPE>* Wj = d_F2[x];
-		ART_TYPE Tj 	= 0;
-		ART_TYPE diff	= 0;
-		ART_TYPE sumWj 	= 0;
+	for (int x = 0; x < d_F2Size.size(); ++x)
+		evaluatePrototype(x, F1, sizeF1, inputSize, activations);
+	return false;
+}
 
-		// Align for different size with complement coding
-		if(d_useInputComplement)
+//! Adds the activation of prototype x to activations if it is active enough
+void Art::evaluatePrototype(int x, const ART_TYPE *F1, int sizeF1, float &inputSize,
+		std::vector<PROTOTYPE_Activation> &activations) const
+{
+	// monkey out of the sleeve: a node d_F2[i] IS its weight vector
+	const ART_TYPE *Wj = &d_F2[x * d_F2Stride];
+	int sizeWj 		= d_F2Size[x];
+	ART_TYPE Tj 	= 0;
+	ART_TYPE diff	= 0;
+	ART_TYPE sumWj 	= d_F2Norm[x];
+
+	// Align for different size with complement coding
+	if(d_useInputComplement)
+	{
+		// the prototypes normally have the size of the input, then the halves are aligned already and the
+		// complement half of F1 is not needed, it follows from the input half
+		if(sizeWj == sizeF1)
 		{
-			if(Wj->size() <= d_F1.size())
-			{
-				int sizeDiff = (d_F1.size() - Wj->size())/2;
-				for (int i = 0; i < d_F1.size()-sizeDiff; ++i)
-				{
-					int indexF1 = i;
-					if(i >= Wj->size()/2)
-						indexF1 = (d_F1.size()/2) + (i-(Wj->size()/2));
-
-					if(i < Wj->size())
-						diff 	+= fabs(min(d_F1[indexF1],(*Wj)[i]));
-					// Last half of complement is for the shortest always the highest
-					else
-						diff 	+= fabs(d_F1[indexF1]);
-				}
-			}
-			else
+			int half = sizeF1/2;
+			diff = fuzzyAnd(F1, Wj, half) + fuzzyAndComplement(F1, Wj + half, half);
+		}
+		else if(sizeWj < sizeF1)
+		{
+			int sizeDiff = (sizeF1 - sizeWj)/2;
+			for (int i = 0; i < sizeF1-sizeDiff; ++i)
 			{
-				int sizeDiff = (Wj->size() - d_F1.size())/2;
-				for (int i = 0; i < Wj->size()-sizeDiff; ++i)
-				{
-					// The network can have different input sizes
-					int indexF2 = i;
-					if(i >= d_F1.size()/2)
-						indexF2 = (Wj->size()/2) + (i-(d_F1.size()/2));
-
-					if(i < d_F1.size())
-						diff 	+= fabs(min(d_F1[i],(*Wj)[indexF2]));
-					else
-						diff 	+=  fabs((*Wj)[indexF2]);
+				int indexF1 = i;
+				if(i >= sizeWj/2)
+					indexF1 = (sizeF1/2) + (i-(sizeWj/2));
 
-					if(d_inputSize <= i)
-						d_inputSize = i+1;
-				}
+				if(i < sizeWj)
+					diff 	+= fabs(min(F1[indexF1],Wj[i]));
+				// Last half of complement is for the shortest always the highest
+				else
+					diff 	+= fabs(F1[indexF1]);
 			}
 		}
-		// without complement coding
 		else
 		{
-			// if the network is too large for the inputs, weights will be neglected
-			// if the input is larger than the network, inputs will be disregarded (but counted: diff is smaller)
-			for (int i = 0; i < Wj->size(); ++i)
+			int sizeDiff = (sizeWj - sizeF1)/2;
+			for (int i = 0; i < sizeWj-sizeDiff; ++i)
 			{
 				// The network can have different input sizes
-				if(i < d_F1.size())
-					diff 	+= fabs((d_F1[i]-(*Wj)[i]));
-				else if(i > d_inputSize)
-					d_inputSize = i; // only set/increase d_inputSize, diff becomes smaller!
+				int indexF2 = i;
+				if(i >= sizeF1/2)
+					indexF2 = (sizeWj/2) + (i-(sizeF1/2));
+
+				if(i < sizeF1)
+					diff 	+= fabs(min(F1[i],Wj[indexF2]));
+				else
+					diff 	+=  fabs(Wj[indexF2]);
+
+				if(inputSize <= i)
+					inputSize = i+1;
 			}
-			diff = d_inputSize/(diff+1.0);
 		}
+	}
+	// without complement coding
+	else
+	{
+		// if the network is too large for the inputs, weights will be neglected
+		// if the input is larger than the network, inputs will be disregarded (but counted: diff is smaller)
+		for (int i = 0; i < sizeWj; ++i)
+		{
+			// The network can have different input sizes
+			if(i < sizeF1)
+				diff 	+= fabs((F1[i]-Wj[i]));
+			else if(i > inputSize)
+				inputSize = i; // only set/increase inputSize, diff becomes smaller!
+		}
+		diff = inputSize/(diff+1.0);
+	}
 
-		for (int i = 0; i < Wj->size(); ++i)
-			sumWj 	+= fabs((*Wj)[i]);
+	if(d_ACT == DEFAULT_ARTMAP)
+		Tj = diff + (1 - d_alpha) * (inputSize - sumWj);
 
-		if(d_ACT == DEFAULT_ARTMAP)
-			Tj = diff + (1 - d_alpha) * (d_inputSize - sumWj);
+	if(d_ACT == FUZZY_ARTMAP)
+		Tj = diff / (d_alpha + sumWj);
 
-		if(d_ACT == FUZZY_ARTMAP)
-			Tj = diff / (d_alpha + sumWj);
+	if((d_ACT == DEFAULT_ARTMAP && Tj > d_alpha*inputSize) || d_ACT == FUZZY_ARTMAP || !d_useInputComplement)
+	{
+		PROTOTYPE_Activation pr;
+		pr.id = x;
+		pr.T = Tj;
+		pr.resonance = diff/inputSize;
+		activations.push_back(pr);
+	}
+	//else
+	//	cout << "Prototype activation Tj lower then " << d_alpha*inputSize << endl;
+}
 
-		if((d_ACT == DEFAULT_ARTMAP && Tj > d_alpha*d_inputSize) || d_ACT == FUZZY_ARTMAP || !d_useInputComplement)
+void Art::addPrototype(const ART_TYPE *weights, int size)
+{
+	int count = d_F2Size.size();
+	if(size > d_F2Stride)
+	{
+		// rare, only when an input is larger than all before, the rows move to the larger stride
+		int stride = ((size + ART_ROW_ALIGN - 1) / ART_ROW_ALIGN) * ART_ROW_ALIGN;
+		vector<ART_TYPE> F2(count * stride, 0);
+		for (int x = 0; x < count; ++x)
+			copy(d_F2.begin() + x * d_F2Stride, d_F2.begin() + x * d_F2Stride + d_F2Size[x], F2.begin() + x * stride);
+		d_F2.swap(F2);
+		d_F2Stride = stride;
+	}
+	d_F2.resize((count + 1) * d_F2Stride, 0);
+	copy(weights, weights + size, d_F2.begin() + count * d_F2Stride);
+	d_F2Size.push_back(size);
+	d_F2Norm.push_back(0);
+	updateNorm(count);
+
+	if(count == 0)
+		d_F2UniformSize = size;
+	else if(size != d_F2UniformSize)
+		d_F2UniformSize = -1;
+	if(d_pruning)
+	{
+		d_indexBox.resize(4 * (count + 1), -1);
+		indexPrototype(count);
+	}
+}
+
+void Art::updateNorm(int id)
+{
+	const ART_TYPE *Wj = getPrototype(id);
+	ART_TYPE sumWj = 0;
+	for (int i = 0; i < d_F2Size[id]; ++i)
+		sumWj 	+= fabs(Wj[i]);
+	d_F2Norm[id] = sumWj;
+}
+
+void Art::setPruning(bool pruning, int dim0, int dim1)
+{
+	d_pruning 		= pruning;
+	d_indexDim[0] 	= dim0;
+	d_indexDim[1] 	= dim1;
+	d_indexCells.clear();
+	d_indexBox.clear();
+	if(pruning)
+	{
+		d_indexCells.resize(ART_INDEX_CELLS * ART_INDEX_CELLS);
+		d_indexBox.resize(4 * d_F2Size.size(), -1);
+		for (int x = 0; x < d_F2Size.size(); ++x)
+			indexPrototype(x);
+	}
+}
+
+int Art::indexCell(ART_TYPE value) const
+{
+	int cell = (int)floor(value * ART_INDEX_CELLS);
+	if(!(cell >= 0))
+		return 0;
+	return min(cell, ART_INDEX_CELLS - 1);
+}
+
+/**
+ * Puts the box of the prototype in the cells of the grid it overlaps. The box is [u, 1-v] for a prototype (u, v),
+ * learning only lets it grow, so usually it is only added to more cells.
+ */
+void Art::indexPrototype(int id)
+{
+	if(!d_pruning || d_F2UniformSize < 0)
+		return;
+	const ART_TYPE *Wj = getPrototype(id);
+	int half = d_F2Size[id] / 2;
+	int box[4];
+	for (int d = 0; d < 2; ++d)
+	{
+		if(d_indexDim[d] >= half)
+			return;
+		box[d] 		= indexCell(Wj[d_indexDim[d]]);
+		box[d + 2] 	= indexCell(1 - Wj[half + d_indexDim[d]]);
+	}
+	int *old = &d_indexBox[4 * id];
+	if(old[0] >= 0 && equal(box, box + 4, old))
+		return;
+	if(old[0] >= 0)
+		for (int cx = old[0]; cx <= old[2]; ++cx)
+			for (int cy = old[1]; cy <= old[3]; ++cy)
+			{
+				vector<int> &cell = d_indexCells[cx * ART_INDEX_CELLS + cy];
+				cell.erase(remove(cell.begin(), cell.end(), id), cell.end());
+			}
+	for (int cx = box[0]; cx <= box[2]; ++cx)
+		for (int cy = box[1]; cy <= box[3]; ++cy)
+			d_indexCells[cx * ART_INDEX_CELLS + cy].push_back(id);
+	copy(box, box + 4, old);
+}
+
+bool Art::canPrune(const std::vector<ART_TYPE> &input, float vigilance) const
+{
+	int half = input.size() / 2;
+	if(!d_pruning || !d_useInputComplement || vigilance <= 0 || d_F2UniformSize != input.size()
+			|| max(d_indexDim[0], d_indexDim[1]) >= half)
+		return false;
+	// the distance to a box only gives |A n Wj| for inputs in [0,1]
+	for (int i = 0; i < half; ++i)
+		if(!(input[i] >= 0 && input[i] <= 1))
+			return false;
+	return true;
+}
+
+/**
+ * The prototypes of which the box lies close enough to the input A to reach the vigilance, in no particular order,
+ * the heap orders them anyway.
+ * |A n Wj| = |Wj| - d(A, box j), with d the L1 distance, so the resonance |A n Wj|/M reaches the vigilance only if
+ * d(A, box j) <= |Wj| - vigilance*M. The distance along one dimension is not larger, which gives cells of the grid,
+ * then the distance is summed until it is too large.
+ */
+void Art::pruneCandidates(const ART_TYPE *A, int half, float vigilance, std::vector<int> &candidates) const
+{
+	candidates.clear();
+	ART_TYPE margin = ART_PRUNE_MARGIN * half;
+	ART_TYPE reach = half * (1 - vigilance) + margin;
+	int x0 = indexCell(A[d_indexDim[0]] - reach), x1 = indexCell(A[d_indexDim[0]] + reach);
+	int y0 = indexCell(A[d_indexDim[1]] - reach), y1 = indexCell(A[d_indexDim[1]] + reach);
+	for (int cx = x0; cx <= x1; ++cx)
+		for (int cy = y0; cy <= y1; ++cy)
 		{
-			PROTOTYPE_Activation *pr = new PROTOTYPE_Activation;
-			pr->id = x;
-			pr->T = Tj;
-			pr->resonance = diff/d_inputSize;
-			d_curPTAct.push(pr);
+			const vector<int> &cell = d_indexCells[cx * ART_INDEX_CELLS + cy];
+			for (int c = 0; c < cell.size(); ++c)
+			{
+				int id = cell[c];
+				// a box is in all cells it overlaps, take it only in the first of those that is searched
+				const int *box = &d_indexBox[4 * id];
+				if(cx != max(box[0], x0) || cy != max(box[1], y0))
+					continue;
+				const ART_TYPE *Wj = getPrototype(id);
+				ART_TYPE bound = d_F2Norm[id] - vigilance * half + margin;
+				ART_TYPE distance = 0;
+				for (int i = 0; i < half && distance <= bound; ++i)
+					distance += max(Wj[i] - A[i], (ART_TYPE)0) + max(A[i] + Wj[half + i] - 1, (ART_TYPE)0);
+				if(distance <= bound)
+					candidates.push_back(id);
+			}
 		}
-		//else
-		//	cout << "Prototype activation Tj lower then " << d_alpha*d_inputSize << endl;
-	}
+}
+
+/**
+ * After pruning the heap misses the prototypes that could not reach the vigilance of the search. If the vigilance
+ * drops below it, here by match tracking, all are evaluated again, and the ones a search before would have passed
+ * already are removed again.
+ */
+void Art::restoreActivations()
+{
+	bool hasTop = !noActivation();
+	PROTOTYPE_Activation top;
+	if(hasTop)
+		top = topActivation();
+	d_curPTAct.clear();
+	d_pruned = computeActivations(d_F1, d_inputSize, d_curPTAct, d_candidates, 0);
+	d_curPTActCount = d_curPTAct.size();
+	make_heap(d_curPTAct.begin(), d_curPTAct.end(), ComparePrototype());
+	if(!d_searched)
+		return;
+	if(!hasTop)
+		d_curPTActCount = 0;
+	while (!noActivation() && ComparePrototype()(top, topActivation()))
+		popActivation();
+}
+
+float Art::searchVigilance() const
+{
+	float vigilance = d_vigilance;
+	if(d_vigilanceHistorySize > 0)
+		vigilance = getAVGVigilance();
+	if(d_matchTrack)
+		vigilance = 0;
+	return vigilance;
+}
+
+void Art::popActivation()
+{
+	pop_heap(d_curPTAct.begin(), d_curPTAct.begin() + d_curPTActCount, ComparePrototype());
+	--d_curPTActCount;
+}
+
+void Art::clearActivations()
+{
+	d_curPTAct.clear();
+	d_curPTActCount = 0;
+	d_pruned = false;
+	d_searched = false;
 }
 
 void Art::setVigilanceHistorySize(int vigilanceHistorySize)
@@ -212,7 +591,7 @@ void Art::addToVigilanceHistory(ART_TYPE vig)
 		d_currVHist = 0;
 }
 
-ART_TYPE Art::getAVGVigilance()
+ART_TYPE Art::getAVGVigilance() const
 {
 	ART_TYPE avg = 0;
 	for (int x = 0; x < d_vigilanceHist.size(); ++x)
@@ -228,56 +607,59 @@ ART_TYPE Art::getAVGVigilance()
  * Does the actual updating.
  */
 void Art::updateWeights() {
-	if(d_curPTAct.empty()) return;
+	if(noActivation()) return;
 
 	// Last node is send as winning node, update
 	if(!d_testMatch)
 	{
-		PROTOTYPE_Activation *protA = d_curPTAct.top();
-		PROTOTYPE *prot 			= (d_F2[protA->id]);
+		const PROTOTYPE_Activation *protA = &topActivation();
+		ART_TYPE *prot 				= &d_F2[protA->id * d_F2Stride];
+		int size 					= d_F2Size[protA->id];
 
 		// align prototype to input, do not change prototype size
 		if(d_useInputComplement)
-			if(prot->size() > d_F1.size())
+			if(size > d_F1.size())
 			{
-				for (int x = 0; x < prot->size(); ++x)
+				for (int x = 0; x < size; ++x)
 				{
 					if(x < d_F1.size()/2)
-						(*prot)[x] = d_learningFraction*( min(d_F1[x],(*prot)[x]) )+(1 - d_learningFraction)*(*prot)[x];
-					else if(x >= d_F1.size()/2 &&  x < prot->size()/2)
-						(*prot)[x] = d_learningFraction*( 0 )+(1 - d_learningFraction)*(*prot)[x];
-					else if(x >= prot->size()/2 && ((d_F1.size()/2) + (x-(prot->size()/2))) < d_F1.size())
+						prot[x] = d_learningFraction*( min(d_F1[x],prot[x]) )+(1 - d_learningFraction)*prot[x];
+					else if(x >= d_F1.size()/2 &&  x < size/2)
+						prot[x] = d_learningFraction*( 0 )+(1 - d_learningFraction)*prot[x];
+					else if(x >= size/2 && ((d_F1.size()/2) + (x-(size/2))) < d_F1.size())
 					{
-						int indexF1 = (d_F1.size()/2) + (x-(prot->size()/2));
-						(*prot)[x] = d_learningFraction*( min(d_F1[indexF1],(*prot)[x]) )+(1 - d_learningFraction)*(*prot)[x];
+						int indexF1 = (d_F1.size()/2) + (x-(size/2));
+						prot[x] = d_learningFraction*( min(d_F1[indexF1],prot[x]) )+(1 - d_learningFraction)*prot[x];
 					}
 					else
 					{
-						(*prot)[x] = d_learningFraction*( (*prot)[x] )+(1 - d_learningFraction)*(*prot)[x];
+						prot[x] = d_learningFraction*( prot[x] )+(1 - d_learningFraction)*prot[x];
 					}
 				}
 			}
 			else
 			{
-				for (int x = 0; x < prot->size(); ++x)
+				for (int x = 0; x < size; ++x)
 				{
 					int indexF1 = x;
-					if(x >= prot->size()/2)
-						indexF1 = (d_F1.size()/2) + (x-(prot->size()/2));
-					(*prot)[x] = d_learningFraction*( min(d_F1[indexF1],(*prot)[x]) )+(1 - d_learningFraction)*(*prot)[x];
+					if(x >= size/2)
+						indexF1 = (d_F1.size()/2) + (x-(size/2));
+					prot[x] = d_learningFraction*( min(d_F1[indexF1],prot[x]) )+(1 - d_learningFraction)*prot[x];
 				}
 			}
 		else
 		{
-			for (int x = 0; x < prot->size(); ++x)
+			for (int x = 0; x < size; ++x)
 			{
 				if(x < d_F1.size())
-					(*prot)[x] = d_learningFraction*( min(d_F1[x],(*prot)[x]) )+(1 - d_learningFraction)*(*prot)[x];
+					prot[x] = d_learningFraction*( min(d_F1[x],prot[x]) )+(1 - d_learningFraction)*prot[x];
 				else
-					(*prot)[x] = d_learningFraction*( 0 )+(1 - d_learningFraction)*(*prot)[x];
+					prot[x] = d_learningFraction*( 0 )+(1 - d_learningFraction)*prot[x];
 
 			}
 		}
+		updateNorm(protA->id);
+		indexPrototype(protA->id);
 
 		if(d_vigilanceHistorySize > 0 && d_matchTrack)
 			addToVigilanceHistory(protA->resonance-(d_alpha*10));
@@ -294,11 +676,7 @@ void Art::updateWeights() {
 	// set resonance in history
 
 	// Clear previous activations
-	while (!d_curPTAct.empty())
-	{
-		delete d_curPTAct.top();
-		d_curPTAct.pop();
-	}
+	clearActivations();
 }
 
 /**
@@ -310,22 +688,17 @@ void Art::updateWeights() {
  */
 std::vector<ART_TYPE>* Art::matchTrack(bool finished, bool raiseVigilance)
 {
-	std::vector<ART_TYPE> * output = new std::vector<ART_TYPE>(0);
-
 	// Update weights
 	if (finished) {
 		updateWeights();
 		return NULL;
 	}
 
-	float vigilance = d_vigilance;
-	if(d_vigilanceHistorySize > 0)
-		vigilance = getAVGVigilance();
+	float vigilance = searchVigilance();
+	if(d_pruned && vigilance < d_prunedAt)
+		restoreActivations();
 
-	//cout << "AVigilance: " << getAVGVigilance() << " vig: " <<  vigilance << " candidates: " << d_curPTAct.size() << endl;
-
-	if(d_matchTrack)
-		vigilance = 0;
+	//cout << "AVigilance: " << getAVGVigilance() << " vig: " <<  vigilance << " candidates: " << d_curPTActCount << endl;
 
 	// Find the node that matches the criterion
 	// resonance >= vigilance
@@ -333,20 +706,21 @@ std::vector<ART_TYPE>* Art::matchTrack(bool finished, bool raiseVigilance)
 	// TODO: Distributed output
 	if(d_useWTA)
 	{
-		while (!d_curPTAct.empty())
+		while (!noActivation())
 		{
-			PROTOTYPE_Activation *prot = d_curPTAct.top();
+			const PROTOTYPE_Activation *prot = &topActivation();
 
 			// Last prototype was not correct
 			// find new prototype with new vigilance
 			if(raiseVigilance)
 			{
 				vigilance = prot->resonance+d_trackingValue;
-				delete prot;
-				d_curPTAct.pop();
-				if (d_curPTAct.empty())
+				if(d_pruned && vigilance < d_prunedAt)
+					restoreActivations();
+				popActivation();
+				if (noActivation())
 					continue;
-				prot = d_curPTAct.top();
+				prot = &topActivation();
 				raiseVigilance = false;
 			}
 			// Return winning node
@@ -355,8 +729,9 @@ std::vector<ART_TYPE>* Art::matchTrack(bool finished, bool raiseVigilance)
 			{
 				//cout << "prot: " << prot->id << " res: " << prot->resonance << " Tj:" << prot->T << " inpsize: " << d_inputSize << endl ;
 
-				output->push_back(prot->id);
-				return output;
+				d_resonance = prot->resonance;
+				d_searched = true;
+				return new std::vector<ART_TYPE>(1, prot->id);
 			}
 			// Remove node from list
 			// Check if the nodes can still be chosen
@@ -364,80 +739,161 @@ std::vector<ART_TYPE>* Art::matchTrack(bool finished, bool raiseVigilance)
 			else
 			{
 				//cout << "No resonance id:" << prot->id << " resonance:" << prot->resonance << " vig:" << vigilance << endl;
-				delete prot;
-				d_curPTAct.pop();
+				popActivation();
 			}
 		}
 
+		d_searched = true;
+
 		// Return nothing if only testing for a match is used
 		if(d_testMatch)
 			return NULL;
 
 		// If empty create new prototype
-		PROTOTYPE *pr = new PROTOTYPE(0);
-		for (int x = 0; x < d_F1.size(); ++x)
-			(*pr).push_back(d_F1[x]);
-
-		d_F2.push_back(pr);
-		output->push_back(d_F2.size()-1);
-		return output;
+		// the new prototype is the input itself
+		addPrototype(d_F1.empty() ? NULL : &d_F1[0], d_F1.size());
+		d_resonance = 1;
+		return new std::vector<ART_TYPE>(1, d_F2Size.size()-1);
 	}
 	else
 		return NULL;
 }
 
 /**
- * Just storing the network to the given file.
+ * Just storing the network to the given file, see ArtFileHeader. It goes through one buffer, which is about the size
+ * of the prototype matrix.
  */
 void Art::saveArtNetwork(std::string fileName)
 {
-	ofstream outputFile(fileName.c_str(), ios::out | ios::binary);
-	if(!outputFile)
-		printf( "Cannot open ART output file.\n");
-	else
+	ArtFileHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic 				= ART_FILE_MAGIC;
+	header.version 				= ART_FILE_VERSION;
+	header.vigilance 			= d_vigilance;
+	header.alpha 				= d_alpha;
+	header.inputSize 			= d_inputSize;
+	header.trackingValue 		= d_trackingValue;
+	header.learningFraction 	= d_learningFraction;
+	header.networkReliability 	= d_networkReliability;
+	header.vigilanceHistorySize = d_vigilanceHistorySize;
+	header.currVHist 			= d_currVHist;
+	header.compressionCount 	= d_compressionCount;
+	header.matchTrack 			= d_matchTrack;
+	header.useInputComplement 	= d_useInputComplement;
+	header.useWTA 				= d_useWTA;
+	header.testMatch 			= d_testMatch;
+	header.F1 					= d_F1.size();
+	header.prototypes 			= d_F2Size.size();
+	header.stride 				= d_F2Stride;
+	header.history 				= d_vigilanceHist.size();
+	header.F1_offset 			= sizeof(ArtFileHeader);
+	header.sizes_offset 		= header.F1_offset + header.F1 * sizeof(ART_TYPE);
+	header.norms_offset 		= header.sizes_offset + header.prototypes * sizeof(uint32_t);
+	header.weights_offset 		= artFileAlign(header.norms_offset + header.prototypes * sizeof(ART_TYPE));
+	header.history_offset 		= header.weights_offset + header.prototypes * header.stride * sizeof(ART_TYPE);
+	header.file_size 			= header.history_offset + header.history * sizeof(ART_TYPE);
+
+	vector<char> file(header.file_size, 0);
+	memcpy(&file[0], &header, sizeof(header));
+	if(header.F1 > 0)
+		memcpy(&file[header.F1_offset], &d_F1[0], header.F1 * sizeof(ART_TYPE));
+	for (int x = 0; x < d_F2Size.size(); ++x)
 	{
-		outputFile.write((char *) &d_vigilance, sizeof(float));
-		outputFile.write((char *) &d_alpha, sizeof(float));
-		outputFile.write((char *) &d_inputSize, sizeof(float));
-		outputFile.write((char *) &d_trackingValue, sizeof(float));
-		outputFile.write((char *) &d_learningFraction, sizeof(float));
-		outputFile.write((char *) &d_networkReliability, sizeof(float));
-		outputFile.write((char *) &d_vigilanceHistorySize, sizeof(int));
-		outputFile.write((char *) &d_currVHist, sizeof(int));
-		outputFile.write((char *) &d_compressionCount, sizeof(int));
-		outputFile.write((char *) &d_matchTrack, sizeof(bool));
-		outputFile.write((char *) &d_useInputComplement, sizeof(bool));
-		outputFile.write((char *) &d_useWTA, sizeof(bool));
-		outputFile.write((char *) &d_testMatch, sizeof(bool));
-
-		int size = d_F1.size();
-		outputFile.write((char *) &size, sizeof(int));
-
-		for (int x = 0; x < d_F1.size(); ++x)
-			outputFile.write((char *) &(d_F1[x]), sizeof(ART_TYPE));
-
-		size = d_F2.size();
-		outputFile.write((char *) &size, sizeof(int));
-		for (int x = 0; x < d_F2.size(); ++x)
-		{
-			size = d_F2[x]->size();
-			outputFile.write((char *) &size, sizeof(int));
-			for (int y = 0; y < d_F2[x]->size(); ++y)
-				outputFile.write((char *) &(*(d_F2[x]))[y], sizeof(ART_TYPE));
-		}
-		size = d_vigilanceHist.size();
-		outputFile.write((char *) &size, sizeof(int));
-		for (int x = 0; x < d_vigilanceHist.size(); ++x)
-			outputFile.write((char *) &(d_vigilanceHist[x]), sizeof(ART_TYPE));
-
-		outputFile.close();
+		uint32_t size = d_F2Size[x];
+		memcpy(&file[header.sizes_offset + x * sizeof(uint32_t)], &size, sizeof(uint32_t));
+	}
+	if(header.prototypes > 0)
+	{
+		memcpy(&file[header.norms_offset], &d_F2Norm[0], header.prototypes * sizeof(ART_TYPE));
+		memcpy(&file[header.weights_offset], &d_F2[0], header.prototypes * header.stride * sizeof(ART_TYPE));
 	}
+	if(header.history > 0)
+		memcpy(&file[header.history_offset], &d_vigilanceHist[0], header.history * sizeof(ART_TYPE));
+
+	if(!artFileWrite(fileName.c_str(), &file[0], file.size()))
+		printf( "Cannot open ART output file.\n");
 }
 
 /**
- * Loading the ART network from the given file.
+ * Loading the ART network from the given file, it replaces the network. The file is mapped and checked, and the
+ * prototype matrix is then copied in one go. The network keeps learning, so it is not used from the mapping itself.
  */
 void Art::loadArtNetWork(std::string fileName)
+{
+	uint32_t fileSize = 0;
+	const char *file = artFileOpen(fileName.c_str(), &fileSize);
+	if(file == NULL)
+	{
+		printf("Failed loading Art input file\n");
+		return;
+	}
+	const ArtFileHeader *header = (const ArtFileHeader*)file;
+	if(fileSize < sizeof(uint32_t) || header->magic != ART_FILE_MAGIC)
+	{
+		artFileClose(file, fileSize);
+		loadArtNetworkVersion0(fileName);
+		return;
+	}
+	uint64_t prototypes = fileSize >= sizeof(ArtFileHeader) ? header->prototypes : 0;
+	if(fileSize < sizeof(ArtFileHeader) || header->version != ART_FILE_VERSION || header->file_size != fileSize
+			|| header->stride == 0 || header->stride % ART_ROW_ALIGN != 0 || header->weights_offset % 16 != 0
+			|| header->F1_offset + (uint64_t)header->F1 * sizeof(ART_TYPE) > fileSize
+			|| header->sizes_offset + prototypes * sizeof(uint32_t) > fileSize
+			|| header->norms_offset + prototypes * sizeof(ART_TYPE) > fileSize
+			|| header->weights_offset + prototypes * header->stride * sizeof(ART_TYPE) > fileSize
+			|| header->history_offset + (uint64_t)header->history * sizeof(ART_TYPE) > fileSize)
+	{
+		printf("%s is not an Art file of version %d\n", fileName.c_str(), ART_FILE_VERSION);
+		artFileClose(file, fileSize);
+		return;
+	}
+	const uint32_t *sizes = (const uint32_t*)(file + header->sizes_offset);
+	for (uint32_t x = 0; x < header->prototypes; ++x)
+		if(sizes[x] > header->stride)
+		{
+			printf("%s is not an Art file of version %d\n", fileName.c_str(), ART_FILE_VERSION);
+			artFileClose(file, fileSize);
+			return;
+		}
+
+	printf("Loading Art Network from file\n");
+	d_vigilance 			= header->vigilance;
+	d_alpha 				= header->alpha;
+	d_inputSize 			= header->inputSize;
+	d_trackingValue 		= header->trackingValue;
+	d_learningFraction 		= header->learningFraction;
+	d_networkReliability 	= header->networkReliability;
+	d_vigilanceHistorySize 	= header->vigilanceHistorySize;
+	d_currVHist 			= header->currVHist;
+	d_compressionCount 		= header->compressionCount;
+	d_matchTrack 			= header->matchTrack;
+	d_useInputComplement 	= header->useInputComplement;
+	d_useWTA 				= header->useWTA;
+	d_testMatch 			= header->testMatch;
+
+	const ART_TYPE *F1 = (const ART_TYPE*)(file + header->F1_offset);
+	d_F1.assign(F1, F1 + header->F1);
+	const ART_TYPE *norms = (const ART_TYPE*)(file + header->norms_offset);
+	d_F2Norm.assign(norms, norms + header->prototypes);
+	d_F2Size.assign(sizes, sizes + header->prototypes);
+	const ART_TYPE *weights = (const ART_TYPE*)(file + header->weights_offset);
+	d_F2.assign(weights, weights + header->prototypes * header->stride);
+	d_F2Stride = header->stride;
+	const ART_TYPE *history = (const ART_TYPE*)(file + header->history_offset);
+	d_vigilanceHist.assign(history, history + header->history);
+	artFileClose(file, fileSize);
+
+	d_F2UniformSize = d_F2Size.empty() ? 0 : d_F2Size[0];
+	for (int x = 1; x < d_F2Size.size(); ++x)
+		if(d_F2Size[x] != d_F2UniformSize)
+			d_F2UniformSize = -1;
+	clearActivations();
+	if(d_pruning)
+		setPruning(true, d_indexDim[0], d_indexDim[1]);
+}
+
+//! The format before ArtFileHeader, it adds the prototypes of the file to the network
+void Art::loadArtNetworkVersion0(std::string fileName)
 {
 	ifstream inputFile(fileName.c_str(),std::ios::in | std::ios::binary);
 
@@ -475,14 +931,10 @@ void Art::loadArtNetWork(std::string fileName)
 			int size2 = 0;
 			inputFile.read((char *) &size2, sizeof(int));
 
-			d_F2.push_back(new vector<ART_TYPE>);
-
+			vector<ART_TYPE> weights(size2, 0);
 			for (int y = 0; y < size2; ++y)
-			{
-				ART_TYPE value = 0;
-				inputFile.read((char *) &value, sizeof(ART_TYPE));
-				(*(d_F2[x])).push_back(value);
-			}
+				inputFile.read((char *) &weights[y], sizeof(ART_TYPE));
+			addPrototype(weights.empty() ? NULL : &weights[0], size2);
 		}
 
 		inputFile.read((char *) &size, sizeof(int));
@@ -14,10 +14,11 @@
 #define ART_H_
 
 #include <vector>
-#include <queue>
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 #include <fstream>
+#include <pthread.h>
 
 
 /**************************************************************************************************************
@@ -34,6 +35,14 @@ typedef float ART_TYPE;
 //! weights from all F1 nodes to the given node.
 typedef std::vector<ART_TYPE> PROTOTYPE;
 
+//! The rows of the prototype matrix of F2 are padded to a multiple of this many weights
+#define ART_ROW_ALIGN 4
+
+//! Cells along each of the two dimensions of the grid for pruning, over [0,1]
+#define ART_INDEX_CELLS 16
+//! Rounding allowed, per input, when the bound of pruning is compared with the vigilance
+#define ART_PRUNE_MARGIN 1e-4f
+
 //! An "aspect" is a mono-modal view of a perceivable "object" using one (sub)modality
 typedef std::vector< ART_TYPE> ART_ASPECT;
 
@@ -80,21 +89,41 @@ public:
 	 */
 	ART_DISTRIBUTED_CLASS* classifyInput(ART_ASPECT &input);
 
+	/**
+	 * Classifies count inputs of size values, stored row after row in inputs. For every input choices gets the
+	 * winning F2 node, -1 if there is none, and resonances its resonance if it is not NULL. While only testing for a
+	 * match (setTestMatch(true)) the inputs are classified on up to "threads" threads.
+	 */
+	void classifyBatch(const ART_TYPE *inputs, int count, int size, int *choices, ART_TYPE *resonances = NULL,
+			int threads = 1);
+
 	void addToVigilanceHistory(ART_TYPE vig);
 	void setVigilanceHistorySize(int size);
 	void saveArtNetwork(std::string fileName);
 	void loadArtNetWork(std::string fileName);
 
-	ART_TYPE getAVGVigilance();
+	ART_TYPE getAVGVigilance() const;
 	inline int getCompressionCount() const { return d_compressionCount;}
 
+	/**
+	 * Evaluate only the prototypes that can pass the vigilance test. With complement coding a prototype Wj = (u, v)
+	 * is the box [u, 1-v], and an input resonates only with boxes it lies close enough to. The boxes are kept in a
+	 * grid over the inputs dim0 and dim1, and the candidates from it are checked with the distance to their box
+	 * before their activation is computed. The result of a search is the same. It needs inputs in [0,1], and all
+	 * prototypes of the size of the input, otherwise all prototypes are evaluated.
+	 */
+	void setPruning(bool pruning, int dim0 = 0, int dim1 = 1);
+	inline bool getPruning() const { return d_pruning; }
+
 	inline int getVigilanceHistorySize() const { return d_vigilanceHistorySize; }
 
 	inline bool getMatchTrack() const { return d_matchTrack; }
+	inline bool getUseInputComplement() const { return d_useInputComplement; }
 	inline void setMatchTrack(bool d_matchTrack) { this->d_matchTrack = d_matchTrack; }
 
-	//! Return all incoming weights of F2 node
-	inline PROTOTYPE* getPrototype(int id){ return d_F2[id];}
+	//! Return all incoming weights of F2 node, there are getPrototypeSize(id) of them
+	inline const ART_TYPE* getPrototype(int id) const { return &d_F2[id * d_F2Stride]; }
+	inline int getPrototypeSize(int id) const 			{ return d_F2Size[id]; }
 
 	inline float getAlpha() const 						{ return d_alpha; }
 
@@ -112,8 +141,11 @@ public:
 	inline float getVigilance() const 					{ return d_vigilance; }
 	inline void setVigilance(float vigilance)			{ d_vigilance = vigilance; }
 
-	//! Return all weights of all prototypes (you can see this as the actual network)
-	inline std::vector<PROTOTYPE*>* getF2()  			{ return &d_F2; }
+	//! The number of prototypes (you can see their weights as the actual network)
+	inline int getPrototypeCount() const 				{ return d_F2Size.size(); }
+	//! Bytes of the prototype matrix, the sizes and the norms of the prototypes
+	inline int getMemoryUsage() const
+	{ return d_F2.size() * sizeof(ART_TYPE) + d_F2Size.size() * (sizeof(int) + sizeof(ART_TYPE)); }
 	inline float getNetworkReliability() const 			{ return d_networkReliability; }
 	inline void setNetworkReliability(float d_networkReliability)
 	{ this->d_networkReliability = d_networkReliability; }
@@ -123,6 +155,9 @@ public:
 	//! Match the input vector
 	std::vector<ART_TYPE>* matchTrack(bool finished = false, bool raiseVigilance = false);
 
+	//! The vigilance a search starts with, from the history if there is one, 0 for match tracking
+	float searchVigilance() const;
+
 protected:
 	//! Actually update the weights
 	void updateWeights();
@@ -146,16 +181,16 @@ private:
 
 	/**
 	 * Function to sort the prototypes based on their "T" activity levels (depends on the last input).
-	 * As you can see the value with the highest "T" value "wins" (in the priority queue will be at
+	 * As you can see the value with the highest "T" value "wins" (in the heap it will be at
 	 * the front). With equal "T" values the highest index always wins.
 	 */
 	struct ComparePrototype {
-		bool operator() (const PROTOTYPE_Activation* pt1, const PROTOTYPE_Activation* pt2) const
+		bool operator() (const PROTOTYPE_Activation &pt1, const PROTOTYPE_Activation &pt2) const
 		{
-			if(pt1->T == pt2->T)
-				return pt1->id < pt2->id;
+			if(pt1.T == pt2.T)
+				return pt1.id < pt2.id;
 
-			return pt1->T < pt2->T;
+			return pt1.T < pt2.T;
 		}
 	};
 
@@ -174,20 +209,90 @@ private:
 
 	//! Short-term memory input pattern
 	std::vector<ART_TYPE>	d_F1;
-	//! Long-term memory (which is not a series of nodes, but the weights to each high-level nodes)
-	std::vector<PROTOTYPE*>	d_F2;
+	/**
+	 * Long-term memory (which is not a series of nodes, but the weights to each high-level nodes). All prototypes
+	 * are rows of one matrix of d_F2Stride weights, so signalToProtoType() walks through memory in one go. A row can
+	 * be shorter than the stride, the network can have prototypes of different sizes, the rest is zero.
+	 */
+	std::vector<ART_TYPE>	d_F2;
+	int						d_F2Stride;
+	//! Number of weights of each prototype
+	std::vector<int>		d_F2Size;
+	//! The L1-norm |Wj| of each prototype, kept up to date with the weights
+	std::vector<ART_TYPE>	d_F2Norm;
 
 	std::vector<ART_TYPE>	d_vigilanceHist;
-	//! A queue with the prototypes ordered on activity ("T" value)
-	std::priority_queue<PROTOTYPE_Activation*, std::vector<PROTOTYPE_Activation*>, ComparePrototype> d_curPTAct;
+	/**
+	 * The activations of the last input, the first d_curPTActCount of them are a heap ordered on activity ("T"
+	 * value). The heap is built once per input and only the nodes the search looks at are popped, so it is a
+	 * partial sort. The vector keeps its memory, an input does not allocate anything once it has grown.
+	 */
+	std::vector<PROTOTYPE_Activation> d_curPTAct;
+	int d_curPTActCount;
+	//! The resonance of the node matchTrack() returned last
+	float d_resonance;
+	//! The activations miss the prototypes that cannot reach d_prunedAt
+	bool d_pruned;
+	float d_prunedAt;
+	//! matchTrack() went through the activations, prototypes before the top were rejected
+	bool d_searched;
+	std::vector<int> d_candidates;
+
+	bool d_pruning;
+	int d_indexDim[2];
+	//! The size of all prototypes, -1 if they differ, then there is no pruning
+	int d_F2UniformSize;
+	//! The prototypes of which the box overlaps a cell, ART_INDEX_CELLS by ART_INDEX_CELLS
+	std::vector< std::vector<int> > d_indexCells;
+	//! The cells of the box of each prototype, x0, y0, x1 and y1
+	std::vector<int> d_indexBox;
 	bool d_matchTrack, d_useInputComplement, d_useWTA, d_testMatch;
 	ART_COMPUTATION_TYPE d_ACT;
 
 	//! Creates values for F1 (and uses two-complementary representation if needed)
 	void createF1(std::vector<ART_TYPE> &input);
+	void createF1(const ART_TYPE *input, int size, std::vector<ART_TYPE> &F1) const;
 
 	//! Calculates activity and resonance values for each prototype in F2
 	void signalToProtoType();
+	bool computeActivations(const std::vector<ART_TYPE> &input, float &inputSize,
+			std::vector<PROTOTYPE_Activation> &activations, std::vector<int> &candidates, float vigilance) const;
+	void evaluatePrototype(int x, const ART_TYPE *F1, int sizeF1, float &inputSize,
+			std::vector<PROTOTYPE_Activation> &activations) const;
+
+	bool canPrune(const std::vector<ART_TYPE> &input, float vigilance) const;
+	void pruneCandidates(const ART_TYPE *A, int half, float vigilance, std::vector<int> &candidates) const;
+	int indexCell(ART_TYPE value) const;
+	void indexPrototype(int id);
+	void restoreActivations();
+
+	void loadArtNetworkVersion0(std::string fileName);
+
+	//! The inputs of classifyBatch() one thread classifies
+	struct BatchRange
+	{
+		const Art *art;
+		const ART_TYPE *inputs;
+		int size, first, last;
+		float vigilance;
+		int *choices;
+		ART_TYPE *resonances;
+		pthread_t thread;
+		bool started;
+	};
+	static void* searchBatchThread(void *batch);
+	void searchBatch(const BatchRange &range) const;
+
+	//! The most active prototype that is left, only if there is one
+	inline const PROTOTYPE_Activation& topActivation() const { return d_curPTAct[0]; }
+	inline bool noActivation() const { return d_curPTActCount == 0; }
+	void popActivation();
+	void clearActivations();
+
+	//! Appends a prototype to F2, the matrix gets a larger stride if it does not fit
+	void addPrototype(const ART_TYPE *weights, int size);
+	//! Calculates |Wj| of the prototype again after its weights changed
+	void updateNorm(int id);
 };
 
 #endif /* ART_H_ */
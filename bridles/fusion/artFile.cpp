@@ -0,0 +1,53 @@
+/*
+ * artFile.cpp
+ *
+ * Reading and writing of the files of artFile.h
+ */
+
+#include "artFile.h"
+#include <string>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+const char* artFileOpen(const char *fileName, uint32_t *size)
+{
+	int fd = open(fileName, O_RDONLY);
+	struct stat info;
+	if(fd < 0 || fstat(fd, &info) != 0 || info.st_size == 0 || info.st_size > (off_t)0xffffffffu)
+	{
+		if(fd >= 0)
+			close(fd);
+		return NULL;
+	}
+	void *address = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(address == MAP_FAILED)
+		return NULL;
+	*size = info.st_size;
+	return (const char*)address;
+}
+
+void artFileClose(const char *file, uint32_t size)
+{
+	munmap((void*)file, size);
+}
+
+//! A robot that is switched off while it writes still has the file before
+bool artFileWrite(const char *fileName, const char *data, uint32_t size)
+{
+	std::string temporary = std::string(fileName) + ".tmp";
+	FILE *file = fopen(temporary.c_str(), "wb");
+	if(file == NULL)
+		return false;
+	bool written = (fwrite(data, 1, size, file) == size);
+	written = (fclose(file) == 0) && written;
+	if(!written || rename(temporary.c_str(), fileName) != 0)
+	{
+		remove(temporary.c_str());
+		return false;
+	}
+	return true;
+}
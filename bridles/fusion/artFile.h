@@ -0,0 +1,99 @@
+/*
+ * artFile.h
+ *
+ * Layout of the binary files of Art::saveArtNetwork and ArtMap::saveArtMap. They are written and read on the same
+ * robot, so everything is in the byte order of the robot, which is checked with the magic, and the arrays can be
+ * used straight from a read only mmap of the file. Files without the magic are of the format before, which is still
+ * read.
+ */
+#include <stdint.h>
+
+#ifndef ARTFILE_H_
+#define ARTFILE_H_
+
+#define ART_FILE_MAGIC 0x54524145 // "EART" on a little endian robot
+#define ART_MAP_FILE_MAGIC 0x504d4145 // "EAMP" on a little endian robot
+#define ART_FILE_VERSION 1
+
+/**
+ * The header of an Art network is followed by F1 as floats, the size of every prototype as uint32, their |Wj| as
+ * floats, the prototype matrix of prototypes * stride floats, row by row, and the vigilance history. The offsets are
+ * from the start of the file, the matrix starts at a multiple of 16.
+ */
+struct ArtFileHeader {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t flags;
+	float vigilance;
+	float alpha;
+	float inputSize;
+	float trackingValue;
+	float learningFraction;
+	float networkReliability;
+	int32_t vigilanceHistorySize;
+	int32_t currVHist;
+	int32_t compressionCount;
+	uint8_t matchTrack;
+	uint8_t useInputComplement;
+	uint8_t useWTA;
+	uint8_t testMatch;
+	uint32_t F1;                //!< Values in F1
+	uint32_t prototypes;
+	uint32_t stride;            //!< Floats per row of the matrix, a multiple of ART_ROW_ALIGN
+	uint32_t history;           //!< Values in the vigilance history
+	uint32_t F1_offset;
+	uint32_t sizes_offset;
+	uint32_t norms_offset;
+	uint32_t weights_offset;
+	uint32_t history_offset;
+	uint32_t file_size;         //!< Bytes of the whole file, a file that was cut off is not loaded
+};
+
+//! A connection of the map field, to an F2 node or to a map field node
+struct ArtFileConnection {
+	int32_t index;
+	float weight;
+};
+
+/**
+ * A list of lists of lists of connections, as the map field of ArtMap is stored in both directions. The outer table
+ * has outer + 1 ascending starts into the inner table, the inner table has inner + 1 ascending starts into the
+ * connections, so list i of the inner table has the connections from start i up to start i + 1.
+ */
+struct ArtFileTable {
+	uint32_t outer;
+	uint32_t inner;
+	uint32_t connections;
+	uint32_t outer_offset;
+	uint32_t inner_offset;
+	uint32_t connections_offset;
+};
+
+//! The header of an ArtMap is followed by the tables of the connections of F2 to the map field and back
+struct ArtMapFileHeader {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t flags;
+	float learningFraction;
+	float vigilance;
+	int32_t nrMapNodes;
+	int32_t nrOfInputClasses;
+	uint8_t useVigilance;
+	uint8_t reserved[3];
+	ArtFileTable artF2;         //!< Per ART network, per F2 node, the map field nodes
+	ArtFileTable mapNodes;      //!< Per map field node, per ART network, the F2 nodes
+	uint32_t file_size;
+};
+
+static inline uint32_t artFileAlign(uint32_t offset) {
+	return (offset + 15) & ~15u;
+}
+
+//! Maps the whole file read only, NULL if it cannot be read, size is set to its size
+const char* artFileOpen(const char *fileName, uint32_t *size);
+void artFileClose(const char *file, uint32_t size);
+
+//! Writes the file next to fileName and renames it when it is complete, returns false if that failed
+bool artFileWrite(const char *fileName, const char *data, uint32_t size);
+
+#endif /* ARTFILE_H_ */
@@ -0,0 +1,166 @@
+/*
+ * artFixed.cpp
+ *
+ * The search of a trained Art network in fixed point, see artFixed.h
+ */
+
+#include "artFixed.h"
+#include <cstdio>
+
+using namespace std;
+
+static inline ART_FIXED_TYPE toFixed(ART_TYPE value)
+{
+	if(value <= 0)
+		return 0;
+	if(value >= 1)
+		return ART_FIXED_ONE;
+	return (ART_FIXED_TYPE)(value * ART_FIXED_ONE + 0.5f);
+}
+
+//! The fuzzy intersection |A n W| of n values, as fuzzyAnd() of art.cpp in integers
+static inline uint32_t fixedAnd(const ART_FIXED_TYPE *A, const ART_FIXED_TYPE *W, int n)
+{
+	uint32_t sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0;
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		sum0 += min(A[i], W[i]);
+		sum1 += min(A[i+1], W[i+1]);
+		sum2 += min(A[i+2], W[i+2]);
+		sum3 += min(A[i+3], W[i+3]);
+	}
+	for (; i < n; ++i)
+		sum0 += min(A[i], W[i]);
+	return (sum0 + sum1) + (sum2 + sum3);
+}
+
+ArtFixed::ArtFixed(): d_F1(0),
+		d_F2(0),
+		d_F2Stride(ART_ROW_ALIGN),
+		d_F2Bias(0),
+		d_inputSize(0),
+		d_alpha(0),
+		d_vigilance(0),
+		d_activationMin(0),
+		d_resonanceMin(0)
+{
+}
+
+/**
+ * The weights are rounded to the nearest fixed point value. The bias of a prototype is computed from its rounded
+ * weights, so Tj is what Art computes for the rounded prototype.
+ */
+bool ArtFixed::convert(const Art &art)
+{
+	d_F2.clear();
+	d_F2Bias.clear();
+	d_inputSize = 0;
+	d_alpha = art.getAlpha();
+
+	int count = art.getPrototypeCount();
+	int size = (count > 0) ? art.getPrototypeSize(0) : 0;
+	bool uniform = art.getUseInputComplement() && (size % 2 == 0);
+	for (int x = 1; x < count && uniform; ++x)
+		uniform = (art.getPrototypeSize(x) == size);
+	if(!uniform)
+	{
+		printf("Error: only a network with complement coding and prototypes of one size can be converted\n");
+		return false;
+	}
+
+	d_inputSize = size/2;
+	d_F2Stride = (size + ART_ROW_ALIGN - 1) / ART_ROW_ALIGN * ART_ROW_ALIGN;
+	d_F2.assign(count * d_F2Stride, 0);
+	d_F2Bias.resize(count);
+	for (int x = 0; x < count; ++x)
+	{
+		const ART_TYPE *Wj = art.getPrototype(x);
+		ART_FIXED_TYPE *row = &d_F2[x * d_F2Stride];
+		uint32_t sumWj = 0;
+		for (int i = 0; i < size; ++i)
+		{
+			row[i] = toFixed(Wj[i]);
+			sumWj += row[i];
+		}
+		double bias = (1 - d_alpha) * ((double)d_inputSize * ART_FIXED_ONE - sumWj);
+		d_F2Bias[x] = (int32_t)floor(bias + 0.5);
+	}
+	setVigilance(art.searchVigilance());
+	return true;
+}
+
+void ArtFixed::setVigilance(float vigilance)
+{
+	d_vigilance = vigilance;
+	double M = (double)d_inputSize * ART_FIXED_ONE;
+	d_activationMin = (int32_t)floor(d_alpha * M);
+	d_resonanceMin = (vigilance > 0) ? (uint32_t)ceil(vigilance * M) : 0;
+}
+
+void ArtFixed::createF1(const ART_TYPE *input)
+{
+	d_F1.resize(2 * d_inputSize);
+	for (int x = 0; x < d_inputSize; ++x)
+	{
+		d_F1[x] = toFixed(input[x]);
+		d_F1[d_inputSize + x] = ART_FIXED_ONE - d_F1[x];
+	}
+}
+
+/**
+ * What matchTrack() finds while only testing for a match: the most active prototype, the highest index with equal
+ * activity, that resonates with the input.
+ */
+int ArtFixed::classify(const ART_TYPE *input, int size, ART_TYPE *resonance)
+{
+	int choice = -1;
+	uint32_t choiceAnd = 0;
+	if(size == d_inputSize && !d_F2Bias.empty())
+	{
+		createF1(input);
+		const ART_FIXED_TYPE *F1 = &d_F1[0];
+		int sizeF1 = d_F1.size();
+		int32_t choiceT = 0;
+		for (int x = 0; x < d_F2Bias.size(); ++x)
+		{
+			uint32_t diff = fixedAnd(F1, &d_F2[x * d_F2Stride], sizeF1);
+			int32_t Tj = (int32_t)diff + d_F2Bias[x];
+			if(Tj > d_activationMin && diff >= d_resonanceMin && (choice < 0 || Tj >= choiceT))
+			{
+				choice = x;
+				choiceT = Tj;
+				choiceAnd = diff;
+			}
+		}
+	}
+	if(resonance != NULL)
+		*resonance = (choice >= 0) ? choiceAnd / ((ART_TYPE)d_inputSize * ART_FIXED_ONE) : 0;
+	return choice;
+}
+
+void ArtFixed::classifyBatch(const ART_TYPE *inputs, int count, int size, int *choices, ART_TYPE *resonances)
+{
+	for (int x = 0; x < count; ++x)
+		choices[x] = classify(inputs + x * size, size, resonances != NULL ? &resonances[x] : NULL);
+}
+
+float ArtFixed::agreement(Art &art, const ART_TYPE *inputs, int count, int size, int *mismatches)
+{
+	int differ = 0;
+	if(count > 0)
+	{
+		vector<int> expected(count), choices(count);
+		bool testMatch = art.getTestMatch();
+		art.setTestMatch(true);
+		art.classifyBatch(inputs, count, size, &expected[0]);
+		art.setTestMatch(testMatch);
+		classifyBatch(inputs, count, size, &choices[0]);
+		for (int x = 0; x < count; ++x)
+			if(choices[x] != expected[x])
+				++differ;
+	}
+	if(mismatches != NULL)
+		*mismatches = differ;
+	return (count > 0) ? (count - differ) / (float)count : 1;
+}
@@ -0,0 +1,87 @@
+/*
+ * artFixed.h
+ *
+ * A trained Art network in fixed point, for searching on a robot without floating point unit. The weights and the
+ * inputs in [0,1] are integers up to ART_FIXED_ONE, and the activations and the vigilance test are integer sums, so a
+ * search does not use floats beyond converting the input.
+ */
+
+#include "art.h"
+#include <stdint.h>
+
+#ifndef ARTFIXED_H_
+#define ARTFIXED_H_
+
+//! Bits of the weights, 8 or 16, with 8 bits the prototypes take half the memory but round more often
+#ifndef ART_FIXED_BITS
+#define ART_FIXED_BITS 16
+#endif
+
+#if ART_FIXED_BITS == 8
+typedef uint8_t ART_FIXED_TYPE;
+#else
+typedef uint16_t ART_FIXED_TYPE;
+#endif
+
+//! The weight and input of 1
+#define ART_FIXED_ONE ((1 << ART_FIXED_BITS) - 1)
+
+/**
+ * Only the search of Art while it tests for a match, with complement coding, DEFAULT_ARTMAP and winner takes all, is
+ * done in fixed point, as for all networks of CFusion. With everything times ART_FIXED_ONE the activation is
+ * Tj = |A n Wj| + (1-alpha)(M-|Wj|), where the second term is fixed per prototype and computed when the network is
+ * converted. A prototype wins if its |A n Wj| is at least vigilance * M, so only the rounding of the weights
+ * and the input can make a different choice than Art, see agreement().
+ */
+class ArtFixed
+{
+public:
+	ArtFixed();
+
+	/**
+	 * Converts the prototypes of a trained network, with its alpha and the vigilance it searches with. Returns false
+	 * if the network cannot be searched in fixed point, it is empty then. Convert it again after it learned.
+	 */
+	bool convert(const Art &art);
+
+	//! The winning prototype for size inputs, -1 if there is none, resonance is set if it is not NULL
+	int classify(const ART_TYPE *input, int size, ART_TYPE *resonance = NULL);
+
+	//! As Art::classifyBatch() with setTestMatch(true), for count inputs stored row after row
+	void classifyBatch(const ART_TYPE *inputs, int count, int size, int *choices, ART_TYPE *resonances = NULL);
+
+	/**
+	 * The fraction of count inputs for which this network chooses the same prototype as art, which is searched with
+	 * Art::classifyBatch() while it tests for a match. The inputs that differ are counted in mismatches if it is not
+	 * NULL, to see what rounding costs before the network is used on the robot.
+	 */
+	float agreement(Art &art, const ART_TYPE *inputs, int count, int size, int *mismatches = NULL);
+
+	void setVigilance(float vigilance);
+	inline float getVigilance() const 				{ return d_vigilance; }
+
+	inline int getPrototypeCount() const 			{ return d_F2Bias.size(); }
+	//! Values of an input, the prototypes have twice as many weights
+	inline int getInputSize() const 				{ return d_inputSize; }
+	//! Bytes of the prototypes, Art takes sizeof(ART_TYPE) for every weight instead
+	inline int getMemoryUsage() const 				{ return d_F2.size() * sizeof(ART_FIXED_TYPE); }
+
+private:
+	//! Complement coded input of the last call, it keeps its memory
+	std::vector<ART_FIXED_TYPE> d_F1;
+	//! The prototypes as rows of d_F2Stride weights, as the matrix of Art
+	std::vector<ART_FIXED_TYPE> d_F2;
+	int d_F2Stride;
+	//! (1-alpha)(M-|Wj|) of every prototype
+	std::vector<int32_t> d_F2Bias;
+	int d_inputSize;
+	float d_alpha;
+	float d_vigilance;
+	//! An activation has to be above alpha * M, |A n Wj| at least vigilance * M
+	int32_t d_activationMin;
+	uint32_t d_resonanceMin;
+
+	void createF1(const ART_TYPE *input);
+};
+
+#endif /* ARTFIXED_H_ */
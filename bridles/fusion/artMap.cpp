@@ -6,6 +6,9 @@
  */
 
 #include "artMap.h"
+#include "artFile.h"
+#include <cstdio>
+#include <cstring>
 #define DEBUG_INFO 1
 
 using namespace std;
@@ -14,8 +17,8 @@ using namespace std;
  * An ARTMAP basically exists out of ART networks and an association field in between the
  * networks.
  */
-ArtMap::ArtMap(std::vector<Art*>* networks, float learnFraction): d_artF2(0),
-		d_mapNodes(0)
+ArtMap::ArtMap(std::vector<Art*>* networks, float learnFraction): d_weights(0),
+		d_mapStride(ART_MAP_STRIDE)
 {
 	d_learningFraction 	= learnFraction;
 	d_artNetworks		= networks;
@@ -35,7 +38,7 @@ ART_DISTRIBUTED_CLASSES* ArtMap::classify(ART_VIEW& multipleInputVectors)
 {
 	ART_DISTRIBUTED_CLASSES* artClasses = new ART_DISTRIBUTED_CLASSES(0);
 	// Maybe have a different vigilance for match track and when no supervision is available
-	ART_NETWORK_INDICES* nrOfSuperv = getSupervisors(&multipleInputVectors);
+	int nrOfSuperv = getSupervisors(&multipleInputVectors).size();
 	d_nrOfInputClasses = 0;
 	for (int x = 0; x < multipleInputVectors.size(); ++x)
 		if(multipleInputVectors[x] != NULL)
@@ -50,7 +53,7 @@ ART_DISTRIBUTED_CLASSES* ArtMap::classify(ART_VIEW& multipleInputVectors)
 			// but when there is no other input to associate with
 			// take the best match -> match tracking
 			// unless there the use of vigilance is forced
-			if(nrOfSuperv->size() == 0 && (d_nrOfInputClasses > 1 || d_useVigilance))
+			if(nrOfSuperv == 0 && (d_nrOfInputClasses > 1 || d_useVigilance))
 			{
 				(*d_artNetworks)[artNr]->setMatchTrack(false);
 			}
@@ -73,7 +76,6 @@ ART_DISTRIBUTED_CLASSES* ArtMap::classify(ART_VIEW& multipleInputVectors)
 			(*d_artNetworks)[artNr]->matchTrack(true);
 		}
 	}
-	delete nrOfSuperv;
 	return artClasses;
 }
 
@@ -85,7 +87,8 @@ ART_DISTRIBUTED_CLASSES* ArtMap::classify(ART_VIEW& multipleInputVectors)
 ART_DISTRIBUTED_CLASS* ArtMap::distMapNodeClassification(ART_VIEWS* multipleInputVectors,
 		int* foundCount, std::vector<int>* winnerCount, F2_TO_MAPFIELD* distOutput)
 {
-	vector<pair<int,ART_TYPE>*>* total_node_values = new vector<pair<int,ART_TYPE>*>(0);
+	ART_MAPFIELD_POPULARITY& total_node_values = d_totalPopularity;
+	total_node_values.clear();
 	*foundCount = 0;
 
 	// iterate over all views
@@ -109,12 +112,12 @@ ART_DISTRIBUTED_CLASS* ArtMap::distMapNodeClassification(ART_VIEWS* multipleInpu
 				artClasses->push_back(NULL);
 
 		// calculate map field
-		ART_MAPFIELDS* result = calcMapNodeActivation(artClasses);
+		bool result = calcMapNodeActivation(artClasses);
 
 		// Temp values //
-		ART_NETWORK_INDICES* nrSv = getSupervisors(inputVectors);
-		vector<ART_TYPE> artN_new_nodes(0);
-		ART_MAPFIELD_INDICES input_map_nodes(inputVectors->size());
+		const ART_NETWORK_INDICES& nrSv = getSupervisors(inputVectors);
+		d_newNodes.clear();
+		d_winningNodes.assign(inputVectors->size(), 0);
 
 		int countExistingNodes 	= 0;
 		int maxNodeNr 			= -1;					// winning node
@@ -122,8 +125,9 @@ ART_DISTRIBUTED_CLASS* ArtMap::distMapNodeClassification(ART_VIEWS* multipleInpu
 		// Temp values //
 
 		// calculate winning Node and activations
-		vector<pair<int,ART_TYPE>*>* node_values = calcWinningNode(result, &artN_new_nodes, &input_map_nodes,
-				nrSv, &maxNodeNr, &maxNodeCount);
+		const ART_MAPFIELD_POPULARITY* node_values = NULL;
+		if(result)
+			node_values = &calcWinningNode(d_newNodes, d_winningNodes, nrSv, &maxNodeNr, &maxNodeCount);
 
 		// finalize the matchtrack process (means: update the weights)
 		for (int artNr = 0; artNr < inputVectors->size(); ++artNr)
@@ -135,23 +139,20 @@ ART_DISTRIBUTED_CLASS* ArtMap::distMapNodeClassification(ART_VIEWS* multipleInpu
 			if((*artClasses)[artNr] != NULL)
 				delete (*artClasses)[artNr];
 		delete artClasses;
-		delete nrSv;
 
 		//Sum the node values
 		if(node_values != NULL)
 		{
 			bool nodeFound = false;
+			if(total_node_values.size() < node_values->size())
+				total_node_values.resize(node_values->size(), ART_MAPFIELD_NODE_POPULARITY(0, 0.0));
 			for (int nodeNr = 0; nodeNr < node_values->size(); ++nodeNr)
 			{
-				while(total_node_values->size() < node_values->size())
-					total_node_values->push_back(new pair<int, ART_TYPE>(0,0.0));
-				(*total_node_values)[nodeNr]->first += (*node_values)[nodeNr]->first;
-				(*total_node_values)[nodeNr]->second += (*node_values)[nodeNr]->second;
-				if((*total_node_values)[nodeNr]->first > 0)
+				total_node_values[nodeNr].first += (*node_values)[nodeNr].first;
+				total_node_values[nodeNr].second += (*node_values)[nodeNr].second;
+				if(total_node_values[nodeNr].first > 0)
 					nodeFound = true;
-				delete (*node_values)[nodeNr];
 			}
-			delete node_values;
 			if(nodeFound) ++(*foundCount);
 		}
 	}
@@ -159,15 +160,12 @@ ART_DISTRIBUTED_CLASS* ArtMap::distMapNodeClassification(ART_VIEWS* multipleInpu
 	// Debugging info
 #if DEBUG_INFO > 0
 //	cout << "MapField Activation:" << endl;
-	for (int nodeNr = 0; nodeNr < total_node_values->size(); ++nodeNr)
+	for (int nodeNr = 0; nodeNr < total_node_values.size(); ++nodeNr)
 	{
-		cout << "	Mapfield ID:" << nodeNr << " Connections:" << (*total_node_values)[nodeNr]->first << " Total weight:" << (*total_node_values)[nodeNr]->second << endl;
+		cout << "	Mapfield ID:" << nodeNr << " Connections:" << total_node_values[nodeNr].first << " Total weight:" << total_node_values[nodeNr].second << endl;
 	}
 #endif
 
-	// First search if there is a node
-	for (int nodeNr = 0; nodeNr < total_node_values->size(); ++nodeNr){ 	}
-
 	vector<ART_TYPE>* artClasses = NULL;
 
 	// For all ART networks that where empty find the associated classes
@@ -183,9 +181,9 @@ ART_DISTRIBUTED_CLASS* ArtMap::distMapNodeClassification(ART_VIEWS* multipleInpu
 			{
 				//std::cout << "find empty class art: " << artNr << std::endl;
 				vector<pair<int,ART_TYPE>*>* artClassValues = new vector<pair<int,ART_TYPE>*>(0);
-				for (int nodeNr = 0; nodeNr < total_node_values->size(); ++nodeNr)
+				for (int nodeNr = 0; nodeNr < total_node_values.size(); ++nodeNr)
 				{
-					if((*total_node_values)[nodeNr]->first > 0)
+					if(total_node_values[nodeNr].first > 0)
 					{
 						int artClass = getArtClassWTA(artNr, nodeNr);
 						if(artClass != -1)
@@ -195,14 +193,14 @@ ART_DISTRIBUTED_CLASS* ArtMap::distMapNodeClassification(ART_VIEWS* multipleInpu
 
 							// Edited!!
 							// now using the mapnode active connection count instead of 1 time activation
-							(*artClassValues)[artClass]->first += (*total_node_values)[nodeNr]->first;
-							(*artClassValues)[artClass]->second += (*total_node_values)[nodeNr]->second;
+							(*artClassValues)[artClass]->first += total_node_values[nodeNr].first;
+							(*artClassValues)[artClass]->second += total_node_values[nodeNr].second;
 							// Edited!!
 							// the winning class is the one connected to the mapfield with the heights number of connection
 							// Only this way we can overcome the plasticity stability dilemma
-							if((*total_node_values)[nodeNr]->first > winnCount)
+							if(total_node_values[nodeNr].first > winnCount)
 							{
-								winnCount = (*total_node_values)[nodeNr]->first;
+								winnCount = total_node_values[nodeNr].first;
 								winningClass = artClass;
 								//cout << "winnclass " << winningClass << " winncount " << winnCount << endl;
 							}
@@ -216,12 +214,12 @@ ART_DISTRIBUTED_CLASS* ArtMap::distMapNodeClassification(ART_VIEWS* multipleInpu
 					// Check if there is another mapfield with the same number of connections
 					// if so than if the associated class has a higher amount of active connections, then it will be chosen
 					ART_TYPE winnValue = (*artClassValues)[winningClass]->first;
-					for (int nodeNr = 0; nodeNr < total_node_values->size(); ++nodeNr)
+					for (int nodeNr = 0; nodeNr < total_node_values.size(); ++nodeNr)
 					{
 						int artClass = getArtClassWTA(artNr, nodeNr);
 						if(artClass != -1)
 						{
-							if((*total_node_values)[nodeNr]->first == winnCount && winnValue < (*artClassValues)[artClass]->second)
+							if(total_node_values[nodeNr].first == winnCount && winnValue < (*artClassValues)[artClass]->second)
 							{
 								winnValue 		= (*artClassValues)[artClass]->second;
 								winningClass	 = artClass;
@@ -250,82 +248,67 @@ ART_DISTRIBUTED_CLASS* ArtMap::distMapNodeClassification(ART_VIEWS* multipleInpu
 			}
 		}
 	}
-	// clean up stuff
-	for (int nodeNr = 0; nodeNr < total_node_values->size(); ++nodeNr)
-		delete (*total_node_values)[nodeNr];
-	delete total_node_values;
 	return artClasses;
 }
 
 /**
  * Calculate the winning "node". This node is one in the map field. So, not a node in one of the
- * F2 layers of one of the ART networks.
- * @param mnActList			in: a pointer to the set of activity values for the map field sorted on ART network
- * @param artN_new_nodes
+ * F2 layers of one of the ART networks. The activity values for the map field are in d_activation.
+ * @param artN_new_nodes	out: the ART networks of which the class does not activate a map field node
  * @param input_map_nodes	out: the winning map field node per ART network, -1 if there was no node winning
  * @param nrSv				in: indices to the ART networks that are supervising
  * @param maxNodeNr			out: the index to the map field node with maximum overall activity
  * @param maxNodeCount		out: the number of ART networks that do activate this map field node
- * @return					out: "popularity" of each map field node
+ * @return					out: "popularity" of each map field node, valid up to the next call
  */
-ART_MAPFIELD_POPULARITY* ArtMap::calcWinningNode(ART_MAPFIELDS* mnActList,
-		vector<ART_TYPE>* artN_new_nodes, ART_MAPFIELD_INDICES* input_map_nodes, ART_NETWORK_INDICES* nrSv,
-		int *maxNodeNr , ART_TYPE *maxNodeCount)
+const ART_MAPFIELD_POPULARITY& ArtMap::calcWinningNode(ART_NETWORK_INDICES& artN_new_nodes,
+		ART_MAPFIELD_INDICES& input_map_nodes, const ART_NETWORK_INDICES& nrSv, int *maxNodeNr , ART_TYPE *maxNodeCount)
 {
-	/****************WARNING SUPERBAD CODE***************/
-	if(mnActList == NULL)
-		return NULL;
-
 	*maxNodeNr  = -1;
 
 	// the "int" in this pair defines the number of ART networks that activate this node positively
 	// the "ART_TYPE" value in this pair denotes the total activation of this node
 	// then in the end we store the popularity for each map field node
-	ART_MAPFIELD_POPULARITY* node_valuePair = new ART_MAPFIELD_POPULARITY(0);
+	ART_MAPFIELD_POPULARITY& node_valuePair = d_popularity;
+	node_valuePair.assign(d_nrMapNodes, ART_MAPFIELD_NODE_POPULARITY(0, 0.0));
 
-	for (int networkNr = 0; networkNr < mnActList->size(); ++networkNr)
+	for (int networkNr = 0; networkNr < d_activation.size(); ++networkNr)
 	{
-		// So the individual values in "nodes" will be the activity values of the map field nodes
-		ART_MAPFIELD* nodes = (*mnActList)[networkNr];
+		// So the individual values in "nodes" will be the weights to the map field nodes, which are their
+		// activity values, a node that is not connected has no activity.
+		const ART_TYPE* nodes = d_activation[networkNr];
 		if(nodes != NULL)
 		{
-			//cout << "Calc winning node art:" << networkNr << " : node size: " << nodes->size();
 			ART_TYPE winningNodeValue = 0;
 			int 	winningNode = -2;
 
 			// iterate over all map field nodes for this ART network
-			for (int nodeNr = 0; nodeNr < nodes->size(); ++nodeNr)
+			for (int nodeNr = 0; nodeNr < d_nrMapNodes; ++nodeNr)
 			{
-				// ugly code indeed, basically just adds a pair only at loop networkNr==0
-				while(node_valuePair->size() <= nodeNr)
-					(*node_valuePair).push_back(new ART_MAPFIELD_NODE_POPULARITY(0,0.0));
-
-				// now retrieve the previously created pair
-				ART_MAPFIELD_NODE_POPULARITY* node_pair = (*node_valuePair)[nodeNr];
+				ART_MAPFIELD_NODE_POPULARITY& node_pair = node_valuePair[nodeNr];
 
 				// the second field is increased with the activity value of the node
 				// it will contain total aggregated activity for all ART networks for this node in the end
-				node_pair->second += (*nodes)[nodeNr];
-
 				// the first field counts the number of strictly positive activity values
 				// it will contain a number w.r.t. how many ART network positively contributed to this node
-				if((*nodes)[nodeNr] > 0) {
-					node_pair->first += 1;
+				if(nodes[nodeNr] > 0) {
+					node_pair.second += nodes[nodeNr];
+					node_pair.first += 1;
 				}
 
 				// update maximum node "count" number if node_pair is larger
 				// stores node with the most ART networks referencing it
-				if(*maxNodeCount < node_pair->first)
+				if(*maxNodeCount < node_pair.first)
 				{
 					*maxNodeNr 		= nodeNr;
-					*maxNodeCount 	= node_pair->first;
+					*maxNodeCount 	= node_pair.first;
 				}
 
 				// update activity of (currently) winning node
 				// stores node with highest activity caused by 1 of the ART networks
-				if(winningNodeValue < (*nodes)[nodeNr])
+				if(winningNodeValue < nodes[nodeNr])
 				{
-					winningNodeValue = (*nodes)[nodeNr];
+					winningNodeValue = nodes[nodeNr];
 					winningNode = nodeNr;
 				}
 			}
@@ -334,22 +317,21 @@ ART_MAPFIELD_POPULARITY* ArtMap::calcWinningNode(ART_MAPFIELDS* mnActList,
 			// then add this node to the existing node
 			if(winningNode == -2)
 			{
-				bool superVisorNew = nrSv->size() > 0;
-				for (int spv = 0; spv < nrSv->size(); ++spv)
+				bool superVisorNew = nrSv.size() > 0;
+				for (int spv = 0; spv < nrSv.size(); ++spv)
 				{
-					superVisorNew *= ((*nrSv)[spv] == networkNr);
+					superVisorNew *= (nrSv[spv] == networkNr);
 				}
 				if(!superVisorNew)
-					artN_new_nodes->push_back(networkNr);
+					artN_new_nodes.push_back(networkNr);
 			}
 
 			// here we set the winning node per ART network
-			(*input_map_nodes)[networkNr] = winningNode;
-			delete nodes;
+			input_map_nodes[networkNr] = winningNode;
 		}
 		else
 		{
-			(*input_map_nodes)[networkNr] = -1;
+			input_map_nodes[networkNr] = -1;
 		}
 	}
 	// The node with the most occurrence is found, now check if others don't
@@ -358,12 +340,11 @@ ART_MAPFIELD_POPULARITY* ArtMap::calcWinningNode(ART_MAPFIELDS* mnActList,
 	{
 		// so this only is useful if there is another node with just as many ART networks voting for it
 		// only then the activity of the node is considered
-		pair<int, ART_TYPE>* maxNode_pair = (*node_valuePair)[*maxNodeNr];
-		ART_TYPE maxActivation = maxNode_pair->second;
-		for (int nodeNr = 0; nodeNr < node_valuePair->size(); ++nodeNr)
+		ART_TYPE maxActivation = node_valuePair[*maxNodeNr].second;
+		for (int nodeNr = 0; nodeNr < node_valuePair.size(); ++nodeNr)
 		{
-			pair<int, ART_TYPE>* node_pair = (*node_valuePair)[nodeNr];
-			if(*maxNodeCount == node_pair->first && maxActivation < node_pair->second)
+			const ART_MAPFIELD_NODE_POPULARITY& node_pair = node_valuePair[nodeNr];
+			if(*maxNodeCount == node_pair.first && maxActivation < node_pair.second)
 			{
 				*maxNodeNr = nodeNr;
 				// Have to check this!!!
@@ -433,23 +414,20 @@ ART_MAPFIELD_POPULARITY* ArtMap::calcWinningNode(ART_MAPFIELDS* mnActList,
 bool ArtMap::mapClasses(vector<vector<ART_TYPE>*>* inputVectors)
 {
 	//cout << "Calc act" << endl;
-	vector<vector<ART_TYPE>*>* mnActList = calcMapNodeActivation(inputVectors);
-	if(mnActList == NULL)
+	if(!calcMapNodeActivation(inputVectors))
 		return false;
 	int nrOfMapsNodes = d_nrMapNodes;
-	ART_NETWORK_INDICES* nrSv = getSupervisors(inputVectors);
-	vector<ART_TYPE> artN_new_nodes(0);
-	ART_MAPFIELD_INDICES input_map_nodes(inputVectors->size());
+	const ART_NETWORK_INDICES& nrSv = getSupervisors(inputVectors);
+	ART_NETWORK_INDICES& artN_new_nodes = d_newNodes;
+	ART_MAPFIELD_INDICES& input_map_nodes = d_winningNodes;
+	artN_new_nodes.clear();
+	input_map_nodes.assign(inputVectors->size(), 0);
 
 	int maxNodeNr 			= -1;					// winning node
 	ART_TYPE maxNodeCount 	= 0;					// nr of times a winner
 
 	// calculate winning Node and activations
-	vector<pair<int,ART_TYPE>*>* node_values = calcWinningNode(mnActList, &artN_new_nodes, &input_map_nodes, nrSv,  &maxNodeNr, &maxNodeCount);
-	for (int x = 0; x < node_values->size(); ++x)
-		delete (*node_values)[x];
-	delete node_values;
-	delete mnActList;
+	calcWinningNode(artN_new_nodes, input_map_nodes, nrSv, &maxNodeNr, &maxNodeCount);
 
 	//cout << "Winning node:" << maxNodeNr << endl;
 	//cout << "Nodes win time: " << maxNodeCount<< endl;
@@ -475,7 +453,7 @@ bool ArtMap::mapClasses(vector<vector<ART_TYPE>*>* inputVectors)
 		// check if the winning map node has this ART network else connect it
 		bool newInfo = true;
 		for (int netNr = 0; netNr < artN_new_nodes.size(); ++netNr)
-			newInfo *= ((*(d_mapNodes[maxNodeNr])).size() <= artN_new_nodes[netNr]) || ((*(d_mapNodes[maxNodeNr]))[artN_new_nodes[netNr]]->size()==0);
+			newInfo *= !isConnected(artN_new_nodes[netNr], maxNodeNr);
 
 		// No Art network available
 		// connect and update weights
@@ -505,14 +483,14 @@ bool ArtMap::mapClasses(vector<vector<ART_TYPE>*>* inputVectors)
 		{
 			createNewMapNode(inputVectors);
 		}
-		else if(nrSv->size() > 0)
+		else if(nrSv.size() > 0)
 		{
 			// check if all supervisors have the same map node as output
 			bool consistentSupervisors = true;
 			int spvWinningNode = 0;
-			for (int superVNr = 0; superVNr < nrSv->size(); ++superVNr)
+			for (int superVNr = 0; superVNr < nrSv.size(); ++superVNr)
 			{
-				int artNNr = (*nrSv)[superVNr];
+				int artNNr = nrSv[superVNr];
 				if(superVNr == 0)
 					spvWinningNode = input_map_nodes[artNNr];
 				else
@@ -566,10 +544,8 @@ bool ArtMap::mapClasses(vector<vector<ART_TYPE>*>* inputVectors)
 							// If class is new, add to map node
 							if(map_node == -1)
 							{
-								F2_TO_MAPFIELD* F2 = d_artF2[nodeNR];
 								// If the class index is not known in the F2 network then create it
-								while(F2->size() <= classId)
-									F2->push_back(new F2_TO_MAPFIELD_NODE(0));
+								getWeights(nodeNR, classId);
 								break;
 							}
 						}
@@ -617,7 +593,6 @@ bool ArtMap::mapClasses(vector<vector<ART_TYPE>*>* inputVectors)
 			createNewMapNode(inputVectors);
 		}
 	}
-	delete nrSv;
 	// find missing values
 	if(d_nrOfInputClasses < d_artNetworks->size())
 	{
@@ -661,26 +636,24 @@ bool ArtMap::mapClasses(vector<vector<ART_TYPE>*>* inputVectors)
  */
 int ArtMap::getMapNodeWTA(ART_INDEX artNetworkNr, ART_INDEX classId)
 {
-	if(d_artF2.size() <= artNetworkNr)
+	if(d_weights.size() <= artNetworkNr)
 		return -1;
 
-	F2_TO_MAPFIELD* F2 = d_artF2[artNetworkNr];
-	if(F2->size() <= classId)
+	if(getF2Nodes(artNetworkNr) <= classId)
 		return -1;
 
 	// the f2 nodes are also called "classes"
-	F2_TO_MAPFIELD_NODE* mnl = (*F2)[classId];
+	const ART_TYPE* mnl 	= &d_weights[artNetworkNr][classId * d_mapStride];
 	int maxNodeNr 			= -1;		// winning map node
-	ART_TYPE maxNodeValue 	= -1;		// max value
+	ART_TYPE maxNodeValue 	= -1;		// max value, not connected nodes are at ART_MAP_NO_CONNECTION
 
 	// iterate over all map field nodes and get the one with largest activity/weight
-	for (int i = 0; i < mnl->size(); ++i)
+	for (int i = 0; i < d_nrMapNodes; ++i)
 	{
-		F2_NODE_TO_MAPFIELD_NODE* ml = (*mnl)[i];
-		if(maxNodeValue <  ml->second)
+		if(maxNodeValue <  mnl[i])
 		{
-			maxNodeValue 	= ml->second;
-			maxNodeNr		= ml->first;
+			maxNodeValue 	= mnl[i];
+			maxNodeNr		= i;
 		}
 	}
 	return maxNodeNr;
@@ -688,32 +661,117 @@ int ArtMap::getMapNodeWTA(ART_INDEX artNetworkNr, ART_INDEX classId)
 
 /**
  * See getMapNodeWTA, but this time the F2 node will be chosen in the network
- * to which this map node is connected with the highest weight
+ * to which this map node is connected with the highest weight, it is kept in d_mapNodeClass
  */
 int ArtMap::getArtClassWTA(int artNetworkNr, int mapNode)
 {
-	if(d_mapNodes.size() <= mapNode)
+	if(mapNode < 0 || d_mapNodeClass.size() <= artNetworkNr || d_mapNodeClass[artNetworkNr].size() <= mapNode)
 		return -1;
 
-	MAPFIELD_TO_F2* artN = d_mapNodes[mapNode];
-	if(artN->size() <= artNetworkNr)
-		return -1;
+	return d_mapNodeClass[artNetworkNr][mapNode];
+}
+
+bool ArtMap::isConnected(ART_INDEX artNetworkNr, int mapNode) const
+{
+	if(mapNode < 0 || d_mapNodeClass.size() <= artNetworkNr || d_mapNodeClass[artNetworkNr].size() <= mapNode)
+		return false;
+
+	return d_mapNodeClass[artNetworkNr][mapNode] != -1;
+}
 
-	MAPFIELD_TO_F2_NODE* acl = (*artN)[artNetworkNr];
-	int maxClassNr			= -1;			// winning class
-	ART_TYPE maxClassValue 	= -1;			// nr of times a winner
+int ArtMap::getMemoryUsage() const
+{
+	int bytes = 0;
+	for (int artNr = 0; artNr < d_weights.size(); ++artNr)
+		bytes += d_weights[artNr].size() * sizeof(ART_TYPE);
+	for (int artNr = 0; artNr < d_mapNodeClass.size(); ++artNr)
+		bytes += d_mapNodeClass[artNr].size() * sizeof(ART_INDEX);
+	return bytes;
+}
 
-	// iterate over all classes
-	for (int i = 0; i < acl->size(); ++i)
+/**
+ * The first F2 node with the largest weight wins, as weights only grow the winner only changes to the F2 node of
+ * which the weight is set.
+ */
+void ArtMap::setWeight(ART_INDEX artNetworkNr, ART_INDEX classId, int mapNode, ART_TYPE weight)
+{
+	ART_TYPE* weights = getWeights(artNetworkNr, classId);
+	weights[mapNode] = weight;
+
+	if(d_mapNodeClass.size() <= artNetworkNr)
+		d_mapNodeClass.resize(artNetworkNr + 1);
+	ART_MAPFIELD_INDICES& classes = d_mapNodeClass[artNetworkNr];
+	if(classes.size() <= mapNode)
+		classes.resize(d_mapStride, -1);
+
+	int winner = classes[mapNode];
+	if(winner == -1 || winner == classId)
+		classes[mapNode] = classId;
+	else
+	{
+		ART_TYPE winnerWeight = d_weights[artNetworkNr][winner * d_mapStride + mapNode];
+		if(winnerWeight < weight || (winnerWeight == weight && classId < winner))
+			classes[mapNode] = classId;
+	}
+}
+
+void ArtMap::findMapNodeClasses()
+{
+	d_mapNodeClass.assign(d_weights.size(), ART_MAPFIELD_INDICES(d_nrMapNodes, -1));
+	for (int x = 0; x < d_weights.size(); ++x)
 	{
-		MAPFIELD_NODE_TO_F2_NODE* ac = (*acl)[i];
-		if(maxClassValue <  ac->second)
+		ART_MAPFIELD_INDICES& classes = d_mapNodeClass[x];
+		for (int z = 0; z < d_nrMapNodes; ++z)
 		{
-			maxClassValue 	= ac->second;
-			maxClassNr		= ac->first;
+			ART_TYPE maxClassValue = -1;
+			for (int y = 0; y < getF2Nodes(x); ++y)
+			{
+				if(maxClassValue < d_weights[x][y * d_mapStride + z])
+				{
+					maxClassValue 	= d_weights[x][y * d_mapStride + z];
+					classes[z]		= y;
+				}
+			}
 		}
 	}
-	return maxClassNr;
+}
+
+ART_TYPE* ArtMap::getWeights(ART_INDEX artNetworkNr, ART_INDEX classId)
+{
+	// Create structure if this is the first time
+	if(d_weights.size() <= artNetworkNr)
+		d_weights.resize(artNetworkNr + 1);
+
+	// If the class index is not known in the F2 network then create it
+	ART_MAPFIELD_WEIGHTS& weights = d_weights[artNetworkNr];
+	if(weights.size() <= classId * d_mapStride)
+		weights.resize((classId + 1) * d_mapStride, ART_MAP_NO_CONNECTION);
+	return &weights[classId * d_mapStride];
+}
+
+/**
+ * The rows of all networks are moved to a stride that is at least twice as large, so adding map nodes one by one
+ * moves every weight only a few times.
+ */
+void ArtMap::reserveMapNodes(int count)
+{
+	if(count <= d_mapStride)
+		return;
+
+	int stride = d_mapStride;
+	while(stride < count)
+		stride *= 2;
+
+	for (int x = 0; x < d_weights.size(); ++x)
+	{
+		int nrOfClasses = getF2Nodes(x);
+		ART_MAPFIELD_WEIGHTS weights(nrOfClasses * stride, ART_MAP_NO_CONNECTION);
+		for (int y = 0; y < nrOfClasses; ++y)
+			std::copy(&d_weights[x][y * d_mapStride], &d_weights[x][y * d_mapStride] + d_nrMapNodes,
+					&weights[y * stride]);
+		d_weights[x].swap(weights);
+	}
+	d_mapStride = stride;
 }
 
 void ArtMap::updateConnections(int winningMapNode, vector<vector<ART_TYPE>*>* inputVectors)
@@ -724,44 +782,28 @@ void ArtMap::updateConnections(int winningMapNode, vector<vector<ART_TYPE>*>* in
 		// For all the input vectors that have values
 		if((*inputVectors)[x] != NULL)
 		{
-			// For F2 to Map_Node
+			// For F2 to Map_Node and back, only a connection that exists is learned
 			vector<ART_TYPE> *outputClasses = (*inputVectors)[x];
 			int	classIndex = (*outputClasses)[0];
-			F2_TO_MAPFIELD* F2 = d_artF2[x];
-			F2_TO_MAPFIELD_NODE* mnl = (*F2)[classIndex];
-			// Maybe better to have each map_node a position but
-			// maybe slower when there are a lot of map nodes and only 2 per class
-			for (int i = 0; i < mnl->size(); ++i)
-			{
-				F2_NODE_TO_MAPFIELD_NODE* ml = (*mnl)[i];
-				if(ml->first == winningMapNode)
-					ml->second += d_learningFraction;
-			}
-
-			// For Map_Node to F2
-			MAPFIELD_TO_F2* artNs 	= d_mapNodes[winningMapNode];
-			MAPFIELD_TO_F2_NODE* artCl 	= (*artNs)[x];
-			for (int i = 0; i < artCl->size(); ++i)
-			{
-				MAPFIELD_NODE_TO_F2_NODE* artC 	= (*artCl)[i];
-				if(artC->first == classIndex)
-					artC->second += d_learningFraction;
-			}
+			ART_TYPE weight = getWeights(x, classIndex)[winningMapNode];
+			if(weight != ART_MAP_NO_CONNECTION)
+				setWeight(x, classIndex, winningMapNode, weight + d_learningFraction);
 		}
 	}
 }
 
 /**
- * Get all the supervising networks (recognizable by a network reliability of 1.0)
+ * Get all the supervising networks (recognizable by a network reliability of 1.0), valid up to the next call
  */
-ART_NETWORK_INDICES* ArtMap::getSupervisors(ART_VIEW* inputVectors)
+const ART_NETWORK_INDICES& ArtMap::getSupervisors(ART_VIEW* inputVectors)
 {
-	ART_NETWORK_INDICES* supers = new ART_NETWORK_INDICES(0);
+	ART_NETWORK_INDICES& supers = d_supervisors;
+	supers.clear();
 	for (ART_INDEX x = 0; x < d_artNetworks->size(); ++x)
 	{
 		if((*inputVectors)[x] != NULL)
 			if((*d_artNetworks)[x]->getNetworkReliability() == 1.0)
-				supers->push_back(x);
+				supers.push_back(x);
 	}
 	return supers;
 }
@@ -775,6 +817,8 @@ ART_NETWORK_INDICES* ArtMap::getSupervisors(ART_VIEW* inputVectors)
  */
 void ArtMap::createNewMapNode(ART_VIEW* inputVectors)
 {
+	reserveMapNodes(d_nrMapNodes + 1);
+
 	// we iterate over all "views", per view we have a network
 	for (int x = 0; x < inputVectors->size(); ++x)
 	{
@@ -784,22 +828,8 @@ void ArtMap::createNewMapNode(ART_VIEW* inputVectors)
 		vector<ART_TYPE> *outputClasses = (*inputVectors)[x];
 		int	classIndex = (*outputClasses)[0];
 
-		// F2 to Map node
-		F2_NODE_TO_MAPFIELD_NODE* mn = new F2_NODE_TO_MAPFIELD_NODE(d_nrMapNodes, d_learningFraction);
-		F2_TO_MAPFIELD* F2 = d_artF2[x];
-		F2_TO_MAPFIELD_NODE* mnl = (*F2)[classIndex];
-		mnl->push_back(mn);
-
-		// Map node to F2
-		if(d_mapNodes.size() <= d_nrMapNodes)
-			d_mapNodes.push_back(new MAPFIELD_TO_F2(0));
-
-		MAPFIELD_TO_F2* artN = d_mapNodes[d_nrMapNodes];
-		while(artN->size() <= x)
-			artN->push_back(new MAPFIELD_TO_F2_NODE(0));
-
-		MAPFIELD_NODE_TO_F2_NODE* artC = new MAPFIELD_NODE_TO_F2_NODE(classIndex, d_learningFraction);
-		(*artN)[x]->push_back(artC);
+		// F2 to Map node and back
+		setWeight(x, classIndex, d_nrMapNodes, d_learningFraction);
 	}
 	// increment the counter
 	++d_nrMapNodes;
@@ -807,10 +837,10 @@ void ArtMap::createNewMapNode(ART_VIEW* inputVectors)
 
 /**
  * This function adds new incoming/outgoing weights to an existing "map field node" or "class".
- * All connections will be created, so: only WTA.
+ * All connections will be created, so: only WTA. A connection that exists keeps its weight.
  * @param mapNodeNr		The map field node the weights need to be added at
  * @param inputVectors	A bundle of weights from all F2 to given map field node
- * @result				d_artF2 gets outgoing weights, d_mapNodes gets outgoing weights too
+ * @result				d_weights gets the connections
  */
 void ArtMap::addToMapNode(int mapNodeNr, vector<ART_TYPE>* inputVectors)
 {
@@ -821,29 +851,20 @@ void ArtMap::addToMapNode(int mapNodeNr, vector<ART_TYPE>* inputVectors)
 		{
 			int	classIndex = (*inputVectors)[x];
 
-			// F2 to Map node
-			F2_NODE_TO_MAPFIELD_NODE* mn = new F2_NODE_TO_MAPFIELD_NODE(mapNodeNr, 0);
-			F2_TO_MAPFIELD* F2 = d_artF2[x];
-			F2_TO_MAPFIELD_NODE* mnl = (*F2)[classIndex];
-			mnl->push_back(mn);
-
-			// Map node to F2
-			MAPFIELD_TO_F2* artN = d_mapNodes[mapNodeNr];
-			while(artN->size() <= x)
-				artN->push_back(new MAPFIELD_TO_F2_NODE(0));
-
-			MAPFIELD_NODE_TO_F2_NODE* artC = new MAPFIELD_NODE_TO_F2_NODE(classIndex, 0);
-			(*artN)[x]->push_back(artC);
+			// F2 to Map node and back
+			if(getWeights(x, classIndex)[mapNodeNr] == ART_MAP_NO_CONNECTION)
+				setWeight(x, classIndex, mapNodeNr, 0);
 		}
 	}
 }
 
 /**
- * This function calculates the activation of the map nodes (WTA) for every ART Network
+ * This function calculates the activation of the map nodes (WTA) for every ART Network. As a
+ * class activates with 1.0, the activation of the map nodes is the row of weights of the class.
  */
-ART_MAPFIELDS* ArtMap::calcMapNodeActivation(ART_VIEW* inputVectors)
+bool ArtMap::calcMapNodeActivation(ART_VIEW* inputVectors)
 {
-	vector<vector<ART_TYPE>*> *mapNodeActList = new vector<vector<ART_TYPE>*>(0);
+	d_activation.assign(d_artNetworks->size(), (const ART_TYPE*) NULL);
 	int nrOfInputVectors = 0;
 
 	for (int x = 0; x < d_artNetworks->size(); ++x)
@@ -856,106 +877,220 @@ ART_MAPFIELDS* ArtMap::calcMapNodeActivation(ART_VIEW* inputVectors)
 			if ((*outputClasses).size() > 1)
 			{
 				cout << "Distributed ART network not supported yet." << endl;
-				return NULL;
+				return false;
 			}
 			int	classIndex = (*outputClasses)[0];
+			getWeights(x, classIndex);
+		}
+	}
 
-			// Create structure if this is the first time
-			while (d_artF2.size() <= x)
-			{
-				F2_TO_MAPFIELD* cl = new F2_TO_MAPFIELD(0);
-				d_artF2.push_back(cl);
-			}
+	// The rows are taken after all are created, creating a network moves the others
+	for (int x = 0; x < d_artNetworks->size(); ++x)
+		if((*inputVectors)[x] != NULL)
+			d_activation[x] = &d_weights[x][(*(*inputVectors)[x])[0] * d_mapStride];
 
-			F2_TO_MAPFIELD* F2 = d_artF2[x];
-			// If the class index is not known in the F2 network then create it
-			while(F2->size() <= classIndex)
-				F2->push_back(new F2_TO_MAPFIELD_NODE(0));
+	return nrOfInputVectors > 0;
+}
 
-			F2_TO_MAPFIELD_NODE* mnl = (*F2)[classIndex];
+//! One direction of the map field as it is stored, see ArtFileTable
+struct ArtMapFileLists
+{
+	std::vector<uint32_t> outer;
+	std::vector<uint32_t> inner;
+	std::vector<ArtFileConnection> connections;
+};
 
-			// Calculate how many times a Map node is activated for this ART network x
-			// map_node first has the number of the map_node, and second the weight value
-			// because of WTA 1.0 times the weight is used
-			mapNodeActList->push_back(new vector<ART_TYPE>(d_nrMapNodes));
-			for (int mnNr = 0; mnNr < mnl->size(); ++mnNr)
-			{
-				F2_NODE_TO_MAPFIELD_NODE * mn = (*mnl)[mnNr];
-				(*(*mapNodeActList)[x])[mn->first] = 1.0*(mn->second);
-			}
-		}
-		else
-			mapNodeActList->push_back(NULL);
-	}
+static inline void addConnection(ArtMapFileLists &lists, int index, ART_TYPE weight)
+{
+	ArtFileConnection connection;
+	connection.index = index;
+	connection.weight = weight;
+	lists.connections.push_back(connection);
+}
+
+//! Counts the lists and the connections and places the table at offset, which is moved past it
+static void layoutTable(const ArtMapFileLists &lists, ArtFileTable &table, uint32_t &offset)
+{
+	table.outer = lists.outer.size() - 1;
+	table.inner = lists.inner.size() - 1;
+	table.connections = lists.connections.size();
+	table.outer_offset = offset;
+	table.inner_offset = table.outer_offset + (table.outer + 1) * sizeof(uint32_t);
+	table.connections_offset = artFileAlign(table.inner_offset + (table.inner + 1) * sizeof(uint32_t));
+	offset = table.connections_offset + table.connections * sizeof(ArtFileConnection);
+}
+
+static void writeTable(const ArtMapFileLists &lists, const ArtFileTable &table, char *file)
+{
+	memcpy(file + table.outer_offset, &lists.outer[0], lists.outer.size() * sizeof(uint32_t));
+	memcpy(file + table.inner_offset, &lists.inner[0], lists.inner.size() * sizeof(uint32_t));
+	if(!lists.connections.empty())
+		memcpy(file + table.connections_offset, &lists.connections[0],
+				lists.connections.size() * sizeof(ArtFileConnection));
+}
 
-	if(nrOfInputVectors == 0)
-		return NULL;
-	return mapNodeActList;
+//! The arrays have to lie in the file and the starts have to ascend up to the number of entries
+static bool checkTable(const char *file, uint32_t fileSize, const ArtFileTable &table)
+{
+	if(table.outer_offset % sizeof(uint32_t) != 0 || table.inner_offset % sizeof(uint32_t) != 0
+			|| table.connections_offset % sizeof(uint32_t) != 0
+			|| table.outer_offset + (uint64_t)(table.outer + 1) * sizeof(uint32_t) > fileSize
+			|| table.inner_offset + (uint64_t)(table.inner + 1) * sizeof(uint32_t) > fileSize
+			|| table.connections_offset + (uint64_t)table.connections * sizeof(ArtFileConnection) > fileSize)
+		return false;
+	const uint32_t *outer = (const uint32_t*)(file + table.outer_offset);
+	const uint32_t *inner = (const uint32_t*)(file + table.inner_offset);
+	for (uint32_t x = 0; x < table.outer; ++x)
+		if(outer[x] > outer[x + 1])
+			return false;
+	for (uint32_t y = 0; y < table.inner; ++y)
+		if(inner[y] > inner[y + 1])
+			return false;
+	return outer[0] == 0 && outer[table.outer] == table.inner && inner[0] == 0 && inner[table.inner] == table.connections;
+}
+
+//! The connections have to point to one of indices nodes with a weight of a connection
+static bool checkConnections(const char *file, const ArtFileTable &table, int indices)
+{
+	const ArtFileConnection *connections = (const ArtFileConnection*)(file + table.connections_offset);
+	for (uint32_t z = 0; z < table.connections; ++z)
+		if(connections[z].index < 0 || connections[z].index >= indices || !(connections[z].weight >= 0))
+			return false;
+	return true;
 }
 
+void ArtMap::resetMapField(int nrMapNodes)
+{
+	d_weights.clear();
+	d_mapNodeClass.clear();
+	d_mapStride = ART_MAP_STRIDE;
+	d_nrMapNodes = 0;
+	reserveMapNodes(nrMapNodes);
+	d_nrMapNodes = nrMapNodes;
+}
+
+/**
+ * Store the map field to the given file, see ArtMapFileHeader. The ART networks are stored separately.
+ */
 void ArtMap::saveArtMap(std::string fileName)
 {
-	ofstream outputFile(fileName.c_str(), ios::out | ios::binary);
-	if(!outputFile)
-		printf( "Cannot open ARTMAP output file.\n");
-	else
+	ArtMapFileHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic 				= ART_MAP_FILE_MAGIC;
+	header.version 				= ART_FILE_VERSION;
+	header.learningFraction 	= d_learningFraction;
+	header.vigilance 			= d_vigilance;
+	header.nrMapNodes 			= d_nrMapNodes;
+	header.nrOfInputClasses 	= d_nrOfInputClasses;
+	header.useVigilance 		= d_useVigilance;
+
+	// From the F2 nodes to the map field nodes
+	ArtMapFileLists artF2;
+	for (int x = 0; x < d_weights.size(); ++x)
 	{
-		outputFile.write((char *) &d_learningFraction, sizeof(float));
-		outputFile.write((char *) &d_vigilance, sizeof(float));
-		outputFile.write((char *) &d_nrMapNodes, sizeof(int));
-		outputFile.write((char *) &d_nrOfInputClasses, sizeof(int));
-		outputFile.write((char *) &d_useVigilance, sizeof(bool));
-
-		// Write d_artF2
-		int f2Size = d_artF2.size();
-		outputFile.write((char *) &f2Size, sizeof(int));
-		for (int x = 0; x < d_artF2.size(); ++x)
+		artF2.outer.push_back(artF2.inner.size());
+		for (int y = 0; y < getF2Nodes(x); ++y)
 		{
-			F2_TO_MAPFIELD *classes = d_artF2[x];
-			int classesSize = classes->size();
-			outputFile.write((char *) &classesSize, sizeof(int));
-			for (int y = 0; y < classes->size(); ++y)
-			{
-				MAPFIELD_TO_F2_NODE * artClassList = (*classes)[y];
-				int artClassListSize = artClassList->size();
-
-				outputFile.write((char *) &artClassListSize, sizeof(int));
-				for (int z = 0; z < artClassList->size(); ++z)
-				{
-					MAPFIELD_NODE_TO_F2_NODE * artClass = (*artClassList)[z];
-					outputFile.write((char *) &artClass->first, sizeof(int));
-					outputFile.write((char *) &artClass->second, sizeof(ART_TYPE));
-				}
-			}
+			artF2.inner.push_back(artF2.connections.size());
+			const ART_TYPE* weights = &d_weights[x][y * d_mapStride];
+			for (int z = 0; z < d_nrMapNodes; ++z)
+				if(weights[z] != ART_MAP_NO_CONNECTION)
+					addConnection(artF2, z, weights[z]);
 		}
+	}
+	artF2.outer.push_back(artF2.inner.size());
+	artF2.inner.push_back(artF2.connections.size());
 
-		// Write d_mapNodes
-		int size = d_mapNodes.size();
-		outputFile.write((char *) &size, sizeof(int));
-		for (int x = 0; x < d_mapNodes.size(); ++x)
+	// From the map field nodes to the F2 nodes of the networks up to the last one that is connected
+	ArtMapFileLists mapNodes;
+	for (int z = 0; z < d_nrMapNodes; ++z)
+	{
+		mapNodes.outer.push_back(mapNodes.inner.size());
+		int nrOfNetworks = d_weights.size();
+		while(nrOfNetworks > 0 && !isConnected(nrOfNetworks - 1, z))
+			--nrOfNetworks;
+		for (int x = 0; x < nrOfNetworks; ++x)
 		{
-			MAPFIELD_TO_F2 * artNetworks = d_mapNodes[x];
-			size = artNetworks->size();
-			outputFile.write((char *) &size, sizeof(int));
-			for (int y = 0; y < artNetworks->size(); ++y)
-			{
-				MAPFIELD_TO_F2_NODE * artClassList = (*artNetworks)[y];
-				size =  artClassList->size();
-				outputFile.write((char *) &size, sizeof(int));
-				for (int z = 0; z < artClassList->size(); ++z)
-				{
-					MAPFIELD_NODE_TO_F2_NODE * artClass = (*artClassList)[z];
-					outputFile.write((char *) &artClass->first, sizeof(int));
-					outputFile.write((char *) &artClass->second, sizeof(ART_TYPE));
-				}
-
-			}
+			mapNodes.inner.push_back(mapNodes.connections.size());
+			for (int y = 0; y < getF2Nodes(x); ++y)
+				if(d_weights[x][y * d_mapStride + z] != ART_MAP_NO_CONNECTION)
+					addConnection(mapNodes, y, d_weights[x][y * d_mapStride + z]);
 		}
-		outputFile.close();
 	}
+	mapNodes.outer.push_back(mapNodes.inner.size());
+	mapNodes.inner.push_back(mapNodes.connections.size());
+
+	uint32_t offset = sizeof(ArtMapFileHeader);
+	layoutTable(artF2, header.artF2, offset);
+	offset = artFileAlign(offset);
+	layoutTable(mapNodes, header.mapNodes, offset);
+	header.file_size = offset;
+
+	vector<char> file(header.file_size, 0);
+	memcpy(&file[0], &header, sizeof(header));
+	writeTable(artF2, header.artF2, &file[0]);
+	writeTable(mapNodes, header.mapNodes, &file[0]);
+	if(!artFileWrite(fileName.c_str(), &file[0], file.size()))
+		printf( "Cannot open ARTMAP output file.\n");
 }
 
+/**
+ * Loading the map field from the given file, it replaces the map field there is. Files of the format before
+ * ArtMapFileHeader are read as before. The weights are the same in both directions, so only the table of the
+ * F2 nodes to the map field is read.
+ */
 void ArtMap::loadArtMap(std::string fileName)
+{
+	uint32_t fileSize = 0;
+	const char *file = artFileOpen(fileName.c_str(), &fileSize);
+	if(file == NULL)
+		return;
+	const ArtMapFileHeader *header = (const ArtMapFileHeader*)file;
+	if(fileSize < sizeof(uint32_t) || header->magic != ART_MAP_FILE_MAGIC)
+	{
+		artFileClose(file, fileSize);
+		loadArtMapVersion0(fileName);
+		return;
+	}
+	if(fileSize < sizeof(ArtMapFileHeader) || header->version != ART_FILE_VERSION || header->file_size != fileSize
+			|| header->nrMapNodes < 0
+			|| !checkTable(file, fileSize, header->artF2) || !checkTable(file, fileSize, header->mapNodes)
+			|| !checkConnections(file, header->artF2, header->nrMapNodes))
+	{
+		printf("%s is not an ARTMAP file of version %d\n", fileName.c_str(), ART_FILE_VERSION);
+		artFileClose(file, fileSize);
+		return;
+	}
+	printf("Loading ARTMAP from file\n");
+	d_learningFraction 	= header->learningFraction;
+	d_vigilance 		= header->vigilance;
+	d_nrOfInputClasses 	= header->nrOfInputClasses;
+	d_useVigilance 		= header->useVigilance;
+	resetMapField(header->nrMapNodes);
+
+	const uint32_t *outer = (const uint32_t*)(file + header->artF2.outer_offset);
+	const uint32_t *inner = (const uint32_t*)(file + header->artF2.inner_offset);
+	const ArtFileConnection *connections = (const ArtFileConnection*)(file + header->artF2.connections_offset);
+	d_weights.resize(header->artF2.outer);
+	for (uint32_t x = 0; x < header->artF2.outer; ++x)
+	{
+		d_weights[x].reserve((outer[x + 1] - outer[x]) * d_mapStride);
+		for (uint32_t y = outer[x]; y < outer[x + 1]; ++y)
+		{
+			ART_TYPE* weights = getWeights(x, y - outer[x]);
+			for (uint32_t z = inner[y]; z < inner[y + 1]; ++z)
+				weights[connections[z].index] = connections[z].weight;
+		}
+	}
+	findMapNodeClasses();
+	artFileClose(file, fileSize);
+}
+
+/**
+ * The format before ArtMapFileHeader, field by field. It replaces the map field there is, the map field nodes to
+ * the F2 nodes are skipped as they have the same weights.
+ */
+void ArtMap::loadArtMapVersion0(std::string fileName)
 {
 	ifstream inputFile(fileName.c_str(),std::ios::in | std::ios::binary);
 
@@ -963,65 +1098,40 @@ void ArtMap::loadArtMap(std::string fileName)
 	if(!inputFile.fail())
 	{
 		printf("Loading ARTMAP from file\n");
+		int nrMapNodes = 0;
 		inputFile.read((char *) &d_learningFraction, sizeof(float));
 		inputFile.read((char *) &d_vigilance, sizeof(float));
-		inputFile.read((char *) &d_nrMapNodes, sizeof(int));
+		inputFile.read((char *) &nrMapNodes, sizeof(int));
 		inputFile.read((char *) &d_nrOfInputClasses, sizeof(int));
 		inputFile.read((char *) &d_useVigilance, sizeof(bool));
+		resetMapField(nrMapNodes < 0 ? 0 : nrMapNodes);
 
-		// load d_artF2
-		int f2Size = d_artF2.size();
+		// load the F2 nodes to the map field
+		int f2Size = 0;
 		inputFile.read((char *) &f2Size, sizeof(int));
-		for (int x = 0; x < f2Size; ++x)
+		for (int x = 0; x < f2Size && inputFile.good(); ++x)
 		{
-			F2_TO_MAPFIELD *classes = new F2_TO_MAPFIELD(0);
-			d_artF2.push_back(classes);
-			int classesSize = classes->size();
+			if(d_weights.size() <= x)
+				d_weights.resize(x + 1);
+			int classesSize = 0;
 			inputFile.read((char *) &classesSize, sizeof(int));
-			for (int y = 0; y < classesSize; ++y)
-			{
-				MAPFIELD_TO_F2_NODE * artClassList =  new MAPFIELD_TO_F2_NODE(0);
-				classes->push_back(artClassList);
-				int artClassListSize = artClassList->size();
-				inputFile.read((char *) &artClassListSize, sizeof(int));
-				for (int z = 0; z < artClassListSize; ++z)
-				{
-					int first = 0;
-					ART_TYPE second = 0;
-					inputFile.read((char *) &first, sizeof(int));
-					inputFile.read((char *) &second, sizeof(ART_TYPE));
-					MAPFIELD_NODE_TO_F2_NODE * artClass = new MAPFIELD_NODE_TO_F2_NODE(first, second);
-					artClassList->push_back(artClass);
-				}
-			}
-		}
-
-		// load d_mapNodes
-		int mapNodeSize = d_mapNodes.size();
-		inputFile.read((char *) &mapNodeSize, sizeof(int));
-		for (int x = 0; x < mapNodeSize; ++x)
-		{
-			MAPFIELD_TO_F2 * artNetworks =  new MAPFIELD_TO_F2(0);
-			int artNetworkSize = artNetworks->size();
-			d_mapNodes.push_back(artNetworks);
-			inputFile.read((char *) &artNetworkSize, sizeof(int));
-			for (int y = 0; y < artNetworkSize; ++y)
+			for (int y = 0; y < classesSize && inputFile.good(); ++y)
 			{
-				MAPFIELD_TO_F2_NODE * artClassList = new MAPFIELD_TO_F2_NODE(0);
-				int artClassListSize =  artClassList->size();
-				artNetworks->push_back(artClassList);
+				ART_TYPE* weights = getWeights(x, y);
+				int artClassListSize = 0;
 				inputFile.read((char *) &artClassListSize, sizeof(int));
-				for (int z = 0; z < artClassListSize; ++z)
+				for (int z = 0; z < artClassListSize && inputFile.good(); ++z)
 				{
 					int first = 0;
 					ART_TYPE second = 0;
 					inputFile.read((char *) &first, sizeof(int));
 					inputFile.read((char *) &second, sizeof(ART_TYPE));
-					MAPFIELD_NODE_TO_F2_NODE * artClass = new MAPFIELD_NODE_TO_F2_NODE(first, second);
-					artClassList->push_back(artClass);
+					if(first >= 0 && first < d_nrMapNodes)
+						weights[first] = second;
 				}
 			}
 		}
+		findMapNodeClasses();
 		inputFile.close();
 	}
 }
@@ -1029,32 +1139,32 @@ void ArtMap::loadArtMap(std::string fileName)
 void ArtMap::printArtMap()
 {
 	// Loop through all the mapfield nodes and print the associate class
-	int mapNodeSize = d_mapNodes.size();
 	cout << "ARTMAP" << endl;
 	int maxPatternSize = 20;
-	for (int x = 0; x < mapNodeSize; ++x)
+	for (int x = 0; x < d_nrMapNodes; ++x)
 	{
 		cout << "Mapfield: " << x << endl; 														// Mapfield nodeID
-		vector<MAPFIELD_TO_F2_NODE*>* artNetworks = d_mapNodes[x];
-		for (int ARTnetworkId = 0; ARTnetworkId < artNetworks->size(); ++ARTnetworkId)
+		for (int ARTnetworkId = 0; ARTnetworkId < d_weights.size(); ++ARTnetworkId)
 		{
-			vector<MAPFIELD_NODE_TO_F2_NODE*>* artClassList = (*artNetworks)[ARTnetworkId];
 			cout << "	ART: " << ARTnetworkId << endl; 											// ART networkID
-			for (int classID = 0; classID < artClassList->size(); ++classID)
+			for (int classId = 0; classId < getF2Nodes(ARTnetworkId); ++classId)
 			{
-				int classId = ((MAPFIELD_NODE_TO_F2_NODE)*(*artClassList)[classID]).first; 			// ART classID
-				ART_TYPE strength = ((MAPFIELD_NODE_TO_F2_NODE)*(*artClassList)[classID]).second;		// Connection strength
+				ART_TYPE strength = d_weights[ARTnetworkId][classId * d_mapStride + x];				// Connection strength
+				if(strength == ART_MAP_NO_CONNECTION)
+					continue;
 				stringstream value;
 
-				vector<ART_TYPE>* pattern = ((Art*)(*d_artNetworks)[ARTnetworkId])->getF2()->at(classId);
-				for (int patternPos = 0; patternPos < pattern->size()/2; ++patternPos)
+				Art *art = (*d_artNetworks)[ARTnetworkId];
+				const ART_TYPE *pattern = art->getPrototype(classId);
+				int patternSize = art->getPrototypeSize(classId);
+				for (int patternPos = 0; patternPos < patternSize/2; ++patternPos)
 				{
 					if(patternPos != 0)
 						value << ", ";
-					value <<  setprecision(2) << (*pattern)[patternPos];
+					value <<  setprecision(2) << pattern[patternPos];
 				}
-				if(pattern->size() == 1)
-					value << (*pattern)[0];
+				if(patternSize == 1)
+					value << pattern[0];
 
 				//if(value.str().length() > maxPatternSize)
 				//	maxPatternSize = value.str().length();
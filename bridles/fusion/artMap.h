@@ -42,14 +42,14 @@
 //! A "map field" is used to "synchronize" between two or more ART networks (see artMap class explanation)
 typedef std::vector< ART_TYPE> ART_MAPFIELD;
 
-//! The activity of the "map field" calculated for all ART networks
-typedef std::vector<ART_MAPFIELD*> ART_MAPFIELDS;
+//! The activity of the "map field" calculated for all ART networks, NULL for a network without input
+typedef std::vector<const ART_TYPE*> ART_MAPFIELDS;
 
 //! Normal ART_MAPFIELD is about activity, this is also about how many ART networks "vote" for it
 typedef std::pair<int,ART_TYPE> ART_MAPFIELD_NODE_POPULARITY;
 
 //! Stores the popularity of each node (in a vector)
-typedef std::vector<ART_MAPFIELD_NODE_POPULARITY*> ART_MAPFIELD_POPULARITY;
+typedef std::vector<ART_MAPFIELD_NODE_POPULARITY> ART_MAPFIELD_POPULARITY;
 
 //! One weight from a given F2 node to a map field node
 typedef std::pair<int, ART_TYPE> F2_NODE_TO_MAPFIELD_NODE;
@@ -63,10 +63,14 @@ typedef std::vector<F2_NODE_TO_MAPFIELD_NODE*> F2_TO_MAPFIELD_NODE;
 //! The size of F2_TO_MAPFIELD should be the number of neurons in long-term memory (F2)
 typedef std::vector<F2_TO_MAPFIELD_NODE*> F2_TO_MAPFIELD;
 
-//! One weight from map field node to an F2 node
-typedef std::pair<int, ART_TYPE> MAPFIELD_NODE_TO_F2_NODE;
-typedef std::vector<MAPFIELD_NODE_TO_F2_NODE*> MAPFIELD_TO_F2_NODE;
-typedef std::vector<MAPFIELD_TO_F2_NODE*> MAPFIELD_TO_F2;
+//! The weights of all F2 nodes of one ART network to all map field nodes, a row per F2 node
+typedef std::vector< ART_TYPE> ART_MAPFIELD_WEIGHTS;
+
+//! The weight of an F2 node that is not connected to a map field node, the weights that are connected are >= 0
+#define ART_MAP_NO_CONNECTION -1
+
+//! Map field nodes there is room for in a row of the weights at first, it doubles when they do not fit
+#define ART_MAP_STRIDE 16
 
 //! For referencing we use integers, we might use char's for size later.
 typedef int ART_INDEX;
@@ -121,6 +125,8 @@ public:
 
 
 	inline int getNrMapNodes() const { return d_nrMapNodes; }
+	//! Bytes of the weights of the map field
+	int getMemoryUsage() const;
 	inline bool getUseVigilance() const { return d_useVigilance; }
 	inline void setUseVigilance(bool d_useVigilance) { this->d_useVigilance = d_useVigilance; }
 
@@ -130,6 +136,8 @@ public:
 	inline void setVigilance(float d_vigilance) { this->d_vigilance = d_vigilance; }
 	inline void addArtNetwork(Art* artNetwork) { d_artNetworks->push_back(artNetwork); }
 	inline Art* getArtNetwork(int networkNr) { return (*d_artNetworks)[networkNr] ;}
+	//! The networks the map field refers to, a copy of an ArtMap still refers to the networks of the original
+	inline void setArtNetworks(std::vector<Art*>* networks) { d_artNetworks = networks; }
 
 protected:
 	//! Winner-take-all of all field map nodes
@@ -145,16 +153,48 @@ private:
 
 	std::vector<Art*>*	d_artNetworks;
 
-	//! From all ART networks to "map field" structure
-	//! The size of d_artF2 is equal to the number of ART networks
-	std::vector<F2_TO_MAPFIELD*> d_artF2;
+	/**
+	 * From all ART networks to "map field" structure and back, as the weights are the same in both directions.
+	 * The size of d_weights is equal to the number of ART networks, each has d_mapStride weights per F2 node.
+	 * That is a float for every F2 node and map field node, where the lists of connections before had only the
+	 * connections, but classifying needs no allocation and walks a row per network.
+	 */
+	std::vector<ART_MAPFIELD_WEIGHTS> d_weights;
+	int			d_mapStride;
+
+	//! Per ART network the F2 node with the highest weight to every map field node, -1 if none is connected
+	std::vector<ART_MAPFIELD_INDICES> d_mapNodeClass;
+
+	//! Scratch of a classification, so it does not allocate once the map field has grown
+	ART_MAPFIELDS				d_activation;
+	ART_MAPFIELD_POPULARITY		d_popularity;
+	ART_MAPFIELD_POPULARITY		d_totalPopularity;
+	ART_NETWORK_INDICES			d_supervisors;
+	ART_NETWORK_INDICES			d_newNodes;
+	ART_MAPFIELD_INDICES		d_winningNodes;
+
+	inline int getF2Nodes(ART_INDEX artNetworkNr) const { return d_weights[artNetworkNr].size() / d_mapStride; }
 
-	//! From "map field" to all ART networks
-	//! The size of d_mapNodes is equal to the number of map field nodes
-	std::vector<MAPFIELD_TO_F2*> d_mapNodes;
+	//! The weights of an F2 node to all map field nodes, the network and the node are added if they are new
+	ART_TYPE* getWeights(ART_INDEX artNetworkNr, ART_INDEX classId);
 
-	//! Calculate map field activity for each ART network
-	ART_MAPFIELDS* calcMapNodeActivation(ART_VIEW* inputVectors);
+	//! Set a weight of the map field, a weight is only set higher than it was, see d_mapNodeClass
+	void setWeight(ART_INDEX artNetworkNr, ART_INDEX classId, int mapNode, ART_TYPE weight);
+
+	//! Find d_mapNodeClass again after the weights were loaded
+	void findMapNodeClasses();
+
+	//! Make room for count map field nodes in the rows of the weights
+	void reserveMapNodes(int count);
+
+	//! Whether any F2 node of the ART network is connected to the map field node
+	bool isConnected(ART_INDEX artNetworkNr, int mapNode) const;
+
+	//! An empty map field with room for nrMapNodes map field nodes
+	void resetMapField(int nrMapNodes);
+
+	//! Calculate map field activity for each ART network in d_activation, false if there is none
+	bool calcMapNodeActivation(ART_VIEW* inputVectors);
 
 	//! Create a new map field node
 	void createNewMapNode(ART_VIEW* inputVectors);
@@ -162,15 +202,17 @@ private:
 	void addToMapNode(int mapNodeNr, ART_ASPECT* inputVectors);
 
 	//! Get the ART networks
-	ART_NETWORK_INDICES* getSupervisors(ART_VIEW* inputVectors);
+	const ART_NETWORK_INDICES& getSupervisors(ART_VIEW* inputVectors);
 
 	void updateConnections(int winningMapNode, ART_VIEW* inputVectors);
 
-	//! The "popularity" of each map field node
-	ART_MAPFIELD_POPULARITY* calcWinningNode(ART_MAPFIELDS* mnActList, ART_ASPECT* artN_new_nodes,
-			ART_MAPFIELD_INDICES* input_map_nodes, ART_NETWORK_INDICES* nrSv, int *maxNodeNr, ART_TYPE *maxNodeCount);
+	//! The "popularity" of each map field node, of the activity in d_activation
+	const ART_MAPFIELD_POPULARITY& calcWinningNode(ART_NETWORK_INDICES& artN_new_nodes,
+			ART_MAPFIELD_INDICES& input_map_nodes, const ART_NETWORK_INDICES& nrSv, int *maxNodeNr, ART_TYPE *maxNodeCount);
 
 	bool mapClasses(ART_VIEW* inputVectors);
+
+	void loadArtMapVersion0(std::string fileName);
 };
 
 
@@ -0,0 +1,282 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief A world shared by the virtual robots on a host, with their poses, infrared sensors and radio
+ * @file CVirtualWorld.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Testing
+ */
+
+#include <CVirtualWorld.h>
+#include <CRobotIndex.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+//! Radius of a robot in m, the infrared sensors measure to its edge
+#define HOST_ROBOT_RADIUS 0.05
+
+static double worldSetting(const char *name, double value) {
+	const char *text = getenv(name);
+	return (text != NULL) ? atof(text) : value;
+}
+
+static pthread_once_t world_once = PTHREAD_ONCE_INIT;
+static CVirtualWorld *world_instance = NULL;
+
+/**
+ * The first robot creates the segment with O_EXCL and sets it up, the others wait until its magic is there, as with
+ * the shared pose of CMotors.
+ */
+static WorldSegment *worldMap() {
+	const char *name = getenv("HOST_WORLD");
+	if (name == NULL) name = HOST_WORLD_NAME;
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	bool create = fd >= 0;
+	if (!create) fd = shm_open(name, O_RDWR, 0600);
+	if (fd < 0) {
+		fprintf(stderr, "CVirtualWorld: cannot open %s, %s\n", name, strerror(errno));
+		return NULL;
+	}
+	if (create && ftruncate(fd, sizeof(WorldSegment)) < 0) {
+		fprintf(stderr, "CVirtualWorld: cannot size %s, %s\n", name, strerror(errno));
+		close(fd);
+		shm_unlink(name);
+		return NULL;
+	}
+	struct stat status;
+	for (int i = 0; i < 100 && fstat(fd, &status) == 0 && status.st_size < (off_t) sizeof(WorldSegment); i++) {
+		usleep(1000);
+	}
+	if (fstat(fd, &status) != 0 || status.st_size < (off_t) sizeof(WorldSegment)) {
+		fprintf(stderr, "CVirtualWorld: %s has no size\n", name);
+		close(fd);
+		return NULL;
+	}
+	void *ptr = mmap(NULL, sizeof(WorldSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ptr == MAP_FAILED) {
+		fprintf(stderr, "CVirtualWorld: cannot map %s, %s\n", name, strerror(errno));
+		return NULL;
+	}
+	WorldSegment *segment = (WorldSegment*) ptr;
+	if (create) {
+		pthread_mutexattr_t attr;
+		pthread_mutexattr_init(&attr);
+		pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+		pthread_mutex_init(&segment->mutex, &attr);
+		pthread_mutexattr_destroy(&attr);
+		segment->size = sizeof(WorldSegment);
+		__sync_synchronize();
+		segment->magic = HOST_WORLD_MAGIC;
+	} else {
+		for (int i = 0; i < 100 && segment->magic != HOST_WORLD_MAGIC; i++) {
+			usleep(1000);
+		}
+		if (segment->magic != HOST_WORLD_MAGIC || segment->size != sizeof(WorldSegment)) {
+			fprintf(stderr, "CVirtualWorld: %s is not a world of this build\n", name);
+			munmap(ptr, sizeof(WorldSegment));
+			return NULL;
+		}
+	}
+	return segment;
+}
+
+void CVirtualWorld::create() {
+	int index = robotIndex();
+	if (index < 1 || index > HOST_WORLD_ROBOTS) return;
+	WorldSegment *segment = worldMap();
+	if (segment != NULL) world_instance = new CVirtualWorld(segment, index);
+}
+
+CVirtualWorld *CVirtualWorld::world() {
+	pthread_once(&world_once, &CVirtualWorld::create);
+	return world_instance;
+}
+
+CVirtualWorld::CVirtualWorld(WorldSegment *segment, int index): segment(segment), index(index) {
+	speed_unit = worldSetting("HOST_SPEED_UNIT", 0.003);
+	wheel_base = worldSetting("HOST_WHEEL_BASE", 0.1);
+	ir_range = worldSetting("HOST_IR_RANGE", 0.3);
+	radio_range = worldSetting("HOST_RADIO_RANGE", 0);
+	radio_loss = worldSetting("HOST_RADIO_LOSS", 0);
+	radio_delay = (int) worldSetting("HOST_RADIO_DELAY", 5);
+	seed = getpid() ^ (index << 16);
+}
+
+uint64_t CVirtualWorld::now() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (uint64_t)time.tv_sec * 1000000 + time.tv_nsec / 1000;
+}
+
+/**
+ * A robot that drives with a constant forward speed and turn rate moves over an arc, which is exact for the speeds
+ * that only change when the motors are set.
+ */
+void CVirtualWorld::advance(WorldRobot & robot, uint64_t time) {
+	if (time <= robot.updated) return;
+	double dt = (time - robot.updated) / 1e6;
+	robot.updated = time;
+	if (robot.forward == 0 && robot.turn == 0) return;
+	double phi = robot.phi + robot.turn * dt;
+	if (fabs(robot.turn) < 1e-9) {
+		robot.x += robot.forward * dt * cos(robot.phi);
+		robot.y += robot.forward * dt * sin(robot.phi);
+	} else {
+		double radius = robot.forward / robot.turn;
+		robot.x += radius * (sin(phi) - sin(robot.phi));
+		robot.y -= radius * (cos(phi) - cos(robot.phi));
+	}
+	robot.phi = atan2(sin(phi), cos(phi));
+}
+
+void CVirtualWorld::join(int type) {
+	pthread_mutex_lock(&segment->mutex);
+	WorldRobot & robot = segment->robot[index];
+	bool placed = (robot.pid != 0);
+	robot.pid = getpid();
+	robot.type = type;
+	if (!placed) {
+		robot.x = ((index - 1) % 8) * 1.0;
+		robot.y = ((index - 1) / 8) * 1.0;
+		robot.phi = 0;
+		const char *pose = getenv("HOST_ROBOT_POSE");
+		if (pose != NULL) sscanf(pose, "%lf,%lf,%lf", &robot.x, &robot.y, &robot.phi);
+		robot.forward = 0;
+		robot.turn = 0;
+		robot.updated = now();
+		robot.head = robot.tail = 0;
+	}
+	pthread_mutex_unlock(&segment->mutex);
+}
+
+void CVirtualWorld::setWheels(int left, int right) {
+	pthread_mutex_lock(&segment->mutex);
+	WorldRobot & robot = segment->robot[index];
+	advance(robot, now());
+	robot.forward = (left + right) / 2.0 * speed_unit;
+	robot.turn = (right - left) * speed_unit / wheel_base;
+	pthread_mutex_unlock(&segment->mutex);
+}
+
+bool CVirtualWorld::getPose(int robot, double & x, double & y, double & phi) {
+	if (robot < 1 || robot > HOST_WORLD_ROBOTS) return false;
+	pthread_mutex_lock(&segment->mutex);
+	WorldRobot & other = segment->robot[robot];
+	bool present = (other.pid != 0);
+	if (present) {
+		advance(other, now());
+		x = other.x;
+		y = other.y;
+		phi = other.phi;
+	}
+	pthread_mutex_unlock(&segment->mutex);
+	return present;
+}
+
+/**
+ * A side sees the robots within HOST_IR_RANGE of its edge in the quarter around its direction, the reading falls
+ * linearly from HOST_IR_MAX at contact to 0 at the end of the range. The sides go clockwise from the front.
+ */
+int CVirtualWorld::proximity(int side) {
+	uint64_t time = now();
+	int reading = 0;
+	pthread_mutex_lock(&segment->mutex);
+	WorldRobot & robot = segment->robot[index];
+	advance(robot, time);
+	double direction = robot.phi - side * M_PI / 2;
+	for (int i = 1; i <= HOST_WORLD_ROBOTS; ++i) {
+		WorldRobot & other = segment->robot[i];
+		if (i == index || other.pid == 0) continue;
+		advance(other, time);
+		double dx = other.x - robot.x, dy = other.y - robot.y;
+		double gap = sqrt(dx * dx + dy * dy) - 2 * HOST_ROBOT_RADIUS;
+		if (gap >= ir_range) continue;
+		double bearing = atan2(dy, dx) - direction;
+		if (fabs(atan2(sin(bearing), cos(bearing))) > M_PI / 4) continue;
+		int value = (gap <= 0) ? HOST_IR_MAX : (int)(HOST_IR_MAX * (1 - gap / ir_range));
+		if (value > reading) reading = value;
+	}
+	pthread_mutex_unlock(&segment->mutex);
+	return reading;
+}
+
+/**
+ * Every robot in range gets its own copy, each one can be lost. A mailbox that is full loses the frame as well, as a
+ * radio that is not read in time.
+ */
+bool CVirtualWorld::send(int destination, const uint8_t *data, int len) {
+	if (len < 0 || len > HOST_RADIO_MTU) return false;
+	uint64_t time = now();
+	pthread_mutex_lock(&segment->mutex);
+	WorldRobot & robot = segment->robot[index];
+	advance(robot, time);
+	robot.sent++;
+	for (int i = 1; i <= HOST_WORLD_ROBOTS; ++i) {
+		WorldRobot & other = segment->robot[i];
+		if (i == index || other.pid == 0 || (destination != 0 && destination != i)) continue;
+		advance(other, time);
+		double dx = other.x - robot.x, dy = other.y - robot.y;
+		bool reached = (radio_range <= 0 || dx * dx + dy * dy <= radio_range * radio_range);
+		bool full = (other.tail - other.head >= HOST_RADIO_FRAMES);
+		if (!reached || full || (double) rand_r(&seed) / RAND_MAX < radio_loss) {
+			robot.lost++;
+			continue;
+		}
+		WorldFrame & frame = other.frames[other.tail % HOST_RADIO_FRAMES];
+		frame.due = time + (uint64_t) radio_delay * 1000;
+		frame.sender = index;
+		frame.len = len;
+		memcpy(frame.data, data, len);
+		other.tail++;
+		robot.delivered++;
+	}
+	pthread_mutex_unlock(&segment->mutex);
+	return true;
+}
+
+int CVirtualWorld::receive(uint8_t *data, int size, int & sender, int timeout) {
+	uint64_t deadline = now() + (uint64_t)(timeout > 0 ? timeout : 0) * 1000;
+	while (true) {
+		uint64_t time = now();
+		int len = -1;
+		pthread_mutex_lock(&segment->mutex);
+		WorldRobot & robot = segment->robot[index];
+		if (robot.head != robot.tail && robot.frames[robot.head % HOST_RADIO_FRAMES].due <= time) {
+			WorldFrame & frame = robot.frames[robot.head % HOST_RADIO_FRAMES];
+			len = (frame.len < size) ? frame.len : size;
+			memcpy(data, frame.data, len);
+			sender = frame.sender;
+			robot.head++;
+		}
+		pthread_mutex_unlock(&segment->mutex);
+		if (len >= 0 || time >= deadline) return len;
+		usleep(1000);
+	}
+}
@@ -0,0 +1,147 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief A world shared by the virtual robots on a host, with their poses, infrared sensors and radio
+ * @file CVirtualWorld.h
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Testing
+ */
+
+#ifndef HOST_CVIRTUALWORLD_H_
+#define HOST_CVIRTUALWORLD_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * Several virtual robots can run on one host, each as a CEquids with its jockeys, see tools/dovirtual. The processes
+ * of a robot get its index in EQUIDS_ROBOT, from 1 on (see CRobotIndex.h), and all robots map the same shared memory
+ * segment, HOST_WORLD_NAME or the one in HOST_WORLD. In there every robot has a pose that the motors of the stand-in
+ * for IRobot drive, the infrared sensors see the robots around it, and the stand-in for the WAPI sends the frames of
+ * its ZigBee radio to the mailboxes of the others, with a loss, a delay and a range. The camera replays a recorded log
+ * instead, with CAMERA_REPLAY of cameradetection, and the links over WiFi are the loopback connections to the ports of
+ * each robot.
+ *
+ * The world is set up with environment variables, read by each robot when it joins:
+ *
+ *   HOST_ROBOT_POSE      x,y,phi in m and radians, by default the robots stand on a grid 1 m apart, facing along x
+ *   HOST_SPEED_UNIT      m/s of a wheel per unit of motor speed, 0.003 by default
+ *   HOST_WHEEL_BASE      m between the wheels, 0.1 by default
+ *   HOST_IR_RANGE        m within which the infrared sensors see another robot, 0.3 by default
+ *   HOST_RADIO_RANGE     m over which a frame is received, 0 (the default) for any distance
+ *   HOST_RADIO_LOSS      fraction of the frames that is lost, 0 by default
+ *   HOST_RADIO_DELAY     ms after which a frame arrives, 5 by default
+ *
+ * The segment is never removed by a robot, they come and go, tools/dovirtual removes it before it starts them.
+ */
+
+#define HOST_WORLD_NAME "/equids_world"
+#define HOST_WORLD_MAGIC 0x444c5257
+//! Robots in a world, the indices are 1 to HOST_WORLD_ROBOTS
+#define HOST_WORLD_ROBOTS 64
+//! Frames that wait in the mailbox of a robot, more are lost
+#define HOST_RADIO_FRAMES 32
+//! Bytes of a radio frame, as an 802.15.4 frame
+#define HOST_RADIO_MTU 128
+//! Highest reading of an infrared sensor, for a robot that touches it
+#define HOST_IR_MAX 4000
+
+//! A frame in a mailbox, it is received from due on
+struct WorldFrame {
+	uint64_t due;
+	uint32_t sender;
+	uint16_t len;
+	uint8_t data[HOST_RADIO_MTU];
+};
+
+struct WorldRobot {
+	//! The pid of the CEquids or jockey that joined it, 0 if the robot is not there
+	pid_t pid;
+	int type;
+	//! Pose in m and radians at time updated, and the speeds it moves with since then, in m/s and rad/s
+	double x, y, phi;
+	double forward, turn;
+	uint64_t updated;
+	//! The mailbox of the radio, frames are taken at head and added at tail
+	uint32_t head, tail;
+	WorldFrame frames[HOST_RADIO_FRAMES];
+	//! Frames that were sent, that arrived in the mailbox of another robot, and that got lost on the way
+	uint32_t sent, delivered, lost;
+};
+
+struct WorldSegment {
+	uint32_t magic;
+	uint32_t size;
+	//! Shared by the processes, it guards the robots
+	pthread_mutex_t mutex;
+	WorldRobot robot[HOST_WORLD_ROBOTS + 1];
+};
+
+class CVirtualWorld {
+public:
+	//! The world of this process, NULL if EQUIDS_ROBOT is not set or the world cannot be mapped
+	static CVirtualWorld *world();
+
+	//! Index of the robot of this process
+	inline int self() const { return index; }
+
+	//! Put the robot of this process in the world, where it was if it is there already, for example after a restart
+	void join(int type);
+
+	//! Drive with the speeds of the left and right wheels, in units of the motors
+	void setWheels(int left, int right);
+
+	//! The pose of a robot now, false if it is not in the world
+	bool getPose(int robot, double & x, double & y, double & phi);
+
+	//! Reading of the infrared sensor on a side (RobotBase::RobotSide) of the robot of this process
+	int proximity(int side);
+
+	//! Send a frame to a robot, or to all with destination 0, false if it is too long
+	bool send(int destination, const uint8_t *data, int len);
+
+	//! Take the next frame that arrived, wait at most timeout ms, returns its length, or -1 if there is none
+	int receive(uint8_t *data, int size, int & sender, int timeout);
+
+	//! Time in microseconds, the clock of the world
+	static uint64_t now();
+
+private:
+	CVirtualWorld(WorldSegment *segment, int index);
+
+	//! Map the world and create the robot of this process, once
+	static void create();
+
+	//! Move a robot to now, call with the mutex locked
+	void advance(WorldRobot & robot, uint64_t time);
+
+	WorldSegment *segment;
+	int index;
+	double speed_unit;
+	double wheel_base;
+	double ir_range;
+	double radio_range;
+	double radio_loss;
+	int radio_delay;
+	unsigned int seed;
+};
+
+#endif /* HOST_CVIRTUALWORLD_H_ */
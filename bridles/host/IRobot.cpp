@@ -0,0 +1,107 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Stand-in for the IRobot middleware, so the bridles and the benchmarks build and run on the host
+ * @file IRobot.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Testing
+ */
+
+#include <IRobot.h>
+#include <CVirtualWorld.h>
+
+#include <string.h>
+
+const char *RobotTypeStr[] = { "UNKNOWN", "KABOT", "ACTIVEWHEEL", "SCOUTBOT" };
+
+static RobotBase *instance = NULL;
+
+RobotBase::RobotBase(RobotType type): type(type), paused(true), motors_enabled(false) {
+	memset(leds, 0, sizeof(leds));
+	memset(ir_set, 0, sizeof(ir_set));
+	memset(speeds, 0, sizeof(speeds));
+}
+
+RobotBase::RobotType RobotBase::Initialize(const std::string & name) {
+	if (instance != NULL) return instance->type;
+	const char *type = getenv("HOST_ROBOT_TYPE");
+	if (type != NULL && strcmp(type, "KABOT") == 0) {
+		instance = new KaBot();
+	} else if (type != NULL && strcmp(type, "ACTIVEWHEEL") == 0) {
+		instance = new ActiveWheel();
+	} else {
+		instance = new ScoutBot();
+	}
+	std::cout << "Host stand-in for IRobot, " << name << " runs on a " << RobotTypeStr[instance->type] << std::endl;
+	CVirtualWorld *world = CVirtualWorld::world();
+	if (world != NULL) {
+		world->join(instance->type);
+		std::cout << "It is robot " << world->self() << " of the virtual world" << std::endl;
+	}
+	return instance->type;
+}
+
+RobotBase *RobotBase::Instance() {
+	return instance;
+}
+
+void RobotBase::SetLEDAll(int board, int color) {
+	if (board < 0 || board >= HOST_ROBOT_SIDES) return;
+	for (int i = 0; i < 3; ++i) leds[board][i] = color;
+}
+
+void RobotBase::SetLEDOne(int board, int led, int color) {
+	if (board < 0 || board >= HOST_ROBOT_SIDES || led < 0 || led >= 3) return;
+	leds[board][led] = color;
+}
+
+int RobotBase::GetLED(int board, int led) const {
+	if (board < 0 || board >= HOST_ROBOT_SIDES || led < 0 || led >= 3) return LED_OFF;
+	return leds[board][led];
+}
+
+IRValues RobotBase::GetIRValues(int board) {
+	if (board < 0 || board >= HOST_ROBOT_SIDES) return IRValues();
+	CVirtualWorld *world = CVirtualWorld::world();
+	if (ir_set[board] || world == NULL) return ir[board];
+	IRValues values;
+	int reading = world->proximity(board);
+	for (int i = 0; i < 2; ++i) {
+		values.sensor[i].reflective = reading;
+		values.sensor[i].proximity = reading;
+	}
+	return values;
+}
+
+void RobotBase::SetIRValues(int board, const IRValues & values) {
+	if (board < 0 || board >= HOST_ROBOT_SIDES) return;
+	ir[board] = values;
+	ir_set[board] = true;
+}
+
+void RobotBase::setSpeeds(int speed0, int speed1, int speed2, int speed3) {
+	if (!motors_enabled) return;
+	speeds[0] = speed0;
+	speeds[1] = speed1;
+	speeds[2] = speed2;
+	speeds[3] = speed3;
+	CVirtualWorld *world = CVirtualWorld::world();
+	if (world != NULL) world->setWheels(speed0, speed1);
+}
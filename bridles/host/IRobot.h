@@ -0,0 +1,210 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Stand-in for the IRobot middleware, so the bridles and the benchmarks build and run on the host
+ * @file IRobot.h
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Testing
+ */
+
+#ifndef HOST_IROBOT_H_
+#define HOST_IROBOT_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <iostream>
+#include <string>
+
+/**
+ * Only the part of the interface of the middleware that the bridles and the jockeys use, with the same names, so the
+ * code compiles unchanged with TARGET_PLATFORM=HOST, for which Mk/default.mk puts this directory on the include path
+ * instead of the one of IRobot. Nothing talks to hardware: the leds and the motors only remember what they are set to,
+ * and the infrared sensors return what is set with SetIRValues(), zero by default. The type of the robot is taken from
+ * the environment variable HOST_ROBOT_TYPE, "KABOT", "ACTIVEWHEEL", or "SCOUTBOT" (the default).
+ *
+ * A robot with an index in EQUIDS_ROBOT is part of the virtual world of CVirtualWorld.h: the first two motor speeds
+ * drive it as the left and the right wheel, and the infrared sensors see the other robots, unless SetIRValues() was
+ * called for the board.
+ */
+
+#define SPI_A 0
+#define SPI_B 1
+#define SPI_C 2
+#define SPI_D 3
+
+//! The sides of the robot with a board
+#define HOST_ROBOT_SIDES 4
+
+#define IRLEDOFF 0x0
+#define IRLEDPROXIMITY 0x1
+#define IRLEDDOCKING 0x2
+
+#define IRLED0 0x1
+#define IRLED1 0x2
+#define IRLED2 0x4
+
+#define IRPULSE0 0x1
+#define IRPULSE1 0x2
+#define IRPULSE2 0x4
+#define IRPULSE3 0x8
+#define IRPULSE4 0x10
+#define IRPULSE5 0x20
+
+enum LEDColor {
+	LED_OFF = 0,
+	LED_RED,
+	LED_GREEN,
+	LED_BLUE,
+	LED_ORANGE,
+	LED_WHITE
+};
+
+//! The readings of one infrared sensor
+struct IRSensor {
+	int32_t reflective;
+	int32_t ambient;
+	int32_t proximity;
+	IRSensor(): reflective(0), ambient(0), proximity(0) {}
+};
+
+//! The two infrared sensors of a board
+struct IRValues {
+	IRSensor sensor[2];
+};
+
+class RobotBase {
+public:
+	enum RobotType {
+		UNKNOWN = 0,
+		KABOT,
+		ACTIVEWHEEL,
+		SCOUTBOT
+	};
+
+	enum RobotSide {
+		FRONT = 0,
+		RIGHT,
+		REAR,
+		LEFT
+	};
+
+	//! Create the robot of the type in HOST_ROBOT_TYPE, the name is only printed
+	static RobotType Initialize(const std::string & name);
+
+	//! The robot of Initialize(), NULL before that
+	static RobotBase *Instance();
+
+	static void MSPReset() {}
+
+	virtual ~RobotBase() {}
+
+	inline RobotType Type() const { return type; }
+
+	//! The board on a side, the same for every type of robot
+	inline int GetSide(RobotSide side) const { return (int)side; }
+
+	inline bool IsBoardRunning(int board) const { return board >= 0 && board < HOST_ROBOT_SIDES; }
+
+	inline void SetPrintEnabled(int board, bool enabled) {}
+
+	inline void pauseSPI(bool pause) { paused = pause; }
+
+	inline bool isSPIPaused() const { return paused; }
+
+	void SetLEDAll(int board, int color);
+
+	void SetLEDOne(int board, int led, int color);
+
+	inline void SetIRLED(int board, uint8_t leds) {}
+
+	inline void SetIRPulse(int board, uint8_t pulses) {}
+
+	inline void SetIRMode(int board, uint8_t mode) {}
+
+	inline void SetIRRX(int board, bool enable) {}
+
+	inline void CalibrateIR(int board) {}
+
+	IRValues GetIRValues(int board);
+
+	inline void EnableMotors(bool enable) { motors_enabled = enable; }
+
+	inline void enableAccelerometer(int board, bool enable) {}
+
+	//! Not part of IRobot, the readings that GetIRValues() returns for a board from now on
+	void SetIRValues(int board, const IRValues & values);
+
+	//! Not part of IRobot, the color of a led as the last SetLED*() left it
+	int GetLED(int board, int led) const;
+
+	//! Not part of IRobot, the speeds that were sent last to the motors of the robot
+	inline const int *GetSpeeds() const { return speeds; }
+
+protected:
+	RobotBase(RobotType type);
+
+	//! Remember the speeds of the motors, the types map their own commands onto this
+	void setSpeeds(int speed0, int speed1, int speed2 = 0, int speed3 = 0);
+
+private:
+	RobotType type;
+	bool paused;
+	bool motors_enabled;
+	int leds[HOST_ROBOT_SIDES][3];
+	IRValues ir[HOST_ROBOT_SIDES];
+	//! Boards of which the readings are set with SetIRValues(), instead of taken from the virtual world
+	bool ir_set[HOST_ROBOT_SIDES];
+	int speeds[4];
+};
+
+class KaBot: public RobotBase {
+public:
+	KaBot(): RobotBase(KABOT) {}
+	inline void MoveScrewFront(int speed) { setSpeeds(speed, GetSpeeds()[1]); }
+	inline void MoveScrewRear(int speed) { setSpeeds(GetSpeeds()[0], speed); }
+	inline void activateLaser(bool on) {}
+};
+
+class ScoutBot: public RobotBase {
+public:
+	ScoutBot(): RobotBase(SCOUTBOT) {}
+	inline void Move(int left, int right) { setSpeeds(left, right); }
+	inline void activateLaser(bool on) {}
+	inline bool isEthernetPortConnected(int side) { return false; }
+};
+
+class ActiveWheel: public RobotBase {
+public:
+	ActiveWheel(): RobotBase(ACTIVEWHEEL) {}
+	inline void MoveWheelsFront(int left, int right) {
+		setSpeeds(left, right, GetSpeeds()[2], GetSpeeds()[3]);
+	}
+	inline void MoveWheelsRear(int left, int right) {
+		setSpeeds(GetSpeeds()[0], GetSpeeds()[1], left, right);
+	}
+	inline void MoveHingeToAngle(float angle) {}
+	inline bool isEthernetPortConnected(int side) { return false; }
+};
+
+//! Names of the robot types, indexed by RobotBase::RobotType
+extern const char *RobotTypeStr[];
+
+#endif /* HOST_IROBOT_H_ */
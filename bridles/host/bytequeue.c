@@ -0,0 +1 @@
+../../managers/visualiser/src/common/bytequeue.c
\ No newline at end of file
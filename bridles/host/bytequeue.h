@@ -0,0 +1 @@
+../../managers/visualiser/src/common/bytequeue.h
\ No newline at end of file
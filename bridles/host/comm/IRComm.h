@@ -0,0 +1,45 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Stand-in for the infrared communication of the middleware, nothing is received and sending is a no-op
+ * @file IRComm.h
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Testing
+ */
+
+#ifndef HOST_IRCOMM_H_
+#define HOST_IRCOMM_H_
+
+//! Only the calls of the leds bridle, see IRobot.h of this directory
+namespace IRComm {
+
+inline bool HasMessage() {
+	return false;
+}
+
+inline void ReadMessage() {
+}
+
+inline void SendMessage(int side, const char *data, int length) {
+}
+
+}
+
+#endif /* HOST_IRCOMM_H_ */
@@ -0,0 +1 @@
+../../managers/visualiser/src/common/crc8.c
\ No newline at end of file
@@ -0,0 +1 @@
+../../managers/visualiser/src/common/ethlolmsg.c
\ No newline at end of file
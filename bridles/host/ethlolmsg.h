@@ -0,0 +1 @@
+../../managers/visualiser/src/common/ethlolmsg.h
\ No newline at end of file
@@ -0,0 +1,161 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Host stand-in for the WAPI library, ZigBee and Ubisense over the virtual world
+ * @file wapi.h
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Testing
+ */
+
+#ifndef HOST_WAPI_H_
+#define HOST_WAPI_H_
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include <CVirtualWorld.h>
+#include <wapi/wapi_ubitag.h>
+
+/**
+ * Only the part of WAPI that the jockeys use, and the headers they get through it. The radio is the one of the virtual
+ * world, with its range, loss and delay, and the position is the pose of the robot in the world in mm. Outside of a
+ * virtual world, without EQUIDS_ROBOT, nothing can be joined, as on a robot without a tag.
+ */
+namespace wapi {
+
+class Message {
+public:
+	Message(): destination(0), size(0) {}
+
+	inline void SetDestination(const Ubitag & tag) { destination = tag.Id(); }
+
+	inline uint64_t Destination() const { return destination; }
+
+	inline void SetHops(int hops) {}
+
+	inline void SetSignalStrength(int strength) {}
+
+	inline void SetChannel(int channel) {}
+
+	inline void SetData(const char *data, int len) {
+		size = (len < 0) ? 0 : (len > HOST_RADIO_MTU ? HOST_RADIO_MTU : len);
+		memcpy(buffer, data, size);
+	}
+
+	inline const char *Data() const { return buffer; }
+
+	inline int Size() const { return size; }
+private:
+	friend class WAPI;
+	uint64_t destination;
+	int size;
+	char buffer[HOST_RADIO_MTU];
+};
+
+class Coordinates {
+public:
+	Coordinates(): x(0), y(0), z(0), timestamp(0) {}
+
+	inline float getX() const { return x; }
+
+	inline float getY() const { return y; }
+
+	inline float getZ() const { return z; }
+
+	inline uint32_t getTimestamp() const { return timestamp; }
+
+	std::string toString() const {
+		std::ostringstream text;
+		text << "(" << x << ", " << y << ", " << z << ") at " << timestamp;
+		return text.str();
+	}
+private:
+	friend class WAPI;
+	float x, y, z;
+	uint32_t timestamp;
+};
+
+class WAPI {
+public:
+	enum {
+		WAPI_OK = 0,
+		WAPI_ERROR = -1,
+		WAPI_TIMEOUT = -2
+	};
+
+	WAPI(int device = 0): joined(false) {}
+
+	inline int join(int channel) {
+		joined = (CVirtualWorld::world() != NULL);
+		return joined ? WAPI_OK : WAPI_ERROR;
+	}
+
+	inline int disjoin() {
+		joined = false;
+		return WAPI_OK;
+	}
+
+	inline int nodeInfo(Ubitag & tag) {
+		if (!joined) return WAPI_ERROR;
+		tag.SetId(CVirtualWorld::world()->self());
+		return WAPI_OK;
+	}
+
+	inline int send(Message & message) {
+		if (!joined) return WAPI_ERROR;
+		int destination = (message.destination == Ubitag::BROADCAST) ? 0 : (int)message.destination;
+		bool sent = CVirtualWorld::world()->send(destination, (const uint8_t*)message.buffer, message.size);
+		return sent ? WAPI_OK : WAPI_ERROR;
+	}
+
+	//! Wait at most timeout ms for a frame
+	inline int receive(Message & message, int timeout) {
+		if (!joined) return WAPI_ERROR;
+		int sender;
+		int len = CVirtualWorld::world()->receive((uint8_t*)message.buffer, HOST_RADIO_MTU, sender, timeout);
+		if (len < 0) return WAPI_TIMEOUT;
+		message.size = len;
+		message.destination = CVirtualWorld::world()->self();
+		return WAPI_OK;
+	}
+
+	//! The fix is the current pose, the timestamp is in ms
+	inline int position(Coordinates & coordinates, int timeout) {
+		if (!joined) return WAPI_ERROR;
+		CVirtualWorld *world = CVirtualWorld::world();
+		double x, y, phi;
+		if (!world->getPose(world->self(), x, y, phi)) return WAPI_ERROR;
+		coordinates.x = x * 1000;
+		coordinates.y = y * 1000;
+		coordinates.z = 0;
+		coordinates.timestamp = (uint32_t)(CVirtualWorld::now() / 1000);
+		return WAPI_OK;
+	}
+private:
+	bool joined;
+};
+
+}
+
+#endif /* HOST_WAPI_H_ */
@@ -0,0 +1,50 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Host stand-in for the ubitag of the WAPI library
+ * @file wapi_ubitag.h
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Testing
+ */
+
+#ifndef HOST_WAPI_UBITAG_H_
+#define HOST_WAPI_UBITAG_H_
+
+#include <stdint.h>
+
+namespace wapi {
+
+//! The tag of a robot is its index in the virtual world, see CVirtualWorld.h
+class Ubitag {
+public:
+	static const uint64_t BROADCAST = 0xFFFFFFFFFFFFFFFFULL;
+
+	Ubitag(uint64_t id = 0): id(id) {}
+
+	inline uint64_t Id() const { return id; }
+
+	inline void SetId(uint64_t value) { id = value; }
+private:
+	uint64_t id;
+};
+
+}
+
+#endif /* HOST_WAPI_UBITAG_H_ */
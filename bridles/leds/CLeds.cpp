@@ -30,10 +30,22 @@
 #include <CLeds.h>
 
 #include <CMotors.h>
+#include <CSched.h>
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <fstream>
+#include <sstream>
 #include <dim1algebra.hpp>
 #include <syslog.h> // log-levels
+#include <sys/time.h>
+
+static long long sampleTime() {
+	struct timeval time;
+	gettimeofday(&time, NULL);
+	return (long long) time.tv_sec * 1000000 + time.tv_usec;
+}
 
 /**
  * Create object that drives the leds, the normal ones, as well as the infrared ones.
@@ -95,17 +107,40 @@ CLeds::CLeds(RobotBase *robot_base, RobotBase::RobotType robot_type) {
 
 	log_level = LOG_EMERG;
 
-	message_recv = false;
-
     pthread_mutex_init(&ir_rx_mutex, NULL);
 
     receiving_messages = false;
     messages_sent = 0;
+	messages_dropped = 0;
+	tx_queue.resize(board_count);
+	tx_side = 0;
+	tx_next_side = 0;
+
+	sampling = false;
+	sample_period = LEDS_SAMPLE_PERIOD;
+	memset(frames, 0, sizeof(frames));
+	frame_sequence[0] = frame_sequence[1] = 0;
+	published = -1;
+	reset_requested = false;
+	frame_log = NULL;
+
+	watch_count = 0;
+	pthread_mutex_init(&watch_mutex, NULL);
+
+	char* robotID = getenv("sr_id");
+	robot_id = (robotID != NULL) ? atoi(robotID) : -1;
+	recalibrating = false;
+	recalib_frames = 0;
+	RunningStatistic empty = { 0, 0, 0 };
+	running_reflective.resize(irled_count, empty);
+	running_ambient.resize(irled_count, empty);
+	running_proximity.resize(irled_count, empty);
 }
 
 CLeds::~CLeds() {
-	receiving_messages = false;
-	usleep(100000);
+	stopSampling();
+	stopCommunication();
+	pthread_mutex_destroy(&watch_mutex);
 }
 
 /**
@@ -113,6 +148,10 @@ CLeds::~CLeds() {
  * taken into account by subsequent functions.
  */
 bool CLeds::init() {
+	// the boards are set up again, the sampler thread starts again only if the front board runs
+	bool was_sampling = sampling;
+	stopSampling();
+
 	std::cout << log_prefix << "Turn off the normal LEDs for less inference" << std::endl;
 	power_all(LT_NORMAL, false);
 
@@ -137,12 +176,16 @@ bool CLeds::init() {
 		board_running[i] = robot->IsBoardRunning(i);
 	}
 
+	// without a calibration of its own the robot keeps the offsets it has
+	load_calibration();
+
 	// return false, if the front board is not running
 	int side = robot->GetSide(RobotBase::FRONT);
 	if (!board_running[side]) {
 		std::cerr << "Front board is not running!" << std::endl;
 		return false;
 	}
+	if (was_sampling) return startSampling(sample_period);
 	return true;
 //	robot->SetIRLED(SPI_D, 0x7);
 }
@@ -179,51 +222,130 @@ int CLeds::proximity(int i, bool offset) {
 	return value;
 }
 
-void *IRCommRxThread(void *l) {
-    CLeds * leds = (CLeds*) l;
-    std::cout << leds->log_prefix << "Start IRCommRxThread" << std::endl;
-    leds->receiving_messages = true;
-    while(leds->receiving_messages) {
-        pthread_mutex_lock(&leds->ir_rx_mutex);
-        while(IRComm::HasMessage()) {
-            IRComm::ReadMessage();
-            leds->message_recv = true;
-        }
-        pthread_mutex_unlock(&leds->ir_rx_mutex);
+/**
+ * Every period the thread takes all messages the irobot library received into the queue, and sends at most one message
+ * to one side, the next running side in turn. A side without queued messages gets the beacon, if there is one, so a
+ * beacon never holds up the messages.
+ */
+void *CLeds::IRCommTxThread(void *l) {
+	CLeds *leds = (CLeds*) l;
+	std::cout << leds->log_prefix << "Start IRCommTxThread" << std::endl;
+	long long next = sampleTime();
+	while (leds->receiving_messages) {
+		next += IRCOMM_PERIOD;
+		long long now = sampleTime();
+		if (next > now) {
+			usleep(next - now);
+		} else if (now - next > 10 * IRCOMM_PERIOD) {
+			next = now;
+		}
+
+		std::string msg;
+		int side = leds->tx_side;
+		leds->tx_side = (side + 1) % leds->board_count;
 
-        usleep(20000);
-    }
-    std::cout << leds->log_prefix << "Quit IRCommRxThread" << std::endl;
+		pthread_mutex_lock(&leds->ir_rx_mutex);
+		while (IRComm::HasMessage()) {
+			IRComm::ReadMessage();
+			if (leds->rx_queue.size() >= IRCOMM_QUEUE_SIZE) {
+				leds->rx_queue.pop_front();
+				leds->messages_dropped++;
+			}
+			IRReception reception;
+			reception.timestamp = sampleTime();
+			leds->rx_queue.push_back(reception);
+		}
+		if (!leds->tx_queue[side].empty()) {
+			msg = leds->tx_queue[side].front();
+			leds->tx_queue[side].pop_front();
+		} else {
+			msg = leds->beacon_message;
+		}
+		pthread_mutex_unlock(&leds->ir_rx_mutex);
+
+		if (!msg.empty() && leds->board_running[side]) {
+			IRComm::SendMessage(side, msg.c_str(), msg.length());
+			leds->messages_sent++;
+		}
+	}
+	std::cout << leds->log_prefix << "Quit IRCommTxThread" << std::endl;
+	return NULL;
 }
 
-void CLeds::send_message(const std::string & msg) {
-	static int side = 0;
-	if (board_running[side])
-		IRComm::SendMessage(side, msg.c_str(), msg.length());
-	side = (side + 1) % board_count;
-	usleep(20000);
-	messages_sent++;
+bool CLeds::startCommunication() {
+	if (receiving_messages) return true;
+	// the sides are only known after init()
+	if (board_running.empty()) {
+		std::cerr << log_prefix << "Call init() before the infrared communication" << std::endl;
+		return false;
+	}
+	receiving_messages = true;
+	if (pthread_create(&ircomm_rx_thread, NULL, &CLeds::IRCommTxThread, this) != 0) {
+		perror("IRComm pthread_create.\n");
+		receiving_messages = false;
+		return false;
+	}
+	return true;
 }
 
-bool CLeds::message_received() {
-	if (message_recv) {
-		pthread_mutex_lock(&ir_rx_mutex);
-		message_recv = false;
-		pthread_mutex_unlock(&ir_rx_mutex);
-		return true;
+void CLeds::stopCommunication() {
+	if (!receiving_messages) return;
+	receiving_messages = false;
+	pthread_join(ircomm_rx_thread, NULL);
+}
+
+bool CLeds::send_message(const std::string & msg, int side) {
+	if (!startCommunication()) return false;
+	bool queued = false;
+	pthread_mutex_lock(&ir_rx_mutex);
+	if (side < 0) {
+		side = tx_next_side;
+		tx_next_side = (tx_next_side + 1) % board_count;
 	}
-	return false;
+	std::deque<std::string> & queue = tx_queue[side];
+	if (std::find(queue.begin(), queue.end(), msg) != queue.end()) {
+		queued = true;
+	} else if (queue.size() < IRCOMM_QUEUE_SIZE) {
+		queue.push_back(msg);
+		queued = true;
+	}
+	pthread_mutex_unlock(&ir_rx_mutex);
+	return queued;
 }
 
-bool CLeds::encounter() {
-	if (!receiving_messages) {
-		int ret_rx = pthread_create(&ircomm_rx_thread, NULL, IRCommRxThread, this);
-		if (ret_rx != 0) {
-			perror("IRComm pthread_create.\n");
-			return false;
-		}
+void CLeds::beacon(const std::string & msg) {
+	if (!msg.empty() && !startCommunication()) return;
+	pthread_mutex_lock(&ir_rx_mutex);
+	beacon_message = msg;
+	pthread_mutex_unlock(&ir_rx_mutex);
+}
+
+bool CLeds::receive(IRReception & reception) {
+	bool received = false;
+	pthread_mutex_lock(&ir_rx_mutex);
+	if (!rx_queue.empty()) {
+		reception = rx_queue.front();
+		rx_queue.pop_front();
+		received = true;
 	}
-	send_message("hello");
+	pthread_mutex_unlock(&ir_rx_mutex);
+	return received;
+}
+
+bool CLeds::message_received() {
+	pthread_mutex_lock(&ir_rx_mutex);
+	bool received = !rx_queue.empty();
+	rx_queue.clear();
+	pthread_mutex_unlock(&ir_rx_mutex);
+	return received;
+}
+
+/**
+ * Before, every call sent "hello" itself and waited for it, now the beacon goes out on all sides from the thread and
+ * this only looks at what came in.
+ */
+bool CLeds::encounter() {
+	beacon("hello");
 	return message_received();
 }
 
@@ -258,6 +380,12 @@ int CLeds::led_index_to_side(int i) {
  * function.
  */
 void CLeds::sample() {
+	// the sampler thread owns the values
+	if (sampling) return;
+	readBoards();
+}
+
+void CLeds::readBoards() {
 	for (int i = 0; i < 8; i++) {
 		int side = led_index_to_side(i);
 		if (board_running[side]) {
@@ -363,6 +491,10 @@ void CLeds::colorToggle(LedColor color) {
  * todo: check if the calibration can actually be done like this, or must be done separately for each mode
  */
 void CLeds::calibrate(bool turn_around) {
+	// the calibration reads the boards itself
+	bool was_sampling = sampling;
+	stopSampling();
+
 	// enable everything
 	bool e_reflective = enable_reflective;
 	bool e_ambient = enable_ambient;
@@ -376,6 +508,11 @@ void CLeds::calibrate(bool turn_around) {
 	power_all(LT_NORMAL, false);
 	power_all(LT_REFLECTIVE, true);
 
+	// the offsets are summed from zero, not on top of the ones loaded before
+	std::fill(offset_reflective.begin(), offset_reflective.end(), 0);
+	std::fill(offset_ambient.begin(), offset_ambient.end(), 0);
+	std::fill(offset_proximity.begin(), offset_proximity.end(), 0);
+
 	int turns = 1;
 	if (turn_around) {
 		turns = 360/45;
@@ -456,6 +593,12 @@ void CLeds::calibrate(bool turn_around) {
 			}
 			optionfile.Save(optionfile_name);
 		}
+		for(int i=0;i<irled_count;i++) {
+			variance_reflective[i] = hist_reflective.variance(i);
+			variance_ambient[i] = hist_ambient.variance(i);
+			variance_proximity[i] = hist_proximity.variance(i);
+		}
+		save_calibration();
 	}
 
 	power_all(LT_REFLECTIVE, false);
@@ -466,6 +609,7 @@ void CLeds::calibrate(bool turn_around) {
 	enable_ambient = e_ambient;
 	enable_proximity = e_proximity;
 
+	if (was_sampling) startSampling(sample_period);
 }
 
 /**
@@ -473,6 +617,8 @@ void CLeds::calibrate(bool turn_around) {
  * exist, it will just drop out.
  */
 void CLeds::get_calibration() {
+	if (load_calibration()) return;
+
 	if( access( optionfile_name.c_str(), F_OK ) != -1 ) {
 		optionfile.Load(optionfile_name);
 	} else {
@@ -552,7 +698,142 @@ void CLeds::get_calibration() {
 
 }
 
+static void write_values(FILE *file, const std::vector<int32_t> & values) {
+	for (size_t i = 0; i < values.size(); i++) fprintf(file, " %d", values[i]);
+}
+
+static bool read_values(std::istringstream & line, std::vector<int32_t> & values) {
+	for (size_t i = 0; i < values.size(); i++) {
+		if (!(line >> values[i])) return false;
+	}
+	return true;
+}
+
+/**
+ * A line of IR_CALIB_FILE is the robot id, the type of the robot, and the reflective, ambient and proximity offsets
+ * and then variances of the leds.
+ */
+bool CLeds::load_calibration() {
+	std::ifstream file(IR_CALIB_FILE);
+	if (!file.is_open()) return false;
+	std::string text;
+	while (std::getline(file, text)) {
+		std::istringstream line(text);
+		int id, robot_type;
+		if (!(line >> id >> robot_type) || id != robot_id || robot_type != type) continue;
+		std::vector<int32_t> values(6 * irled_count);
+		if (!read_values(line, values)) {
+			std::cerr << log_prefix << "The calibration of robot " << robot_id << " in " << IR_CALIB_FILE <<
+					" is not complete" << std::endl;
+			return false;
+		}
+		std::vector<int32_t>::iterator v = values.begin();
+		std::copy(v, v + irled_count, offset_reflective.begin()); v += irled_count;
+		std::copy(v, v + irled_count, offset_ambient.begin()); v += irled_count;
+		std::copy(v, v + irled_count, offset_proximity.begin()); v += irled_count;
+		std::copy(v, v + irled_count, variance_reflective.begin()); v += irled_count;
+		std::copy(v, v + irled_count, variance_ambient.begin()); v += irled_count;
+		std::copy(v, v + irled_count, variance_proximity.begin());
+		if (log_level >= LOG_INFO) {
+			std::cout << log_prefix << "Calibration of robot " << robot_id << " read from " << IR_CALIB_FILE << std::endl;
+		}
+		return true;
+	}
+	return false;
+}
+
+bool CLeds::save_calibration() {
+	std::vector<std::string> others;
+	std::ifstream in(IR_CALIB_FILE);
+	std::string text;
+	while (std::getline(in, text)) {
+		std::istringstream line(text);
+		int id, robot_type;
+		if ((line >> id >> robot_type) && id == robot_id && robot_type == type) continue;
+		if (!text.empty()) others.push_back(text);
+	}
+	in.close();
+
+	FILE *file = fopen(IR_CALIB_FILE, "w");
+	if (file == NULL) {
+		std::cerr << log_prefix << "Can not write the calibration to " << IR_CALIB_FILE << std::endl;
+		return false;
+	}
+	for (size_t i = 0; i < others.size(); i++) fprintf(file, "%s\n", others[i].c_str());
+	fprintf(file, "%d %d", robot_id, (int)type);
+	write_values(file, offset_reflective);
+	write_values(file, offset_ambient);
+	write_values(file, offset_proximity);
+	write_values(file, variance_reflective);
+	write_values(file, variance_ambient);
+	write_values(file, variance_proximity);
+	fprintf(file, "\n");
+	fclose(file);
+	return true;
+}
+
+void CLeds::recalibrate(bool on) {
+	if (on && !recalibrating) {
+		RunningStatistic empty = { 0, 0, 0 };
+		std::fill(running_reflective.begin(), running_reflective.end(), empty);
+		std::fill(running_ambient.begin(), running_ambient.end(), empty);
+		std::fill(running_proximity.begin(), running_proximity.end(), empty);
+		recalib_frames = 0;
+	}
+	recalibrating = on;
+}
+
+/**
+ * The weight of a reading is one over the count, so the mean is exact at first and then follows about the last window
+ * readings, and the variance is updated with the same weight.
+ */
+static void add_reading(int window, double value, int & count, double & mean, double & variance) {
+	if (count < window) count++;
+	double weight = 1.0 / count;
+	double difference = value - mean;
+	mean += weight * difference;
+	variance = (1 - weight) * (variance + weight * difference * difference);
+}
+
+/**
+ * Only a frame in which every reflective led stays below half its collision threshold counts, then nothing is near and
+ * the readings are what the offsets should subtract. Every IR_RECALIB_UPDATE of those frames the means become the
+ * offsets, and the variances, scaled to the sum over the window that the histograms give in calibrate(), the variances.
+ */
+void CLeds::recalibrate_frame() {
+	int threshold = collision_threshold(0) / 2;
+	for (int i = 0; i < irled_count; i++) {
+		if (reflective(i) > threshold) return;
+	}
+	for (int i = 0; i < irled_count; i++) {
+		RunningStatistic & r = running_reflective[i];
+		add_reading(IR_RECALIB_WINDOW, reflective(i, false), r.count, r.mean, r.variance);
+		RunningStatistic & a = running_ambient[i];
+		add_reading(IR_RECALIB_WINDOW, ambient(i, false), a.count, a.mean, a.variance);
+		RunningStatistic & p = running_proximity[i];
+		add_reading(IR_RECALIB_WINDOW, proximity(i, false), p.count, p.mean, p.variance);
+	}
+	if (++recalib_frames < IR_RECALIB_UPDATE) return;
+	recalib_frames = 0;
+	for (int i = 0; i < irled_count; i++) {
+		offset_reflective[i] = (int32_t)(running_reflective[i].mean + 0.5);
+		offset_ambient[i] = (int32_t)(running_ambient[i].mean + 0.5);
+		offset_proximity[i] = (int32_t)(running_proximity[i].mean + 0.5);
+		variance_reflective[i] = (int32_t)(running_reflective[i].variance * window_size);
+		variance_ambient[i] = (int32_t)(running_ambient[i].variance * window_size);
+		variance_proximity[i] = (int32_t)(running_proximity[i].variance * window_size);
+	}
+	if (log_level >= LOG_INFO) {
+		std::cout << log_prefix << "Recalibrated reflective offsets ";
+		dobots::print(offset_reflective.begin(), offset_reflective.end());
+	}
+}
+
 void CLeds::reset() {
+	if (sampling) {
+		reset_requested = true;
+		return;
+	}
 	for (int i=0; i < irled_count; i++) {
 		hist_reflective.clear(i);
 		hist_ambient.clear(i);
@@ -561,30 +842,188 @@ void CLeds::reset() {
 }
 
 /**
- * Returns in 2000 milliseconds times the number of IR leds, so 0.016 seconds.
+ * The sampler thread runs sampleFrame() once per period, until stopSampling() clears the flag. It wakes up at fixed
+ * times, like the odometry thread of CMotors, so the rate does not drift with the time the boards take to answer.
  */
-void CLeds::update() {
-	sample();
-
-	int us = 1000;
-	for (int i=0; i < irled_count; i++) {
-		if (enable_ambient) {
-			hist_ambient.push(i, ambient(i));
-			usleep(us);
+void *CLeds::samplerThread(void *l) {
+	CLeds *leds = (CLeds*) l;
+	schedThread("leds");
+	long long next = sampleTime();
+	while (leds->sampling) {
+		next += leds->sample_period;
+		long long now = sampleTime();
+		if (next > now) {
+			usleep(next - now);
+		} else if (now - next > 10 * leds->sample_period) {
+			next = now;
 		}
-		if (enable_reflective) {
-			hist_reflective.push(i, reflective(i));
-			usleep(us);
+		if (!leds->sampling) break;
+		leds->sampleFrame();
+	}
+	return NULL;
+}
+
+bool CLeds::startSampling(int period) {
+	if (sampling) return true;
+	sample_period = period;
+	// the first frame is published before anyone can ask for it
+	sampleFrame();
+	sampling = true;
+	if (pthread_create(&sampler_thread, NULL, &CLeds::samplerThread, this) != 0) {
+		std::cerr << log_prefix << "Could not start the sampler thread" << std::endl;
+		sampling = false;
+		return false;
+	}
+	return true;
+}
+
+void CLeds::stopSampling() {
+	if (!sampling) return;
+	sampling = false;
+	pthread_join(sampler_thread, NULL);
+}
+
+/**
+ * Reads the boards, pushes the frame into the histograms and writes it with their averages into the buffer that is not
+ * published, then publishes that one. A reader that still copies the other buffer is not disturbed, and one that is
+ * overtaken by two frames sees the sequence of its buffer change and copies again.
+ */
+void CLeds::sampleFrame() {
+	if (reset_requested) {
+		reset_requested = false;
+		for (int i=0; i < irled_count; i++) {
+			hist_reflective.clear(i);
+			hist_ambient.clear(i);
+			hist_proximity.clear(i);
 		}
-		if (enable_proximity) {
-			hist_proximity.push(i, proximity(i));
-			usleep(us);
+	}
+
+	long long timestamp = sampleTime();
+	readBoards();
+
+	int index = (published == 0) ? 1 : 0;
+	IRFrame & frame = frames[index];
+	frame_sequence[index] = frame_sequence[index] + 1;
+	__sync_synchronize();
+	frame.timestamp = timestamp;
+	frame.sequence = frames[1-index].sequence + 1;
+	for (int i = 0; i < irled_count; i++) {
+		frame.reflective[i] = reflective(i);
+		frame.ambient[i] = ambient(i);
+		frame.proximity[i] = proximity(i);
+	}
+	if (enable_reflective) {
+		hist_reflective.push(frame.reflective);
+		hist_reflective.average(frame.average_reflective);
+	}
+	if (enable_ambient) {
+		hist_ambient.push(frame.ambient);
+		hist_ambient.average(frame.average_ambient);
+	}
+	if (enable_proximity) {
+		hist_proximity.push(frame.proximity);
+		hist_proximity.average(frame.average_proximity);
+	}
+	__sync_synchronize();
+	frame_sequence[index] = frame_sequence[index] + 1;
+	published = index;
+
+	if (frame_log != NULL) {
+		FrameLogIR record;
+		memcpy(record.reflective, frame.reflective, sizeof(record.reflective));
+		memcpy(record.ambient, frame.ambient, sizeof(record.ambient));
+		memcpy(record.proximity, frame.proximity, sizeof(record.proximity));
+		memcpy(record.average_reflective, frame.average_reflective, sizeof(record.average_reflective));
+		memcpy(record.average_ambient, frame.average_ambient, sizeof(record.average_ambient));
+		memcpy(record.average_proximity, frame.average_proximity, sizeof(record.average_proximity));
+		frame_log->append(FRAME_LOG_IR, &record, sizeof(record), timestamp);
+	}
+
+	if (enable_reflective) check_collisions(frame);
+	if (recalibrating) recalibrate_frame();
+}
+
+int CLeds::watchCollision(LedLocation loc, int adjust_threshold, CollisionCallback callback, void *context) {
+	pthread_mutex_lock(&watch_mutex);
+	int index = -1;
+	if (watch_count < LEDS_COLLISION_WATCHES) {
+		index = watch_count++;
+		CollisionWatch & watch = watches[index];
+		watch.led = collision_led(loc);
+		watch.threshold = collision_threshold(adjust_threshold);
+		watch.callback = callback;
+		watch.context = context;
+		watch.active = false;
+	}
+	pthread_mutex_unlock(&watch_mutex);
+	if (index < 0) std::cerr << log_prefix << "No room to watch another collision" << std::endl;
+	return index;
+}
+
+void CLeds::clearCollisionWatches() {
+	pthread_mutex_lock(&watch_mutex);
+	watch_count = 0;
+	pthread_mutex_unlock(&watch_mutex);
+}
+
+/**
+ * Only the crossing of the threshold calls the callback, so a jockey that is still busy with the last collision does
+ * not get it again on every frame.
+ */
+void CLeds::check_collisions(const IRFrame & frame) {
+	pthread_mutex_lock(&watch_mutex);
+	for (int i = 0; i < watch_count; i++) {
+		CollisionWatch & watch = watches[i];
+		int avg = frame.average_reflective[watch.led];
+		if (avg > watch.threshold) {
+			if (!watch.active) {
+				watch.active = true;
+				watch.callback(watch.context, watch.led, avg);
+			}
+		} else {
+			watch.active = false;
 		}
 	}
-	if (log_level >= LOG_INFO) {
-		std::vector<int> values;
-		values.resize(irled_count);
+	pthread_mutex_unlock(&watch_mutex);
+}
+
+bool CLeds::getFrame(IRFrame & frame) const {
+	uint32_t before, after;
+	do {
+		int index = published;
+		if (index < 0) return false;
+		before = frame_sequence[index];
+		__sync_synchronize();
+		memcpy(&frame, &frames[index], sizeof(IRFrame));
+		__sync_synchronize();
+		after = frame_sequence[index];
+	} while ((before & 1) || before != after);
+	return true;
+}
+
+/**
+ * Pushes the sample of every IR led as one frame per mode, the values are already there after sample(), so there is no
+ * need to wait in between. While the sampler thread runs it does that already, and this does nothing.
+ */
+void CLeds::update() {
+	if (sampling) return;
+	sample();
 
+	std::vector<int> values;
+	values.resize(irled_count);
+	if (enable_ambient) {
+		for (int i=0; i < irled_count; i++) values[i] = ambient(i);
+		hist_ambient.push(values.begin());
+	}
+	if (enable_reflective) {
+		for (int i=0; i < irled_count; i++) values[i] = reflective(i);
+		hist_reflective.push(values.begin());
+	}
+	if (enable_proximity) {
+		for (int i=0; i < irled_count; i++) values[i] = proximity(i);
+		hist_proximity.push(values.begin());
+	}
+	if (log_level >= LOG_INFO) {
 		if (enable_reflective) {
 			hist_reflective.average(values.begin());
 			std::cout << log_prefix << "Reflective (smoothed) ";
@@ -608,6 +1047,7 @@ void CLeds::update() {
  * that.
  */
 void CLeds::update(int i) {
+	if (sampling) return;
 	if (enable_ambient)	hist_ambient.push(i, ambient(i));
 	if (enable_reflective) hist_reflective.push(i, reflective(i));
 	if (enable_proximity) hist_proximity.push(i, proximity(i));
@@ -621,6 +1061,8 @@ void CLeds::update(int i) {
  * from the proximity mode, where an active object (another robot) is detected by the signals it emits.
  */
 int CLeds::distance(int i) {
+	IRFrame frame;
+	if (sampling && getFrame(frame)) return frame.average_reflective[i];
 	update(i);
 	//return hist_ambient.average(i);
 	return hist_reflective.average(i);
@@ -649,15 +1091,19 @@ int CLeds::distance(int i) {
  * of the highest value (which is assumed to be the most spacious direction).
  */
 void CLeds::direction(int & sign_speed, int & radius) {
-	update();
-
 	float beta = 360 / irled_count; // = 360/8 is 45 degrees
 	float start = -beta/2.0;
 
 	// get the averaged values from each LED
 	std::vector<float> avg_values;
 	avg_values.resize(irled_count, 0);
-	hist_reflective.average(avg_values.begin());
+	IRFrame frame;
+	if (sampling && getFrame(frame)) {
+		std::copy(frame.average_reflective, frame.average_reflective + irled_count, avg_values.begin());
+	} else {
+		update();
+		hist_reflective.average(avg_values.begin());
+	}
 
 	std::cout << log_prefix << "Averages: ";
 	for (int i = 0; i < avg_values.size(); ++i) {
@@ -755,7 +1201,7 @@ void CLeds::direction(int & sign_speed, int & radius) {
 }
 
 
-bool CLeds::collision(LedLocation loc, int adjust_threshold) {
+LedLocation CLeds::collision_led(LedLocation loc) {
 	int intLoc = ((((int) loc)/2)*2);
 
 	LedLocation best_led;
@@ -765,6 +1211,10 @@ bool CLeds::collision(LedLocation loc, int adjust_threshold) {
 	} else {
 		best_led = (LedLocation)(intLoc+1);
 	}
+	return best_led;
+}
+
+int CLeds::collision_threshold(int adjust_threshold) {
 	int threshold = 15 + adjust_threshold;
 	switch (type) {
 		case RobotBase::SCOUTBOT:{
@@ -777,10 +1227,22 @@ bool CLeds::collision(LedLocation loc, int adjust_threshold) {
 		default:
 			break;
 	}
+	return threshold;
+}
 
-	sample(); // cannot hurt, and you might forget
-	update(best_led);
-	int avg = hist_reflective.average((int)best_led) ;
+bool CLeds::collision(LedLocation loc, int adjust_threshold) {
+	LedLocation best_led = collision_led(loc);
+	int threshold = collision_threshold(adjust_threshold);
+
+	int avg;
+	IRFrame frame;
+	if (sampling && getFrame(frame)) {
+		avg = frame.average_reflective[best_led];
+	} else {
+		sample(); // cannot hurt, and you might forget
+		update(best_led);
+		avg = hist_reflective.average((int)best_led);
+	}
 
 	std::cout << log_prefix << "Smoothing average from best LED [" << best_led << "]: " << avg << std::endl;
 
@@ -32,11 +32,30 @@
 
 #include <syslog.h>
 #include <vector>
+#include <deque>
 
 #include <worldfile.h>
 #include <pthread.h>
 
 #include <CMultiHistogram.h>
+#include <CFrameLog.h>
+
+//! Period in us of the sampler thread, a frame from all boards every period
+#define LEDS_SAMPLE_PERIOD 20000
+//! Infrared leds of a frame
+#define LEDS_IR_COUNT 8
+//! Collisions the sampler thread can watch at the same time
+#define LEDS_COLLISION_WATCHES 4
+//! Calibration of the infrared leds of all robots, a line per robot id
+#define IR_CALIB_FILE "/flash/irCALIB.dat"
+//! The running statistics of the recalibration weigh about the last as many frames
+#define IR_RECALIB_WINDOW 500
+//! Frames between two updates of the offsets by the recalibration
+#define IR_RECALIB_UPDATE 100
+//! Period in us of the infrared communication thread, it sends to one side per period
+#define IRCOMM_PERIOD 20000
+//! Messages waiting per side to be sent, and messages received that nobody took yet
+#define IRCOMM_QUEUE_SIZE 16
 
 enum LedType { LT_REFLECTIVE, LT_AMBIENT, LT_PROXIMITY, LT_NORMAL, LT_ENUM_SIZE };
 
@@ -65,8 +84,44 @@ enum LedLocation {
 	LL_RIGHT_FRONT = 7
 };
 
+/**
+ * One sample of all infrared leds, with the offsets of the calibration subtracted, and the averages over the sliding
+ * window up to and including it. The averages of a mode that is not enabled stay zero.
+ */
+struct IRFrame {
+	//! Time in us of gettimeofday() at which the boards were read, the clock of CMotors::getPositionAt()
+	long long timestamp;
+	//! Counts the frames since startSampling()
+	uint32_t sequence;
+	int32_t reflective[LEDS_IR_COUNT];
+	int32_t ambient[LEDS_IR_COUNT];
+	int32_t proximity[LEDS_IR_COUNT];
+	int32_t average_reflective[LEDS_IR_COUNT];
+	int32_t average_ambient[LEDS_IR_COUNT];
+	int32_t average_proximity[LEDS_IR_COUNT];
+};
+
+/**
+ * Infrared messages are read by the communication thread as soon as they arrive. The irobot library does not tell
+ * which side or what, so a reception is the time it was read.
+ */
+struct IRReception {
+	//! Time in us of gettimeofday()
+	long long timestamp;
+};
+
+/**
+ * Called from the sampler thread with the led that is used for the location and its average, in the frame in which the
+ * average crosses the collision threshold. It runs before the next frame is sampled, so keep it short.
+ */
+typedef void (*CollisionCallback)(void *context, LedLocation loc, int value);
+
 /**
  * Everything around the infrared and other types of leds on the robot.
+ *
+ * After startSampling() a thread reads all boards every period and publishes each frame in one of two buffers, the one
+ * the readers do not use. Then update() does nothing, and distance(), collision() and direction() only read the last
+ * frame, so they do not wait for the boards anymore.
  */
 class CLeds {
 public:
@@ -82,13 +137,27 @@ public:
 	//! Do the calibration now, if turn_around use the wheels to turn around
 	void calibrate(bool turn_around = true);
 
-	//! Get previously calibrated values
+	//! Get previously calibrated values, of this robot from IR_CALIB_FILE, otherwise from the option file of the type
 	void get_calibration();
 
+	//! Read the calibration of this robot from IR_CALIB_FILE, false if it has none
+	bool load_calibration();
+
+	//! Write the calibration of this robot into IR_CALIB_FILE, the lines of the other robots stay
+	bool save_calibration();
+
+	/**
+	 * Let the sampler thread adapt the offsets to the readings while nothing is near, as the robot drives around,
+	 * instead of turning on the spot in calibrate().
+	 */
+	void recalibrate(bool on = true);
+
+	inline bool isRecalibrating() const { return recalibrating; }
+
 	//! Map from led index to side index
 	int led_index_to_side(int i);
 
-	//! Get actual sensor values
+	//! Get actual sensor values, nothing while the sampler thread does that
 	void sample();
 
 	//! Get the reflective led with index i
@@ -100,9 +169,20 @@ public:
 	//! Get the proximity led with index i
 	int proximity(int i, bool offset=true);
 
-	//! Clear all histogram info
+	//! Clear all histogram info, the sampler thread does it before its next frame
 	void reset();
 
+	//! Read the boards from a thread every period in us, the first frame is there when it returns
+	bool startSampling(int period = LEDS_SAMPLE_PERIOD);
+
+	//! Stop the sampler thread, update() reads the boards itself again
+	void stopSampling();
+
+	inline bool isSampling() const { return sampling; }
+
+	//! Copy the last frame of the sampler thread, false if there is none
+	bool getFrame(IRFrame & frame) const;
+
 	//! Update all sensors (includes waiting time)
 	void update();
 
@@ -118,6 +198,16 @@ public:
 	//! Just a collision signal for the front leds
 	bool collision(LedLocation loc=LL_FRONT_LEFT, int adjust_treshold=0);
 
+	/**
+	 * Let the sampler thread call callback each time collision(loc, adjust_threshold) becomes true, instead of polling
+	 * collision(). It is called again only after the average dropped below the threshold. Returns the index of the
+	 * watch, or -1 if there are already LEDS_COLLISION_WATCHES.
+	 */
+	int watchCollision(LedLocation loc, int adjust_threshold, CollisionCallback callback, void *context = NULL);
+
+	//! Remove all watches, no callback runs anymore when this returns
+	void clearCollisionWatches();
+
 	//! Power on the given LED type
 	void power_all(LedType led_type, bool on=true);
 
@@ -133,16 +223,34 @@ public:
 	//! Set verbosity
 	inline void setVerbosity(char verbosity) { log_level = verbosity; }
 
-	//! Thread that continuously checks if there has been a message received over infrared
+	//! Record every frame of the sampler thread, NULL stops it
+	inline void setFrameLog(CFrameLog *log) { frame_log = log; }
+
+	//! Thread that sends the queued messages and continuously checks if there has been a message received over infrared
     static void *IRCommTxThread(void* leds);
 
-    //! Only get indication that "a" message is received, not which message
+	//! Start the communication thread, the functions below start it themselves if needed
+	bool startCommunication();
+
+	//! Stop the communication thread, the queued messages stay queued
+	void stopCommunication();
+
+    //! Only get indication that "a" message is received, not which message, takes all receptions from the queue
 	bool message_received();
 
-	//! Send this message to a random side of the robot
-	void send_message(const std::string & msg);
+	//! Take the oldest reception from the queue, false if there is none
+	bool receive(IRReception & reception);
+
+	/**
+	 * Queue the message for side, or for the next side in turn if side is -1, without waiting for it to be sent. The
+	 * same message waiting already for that side is not queued twice. False if the queue of the side is full.
+	 */
+	bool send_message(const std::string & msg, int side = -1);
+
+	//! Send msg on every side whenever the side has nothing else to send, an empty msg stops the beacon
+	void beacon(const std::string & msg);
 
-	//! Encounter of another robot
+	//! Encounter of another robot, beacons "hello" and tells whether anything was received since the last call
 	bool encounter();
 
 	//! Set prefix for log messages
@@ -202,6 +310,96 @@ private:
 
     pthread_t ircomm_rx_thread;
 
+	pthread_t sampler_thread;
+
+	volatile bool sampling;
+
+	int sample_period;
+
+	//! The sampler thread writes the buffer that is not published, each under its sequence counter, odd while written
+	IRFrame frames[2];
+
+	volatile uint32_t frame_sequence[2];
+
+	//! Index of the last frame written, -1 before the first one
+	volatile int published;
+
+	volatile bool reset_requested;
+
+	CFrameLog *frame_log;
+
+	struct CollisionWatch {
+		LedLocation led;
+		int threshold;
+		CollisionCallback callback;
+		void *context;
+		//! The average is above the threshold, the callback has been called
+		bool active;
+	};
+
+	CollisionWatch watches[LEDS_COLLISION_WATCHES];
+
+	int watch_count;
+
+	//! Held while the watches change and while the sampler thread checks them
+	pthread_mutex_t watch_mutex;
+
+	//! Mean and variance of a led, weighted exponentially once there are IR_RECALIB_WINDOW readings
+	struct RunningStatistic {
+		int count;
+		double mean;
+		double variance;
+	};
+
+	//! The sr_id of the robot, -1 if unknown
+	int robot_id;
+
+	volatile bool recalibrating;
+
+	int recalib_frames;
+
+	std::vector<RunningStatistic> running_reflective;
+
+	std::vector<RunningStatistic> running_ambient;
+
+	std::vector<RunningStatistic> running_proximity;
+
+	//! Add the raw readings of the frame to the running statistics, if no led sees anything near
+	void recalibrate_frame();
+
+	static void *samplerThread(void *leds);
+
+	//! Get the values of all boards that are running into ir_values
+	void readBoards();
+
+	//! The led of the pair at loc that varied least during the calibration
+	LedLocation collision_led(LedLocation loc);
+
+	//! Threshold on the average of a reflective led for a collision on this type of robot
+	int collision_threshold(int adjust_threshold);
+
+	//! Call the callbacks of the watches whose threshold the frame crossed
+	void check_collisions(const IRFrame & frame);
+
+	//! Sample, update the histograms and publish the frame, only from one thread at a time
+	void sampleFrame();
+
+	//! Messages waiting per side, under ir_rx_mutex
+	std::vector<std::deque<std::string> > tx_queue;
+
+	std::string beacon_message;
+
+	//! The side the communication thread sends to next, and the side send_message() queues to next
+	int tx_side;
+
+	int tx_next_side;
+
+	//! Received and not taken yet, under ir_rx_mutex
+	std::deque<IRReception> rx_queue;
+
+	//! Receptions dropped because nobody took them
+	long int messages_dropped;
+
     bool enable_reflective;
 
     bool enable_ambient;
@@ -211,9 +409,7 @@ private:
 public:
 	pthread_mutex_t ir_rx_mutex;
 
-	bool receiving_messages;
-
-	bool message_recv;
+	volatile bool receiving_messages;
 
 	long int messages_sent;
 
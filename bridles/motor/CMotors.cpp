@@ -10,12 +10,38 @@
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <sys/syslog.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <cassert>
+#include <cerrno>
+#include <cstring>
 #include <cmath>
 #include <cstdio>
 
 #include <CMotors.h>
 #include <dim1algebra.hpp>
+#ifdef FIXED_POINT_MATH
+#include <fixmath.h>
+#endif
+#include <CLatencyTrace.h>
+#include <CRobotIndex.h>
+#include <CSched.h>
+#include <messageSchema.h>
+
+#define MOTOR_POSE_MAGIC 0x504f5345
+
+static long long odometryTime() {
+	struct timeval time;
+	gettimeofday(&time, NULL);
+	return (long long) time.tv_sec * 1000000 + time.tv_usec;
+}
+
+//! The angle between the wheels of the ActiveWheel, 60 degrees
+static const double awDelta = 0.523598776;
+static const double awCosDelta = cos(awDelta);
+static const double awSinDelta = sin(awDelta);
+static const double awSin2Delta = sin(2 * awDelta);
 
 /**
  * This class, in the end, will be able to drive robots in multiple ways. A holonomic drive (in which a robot can
@@ -43,6 +69,7 @@ CMotors::CMotors(RobotBase *robot_base, RobotBase::RobotType robot_type) {
 	}
 	this->robot_base = robot_base;
 	this->robot_type = robot_type;
+	frameLog = NULL;
 
 	min_wheel_velocity = 20;  // minimum value send to the motors to make the robot move
 	max_wheel_velocity = 100; // maximum value the motors can take
@@ -56,30 +83,53 @@ CMotors::CMotors(RobotBase *robot_base, RobotBase::RobotType robot_type) {
 	motorOrientation2 = 1;
 	motorOrientation3 = 1;
 
-	buf[0]=0;
-	buf[1]=0;
-	buf[2]=0;
-	buf[3]=0;
-	buf[4]=0;
-	buf[5]=0;
+	memset(buf, 0, sizeof(buf));
+	memset(odometry, 0, sizeof(odometry));
 	actualspeed1=0;
 	actualspeed2=0;
 	actualspeed3=0;
 
 	posX=0;
 	posY=0;
-	posPhi=0;
+	setHeading(0);
 	dx=0;
 	dy=0;
 	dphi=0;
-
-	timer = new CTimer();
-	timer->start();
-	lastTime=timer->getTime();
+	// not a number, so the models derive their constants at the first step
+	cachedKoef2 = cachedKoef3 = cachedHinge = NAN;
+
+	odometryRunning = false;
+	pthread_mutex_init(&odometryMutex, NULL);
+	pthread_mutex_init(&busMutex, NULL);
+	commandDeadband = MOTOR_COMMAND_DEADBAND;
+	commandInterval = MOTOR_COMMAND_INTERVAL;
+	commandPending = false;
+	commandsSent = 0;
+	commandsDropped = 0;
+	motionActive = false;
+	motionHead = 0;
+	motionTail = 0;
+	motionsDone = 0;
+	motionWake = 0;
+	organismSequence = -1;
+	poseSequence = 0;
+	localHistory.count = 0;
+	sharedPose = NULL;
+	poseOwner = getpid();
+	lastTime = odometryTime();
+	lastCommandTime = lastTime - commandInterval;
+	publishPose();
 }
 
 CMotors::~CMotors() {
-
+	stopOdometry();
+	if (sharedPose != NULL) {
+		// the pose stays for the next owner
+		__sync_bool_compare_and_swap(&sharedPose->owner, poseOwner, 0);
+		munmap(sharedPose, sizeof(MotorPoseBlock));
+	}
+	pthread_mutex_destroy(&busMutex);
+	pthread_mutex_destroy(&odometryMutex);
 }
 
 /**
@@ -159,13 +209,275 @@ void CMotors::init() {
 
 	this->go();
 	srand(time(NULL));
+	attachPose();
+	startOdometry();
+}
+
+int CMotors::startOdometry() {
+	if (odometryRunning) return 0;
+	odometryRunning = true;
+	if (pthread_create(&odometryThread, NULL, &CMotors::runOdometry, this) != 0) {
+		std::cerr << log_prefix << "Could not start the odometry thread" << std::endl;
+		odometryRunning = false;
+		return -1;
+	}
+	return 0;
+}
+
+void CMotors::stopOdometry() {
+	if (!odometryRunning) return;
+	odometryRunning = false;
+	pthread_join(odometryThread, NULL);
+}
+
+void* CMotors::runOdometry(void *motors) {
+	schedThread("odometry");
+	((CMotors*) motors)->odometryLoop();
+	return NULL;
+}
+
+/**
+ * The thread wakes up at fixed times rather than after a fixed sleep, so the rate does not drift with the time an
+ * integration takes. After a long stall, for example when the thread was not scheduled, it starts counting again from
+ * now, the integration itself covers the gap, as it always runs over the time since the last one. A motion that waits
+ * for its start time wakes the thread in between, so it starts at that time and not up to a period later.
+ */
+void CMotors::odometryLoop() {
+	long long next = odometryTime();
+	while (odometryRunning) {
+		long long now = odometryTime();
+		long long wake = motionWake;
+		bool early = wake > now && wake < next + MOTOR_ODOMETRY_PERIOD;
+		if (!early) {
+			next += MOTOR_ODOMETRY_PERIOD;
+			wake = next;
+		}
+		if (wake > now) {
+			usleep(wake - now);
+		} else if (now - next > 10 * MOTOR_ODOMETRY_PERIOD) {
+			next = now;
+		}
+		pthread_mutex_lock(&odometryMutex);
+		integrate();
+		pthread_mutex_unlock(&odometryMutex);
+		if (commandPending) flushCommand();
+		if (motionActive || motionHead != motionTail) runMotion();
+	}
 }
 
+void CMotors::integrate() {
+	long long now = odometryTime();
+	double timediff = (now - lastTime) / 1000.0;
+	lastTime = now;
+	// the pose of another owner is not integrated here, it would only be thrown away
+	if (timediff > 0 && ownsPose()) {
+		switch (robot_type) {
+		case RobotBase::ACTIVEWHEEL:
+			countOdometryTimeAW(timediff, odometry[5]);
+			break;
+		case RobotBase::KABOT:
+			countOdometryTimeKB(timediff);
+			break;
+		case RobotBase::SCOUTBOT:
+			countOdometryTimeS(timediff);
+			break;
+		default:
+			break;
+		}
+	}
+	publishPose();
+}
+
+//! Called with odometryMutex, or before the thread runs
+void CMotors::publishPose(const double *shift) {
+	poseSequence = poseSequence + 1;
+	__sync_synchronize();
+	memcpy(pose, odometry, sizeof(pose));
+	if (sharedPose == NULL) recordPose(&localHistory, shift);
+	__sync_synchronize();
+	poseSequence = poseSequence + 1;
+	if (sharedPose != NULL && sharedPose->owner == poseOwner) {
+		// an owner that just lost the block may still pass the check, the counter lets only one write at a time
+		uint32_t sequence = sharedPose->sequence;
+		if (!(sequence & 1) && __sync_bool_compare_and_swap(&sharedPose->sequence, sequence, sequence + 1)) {
+			memcpy(sharedPose->pose, odometry, sizeof(odometry));
+			recordPose(&sharedPose->history, shift);
+			__sync_synchronize();
+			sharedPose->sequence = sequence + 2;
+		}
+	}
+}
+
+/**
+ * Called while the pose the history belongs to is written. The integrator publishes far more often than the history
+ * keeps poses, so the newest pose is overwritten until it is a period after the one before it.
+ */
+void CMotors::recordPose(MotorPoseHistory *history, const double *shift) {
+	uint32_t count = history->count;
+	if (shift != NULL) {
+		uint32_t kept = count < MOTOR_POSE_HISTORY ? count : MOTOR_POSE_HISTORY;
+		for (uint32_t i = 0; i < kept; i++) {
+			history->stamps[i].x += shift[0];
+			history->stamps[i].y += shift[1];
+			history->stamps[i].phi += shift[2];
+		}
+	}
+	if (count < 2 || history->stamps[(count - 1) % MOTOR_POSE_HISTORY].time
+			- history->stamps[(count - 2) % MOTOR_POSE_HISTORY].time >= MOTOR_POSE_HISTORY_PERIOD) {
+		count++;
+	}
+	MotorPoseStamp & stamp = history->stamps[(count - 1) % MOTOR_POSE_HISTORY];
+	stamp.time = lastTime;
+	stamp.x = odometry[0];
+	stamp.y = odometry[1];
+	stamp.phi = odometry[2];
+	history->count = count;
+}
+
+bool CMotors::interpolatePose(const MotorPoseHistory *history, long long time, double *result) {
+	uint32_t count = history->count;
+	if (count == 0) return false;
+	uint32_t kept = count < MOTOR_POSE_HISTORY ? count : MOTOR_POSE_HISTORY;
+	const MotorPoseStamp *newer = &history->stamps[(count - 1) % MOTOR_POSE_HISTORY];
+	if (time >= newer->time) {
+		result[0] = newer->x;
+		result[1] = newer->y;
+		result[2] = newer->phi;
+		return true;
+	}
+	for (uint32_t i = 2; i <= kept; i++) {
+		const MotorPoseStamp *older = &history->stamps[(count - i) % MOTOR_POSE_HISTORY];
+		if (older->time <= time) {
+			double span = newer->time - older->time;
+			double f = span > 0 ? (time - older->time) / span : 1;
+			// phi is not wrapped by the integrator, so the poses can be interpolated as they are
+			result[0] = older->x + f * (newer->x - older->x);
+			result[1] = older->y + f * (newer->y - older->y);
+			result[2] = older->phi + f * (newer->phi - older->phi);
+			return true;
+		}
+		newer = older;
+	}
+	result[0] = newer->x;
+	result[1] = newer->y;
+	result[2] = newer->phi;
+	return false;
+}
+
+void CMotors::readPose(double *result) {
+	if (!ownsPose()) {
+		readSharedPose(result);
+		return;
+	}
+	unsigned int before, after;
+	do {
+		before = poseSequence;
+		__sync_synchronize();
+		memcpy(result, pose, sizeof(pose));
+		__sync_synchronize();
+		after = poseSequence;
+	} while ((before & 1) || before != after);
+}
+
+void CMotors::readSharedPose(double *result) {
+	uint32_t before, after;
+	do {
+		before = sharedPose->sequence;
+		__sync_synchronize();
+		memcpy(result, sharedPose->pose, sizeof(sharedPose->pose));
+		__sync_synchronize();
+		after = sharedPose->sequence;
+	} while ((before & 1) || before != after);
+}
+
+/**
+ * The first CMotors on the robot creates the segment, the others map it. It is never removed, so the pose outlives the
+ * jockeys that come and go.
+ */
+void CMotors::attachPose() {
+	char name[64];
+	segmentName(MOTOR_POSE_NAME, name, sizeof(name));
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	bool create = fd >= 0;
+	if (!create) fd = shm_open(name, O_RDWR, 0600);
+	if (fd < 0) {
+		std::cerr << log_prefix << "No shared pose, " << strerror(errno) << std::endl;
+		return;
+	}
+	if (create && ftruncate(fd, sizeof(MotorPoseBlock)) < 0) {
+		std::cerr << log_prefix << "Shared pose can not be sized, " << strerror(errno) << std::endl;
+		close(fd);
+		shm_unlink(name);
+		return;
+	}
+	// a segment another jockey just created may not have its size yet
+	struct stat status;
+	for (int i = 0; i < 100 && fstat(fd, &status) == 0 && status.st_size < (off_t) sizeof(MotorPoseBlock); i++) {
+		usleep(1000);
+	}
+	if (fstat(fd, &status) != 0 || status.st_size < (off_t) sizeof(MotorPoseBlock)) {
+		std::cerr << log_prefix << "Shared pose has no size" << std::endl;
+		close(fd);
+		return;
+	}
+	void *ptr = mmap(NULL, sizeof(MotorPoseBlock), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ptr == MAP_FAILED) {
+		std::cerr << log_prefix << "Shared pose can not be mapped, " << strerror(errno) << std::endl;
+		return;
+	}
+	MotorPoseBlock *block = (MotorPoseBlock*) ptr;
+	if (create) {
+		block->owner = 0;
+		block->sequence = 0;
+		memset(block->pose, 0, sizeof(block->pose));
+		__sync_synchronize();
+		block->magic = MOTOR_POSE_MAGIC;
+	} else {
+		for (int i = 0; i < 100 && block->magic != MOTOR_POSE_MAGIC; i++) {
+			usleep(1000);
+		}
+		if (block->magic != MOTOR_POSE_MAGIC) {
+			std::cerr << log_prefix << "Shared memory " << name << " is not a pose" << std::endl;
+			munmap(ptr, sizeof(MotorPoseBlock));
+			return;
+		}
+	}
+	pthread_mutex_lock(&odometryMutex);
+	sharedPose = block;
+	pthread_mutex_unlock(&odometryMutex);
+}
+
+/**
+ * The pose of the previous owner is taken over, with the wheels and the hinge, unless the block was never written,
+ * then the pose of this CMotors is the first one.
+ */
+void CMotors::claimPose() {
+	if (ownsPose()) return;
+	int32_t previous;
+	do {
+		previous = sharedPose->owner;
+	} while (!__sync_bool_compare_and_swap(&sharedPose->owner, previous, poseOwner));
+	if (sharedPose->sequence != 0) {
+		readSharedPose(odometry);
+		posX = odometry[0];
+		posY = odometry[1];
+		setHeading(odometry[2]);
+	}
+	lastTime = odometryTime();
+	publishPose();
+}
+
+//! The motion up to now is integrated with the old coefficients
 void CMotors::calibrate(MotorCalibResult calibrationResult){
+	pthread_mutex_lock(&odometryMutex);
+	integrate();
 	this->odometry_koef1=calibrationResult.odometry_koef1;
 	this->odometry_koef2=calibrationResult.odometry_koef2;
 	this->odometry_koef3=calibrationResult.odometry_koef3;
 	this->calibratedSpeed=calibrationResult.calibratedSpeed;
+	prepareOdometry(odometry[5]);
+	pthread_mutex_unlock(&odometryMutex);
 	if (log_level >= LOG_INFO) {
 		std::cout << log_prefix << "calibrating on " << calibratedSpeed << std::endl;
 	}
@@ -317,13 +629,12 @@ void CMotors::setRadianSpeeds(int forward, int radius) {
 		break;
 	}
 	case RobotBase::SCOUTBOT: {
-		ScoutBot *bot = (ScoutBot*)robot_base;
 		int left, right;
 		translate(forward, radius, left, right);
 		if (log_level >= LOG_NOTICE) {
 			std::cout << log_prefix << "Send command to the wheels [left,right]=[" << left << ',' << right << ']' << std::endl;
 		}
-		bot->Move(motorOrientation1*left,motorOrientation2*right);
+		setMotorSpeedsS(left, right);
 		break;
 	}
 	default:
@@ -356,7 +667,6 @@ void CMotors::rotate(int degrees) {
 		break;
 	}
 	case RobotBase::SCOUTBOT: {
-		ScoutBot *bot = (ScoutBot*)robot_base;
 		int left = 40; int right = -40;
 		if (degrees < 0) {
 			left = -left;
@@ -365,11 +675,11 @@ void CMotors::rotate(int degrees) {
 		if (log_level >= LOG_NOTICE) {
 			std::cout << log_prefix << "Make wheels rotating [left,right]=[" << left << ',' << right << ']' << std::endl;
 		}
-		bot->Move(motorOrientation1*left,motorOrientation2*right);
+		setMotorSpeedsS(left, right);
 		// rotations per second, in case left and right are +/- 40
 		static const int us_per_degree = 20000; //25000;
 		usleep(us_per_degree * abs(degrees));
-		bot->Move(0,0);
+		setMotorSpeedsS(0, 0);
 		break;
 	}
 	default:
@@ -387,13 +697,26 @@ void CMotors::rotate(int degrees) {
  * Always try to use calibrated speed for motions to avoid nonlinearity in speed setting
  */
 void CMotors::setSpeeds(int forward, int turn) {
+	if (robot_type == RobotBase::ACTIVEWHEEL) {
+		std::cout << "Set speeds to " << forward << " and " << turn << std::endl;
+	}
+	int speed[3];
+	if (wheelSpeeds(forward, turn, speed)) {
+		command(speed[0], speed[1], speed[2]);
+		// ends the trace of the detection the jockey follows, see traceFollow
+		traceAction(TRACE_MOTOR);
+	}
+}
+
+//! The speeds of the wheels for setSpeeds(), false if the layout of the robot is unknown
+bool CMotors::wheelSpeeds(int forward, int turn, int *speed) {
 	//std::cout << log_prefix << "robot type is %d\n",this->robot_type);
+	speed[2] = 0;
 	switch (robot_type) {
 	case RobotBase::ACTIVEWHEEL: {
 		//drive differentially - means two down wheel speeds are equal
 		//can not turn and forward 100% and 100% - therefore count equivalent
 		//max turn is on place turning
-		std::cout << "Set speeds to " << forward << " and " << turn << std::endl;
 		int speedtop;
 		int speeddown;
 		float curving_factor=1-(abs(turn)/100.0);
@@ -420,9 +743,10 @@ void CMotors::setSpeeds(int forward, int turn) {
 		}
 
 		float top_faster=2*odometry_koef1/odometry_koef2;//count how much alone wheel must be faster
-		setMotorSpeedsAW(-speeddown/top_faster,-speeddown/top_faster,speedtop);
-
-		break;
+		speed[0] = -speeddown/top_faster;
+		speed[1] = -speeddown/top_faster;
+		speed[2] = speedtop;
+		return true;
 	}
 	case RobotBase::KABOT: {
 		//max rotation is when one wheel is max speed and one null
@@ -441,8 +765,9 @@ void CMotors::setSpeeds(int forward, int turn) {
 				speedrear = turn;
 			}
 		}
-		setMotorSpeedsKB(speedfront,speedrear);
-		break;
+		speed[0] = speedfront;
+		speed[1] = speedrear;
+		return true;
 	}
 	case RobotBase::SCOUTBOT: {
 		//drive forward with speed forward and rotate with speed turn
@@ -473,14 +798,13 @@ void CMotors::setSpeeds(int forward, int turn) {
 		}
 
 		float leftfaster=odometry_koef1/odometry_koef2;
-		setMotorSpeedsS(speedleft/leftfaster,-speedright);
-
-		break;
-		usleep(100000); // at least 0.1 second per command
+		speed[0] = speedleft/leftfaster;
+		speed[1] = -speedright;
+		return true;
 	}
 	default:
 		std::cerr << log_prefix <<"There is no way to drive a robot without knowing its layout" << std::endl;
-		break;
+		return false;
 	}
 }
 
@@ -492,7 +816,19 @@ void CMotors::randomSpeeds(){
 	this->setSpeeds(rand() % 30 + 30, rand() % 50 + 30 );
 }
 
+//! Also drops a command that waits, so it cannot start the wheels again
 void CMotors::set_to_zero() {
+	pthread_mutex_lock(&busMutex);
+	pthread_mutex_lock(&odometryMutex);
+	claimPose();
+	integrate();
+	actualspeed1 = 0;
+	actualspeed2 = 0;
+	actualspeed3 = 0;
+	if (commandPending) commandsDropped++;
+	commandPending = false;
+	lastCommandTime = lastTime;
+	pthread_mutex_unlock(&odometryMutex);
 	switch (robot_type) {
 	case RobotBase::ACTIVEWHEEL: {
 		ActiveWheel *bot = (ActiveWheel*)robot_base;
@@ -515,6 +851,7 @@ void CMotors::set_to_zero() {
 		std::cerr << log_prefix <<"in function halt no robot type" << std::endl;
 		break;
 	}
+	pthread_mutex_unlock(&busMutex);
 }
 
 //! Halt does not set last command, so go() can be used to continue
@@ -582,16 +919,7 @@ void CMotors::go() {
 void CMotors::setMotorSpeedsKB(int sFront,int sRear)
 {
 	if(robot_type==RobotBase::KABOT){
-		countOdometryTimeKB(timer->getTime()-lastTime);
-		if(actualspeed1!=sFront || actualspeed2!=sRear){
-			actualspeed1=sFront;
-			actualspeed2=sRear;
-			KaBot *bot = (KaBot*)robot_base;
-			bot->MoveScrewFront(motorOrientation1*actualspeed1);
-			bot->MoveScrewRear(motorOrientation2*actualspeed2);
-			usleep(10000);
-		}
-		lastTime=timer->getTime();
+		command(sFront, sRear, 0);
 	}else{
 		std::cout << log_prefix << "Can not move like KaBot" << std::endl;
 	}
@@ -600,20 +928,7 @@ void CMotors::setMotorSpeedsKB(int sFront,int sRear)
 void CMotors::setMotorSpeedsAW(int leftD,int rightD,int top)
 {
 	if(robot_type==RobotBase::ACTIVEWHEEL){
-
-		ActiveWheel *bot = (ActiveWheel*)robot_base;
-		//buf[5] = bot -> GetHingeStatus().currentAngle*M_PI/180;
-		countOdometryTimeAW(timer->getTime()-lastTime,buf[5]);
-		if(actualspeed1!=leftD || actualspeed2!=rightD || actualspeed3!=top){
-			actualspeed1=leftD;
-			actualspeed2=rightD;
-			actualspeed3=top;
-			//dopredu
-
-			bot->MoveWheelsFront(motorOrientation1*actualspeed1 , motorOrientation2*actualspeed2);
-			bot->MoveWheelsRear(motorOrientation3*actualspeed3, 0);
-		}
-		lastTime=timer->getTime();
+		command(leftD, rightD, top);
 	}else{
 		std::cout << log_prefix << "Can not move like AW" << std::endl;
 	}
@@ -622,84 +937,404 @@ void CMotors::setMotorSpeedsAW(int leftD,int rightD,int top)
 void CMotors::setMotorSpeedsS(int left,int right)
 {	//std::cout << log_prefix << "setting speed Scout: %d %d\n",left, right);
 	if(robot_type==RobotBase::SCOUTBOT){
-		countOdometryTimeS(timer->getTime()-lastTime);
-		if(actualspeed1!=left || actualspeed2!=right){
-			actualspeed1=left;
-			actualspeed2=right;
-			ScoutBot *bot = (ScoutBot*)robot_base;
-			bot->Move(motorOrientation1*actualspeed1,motorOrientation2*actualspeed2);
-		}
-		lastTime=timer->getTime();
+		command(left, right, 0);
 	}else{
 		std::cout << log_prefix << "Can not move like Scout" << std::endl;
 	}
 
 }
 
-void CMotors::countOdometryTimeKB(int timediff){
+void CMotors::setCommandLimits(int deadband, int interval) {
+	pthread_mutex_lock(&odometryMutex);
+	commandDeadband = deadband < 0 ? 0 : deadband;
+	commandInterval = interval < 0 ? 0 : interval;
+	pthread_mutex_unlock(&odometryMutex);
+}
+
+/**
+ * A speed that changes sign, or that starts or stops a wheel, is never within the deadband. Only the latest command
+ * counts, so a command within the deadband also drops a command that still waits.
+ */
+bool CMotors::withinDeadband(int speed1, int speed2, int speed3) const {
+	int speed[3] = { speed1, speed2, speed3 };
+	int actual[3] = { actualspeed1, actualspeed2, actualspeed3 };
+	for (int i = 0; i < 3; ++i) {
+		if (speed[i] == actual[i]) continue;
+		if (speed[i] == 0 || actual[i] == 0 || (speed[i] < 0) != (actual[i] < 0)) return false;
+		if (abs(speed[i] - actual[i]) > commandDeadband) return false;
+	}
+	return true;
+}
+
+void CMotors::command(int speed1, int speed2, int speed3) {
+	pthread_mutex_lock(&busMutex);
+	sendCommand(speed1, speed2, speed3, false);
+	pthread_mutex_unlock(&busMutex);
+}
+
+void CMotors::sendCommand(int speed1, int speed2, int speed3, bool immediate) {
+	bool send = false;
+	pthread_mutex_lock(&odometryMutex);
+	claimPose();
+	// the old speeds are integrated up to now, the new ones from now on
+	integrate();
+	bool stop = !speed1 && !speed2 && !speed3;
+	if (withinDeadband(speed1, speed2, speed3)) {
+		if (commandPending) commandsDropped++;
+		commandPending = false;
+		// a repetition of the speeds the wheels have is not a command that was dropped
+		if (speed1 != actualspeed1 || speed2 != actualspeed2 || speed3 != actualspeed3) commandsDropped++;
+	} else if (stop || immediate || !odometryRunning || lastTime - lastCommandTime >= commandInterval) {
+		// without the thread nobody would send a waiting command later
+		if (commandPending) commandsDropped++;
+		commandPending = false;
+		actualspeed1 = speed1;
+		actualspeed2 = speed2;
+		actualspeed3 = speed3;
+		lastCommandTime = lastTime;
+		send = true;
+	} else {
+		if (commandPending) commandsDropped++;
+		pendingSpeed[0] = speed1;
+		pendingSpeed[1] = speed2;
+		pendingSpeed[2] = speed3;
+		commandPending = true;
+	}
+	pthread_mutex_unlock(&odometryMutex);
+	if (send) writeSpeeds(speed1, speed2, speed3);
+}
+
+void CMotors::flushCommand() {
+	bool send = false;
+	pthread_mutex_lock(&busMutex);
+	pthread_mutex_lock(&odometryMutex);
+	if (commandPending && lastTime - lastCommandTime >= commandInterval) {
+		integrate();
+		actualspeed1 = pendingSpeed[0];
+		actualspeed2 = pendingSpeed[1];
+		actualspeed3 = pendingSpeed[2];
+		lastCommandTime = lastTime;
+		commandPending = false;
+		send = true;
+	}
+	pthread_mutex_unlock(&odometryMutex);
+	if (send) writeSpeeds(actualspeed1, actualspeed2, actualspeed3);
+	pthread_mutex_unlock(&busMutex);
+}
+
+void CMotors::writeSpeeds(int speed1, int speed2, int speed3) {
+	switch (robot_type) {
+	case RobotBase::ACTIVEWHEEL: {
+		ActiveWheel *bot = (ActiveWheel*)robot_base;
+		//dopredu
+		bot->MoveWheelsFront(motorOrientation1*speed1 , motorOrientation2*speed2);
+		bot->MoveWheelsRear(motorOrientation3*speed3, 0);
+		break;
+	}
+	case RobotBase::KABOT: {
+		KaBot *bot = (KaBot*)robot_base;
+		bot->MoveScrewFront(motorOrientation1*speed1);
+		bot->MoveScrewRear(motorOrientation2*speed2);
+		usleep(10000);
+		break;
+	}
+	case RobotBase::SCOUTBOT: {
+		ScoutBot *bot = (ScoutBot*)robot_base;
+		bot->Move(motorOrientation1*speed1,motorOrientation2*speed2);
+		break;
+	}
+	default:
+		break;
+	}
+	commandsSent++;
+	if (frameLog != NULL) {
+		FrameLogMotor record;
+		record.speed[0] = speed1;
+		record.speed[1] = speed2;
+		record.speed[2] = speed3;
+		record.reserved = 0;
+		double pose[10];
+		readPose(pose);
+		memcpy(record.pose, pose, sizeof(record.pose));
+		frameLog->append(FRAME_LOG_MOTOR, &record, sizeof(record));
+	}
+}
+
+MotorMotion CMotors::motion(int forward, int turn, long duration, double distance, double angle) {
+	MotorMotion result = wheelMotion(0, 0, 0, duration, distance, angle);
+	wheelSpeeds(forward, turn, result.speed);
+	return result;
+}
+
+MotorMotion CMotors::wheelMotion(int speed1, int speed2, int speed3, long duration, double distance, double angle) {
+	MotorMotion result;
+	result.speed[0] = speed1;
+	result.speed[1] = speed2;
+	result.speed[2] = speed3;
+	result.duration = duration;
+	result.distance = distance;
+	result.angle = angle;
+	result.start = 0;
+	return result;
+}
+
+int CMotors::queueMotion(const MotorMotion & motion) {
+	if (motion.duration <= 0 && motion.distance <= 0 && motion.angle <= 0) {
+		std::cerr << log_prefix << "A motion needs a duration or a target" << std::endl;
+		return -1;
+	}
+	if (!odometryRunning) {
+		std::cerr << log_prefix << "Motions need the odometry thread" << std::endl;
+		return -1;
+	}
+	int number = -1;
+	pthread_mutex_lock(&odometryMutex);
+	claimPose();
+	if (motionTail - motionHead < MOTOR_MOTION_QUEUE) {
+		motions[motionTail % MOTOR_MOTION_QUEUE] = motion;
+		number = motionTail++;
+		updateMotionWake();
+	}
+	pthread_mutex_unlock(&odometryMutex);
+	if (number < 0) std::cerr << log_prefix << "The queue of motions is full" << std::endl;
+	return number;
+}
+
+bool CMotors::motionDone() {
+	pthread_mutex_lock(&odometryMutex);
+	bool done = !motionActive && motionHead == motionTail;
+	pthread_mutex_unlock(&odometryMutex);
+	return done;
+}
+
+void CMotors::stopMotion() {
+	pthread_mutex_lock(&busMutex);
+	pthread_mutex_lock(&odometryMutex);
+	bool moving = motionActive || motionHead != motionTail;
+	motionActive = false;
+	motionHead = motionTail;
+	motionWake = 0;
+	pthread_mutex_unlock(&odometryMutex);
+	if (moving) sendCommand(0, 0, 0, true);
+	pthread_mutex_unlock(&busMutex);
+}
+
+//! Called with odometryMutex
+void CMotors::updateMotionWake() {
+	unsigned int next = motionActive ? motionHead + 1 : motionHead;
+	motionWake = (next != motionTail) ? motions[next % MOTOR_MOTION_QUEUE].start : 0;
+}
+
+/**
+ * The setpoints start at the time the sender gave, if the clocks agree, as the robots of an organism keep their time of
+ * day in step. Otherwise they start the lead after the arrival, which is still close, as the one message reaches all
+ * modules at about the same time. A module that is listed takes only its own setpoints.
+ */
+int CMotors::applyOrganismCommand(const uint8_t *data, int length, uint8_t module) {
+	const OrganismCommandHeaderWire *header = orgCommandView(data, length);
+	if (header == NULL) {
+		std::cerr << log_prefix << "An organism command that is not valid" << std::endl;
+		return -1;
+	}
+	int sequence = (uint16_t) header->sequence;
+	if (sequence == organismSequence) return 0;
+	organismSequence = sequence;
+	if (!odometryRunning) {
+		std::cerr << log_prefix << "Organism commands need the odometry thread" << std::endl;
+		return -1;
+	}
+
+	long long now = odometryTime();
+	long long sent = (int64_t) header->sent;
+	long long skew = now - sent;
+	long long activation = ((skew < 0 ? -skew : skew) <= MOTOR_CLOCK_SKEW ? sent : now) + (uint32_t) header->lead;
+	bool listed = false;
+	for (int i = 0; i < header->count; ++i) {
+		if (orgCommandSetpoint(data, i)->module == module) listed = true;
+	}
+
+	pthread_mutex_lock(&odometryMutex);
+	if (motionActive) {
+		// the motions that wait count as done, the one that runs moves to the end of the queue and ends at activation
+		MotorMotion & running = motions[motionHead % MOTOR_MOTION_QUEUE];
+		long left = activation - motionStart;
+		if (running.duration <= 0 || running.duration > left) running.duration = (left > 0) ? left : 1;
+		motions[(motionTail - 1) % MOTOR_MOTION_QUEUE] = running;
+		motionsDone += motionTail - 1 - motionHead;
+		motionHead = motionTail - 1;
+	} else {
+		motionHead = motionTail;
+	}
+	updateMotionWake();
+	pthread_mutex_unlock(&odometryMutex);
+
+	int queued = 0;
+	for (int i = 0; i < header->count; ++i) {
+		const OrganismSetpointWire *setpoint = orgCommandSetpoint(data, i);
+		if (setpoint->module != (listed ? module : ORG_MODULE_ALL)) continue;
+		long duration = (uint16_t) setpoint->duration * 1000L;
+		MotorMotion next = (setpoint->flags & ORG_SETPOINT_DIRECT) ?
+				wheelMotion(setpoint->speed[0], setpoint->speed[1], setpoint->speed[2], duration) :
+				motion(setpoint->speed[0], setpoint->speed[1], duration);
+		next.start = activation + (uint16_t) setpoint->delay * 1000LL;
+		if (queueMotion(next) >= 0) queued++;
+	}
+	if (log_level >= LOG_INFO) {
+		std::cout << log_prefix << "Organism command " << sequence << " starts in " << (activation - now) / 1000 <<
+				" ms with " << queued << " motions" << std::endl;
+	}
+	return queued;
+}
+
+/**
+ * A motion ends when its duration is over or when the odometry reached its distance or rotation from the pose it
+ * started at, whatever comes first. The next motion starts right away, without the minimum interval between commands,
+ * or at its start time, the wheels stop until then and after the last one.
+ */
+void CMotors::runMotion() {
+	int speed[3];
+	bool start = false, end = false;
+	pthread_mutex_lock(&busMutex);
+	pthread_mutex_lock(&odometryMutex);
+	if (motionActive) {
+		const MotorMotion & motion = motions[motionHead % MOTOR_MOTION_QUEUE];
+		double x = odometry[0] - motionPose[0];
+		double y = odometry[1] - motionPose[1];
+		if ((motion.duration > 0 && lastTime - motionStart >= motion.duration) ||
+				(motion.distance > 0 && x * x + y * y >= motion.distance * motion.distance) ||
+				(motion.angle > 0 && fabs(odometry[2] - motionPose[2]) >= motion.angle)) {
+			motionActive = false;
+			motionHead++;
+			motionsDone++;
+			end = true;
+		}
+	}
+	if (!motionActive && motionHead != motionTail) {
+		const MotorMotion & motion = motions[motionHead % MOTOR_MOTION_QUEUE];
+		if (motion.start <= lastTime) {
+			memcpy(speed, motion.speed, sizeof(speed));
+			memcpy(motionPose, odometry, sizeof(motionPose));
+			motionStart = lastTime;
+			motionActive = true;
+			start = true;
+		}
+	}
+	if (start || end) updateMotionWake();
+	pthread_mutex_unlock(&odometryMutex);
+	if (start) {
+		sendCommand(speed[0], speed[1], speed[2], true);
+	} else if (end) {
+		sendCommand(0, 0, 0, true);
+	}
+	pthread_mutex_unlock(&busMutex);
+}
+
+void CMotors::setHeading(double phi) {
+	posPhi = phi;
+	sinPhi = sin(phi);
+	cosPhi = cos(phi);
+}
+
+/**
+ * The odometry turns by a small angle at each step, for which a few terms of the series of sine and cosine are exact to
+ * the last bits, so the step needs no call of sin() or cos(). The length of (cosPhi, sinPhi) is pulled back to one at
+ * each step, so the rounding of many steps does not add up.
+ */
+void CMotors::rotateHeading(double dphi) {
+	double s, c;
+	posPhi += dphi;
+	if (fabs(dphi) < 0.05) {
+		double d2 = dphi * dphi;
+		s = dphi * (1 - d2 / 6 * (1 - d2 / 20));
+		c = 1 - d2 / 2 * (1 - d2 / 12);
+	} else {
+#ifdef FIXED_POINT_MATH
+		q16_t qs, qc;
+		q16_sincos(q16_from_double(dphi), qs, qc);
+		s = q16_to_double(qs);
+		c = q16_to_double(qc);
+#else
+		s = sin(dphi);
+		c = cos(dphi);
+#endif
+	}
+	double sinNew = sinPhi * c + cosPhi * s;
+	double cosNew = cosPhi * c - sinPhi * s;
+	double norm = 0.5 * (3 - sinNew * sinNew - cosNew * cosNew);
+	sinPhi = sinNew * norm;
+	cosPhi = cosNew * norm;
+}
+
+void CMotors::prepareOdometry(double hinge) {
+	cachedKoef2 = odometry_koef2;
+	cachedKoef3 = odometry_koef3;
+	cachedHinge = hinge;
+	sinKoef2 = sin(odometry_koef2);
+	cosKoef2 = cos(odometry_koef2);
+	awL12 = 0.1051 * odometry_koef3;
+	awL3 = (2 * sin(0.5 * hinge) * 0.105 - 0.05254) * odometry_koef3;
+	awD = 2 * awCosDelta * (awL12 + awL3 * awSinDelta);
+}
+
+void CMotors::countOdometryTimeKB(double timediff){
+	if (odometry_koef2 != cachedKoef2) prepareOdometry(odometry[5]);
 
 	//float diagonala = sqrt(odometry_koef1 * odometry_koef1 + odometry_koef2 * odometry_koef2);
 
 	float dfront = timediff * odometry_koef1 * actualspeed1;
 	float drear = timediff * odometry_koef1 * actualspeed2;
 
-	float delta = atan(odometry_koef2 / odometry_koef1); //uhel mezi rychlosti do strany a dopredu, atan(b/a)=delta
 	float r = 0.3713;	//polovicni vydalenost sroubu
-	dx = dfront * cos(posPhi + odometry_koef2) + drear * cos(posPhi - odometry_koef2);
-	dy = dfront * sin(posPhi + odometry_koef2) + drear * sin(posPhi - odometry_koef2);
-	dphi = (dfront * sin(posPhi + odometry_koef2) - drear * sin(posPhi - odometry_koef2)) * (r);
+	// cos(posPhi + odometry_koef2) and the others by angle addition
+	double cosFront = cosPhi * cosKoef2 - sinPhi * sinKoef2;
+	double sinFront = sinPhi * cosKoef2 + cosPhi * sinKoef2;
+	double cosRear = cosPhi * cosKoef2 + sinPhi * sinKoef2;
+	double sinRear = sinPhi * cosKoef2 - cosPhi * sinKoef2;
+	dx = dfront * cosFront + drear * cosRear;
+	dy = dfront * sinFront + drear * sinRear;
+	dphi = (dfront * sinFront - drear * sinRear) * (r);
 
 	posX += dx;
 	posY += dy;
-	posPhi += dphi;
-	buf[0] = posX;
-	buf[1] = posY;
-	buf[2] = posPhi;
-	buf[3] = dfront;
-	buf[4] = drear;
+	rotateHeading(dphi);
+	odometry[0] = posX;
+	odometry[1] = posY;
+	odometry[2] = posPhi;
+	odometry[3] = dfront;
+	odometry[4] = drear;
 }
 
-void CMotors::countOdometryTimeAW(int timediff,double hinge){
-	dphi=0;
-	dx=0;
-	dy=0;
-	double delta=0.523598776;//60 stupnu
-	//	double hinge=120;
-	double L12=0.1051;
-	double L3=2*sin(0.5*hinge)*0.105-0.05254;
-	//std::cout << log_prefix << "%f\n",L3);
-	L12=L12*odometry_koef3;
-	L3=L3*odometry_koef3;
-
-	//L3=0.1575;
-	//L12=L12/1.225;
-	//L3=L3/1.225;
-	//std::cout << log_prefix << "timediff %d \n",timediff);
-	double D=2*cos(delta)*(L12+L3*sin(delta));
+void CMotors::countOdometryTimeAW(double timediff,double hinge){
+	// L12, L3 and D only change with the hinge and the calibration
+	if (hinge != cachedHinge || odometry_koef3 != cachedKoef3) prepareOdometry(hinge);
+
 	double ld=odometry_koef1*timediff*(-actualspeed1);
 	double pd=odometry_koef1*timediff*(-actualspeed2);
 	double h=odometry_koef2*timediff*(-actualspeed3);
-	dx=(1/D)*((-L12*sin(posPhi)-L3*cos(delta-posPhi))*ld+(L12*sin(posPhi)-L3*cos(delta+posPhi))*pd+(2*L12*cos(delta)*cos(posPhi))*h);
-	dy=(1/D)*((L12*cos(posPhi)+L3*sin(delta-posPhi))*ld+(-L12*cos(posPhi)-L3*sin(delta+posPhi))*pd+(2*L12*cos(delta)*sin(posPhi))*h);
-	dphi=(1/D)*((cos(delta))*ld+(cos(delta))*pd+(sin(2*delta))*h);
-	//std::cout << log_prefix << "timediff=[timediff %d];\n",timediff);
+	// cos(delta - posPhi) and the others by angle addition
+	double cosMinus = awCosDelta * cosPhi + awSinDelta * sinPhi;
+	double cosPlus = awCosDelta * cosPhi - awSinDelta * sinPhi;
+	double sinMinus = awSinDelta * cosPhi - awCosDelta * sinPhi;
+	double sinPlus = awSinDelta * cosPhi + awCosDelta * sinPhi;
+	dx=((-awL12*sinPhi-awL3*cosMinus)*ld+(awL12*sinPhi-awL3*cosPlus)*pd+(2*awL12*awCosDelta*cosPhi)*h)/awD;
+	dy=((awL12*cosPhi+awL3*sinMinus)*ld+(-awL12*cosPhi-awL3*sinPlus)*pd+(2*awL12*awCosDelta*sinPhi)*h)/awD;
+	dphi=(awCosDelta*ld+awCosDelta*pd+awSin2Delta*h)/awD;
 	posX -= dx;
 	posY -= dy;
-	double pok=sin(0.5*hinge)*0.135-0.0519615;
-	pok=0.1575-0.105;
-	posX += sin(posPhi)*pok ;
-	posY += -cos(posPhi)*pok;
-	posPhi += dphi;
-	posX += -sin(posPhi)*pok ;
-	posY += cos(posPhi)*pok;
+	double pok=0.1575-0.105;
+	posX += sinPhi*pok ;
+	posY += -cosPhi*pok;
+	rotateHeading(dphi);
+	posX += -sinPhi*pok ;
+	posY += cosPhi*pok;
 
-	buf[0] = posX;
-	buf[1] = posY;
-	buf[2] = posPhi;
+	odometry[0] = posX;
+	odometry[1] = posY;
+	odometry[2] = posPhi;
 
 }
 
-void CMotors::countOdometryTimeS(int timediff){
+void CMotors::countOdometryTimeS(double timediff){
 	//dl=timediff/(820000.0/leftSpeed);
 	//dr=timediff/(820000.0/-rightSpeed);
 	//hallData = robot->GetHallSensorValues2D();
@@ -707,68 +1342,111 @@ void CMotors::countOdometryTimeS(int timediff){
 
 	double dl=odometry_koef1*actualspeed1*timediff ;
 	double dr=-odometry_koef2*actualspeed2*timediff;
-	buf[3]=buf[3]+dl;
-	buf[4]=buf[4]+dr;
+	odometry[3]=odometry[3]+dl;
+	odometry[4]=odometry[4]+dr;
 	//std::cout << log_prefix << "ujel jsem levou odometry: %f\n",dl);
 	//std::cout << log_prefix << "ujel jsem pravou odometry: %f\n",dr);
 	dphi = (-dr+dl)/odometry_koef3;
 	//	std::cout << log_prefix << "dphi: %f\n",dphi);
 
+	double sinBefore = sinPhi;
+	double cosBefore = cosPhi;
+	rotateHeading(dphi);
 	if(dl==dr || dl==-dr){
 		double stredniujeta=((dl + dr)/2.0);
 		//std::cout << log_prefix << "stredniujeta: %f\n",stredniujeta);
-		dx = stredniujeta*cos(posPhi+dphi);
-		dy = stredniujeta*sin(posPhi+dphi);
+		dx = stredniujeta*cosPhi;
+		dy = stredniujeta*sinPhi;
 	}else{
 		float centric=(odometry_koef3*(dr+dl))/(2*(dr-dl));
 		//std::cout << log_prefix << "centric: %f\n",centric);
-		//std::cout << log_prefix << "posPhi: %f\n",posPhi);
-		dx=-centric*(sin(posPhi+dphi)-sin(posPhi));
-		dy=centric*(cos(posPhi+dphi)-cos(posPhi));
+		dx=-centric*(sinPhi-sinBefore);
+		dy=centric*(cosPhi-cosBefore);
 	}
 	posX += dx;
 	posY += dy;
-	posPhi += dphi;
-	buf[0] = posX;
-	buf[1] = posY;
-	buf[2] = posPhi;
+	odometry[0] = posX;
+	odometry[1] = posY;
+	odometry[2] = posPhi;
 	//std::cout << log_prefix << "uhel: %f\n",buf[2]);
 }
 
+//! The motion before is dropped, the position is set for now
 void CMotors::setMotorPosition(float x,float y,float phi){
-	this->buf[0]=x;
-	this->buf[1]=y;
-	this->buf[2]=phi;
+	pthread_mutex_lock(&odometryMutex);
+	claimPose();
+	// the history moves along, so the poses in it are in the frame of the new position
+	double shift[3] = { x - odometry[0], y - odometry[1], phi - odometry[2] };
+	lastTime=odometryTime();
+	this->odometry[0]=x;
+	this->odometry[1]=y;
+	this->odometry[2]=phi;
 	this->posX=x;
 	this->posY=y;
-	this->posPhi=phi;
-	std::cout << log_prefix << "setting position " << buf[0] << ',' << buf[1] << ',' << buf[2] << std::endl;
+	setHeading(phi);
+	publishPose(shift);
+	pthread_mutex_unlock(&odometryMutex);
+	std::cout << log_prefix << "setting position " << x << ',' << y << ',' << phi << std::endl;
+}
+
+void CMotors::correctPosition(double dx, double dy, double dphi){
+	pthread_mutex_lock(&odometryMutex);
+	claimPose();
+	posX += dx;
+	posY += dy;
+	rotateHeading(dphi);
+	odometry[0] = posX;
+	odometry[1] = posY;
+	odometry[2] = posPhi;
+	double shift[3] = { dx, dy, dphi };
+	publishPose(shift);
+	pthread_mutex_unlock(&odometryMutex);
+}
+
+void CMotors::setHinge(double hinge){
+	pthread_mutex_lock(&odometryMutex);
+	claimPose();
+	integrate();
+	odometry[5] = hinge;
+	publishPose();
+	pthread_mutex_unlock(&odometryMutex);
 }
 
 double* CMotors::getPosition(){
-	this->evaluatePosition();
+	// without the thread the pose is only as recent as the last integration
+	if (!odometryRunning) this->evaluatePosition();
+	readPose(this->buf);
 	//this->buf[2]=normalizeAngle(this->buf[2]);
 	return this->buf;
 }
+
+void CMotors::getPosition(double *result){
+	if (!odometryRunning) this->evaluatePosition();
+	readPose(result);
+}
+
+bool CMotors::getPositionAt(long long time, double *result){
+	if (!odometryRunning) this->evaluatePosition();
+	const MotorPoseHistory *history = sharedPose != NULL ? &sharedPose->history : &localHistory;
+	volatile uint32_t *sequence = sharedPose != NULL ? &sharedPose->sequence : &poseSequence;
+	double found[3] = { result[0], result[1], result[2] };
+	bool valid;
+	uint32_t before, after;
+	do {
+		before = *sequence;
+		__sync_synchronize();
+		valid = interpolatePose(history, time, found);
+		__sync_synchronize();
+		after = *sequence;
+	} while ((before & 1) || before != after);
+	memcpy(result, found, sizeof(found));
+	return valid;
+}
+
 void CMotors::evaluatePosition(){
-	//std::cout << log_prefix << "evaluate position" << std::endl;
-	switch (robot_type) {
-	case RobotBase::ACTIVEWHEEL: {
-		this->setMotorSpeedsAW(	this->actualspeed1,this->actualspeed2,this->actualspeed3);
-		break;
-	}
-	case RobotBase::KABOT: {
-		this->setMotorSpeedsKB(this->actualspeed1,this->actualspeed2);
-		break;
-	}
-	case RobotBase::SCOUTBOT: {
-		this->setMotorSpeedsS(this->actualspeed1,this->actualspeed2);
-		break;
-	}
-	default:
-		std::cerr << log_prefix <<"cannot evaluate position for unknown robot type" << std::endl;
-		break;
-	}
+	pthread_mutex_lock(&odometryMutex);
+	integrate();
+	pthread_mutex_unlock(&odometryMutex);
 }
 
 bool CMotors::isMoving(){
@@ -29,10 +29,80 @@
 
 #include <IRobot.h>
 #include <CTimer.h>
+#include <CFrameLog.h>
+#include <pthread.h>
+#include <stdint.h>
 
 //@todo: remove dependency of motors on this shared file with the "eth" bridle
 #include <messageDataType.h>
 
+//! Period of the odometry integrator in us
+#define MOTOR_ODOMETRY_PERIOD 2000
+
+//! Speed commands that differ this much or less per wheel from the speeds the wheels have are not sent
+#define MOTOR_COMMAND_DEADBAND 2
+//! Minimum time between two speed commands on the bus in us, except for a stop
+#define MOTOR_COMMAND_INTERVAL 20000
+
+//! Motions that can wait in the queue of CMotors
+#define MOTOR_MOTION_QUEUE 16
+
+/**
+ * An organism command that was sent further than this from the time it arrives, in us, comes from a clock that does not
+ * agree with this one, its lead then starts at the arrival
+ */
+#ifndef MOTOR_CLOCK_SKEW
+#define MOTOR_CLOCK_SKEW 100000
+#endif
+
+//! The shared memory segment with the pose of the robot, one for all jockeys
+#define MOTOR_POSE_NAME "/equids_pose"
+
+//! Poses kept to look up the pose at the capture time of a measurement, one per MOTOR_POSE_HISTORY_PERIOD us
+#define MOTOR_POSE_HISTORY 128
+#define MOTOR_POSE_HISTORY_PERIOD 10000
+
+struct MotorPoseStamp {
+	//! Time in us, as the timestamps of the camera and the laser
+	int64_t time;
+	double x, y, phi;
+};
+
+//! The last poses of the integrator, a ring of which the newest one follows the pose until the period is over
+struct MotorPoseHistory {
+	//! Poses recorded since the start, the newest one is at (count - 1) % MOTOR_POSE_HISTORY
+	volatile uint32_t count;
+	MotorPoseStamp stamps[MOTOR_POSE_HISTORY];
+};
+
+/**
+ * The pose of the robot in shared memory. Only the owner writes it, under the sequence counter, which is odd while the
+ * pose is written, the others copy it without a lock.
+ */
+struct MotorPoseBlock {
+	uint32_t magic;
+	//! The process of the CMotors that commanded the motors last, 0 for none
+	volatile int32_t owner;
+	volatile uint32_t sequence;
+	double pose[10];
+	MotorPoseHistory history;
+};
+
+/**
+ * Speeds of the wheels, as for setMotorSpeedsKB/AW/S, that are held until the duration is over or until the odometry
+ * reached the distance or the rotation, whatever comes first. A target of 0 is not used.
+ */
+struct MotorMotion {
+	int speed[3];
+	//! Duration in us
+	long duration;
+	//! Distance in m and rotation in rad, both from the pose at the start of the motion
+	double distance;
+	double angle;
+	//! Time of day in us at which the motion starts, 0 for right after the one before it
+	long long start;
+};
+
 /* *********************************************************************************************************************
  * Interface of CMotors
  * ********************************************************************************************************************/
@@ -41,6 +111,22 @@
  * The number and location of the motors is different for each robot. However, our controllers should not be bothered
  * by that. Hence, this is a little wrapper that converts commands that set the speeds into specific commands to the
  * wheels.
+ *
+ * The odometry is integrated on a thread of its own every MOTOR_ODOMETRY_PERIOD, and at the moment the speeds change,
+ * so it does not depend on how often a jockey asks for the position. The thread publishes the pose under a sequence
+ * counter, getPosition() copies it without waiting and without talking to the motors.
+ *
+ * The motors share the SPI bus with the sensors, so speed commands are scheduled: a command within the deadband of the
+ * current speeds is dropped, and a command that comes within the interval after the last one waits, the thread sends
+ * the latest waiting command when the interval is over. A stop is always sent at once.
+ *
+ * Manoeuvres are queued as motions, which the thread starts and ends, so a jockey can go on reading its messages while
+ * the robot moves and poll motionDone(). A command of the jockey during a motion holds until the motion ends. A motion
+ * can wait for a start time, the modules of an organism start the setpoints of an organism command together that way.
+ *
+ * All jockeys on a robot have a CMotors, but there is one pose, in shared memory. The CMotors that commands the motors
+ * owns it: its first command, motion or change of the pose claims it and carries on from the pose the previous owner
+ * left. Only the owner integrates and publishes, the others copy the shared pose in getPosition().
  */
 class CMotors {
 public:
@@ -82,7 +168,58 @@ public:
 	double odometry_koef2; //screw side KB , track right  Scout, top AW
 	double odometry_koef3; //scout track,
 	int calibratedSpeed;
+
+	/**
+	 * The last pose of the integrator: x, y and phi, the distances of the wheels (index 3 and 4) and the hinge
+	 * (index 5). It is a copy that belongs to the caller until the next call, writing it does not move the robot,
+	 * use setMotorPosition(), correctPosition() or setHinge() for that.
+	 */
 	double* getPosition();
+	//! Copy the pose into result, ten doubles, safe to call from several threads
+	void getPosition(double *result);
+	/**
+	 * Overwrite x, y and phi of result with the pose at time in us, for example the capture time of a camera frame,
+	 * interpolated in the history. A correction moves the whole history along, so the pose fits the current one. False
+	 * if the time is older than the history, result then holds the oldest pose, or there is no history yet.
+	 */
+	bool getPositionAt(long long time, double *result);
+	//! Add a correction, for example of a filter, to the pose
+	void correctPosition(double dx, double dy, double dphi);
+	//! The angle of the hinge of the ActiveWheel in radians, it changes the geometry of its odometry
+	void setHinge(double hinge);
+
+	/**
+	 * Deadband per wheel and minimum interval in us of the speed commands, setCommandLimits(0, 0) sends every command
+	 * that changes a speed at once.
+	 */
+	void setCommandLimits(int deadband, int interval);
+	//! Speed commands that were sent to the motors and commands that were dropped or replaced by a later one
+	inline long getCommandsSent() const { return commandsSent; }
+	inline long getCommandsDropped() const { return commandsDropped; }
+
+	//! A motion with the speeds setSpeeds() would give
+	MotorMotion motion(int forward, int turn, long duration, double distance = 0, double angle = 0);
+	MotorMotion wheelMotion(int speed1, int speed2, int speed3, long duration, double distance = 0, double angle = 0);
+	//! Queue a motion after the ones that are queued already, returns its number, -1 if it cannot be queued
+	int queueMotion(const MotorMotion & motion);
+	//! No motion runs or waits
+	bool motionDone();
+	//! The number of motions that ended, the motion of number n is done when this is larger than n
+	inline unsigned int getMotionsDone() const { return motionsDone; }
+	//! Drop all motions and stop the wheels if a motion was running
+	void stopMotion();
+	/**
+	 * Queue the setpoints of this module in a MSG_ORGANISM_COMMAND as motions that start at the activation time of the
+	 * command, so all modules of the organism start together. The command replaces the motions that wait, a motion that
+	 * runs ends at the activation. Returns the motions that were queued, 0 for a command that was applied already, -1
+	 * for a command that is not valid.
+	 */
+	int applyOrganismCommand(const uint8_t *data, int length, uint8_t module);
+
+	//! Integrate the odometry on a thread at a fixed rate, init() starts it
+	int startOdometry();
+	void stopOdometry();
+
 	bool isMoving();
 	void calibrate(MotorCalibResult calibrationResult);
 	bool readCalibResult();
@@ -95,6 +232,9 @@ public:
 		this->log_prefix = prefix + "CMotors: ";
 	}
 
+	//! Record every command sent to the wheels with the pose at that time, NULL stops it
+	inline void setFrameLog(CFrameLog *log) { frameLog = log; }
+
 protected:
 
 	//! From speed command to value for wheel velocity
@@ -102,18 +242,102 @@ protected:
 private:
 	//! Reference to the robot class and type
 	RobotBase *robot_base;
+	CFrameLog *frameLog;
 	RobotBase::RobotType robot_type;
-	CTimer* timer;
-	int lastTime;
+	//! Time in us at which the odometry was integrated last
+	long long lastTime;
+	//! The copy getPosition() returns
 	double buf[10];
-	float posX;
-	float posY;
-	float posPhi;
-	float dx, dy, dphi;
-	void countOdometryTimeKB(int timediff);//count dead reckoning position change for KaBot
-	void countOdometryTimeAW(int timediff,double hinge);//count dead reckoning position change for ActiveWheel
-	void countOdometryTimeS(int timediff);//count dead reckoning position change for ScoutBot
+	//! The pose of the integrator, only changed with odometryMutex
+	double odometry[10];
+	//! In double, as the integrator adds many small steps
+	double posX;
+	double posY;
+	double posPhi;
+	double dx, dy, dphi;
+	//! Sine and cosine of posPhi, turned along with it by angle addition
+	double sinPhi, cosPhi;
+	//! Set posPhi, and its sine and cosine exactly
+	void setHeading(double phi);
+	//! Add dphi to posPhi, and to its sine and cosine by angle addition
+	void rotateHeading(double dphi);
+	//! The coefficients and the hinge the constants of the models were derived from
+	double cachedKoef2, cachedKoef3, cachedHinge;
+	double sinKoef2, cosKoef2;
+	double awL12, awL3, awD;
+	//! Derive the constants of the models again, calibrate() calls it, a model too if a coefficient was set directly
+	void prepareOdometry(double hinge);
+	void countOdometryTimeKB(double timediff);//count dead reckoning position change for KaBot, timediff in ms
+	void countOdometryTimeAW(double timediff,double hinge);//count dead reckoning position change for ActiveWheel
+	void countOdometryTimeS(double timediff);//count dead reckoning position change for ScoutBot
 	void evaluatePosition();
+
+	pthread_t odometryThread;
+	volatile bool odometryRunning;
+	//! Held while the odometry is integrated and while the speeds it integrates change
+	pthread_mutex_t odometryMutex;
+	//! Odd while the pose is written
+	volatile unsigned int poseSequence;
+	double pose[10];
+
+	static void* runOdometry(void *motors);
+	void odometryLoop();
+	//! Integrate from lastTime to now with the current speeds and publish the pose, called with odometryMutex
+	void integrate();
+	//! Publish the pose and record it in the history, a shift of x, y and phi moves the history along
+	void publishPose(const double *shift = NULL);
+	void readPose(double *result);
+	//! The history without shared memory, with poseSequence
+	MotorPoseHistory localHistory;
+	void recordPose(MotorPoseHistory *history, const double *shift);
+	static bool interpolatePose(const MotorPoseHistory *history, long long time, double *result);
+
+	//! The shared pose, NULL if there is no shared memory, then this CMotors keeps a pose of its own
+	MotorPoseBlock *sharedPose;
+	//! The process id that marks the owner of the shared pose
+	int32_t poseOwner;
+	void attachPose();
+	inline bool ownsPose() const { return sharedPose == NULL || sharedPose->owner == poseOwner; }
+	//! Become the owner of the shared pose and take it over, called with odometryMutex
+	void claimPose();
+	void readSharedPose(double *result);
+
+	//! Held from the decision to send a command until it is on the bus, before odometryMutex
+	pthread_mutex_t busMutex;
+	int commandDeadband;
+	int commandInterval;
+	long long lastCommandTime;
+	volatile bool commandPending;
+	int pendingSpeed[3];
+	long commandsSent;
+	long commandsDropped;
+
+	//! Schedule the speeds of the wheels, as actualspeed1 to actualspeed3
+	void command(int speed1, int speed2, int speed3);
+	//! As command(), called with busMutex, immediate sends a command without waiting for the interval
+	void sendCommand(int speed1, int speed2, int speed3, bool immediate);
+	//! Send the waiting command if its time has come, on the odometry thread
+	void flushCommand();
+	bool withinDeadband(int speed1, int speed2, int speed3) const;
+	//! Called with busMutex
+	void writeSpeeds(int speed1, int speed2, int speed3);
+	bool wheelSpeeds(int forward, int turn, int *speed);
+
+	//! The queue of motions, with odometryMutex, the one at motionHead runs if motionActive
+	MotorMotion motions[MOTOR_MOTION_QUEUE];
+	unsigned int motionHead;
+	unsigned int motionTail;
+	bool motionActive;
+	volatile unsigned int motionsDone;
+	long long motionStart;
+	double motionPose[3];
+	//! The start of the motion that waits next, 0 for none, the odometry thread wakes up for it
+	volatile long long motionWake;
+	void updateMotionWake();
+	//! The sequence of the last organism command, -1 for none
+	int organismSequence;
+	//! End and start motions, on the odometry thread
+	void runMotion();
 	bool readMotorOrientations();
 	int motorOrientation1;
 	int motorOrientation2;
@@ -33,11 +33,8 @@
 BackandforthScenario::BackandforthScenario(CEquids * equids): CScenario(equids) {
 	J_BACK = J_FORTH = J_WENGUO = -1;
 
-	state = S_FORTH;
 	cnt = 0;
 	num = 0;
-
-	quit = false;
 }
 
 BackandforthScenario::~BackandforthScenario() {
@@ -74,64 +71,65 @@ bool BackandforthScenario::Init() {
 }
 
 void BackandforthScenario::Run() {
-	while (!quit) {
-		switch(state) {
-		case S_FORTH:
-			sleep(1);
-			equids->switchToJockey(J_BACK);
-			state = S_BACK;
-			break;
-		case S_BACK:
-			sleep(1);
-			num++;
-			if (num>2) {
-				if (J_WENGUO==-1) {
-					state = S_QUIT;
-					std::cout << "Quit system" <<std::endl;
-				} else {
-					uint8_t cmd_data[3];
-					cmd_data[0] = 2; //recruiting side: 0 -- front, 1 -- left, 2 -- back, 3 -- right
-					cmd_data[1] = 3; //recruited robot type: 1 -- KIT, 2 -- Scout, 3 -- ActiveWheel
-					cmd_data[2] = 0; //recruited robot side: 0 -- front, 1 -- left, 2 -- back, 3 -- right
-					equids->sendMessage(J_WENGUO, DAEMON_MSG_RECRUITING, cmd_data, sizeof(cmd_data));
-					equids->switchToJockey(J_WENGUO);
-					state = S_RECRUITING;
-					equids->sendMessage(J_WENGUO, DAEMON_MSG_STATE_REQ, NULL, 0);
-					cnt = 0;
-				}
-			} else {
-				equids->switchToJockey(J_FORTH);
-				state = S_FORTH;
-			}
-			break;
-		case S_RECRUITING:
-			uint8_t st;
-			if (cnt<60) { // one minut wait for recruiting
-				CMessage mess=equids->getMessage(J_WENGUO);
-				if (mess.type==DAEMON_MSG_STATE) {
-					st = mess.data[0];
-					printf("J_WENGUO state is %i\n", st);
-					if (st == INORGANISM) {
-						printf("Quit Goal finished\n");
-						state = S_QUIT;
-					} else {
-						sleep(1);
-						cnt++;
-						mess.type==0;
-						equids->sendMessage(J_WENGUO, DAEMON_MSG_STATE_REQ, NULL, 0);
-					}
-					mess.type==0;
-				}
-			} else {
-				printf("Quit TIME elapsed\n");
-				state = S_QUIT;
-			}
-			break;
-		case S_QUIT:
-			quit = true;
-			break;
-		}
-		usleep(100000);
+	after(S_FORTH, 1000, S_BACK);
+	listen(J_WENGUO);
+	Loop(S_FORTH);
+}
+
+void BackandforthScenario::Enter(int state) {
+	switch(state) {
+	case S_FORTH:
+		equids->switchToJockey(J_FORTH);
+		break;
+	case S_BACK:
+		equids->switchToJockey(J_BACK);
+		setTimer(T_TURN, 1000);
+		break;
+	case S_RECRUITING: {
+		uint8_t cmd_data[3];
+		cmd_data[0] = 2; //recruiting side: 0 -- front, 1 -- left, 2 -- back, 3 -- right
+		cmd_data[1] = 3; //recruited robot type: 1 -- KIT, 2 -- Scout, 3 -- ActiveWheel
+		cmd_data[2] = 0; //recruited robot side: 0 -- front, 1 -- left, 2 -- back, 3 -- right
+		equids->sendMessage(J_WENGUO, DAEMON_MSG_RECRUITING, cmd_data, sizeof(cmd_data));
+		equids->switchToJockey(J_WENGUO);
+		equids->sendMessage(J_WENGUO, DAEMON_MSG_STATE_REQ, NULL, 0);
+		cnt = 0;
+		break;
+	}
+	case S_QUIT:
+		finish();
+		break;
+	}
+}
+
+int BackandforthScenario::React(int state, jockey_id jockey, CMessage & message) {
+	if (state != S_RECRUITING || message.type != DAEMON_MSG_STATE) return KEEP_STATE;
+	uint8_t st = message.data[0];
+	printf("J_WENGUO state is %i\n", st);
+	if (st == INORGANISM) {
+		printf("Quit Goal finished\n");
+		return S_QUIT;
 	}
+	// ask again a second later
+	setTimer(T_STATE_REQUEST, 1000);
+	return KEEP_STATE;
+}
 
+int BackandforthScenario::Expire(int state, int timer) {
+	if (timer == T_STATE_REQUEST) {
+		if (++cnt >= 60) { // one minut wait for recruiting
+			printf("Quit TIME elapsed\n");
+			return S_QUIT;
+		}
+		equids->sendMessage(J_WENGUO, DAEMON_MSG_STATE_REQ, NULL, 0);
+		return KEEP_STATE;
+	}
+	// T_TURN, at the end of S_BACK
+	num++;
+	if (num <= 2) return S_FORTH;
+	if (J_WENGUO == -1) {
+		std::cout << "Quit system" <<std::endl;
+		return S_QUIT;
+	}
+	return S_RECRUITING;
 }
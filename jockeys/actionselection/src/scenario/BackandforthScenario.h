@@ -30,7 +30,7 @@
 #include <CScenario.h>
 
 /**
- * A simple scenario to show the switching between jockeys
+ * A simple scenario to show the switching between jockeys, and how a scenario is written for CScenario::Loop()
  */
 class BackandforthScenario: public CScenario {
 public:
@@ -50,6 +50,12 @@ public:
 
 	void Run();
 
+	void Enter(int state);
+
+	int React(int state, jockey_id jockey, CMessage & message);
+
+	int Expire(int state, int timer);
+
 	// define the jockeys for this scenario
 	jockey_id J_BACK;
 
@@ -57,10 +63,11 @@ public:
 
 	jockey_id J_WENGUO;
 private:
-
-	bool quit;
-
-	TState state;
+	//! Timers of the scenario
+	enum {
+		T_TURN = 0,
+		T_STATE_REQUEST
+	};
 
 	int num;
 
@@ -0,0 +1,280 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Recruitment of robots for an organism through a table that every robot keeps
+ * @file CRecruitment.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Action selection
+ */
+
+
+#include <CRecruitment.h>
+
+#include <CTimer.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+//! Revisions wrap around, a difference of less than half the range tells which one is newer
+static inline bool newer(uint16_t revision, uint16_t than) {
+	return (int16_t)(revision - than) > 0;
+}
+
+static inline int16_t toCm(float m) {
+	float cm = m * 100;
+	if (cm > 32767) cm = 32767;
+	if (cm < -32767) cm = -32767;
+	return (int16_t) cm;
+}
+
+CRecruitment::CRecruitment(uint8_t robot, uint8_t robot_type): self(robot), last_sent(0), sent(0), received(0) {
+	Entry & entry = table[self];
+	memset(&entry, 0, sizeof(entry));
+	entry.robot_type = robot_type;
+	entry.role = ORG_FREE;
+	entry.revision = 1;
+	entry.dirty = true;
+}
+
+long long CRecruitment::now() {
+	return CTimer::now() / 1000000;
+}
+
+void CRecruitment::setPosition(float x, float y) {
+	Entry & entry = table[self];
+	int16_t cx = toCm(x), cy = toCm(y);
+	if (abs(cx - entry.x) + abs(cy - entry.y) <= ORG_MOVE_CM) return;
+	entry.x = cx;
+	entry.y = cy;
+	entry.revision++;
+	entry.dirty = true;
+}
+
+void CRecruitment::change(uint8_t role, uint8_t seed) {
+	Entry & entry = table[self];
+	entry.role = role;
+	entry.seed = seed;
+	entry.revision++;
+	entry.dirty = true;
+}
+
+void CRecruitment::need(uint8_t robot_type, uint8_t count) {
+	Entry & entry = table[self];
+	entry.need_type = robot_type;
+	entry.need_count = count;
+	change(ORG_SEED, 0);
+}
+
+void CRecruitment::cancel() {
+	table[self].need_count = 0;
+	change(ORG_FREE, 0);
+}
+
+bool CRecruitment::receive(const uint8_t *data, int len) {
+	const OrganismStateHeaderWire *header = orgStateView(data, len);
+	if (header == NULL) return false;
+	received++;
+	long long time = now();
+	Entry & own = table[self];
+	for (int i = 0; i < header->count; i++) {
+		const OrganismEntryWire *wire = orgStateEntry(data, i);
+		uint16_t revision = wire->revision;
+		if (wire->robot == self) {
+			// an entry of a former run of this robot is still around, the current one has to be newer
+			if (newer(revision, own.revision)) {
+				own.revision = revision + 1;
+				own.dirty = true;
+			}
+			continue;
+		}
+		std::map<uint8_t, Entry>::iterator known = table.find(wire->robot);
+		if (known != table.end() && !newer(revision, known->second.revision)) {
+			if (wire->robot == header->sender) known->second.heard = time;
+			continue;
+		}
+		bool new_seed = (wire->role == ORG_SEED) && (known == table.end() || known->second.role != ORG_SEED);
+		Entry & entry = table[wire->robot];
+		entry.robot_type = wire->robot_type;
+		entry.role = wire->role;
+		entry.seed = wire->seed;
+		entry.need_type = wire->need_type;
+		entry.need_count = wire->need_count;
+		entry.revision = revision;
+		entry.x = wire->x;
+		entry.y = wire->y;
+		entry.heard = time;
+		if (new_seed) entry.since = time;
+		entry.dirty = true;
+		// a candidate answers a new seed with its position without waiting for its keepalive
+		if (new_seed && entry.need_type == own.robot_type && own.role == ORG_FREE) own.dirty = true;
+	}
+	return true;
+}
+
+void CRecruitment::expire(long long time) {
+	std::map<uint8_t, Entry>::iterator i = table.begin();
+	while (i != table.end()) {
+		if (i->first != self && time - i->second.heard > ORG_STALE_MS) table.erase(i++);
+		else ++i;
+	}
+}
+
+int CRecruitment::members(uint8_t seed) {
+	int count = 0;
+	for (std::map<uint8_t, Entry>::iterator i = table.begin(); i != table.end(); ++i) {
+		if (i->second.role == ORG_JOINING && i->second.seed == seed) count++;
+	}
+	return count;
+}
+
+/**
+ * The table is small, a few robots per seed, so the assignment is simply computed again every round. The seeds take
+ * robots in the order of their id, so a robot that two seeds need goes to the one with the lowest id on every robot.
+ */
+void CRecruitment::resolve(long long time) {
+	std::map<uint8_t, int> assignment;
+	std::map<uint8_t, int> count;
+	std::map<uint8_t, Entry>::iterator s, c;
+	// who joined a seed already stays with it, unless the seed needs less now
+	for (s = table.begin(); s != table.end(); ++s) {
+		if (s->second.role != ORG_SEED) continue;
+		int & taken = count[s->first];
+		for (c = table.begin(); c != table.end() && taken < s->second.need_count; ++c) {
+			if (c->second.role != ORG_JOINING || c->second.seed != s->first) continue;
+			if (c->second.robot_type != s->second.need_type) continue;
+			assignment[c->first] = s->first;
+			taken++;
+		}
+	}
+	for (s = table.begin(); s != table.end(); ++s) {
+		if (s->second.role != ORG_SEED) continue;
+		int & taken = count[s->first];
+		while (taken < s->second.need_count) {
+			long best_distance = -1;
+			uint8_t best = 0;
+			for (c = table.begin(); c != table.end(); ++c) {
+				if (c->second.role == ORG_SEED || c->second.robot_type != s->second.need_type) continue;
+				if (assignment.count(c->first)) continue;
+				long dx = c->second.x - s->second.x, dy = c->second.y - s->second.y;
+				long distance = dx * dx + dy * dy;
+				// ties go to the lowest id, which the map iterates first
+				if (best_distance < 0 || distance < best_distance) {
+					best_distance = distance;
+					best = c->first;
+				}
+			}
+			if (best_distance < 0) break;
+			assignment[best] = s->first;
+			taken++;
+		}
+	}
+
+	Entry & own = table[self];
+	if (own.role == ORG_SEED) return;
+	std::map<uint8_t, int>::iterator mine = assignment.find(self);
+	if (mine != assignment.end()) {
+		if (own.role == ORG_JOINING && own.seed == mine->second) return;
+		// a seed that just came up may not have heard of the candidates that are closer yet
+		if (time - table[mine->second].since < ORG_SETTLE_MS) return;
+		change(ORG_JOINING, mine->second);
+	} else if (own.role == ORG_JOINING) {
+		change(ORG_FREE, 0);
+	}
+}
+
+bool CRecruitment::involved() {
+	Entry & own = table[self];
+	if (own.role != ORG_FREE) return true;
+	for (std::map<uint8_t, Entry>::iterator i = table.begin(); i != table.end(); ++i) {
+		if (i->second.role == ORG_SEED && i->second.need_type == own.robot_type
+				&& members(i->first) < i->second.need_count) return true;
+	}
+	return false;
+}
+
+/**
+ * The entry of this robot goes first, the other slots are for the changes it heard of, so they reach the robots that
+ * are out of range of the one that made them. Changes that do not fit wait for the next broadcast.
+ */
+int CRecruitment::tick(uint8_t *buffer) {
+	long long time = now();
+	expire(time);
+	resolve(time);
+	if (!involved()) return 0;
+
+	bool dirty = false;
+	for (std::map<uint8_t, Entry>::iterator i = table.begin(); i != table.end() && !dirty; ++i) {
+		dirty = i->second.dirty;
+	}
+	if (!(dirty && time - last_sent >= ORG_BROADCAST_MS) && time - last_sent < ORG_KEEPALIVE_MS) return 0;
+
+	OrganismStateHeaderWire *header = (OrganismStateHeaderWire*) buffer;
+	header->version = OrganismStateHeaderWire::VERSION;
+	header->sender = self;
+	int count = 0;
+	std::vector<uint8_t> robots;
+	robots.push_back(self);
+	for (std::map<uint8_t, Entry>::iterator i = table.begin(); i != table.end(); ++i) {
+		if (i->first != self && i->second.dirty) robots.push_back(i->first);
+	}
+	for (size_t r = 0; r < robots.size() && count < ORG_STATE_MAX_ENTRIES; ++r) {
+		Entry & entry = table[robots[r]];
+		OrganismEntryWire *wire = orgStateEntry(buffer, count++);
+		wire->robot = robots[r];
+		wire->robot_type = entry.robot_type;
+		wire->role = entry.role;
+		wire->seed = entry.seed;
+		wire->need_type = entry.need_type;
+		wire->need_count = entry.need_count;
+		wire->revision = entry.revision;
+		wire->x = entry.x;
+		wire->y = entry.y;
+		entry.dirty = false;
+	}
+	header->count = count;
+	last_sent = time;
+	sent++;
+	return orgStateLength(count);
+}
+
+int CRecruitment::getSeed() {
+	Entry & own = table[self];
+	return (own.role == ORG_JOINING) ? own.seed : -1;
+}
+
+bool CRecruitment::getSeedPosition(float & x, float & y) {
+	int seed = getSeed();
+	if (seed < 0) return false;
+	std::map<uint8_t, Entry>::iterator i = table.find(seed);
+	if (i == table.end()) return false;
+	x = i->second.x / 100.0f;
+	y = i->second.y / 100.0f;
+	return true;
+}
+
+int CRecruitment::getMembers() {
+	return members(self);
+}
+
+bool CRecruitment::isComplete() {
+	Entry & own = table[self];
+	return own.role == ORG_SEED && members(self) >= own.need_count;
+}
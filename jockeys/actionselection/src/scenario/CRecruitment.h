@@ -0,0 +1,150 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Recruitment of robots for an organism through a table that every robot keeps
+ * @file CRecruitment.h
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Action selection
+ */
+
+
+#ifndef CRECRUITMENT_H_
+#define CRECRUITMENT_H_
+
+#include <messageSchema.h>
+
+#include <map>
+
+//! A robot that changed its entry, or heard of a change of another one, broadcasts it at most this often in ms
+#ifndef ORG_BROADCAST_MS
+#define ORG_BROADCAST_MS 300
+#endif
+
+//! A robot that takes part in a recruitment announces itself at least this often in ms
+#ifndef ORG_KEEPALIVE_MS
+#define ORG_KEEPALIVE_MS 2000
+#endif
+
+//! A robot that is not heard of for this long in ms is dropped from the table, its assignment goes to another one
+#ifndef ORG_STALE_MS
+#define ORG_STALE_MS 6000
+#endif
+
+//! A free robot joins a seed only after it knew of it for this long in ms, so the other candidates are in its table
+#ifndef ORG_SETTLE_MS
+#define ORG_SETTLE_MS (2 * ORG_BROADCAST_MS)
+#endif
+
+//! A robot announces its position again when it moved more than this in cm
+#ifndef ORG_MOVE_CM
+#define ORG_MOVE_CM 10
+#endif
+
+/**
+ * Every robot keeps a table of the robots it heard of, with their type, role and position. A robot only changes its
+ * own entry and numbers its changes, so the tables merge without conflicts: a newer revision of an entry replaces the
+ * older one, whoever relays it.
+ *
+ * Instead of a MSG_NEED_ORG, a MSG_HELP_ORG from every candidate and a MSG_HELP_ACP back, a seed sets its need in its
+ * entry. The changes of a robot are collected and sent as a single MSG_ORG_STATE broadcast every ORG_BROADCAST_MS at
+ * most, with the changes it heard of others, and a robot that has nothing to do with a recruitment keeps quiet. Every
+ * robot then computes the same assignment from its table: the seeds in the order of their id take the robots that
+ * already joined them and then the nearest free robots of the type they need. A robot that is assigned announces that
+ * it joins, so two seeds never get the same robot and nobody has to wait for an acceptance.
+ */
+class CRecruitment {
+public:
+	CRecruitment(uint8_t robot, uint8_t robot_type);
+
+	//! The position of this robot in m
+	void setPosition(float x, float y);
+
+	//! Become a seed that recruits count robots of a RobotBase::RobotType
+	void need(uint8_t robot_type, uint8_t count);
+
+	//! Stop recruiting or joining, this robot is free again
+	void cancel();
+
+	//! Merge the payload of a MSG_ORG_STATE, false if it is not valid
+	bool receive(const uint8_t *data, int len);
+
+	/**
+	 * Resolve the assignment and write a MSG_ORG_STATE into buffer, which holds ORG_STATE_MAX_LENGTH bytes, if it is
+	 * time for one. Call it every round, returns the length or 0 if nothing has to be sent.
+	 */
+	int tick(uint8_t *buffer);
+
+	//! The seed this robot joins, -1 if it does not join one
+	int getSeed();
+
+	//! The position of the seed this robot joins in m, false if there is none
+	bool getSeedPosition(float & x, float & y);
+
+	//! The robots that join this seed
+	int getMembers();
+
+	//! This seed has all the robots it needs
+	bool isComplete();
+
+	inline long getSent() { return sent; }
+	inline long getReceived() { return received; }
+
+private:
+	struct Entry {
+		uint8_t robot_type;
+		uint8_t role;
+		uint8_t seed;
+		uint8_t need_type;
+		uint8_t need_count;
+		uint16_t revision;
+		int16_t x;
+		int16_t y;
+		//! Local time in ms it was last heard of from the robot itself
+		long long heard;
+		//! Local time in ms it became a seed
+		long long since;
+		//! Changed since the last broadcast
+		bool dirty;
+	};
+
+	static long long now();
+
+	//! Change the entry of this robot, it is announced with the next broadcast
+	void change(uint8_t role, uint8_t seed);
+
+	//! Drop the robots that were not heard of for ORG_STALE_MS
+	void expire(long long time);
+
+	//! Compute the assignment from the table and join the seed this robot is assigned to
+	void resolve(long long time);
+
+	//! This robot is a seed, joins one or is a candidate for a seed that still needs robots
+	bool involved();
+
+	int members(uint8_t seed);
+
+	uint8_t self;
+	std::map<uint8_t, Entry> table;
+	long long last_sent;
+	long sent;
+	long received;
+};
+
+#endif /* CRECRUITMENT_H_ */
@@ -27,9 +27,114 @@
 #include <CScenario.h>
 
 CScenario::CScenario(CEquids * equids): equids(equids) {
-
+	for (int t = 0; t < SCENARIO_TIMERS; ++t) timers[t].due = 0;
+	stateDue = 0;
+	stateNext = ANY_STATE;
+	current = ANY_STATE;
+	finished = false;
 }
 
 CScenario::~CScenario() {
 
 }
+
+void CScenario::listen(jockey_id jockey) {
+	if (jockey < 0) return;
+	for (size_t j = 0; j < jockeys.size(); ++j) {
+		if (jockeys[j] == jockey) return;
+	}
+	jockeys.push_back(jockey);
+}
+
+void CScenario::on(int state, jockey_id jockey, int type, int next) {
+	Transition transition = { state, jockey, type, next };
+	transitions.push_back(transition);
+	listen(jockey);
+}
+
+void CScenario::after(int state, int ms, int next) {
+	Timeout timeout = { state, ms, next };
+	timeouts.push_back(timeout);
+}
+
+void CScenario::setTimer(int timer, int ms, bool repeat) {
+	if (timer < 0 || timer >= SCENARIO_TIMERS) return;
+	timers[timer].due = CJockey::now() + (long long)ms * 1000;
+	timers[timer].period = repeat ? ms : 0;
+}
+
+void CScenario::cancelTimer(int timer) {
+	if (timer >= 0 && timer < SCENARIO_TIMERS) timers[timer].due = 0;
+}
+
+void CScenario::go(int next) {
+	if (current != ANY_STATE) Leave(current);
+	current = next;
+	stateDue = 0;
+	for (size_t t = 0; t < timeouts.size(); ++t) {
+		if (timeouts[t].state == next) {
+			stateDue = CJockey::now() + (long long)timeouts[t].ms * 1000;
+			stateNext = timeouts[t].next;
+			break;
+		}
+	}
+	Enter(next);
+}
+
+void CScenario::dispatch(jockey_id jockey, CMessage & message) {
+	int next = React(current, jockey, message);
+	for (size_t t = 0; t < transitions.size() && next == KEEP_STATE; ++t) {
+		const Transition & transition = transitions[t];
+		if ((transition.state == current || transition.state == ANY_STATE) && transition.jockey == jockey
+				&& (transition.type == ANY_MESSAGE || transition.type == message.type)) {
+			next = transition.next;
+		}
+	}
+	if (next != KEEP_STATE) go(next);
+}
+
+void CScenario::expire(long long now) {
+	if (stateDue && now >= stateDue) {
+		stateDue = 0;
+		go(stateNext);
+	}
+	for (int t = 0; t < SCENARIO_TIMERS && !finished; ++t) {
+		if (!timers[t].due || now < timers[t].due) continue;
+		if (timers[t].period > 0) {
+			// a repeating timer that fell behind skips the periods it missed
+			timers[t].due += (long long)timers[t].period * 1000;
+			if (timers[t].due <= now) timers[t].due = now + (long long)timers[t].period * 1000;
+		} else {
+			timers[t].due = 0;
+		}
+		int next = Expire(current, t);
+		if (next != KEEP_STATE) go(next);
+	}
+}
+
+int CScenario::untilDue(long long now) {
+	long long due = stateDue;
+	for (int t = 0; t < SCENARIO_TIMERS; ++t) {
+		if (timers[t].due && (!due || timers[t].due < due)) due = timers[t].due;
+	}
+	if (!due) return -1;
+	if (due <= now) return 0;
+	// rounded up, so the wait does not end just before the timer is due
+	return (int)((due - now + 999) / 1000);
+}
+
+/**
+ * CEquids::waitAny reads the listened jockeys in turn, so a jockey that sends a lot does not starve the others, and
+ * sleeps until one of them has a message or the first timer is due.
+ */
+void CScenario::Loop(int start) {
+	finished = false;
+	go(start);
+	while (!finished) {
+		expire(CJockey::now());
+		if (finished) break;
+		CMessage message;
+		int jockey = equids->waitAny(jockeys, untilDue(CJockey::now()), message);
+		if (jockey >= 0) dispatch(jockey, message);
+	}
+}
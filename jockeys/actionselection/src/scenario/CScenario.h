@@ -28,11 +28,34 @@
 #define CSCENARIO_H_
 
 #include <CEquids.h>
+#include <vector>
 
 typedef int jockey_id;
 
+//! A transition of on() that applies in every state, or to every message type
+#define ANY_STATE -1
+#define ANY_MESSAGE -1
+//! Returned by React() and Expire() to stay in the current state
+#define KEEP_STATE -2
+//! Timers of setTimer() that a scenario can have running at once
+#define SCENARIO_TIMERS 8
+
 /**
  * Subclass this scenario class to build your own.
+ *
+ * A scenario can be a loop in Run() that polls its jockeys and sleeps, or it can declare its states and let Loop()
+ * drive them. Loop() sleeps in CEquids::waitAny until one of its jockeys has a message or a timer is due, so
+ * it reacts within the latency of the IPC and does not use the CPU in between:
+ *
+ *   void Run() {
+ *     listen(J_MAPPING);
+ *     on(S_BUILD_MAP, J_MAPPING, MSG_MAP_COMPLETE, S_DOCK_SOCKET);
+ *     after(S_DOCK_SOCKET, 60000, S_QUIT);
+ *     Loop(S_BUILD_MAP);
+ *   }
+ *
+ * What has to be done on a transition goes in Enter() and Leave(), messages that need more than their type to decide
+ * on the next state go to React().
  */
 class CScenario {
 public:
@@ -54,7 +77,81 @@ public:
 
 protected:
 
+	//! Read the messages of this jockey in Loop(), messages of other jockeys stay in their queues
+	void listen(jockey_id jockey);
+
+	//! Go from state to next when a message of this type arrives from jockey, the first matching one is taken
+	void on(int state, jockey_id jockey, int type, int next);
+
+	//! Go from state to next when it has been the state for ms without leaving it
+	void after(int state, int ms, int next);
+
+	//! Call Expire() with timer after ms, and every ms after that if repeat is set, a running timer is restarted
+	void setTimer(int timer, int ms, bool repeat = false);
+
+	void cancelTimer(int timer);
+
+	//! Change the state, also to the current one, which calls Leave() and Enter() again
+	void go(int next);
+
+	inline int getState() { return current; }
+
+	//! Let Loop() return after the event that is handled now
+	inline void finish() { finished = true; }
+
+	//! Enter start and handle the messages of the listened jockeys and the timers until finish() is called
+	void Loop(int start);
+
+	virtual void Enter(int state) {}
+
+	virtual void Leave(int state) {}
+
+	//! Every message of a listened jockey comes here before the transitions of on(), return the next state or
+	//! KEEP_STATE to let on() decide
+	virtual int React(int state, jockey_id jockey, CMessage & message) { return KEEP_STATE; }
+
+	//! A timer of setTimer() is due, return the next state or KEEP_STATE
+	virtual int Expire(int state, int timer) { return KEEP_STATE; }
+
 	CEquids * equids;
+
+private:
+	struct Transition {
+		int state;
+		jockey_id jockey;
+		int type;
+		int next;
+	};
+
+	struct Timeout {
+		int state;
+		int ms;
+		int next;
+	};
+
+	struct Timer {
+		//! Time it is due in microseconds, 0 if it is not running
+		long long due;
+		int period;
+	};
+
+	void dispatch(jockey_id jockey, CMessage & message);
+
+	//! Fire what is due at now, a state change cancels the timeout of the state it leaves
+	void expire(long long now);
+
+	//! Milliseconds until the first timer or timeout is due, -1 if none is running
+	int untilDue(long long now);
+
+	std::vector<jockey_id> jockeys;
+	std::vector<Transition> transitions;
+	std::vector<Timeout> timeouts;
+	Timer timers[SCENARIO_TIMERS];
+	//! The timeout of after() for the current state, 0 if it has none
+	long long stateDue;
+	int stateNext;
+	int current;
+	bool finished;
 };
 
 
@@ -32,6 +32,7 @@
 #include <unistd.h>
 #include <iomanip>
 #include <messageDataType.h>
+#include <messageSchema.h>
 #include <IRobot.h>
 #include <CLeds.h>
 //#define VIDEOSTREAM
@@ -42,11 +43,11 @@
 
 //! Name of this challenge
 static const std::string NAME = "GrandChallenge1";
-static uint8_t recruiting_tmp[8];
-static uint8_t recruiting_answ[64];
-static uint8_t recruiting_accp[64];
 static struct RobotPosition goal;
 
+//! A seed that did not get a single robot in this many s goes back to exploration
+#define RECRUIT_TIMEOUT 10
+
 //! Convenience function for printing to standard out
 #define DEBUG NAME << '[' << getpid() << "] " << __func__ << "(): "
 #define sqr(x) (x)*(x)
@@ -56,13 +57,15 @@ GrandChallenge1Scenario::GrandChallenge1Scenario(CEquids * equids) :
 			J_INFRARED_EXPLORATION = J_WENGUO = J_CAMERADETECTION = J_ZBMESSENGER = J_POSITION = J_MOVETO = -1;
 
 	quit = false;
+	recruitment = NULL;
+	recruit_time = 0;
 
 	// set initial state
 	state = S_START;
 }
 
 GrandChallenge1Scenario::~GrandChallenge1Scenario() {
-
+	delete recruitment;
 }
 
 bool GrandChallenge1Scenario::Init() {
@@ -131,23 +134,42 @@ bool GrandChallenge1Scenario::Init() {
 	return continue_program;
 }
 
-static int recr_state;   
-static int robot_nearest_id;
-static float robot_nearest_distance;
+/**
+ * The recruitment broadcasts on its own when it has news, see CRecruitment, so this is called every round. A robot
+ * that is assigned to a seed drives to 20 cm in front of it, as with the MSG_HELP_ACP before.
+ */
+void GrandChallenge1Scenario::Recruit() {
+	UbiPosition *my = &equids->getJockey(J_POSITION)->actual_position;
+	recruitment->setPosition(my->x, my->y);
+	// the state is written behind room for the envelope, so it goes out without another copy
+	uint8_t buffer[ZB_ENVELOPE_HEADER + ORG_STATE_MAX_LENGTH];
+	int len = recruitment->tick(buffer + ZB_ENVELOPE_HEADER);
+	if (len > 0) {
+		CMessage::packZBHeader(buffer, -1, MSG_ORG_STATE);
+		equids->getJockey(J_ZBMESSENGER)->SendMessage(MSG_ZIGBEE_MSG, buffer, ZB_ENVELOPE_HEADER + len);
+	}
 
-void init_recruiting() {
-   recr_state= 0;
-   robot_nearest_id = -1;
+	float x, y;
+	if (state == S_RECRUITING || state == S_CONNECTING || !recruitment->getSeedPosition(x, y)) return;
+	float robot_distance = sqrt(sqr(x - my->x) + sqr(y - my->y));
+	if (robot_distance < 0.01) robot_distance = 0.01;
+	goal.x = x + 0.2 * (my->x - x) / robot_distance;
+	goal.y = y + 0.2 * (my->y - y) / robot_distance;
+	goal.phi = atan2(y - my->y, x - my->x);
+	std::cout << DEBUG << "Join seed " << recruitment->getSeed() << ", move to (" << goal.x << ", " << goal.y << ", "
+			<< goal.phi << ")" << std::endl;
+	CMessage go_to;
+	go_to.type = MSG_MOVETOPOSITION;
+	go_to.data = (uint8_t *)&goal;
+	go_to.len = sizeof(RobotPosition);
+	equids->getJockey(J_MOVETO)->SendMessage(go_to);
+	equids->switchToJockey(J_MOVETO);
+	state = S_CONNECTING;
 }
 
 void GrandChallenge1Scenario::Run() {
    int robot_id = -1;
-   int robot_need_id = -1;
-   int robot_need_time;
-   int robot_recr_time;
-   UbiPosition goto_pos;
    char* robotID = getenv("sr_id");
-   init_recruiting();
    
    if (robotID != NULL) {
       robot_id = atoi(robotID);
@@ -156,6 +178,7 @@ void GrandChallenge1Scenario::Run() {
    RobotBase::RobotType robot_type;
    RobotBase * robot;
    robot_type = RobotBase::Initialize(NAME);
+   recruitment = new CRecruitment((uint8_t)robot_id, (uint8_t)robot_type);
    robot = RobotBase::Instance();
    for (int i = 0; i < 4; ++i) {
       robot->SetPrintEnabled(i, false);
@@ -182,18 +205,21 @@ void GrandChallenge1Scenario::Run() {
 
 	while (!quit) {
 
+		// taken before the queues are read, a message that arrives while they are read ends the wait at once
+		unsigned int seen = equids->arrivals();
 		if (!equids->getJockey(J_ZBMESSENGER)->started) {
 			std::cerr << DEBUG << "The ZigBee jockey is not running, that cannot be correct" << std::endl;
 		}
 
 		//receive messages over zigbee
 		CMessage zigbMessage = equids->getJockey(J_ZBMESSENGER)->getMessage();
-		if (zigbMessage.type != MSG_NONE) {
-			CMessage unpacked = CMessage::unpackZBMessage(zigbMessage);
+		ZBEnvelope unpacked;
+		if (zigbMessage.viewZBMessage(unpacked)) {
 			switch (unpacked.type) {
-			case MSG_MAP_DATA: {
+			case MSG_MAP_DATA:
+			case MSG_MAP_SNAPSHOT: {
 				std::cout << DEBUG << "Received message \"" << StrMessage[zigbMessage.type] << "\"" << std::endl;
-				equids->getJockey(J_MAPPING)->SendMessage(unpacked);
+				equids->getJockey(J_MAPPING)->SendMessage(unpacked.type, unpacked.data, unpacked.len);
             break;
 			}
 			case MSG_ACTIVE_JOCKEYS: {
@@ -204,19 +230,18 @@ void GrandChallenge1Scenario::Run() {
 				equids->getAllRunningJockeys(jockey_ids);
 				int id = V_ACTIONSELECTION;
 				jockey_ids.push_back(id);
-				int *jockey_arr = NULL;
 				int n_jockeys = jockey_ids.size();
 				int len = n_jockeys * ( sizeof(int) / sizeof(char) );
-				jockey_arr = new int[n_jockeys];
+				// the ids are written straight behind the envelope, with memcpy as the payload is not aligned
+				CMessage packedMessage;
+				uint8_t *payload = packedMessage.reserveZBMessage(-1, MSG_ACTIVE_JOCKEYS, len);
 				for (int i = 0; i < n_jockeys; i++) {
-					jockey_arr[i] = jockey_ids[i];
-//				if (len > 0) {
-//					jockey_arr = &jockey_ids[0];
+					int jockey_id = jockey_ids[i];
+					memcpy(payload + i * sizeof(int), &jockey_id, sizeof(int));
 				}
-				CMessage packedMessage = CMessage::packToZBMessage(-1, MSG_ACTIVE_JOCKEYS, jockey_arr, len);
 				std::cout << DEBUG << "????????????????????????????????????????????????????????????????????????????????????????????????????????????" << std::endl;
 				std::cout << DEBUG << "respond with message indicating " << n_jockeys << " active jockeys, namely: ";
-				for (int i = 0; i < n_jockeys; i++) std::cout << jockey_arr[i] << ' ';
+				for (int i = 0; i < n_jockeys; i++) std::cout << jockey_ids[i] << ' ';
 				std::cout << std::endl;
 				std::cout << DEBUG << "ActionSelection " << id << " should be one of them" << std::endl;
 //				equids->getJockey(J_ZBMESSENGER)->acknowledge = 0;
@@ -231,59 +256,12 @@ void GrandChallenge1Scenario::Run() {
             state = newState;
             break;
          }
-         case MSG_NEED_ORG: {
-            if (robot_type==(int)unpacked.data[0]) {
-               printf("SOMEBODY NEED Me, I'll send my position\n");
-               if (robot_need_id<0 || robot_need_time<time(NULL)-10) {
-                  robot_need_id = (int)unpacked.data[1];
-                  robot_need_time = time(NULL);
-                  CMessage recruitingMsg;
-                  CMessage packedMessage;
-
-                  recruitingMsg.type = MSG_HELP_ORG;
-                  recruiting_answ[0] = (uint8_t)robot_id;
-                  memcpy(&recruiting_answ[1], &equids->getJockey(J_POSITION)->actual_position, sizeof(struct UbiPosition));
-                  recruitingMsg.data = recruiting_answ;
-                  recruitingMsg.len=1+sizeof(struct UbiPosition); 
-            
-                  packedMessage = CMessage::packToZBMessage(robot_need_id,
-                     recruitingMsg.type, recruitingMsg.data,
-                     recruitingMsg.len);
-                  equids->getJockey(J_ZBMESSENGER)->SendMessage(packedMessage);
-               } else {
-                  printf("I promise to help %i in time %i now is %i\n", robot_need_id, robot_need_time, time(NULL));
-               }
-            }
-            break;
-         }
-         case MSG_HELP_ORG: {
-            printf("ROBOT from %f, %f wants to help\n");
-            UbiPosition *pos=(UbiPosition *)&unpacked.data[1];
-            UbiPosition *my = &equids->getJockey(J_POSITION)->actual_position;
-            float robot_distance=sqrt(sqr(pos->x-my->x)+sqr(pos->y-my->y));
-            if (robot_nearest_id<0 || robot_nearest_distance>robot_distance) {
-               robot_nearest_id = (int)unpacked.data[0];
-               robot_nearest_distance = robot_distance;
+         case MSG_ORG_STATE: {
+            if (!recruitment->receive(unpacked.data, unpacked.len)) {
+               std::cerr << DEBUG << "MSG_ORG_STATE of " << unpacked.len << " bytes is not a known version" << std::endl;
             }
             break;
          }
-         case MSG_HELP_ACP: {
-            UbiPosition *pos=(UbiPosition *)&unpacked.data[0];
-            UbiPosition *my = &equids->getJockey(J_POSITION)->actual_position;
-            float robot_distance=sqrt(sqr(pos->x-my->x)+sqr(pos->y-my->y));
-            goal.x = pos->x + 0.2*(my->x-pos->x)/robot_distance;
-            goal.y = pos->y + 0.2*(my->y-pos->y)/robot_distance;
-            goal.phi = atan2(pos->y-my->y,pos->x-my->x);
-            printf("MOVE TO pos (%f, %f, %f)\n", goal.x, goal.y, goal.phi);
-            CMessage go_to;
-            go_to.type = MSG_MOVETOPOSITION;
-            go_to.data = (uint8_t *)&goal;
-            go_to.len = sizeof(RobotPosition);
-            equids->getJockey(J_MOVETO)->SendMessage(go_to);
-            equids->switchToJockey(J_MOVETO);
-            state = S_CONNECTING;            
-				break;
-			}
 			default: {
 				std::cout << DEBUG << "received zigbee unknown message " << (int)unpacked.type << std::endl;
             break;
@@ -298,7 +276,6 @@ void GrandChallenge1Scenario::Run() {
 			}
 #ifdef __START_WITH_ZIGBEE__
 			if (zigbMessage.type != MSG_NONE) {
-				CMessage unpacked = CMessage::unpackZBMessage(zigbMessage);
 				switch (unpacked.type) {
 				case MSG_START: {
 					std::cout << DEBUG << "Go to state mapping through MSG_START through zigbee" << std::endl;
@@ -320,7 +297,6 @@ void GrandChallenge1Scenario::Run() {
 		}
 		case S_REMOTE_CONTROL: {
 					if (zigbMessage.type != MSG_NONE) {
-						CMessage unpacked = CMessage::unpackZBMessage(zigbMessage);
 						if (!equids->getJockey(J_REMOTE_CONTROL)->started) {
 							printf("switching to remote controll \n");
 							equids->switchToJockey(J_REMOTE_CONTROL);
@@ -328,7 +304,7 @@ void GrandChallenge1Scenario::Run() {
 						//sleepTime = 50;
 						if (unpacked.type == MSG_REMOTE_CONTROL) {
 							printf("sending MSG_REMOTE_CONTROL \n");
-							equids->getJockey(J_REMOTE_CONTROL)->SendMessage(unpacked);
+							equids->getJockey(J_REMOTE_CONTROL)->SendMessage(unpacked.type, unpacked.data, unpacked.len);
 						}
 						while (zigbMessage.type != MSG_NONE) {
 							zigbMessage =
@@ -345,13 +321,9 @@ void GrandChallenge1Scenario::Run() {
 							<< std::endl;
 					equids->initJockey(J_CAMERADETECTION,true);
 #if defined(VIDEOSTREAM)
-					equids->getJockey(J_CAMERADETECTION)->acknowledge = 0;
 					equids->getJockey(J_CAMERADETECTION)->SendMessage(
 							MSG_CAM_VIDEOSTREAM_START, NULL, 0);
-					while (equids->getJockey(J_CAMERADETECTION)->acknowledge
-							!= 1) {
-						usleep(10000);
-					}
+					equids->getJockey(J_CAMERADETECTION)->waitForAck();
 #endif
 				}
 				std::cout << DEBUG << "!equids->getJockey(J_POSITION)->started"
@@ -361,10 +333,9 @@ void GrandChallenge1Scenario::Run() {
 					equids->initJockey(J_POSITION,true);
 				}
 
-				equids->getJockey(J_POSITION)->addRedirection(J_MAPPING,
-						MSG_UBISENCE_POSITION);
-				equids->getJockey(J_CAMERADETECTION)->addRedirection(J_MAPPING,
-						MSG_CAM_DETECTED_BLOB);
+				equids->subscribe(J_MAPPING, MSG_UBISENCE_POSITION);
+				equids->subscribe(J_MAPPING, MSG_CAM_DETECTED_BLOB);
+				// not a subscription, the zigbee messenger itself sends MSG_ZIGBEE_MSG to the action selection
 				equids->getJockey(J_MAPPING)->addRedirection(J_ZBMESSENGER,
 						MSG_ZIGBEE_MSG);
 				equids->getJockey(J_CAMERADETECTION)->SendMessage(
@@ -381,10 +352,7 @@ void GrandChallenge1Scenario::Run() {
 			if (mappingMessage.type == MSG_MAP_DATA) {
 				std::cout << DEBUG << "MAP data.............." << std::endl;
 
-				CMessage packedMessage;
-
-				packedMessage = CMessage::packToZBMessage(-1,
-						mappingMessage.type, mappingMessage.data,
+				CMessage packedMessage = CMessage::packToZBMessage(-1, mappingMessage.type, mappingMessage.data,
 						mappingMessage.len);
 				equids->getJockey(J_ZBMESSENGER)->SendMessage(packedMessage);
 
@@ -392,7 +360,7 @@ void GrandChallenge1Scenario::Run() {
 
 			if (mappingMessage.type == MSG_MAP_COMPLETE) {
 				std::cout << DEBUG << "MAPPING JOCKEY EXIT" << std::endl;
-				equids->getJockey(J_POSITION)->removeAllRedirections();
+				equids->unsubscribeAll(J_MAPPING);
 				equids->getJockey(J_CAMERADETECTION)->stop(true);
 				equids->getJockey(J_MAPPING)->stop(true);
 				equids->getJockey(J_POSITION)->stop(true); // actually not necessary?
@@ -404,6 +372,8 @@ void GrandChallenge1Scenario::Run() {
 		case S_EXPLORATION: {
 			if (!equids->getJockey(J_INFRARED_EXPLORATION)->started) {
 				equids->switchToJockey(J_INFRARED_EXPLORATION);
+				// a collision switches to the laser scan, let it be ready for that
+				if (!equids->getJockey(J_LASER_RECOGNITION)->standby) equids->standbyJockey(J_LASER_RECOGNITION);
 			}
 			CMessage message = equids->getMessage(J_INFRARED_EXPLORATION);
 			if (message.type == MSG_COLLISION_DETECTED) {
@@ -422,9 +392,9 @@ void GrandChallenge1Scenario::Run() {
 			}
 			if (!equids->getJockey(J_LASER_RECOGNITION)->started) {
 				equids->initJockey(J_POSITION,true);
-				equids->getJockey(J_POSITION)->removeAllRedirections();
+				equids->unsubscribeAll(J_MAPPING);
 				// from ubisense positions to the laser scan application
-				equids->getJockey(J_POSITION)->addRedirection(J_LASER_RECOGNITION,MSG_UBISENCE_POSITION);
+				equids->subscribe(J_LASER_RECOGNITION, MSG_UBISENCE_POSITION);
 				equids->switchToJockey(J_LASER_RECOGNITION);
 			}
 #ifdef LASERSCAN_VIDEOSTREAM
@@ -451,15 +421,15 @@ void GrandChallenge1Scenario::Run() {
 			if (message.type == MSG_MAP_DATA) {
 				std::cout << DEBUG << "Got message: " << StrMessage[message.type]
 				                                                    << std::endl;
-				int len = sizeof(struct MappedObjectPosition);
-				if (message.len != len) {
+				MappedObjectPosition positionForMappedObject;
+				if (!unpackMappedObjectPosition(message.data, message.len, positionForMappedObject)) {
 					std::cerr << DEBUG
-							<< "Error, expected payload of MappedObjectPosition of size "
-							<< len << " while it is " << message.len
+							<< "Error, expected payload of MappedObjectPositionWire version "
+							<< MappedObjectPositionWire::VERSION << " of at least size "
+							<< sizeof(MappedObjectPositionWire) << " while it is " << message.len
 							<< std::endl;
+					break;
 				}
-				MappedObjectPosition positionForMappedObject;
-				memcpy(&positionForMappedObject, message.data, message.len);
 				std::cout << DEBUG << "Detected object: "
 						<< StrMapObjectType[positionForMappedObject.type]
 						                    << std::endl;
@@ -468,6 +438,8 @@ void GrandChallenge1Scenario::Run() {
 				case SMALL_STEP:
 				case LARGE_STEP:
 					state = S_RECRUITING;
+					recruitment->need(RobotBase::ACTIVEWHEEL, 1);
+					recruit_time = time(NULL);
                std::cout << DEBUG << "Start recruiting robots for organism and update map with info on \"step\"" << std::endl;
                equids->getJockey(J_MAPPING)->SendMessage(message);
                if (J_WENGUO>=0) {
@@ -498,49 +470,26 @@ void GrandChallenge1Scenario::Run() {
 			break;
 		}
       case S_RECRUITING: {
-         CMessage recruitingMsg;
-         CMessage packedMessage;
-         if (recr_state==0) {
-            recruitingMsg.type = MSG_NEED_ORG;
-            recruiting_tmp[0] = (uint8_t)(RobotBase::ACTIVEWHEEL);
-            recruiting_tmp[1] = (uint8_t)robot_id;
-            recruitingMsg.data = recruiting_tmp;
-            recruitingMsg.len=2;
-            
-            packedMessage = CMessage::packToZBMessage(-1,
-                  recruitingMsg.type, recruitingMsg.data,
-                  recruitingMsg.len);
-            equids->getJockey(J_ZBMESSENGER)->SendMessage(packedMessage);
-            recr_state=1;
-            robot_recr_time = time(NULL);
-         } if (recr_state==1) {
-            if (robot_recr_time > time(NULL)-5) {
-               if (robot_nearest_id<0) {
-                  std::cout << DEBUG << "Nobody is listening, Go back to exploration" << std::endl;
-                  equids->getJockey(J_POSITION)->stop(true);
-                  state = S_EXPLORATION;
-               } else {
-                  memcpy(&recruiting_accp[0], &equids->getJockey(J_POSITION)->actual_position, sizeof(UbiPosition));
-                  recruitingMsg.type = MSG_HELP_ACP;
-                  recruitingMsg.data = recruiting_accp;
-                  recruitingMsg.len=sizeof(UbiPosition);
-                  packedMessage = CMessage::packToZBMessage(robot_nearest_id,
-                     recruitingMsg.type, recruitingMsg.data,
-                     recruitingMsg.len);
-                  equids->getJockey(J_ZBMESSENGER)->SendMessage(packedMessage);
-                  recr_state=2;
-                  robot_recr_time = time(NULL);
-               }
-            } 
-         } else if (recr_state==2) {
+         if (recruitment->isComplete()) {
+            std::cout << DEBUG << "Recruited " << recruitment->getMembers() << " robots, wait for them to dock" << std::endl;
+            state = S_ASSEMBLE;
+         } else if (recruitment->getMembers() == 0 && time(NULL) - recruit_time > RECRUIT_TIMEOUT) {
+            std::cout << DEBUG << "Nobody is listening, Go back to exploration" << std::endl;
+            recruitment->cancel();
+            equids->getJockey(J_POSITION)->stop(true);
+            state = S_EXPLORATION;
          }
          break;
       }
 		case S_QUIT:
 			quit = true;
 			break;
+		default:
+			break;
 		}
-		usleep(100000);
+		Recruit();
+		// the next round starts when a jockey has a message, or after 100 ms
+		equids->waitForArrival(seen, 100);
 	}
 }
 
@@ -28,6 +28,7 @@
 #define GRANDCHALLENGE1SCENARIO_H_
 
 #include <CScenario.h>
+#include <CRecruitment.h>
 
 /**
  * The scenario implements the overall Grand Challenge 1. It contains mapping, exploration (which puts on the map where
@@ -74,6 +75,9 @@ public:
 	//! Create msg
 	void CreateMsgLaserDetectObject(CMessage &msg);
 
+	//! Broadcast the recruitment table when it is time and drive to the seed this robot is assigned to
+	void Recruit();
+
 	// Define the jockeys for this scenario
 	jockey_id J_MAPPING;
 	jockey_id J_LASER_RECOGNITION;
@@ -93,6 +97,12 @@ private:
 
 	//! A raised quit flag will drop out of the while loop in Run()
 	bool quit;
+
+	//! The robots and their roles in the building of an organism, created in Run() when the id of the robot is known
+	CRecruitment *recruitment;
+
+	//! Time in s the recruitment of this robot started
+	time_t recruit_time;
 };
 
 
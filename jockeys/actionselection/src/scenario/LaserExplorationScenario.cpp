@@ -29,11 +29,13 @@
 #include <iostream>
 
 #include <messageDataType.h>
+#include <messageSchema.h>
 
 LaserExplorationScenario::LaserExplorationScenario(CEquids * equids): CScenario(equids) {
-	J_LASER_RECOGNITION = J_POSITION = J_RANDOM_EXPLORATION = -1;
+	J_LASER_RECOGNITION = J_POSITION = J_RANDOM_EXPLORATION = J_MAPPING = J_DRIVE_TO_POSITION = -1;
 
 	quit = false;
+	frontierAsked = false;
 
 	// set initial state
 	state = S_START;
@@ -62,6 +64,14 @@ bool LaserExplorationScenario::Init() {
 		continue_program = false;
 	}
 
+	id = V_MAPPING;
+	J_MAPPING = equids->find("mapping", id);
+	id = V_MOVE_TO_POSITION;
+	J_DRIVE_TO_POSITION = equids->find("movetoposition", id);
+	if (J_MAPPING == -1 || J_DRIVE_TO_POSITION == -1) {
+		std::cout << "No jockeys \"mapping\" and \"movetoposition\", the frontiers are not explored" << std::endl;
+	}
+
 	//equids->initJockey(J_POSITION);
 
 	equids->initJockey(J_LASER_RECOGNITION);
@@ -69,6 +79,22 @@ bool LaserExplorationScenario::Init() {
 	return continue_program;
 }
 
+void LaserExplorationScenario::streamScans(bool enable) {
+	uint8_t stream = enable ? 1 : 0;
+	if (enable) {
+		equids->getJockey(J_LASER_RECOGNITION)->addRedirection(J_MAPPING, MSG_LASER_SCAN);
+	} else {
+		equids->getJockey(J_LASER_RECOGNITION)->removeRedirection(J_MAPPING, MSG_LASER_SCAN);
+	}
+	equids->getJockey(J_LASER_RECOGNITION)->SendMessage(MSG_LASER_SCAN_STREAM, &stream, 1);
+}
+
+/**
+ * The mapping jockey is not started, it only fills its occupancy grid with the scans and answers MSG_FRONTIER_REQ,
+ * while the movetoposition jockey drives. Both use the odometry that the motors of the robot share between the
+ * jockeys, the frontiers are in its frame. The Ubisense fixes are not redirected to movetoposition, because the corrections would
+ * move the odometry away from the frame of the grid.
+ */
 void LaserExplorationScenario::Run() {
 	CMessage msg;
 	MappedObjectPosition position;
@@ -76,12 +102,19 @@ void LaserExplorationScenario::Run() {
 	msg.data = new uint8_t[len];
 	msg.len = len;
 	while (!quit) {
+		// taken before the queues are read, a message that arrives while they are read ends the wait at once
+		unsigned int seen = equids->arrivals();
 		switch(state) {
 		case S_START:
 			//equids->switchToJockey(J_POSITION);
 //			state = S_RANDOM_EXPLORATION;
 //			equids->switchToJockey(J_LASER_RECOGNITION);
-			state = S_RECOGNITION;
+			if (J_MAPPING != -1 && J_DRIVE_TO_POSITION != -1) {
+				streamScans(true);
+				state = S_FRONTIER_REQUEST;
+			} else {
+				state = S_RECOGNITION;
+			}
 			break;
 		case S_RANDOM_EXPLORATION: {
 			// run this forever for now
@@ -91,6 +124,41 @@ void LaserExplorationScenario::Run() {
 			}
 			break;
 		}
+		case S_FRONTIER_REQUEST: {
+			if (!frontierAsked) {
+				equids->getJockey(J_MAPPING)->SendMessage(MSG_FRONTIER_REQ, NULL, 0);
+				frontierAsked = true;
+			}
+			CMessage answer = equids->getJockey(J_MAPPING)->getMessage();
+			if (answer.type != MSG_FRONTIER) break;
+			frontierAsked = false;
+			const FrontierWire *frontier = wireView<FrontierWire>(answer.data, answer.len);
+			if (frontier == NULL || !frontier->found) {
+				std::cout << "No frontier left, the arena is explored" << std::endl;
+				streamScans(false);
+				state = S_RECOGNITION;
+				break;
+			}
+			RobotPosition goal;
+			goal.x = frontier->x;
+			goal.y = frontier->y;
+			goal.phi = frontier->phi;
+			std::cout << "Explore the frontier at " << goal.x << ", " << goal.y << " of " << frontier->gain
+					<< " cells, " << frontier->clusters << " frontiers left" << std::endl;
+			equids->getJockey(J_DRIVE_TO_POSITION)->SendMessage(MSG_MOVETOPOSITION, &goal, sizeof(RobotPosition));
+			equids->initJockey(J_DRIVE_TO_POSITION, true);
+			state = S_FRONTIER_DRIVE;
+			break;
+		}
+		case S_FRONTIER_DRIVE: {
+			CMessage drive = equids->getJockey(J_DRIVE_TO_POSITION)->getMessage();
+			if (drive.type == MSG_MOVETOPOSITION_DONE) {
+				// stopped, so the next goal starts it again from the beginning
+				equids->getJockey(J_DRIVE_TO_POSITION)->stop(true);
+				state = S_FRONTIER_REQUEST;
+			}
+			break;
+		}
 		case S_RECOGNITION: {
 			std::cout << "Send recognition message of size " << len << std::endl;
 			// send message to recognize object at this location
@@ -112,7 +180,7 @@ void LaserExplorationScenario::Run() {
 			quit = true;
 			break;
 		}
-		usleep(100000);
+		equids->waitForArrival(seen, 100);
 	}
 }
 
@@ -40,13 +40,15 @@
 class LaserExplorationScenario: public CScenario {
 public:
 	/**
-	 * After starting we perform random exploration. Later on we will need to replace this by going to position indicated
-	 * as interesting by the mapping jockey.
+	 * After starting we explore the frontiers that the mapping jockey finds in its occupancy grid, one after the other,
+	 * if there are a mapping and a movetoposition jockey, and recognize objects after that.
 	 */
 	typedef enum
 	{
 		S_START,
 		S_RANDOM_EXPLORATION,              // randomly explore, using infrared for collision avoidance
+		S_FRONTIER_REQUEST,                // ask the mapping jockey for the next frontier to explore
+		S_FRONTIER_DRIVE,                  // drive to the frontier, the laser scans it meanwhile
 		S_RECOGNITION,                     // recognize (height of) an object, small obstacle like a step, or a wall
 		S_QUIT
 	} TState;
@@ -67,6 +69,9 @@ public:
 	jockey_id J_RANDOM_EXPLORATION;
 	jockey_id J_LASER_RECOGNITION;
 	jockey_id J_POSITION;
+	//! Optional, with J_DRIVE_TO_POSITION the frontiers of the occupancy grid of the mapping jockey are explored first
+	jockey_id J_MAPPING;
+	jockey_id J_DRIVE_TO_POSITION;
 
 private:
 	//! State for the state machine in Run()
@@ -74,6 +79,12 @@ private:
 
 	//! A raised quit flag will drop out of the while loop in Run()
 	bool quit;
+
+	//! Start or stop the stream of scans from the laser to the occupancy grid of the mapping jockey
+	void streamScans(bool enable);
+
+	//! A MSG_FRONTIER_REQ is sent and not answered yet
+	bool frontierAsked;
 };
 
 
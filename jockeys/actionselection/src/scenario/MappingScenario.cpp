@@ -26,6 +26,7 @@
 #ifdef ENABLE_MAPPING_SCENARIO
 
 #include <messageDataType.h>
+#include <messageSchema.h>
 #include <wapi/wapi_ubitag.h>
 #include <iostream>
 #include <inttypes.h>
@@ -42,7 +43,7 @@ MappingScenario::MappingScenario(CEquids * equids) :
 		CScenario(equids) {
 	J_CAMERADETECTION = J_POSITION = J_MOTORCALIBRATION = J_MAPPING =
 			J_DRIVE_TO_POSITION = J_DOCK_SOCKET = J_ZBMESSENGER =
-					J_REMOTE_CONTROL = J_ORGANISM_CONTROL = lastActiveJockey =
+					J_REMOTE_CONTROL = J_ORGANISM_CONTROL = J_LASERSCAN = lastActiveJockey =
 							-1;
 
 	quit = false;
@@ -76,6 +77,8 @@ bool MappingScenario::Init() {
 	J_REMOTE_CONTROL = equids->find("remotecontrol",id);
 	id = V_ORGANISM_CONTROL;
 	J_ORGANISM_CONTROL = equids->find("organismcontrol",id);
+	id = V_LASERSCAN;
+	J_LASERSCAN = equids->find("laserscan",id);
 
 	//! Send an error message or also quit program..
 	if (J_POSITION == -1) {
@@ -151,16 +154,18 @@ void MappingScenario::Run() {
 
 	while (!quit) {
 
+		// taken before the queues are read, a message that arrives while they are read ends the wait at once
+		unsigned int seen = equids->arrivals();
 		CMessage zigbMessage = equids->getJockey(J_ZBMESSENGER)->getMessage();
 		//	printf("after read \n");
 		//	printf("message type %d \n",zigbMessage.type);
-		if (zigbMessage.type != MSG_NONE) {
-			//	printf("unpacking \n");
-			CMessage unpacked = CMessage::unpackZBMessage(zigbMessage);
-			//	printf("unpacked \n");
+		// a view into the received message, valid until zigbMessage is read again
+		ZBEnvelope unpacked;
+		if (zigbMessage.viewZBMessage(unpacked)) {
 			switch (unpacked.type) {
-			case MSG_MAP_DATA: {
-				equids->getJockey(J_MAPPING)->SendMessage(unpacked);
+			case MSG_MAP_DATA:
+			case MSG_MAP_SNAPSHOT: {
+				equids->getJockey(J_MAPPING)->SendMessage(unpacked.type, unpacked.data, unpacked.len);
 			}
 				break;
 			case MSG_FORCE_CHANGE_JOCKEY: {
@@ -183,8 +188,7 @@ void MappingScenario::Run() {
 			break;
 
 			if (zigbMessage.type == MSG_ZIGBEE_MSG) {
-				CMessage normal = CMessage::unpackZBMessage(zigbMessage);
-				if (normal.type == MSG_START) {
+				if (unpacked.type == MSG_START) {
 					printf("starting \n\n\n\n");
 					state = S_CALIBRATE_ODOMETRY;
 				}
@@ -203,13 +207,9 @@ void MappingScenario::Run() {
 					std::cout << "init Cameradetection" << std::endl;
 					equids->initJockey(J_CAMERADETECTION);
 #if defined(VIDEOSTREAM)
-					equids->getJockey(J_CAMERADETECTION)->acknowledge = 0;
 					equids->getJockey(J_CAMERADETECTION)->SendMessage(
 							MSG_CAM_VIDEOSTREAM_START, NULL, 0);
-					while (equids->getJockey(J_CAMERADETECTION)->acknowledge
-							!= 1) {
-						usleep(10000);
-					}
+					equids->getJockey(J_CAMERADETECTION)->waitForAck();
 #endif
 
 				}
@@ -225,6 +225,13 @@ void MappingScenario::Run() {
 			}
 			//running jockey is J_MOTORCALIBRATION
 			CMessage message = equids->getRunningJockey()->getMessage();
+			if (message.type == MSG_MOTOR_CALIBRATION_REPORT) {
+				// the reports of all robots are collected by the visualiser over the ZigBee
+				uint64_t broadcast = Ubitag::BROADCAST;
+				CMessage packedMessage = CMessage::packToZBMessage(broadcast,
+						message.type, message.data, message.len);
+				equids->getJockey(J_ZBMESSENGER)->SendMessage(packedMessage);
+			}
 			if (message.type == MSG_MOTOR_CALIBRATION_RESULT) {
 				std::cout << "calibrated" << std::endl;
 				MotorCalibResult calib;
@@ -263,13 +270,9 @@ void MappingScenario::Run() {
 							<< std::endl;
 					equids->initJockey(J_CAMERADETECTION);
 #if defined(VIDEOSTREAM)
-					equids->getJockey(J_CAMERADETECTION)->acknowledge = 0;
 					equids->getJockey(J_CAMERADETECTION)->SendMessage(
 							MSG_CAM_VIDEOSTREAM_START, NULL, 0);
-					while (equids->getJockey(J_CAMERADETECTION)->acknowledge
-							!= 1) {
-						usleep(10000);
-					}
+					equids->getJockey(J_CAMERADETECTION)->waitForAck();
 #endif
 				}
 				std::cout << "!equids->getJockey(J_POSITION)->started"
@@ -287,6 +290,14 @@ void MappingScenario::Run() {
 						MSG_ZIGBEE_MSG);
 				equids->getJockey(J_CAMERADETECTION)->SendMessage(
 						MSG_CAM_DETECT_MAPPING, NULL, 0);
+				if (J_LASERSCAN != -1) {
+					if (!equids->getJockey(J_LASERSCAN)->started) {
+						equids->initJockey(J_LASERSCAN, true);
+					}
+					uint8_t stream = 1;
+					equids->getJockey(J_LASERSCAN)->addRedirection(J_MAPPING, MSG_LASER_SCAN);
+					equids->getJockey(J_LASERSCAN)->SendMessage(MSG_LASER_SCAN_STREAM, &stream, 1);
+				}
 				std::cout << "init J_MAPPING" << std::endl;
 				equids->initJockey(J_MAPPING);
 				std::cout << "redirecting camera detection to J_MAPPING"
@@ -294,9 +305,8 @@ void MappingScenario::Run() {
 			}
 
 			if (zigbMessage.type == MSG_ZIGBEE_MSG) {
-				CMessage normalMSG = CMessage::unpackZBMessage(zigbMessage);
-				if (normalMSG.type == MSG_MAP_DATA) {
-					equids->getJockey(J_MAPPING)->SendMessage(normalMSG);
+				if (unpacked.type == MSG_MAP_DATA || unpacked.type == MSG_MAP_SNAPSHOT) {
+					equids->getJockey(J_MAPPING)->SendMessage(unpacked.type, unpacked.data, unpacked.len);
 				}
 			}
 
@@ -382,10 +392,8 @@ void MappingScenario::Run() {
 					messageDockPos = equids->getJockey(J_MAPPING)->getMessage();
 				}
 				RobotPosition driveTo;
-				if (iter < 20) {
-					MappedObjectPosition dockPos;
-					memcpy(&dockPos, messageDockPos.data,
-							sizeof(MappedObjectPosition));
+				MappedObjectPosition dockPos;
+				if (iter < 20 && unpackMappedObjectPosition(messageDockPos.data, messageDockPos.len, dockPos)) {
 					printf("received docking pos %f %f \n", dockPos.xPosition,
 							dockPos.yPosition);
 					driveTo.phi = dockPos.phiPosition;
@@ -586,12 +594,9 @@ void MappingScenario::Run() {
 				equids->getJockey(J_CAMERADETECTION)->SendMessage(
 						MSG_CAM_DETECT_MAPPING, NULL, 0);
 #if defined(VIDEOSTREAM)
-				equids->getJockey(J_CAMERADETECTION)->acknowledge = 0;
 				equids->getJockey(J_CAMERADETECTION)->SendMessage(
 						MSG_CAM_VIDEOSTREAM_START, NULL, 0);
-				while (equids->getJockey(J_CAMERADETECTION)->acknowledge != 1) {
-					usleep(10000);
-				}
+				equids->getJockey(J_CAMERADETECTION)->waitForAck();
 #endif
 			}
 		}
@@ -599,7 +604,6 @@ void MappingScenario::Run() {
 			break;
 		case S_REMOTE_CONTROL: {
 			if (zigbMessage.type != MSG_NONE) {
-				CMessage unpacked = CMessage::unpackZBMessage(zigbMessage);
 				if (!equids->getJockey(J_REMOTE_CONTROL)->started) {
 					printf("switching to remote controll \n");
 					equids->switchToJockey(J_REMOTE_CONTROL);
@@ -607,7 +611,7 @@ void MappingScenario::Run() {
 				sleepTime = 50;
 				if (unpacked.type == MSG_REMOTE_CONTROL) {
 					printf("sending MSG_REMOTE_CONTROL \n");
-					equids->getJockey(J_REMOTE_CONTROL)->SendMessage(unpacked);
+					equids->getJockey(J_REMOTE_CONTROL)->SendMessage(unpacked.type, unpacked.data, unpacked.len);
 				}
 				while (zigbMessage.type != MSG_NONE) {
 					zigbMessage =
@@ -734,6 +738,8 @@ void MappingScenario::Run() {
 						MSG_CAM_DETECT_DOCKING, NULL, 0);
 				equids->getJockey(J_DOCK_SOCKET)->addRedirection(
 						J_ORGANISM_CONTROL, MSG_REMOTE_CONTROL);
+				equids->getJockey(J_DOCK_SOCKET)->addRedirection(
+						J_ORGANISM_CONTROL, MSG_ORGANISM_COMMAND);
 				equids->getJockey(J_DOCK_SOCKET)->SendMessage(MSG_DOCK_ORGANISM,
 						NULL, 0);
 				if (!equids->getJockey(J_DOCK_SOCKET)->started) {
@@ -770,12 +776,9 @@ void MappingScenario::Run() {
 			break;
 		case S_LEADER_OF_ORGANISM_REMOTECONTROL: {
 			if (zigbMessage.type != MSG_NONE) {
-				CMessage unpacked = CMessage::unpackZBMessage(zigbMessage);
-
 				if (unpacked.type == MSG_REMOTE_CONTROL) {
 					printf("sending MSG_REMOTE_CONTROL \n");
-					equids->getJockey(J_ORGANISM_CONTROL)->SendMessage(
-							unpacked);
+					equids->getJockey(J_ORGANISM_CONTROL)->SendMessage(unpacked.type, unpacked.data, unpacked.len);
 				}
 			}
 		}
@@ -798,7 +801,8 @@ void MappingScenario::Run() {
 			quit = true;
 			break;
 		}
-		usleep(sleepTime);
+		// the next round starts when a jockey has a message, or after sleepTime
+		equids->waitForArrival(seen, sleepTime / 1000);
 	}
 }
 
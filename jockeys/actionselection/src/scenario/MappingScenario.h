@@ -81,6 +81,8 @@ typedef enum {
 	jockey_id J_DOCK_SOCKET;
 	jockey_id J_REMOTE_CONTROL;
 	jockey_id J_ORGANISM_CONTROL;
+	//! Optional, its scans fill the occupancy grid of the mapping jockey, with a camera shared with cameradetection
+	jockey_id J_LASERSCAN;
 
 private:
 	//! State for the state machine in Run()
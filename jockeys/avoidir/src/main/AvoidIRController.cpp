@@ -35,7 +35,8 @@ static const std::string NAME = "AvoidInfrared";
 //#define REACT_TO_LEFT_AND_RIGHT
 // #define RANDOM_ESCAPE // too much back and forth rotations then...
 
-AvoidIRController::AvoidIRController(): motors(NULL), leds(NULL), collision(false), standalone(false) {
+AvoidIRController::AvoidIRController(): motors(NULL), leds(NULL), frameLog(NULL), collision(false), standalone(false),
+		collision_event(false) {
 #ifdef RANDOM_ESCAPE
 	srand(time(NULL));
 #endif
@@ -62,6 +63,34 @@ void AvoidIRController::start() {
 	CController::start();
 }
 
+void AvoidIRController::onStart() {
+	start();
+	if (collision) {
+		std::cout << "Start controller again after a collision, perform an escape maneuver" << std::endl;
+		escape();
+	} else {
+		get_calibration();
+	}
+}
+
+void AvoidIRController::onStop() {
+	stop_motors();
+	pause();
+}
+
+//! Do calibration - if you want to - after MSG_INIT or after MSG_STOP
+void AvoidIRController::onCalibrate() {
+	start();
+	calibrate();
+	pause();
+}
+
+void AvoidIRController::onQuit() {
+	pause();
+	signal_end();
+	graceful_end();
+}
+
 void AvoidIRController::initRobotPeriphery() {
 	// we need to initialize the motors before calibrate leds (which turns the robot around)
 	std::ostringstream msg;
@@ -85,15 +114,51 @@ void AvoidIRController::initRobotPeriphery() {
 		graceful_end();
 		exit(EXIT_SUCCESS);
 	}
+	// FRAME_LOG=/data/log/avoidir.flog records every IR frame and motor command, convert it with framelogcsv
+	char *str_frame_log = getenv("FRAME_LOG");
+	if (str_frame_log) {
+		frameLog = new CFrameLog();
+		if (frameLog->open(str_frame_log)) {
+			leds->setFrameLog(frameLog);
+			motors->setFrameLog(frameLog);
+		} else {
+			delete frameLog;
+			frameLog = NULL;
+		}
+	}
+
+	// from now on the LEDs are sampled at a fixed rate, collision() only reads the last frame
+	if (!leds->startSampling()) {
+		std::cerr << DEBUG << "Sample the LEDs on every tick instead" << std::endl;
+	} else {
+		// the offsets follow the readings while driving, so the robot does not have to turn around for calibrate()
+		leds->recalibrate();
+		if (robot_type == RobotBase::SCOUTBOT) {
+			leds->watchCollision(LL_FRONT_LEFT, 0, &AvoidIRController::collisionEvent, this);
+		}
+	}
+}
+
+/**
+ * Runs in the sampler thread of the leds, in the frame in which the threshold is crossed, so the robot does not drive
+ * on until the next tick. While it escapes from a collision the motors are left alone.
+ */
+void AvoidIRController::collisionEvent(void *controller, LedLocation loc, int value) {
+	AvoidIRController *self = (AvoidIRController*) controller;
+	if (self->collision) return;
+	self->motors->setSpeeds(0, 0);
+	self->collision_event = true;
 }
 
 void AvoidIRController::print() {
-	// sample the LEDs for a while, each update() takes a bit of time, so the total span is around 0.1 seconds.
-	leds->setVerbosity(LOG_ERR);
-	for (int s = 0; s < 10; ++s)  {
-		leds->update();
+	// without the sampler thread, sample the LEDs for a while, the update() calls span around 0.1 seconds
+	if (!leds->isSampling()) {
+		leds->setVerbosity(LOG_ERR);
+		for (int s = 0; s < 10; ++s)  {
+			leds->update();
+		}
+		leds->setVerbosity(LOG_INFO);
 	}
-	leds->setVerbosity(LOG_INFO);
 
 	if (robot_type == RobotBase::ACTIVEWHEEL) {
 		for (int i = 0; i < 4; i++) {
@@ -177,14 +242,19 @@ void AvoidIRController::tick() {
 	// just return when there has been a collision, first call escape()
 	if (collision) return;
 
-	// sample the LEDs for a while, each update() takes a bit of time, so the total span is around 0.1 seconds.
-	for (int s = 0; s < 40; ++s)  {
-		leds->update();
+	// the sampler thread of the LEDs keeps the averages up to date, otherwise sample them for a while
+	if (!leds->isSampling()) {
+		for (int s = 0; s < 40; ++s)  {
+			leds->update();
+		}
 	}
 
 	// only on a collision, drive the wheels
 	if (robot_type == RobotBase::SCOUTBOT) {
-		if (leds->collision()) {
+		// with the sampler thread the collision has been signalled already, otherwise ask for it
+		bool collided = leds->isSampling() ? collision_event : leds->collision();
+		if (collided) {
+			collision_event = false;
 			collision = true;
 			reportCollision();
 			if (standalone) {
@@ -309,6 +379,18 @@ void AvoidIRController::graceful_end() {
 	motors->halt();
 	sleep(1);
 
+	// the next start begins with the offsets of this run
+	if (leds->isRecalibrating()) {
+		leds->recalibrate(false);
+		leds->save_calibration();
+	}
+
+	if (frameLog != NULL) {
+		leds->setFrameLog(NULL);
+		motors->setFrameLog(NULL);
+		frameLog->close();
+	}
+
 	std::cout << DEBUG << "Graceful end..." << std::endl;
 	//exit(EXIT_SUCCESS);
 }
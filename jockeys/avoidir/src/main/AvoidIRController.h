@@ -83,12 +83,28 @@ public:
 	void graceful_end();
 
 	inline void setStandAlone(bool standalone = true) { this->standalone = standalone; }
+protected:
+	//! Escape if the controller was stopped by a collision, otherwise get the calibration again
+	void onStart();
+
+	void onStop();
+
+	void onCalibrate();
+
+	void onQuit();
 private:
 	//! Specific bridles to be used
 	CMotors *motors;
 	CLeds *leds;
+	//! The IR frames and motor commands of the run, if FRAME_LOG is set
+	CFrameLog *frameLog;
 	bool standalone;
 	bool collision;
+	//! Set by the sampler thread of the leds, tick() handles it
+	volatile bool collision_event;
+
+	//! Stops the motors right away, the collision itself is handled in tick()
+	static void collisionEvent(void *controller, LedLocation loc, int value);
 };
 
 
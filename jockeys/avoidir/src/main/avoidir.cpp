@@ -48,6 +48,7 @@
 
 #include <CMotors.h>
 #include <CLeds.h>
+#include <CTimer.h>
 
 /***********************************************************************************************************************
  * Debug info
@@ -123,9 +124,15 @@ void controller_specific_args(AvoidIRController & controller, int argc, char **a
 					controller.print();
 				} while (!gStop);
 			} else {
+				// tick at the rate the LEDs are sampled, without the sampler a tick itself takes longer than that
+				CPeriodic rate(LEDS_SAMPLE_PERIOD * 1000LL);
 				do {
 					controller.tick();
+					rate.wait();
 				} while (!gStop);
+				std::cout << DEBUG << "Ticks were late by " << rate.getMeanLateness() / 1000 << "us on average and "
+						<< rate.getMaxLateness() / 1000 << "us at most, " << rate.getOverruns() << " times behind"
+						<< std::endl;
 			}
 		}
 		controller.signal_end();
@@ -154,78 +161,7 @@ int main(int argc, char **argv) {
 
 	controller.initServer();
 
-	CMessage message;
-	bool quitController = false;
-	bool runController = false;
-	while (!quitController){
-
-		usleep(50000);
-		if (!runController)
-			usleep(450000);
-
-		message = controller.getMessage();
-
-		if (message.type != MSG_NONE) {
-			if (message.len > 0) {
-				std::cout << DEBUG << "Got command: \"" << message.getStrType() << "\" of length " << message.len << std::endl;
-			} else {
-				std::cout << DEBUG << "Got command: \"" << message.getStrType() << "\"" << std::endl;
-			}
-		}
-
-		switch (message.type){
-		case MSG_INIT: {
-			controller.initRobot();
-			controller.initRobotPeriphery();
-			controller.pause();
-			controller.acknowledge();
-			break;
-		}
-		case MSG_START: {
-			runController = true;
-			controller.start();
-			if (controller.collided()) {
-				std::cout << "Start controller again after a collision, perform an escape maneuver" << std::endl;
-				controller.escape();
-			} else {
-				controller.get_calibration();
-			}
-			controller.acknowledge();
-			break;
-		}
-		// do calibration - if you want to - after MSG_INIT or after MSG_STOP
-		case MSG_CALIBRATE: {
-			controller.start();
-			controller.calibrate();
-			controller.pause();
-			controller.acknowledge();
-			break;
-		}
-		case MSG_STOP: {
-			runController = false;
-			controller.stop_motors();
-			controller.pause();
-			controller.acknowledge();
-			break;
-		}
-		case MSG_NONE: {
-			if (runController) {
-				// do our thing
-				controller.tick();
-			}
-			break;
-		}
-		case MSG_QUIT: {
-			runController = true;
-			controller.pause();
-			controller.signal_end();
-			controller.graceful_end();
-			controller.acknowledge();
-			quitController = true;
-			break;
-		}
-
-		}
-	}
-	return EXIT_SUCCESS;
+	// look for messages and tick every 50ms, like the loop of the other jockeys
+	controller.setCycle(50000);
+	return controller.run();
 }
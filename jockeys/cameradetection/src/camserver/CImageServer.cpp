@@ -1,53 +1,42 @@
 #include "CImageServer.h"
+#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <algorithm>
 
 bool CISdebug = false;
 
-CImageServer::CImageServer(sem_t *imsem, CRawImage* im) {
-	connected = false;
-	serverSocket = mySocket = -1;
-	dataSem = imsem;
-	messageRead = 0;
-	image = im;
+CImageServer::CImageServer(CFramePublisher *frames) {
+	serverSocket = -1;
+	this->frames = frames;
 	CISdebug = false;
 	stop = false;
-	sem_init(&connectSem, 0, 1);
+	raw[0] = raw[1] = NULL;
+	running = false;
 }
 
 CImageServer::~CImageServer() {
+	stopServer();
 }
 
-void* connectLoop(void *serv) {
-	struct sockaddr_in clientAddr;
-	socklen_t addrLen = sizeof(clientAddr);
+static uint64_t streamTime() {
+	struct timeval time;
+	gettimeofday(&time, NULL);
+	return (uint64_t) time.tv_sec * 1000000 + time.tv_usec;
+}
+
+void* serverLoop(void* serv) {
 	CImageServer* server = (CImageServer*) serv;
-	int newServer = 0;
-	while (!server->stop) {
-		newServer = accept(server->serverSocket,
-				(struct sockaddr *) &clientAddr, &addrLen);
-		if (newServer > -1) {
-			if (CISdebug)
-				fprintf(stdout, "CImageServer: Incoming connection from %s.\n",
-						inet_ntoa(clientAddr.sin_addr));
-			if (CISdebug)
-				fprintf(stdout,
-						"CImageServer: Incoming connection accepted on socket level %i.\n",
-						newServer);
-			sem_wait(&server->connectSem);
-			server->mySocket = newServer;
-			sem_post(&server->connectSem);
-			pthread_t* thread = (pthread_t*) malloc(sizeof(pthread_t));
-			pthread_create(thread, NULL, &serverLoop, (void*) server);
-		} else {
-			if (CISdebug)
-				fprintf(stdout, "CImageServer: Accept on listening socked failed.\n");
-		}
-	}
+	server->serve();
 	return NULL;
 }
 
 int CImageServer::initServer(const char* port) {
 	if (CISdebug)
 		fprintf(stdout, "CImageServer: Initialize server.\n");
+	if (running)
+		stopServer();
 	int used_port = atoi(port);
 	stop = false;
 	struct sockaddr_in mySocketAddr;
@@ -60,90 +49,401 @@ int CImageServer::initServer(const char* port) {
 			fprintf(stdout, "Cannot create socket.\n");
 		return -1;
 	}
+	int reuse = 1;
+	setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
 	if (bind(serverSocket, (struct sockaddr *) &mySocketAddr,
 			sizeof(mySocketAddr)) < 0) {
 		if (CISdebug)
 			fprintf(stdout, "Cannot bind socket.\n");
+		close(serverSocket);
+		serverSocket = -1;
 		return -2;
 	}
-	if (listen(serverSocket, 1) < 0) {
+	if (listen(serverSocket, 4) < 0) {
 		if (CISdebug)
 			fprintf(stdout, "cannot make socket listen.\n");
 	}
-	pthread_t* thread = (pthread_t*) malloc(sizeof(pthread_t));
 	if (CISdebug)
-		fprintf(stdout, "creating connectLoop\n");
-	pthread_create(thread, NULL, &connectLoop, (void*) this);
-	return 0;
+		fprintf(stdout, "creating serverLoop\n");
+	running = (pthread_create(&thread, NULL, &serverLoop, (void*) this) == 0);
+	return running ? 0 : -3;
 }
 
 void CImageServer::stopServer() {
-//	pthread_kill(connectLoopThread, SIGALRM);
-
-	close(this->serverSocket);
 	this->stop = true;
+	if (running) {
+		pthread_join(thread, NULL);
+		running = false;
+	}
+}
 
+void CImageServer::serve() {
+	std::vector<struct pollfd> fds;
+	while (!stop) {
+		uint64_t now = streamTime();
+		int timeout = CIS_POLL_TIMEOUT;
+		for (int i = 0; i < (int) streams.size(); i++) {
+			int due = streams[i]->next > now ? (int) ((streams[i]->next - now + 999) / 1000) : 0;
+			timeout = std::min(timeout, due);
+		}
+		fds.resize(clients.size() + 1);
+		fds[0].fd = serverSocket;
+		fds[0].events = POLLIN;
+		fds[0].revents = 0;
+		for (int i = 0; i < (int) clients.size(); i++) {
+			fds[i + 1].fd = clients[i].socket;
+			fds[i + 1].events = POLLIN;
+			fds[i + 1].revents = 0;
+			if (clients[i].packet != NULL) {
+				fds[i + 1].events |= POLLOUT;
+			} else if (clients[i].gets > 0) {
+				// waits for a frame to be published
+				timeout = std::min(timeout, CIS_FRAME_POLL);
+			}
+		}
+		int ready = poll(&fds[0], fds.size(), timeout);
+		if (ready < 0 && errno != EINTR) {
+			fprintf(stdout, "CImageServer: Poll failed: %s.\n", strerror(errno));
+			break;
+		}
+
+		// the clients are handled in the order of fds, new clients are added after them
+		std::vector<bool> alive(clients.size(), true);
+		for (int i = 0; i < (int) clients.size() && ready > 0; i++) {
+			if (fds[i + 1].revents & (POLLIN | POLLERR | POLLHUP)) {
+				alive[i] = readRequests(clients[i]);
+			}
+		}
+		now = streamTime();
+		for (int i = 0; i < (int) streams.size(); i++) {
+			if (streams[i]->next <= now)
+				tickStream(streams[i], now);
+		}
+		for (int i = 0; i < (int) clients.size(); i++) {
+			if (!alive[i])
+				continue;
+			if (clients[i].packet == NULL && clients[i].gets > 0)
+				answerRequest(clients[i]);
+			if (clients[i].packet != NULL)
+				alive[i] = writePacket(clients[i]);
+		}
+		for (int i = clients.size() - 1; i >= 0; i--) {
+			if (!alive[i]) {
+				closeClient(clients[i]);
+				clients.erase(clients.begin() + i);
+			}
+		}
+		if (ready > 0 && (fds[0].revents & POLLIN))
+			acceptClient();
+	}
+	for (int i = 0; i < (int) clients.size(); i++) {
+		closeClient(clients[i]);
+	}
+	clients.clear();
+	for (int i = 0; i < 2; i++) {
+		releasePacket(raw[i]);
+		raw[i] = NULL;
+	}
+	close(serverSocket);
+	serverSocket = -1;
 }
 
-void* serverLoop(void* serv) {
-	SClientInfoIMG info;
-	CImageServer* server = (CImageServer*) serv;
-	sem_wait(&server->connectSem);
-	info.socket = server->mySocket;
-	info.sem = server->dataSem;
-	sem_post(&server->connectSem);
-	int dataOk = 0;
-	bool connected = true;
-	while (connected && !server->stop) {
-		dataOk = 0;
+void CImageServer::acceptClient() {
+	struct sockaddr_in clientAddr;
+	socklen_t addrLen = sizeof(clientAddr);
+	int newServer = accept(serverSocket, (struct sockaddr *) &clientAddr, &addrLen);
+	if (newServer < 0) {
 		if (CISdebug)
-			fprintf(stdout, "CImageServer: Waiting to receive a message.\n", info.socket);
-		int msg = server->checkForMessage(info.socket);
+			fprintf(stdout, "CImageServer: Accept on listening socked failed.\n");
+		return;
+	}
+	if (clients.size() >= NUM_CONNECTIONS) {
+		fprintf(stdout, "CImageServer: Refused connection from %s, %i clients already.\n",
+				inet_ntoa(clientAddr.sin_addr), NUM_CONNECTIONS);
+		close(newServer);
+		return;
+	}
+	if (CISdebug)
+		fprintf(stdout, "CImageServer: Incoming connection from %s.\n", inet_ntoa(clientAddr.sin_addr));
+	fcntl(newServer, F_SETFL, fcntl(newServer, F_GETFL) | O_NONBLOCK);
+	SClientInfoIMG client;
+	memset(&client, 0, sizeof(client));
+	client.socket = newServer;
+	clients.push_back(client);
+}
+
+/**
+ * Every byte is a request, except the ImageStreamRequest after a CM_STREAM. Returns false when the client is gone.
+ */
+bool CImageServer::readRequests(SClientInfoIMG &client) {
+	uint8_t buffer[64];
+	int length = recv(client.socket, buffer, sizeof(buffer), MSG_DONTWAIT);
+	if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		return true;
+	if (length <= 0) {
 		if (CISdebug)
-			fprintf(stdout, "CImageServer: Message received from %i.\n", info.socket);
-		sem_wait(info.sem);
-		server->sendImage(info.socket);
-		sem_post(info.sem);
-		//usleep(100000);
-		if (msg == 1) {
-			connected = false;
+			fprintf(stdout, "Disconnect detected.\n");
+		return false;
+	}
+	for (int i = 0; i < length; i++) {
+		if (client.received > 0) {
+			client.request[client.received++] = buffer[i];
+			if (client.received == (int) sizeof(client.request)) {
+				client.received = 0;
+				joinStream(client);
+			}
+			continue;
+		}
+		switch (buffer[i]) {
+		case CM_QUIT:
 			fprintf(stdout, "Disconnecting.\n");
+			return false;
+		case CM_STREAM:
+			client.request[client.received++] = buffer[i];
+			break;
+		case CM_STOP:
+			leaveStream(client);
+			break;
+		default:
+			// a single frame ends a stream, like any other request
+			leaveStream(client);
+			client.gets++;
+			client.framed = (buffer[i] == CM_FRAME);
+			break;
 		}
 	}
-	server->closeConnection(info.socket);
-	return NULL;
+	return true;
 }
 
-int CImageServer::checkForMessage(int socket) {
-	int message = 0;
-	int receiveResult = recv(socket, &message, 1, MSG_WAITALL);
-	if (receiveResult > 0) {
-		if (CISdebug)
-			fprintf(stdout, "Packet accepted length %i.\n", receiveResult);
+bool CImageServer::writePacket(SClientInfoIMG &client) {
+	SImagePacket *packet = client.packet;
+	int length;
+	if (client.sent < packet->headerLength) {
+		length = send(client.socket, packet->header + client.sent, packet->headerLength - client.sent,
+				MSG_DONTWAIT | MSG_NOSIGNAL);
 	} else {
+		length = send(client.socket, packet->data + client.sent - packet->headerLength,
+				packet->headerLength + packet->length - client.sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+	}
+	if (length < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			return true;
 		if (CISdebug)
-			fprintf(stdout, "Disconnect detected.\n");
-		message = 1;
+			fprintf(stdout, "CImageServer: Network error.\n");
+		return false;
 	}
-	return message;
-}
-
-int CImageServer::sendImage(int socket) {
-	if (send(socket, image->data, image->getsize(), MSG_NOSIGNAL) == image->getsize()) {
+	client.sent += length;
+	if (client.sent == packet->headerLength + packet->length) {
 		if (CISdebug)
 			fprintf(stdout, "CImageServer: Image send.\n");
-		return 0;
+		releasePacket(packet);
+		client.packet = NULL;
+		client.sent = 0;
+	}
+	return true;
+}
+
+/**
+ * The latest frame, the same packet for every client that asks before the next frame is published.
+ */
+void CImageServer::answerRequest(SClientInfoIMG &client) {
+	uint32_t id;
+	uint64_t timestamp;
+	SImagePacket *&cached = raw[client.framed ? 1 : 0];
+	if (cached == NULL || cached->source != frames->latest()) {
+		CRawImage *frame = frames->acquire(0, 0, &id, &timestamp);
+		if (frame == NULL)
+			return;
+		releasePacket(cached);
+		cached = new SImagePacket;
+		cached->data = frame->data;
+		cached->length = frame->getsize();
+		cached->capacity = 0;
+		cached->frame = frame;
+		cached->source = id;
+		cached->references = 1;
+		cached->headerLength = 0;
+		if (client.framed) {
+			ImageFrameHeader header;
+			memset(&header, 0, sizeof(header));
+			header.magic = IMAGE_STREAM_MAGIC;
+			// a CM_FRAME does not say which version the client knows, the frame carries nothing of a later one
+			header.version = 1;
+			header.encoding = IMAGE_ENCODING_RAW;
+			header.flags = IMAGE_FRAME_KEY;
+			header.bpp = frame->getbpp();
+			header.frame_id = id;
+			header.timestamp = timestamp;
+			header.width = frame->getwidth();
+			header.height = frame->getheight();
+			header.length = frame->getsize();
+			header.decimation = 1;
+			packImageFrameHeader(header, cached->header);
+			cached->headerLength = IMAGE_FRAME_HEADER_LENGTH;
+		}
+	}
+	cached->references++;
+	client.packet = cached;
+	client.sent = 0;
+	client.frame = cached->source;
+	client.gets--;
+}
+
+void CImageServer::joinStream(SClientInfoIMG &client) {
+	leaveStream(client);
+	ImageStreamRequest request;
+	unpackImageStreamRequest(&client.request[1], request);
+	SImageStream *stream = NULL;
+	for (int i = 0; i < (int) streams.size(); i++) {
+		ImageStreamRequest &other = streams[i]->request;
+		if (other.version == request.version && other.fps == request.fps && other.encoding == request.encoding
+				&& other.decimation == request.decimation && other.bpp == request.bpp) {
+			stream = streams[i];
+		}
+	}
+	if (stream == NULL) {
+		stream = new SImageStream;
+		memset(stream, 0, sizeof(SImageStream));
+		stream->request = request;
+		ImageFrameHeader &header = stream->header;
+		header.magic = IMAGE_STREAM_MAGIC;
+		header.version = request.version;
+		header.encoding = request.encoding;
+		header.bpp = request.bpp;
+		header.width = frames->getwidth() / request.decimation;
+		header.height = frames->getheight() / request.decimation;
+		header.fps = request.fps;
+		header.decimation = request.decimation;
+		stream->frameSize = header.width * header.height * header.bpp;
+		stream->packetSize = IMAGE_FRAME_HEADER_LENGTH + imageStreamMaxPayload(stream->frameSize);
+		if (request.version >= IMAGE_STREAM_OVERLAY_VERSION)
+			stream->packetSize += IMAGE_OVERLAY_MAX_LENGTH;
+		stream->frame = CImagePool::pool().acquire(stream->frameSize, false);
+		stream->previous = CImagePool::pool().acquire(stream->frameSize, false);
+		stream->next = streamTime();
+		streams.push_back(stream);
+		fprintf(stdout, "CImageServer: Streaming %ix%ix%i frames at %i fps, encoding %i.\n", header.width,
+				header.height, header.bpp, header.fps, header.encoding);
+	}
+	stream->members++;
+	client.stream = stream;
+	client.synced = false;
+}
+
+void CImageServer::leaveStream(SClientInfoIMG &client) {
+	SImageStream *stream = client.stream;
+	client.stream = NULL;
+	if (stream == NULL || --stream->members > 0)
+		return;
+	streams.erase(std::find(streams.begin(), streams.end(), stream));
+	CImagePool::pool().release(stream->frame, stream->frameSize);
+	CImagePool::pool().release(stream->previous, stream->frameSize);
+	delete stream;
+}
+
+/**
+ * Encode the newest frame once as a delta for the members that are in sync, and once as a key frame for the members
+ * that joined or skipped a frame, but only if one of them is ready to send it.
+ */
+void CImageServer::tickStream(SImageStream *stream, uint64_t now) {
+	uint64_t interval = 1000000 / stream->request.fps;
+	stream->next += interval;
+	// a slow link lowers the rate, it does not make the server send a burst of old frames afterwards
+	if (stream->next + interval < now)
+		stream->next = now + interval;
+
+	uint64_t timestamp;
+	CRawImage *snapshot = frames->acquire(stream->source, 0, &stream->source, &timestamp);
+	SImagePacket *delta = NULL;
+	SImagePacket *key = NULL;
+	unsigned char *current = stream->previous;
+	if (snapshot != NULL) {
+		decimateImage(snapshot->data, snapshot->getwidth(), snapshot->getheight(), snapshot->getbpp(),
+				stream->request.decimation, stream->request.bpp, stream->frame);
+		frames->release(snapshot);
+		stream->header.timestamp = timestamp;
+		stream->header.frame_id++;
+		stream->overlaid = (stream->request.version >= IMAGE_STREAM_OVERLAY_VERSION
+				&& frames->getOverlay(stream->source, stream->overlay));
+		if (stream->valid)
+			delta = encodeFrame(stream, stream->frame, stream->previous, false);
+		current = stream->frame;
+	} else if (!stream->valid) {
+		return;
+	}
+	for (int i = 0; i < (int) clients.size(); i++) {
+		SClientInfoIMG &client = clients[i];
+		if (client.stream != stream)
+			continue;
+		if (client.packet != NULL) {
+			// busy with an older frame, the delta of this one does not apply to what it has
+			if (delta != NULL)
+				client.synced = false;
+			continue;
+		}
+		SImagePacket *packet = NULL;
+		if (client.synced) {
+			packet = delta;
+		} else {
+			if (key == NULL)
+				key = encodeFrame(stream, current, NULL, true);
+			packet = key;
+			client.synced = true;
+		}
+		if (packet == NULL)
+			continue;
+		packet->references++;
+		client.packet = packet;
+		client.sent = 0;
+	}
+	releasePacket(delta);
+	releasePacket(key);
+	if (snapshot != NULL) {
+		std::swap(stream->frame, stream->previous);
+		stream->valid = true;
+	}
+}
+
+SImagePacket* CImageServer::encodeFrame(SImageStream *stream, unsigned char *frame, unsigned char *previous,
+		bool key) {
+	SImagePacket *packet = new SImagePacket;
+	packet->capacity = stream->packetSize;
+	packet->data = CImagePool::pool().acquire(packet->capacity, false);
+	packet->frame = NULL;
+	packet->source = stream->source;
+	packet->references = 1;
+	packet->headerLength = 0;
+	ImageFrameHeader header = stream->header;
+	if (header.encoding == IMAGE_ENCODING_DELTA_RLE) {
+		header.length = encodeDeltaRLE(frame, previous, stream->frameSize, packet->data + IMAGE_FRAME_HEADER_LENGTH);
 	} else {
-		if (CISdebug)
-			fprintf(stdout, "CImageServer: Network error.\n");
-		return -1;
+		memcpy(packet->data + IMAGE_FRAME_HEADER_LENGTH, frame, stream->frameSize);
+		header.length = stream->frameSize;
 	}
-	return 0;
+	header.flags = key ? IMAGE_FRAME_KEY : 0;
+	header.overlay = 0;
+	if (stream->overlaid) {
+		header.flags |= IMAGE_FRAME_OVERLAY;
+		header.overlay = packImageOverlay(stream->overlay, packet->data + IMAGE_FRAME_HEADER_LENGTH + header.length);
+	}
+	packImageFrameHeader(header, packet->data);
+	packet->length = IMAGE_FRAME_HEADER_LENGTH + header.length + header.overlay;
+	return packet;
 }
 
-int CImageServer::closeConnection(int socket) {
-	close(socket);
-	connected = false;
-	return 0;
+void CImageServer::releasePacket(SImagePacket *packet) {
+	if (packet == NULL || --packet->references > 0)
+		return;
+	if (packet->frame != NULL)
+		frames->release(packet->frame);
+	if (packet->capacity > 0)
+		CImagePool::pool().release(packet->data, packet->capacity);
+	delete packet;
 }
 
+void CImageServer::closeClient(SClientInfoIMG &client) {
+	leaveStream(client);
+	releasePacket(client.packet);
+	client.packet = NULL;
+	close(client.socket);
+}
@@ -21,46 +21,109 @@
 #include <pthread.h>
 
 #include <CRawImage.h>
+#include <CFramePublisher.h>
+#include <imageStream.h>
 
+#include <vector>
+
+//! Clients beyond this are refused
 #define NUM_CONNECTIONS 100
+
+//! The longest a server thread sleeps, so a stopServer() is noticed
+#define CIS_POLL_TIMEOUT 100
+
+//! How often a client that waits for a new frame to be published is looked after, in ms
+#define CIS_FRAME_POLL 10
+
+//! An encoded frame, or a published frame, shared by all clients that send it
+typedef struct {
+	unsigned char *data;
+	int length;
+	int capacity; // bytes acquired from the image pool, 0 if data belongs to frame
+	CRawImage *frame; // a published frame, released with the last reference
+	uint32_t source; // id of the published frame
+	int references;
+	uint8_t header[IMAGE_FRAME_HEADER_LENGTH]; // sent before data, for CM_FRAME
+	int headerLength;
+} SImagePacket;
+
+//! Clients that stream with the same settings share one encoder, so they also share the deltas
+typedef struct {
+	ImageStreamRequest request;
+	ImageFrameHeader header;
+	unsigned char *frame;
+	unsigned char *previous; // the frame a synced client has decoded
+	int frameSize;
+	int packetSize;
+	bool valid; // previous holds a frame
+	uint32_t source;
+	uint64_t next;
+	int members;
+	ImageOverlay overlay; // of source or the frame before it, for streams of IMAGE_STREAM_OVERLAY_VERSION
+	bool overlaid; // overlay goes along with the frames
+} SImageStream;
+
 typedef struct {
 	int socket;
-	sem_t* sem;
+	uint32_t frame; // the last published frame sent to this client
+	SImageStream *stream; // NULL for request/response
+	bool synced; // got a key frame of its stream and every delta after it
+	int gets; // CM_GET and CM_FRAME requests that are not answered yet
+	bool framed; // the last of them was a CM_FRAME
+	uint8_t request[1 + IMAGE_STREAM_REQUEST_LENGTH];
+	int received; // bytes of a CM_STREAM request read so far
+	SImagePacket *packet; // on its way to the client
+	int sent;
 } SClientInfoIMG;
 
-/*typedef enum
- {
- CM_GET = 0,
- CM_QUIT
- }
- ECameraMessage;*/
-
 void* serverLoop(void* serv);
 
+/**
+ * One thread accepts the clients, reads their requests, and feeds all of them with non-blocking sends from a single
+ * poll(). A client that sends CM_GET gets the latest published frame, raw, and the frame is not copied for it. CM_FRAME
+ * does the same, with an ImageFrameHeader in front. A client that sends CM_STREAM joins the stream with its settings,
+ * every stream encodes a frame once per tick for all its members. A member that is still busy with the previous frame
+ * skips the tick, and gets a key frame when it is ready again, so a slow client neither holds up the others nor loses
+ * track of the deltas. A stream of a client of IMAGE_STREAM_OVERLAY_VERSION or later also sends the overlay that the
+ * detection published for the frame, or for the one before it.
+ */
 class CImageServer {
 public:
 
-	CImageServer(sem_t *imsem, CRawImage* image);
+	CImageServer(CFramePublisher *frames);
 	~CImageServer();
 	int initServer(const char* port);
-
-	int checkForMessage(int socket);
-	int sendImage(int socket);
-	int closeConnection(int socket);
 	void stopServer();
 
-	int connected;
 	int serverSocket;
-	int mySocket;
-	sem_t *dataSem;
-	sem_t connectSem;
-	int messageRead;
-	CRawImage *image;
+	//! The detection loop publishes its frames here
+	CFramePublisher *frames;
 	bool stop;
 
+	//! The body of the server thread
+	void serve();
+
 private:
-	pthread_t* connectLoopThread;
+	void acceptClient();
+	bool readRequests(SClientInfoIMG &client);
+	bool writePacket(SClientInfoIMG &client);
+	void answerRequest(SClientInfoIMG &client);
+	void joinStream(SClientInfoIMG &client);
+	void leaveStream(SClientInfoIMG &client);
+	void tickStream(SImageStream *stream, uint64_t now);
+	void closeClient(SClientInfoIMG &client);
+
+	SImagePacket* encodeFrame(SImageStream *stream, unsigned char *frame, unsigned char *previous, bool key);
+	void releasePacket(SImagePacket *packet);
+
+	std::vector<SClientInfoIMG> clients;
+	std::vector<SImageStream*> streams;
+
+	//! The last raw frame, without and with a header, shared by clients that ask for the same frame
+	SImagePacket *raw[2];
 
+	pthread_t thread;
+	bool running;
 };
 
 #endif
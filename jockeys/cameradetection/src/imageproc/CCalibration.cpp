@@ -0,0 +1,580 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Fit the camera to all detections of a grid of patterns in a recorded calibration sequence
+ * @file CCalibration.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Calibration
+ */
+
+#include "CCalibration.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+
+CCalibration::CCalibration(int width, int height, int cols, int rows, float spacing): width(width), height(height),
+		cols(cols), rows(rows), spacing(spacing) {
+	memset(&camera, 0, sizeof(camera));
+}
+
+//! Solve a x = b for the m columns of b, with partial pivoting, a and b are overwritten
+static bool solveLinear(double *a, double *b, int n, int m) {
+	for (int i = 0; i < n; i++) {
+		int pivot = i;
+		for (int j = i + 1; j < n; j++)
+			if (fabs(a[j * n + i]) > fabs(a[pivot * n + i])) pivot = j;
+		if (fabs(a[pivot * n + i]) < 1e-300) return false;
+		if (pivot != i) {
+			for (int k = 0; k < n; k++) std::swap(a[i * n + k], a[pivot * n + k]);
+			for (int k = 0; k < m; k++) std::swap(b[i * m + k], b[pivot * m + k]);
+		}
+		for (int j = i + 1; j < n; j++) {
+			double factor = a[j * n + i] / a[i * n + i];
+			if (factor == 0) continue;
+			for (int k = i; k < n; k++) a[j * n + k] -= factor * a[i * n + k];
+			for (int k = 0; k < m; k++) b[j * m + k] -= factor * b[i * m + k];
+		}
+	}
+	for (int i = n - 1; i >= 0; i--) {
+		for (int k = 0; k < m; k++) {
+			double sum = b[i * m + k];
+			for (int j = i + 1; j < n; j++) sum -= a[i * n + j] * b[j * m + k];
+			b[i * m + k] = sum / a[i * n + i];
+		}
+	}
+	return true;
+}
+
+static void multiply3(const double *a, const double *b, double *result) {
+	for (int i = 0; i < 3; i++)
+		for (int j = 0; j < 3; j++)
+			result[i * 3 + j] = a[i * 3] * b[j] + a[i * 3 + 1] * b[3 + j] + a[i * 3 + 2] * b[6 + j];
+}
+
+//! The similarity that moves the points, given as pairs, around their centroid at a mean distance of sqrt(2)
+static bool normalization(const double *p, int n, double *T) {
+	double mx = 0, my = 0, distance = 0;
+	for (int i = 0; i < n; i++) {
+		mx += p[2 * i];
+		my += p[2 * i + 1];
+	}
+	mx /= n;
+	my /= n;
+	for (int i = 0; i < n; i++) distance += hypot(p[2 * i] - mx, p[2 * i + 1] - my);
+	if (distance <= 0) return false;
+	double s = M_SQRT2 * n / distance;
+	double result[9] = { s, 0, -s * mx, 0, s, -s * my, 0, 0, 1 };
+	memcpy(T, result, sizeof(result));
+	return true;
+}
+
+/**
+ * The homography H that maps the n points from onto the points to, both given as pairs, by least squares on the
+ * normalized points of Hartley with H[8] = 1.
+ */
+static bool fitHomography(const double *from, const double *to, int n, double *H) {
+	double Tf[9], Tt[9];
+	if (n < 4 || !normalization(from, n, Tf) || !normalization(to, n, Tt)) return false;
+	double m[8 * 8], h[8];
+	memset(m, 0, sizeof(m));
+	memset(h, 0, sizeof(h));
+	for (int i = 0; i < n; i++) {
+		double x = Tf[0] * from[2 * i] + Tf[2], y = Tf[4] * from[2 * i + 1] + Tf[5];
+		double u = Tt[0] * to[2 * i] + Tt[2], v = Tt[4] * to[2 * i + 1] + Tt[5];
+		double rows[2][8] = { { x, y, 1, 0, 0, 0, -u * x, -u * y }, { 0, 0, 0, x, y, 1, -v * x, -v * y } };
+		double rhs[2] = { u, v };
+		for (int r = 0; r < 2; r++) {
+			for (int j = 0; j < 8; j++) {
+				for (int k = 0; k < 8; k++) m[j * 8 + k] += rows[r][j] * rows[r][k];
+				h[j] += rows[r][j] * rhs[r];
+			}
+		}
+	}
+	if (!solveLinear(m, h, 8, 1)) return false;
+	double Hn[9] = { h[0], h[1], h[2], h[3], h[4], h[5], h[6], h[7], 1 };
+	// the inverse of the similarity Tt
+	double Ti[9] = { 1 / Tt[0], 0, -Tt[2] / Tt[0], 0, 1 / Tt[4], -Tt[5] / Tt[4], 0, 0, 1 };
+	double product[9];
+	multiply3(Hn, Tf, product);
+	multiply3(Ti, product, H);
+	if (H[8] == 0) return false;
+	for (int i = 0; i < 9; i++) H[i] /= H[8];
+	return true;
+}
+
+void CCalibration::rotation(const double *omega, double *R) {
+	double theta = sqrt(omega[0] * omega[0] + omega[1] * omega[1] + omega[2] * omega[2]);
+	if (theta < 1e-12) {
+		double result[9] = { 1, -omega[2], omega[1], omega[2], 1, -omega[0], -omega[1], omega[0], 1 };
+		memcpy(R, result, sizeof(result));
+		return;
+	}
+	double k[3] = { omega[0] / theta, omega[1] / theta, omega[2] / theta };
+	double c = cos(theta), s = sin(theta), v = 1 - c;
+	R[0] = c + v * k[0] * k[0];
+	R[1] = v * k[0] * k[1] - s * k[2];
+	R[2] = v * k[0] * k[2] + s * k[1];
+	R[3] = v * k[1] * k[0] + s * k[2];
+	R[4] = c + v * k[1] * k[1];
+	R[5] = v * k[1] * k[2] - s * k[0];
+	R[6] = v * k[2] * k[0] - s * k[1];
+	R[7] = v * k[2] * k[1] + s * k[0];
+	R[8] = c + v * k[2] * k[2];
+}
+
+//! The Rodrigues vector of rotation matrix R, also for the angles near pi where the skew part vanishes
+static void rotationVector(const double *R, double *omega) {
+	double c = std::max(-1.0, std::min(1.0, (R[0] + R[4] + R[8] - 1) / 2));
+	double theta = acos(c), s = sin(theta);
+	double skew[3] = { R[7] - R[5], R[2] - R[6], R[3] - R[1] };
+	if (s > 1e-6) {
+		for (int i = 0; i < 3; i++) omega[i] = theta / (2 * s) * skew[i];
+	} else if (c > 0) {
+		for (int i = 0; i < 3; i++) omega[i] = skew[i] / 2;
+	} else {
+		// the axis is the column of R+I with the largest diagonal element, its sign does not matter at pi
+		int i = (R[0] >= R[4] && R[0] >= R[8]) ? 0 : (R[4] >= R[8] ? 1 : 2);
+		double k[3];
+		k[i] = sqrt(std::max(0.0, (R[i * 4] + 1) / 2));
+		for (int j = 0; j < 3; j++)
+			if (j != i) k[j] = (R[j * 3 + i] + R[i * 3 + j]) / (4 * k[i]);
+		for (int j = 0; j < 3; j++) omega[j] = theta * k[j];
+	}
+}
+
+//! Cross product of b - a and c - a
+static inline double turn(const double *a, const double *b, const double *c) {
+	return (b[0] - a[0]) * (c[1] - a[1]) - (b[1] - a[1]) * (c[0] - a[0]);
+}
+
+bool CCalibration::addGrid(int frame, const float *u, const float *v, int count) {
+	if (count != cols * rows || cols < 2 || rows < 2) return false;
+	// the convex hull with the monotone chain, with a positive turn from one vertex to the next
+	std::vector<std::pair<double, double> > sorted(count);
+	for (int i = 0; i < count; i++) sorted[i] = std::make_pair((double) u[i], (double) v[i]);
+	std::sort(sorted.begin(), sorted.end());
+	std::vector<double> hull(4 * count + 2);
+	int k = 0;
+	for (int pass = 0; pass < 2; pass++) {
+		int start = k;
+		for (int j = 0; j < count; j++) {
+			int i = pass == 0 ? j : count - 1 - j;
+			double p[2] = { sorted[i].first, sorted[i].second };
+			while (k >= start + 2 && turn(&hull[2 * (k - 2)], &hull[2 * (k - 1)], p) <= 0) k--;
+			hull[2 * k] = p[0];
+			hull[2 * k + 1] = p[1];
+			k++;
+		}
+		// the last point of a chain is the first of the other one
+		k--;
+	}
+	int n = k;
+	if (n < 4) return false;
+
+	// the corners of the grid are the four vertices of the hull with the sharpest angles
+	std::vector<std::pair<double, int> > angles(n);
+	for (int i = 0; i < n; i++) {
+		const double *a = &hull[2 * ((i + n - 1) % n)], *b = &hull[2 * i], *c = &hull[2 * ((i + 1) % n)];
+		double ax = a[0] - b[0], ay = a[1] - b[1], cx = c[0] - b[0], cy = c[1] - b[1];
+		angles[i] = std::make_pair(acos((ax * cx + ay * cy) / (hypot(ax, ay) * hypot(cx, cy))), i);
+	}
+	std::sort(angles.begin(), angles.end());
+	int corner[4];
+	for (int i = 0; i < 4; i++) corner[i] = angles[i].second;
+	std::sort(corner, corner + 4);
+
+	// every corner can be the first one of the grid, the one with the detections closest to the cells is taken
+	double right = cols - 1, bottom = rows - 1, grid[8] = { 0, 0, right, 0, right, bottom, 0, bottom };
+	std::vector<int> cells(count), best;
+	double bestError = CALIBRATION_GRID_TOLERANCE * CALIBRATION_GRID_TOLERANCE * count;
+	for (int first = 0; first < 4; first++) {
+		double image[8], H[9];
+		for (int i = 0; i < 4; i++) {
+			image[2 * i] = hull[2 * corner[(first + i) % 4]];
+			image[2 * i + 1] = hull[2 * corner[(first + i) % 4] + 1];
+		}
+		if (!fitHomography(image, grid, 4, H)) continue;
+		std::vector<bool> taken(count, false);
+		double error = 0;
+		bool valid = true;
+		for (int i = 0; i < count && valid; i++) {
+			double w = H[6] * u[i] + H[7] * v[i] + H[8];
+			double x = (H[0] * u[i] + H[1] * v[i] + H[2]) / w, y = (H[3] * u[i] + H[4] * v[i] + H[5]) / w;
+			int col = (int) floor(x + 0.5), row = (int) floor(y + 0.5);
+			double distance = (x - col) * (x - col) + (y - row) * (y - row);
+			valid = (col >= 0 && col < cols && row >= 0 && row < rows && !taken[row * cols + col]
+					&& distance <= CALIBRATION_GRID_TOLERANCE * CALIBRATION_GRID_TOLERANCE);
+			if (!valid) break;
+			taken[row * cols + col] = true;
+			cells[i] = row * cols + col;
+			error += distance;
+		}
+		if (valid && error < bestError) {
+			bestError = error;
+			best = cells;
+		}
+	}
+	if (best.empty()) return false;
+	for (int i = 0; i < count; i++) {
+		SCalibrationPoint point;
+		point.frame = frame;
+		point.u = u[i];
+		point.v = v[i];
+		point.x = (best[i] % cols) * spacing;
+		point.y = (best[i] / cols) * spacing;
+		points.push_back(point);
+	}
+	return true;
+}
+
+void CCalibration::addPoint(const SCalibrationPoint & point) {
+	points.push_back(point);
+}
+
+const SGridPose *CCalibration::getPose(int frame) const {
+	for (unsigned int i = 0; i < poses.size(); i++)
+		if (poses[i].frame == frame) return &poses[i];
+	return NULL;
+}
+
+bool CCalibration::homography(const std::vector<int> & frame, double *H) {
+	int n = frame.size();
+	std::vector<double> from(2 * n), to(2 * n);
+	for (int i = 0; i < n; i++) {
+		const SCalibrationPoint & p = points[frame[i]];
+		from[2 * i] = p.x;
+		from[2 * i + 1] = p.y;
+		to[2 * i] = p.u;
+		to[2 * i + 1] = p.v;
+	}
+	return fitHomography(&from[0], &to[0], n, H);
+}
+
+/**
+ * With the intrinsics c, the columns of K^-1 H are the first two columns of the rotation and the translation, up to
+ * a scale. The scale is the one that puts the grid in front of the camera.
+ */
+bool CCalibration::initialPose(const double *H, const double *c, double *pose) {
+	double a[3][3];
+	for (int i = 0; i < 3; i++) {
+		a[i][0] = (H[i] - c[2] * H[6 + i]) / c[0];
+		a[i][1] = (H[3 + i] - c[3] * H[6 + i]) / c[1];
+		a[i][2] = H[6 + i];
+	}
+	double scale = 2 / (sqrt(a[0][0] * a[0][0] + a[0][1] * a[0][1] + a[0][2] * a[0][2])
+			+ sqrt(a[1][0] * a[1][0] + a[1][1] * a[1][1] + a[1][2] * a[1][2]));
+	if (scale * a[2][2] < 0) scale = -scale;
+	double r1[3], r2[3], r3[3], dot = 0, norm = 0;
+	for (int i = 0; i < 3; i++) norm += a[0][i] * a[0][i];
+	norm = sqrt(norm);
+	for (int i = 0; i < 3; i++) {
+		r1[i] = a[0][i] / norm;
+		dot += r1[i] * a[1][i];
+	}
+	norm = 0;
+	for (int i = 0; i < 3; i++) {
+		r2[i] = a[1][i] - dot * r1[i];
+		norm += r2[i] * r2[i];
+	}
+	norm = sqrt(norm);
+	for (int i = 0; i < 3; i++) r2[i] /= norm;
+	r3[0] = r1[1] * r2[2] - r1[2] * r2[1];
+	r3[1] = r1[2] * r2[0] - r1[0] * r2[2];
+	r3[2] = r1[0] * r2[1] - r1[1] * r2[0];
+	// a negative scale turns the first two columns around, the normal of the grid stays as it is
+	if (scale < 0) {
+		for (int i = 0; i < 3; i++) {
+			r1[i] = -r1[i];
+			r2[i] = -r2[i];
+		}
+	}
+	double R[9] = { r1[0], r2[0], r3[0], r1[1], r2[1], r3[1], r1[2], r2[2], r3[2] };
+	rotationVector(R, pose);
+	for (int i = 0; i < 3; i++) pose[3 + i] = scale * a[2][i];
+	for (int i = 0; i < 6; i++)
+		if (!(pose[i] == pose[i])) return false;
+	return pose[5] > 0;
+}
+
+bool CCalibration::residual(const double *c, const double *R, const double *t, const SCalibrationPoint & p,
+		double *e) {
+	double X = R[0] * p.x + R[1] * p.y + t[0];
+	double Y = R[3] * p.x + R[4] * p.y + t[1];
+	double Z = R[6] * p.x + R[7] * p.y + t[2];
+	if (Z <= 1e-9) return false;
+	double x = X / Z, y = Y / Z, r = x * x + y * y;
+	double radial = 1 + c[4] * r + c[5] * r * r;
+	double xd = radial * x + 2 * c[6] * x * y + c[7] * (r + 2 * x * x);
+	double yd = radial * y + c[6] * (r + 2 * y * y) + 2 * c[7] * x * y;
+	e[0] = c[0] * xd + c[2] - p.u;
+	e[1] = c[1] * yd + c[3] - p.v;
+	return true;
+}
+
+static inline double huber(double e) {
+	return (e <= CALIBRATION_HUBER) ? e * e / 2 : CALIBRATION_HUBER * (e - CALIBRATION_HUBER / 2);
+}
+
+double CCalibration::robustCost(const double *c, const std::vector<double> & pose) {
+	double cost = 0;
+	for (unsigned int f = 0; f < frames.size(); f++) {
+		double R[9], e[2];
+		rotation(&pose[6 * f], R);
+		for (unsigned int i = 0; i < frames[f].size(); i++) {
+			if (!residual(c, R, &pose[6 * f + 3], points[frames[f][i]], e)) return HUGE_VAL;
+			cost += huber(hypot(e[0], e[1]));
+		}
+	}
+	return cost;
+}
+
+/**
+ * The Jacobian is taken with central differences, for every pattern only the 8 intrinsics and the 6 parameters of the
+ * pose of its frame are not zero. The weights of the Huber loss make the normal equations those of the reweighted
+ * least squares at the current estimate.
+ */
+void CCalibration::buildSystem(const double *c, const std::vector<double> & pose) {
+	int count = frames.size();
+	memset(A, 0, sizeof(A));
+	memset(ga, 0, sizeof(ga));
+	B.assign(count * 8 * 6, 0);
+	C.assign(count * 6 * 6, 0);
+	gc.assign(count * 6, 0);
+	double hc[8];
+	for (int k = 0; k < 8; k++) hc[k] = 1e-6 * (fabs(c[k]) + 1);
+	for (int f = 0; f < count; f++) {
+		const double *omega = &pose[6 * f], *t = &pose[6 * f + 3];
+		double R[9], Rp[3][9], Rm[3][9], ht[3];
+		rotation(omega, R);
+		for (int k = 0; k < 3; k++) {
+			double o[3] = { omega[0], omega[1], omega[2] };
+			o[k] += 1e-6;
+			rotation(o, Rp[k]);
+			o[k] -= 2e-6;
+			rotation(o, Rm[k]);
+			ht[k] = 1e-6 * (fabs(t[k]) + 1);
+		}
+		double *Bf = &B[f * 48], *Cf = &C[f * 36], *gf = &gc[f * 6];
+		for (unsigned int i = 0; i < frames[f].size(); i++) {
+			const SCalibrationPoint & p = points[frames[f][i]];
+			double e[2], ep[2], em[2], Jc[2][8], Jp[2][6];
+			if (!residual(c, R, t, p, e)) continue;
+			bool valid = true;
+			for (int k = 0; k < 8 && valid; k++) {
+				double cp[8], cm[8];
+				memcpy(cp, c, sizeof(cp));
+				memcpy(cm, c, sizeof(cm));
+				cp[k] += hc[k];
+				cm[k] -= hc[k];
+				valid = residual(cp, R, t, p, ep) && residual(cm, R, t, p, em);
+				for (int r = 0; r < 2; r++) Jc[r][k] = (ep[r] - em[r]) / (2 * hc[k]);
+			}
+			for (int k = 0; k < 3 && valid; k++) {
+				valid = residual(c, Rp[k], t, p, ep) && residual(c, Rm[k], t, p, em);
+				for (int r = 0; r < 2; r++) Jp[r][k] = (ep[r] - em[r]) / 2e-6;
+			}
+			for (int k = 0; k < 3 && valid; k++) {
+				double tp[3] = { t[0], t[1], t[2] }, tm[3] = { t[0], t[1], t[2] };
+				tp[k] += ht[k];
+				tm[k] -= ht[k];
+				valid = residual(c, R, tp, p, ep) && residual(c, R, tm, p, em);
+				for (int r = 0; r < 2; r++) Jp[r][3 + k] = (ep[r] - em[r]) / (2 * ht[k]);
+			}
+			if (!valid) continue;
+			double norm = hypot(e[0], e[1]);
+			double w = (norm <= CALIBRATION_HUBER) ? 1 : CALIBRATION_HUBER / norm;
+			for (int r = 0; r < 2; r++) {
+				for (int j = 0; j < 8; j++) {
+					for (int k = 0; k < 8; k++) A[j * 8 + k] += w * Jc[r][j] * Jc[r][k];
+					for (int k = 0; k < 6; k++) Bf[j * 6 + k] += w * Jc[r][j] * Jp[r][k];
+					ga[j] -= w * Jc[r][j] * e[r];
+				}
+				for (int j = 0; j < 6; j++) {
+					for (int k = 0; k < 6; k++) Cf[j * 6 + k] += w * Jp[r][j] * Jp[r][k];
+					gf[j] -= w * Jp[r][j] * e[r];
+				}
+			}
+		}
+	}
+}
+
+/**
+ * The step of the damped normal equations [A B; B' C] [dc; dp] = [ga; gc], of which C is block diagonal with a 6x6
+ * block per frame. The poses are eliminated: (A - B C^-1 B') dc = ga - B C^-1 gc, and then dp = C^-1 (gc - B' dc).
+ */
+bool CCalibration::solveStep(double lambda, double *dc, std::vector<double> & dpose) {
+	int count = frames.size();
+	double S[8 * 8];
+	memcpy(S, A, sizeof(S));
+	memcpy(dc, ga, sizeof(ga));
+	for (int j = 0; j < 8; j++) S[j * 9] = S[j * 9] * (1 + lambda) + 1e-12;
+	// the columns of C^-1 [B' gc] of every frame
+	std::vector<double> X(count * 6 * 9);
+	for (int f = 0; f < count; f++) {
+		double Cd[6 * 6], *Xf = &X[f * 54];
+		const double *Bf = &B[f * 48];
+		memcpy(Cd, &C[f * 36], sizeof(Cd));
+		for (int j = 0; j < 6; j++) {
+			Cd[j * 7] = Cd[j * 7] * (1 + lambda) + 1e-12;
+			for (int k = 0; k < 8; k++) Xf[j * 9 + k] = Bf[k * 6 + j];
+			Xf[j * 9 + 8] = gc[f * 6 + j];
+		}
+		if (!solveLinear(Cd, Xf, 6, 9)) return false;
+		for (int j = 0; j < 8; j++) {
+			for (int i = 0; i < 6; i++) {
+				for (int k = 0; k < 8; k++) S[j * 8 + k] -= Bf[j * 6 + i] * Xf[i * 9 + k];
+				dc[j] -= Bf[j * 6 + i] * Xf[i * 9 + 8];
+			}
+		}
+	}
+	if (!solveLinear(S, dc, 8, 1)) return false;
+	dpose.resize(count * 6);
+	for (int f = 0; f < count; f++) {
+		const double *Xf = &X[f * 54];
+		for (int i = 0; i < 6; i++) {
+			double sum = Xf[i * 9 + 8];
+			for (int k = 0; k < 8; k++) sum -= Xf[i * 9 + k] * dc[k];
+			dpose[f * 6 + i] = sum;
+		}
+	}
+	return true;
+}
+
+/**
+ * The focal length in closed form assumes the principal point and no distortion: with K = diag(fx, fy, 1) after the
+ * principal point is moved to the origin, the columns h1 and h2 of K^-1 H are orthogonal and of the same length, which
+ * are two equations in 1/fx^2 and 1/fy^2 for every frame.
+ */
+float CCalibration::fit(const SCameraModel & guess) {
+	std::map<int, std::vector<int> > byFrame;
+	for (unsigned int i = 0; i < points.size(); i++) byFrame[points[i].frame].push_back(i);
+	std::vector<int> ids;
+	std::vector<double> Hs;
+	frames.clear();
+	for (std::map<int, std::vector<int> >::iterator i = byFrame.begin(); i != byFrame.end(); ++i) {
+		double H[9];
+		if (i->second.size() < 4 || !homography(i->second, H)) continue;
+		ids.push_back(i->first);
+		frames.push_back(i->second);
+		Hs.insert(Hs.end(), H, H + 9);
+	}
+	poses.clear();
+	if ((int) frames.size() < CALIBRATION_MIN_FRAMES) return -1;
+
+	double c[8] = { 0, 0, (width - 1) / 2.0, (height - 1) / 2.0, 0, 0, 0, 0 };
+	if (guess.fc[0] > 0) {
+		c[2] = guess.cc[0];
+		c[3] = guess.cc[1];
+	}
+	double m[4] = { 0, 0, 0, 0 }, b[2] = { 0, 0 };
+	for (unsigned int f = 0; f < frames.size(); f++) {
+		double h[9], norm = 0;
+		for (int i = 0; i < 3; i++) {
+			h[i] = Hs[9 * f + i] - c[2] * Hs[9 * f + 6 + i];
+			h[3 + i] = Hs[9 * f + 3 + i] - c[3] * Hs[9 * f + 6 + i];
+			h[6 + i] = Hs[9 * f + 6 + i];
+		}
+		for (int i = 0; i < 9; i++) norm += h[i] * h[i];
+		for (int i = 0; i < 9; i++) h[i] /= sqrt(norm);
+		double equation[2][3] = { { h[0] * h[1], h[3] * h[4], -h[6] * h[7] },
+				{ h[0] * h[0] - h[1] * h[1], h[3] * h[3] - h[4] * h[4], -(h[6] * h[6] - h[7] * h[7]) } };
+		for (int r = 0; r < 2; r++) {
+			for (int j = 0; j < 2; j++) {
+				for (int k = 0; k < 2; k++) m[j * 2 + k] += equation[r][j] * equation[r][k];
+				b[j] += equation[r][j] * equation[r][2];
+			}
+		}
+	}
+	if (solveLinear(m, b, 2, 1) && b[0] > 0 && b[1] > 0) {
+		c[0] = 1 / sqrt(b[0]);
+		c[1] = 1 / sqrt(b[1]);
+	} else if (guess.fc[0] > 0) {
+		// the frames are all about parallel to the image, the focal length is not observable from them
+		c[0] = guess.fc[0];
+		c[1] = guess.fc[1];
+	} else {
+		c[0] = c[1] = width;
+	}
+
+	std::vector<double> pose;
+	std::vector<std::vector<int> > fitted;
+	std::vector<int> fittedIds;
+	for (unsigned int f = 0; f < frames.size(); f++) {
+		double p[6];
+		if (!initialPose(&Hs[9 * f], c, p)) continue;
+		pose.insert(pose.end(), p, p + 6);
+		fitted.push_back(frames[f]);
+		fittedIds.push_back(ids[f]);
+	}
+	frames = fitted;
+	if ((int) frames.size() < CALIBRATION_MIN_FRAMES) return -1;
+
+	double cost = robustCost(c, pose), lambda = 1e-3;
+	for (int iteration = 0; iteration < CALIBRATION_ITERATIONS; iteration++) {
+		buildSystem(c, pose);
+		double previous = cost;
+		bool improved = false;
+		while (!improved && lambda < 1e10) {
+			double dc[8], trial[8];
+			std::vector<double> dpose, trialPose(pose);
+			if (solveStep(lambda, dc, dpose)) {
+				for (int k = 0; k < 8; k++) trial[k] = c[k] + dc[k];
+				for (unsigned int k = 0; k < pose.size(); k++) trialPose[k] += dpose[k];
+				double trialCost = robustCost(trial, trialPose);
+				if (trialCost < cost) {
+					memcpy(c, trial, sizeof(c));
+					pose.swap(trialPose);
+					cost = trialCost;
+					improved = true;
+					lambda = std::max(lambda / 10, 1e-12);
+					continue;
+				}
+			}
+			lambda *= 10;
+		}
+		if (!improved || previous - cost < 1e-10 * previous) break;
+	}
+
+	for (int i = 0; i < 2; i++) {
+		camera.fc[i] = c[i];
+		camera.cc[i] = c[2 + i];
+	}
+	for (int i = 0; i < 4; i++) camera.kc[i] = c[4 + i];
+	double total = 0;
+	int count = 0;
+	for (unsigned int f = 0; f < frames.size(); f++) {
+		SGridPose grid;
+		grid.frame = fittedIds[f];
+		memcpy(grid.omega, &pose[6 * f], sizeof(grid.omega));
+		memcpy(grid.t, &pose[6 * f + 3], sizeof(grid.t));
+		double R[9], e[2], sum = 0;
+		rotation(grid.omega, R);
+		for (unsigned int i = 0; i < frames[f].size(); i++) {
+			if (residual(c, R, grid.t, points[frames[f][i]], e)) sum += e[0] * e[0] + e[1] * e[1];
+		}
+		grid.error = sqrt(sum / frames[f].size());
+		total += sum;
+		count += frames[f].size();
+		poses.push_back(grid);
+	}
+	return sqrt(total / count);
+}
@@ -0,0 +1,139 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Fit the camera to all detections of a grid of patterns in a recorded calibration sequence
+ * @file CCalibration.h
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Calibration
+ */
+
+#ifndef CCALIBRATION_H_
+#define CCALIBRATION_H_
+
+#include <vector>
+
+//! Huber threshold in pixels of the reprojection error, larger errors weigh linearly instead of quadratically
+#define CALIBRATION_HUBER 1.0
+
+//! Iterations of Levenberg-Marquardt, a fit usually converges within 20
+#define CALIBRATION_ITERATIONS 100
+
+//! Frames with a grid that are needed for the principal point and the distortion
+#define CALIBRATION_MIN_FRAMES 3
+
+//! Largest distance of a pattern to its cell, in cells, for the detections of a frame to be taken as the grid
+#define CALIBRATION_GRID_TOLERANCE 0.3
+
+//! A pattern of the calibration grid, where it is detected in the image and where it lies on the grid
+struct SCalibrationPoint {
+	int frame;
+	//! Centre of the pattern in pixels of the distorted image
+	float u, v;
+	//! Position on the grid, in the unit of its spacing
+	float x, y;
+};
+
+//! The camera model of the Matlab toolbox without skew, as CTransformation uses it
+struct SCameraModel {
+	double fc[2];
+	double cc[2];
+	//! k1, k2, p1 and p2, which are kc[1] to kc[4] of CTransformation, the sixth order term kc[5] is not fitted
+	double kc[4];
+};
+
+//! The pose of the grid in a frame, in camera coordinates with z along the optical axis
+struct SGridPose {
+	int frame;
+	//! Rotation as a Rodrigues vector
+	double omega[3];
+	//! Origin of the grid, in the unit of its spacing
+	double t[3];
+	//! RMS reprojection error of the patterns of the frame in pixels
+	float error;
+};
+
+/**
+ * Instead of clicking a few patterns in one image, all frames of a sequence in which the grid is moved in front of the
+ * camera are used. The detections of a frame are put in order on the grid by addGrid(), after which fit() estimates
+ * the camera as the calibration toolbox does: a homography of every frame gives the focal length and the poses in
+ * closed form, and Levenberg-Marquardt then refines the intrinsics, the distortion and all poses together on the
+ * reprojection error. The error is weighed with a Huber loss, so a pattern that is detected at the wrong place pulls
+ * the fit linearly and not quadratically.
+ *
+ * The normal equations are solved with the Schur complement: the poses only couple through the 8 intrinsics, so a step
+ * costs a 6x6 solve per frame and one 8x8 solve, and hundreds of frames are fitted within a second.
+ */
+class CCalibration {
+public:
+	CCalibration(int width, int height, int cols, int rows, float spacing);
+
+	/**
+	 * Put the detections of a frame in order on the grid and add them. The corners of the grid are the corners of the
+	 * convex hull of the detections, a homography from them to the grid gives the cell of every pattern.
+	 *
+	 * @return                   false if the detections are not all cols x rows patterns of the grid
+	 */
+	bool addGrid(int frame, const float *u, const float *v, int count);
+
+	//! Add a pattern of which the position on the grid is known already
+	void addPoint(const SCalibrationPoint & point);
+
+	/**
+	 * Fit the camera and the poses of the grid. The principal point starts at the one of guess if its focal length is
+	 * positive, and else in the centre of the image.
+	 *
+	 * @return                   RMS reprojection error in pixels, or -1 if there are not enough frames
+	 */
+	float fit(const SCameraModel & guess);
+
+	inline const SCameraModel & getCamera() const { return camera; }
+	inline const std::vector<SGridPose> & getPoses() const { return poses; }
+	inline int getFrames() const { return (int) poses.size(); }
+	inline int getPoints() const { return (int) points.size(); }
+
+	//! The pose in frame, NULL if the frame is not fitted
+	const SGridPose *getPose(int frame) const;
+
+	//! The rotation matrix, row by row, of Rodrigues vector omega
+	static void rotation(const double *omega, double *R);
+private:
+	bool homography(const std::vector<int> & frame, double *H);
+	bool initialPose(const double *H, const double *c, double *pose);
+	bool residual(const double *c, const double *R, const double *t, const SCalibrationPoint & p, double *e);
+	double robustCost(const double *c, const std::vector<double> & pose);
+	void buildSystem(const double *c, const std::vector<double> & pose);
+	bool solveStep(double lambda, double *dc, std::vector<double> & dpose);
+
+	int width, height;
+	int cols, rows;
+	float spacing;
+	std::vector<SCalibrationPoint> points;
+
+	SCameraModel camera;
+	std::vector<SGridPose> poses;
+
+	//! Indices of the points of every fitted frame
+	std::vector<std::vector<int> > frames;
+	//! The normal equations [A B; B' C] of the intrinsics and the poses, with gradients ga and gc
+	double A[8 * 8], ga[8];
+	std::vector<double> B, C, gc;
+};
+
+#endif /* CCALIBRATION_H_ */
@@ -1,17 +1,22 @@
 #include "CCircleDetect.h"
+#include <CMemStats.h>
+#include <CTaskPool.h>
 
 #define min(a,b) ((a) < (b) ? (a) : (b))
 #define max(a,b) ((a) > (b) ? (a) : (b))
 
-int* CCircleDetect::buffer = NULL;
-int* CCircleDetect::queue = NULL;
+//the buffers of all detectors
+static int detectMemory() {
+	static int module = memModule("detect");
+	return module;
+}
 
 //Variable initialization
 CCircleDetect::CCircleDetect(int wi, int he, float diamRatio) {
 	lastTrackOK = false;
 	debug = false;
-	draw = false;
 	drawAll = false;
+	traceContours = false;
 	maxFailed = 0;
 	minSize = 10;
 	thresholdStep = 256;
@@ -22,6 +27,8 @@ CCircleDetect::CCircleDetect(int wi, int he, float diamRatio) {
 	ratioTolerance = 0.1;
 	threshold = maxThreshold / 2;
 	numFailed = maxFailed;
+	useProposals = true;
+	numProposals = proposal = 0;
 	track = true;
 	//circularityTolerance = 0.02;
 	//circularityTolerance = 0.1;
@@ -32,14 +39,36 @@ CCircleDetect::CCircleDetect(int wi, int he, float diamRatio) {
 	height = he;
 	len = width * height;
 	siz = len * 3;
-	ownBuffer = false;
-	if (buffer == NULL) {
-		ownBuffer = true;
-		buffer = (int*) malloc(len * sizeof(int));
-		queue = (int*) malloc(len * sizeof(int));
-		SSegment dummy;
-		bufferCleanup(dummy);
+	buffer = (int*) malloc(len * sizeof(int));
+	queue = (int*) malloc(len * sizeof(int));
+	maxSegments = MAX_SEGMENTS;
+	numSegments = 0;
+	segmentArray = (SSegment*) malloc(maxSegments * sizeof(SSegment));
+	SSegment dummy;
+	dummy.valid = false;
+	bufferCleanup(dummy);
+	backend = SEG_FLOOD_FILL;
+	firstRow = 0;
+	rowValue = (unsigned short*) malloc(width * sizeof(unsigned short));
+	rowMask = (unsigned char*) malloc(width);
+	memAllocated(detectMemory(), 2 * len * sizeof(int) + maxSegments * sizeof(SSegment)
+			+ width * (sizeof(unsigned short) + 1));
+	numStripes = 1;
+	for (int s = 0; s < MAX_STRIPES; s++) {
+		stripes[s].rowValue = NULL;
+		stripes[s].rowMask = NULL;
 	}
+	stripes[0].rowValue = rowValue;
+	stripes[0].rowMask = rowMask;
+	stripeImage = NULL;
+	plane = NULL;
+	planeThreshold = -1;
+	pyramidLevels = 0;
+	coarse = NULL;
+	for (int l = 0; l < MAX_PYRAMID_LEVELS; l++) pyramid[l] = NULL;
+	prediction = false;
+	for (int t = 0; t < MAX_TARGETS; t++) motion[t].valid = false;
+	setMotionHint(0, 0);
 	//diameterRatio = 5.0/14.0; //inner vs. outer circle diameter
 	diameterRatio = diamRatio;
 	float areaRatioInner_Outer = diameterRatio * diameterRatio;
@@ -51,16 +80,224 @@ CCircleDetect::CCircleDetect(int wi, int he, float diamRatio) {
 
 CCircleDetect::~CCircleDetect() {
 //	if (debug) printf("Timi %i %i %i %i\n",tima,timb,sizer,sizerAll);
-	if (ownBuffer) {
-		free(buffer);
-		free(queue);
-	}
+	setStripes(1);
+	free(buffer);
+	free(queue);
+	free(rowValue);
+	free(rowMask);
+	free(segmentArray);
+	memFreed(detectMemory(), 2 * len * sizeof(int) + maxSegments * sizeof(SSegment)
+			+ width * (sizeof(unsigned short) + 1));
+	setBitplane(false);
+	delete coarse;
+	for (int l = 0; l < MAX_PYRAMID_LEVELS; l++) delete pyramid[l];
 }
 
 void CCircleDetect::setDiameterRatio(float diameter) {
 	this->diameterRatio = diameter;
 }
 
+/**
+ * The flood fill grows segments from the scan position and, when tracking, stops at the first pattern, so it is fast if
+ * the pattern did not move. The run backend always segments the whole image (or its region of interest), but does so
+ * row by row without the label buffer, which is the faster choice when the pattern has to be searched for anyway.
+ */
+void CCircleDetect::setBackend(SegmentationBackend backend) {
+	if (backend == this->backend) return;
+	this->backend = backend;
+	// the flood fill expects an empty label buffer
+	lastTrackOK = false;
+	SSegment none;
+	none.valid = false;
+	bufferCleanup(none);
+}
+
+/**
+ * The stripes are segmented at the same time and only the runs of the rows at their borders are joined afterwards, so
+ * the time to segment a large region goes down with the number of cores. The stripes are tasks of the pool of the
+ * process, so the detector shares the cores with the other kernels instead of starting threads of its own. The flood
+ * fill backend does not use the stripes.
+ *
+ * @param count              number of stripes, at most MAX_STRIPES
+ */
+void CCircleDetect::setStripes(int count) {
+	count = min(max(count, 1), MAX_STRIPES);
+	if (count == numStripes) return;
+	for (int s = 1; s < numStripes; s++) {
+		free(stripes[s].rowValue);
+		free(stripes[s].rowMask);
+		stripes[s].rowValue = NULL;
+		stripes[s].rowMask = NULL;
+		std::vector<SRun>().swap(stripes[s].runs);
+	}
+	memFreed(detectMemory(), (numStripes - 1) * width * (sizeof(unsigned short) + 1));
+	for (int s = 1; s < count; s++) {
+		stripes[s].rowValue = (unsigned short*) malloc(width * sizeof(unsigned short));
+		stripes[s].rowMask = (unsigned char*) malloc(width);
+	}
+	memAllocated(detectMemory(), (count - 1) * width * (sizeof(unsigned short) + 1));
+	numStripes = count;
+}
+
+void CCircleDetect::buildStripes(void *arg, int begin, int end) {
+	CCircleDetect *detector = (CCircleDetect*) arg;
+	for (int s = begin; s < end; s++)
+		detector->buildStripe(detector->stripeImage, detector->stripeRegion, detector->stripes[s]);
+}
+
+/**
+ * Without the bitplane every pixel is thresholded when the flood fill or the scan reaches it. With the bitplane the
+ * whole search region is thresholded up front, in a tight loop over the rows, and the flood fill only reads one byte
+ * per pixel. It is rebuilt for every frame and whenever a pattern changes the threshold during the search. This pays
+ * off if most of the region is scanned anyway, e.g. when the pattern is lost or when there is no tracking, but not if
+ * the tracked pattern is found immediately around its previous position.
+ */
+void CCircleDetect::setBitplane(bool enable) {
+	if (enable == (plane != NULL)) return;
+	if (enable) {
+		plane = (unsigned char*) malloc(len);
+		memAllocated(detectMemory(), len);
+		memset(plane, PLANE_UNKNOWN, len);
+		planeRegion = ImageRoi();
+	} else {
+		free(plane);
+		memFreed(detectMemory(), len);
+		plane = NULL;
+	}
+}
+
+void CCircleDetect::buildPlane(CRawImage *image, const ImageRoi & roi) {
+	// the border of the image is never thresholded, see bufferCleanup
+	ImageRoi region = roi.intersect(ImageRoi(1, 1, width - 2, height - 2));
+	if (region.x != planeRegion.x || region.y != planeRegion.y || region.width != planeRegion.width
+			|| region.height != planeRegion.height) {
+		// the values outside of the new region would be of an old frame
+		for (int y = planeRegion.y; y < planeRegion.y + planeRegion.height; y++)
+			memset(plane + y * width + planeRegion.x, PLANE_UNKNOWN, planeRegion.width);
+		planeRegion = region;
+	}
+	for (int y = region.y; y < region.y + region.height; y++)
+		thresholdRow(image, y, region.x, region.x + region.width, rowValue, plane + y * width + region.x);
+	planeThreshold = threshold;
+}
+
+/**
+ * If a pattern is lost, the whole image has to be flooded at full resolution, for every threshold that is tried. With
+ * a pyramid the image is decimated by averaging 2x2 blocks, once or twice, and the candidates that are found in the
+ * small image are confirmed by scanning small windows around them at full resolution. Because the candidates are
+ * confirmed anyway, the detector of the small image is more tolerant. A pattern that is smaller than about 4 pixels in
+ * the decimated image is not found anymore.
+ */
+void CCircleDetect::setPyramid(int levels) {
+	levels = max(0, min(levels, MAX_PYRAMID_LEVELS));
+	if (levels == pyramidLevels) return;
+	pyramidLevels = levels;
+	delete coarse;
+	coarse = NULL;
+	for (int l = 0; l < MAX_PYRAMID_LEVELS; l++) {
+		delete pyramid[l];
+		pyramid[l] = NULL;
+	}
+	if (levels == 0) return;
+	int factor = 1 << levels;
+	coarse = new CCircleDetect(width / factor, height / factor, diameterRatio);
+	coarse->minSize = max(minSize / (factor * factor), 2);
+	coarse->circularTolerance = 2 * circularTolerance;
+	coarse->circularityTolerance = 2 * circularityTolerance;
+	coarse->ratioTolerance = 2 * ratioTolerance;
+	coarse->setMaxSegments(max(maxSegments / (factor * factor), MIN_COARSE_SEGMENTS));
+}
+
+/**
+ * Most of the memory of a detector that is not per pixel is its array of segments. A frame with more segments than
+ * fit, e.g. a noisy image at a bad threshold, is searched only partly, so fewer segments save memory at the cost of
+ * patterns being missed in such frames. The detector of the top of the pyramid keeps MIN_COARSE_SEGMENTS at least.
+ */
+void CCircleDetect::setMaxSegments(int count) {
+	count = max(count, 2);
+	if (count == maxSegments) return;
+	SSegment *segments = (SSegment*) realloc(segmentArray, count * sizeof(SSegment));
+	if (segments == NULL) return;
+	memFreed(detectMemory(), maxSegments * sizeof(SSegment));
+	memAllocated(detectMemory(), count * sizeof(SSegment));
+	segmentArray = segments;
+	maxSegments = count;
+	numSegments = min(numSegments, maxSegments);
+	if (coarse != NULL) coarse->setMaxSegments(max(count >> (2 * pyramidLevels), MIN_COARSE_SEGMENTS));
+}
+
+/**
+ * Without prediction a tracked pattern is searched for around its last position, in a window of twice its size. With
+ * prediction the velocity and the growth of every tracked pattern over the last frames, plus the motion hint, move and
+ * scale its last bounding box to where it is expected in this frame, and only a small margin around that is searched.
+ * When the robot turns or approaches the pattern its image moves steadily, so the window can stay tight without losing
+ * the pattern. If it is not in the window, the rest of the image is searched as before.
+ */
+void CCircleDetect::setPrediction(bool enable) {
+	prediction = enable;
+	for (int t = 0; t < MAX_TARGETS; t++) motion[t].valid = false;
+}
+
+/**
+ * The hint is added to the motion of all targets in the next call of findSegment or findSegments, and is not part of
+ * their velocity. It is in pixels, so the caller has to convert e.g. a rotation of the robot with the focal length.
+ *
+ * @param dx                 horizontal motion of the patterns in pixels
+ * @param dy                 vertical motion of the patterns in pixels
+ * @param scale              growth of their diameter, above 1 when approaching
+ */
+void CCircleDetect::setMotionHint(float dx, float dy, float scale) {
+	hintX = dx;
+	hintY = dy;
+	hintScale = scale;
+}
+
+SSegment CCircleDetect::predict(const SSegment & segment, int target) {
+	SSegment result = segment;
+	if (!prediction || !segment.valid) return result;
+	float dx = hintX, dy = hintY, scale = hintScale;
+	if (target >= 0 && target < MAX_TARGETS && motion[target].valid) {
+		dx += motion[target].vx;
+		dy += motion[target].vy;
+		scale *= motion[target].scale;
+	}
+	result.x = max(1, min(segment.x + dx, width - 2));
+	result.y = max(1, min(segment.y + dy, height - 2));
+	float cx = (segment.minx + segment.maxx) / 2.0f + dx;
+	float cy = (segment.miny + segment.maxy) / 2.0f + dy;
+	float halfWidth = (segment.maxx - segment.minx + 1) * scale / 2;
+	float halfHeight = (segment.maxy - segment.miny + 1) * scale / 2;
+	result.minx = max(1, (int)(cx - halfWidth));
+	result.maxx = min(width - 2, (int)(cx + halfWidth));
+	result.miny = max(1, (int)(cy - halfHeight));
+	result.maxy = min(height - 2, (int)(cy + halfHeight));
+	result.size = (int)(segment.size * scale * scale);
+	return result;
+}
+
+void CCircleDetect::updateMotion(const SSegment *init, const SSegment *result, int targets) {
+	for (int t = 0; t < targets; t++) {
+		if (!init[t].valid || !result[t].valid || init[t].size <= 0) {
+			motion[t].valid = false;
+			continue;
+		}
+		float vx = result[t].x - init[t].x - hintX;
+		float vy = result[t].y - init[t].y - hintY;
+		float scale = sqrtf((float) result[t].size / init[t].size) / hintScale;
+		if (motion[t].valid) {
+			motion[t].vx += MOTION_SMOOTHING * (vx - motion[t].vx);
+			motion[t].vy += MOTION_SMOOTHING * (vy - motion[t].vy);
+			motion[t].scale += MOTION_SMOOTHING * (scale - motion[t].scale);
+		} else {
+			motion[t].vx = vx;
+			motion[t].vy = vy;
+			motion[t].scale = scale;
+			motion[t].valid = true;
+		}
+	}
+	setMotionHint(0, 0);
+}
+
 bool CCircleDetect::changeThreshold() {
 	int div = 1;
 	int dum = numFailed;
@@ -74,8 +311,12 @@ bool CCircleDetect::changeThreshold() {
 	return step > 16;
 }
 
+/**
+ * Flood fill from pixel ii. The sums that the shape of a pattern needs are accumulated while flooding, so the pixels
+ * in the queue do not have to be visited again.
+ */
 bool CCircleDetect::examineSegment(CRawImage *image, SSegment *segmen, int ii,
-		float areaRatio) {
+		float areaRatio, SMoments *moments) {
 	timer.reset();
 	timer.start();
 	int vx, vy;
@@ -85,6 +326,8 @@ bool CCircleDetect::examineSegment(CRawImage *image, SSegment *segmen, int ii,
 	bool result = false;
 	int type = buffer[ii];
 	int maxx, maxy, minx, miny;
+	SMoments sums;
+	memset(&sums, 0, sizeof(sums));
 
 	buffer[ii] = ++numSegments;
 	segmen->x = ii % width;
@@ -99,48 +342,53 @@ bool CCircleDetect::examineSegment(CRawImage *image, SSegment *segmen, int ii,
 	while (queueEnd > queueStart) {
 		//pull the coord from the queue
 		position = queue[queueStart++];
+		int y = position / width;
+		int x = position - y * width;
+		sums.sum += brightness(image, position);
+		sums.sx += x;
+		sums.sy += y;
+		sums.sxx += x * x;
+		sums.sxy += x * y;
+		sums.syy += y * y;
 		//search neighbours
 		pos = position + 1;
 		if (buffer[pos] == 0) {
-			ptr = &image->data[pos * 3];
-			buffer[pos] = ((ptr[0] + ptr[1] + ptr[2]) > threshold) - 2;
+			buffer[pos] = bright(image, pos) - 2;
 		}
 		if (buffer[pos] == type) {
 			queue[queueEnd++] = pos;
-			maxx = max(maxx,pos%width);
+			maxx = max(maxx,x + 1);
 			buffer[pos] = numSegments;
 		}
 		pos = position - 1;
 		if (buffer[pos] == 0) {
-			ptr = &image->data[pos * 3];
-			buffer[pos] = ((ptr[0] + ptr[1] + ptr[2]) > threshold) - 2;
+			buffer[pos] = bright(image, pos) - 2;
 		}
 		if (buffer[pos] == type) {
 			queue[queueEnd++] = pos;
-			minx = min(minx,pos%width);
+			minx = min(minx,x - 1);
 			buffer[pos] = numSegments;
 		}
 		pos = position - width;
 		if (buffer[pos] == 0) {
-			ptr = &image->data[pos * 3];
-			buffer[pos] = ((ptr[0] + ptr[1] + ptr[2]) > threshold) - 2;
+			buffer[pos] = bright(image, pos) - 2;
 		}
 		if (buffer[pos] == type) {
 			queue[queueEnd++] = pos;
-			miny = min(miny,pos/width);
+			miny = min(miny,y - 1);
 			buffer[pos] = numSegments;
 		}
 		pos = position + width;
 		if (buffer[pos] == 0) {
-			ptr = &image->data[pos * 3];
-			buffer[pos] = ((ptr[0] + ptr[1] + ptr[2]) > threshold) - 2;
+			buffer[pos] = bright(image, pos) - 2;
 		}
 		if (buffer[pos] == type) {
 			queue[queueEnd++] = pos;
-			maxy = max(maxy,pos/width);
+			maxy = max(maxy,y + 1);
 			buffer[pos] = numSegments;
 		}
 	}
+	if (moments != NULL) *moments = sums;
 
 	//once the queue is empty, i.e. segment is complete, we compute its size 
 	segmen->size = queueEnd - queueOldStart;
@@ -161,13 +409,7 @@ bool CCircleDetect::examineSegment(CRawImage *image, SSegment *segmen, int ii,
 				&& segmen->roundness + circularTolerance > 1.0) {
 			//if its round, we compute yet another properties 
 			segmen->round = true;
-			segmen->mean = 0;
-			for (int p = queueOldStart; p < queueEnd; p++) {
-				pos = queue[p];
-				segmen->mean += image->data[pos * 3] + image->data[pos * 3 + 1]
-						+ image->data[pos * 3 + 2];
-			}
-			segmen->mean = segmen->mean / segmen->size;
+			segmen->mean = sums.sum / segmen->size;
 			result = true;
 		}
 	}
@@ -201,8 +443,184 @@ void CCircleDetect::bufferCleanup(SSegment init) {
 	}
 }
 
+/**
+ * The outer and inner segment of a pattern need to have the right ratio of their areas, and their centres need to be
+ * close enough to each other.
+ */
+bool CCircleDetect::isConcentric(int outer, int inner) {
+	//the inside area is a circle. now what is the area ratio of the black and white ? also, are the circles concentric ?
+	float ratio = (float) segmentArray[outer].size / areasRatio / (float) segmentArray[inner].size;
+	if (debug)
+		printf("Area ratio %i/%i is %.3f %.3f %.3f\n", outer, inner,
+				(float) segmentArray[outer].size / segmentArray[inner].size, areasRatio, ratio);
+	return (ratio - ratioTolerance < 1.0 && ratio + ratioTolerance > 1.0)
+			&& (abs(segmentArray[inner].x - segmentArray[outer].x) <= centerDistanceToleranceAbs
+					+ centerDistanceToleranceRatio * ((float) (segmentArray[outer].maxx - segmentArray[outer].minx)))
+			&& (abs(segmentArray[inner].y - segmentArray[outer].y) <= centerDistanceToleranceAbs
+					+ centerDistanceToleranceRatio * ((float) (segmentArray[outer].maxy - segmentArray[outer].miny)));
+}
+
+/**
+ * The centroid of the outer segment is replaced by that of the inner segment, and the central moments of both segments
+ * together are computed from their raw sums. That takes a double, the difference between the raw second moment and
+ * the squared mean is too small compared to either of them for a float.
+ */
+void CCircleDetect::measurePattern(const SMoments & outer, const SMoments & inner) {
+	int outerSize = segmentArray[numSegments - 2].size;
+	int innerSize = segmentArray[numSegments - 1].size;
+	int pixels = outerSize + innerSize;
+	segmentArray[numSegments - 2].x = (double) inner.sx / innerSize;
+	segmentArray[numSegments - 2].y = (double) inner.sy / innerSize;
+	double sx = (double) (outer.sx + inner.sx) / pixels;
+	double sy = (double) (outer.sy + inner.sy) / pixels;
+	double fm0 = (double) (outer.sxx + inner.sxx) / pixels - sx * sx;
+	double fm1 = (double) (outer.sxy + inner.sxy) / pixels - sx * sy;
+	double fm2 = (double) (outer.syy + inner.syy) / pixels - sy * sy;
+	measurePattern(sx, sy, fm0, fm1, fm2, pixels);
+}
+
+/**
+ * Compute the eigenvectors and the circularity of a concentric pair, the last two segments in segmentArray. The x and
+ * y of the outer segment have to be the centroid of the inner segment. If the pair is circular, both segments are
+ * marked valid, the leakage of pixels between the two circles is corrected, and the threshold is set between their
+ * mean brightness.
+ *
+ * @param sx                 x coordinate of the centroid of both segments together
+ * @param sy                 y coordinate of the centroid of both segments together
+ * @param fm0                second central moment in x, divided by the number of pixels
+ * @param fm1                mixed second central moment, divided by the number of pixels
+ * @param fm2                second central moment in y, divided by the number of pixels
+ * @param pixels             the number of pixels of both segments
+ */
+void CCircleDetect::measurePattern(float sx, float sy, float fm0, float fm1, float fm2, int pixels) {
+	SSegment & outer = segmentArray[numSegments - 2];
+	SSegment & inner = segmentArray[numSegments - 1];
+	float f0 = ((fm0 + fm2) + sqrt((fm0 + fm2) * (fm0 + fm2) - 4 * (fm0 * fm2 - fm1 * fm1))) / 2;
+	float f1 = ((fm0 + fm2) - sqrt((fm0 + fm2) * (fm0 + fm2) - 4 * (fm0 * fm2 - fm1 * fm1))) / 2;
+	inner.m0 = sqrt(f0);
+	inner.m1 = sqrt(f1);
+	inner.v0 = -fm1 / sqrt(fm1 * fm1 + (fm0 - f0) * (fm0 - f0));
+	inner.v1 = (fm0 - f0) / sqrt(fm1 * fm1 + (fm0 - f0) * (fm0 - f0));
+	inner.bwRatio = (float) outer.size / inner.size;
+
+	sizer += outer.size + inner.size; //for debugging
+	sizerAll += len; 					//for debugging
+	float circularity = M_PI * 4 * inner.m0 * inner.m1 / pixels;
+	inner.circularity = circularity;
+	if (debug)
+		fprintf(stdout, "Circularity: %f  \n", circularity);
+	if (circularity - 1.0 < circularityTolerance && circularity - 1.0 > -circularityTolerance) {
+		outer.valid = inner.valid = true;
+		threshold = (outer.mean + inner.mean) / 2;
+		if (debug)
+			fprintf(stdout, "Circularity: %i %03f %03f %03f \n", pixels, M_PI * 4 * inner.m0 * inner.m1 / pixels,
+					M_PI * 4 * inner.m0 * inner.m1, inner.x / 1000.0);
+
+		//pixel leakage correction
+		float r = diameterRatio * diameterRatio;
+		float m0o = sqrt(f0);
+		float m1o = sqrt(f1);
+		float ratio = (float) inner.size / (outer.size + inner.size);
+		float m0i = sqrt(ratio) * m0o;
+		float m1i = sqrt(ratio) * m1o;
+		float a = (1 - r);
+		float b = -(m0i + m1i) - (m0o + m1o) * r;
+		float c = (m0i * m1i) - (m0o * m1o) * r;
+		float t = (-b - sqrt(b * b - 4 * a * c)) / (2 * a);
+		m0i -= t;
+		m1i -= t;
+		m0o += t;
+		m1o += t;
+		//fprintf(stdout,"UUU: %f %f %f %f %f\n",t,ratio,(m1i-t)/(m1o+t)*0.14,(m0i-t)/(m0o+t)*0.14,(m0o*m1o-m0i*m1i)/(m0i*m1i));
+		inner.m0 = sqrt(f0) + t;
+		inner.m1 = sqrt(f1) + t;
+		inner.maxx = outer.maxx;
+		inner.maxy = outer.maxy;
+		inner.minx = outer.minx;
+		inner.miny = outer.miny;
+		inner.x = sx;
+		inner.y = sy;
+		inner.size = outer.size + inner.size;
+		inner.horizontal = sx - outer.x;
+		inner.angle = atan2(sy - outer.y, sx - outer.x);
+		outer.x = sx;
+		outer.y = sy;
+	}
+}
+
+/**
+ * Flood the dark segment at pixel ii and, if it looks like a ring, the bright segment at its centre. If both are round,
+ * have the right area ratio, and are concentric, the pair is a candidate. If it is circular as well, both segments are
+ * marked valid and the threshold is set between their mean brightness. The valid pattern is segmentArray[numSegments-1],
+ * the pixels of its inner segment are queue[queueOldStart] up to queue[queueEnd].
+ *
+ * @param image              the image to search in
+ * @param ii                 the first pixel of the dark segment
+ * @return                   a concentric pair was found, valid or not
+ */
+bool CCircleDetect::examinePattern(CRawImage *image, int ii) {
+	bool concentric = false;
+	int pos = 0;
+	SMoments outer, inner;
+	//new segment found
+	queueEnd = 0;
+	queueStart = 0;
+	//if the segment looks like a ring, we check its inside area
+	if (examineSegment(image, &segmentArray[numSegments], ii,
+			outerAreaRatio, &outer)) {
+		pos = segmentArray[numSegments - 1].y * image->getwidth()
+				+ segmentArray[numSegments - 1].x;
+		if (buffer[pos] == 0) {
+			buffer[pos] = bright(image, pos) - 2;
+		}
+		if (buffer[pos] == -1 && numSegments < maxSegments) {
+			if (examineSegment(image, &segmentArray[numSegments], pos,
+					innerAreaRatio, &inner)) {
+				if (isConcentric(numSegments - 2, numSegments - 1)) {
+					concentric = true;
+					measurePattern(outer, inner);
+				}
+			}
+		}
+	}
+	return concentric;
+}
+
+/**
+ * The pixel after ii in the scan order. The scan goes row by row through the region and starts at the first pixel of
+ * the region again after its last pixel.
+ */
+int CCircleDetect::nextPixel(int ii, const ImageRoi & region) {
+	ii++;
+	int column = ii % width;
+	if (column >= region.x + region.width)
+		ii += width - column + region.x;
+	else if (column < region.x)
+		ii += region.x - column;
+	if (ii >= (region.y + region.height) * width)
+		ii = region.y * width + region.x;
+	return ii;
+}
+
+//! Check if pixel ii lies within the region
+static inline bool inRegion(int ii, int width, const ImageRoi & region) {
+	int x = ii % width, y = ii / width;
+	return (x >= region.x && x < region.x + region.width && y >= region.y && y < region.y + region.height);
+}
+
 SSegment CCircleDetect::findSegment(CRawImage* image, SSegment init) {//printf("findingSegment\n");
 	SSegment result;
+	if (image->corrupt) {
+		// neither the threshold nor the motion model learn from a frame the camera could not repair
+		memset(&result, 0, sizeof(SSegment));
+		contours[0].count = 0;
+		return result;
+	}
+	if (backend == SEG_RUNS) {
+		findSegments(image, &init, &result, 1);
+		return result;
+	}
+	contours[0].count = 0;
 	result.x = 0;
 	result.y = 0;
 	result.round = false;
@@ -212,245 +630,50 @@ SSegment CCircleDetect::findSegment(CRawImage* image, SSegment init) {//printf("
 	timer.reset();
 	timer.start();
 	tima += timer.getTime();
-	int pos = 0;
 	int ii = 0;
 	int start = 0;
 	bool cont = true;
 
 	//bufferCleanup(init);
 	if (init.valid && track) {
-		ii = ((int) init.y) * image->getwidth() + init.x;
+		SSegment expected = predict(init);
+		ii = ((int) expected.y) * image->getwidth() + expected.x;
 		start = ii;
 	}
+	// pixels outside the region of interest are not up to date, so only search within it
+	ImageRoi region = image->getRoi();
+	if (image->hasRoi() && !inRegion(ii, width, region)) {
+		ii = start = region.y * width + region.x;
+	}
+	if (plane != NULL) buildPlane(image, region);
+	// a lost pattern is searched for in the decimated image, and only confirmed at full resolution
+	bool decimated = (pyramidLevels > 0 && !(init.valid && track));
+	if (decimated) {
+		SSegment found;
+		int thresholdSum = 0;
+		if (searchPyramid(image, region, &found, 0, 1, thresholdSum) > 0)
+			threshold = thresholdSum;
+		cont = false;
+	}
 	while (cont) {
 		if (buffer[ii] == 0) {
-			ptr = &image->data[ii * 3];
 			//buffer[ii]=((ptr[0]+ptr[1]+ptr[2]) > threshold)-2;
-			if ((ptr[0] + ptr[1] + ptr[2]) < threshold)
+			if (dark(image, ii))
 				buffer[ii] = -2;
 		}
-		if (buffer[ii] == -2 && numSegments < MAX_SEGMENTS) {
-			//new segment found
-			queueEnd = 0;
-			queueStart = 0;
-			//if the segment looks like a ring, we check its inside area
-			if (examineSegment(image, &segmentArray[numSegments], ii,
-					outerAreaRatio)) {
-				pos = segmentArray[numSegments - 1].y * image->getwidth()
-						+ segmentArray[numSegments - 1].x;
-				if (buffer[pos] == 0) {
-					ptr = &image->data[pos * 3];
-					buffer[pos] = ((ptr[0] + ptr[1] + ptr[2]) > threshold) - 2;
-				}
-				if (buffer[pos] == -1 && numSegments < MAX_SEGMENTS) {
-					if (examineSegment(image, &segmentArray[numSegments], pos,
-							innerAreaRatio)) {
-						//the inside area is a circle. now what is the area ratio of the black and white ? also, are the circles concentric ?
-
-						if (debug)
-							printf("Area ratio %i/%i is %.3f %.3f %.3f\n",
-									numSegments - 2, numSegments - 1,
-									(float) segmentArray[numSegments - 2].size
-											/ segmentArray[numSegments - 1].size,
-									areasRatio,
-									segmentArray[numSegments - 2].size
-											/ areasRatio
-											/ segmentArray[numSegments - 1].size);
-						if (((float) segmentArray[numSegments - 2].size
-								/ areasRatio
-								/ (float) segmentArray[numSegments - 1].size
-								- ratioTolerance < 1.0
-								&& (float) segmentArray[numSegments - 2].size
-										/ areasRatio
-										/ (float) segmentArray[numSegments - 1].size
-										+ ratioTolerance > 1.0)
-								&& (abs(
-										segmentArray[numSegments - 1].x
-												- segmentArray[numSegments - 2].x)
-										<= centerDistanceToleranceAbs
-												+ centerDistanceToleranceRatio
-														* ((float) (segmentArray[numSegments
-																- 2].maxx
-																- segmentArray[numSegments
-																		- 2].minx)))
-								&& (abs(
-										segmentArray[numSegments - 1].y
-												- segmentArray[numSegments - 2].y)
-										<= centerDistanceToleranceAbs
-												+ centerDistanceToleranceRatio
-														* ((float) (segmentArray[numSegments
-																- 2].maxy
-																- segmentArray[numSegments
-																		- 2].miny)))
-
-								) {
-							float tx, ty, cm0, cm1, cm2, sx, sy, fm0, fm1, fm2,
-									f0, f1;
-							sx = sy = cm0 = cm1 = cm2 = 0;
-							//	segmentArray[numSegments-1].x = segmentArray[numSegments-2].x;
-							//	segmentArray[numSegments-1].y = segmentArray[numSegments-2].y;
-
-							for (int p = queueOldStart; p < queueEnd; p++) {
-								pos = queue[p];
-								sx += pos % image->getwidth();
-								sy += pos / image->getwidth();
-							}
-							segmentArray[numSegments - 2].x = sx
-									/ (queueEnd - queueOldStart);
-							segmentArray[numSegments - 2].y = sy
-									/ (queueEnd - queueOldStart);
-							for (int p = 0; p < queueOldStart; p++) {
-								pos = queue[p];
-								sx += pos % image->getwidth();
-								sy += pos / image->getwidth();
-							}
-							sx = sx / queueEnd;
-							sy = sy / queueEnd;
-							for (int p = 0; p < queueEnd; p++) {
-								pos = queue[p];
-								tx = pos % image->getwidth() - sx;
-								ty = pos / image->getwidth() - sy;
-								cm0 += tx * tx;
-								cm1 += tx * ty;
-								cm2 += ty * ty;
-							}
-							fm0 = cm0 / queueEnd;
-							fm1 = cm1 / queueEnd;
-							fm2 = cm2 / queueEnd;
-							f0 =
-									((fm0 + fm2)
-											+ sqrt(
-													(fm0 + fm2) * (fm0 + fm2)
-															- 4
-																	* (fm0 * fm2
-																			- fm1
-																					* fm1)))
-											/ 2;
-							f1 =
-									((fm0 + fm2)
-											- sqrt(
-													(fm0 + fm2) * (fm0 + fm2)
-															- 4
-																	* (fm0 * fm2
-																			- fm1
-																					* fm1)))
-											/ 2;
-							segmentArray[numSegments - 1].m0 = sqrt(f0);
-							segmentArray[numSegments - 1].m1 = sqrt(f1);
-							segmentArray[numSegments - 1].v0 = -fm1
-									/ sqrt(fm1 * fm1 + (fm0 - f0) * (fm0 - f0));
-							segmentArray[numSegments - 1].v1 = (fm0 - f0)
-									/ sqrt(fm1 * fm1 + (fm0 - f0) * (fm0 - f0));
-							segmentArray[numSegments - 1].bwRatio =
-									(float) segmentArray[numSegments - 2].size
-											/ segmentArray[numSegments - 1].size;
-
-							if (track)
-								ii = start - 1;
-							sizer += segmentArray[numSegments - 2].size
-									+ segmentArray[numSegments - 1].size; //for debugging
-							sizerAll += len; 					//for debugging
-							float circularity = M_PI * 4
-									* (segmentArray[numSegments - 1].m0)
-									* (segmentArray[numSegments - 1].m1)
-									/ queueEnd;
-							if (debug)
-								fprintf(stdout, "Circularity: %f  \n",
-										circularity);
-							if (circularity - 1.0 < circularityTolerance
-									&& circularity - 1.0
-											> -circularityTolerance) {
-								segmentArray[numSegments - 2].valid =
-										segmentArray[numSegments - 1].valid =
-												true;
-								threshold = (segmentArray[numSegments - 2].mean
-										+ segmentArray[numSegments - 1].mean)
-										/ 2;
-								if (debug)
-									fprintf(stdout,
-											"Circularity: %i %03f %03f %03f \n",
-											queueEnd,
-											M_PI * 4
-													* (segmentArray[numSegments
-															- 1].m0)
-													* (segmentArray[numSegments
-															- 1].m1) / queueEnd,
-											M_PI * 4
-													* (segmentArray[numSegments
-															- 1].m0)
-													* (segmentArray[numSegments
-															- 1].m1),
-											segmentArray[numSegments - 1].x
-													/ 1000.0);
-
-								//pixel leakage correction
-								float r = diameterRatio * diameterRatio;
-								float m0o = sqrt(f0);
-								float m1o = sqrt(f1);
-								float ratio =
-										(float) segmentArray[numSegments - 1].size
-												/ (segmentArray[numSegments - 2].size
-														+ segmentArray[numSegments
-																- 1].size);
-								float m0i = sqrt(ratio) * m0o;
-								float m1i = sqrt(ratio) * m1o;
-								float a = (1 - r);
-								float b = -(m0i + m1i) - (m0o + m1o) * r;
-								float c = (m0i * m1i) - (m0o * m1o) * r;
-								float t = (-b - sqrt(b * b - 4 * a * c))
-										/ (2 * a);
-								m0i -= t;
-								m1i -= t;
-								m0o += t;
-								m1o += t;
-								//fprintf(stdout,"UUU: %f %f %f %f %f\n",t,ratio,(m1i-t)/(m1o+t)*0.14,(m0i-t)/(m0o+t)*0.14,(m0o*m1o-m0i*m1i)/(m0i*m1i));
-								segmentArray[numSegments - 1].m0 = sqrt(f0) + t;
-								segmentArray[numSegments - 1].m1 = sqrt(f1) + t;
-								segmentArray[numSegments - 1].maxx =
-										segmentArray[numSegments - 2].maxx;
-								segmentArray[numSegments - 1].maxy =
-										segmentArray[numSegments - 2].maxy;
-								segmentArray[numSegments - 1].minx =
-										segmentArray[numSegments - 2].minx;
-								segmentArray[numSegments - 1].miny =
-										segmentArray[numSegments - 2].miny;
-								segmentArray[numSegments - 1].x = sx;
-								segmentArray[numSegments - 1].y = sy;
-								segmentArray[numSegments - 1].size =
-										segmentArray[numSegments - 2].size
-												+ segmentArray[numSegments - 1].size;
-								segmentArray[numSegments - 1].horizontal = sx
-										- segmentArray[numSegments - 2].x;
-								segmentArray[numSegments - 1].angle = atan2(
-										sy - segmentArray[numSegments - 2].y,
-										sx - segmentArray[numSegments - 2].x);
-								segmentArray[numSegments - 2].x = sx;
-								segmentArray[numSegments - 2].y = sy;
-							}
-						}
-					}
-				}
-			}
+		if (buffer[ii] == -2 && numSegments < maxSegments) {
+			if (examinePattern(image, ii) && track)
+				ii = start - 1;
+			else if (plane != NULL && threshold != planeThreshold)
+				buildPlane(image, region);
 		}
-		ii++;
-		if (ii >= len)
-			ii = 0;
+		ii = nextPixel(ii, region);
 		cont = (ii != start);
 	}
 	for (int i = 0; i < numSegments; i++) {
 		if (segmentArray[i].size > minSize
 				&& (segmentArray[i].valid || debug)) {
-			if (debug)
-				fprintf(stdout,
-						"Segment %i Type: %i Pos: %.2f %.2f Area: %i Vx: %i Vy: %i Mean: %i Thr: %i Eigen: %03f %03f %03f Roundness: %03f\n",
-						i, segmentArray[i].type, segmentArray[i].x,
-						segmentArray[i].y, segmentArray[i].size,
-						segmentArray[i].maxx - segmentArray[i].minx,
-						segmentArray[i].maxy - segmentArray[i].miny,
-						segmentArray[i].mean, threshold, segmentArray[i].m0,
-						segmentArray[i].m1,
-						M_PI * 4 * segmentArray[i].m0 * segmentArray[i].m1,
-						segmentArray[i].roundness);
+			printSegment(i);
 			if (segmentArray[i].valid)
 				result = segmentArray[i];
 		}
@@ -459,45 +682,637 @@ SSegment CCircleDetect::findSegment(CRawImage* image, SSegment init) {//printf("
 		lastTrackOK = true;
 	else
 		lastTrackOK = false;
-	//Drawing results 
-	if (result.valid) {
+	updateThreshold(result.valid, image);
+	// scanForPatterns already cleared the pattern
+	if (!decimated) clearSegmentPixels(image);
+	if (traceContours && result.valid) traceContour(image, result, contours[0]);
+	bufferCleanup(result);
+	if (prediction) updateMotion(&init, &result, 1);
+	return result;
+}
+
+/**
+ * All targets are searched for in a single pass, so every pixel is flooded at most once, however many targets there
+ * are. Targets that were found in the previous frame are searched for around their previous position first, the rest
+ * of the image (or of its region of interest) is only scanned if not all targets are found there. Each result is put
+ * at the index of the previous segment that is closest to it, so the tracking of init[i] continues in result[i].
+ *
+ * @param image              the image to search in, the inner circle of every pattern that is found is made black,
+ *                           a corrupt frame (see CRawImage::corrupt) is skipped and gives no patterns
+ * @param init               the segments of the previous frame, targets items
+ * @param result             the segments that are found, targets items, invalid if there was nothing to be found
+ * @param targets            the maximum number of patterns to search for, at most MAX_TARGETS
+ * @return                   the number of patterns found
+ */
+int CCircleDetect::findSegments(CRawImage* image, const SSegment *init, SSegment *result, int targets) {
+	SSegment found[MAX_TARGETS];
+	int inner[MAX_TARGETS];
+	int numFound = 0;
+	int thresholdSum = 0;
+	targets = min(targets, MAX_TARGETS);
+	if (image->corrupt) {
+		for (int t = 0; t < targets; t++) {
+			memset(&result[t], 0, sizeof(SSegment));
+			contours[t].count = 0;
+		}
+		return 0;
+	}
+	numSegments = 0;
+
+	ImageRoi region = image->getRoi();
+	bool searched = false;
+	int start = region.y * width + region.x;
+	if (plane != NULL && backend == SEG_FLOOD_FILL) buildPlane(image, region);
+	if (backend == SEG_RUNS) {
+		// the runs have to be built for the whole region anyway, so take all patterns and pick the closest ones below
+		buildRuns(image, region);
+		numFound = findPatternsInRuns(image, found, inner, MAX_TARGETS, thresholdSum);
+	}
+	for (int t = 0; t < targets && numFound < targets && backend == SEG_FLOOD_FILL; t++) {
+		if (!init[t].valid || !track) continue;
+		SSegment expected = predict(init[t], t);
+		int ii = ((int) expected.y) * width + expected.x;
+		if (!inRegion(ii, width, region)) continue;
+		if (!searched) start = ii;
+		searched = true;
+		int w = expected.maxx - expected.minx + 1;
+		int h = expected.maxy - expected.miny + 1;
+		ImageRoi window;
+		if (prediction) {
+			// the predicted bounding box only needs a small margin for the error of the prediction
+			int mx = w / 4 + PREDICTION_MARGIN, my = h / 4 + PREDICTION_MARGIN;
+			window = ImageRoi(expected.minx - mx, expected.miny - my, w + 2 * mx, h + 2 * my);
+		} else {
+			// the previous bounding box, grown by its own size to allow for the motion between frames
+			window = ImageRoi(expected.minx - w / 2, expected.miny - h / 2, 2 * w, 2 * h);
+		}
+		window = window.intersect(region);
+		if (!inRegion(ii, width, window)) continue;
+		numFound = scanForPatterns(image, window, ii, found, numFound, targets, thresholdSum);
+	}
+	if (numFound < targets && backend == SEG_FLOOD_FILL) {
+		if (pyramidLevels > 0)
+			numFound = searchPyramid(image, region, found, numFound, targets, thresholdSum);
+		else
+			numFound = scanForPatterns(image, region, start, found, numFound, targets, thresholdSum);
+	}
+
+	for (int i = 0; i < numSegments; i++) {
+		if (segmentArray[i].size > minSize && (segmentArray[i].valid || debug)) printSegment(i);
+	}
+
+	// continue the track of every previous segment with the closest pattern
+	bool used[MAX_TARGETS];
+	for (int i = 0; i < MAX_TARGETS; i++) used[i] = false;
+	for (int i = 0; i < targets; i++) memset(&result[i], 0, sizeof(SSegment));
+	for (int t = 0; t < targets; t++) {
+		if (!init[t].valid) continue;
+		int best = -1;
+		float bestDistance = 0;
+		for (int f = 0; f < numFound; f++) {
+			if (used[f]) continue;
+			float dx = found[f].x - init[t].x, dy = found[f].y - init[t].y;
+			if (best < 0 || dx * dx + dy * dy < bestDistance) {
+				best = f;
+				bestDistance = dx * dx + dy * dy;
+			}
+		}
+		if (best < 0) break;
+		result[t] = found[best];
+		used[best] = true;
+	}
+	for (int f = 0, t = 0; f < numFound; f++) {
+		if (used[f]) continue;
+		while (t < targets && result[t].valid) t++;
+		if (t == targets) break;
+		result[t] = found[f];
+		used[f] = true;
+	}
+
+	if (numFound > 0) threshold = thresholdSum / numFound;
+	updateThreshold(numFound > 0, image);
+	if (prediction) updateMotion(init, result, targets);
+	for (int t = 0; t < targets; t++) {
+		contours[t].count = 0;
+		if (traceContours && result[t].valid) traceContour(image, result[t], contours[t]);
+	}
+	if (backend == SEG_RUNS) {
+		int count = 0;
+		for (int f = 0; f < numFound; f++) {
+			if (!used[f]) continue;
+			clearRunPixels(image, inner[f]);
+			count++;
+		}
+		return count;
+	}
+
+	lastTrackOK = (numFound == targets && numSegments == 2 * numFound);
+	if (lastTrackOK) {
+		for (int i = 0; i < targets; i++) bufferCleanup(result[i]);
+	} else {
+		SSegment none;
+		none.valid = false;
+		bufferCleanup(none);
+	}
+	return numFound;
+}
+
+/**
+ * Scan the region from pixel start on for patterns, until the whole region is scanned or all targets are found. Pixels
+ * that are already part of a segment, also of one found by an earlier scan, are not flooded again.
+ *
+ * @return                   the number of patterns in found
+ */
+int CCircleDetect::scanForPatterns(CRawImage *image, const ImageRoi & region, int start, SSegment *found, int numFound,
+		int targets, int & thresholdSum) {
+	int ii = start;
+	do {
+		if (buffer[ii] == 0) {
+			if (dark(image, ii))
+				buffer[ii] = -2;
+		}
+		if (buffer[ii] == -2 && numSegments < maxSegments) {
+			int seedThreshold = threshold;
+			if (examinePattern(image, ii) && segmentArray[numSegments - 1].valid) {
+				found[numFound++] = segmentArray[numSegments - 1];
+				thresholdSum += threshold;
+				// the pattern sets the threshold for itself only, the others are searched with the old one
+				threshold = seedThreshold;
+				clearSegmentPixels(image);
+				if (numFound == targets) break;
+			}
+		}
+		ii = nextPixel(ii, region);
+	} while (ii != start);
+	return numFound;
+}
+
+/**
+ * Decimate the image, find the patterns in the top of the pyramid with the current threshold, and scan the windows of
+ * their bounding boxes, scaled back to full resolution and with a margin, for the patterns themselves.
+ *
+ * @return                   the number of patterns in found
+ */
+int CCircleDetect::searchPyramid(CRawImage *image, const ImageRoi & region, SSegment *found, int numFound, int targets,
+		int & thresholdSum) {
+	CRawImage *level = image;
+	for (int l = 0; l < pyramidLevels; l++) {
+		if (pyramid[l] == NULL || pyramid[l]->getbpp() != image->getbpp()) {
+			delete pyramid[l];
+			pyramid[l] = new CRawImage(width >> (l + 1), height >> (l + 1), image->getbpp());
+		}
+		level->compress(pyramid[l]->getView(), true);
+		level = pyramid[l];
+	}
+	int factor = 1 << pyramidLevels;
+	level->clearRoi();
+	if (image->hasRoi())
+		level->setRoi(ImageRoi(region.x / factor, region.y / factor, region.width / factor, region.height / factor));
+
+	SSegment none[MAX_TARGETS], candidates[MAX_TARGETS];
+	for (int i = 0; i < MAX_TARGETS; i++) none[i].valid = false;
+	coarse->threshold = threshold;
+	int numCandidates = coarse->findSegments(level, none, candidates, targets - numFound);
+	for (int i = 0; i < numCandidates && numFound < targets; i++) {
+		const SSegment & candidate = candidates[i];
+		ImageRoi window(candidate.minx * factor, candidate.miny * factor, (candidate.maxx - candidate.minx + 1) * factor,
+				(candidate.maxy - candidate.miny + 1) * factor);
+		window = window.grow(2 * factor).intersect(region);
+		if (window.empty()) continue;
+		numFound = scanForPatterns(image, window, window.y * width + window.x, found, numFound, targets, thresholdSum);
+	}
+	return numFound;
+}
+
+/**
+ * Adapt the threshold after a search. If the pattern is lost, the thresholds proposed by the histogram of the frame
+ * are tried first, so a change of the lighting costs a single frame. After those, other thresholds are tried in a
+ * binary subdivision of the range, alternated with the last threshold that worked as long as numFailed is below
+ * maxFailed.
+ */
+void CCircleDetect::updateThreshold(bool found, CRawImage *image) {
+	if (found) {
 		lastThreshold = threshold;
 		drawAll = false;
 		numFailed = 0;
+		numProposals = proposal = 0;
+		return;
+	}
+	if (debug)
+		drawAll = true;
+	if (useProposals && numFailed == 0 && numProposals == 0) {
+		numProposals = proposeThresholds(image, proposals);
+		proposal = 0;
+	}
+	if (proposal < numProposals) {
+		threshold = proposals[proposal++];
 	} else if (numFailed < maxFailed) {
 		if (numFailed++ % 2 == 0)
 			changeThreshold();
 		else
 			threshold = lastThreshold;
-		if (debug)
-			drawAll = true;
 	} else {
 		numFailed++;
-		if (changeThreshold() == false)
+		if (changeThreshold() == false) {
+			// the next round starts with the proposals of the frame it starts at
 			numFailed = 0;
-		if (debug)
-			drawAll = true;
+			numProposals = 0;
+		}
 	}
-	int j = 0;
+}
+
+//! Sum of the bins [a,b) squared divided by their count, the part of a class in the variance between the classes
+static inline double classScore(const double *count, const double *sum, int a, int b) {
+	double n = count[b] - count[a];
+	return (n > 0) ? (sum[b] - sum[a]) * (sum[b] - sum[a]) / n : 0;
+}
+
+/**
+ * Otsu's method on the histogram the camera counted while it converted the frame. The pattern is black on white, but
+ * the floor or the walls around it add a third level, so the two thresholds that split the histogram best in three
+ * classes are proposed as well, if they differ from Otsu's threshold. Maximizing the sum of the squared sums divided by
+ * the counts of the classes is the same as maximizing the variance between the classes.
+ */
+int CCircleDetect::proposeThresholds(CRawImage *image, int *result) {
+	if (!image->hasHistogram()) return 0;
+	const int bins = IMAGE_HISTOGRAM_BINS;
+	double count[bins + 1], sum[bins + 1];
+	count[0] = sum[0] = 0;
+	for (int i = 0; i < bins; i++) {
+		count[i + 1] = count[i] + image->histogram[i];
+		sum[i + 1] = sum[i] + (double) i * image->histogram[i];
+	}
+	int split = 0;
+	double best = 0;
+	for (int t = 1; t < bins; t++) {
+		double score = classScore(count, sum, 0, t) + classScore(count, sum, t, bins);
+		if (score > best) {
+			best = score;
+			split = t;
+		}
+	}
+	if (split == 0) return 0;
+	int splits[MAX_PROPOSALS] = { split, 0, 0 };
+	best = 0;
+	for (int t1 = 1; t1 < bins - 1; t1++) {
+		double low = classScore(count, sum, 0, t1);
+		for (int t2 = t1 + 1; t2 < bins; t2++) {
+			double score = low + classScore(count, sum, t1, t2) + classScore(count, sum, t2, bins);
+			if (score > best) {
+				best = score;
+				splits[1] = t1;
+				splits[2] = t2;
+			}
+		}
+	}
+	// a split is the first bin of the bright class, the threshold is the lowest value that is counted in that bin
+	int found = 0;
+	for (int i = 0; i < MAX_PROPOSALS; i++) {
+		bool known = (splits[i] == 0);
+		for (int j = 0; j < found && !known; j++)
+			known = (abs(result[j] - 3 * splits[i] * (256 / bins)) <= 3 * (256 / bins));
+		if (!known) result[found++] = 3 * splits[i] * (256 / bins);
+	}
+	return found;
+}
+
+float CCircleDetect::sampleBrightness(CRawImage *image, float x, float y) {
+	int ix = (int) x, iy = (int) y;
+	float gx = x - ix, gy = y - iy;
+	int pos = iy * width + ix;
+	return (brightness(image, pos) * (1 - gx) + brightness(image, pos + 1) * gx) * (1 - gy)
+			+ (brightness(image, pos + width) * (1 - gx) + brightness(image, pos + width + 1) * gx) * gy;
+}
+
+/**
+ * Walk outwards from the centre of the pattern along CONTOUR_POINTS rays. The inner circle may be bright, or already be
+ * made black, so the edge is the first place where the ray gets above the threshold after it has been below it. The
+ * position of the edge is interpolated between the two samples around it. Rays that leave the image, or go further
+ * than the size of the bounding box, do not give a point.
+ */
+void CCircleDetect::traceContour(CRawImage *image, const SSegment & segment, SContour & contour) {
+	contour.count = 0;
+	float maxRadius = max(segment.maxx - segment.minx, segment.maxy - segment.miny) + 2;
+	for (int i = 0; i < CONTOUR_POINTS; i++) {
+		float dx = cos(2 * M_PI * i / CONTOUR_POINTS);
+		float dy = sin(2 * M_PI * i / CONTOUR_POINTS);
+		bool inRing = false;
+		float last = 0;
+		for (int r = 0; r < maxRadius; r++) {
+			float x = segment.x + r * dx, y = segment.y + r * dy;
+			if (x < 0 || y < 0 || x >= width - 1 || y >= height - 1) break;
+			float b = sampleBrightness(image, x, y);
+			if (b < threshold) {
+				inRing = true;
+			} else if (inRing) {
+				float edge = r - 1 + (threshold - last) / (b - last);
+				contour.x[contour.count] = segment.x + edge * dx;
+				contour.y[contour.count] = segment.y + edge * dy;
+				contour.count++;
+				break;
+			}
+			last = b;
+		}
+	}
+}
+
+//! Make the pixels of the last segment that is flooded black, for a pattern this is its inner circle
+void CCircleDetect::clearSegmentPixels(CRawImage *image) {
+	int bpp = image->getbpp();
 	for (int p = queueOldStart; p < queueEnd; p++) {
-		pos = queue[p];
-		image->data[3 * pos + 0] = 0;
-		image->data[3 * pos + 1] = 0;
-		image->data[3 * pos + 2] = 0;
-	}
-
-	if (draw) {
-		for (int i = 0; i < len; i++) {
-			j = buffer[i];
-			if (j > 0) {
-				if (drawAll || segmentArray[j - 1].valid) {
-					image->data[i * 3 + j % 3] = 0;
-					image->data[i * 3 + (j + 1) % 3] = 255;
-					image->data[i * 3 + (j + 2) % 3] = 255;
-				}
+		int pos = queue[p];
+		if (bpp == 3) {
+			image->data[3 * pos + 0] = 0;
+			image->data[3 * pos + 1] = 0;
+			image->data[3 * pos + 2] = 0;
+		} else {
+			image->data[bpp * pos] = 0;
+		}
+	}
+}
+
+/**
+ * The segments are not coloured in the image any more, the image server sends the boxes along with the frame and the
+ * visualiser draws them, so the frame stays what the camera saw. Valid segments are green, the others yellow.
+ */
+void CCircleDetect::overlaySegments(ImageOverlay & overlay) {
+	for (int i = 0; i < numSegments; i++) {
+		const SSegment & segment = segmentArray[i];
+		if (!drawAll && !segment.valid) continue;
+		if (!addImageOverlay(overlay, OVERLAY_BOX, segment.valid ? OVERLAY_GREEN : OVERLAY_YELLOW, segment.minx,
+				segment.miny, segment.maxx, segment.maxy)) return;
+	}
+}
+
+void CCircleDetect::printSegment(int i) {
+	if (!debug) return;
+	fprintf(stdout,
+			"Segment %i Type: %i Pos: %.2f %.2f Area: %i Vx: %i Vy: %i Mean: %i Thr: %i Eigen: %03f %03f %03f Roundness: %03f\n",
+			i, segmentArray[i].type, segmentArray[i].x,
+			segmentArray[i].y, segmentArray[i].size,
+			segmentArray[i].maxx - segmentArray[i].minx,
+			segmentArray[i].maxy - segmentArray[i].miny,
+			segmentArray[i].mean, threshold, segmentArray[i].m0,
+			segmentArray[i].m1,
+			M_PI * 4 * segmentArray[i].m0 * segmentArray[i].m1,
+			segmentArray[i].roundness);
+}
+
+/**
+ * One pass over the row that only writes to the small row buffers without any branches, so the compiler can vectorize
+ * it. A pixel is bright if it is above the threshold, like in examineSegment.
+ */
+void CCircleDetect::thresholdRow(CRawImage *image, int y, int x0, int x1, unsigned short *value, unsigned char *mask) {
+	int n = x1 - x0;
+	int t = threshold;
+	switch (image->getbpp()) {
+	case 1: {
+		const unsigned char *p = image->data + y * width + x0;
+		for (int i = 0; i < n; i++) {
+			value[i] = 3 * p[i];
+			mask[i] = value[i] > t;
+		}
+		break;
+	}
+	case 2: {
+		const unsigned char *p = image->data + 2 * (y * width + x0);
+		for (int i = 0; i < n; i++) {
+			value[i] = 3 * p[2 * i];
+			mask[i] = value[i] > t;
+		}
+		break;
+	}
+	default: {
+		const unsigned char *p = image->data + 3 * (y * width + x0);
+		for (int i = 0; i < n; i++) {
+			value[i] = p[3 * i] + p[3 * i + 1] + p[3 * i + 2];
+			mask[i] = value[i] > t;
+		}
+		break;
+	}
+	}
+}
+
+//! The root of the run in runs, the path to it is halved on the way
+static inline int rootOf(std::vector<SRun> & runs, int run) {
+	while (runs[run].parent != run) {
+		runs[run].parent = runs[runs[run].parent].parent;
+		run = runs[run].parent;
+	}
+	return run;
+}
+
+//! Join the runs [a,aEnd) of a row with the overlapping runs of the same kind [aEnd,bEnd) of the row below it
+static void joinRows(std::vector<SRun> & runs, int a, int aEnd, int bEnd) {
+	int b = aEnd;
+	while (a < aEnd && b < bEnd) {
+		if (runs[a].dark == runs[b].dark && runs[a].x0 < runs[b].x1 && runs[b].x0 < runs[a].x1) {
+			int ra = rootOf(runs, a), rb = rootOf(runs, b);
+			if (ra != rb) runs[max(ra, rb)].parent = min(ra, rb);
+		}
+		if (runs[a].x1 < runs[b].x1) a++;
+		else if (runs[b].x1 < runs[a].x1) b++;
+		else { a++; b++; }
+	}
+}
+
+int CCircleDetect::findRoot(int run) {
+	return rootOf(runs, run);
+}
+
+/**
+ * The runs of a stripe are numbered from 0 and only refer to each other, so stripes can be built at the same time. A
+ * run is joined with the root that comes first, so the root of a segment is always its first run.
+ */
+void CCircleDetect::buildStripe(CRawImage *image, const ImageRoi & region, SStripe & stripe) {
+	std::vector<SRun> & out = stripe.runs;
+	out.clear();
+	stripe.rowStart.assign(stripe.last - stripe.first + 1, 0);
+	for (int r = 0; r < stripe.last - stripe.first; r++) {
+		int y = region.y + stripe.first + r;
+		stripe.rowStart[r] = out.size();
+		thresholdRow(image, y, region.x, region.x + region.width, stripe.rowValue, stripe.rowMask);
+		int i = 0;
+		while (i < region.width) {
+			SRun run;
+			run.x0 = region.x + i;
+			run.y = y;
+			run.dark = !stripe.rowMask[i];
+			run.sum = 0;
+			run.parent = out.size();
+			unsigned char kind = stripe.rowMask[i];
+			for (; i < region.width && stripe.rowMask[i] == kind; i++) run.sum += stripe.rowValue[i];
+			run.x1 = region.x + i;
+			out.push_back(run);
+		}
+		// join with the overlapping runs of the row above
+		if (r > 0) joinRows(out, stripe.rowStart[r - 1], stripe.rowStart[r], out.size());
+	}
+	stripe.rowStart[stripe.last - stripe.first] = out.size();
+}
+
+/**
+ * Every row of the region is thresholded and split in runs of dark and bright pixels. Runs of the same kind in
+ * adjacent rows that overlap in at least one column are 4-connected and are joined with a union-find. Afterwards the
+ * size, bounding box, brightness sum, and raw moments of every segment are summed from its runs. The outermost rows and
+ * columns of the image are left out, like the border of the label buffer of the flood fill. With more than one stripe
+ * (see setStripes) the stripes are built by the tasks of the pool, put after each other, and joined at their borders.
+ */
+void CCircleDetect::buildRuns(CRawImage *image, const ImageRoi & roi) {
+	ImageRoi region = roi.intersect(ImageRoi(1, 1, width - 2, height - 2));
+	firstRow = region.y;
+	int count = min(numStripes, max(region.height / MIN_STRIPE_ROWS, 1));
+	for (int s = 0; s < count; s++) {
+		stripes[s].first = region.height * s / count;
+		stripes[s].last = region.height * (s + 1) / count;
+	}
+	if (count == 1) {
+		buildStripe(image, region, stripes[0]);
+		runs.swap(stripes[0].runs);
+		rowStart.swap(stripes[0].rowStart);
+	} else {
+		stripeImage = image;
+		stripeRegion = region;
+		CTaskPool::shared().parallelFor(0, count, 1, &CCircleDetect::buildStripes, this);
+
+		runs.clear();
+		rowStart.assign(region.height + 1, 0);
+		for (int s = 0; s < count; s++) {
+			const SStripe & stripe = stripes[s];
+			int offset = runs.size();
+			for (int r = 0; r < stripe.last - stripe.first; r++)
+				rowStart[stripe.first + r] = offset + stripe.rowStart[r];
+			for (int i = 0; i < (int)stripe.runs.size(); i++) {
+				runs.push_back(stripe.runs[i]);
+				runs.back().parent += offset;
 			}
+			// join the first row of the stripe with the last row of the stripe above
+			if (s > 0) joinRows(runs, rowStart[stripe.first - 1], offset, offset + stripe.rowStart[1]);
+		}
+		rowStart[region.height] = runs.size();
+	}
+
+	runSegment.assign(runs.size(), -1);
+	runSegments.clear();
+	for (int i = 0; i < (int)runs.size(); i++) {
+		int root = findRoot(i);
+		if (runSegment[root] < 0) {
+			SRunSegment segment;
+			memset(&segment, 0, sizeof(segment));
+			segment.minx = runs[i].x0;
+			segment.maxx = runs[i].x1 - 1;
+			segment.miny = segment.maxy = runs[i].y;
+			segment.dark = runs[i].dark;
+			runSegment[root] = runSegments.size();
+			runSegments.push_back(segment);
+		}
+		const SRun & run = runs[i];
+		SRunSegment & segment = runSegments[runSegment[root]];
+		long long n = run.x1 - run.x0;
+		long long x0 = run.x0, x1 = run.x1 - 1;
+		// the sums of x and x^2 over the run, both are whole numbers
+		long long sumX = n * (x0 + x1) / 2;
+		long long sumXX = (x1 * (x1 + 1) * (2 * x1 + 1) - (x0 - 1) * x0 * (2 * x0 - 1)) / 6;
+		segment.size += n;
+		segment.minx = min(segment.minx, (int)run.x0);
+		segment.maxx = max(segment.maxx, run.x1 - 1);
+		segment.maxy = max(segment.maxy, (int)run.y);
+		SMoments & moments = segment.moments;
+		moments.sum += run.sum;
+		moments.sx += sumX;
+		moments.sy += n * run.y;
+		moments.sxx += sumXX;
+		moments.sxy += sumX * run.y;
+		moments.syy += n * run.y * run.y;
+	}
+}
+
+int CCircleDetect::findRun(int x, int y) {
+	int r = y - firstRow;
+	if (r < 0 || r + 1 >= (int)rowStart.size()) return -1;
+	int lo = rowStart[r], hi = rowStart[r + 1] - 1;
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		if (x < runs[mid].x0) hi = mid - 1;
+		else if (x >= runs[mid].x1) lo = mid + 1;
+		else return mid;
+	}
+	return -1;
+}
+
+/**
+ * The same properties that examineSegment computes for a flooded segment, but from the sums of the runs.
+ */
+bool CCircleDetect::examineRunSegment(int run, float areaRatio) {
+	SRunSegment & source = runSegments[runSegment[findRoot(run)]];
+	if (source.examined || numSegments >= maxSegments) return false;
+	source.examined = true;
+	if (source.size <= minSize) return false;
+	SSegment *segmen = &segmentArray[numSegments++];
+	segmen->valid = false;
+	segmen->round = false;
+	segmen->size = source.size;
+	segmen->maxx = source.maxx;
+	segmen->maxy = source.maxy;
+	segmen->minx = source.minx;
+	segmen->miny = source.miny;
+	segmen->type = source.dark ? 2 : 1;
+	int vx = (segmen->maxx - segmen->minx + 1);
+	int vy = (segmen->maxy - segmen->miny + 1);
+	segmen->x = (segmen->maxx + segmen->minx) / 2;
+	segmen->y = (segmen->maxy + segmen->miny) / 2;
+	segmen->roundness = vx * vy * areaRatio / segmen->size;
+	if (segmen->roundness - circularTolerance < 1.0 && segmen->roundness + circularTolerance > 1.0) {
+		segmen->round = true;
+		segmen->mean = source.moments.sum / segmen->size;
+		return true;
+	}
+	return false;
+}
+
+/**
+ * Every dark segment that looks like a ring is checked for a bright segment at its centre, and the pair for being
+ * concentric and circular, exactly like examinePattern does. The moments come from the sums of the runs instead of from
+ * the pixels in the queue.
+ *
+ * @return                   the number of patterns in found, at most maxFound
+ */
+int CCircleDetect::findPatternsInRuns(CRawImage *image, SSegment *found, int *inner, int maxFound,
+		int & thresholdSum) {
+	int numFound = 0;
+	int searchThreshold = threshold;
+	for (int i = 0; i < (int)runs.size() && numFound < maxFound; i++) {
+		if (!runs[i].dark || runs[i].parent != i) continue;
+		if (!examineRunSegment(i, outerAreaRatio)) continue;
+		SSegment & outerSegment = segmentArray[numSegments - 1];
+		int centre = findRun((int)outerSegment.x, (int)outerSegment.y);
+		if (centre < 0 || runs[centre].dark) continue;
+		int outerRoot = i, innerRoot = findRoot(centre);
+		if (!examineRunSegment(centre, innerAreaRatio)) continue;
+		if (!isConcentric(numSegments - 2, numSegments - 1)) continue;
+
+		measurePattern(runSegments[runSegment[outerRoot]].moments, runSegments[runSegment[innerRoot]].moments);
+		if (segmentArray[numSegments - 1].valid) {
+			inner[numFound] = innerRoot;
+			found[numFound++] = segmentArray[numSegments - 1];
+			thresholdSum += threshold;
+			threshold = searchThreshold;
+		}
+	}
+	return numFound;
+}
+
+//! Make the pixels of the runs of a segment black
+void CCircleDetect::clearRunPixels(CRawImage *image, int root) {
+	int bpp = image->getbpp();
+	for (int i = 0; i < (int)runs.size(); i++) {
+		if (findRoot(i) != root) continue;
+		unsigned char *p = image->data + bpp * (runs[i].y * width + runs[i].x0);
+		int n = runs[i].x1 - runs[i].x0;
+		if (bpp == 2) {
+			for (int x = 0; x < n; x++) p[2 * x] = 0;
+		} else {
+			memset(p, 0, n * bpp);
 		}
 	}
-	bufferCleanup(result);
-	return result;
 }
@@ -9,11 +9,35 @@
 
 #include "CRawImage.h"
 #include "CTimer.h"
+#include "imageStream.h"
 #include <math.h>
-//#define MAX_SEGMENTS 1000
+#include <vector>
+//default number of segments a detector keeps per frame, see setMaxSegments, about 80 bytes each
+#ifndef MAX_SEGMENTS
 #define MAX_SEGMENTS 10000
+#endif
+//fewest segments of the detector of the top of the pyramid
+#define MIN_COARSE_SEGMENTS 100
 #define COLOR_PRECISION 32
 #define COLOR_STEP 8
+//maximum number of patterns that findSegments searches for at once
+#define MAX_TARGETS 8
+//value in the bitplane of a pixel that is not thresholded yet
+#define PLANE_UNKNOWN 2
+//maximum number of times the image is halved for the search of lost patterns
+#define MAX_PYRAMID_LEVELS 2
+//number of rays along which the outer edge of a pattern is traced
+#define CONTOUR_POINTS 32
+//pixels around the predicted bounding box of a tracked pattern that are searched, on top of a quarter of its size
+#define PREDICTION_MARGIN 4
+//weight of the last frame in the velocity of a tracked pattern
+#define MOTION_SMOOTHING 0.5f
+//maximum number of thresholds proposed by the histogram of a frame, Otsu's threshold and those of three classes
+#define MAX_PROPOSALS 3
+//most horizontal stripes the run backend splits the region in, see setStripes
+#define MAX_STRIPES 8
+//fewest rows of a stripe, a small region is split in fewer stripes
+#define MIN_STRIPE_ROWS 16
 
 typedef struct {
 	float x;
@@ -29,20 +53,193 @@ typedef struct {
 	bool valid;
 	float m0, m1;
 	float v0, v1;
+	float circularity;
 } SSegment;
 
+//points on the outer edge of a pattern in image coordinates, with subpixel accuracy
+typedef struct {
+	int count;
+	float x[CONTOUR_POINTS];
+	float y[CONTOUR_POINTS];
+} SContour;
+
+//how segments are found, see setBackend
+typedef enum {
+	SEG_FLOOD_FILL = 0,
+	SEG_RUNS
+} SegmentationBackend;
+
+//sums over the pixels of a segment, from which its mean brightness, centroid and second moments follow
+typedef struct {
+	long long sum;
+	long long sx, sy, sxx, sxy, syy;
+} SMoments;
+
+//constant-velocity model of a tracked pattern, its motion in pixels and the growth of its diameter per frame
+typedef struct {
+	float vx, vy;
+	float scale;
+	bool valid;
+} SMotion;
+
+//horizontal run of pixels [x0,x1) of row y on the same side of the threshold
+typedef struct {
+	short x0, x1;
+	short y;
+	bool dark;
+	int sum;
+	int parent;
+} SRun;
+
+//connected runs, with the sums needed for the size, the mean, and the moments of a segment
+typedef struct {
+	int size;
+	int minx, maxx, miny, maxy;
+	bool dark;
+	bool examined;
+	SMoments moments;
+} SRunSegment;
+
+//the runs of the rows [first,last) of the region of the run backend, built by a task of its own
+struct SStripe {
+	std::vector<SRun> runs;
+	//index of the first run of every row of the stripe, plus one item for the end
+	std::vector<int> rowStart;
+	int first, last;
+	unsigned short *rowValue;
+	unsigned char *rowMask;
+};
+
 class CCircleDetect {
 public:
 	CCircleDetect(int wi, int he, float diamRatio);
 	~CCircleDetect();
 	void bufferCleanup(SSegment init);
 	SSegment findSegment(CRawImage* image, SSegment init);
+	//find up to targets patterns in a single pass over the image, result[i] continues the track of init[i]
+	int findSegments(CRawImage* image, const SSegment *init, SSegment *result, int targets);
+	//flood the segment at ii into segmen, its sums are put in moments if that is given
 	bool examineSegment(CRawImage* image, SSegment *segmen, int ii,
-			float areaRatio);
+			float areaRatio, SMoments *moments = NULL);
 	void setDiameterRatio(float diameter);
+	//SEG_FLOOD_FILL (default) or SEG_RUNS
+	void setBackend(SegmentationBackend backend);
+	inline SegmentationBackend getBackend() { return backend; }
+	//split the region of the run backend in count horizontal stripes that are segmented at the same time by the tasks
+	//of CTaskPool::shared(), 1 (default) segments it in the calling thread only
+	void setStripes(int count);
+	inline int getStripes() { return numStripes; }
+	//threshold the search region in one pass before the flood fill, instead of pixel by pixel while flooding
+	void setBitplane(bool enable);
+	inline bool hasBitplane() { return plane != NULL; }
+	//search lost patterns in the image decimated levels times by 2x2 first, 0 (default) searches at full resolution
+	void setPyramid(int levels);
+	inline int getPyramid() { return pyramidLevels; }
+	//segments that are examined per frame, the search stops when they are used up, MAX_SEGMENTS by default
+	void setMaxSegments(int count);
+	inline int getMaxSegments() { return maxSegments; }
+	//search tracked patterns in a tight window around where their motion model expects them, instead of around their
+	//last position
+	void setPrediction(bool enable);
+	inline bool hasPrediction() { return prediction; }
+	//the segment moved and scaled to where it is expected in the next frame, target is its index in findSegments
+	SSegment predict(const SSegment & segment, int target = 0);
+	//image motion that is expected in the next frame on top of the motion model, e.g. from the odometry of the robot
+	void setMotionHint(float dx, float dy, float scale = 1);
 	bool changeThreshold();
-	bool debug, draw, drawAll;
+	//after the pattern is lost, try the thresholds proposed by the histogram of the frame first (default)
+	inline void setProposals(bool enable) { useProposals = enable; numProposals = proposal = 0; }
+	inline bool hasProposals() { return useProposals; }
+	//thresholds that split the histogram of the image best, the best first, returns how many, 0 without histogram
+	int proposeThresholds(CRawImage *image, int *result);
+	//the outer edge of result i of the last search, only traced if traceContours is set
+	inline const SContour & getContour(int i) { return contours[i]; }
+	//how well a valid pattern fits a circle, 1 for a perfect circle and 0 at the edge of the tolerance
+	inline float getConfidence(const SSegment & segment) {
+		float confidence = 1.0f - fabsf(segment.circularity - 1.0f) / circularityTolerance;
+		return (segment.valid && confidence > 0) ? confidence : 0;
+	}
+	//boxes around the valid segments of the last search, or around all of them with drawAll, see imageStream.h
+	void overlaySegments(ImageOverlay & overlay);
+	bool debug, drawAll;
+	bool traceContours;
 private:
+	/**
+	 * Sum of the colour channels of the pixel at position pos. For a grey image, or a YUYV frame borrowed from the
+	 * camera driver, three times the luminance is used, so the threshold has the same range in all cases.
+	 */
+	inline int brightness(CRawImage* image, int pos) {
+		switch (image->getbpp()) {
+		case 1:
+			return 3 * image->data[pos];
+		case 2:
+			return 3 * image->data[pos * 2];
+		default:
+			ptr = &image->data[pos * 3];
+			return ptr[0] + ptr[1] + ptr[2];
+		}
+	}
+
+	/**
+	 * Whether the pixel at position pos is above the threshold. With the bitplane its precomputed value is used, pixels
+	 * outside of the region it is built for are still thresholded here.
+	 */
+	inline bool bright(CRawImage* image, int pos) {
+		if (plane != NULL && plane[pos] != PLANE_UNKNOWN) return plane[pos];
+		return brightness(image, pos) > threshold;
+	}
+
+	//whether the scan can start a dark segment at pos, with the bitplane every pixel that is not bright is dark
+	inline bool dark(CRawImage* image, int pos) {
+		if (plane != NULL && plane[pos] != PLANE_UNKNOWN) return !plane[pos];
+		return brightness(image, pos) < threshold;
+	}
+
+	//threshold the region of the current frame into the bitplane with the current threshold
+	void buildPlane(CRawImage *image, const ImageRoi & region);
+
+	//flood the dark segment at ii and the bright segment inside it, true if they form a concentric pair
+	bool examinePattern(CRawImage *image, int ii);
+	//check the area ratio and the distance between the centres of two segments in segmentArray
+	bool isConcentric(int outer, int inner);
+	//shape of the concentric pair at the end of segmentArray, marks it valid if it is circular
+	void measurePattern(float sx, float sy, float fm0, float fm1, float fm2, int pixels);
+	//measurePattern from the sums of the outer and the inner segment
+	void measurePattern(const SMoments & outer, const SMoments & inner);
+	//scan the region from start on and add the valid patterns to found, returns the number of patterns in found
+	int scanForPatterns(CRawImage *image, const ImageRoi & region, int start, SSegment *found, int numFound,
+			int targets, int & thresholdSum);
+	//find candidates in the decimated image and scan the windows around them, returns the number of patterns in found
+	int searchPyramid(CRawImage *image, const ImageRoi & region, SSegment *found, int numFound, int targets,
+			int & thresholdSum);
+	//the pixel after ii when scanning the region row by row, wraps around at the end of the region
+	int nextPixel(int ii, const ImageRoi & region);
+	void updateThreshold(bool found, CRawImage *image);
+	//update the motion model of every target that is tracked from init to result
+	void updateMotion(const SSegment *init, const SSegment *result, int targets);
+	//brightness at a point between pixels, interpolated bilinearly
+	float sampleBrightness(CRawImage *image, float x, float y);
+	//find the outer edge of the pattern along rays from its centre
+	void traceContour(CRawImage *image, const SSegment & segment, SContour & contour);
+	void clearSegmentPixels(CRawImage *image);
+	void printSegment(int i);
+
+	//brightness of the pixels [x0,x1) of row y in value and whether they are above the threshold in mask
+	void thresholdRow(CRawImage *image, int y, int x0, int x1, unsigned short *value, unsigned char *mask);
+	//split the rows of the region in runs and join the runs of adjacent rows into segments
+	void buildRuns(CRawImage *image, const ImageRoi & region);
+	//split the rows of a stripe of the region in runs and join the runs of its adjacent rows
+	void buildStripe(CRawImage *image, const ImageRoi & region, SStripe & stripe);
+	//build the stripes [begin,end) of the frame of buildRuns, a range function of CTaskPool::parallelFor
+	static void buildStripes(void *arg, int begin, int end);
+	int findRoot(int run);
+	//the run that contains pixel (x,y), or -1 if it lies outside of the runs
+	int findRun(int x, int y);
+	//fill segmentArray[numSegments] from the segment of the run, false if it is too small or not round
+	bool examineRunSegment(int run, float areaRatio);
+	//find the patterns among the segments of the runs, the index of the root run of their inner circle is put in inner
+	int findPatternsInRuns(CRawImage *image, SSegment *found, int *inner, int maxFound, int & thresholdSum);
+	void clearRunPixels(CRawImage *image, int root);
 
 	bool track;
 	int maxFailed;
@@ -55,13 +252,19 @@ private:
 	int maxThreshold;
 
 	int thresholdStep;
+	//thresholds proposed when the pattern was lost, proposal is the next one to try
+	bool useProposals;
+	int proposals[MAX_PROPOSALS];
+	int numProposals, proposal;
 	float circularTolerance;
 	float circularityTolerance;
 	float ratioTolerance;
 	float centerDistanceToleranceRatio;
 	int centerDistanceToleranceAbs;
 
-	SSegment segmentArray[MAX_SEGMENTS];
+	//maxSegments segments, allocated with the detector
+	SSegment *segmentArray;
+	int maxSegments;
 	bool lastTrackOK;
 	float outerAreaRatio, innerAreaRatio, areasRatio;
 	int queueStart, queueEnd, queueOldStart, numSegments;
@@ -71,9 +274,43 @@ private:
 	CTimer timer;
 	int tima, timb, timc, timd, sizer, sizerAll;
 	float diameterRatio;
-	bool ownBuffer;
-	static int *buffer;
-	static int *queue;
+	SContour contours[MAX_TARGETS];
+	//segment labels and flood fill queue, one item per pixel, every detector has its own
+	int *buffer;
+	int *queue;
+
+	SegmentationBackend backend;
+	std::vector<SRun> runs;
+	//index of the first run of every row, plus one item for the end
+	std::vector<int> rowStart;
+	int firstRow;
+	//segment of every root run, -1 for other runs
+	std::vector<int> runSegment;
+	std::vector<SRunSegment> runSegments;
+	unsigned short *rowValue;
+	unsigned char *rowMask;
+
+	//the first stripe uses rowValue and rowMask
+	int numStripes;
+	SStripe stripes[MAX_STRIPES];
+	//the frame and the region buildRuns segments, for the tasks of the stripes
+	CRawImage *stripeImage;
+	ImageRoi stripeRegion;
+
+	//one byte per pixel, 1 if above planeThreshold, 0 if not, PLANE_UNKNOWN outside of planeRegion
+	unsigned char *plane;
+	int planeThreshold;
+	ImageRoi planeRegion;
+
+	int pyramidLevels;
+	//the detector for the top of the pyramid, pyramid[l] is the image decimated l+1 times
+	CCircleDetect *coarse;
+	CRawImage *pyramid[MAX_PYRAMID_LEVELS];
+
+	bool prediction;
+	SMotion motion[MAX_TARGETS];
+	//only used for the next frame
+	float hintX, hintY, hintScale;
 };
 
 #endif
@@ -7,6 +7,7 @@
 #include <stdio.h>
 #include <iostream>
 #include <string>
+#include <algorithm>
 
 CTransformation::CTransformation(int widthi, int heighti, float diam,
 		RobotBase::RobotType robot_type, bool fullUnbarreli) {
@@ -14,6 +15,12 @@ CTransformation::CTransformation(int widthi, int heighti, float diam,
 	fullUnbarrel = fullUnbarreli;
 	width = widthi;
 	height = heighti;
+	unbarrelInitialized = false;
+	remap = NULL;
+	undistortX = undistortY = NULL;
+	memset(fc, 0, sizeof(fc));
+	memset(cc, 0, sizeof(cc));
+	memset(kc, 0, sizeof(kc));
 	char dummy[1000];
 	FILE* file;
 	std::string filename;
@@ -75,49 +82,166 @@ CTransformation::CTransformation(int widthi, int heighti, float diam,
 //	for (int i = 0;i<6;i++) printf("%05f,",kc[i]);
 	unbarrelInitialized = false;
 
+	buildUndistortTable();
+
 	if (fullUnbarrel) {
 		unbarrelInitialized = true;
-		float ix, iy;
-		float gx, gy, ux, uy;
-		xArray = (float*) malloc(width * height * sizeof(float));
-		yArray = (float*) malloc(width * height * sizeof(float));
-		gArrayX = (float*) malloc(width * height * sizeof(float));
-		gArrayY = (float*) malloc(width * height * sizeof(float));
-		pArray = (int*) malloc(width * height * sizeof(int) * 4);
+		std::string cache = filename.substr(0, filename.rfind('.')) + ".remap";
+		if (!loadRemap(cache.c_str())) {
+			buildRemap();
+			saveRemap(cache.c_str());
+		}
+	}
+	loadCalibration("default.cal");
+}
 
+CTransformation::~CTransformation() {
+	free(remap);
+	free(undistortX);
+	free(undistortY);
+}
+
+/**
+ * For every pixel of the unbarrelled image the pixel of the camera image it comes from, in fixed point. Pixels that
+ * come from outside of the camera image are taken from pixel [0,0], which unbarrel() makes white.
+ */
+void CTransformation::buildRemap() {
+	remap = (SRemap*) malloc(width * height * sizeof(SRemap));
+	for (int y = 0; y < height; y++) {
 		for (int x = 0; x < width; x++) {
-			for (int y = 0; y < height; y++) {
-				xArray[y * width + x] = barrelX(x, y);
-				yArray[y * width + x] = barrelY(x, y);
-				if (xArray[y * width + x] < 0
-						|| xArray[y * width + x] > (width - 1)
-						|| yArray[y * width + x] < 0
-						|| yArray[y * width + x] > (height - 1)) {
-					xArray[y * width + x] = 0;
-					yArray[y * width + x] = 0;
-				}
-				ux = trunc(xArray[y * width + x]);
-				uy = trunc(yArray[y * width + x]);
-				gx = xArray[y * width + x] - ux;
-				gy = yArray[y * width + x] - uy;
-				ix = (int) ux;
-				iy = (int) uy;
-				pArray[y * width + x] = width * iy + ix;
-				gArrayX[y * width + x] = gx;
-				gArrayY[y * width + x] = gy;
+			float bx = barrelX(x, y);
+			float by = barrelY(x, y);
+			if (bx < 0 || bx > (width - 1) || by < 0 || by > (height - 1)) {
+				bx = 0;
+				by = 0;
 			}
+			SRemap & m = remap[y * width + x];
+			m.x = (short) bx;
+			m.y = (short) by;
+			m.wx = (unsigned char) std::min((int) ((bx - m.x) * 256 + 0.5), 255);
+			m.wy = (unsigned char) std::min((int) ((by - m.y) * 256 + 0.5), 255);
 		}
 	}
-	loadCalibration("default.cal");
 }
 
-CTransformation::~CTransformation() {
-	if (unbarrelInitialized) {
-		free(xArray);
-		free(yArray);
-		free(gArrayX);
-		free(gArrayY);
-		free(pArray);
+//! Header of the cache file of the remap table, the table is only valid for the same image size and calibration
+typedef struct {
+	char magic[4];
+	int width, height;
+	float fc[2], cc[2], kc[6];
+} SRemapHeader;
+
+static void fillRemapHeader(SRemapHeader & header, int width, int height, const float *fc, const float *cc,
+		const float *kc) {
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "RMP1", 4);
+	header.width = width;
+	header.height = height;
+	memcpy(header.fc, fc, sizeof(header.fc));
+	memcpy(header.cc, cc, sizeof(header.cc));
+	memcpy(header.kc, kc, sizeof(header.kc));
+}
+
+bool CTransformation::loadRemap(const char *name) {
+	FILE *file = fopen(name, "rb");
+	if (file == NULL) return false;
+	SRemapHeader expected, header;
+	fillRemapHeader(expected, width, height, fc, cc, kc);
+	bool valid = (fread(&header, sizeof(header), 1, file) == 1 && memcmp(&header, &expected, sizeof(header)) == 0);
+	if (valid) {
+		remap = (SRemap*) malloc(width * height * sizeof(SRemap));
+		valid = (fread(remap, sizeof(SRemap), width * height, file) == (size_t) (width * height));
+		if (!valid) {
+			free(remap);
+			remap = NULL;
+		}
+	}
+	fclose(file);
+	return valid;
+}
+
+//! Cache the remap table, if the directory of the calibration is read-only the table is just computed every time
+void CTransformation::saveRemap(const char *name) {
+	FILE *file = fopen(name, "wb");
+	if (file == NULL) return;
+	SRemapHeader header;
+	fillRemapHeader(header, width, height, fc, cc, kc);
+	bool written = (fwrite(&header, sizeof(header), 1, file) == 1
+			&& fwrite(remap, sizeof(SRemap), width * height, file) == (size_t) (width * height));
+	fclose(file);
+	if (!written) {
+		fprintf(stderr, "Could not write the remap table to %s\n", name);
+		unlink(name);
+	}
+}
+
+/**
+ * The undistortion is smooth, so it is sampled every UNDISTORT_GRID pixels and interpolated bilinearly in between,
+ * which replaces the iterations of undistort() by a few multiplications for every point that lies within the image.
+ */
+void CTransformation::buildUndistortTable() {
+	gridWidth = (width - 1) / UNDISTORT_GRID + 2;
+	gridHeight = (height - 1) / UNDISTORT_GRID + 2;
+	undistortX = (undistort_t*) malloc(gridWidth * gridHeight * sizeof(undistort_t));
+	undistortY = (undistort_t*) malloc(gridWidth * gridHeight * sizeof(undistort_t));
+	for (int j = 0; j < gridHeight; j++) {
+		for (int i = 0; i < gridWidth; i++) {
+			float x = (i * UNDISTORT_GRID - cc[0]) / fc[0];
+			float y = (j * UNDISTORT_GRID - cc[1]) / fc[1];
+			undistort(x, y);
+#ifdef FIXED_POINT_MATH
+			undistortX[j * gridWidth + i] = q16_from_float(x);
+			undistortY[j * gridWidth + i] = q16_from_float(y);
+#else
+			undistortX[j * gridWidth + i] = x;
+			undistortY[j * gridWidth + i] = y;
+#endif
+		}
+	}
+}
+
+bool CTransformation::lookupUndistorted(float px, float py, float *x, float *y) {
+	if (undistortX == NULL || px < 0 || py < 0 || px >= width || py >= height) return false;
+#ifdef FIXED_POINT_MATH
+	// the position in the grid in Q16, its integer part is the cell and its fraction the weight
+	q16_t qx = q16_from_float(px) / UNDISTORT_GRID;
+	q16_t qy = q16_from_float(py) / UNDISTORT_GRID;
+	int p = (qy >> 16) * gridWidth + (qx >> 16);
+	q16_t wx = qx & 0xFFFF, wy = qy & 0xFFFF;
+	q16_t top = undistortX[p] + q16_mul(undistortX[p + 1] - undistortX[p], wx);
+	q16_t bottom = undistortX[p + gridWidth] + q16_mul(undistortX[p + gridWidth + 1] - undistortX[p + gridWidth], wx);
+	*x = q16_to_float(top + q16_mul(bottom - top, wy));
+	top = undistortY[p] + q16_mul(undistortY[p + 1] - undistortY[p], wx);
+	bottom = undistortY[p + gridWidth] + q16_mul(undistortY[p + gridWidth + 1] - undistortY[p + gridWidth], wx);
+	*y = q16_to_float(top + q16_mul(bottom - top, wy));
+	return true;
+#else
+	float gx = px / UNDISTORT_GRID;
+	float gy = py / UNDISTORT_GRID;
+	int i = (int) gx;
+	int j = (int) gy;
+	gx -= i;
+	gy -= j;
+	int p = j * gridWidth + i;
+	*x = (undistortX[p] * (1 - gx) + undistortX[p + 1] * gx) * (1 - gy)
+			+ (undistortX[p + gridWidth] * (1 - gx) + undistortX[p + gridWidth + 1] * gx) * gy;
+	*y = (undistortY[p] * (1 - gx) + undistortY[p + 1] * gx) * (1 - gy)
+			+ (undistortY[p + gridWidth] * (1 - gx) + undistortY[p + gridWidth + 1] * gx) * gy;
+	return true;
+#endif
+}
+
+void CTransformation::undistort(float &x, float &y) {
+	float ix, iy, dx, dy, r, rad;
+	ix = x;
+	iy = y;
+	for (int i = 0; i < 5; i++) {
+		r = x * x + y * y;
+		dx = 2 * kc[3] * x * y + kc[4] * (r + 2 * x * x);
+		dy = 2 * kc[4] * x * y + kc[3] * (r + 2 * y * y);
+		rad = 1 + kc[1] * r + kc[2] * r * r + kc[5] * r * r * r;
+		x = (ix - dx) / rad;
+		y = (iy - dy) / rad;
 	}
 }
 
@@ -182,21 +306,14 @@ float CTransformation::unbarrelY(float x, float y) {
 }
 
 void CTransformation::transformXY(float *ax, float *ay) {
-	float x, y, ix, iy, dx, dy, r, rad;
-	*ax = ix = x = (*ax - cc[0]) / fc[0];
-	*ay = iy = y = (*ay - cc[1]) / fc[1];
+	float px = *ax, py = *ay;
+	*ax = (*ax - cc[0]) / fc[0];
+	*ay = (*ay - cc[1]) / fc[1];
 	if (fullUnbarrel)
 		return;
-	for (int i = 0; i < 5; i++) {
-		r = x * x + y * y;
-		dx = 2 * kc[3] * x * y + kc[4] * (r + 2 * x * x);
-		dy = 2 * kc[4] * x * y + kc[3] * (r + 2 * y * y);
-		rad = 1 + kc[1] * r + kc[2] * r * r + kc[5] * r * r * r;
-		x = (ix - dx) / rad;
-		y = (iy - dy) / rad;
-	}
-	*ax = x;
-	*ay = y;
+	if (lookupUndistorted(px, py, ax, ay))
+		return;
+	undistort(*ax, *ay);
 }
 
 float CTransformation::transformX(float xc, float yc) {
@@ -207,25 +324,23 @@ float CTransformation::transformY(float xc, float yc) {
 	return (unbarrelY(xc, yc) - cc[1]) / fc[1];
 }
 
+/**
+ * Bilinear interpolation in fixed point, the four weights add up to 65536.
+ */
 void CTransformation::unbarrel(unsigned char *dst, unsigned char *src) {
 	src[0] = src[1] = src[2] = 255;
-	if (fullUnbarrel) {
-		float gx, gy;
+	if (remap != NULL) {
 		for (int p = 0; p < width * (height - 1); p++) {
-			gx = gArrayX[p];
-			gy = gArrayY[p];
-			dst[3 * p] = src[3 * pArray[p]] * (1 - gx) * (1 - gy)
-					+ src[3 * pArray[p] + 3] * gx * (1 - gy)
-					+ src[3 * pArray[p] + width * 3] * (1 - gx) * gy
-					+ src[3 * pArray[p] + (width + 1) * 3] * gx * gy;
-			dst[3 * p + 1] = src[3 * pArray[p] + 1] * (1 - gx) * (1 - gy)
-					+ src[3 * pArray[p] + 3 + 1] * gx * (1 - gy)
-					+ src[3 * pArray[p] + width * 3 + 1] * (1 - gx) * gy
-					+ src[3 * pArray[p] + (width + 1) * 3 + 1] * gx * gy;
-			dst[3 * p + 2] = src[3 * pArray[p] + 2] * (1 - gx) * (1 - gy)
-					+ src[3 * pArray[p] + 3 + 2] * gx * (1 - gy)
-					+ src[3 * pArray[p] + width * 3 + 2] * (1 - gx) * gy
-					+ src[3 * pArray[p] + (width + 1) * 3 + 2] * gx * gy;
+			const SRemap & m = remap[p];
+			const unsigned char *s = src + 3 * (m.y * width + m.x);
+			int w11 = m.wx * m.wy;
+			int w10 = (m.wx << 8) - w11;
+			int w01 = (m.wy << 8) - w11;
+			int w00 = 65536 - w10 - w01 - w11;
+			for (int c = 0; c < 3; c++) {
+				dst[3 * p + c] = (s[c] * w00 + s[3 + c] * w10 + s[3 * width + c] * w01
+						+ s[3 * width + 3 + c] * w11 + 32768) >> 16;
+			}
 		}
 	} else {
 		fprintf(stdout, "Image unbarrel was not enabled\n");
@@ -302,6 +417,91 @@ void CTransformation::saveCalibration(const char *str) {
 	fclose(file);
 }
 
+/**
+ * The same layout as the Calib_Results.m of the toolbox, which the constructor depends on: it takes the values by their
+ * position after fc, cc and kc. The values are written with 9 digits, so they are read back as the same floats and the
+ * remap table matches the calibration that the constructor reads.
+ */
+bool CTransformation::saveCameraCalibration(const char *name) {
+	FILE* file = fopen(name, "w");
+	if (file == NULL) {
+		fprintf(stderr, "Could not write the calibration to %s\n", name);
+		return false;
+	}
+	fprintf(file, "%% Intrinsic and Extrinsic Camera Parameters\n%%\n");
+	fprintf(file, "%% Fitted to a calibration sequence, in the format of the Calibration Toolbox for Matlab.\n\n\n");
+	fprintf(file, "%%-- Focal length:\nfc = [ %.9g ; %.9g ];\n\n", fc[0], fc[1]);
+	fprintf(file, "%%-- Principal point:\ncc = [ %.9g ; %.9g ];\n\n", cc[0], cc[1]);
+	fprintf(file, "%%-- Skew coefficient:\nalpha_c = 0.000000000000000;\n\n");
+	fprintf(file, "%%-- Distortion coefficients:\nkc = [ %.9g ; %.9g ; %.9g ; %.9g ; %.9g ];\n\n", kc[1], kc[2], kc[3],
+			kc[4], kc[5]);
+	fprintf(file, "%%-- Image size:\nnx = %i;\nny = %i;\n", width, height);
+	fclose(file);
+	if (remap == NULL) buildRemap();
+	std::string cache(name);
+	saveRemap((cache.substr(0, cache.rfind('.')) + ".remap").c_str());
+	return true;
+}
+
+/**
+ * The intrinsics and the distortion replace the ones of the calibration file, which are the starting point of the
+ * fit, and the undistortion tables are built again for them. The ground plane is set from the pose of the grid in
+ * frame reference, or in the first frame if that one is not fitted, as calibrate2D and calibrate3D set it from four
+ * patterns: hom maps canonical camera coordinates onto the grid, and to3D and orig3D turn the result of eigen() into
+ * coordinates of the grid.
+ *
+ * @return                   RMS reprojection error in pixels, or -1 if there are not enough frames with a grid
+ */
+float CTransformation::calibrateSequence(CCalibration & calibration, int reference) {
+	SCameraModel guess;
+	for (int i = 0; i < 2; i++) {
+		guess.fc[i] = fc[i];
+		guess.cc[i] = cc[i];
+	}
+	for (int i = 0; i < 4; i++)
+		guess.kc[i] = kc[i + 1];
+	float error = calibration.fit(guess);
+	if (error < 0) return error;
+	const SCameraModel & camera = calibration.getCamera();
+	for (int i = 0; i < 2; i++) {
+		fc[i] = camera.fc[i];
+		cc[i] = camera.cc[i];
+	}
+	kc[0] = 1.0;
+	for (int i = 0; i < 4; i++)
+		kc[i + 1] = camera.kc[i];
+	kc[5] = 0;
+	free(undistortX);
+	free(undistortY);
+	buildUndistortTable();
+	if (remap != NULL) {
+		free(remap);
+		buildRemap();
+	}
+
+	const SGridPose *pose = calibration.getPose(reference);
+	if (pose == NULL) pose = &calibration.getPoses()[0];
+	double R[9];
+	CCalibration::rotation(pose->omega, R);
+	//eigen() has x along the optical axis, y to the left and z up, column j of R is axis j of the grid in the camera
+	orig3D.x = pose->t[2];
+	orig3D.y = -pose->t[0];
+	orig3D.z = -pose->t[1];
+	for (int j = 0; j < 3; j++) {
+		to3D[j][0] = R[6 + j];
+		to3D[j][1] = -R[j];
+		to3D[j][2] = -R[3 + j];
+	}
+	//the grid is mapped onto canonical coordinates by [r1 r2 t], hom is its inverse
+	double m[9] = { R[0], R[1], pose->t[0], R[3], R[4], pose->t[1], R[6], R[7], pose->t[2] };
+	double inverse[9] = { m[4] * m[8] - m[5] * m[7], m[2] * m[7] - m[1] * m[8], m[1] * m[5] - m[2] * m[4],
+			m[5] * m[6] - m[3] * m[8], m[0] * m[8] - m[2] * m[6], m[2] * m[3] - m[0] * m[5],
+			m[3] * m[7] - m[4] * m[6], m[1] * m[6] - m[0] * m[7], m[0] * m[4] - m[1] * m[3] };
+	for (int i = 0; i < 9; i++)
+		hom[i] = inverse[i] / inverse[8];
+	return error;
+}
+
 //this function if meant for debugging
 float CTransformation::establishError(STrackedObject o) {
 	STrackedObject result;
@@ -501,7 +701,6 @@ STrackedObject CTransformation::eigen(double data[]) {
 
 STrackedObject CTransformation::transform(SSegment segment, bool unbarreli) {
 	float x, y, x1, x2, y1, y2, major, minor, v0, v1;
-	STrackedObject result;
 	fullUnbarrel = unbarreli;
 
 	//Transform to the Canonical camera coordinates
@@ -545,6 +744,108 @@ STrackedObject CTransformation::transform(SSegment segment, bool unbarreli) {
 
 	//transformation to global coordinates
 	double data[] = { a, b, d, b, c, e, d, e, f };
+	return transformEllipse(segment, data, x, y, major, minor);
+}
+
+/**
+ * The moments describe the pattern in the distorted image, and only the centre and the vertices of the axes are
+ * undistorted by transform(segment, false). The contour points are undistorted one by one, so the ellipse fits the
+ * pattern as it would be seen in an unbarrelled image, without unbarrelling the image itself.
+ */
+STrackedObject CTransformation::transform(SSegment segment, const SContour & contour) {
+	double data[9];
+	float x, y, major, minor;
+	fullUnbarrel = false;
+	if (!fitEllipse(contour, data, x, y, major, minor))
+		return transform(segment, false);
+	return transformEllipse(segment, data, x, y, major, minor);
+}
+
+//! Solve the 5x5 system in m, of which the last column is the right-hand side, with partial pivoting
+static bool solve5(double m[5][6], double *result) {
+	for (int i = 0; i < 5; i++) {
+		int pivot = i;
+		for (int j = i + 1; j < 5; j++)
+			if (fabs(m[j][i]) > fabs(m[pivot][i])) pivot = j;
+		if (fabs(m[pivot][i]) < 1e-12) return false;
+		for (int k = 0; k < 6; k++) std::swap(m[i][k], m[pivot][k]);
+		for (int j = i + 1; j < 5; j++) {
+			double factor = m[j][i] / m[i][i];
+			for (int k = i; k < 6; k++) m[j][k] -= factor * m[i][k];
+		}
+	}
+	for (int i = 4; i >= 0; i--) {
+		double sum = m[i][5];
+		for (int k = i + 1; k < 5; k++) sum -= m[i][k] * result[k];
+		result[i] = sum / m[i][i];
+	}
+	return true;
+}
+
+/**
+ * Least squares fit of a x^2 + 2b xy + c y^2 + 2d x + 2e y + f = 0 with a + c = 1, on points that are centred and
+ * scaled for the conditioning. The result is written in the same form as in transform(), (p-c)'A(p-c) - 1 = 0.
+ */
+bool CTransformation::fitEllipse(const SContour & contour, double data[], float & x, float & y, float & major,
+		float & minor) {
+	if (contour.count < CONTOUR_POINTS / 2) return false;
+	float px[CONTOUR_POINTS], py[CONTOUR_POINTS];
+	double mx = 0, my = 0, scale = 0;
+	for (int i = 0; i < contour.count; i++) {
+		px[i] = contour.x[i];
+		py[i] = contour.y[i];
+		transformXY(&px[i], &py[i]);
+		mx += px[i];
+		my += py[i];
+	}
+	mx /= contour.count;
+	my /= contour.count;
+	for (int i = 0; i < contour.count; i++)
+		scale += (px[i] - mx) * (px[i] - mx) + (py[i] - my) * (py[i] - my);
+	scale = sqrt(scale / contour.count);
+	if (scale <= 0) return false;
+
+	double m[5][6];
+	memset(m, 0, sizeof(m));
+	for (int i = 0; i < contour.count; i++) {
+		double u = (px[i] - mx) / scale, v = (py[i] - my) / scale;
+		double row[6] = { u * u - v * v, 2 * u * v, 2 * u, 2 * v, 1, -v * v };
+		for (int j = 0; j < 5; j++)
+			for (int k = 0; k < 6; k++)
+				m[j][k] += row[j] * row[k];
+	}
+	double t[5];
+	if (!solve5(m, t)) return false;
+	double a = t[0], b = t[1], c = 1 - t[0], d = t[2], e = t[3], f = t[4];
+	double det = a * c - b * b;
+	if (det <= 0) return false;
+	//centre of the conic, and its value there, which is negative for an ellipse
+	double cu = -(c * d - b * e) / det, cv = -(a * e - b * d) / det;
+	double k = f + d * cu + e * cv;
+	if (k >= 0) return false;
+	a = a / (-k * scale * scale);
+	b = b / (-k * scale * scale);
+	c = c / (-k * scale * scale);
+	double cx = mx + cu * scale, cy = my + cv * scale;
+
+	data[0] = a;
+	data[1] = data[3] = b;
+	data[4] = c;
+	data[2] = data[6] = -(a * cx + b * cy);
+	data[5] = data[7] = -(b * cx + c * cy);
+	data[8] = a * cx * cx + c * cy * cy + 2 * b * cx * cy - 1.0;
+	x = cx;
+	y = cy;
+	//the semiaxes are one over the square root of the eigenvalues of A
+	double mean = (a + c) / 2, diff = sqrt((a - c) * (a - c) / 4 + b * b);
+	major = 1.0 / sqrt(mean - diff);
+	minor = 1.0 / sqrt(mean + diff);
+	return true;
+}
+
+STrackedObject CTransformation::transformEllipse(SSegment & segment, double data[], float x, float y, float major,
+		float minor) {
+	STrackedObject result;
 	//homographic transform
 	if (transformType == TRANSFORM_2D) {
 		result.x = x;
@@ -10,9 +10,19 @@
 #include <stdio.h>
 #include <math.h>
 #include <unistd.h>
+#include <string>
 #include "CCircleDetect.h"
+#include "CCalibration.h"
 #include "IRobot.h"
 
+//the grid of undistorted coordinates is in Q16.16 when there is no floating point unit
+#ifdef FIXED_POINT_MATH
+#include "fixmath.h"
+typedef q16_t undistort_t;
+#else
+typedef float undistort_t;
+#endif
+
 typedef enum {
 	TRANSFORM_NONE, TRANSFORM_2D, TRANSFORM_3D, TRANSFORM_NUMBER
 } ETransformType;
@@ -25,6 +35,15 @@ typedef struct {
 	float error;
 } STrackedObject;
 
+//source pixel of a pixel of the unbarrelled image, with the weights of its right and lower neighbour out of 256
+typedef struct {
+	short x, y;
+	unsigned char wx, wy;
+} SRemap;
+
+//distance in pixels between the points of the undistortion table
+#define UNDISTORT_GRID 8
+
 class CTransformation {
 public:
 	CTransformation(int widthi, int heighti, float diam, RobotBase::RobotType robot_type, bool fullUnbarreli =
@@ -42,23 +61,42 @@ public:
 
 	void unbarrel(unsigned char* src, unsigned char* dst);
 	STrackedObject transform(SSegment segment, bool unbarrel);
+	//pose from the ellipse that fits the undistorted contour, falls back to the moments of the segment
+	STrackedObject transform(SSegment segment, const SContour & contour);
 	STrackedObject eigen(double data[]);
 	int calibrate3D(STrackedObject *o, float gridDimX, float gridDimY);
 	int calibrate2D(STrackedObject *o, float gridDimX, float gridDimY);
+	//fit the camera to all grids of a calibration sequence, the grid in frame reference becomes the ground plane
+	float calibrateSequence(CCalibration & calibration, int reference);
 	ETransformType transformType;
 	void saveCalibration(const char *str);
 	void loadCalibration(const char *str);
+	//write the camera as the calibration file that the constructor reads, with the remap table next to it
+	bool saveCameraCalibration(const char *name);
 
 private:
 	STrackedObject normalize(STrackedObject o);
 	float establishError(STrackedObject o);
 	STrackedObject transform3D(STrackedObject o);
 	STrackedObject transform2D(STrackedObject o);
-	float *xArray;
-	float *yArray;
-	float *gArrayX;
-	float *gArrayY;
-	int *pArray;
+	//fit a conic to the undistorted contour in canonical camera coordinates, false if it is not an ellipse
+	bool fitEllipse(const SContour & contour, double data[], float & x, float & y, float & major, float & minor);
+	//the pose of the pattern from the ellipse, given as conic and as centre and semiaxes
+	STrackedObject transformEllipse(SSegment & segment, double data[], float x, float y, float major, float minor);
+	//undistort a point in canonical camera coordinates, iteratively
+	void undistort(float &x, float &y);
+	//undistorted canonical coordinates of pixel [px,py] from the table, false if the point is outside of it
+	bool lookupUndistorted(float px, float py, float *x, float *y);
+	void buildUndistortTable();
+	void buildRemap();
+	//read the remap table from the cache file, false if it does not exist or is of another calibration
+	bool loadRemap(const char *name);
+	void saveRemap(const char *name);
+
+	SRemap *remap;
+	undistort_t *undistortX;
+	undistort_t *undistortY;
+	int gridWidth, gridHeight;
 
 	float to3D[3][3];
 	float hom[9];
@@ -7,12 +7,18 @@
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <algorithm>
 #include "termios.h"
 #include <signal.h>
 #include <messageDataType.h>
 #include <CRawImage.h>
 #include <CImageServer.h>
 #include <CCamera.h>
+#include <CStreamLog.h>
+#include <CFrameLog.h>
+#include <CLatencyTrace.h>
+#include <CStageStats.h>
+#include <CImageWriter.h>
 #include <CTimer.h>
 #include <CCircleDetect.h>
 #include <CTransformation.h>
@@ -31,10 +37,16 @@
 #define VIDEO_DEVICE "/dev/video0"
 #define IMAGE_WIDTH 640
 #define IMAGE_HEIGHT 480
+//pixels around the tracked pattern that are converted on top of half its size, to allow for motion between frames
+#define ROI_MARGIN 16
 #define TRACKED_CIRC_DIAMETER_MAP 0.19
 #define INNER_CIRC_DIAMETER_MAP 0.1
 #define TRACKED_CIRC_DIAMETER_DOCK 0.012
 #define INNER_CIRC_DIAMETER_DOCK 0.004
+//times the image is halved to search for lost docking patterns, see CCircleDetect::setPyramid
+#define DOCKING_PYRAMID_LEVELS 1
+//pixels of the arms of the cross at a detected pattern in the overlay of a streamed frame
+#define OVERLAY_CROSS_SIZE 6
 #define PI 3.14159265
 
 #define DEBUGSTRING NAME << '[' << getpid() << "] " << __func__ << "(): "
@@ -56,12 +68,22 @@ CTimer* timer;
 
 //camera server and image
 CRawImage* image;
-sem_t imageSem;
+CFramePublisher* frames;
 CImageServer* image_server;
 CCamera* camera = NULL;
 bool swapIMG = false;
 std::string portIS;
 bool streamVideo = false;
+//what the detection found in the frame that was published last, the image server streams it along with the frames
+ImageOverlay overlay;
+//capture in a background thread, so detection overlaps with capturing the next frame
+bool useGrabber = true;
+//without grabber, detect directly on the frame in the driver buffer, falls back to a copy if that is not possible
+bool zeroCopy = true;
+//records the frames and messages of the run if STREAM_LOG is set, NULL otherwise
+CStreamLog* recorder = NULL;
+//records every detection if FRAME_LOG is set, NULL otherwise
+CFrameLog* frameLog = NULL;
 
 //cicrcle detector for mapping
 CCircleDetect* circle_detector;
@@ -71,13 +93,22 @@ SSegment currentSegment;
 SSegment lastSegment;
 RobotBase::RobotType robot_type;
 RobotBase* robot;
-//cicrcle detector for docking
-CCircleDetect *detectorArray[MAX_DOCKING_PATTERNS];
-STrackedObject objectArray[MAX_DOCKING_PATTERNS];
-SSegment currentSegmentArray[MAX_DOCKING_PATTERNS];
-SSegment lastSegmentArray[MAX_DOCKING_PATTERNS];
+//cicrcle detector for docking, finds all patterns in one pass
+CCircleDetect *docking_detector;
+//MAX_DOCKING_PATTERNS are tracked, or all that findSegments can find in batch mode
+STrackedObject objectArray[MAX_TARGETS];
+SSegment currentSegmentArray[MAX_TARGETS];
+SSegment lastSegmentArray[MAX_TARGETS];
+//send all detections of a frame in one MSG_CAM_DETECTED_BATCH, see MSG_CAM_BATCH_MODE
+bool batchMode = false;
+uint32_t frameNumber = 0;
+//segment with the run backend in this many stripes at the same time if DETECT_STRIPES is set, see setStripes
+int detectStripes = 1;
 
 bool stop = false;
+
+//! Got MSG_STANDBY, so look for MSG_START every STANDBY_POLL_PERIOD while there is no task
+bool standby = false;
 void interrupt_signal_handler(int signal) {
 	if (signal == SIGINT) {
 		//RobotBase::MSPReset();
@@ -94,9 +125,7 @@ void switchActualTask(ActualCameraUsage newTask) {
 		 */
 		switch (actualTask) {
 		case DETECT_DOCKING: {
-			for (int i = 0; i < MAX_DOCKING_PATTERNS; i++) {
-				delete detectorArray[i];
-			}
+			delete docking_detector;
 			delete circle_trans;
 		}
 			break;
@@ -121,9 +150,17 @@ void switchActualTask(ActualCameraUsage newTask) {
 			circle_trans = new CTransformation(IMAGE_WIDTH, IMAGE_HEIGHT,
 					TRACKED_CIRC_DIAMETER_DOCK, robot_type);
 
-			for (int i = 0; i < MAX_DOCKING_PATTERNS; i++)
-				detectorArray[i] = new CCircleDetect(IMAGE_WIDTH, IMAGE_HEIGHT,
-						INNER_CIRC_DIAMETER_DOCK / TRACKED_CIRC_DIAMETER_DOCK);
+			docking_detector = new CCircleDetect(IMAGE_WIDTH, IMAGE_HEIGHT,
+					INNER_CIRC_DIAMETER_DOCK / TRACKED_CIRC_DIAMETER_DOCK);
+			docking_detector->setPyramid(DOCKING_PYRAMID_LEVELS);
+			docking_detector->setPrediction(true);
+			docking_detector->traceContours = true;
+			if (detectStripes > 1) {
+				docking_detector->setBackend(SEG_RUNS);
+				docking_detector->setStripes(detectStripes);
+			}
+			for (int i = 0; i < MAX_TARGETS; i++)
+				currentSegmentArray[i].valid = false;
 		}
 			;
 			break;
@@ -132,6 +169,12 @@ void switchActualTask(ActualCameraUsage newTask) {
 					TRACKED_CIRC_DIAMETER_MAP, robot_type);
 			circle_detector = new CCircleDetect(IMAGE_WIDTH, IMAGE_HEIGHT,
 					INNER_CIRC_DIAMETER_MAP / TRACKED_CIRC_DIAMETER_MAP);
+			circle_detector->setPrediction(true);
+			circle_detector->traceContours = true;
+			if (detectStripes > 1) {
+				circle_detector->setBackend(SEG_RUNS);
+				circle_detector->setStripes(detectStripes);
+			}
 		}
 			;
 			break;
@@ -147,6 +190,115 @@ void switchActualTask(ActualCameraUsage newTask) {
 	}
 
 	actualTask = newTask;
+	if (camera != NULL && camera->isGrabbing()) camera->setCaptureRoi(ImageRoi());
+}
+
+//the detector only needs the luminance, the image server needs RGB
+CaptureFormat grabFormat() {
+	return streamVideo ? CF_RGB : CF_GREY;
+}
+
+/**
+ * Boxes around the segments of the detector and a cross with the number of every pattern in segments, drawn by the
+ * visualiser over the frame it belongs to. Nothing is drawn into the frame itself.
+ */
+void publishOverlay(uint32_t frame, CCircleDetect *detector, const SSegment *segments, int count) {
+	clearImageOverlay(overlay, frame);
+	detector->overlaySegments(overlay);
+	for (int i = 0; i < count; i++) {
+		if (!segments[i].valid) continue;
+		int x = (int) (segments[i].x + 0.5f), y = (int) (segments[i].y + 0.5f);
+		addImageOverlay(overlay, OVERLAY_CROSS, OVERLAY_RED, x, y, OVERLAY_CROSS_SIZE, 0);
+		addImageOverlay(overlay, OVERLAY_NUMBER, OVERLAY_RED, x + 2, y + 2, i, 0);
+	}
+	frames->publishOverlay(overlay);
+}
+
+//while the pattern is tracked, the grabber only has to convert the part of the frame around where it is expected
+void trackRegion(const SSegment & segment) {
+	if (camera == NULL || !camera->isGrabbing()) return;
+	if (!segment.valid || streamVideo) {
+		camera->setCaptureRoi(ImageRoi());
+		return;
+	}
+	int w = segment.maxx - segment.minx + 1;
+	int h = segment.maxy - segment.miny + 1;
+	camera->setCaptureRoi(ImageRoi(segment.minx, segment.miny, w, h), std::max(w, h) / 2 + ROI_MARGIN);
+}
+
+//start the grabber again in the format that is needed now
+void restartGrabbing() {
+	if (!camera->isGrabbing()) return;
+	camera->stopGrabbing();
+	if (camera->startGrabbing(3, grabFormat()) < 0) {
+		useGrabber = false;
+	}
+}
+
+//reply to MSG_STATS_REQ with the latencies of all stages since the statistics were enabled
+void sendStats() {
+	CStageStats & stats = CStageStats::stats();
+	PipelineStats reply;
+	memset(&reply, 0, sizeof(reply));
+	reply.enabled = stats.isEnabled();
+	reply.frames = stats.getFrames();
+	reply.dropped = stats.getDropped();
+	for (int i = 0; i < STATS_PIPELINE_STAGES && i < PIPELINE_STAGES; i++) {
+		StageSummary summary;
+		stats.getSummary((PipelineStage)i, summary);
+		reply.stages[i].count = summary.count;
+		reply.stages[i].p50 = summary.p50;
+		reply.stages[i].p95 = summary.p95;
+		reply.stages[i].p99 = summary.p99;
+		reply.stages[i].max = summary.max;
+	}
+	message_server->sendMessage(MSG_STATS, &reply, sizeof(PipelineStats));
+}
+
+//start a batch for the frame that is taken from the camera at frameTime
+void beginBatch(DetectionBatch & batch, long long frameTime) {
+	memset(&batch.header, 0, sizeof(DetectionBatchHeader));
+	batch.header.timestamp = frameTime;
+	batch.header.frame = frameNumber;
+}
+
+void addToBatch(DetectionBatch & batch, const STrackedObject & object, float phi, const SSegment & segment,
+		float confidence) {
+	int i = batch.header.count;
+	if (i >= MAX_BATCH_DETECTIONS) return;
+	batch.field[BATCH_X][i] = object.x;
+	batch.field[BATCH_Y][i] = object.y;
+	batch.field[BATCH_Z][i] = object.z;
+	batch.field[BATCH_PHI][i] = phi;
+	batch.field[BATCH_SIZE][i] = segment.size;
+	batch.field[BATCH_CONFIDENCE][i] = confidence;
+	batch.header.count++;
+}
+
+//send the batch, also if it is empty, so the receiver knows the frame is processed
+void sendBatch(const DetectionBatch & batch) {
+	uint8_t buffer[sizeof(DetectionBatch)];
+	int len = packDetectionBatch(batch, buffer);
+	message_server->sendMessage(MSG_CAM_DETECTED_BATCH, buffer, len);
+	if (frameLog != NULL) {
+		FrameLogDetection record;
+		memset(&record, 0, sizeof(record));
+		record.frame = batch.header.frame;
+		record.count = batch.header.count;
+		if (batch.header.count == 0) {
+			frameLog->append(FRAME_LOG_DETECTION, &record, sizeof(record), batch.header.timestamp);
+		}
+		for (int i = 0; i < batch.header.count; i++) {
+			record.index = i;
+			record.x = batch.field[BATCH_X][i];
+			record.y = batch.field[BATCH_Y][i];
+			record.z = batch.field[BATCH_Z][i];
+			record.phi = batch.field[BATCH_PHI][i];
+			record.size = batch.field[BATCH_SIZE][i];
+			record.confidence = batch.field[BATCH_CONFIDENCE][i];
+			frameLog->append(FRAME_LOG_DETECTION, &record, sizeof(record), batch.header.timestamp);
+		}
+	}
 }
 
 /*
@@ -187,8 +339,6 @@ void readMessages() {
 			 break;
 			 }
 
-			sem_init(&imageSem, 0, 1);
-
 			int imgWidth = IMAGE_WIDTH;
 			int imgHeight = IMAGE_HEIGHT;
 			int bytes_per_pixel = 3;
@@ -197,10 +347,25 @@ void readMessages() {
 			std::ostringstream msg; msg.clear(); msg.str("");
 			msg << NAME << '[' << getpid() << "] ";
 			camera->setLogPrefix(msg.str());
+			// use an environmental variable CAMERA_REPLAY to take the frames from a log, CAMERA_REPLAY_SPEED is 1 by default
+			char *str_replay = getenv("CAMERA_REPLAY");
+			if (str_replay) {
+				char *str_speed = getenv("CAMERA_REPLAY_SPEED");
+				camera->replayInit(str_replay, str_speed ? atof(str_speed) : 1);
+			}
+			// use an environmental variable SAVE_IMAGES (raw, pnm, or bmp) to write every frame to disk in the background
+			char *str_save = getenv("SAVE_IMAGES");
+			if (str_save) {
+				SaveFormat format = SF_RAW;
+				if (!strcmp(str_save, "pnm")) format = SF_PNM;
+				else if (!strcmp(str_save, "bmp")) format = SF_BMP;
+				camera->saveImages(true, format);
+			}
 
 			image = new CRawImage(imgWidth, imgHeight, bytes_per_pixel);
 
-			image_server = new CImageServer(&imageSem, image);
+			frames = new CFramePublisher(imgWidth, imgHeight, bytes_per_pixel);
+			image_server = new CImageServer(frames);
 
 			std::cout << DEBUG << "Possible image server on port " << portIS
 					<< std::endl;
@@ -213,6 +378,9 @@ void readMessages() {
 			printf("%sStart %s\n", debug_str.c_str(), NAME);
 			int cameraDeviceHandler;
 			camera->Start(VIDEO_DEVICE, cameraDeviceHandler);
+			if (useGrabber && camera->startGrabbing(3, grabFormat()) < 0) {
+				useGrabber = false;
+			}
 			actualTask = DETECT_NO_TASK;
 			message_server->sendMessage(MSG_ACKNOWLEDGE, NULL, 0);
 		}
@@ -226,6 +394,12 @@ void readMessages() {
 		}
 			;
 			break;
+		case MSG_STANDBY: {
+			standby = (message.len < 1 || message.data[0] != 0);
+			message_server->sendMessage(MSG_ACKNOWLEDGE, NULL, 0);
+		}
+			;
+			break;
 		case MSG_QUIT: {
 			printf("%sQuit %s\n", debug_str.c_str(), NAME);
 			switchActualTask(DETECT_NO_TASK);
@@ -266,6 +440,7 @@ void readMessages() {
 			if (!streamVideo) {
 				streamVideo = true;
 				image_server->initServer(portIS.c_str());
+				restartGrabbing();
 			}
 			message_server->sendMessage(MSG_ACKNOWLEDGE, NULL, 0);
 		}
@@ -276,11 +451,34 @@ void readMessages() {
 			if (streamVideo) {
 				streamVideo = false;
 				image_server->stopServer();
+				restartGrabbing();
 			}
 			message_server->sendMessage(MSG_ACKNOWLEDGE, NULL, 0);
 		}
 			;
 			break;
+		case MSG_CAM_BATCH_MODE: {
+			if (message.len == 1) {
+				batchMode = message.data[0];
+				printf("%s%s batch mode\n", debug_str.c_str(), batchMode ? "Enable" : "Disable");
+				// the number of docking patterns that is tracked changes
+				for (int i = 0; i < MAX_TARGETS; i++)
+					currentSegmentArray[i].valid = false;
+			}
+			message_server->sendMessage(MSG_ACKNOWLEDGE, NULL, 0);
+		}
+			;
+			break;
+		case MSG_STATS_REQ: {
+			if (message.len == 1) {
+				bool enable = message.data[0];
+				printf("%s%s latency statistics\n", debug_str.c_str(), enable ? "Enable" : "Disable");
+				CStageStats::stats().setEnabled(enable);
+			}
+			sendStats();
+		}
+			;
+			break;
 		default:
 			break;
 		}
@@ -288,6 +486,11 @@ void readMessages() {
 
 }
 
+//! Called for every message of the jockey, on the IPC thread for the incoming ones
+static void recordMessage(int type, const void *data, int len, bool outgoing, void *log) {
+	((CStreamLog*)log)->append(STREAM_LOG_MESSAGE, type, data, len, 0, outgoing ? STREAM_LOG_OUTGOING : 0);
+}
+
 /**
  * Initializes 
  */
@@ -320,43 +523,152 @@ int main(int argc, char **argv) {
 	std::cout << DEBUG << "Initialize CMessageServer" << std::endl;
 	message_server->initServer(portMS.c_str());
 
-	while (!stop) {
-		if (camera!=NULL && !camera->stopped && (actualTask != DETECT_NO_TASK || streamVideo)) {
-			//camera->renewImage(image,true);
-			camera->renewImage(image, true,false);
+	// use an environmental variable STREAM_LOG to record the run, for example STREAM_LOG=/data/log/cameradetection
+	char *str_stream_log = getenv("STREAM_LOG");
+	if (str_stream_log) {
+		recorder = new CStreamLog();
+		if (recorder->open(str_stream_log)) {
+			std::cout << DEBUG << "Record to " << str_stream_log << std::endl;
+			message_server->setTap(recordMessage, recorder);
+		} else {
+			delete recorder;
+			recorder = NULL;
 		}
+	}
+
+	// FRAME_LOG=/data/log/detections.flog records only the detections, for framelogcsv
+	char *str_frame_log = getenv("FRAME_LOG");
+	if (str_frame_log) {
+		frameLog = new CFrameLog();
+		if (frameLog->open(str_frame_log)) {
+			std::cout << DEBUG << "Log the detections to " << str_frame_log << std::endl;
+		} else {
+			delete frameLog;
+			frameLog = NULL;
+		}
+	}
+
+	// DETECT_STRIPES=4 segments the frames in 4 stripes on the cores of the task pool (TASK_POOL_THREADS), the flood
+	// fill is used if it is not set
+	char *str_stripes = getenv("DETECT_STRIPES");
+	if (str_stripes) {
+		detectStripes = atoi(str_stripes);
+		std::cout << DEBUG << "Segment in " << detectStripes << " stripes" << std::endl;
+	}
+
+	while (!stop) {
+		// handle messages first, a MSG_STOP may not arrive while a frame from the driver is borrowed
 		readMessages();
+		// a grab that hangs, as in renewImage, stops the heartbeat and CEquids restarts the jockey
+		message_server->heartbeat(actualTask != DETECT_NO_TASK || streamVideo);
+		bool borrowed = false;
+		//the number of the frame if it is published for the image server, 0 if not
+		uint32_t published = 0;
+		CRawImage *frame = image;
+		if (camera!=NULL && camera->isGrabbing() && (actualTask != DETECT_NO_TASK || streamVideo)) {
+			CRawImage *latest = camera->waitNextFrame();
+			if (latest != NULL) {
+				frame = latest;
+				if (streamVideo) {
+					// the image server sends from its own snapshot, a slow client does not hold up detection
+					frames->publish(frame);
+					published = frames->latest();
+				}
+			}
+		} else if (camera!=NULL && !camera->stopped && (actualTask != DETECT_NO_TASK || streamVideo)) {
+			// the image server and the recorder need RGB frames, so only borrow the YUYV frame when neither runs
+			if (zeroCopy && !streamVideo && recorder == NULL) {
+				borrowed = (camera->borrowImage(image) == 0);
+				if (!borrowed) {
+					std::cout << DEBUG << "Cannot borrow frames from the camera, copy them instead" << std::endl;
+					zeroCopy = false;
+				}
+			}
+			if (!borrowed) {
+				//camera->renewImage(image,true);
+				camera->renewImage(image, true,false);
+			}
+		}
+		// the time the camera handed out the frame, it traces the detections down to the motors, see CLatencyTrace.h
+		long long frameTime = (frame->captured != 0) ? frame->captured : CStageStats::now();
+		frameNumber++;
+		if (recorder != NULL && camera != NULL && (actualTask != DETECT_NO_TASK || streamVideo)) {
+			recorder->appendFrame(0, frame->data, frame->getwidth(), frame->getheight(), frame->getbpp(), frameNumber,
+					frameTime);
+		}
+		if (frame->corrupt && actualTask != DETECT_NO_TASK) {
+			// too many rows of the frame were corrupt to repair them, the tracks go on in the next frame
+			CStageStats::stats().countDropped();
+			if (borrowed) camera->releaseImage(image);
+			continue;
+		}
 		switch (actualTask) {
 		case DETECT_MAPPING: {
 			lastSegment = currentSegment;
-			currentSegment = circle_detector->findSegment(image, lastSegment);
+			{
+				CStageTimer timer(STAGE_DETECT);
+				currentSegment = circle_detector->findSegment(frame, lastSegment);
+			}
+			traceHop(frameTime, TRACE_DETECTED);
+			trackRegion(circle_detector->predict(currentSegment));
+			if (published != 0) publishOverlay(published, circle_detector, &currentSegment, 1);
 			if (currentSegment.valid) {
-				o = circle_trans->transform(currentSegment, false);
+				{
+					CStageTimer timer(STAGE_TRANSFORM);
+					o = circle_trans->transform(currentSegment, circle_detector->getContour(0));
+				}
 				int sign = (o.roll > 0) ? -1 : 1;
 				DetectedBlob blob = { o.x, o.y, o.z, o.pitch * PI / 180 * sign };
 				DetectedBlobWSize blobWSize = { 1, { o.x, o.y, o.z, o.pitch * PI
 						/ 180 * sign } };
+				blobWSize.timestamp = frameTime;
 				//	printf("%f %f %f %f\n",blob.x,blob.y,blob.z,blob.phi);
 				//		std::cout << "MSG_CAM_DETECTED_BLOB_SIZE " << sizeof(DetectedBlobWSize) << std::endl;
-				message_server->sendMessage(MSG_CAM_DETECTED_BLOB, &blobWSize,
-						sizeof(DetectedBlobWSize));
+				CStageTimer timer(STAGE_SEND);
+				if (batchMode) {
+					DetectionBatch batch;
+					beginBatch(batch, frameTime);
+					addToBatch(batch, o, blob.phi, currentSegment, circle_detector->getConfidence(currentSegment));
+					sendBatch(batch);
+				} else {
+					message_server->sendMessage(MSG_CAM_DETECTED_BLOB, &blobWSize,
+							sizeof(DetectedBlobWSize));
+				}
+			} else if (batchMode) {
+				CStageTimer timer(STAGE_SEND);
+				DetectionBatch batch;
+				beginBatch(batch, frameTime);
+				sendBatch(batch);
 			} else {
 				//	printf("NULL blob\n");
+				CStageTimer timer(STAGE_SEND);
 				message_server->sendMessage(MSG_CAM_DETECTED_BLOB, NULL, 0);
 			}
+			traceHop(frameTime, TRACE_SENT);
+			CStageStats::stats().countFrame();
 		}
 			break;
 		case DETECT_DOCKING: {
-			DetectedBlob blobArray[MAX_DOCKING_PATTERNS];
+			int targets = batchMode ? MAX_TARGETS : MAX_DOCKING_PATTERNS;
+			DetectedBlob blobArray[MAX_TARGETS];
+			DetectionBatch batch;
+			beginBatch(batch, frameTime);
 			int pocet = 0;
-			for (int i = 0; i < MAX_DOCKING_PATTERNS; i++) {
+			for (int i = 0; i < targets; i++)
 				lastSegmentArray[i] = currentSegmentArray[i];
-				currentSegmentArray[i] = detectorArray[i]->findSegment(image,
-						lastSegmentArray[i]);
-
+			{
+				CStageTimer timer(STAGE_DETECT);
+				docking_detector->findSegments(frame, lastSegmentArray, currentSegmentArray,
+						targets);
+			}
+			traceHop(frameTime, TRACE_DETECTED);
+			if (published != 0) publishOverlay(published, docking_detector, currentSegmentArray, targets);
+			for (int i = 0; i < targets; i++) {
 				if (currentSegmentArray[i].valid) {
-					objectArray[i] = circle_trans->transform(
-							currentSegmentArray[i], false);
+					CStageTimer timer(STAGE_TRANSFORM);
+					objectArray[i] = circle_trans->transform(currentSegmentArray[i],
+							docking_detector->getContour(i));
+					timer.stop();
 					blobArray[pocet].x = objectArray[i].x;
 					blobArray[pocet].y = objectArray[i].y;
 					blobArray[pocet].z = objectArray[i].z;
@@ -364,12 +676,18 @@ int main(int argc, char **argv) {
 							(objectArray[i].roll > 0) ?
 									-objectArray[i].pitch * PI / 180.0 :
 									objectArray[i].pitch * PI / 180.0;
+					addToBatch(batch, objectArray[i], blobArray[pocet].phi, currentSegmentArray[i],
+							docking_detector->getConfidence(currentSegmentArray[i]));
 					pocet++;
 				}
 			}
-			if (pocet != 0) {
+			CStageTimer timer(STAGE_SEND);
+			if (batchMode) {
+				sendBatch(batch);
+			} else if (pocet != 0) {
 				DetectedBlobWSizeArray blobArrayWSize;
 				blobArrayWSize.size = pocet;
+				blobArrayWSize.timestamp = frameTime;
 				for (int var = 0; var < pocet; ++var) {
 					blobArrayWSize.detectedBlobArray[var] = blobArray[var];
 					//		printf("%f %f %f %f\n",blobArrayWSize.detectedBlobArray[var].x,blobArrayWSize.detectedBlobArray[var].y,blobArrayWSize.detectedBlobArray[var].z,blobArrayWSize.detectedBlobArray[var].phi);
@@ -380,6 +698,9 @@ int main(int argc, char **argv) {
 				message_server->sendMessage(MSG_CAM_DETECTED_BLOB_ARRAY, NULL,
 						0);
 			}
+			timer.stop();
+			traceHop(frameTime, TRACE_SENT);
+			CStageStats::stats().countFrame();
 		}
 			break;
 		case DETECT_STAIR: {
@@ -388,13 +709,21 @@ int main(int argc, char **argv) {
 			break;
 		default: {
 			//		printf("No actual Task\n");
-			usleep(100000);
+			usleep(standby ? STANDBY_POLL_PERIOD : 100000);
 		}
 			;
 			break;
 		}
+		if (borrowed) {
+			camera->releaseImage(image);
+		}
 	}
 	std::cout << DEBUG << "Stopping camera detection jockey" << std::endl;
+	CImageWriter::writer().flush();
+	CImagePool::pool().printStatistics();
+	CImageWriter::writer().printStatistics();
+	CStageStats::stats().printStatistics();
+	if (frameLog != NULL) frameLog->close();
 	return 0;
 }
 
@@ -0,0 +1,85 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Own the camera and serve its frames to all jockeys at the same time
+ * @file CameraServerController.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#include <CameraServerController.h>
+
+#include <iostream>
+#include <sstream>
+
+//! The name of the controller can be used for controller selection
+static const std::string NAME = "CameraServer";
+
+//! Convenience function for printing to standard out
+#define DEBUG NAME << '[' << getpid() << "] " << __func__ << "(): "
+
+CameraServerController::CameraServerController(): camera(NULL), device("/dev/video0"), segment(SHARED_FRAMES_NAME),
+		width(640), height(480), dropped(0) {
+}
+
+CameraServerController::~CameraServerController() {
+	delete camera;
+}
+
+void CameraServerController::configure(const std::string & device, int width, int height,
+		const std::string & segment) {
+	this->device = device;
+	this->width = width;
+	this->height = height;
+	this->segment = segment;
+}
+
+/**
+ * The camera is opened only once, a MSG_INIT that comes again keeps serving.
+ */
+void CameraServerController::initRobotPeriphery() {
+	if (camera != NULL) return;
+	camera = new CCamera();
+	std::ostringstream prefix;
+	prefix << NAME << '[' << getpid() << "] ";
+	camera->setLogPrefix(prefix.str());
+	camera->setVerbosity(log_level);
+	camera->Init(width, height);
+	int fd;
+	if (camera->Start(device.c_str(), fd) < 0 || camera->startServing(segment.c_str()) < 0) {
+		std::cerr << DEBUG << "Can not serve the frames of " << device << " in " << segment << std::endl;
+		return;
+	}
+	std::cout << DEBUG << "Serve the frames of " << device << " in " << segment << std::endl;
+}
+
+void CameraServerController::tick() {
+	if (camera == NULL) return;
+	uint32_t total = camera->getServerDropped();
+	if (total != dropped) {
+		std::cout << DEBUG << "Dropped " << total - dropped << " frames, the consumers held all slots" << std::endl;
+		dropped = total;
+	}
+}
+
+void CameraServerController::onQuit() {
+	if (camera != NULL) camera->Stop();
+	CController::onQuit();
+}
@@ -0,0 +1,69 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Own the camera and serve its frames to all jockeys at the same time
+ * @file CameraServerController.h
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#ifndef CAMERASERVERCONTROLLER_H_
+#define CAMERASERVERCONTROLLER_H_
+
+#include <CCamera.h>
+
+#include <CController.h>
+
+#include <string>
+
+/**
+ * The camera server opens the camera after MSG_INIT and puts its frames in shared memory until MSG_QUIT, see
+ * CCamera::startServing. Jockeys that run with CAMERA_SHARED set, such as cameradetection and laserscan, take their
+ * frames from there, so they can run at the same time and do not open and close the device when they are switched.
+ * MSG_START and MSG_STOP only switch the report of the frames that are dropped.
+ */
+class CameraServerController: public CController {
+public:
+	CameraServerController();
+
+	virtual ~CameraServerController();
+
+	//! The device, the dimensions and the segment, before MSG_INIT
+	void configure(const std::string & device, int width, int height, const std::string & segment);
+
+	//! Open the camera and start serving
+	void initRobotPeriphery();
+
+	//! Report the frames that were dropped since the last tick
+	void tick();
+
+protected:
+	void onQuit();
+
+private:
+	CCamera *camera;
+	std::string device;
+	std::string segment;
+	int width;
+	int height;
+	uint32_t dropped;
+};
+
+#endif /* CAMERASERVERCONTROLLER_H_ */
@@ -0,0 +1,90 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Jockey that owns the camera and serves its frames to the other jockeys
+ * @file cameraserver.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <iostream>
+
+/***********************************************************************************************************************
+ * Jockey framework includes
+ **********************************************************************************************************************/
+
+#include <CameraServerController.h>
+
+/***********************************************************************************************************************
+ * Debug info
+ **********************************************************************************************************************/
+
+//! The name of the controller can be used for controller selection
+static const std::string NAME = "CameraServer";
+
+//! Convenience function for printing to standard out
+#define DEBUG NAME << '[' << getpid() << "] " << __func__ << "(): "
+
+/***********************************************************************************************************************
+ * Implementation
+ **********************************************************************************************************************/
+
+static CameraServerController *server = NULL;
+
+//! Ctrl+C stops the loop, so the segment is removed and the consumers see the server is gone
+void sigproc(int) {
+	if (server != NULL) server->stopLoop();
+}
+
+/**
+ * Usage: cameraserver PORT [DEVICE [WIDTH HEIGHT [SEGMENT]]], by default /dev/video0 at 640x480 in /equids_camera. Put
+ * it in the jockey file before the jockeys that use the camera and start those with CAMERA_SHARED set.
+ */
+int main(int argc, char **argv) {
+	signal(SIGINT, sigproc);
+
+	std::cout << "################################################################################" << std::endl;
+	std::cout << "Run " << NAME << " compiled at time " << __TIME__ << std::endl;
+	std::cout << "################################################################################" << std::endl;
+
+	CameraServerController controller;
+	server = &controller;
+	controller.parsePort(argc, argv);
+
+	std::string device = (argc > 2) ? argv[2] : "/dev/video0";
+	int width = (argc > 4) ? atoi(argv[3]) : 640;
+	int height = (argc > 4) ? atoi(argv[4]) : 480;
+	std::string segment = (argc > 5) ? argv[5] : SHARED_FRAMES_NAME;
+	if (width <= 0 || height <= 0) {
+		std::cerr << DEBUG << "usage: " << argv[0] << " PORT [DEVICE [WIDTH HEIGHT [SEGMENT]]]" << std::endl;
+		return EXIT_FAILURE;
+	}
+	controller.configure(device, width, height, segment);
+
+	controller.initServer();
+
+	// the frames are served by a thread of the camera, the loop only reports every second while started
+	controller.setCycle(1000000);
+	// deleting the camera with the controller removes the segment
+	return controller.run();
+}
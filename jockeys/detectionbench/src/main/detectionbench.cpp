@@ -0,0 +1,364 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Replay recorded frames through the pattern detection of cameradetection
+ * @file detectionbench.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 14, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Testing
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+/***********************************************************************************************************************
+ * Middleware includes
+ **********************************************************************************************************************/
+
+#include <IRobot.h>
+
+/***********************************************************************************************************************
+ * Jockey framework includes
+ **********************************************************************************************************************/
+
+#include <CRawImage.h>
+#include <CStageStats.h>
+#include <CCircleDetect.h>
+#include <CTransformation.h>
+#include <CCalibration.h>
+
+/***********************************************************************************************************************
+ * Implementation
+ **********************************************************************************************************************/
+
+//! The same sizes as in cameradetection, DOCKING_PATTERNS is MAX_DOCKING_PATTERNS of messageDataType.h
+#define IMAGE_WIDTH 640
+#define IMAGE_HEIGHT 480
+#define TRACKED_CIRC_DIAMETER_MAP 0.19
+#define INNER_CIRC_DIAMETER_MAP 0.1
+#define TRACKED_CIRC_DIAMETER_DOCK 0.012
+#define INNER_CIRC_DIAMETER_DOCK 0.004
+#define DOCKING_PATTERNS 2
+
+//! Frames are kept in memory, so reading the files is not measured, this limits the memory that is used
+#define MAX_FRAMES 500
+
+//! A pattern in the ground truth, in pixels
+struct GroundTruth {
+	int frame;
+	float x, y;
+};
+
+//! Detection accuracy against the ground truth
+struct Accuracy {
+	long found;
+	long falsePositives;
+	long missed;
+	double error;
+	double maxError;
+};
+
+/**
+ * Print the usage of the benchmark.
+ */
+void usage(const char *name) {
+	printf("Usage: %s [options] <directory> <prefix>\n", name);
+	printf("Replays <directory>/<prefix>0000.bmp, <prefix>0001.bmp, etc. through the detector at maximum speed\n");
+	printf("  -d          detect the docking patterns instead of the mapping pattern\n");
+	printf("  -r          use the run-length segmentation backend instead of the flood fill\n");
+	printf("  -b          threshold the search region into a bitplane first\n");
+	printf("  -p levels   search lost patterns in a decimated image first\n");
+	printf("  -l loops    replay all frames this many times (default 10)\n");
+	printf("  -n frames   load at most this many frames (default %i)\n", MAX_FRAMES);
+	printf("  -t file     ground truth, a line \"frame x y\" in pixels for every pattern, frames start at 0\n");
+	printf("  -e pixels   maximum distance of a detection to its ground truth (default 3)\n");
+	printf("  -c type     calibration of the robot type AW, KIT or SC (default SC)\n");
+	printf("  -k CxR      calibrate the camera on a grid of C by R patterns, of at most %i\n", MAX_TARGETS);
+	printf("  -s metres   distance between the patterns of the grid (default 0.1)\n");
+	printf("  -f frame    frame in which the grid lies on the ground plane (default 0)\n");
+	printf("  -o file     calibration to write (default Calib_Results.m), with the .remap and .cal next to it\n");
+}
+
+/**
+ * Read the ground truth. Lines that do not start with three numbers, such as comments, are skipped.
+ *
+ * @param fileName           file with a line "frame x y" for every pattern in a frame
+ * @param truth              the patterns that are read
+ * @return                   success (0), failure (-1)
+ */
+int loadGroundTruth(const char *fileName, std::vector<GroundTruth> & truth) {
+	FILE *file = fopen(fileName, "r");
+	if (file == NULL) {
+		fprintf(stderr, "Cannot open ground truth %s\n", fileName);
+		return -1;
+	}
+	char line[256];
+	while (fgets(line, sizeof(line), file) != NULL) {
+		GroundTruth t;
+		if (sscanf(line, "%i %f %f", &t.frame, &t.x, &t.y) == 3) truth.push_back(t);
+	}
+	fclose(file);
+	printf("Read %i patterns from %s\n", (int)truth.size(), fileName);
+	return 0;
+}
+
+/**
+ * Match the detections of a frame to the nearest pattern in the ground truth that is not matched yet.
+ *
+ * @param frame              index of the frame
+ * @param segments           results of the detector
+ * @param count              number of results, not all of them have to be valid
+ * @param truth              ground truth of all frames
+ * @param tolerance          maximum distance in pixels for a match
+ * @param accuracy           accumulated accuracy
+ */
+void score(int frame, const SSegment *segments, int count, const std::vector<GroundTruth> & truth,
+		float tolerance, Accuracy & accuracy) {
+	std::vector<bool> matched(truth.size(), false);
+	for (int i = 0; i < count; i++) {
+		if (!segments[i].valid) continue;
+		int best = -1;
+		float bestDistance = tolerance;
+		for (int j = 0; j < (int)truth.size(); j++) {
+			if (truth[j].frame != frame || matched[j]) continue;
+			float distance = hypotf(segments[i].x - truth[j].x, segments[i].y - truth[j].y);
+			if (distance <= bestDistance) {
+				bestDistance = distance;
+				best = j;
+			}
+		}
+		if (best < 0) {
+			accuracy.falsePositives++;
+			continue;
+		}
+		matched[best] = true;
+		accuracy.found++;
+		accuracy.error += bestDistance;
+		if (bestDistance > accuracy.maxError) accuracy.maxError = bestDistance;
+	}
+	for (int j = 0; j < (int)truth.size(); j++) {
+		if (truth[j].frame == frame && !matched[j]) accuracy.missed++;
+	}
+}
+
+/**
+ * Calibrate the camera on a sequence in which a grid of patterns is moved in front of it. Every frame in which all
+ * patterns of the grid are found adds them to the calibration, which is fitted to all of them at once afterwards.
+ *
+ * @param frames             the sequence
+ * @param detector           detector for the patterns of the grid
+ * @param transformation     the calibration of the robot type, which the fit starts from
+ * @param cols               patterns in a row of the grid
+ * @param rows               patterns in a column of the grid
+ * @param spacing            distance between the patterns in m
+ * @param reference          frame with the grid on the ground plane
+ * @param output             calibration file to write, the remap table and the ground plane (.cal) are put next to it
+ * @return                   EXIT_SUCCESS or EXIT_FAILURE
+ */
+int calibrate(const std::vector<CRawImage*> & frames, CCircleDetect & detector, CTransformation & transformation,
+		int cols, int rows, float spacing, int reference, const char *output) {
+	CCalibration calibration(IMAGE_WIDTH, IMAGE_HEIGHT, cols, rows, spacing);
+	int targets = cols * rows, grids = 0;
+	SSegment last[MAX_TARGETS], current[MAX_TARGETS];
+	for (int i = 0; i < targets; i++) current[i].valid = false;
+	long long start = CStageStats::now();
+	for (int f = 0; f < (int)frames.size(); f++) {
+		for (int i = 0; i < targets; i++) last[i] = current[i];
+		detector.findSegments(frames[f], last, current, targets);
+		float u[MAX_TARGETS], v[MAX_TARGETS];
+		int found = 0;
+		for (int i = 0; i < targets; i++) {
+			if (!current[i].valid) continue;
+			u[found] = current[i].x;
+			v[found++] = current[i].y;
+		}
+		if (calibration.addGrid(f, u, v, found)) grids++;
+	}
+	long long detected = CStageStats::now();
+	float error = transformation.calibrateSequence(calibration, reference);
+	long long fitted = CStageStats::now();
+	printf("Found the grid in %i of %i frames in %.3f s\n", grids, (int)frames.size(), (detected - start) / 1000000.0);
+	if (error < 0) {
+		fprintf(stderr, "The grid has to be found in at least %i frames\n", CALIBRATION_MIN_FRAMES);
+		return EXIT_FAILURE;
+	}
+	const SCameraModel & camera = calibration.getCamera();
+	printf("Fitted %i patterns in %.3f s, RMS reprojection error %.3f pixels\n", calibration.getPoints(),
+			(fitted - detected) / 1000000.0, error);
+	printf("fc %.2f %.2f, cc %.2f %.2f, kc %.5f %.5f %.5f %.5f\n", camera.fc[0], camera.fc[1], camera.cc[0],
+			camera.cc[1], camera.kc[0], camera.kc[1], camera.kc[2], camera.kc[3]);
+	// a frame that is far off usually has a pattern that is detected at the wrong place
+	const std::vector<SGridPose> & poses = calibration.getPoses();
+	for (int i = 0; i < (int)poses.size(); i++) {
+		if (poses[i].error > 3 * error) printf("Frame %i is off by %.2f pixels\n", poses[i].frame, poses[i].error);
+	}
+	if (calibration.getPose(reference) == NULL) {
+		printf("Frame %i is not fitted, the ground plane is the grid in frame %i\n", reference, poses[0].frame);
+	}
+	if (!transformation.saveCameraCalibration(output)) return EXIT_FAILURE;
+	std::string plane(output);
+	plane = plane.substr(0, plane.rfind('.')) + ".cal";
+	transformation.saveCalibration(plane.c_str());
+	printf("Wrote %s with its remap table, and the ground plane to %s\n", output, plane.c_str());
+	return EXIT_SUCCESS;
+}
+
+/**
+ * The frames are replayed in order, so the detector tracks the patterns from frame to frame as it does on the robot.
+ * Every loop starts without a track. Only the detection and the transformation are timed, with the same stages as
+ * in cameradetection, so the numbers can be compared with MSG_STATS_REQ on a robot.
+ */
+int main(int argc, char **argv) {
+	bool docking = false, bitplane = false;
+	SegmentationBackend backend = SEG_FLOOD_FILL;
+	int pyramid = 0, loops = 10, maxFrames = MAX_FRAMES;
+	float tolerance = 3;
+	const char *truthFile = NULL;
+	RobotBase::RobotType robot_type = RobotBase::SCOUTBOT;
+	int cols = 0, rows = 0, reference = 0;
+	float spacing = 0.1;
+	const char *output = "Calib_Results.m";
+
+	int option;
+	while ((option = getopt(argc, argv, "drbp:l:n:t:e:c:k:s:f:o:h")) != -1) {
+		switch (option) {
+		case 'd': docking = true; break;
+		case 'r': backend = SEG_RUNS; break;
+		case 'b': bitplane = true; break;
+		case 'p': pyramid = atoi(optarg); break;
+		case 'l': loops = atoi(optarg); break;
+		case 'n': maxFrames = atoi(optarg); break;
+		case 't': truthFile = optarg; break;
+		case 'e': tolerance = atof(optarg); break;
+		case 'c':
+			if (strcmp(optarg, "AW") == 0) robot_type = RobotBase::ACTIVEWHEEL;
+			else if (strcmp(optarg, "KIT") == 0) robot_type = RobotBase::KABOT;
+			else robot_type = RobotBase::SCOUTBOT;
+			break;
+		case 'k':
+			if (sscanf(optarg, "%ix%i", &cols, &rows) != 2 || cols < 2 || rows < 2 || cols * rows > MAX_TARGETS) {
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 's': spacing = atof(optarg); break;
+		case 'f': reference = atoi(optarg); break;
+		case 'o': output = optarg; break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (argc - optind != 2) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (maxFrames > MAX_FRAMES) maxFrames = MAX_FRAMES;
+
+	std::vector<GroundTruth> truth;
+	if (truthFile != NULL && loadGroundTruth(truthFile, truth) < 0) return EXIT_FAILURE;
+
+	char name[1000];
+	snprintf(name, sizeof(name), "%s/%s", argv[optind], argv[optind + 1]);
+	std::vector<CRawImage*> frames;
+	while ((int)frames.size() < maxFrames) {
+		CRawImage *frame = new CRawImage(IMAGE_WIDTH, IMAGE_HEIGHT, 3);
+		if (!frame->loadNumberedBmp(name)) {
+			delete frame;
+			break;
+		}
+		frames.push_back(frame);
+	}
+	if (frames.empty()) {
+		fprintf(stderr, "No frames found as %s0000.bmp\n", name);
+		return EXIT_FAILURE;
+	}
+
+	float diameter = docking ? TRACKED_CIRC_DIAMETER_DOCK : TRACKED_CIRC_DIAMETER_MAP;
+	float inner = docking ? INNER_CIRC_DIAMETER_DOCK : INNER_CIRC_DIAMETER_MAP;
+	CTransformation transformation(IMAGE_WIDTH, IMAGE_HEIGHT, diameter, robot_type);
+	CCircleDetect detector(IMAGE_WIDTH, IMAGE_HEIGHT, inner / diameter);
+	detector.setBackend(backend);
+	detector.setBitplane(bitplane);
+	detector.setPyramid(pyramid);
+	detector.traceContours = true;
+	if (cols > 0) {
+		int result = calibrate(frames, detector, transformation, cols, rows, spacing, reference, output);
+		for (int f = 0; f < (int)frames.size(); f++) delete frames[f];
+		return result;
+	}
+	int targets = docking ? DOCKING_PATTERNS : 1;
+
+	printf("Replay %i frames %i times, %s, %s backend, bitplane %s, pyramid %i\n", (int)frames.size(), loops,
+			docking ? "docking" : "mapping", backend == SEG_RUNS ? "run-length" : "flood fill",
+			bitplane ? "on" : "off", pyramid);
+
+	CStageStats & stats = CStageStats::stats();
+	stats.setEnabled(true);
+	Accuracy accuracy;
+	memset(&accuracy, 0, sizeof(accuracy));
+	SSegment last[MAX_TARGETS], current[MAX_TARGETS];
+	STrackedObject object;
+	long long start = CStageStats::now();
+	for (int loop = 0; loop < loops; loop++) {
+		for (int i = 0; i < targets; i++) current[i].valid = false;
+		for (int f = 0; f < (int)frames.size(); f++) {
+			for (int i = 0; i < targets; i++) last[i] = current[i];
+			{
+				CStageTimer timer(STAGE_DETECT);
+				if (docking) {
+					detector.findSegments(frames[f], last, current, targets);
+				} else {
+					current[0] = detector.findSegment(frames[f], last[0]);
+				}
+			}
+			for (int i = 0; i < targets; i++) {
+				if (!current[i].valid) continue;
+				CStageTimer timer(STAGE_TRANSFORM);
+				object = transformation.transform(current[i], detector.getContour(i));
+			}
+			stats.countFrame();
+			// the accuracy does not depend on the loop
+			if (loop == 0 && truthFile != NULL) score(f, current, targets, truth, tolerance, accuracy);
+		}
+	}
+	long long elapsed = CStageStats::now() - start;
+
+	long processed = stats.getFrames();
+	printf("Processed %li frames in %.3f s, %.1f frames/s\n", processed, elapsed / 1000000.0,
+			elapsed > 0 ? processed * 1000000.0 / elapsed : 0.0);
+	stats.printStatistics(stdout);
+	if (truthFile != NULL) {
+		long patterns = accuracy.found + accuracy.missed;
+		printf("Found %li of %li patterns (%.1f%%), missed %li, false positives %li\n", accuracy.found, patterns,
+				patterns > 0 ? 100.0 * accuracy.found / patterns : 0.0, accuracy.missed, accuracy.falsePositives);
+		if (accuracy.found > 0) {
+			printf("Error of the found patterns in pixels: mean %.2f, max %.2f\n", accuracy.error / accuracy.found,
+					accuracy.maxError);
+		}
+	}
+
+	for (int f = 0; f < (int)frames.size(); f++) delete frames[f];
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,264 @@
+/*
+ * CDockingPlanner.cpp
+ *
+ * Planning of the approach to a docking pattern over a lattice of motion primitives.
+ */
+#include "CDockingPlanner.h"
+#include <math.h>
+#include <stdio.h>
+#include <map>
+#include <queue>
+#include <algorithm>
+
+#define HEADING_STEP (2 * M_PI / PLAN_HEADINGS)
+
+static double normalizeAngle(double angle) {
+	while (angle > M_PI)
+		angle -= 2 * M_PI;
+	while (angle <= -M_PI)
+		angle += 2 * M_PI;
+	return angle;
+}
+
+/**
+ * The speeds are those of goSC() and turnSC(), and of goAW() and turnAW(): 20 mm/s at 30 and 31 deg/s at a turn of 30
+ * on the Scout, 33 mm/s at 40 and 22 deg/s at a turn of 30 on the Active Wheel. There are none for the other robots.
+ */
+CDockingPlanner::CDockingPlanner(RobotBase::RobotType robot_type, int approach) {
+	this->approach = approach;
+	switch (robot_type) {
+	case RobotBase::SCOUTBOT:
+		forward = 30;
+		turn = 30;
+		forwardSpeed = 20.0 / 30;
+		turnSpeed = 31.25 * M_PI / 180 / 30;
+		step = 50;
+		radius = 130;
+		break;
+	case RobotBase::ACTIVEWHEEL:
+		forward = 40;
+		turn = 30;
+		forwardSpeed = 33.3 / 40;
+		turnSpeed = 22.2 * M_PI / 180 / 30;
+		step = 60;
+		radius = 160;
+		break;
+	default:
+		return;
+	}
+	primitives.push_back(straight(step));
+	primitives.push_back(straight(step / 4));
+	primitives.push_back(straight(-step));
+	primitives.push_back(arc(1));
+	primitives.push_back(arc(-1));
+	primitives.push_back(turnOnSpot(HEADING_STEP));
+	primitives.push_back(turnOnSpot(-HEADING_STEP));
+}
+
+CDockingPlanner::~CDockingPlanner() {
+}
+
+//! Backwards if length is negative, at twice the cost, as the camera does not see where the robot goes
+DockingPrimitive CDockingPlanner::straight(double length) const {
+	DockingPrimitive result;
+	double speed = forwardSpeed * forward;
+	result.forward = length < 0 ? -forward : forward;
+	result.turn = 0;
+	result.duration = (long) (2e6 * fabs(length) / speed);
+	result.distance = fabs(length) / 1000;
+	result.angle = 0;
+	result.dx = length;
+	result.dy = 0;
+	result.dphi = 0;
+	result.headings = 0;
+	result.cost = length < 0 ? -2 * length : length;
+	return result;
+}
+
+/**
+ * An arc forward by one heading to the side, left if side is positive. One wheel is slowed down by turn percent in
+ * CMotors::wheelSpeeds(), so the turn for the radius follows from the wheel base, which is in turn given by the speed
+ * of the wheels and of the robot on a turn on the spot.
+ */
+DockingPrimitive CDockingPlanner::arc(int side) const {
+	DockingPrimitive result;
+	double base = 2 * forwardSpeed / turnSpeed;
+	int slow = (int) floor(100 * base / (radius + base / 2) + 0.5);
+	double c = slow / 100.0;
+	double r = base * (1 - c / 2) / c;
+	double speed = forwardSpeed * forward * (1 - c / 2);
+	result.forward = forward;
+	result.turn = side * slow;
+	result.duration = (long) (2e6 * r * HEADING_STEP / speed);
+	result.distance = 0;
+	result.angle = HEADING_STEP;
+	result.dx = r * sin(HEADING_STEP);
+	result.dy = side * r * (1 - cos(HEADING_STEP));
+	result.dphi = side * HEADING_STEP;
+	result.headings = side;
+	result.cost = r * HEADING_STEP;
+	return result;
+}
+
+DockingPrimitive CDockingPlanner::turnOnSpot(double angle) const {
+	DockingPrimitive result;
+	result.forward = 0;
+	result.turn = angle < 0 ? -turn : turn;
+	result.duration = (long) (2e6 * fabs(angle) / (turnSpeed * turn));
+	result.distance = 0;
+	result.angle = fabs(angle);
+	result.dx = 0;
+	result.dy = 0;
+	result.dphi = angle;
+	result.headings = (int) floor(angle / HEADING_STEP + 0.5);
+	result.cost = PLAN_TURN_COST * fabs(angle) / HEADING_STEP;
+	return result;
+}
+
+bool CDockingPlanner::free(double x, double y) const {
+	double dx = x - approach - PLAN_BODY;
+	return dx * dx + y * y > PLAN_CLEARANCE * PLAN_CLEARANCE && fabs(x) < PLAN_RANGE && fabs(y) < PLAN_RANGE;
+}
+
+void CDockingPlanner::advance(const PlanPose & from, const DockingPrimitive & primitive, PlanPose & to) const {
+	double c = cos(from.phi), s = sin(from.phi);
+	to.x = from.x + c * primitive.dx - s * primitive.dy;
+	to.y = from.y + s * primitive.dx + c * primitive.dy;
+	to.phi = normalizeAngle(from.phi + primitive.dphi);
+}
+
+/**
+ * Hybrid A*: the poses are continuous, but a cell of PLAN_CELL mm and a heading are expanded only by the cheapest path
+ * that reaches them. The estimate of the rest is the distance to the approach pose, which no path is shorter than.
+ */
+bool CDockingPlanner::plan(const DetectedBlob & blob) {
+	path.clear();
+	poses.clear();
+	if (primitives.empty()) return false;
+
+	// the approach line in the frame of the robot, and the robot in the frame of the approach pose
+	double alpha = atan2(blob.y, blob.x);
+	double psi = alpha - blob.phi * M_PI / 180;
+	double gx = blob.x - approach * cos(psi);
+	double gy = blob.y - approach * sin(psi);
+	PlanPose start;
+	start.x = -cos(psi) * gx - sin(psi) * gy;
+	start.y = sin(psi) * gx - cos(psi) * gy;
+	start.phi = normalizeAngle(-psi);
+	if (!free(start.x, start.y)) return false;
+
+	// onto the lattice
+	int heading = ((int) floor(start.phi / HEADING_STEP + 0.5) + PLAN_HEADINGS) % PLAN_HEADINGS;
+	DockingPrimitive snap = turnOnSpot(normalizeAngle(heading * HEADING_STEP - start.phi));
+	poses.push_back(start);
+	if (fabs(snap.dphi) > 0.01) {
+		path.push_back(snap);
+		start.phi = normalizeAngle(start.phi + snap.dphi);
+		poses.push_back(start);
+	}
+
+	std::vector<Node> nodes;
+	std::map<long, double> visited;
+	NodeOrder order;
+	order.nodes = &nodes;
+	std::priority_queue<int, std::vector<int>, NodeOrder> open(order);
+	Node first;
+	first.pose = start;
+	first.heading = heading;
+	first.cost = 0;
+	first.estimate = hypot(start.x, start.y);
+	first.parent = -1;
+	first.primitive = -1;
+	nodes.push_back(first);
+	open.push(0);
+
+	int goal = -1;
+	for (int expansions = 0; !open.empty() && expansions < PLAN_EXPANSIONS; expansions++) {
+		int current = open.top();
+		open.pop();
+		Node node = nodes[current];
+		if (node.heading == 0 && fabs(node.pose.y) <= PLAN_TOLERANCE && node.pose.x <= 0) {
+			goal = current;
+			break;
+		}
+		for (unsigned int i = 0; i < primitives.size(); i++) {
+			Node next;
+			advance(node.pose, primitives[i], next.pose);
+			PlanPose middle;
+			middle.x = (node.pose.x + next.pose.x) / 2;
+			middle.y = (node.pose.y + next.pose.y) / 2;
+			if (!free(next.pose.x, next.pose.y) || !free(middle.x, middle.y)) continue;
+			next.heading = (node.heading + primitives[i].headings + PLAN_HEADINGS) % PLAN_HEADINGS;
+			next.cost = node.cost + primitives[i].cost;
+			long cx = (long) floor(next.pose.x / PLAN_CELL) + PLAN_RANGE / PLAN_CELL;
+			long cy = (long) floor(next.pose.y / PLAN_CELL) + PLAN_RANGE / PLAN_CELL;
+			long key = (cx * (2 * PLAN_RANGE / PLAN_CELL + 1) + cy) * PLAN_HEADINGS + next.heading;
+			std::map<long, double>::iterator known = visited.find(key);
+			if (known != visited.end() && known->second <= next.cost) continue;
+			visited[key] = next.cost;
+			next.estimate = next.cost + hypot(next.pose.x, next.pose.y);
+			next.parent = current;
+			next.primitive = i;
+			nodes.push_back(next);
+			open.push(nodes.size() - 1);
+		}
+	}
+	if (goal < 0) {
+		path.clear();
+		poses.clear();
+		return false;
+	}
+
+	std::vector<int> chain;
+	for (int n = goal; nodes[n].parent >= 0; n = nodes[n].parent) {
+		chain.push_back(nodes[n].primitive);
+	}
+	std::reverse(chain.begin(), chain.end());
+	for (unsigned int i = 0; i < chain.size(); i++) {
+		append(primitives[chain[i]]);
+	}
+	// along the approach line to the approach pose
+	if (nodes[goal].pose.x < -1) {
+		append(straight(-nodes[goal].pose.x));
+	}
+	for (unsigned int i = poses.size() - 1; i < path.size(); i++) {
+		PlanPose next;
+		advance(poses.back(), path[i], next);
+		poses.push_back(next);
+	}
+	printf("Planned %i primitives from (%.0f, %.0f, %.0f deg), cost %.0f\n", (int) path.size(), poses[0].x,
+			poses[0].y, poses[0].phi * 180 / M_PI, nodes[goal].cost);
+	return true;
+}
+
+//! Straight drives forward one after the other are driven as one
+void CDockingPlanner::append(const DockingPrimitive & primitive) {
+	if (!path.empty() && primitive.turn == 0 && primitive.forward > 0 && path.back().turn == 0
+			&& path.back().forward > 0) {
+		path.back() = straight(path.back().dx + primitive.dx);
+	} else {
+		path.push_back(primitive);
+	}
+}
+
+/**
+ * Inverse of the start pose of plan(): the pattern is at approach on the x axis of the approach pose.
+ */
+DetectedBlob CDockingPlanner::expected(int step) const {
+	DetectedBlob result;
+	const PlanPose & pose = poses[step];
+	double dx = approach - pose.x;
+	double dy = -pose.y;
+	result.x = cos(pose.phi) * dx + sin(pose.phi) * dy;
+	result.y = -sin(pose.phi) * dx + cos(pose.phi) * dy;
+	result.z = 0;
+	result.phi = normalizeAngle(atan2(result.y, result.x) + pose.phi) * 180 / M_PI;
+	return result;
+}
+
+bool CDockingPlanner::deviates(int step, const DetectedBlob & observed) const {
+	DetectedBlob plan = expected(step);
+	double distance = hypot(plan.x, plan.y);
+	double error = hypot(observed.x - plan.x, observed.y - plan.y);
+	return error > PLAN_DEVIATION + PLAN_DEVIATION_SCALE * distance || fabs(observed.phi - plan.phi) > PLAN_DEVIATION_PHI;
+}
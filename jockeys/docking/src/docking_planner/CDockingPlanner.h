@@ -0,0 +1,130 @@
+/*
+ * CDockingPlanner.h
+ *
+ * Planning of the approach to a docking pattern over a lattice of motion primitives.
+ */
+#include "../motor/CMotors.h"
+#include "../eth/messageDataType.h"
+#include <IRobot.h>
+#include <vector>
+
+#ifndef DOCKINGPLANNER_H_
+#define DOCKINGPLANNER_H_
+
+//! Headings of the lattice, a turn primitive turns by one of them
+#define PLAN_HEADINGS 16
+//! Cell in mm of the positions that the search visits once per heading
+#define PLAN_CELL 10
+//! The search gives up after as many states
+#define PLAN_EXPANSIONS 6000
+//! The path stays within this many mm of the approach pose
+#define PLAN_RANGE 2000
+//! Offset in mm to the side of the approach line from which the last straight drive may start
+#define PLAN_TOLERANCE 10
+//! The path keeps this many mm away from the centre of the robot of the pattern, which is PLAN_BODY behind it
+#define PLAN_CLEARANCE 90
+#define PLAN_BODY 60
+//! Cost in mm of a turn on the spot by one heading of the lattice
+#define PLAN_TURN_COST 40
+//! The observation deviates from the plan by more than PLAN_DEVIATION mm and PLAN_DEVIATION_SCALE of the distance,
+//! or by more than PLAN_DEVIATION_PHI degrees in the angle of the pattern
+#define PLAN_DEVIATION 25
+#define PLAN_DEVIATION_SCALE 0.1
+#define PLAN_DEVIATION_PHI 10
+
+/**
+ * A motion of CMotors with its outcome. It ends at the distance or angle of the odometry, the duration only bounds it.
+ */
+struct DockingPrimitive {
+	//! Speeds of CMotors::setSpeeds()
+	int forward;
+	int turn;
+	//! Duration in us, distance in m and angle in rad of the MotorMotion
+	long duration;
+	double distance;
+	double angle;
+	//! The pose at the end in mm and rad, in the frame of the pose at the start
+	double dx;
+	double dy;
+	double dphi;
+	//! Headings of the lattice turned
+	int headings;
+	double cost;
+};
+
+/**
+ * Plans the approach of a robot to a docking pattern, instead of the cycles of turning to the pattern, looking and
+ * driving a bit of dorovnejSC() and dorovnejAW().
+ *
+ * The goal is the approach pose APPROACH_LINE in front of the pattern, facing it. The search runs in the frame of that
+ * pose, over a lattice of PLAN_HEADINGS headings: straight drives, arcs and turns on the spot that each turn by one
+ * heading, precomputed for the type of the robot from the speeds the docking jockey drives with. A turn on the spot
+ * brings the robot onto the lattice first, and a straight drive along the approach line ends the path. The primitives
+ * end on the odometry, so the path is driven without looking at the pattern, and the pattern seen meanwhile is only
+ * compared with where the path expects it.
+ */
+class CDockingPlanner {
+public:
+	//! approach is the distance in mm of the approach pose from the pattern
+	CDockingPlanner(RobotBase::RobotType robot_type, int approach);
+	virtual ~CDockingPlanner();
+	//! The robot has primitives, without them plan() fails
+	inline bool isAvailable() const { return !primitives.empty(); }
+	//! The speeds the primitives are driven with, and the speed in mm/s and rad/s per unit of them
+	inline int getForward() const { return forward; }
+	inline int getTurn() const { return turn; }
+	inline double getForwardSpeed() const { return forwardSpeed; }
+	inline double getTurnSpeed() const { return turnSpeed; }
+	/**
+	 * Plan a path from the robot to the approach pose of the pattern in blob, in mm and degrees as the docking jockey
+	 * stores it. False if there is no path within PLAN_EXPANSIONS.
+	 */
+	bool plan(const DetectedBlob & blob);
+	inline int getLength() const { return path.size(); }
+	inline const DockingPrimitive & getStep(int step) const { return path[step]; }
+	//! The pattern as it should be seen after the first step primitives of the path
+	DetectedBlob expected(int step) const;
+	//! The observation is too far from expected() to go on with the path
+	bool deviates(int step, const DetectedBlob & observed) const;
+private:
+	struct PlanPose {
+		double x;
+		double y;
+		double phi;
+	};
+	struct Node {
+		PlanPose pose;
+		int heading;
+		double cost;
+		double estimate;
+		int parent;
+		int primitive;
+	};
+	struct NodeOrder {
+		const std::vector<Node> *nodes;
+		bool operator()(int a, int b) const { return (*nodes)[a].estimate > (*nodes)[b].estimate; }
+	};
+	int approach;
+	//! Speed of a straight drive in mm/s and of a turn on the spot in rad/s, per unit of forward and turn
+	double forwardSpeed;
+	double turnSpeed;
+	//! The speeds the primitives are driven with, their length in mm and the radius of the arcs in mm
+	int forward;
+	int turn;
+	double step;
+	double radius;
+	std::vector<DockingPrimitive> primitives;
+	std::vector<DockingPrimitive> path;
+	//! The pose before each primitive of the path and at its end, in the frame of the approach pose
+	std::vector<PlanPose> poses;
+
+	DockingPrimitive straight(double length) const;
+	DockingPrimitive arc(int side) const;
+	DockingPrimitive turnOnSpot(double angle) const;
+	//! The position in the frame of the approach pose is clear of the robot of the pattern
+	bool free(double x, double y) const;
+	void append(const DockingPrimitive & primitive);
+	void advance(const PlanPose & from, const DockingPrimitive & primitive, PlanPose & to) const;
+};
+
+#endif /* DOCKINGPLANNER_H_ */
@@ -0,0 +1,99 @@
+/*
+ * CDockingServo.cpp
+ *
+ * Visual servoing to the approach pose of a docking pattern, a new speed command for every detection.
+ */
+#include "CDockingServo.h"
+#include <math.h>
+
+static double normalizeAngle(double angle) {
+	while (angle > M_PI)
+		angle -= 2 * M_PI;
+	while (angle <= -M_PI)
+		angle += 2 * M_PI;
+	return angle;
+}
+
+static int clamp(double value, int limit) {
+	int result = (int) floor(value + 0.5);
+	if (result > limit) return limit;
+	if (result < -limit) return -limit;
+	return result;
+}
+
+CDockingServo::CDockingServo(const CDockingPlanner & planner, int approach): planner(planner) {
+	this->approach = approach;
+	reset();
+}
+
+void CDockingServo::reset() {
+	known = false;
+	x = y = heading = 0;
+	rejected = 0;
+}
+
+/**
+ * The heading to dock with follows from the bearing of the pattern and its angle, as in CDockingPlanner::plan().
+ */
+bool CDockingServo::observe(const DetectedBlob & blob, const double *pose) {
+	double c = cos(pose[2]), s = sin(pose[2]);
+	double ox = pose[0] * 1000 + c * blob.x - s * blob.y;
+	double oy = pose[1] * 1000 + s * blob.x + c * blob.y;
+	double oheading = normalizeAngle(pose[2] + atan2(blob.y, blob.x) - blob.phi * M_PI / 180);
+	if (!known || rejected >= SERVO_REJECTS) {
+		x = ox;
+		y = oy;
+		heading = oheading;
+		known = true;
+		rejected = 0;
+		return true;
+	}
+	if (hypot(ox - x, oy - y) > SERVO_GATE) {
+		rejected++;
+		return false;
+	}
+	rejected = 0;
+	x += SERVO_GAIN * (ox - x);
+	y += SERVO_GAIN * (oy - y);
+	heading = normalizeAngle(heading + SERVO_GAIN * normalizeAngle(oheading - heading));
+	return true;
+}
+
+bool CDockingServo::predict(const double *pose, DetectedBlob & blob) const {
+	if (!known) return false;
+	double c = cos(pose[2]), s = sin(pose[2]);
+	double dx = x - pose[0] * 1000, dy = y - pose[1] * 1000;
+	blob.x = c * dx + s * dy;
+	blob.y = -s * dx + c * dy;
+	blob.z = 0;
+	blob.phi = normalizeAngle(atan2(blob.y, blob.x) - normalizeAngle(heading - pose[2])) * 180 / M_PI;
+	return true;
+}
+
+/**
+ * In polar coordinates of the approach pose: rho is the distance to it, alpha its bearing and beta the heading to
+ * dock with relative to that bearing. The forward speed slows down with rho and with the bearing, so the robot does not
+ * drive off sideways, and the turn brings alpha and beta to 0 together.
+ */
+bool CDockingServo::command(const double *pose, int & forward, int & turn) const {
+	forward = turn = 0;
+	DetectedBlob blob;
+	if (!predict(pose, blob)) return false;
+	double psi = normalizeAngle(atan2(blob.y, blob.x) - blob.phi * M_PI / 180);
+	double gx = blob.x - approach * cos(psi);
+	double gy = blob.y - approach * sin(psi);
+	double rho = hypot(gx, gy);
+	if (rho < SERVO_TOLERANCE && fabs(psi) < SERVO_TOLERANCE_PHI * M_PI / 180) return true;
+
+	double alpha = rho < SERVO_TOLERANCE ? 0 : atan2(gy, gx);
+	double beta = normalizeAngle(psi - alpha);
+	double w = SERVO_K_ALPHA * alpha + SERVO_K_BETA * beta;
+	if (rho < SERVO_TOLERANCE) w = psi;
+	double v = 0;
+	if (fabs(alpha) < SERVO_TURN_FIRST * M_PI / 180) v = SERVO_K_RHO * rho * cos(alpha);
+	forward = clamp(v / planner.getForwardSpeed(), planner.getForward());
+	turn = clamp(w / planner.getTurnSpeed(), planner.getTurn());
+	// a speed that rounds to nothing would stall the robot just before the approach pose
+	if (forward == 0 && turn == 0) turn = (w < 0) ? -1 : 1;
+	return false;
+}
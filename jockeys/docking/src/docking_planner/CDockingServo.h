@@ -0,0 +1,69 @@
+/*
+ * CDockingServo.h
+ *
+ * Visual servoing to the approach pose of a docking pattern, a new speed command for every detection.
+ */
+#include "CDockingPlanner.h"
+
+#ifndef DOCKINGSERVO_H_
+#define DOCKINGSERVO_H_
+
+//! Weight of a detection against the estimate that the odometry carried along
+#define SERVO_GAIN 0.4
+//! A detection more than SERVO_GATE mm from the estimate is dropped, after SERVO_REJECTS of them in a row it is taken
+#define SERVO_GATE 80
+#define SERVO_REJECTS 3
+//! Gains of the distance, of the bearing of the approach pose and of the heading at the approach pose
+#define SERVO_K_RHO 0.5
+#define SERVO_K_ALPHA 1.5
+#define SERVO_K_BETA -0.4
+//! Beyond this bearing in degrees the robot turns on the spot before it drives
+#define SERVO_TURN_FIRST 45
+//! The approach pose is reached within SERVO_TOLERANCE mm and SERVO_TOLERANCE_PHI degrees
+#define SERVO_TOLERANCE 10
+#define SERVO_TOLERANCE_PHI 4
+
+/**
+ * Instead of driving a path and stopping to look at the pattern, the robot keeps driving and every detection of the
+ * camera corrects where it goes. The pattern is kept in the frame of the odometry: a detection is put there with the
+ * pose of the odometry at the time the frame was captured, and blended with the estimate, so a single bad detection
+ * does not make the robot swerve. In between the detections the odometry tells where the pattern is, so the speeds are
+ * updated every cycle of the jockey, also while the pattern is out of sight for a moment.
+ *
+ * The control law is the one of a unicycle to a pose: it drives to the approach pose APPROACH_LINE in front of the
+ * pattern, turning onto the line of the pattern as it gets there. The speeds are those of the primitives of
+ * CDockingPlanner, which knows them for the type of the robot.
+ */
+class CDockingServo {
+public:
+	CDockingServo(const CDockingPlanner & planner, int approach);
+	//! The planner knows the speeds of the robot
+	inline bool isAvailable() const { return planner.isAvailable(); }
+	//! Forget the pattern
+	void reset();
+	/**
+	 * A detection, in mm and degrees as the docking jockey stores it, with the pose of the odometry (x and y in m and
+	 * phi in rad, as CMotors::getPosition()) at the time its frame was captured. False if it was dropped.
+	 */
+	bool observe(const DetectedBlob & blob, const double *pose);
+	//! The pattern as it would be seen from the pose, false if it was never seen
+	bool predict(const double *pose, DetectedBlob & blob) const;
+	/**
+	 * The speeds of CMotors::setSpeeds() from the pose to the approach pose. True when the approach pose is reached,
+	 * the speeds are 0 then.
+	 */
+	bool command(const double *pose, int & forward, int & turn) const;
+	inline bool isKnown() const { return known; }
+	inline int getRejected() const { return rejected; }
+private:
+	const CDockingPlanner & planner;
+	int approach;
+	bool known;
+	//! The pattern in the frame of the odometry, in mm, and the heading of the robot to dock, in rad
+	double x;
+	double y;
+	double heading;
+	int rejected;
+};
+
+#endif /* DOCKINGSERVO_H_ */
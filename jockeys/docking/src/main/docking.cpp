@@ -10,9 +10,13 @@
 #include "termios.h"
 #include <CMessageServer.h>
 #include <CTimer.h>
+#include <CLatencyTrace.h>
 #include <signal.h>
 #include "../eth/messageDataType.h"
+#include "../eth/messageSchema.h"
 #include "../motor/CMotors.h"
+#include "../docking_planner/CDockingPlanner.h"
+#include "../docking_planner/CDockingServo.h"
 
 #if MULTI_CONTROLLER==true
 #include <action/StateEstimate.h>
@@ -25,6 +29,18 @@
 #define DEBUGSTRING NAME << '[' << getpid() << "] " << __func__ << "(): "
 #define PI 3.14159265
 #define  APPROACH_LINE 70
+//! Primitives of a planned path driven between two looks at the pattern
+#define PLAN_CHECK 4
+//! After a manoeuvre the detections are dropped for LOOK_SETTLE us, then a detection is waited for up to LOOK_TIMEOUT us
+#define LOOK_SETTLE 300000
+#define LOOK_TIMEOUT 1000000
+//! Under visual servoing the speeds are updated every SERVO_PERIOD us, it gives up when the pattern was not seen for
+//! SERVO_LOST us or the approach line is not reached within SERVO_TIMEOUT us
+#define SERVO_PERIOD 50000
+#define SERVO_LOST 1500000
+#define SERVO_TIMEOUT 60000000
+//! The setpoints of an organism command start this long after it is sent in us, so it reached all modules by then
+#define ORG_COMMAND_LEAD 100000
 
 using namespace std;
 float prumZ = 0;
@@ -39,6 +55,13 @@ int strana = 0;
 //bridles
 CMotors* motor;
 CTimer* timer;
+CDockingPlanner* planner = NULL;
+CDockingServo* servo = NULL;
+//! DOCKING_SERVO=0 drives the paths of the planner instead of visual servoing
+bool useServo = true;
+//! Counts the detections of the pattern, and the capture time in us of the frame of the last one, 0 if unknown
+unsigned int detections = 0;
+long long detectedTime = 0;
 int dx, dy, dphi;
 int curvingFactor = 17;
 bool hadMoved = false;
@@ -62,6 +85,10 @@ Mode mode = SWARM;
 
 //actions hadlers
 bool stop = false;
+//! Set while the robot makes a manoeuvre, detections that come in meanwhile are dropped
+bool manoeuvre = false;
+
+void readMessages();
 
 void interrupt_signal_handler(int signal) {
 	if (signal == SIGINT) {
@@ -114,32 +141,57 @@ void initialize() {
 	motor->init();
 	std::cout << "after motor init" << std::endl;
 	motor->setSpeeds(0, 0);
+	planner = new CDockingPlanner(robot_type, APPROACH_LINE);
+	servo = new CDockingServo(*planner, APPROACH_LINE);
 	usleep(20000);
 }
 
+/**
+ * Queue a manoeuvre of duration us with the speeds of setSpeeds(), unless the jockey was stopped. The motors end it
+ * themselves, waitMotion() waits for it. With a distance in m or an angle in rad it ends there already.
+ */
+void drive(int forward, int turn, long duration, double distance = 0, double angle = 0) {
+	if (DockingState == WAIT || stop || duration <= 0) return;
+	motor->queueMotion(motor->motion(forward, turn, duration, distance, angle));
+}
+
+//! As drive() with the speeds of the wheels, as setMotorSpeedsAW() and setMotorSpeedsS()
+void driveWheels(int speed1, int speed2, int speed3, long duration) {
+	if (DockingState == WAIT || stop || duration <= 0) return;
+	motor->queueMotion(motor->wheelMotion(speed1, speed2, speed3, duration));
+}
+
+/**
+ * Wait until the queued manoeuvres are done. The messages are read meanwhile, so MSG_STOP and MSG_QUIT stop the robot
+ * at once, the detections are dropped, as they are blurred by the motion. Returns false if the jockey was stopped.
+ */
+bool waitMotion() {
+	manoeuvre = true;
+	while (!motor->motionDone()) {
+		readMessages();
+		usleep(10000);
+	}
+	manoeuvre = false;
+	return DockingState != WAIT && !stop;
+}
+
 void turnAW(int a) {
-	motor->setSpeeds(0, sign(a) * 30);
-	usleep(abs(a) * 45000);
-	motor->setSpeeds(0, 0);
-	usleep(5000);
-	motor->setSpeeds(0, 0);
-	usleep(5000);
+	drive(0, sign(a) * 30, abs(a) * 45000);
+	waitMotion();
 }
 
 void goAW(int a, int b) {
 	//motor->setMotorSpeedsAW(sign(a) * -20, sign(a) * -20, sign(a) * 40);
-	motor->setSpeeds(sign(a) * 40, 0);
+	drive(sign(a) * 40, 0, abs(a) * 30000);
 	//bot->MoveWheelsFront(sign(a)*-20,sign(a)*-20);
 	//bot->MoveWheelsRear(sign(a)*40,0);
-	usleep(abs(a) * 30000);
 
-	motor->setMotorSpeedsAW(sign(b) * -40, sign(b) * 40, 0);
+	driveWheels(sign(b) * -40, sign(b) * 40, 0, abs(b) * 30000);
 	// bot->MoveWheelsFront(sign(b)*-40,sign(b)*40);
 	// bot->MoveWheelsRear(0,0);
-	usleep(abs(b) * 30000);
 
-	motor->setMotorSpeedsAW(0, 0, 0);
-	usleep(50000);
+	driveWheels(0, 0, 0, 50000);
+	waitMotion();
 }
 
 int dorovnejAW(int a) {
@@ -161,23 +213,15 @@ int dorovnejAW(int a) {
 }
 
 void turnSC(int rot) {
-	motor->setSpeeds(0, sign(rot) * 30);
-	usleep(32000 * abs(rot)); //24000
-	motor->setSpeeds(0, 0);
-	usleep(5000);
-	motor->setSpeeds(0, 0);
-	usleep(5000);
+	drive(0, sign(rot) * 30, 32000 * abs(rot)); //24000
+	waitMotion();
 }
 
 void goSC(int x) {
 	//x = x/10; //todo rozmer
 	//bot->Move(sgn(x)*20,sgn(x)*(-20));
-	motor->setMotorSpeedsS(sign(x) * 30, sign(x) * (-30));
-	usleep(50000 * abs(x));//40 000
-	motor->setSpeeds(0, 0);
-	usleep(5000);
-	motor->setSpeeds(0, 0);
-	usleep(5000);
+	driveWheels(sign(x) * 30, sign(x) * (-30), 0, 50000 * abs(x));//40 000
+	waitMotion();
 }
 
 int dorovnejSC(int a) {
@@ -201,83 +245,80 @@ int dorovnejSC(int a) {
 int dorovnej2SC() {
 	if (atan(detectedBlob->y / detectedBlob->x) * 180 / PI > 2) {
 		//motor->setSpeeds(0, -30);
-		motor->setMotorSpeedsS(30, 30);
+		driveWheels(30, 30, 0, 75000);
 		//bot->Move(-30,-30);
-		usleep(75000);
-		motor->setSpeeds(0, 0);
-		usleep(5000);
-		motor->setSpeeds(0, 0);
-		usleep(5000);
+		waitMotion();
 		return 0;
 	} else if (atan(detectedBlob->y / detectedBlob->x) * 180 / PI < -2) {
 		//motor->setSpeeds(0, 30);
-		motor->setMotorSpeedsS(-30, -30);
+		driveWheels(-30, -30, 0, 50000);
 
 		//bot->Move(30,30);
-		usleep(50000);
-		motor->setSpeeds(0, 0);
-		usleep(5000);
-		motor->setSpeeds(0, 0);
-		usleep(5000);
+		waitMotion();
 		return 0;
 	} else
 		return 1;
 
 }
 
+//! The sequence of the last organism command
+static uint16_t orgSequence = 0;
+
+static void orgSetpoint(OrganismSetpointWire *setpoints, int & count, uint8_t flags, int speed1, int speed2,
+		int speed3, int delay, int duration) {
+	if (duration <= 0 || count >= ORG_COMMAND_MAX_SETPOINTS) return;
+	OrganismSetpointWire & setpoint = setpoints[count++];
+	setpoint.module = ORG_MODULE_ALL;
+	setpoint.flags = flags;
+	setpoint.speed[0] = speed1;
+	setpoint.speed[1] = speed2;
+	setpoint.speed[2] = speed3;
+	setpoint.delay = delay;
+	setpoint.duration = duration;
+}
+
+/**
+ * Send the setpoints to all modules in a single MSG_ORGANISM_COMMAND, instead of a MSG_REMOTE_CONTROL per change of
+ * the speeds, and wait until the last one is over. The modules start them at the same time and stop the wheels in
+ * between themselves, so the pauses do not depend on how fast each message gets through.
+ */
+static void commandORG(const OrganismSetpointWire *setpoints, int count) {
+	if (count == 0) return;
+	uint8_t buffer[ORG_COMMAND_MAX_LENGTH];
+	OrganismCommandHeaderWire *header = (OrganismCommandHeaderWire*) buffer;
+	header->version = OrganismCommandHeaderWire::VERSION;
+	header->count = count;
+	header->sequence = ++orgSequence;
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	header->sent = (int64_t) now.tv_sec * 1000000 + now.tv_usec;
+	header->lead = ORG_COMMAND_LEAD;
+	long end = 0;
+	for (int i = 0; i < count; ++i) {
+		memcpy(orgCommandSetpoint(buffer, i), &setpoints[i], sizeof(OrganismSetpointWire));
+		long last = (uint16_t) setpoints[i].delay + (uint16_t) setpoints[i].duration;
+		if (last > end) end = last;
+	}
+	message_server->sendMessage(MSG_ORGANISM_COMMAND, buffer, orgCommandLength(count));
+	usleep(ORG_COMMAND_LEAD + end * 1000);
+}
+
 void turnORG(int a) {
-	RemoteControlData data;
-	data.action = A_NO_ACTION;
-	data.speed1 = 0;
-	data.speed2 = sign(a) * 40;
-	data.directMotorSpeed = false;
-	message_server->sendMessage(MSG_REMOTE_CONTROL, &data,
-			sizeof(RemoteControlData));
-	usleep(abs(a) * 30000);
-	data.action = A_NO_ACTION;
-	data.speed1 = 0;
-	data.speed2 = 0;
-	data.directMotorSpeed = false;
-	message_server->sendMessage(MSG_REMOTE_CONTROL, &data,
-			sizeof(RemoteControlData));
+	OrganismSetpointWire setpoints[1];
+	int count = 0;
+	orgSetpoint(setpoints, count, 0, 0, sign(a) * 40, 0, 0, abs(a) * 30);
+	commandORG(setpoints, count);
 	usleep(50000);
 }
 
 void goORG(int a, int b) {
-	RemoteControlData data;
-	data.action = A_NO_ACTION;
-	data.speed1 = sign(a) * 60;
-	data.speed2 = 10;
-	data.directMotorSpeed = false;
-	message_server->sendMessage(MSG_REMOTE_CONTROL, &data,
-			sizeof(RemoteControlData));
-	usleep(abs(a) * 30000);
-
-	data.speed1 = 0;
-	data.speed2 = 0;
-	data.speed3 = 0;
-	data.directMotorSpeed = true;
-	message_server->sendMessage(MSG_REMOTE_CONTROL, &data,
-			sizeof(RemoteControlData));
-	usleep(50000);
-
-	data.speed1 = -sign(b) * 70;
-	data.speed2 = sign(b) * 70;
-	data.speed3 = 0;
-	data.directMotorSpeed = true;
-	message_server->sendMessage(MSG_REMOTE_CONTROL, &data,
-			sizeof(RemoteControlData));
-	usleep(abs(a) * 30000);
+	OrganismSetpointWire setpoints[2];
+	int count = 0;
+	orgSetpoint(setpoints, count, 0, sign(a) * 60, 10, 0, 0, abs(a) * 30);
 	//motor->setMotorSpeedsAW(sign(b) * -40, sign(b) * 40, 0);
-
-	usleep(abs(b) * 30000);
-
-	data.speed1 = 0;
-	data.speed2 = 0;
-	data.speed3 = 0;
-	data.directMotorSpeed = true;
-	message_server->sendMessage(MSG_REMOTE_CONTROL, &data,
-			sizeof(RemoteControlData));
+	orgSetpoint(setpoints, count, ORG_SETPOINT_DIRECT, -sign(b) * 70, sign(b) * 70, 0, abs(a) * 30 + 50,
+			(abs(a) + abs(b)) * 30);
+	commandORG(setpoints, count);
 	usleep(50000);
 }
 
@@ -299,11 +340,124 @@ int dorovnejORG(int a, int b) {
 
 }
 
+/**
+ * Choose the docking pattern to steer to from the patterns detected by the camera.
+ */
+void useDetectedBlobs(DetectedBlobWSizeArray *detected) {
+	if (detectedBlob != NULL) {
+		if (detectedBlobOld == NULL) {
+			detectedBlobOld = new DetectedBlob();
+		}
+		detectedBlobOld->x = detectedBlob->x;
+		detectedBlobOld->y = detectedBlob->y;
+		detectedBlobOld->z = detectedBlob->z;
+		detectedBlobOld->phi = detectedBlob->phi;
+		delete detectedBlob;
+	}
+	detectedBlob = NULL;
+//				fprintf(stdout, "pocet tercu: %i\n", detected->size);
+//
+
+	if (detected->size == 2) {
+		prumZ = (detected->detectedBlobArray[0].z
+				+ detected->detectedBlobArray[1].z) / 2;
+		printf("prumZ: %f \n", prumZ);
+
+		if (detected->detectedBlobArray[0].z
+				> detected->detectedBlobArray[1].z) {
+			detectedBlob = new DetectedBlob();
+			detectedBlob->x = detected->detectedBlobArray[0].x
+					* 1000;
+			if (robot_type == RobotBase::ACTIVEWHEEL) {
+				detectedBlob->y = detected->detectedBlobArray[0].y
+						* 1000 * cos(0.16);
+				detectedBlob->z = detected->detectedBlobArray[0].z
+						* 1000 * sin(0.16);
+				detectedBlob->phi =
+						detected->detectedBlobArray[0].phi
+								* 180/ PI;
+			} else {
+				detectedBlob->y = detected->detectedBlobArray[0].y
+						* 1000;
+				detectedBlob->z = detected->detectedBlobArray[0].z
+						* 1000;
+				detectedBlob->phi =
+						-detected->detectedBlobArray[0].phi
+								* 180/ PI;
+				if (mode == ORGANISM) {
+					detectedBlob->phi = detectedBlob->phi;
+					detectedBlob->y = -detectedBlob->y;
+				}
+			}
+
+		} else {
+			detectedBlob = new DetectedBlob();
+			detectedBlob->x = detected->detectedBlobArray[1].x
+					* 1000;
+			if (robot_type == RobotBase::ACTIVEWHEEL) {
+				detectedBlob->y = detected->detectedBlobArray[1].y
+						* 1000 * cos(0.16);
+				detectedBlob->z = detected->detectedBlobArray[1].z
+						* 1000 * sin(0.16);
+				detectedBlob->phi =
+						detected->detectedBlobArray[1].phi
+								* 180/ PI;
+			} else {
+				detectedBlob->y = detected->detectedBlobArray[1].y
+						* 1000;
+				detectedBlob->z = detected->detectedBlobArray[1].z
+						* 1000;
+				detectedBlob->phi =
+						-detected->detectedBlobArray[1].phi
+								* 180/ PI;
+				if (mode == ORGANISM) {
+					detectedBlob->phi = detectedBlob->phi;
+					detectedBlob->y = -detectedBlob->y;
+				}
+			}
+
+		}
+	} else if (detected->size == 1) {
+
+		if (detected->detectedBlobArray[0].z > prumZ - 0.02) {
+			detectedBlob = new DetectedBlob();
+			detectedBlob->x = detected->detectedBlobArray[0].x
+					* 1000;
+			if (robot_type == RobotBase::ACTIVEWHEEL) {
+				detectedBlob->y = detected->detectedBlobArray[0].y
+						* 1000 * cos(0.16);
+				detectedBlob->z = detected->detectedBlobArray[0].z
+						* 1000 * sin(0.16);
+				detectedBlob->phi =
+						detected->detectedBlobArray[0].phi
+								* 180/ PI;
+			} else {
+				detectedBlob->y = detected->detectedBlobArray[0].y
+						* 1000;
+				detectedBlob->z = detected->detectedBlobArray[0].z
+						* 1000;
+				detectedBlob->phi =
+						-detected->detectedBlobArray[0].phi
+								* 180/ PI;
+				if (mode == ORGANISM) {
+					detectedBlob->phi = detectedBlob->phi;
+					detectedBlob->y = -detectedBlob->y;
+				}
+			}
+
+		} else {
+			printf("spatny kolecko\n");
+			detectedBlob = NULL;
+		}
+	} else {
+		detectedBlob = NULL;
+	}
+}
+
 void readMessages() {
 	//CMessage messagee;
 
 	messagee = message_server->getMessage();
-	printf("%i ", messagee.type, " dock \n");
 	if (messagee.type != MSG_NONE) {
 		switch (messagee.type) {
 		case MSG_INIT: {
@@ -380,6 +534,9 @@ void readMessages() {
 			break;
 		case MSG_STOP: {
 			printf("MSG stop\n");
+			// a manoeuvre that runs is dropped, and no new one is started before MSG_START
+			motor->stopMotion();
+			DockingState = WAIT;
 			motor->setSpeeds(0, 0);
 			usleep(5000);
 			motor->setSpeeds(0, 0);
@@ -396,6 +553,7 @@ void readMessages() {
 		case MSG_QUIT: {
 			printf("MSG quit\n");
 			{
+				motor->stopMotion();
 				motor->setSpeeds(0, 0);
 				motor->setSpeeds(0, 0);
 				usleep(10000);
@@ -406,123 +564,56 @@ void readMessages() {
 			break;
 		}
 		case MSG_CAM_DETECTED_BLOB_ARRAY: {
+			if (manoeuvre) break;
 
 			//printf("MSG detected blob\n");
 			if (messagee.len != 0) {
+				DetectedBlobWSizeArray detected;
+				memset(&detected, 0, sizeof(detected));
+				memcpy(&detected, messagee.data, messagee.len < (int) sizeof(detected) ? messagee.len : sizeof(detected));
+				useDetectedBlobs(&detected);
 				if (detectedBlob != NULL) {
-					if (detectedBlobOld == NULL) {
-						detectedBlobOld = new DetectedBlob();
-					}
-					detectedBlobOld->x = detectedBlob->x;
-					detectedBlobOld->y = detectedBlob->y;
-					detectedBlobOld->z = detectedBlob->z;
-					detectedBlobOld->phi = detectedBlob->phi;
-					delete detectedBlob;
+					detections++;
+					detectedTime = detected.timestamp;
+					traceFollow(detectedTime);
 				}
+			} else {
 				detectedBlob = NULL;
-				DetectedBlobWSizeArray* detected = new DetectedBlobWSizeArray();
-				memcpy(detected, messagee.data, messagee.len);
-//				fprintf(stdout, "pocet tercu: %i\n", detected->size);
-//
-
-				if (detected->size == 2) {
-					prumZ = (detected->detectedBlobArray[0].z
-							+ detected->detectedBlobArray[1].z) / 2;
-					printf("prumZ: %f \n", prumZ);
-
-					if (detected->detectedBlobArray[0].z
-							> detected->detectedBlobArray[1].z) {
-						detectedBlob = new DetectedBlob();
-						detectedBlob->x = detected->detectedBlobArray[0].x
-								* 1000;
-						if (robot_type == RobotBase::ACTIVEWHEEL) {
-							detectedBlob->y = detected->detectedBlobArray[0].y
-									* 1000 * cos(0.16);
-							detectedBlob->z = detected->detectedBlobArray[0].z
-									* 1000 * sin(0.16);
-							detectedBlob->phi =
-									detected->detectedBlobArray[0].phi
-											* 180/ PI;
-						} else {
-							detectedBlob->y = detected->detectedBlobArray[0].y
-									* 1000;
-							detectedBlob->z = detected->detectedBlobArray[0].z
-									* 1000;
-							detectedBlob->phi =
-									-detected->detectedBlobArray[0].phi
-											* 180/ PI;
-							if (mode == ORGANISM) {
-								detectedBlob->phi = detectedBlob->phi;
-								detectedBlob->y = -detectedBlob->y;
-							}
-						}
-
-					} else {
-						detectedBlob = new DetectedBlob();
-						detectedBlob->x = detected->detectedBlobArray[1].x
-								* 1000;
-						if (robot_type == RobotBase::ACTIVEWHEEL) {
-							detectedBlob->y = detected->detectedBlobArray[1].y
-									* 1000 * cos(0.16);
-							detectedBlob->z = detected->detectedBlobArray[1].z
-									* 1000 * sin(0.16);
-							detectedBlob->phi =
-									detected->detectedBlobArray[1].phi
-											* 180/ PI;
-						} else {
-							detectedBlob->y = detected->detectedBlobArray[1].y
-									* 1000;
-							detectedBlob->z = detected->detectedBlobArray[1].z
-									* 1000;
-							detectedBlob->phi =
-									-detected->detectedBlobArray[1].phi
-											* 180/ PI;
-							if (mode == ORGANISM) {
-								detectedBlob->phi = detectedBlob->phi;
-								detectedBlob->y = -detectedBlob->y;
-							}
-						}
-
-					}
-				} else if (detected->size == 1) {
-
-					if (detected->detectedBlobArray[0].z > prumZ - 0.02) {
-						detectedBlob = new DetectedBlob();
-						detectedBlob->x = detected->detectedBlobArray[0].x
-								* 1000;
-						if (robot_type == RobotBase::ACTIVEWHEEL) {
-							detectedBlob->y = detected->detectedBlobArray[0].y
-									* 1000 * cos(0.16);
-							detectedBlob->z = detected->detectedBlobArray[0].z
-									* 1000 * sin(0.16);
-							detectedBlob->phi =
-									detected->detectedBlobArray[0].phi
-											* 180/ PI;
-						} else {
-							detectedBlob->y = detected->detectedBlobArray[0].y
-									* 1000;
-							detectedBlob->z = detected->detectedBlobArray[0].z
-									* 1000;
-							detectedBlob->phi =
-									-detected->detectedBlobArray[0].phi
-											* 180/ PI;
-							if (mode == ORGANISM) {
-								detectedBlob->phi = detectedBlob->phi;
-								detectedBlob->y = -detectedBlob->y;
-							}
-						}
+			}
 
-					} else {
-						printf("spatny kolecko\n");
-						detectedBlob = NULL;
+		}
+			;
+			break;
+		case MSG_CAM_DETECTED_BATCH: {
+			if (manoeuvre) break;
+			// treated as a blob array of the most confident patterns in the batch
+			DetectionBatch batch;
+			if (unpackDetectionBatch(messagee.data, messagee.len, batch) && batch.header.count > 0) {
+				DetectedBlobWSizeArray detected;
+				bool used[MAX_BATCH_DETECTIONS] = { false };
+				int count = batch.header.count < MAX_DOCKING_PATTERNS ? batch.header.count : MAX_DOCKING_PATTERNS;
+				for (int i = 0; i < count; i++) {
+					int best = -1;
+					for (int j = 0; j < batch.header.count; j++) {
+						float *confidence = batch.field[BATCH_CONFIDENCE];
+						if (!used[j] && (best < 0 || confidence[j] > confidence[best])) best = j;
 					}
-				} else {
-					detectedBlob = NULL;
+					used[best] = true;
+					detected.detectedBlobArray[i].x = batch.field[BATCH_X][best];
+					detected.detectedBlobArray[i].y = batch.field[BATCH_Y][best];
+					detected.detectedBlobArray[i].z = batch.field[BATCH_Z][best];
+					detected.detectedBlobArray[i].phi = batch.field[BATCH_PHI][best];
+				}
+				detected.size = count;
+				useDetectedBlobs(&detected);
+				if (detectedBlob != NULL) {
+					detections++;
+					detectedTime = batch.header.timestamp;
+					traceFollow(detectedTime);
 				}
 			} else {
 				detectedBlob = NULL;
 			}
-
 		}
 			;
 			break;
@@ -535,6 +626,121 @@ void readMessages() {
 
 }
 
+/**
+ * Wait for a detection of the pattern after a manoeuvre, the ones of the first LOOK_SETTLE are dropped as the robot
+ * may still shake. False if the pattern is not seen within LOOK_TIMEOUT or the jockey was stopped.
+ */
+bool look() {
+	manoeuvre = true;
+	for (int i = 0; i < LOOK_SETTLE / 10000; i++) {
+		readMessages();
+		usleep(10000);
+	}
+	manoeuvre = false;
+	if (detectedBlob != NULL) {
+		delete detectedBlob;
+		detectedBlob = NULL;
+	}
+	for (int i = 0; i < LOOK_TIMEOUT / 10000 && detectedBlob == NULL; i++) {
+		readMessages();
+		usleep(10000);
+	}
+	return detectedBlob != NULL && DockingState != WAIT && !stop;
+}
+
+/**
+ * Drive to the approach line of the pattern on a path of the planner, instead of the cycles of turning, looking and
+ * moving. The pattern is looked at every PLAN_CHECK primitives, and the path is only planned again if the pattern is
+ * not where the path expects it; while it is out of sight the path goes on by the odometry. At the approach line the
+ * docking goes on in DOCKING. False if there is no path or the jockey was stopped, the cycles take over then.
+ */
+bool approach() {
+	if (planner == NULL || !planner->isAvailable() || detectedBlob == NULL || detectedBlob->x <= APPROACH_LINE)
+		return false;
+	if (!planner->plan(*detectedBlob)) {
+		printf("no path to the pattern\n");
+		return false;
+	}
+	int step = 0;
+	while (step < planner->getLength()) {
+		for (int end = step + PLAN_CHECK; step < end && step < planner->getLength(); step++) {
+			const DockingPrimitive & primitive = planner->getStep(step);
+			drive(primitive.forward, primitive.turn, primitive.duration, primitive.distance, primitive.angle);
+		}
+		if (!waitMotion()) return false;
+		if (step == planner->getLength()) break;
+		if (!look()) {
+			if (DockingState == WAIT || stop) return false;
+			printf("pattern lost, going on with the path\n");
+			continue;
+		}
+		if (planner->deviates(step, *detectedBlob)) {
+			DetectedBlob expected = planner->expected(step);
+			printf("pattern at (%.0f, %.0f, %.0f) instead of (%.0f, %.0f, %.0f), planning again\n", detectedBlob->x,
+					detectedBlob->y, detectedBlob->phi, expected.x, expected.y, expected.phi);
+			if (detectedBlob->x <= APPROACH_LINE || !planner->plan(*detectedBlob)) return false;
+			step = 0;
+		}
+	}
+	printf("on the approach line\n");
+	DockingState = DOCKING;
+	Matching = UNMATCHED;
+	return true;
+}
+
+//! Time in us on the clock of the odometry and of the capture time of the frames
+long long servoTime() {
+	struct timeval time;
+	gettimeofday(&time, NULL);
+	return (long long) time.tv_sec * 1000000 + time.tv_usec;
+}
+
+/**
+ * Drive to the approach line of the pattern under visual servoing, see CDockingServo. Every detection that comes in
+ * corrects the estimate of the pattern, with the pose of the odometry when its frame was captured, and the speeds are
+ * updated every SERVO_PERIOD, so the robot does not stop to look and the camera is used during the whole approach. At
+ * the approach line the docking goes on in DOCKING. False if the pattern is lost or the jockey was stopped, approach()
+ * and the cycles take over then.
+ */
+bool servoApproach() {
+	if (servo == NULL || !servo->isAvailable() || detectedBlob == NULL || detectedBlob->x <= APPROACH_LINE)
+		return false;
+	servo->reset();
+	// the detection that is there already is the first one
+	unsigned int seen = detections - 1;
+	long long start = servoTime();
+	long long lastSeen = start;
+	double pose[10];
+	int forward, turn;
+	while (true) {
+		do {
+			readMessages();
+		} while (messagee.type != MSG_NONE && DockingState != WAIT && !stop);
+		if (DockingState == WAIT || stop) return false;
+		long long time = servoTime();
+		if (seen != detections && detectedBlob != NULL) {
+			seen = detections;
+			motor->getPosition(pose);
+			if (detectedTime != 0 && !motor->getPositionAt(detectedTime, pose)) motor->getPosition(pose);
+			if (servo->observe(*detectedBlob, pose)) lastSeen = time;
+		}
+		if (time - lastSeen > SERVO_LOST || time - start > SERVO_TIMEOUT) {
+			printf("pattern lost while servoing\n");
+			motor->setSpeeds(0, 0);
+			return false;
+		}
+		motor->getPosition(pose);
+		if (servo->command(pose, forward, turn)) break;
+		motor->setSpeeds(forward, turn);
+		usleep(SERVO_PERIOD);
+	}
+	motor->setSpeeds(0, 0);
+	printf("on the approach line after %lli ms of servoing\n", (servoTime() - start) / 1000);
+	DockingState = DOCKING;
+	Matching = UNMATCHED;
+	return true;
+}
+
 int getTargetTurnSC() {
 	int s[3];
 	int i;
@@ -589,6 +795,8 @@ int main(int argc, char **argv) {
 	message_server->initServer(portMS.c_str());
 
 	strana = 0;
+	char *servoSetting = getenv("DOCKING_SERVO");
+	useServo = (servoSetting == NULL || atoi(servoSetting) != 0);
 
 	while (!stop) {
 		switch (DockingState) {
@@ -611,6 +819,9 @@ int main(int argc, char **argv) {
 			printf("read\n");
 			readMessages();
 			if (mode == SWARM) {
+				if (detectedBlob != NULL && (DockingState == SEARCHING || DockingState == APPROACHING)) {
+					if (!useServo || !servoApproach()) approach();
+				}
 				switch (robot_type) {
 				case RobotBase::ACTIVEWHEEL: {
 					if (detectedBlob != NULL)
@@ -731,14 +942,11 @@ int main(int argc, char **argv) {
 //					}
 						if (detectedBlob != NULL)
 							goAW(0, floor((int) detectedBlob->y));
-						motor->setMotorSpeedsAW(-45, -45, 90);
-						sleep(1);
-						motor->setMotorSpeedsAW(-25, -25, 0);
-						usleep(500000);
-						motor->setMotorSpeedsAW(0, 0, 50);
-						usleep(500000);
-						motor->setMotorSpeedsAW(0, 0, 0);
-						usleep(500000);
+						driveWheels(-45, -45, 90, 1000000);
+						driveWheels(-25, -25, 0, 500000);
+						driveWheels(0, 0, 50, 500000);
+						driveWheels(0, 0, 0, 500000);
+						waitMotion();
 						if (((ActiveWheel*) robot)->isEthernetPortConnected(
 								ActiveWheel::LEFT)) {
 							fprintf(stdout, "propojeno\n");
@@ -746,16 +954,11 @@ int main(int argc, char **argv) {
 									NULL, 0);
 							DockingState = WAIT;
 						} else {
-							motor->setMotorSpeedsAW(15, 15, -30);
-							usleep(500000);
-							motor->setMotorSpeedsAW(-35, -35, 70);
-							sleep(2);
-							motor->setSpeeds(100, 0);
-							sleep(1);
-							motor->setMotorSpeedsAW(0, 0, 0);
-							usleep(6000);
-							motor->setMotorSpeedsAW(0, 0, 0);
-							sleep(3);
+							driveWheels(15, 15, -30, 500000);
+							driveWheels(-35, -35, 70, 2000000);
+							drive(100, 0, 1000000);
+							driveWheels(0, 0, 0, 3000000);
+							waitMotion();
 						} //todo
 						if (((ActiveWheel*) robot)->isEthernetPortConnected(
 								ActiveWheel::LEFT)) {
@@ -765,13 +968,7 @@ int main(int argc, char **argv) {
 							DockingState = WAIT;
 						} else {
 							fprintf(stdout, "nepropojeno\n");
-							motor->setSpeeds(-100, 0);
-							usleep(100000);
-							motor->setSpeeds(0, 0);
-							usleep(5000);
-
-							motor->setSpeeds(0, 0);
-							usleep(5000);
+							drive(-100, 0, 100000);
 							goAW(-80, 0);
 							DockingState = SEARCHING;
 							Matching = UNMATCHED;
@@ -884,12 +1081,8 @@ int main(int argc, char **argv) {
 							}
 						} else {
 							printf("APPROACHING MATCHED\n");
-							motor->setSpeeds(40, strana * 10);
-							usleep(200000); //100000
-							motor->setSpeeds(0, 0);
-							usleep(5000);
-							motor->setSpeeds(0, 0);
-							usleep(5000);
+							drive(40, strana * 10, 200000); //100000
+							waitMotion();
 							hadMoved = true;
 							Matching = UNMATCHED;
 						}
@@ -936,18 +1129,13 @@ int main(int argc, char **argv) {
 									sleep(1);
 								}
 							} else if (detectedBlob->x < 50) {
-								motor->setSpeeds(40, 0);
-								sleep(2);
-								motor->setSpeeds(-30, 0);
-								sleep(1);
-								motor->setSpeeds(60, 0);
-								sleep(1);
+								drive(40, 0, 2000000);
+								drive(-30, 0, 1000000);
+								drive(60, 0, 1000000);
 								//todo kontrola pripojeni
 
-								motor->setSpeeds(0, 0);
-								usleep(5000);
-								motor->setSpeeds(0, 0);
-								sleep(3);
+								driveWheels(0, 0, 0, 3000000);
+								waitMotion();
 								if (((ScoutBot*) robot)->isEthernetPortConnected(
 										ScoutBot::FRONT)) {
 									fprintf(stdout, "propojeno\n");
@@ -967,12 +1155,8 @@ int main(int argc, char **argv) {
 								hadMoved = true;
 
 							} else {
-								motor->setSpeeds(30, 0);
-								usleep(100000);
-								motor->setSpeeds(0, 0);
-								usleep(5000);
-								motor->setSpeeds(0, 0);
-								usleep(5000);
+								drive(30, 0, 100000);
+								waitMotion();
 								//sleep(1);
 								hadMoved = true;
 								Matching = UNMATCHED;
@@ -984,15 +1168,12 @@ int main(int argc, char **argv) {
 							&& DockingState == DOCKING) {
 						printf("nevidim pattern DOCKING \n");
 //				if(strana==0){
-						motor->setSpeeds(-30, 0);
+						drive(-30, 0, 40000);
 //				}else{
 //					motor->setSpeeds(0,-strana*30);
 //				}
-						usleep(40000);
-						motor->setSpeeds(0, 0);
-						usleep(5000);
-						motor->setSpeeds(0, 0);
-						sleep(2);
+						driveWheels(0, 0, 0, 2000000);
+						waitMotion();
 						hadMoved = true;
 
 					}
@@ -0,0 +1,185 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Report the accuracy and the speed of the fixed-point functions against the floating point ones
+ * @file fixbench.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Testing
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+#include <vector>
+
+/***********************************************************************************************************************
+ * Jockey framework includes
+ **********************************************************************************************************************/
+
+#include <fixmath.h>
+
+/***********************************************************************************************************************
+ * Implementation
+ **********************************************************************************************************************/
+
+#define FIXBENCH_SAMPLES 4096
+#define FIXBENCH_ROUNDS 64
+
+static void usage() {
+	printf("Usage: fixbench [rounds]\n");
+	printf("Compares the functions of fixmath.h with those of libm over %d arguments, rounds times, %d by default.\n",
+			FIXBENCH_SAMPLES, FIXBENCH_ROUNDS);
+	printf("The error is the largest difference with sin() and the others in double precision, for arguments that\n");
+	printf("are exact in Q16.16, so it is the error of the function and not of the conversion of its argument.\n");
+}
+
+static double now() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+//! Keeps the compiler from leaving out the calls of which the results are not used
+static volatile double sink;
+
+static int rounds = FIXBENCH_ROUNDS;
+
+//! Arguments in floating point and in Q16.16, the same values
+struct Arguments {
+	std::vector<double> a, b;
+	std::vector<float> fa, fb;
+	std::vector<q16_t> qa, qb;
+
+	Arguments(double from, double to) {
+		srand(1);
+		for (int i = 0; i < FIXBENCH_SAMPLES; i++) {
+			qa.push_back(q16_from_double(from + (to - from) * rand() / RAND_MAX));
+			qb.push_back(q16_from_double(from + (to - from) * rand() / RAND_MAX));
+			a.push_back(q16_to_double(qa.back()));
+			b.push_back(q16_to_double(qb.back()));
+			fa.push_back(a.back());
+			fb.push_back(b.back());
+		}
+	}
+};
+
+static void report(const char *name, double error, double fixed, double single, double twice) {
+	int calls = rounds * FIXBENCH_SAMPLES;
+	printf("%-10s %12.2e %10.1f %10.1f %10.1f %8.1fx\n", name, error, fixed / calls, single / calls, twice / calls,
+			single / fixed);
+}
+
+/**
+ * Each function is timed in fixed point, in float and in double, over the same arguments. The macro keeps the three
+ * loops the same apart from the call.
+ */
+#define FIXBENCH_TIME(result, expression) { \
+	double start = now(), sum = 0; \
+	for (int r = 0; r < rounds; r++) for (int i = 0; i < FIXBENCH_SAMPLES; i++) sum += (expression); \
+	sink = sum; \
+	result = now() - start; }
+
+int main(int argc, char **argv) {
+	if (argc > 1) rounds = atoi(argv[1]);
+	if (rounds <= 0) {
+		usage();
+		return EXIT_FAILURE;
+	}
+	printf("%-10s %12s %10s %10s %10s %9s\n", "function", "max error", "fixed ns", "float ns", "double ns",
+			"speedup");
+
+	double fixed, single, twice, error;
+
+	Arguments angles(-2 * M_PI, 2 * M_PI);
+	error = 0;
+	for (int i = 0; i < FIXBENCH_SAMPLES; i++)
+		error = fmax(error, fabs(q16_to_double(q16_sin(angles.qa[i])) - sin(angles.a[i])));
+	FIXBENCH_TIME(fixed, q16_sin(angles.qa[i]));
+	FIXBENCH_TIME(single, sinf(angles.fa[i]));
+	FIXBENCH_TIME(twice, sin(angles.a[i]));
+	report("sin", error, fixed, single, twice);
+
+	error = 0;
+	for (int i = 0; i < FIXBENCH_SAMPLES; i++)
+		error = fmax(error, fabs(q16_to_double(q16_cos(angles.qa[i])) - cos(angles.a[i])));
+	FIXBENCH_TIME(fixed, q16_cos(angles.qa[i]));
+	FIXBENCH_TIME(single, cosf(angles.fa[i]));
+	FIXBENCH_TIME(twice, cos(angles.a[i]));
+	report("cos", error, fixed, single, twice);
+
+	Arguments coordinates(-100, 100);
+	error = 0;
+	for (int i = 0; i < FIXBENCH_SAMPLES; i++) {
+		double difference = q16_to_double(q16_atan2(coordinates.qa[i], coordinates.qb[i]))
+				- atan2(coordinates.a[i], coordinates.b[i]);
+		error = fmax(error, fabs(difference));
+	}
+	FIXBENCH_TIME(fixed, q16_atan2(coordinates.qa[i], coordinates.qb[i]));
+	FIXBENCH_TIME(single, atan2f(coordinates.fa[i], coordinates.fb[i]));
+	FIXBENCH_TIME(twice, atan2(coordinates.a[i], coordinates.b[i]));
+	report("atan2", error, fixed, single, twice);
+
+	error = 0;
+	for (int i = 0; i < FIXBENCH_SAMPLES; i++) {
+		double difference = q16_to_double(q16_hypot(coordinates.qa[i], coordinates.qb[i]))
+				- hypot(coordinates.a[i], coordinates.b[i]);
+		error = fmax(error, fabs(difference));
+	}
+	FIXBENCH_TIME(fixed, q16_hypot(coordinates.qa[i], coordinates.qb[i]));
+	FIXBENCH_TIME(single, hypotf(coordinates.fa[i], coordinates.fb[i]));
+	FIXBENCH_TIME(twice, hypot(coordinates.a[i], coordinates.b[i]));
+	report("hypot", error, fixed, single, twice);
+
+	Arguments positive(0, 10000);
+	error = 0;
+	for (int i = 0; i < FIXBENCH_SAMPLES; i++)
+		error = fmax(error, fabs(q16_to_double(q16_sqrt(positive.qa[i])) - sqrt(positive.a[i])));
+	FIXBENCH_TIME(fixed, q16_sqrt(positive.qa[i]));
+	FIXBENCH_TIME(single, sqrtf(positive.fa[i]));
+	FIXBENCH_TIME(twice, sqrt(positive.a[i]));
+	report("sqrt", error, fixed, single, twice);
+
+	Arguments factors(-100, 100);
+	error = 0;
+	for (int i = 0; i < FIXBENCH_SAMPLES; i++) {
+		double difference = q16_to_double(q16_mul(factors.qa[i], factors.qb[i])) - factors.a[i] * factors.b[i];
+		error = fmax(error, fabs(difference));
+	}
+	FIXBENCH_TIME(fixed, q16_mul(factors.qa[i], factors.qb[i]));
+	FIXBENCH_TIME(single, factors.fa[i] * factors.fb[i]);
+	FIXBENCH_TIME(twice, factors.a[i] * factors.b[i]);
+	report("mul", error, fixed, single, twice);
+
+	error = 0;
+	for (int i = 0; i < FIXBENCH_SAMPLES; i++) {
+		// keep the quotient within the range of Q16.16
+		if (fabs(factors.b[i]) < 0.01) continue;
+		double difference = q16_to_double(q16_div(factors.qa[i], factors.qb[i])) - factors.a[i] / factors.b[i];
+		error = fmax(error, fabs(difference));
+	}
+	FIXBENCH_TIME(fixed, q16_div(factors.qa[i], factors.qb[i] | 1));
+	FIXBENCH_TIME(single, factors.fa[i] / factors.fb[i]);
+	FIXBENCH_TIME(twice, factors.a[i] / factors.b[i]);
+	report("div", error, fixed, single, twice);
+
+	printf("Times are per call, the speedup is that of fixed point over float.\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,173 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Convert a log of CFrameLog into CSV files, one per type of record
+ * @file framelogcsv.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Testing
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+/***********************************************************************************************************************
+ * Jockey framework includes
+ **********************************************************************************************************************/
+
+#include <CFrameLog.h>
+
+/***********************************************************************************************************************
+ * Implementation
+ **********************************************************************************************************************/
+
+static void usage() {
+	printf("Usage: framelogcsv log [prefix]\n");
+	printf("Writes prefix.ir.csv, prefix.motor.csv and prefix.detection.csv for the records in the log, the prefix\n");
+	printf("is the log itself by default. Every line starts with the time in us since the first record and the\n");
+	printf("sequence number of the record, a gap in the sequence numbers is where the ring of the log was full.\n");
+}
+
+static void writeArray(FILE *file, const int32_t *values) {
+	for (int i = 0; i < FRAME_LOG_IR_COUNT; i++) fprintf(file, ",%d", values[i]);
+}
+
+static void writeArrayHeader(FILE *file, const char *name) {
+	for (int i = 0; i < FRAME_LOG_IR_COUNT; i++) fprintf(file, ",%s%d", name, i);
+}
+
+//! Opened at the first record of its type, so a log without detections does not leave an empty file
+static FILE *csvFile(FILE *&file, const std::string &prefix, uint8_t type) {
+	if (file != NULL) return file;
+	std::string path = prefix;
+	switch (type) {
+	case FRAME_LOG_IR: path += ".ir.csv"; break;
+	case FRAME_LOG_MOTOR: path += ".motor.csv"; break;
+	case FRAME_LOG_DETECTION: path += ".detection.csv"; break;
+	}
+	file = fopen(path.c_str(), "w");
+	if (file == NULL) {
+		fprintf(stderr, "Can not write %s\n", path.c_str());
+		exit(EXIT_FAILURE);
+	}
+	fprintf(file, "time,sequence");
+	switch (type) {
+	case FRAME_LOG_IR:
+		writeArrayHeader(file, "reflective");
+		writeArrayHeader(file, "ambient");
+		writeArrayHeader(file, "proximity");
+		writeArrayHeader(file, "average_reflective");
+		writeArrayHeader(file, "average_ambient");
+		writeArrayHeader(file, "average_proximity");
+		break;
+	case FRAME_LOG_MOTOR:
+		fprintf(file, ",speed1,speed2,speed3,x,y,phi");
+		break;
+	case FRAME_LOG_DETECTION:
+		fprintf(file, ",frame,count,index,x,y,z,phi,size,confidence");
+		break;
+	}
+	fprintf(file, "\n");
+	printf("Write %s\n", path.c_str());
+	return file;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		usage();
+		return EXIT_FAILURE;
+	}
+	std::string prefix = (argc > 2) ? argv[2] : argv[1];
+
+	CFrameLogReader reader;
+	if (!reader.open(argv[1])) return EXIT_FAILURE;
+
+	FILE *ir = NULL, *motor = NULL, *detection = NULL;
+	int count[FRAME_LOG_DETECTION + 1] = { 0 };
+	int unknown = 0, records = 0;
+	uint64_t start = 0;
+	uint32_t lowest = 0, highest = 0;
+	bool first = true;
+	FrameLogRecordHeader header;
+	const uint8_t *payload;
+	while (reader.next(header, payload)) {
+		if (first) {
+			start = header.timestamp;
+			lowest = highest = header.sequence;
+			first = false;
+		}
+		// the records are written in the order of their slots, which may differ a bit from the sequence
+		if (header.sequence < lowest) lowest = header.sequence;
+		if (header.sequence > highest) highest = header.sequence;
+		records++;
+		long long time = (long long)(header.timestamp - start);
+		switch (header.type) {
+		case FRAME_LOG_IR: {
+			FrameLogIR record;
+			memset(&record, 0, sizeof(record));
+			memcpy(&record, payload, header.length < sizeof(record) ? header.length : sizeof(record));
+			FILE *file = csvFile(ir, prefix, header.type);
+			fprintf(file, "%lld,%u", time, header.sequence);
+			writeArray(file, record.reflective);
+			writeArray(file, record.ambient);
+			writeArray(file, record.proximity);
+			writeArray(file, record.average_reflective);
+			writeArray(file, record.average_ambient);
+			writeArray(file, record.average_proximity);
+			fprintf(file, "\n");
+			break;
+		}
+		case FRAME_LOG_MOTOR: {
+			FrameLogMotor record;
+			memset(&record, 0, sizeof(record));
+			memcpy(&record, payload, header.length < sizeof(record) ? header.length : sizeof(record));
+			FILE *file = csvFile(motor, prefix, header.type);
+			fprintf(file, "%lld,%u,%d,%d,%d,%f,%f,%f\n", time, header.sequence, record.speed[0], record.speed[1],
+					record.speed[2], record.pose[0], record.pose[1], record.pose[2]);
+			break;
+		}
+		case FRAME_LOG_DETECTION: {
+			FrameLogDetection record;
+			memset(&record, 0, sizeof(record));
+			memcpy(&record, payload, header.length < sizeof(record) ? header.length : sizeof(record));
+			FILE *file = csvFile(detection, prefix, header.type);
+			fprintf(file, "%lld,%u,%u,%u,%u,%f,%f,%f,%f,%f,%f\n", time, header.sequence, record.frame, record.count,
+					record.index, record.x, record.y, record.z, record.phi, record.size, record.confidence);
+			break;
+		}
+		default:
+			unknown++;
+			continue;
+		}
+		count[header.type]++;
+	}
+
+	printf("%d IR frames, %d motor commands, %d detections", count[FRAME_LOG_IR], count[FRAME_LOG_MOTOR],
+			count[FRAME_LOG_DETECTION]);
+	if (unknown) printf(", %d records of an unknown type", unknown);
+	int dropped = first ? 0 : (int)(highest - lowest + 1) - records;
+	printf(", %d records dropped by the ring in between\n", dropped);
+
+	if (ir != NULL) fclose(ir);
+	if (motor != NULL) fclose(motor);
+	if (detection != NULL) fclose(detection);
+	return EXIT_SUCCESS;
+}
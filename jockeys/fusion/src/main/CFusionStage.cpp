@@ -0,0 +1,432 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Pairs the laser scans and the camera frames of the same moment and classifies them with CFusion
+ * @file CFusionStage.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 14, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#include <CFusionStage.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <sys/time.h>
+
+//! How long the thread waits for input before it checks whether it should stop, in ms
+#define FUSION_POLL 100
+
+//! The laser vector is normalized as in CFusion::learn, a column of 120 up to 255 is mapped on 0 up to 1
+#define FUSION_LASER_OFFSET 120.0f
+#define FUSION_LASER_RANGE 135.0f
+
+static long long fusionTime() {
+	struct timeval time;
+	gettimeofday(&time, NULL);
+	return (long long) time.tv_sec * 1000000 + time.tv_usec;
+}
+
+static inline float clamp01(float value) {
+	return value < 0 ? 0 : (value > 1 ? 1 : value);
+}
+
+//! Exchange the snapshot in slot, a full barrier unlike __sync_lock_test_and_set which only acquires
+static CFusion *exchange(CFusion **slot, CFusion *snapshot) {
+	CFusion *expected = NULL;
+	while (true) {
+		CFusion *seen = __sync_val_compare_and_swap(slot, expected, snapshot);
+		if (seen == expected) return seen;
+		expected = seen;
+	}
+}
+
+CFusionStage::CFusionStage(CFusion *fusion): fusion(fusion), model(NULL), pending(NULL), retired(NULL),
+		running(false), learning(false), sampleHead(0), sampleTail(0), scanHead(0), scanTail(0), frameHead(0),
+		frameTail(0), publisher(NULL), publisherArg(NULL), laser(FUSION_LASER_FEATURES), blob(FUSION_BLOB_FEATURES),
+		scansIn(0), framesIn(0), invalid(0), overwritten(0), unpairedScans(0), unpairedFrames(0), paired(0),
+		published(0), slowest(0), learned(0), learnDropped(0), publications(0), slowestLearn(0) {
+	pthread_mutex_init(&fusionMutex, NULL);
+	pthread_mutex_init(&ringMutex, NULL);
+	pthread_mutex_init(&learnMutex, NULL);
+	sem_init(&work, 0, 0);
+	sem_init(&learnWork, 0, 0);
+}
+
+CFusionStage::~CFusionStage() {
+	stop();
+	delete model;
+	delete pending;
+	delete retired;
+	sem_destroy(&learnWork);
+	sem_destroy(&work);
+	pthread_mutex_destroy(&learnMutex);
+	pthread_mutex_destroy(&ringMutex);
+	pthread_mutex_destroy(&fusionMutex);
+}
+
+int CFusionStage::start() {
+	if (running) return 0;
+	pthread_mutex_lock(&ringMutex);
+	scanTail = scanHead;
+	frameTail = frameHead;
+	pthread_mutex_unlock(&ringMutex);
+	pthread_mutex_lock(&learnMutex);
+	sampleTail = sampleHead;
+	pthread_mutex_unlock(&learnMutex);
+	if (model == NULL) {
+		pthread_mutex_lock(&fusionMutex);
+		model = new CFusion(*fusion);
+		pthread_mutex_unlock(&fusionMutex);
+	}
+	running = true;
+	if (pthread_create(&thread, NULL, &CFusionStage::run, this) != 0) {
+		fprintf(stderr, "Could not start the fusion thread\n");
+		running = false;
+		return -1;
+	}
+	if (pthread_create(&learner, NULL, &CFusionStage::runLearner, this) != 0) {
+		fprintf(stderr, "Could not start the learner thread\n");
+		running = false;
+		sem_post(&work);
+		pthread_join(thread, NULL);
+		return -1;
+	}
+	return 0;
+}
+
+void CFusionStage::stop() {
+	if (!running) return;
+	running = false;
+	sem_post(&work);
+	sem_post(&learnWork);
+	pthread_join(thread, NULL);
+	pthread_join(learner, NULL);
+}
+
+void CFusionStage::setPublisher(FusionPublisher publisher, void *arg) {
+	publisherArg = arg;
+	this->publisher = publisher;
+}
+
+void CFusionStage::input(int type, const void *data, int len) {
+	if (!running) return;
+	if (type == MSG_LASER_SCAN) {
+		pthread_mutex_lock(&ringMutex);
+		Scan & scan = scans[scanHead % FUSION_SCANS];
+		if (!unpackLaserScan((const uint8_t*) data, len, scan.header, scan.columns)) {
+			invalid++;
+			pthread_mutex_unlock(&ringMutex);
+			return;
+		}
+		if (scanHead - scanTail == FUSION_SCANS) {
+			scanTail++;
+			overwritten++;
+		}
+		scanHead++;
+		scansIn++;
+		pthread_mutex_unlock(&ringMutex);
+	} else if (type == MSG_CAM_DETECTED_BATCH) {
+		pthread_mutex_lock(&ringMutex);
+		DetectionBatch & frame = frames[frameHead % FUSION_FRAMES];
+		if (!unpackDetectionBatch((const uint8_t*) data, len, frame)) {
+			invalid++;
+			pthread_mutex_unlock(&ringMutex);
+			return;
+		}
+		if (frameHead - frameTail == FUSION_FRAMES) {
+			frameTail++;
+			overwritten++;
+		}
+		frameHead++;
+		framesIn++;
+		pthread_mutex_unlock(&ringMutex);
+	} else {
+		return;
+	}
+	sem_post(&work);
+}
+
+void* CFusionStage::run(void *stage) {
+	((CFusionStage*) stage)->fusionLoop();
+	return NULL;
+}
+
+void CFusionStage::fusionLoop() {
+	while (running) {
+		struct timespec timeout;
+		clock_gettime(CLOCK_REALTIME, &timeout);
+		timeout.tv_nsec += FUSION_POLL * 1000000L;
+		if (timeout.tv_nsec >= 1000000000L) {
+			timeout.tv_sec++;
+			timeout.tv_nsec -= 1000000000L;
+		}
+		if (sem_timedwait(&work, &timeout) != 0 && errno != EINTR) continue;
+		while (running) {
+			pthread_mutex_lock(&ringMutex);
+			Alignment alignment = align();
+			pthread_mutex_unlock(&ringMutex);
+			if (alignment == ALIGN_WAIT) break;
+			if (alignment == ALIGN_PAIRED) classify(pairedScan, pairedFrame);
+		}
+	}
+}
+
+/**
+ * The scans and the frames each arrive in the order in which they are captured. A frame that is too old for the
+ * oldest scan is too old for every later scan as well. The oldest scan can be paired as soon as a frame captured after
+ * it arrived, later frames are only further away. If the camera lags behind so much that a scan more than
+ * FUSION_MAX_SKEW younger is already there, the scan is paired with what is there, so it does not wait forever for a
+ * camera that does not run.
+ */
+CFusionStage::Alignment CFusionStage::align() {
+	if (scanTail == scanHead) return ALIGN_WAIT;
+	const Scan & scan = scans[scanTail % FUSION_SCANS];
+	long long time = scan.header.timestamp;
+	while (frameTail != frameHead && (long long) frames[frameTail % FUSION_FRAMES].header.timestamp + FUSION_MAX_SKEW
+			< time) {
+		frameTail++;
+		unpairedFrames++;
+	}
+	bool newer = (frameTail != frameHead) && (long long) frames[(frameHead - 1) % FUSION_FRAMES].header.timestamp >=
+			time;
+	bool late = (long long) scans[(scanHead - 1) % FUSION_SCANS].header.timestamp > time + FUSION_MAX_SKEW;
+	if (!newer && !late) return ALIGN_WAIT;
+
+	unsigned int best = frameHead;
+	long long bestSkew = FUSION_MAX_SKEW + 1;
+	for (unsigned int i = frameTail; i != frameHead; i++) {
+		long long skew = (long long) frames[i % FUSION_FRAMES].header.timestamp - time;
+		if (skew < 0) skew = -skew;
+		if (skew < bestSkew) {
+			bestSkew = skew;
+			best = i;
+		}
+	}
+	if (best == frameHead) {
+		scanTail++;
+		unpairedScans++;
+		return ALIGN_DROPPED;
+	}
+	pairedScan.header = scan.header;
+	memcpy(pairedScan.columns, scan.columns, scan.header.rows * sizeof(int16_t));
+	pairedFrame = frames[best % FUSION_FRAMES];
+	// a frame is used for one scan only, the frames before it are further away from every later scan
+	unpairedFrames += best - frameTail;
+	frameTail = best + 1;
+	scanTail++;
+	return ALIGN_PAIRED;
+}
+
+//! The mean column in every band of rows, a band without laser is 0
+void CFusionStage::laserFeature(const Scan & scan, ART_ASPECT & feature) {
+	int rows = scan.header.rows;
+	for (int f = 0; f < FUSION_LASER_FEATURES; f++) {
+		int begin = f * rows / FUSION_LASER_FEATURES;
+		int end = (f + 1) * rows / FUSION_LASER_FEATURES;
+		int sum = 0, seen = 0;
+		for (int i = begin; i < end; i++) {
+			if (scan.columns[i] == 0) continue;
+			sum += scan.columns[i];
+			seen++;
+		}
+		feature[f] = seen ? clamp01((sum / (float) seen - FUSION_LASER_OFFSET) / FUSION_LASER_RANGE) : 0;
+	}
+}
+
+//! The area of the pattern as fraction of the image, its bearing and its confidence, all 0 without a detection
+void CFusionStage::blobFeature(const DetectionBatch & frame, int detection, ART_ASPECT & feature) {
+	if (detection < 0) {
+		for (int f = 0; f < FUSION_BLOB_FEATURES; f++) feature[f] = 0;
+		return;
+	}
+	float x = frame.field[BATCH_X][detection];
+	float y = frame.field[BATCH_Y][detection];
+	feature[0] = clamp01(frame.field[BATCH_SIZE][detection] / (float) (FUSION_IMAGE_WIDTH * FUSION_IMAGE_HEIGHT));
+	feature[1] = clamp01((float) (atan2(y, x) / (2 * M_PI) + 0.5));
+	feature[2] = clamp01(frame.field[BATCH_CONFIDENCE][detection]);
+}
+
+/**
+ * The copy of the model is made under fusionMutex, so it is a model between two samples. Every exchange of a snapshot
+ * is a full barrier, the copy is complete before the stage can see it and the stage is done with a retired snapshot
+ * before it is overwritten. A snapshot that the stage did not take yet is replaced and becomes the spare.
+ */
+void CFusionStage::publish() {
+	CFusion *snapshot = exchange(&retired, NULL);
+	pthread_mutex_lock(&fusionMutex);
+	if (snapshot == NULL) {
+		snapshot = new CFusion(*fusion);
+	} else {
+		*snapshot = *fusion;
+	}
+	pthread_mutex_unlock(&fusionMutex);
+	snapshot = exchange(&pending, snapshot);
+	if (snapshot != NULL) {
+		// there is only one spare, if two publishers race the other one is freed
+		delete exchange(&retired, snapshot);
+	}
+	__sync_fetch_and_add(&publications, 1);
+}
+
+//! Without a new snapshot this is a single compare-and-swap that finds NULL
+void CFusionStage::takeModel() {
+	CFusion *snapshot = exchange(&pending, NULL);
+	if (snapshot == NULL) return;
+	delete exchange(&retired, model);
+	model = snapshot;
+}
+
+void* CFusionStage::runLearner(void *stage) {
+	((CFusionStage*) stage)->learnLoop();
+	return NULL;
+}
+
+void CFusionStage::learnLoop() {
+	int unpublished = 0;
+	while (running) {
+		struct timespec timeout;
+		clock_gettime(CLOCK_REALTIME, &timeout);
+		timeout.tv_nsec += FUSION_POLL * 1000000L;
+		if (timeout.tv_nsec >= 1000000000L) {
+			timeout.tv_sec++;
+			timeout.tv_nsec -= 1000000000L;
+		}
+		if (sem_timedwait(&learnWork, &timeout) != 0) {
+			// the stream paused, what is learned so far is recognized from now on
+			if (errno == ETIMEDOUT && unpublished > 0) {
+				publish();
+				unpublished = 0;
+			}
+			continue;
+		}
+		while (running) {
+			pthread_mutex_lock(&learnMutex);
+			if (sampleTail == sampleHead) {
+				pthread_mutex_unlock(&learnMutex);
+				break;
+			}
+			learnSample = samples[sampleTail % FUSION_LEARN_SAMPLES];
+			sampleTail++;
+			pthread_mutex_unlock(&learnMutex);
+			learn(learnSample);
+			if (++unpublished >= FUSION_PUBLISH_SAMPLES) {
+				publish();
+				unpublished = 0;
+			}
+		}
+	}
+}
+
+void CFusionStage::teach(const ART_ASPECT & laser, const ART_ASPECT & blob) {
+	pthread_mutex_lock(&learnMutex);
+	if (sampleHead - sampleTail == FUSION_LEARN_SAMPLES) {
+		sampleTail++;
+		learnDropped++;
+	}
+	Sample & sample = samples[sampleHead % FUSION_LEARN_SAMPLES];
+	memcpy(sample.laser, &laser[0], sizeof(sample.laser));
+	memcpy(sample.blob, &blob[0], sizeof(sample.blob));
+	sampleHead++;
+	pthread_mutex_unlock(&learnMutex);
+	sem_post(&learnWork);
+}
+
+void CFusionStage::learn(const Sample & sample) {
+	long long start = fusionTime();
+	pthread_mutex_lock(&fusionMutex);
+	fusion->classifyBatch(sample.laser, FUSION_LASER_FEATURES, sample.blob, FUSION_BLOB_FEATURES, NULL, 0, 1, false,
+			learnClasses);
+	pthread_mutex_unlock(&fusionMutex);
+	learned++;
+	long duration = (long) (fusionTime() - start);
+	if (duration > slowestLearn) slowestLearn = duration;
+}
+
+/**
+ * Every detection of the frame is classified with the scan, a frame without detections once without a blob. The
+ * snapshot is only searched, a pair is learned by the learner thread.
+ */
+void CFusionStage::classify(const Scan & scan, const DetectionBatch & frame) {
+	long long start = fusionTime();
+	paired++;
+	takeModel();
+	laserFeature(scan, laser);
+	int detections = frame.header.count;
+	for (int d = 0; d < detections || (d == 0 && detections == 0); d++) {
+		int detection = (d < detections) ? d : -1;
+		blobFeature(frame, detection, blob);
+
+		model->classifyBatch(&laser[0], FUSION_LASER_FEATURES, &blob[0], FUSION_BLOB_FEATURES, NULL, 0, 1, true,
+				classes);
+		Art & rewards = model->getRewards();
+		bool isObject = (classes[2] >= 0 && classes[2] < rewards.getPrototypeCount() &&
+				rewards.getPrototype(classes[2])[0] == 1);
+		if (learning) teach(laser, blob);
+
+		FusionObject object;
+		memset(&object, 0, sizeof(object));
+		object.timestamp = scan.header.timestamp;
+		object.scan = scan.header.scan;
+		object.frame = frame.header.frame;
+		object.skew = (int32_t) ((long long) frame.header.timestamp - (long long) scan.header.timestamp);
+		object.detection = detection;
+		object.distance = scan.header.distance;
+		object.laserClass = classes[0];
+		object.blobClass = classes[1];
+		object.rewardClass = classes[2];
+		object.isObject = isObject;
+		if (detection >= 0) {
+			object.x = frame.field[BATCH_X][detection];
+			object.y = frame.field[BATCH_Y][detection];
+			object.z = frame.field[BATCH_Z][detection];
+			object.phi = frame.field[BATCH_PHI][detection];
+			object.confidence = frame.field[BATCH_CONFIDENCE][detection];
+		}
+		if (publisher != NULL) {
+			publisher(object, publisherArg);
+			published++;
+		}
+	}
+	long duration = (long) (fusionTime() - start);
+	if (duration > slowest) slowest = duration;
+}
+
+void CFusionStage::lock() {
+	pthread_mutex_lock(&fusionMutex);
+}
+
+void CFusionStage::unlock() {
+	pthread_mutex_unlock(&fusionMutex);
+}
+
+void CFusionStage::printStatistics() {
+	pthread_mutex_lock(&ringMutex);
+	printf("Fusion: %ld scans and %ld frames in, %ld invalid, %ld overwritten\n", scansIn, framesIn, invalid,
+			overwritten);
+	printf("Fusion: %ld pairs, %ld scans and %ld frames without a partner within %d us\n", paired, unpairedScans,
+			unpairedFrames, FUSION_MAX_SKEW);
+	printf("Fusion: %ld objects published, slowest pair took %ld us\n", published, slowest);
+	printf("Fusion: %ld samples learned, %ld dropped, %ld models published, slowest sample took %ld us\n", learned,
+			learnDropped, publications, slowestLearn);
+	pthread_mutex_unlock(&ringMutex);
+}
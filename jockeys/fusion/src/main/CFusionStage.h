@@ -0,0 +1,195 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Pairs the laser scans and the camera frames of the same moment and classifies them with CFusion
+ * @file CFusionStage.h
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 14, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#ifndef CFUSIONSTAGE_H_
+#define CFUSIONSTAGE_H_
+
+#include <CFusion.h>
+#include <CMessage.h>
+#include <messageDataType.h>
+
+#include <pthread.h>
+#include <semaphore.h>
+
+//! Laser scans that wait for a camera frame, a power of two
+#define FUSION_SCANS 4
+//! Camera frames that wait for a laser scan, a power of two, the camera runs faster than the laser
+#define FUSION_FRAMES 8
+
+//! A scan and a frame that are captured further apart than this, in microseconds, are not of the same moment
+#define FUSION_MAX_SKEW 50000
+
+//! The laser vector is averaged over this many bands of rows, the input of the laser network
+#define FUSION_LASER_FEATURES 16
+//! Area, bearing and confidence of a detection, the input of the blob network
+#define FUSION_BLOB_FEATURES 3
+
+//! Samples that wait for the learner, a power of two, the oldest is dropped when the learner falls behind
+#define FUSION_LEARN_SAMPLES 32
+//! The learner publishes its model after this many samples, or earlier when no sample came for FUSION_POLL ms
+#define FUSION_PUBLISH_SAMPLES 16
+
+//! Size of the camera image, the area of a detection is a fraction of it
+#define FUSION_IMAGE_WIDTH 640
+#define FUSION_IMAGE_HEIGHT 480
+
+//! Sends a hypothesis, CMessageServer::sendMessage in the jockey
+typedef void (*FusionPublisher)(const FusionObject & object, void *arg);
+
+/**
+ * The message server only keeps the last message of every type, so the stage sees every MSG_LASER_SCAN and
+ * MSG_CAM_DETECTED_BATCH through input(), on the IPC thread. Both keep their capture time in microseconds of the
+ * same clock, input() only decodes them into two rings, the oldest entry is overwritten when a ring is full. The
+ * thread of the stage pairs the oldest scan with the frame nearest in time as soon as a frame after the scan is
+ * there, or no frame can come any closer, and classifies the scan with every detection of that frame. A scan without
+ * a frame within FUSION_MAX_SKEW is dropped, so is a frame that is too old for every scan that is still to come.
+ *
+ * Recognition and learning do not share a network. The thread of the stage classifies with a snapshot that only it
+ * uses, while a learner thread learns the same samples on the CFusion given to the constructor. The learner publishes
+ * a copy of its model by exchanging a pointer, and the stage takes it before its next pair and hands back the snapshot
+ * it is done with, which the next copy overwrites. Neither thread waits for the other, so a long learning step does
+ * not delay a recognition, and the recognition learns with a delay of at most FUSION_PUBLISH_SAMPLES samples.
+ */
+class CFusionStage {
+public:
+	CFusionStage(CFusion *fusion);
+	~CFusionStage();
+
+	int start();
+	//! Scans and frames that still wait are discarded, a classification that runs is finished first
+	void stop();
+
+	//! Called from the IPC thread with every message, takes MSG_LASER_SCAN and MSG_CAM_DETECTED_BATCH
+	void input(int type, const void *data, int len);
+
+	void setPublisher(FusionPublisher publisher, void *arg);
+
+	//! Learn from the stream as well as search, be careful as every new object takes memory
+	inline void setLearning(bool learn) { learning = learn; }
+	inline bool isLearning() { return learning; }
+
+	//! For everything outside of the learner thread that uses the CFusion, such as saving its memory
+	void lock();
+	void unlock();
+
+	//! Classify with a copy of the CFusion from the next pair on, after its memory is loaded, see lock()
+	void publish();
+
+	void printStatistics();
+
+	inline long getPaired() { return paired; }
+	inline long getPublished() { return published; }
+
+private:
+	struct Scan {
+		LaserScanHeader header;
+		int16_t columns[MAX_LASER_SCAN_ROWS];
+	};
+
+	//! The features of a pair, learned by the learner thread
+	struct Sample {
+		ART_TYPE laser[FUSION_LASER_FEATURES];
+		ART_TYPE blob[FUSION_BLOB_FEATURES];
+	};
+
+	static void* run(void *stage);
+	void fusionLoop();
+	static void* runLearner(void *stage);
+	void learnLoop();
+
+	enum Alignment {
+		ALIGN_WAIT = 0, //!< The oldest scan may still get a closer frame, or there is no scan
+		ALIGN_PAIRED, //!< The oldest scan and its frame are copied to pairedScan and pairedFrame
+		ALIGN_DROPPED //!< The oldest scan had no frame close enough
+	};
+
+	//! Called with ringMutex, takes the oldest scan out of the ring unless it has to wait
+	Alignment align();
+
+	void classify(const Scan & scan, const DetectionBatch & frame);
+	//! Take the snapshot that is published last, if there is a new one
+	void takeModel();
+	//! Queue the features of a pair for the learner
+	void teach(const ART_ASPECT & laser, const ART_ASPECT & blob);
+	void learn(const Sample & sample);
+	void laserFeature(const Scan & scan, ART_ASPECT & feature);
+	void blobFeature(const DetectionBatch & frame, int detection, ART_ASPECT & feature);
+
+	//! The CFusion that learns, used by the learner thread and under lock()
+	CFusion *fusion;
+	//! The snapshot the thread of the stage classifies with, no other thread uses it
+	CFusion *model;
+	//! A snapshot that is published and not taken yet, and one that was replaced, both only exchanged atomically
+	CFusion *pending;
+	CFusion *retired;
+	pthread_t thread;
+	pthread_t learner;
+	volatile bool running;
+	volatile bool learning;
+	pthread_mutex_t fusionMutex;
+
+	pthread_mutex_t learnMutex;
+	sem_t learnWork;
+	Sample samples[FUSION_LEARN_SAMPLES];
+	//! Next free and oldest sample, under learnMutex
+	unsigned int sampleHead, sampleTail;
+	//! Scratch of the learner thread
+	Sample learnSample;
+	int learnClasses[3];
+
+	pthread_mutex_t ringMutex;
+	sem_t work;
+	Scan scans[FUSION_SCANS];
+	DetectionBatch frames[FUSION_FRAMES];
+	//! Next free and oldest entry of the rings, under ringMutex
+	unsigned int scanHead, scanTail;
+	unsigned int frameHead, frameTail;
+
+	FusionPublisher publisher;
+	void *publisherArg;
+
+	//! Scratch of the thread, so a classification does not allocate
+	Scan pairedScan;
+	DetectionBatch pairedFrame;
+	ART_ASPECT laser;
+	ART_ASPECT blob;
+	int classes[3];
+
+	long scansIn, framesIn, invalid;
+	//! Scans and frames that were overwritten before the thread got to them
+	long overwritten;
+	//! Scans without a frame close enough, and frames that were too old for any scan
+	long unpairedScans, unpairedFrames;
+	long paired, published;
+	//! Slowest classification of a pair in us
+	long slowest;
+	//! Samples the learner learned, and those it had no time for, and the snapshots it published
+	long learned, learnDropped, publications;
+	//! Slowest sample the learner learned in us
+	long slowestLearn;
+};
+
+#endif /* CFUSIONSTAGE_H_ */
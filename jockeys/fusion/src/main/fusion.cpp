@@ -0,0 +1,166 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Classify the laser scans and the camera detections of the same moment online and publish the objects
+ * @file fusion.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 14, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <iostream>
+#include <string>
+
+/***********************************************************************************************************************
+ * Jockey framework includes
+ **********************************************************************************************************************/
+
+#include <CMessageServer.h>
+#include <CFusionStage.h>
+
+/***********************************************************************************************************************
+ * Most important configuration parameters
+ **********************************************************************************************************************/
+
+//! The name of the controller can be used for controller selection
+static const std::string NAME = "Fusion";
+
+//! Convenience function for printing to standard out
+#define DEBUG NAME << '[' << getpid() << "] " << __func__ << "(): "
+
+/***********************************************************************************************************************
+ * Implementation
+ **********************************************************************************************************************/
+
+//! Global stop condition
+bool gStop = false;
+
+void sigproc(int) {
+	if (!gStop) {
+		gStop = true;
+		std::cout << "You used Ctrl+c to quit. We will gracefully end. User Ctrl+\\ if you want to end directly."
+				<< std::endl;
+	}
+}
+
+//! Every incoming message passes here on the IPC thread, before the server keeps only the last one of its type
+static void tapMessage(int type, const void *data, int len, bool outgoing, void *arg) {
+	if (outgoing) return;
+	((CFusionStage*) arg)->input(type, data, len);
+}
+
+static void publishObject(const FusionObject & object, void *arg) {
+	((CMessageServer*) arg)->sendMessage(MSG_FUSION_OBJECT, &object, sizeof(FusionObject));
+}
+
+/**
+ * The laser scans and the detections are only sent after MSG_LASER_SCAN_STREAM to the laserscan jockey and
+ * MSG_CAM_BATCH_MODE to the cameradetection jockey, that is up to whoever selects the jockeys. This jockey subscribes
+ * to both on MSG_START. The memory of CFusion is loaded on MSG_INIT from the prefix given, and when it learns it is
+ * saved there again on MSG_QUIT.
+ */
+int main(int argc, char **argv) {
+
+	signal(SIGINT, sigproc);
+
+	std::cout << "################################################################################" << std::endl;
+	std::cout << "Run " << NAME << " compiled at time " << __TIME__ << std::endl;
+	std::cout << "################################################################################" << std::endl;
+
+	if (argc < 2 || argc > 4) {
+		std::cout << DEBUG << "Usage: message_server_port_number [memory_prefix [learn]]" << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::string memory = (argc >= 3) ? std::string(argv[2]) : std::string();
+	bool learn = (argc == 4) && (std::string(argv[3]) == "learn");
+
+	CFusion fusion;
+	CFusionStage stage(&fusion);
+	stage.setLearning(learn);
+
+	CMessageServer *server = new CMessageServer();
+	server->initServer(argv[1]);
+	stage.setPublisher(publishObject, server);
+	server->setTap(tapMessage, &stage);
+
+	CMessage message;
+	bool quitController = false;
+
+	while (!quitController) {
+		usleep(50000);
+
+		message = server->getMessage();
+
+		if (message.type != MSG_NONE) {
+			std::cout << DEBUG << "Command: " << message.getStrType() << std::endl;
+		}
+
+		if (gStop) {
+			message.type = MSG_QUIT;
+		}
+
+		switch (message.type) {
+		case MSG_INIT: {
+			if (!memory.empty()) {
+				std::cout << DEBUG << "Load memory from " << memory << std::endl;
+				stage.lock();
+				fusion.loadMemory(memory);
+				stage.unlock();
+				stage.publish();
+			}
+			server->sendMessage(MSG_ACKNOWLEDGE, NULL, 0);
+			break;
+		}
+		case MSG_START: {
+			server->subscribe(MSG_LASER_SCAN);
+			server->subscribe(MSG_CAM_DETECTED_BATCH);
+			stage.start();
+			server->sendMessage(MSG_ACKNOWLEDGE, NULL, 0);
+			std::cout << DEBUG << "Started controller" << (learn ? ", it learns" : "") << std::endl;
+			break;
+		}
+		case MSG_STOP: {
+			server->unsubscribe(MSG_LASER_SCAN);
+			server->unsubscribe(MSG_CAM_DETECTED_BATCH);
+			stage.stop();
+			server->sendMessage(MSG_ACKNOWLEDGE, NULL, 0);
+			break;
+		}
+		case MSG_QUIT: {
+			stage.stop();
+			if (learn && !memory.empty()) {
+				std::cout << DEBUG << "Save memory to " << memory << std::endl;
+				fusion.saveMemory(memory);
+			}
+			server->sendMessage(MSG_ACKNOWLEDGE, NULL, 0);
+			quitController = true;
+			break;
+		}
+		default:
+			break;
+		}
+	}
+	server->setTap(NULL, NULL);
+	stage.printStatistics();
+	delete server;
+	return EXIT_SUCCESS;
+}
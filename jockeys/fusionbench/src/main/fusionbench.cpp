@@ -0,0 +1,455 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Measure learning and searching of Art, ArtMap and CFusion on synthetic clusters or recorded features
+ * @file fusionbench.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Testing
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+/***********************************************************************************************************************
+ * Jockey framework includes
+ **********************************************************************************************************************/
+
+#include <CFusion.h>
+#include <artFixed.h>
+
+/***********************************************************************************************************************
+ * Implementation
+ **********************************************************************************************************************/
+
+//! The sizes of the features of the fusion jockey, 16 bands of the laser and the area, bearing and confidence of a blob
+#define LASER_FEATURES 16
+#define BLOB_FEATURES 3
+
+#define MAX_THREADS 64
+
+//! Samples with the features of both modalities stored row after row, and the class of each sample
+struct FeatureSet {
+	int sizeA;
+	int sizeB;
+	int classes;
+	std::vector<ART_TYPE> featuresA;
+	std::vector<ART_TYPE> featuresB;
+	std::vector<int> labels;
+
+	inline int count() const { return labels.size(); }
+};
+
+//! What one way of searching a trained network costs and how well it does
+struct SearchResult {
+	const char *backend;
+	double inputsPerSecond;
+	int memory;
+	float accuracy;
+};
+
+static double seconds(const struct timeval & start, const struct timeval & end) {
+	return (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+}
+
+//! A xorshift generator, so the synthetic data is the same on every platform for the same seed
+static inline float uniform(uint32_t & state) {
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return (state >> 8) / (float)(1 << 24);
+}
+
+//! Approximately normal, the sum of four uniform values, clamped to the range of the inputs of Art
+static inline float around(uint32_t & state, float mean, float spread) {
+	float noise = (uniform(state) + uniform(state) + uniform(state) + uniform(state) - 2) * spread;
+	return std::max(0.0f, std::min(1.0f, mean + noise));
+}
+
+/**
+ * Every class has a center in both modalities and its samples are spread around it, the classes of the samples are
+ * drawn at random, so the training and the test half both see every class.
+ *
+ * @param classes            number of clusters
+ * @param count              number of samples
+ * @param spread             width of a cluster around its center
+ * @param seed               seed of the generator, not 0
+ * @param set                the samples, with the sizes already set
+ */
+void generateClusters(int classes, int count, float spread, uint32_t seed, FeatureSet & set) {
+	uint32_t state = seed ? seed : 1;
+	std::vector<ART_TYPE> centersA(classes * set.sizeA), centersB(classes * set.sizeB);
+	for (int i = 0; i < (int)centersA.size(); ++i) centersA[i] = 0.15f + 0.7f * uniform(state);
+	for (int i = 0; i < (int)centersB.size(); ++i) centersB[i] = 0.15f + 0.7f * uniform(state);
+
+	set.classes = classes;
+	set.featuresA.resize(count * set.sizeA);
+	set.featuresB.resize(count * set.sizeB);
+	set.labels.resize(count);
+	for (int x = 0; x < count; ++x) {
+		int label = (int)(uniform(state) * classes) % classes;
+		set.labels[x] = label;
+		for (int i = 0; i < set.sizeA; ++i)
+			set.featuresA[x * set.sizeA + i] = around(state, centersA[label * set.sizeA + i], spread);
+		for (int i = 0; i < set.sizeB; ++i)
+			set.featuresB[x * set.sizeB + i] = around(state, centersB[label * set.sizeB + i], spread);
+	}
+}
+
+/**
+ * Read recorded features, one sample per line: the class, then the laser features and then the blob features,
+ * separated by spaces or commas. Lines that start with # and lines with too few values are skipped. The features
+ * are expected in [0,1], as CFusionStage normalizes them.
+ *
+ * @param fileName           the log of features
+ * @param set                the samples, with the sizes already set
+ * @return                   success (0), failure (-1)
+ */
+int readFeatures(const char *fileName, FeatureSet & set) {
+	FILE *file = fopen(fileName, "r");
+	if (file == NULL) {
+		fprintf(stderr, "Cannot open features %s\n", fileName);
+		return -1;
+	}
+	int values = 1 + set.sizeA + set.sizeB;
+	std::vector<float> row(values);
+	char line[4096];
+	int skipped = 0;
+	set.classes = 0;
+	while (fgets(line, sizeof(line), file) != NULL) {
+		if (line[0] == '#') continue;
+		int read = 0;
+		char *next = line;
+		while (read < values) {
+			while (*next == ' ' || *next == ',' || *next == '\t') next++;
+			char *end;
+			row[read] = strtof(next, &end);
+			if (end == next) break;
+			next = end;
+			read++;
+		}
+		if (read < values || row[0] < 0) {
+			if (read > 0) skipped++;
+			continue;
+		}
+		int label = (int)row[0];
+		set.labels.push_back(label);
+		set.classes = std::max(set.classes, label + 1);
+		set.featuresA.insert(set.featuresA.end(), row.begin() + 1, row.begin() + 1 + set.sizeA);
+		set.featuresB.insert(set.featuresB.end(), row.begin() + 1 + set.sizeA, row.end());
+	}
+	fclose(file);
+	if (skipped) fprintf(stderr, "Skipped %i lines of %s with less than %i values\n", skipped, fileName, values);
+	return 0;
+}
+
+//! Copy the samples [first, last) of a set
+void split(const FeatureSet & set, int first, int last, FeatureSet & part) {
+	part.sizeA = set.sizeA;
+	part.sizeB = set.sizeB;
+	part.classes = set.classes;
+	part.featuresA.assign(set.featuresA.begin() + first * set.sizeA, set.featuresA.begin() + last * set.sizeA);
+	part.featuresB.assign(set.featuresB.begin() + first * set.sizeB, set.featuresB.begin() + last * set.sizeB);
+	part.labels.assign(set.labels.begin() + first, set.labels.begin() + last);
+}
+
+/**
+ * Every prototype gets the class that most of the training samples it is chosen for have, prototypes that are never
+ * chosen get -1. So the accuracy of an unsupervised network is the purity of its categories.
+ */
+void labelPrototypes(const std::vector<int> & choices, const std::vector<int> & labels, int prototypes, int classes,
+		std::vector<int> & prototypeLabels) {
+	std::vector<int> votes(prototypes * classes, 0);
+	for (int x = 0; x < (int)choices.size(); ++x) {
+		if (choices[x] >= 0 && choices[x] < prototypes) votes[choices[x] * classes + labels[x]]++;
+	}
+	prototypeLabels.assign(prototypes, -1);
+	for (int p = 0; p < prototypes; ++p) {
+		int best = 0;
+		for (int c = 0; c < classes; ++c) {
+			if (votes[p * classes + c] > best) {
+				best = votes[p * classes + c];
+				prototypeLabels[p] = c;
+			}
+		}
+	}
+}
+
+float accuracy(const std::vector<int> & choices, const std::vector<int> & labels,
+		const std::vector<int> & prototypeLabels) {
+	if (choices.empty()) return 0;
+	int correct = 0;
+	for (int x = 0; x < (int)choices.size(); ++x) {
+		int choice = choices[x];
+		if (choice >= 0 && choice < (int)prototypeLabels.size() && prototypeLabels[choice] == labels[x]) correct++;
+	}
+	return correct / (float)choices.size();
+}
+
+/**
+ * Search the test features with a trained network in every way there is. The float search is the kernel of
+ * Art::classifyBatch() on one thread, the lanes of which are vectorized by the compiler, threaded is the same over
+ * several threads, quantized is ArtFixed and indexed is Art with pruning on its first two inputs.
+ *
+ * @param art                the trained network
+ * @param inputs             test features, row after row
+ * @param count              number of test features
+ * @param size               size of a feature
+ * @param labels             class of every test feature
+ * @param prototypeLabels    class of every prototype
+ * @param threads            threads of the threaded search
+ * @param repeat             number of times every search is timed
+ * @param results            a result per backend
+ */
+void compareBackends(Art & art, const ART_TYPE *inputs, int count, int size, const std::vector<int> & labels,
+		const std::vector<int> & prototypeLabels, int threads, int repeat, std::vector<SearchResult> & results) {
+	std::vector<int> choices(count);
+	struct timeval start, end;
+	bool testMatch = art.getTestMatch();
+	art.setTestMatch(true);
+
+	for (int backend = 0; backend < 4; ++backend) {
+		SearchResult result;
+		ArtFixed fixed;
+		result.memory = art.getMemoryUsage();
+		switch (backend) {
+		case 0: result.backend = "float"; break;
+		case 1: result.backend = "threaded"; break;
+		case 2:
+			result.backend = "quantized";
+			if (!fixed.convert(art)) continue;
+			result.memory = fixed.getMemoryUsage();
+			break;
+		case 3:
+			result.backend = "indexed";
+			art.setPruning(true);
+			break;
+		}
+
+		gettimeofday(&start, NULL);
+		for (int r = 0; r < repeat; ++r) {
+			if (backend == 2)
+				fixed.classifyBatch(inputs, count, size, &choices[0]);
+			else
+				art.classifyBatch(inputs, count, size, &choices[0], NULL, backend == 1 ? threads : 1);
+		}
+		gettimeofday(&end, NULL);
+		if (backend == 3) art.setPruning(false);
+
+		double elapsed = seconds(start, end);
+		result.inputsPerSecond = elapsed > 0 ? (double)count * repeat / elapsed : 0;
+		result.accuracy = accuracy(choices, labels, prototypeLabels);
+		results.push_back(result);
+	}
+	art.setTestMatch(testMatch);
+}
+
+void printResults(const char *name, const std::vector<SearchResult> & results) {
+	for (int i = 0; i < (int)results.size(); ++i) {
+		const SearchResult & result = results[i];
+		printf("  %-10s search %-10s %12.0f inputs/s %10i bytes accuracy %.3f\n", name, result.backend,
+				result.inputsPerSecond, result.memory, result.accuracy);
+	}
+}
+
+/**
+ * Learn the features of one modality with a stand-alone network, as configured in CFusion, and search the test set
+ * with the trained network. With compare every backend searches the test set, otherwise only the float search.
+ */
+void benchmarkArt(const char *name, const std::vector<ART_TYPE> & train, const std::vector<ART_TYPE> & test,
+		int size, const FeatureSet & trainSet, const FeatureSet & testSet, float vigilance, float learningFraction,
+		bool compare, int threads, int repeat) {
+	Art art(false, true, true);
+	art.setVigilance(vigilance);
+	art.setLearningFraction(learningFraction);
+	int trainCount = trainSet.count();
+	std::vector<int> choices(trainCount);
+
+	struct timeval start, end;
+	art.setTestMatch(false);
+	gettimeofday(&start, NULL);
+	art.classifyBatch(&train[0], trainCount, size, &choices[0]);
+	gettimeofday(&end, NULL);
+	double elapsed = seconds(start, end);
+	printf("  %-10s learn  %-10s %12.0f inputs/s %10i bytes %i categories\n", name, "float",
+			elapsed > 0 ? trainCount / elapsed : 0.0, art.getMemoryUsage(), art.getPrototypeCount());
+
+	// the categories are labeled with what the trained network chooses for the training set
+	art.setTestMatch(true);
+	art.classifyBatch(&train[0], trainCount, size, &choices[0]);
+	std::vector<int> prototypeLabels;
+	labelPrototypes(choices, trainSet.labels, art.getPrototypeCount(), trainSet.classes, prototypeLabels);
+
+	std::vector<SearchResult> results;
+	compareBackends(art, &test[0], testSet.count(), size, testSet.labels, prototypeLabels, threads, repeat, results);
+	if (!compare) results.resize(1);
+	printResults(name, results);
+}
+
+/**
+ * Learn both modalities and the class of every sample, one hot, through the map field of CFusion. A test sample
+ * is classified without its class and the prototype of the reward network it maps to tells the class.
+ */
+void benchmarkFusion(const FeatureSet & trainSet, const FeatureSet & testSet, float vigilanceA, float vigilanceB,
+		float learningFraction) {
+	CFusion fusion;
+	fusion.setVigilance(vigilanceA, vigilanceB);
+	fusion.getFeatureA().setLearningFraction(learningFraction);
+	fusion.getFeatureB().setLearningFraction(learningFraction);
+
+	int classes = trainSet.classes;
+	int trainCount = trainSet.count();
+	std::vector<ART_TYPE> rewards(trainCount * classes, 0);
+	for (int x = 0; x < trainCount; ++x) rewards[x * classes + trainSet.labels[x]] = 1;
+	std::vector<int> classified(3 * std::max(trainCount, testSet.count()));
+
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+	fusion.classifyBatch(&trainSet.featuresA[0], trainSet.sizeA, &trainSet.featuresB[0], trainSet.sizeB,
+			&rewards[0], classes, trainCount, false, &classified[0]);
+	gettimeofday(&end, NULL);
+	double elapsed = seconds(start, end);
+	printf("  %-10s learn  %-10s %12.0f inputs/s %10i bytes %i/%i/%i categories, %i map nodes\n", "fusion", "float",
+			elapsed > 0 ? trainCount / elapsed : 0.0, fusion.getMemoryUsage(),
+			fusion.getFeatureA().getPrototypeCount(), fusion.getFeatureB().getPrototypeCount(),
+			fusion.getRewards().getPrototypeCount(), fusion.getArtMap().getNrMapNodes());
+
+	int testCount = testSet.count();
+	gettimeofday(&start, NULL);
+	fusion.classifyBatch(&testSet.featuresA[0], testSet.sizeA, &testSet.featuresB[0], testSet.sizeB,
+			NULL, 0, testCount, true, &classified[0]);
+	gettimeofday(&end, NULL);
+	elapsed = seconds(start, end);
+
+	Art & reward = fusion.getRewards();
+	int correct = 0;
+	for (int x = 0; x < testCount; ++x) {
+		int choice = classified[3 * x + 2];
+		if (choice < 0 || choice >= reward.getPrototypeCount()) continue;
+		const ART_TYPE *prototype = reward.getPrototype(choice);
+		int size = std::min(reward.getPrototypeSize(choice), classes);
+		int label = (int)(std::max_element(prototype, prototype + size) - prototype);
+		if (label == testSet.labels[x]) correct++;
+	}
+	printf("  %-10s search %-10s %12.0f inputs/s %10i bytes accuracy %.3f\n", "fusion", "float",
+			elapsed > 0 ? testCount / elapsed : 0.0, fusion.getMemoryUsage(),
+			testCount > 0 ? correct / (float)testCount : 0.0f);
+}
+
+void usage(const char *name) {
+	printf("Usage: %s [options] [<features> ...]\n", name);
+	printf("Learns features with Art and CFusion and reports inputs/s, categories, bytes and accuracy. Without\n");
+	printf("files synthetic clusters are used, a file has a line per sample: class, laser features, blob features\n");
+	printf("  -v vigilance  vigilance of the laser network (default 0.97)\n");
+	printf("  -w vigilance  vigilance of the blob network (default 0.95)\n");
+	printf("  -l fraction   learning fraction of both networks (default 1, fast learning)\n");
+	printf("  -a size       laser features per sample (default %i)\n", LASER_FEATURES);
+	printf("  -b size       blob features per sample (default %i)\n", BLOB_FEATURES);
+	printf("  -t fraction   fraction of the samples to learn, the rest is searched (default 0.5)\n");
+	printf("  -c classes    synthetic clusters (default 4)\n");
+	printf("  -n samples    synthetic samples (default 2000)\n");
+	printf("  -s spread     width of a synthetic cluster (default 0.05)\n");
+	printf("  -r seed       seed of the synthetic clusters (default 1)\n");
+	printf("  -B            compare the float, threaded, quantized and indexed searches\n");
+	printf("  -j threads    threads of the threaded search (default the number of processors, at most %i)\n",
+			MAX_THREADS);
+	printf("  -R repeat     times every search is repeated for timing (default 1)\n");
+	printf("  -F            skip CFusion, only the stand-alone networks\n");
+}
+
+/**
+ * The parameters are the same for the whole run, so a sweep over the vigilance or the learning fraction is a loop
+ * over calls of this binary. Learning is timed on the training part, searching on the rest.
+ */
+int main(int argc, char **argv) {
+	float vigilanceA = 0.97f, vigilanceB = 0.95f, learningFraction = 1;
+	float trainFraction = 0.5f, spread = 0.05f;
+	int classes = 4, samples = 2000, repeat = 1;
+	uint32_t seed = 1;
+	bool compare = false, fusion = true;
+	int threads = sysconf(_SC_NPROCESSORS_ONLN);
+	FeatureSet set;
+	set.sizeA = LASER_FEATURES;
+	set.sizeB = BLOB_FEATURES;
+	set.classes = 0;
+
+	int option;
+	while ((option = getopt(argc, argv, "v:w:l:a:b:t:c:n:s:r:Bj:R:Fh")) != -1) {
+		switch (option) {
+		case 'v': vigilanceA = atof(optarg); break;
+		case 'w': vigilanceB = atof(optarg); break;
+		case 'l': learningFraction = atof(optarg); break;
+		case 'a': set.sizeA = atoi(optarg); break;
+		case 'b': set.sizeB = atoi(optarg); break;
+		case 't': trainFraction = atof(optarg); break;
+		case 'c': classes = atoi(optarg); break;
+		case 'n': samples = atoi(optarg); break;
+		case 's': spread = atof(optarg); break;
+		case 'r': seed = strtoul(optarg, NULL, 10); break;
+		case 'B': compare = true; break;
+		case 'j': threads = atoi(optarg); break;
+		case 'R': repeat = atoi(optarg); break;
+		case 'F': fusion = false; break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (set.sizeA < 1 || set.sizeB < 1 || classes < 1 || samples < 2 || trainFraction <= 0 || trainFraction >= 1) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (threads < 1) threads = 1;
+	if (threads > MAX_THREADS) threads = MAX_THREADS;
+	if (repeat < 1) repeat = 1;
+
+	if (optind < argc) {
+		for (int i = optind; i < argc; ++i) {
+			if (readFeatures(argv[i], set) < 0) return EXIT_FAILURE;
+		}
+		printf("Read %i samples of %i classes\n", set.count(), set.classes);
+	} else {
+		generateClusters(classes, samples, spread, seed, set);
+		printf("Generated %i samples in %i clusters of spread %.3f\n", set.count(), set.classes, spread);
+	}
+	int trainCount = (int)(set.count() * trainFraction);
+	if (trainCount < 1 || trainCount >= set.count()) {
+		fprintf(stderr, "Too few samples to learn and search\n");
+		return EXIT_FAILURE;
+	}
+	FeatureSet trainSet, testSet;
+	split(set, 0, trainCount, trainSet);
+	split(set, trainCount, set.count(), testSet);
+
+	printf("Learn %i and search %i samples, vigilance %.3f/%.3f, learning fraction %.3f\n", trainSet.count(),
+			testSet.count(), vigilanceA, vigilanceB, learningFraction);
+	benchmarkArt("laser", trainSet.featuresA, testSet.featuresA, set.sizeA, trainSet, testSet, vigilanceA,
+			learningFraction, compare, threads, repeat);
+	benchmarkArt("blob", trainSet.featuresB, testSet.featuresB, set.sizeB, trainSet, testSet, vigilanceB,
+			learningFraction, compare, threads, repeat);
+	if (fusion) benchmarkFusion(trainSet, testSet, vigilanceA, vigilanceB, learningFraction);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,506 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Measure the throughput and round trip latency of the IPC between CEquids and its jockeys
+ * @file ipcbench.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 14, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Testing
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <vector>
+#include <deque>
+#include <string>
+#include <algorithm>
+
+/***********************************************************************************************************************
+ * Jockey framework includes
+ **********************************************************************************************************************/
+
+#include <ipc.hh>
+#include <shmipc.hh>
+#include <CEquids.h>
+#include <CJockey.h>
+
+/***********************************************************************************************************************
+ * Implementation
+ **********************************************************************************************************************/
+
+//! Connections of one run, every one is a CJockey of the same CEquids
+#define MAX_CONNECTIONS 16
+
+#define DEFAULT_ROUNDS 2000
+#define DEFAULT_WINDOW 8
+#define DEFAULT_PORT 12000
+
+//! A run is aborted if no answer arrives within this time
+#define ROUND_TIMEOUT_MS 2000
+
+//! Large payloads get fewer round trips, so every run moves about this many bytes per connection
+#define BYTES_PER_CONNECTION (16 << 20)
+
+//! A record takes at most half of the ring of the shared memory transport, larger payloads are refused
+#define SHM_MAX_PAYLOAD (SHMIPCRINGSIZE / 2 - (int) sizeof(IPC::SharedRecord))
+
+typedef enum {
+	//! The jockeys receive and send with their own threads, CJockey uses the reactor of CEquids
+	MODE_TCP = 0,
+	//! The jockeys serve their connection from a reactor as well
+	MODE_REACTOR,
+	//! CEquids and the jockeys talk over shared memory, as with transport=shm
+	MODE_SHM,
+	//! Pairs of jockeys ping each other through the redirections of CEquids
+	MODE_ROUTED,
+	MODES
+} BenchMode;
+
+static const char *StrMode[] = { "tcp", "reactor", "shm", "routed" };
+
+static const int PayloadSizes[] = { 0, 64, 1024, 4096, 16384, 65000 };
+
+//! Round trips of one connection, the answers come back in the order of the pings
+struct BenchLink {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	//! Time every outstanding ping was sent
+	std::deque<long long> sent;
+	//! Round trip of every answered ping in microseconds
+	std::vector<int> latencies;
+	int outstanding;
+	int failed;
+	int bad;
+};
+
+//! The jockey end of a connection, it answers every MSG_PING and completes the round trips of its link on MSG_PONG
+struct BenchJockey {
+	IPC::IPC *ipc;
+	BenchLink *link;
+	int len;
+};
+
+struct BenchRun {
+	BenchMode mode;
+	int connections;
+	int len;
+	int rounds;
+	int window;
+	CEquids *equids;
+	BenchJockey jockeys[MAX_CONNECTIONS];
+	BenchLink links[MAX_CONNECTIONS];
+	std::vector<uint8_t> payload;
+	bool timeout;
+};
+
+struct BenchDriver {
+	BenchRun *run;
+	int index;
+	pthread_t thread;
+};
+
+struct BenchResult {
+	BenchMode mode;
+	int connections;
+	int len;
+	int window;
+	int completed;
+	int lost;
+	int failed;
+	int bad;
+	double elapsed;
+	int p50;
+	int p99;
+	int max;
+};
+
+static long long now() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (long long)time.tv_sec * 1000000 + time.tv_nsec / 1000;
+}
+
+static struct timespec deadline(int timeout) {
+	struct timespec time;
+	clock_gettime(CLOCK_REALTIME, &time);
+	long long end = (long long)time.tv_nsec + (long long)timeout * 1000000;
+	time.tv_sec += end / 1000000000;
+	time.tv_nsec = end % 1000000000;
+	return time;
+}
+
+static void complete(BenchLink *link, bool ok) {
+	pthread_mutex_lock(&link->mutex);
+	if (!link->sent.empty()) {
+		link->latencies.push_back(now() - link->sent.front());
+		link->sent.pop_front();
+		link->outstanding--;
+	}
+	if (!ok) link->bad++;
+	pthread_cond_broadcast(&link->cond);
+	pthread_mutex_unlock(&link->mutex);
+}
+
+//! The time is taken before the send, an answer can arrive before SendData returns
+static bool ping(BenchLink *link, IPC::IPC & ipc, std::vector<uint8_t> & payload) {
+	pthread_mutex_lock(&link->mutex);
+	link->sent.push_back(now());
+	link->outstanding++;
+	pthread_mutex_unlock(&link->mutex);
+	if (ipc.SendData(MSG_PING, payload.empty() ? NULL : &payload[0], payload.size())) return true;
+	pthread_mutex_lock(&link->mutex);
+	if (!link->sent.empty()) {
+		link->sent.pop_back();
+		link->outstanding--;
+	}
+	link->failed++;
+	pthread_mutex_unlock(&link->mutex);
+	return false;
+}
+
+static int outstanding(BenchLink *link) {
+	pthread_mutex_lock(&link->mutex);
+	int count = link->outstanding;
+	pthread_mutex_unlock(&link->mutex);
+	return count;
+}
+
+static void jockeyCallback(const ELolMessage *msg, void *connection, void *ptr) {
+	BenchJockey *jockey = (BenchJockey*) ptr;
+	if (msg->command == MSG_PING) {
+		// over shared memory there is no connection, the IPC of the jockey has only the shared channel
+		if (connection != NULL) {
+			((IPC::Connection*) connection)->SendData(MSG_PONG, (uint8_t*) msg->data, msg->length);
+		} else {
+			jockey->ipc->SendData(MSG_PONG, (uint8_t*) msg->data, msg->length);
+		}
+	} else if (msg->command == MSG_PONG && jockey->link != NULL) {
+		complete(jockey->link, (int) msg->length == jockey->len);
+	}
+}
+
+/**
+ * Pings the jockey through its CJockey and takes the answers from the queue of the CJockey, as the user of CEquids
+ * does. The pings go out with SendData of the IPC of the CJockey, because that tells when the queue is full.
+ */
+static void *driveDirect(BenchDriver *driver) {
+	BenchRun *run = driver->run;
+	BenchLink *link = &run->links[driver->index];
+	CJockey *jockey = run->equids->getJockey(driver->index);
+	int sent = 0;
+	long long refused_since = 0;
+	while (sent < run->rounds || outstanding(link) > 0) {
+		while (sent < run->rounds && outstanding(link) < run->window) {
+			if (!ping(link, jockey->jockey_IPC, run->payload)) break;
+			refused_since = 0;
+			sent++;
+		}
+		int count = jockey->messageCount(MSG_PONG);
+		CMessage message = jockey->getMessage();
+		if (message.type == MSG_PONG) {
+			complete(link, message.len == run->len);
+			continue;
+		}
+		if (message.type != MSG_NONE) continue;
+		if (outstanding(link) == 0) {
+			// the queue of the connection was full, give it time to drain
+			if (refused_since == 0) refused_since = now();
+			if (now() - refused_since > ROUND_TIMEOUT_MS * 1000LL) {
+				run->timeout = true;
+				break;
+			}
+			usleep(1000);
+			continue;
+		}
+		if (!jockey->waitForMessage(MSG_PONG, ROUND_TIMEOUT_MS, count)) {
+			run->timeout = true;
+			break;
+		}
+	}
+	return NULL;
+}
+
+//! The even jockey of a pair pings the odd one, the answers are completed in jockeyCallback
+static void *driveRouted(BenchDriver *driver) {
+	BenchRun *run = driver->run;
+	BenchLink *link = &run->links[driver->index];
+	BenchJockey *jockey = &run->jockeys[driver->index];
+	int sent = 0;
+	long long refused_since = 0;
+	pthread_mutex_lock(&link->mutex);
+	while (sent < run->rounds || link->outstanding > 0) {
+		while (sent < run->rounds && link->outstanding < run->window) {
+			pthread_mutex_unlock(&link->mutex);
+			bool ok = ping(link, *jockey->ipc, run->payload);
+			pthread_mutex_lock(&link->mutex);
+			if (!ok) break;
+			refused_since = 0;
+			sent++;
+		}
+		if (link->outstanding == 0) {
+			if (refused_since == 0) refused_since = now();
+			if (now() - refused_since > ROUND_TIMEOUT_MS * 1000LL) {
+				run->timeout = true;
+				break;
+			}
+			pthread_mutex_unlock(&link->mutex);
+			usleep(1000);
+			pthread_mutex_lock(&link->mutex);
+			continue;
+		}
+		int answered = link->latencies.size();
+		struct timespec end = deadline(ROUND_TIMEOUT_MS);
+		int ret = 0;
+		while ((int) link->latencies.size() == answered && ret != ETIMEDOUT) {
+			ret = pthread_cond_timedwait(&link->cond, &link->mutex, &end);
+		}
+		if (ret == ETIMEDOUT) {
+			run->timeout = true;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&link->mutex);
+	return NULL;
+}
+
+static void *drive(void *ptr) {
+	BenchDriver *driver = (BenchDriver*) ptr;
+	return (driver->run->mode == MODE_ROUTED) ? driveRouted(driver) : driveDirect(driver);
+}
+
+//! A jockey attaches to the segment of its port if there is one, also to one that an earlier run left behind
+static void removeSegment(int port) {
+	char name[32];
+	sprintf(name, SHMIPCNAME, port);
+	shm_unlink(name);
+}
+
+static int percentile(const std::vector<int> & sorted, double p) {
+	if (sorted.empty()) return 0;
+	int index = (int) (p * (sorted.size() - 1) + 0.5);
+	return sorted[index];
+}
+
+/**
+ * One CEquids with a CJockey per connection and a jockey IPC on the other end of each, on ports that no other run
+ * uses. The IPCs are stopped afterwards but not deleted, their threads may still be on their way out.
+ */
+static bool benchmark(BenchMode mode, int connections, int len, int rounds, int window, int port, BenchResult &result) {
+	memset(&result, 0, sizeof(result));
+	result.mode = mode;
+	result.connections = connections;
+	result.len = len;
+	result.window = window;
+	BenchRun *run = new BenchRun;
+	run->mode = mode;
+	run->connections = connections;
+	run->len = len;
+	run->rounds = rounds;
+	run->window = window;
+	run->timeout = false;
+	run->payload.resize(len);
+	for (int i = 0; i < len; ++i) run->payload[i] = (uint8_t) i;
+	run->equids = new CEquids();
+
+	for (int i = 0; i < connections; ++i) {
+		BenchLink *link = &run->links[i];
+		pthread_mutex_init(&link->mutex, NULL);
+		pthread_cond_init(&link->cond, NULL);
+		link->outstanding = link->failed = link->bad = 0;
+
+		BenchJockey *jockey = &run->jockeys[i];
+		jockey->ipc = new IPC::IPC();
+		jockey->link = link;
+		jockey->len = len;
+		char name[32];
+		sprintf(name, "bench%i", i);
+		jockey->ipc->Name(name);
+		jockey->ipc->SetCallback(jockeyCallback, jockey);
+		jockey->ipc->SetReactor(mode == MODE_REACTOR);
+
+		CJockey *client = run->equids->getJockey(i);
+		sprintf(client->name, "bench%i", i);
+		client->port_num = port + i;
+		removeSegment(port + i);
+		// the segment exists before the jockey starts, as in CEquids::start
+		if (mode == MODE_SHM && !client->jockey_IPC.CreateShared(port + i)) {
+			fprintf(stderr, "Cannot create shared memory for port %i\n", port + i);
+			return false;
+		}
+		if (!jockey->ipc->Start("localhost", port + i, true)) {
+			fprintf(stderr, "Cannot start jockey on port %i\n", port + i);
+			return false;
+		}
+	}
+	usleep(100000);
+	for (int i = 0; i < connections; ++i) {
+		run->equids->getJockey(i)->init(0, run->equids);
+	}
+	if (mode == MODE_ROUTED) {
+		for (int i = 0; i + 1 < connections; i += 2) {
+			run->equids->getJockey(i)->addRedirection(i + 1, MSG_PING);
+			run->equids->getJockey(i + 1)->addRedirection(i, MSG_PONG);
+		}
+	}
+	// a jockey only sends once CEquids is connected
+	for (int i = 0; mode != MODE_SHM && i < connections; ++i) {
+		for (int wait = 0; wait < 200 && run->jockeys[i].ipc->Connections()->empty(); ++wait) usleep(10000);
+	}
+
+	BenchDriver drivers[MAX_CONNECTIONS];
+	int step = (mode == MODE_ROUTED) ? 2 : 1;
+	long long start = now();
+	for (int i = 0; i < connections; i += step) {
+		drivers[i].run = run;
+		drivers[i].index = i;
+		pthread_create(&drivers[i].thread, NULL, drive, &drivers[i]);
+	}
+	for (int i = 0; i < connections; i += step) {
+		pthread_join(drivers[i].thread, NULL);
+	}
+	long long end = now();
+
+	std::vector<int> latencies;
+	result.mode = mode;
+	result.connections = connections;
+	result.len = len;
+	result.window = window;
+	result.completed = result.lost = result.failed = result.bad = 0;
+	for (int i = 0; i < connections; i += step) {
+		BenchLink *link = &run->links[i];
+		pthread_mutex_lock(&link->mutex);
+		latencies.insert(latencies.end(), link->latencies.begin(), link->latencies.end());
+		result.lost += link->outstanding;
+		result.failed += link->failed;
+		result.bad += link->bad;
+		pthread_mutex_unlock(&link->mutex);
+	}
+	std::sort(latencies.begin(), latencies.end());
+	result.completed = latencies.size();
+	result.elapsed = (end - start) / 1000000.0;
+	result.p50 = percentile(latencies, 0.5);
+	result.p99 = percentile(latencies, 0.99);
+	result.max = latencies.empty() ? 0 : latencies.back();
+
+	for (int i = 0; i < connections; ++i) {
+		run->equids->getJockey(i)->jockey_IPC.Stop();
+		run->jockeys[i].ipc->Stop();
+		if (mode == MODE_SHM) removeSegment(port + i);
+	}
+	usleep(200000);
+	return !run->timeout;
+}
+
+void usage(const char *name) {
+	printf("Usage: %s [options]\n", name);
+	printf("Sends MSG_PING from CEquids to jockeys that answer with MSG_PONG and reports the round trips\n");
+	printf("  -m mode     tcp, reactor, shm or routed, can be repeated (default all of them)\n");
+	printf("  -c number   connections, at most %i (default 1)\n", MAX_CONNECTIONS);
+	printf("  -s bytes    payload size, can be repeated (default 0, 64, 1024, 4096, 16384 and 65000)\n");
+	printf("  -n rounds   round trips per connection (default %i, fewer for large payloads)\n", DEFAULT_ROUNDS);
+	printf("  -w pings    pings in flight per connection (default %i)\n", DEFAULT_WINDOW);
+	printf("  -p port     first port, every run uses the next ports (default %i)\n", DEFAULT_PORT);
+	printf("In routed mode every even jockey pings the next one through the redirections of CEquids\n");
+}
+
+/**
+ * The jockeys run in this process, so the numbers are those of the IPC and the classes around it, not of the
+ * scheduling of separate processes. All runs are done before the table is printed, the IPCs print while they start.
+ */
+int main(int argc, char **argv) {
+	std::vector<int> modes;
+	std::vector<int> sizes;
+	int connections = 1;
+	int rounds = DEFAULT_ROUNDS;
+	int window = DEFAULT_WINDOW;
+	int port = DEFAULT_PORT;
+
+	int option;
+	while ((option = getopt(argc, argv, "m:c:s:n:w:p:h")) != -1) {
+		switch (option) {
+		case 'm': {
+			int mode = 0;
+			while (mode < MODES && strcmp(optarg, StrMode[mode]) != 0) mode++;
+			if (mode == MODES) {
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			modes.push_back(mode);
+			break;
+		}
+		case 'c': connections = atoi(optarg); break;
+		case 's': sizes.push_back(atoi(optarg)); break;
+		case 'n': rounds = atoi(optarg); break;
+		case 'w': window = atoi(optarg); break;
+		case 'p': port = atoi(optarg); break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (connections < 1 || connections > MAX_CONNECTIONS || rounds < 1 || window < 1) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (modes.empty()) {
+		for (int mode = 0; mode < MODES; ++mode) modes.push_back(mode);
+	}
+	if (sizes.empty()) {
+		sizes.assign(PayloadSizes, PayloadSizes + sizeof(PayloadSizes) / sizeof(PayloadSizes[0]));
+	}
+
+	std::vector<BenchResult> results;
+	for (unsigned int m = 0; m < modes.size(); ++m) {
+		// a pair is needed to route
+		int count = (modes[m] == MODE_ROUTED) ? std::max(2, connections & ~1) : connections;
+		for (unsigned int s = 0; s < sizes.size(); ++s) {
+			int len = std::max(0, std::min(sizes[s], IPC::IPC::RxBufferSize() - IPCHEADERSIZE - 1));
+			if (modes[m] == MODE_SHM) len = std::min(len, SHM_MAX_PAYLOAD);
+			int n = std::max(50, std::min(rounds, BYTES_PER_CONNECTION / std::max(len, 1)));
+			// the pings in flight have to fit in the transmit queue and the queue of the CJockey
+			int w = std::max(1, std::min(window, (IPC::IPC::TxBufferSize() / 2) / (len + IPCHEADERSIZE + 1)));
+			BenchResult result;
+			if (!benchmark((BenchMode) modes[m], count, len, n, w, port, result)) {
+				fprintf(stderr, "%s with %i bytes timed out after %i round trips\n", StrMode[modes[m]], len,
+						result.completed);
+			}
+			port += MAX_CONNECTIONS;
+			results.push_back(result);
+		}
+	}
+
+	printf("\n%-8s %5s %7s %6s %9s %11s %9s %8s %8s %8s %6s %6s\n", "mode", "conns", "payload", "window", "rounds",
+			"round/s", "MB/s", "p50 us", "p99 us", "max us", "lost", "full");
+	for (unsigned int i = 0; i < results.size(); ++i) {
+		const BenchResult & r = results[i];
+		double rate = (r.elapsed > 0) ? r.completed / r.elapsed : 0.0;
+		// the payload goes both ways
+		double bandwidth = rate * 2 * r.len / 1000000.0;
+		printf("%-8s %5i %7i %6i %9i %11.0f %9.2f %8i %8i %8i %6i %6i%s\n", StrMode[r.mode], r.connections, r.len,
+				r.window, r.completed, rate, bandwidth, r.p50, r.p99, r.max, r.lost, r.failed,
+				r.bad ? " (wrong length)" : "");
+	}
+	return EXIT_SUCCESS;
+}
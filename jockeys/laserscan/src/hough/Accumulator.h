@@ -24,6 +24,10 @@
 #ifndef ACCUMULATOR_H_
 #define ACCUMULATOR_H_
 
+#include <stdint.h>
+#include <algorithm>
+#include <limits>
+
 #include <HoughDefs.h>
 
 #include <nd-array.hpp>
@@ -34,9 +38,12 @@ namespace dobots {
  * The Hough transform uses a specific type of data structure that is called the accumulator in this context. It is
  * basically just a discretization of the Hough space. For lines, which have only two parameters, you will need a 2D
  * Hough space.
+ *
+ * The cells are stored in a 2-dimensional nd_array_fixed, so the index of a cell is inlined into every vote. The
+ * array with the rank at runtime still works, Accumulator<P, nd_array<Cell<P>,ACCUMULATOR_DATA_TYPE> >.
  */
-template <typename P>
-class Accumulator : public nd_array<Cell<P>,ACCUMULATOR_DATA_TYPE> {
+template <typename P, typename Array = nd_array_fixed<Cell<P>,ACCUMULATOR_DATA_TYPE,2> >
+class Accumulator : public Array {
 public:
 	//! Default accumulator constructor
 	Accumulator(ASize size) {
@@ -66,6 +73,16 @@ public:
 		cell.points.push_back(seg.dest);
 	}
 
+	//! Increment cell in the accumulator for a single point, as in the standard Hough transform
+	void Increment(ACoordinates c, P* point) {
+		assert (c.x >= 0 && c.x < asize.x);
+		assert (c.y >= 0 && c.y < asize.y);
+
+		Cell<P> & cell = this->get(c.x, c.y);
+		cell.hits++;
+		cell.points.push_back(point);
+	}
+
 	/**
 	 * Reset the accumulator, for example when switching from method, but also in some methods you are required to do
 	 * so.
@@ -85,14 +102,14 @@ public:
 	ACoordinates getMaxCoord() {
 		ACoordinates max;
 		max.x = max.y = 0;
-		Cell<P> & max_cell = this->get(max.x,max.y);
+		int max_hits = this->get(max.x,max.y).hits;
 		for (int i = 0; i < asize.x; i++) {
 			for (int j = 0; j < asize.y; j++) {
 				Cell<P> & cell = this->get(i, j);
-				if (cell.hits > max_cell.hits) {
+				if (cell.hits > max_hits) {
 					max.x = i;
 					max.y = j;
-					max_cell = this->get(max.x,max.y);
+					max_hits = cell.hits;
 				}
 			}
 		}
@@ -104,6 +121,175 @@ private:
 	ASize asize;
 };
 
+/**
+ * A vote in the accumulator of type DenseAccumulator, the index of its cell and the two points that cast it.
+ */
+template <typename P>
+struct Vote {
+	int cell;
+	Segment2D<P> segment;
+};
+
+/**
+ * An alternative to Accumulator with the same interface towards Hough. The hits are kept in one contiguous array of 16
+ * bits counters, so incrementing a cell never allocates and searching for the maximum is a linear scan that stays in
+ * the cache (a 100x100 Hough space takes 20kB). The segments that voted are optionally kept in a single side table in
+ * the order in which they were cast, and are only gathered into cells by getCells, for the cells that have enough hits.
+ * Because the table keeps the order of the votes, the cells are identical to the ones of Accumulator.
+ *
+ * The ACCUMULATOR_TOP_CELLS cells with the most hits are kept up to date during voting, ordered on decreasing hits, so
+ * the maximum is available without a scan. A cell that is not in this list never has more hits than the last cell in
+ * it, and because a vote adds only one hit, a cell that gets more hits than the last one simply replaces it.
+ */
+template <typename P>
+class DenseAccumulator {
+public:
+	//! Default accumulator constructor, without support only the number of hits per cell is kept
+	DenseAccumulator(ASize size, bool keep_support = true): keep_support(keep_support) {
+		asize.x = size.x;
+		asize.y = size.y;
+		hits.resize(asize.x * asize.y, 0);
+		top_count = 0;
+	}
+
+	//! Default accumulator destructor
+	~DenseAccumulator() {}
+
+	//! Increment cell in the accumulator, a cell saturates at the maximum of its counter
+	void Increment(ACoordinates c, Segment2D<P> seg) {
+		assert (c.x >= 0 && c.x < asize.x);
+		assert (c.y >= 0 && c.y < asize.y);
+
+		int index = c.y * asize.x + c.x;
+		if (hits[index] < std::numeric_limits<uint16_t>::max()) {
+			hits[index]++;
+			updateTop(index);
+		}
+		if (keep_support) {
+			Vote<P> vote;
+			vote.cell = index;
+			vote.segment = seg;
+			votes.push_back(vote);
+		}
+	}
+
+	//! Increment cell in the accumulator for a single point, its vote has no destination
+	void Increment(ACoordinates c, P* point) {
+		Segment2D<P> seg;
+		seg.src = point;
+		Increment(c, seg);
+	}
+
+	//! Keep the segments or points that vote, or only the hits, this resets the accumulator
+	void setKeepSupport(bool keep) {
+		keep_support = keep;
+		Reset();
+	}
+
+	//! Remove all votes, the memory of the side table is kept for the next transform
+	void Reset() {
+		std::fill(hits.begin(), hits.end(), 0);
+		votes.clear();
+		top_count = 0;
+	}
+
+	//! Size of the accumulator
+	inline ASize getSize() { return asize; }
+
+	//! Number of hits of a cell
+	inline int getHits(int x, int y) { return hits[y * asize.x + x]; }
+
+	//! Return coordinates of cell with maximum number of hits, of the cell that got there first if there is a tie
+	ACoordinates getMaxCoord() {
+		ACoordinates max;
+		int index = (top_count > 0) ? top[0] : 0;
+		max.x = index % asize.x;
+		max.y = index / asize.x;
+		return max;
+	}
+
+	//! Hits of the cell with the rank-th most hits, starting at 0, for rank < ACCUMULATOR_TOP_CELLS
+	inline int getTopHits(int rank) {
+		assert (rank >= 0 && rank < ACCUMULATOR_TOP_CELLS);
+		return (rank < top_count) ? hits[top[rank]] : 0;
+	}
+
+	//! Coordinates of the cell with the rank-th most hits, the same as getMaxCoord for rank 0
+	ACoordinates getTopCoord(int rank) {
+		assert (rank >= 0 && rank < ACCUMULATOR_TOP_CELLS);
+		ACoordinates coord;
+		int index = (rank < top_count) ? top[rank] : 0;
+		coord.x = index % asize.x;
+		coord.y = index / asize.x;
+		return coord;
+	}
+
+	/**
+	 * Get the cells with more than threshold hits, with their segments and points in the order of the votes. The cells
+	 * are in the same order as a loop over x and then y would visit them, and are only valid if support is kept. A
+	 * vote of a single point only adds the point.
+	 */
+	void getCells(int threshold, std::vector<Cell<P> > & cells) {
+		cells.clear();
+		std::vector<int> slot(hits.size(), -1);
+		for (int i = 0; i < asize.x; i++) {
+			for (int j = 0; j < asize.y; j++) {
+				int index = j * asize.x + i;
+				if (hits[index] <= threshold) continue;
+				slot[index] = cells.size();
+				cells.push_back(Cell<P>());
+				cells.back().hits = hits[index];
+			}
+		}
+		if (cells.empty()) return;
+		for (typename std::vector<Vote<P> >::iterator v = votes.begin(); v != votes.end(); ++v) {
+			int s = slot[v->cell];
+			if (s < 0) continue;
+			cells[s].points.push_back(v->segment.src);
+			if (v->segment.dest == NULL) continue;
+			cells[s].segments.push_back(v->segment);
+			cells[s].points.push_back(v->segment.dest);
+		}
+	}
+
+private:
+
+	//! Move the cell that just got a hit to its place in the list of cells with the most hits
+	void updateTop(int index) {
+		int rank = 0;
+		while (rank < top_count && top[rank] != index) rank++;
+		if (rank == top_count) {
+			if (top_count < ACCUMULATOR_TOP_CELLS) {
+				top_count++;
+			} else if (hits[index] > hits[top[rank - 1]]) {
+				rank--;
+			} else {
+				return;
+			}
+			top[rank] = index;
+		}
+		for (; rank > 0 && hits[top[rank - 1]] < hits[index]; rank--) {
+			top[rank] = top[rank - 1];
+			top[rank - 1] = index;
+		}
+	}
+
+	ASize asize;
+
+	//! Cells with the most hits, in decreasing order
+	int top[ACCUMULATOR_TOP_CELLS];
+	int top_count;
+
+	//! Keep the segments that cast the votes
+	bool keep_support;
+
+	//! The hits of cell (x,y) at index y*width+x
+	std::vector<uint16_t> hits;
+
+	//! Side table of all votes
+	std::vector<Vote<P> > votes;
+};
+
 }
 
 #endif /* ACCUMULATOR_H_ */
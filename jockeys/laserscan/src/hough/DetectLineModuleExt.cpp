@@ -276,21 +276,12 @@ void DetectLineModuleExt::addSegments(Cell<DecPoint> & c, std::vector<Segment2D<
 }
 
 /**
- * Get segments by looping over each cell and calling getSegments for each of them if they are beyond a certain
- * threshold w.r.t. number of hits.
+ * Get segments by calling addSegments for each cell that is beyond a certain threshold w.r.t. number of hits, see
+ * prepareSegments.
  */
 void DetectLineModuleExt::getSegments() {
-	Accumulator<DecPoint> & acc = *hough.getAccumulator();
-	ASize asize = acc.getSize();
-
-	// loop over the accumulator
-	for (int i = 0; i < asize.x; ++i) {
-		for (int j = 0; j < asize.y; ++j) {
-			Cell<DecPoint> & c = acc.get(i,j);
-			if (c.hits > HIT_THRESHOLD) {
-				addSegments(c, segments);
-			}
-		}
+	for (int i = 0; i < cells.size(); ++i) {
+		addSegments(cells[i], segments);
 	}
 }
 
@@ -329,14 +320,17 @@ void DetectLineModuleExt::findMatches(Cell<DecPoint> * self, Cell<DecPoint> * ot
 }
 
 
+/**
+ * Only the cells beyond the threshold are gathered from the votes in the accumulator, the other cells are not used for
+ * the segmentation anyway.
+ */
 void DetectLineModuleExt::prepareSegments() {
+	hough.getAccumulator()->getCells(HIT_THRESHOLD, cells);
 	if (segmentation != GLUE_POINTS) return;
 
-	Accumulator<DecPoint> & acc = *hough.getAccumulator();
-
 	std::vector<Cell<DecPoint> * >temp;
-	temp.resize(acc.size());
-	ref(acc.begin(), acc.end(), temp.begin());
+	temp.resize(cells.size());
+	ref(cells.begin(), cells.end(), temp.begin());
 
 	std::cout << "Calculate skew for all points" << std::endl;
 	std::for_each(temp.begin(), temp.end(), std::bind1st(std::mem_fun(&DetectLineModuleExt::calculateSkew), this) );
@@ -347,14 +341,13 @@ void DetectLineModuleExt::prepareSegments() {
 
 //! Plot the accumulator values as an image
 void DetectLineModuleExt::plotAccumulator() {
-	Accumulator<DecPoint> & acc = *hough.getAccumulator();
+	DenseAccumulator<DecPoint> & acc = *hough.getAccumulator();
 	ASize asize = acc.getSize();
 	std::cout << "Create image for accumulator of size " << asize.x << 'x' << asize.y << std::endl;
 	CRawImage *a_img = new CRawImage(asize.x, asize.y, 1);
 	for (int i = 0; i < asize.x; ++i) {
 		for (int j = 0; j < asize.y; ++j) {
-			Cell<DecPoint> & c = acc.get(i,j);
-			if (c.hits > HIT_THRESHOLD) {
+			if (acc.getHits(i,j) > HIT_THRESHOLD) {
 				//					std::cout << "Hit at " << i << ',' << j << " with #hits: " << c.hits << std::endl;
 				a_img->setValue(i,j,100);
 			}
@@ -366,9 +359,6 @@ void DetectLineModuleExt::plotAccumulator() {
 
 //! Plot the segments using values in the accumulator
 void DetectLineModuleExt::plotSegments() {
-	Accumulator<DecPoint> & acc = *hough.getAccumulator();
-	ASize asize = acc.getSize();
-
 	CRawImage *l_img = new CRawImage(IMG_WIDTH, IMG_HEIGHT, 1);
 
 	// first print raster, this explains some artifacts which are out there
@@ -117,8 +117,11 @@ public:
 	//! Plot the segments using values in the accumulator
 	void plotSegments();
 private:
-	//! The internal structure for the Hough transform
-	dobots::Hough<DecPoint> hough;
+	//! The internal structure for the Hough transform, only the hits are counted during the transform
+	dobots::Hough<DecPoint, dobots::DenseAccumulator<DecPoint> > hough;
+
+	//! The cells above the threshold with the points that support them
+	std::vector<Cell<DecPoint> > cells;
 
 	//! Flag stops program
 	bool stop;
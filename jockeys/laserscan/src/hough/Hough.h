@@ -42,8 +42,10 @@ namespace dobots {
 /**
  * The Hough transform can be used to detect higher-order structures from a bunch of points, commonly called a point
  * cloud. It's first implementation used it to detect lines, we will use it to detect lines first, and planes later.
+ * The accumulator can be an Accumulator with a cell per bin, or a DenseAccumulator with only the hits per bin.
+ * The standard transform can vote coarse to fine, see setRefinement, which needs a DenseAccumulator.
  */
-template <typename P>
+template <typename P, typename A = Accumulator<P> >
 class Hough {
 public:
 	//! Use the nd-array also for the point cloud
@@ -59,10 +61,15 @@ public:
 		input_size.x = 640;
 		input_size.y = 480;
 		max_distance = std::sqrt(input_size.x*input_size.x + input_size.y*input_size.y);
-		accumulator = new Accumulator<P>(size);
+		accumulator = new A(size);
+		fine_size = size;
+		refinement = 1;
+		refined = false;
 		//		use_cells = true;
 		use_cells = false;
 		use_random_patch_picker = false;
+		patches.x = patches.y = 0;
+		initTables();
 	}
 
 	//! Constructor with non-standard size for the Hough space
@@ -70,10 +77,15 @@ public:
 		clear();
 		this->input_size = input_size;
 		max_distance = std::sqrt(input_size.x*input_size.x + input_size.y*input_size.y);
-		accumulator = new Accumulator<P>(hough_space_size);
+		accumulator = new A(hough_space_size);
+		fine_size = hough_space_size;
+		refinement = 1;
+		refined = false;
 		//		use_cells = true;
 		use_cells = false;
 		use_random_patch_picker = false;
+		patches.x = patches.y = 0;
+		initTables();
 	}
 
 	//! Default destructor
@@ -90,44 +102,89 @@ public:
 	//! Add points one by one
 	void addPoint(P * p) {
 		points.push_back(p);
+		binned = false;
 	}
 
 	//! Add points in a bunch, points should just be two or three elements, so by value, not by reference
 	void addPoints(std::vector<P*> & point_cloud) {
 		//		std::cout << "Inserting " << point_cloud.size() << " points" << std::endl;
 		points.insert(points.end(), point_cloud.begin(), point_cloud.end());
+		binned = false;
 	}
 
-	//! Add points to spatial point cloud
+	//! Add the points of a spatial point cloud, the transform uses the same patches as the point cloud
 	void addPoints(pointcloud & spatial_point_cloud) {
-		spatial_points = spatial_point_cloud;
-		updatePoints();
+		setPatches(spatial_point_cloud.get_dimension(0), spatial_point_cloud.get_dimension(1));
+		for (int i = 0; i < spatial_point_cloud.size(); ++i) {
+			addPoints(spatial_point_cloud.getf(i));
+		}
+	}
+
+	/**
+	 * Divide the input in patches_x by patches_y patches, the randomized transform then samples both points from the
+	 * same patch. The points are not copied per patch, but kept in one array that is ordered on patch, with the index
+	 * of the first point of every patch in an array of offsets. Adding points only appends them, the order is restored
+	 * with a counting sort in updatePoints before the next sample. Without patches (0 by 0) the points are sampled
+	 * from the entire input.
+	 */
+	void setPatches(int patches_x, int patches_y) {
+		patches.x = patches_x;
+		patches.y = patches_y;
+		use_cells = (patches.x > 0 && patches.y > 0);
+		binned = false;
 	}
 
+	/**
+	 * Let the standard transform vote coarse to fine. The size of the Hough space given at construction stays the
+	 * resolution of the line, but the accumulator is replaced by one that is factor times coarser in r and in theta,
+	 * so call this before the accumulator is configured. A factor of 1 votes at the full resolution again.
+	 */
+	void setRefinement(int factor) {
+		if (factor < 1) factor = 1;
+		refinement = factor;
+		ASize size;
+		size.x = (fine_size.x - 1) / factor + 1;
+		size.y = (fine_size.y - 1) / factor + 1;
+		delete accumulator;
+		accumulator = new A(size);
+		initTables();
+		refined = false;
+	}
+
+	//! Seed the random generator of this transform, the same seed gives the same samples
+	inline void seed(uint32_t seed) { generator.seed(seed); }
+
 	void pickRandomPatch(int &x, int &y) {
-		// pick first a random index from spatial_points patch grid
-		int px = spatial_points.get_dimension(0);
-		int py = spatial_points.get_dimension(1);
-		//std::cout << "Dimensions are " << px << ',' << py << std::endl;
-		int size = px*py;
-		int linear_r = random_value(0,size-1);
-		x = linear_r % px;
-		y = linear_r / px;
+		// pick first a random index from the patch grid
+		int linear_r = generator.below(patches.x * patches.y);
+		x = linear_r % patches.x;
+		y = linear_r / patches.x;
 	}
 
+	//! Order the points on patch with a counting sort, only needed after points are added
 	void updatePoints() {
-		points.clear();
-		for (int i = 0; i < spatial_points.size(); ++i) {
-			std::vector<P*> & pnts = spatial_points.getf(i);
-			//std::vector<P*> pnts;
-			//			pnts.resize(cpy.size());
-			//			ref(cpy.begin(), cpy.end(), pnts.begin());
-			//			std::cout << "Add " << pnts.size() << " points " << std::endl;
-			addPoints(pnts);
-			//			for (int j = 0; j < pnts.size(); ++j) {
-			//				addPoint(&pnts[j]);
-			//			}
+		if (binned) return;
+		int count = patches.x * patches.y;
+		offsets.assign(count + 1, 0);
+		patch_of.resize(points.size());
+		for (size_t i = 0; i < points.size(); ++i) {
+			patch_of[i] = getPatch(*points[i]);
+			offsets[patch_of[i] + 1]++;
+		}
+		for (int i = 0; i < count; ++i) {
+			offsets[i + 1] += offsets[i];
 		}
+		// offsets[p] is used as the insertion position of patch p and ends up at the start of patch p+1
+		ordered.resize(points.size());
+		for (size_t i = 0; i < points.size(); ++i) {
+			ordered[offsets[patch_of[i]]++] = points[i];
+		}
+		for (int i = count; i > 0; --i) {
+			offsets[i] = offsets[i - 1];
+		}
+		offsets[0] = 0;
+		points.swap(ordered);
+		binned = true;
 	}
 
 	//! Absolutely horrible to return a reference to member data, but bare with me for now.
@@ -138,43 +195,47 @@ public:
 	//! This is a better method if the density differs across the cells, it requires all points to be added to one
 	//! data structure. It will pick a point at random and return the given patch indices.
 	void pickRandomPoint(int &x, int &y) {
-		int linear_e = random_value(0,points.size()-1);
-		int wx = input_size.x / spatial_points.get_dimension(0);
-		int wy = input_size.y / spatial_points.get_dimension(1);
-
-		x = points[linear_e]->x / wx;
-		y = points[linear_e]->y / wy;
+		int linear_e = generator.below(points.size());
+		int patch = getPatch(*points[linear_e]);
+		x = patch % patches.x;
+		y = patch / patches.x;
 		//		std::cout << "Got point " << points[linear_e]->x << ',' << points[linear_e]->y <<
 		//				" which becomes patch " << x << ',' << y << std::endl;
 	}
 
-	//! Perform the actual transform on all the points hitherto received
+	//! Perform the actual transform on all the points hitherto received, one sample for the randomized transform, a
+	//! vote of every point for the standard transform (type HOUGH)
 	void doTransform() {
-		std::vector<P*> pnts;
+		refined = false;
+		if (type == HOUGH) {
+			if (refinement > 1) {
+				doRefinedTransform();
+			} else {
+				doStandardTransform();
+			}
+			return;
+		}
+		// sample directly from the points or the patch, so nothing is copied or allocated
+		if (points.size() < 3) return;
+		size_t begin = 0, end = points.size();
 		if (use_cells) {
+			updatePoints();
 			int ix, iy;
 			if (use_random_patch_picker) {
 				pickRandomPatch(ix,iy);
 			} else {
 				pickRandomPoint(ix,iy);
 			}
-			//std::vector<P> & cpy = spatial_points.get(ix,iy);
-			std::vector<P*> & sp = spatial_points.get(ix,iy);
-			pnts.insert(pnts.end(), sp.begin(), sp.end()); // copy all references to points into pnts
-			// create vector with references to points, instead of copying the points
-			//			pnts.resize(cpy.size());
-			//			ref(cpy.begin(), cpy.end(), pnts.begin());
-		} else {
-			pnts.insert(pnts.end(), points.begin(), points.end()); // copy all references to points into pnts
+			int patch = iy * patches.x + ix;
+			begin = offsets[patch];
+			end = offsets[patch + 1];
 		}
 
-		if (pnts.size() < 3) return;
-		std::vector<P*> random_set; random_set.clear();
-		random_set.resize(2);
-
-		random_n(pnts.begin(), pnts.end(), random_set.begin(), 2);
-		P* pnt0 = random_set[0];
-		P* pnt1 = random_set[1];
+		if (end - begin < 3) return;
+		size_t random_set[2];
+		random_indices(generator, end - begin, random_set, 2);
+		P* pnt0 = points[begin + random_set[0]];
+		P* pnt1 = points[begin + random_set[1]];
 
 		ACoordinates c;
 		if (!transform(*pnt0, *pnt1, c)) return;
@@ -184,6 +245,126 @@ public:
 		getAccumulator()->Increment(c, segment);
 	}
 
+	/**
+	 * Perform the transform until one line clearly dominates, or at most max_steps times. This requires an accumulator
+	 * that keeps track of its top cells, such as DenseAccumulator. The standard transform is always done in one step.
+	 *
+	 * @param max_steps          maximum number of calls to doTransform
+	 * @param min_hits           number of hits the best cell needs
+	 * @param dominance          the best cell needs this ratio times the hits of the second best cell
+	 * @return                   the number of calls to doTransform
+	 */
+	int doTransform(int max_steps, int min_hits, float dominance) {
+		if (type == HOUGH) {
+			// all points have voted after a single step, another step would only double the hits
+			doTransform();
+			return 1;
+		}
+		int steps = 0;
+		while (steps < max_steps) {
+			doTransform();
+			steps++;
+			int best = accumulator->getTopHits(0);
+			if (best >= min_hits && best >= dominance * accumulator->getTopHits(1)) break;
+		}
+		return steps;
+	}
+
+	/**
+	 * The standard Hough transform: every point votes for every angle theta, for the line through it at that angle. The
+	 * cells are the same as for the randomized transform, so theta covers [-pi,pi) and only lines with a distance to
+	 * the origin of r >= 0 get a vote. The distances are computed for all points at once per angle, in a loop without
+	 * branches that the compiler can vectorize, the votes are cast afterwards. There are no random numbers, no atan2,
+	 * and no square roots, and the time only depends on the number of points.
+	 */
+	void doStandardTransform() {
+		int count = points.size();
+		if (count == 0) return;
+		point_x.resize(count);
+		point_y.resize(count);
+		radius.resize(count);
+		for (int i = 0; i < count; ++i) {
+			point_x[i] = points[i]->x;
+			point_y[i] = points[i]->y;
+		}
+		const float *px = &point_x[0], *py = &point_y[0];
+		float *pr = &radius[0];
+		ASize size = accumulator->getSize();
+		const float r_scale = (size.x - 1) / max_distance;
+		ACoordinates c;
+		for (c.y = 0; c.y < (int)cos_table.size(); ++c.y) {
+			const float cs = cos_table[c.y] * r_scale, sn = sin_table[c.y] * r_scale;
+			for (int i = 0; i < count; ++i) {
+				pr[i] = px[i] * cs + py[i] * sn;
+			}
+			for (int i = 0; i < count; ++i) {
+				if (pr[i] < 0) continue;
+				c.x = (int)(pr[i] + 0.5f);
+				if (c.x >= size.x) continue;
+				accumulator->Increment(c, points[i]);
+			}
+		}
+	}
+
+	/**
+	 * The standard transform coarse to fine. All points vote in the coarse accumulator, which has refinement^2 times
+	 * fewer cells and refinement times fewer angles than the Hough space. Then only the HOUGH_REFINE_CELLS cells with
+	 * the most hits are refined. The points within HOUGH_REFINE_SUPPORT coarse bins of such a cell vote again, for the
+	 * fine angles within half a coarse angle of the cell and the fine distances around it, in a small table. The best
+	 * fine cell of all of them is the line of getLine, with the resolution of the Hough space. The time per image is
+	 * bounded by the points times the coarse angles plus, per refined cell, its support times the refinement.
+	 */
+	void doRefinedTransform() {
+		doStandardTransform();
+		int count = points.size();
+		if (count == 0) return;
+		ASize size = accumulator->getSize();
+		const float r_scale = (size.x - 1) / max_distance;
+		const float fine_r_scale = (fine_size.x - 1) / max_distance;
+		const double step = M_PIx2 / (size.y - 1), fine_step = M_PIx2 / (fine_size.y - 1);
+		const int fine_rows = fine_size.y - 1;
+		int best = 0;
+		for (int rank = 0; rank < HOUGH_REFINE_CELLS; ++rank) {
+			if (accumulator->getTopHits(rank) == 0) break;
+			ACoordinates cell = accumulator->getTopCoord(rank);
+			// the points near the line of the cell, at the distances of their coarse votes
+			const float cs = cos_table[cell.y] * r_scale, sn = sin_table[cell.y] * r_scale;
+			support.clear();
+			for (int i = 0; i < count; ++i) {
+				float r = point_x[i] * cs + point_y[i] * sn;
+				if (std::fabs(r - cell.x) <= HOUGH_REFINE_SUPPORT) support.push_back(i);
+			}
+			// the fine rows within half a coarse angle, and the fine distances the support can reach at those angles
+			double center = cell.y * step / fine_step, half = 0.5 * step / fine_step;
+			int first_row = (int)std::ceil(center - half - 1e-6);
+			int last_row = (int)std::floor(center + half + 1e-6);
+			int first_bin = (int)std::floor((cell.x - HOUGH_REFINE_SUPPORT - 1) * fine_r_scale / r_scale);
+			int last_bin = (int)std::ceil((cell.x + HOUGH_REFINE_SUPPORT + 1) * fine_r_scale / r_scale);
+			if (first_bin < 0) first_bin = 0;
+			if (last_bin > fine_size.x - 1) last_bin = fine_size.x - 1;
+			int bins = last_bin - first_bin + 1;
+			fine_hits.assign((last_row - first_row + 1) * bins, 0);
+			for (int row = first_row; row <= last_row; ++row) {
+				// the rows of the angles around -pi wrap around to those just below pi
+				double theta = (((row % fine_rows) + fine_rows) % fine_rows) * fine_step - M_PI;
+				const float fc = std::cos(theta) * fine_r_scale, fs = std::sin(theta) * fine_r_scale;
+				int *hits = &fine_hits[(row - first_row) * bins];
+				for (size_t k = 0; k < support.size(); ++k) {
+					float r = point_x[support[k]] * fc + point_y[support[k]] * fs;
+					if (r < 0) continue;
+					int b = (int)(r + 0.5f) - first_bin;
+					if (b < 0 || b >= bins) continue;
+					if (++hits[b] > best) {
+						best = hits[b];
+						refined_r = (b + first_bin) / fine_r_scale;
+						refined_theta = theta;
+					}
+				}
+			}
+		}
+		refined = (best > 0);
+	}
+
 	template <typename P1, typename C1>
 	C1 transform(P1 pnt0, P1 pnt1) {
 		assert(false); // no general implementation possible
@@ -198,7 +379,8 @@ public:
 		// std::cout << "Transform " << pnt0.x << "," << pnt0.y << " and " << pnt1.x << "," << pnt1.y << std::endl;
 		ASSERT_NEQ(point0, point1);
 
-		typedef double ftype;
+		// float and the approximations, the errors are well within a cell of the accumulator
+		typedef float ftype;
 		ftype theta, r;
 
 		int pixels_apart = 10;
@@ -218,7 +400,7 @@ public:
 			//std::cout << "From " << point0 << " and " << point1 << " got slope " << slope << " and y-intersection " << yisect << std::endl;
 			getClosestPoint(slope,yisect,fx,fy);
 
-			bool not_at_origin = getPolarCoordinates<ftype>(fx,fy,r,theta);
+			bool not_at_origin = getPolarCoordinates<ftype>(fx,fy,r,theta,false,GA_FAST);
 			if (!not_at_origin) {
 				// radial line (through origin), pick random point and calculate atan(y/x)
 				theta = atan2(point1.y, point1.x) + M_PI_2;
@@ -262,12 +444,13 @@ public:
 		ASSERT_LT(coordinates.y, accumulator->getSize().y);
 	}
 
-	//! Remove all points from the point cloud
+	//! Remove all points from the point cloud, the patches are kept
 	void clear(bool deallocate = true) {
 		if (deallocate)
 			points.clear();
 		else
 			points.erase(points.begin(), points.end());
+		binned = false;
 	}
 
 	void transform(const ACoordinates coord, double & r, double & theta) {
@@ -292,6 +475,11 @@ public:
 	 * @param theta          angle
 	 */
 	void getLine(double & r, double & theta) {
+		if (refined) {
+			r = refined_r;
+			theta = refined_theta;
+			return;
+		}
 		const ACoordinates coord = getMax();
 		transform(coord, r, theta);
 	}
@@ -303,19 +491,67 @@ public:
 	}
 
 	//! Get the accumulator, e.g. to reset it
-	inline Accumulator<P>* getAccumulator() { return accumulator; }
+	inline A* getAccumulator() { return accumulator; }
 private:
+	//! The patch of a point, points outside of the input are put in the nearest patch
+	inline int getPatch(const P & point) {
+		int x = (point.x * patches.x) / input_size.x;
+		int y = (point.y * patches.y) / input_size.y;
+		x = (x < 0) ? 0 : ((x >= patches.x) ? patches.x - 1 : x);
+		y = (y < 0) ? 0 : ((y >= patches.y) ? patches.y - 1 : y);
+		return y * patches.x + x;
+	}
+
+	//! The angle of every row of the accumulator but the last, which is the same as the first (pi and -pi)
+	void initTables() {
+		int rows = accumulator->getSize().y - 1;
+		cos_table.resize(rows);
+		sin_table.resize(rows);
+		for (int j = 0; j < rows; ++j) {
+			ACoordinates coord;
+			coord.x = 0;
+			coord.y = j;
+			double r, theta;
+			transform(coord, r, theta);
+			cos_table[j] = std::cos(theta);
+			sin_table[j] = std::sin(theta);
+		}
+	}
+
 	//! The type of Hough transform to use
 	HoughTransformType type;
 
 	//! Accumulator
-	Accumulator<P> *accumulator;
+	A *accumulator;
+
+	//! The size of the Hough space, the accumulator is refinement times coarser than this
+	ASize fine_size;
+	int refinement;
+
+	//! The line of the last coarse to fine transform, if there was one
+	bool refined;
+	double refined_r;
+	double refined_theta;
+
+	//! The points that support a coarse cell, and the fine hits around it
+	std::vector<int> support;
+	std::vector<int> fine_hits;
 
 	//! Point cloud, for now store temporary all points, and only perform transform when doTransform is called
 	std::vector<P*> points;
 
-	//! Point cloud, but in a spatial structure
-	pointcloud spatial_points;
+	//! Number of patches in x and y direction
+	ISize patches;
+
+	//! The points of patch p are points[offsets[p]] up to points[offsets[p+1]], if binned
+	std::vector<int> offsets;
+
+	//! The points are ordered on patch
+	bool binned;
+
+	//! Buffers of the counting sort, kept for the next one
+	std::vector<int> patch_of;
+	std::vector<P*> ordered;
 
 	//! The input points should fall in this range
 	ISize input_size;
@@ -328,6 +564,18 @@ private:
 
 	//! Use random patch picker (or random point picker)
 	bool use_random_patch_picker;
+
+	//! Random generator of this transform
+	XorShift generator;
+
+	//! Cosine and sine of the angle of every row of the accumulator, for the standard transform
+	std::vector<float> cos_table;
+	std::vector<float> sin_table;
+
+	//! Coordinates and distances of the points, contiguous for the standard transform
+	std::vector<float> point_x;
+	std::vector<float> point_y;
+	std::vector<float> radius;
 };
 
 }
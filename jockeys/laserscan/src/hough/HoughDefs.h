@@ -35,6 +35,15 @@ typedef int ACCUMULATOR_DATA_TYPE;
 const ACCUMULATOR_DATA_TYPE ACCUMULATOR_SIZE_X = 100;
 const ACCUMULATOR_DATA_TYPE ACCUMULATOR_SIZE_Y = 100;
 
+//! Number of cells with the most hits that a DenseAccumulator keeps track of while voting
+const int ACCUMULATOR_TOP_CELLS = 4;
+
+//! Cells of the coarse accumulator that the coarse to fine transform refines, at most ACCUMULATOR_TOP_CELLS
+const int HOUGH_REFINE_CELLS = ACCUMULATOR_TOP_CELLS;
+
+//! Points within this many coarse bins of the distance of a cell support it in the refinement
+const float HOUGH_REFINE_SUPPORT = 1.5f;
+
 enum HoughTransformType { HOUGH, RANDOMIZED_HOUGH, PROB_PROG_HOUGH, SEGMENT_HOUGH, HOUGH_TRANSFORM_TYPE_COUNT };
 
 struct ACoordinates {
@@ -46,9 +46,9 @@
 
 #if defined(__GXX_EXPERIMENTAL_CXX0X__)
 
-#if __GNUC__ >= 4 && __GNUC_MINOR__ < 5
+#if __GNUC__ == 4 && __GNUC_MINOR__ < 5
 typedef std::uniform_int<int> t_uniform_int_distribution;
-#elif __GNUC__ >= 4 && __GNUC_MINOR__ >= 5
+#else
 typedef std::uniform_int_distribution<int> t_uniform_int_distribution;
 #endif
 
@@ -201,4 +201,62 @@ OutputIterator inline random_n(InputIterator first, InputIterator last, OutputIt
 
 #endif
 
+#include <stdint.h>
+#include <stddef.h>
+#include <cassert>
+
+/**
+ * @brief A xorshift generator with 32 bits of state (Marsaglia, 2003).
+ *
+ * It is small and fast enough to give every user, such as every Hough transform, its own instance, so the sequence
+ * is reproducible for a given seed and does not depend on other users of a global generator.
+ */
+class XorShift {
+public:
+	XorShift(uint32_t seed = 2463534242u) { this->seed(seed); }
+
+	//! The state can not be zero, a seed of 0 uses the default seed
+	inline void seed(uint32_t seed) { state = seed ? seed : 2463534242u; }
+
+	inline uint32_t next() {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+
+	//! A number in [0,size), by multiplication instead of modulo, so the bias is at most size/2^32
+	inline uint32_t below(uint32_t size) {
+		return (uint32_t)(((uint64_t)next() * size) >> 32);
+	}
+private:
+	uint32_t state;
+};
+
+/**
+ * @brief Pick number different indices in [0,size) with the algorithm of Robert Floyd, without any allocation.
+ *
+ * The same as random_n, but it returns indices into the source container, so the source does not have to be copied
+ * and the result can be a plain array. It is meant for small numbers, the check for duplicates is linear.
+ *
+ * @param generator		Random generator
+ * @param size			Number of elements to pick from
+ * @param indices		Output array with room for number indices
+ * @param number		Number of indices to pick, at most size
+ */
+inline void random_indices(XorShift & generator, size_t size, size_t *indices, size_t number) {
+	assert (number <= size);
+	size_t k = 0;
+	for (size_t j = size - number; j < size; ++j, ++k) {
+		size_t t = generator.below(j + 1);
+		indices[k] = t;
+		for (size_t i = 0; i < k; ++i) {
+			if (indices[i] == t) {
+				indices[k] = j;
+				break;
+			}
+		}
+	}
+}
+
 #endif /* RANDOM_H_ */
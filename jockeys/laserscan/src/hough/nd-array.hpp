@@ -392,4 +392,205 @@ private:
 	}
 };
 
+/**
+ * The same table as nd_array, but with the number of dimensions N as a template parameter, for the places where it is
+ * known and where the table is in a hot loop, such as the accumulator of the Hough transform. The sizes of the
+ * dimensions are still set at runtime, but the dimensions and the strides are plain arrays of N elements in the object
+ * instead of vectors, the stride of the first dimension is always 1, and the index of get(x, y) is a single
+ * multiply-add that the compiler inlines, without the loop over the dimensions or the indirection to the heap.
+ *
+ * The interface is that of nd_array for the functions that make sense with a fixed rank, so a class that inherits
+ * from one can inherit from the other, see Accumulator. The convenience functions with 1, 2 or 3 indices only compile
+ * for the N they are meant for.
+ *
+ * @param V		type of the values
+ * @param T		type of the size of the entire array
+ * @param N		number of dimensions, at least 1
+ */
+template <typename V = float, typename T = size_t, int N = 2>
+class nd_array_fixed {
+public:
+	typedef T linear_index;
+	typedef std::vector<T> tabular_index;
+	typedef V value_type;
+	typedef std::vector<value_type> value_container;
+	typedef T dimension_type;
+	typedef std::vector<dimension_type> dimension_container;
+
+	//! The sizes of the N dimensions, see nd_array
+	nd_array_fixed(const dimension_container & dimensions) {
+		init(dimensions);
+	}
+
+	nd_array_fixed() {
+		for (int i = 0; i < N; ++i) {
+			dimensions[i] = 0;
+			strides[i] = 0;
+		}
+	}
+
+	virtual ~nd_array_fixed() {
+	}
+
+	//! Set the sizes of the N dimensions, all values are reset to the default of value_type
+	void init(const dimension_container & sizes) {
+		assert (sizes.size() == (size_t)N);
+		linear_index tsize = 1;
+		for (int i = 0; i < N; ++i) {
+			assert (sizes[i] != 0);
+			dimensions[i] = sizes[i];
+			strides[i] = tsize;
+			linear_index new_size = tsize * sizes[i];
+			if ((new_size / sizes[i]) != tsize) {
+				std::cerr << "Size exceeds maximum size (" << std::numeric_limits<T>::max()
+						<< ") of the container, adjust template parameter T" << std::endl;
+				assert((new_size / sizes[i]) == tsize);
+			}
+			tsize = new_size;
+		}
+		values.clear();
+		values.resize(tsize, value_type());
+	}
+
+	//! Translate [i,j,k] to i+j*strides[1]+k*strides[2], the loop has a fixed number of iterations
+	inline linear_index get_linear_index(const tabular_index & index) const {
+		linear_index result = index[0];
+		for (int i = 1; i < N; ++i) {
+			result += index[i] * strides[i];
+		}
+		return result;
+	}
+
+	inline tabular_index get_tabular_index(linear_index index) const {
+		tabular_index result(N, dimension_type(0));
+		for (int i = 0; i < N; ++i) {
+			result[i] = (index / strides[i]) % dimensions[i];
+		}
+		return result;
+	}
+
+	void set(const tabular_index & table_index, value_type value) {
+		values[get_linear_index(table_index)] = value;
+	}
+
+	const value_type & get(const tabular_index & index) const {
+		return values[get_linear_index(index)];
+	}
+
+	//! Setf forces the value at the given linear index. Nothing is checked.
+	inline void setf(linear_index index, value_type value) {
+		values[index] = value;
+	}
+
+	//! Getf gets the value at the given linear index. Nothing is checked.
+	inline const value_type & getf(linear_index index) const {
+		return values[index];
+	}
+
+	inline value_type & getf(linear_index index) {
+		return values[index];
+	}
+
+	//! Only for a 1-dimensional array
+	inline value_type & get(linear_index index0) {
+		return values[index(index0)];
+	}
+
+	inline const value_type & get(linear_index index0) const {
+		return values[index(index0)];
+	}
+
+	//! Only for a 2-dimensional array
+	inline value_type & get(linear_index index0, linear_index index1) {
+		return values[index(index0, index1)];
+	}
+
+	inline const value_type & get(linear_index index0, linear_index index1) const {
+		return values[index(index0, index1)];
+	}
+
+	//! Only for a 3-dimensional array
+	inline value_type & get(linear_index index0, linear_index index1, linear_index index2) {
+		return values[index(index0, index1, index2)];
+	}
+
+	inline const value_type & get(linear_index index0, linear_index index1, linear_index index2) const {
+		return values[index(index0, index1, index2)];
+	}
+
+	inline void set(linear_index index0, value_type value) {
+		values[index(index0)] = value;
+	}
+
+	inline void set(linear_index index0, linear_index index1, value_type value) {
+		values[index(index0, index1)] = value;
+	}
+
+	inline void set(linear_index index0, linear_index index1, linear_index index2, value_type value) {
+		values[index(index0, index1, index2)] = value;
+	}
+
+	inline void add(linear_index index0, value_type amount) {
+		values[index(index0)] += amount;
+	}
+
+	inline void add(linear_index index0, linear_index index1, value_type amount) {
+		values[index(index0, index1)] += amount;
+	}
+
+	inline void add(linear_index index0, linear_index index1, linear_index index2, value_type amount) {
+		values[index(index0, index1, index2)] += amount;
+	}
+
+	//! The product of all dimension sizes
+	long long int size() const {
+		return values.size();
+	}
+
+	dimension_type get_dimension(size_t index) const {
+		return dimensions[index];
+	}
+
+	size_t get_dimensions() const {
+		return N;
+	}
+
+	typename value_container::iterator begin() { return values.begin(); }
+
+	typename value_container::const_iterator begin() const { return values.begin(); }
+
+	typename value_container::iterator end() { return values.end(); }
+
+	typename value_container::const_iterator end() const { return values.end(); }
+private:
+	// A rank that does not match the number of indices is an array of negative size, which does not compile
+	inline linear_index index(linear_index index0) const {
+		typedef char rank_is_1[(N == 1) ? 1 : -1]; (void)sizeof(rank_is_1);
+		assert (index0 < dimensions[0]);
+		return index0;
+	}
+
+	inline linear_index index(linear_index index0, linear_index index1) const {
+		typedef char rank_is_2[(N == 2) ? 1 : -1]; (void)sizeof(rank_is_2);
+		assert (index0 < dimensions[0]);
+		assert (index1 < dimensions[1]);
+		return index0 + index1 * strides[1];
+	}
+
+	inline linear_index index(linear_index index0, linear_index index1, linear_index index2) const {
+		typedef char rank_is_3[(N == 3) ? 1 : -1]; (void)sizeof(rank_is_3);
+		assert (index0 < dimensions[0]);
+		assert (index1 < dimensions[1]);
+		assert (index2 < dimensions[2]);
+		return index0 + index1 * strides[1] + index2 * strides[2];
+	}
+
+	dimension_type dimensions[N];
+
+	//! The stride of dimension i is the product of the sizes of the dimensions before it, strides[0] is 1
+	linear_index strides[N];
+
+	value_container values;
+};
+
 #endif // ND_ARRAY_H_
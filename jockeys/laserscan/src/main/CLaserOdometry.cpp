@@ -0,0 +1,127 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Relative motion of the robot from consecutive laser vectors
+ * @file CLaserOdometry.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 14, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#include <math.h>
+#include <algorithm>
+
+#include "CLaserOdometry.h"
+
+/**
+ * The calibration is the one of CLaserScan::GetDistance, which is fitted between 7 and 37 cm. The range is limited to
+ * 50 cm, beyond that GetDistance does not see anything either.
+ */
+CLaserOdometry::CLaserOdometry(int rows): capacity(rows), has_previous(false), total(0), scans(0), coeff_a(68.157),
+		coeff_b(-0.688), coeff_c(0.0019176), max_range(50), tolerance(1), min_matches(20) {
+	previous = new float[capacity];
+	current = new float[capacity];
+	differences = new float[capacity];
+	motion.timestamp = 0;
+	motion.forward = 0;
+	motion.residual = 0;
+	motion.matches = 0;
+	motion.valid = false;
+}
+
+CLaserOdometry::~CLaserOdometry() {
+	delete [] previous;
+	delete [] current;
+	delete [] differences;
+}
+
+void CLaserOdometry::reset() {
+	has_previous = false;
+	total = 0;
+	scans = 0;
+	motion.forward = 0;
+	motion.residual = 0;
+	motion.matches = 0;
+	motion.valid = false;
+}
+
+void CLaserOdometry::toDistances(const std::vector<float> & vec, float *distances) {
+	int size = ((int)vec.size() < capacity) ? (int)vec.size() : capacity;
+	for (int i = 0; i < size; ++i) {
+		distances[i] = -1;
+		if (!vec[i]) continue;
+		double column = vec[i];
+		double distance = coeff_a + column * coeff_b + column * column * coeff_c;
+		if (distance > 0 && distance < max_range) distances[i] = distance;
+	}
+	for (int i = size; i < capacity; ++i) distances[i] = -1;
+}
+
+/**
+ * The first vector after a reset only becomes the reference. A vector that does not give an estimate still becomes
+ * the reference for the next one, so the motion is always between consecutive vectors.
+ *
+ * @param vec                sub-pixel laser vector, as filled by CLaserScan::refineVector
+ * @param timestamp          time at which the vector was captured, in microseconds
+ * @return                   true if the motion is valid
+ */
+bool CLaserOdometry::match(const std::vector<float> & vec, long long timestamp) {
+	toDistances(vec, current);
+	scans++;
+	motion.timestamp = timestamp;
+	motion.forward = 0;
+	motion.residual = 0;
+	motion.matches = 0;
+	motion.valid = false;
+
+	int count = 0;
+	if (has_previous) {
+		for (int i = 0; i < capacity; ++i) {
+			if (previous[i] < 0 || current[i] < 0) continue;
+			differences[count++] = previous[i] - current[i];
+		}
+	}
+	std::swap(previous, current);
+	has_previous = true;
+	if (count < min_matches) return false;
+
+	std::nth_element(differences, differences + count / 2, differences + count);
+	float median = differences[count / 2];
+	double sum = 0;
+	int inliers = 0;
+	for (int i = 0; i < count; ++i) {
+		if (fabsf(differences[i] - median) > tolerance) continue;
+		sum += differences[i];
+		inliers++;
+	}
+	if (inliers < min_matches) return false;
+	float forward = sum / inliers;
+	double residual = 0;
+	for (int i = 0; i < count; ++i) {
+		if (fabsf(differences[i] - median) > tolerance) continue;
+		residual += fabsf(differences[i] - forward);
+	}
+
+	motion.forward = forward;
+	motion.residual = residual / inliers;
+	motion.matches = inliers;
+	motion.valid = true;
+	total += forward;
+	return true;
+}
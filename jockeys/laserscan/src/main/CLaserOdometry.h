@@ -0,0 +1,107 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Relative motion of the robot from consecutive laser vectors
+ * @file CLaserOdometry.h
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 14, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#ifndef CLASERODOMETRY_H_
+#define CLASERODOMETRY_H_
+
+#include <vector>
+
+//! The motion between two consecutive laser vectors
+struct LaserMotion {
+	//! Time at which the last vector was captured, in microseconds
+	long long timestamp;
+	//! Motion towards the surface that reflects the laser, in cm, negative if the robot moved away from it
+	float forward;
+	//! Mean absolute difference of the matched rows after the correction, in cm
+	float residual;
+	//! Number of rows the estimate is based on
+	int matches;
+	bool valid;
+};
+
+/**
+ * Scan-to-scan matching of the laser vectors. The laser is a vertical line, so the column of every row of the vector
+ * is converted to the distance of the surface in that row, with the same polynomial as CLaserScan::GetDistance. If
+ * the robot moves towards a surface, all rows that see it get closer by the same amount, so the motion is a 1D
+ * translation between two distance profiles. It is found with one step of ICP: the median of the per-row differences
+ * is the initial estimate, the rows within the tolerance of it are the inliers, and their mean difference is the
+ * estimate. Rotation is not observable from a single vertical line, and rows that see the floor move with the robot,
+ * so they pull the estimate towards zero if they are the majority.
+ */
+class CLaserOdometry {
+public:
+	//! Odometry for laser vectors of at most rows items
+	CLaserOdometry(int rows);
+
+	~CLaserOdometry();
+
+	//! Match the vector with the previous one, returns if the motion could be estimated
+	bool match(const std::vector<float> & vec, long long timestamp);
+
+	//! Forget the previous vector and the total motion
+	void reset();
+
+	//! The motion between the last two vectors
+	inline const LaserMotion & getMotion() { return motion; }
+
+	//! The sum of all valid motions since the last reset
+	inline float getTotal() { return total; }
+
+	//! Number of vectors since the last reset
+	inline int getScans() { return scans; }
+
+	//! Set the polynomial from column to distance in cm, a + b*column + c*column^2
+	inline void setCalibration(double a, double b, double c) { coeff_a = a; coeff_b = b; coeff_c = c; }
+
+	//! Set the maximum difference in cm of an inlier to the median, and the number of inliers that is needed
+	inline void setTolerance(float tolerance, int min_matches) {
+		this->tolerance = tolerance; this->min_matches = min_matches;
+	}
+private:
+	//! Convert the columns of the vector to distances, -1 for rows without laser or out of range
+	void toDistances(const std::vector<float> & vec, float *distances);
+
+	int capacity;
+	//! Distance profiles of the previous and the last vector, swapped after every match
+	float *previous;
+	float *current;
+	bool has_previous;
+	//! Per-row differences, reordered to find the median
+	float *differences;
+
+	LaserMotion motion;
+	float total;
+	int scans;
+
+	double coeff_a;
+	double coeff_b;
+	double coeff_c;
+	float max_range;
+	float tolerance;
+	int min_matches;
+};
+
+#endif /* CLASERODOMETRY_H_ */
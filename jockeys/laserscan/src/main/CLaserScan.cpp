@@ -26,15 +26,17 @@
 
 #include <string.h>
 #include <cassert>
+#include <algorithm>
 #include <sstream>
 
 #include "CLaserScan.h"
 #include "CTimer.h"
 #include "CCamera.h"
+#include "CStageStats.h"
 #include "CLaser.h"
 
 bool LASER_VERBOSE = false;
-bool SAVE_IMAGES_TO_DISK = false; // does not work anyway, jpeg is disabled
+bool SAVE_IMAGES_TO_DISK = false; // every frame as raw YUYV, see CCamera::saveImages
 
 bool STREAM_RED_DIFF_IMAGES = true;
 bool STREAM_RGB_DIFF_IMAGES = true;
@@ -44,6 +46,18 @@ bool SAVE_RGB_DIFF_IMAGES_TO_DISK = false;
 
 bool DUMMY_CAMERA = false;
 
+//! Number of rows that are added to the laser vector at once
+#define LASER_BAND_ROWS 32
+
+//! The randomized Hough transform stops if the best line has HOUGH_MIN_HITS hits and HOUGH_DOMINANCE times the hits of
+//! the second best line, or after HOUGH_MAX_STEPS samples
+#define HOUGH_MAX_STEPS 40
+#define HOUGH_MIN_HITS 6
+#define HOUGH_DOMINANCE 2
+//! The standard Hough transform votes in an accumulator this many times coarser than its 100x100 Hough space, and
+//! refines the best cells with the points that support them, see Hough::setRefinement
+#define HOUGH_REFINEMENT 4
+
 //! The name of the controller can be used for controller selection
 static const std::string NAME = "LaserScan";
 
@@ -72,17 +86,38 @@ CLaserScan::CLaserScan(RobotBase *robot_base, RobotBase::RobotType robot_type,
 				imageWidth(img_width),
 				imageHeight(img_height),
 				laserResolution(laser_width),
+				lineExtractor(img_height),
+				odometry(img_height),
+				captureTime(0),
 				topRowLimit(0),
 				bottomRowLimit(img_height-1), // has high value because index runs from top to bottom from low to high
 				cameraDeviceHandler(-1),
 				coeff_a(20.0066),
 				coeff_b(-0.10189),
-				coeff_c(0.00063011) {
+				coeff_c(0.00063011),
+				pipelined(false),
+				referenceInterval(8),
+				motionThreshold(12),
+				referenceAge(-1),
+				caching(true),
+				changeThreshold(3),
+				cacheValid(false),
+				cachedObject(O_NOTHING),
+				cachedDistance(0),
+				voteSize(5),
+				voteCount(0),
+				voteNext(0) {
 	// the coefficients are obtained in an easy way
 	// x=[16,20,24,30,34] (cm) y=[98,156,197,231,249] (values) and p = polyfit(y,x,2) gives
 	//   6.3011e-04, -1.0189e-01, 2.0066e+01
 
 	assert(img_width > 0);
+#ifdef USE_HOUGH_TRANSFORM
+	// only the best line is used, so the supporting points do not have to be kept
+	hough.setType(HOUGH);
+	hough.setRefinement(HOUGH_REFINEMENT);
+	hough.getAccumulator()->setKeepSupport(false);
+#endif
 	image1 = new CRawImage(img_width, img_height, 3);
 	image2 = new CRawImage(img_width, img_height, 3);
 	if (showDiffRed || streamDiffRed) {
@@ -115,6 +150,7 @@ int CLaserScan::InitCam(int imgWidth, int imgHeight, int laserResolution) {
 	if (printLaser) {
 		printf("%s(): Laser resolution set to %i\n", __func__, laserResolution);
 		printf("%s(): Laser lower res set to %i\n", __func__, laserSmallVecSize);
+		printf("%s(): Use %s kernels for the laser difference\n", __func__, imageManip.getKernelName());
 	}
 	laserVec = new int[laserResolution];
 	laserSmallVec = new int[laserSmallVecSize];
@@ -160,12 +196,49 @@ int CLaserScan::Init() {
 void CLaserScan::Pause() {
 	camera.Stop();
 	started = false;
+	referenceAge = -1;
+	cacheValid = false;
+	voteCount = 0;
+}
+
+/**
+ * In the pipelined mode a measurement normally costs a single capture with the laser turned on instead of two. This is
+ * only valid as long as the scene does not change, so the laser-off reference is captured again after "interval"
+ * measurements, or as soon as the green channel of the new laser-on image differs too much from the reference.
+ *
+ * @param enable             reuse the laser-off reference
+ * @param interval           maximum number of measurements that use the same reference
+ * @param motion_threshold   mean difference in the green channel above which the reference is captured again
+ */
+void CLaserScan::setPipelined(bool enable, int interval, int motion_threshold) {
+	pipelined = enable;
+	referenceInterval = std::max(interval, 1);
+	motionThreshold = motion_threshold;
+	referenceAge = -1;
+}
+
+/**
+ * A robot that stands still sees the same laser vector scan after scan, so there is no need to classify it again. The
+ * vote over the last results removes the single scans that flip between two classes, at the cost of a delay of about
+ * half the votes when the scene really changes. A single vote keeps the old behaviour.
+ *
+ * @param enable             reuse the last result while the vector does not change
+ * @param change_threshold   mean change in columns per row (see vectorChange) below which the vector is the same
+ * @param votes              number of results that are voted over, at most LASER_MAX_VOTES
+ */
+void CLaserScan::setCaching(bool enable, float change_threshold, int votes) {
+	caching = enable;
+	changeThreshold = change_threshold;
+	voteSize = std::min(std::max(votes, 1), LASER_MAX_VOTES);
+	cacheValid = false;
+	voteCount = 0;
 }
 
 int CLaserScan::Start() {
 	started = true;
 	int error = camera.Start("/dev/video0", cameraDeviceHandler);
-	if ((error < 0) || (cameraDeviceHandler <= 0)) {
+	// a camera that takes its frames from the camera server has no device handler
+	if ((error < 0) || (cameraDeviceHandler <= 0 && !camera.isShared())) {
 		std::cerr << DEBUG << "Camera device handler could not be obtained. Other controller using the camera?" << std::endl;
 		error = -1;
 	}
@@ -248,28 +321,18 @@ void CLaserScan::Stop() {
 //	return 0;
 //}
 
+/**
+ * The laser vector is built band by band from the rows between topRowLimit and bottomRowLimit, see addBand(). The
+ * rows outside of these limits are not looked at and get the value 0.
+ */
 int CLaserScan::generateVector(CRawImage* laserImage, CRawImage* noLaserImage, std::vector<int> & vec) {
 
 	assert (laserImage->getwidth() == noLaserImage->getwidth());
 	assert (laserImage->getheight() == noLaserImage->getheight());
 
-	// clear the vector first
-	vec.clear();
-	int margin_left = 150;
-	int margin_right = 220;
-	int threshold = 20;
-	int diff_threshold = 20;
-	for (int j = 0; j < laserImage->getheight(); j++) {
-		int p = 0;
-		for (int i = margin_left; i < laserImage->getwidth() - margin_right; i++) {
-			int pos = 3*(j*laserImage->getwidth()+i);
-			bool red = imageManip.isMoreRed(*laserImage, *noLaserImage, pos, threshold, diff_threshold);
-			if (red) {
-				p = i;
-				break;
-			}
-		}
-		vec.push_back(p);
+	beginVector(vec);
+	for (int row = topRowLimit; row <= bottomRowLimit; row += LASER_BAND_ROWS) {
+		addBand(laserImage, noLaserImage, row, LASER_BAND_ROWS, vec);
 	}
 	if (printLaser) {
 		fprintf(stdout, "%s(): Laser array [%li]: \n", __func__, vec.size());
@@ -285,6 +348,65 @@ int CLaserScan::generateVector(CRawImage* laserImage, CRawImage* noLaserImage, s
 	return 0;
 }
 
+/**
+ * Start a new laser vector, all rows are 0 (nothing detected) until their band is added.
+ */
+void CLaserScan::beginVector(std::vector<int> & vec) {
+	vec.assign(imageHeight, 0);
+}
+
+/**
+ * Add a band of rows to the laser vector. The bands can be added in any order and as soon as the rows of both images
+ * are available, so the laser vector does not need all of both frames at once. The rows are clipped to the limits
+ * that are set with setLimits(). No difference image is created.
+ *
+ * @param laserImage         the image with the laser turned on, only the rows of the band have to be up to date
+ * @param noLaserImage       the image with the laser turned off
+ * @param first_row          the first row of the band
+ * @param rows               the number of rows in the band
+ * @param vec                the vector that was started with beginVector()
+ * @return                   number of rows that were added
+ */
+int CLaserScan::addBand(CRawImage* laserImage, CRawImage* noLaserImage, int first_row, int rows,
+		std::vector<int> & vec) {
+	assert ((int)vec.size() == laserImage->getheight());
+	int first = std::max(first_row, std::max(topRowLimit, 0));
+	int end = std::min(first_row + rows, std::min(bottomRowLimit + 1, laserImage->getheight()));
+	if (end <= first) return 0;
+
+	int margin_left = 150;
+	int margin_right = 220;
+	int threshold = 20;
+	int diff_threshold = 20;
+	int width = laserImage->getwidth();
+	imageManip.red_rows(laserImage->getView(0, first, width, end - first),
+			noLaserImage->getView(0, first, width, end - first), margin_left, margin_right, threshold,
+			diff_threshold, &vec[first]);
+	return end - first;
+}
+
+/**
+ * The first red column of a row is only the edge of the laser line, so the distance resolution is limited to whole
+ * pixels. The peaks are fractional columns around the centre of the line, only the rows within the limits are refined.
+ *
+ * @param laserImage         the image with the laser turned on
+ * @param noLaserImage       the image with the laser turned off
+ * @param vec                the vector that was filled by generateVector
+ * @param peaks              for every row the sub-pixel column of the laser, or 0 if there is none
+ */
+void CLaserScan::refineVector(CRawImage* laserImage, CRawImage* noLaserImage, const std::vector<int> & vec,
+		std::vector<float> & peaks) {
+	assert ((int)vec.size() == laserImage->getheight());
+	peaks.assign(vec.size(), 0);
+	int first = std::max(topRowLimit, 0);
+	int end = std::min(bottomRowLimit + 1, laserImage->getheight());
+	if (end <= first) return;
+	int margin_right = 220;
+	int width = laserImage->getwidth();
+	imageManip.red_peaks(laserImage->getView(0, first, width, end - first),
+			noLaserImage->getView(0, first, width, end - first), margin_right, &vec[first], &peaks[first]);
+}
+
 /**
  * Return the length of the detected red line. Assumes that this is one line only. And estimates the distance to that
  * line. If the thing portrayed on is too close, it will not be seen by the camera and the red-line will be portrayed
@@ -314,18 +436,12 @@ void CLaserScan::estimateParameters(std::vector<int> & vec, int & length, int &
 		}
 	}
 #else
-	// just add all the non-zero entries
-	int avg = 0; int cnt = 0; start = 0; end = 0;
-	for (int i = 0; i < vec.size(); i++) {
-		if (vec[i]) {
-			avg += vec[i];
-			length++;
-		}
-	}
-	if (length) {
-		avg = avg / length;
-	}
-
+	// the average and the variance of the non-zero entries, in one pass
+	start = 0; end = 0;
+	float avg = 0;
+	length = dobots::mean_variance_if(vec.begin(), vec.end(), avg, variance,
+			std::bind2nd(std::not_equal_to<int>(), 0));
+	distance = (int)avg;
 
 	for (int i = 3; i < vec.size(); i++) {
 		if (vec[i] && vec[i-1] && vec[i-2]) {
@@ -339,26 +455,25 @@ void CLaserScan::estimateParameters(std::vector<int> & vec, int & length, int &
 			break;
 		}
 	}
-
-	//	std::cout << DEBUG << "Average: " << avg << std::endl;
-	for (int i = 0; i < vec.size(); ++i) {
-		if (vec[i]) {
-			float var = (vec[i] - avg) * (vec[i] - avg);
-			//			std::cout << DEBUG << "Diff between " << vec[i] << " and " << avg << " = " << var << std::endl;
-			variance += var;
-		}
-	}
-	//	std::cout << DEBUG << "Total variance: " << variance << std::endl;
-
-	if (length) {
-		distance = avg;
-		variance = variance / length;
-	}
 #endif
 }
 
-float CLaserScan::getRobustness(std::vector<int> & vec) {
-	//	float
+/**
+ * A laser line that is seen over the full height between the limits is robust, a few rows with laser can just as well
+ * be noise.
+ *
+ * @param vec                laser vector, as filled by generateVector
+ * @return                   fraction of the rows from topRowLimit to bottomRowLimit with a laser point, 0 to 1
+ */
+float CLaserScan::getRobustness(const std::vector<int> & vec) {
+	int first = std::max(topRowLimit, 0);
+	int last = std::min(bottomRowLimit, (int)vec.size() - 1);
+	if (last < first) return 0;
+	int hits = 0;
+	for (int i = first; i <= last; ++i) {
+		if (vec[i]) hits++;
+	}
+	return (float)hits / (last - first + 1);
 }
 
 
@@ -386,15 +501,10 @@ void CLaserScan::getLine(CRawImage *image, double & alpha, double & d) {
 
 	hough.addPoints(points);
 
-	int hough_steps = 40;
-	std::cout << "Use " << hough_steps << " hough steps" << std::endl;
-
-	std::cout << "Hough transform status ";
-	for (int t = 0; t < hough_steps; t++) {
-		std::cout << '.';
-		hough.doTransform();
-	}
-	std::cout << std::endl;
+	// the votes of the previous image would make the current line look less dominant
+	hough.getAccumulator()->Reset();
+	int hough_steps = hough.doTransform(HOUGH_MAX_STEPS, HOUGH_MIN_HITS, HOUGH_DOMINANCE);
+	std::cout << "Used " << hough_steps << " hough steps" << std::endl;
 
 	hough.getLine(d, alpha);
 
@@ -417,21 +527,57 @@ void CLaserScan::GetData() {
 
 	laser.Off();
 
+	// without difference images only the rows between the limits are needed for the laser vector
+	bool band_only = !(showDiffRed || showDiffRGB || streamDiffRed || streamDiffRGB);
+	if (band_only) {
+		ImageRoi band(0, topRowLimit, imageWidth, bottomRowLimit - topRowLimit + 1);
+		image1->setRoi(band);
+		image2->setRoi(band);
+	} else {
+		image1->clearRoi();
+		image2->clearRoi();
+	}
+
 	if (printTime) fprintf(stdout,"Start grabbing time: %ims\n", sfTimer.getTime());
-	camera.renewImage(image1, true);
-	//	camera.denoiseImageByCapturingAnother(image1);
+	bool reuse = pipelined && (referenceAge >= 0) && (referenceAge < referenceInterval);
+	if (reuse) {
+		// only take the picture with the laser, and check if the reference still fits
+		laser.On();
+		camera.renewImage(image2, CF_RGB);
+		laser.Off();
+		ImageRoi r = image2->getRoi();
+		int change = imageManip.motion(image1->getView(r.x, r.y, r.width, r.height),
+				image2->getView(r.x, r.y, r.width, r.height));
+		if (change > motionThreshold) {
+			if (printLaser) printf("%s(): Scene changed by %i, capture a new reference\n", __func__, change);
+			reuse = false;
+		}
+	}
 
-	assert (imageManip.CheckIntegrity(image1) );
+	if (reuse) {
+		referenceAge++;
+	} else {
+		camera.renewImage(image1, CF_RGB);
 
-	// Turn the laser on
-	laser.On();
+		assert (band_only || imageManip.CheckIntegrity(image1) );
 
-	// Take the second picture
-	camera.renewImage(image2, true);
-	//	camera.denoiseImageByCapturingAnother(image2);
+		// Turn the laser on
+		laser.On();
 
-	// Turn the laser off
-	laser.Off();
+		// Take the second picture
+		camera.renewImage(image2, CF_RGB);
+
+		// Turn the laser off
+		laser.Off();
+		referenceAge = 0;
+	}
+
+	if (image1->corrupt || image2->corrupt) {
+		// the camera could not repair the frame, keep the last scan and take a new reference next time
+		if (printLaser) printf("%s(): Corrupt frame, skip this scan\n", __func__);
+		referenceAge = -1;
+		return;
+	}
 
 	int time = sfTimer.getTime(); // make sure, the time is from capturing... more or less, not from writing
 	//	time = 0; // for debugging purposes, or else the thing is called differently all the time
@@ -446,7 +592,7 @@ void CLaserScan::GetData() {
 			imageManip.CheckIntegrity(image_red_diff);
 			std::stringstream ss; ss.clear(); ss.str("");
 			ss << "red_imagediff" << time << ".bmp";
-			image_red_diff->saveBmp(ss.str().c_str());
+			CImageWriter::writer().save(image_red_diff, SF_BMP, ss.str().c_str());
 		}
 	}
 
@@ -459,7 +605,7 @@ void CLaserScan::GetData() {
 			imageManip.CheckIntegrity(image_rgb_diff);
 			std::stringstream ss; ss.clear(); ss.str("");
 			ss << "rgb_imagediff" << time << ".bmp";
-			image_rgb_diff->saveBmp(ss.str().c_str());
+			CImageWriter::writer().save(image_rgb_diff, SF_BMP, ss.str().c_str());
 		}
 	}
 
@@ -467,12 +613,12 @@ void CLaserScan::GetData() {
 		// also store the raw images themselves for comparison
 		std::stringstream ss; ss.clear(); ss.str("");
 		ss << "raw1_image" << time << ".bmp";
-		image1->saveBmp(ss.str().c_str());
+		CImageWriter::writer().save(image1, SF_BMP, ss.str().c_str());
 
 		// also store the raw images themselves for comparison
 		ss.clear(); ss.str("");
 		ss << "raw2_image" << time << ".bmp";
-		image2->saveBmp(ss.str().c_str());
+		CImageWriter::writer().save(image2, SF_BMP, ss.str().c_str());
 	}
 
 #ifdef CALCULATE_HOUGH
@@ -603,16 +749,36 @@ void CLaserScan::GetRecognizedObject(ObjectType &object_type, int & distance) {
 		// get the two camera images and calculate the difference
 		GetData();
 
+		CStageTimer detect_timer(STAGE_DETECT);
 		generateVector(image2,image1,laserVector);
+		detect_timer.stop();
+
+		if (t == 0 && caching && cacheValid && vectorChange(laserVector, cachedVector) < changeThreshold) {
+			object_type = cachedObject;
+			distance = cachedDistance;
+			CStageStats::stats().countFrame();
+			if (printLaser) std::cout << DEBUG << "Laser vector did not change, keep the last result" << std::endl;
+			return;
+		}
 
 		//	float robustness = getRobustness(laserVector);
 
 		a_distance[t] = 0; a_length[t] = 0; a_start[t] = 0; a_end[t] = 0; a_variance[t] = 0.0;
+		CStageTimer transform_timer(STAGE_TRANSFORM);
 		estimateParameters(laserVector, a_length[t], a_distance[t], a_start[t], a_end[t], a_variance[t]);
+		int segments = lineExtractor.extract(laserVector);
+		transform_timer.stop();
+		CStageStats::stats().countFrame();
 
 		std::cout << DEBUG << "Variance is " << a_variance[t] << std::endl;
 		std::cout << DEBUG << "Laser parameters: length=" << a_length[t] << ", distance=" << a_distance[t] << ", start="
 				<< a_start[t] << ", end=" << a_end[t] << std::endl;
+		for (int i = 0; i < segments; ++i) {
+			const LaserSegment & segment = lineExtractor.getSegment(i);
+			std::cout << DEBUG << "Segment " << i << ": rows " << segment.start << "-" << segment.end << ", points="
+					<< segment.count << ", mean=" << segment.mean << ", slope=" << segment.slope << ", variance="
+					<< segment.variance << std::endl;
+		}
 
 		// used octave to fit the stuff, first array is the distance in cm, second array are the values from the laserscan
 		// x=[7,10,13,16,19,22,25,28,31,34,37];
@@ -682,48 +848,107 @@ void CLaserScan::GetRecognizedObject(ObjectType &object_type, int & distance) {
 	 *  length=304, distance=300, start=1, end=318
 	 */
 
+	object_type = classifyObject(length, distance, start, variance);
+	if (caching) {
+		object_type = voteObject(object_type);
+		cachedVector = laserVector;
+		cachedObject = object_type;
+		cachedDistance = distance;
+		cacheValid = true;
+	}
+}
 
+/**
+ * The classes are based on the length of the line, where it starts, and the distance to it, see the examples in
+ * GetRecognizedObject.
+ */
+ObjectType CLaserScan::classifyObject(int length, int distance, int start, float variance) {
 	printf("Laser detected: \n");
 	if (variance > 50.0) {
 		printf("* something, but too much noise\n");
-		object_type = O_SOMETHING;
+		return O_SOMETHING;
 	} else if (variance == 0) {
 		printf("* nothing for now\n");
-		object_type = O_NOTHING;
+		return O_NOTHING;
 	} else if (distance > 40) {
 		printf("* nothing for now\n");
-		object_type = O_NOTHING;
-		return;
+		return O_NOTHING;
 	} else if (length > 260) { // larger lines are definitely a wall
 		printf("* a wall because the vertical structure is very long\n");
-		object_type = O_WALL;
-		return;
+		return O_WALL;
 	} else if (length > 180 && (start < 150)) { // start very low means that the line goes up very high, must be a wall
 		//	} else if (length > 150 && (start < 150)) { // start very low means that the line goes up very high, must be a wall
 		printf("* a wall because there is something far away\n");
-		object_type = O_WALL;
-		return;
+		return O_WALL;
 	} else if (length > 50 && (start < 100)) { // if start is very low, it is definitely a wall, even if length is small
 		printf("* a wall because there is something very far away\n");
-		object_type = O_WALL;
-		return;
+		return O_WALL;
 	} else if ((length < 100) && (distance < 30)) {
 		printf("* a small step because there is a very tiny line\n");
-		object_type = O_SMALL_STEP;
-		return;
+		return O_SMALL_STEP;
 	} else if ((length < 150) && (start > 250) && (distance < 30)) {
 		printf("* a small step because there is a tiny line and it is nearby\n");
-		object_type = O_SMALL_STEP;
-		return;
+		return O_SMALL_STEP;
 	} else if ((length < 260) && (distance < 30)) { //	 && (distance/length < 2.0) ) {
 		printf("* a large step because there is a nice line\n");
-		object_type = O_LARGE_STEP;
-		return;
+		return O_LARGE_STEP;
 	} else {
 		printf("* something, but has to decide\n");
-		object_type = O_SOMETHING;
+		return O_SOMETHING;
+	}
+}
+
+/**
+ * The rows where neither vector sees the laser do not count, so a vector without laser is the same as another one
+ * without laser. A row where only one of them sees it counts as LASER_CHANGE_MISSING columns.
+ *
+ * @param vec                the new laser vector
+ * @param previous           the vector it is compared with
+ * @return                   mean absolute difference in columns of the rows that count
+ */
+float CLaserScan::vectorChange(const std::vector<int> & vec, const std::vector<int> & previous) {
+	if (vec.size() != previous.size()) return (float)LASER_CHANGE_MISSING;
+	int sum = 0, rows = 0;
+	for (int i = 0; i < (int)vec.size(); ++i) {
+		if (!vec[i] && !previous[i]) continue;
+		sum += (vec[i] && previous[i]) ? abs(vec[i] - previous[i]) : LASER_CHANGE_MISSING;
+		rows++;
+	}
+	return rows ? (float)sum / rows : 0;
+}
+
+ObjectType CLaserScan::voteObject(ObjectType object_type) {
+	votes[voteNext] = object_type;
+	voteNext = (voteNext + 1) % voteSize;
+	if (voteCount < voteSize) voteCount++;
+	ObjectType best = object_type;
+	int best_count = 0;
+	// from the most recent result backwards, so a tie is won by the most recent
+	for (int i = 1; i <= voteCount; ++i) {
+		ObjectType candidate = votes[(voteNext - i + voteSize) % voteSize];
+		int count = 0;
+		for (int j = 0; j < voteCount; ++j) {
+			if (votes[j] == candidate) count++;
+		}
+		if (count > best_count) {
+			best = candidate;
+			best_count = count;
+		}
+	}
+	return best;
+}
+
+/**
+ * Only the minimum interval of the scheduler is set, the maximum interval when idle stays the same.
+ *
+ * @param rate               scans per second, at least 1
+ */
+void CLaserScan::SetRefreshRate(int rate) {
+	if (rate < 1) {
+		std::cerr << DEBUG << "Refresh rate " << rate << " is not valid, it should be at least 1" << std::endl;
 		return;
 	}
+	scheduler.setIntervals(1000000 / rate, scheduler.getMaxInterval());
 }
 
 /**
@@ -738,11 +963,20 @@ void CLaserScan::GetDistance(int &distance) {
 	assert(laserResolution >> div_factor == laserSmallVecSize);
 
 	GetData();
+	captureTime = CStageStats::now();
 
+	CStageTimer detect_timer(STAGE_DETECT);
 	generateVector(image2,image1,laserVector);
+	refineVector(image2,image1,laserVector,laserPeaks);
+	detect_timer.stop();
 
 	int length = 0, start = 0, end = 0; float variance = 0;
+	CStageTimer transform_timer(STAGE_TRANSFORM);
 	estimateParameters(laserVector, length, distance, start, end, variance);
+	lineExtractor.extract(laserVector);
+	odometry.match(laserPeaks, captureTime);
+	transform_timer.stop();
+	CStageStats::stats().countFrame();
 	//	if (printLaser) {
 	std::cout << DEBUG << "Variance is " << variance << std::endl;
 	std::cout << DEBUG << "Line length: " << length << " pixels" << std::endl;
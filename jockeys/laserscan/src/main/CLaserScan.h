@@ -38,6 +38,9 @@
 #include "CTimer.h"
 #include "CLaser.h"
 #include "CCamera.h"
+#include "CLineExtractor.h"
+#include "CLaserOdometry.h"
+#include "CRefreshScheduler.h"
 
 #ifdef USE_HOUGH_TRANSFORM
 #include <Hough.h>
@@ -69,6 +72,14 @@
 //! They are of the type "int"
 typedef int ObjectType ;
 
+//! Most results GetRecognizedObject votes over, see setCaching
+#define LASER_MAX_VOTES 16
+
+//! Change in columns that a row counts for when only one of two laser vectors sees the laser in it, see vectorChange
+#ifndef LASER_CHANGE_MISSING
+#define LASER_CHANGE_MISSING 16
+#endif
+
 /**
  * Uses data from laser and camera for e.g. distance information
  */
@@ -98,12 +109,48 @@ public:
 	//! Get the distance to an object using laser and camera data
 	void GetDistance(int &distance);
 
-	//! Set the refresh rate of the module (will make the distance less accurate of course)
+	//! Set the refresh rate of the module in scans per second while the robot moves (will make the distance less
+	//! accurate of course), when idle the scheduler backs off to a lower rate
 	void SetRefreshRate(int rate);
 
+	//! The scheduler that decides when the controller does the next scan
+	inline CRefreshScheduler & getScheduler() { return scheduler; }
+
 	//! Fill small array from big one
 	void Fill(int *in, int in_size, int *out, int out_size);
 
+	//! Pair every laser-on frame with a laser-off reference that is only captured again every interval measurements,
+	//! or when the scene changed more than motion_threshold (see CImageManip::motion)
+	void setPipelined(bool enable, int interval = 8, int motion_threshold = 12);
+
+	//! Check if the laser-off reference is reused
+	inline bool isPipelined() { return pipelined; }
+
+	//! Let GetRecognizedObject return its last result while the laser vector changes less than change_threshold
+	//! columns per row, and return the most frequent of the last votes results instead of only the last one
+	void setCaching(bool enable, float change_threshold = 3, int votes = 5);
+
+	//! Check if the result of GetRecognizedObject is cached
+	inline bool isCaching() { return caching; }
+
+	//! The straight segments of the last laser vector of GetRecognizedObject or GetDistance
+	inline CLineExtractor & getLines() { return lineExtractor; }
+
+	//! The laser vector of the last scan, the column of the laser in every row, 0 for rows without laser
+	inline const std::vector<int> & getLaserVector() { return laserVector; }
+
+	//! The sub-pixel column of the laser in every row of the last scan of GetDistance, 0 for rows without laser
+	inline const std::vector<float> & getLaserPeaks() { return laserPeaks; }
+
+	//! Time at which the last scan of GetDistance was captured, in microseconds
+	inline long long getCaptureTime() { return captureTime; }
+
+	//! Fraction of the rows within the limits that see the laser
+	float getRobustness(const std::vector<int> & vec);
+
+	//! The motion between the laser vectors of the last two calls of GetDistance
+	inline CLaserOdometry & getOdometry() { return odometry; }
+
 	//! Setter for limits, top < bottom... (awkward, yes)
 	inline void setLimits(int top, int bottom) { topRowLimit = top; bottomRowLimit = bottom; }
 
@@ -150,7 +197,15 @@ protected:
 
 	int generateVector(CRawImage* laserImage, CRawImage* noLaserImage, std::vector<int> & vec);
 
-	float getRobustness(std::vector<int> & vec);
+	//! Start a laser vector that is filled band by band with addBand
+	void beginVector(std::vector<int> & vec);
+
+	//! Add the laser positions of a band of rows to the vector, only rows within the limits are used
+	int addBand(CRawImage* laserImage, CRawImage* noLaserImage, int first_row, int rows, std::vector<int> & vec);
+
+	//! Locate the laser line of the rows of a finished vector with sub-pixel precision, see CImageManip::red_peaks
+	void refineVector(CRawImage* laserImage, CRawImage* noLaserImage, const std::vector<int> & vec,
+			std::vector<float> & peaks);
 
 #ifdef USE_HOUGH_TRANSFORM
 	//! Get line from an image
@@ -159,10 +214,19 @@ protected:
 
 	void estimateParameters(std::vector<int> & vec, int & length, int & distance, int &start, int &end, float &variance);
 
+	//! The object that the parameters of the best trial of GetRecognizedObject describe
+	ObjectType classifyObject(int length, int distance, int start, float variance);
+
+	//! Mean change in columns per row between two laser vectors, only rows where one of them sees the laser count
+	float vectorChange(const std::vector<int> & vec, const std::vector<int> & previous);
+
+	//! Add a result to the votes and return the most frequent of them, the most recent one on a tie
+	ObjectType voteObject(ObjectType object_type);
+
 private:
 #ifdef USE_HOUGH_TRANSFORM
 	//! The internal structure for the Hough transform
-	dobots::Hough<DecPoint> hough;
+	dobots::Hough<DecPoint, dobots::DenseAccumulator<DecPoint> > hough;
 #endif
 	bool printTime;
 
@@ -190,6 +254,16 @@ private:
 
 	std::vector<int> laserVector;
 
+	std::vector<float> laserPeaks;
+
+	CLineExtractor lineExtractor;
+
+	CLaserOdometry odometry;
+
+	CRefreshScheduler scheduler;
+
+	long long captureTime;
+
 	int *laserVec;
 	int *laserSmallVec;
 	int laserSmallVecSize;
@@ -209,6 +283,26 @@ private:
 
 	bool started;
 
+	//! Reuse the laser-off image (image1) for several laser-on images
+	bool pipelined;
+	int referenceInterval;
+	int motionThreshold;
+	//! Number of measurements since the laser-off image was captured, -1 if there is no valid one
+	int referenceAge;
+
+	//! The result of GetRecognizedObject is reused while the laser vector stays the same
+	bool caching;
+	float changeThreshold;
+	bool cacheValid;
+	std::vector<int> cachedVector;
+	ObjectType cachedObject;
+	int cachedDistance;
+	//! Ring of the last results of GetRecognizedObject before the vote
+	ObjectType votes[LASER_MAX_VOTES];
+	int voteSize;
+	int voteCount;
+	int voteNext;
+
 	std::string log_prefix;
 };
 
@@ -0,0 +1,185 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Extract all straight segments of a laser vector
+ * @file CLineExtractor.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 14, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "CLineExtractor.h"
+
+/**
+ * The defaults are such that the noise of the laser line, a few columns, stays within a segment, while a step, which
+ * moves the line at least ten columns, breaks it.
+ */
+CLineExtractor::CLineExtractor(int rows): capacity(rows), points(0), count(0), tolerance(3), max_gap(3),
+		max_jump(10), min_points(5) {
+	this->rows = new int[capacity];
+	columns = new int[capacity];
+	stack = new int[2 * capacity + 2];
+}
+
+CLineExtractor::~CLineExtractor() {
+	delete [] rows;
+	delete [] columns;
+	delete [] stack;
+}
+
+/**
+ * Extract the segments in a single pass over the vector, followed by the splitting and merging of the parts that are
+ * found. The vector is expected to have a column for every row, 0 if there is no laser in that row.
+ *
+ * @param vec                laser vector, as filled by CLaserScan::generateVector
+ * @return                   number of segments
+ */
+int CLineExtractor::extract(const std::vector<int> & vec) {
+	count = 0;
+	points = 0;
+	int size = ((int)vec.size() < capacity) ? (int)vec.size() : capacity;
+	for (int i = 0; i < size; ++i) {
+		if (!vec[i]) continue;
+		rows[points] = i;
+		columns[points] = vec[i];
+		points++;
+	}
+
+	int begin = 0;
+	for (int p = 1; p <= points; ++p) {
+		if (p < points && rows[p] - rows[p-1] <= max_gap + 1 && abs(columns[p] - columns[p-1]) <= max_jump) continue;
+		// split the part [begin, p-1] at its corners, the left part first so the segments stay ordered
+		int top = 0;
+		stack[top++] = begin;
+		stack[top++] = p - 1;
+		while (top > 0) {
+			int last = stack[--top];
+			int first = stack[--top];
+			if (last - first + 1 < min_points) continue;
+			float distance;
+			int corner = furthest(first, last, distance);
+			if (distance > tolerance) {
+				stack[top++] = corner + 1;
+				stack[top++] = last;
+				stack[top++] = first;
+				stack[top++] = corner;
+			} else {
+				addSegment(first, last);
+			}
+		}
+		begin = p;
+	}
+	merge();
+	return count;
+}
+
+const LaserSegment *CLineExtractor::getLongest() {
+	int longest = -1;
+	for (int i = 0; i < count; ++i) {
+		if (longest < 0 || segments[i].count > segments[longest].count) longest = i;
+	}
+	return (longest < 0) ? NULL : &segments[longest];
+}
+
+void CLineExtractor::addSegment(int first, int last) {
+	if (count == MAX_LASER_SEGMENTS) return;
+	fit(first, last, segments[count]);
+	first_point[count] = first;
+	last_point[count] = last;
+	count++;
+}
+
+void CLineExtractor::fit(int first, int last, LaserSegment & segment) {
+	double n = last - first + 1, sr = 0, sc = 0, srr = 0, src = 0;
+	for (int p = first; p <= last; ++p) {
+		sr += rows[p];
+		sc += columns[p];
+		srr += (double)rows[p] * rows[p];
+		src += (double)rows[p] * columns[p];
+	}
+	double denominator = n * srr - sr * sr;
+	segment.slope = (denominator > 0) ? (n * src - sr * sc) / denominator : 0;
+	segment.offset = (sc - segment.slope * sr) / n;
+	segment.mean = sc / n;
+	segment.start = rows[first];
+	segment.end = rows[last];
+	segment.count = last - first + 1;
+	double variance = 0;
+	for (int p = first; p <= last; ++p) {
+		double d = columns[p] - (segment.offset + segment.slope * rows[p]);
+		variance += d * d;
+	}
+	segment.variance = variance / n;
+}
+
+/**
+ * The distance is the perpendicular distance to the chord. The corner itself ends up in the first of the two parts.
+ */
+int CLineExtractor::furthest(int first, int last, float & distance) {
+	float dr = rows[last] - rows[first];
+	float dc = columns[last] - columns[first];
+	float length = sqrtf(dr * dr + dc * dc);
+	int corner = first;
+	distance = 0;
+	if (length == 0) return corner;
+	for (int p = first + 1; p < last; ++p) {
+		float d = fabsf(dc * (rows[p] - rows[first]) - dr * (columns[p] - columns[first])) / length;
+		if (d > distance) {
+			distance = d;
+			corner = p;
+		}
+	}
+	return corner;
+}
+
+/**
+ * The split can cut a line in two at a point that is off by noise, so two neighbours are joined if the line through
+ * all of their points, and the points in between that were too few for a segment, fits within the tolerance.
+ */
+void CLineExtractor::merge() {
+	int i = 1;
+	while (i < count) {
+		int first = first_point[i-1], last = last_point[i];
+		bool close = (rows[first_point[i]] - rows[last_point[i-1]] <= max_gap + 1) &&
+				(abs(columns[first_point[i]] - columns[last_point[i-1]]) <= max_jump);
+		LaserSegment joined;
+		bool fits = close;
+		if (close) {
+			fit(first, last, joined);
+			for (int p = first; p <= last && fits; ++p) {
+				fits = (fabsf(columns[p] - (joined.offset + joined.slope * rows[p])) <= tolerance);
+			}
+		}
+		if (!fits) {
+			i++;
+			continue;
+		}
+		segments[i-1] = joined;
+		last_point[i-1] = last;
+		for (int j = i + 1; j < count; ++j) {
+			segments[j-1] = segments[j];
+			first_point[j-1] = first_point[j];
+			last_point[j-1] = last_point[j];
+		}
+		count--;
+	}
+}
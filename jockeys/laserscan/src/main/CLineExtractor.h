@@ -0,0 +1,116 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Extract all straight segments of a laser vector
+ * @file CLineExtractor.h
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 14, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#ifndef CLINEEXTRACTOR_H_
+#define CLINEEXTRACTOR_H_
+
+#include <vector>
+
+//! Maximum number of segments that are extracted from a single laser vector
+#define MAX_LASER_SEGMENTS 16
+
+/**
+ * A straight part of the laser line. The laser vector has a column for every row of the image, so a segment is a
+ * line column = offset + slope * row over the rows [start, end].
+ */
+struct LaserSegment {
+	int start;
+	int end;
+	//! Number of rows with a laser point
+	int count;
+	float slope;
+	float offset;
+	//! Mean column, the same value as the distance of CLaserScan::estimateParameters for a single segment
+	float mean;
+	//! Mean squared distance of the points to the line, in columns
+	float variance;
+};
+
+/**
+ * Split-and-merge line extraction. The points of the laser vector are split where rows are missing or the column jumps,
+ * every part is split recursively at its point furthest from the chord between its ends, and neighbouring segments
+ * that turn out to lie on the same line are merged again. All buffers are allocated once, so extracting does not
+ * allocate anything.
+ */
+class CLineExtractor {
+public:
+	//! Extractor for laser vectors of at most rows items
+	CLineExtractor(int rows);
+
+	~CLineExtractor();
+
+	//! Extract all segments of the vector, ordered on their first row, returns the number of segments
+	int extract(const std::vector<int> & vec);
+
+	inline int getCount() { return count; }
+
+	inline const LaserSegment & getSegment(int i) { return segments[i]; }
+
+	//! The segment with the most points, NULL if there are no segments
+	const LaserSegment *getLongest();
+
+	//! Set the maximum distance in columns of a point to its segment
+	inline void setTolerance(float tolerance) { this->tolerance = tolerance; }
+
+	//! Set the number of rows without laser that break a segment, and the column jump that does so
+	inline void setBreaks(int max_gap, int max_jump) { this->max_gap = max_gap; this->max_jump = max_jump; }
+
+	//! Set the minimum number of points of a segment
+	inline void setMinPoints(int min_points) { this->min_points = min_points; }
+private:
+	//! Fit the points [first, last] with least squares and add it as a segment
+	void addSegment(int first, int last);
+
+	//! Fit the points [first, last] with least squares
+	void fit(int first, int last, LaserSegment & segment);
+
+	//! The point in (first, last) that is furthest from the chord between first and last, and its distance
+	int furthest(int first, int last, float & distance);
+
+	//! Merge neighbouring segments if all their points are within the tolerance of a single line
+	void merge();
+
+	int capacity;
+	//! Row and column of every laser point, the inlier buffer of the segments
+	int *rows;
+	int *columns;
+	int points;
+	//! Ranges of points that still have to be split, first and last point
+	int *stack;
+
+	LaserSegment segments[MAX_LASER_SEGMENTS];
+	//! First and last point of every segment
+	int first_point[MAX_LASER_SEGMENTS];
+	int last_point[MAX_LASER_SEGMENTS];
+	int count;
+
+	float tolerance;
+	int max_gap;
+	int max_jump;
+	int min_points;
+};
+
+#endif /* CLINEEXTRACTOR_H_ */
@@ -0,0 +1,65 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Schedule the laser scans depending on the motion of the robot
+ * @file CRefreshScheduler.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 14, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#include "CRefreshScheduler.h"
+
+/**
+ * The minimum interval is the 0.1 seconds that the controller used to sleep after every scan, when idle the scans back
+ * off to one every 2 seconds. Anything within 30 cm is near, the distance at which the laser is the most accurate.
+ */
+CRefreshScheduler::CRefreshScheduler(): min_interval(100000), max_interval(2000000), interval(100000), last(0),
+		near_distance(30) {
+}
+
+bool CRefreshScheduler::isDue(long long now) {
+	return (last == 0) || (now - last >= interval);
+}
+
+/**
+ * A distance of -1 (too noisy) also counts as near, if the laser cannot make sense of the scene it is better to look
+ * again soon. A distance of 0 or 255 means that nothing is seen.
+ *
+ * @param now                time of the scan, in microseconds
+ * @param moving             if the motors are driving
+ * @param distance           distance in cm of the scan
+ */
+void CRefreshScheduler::update(long long now, bool moving, int distance) {
+	last = now;
+	bool near = (distance == -1) || (distance > 0 && distance < near_distance);
+	if (moving || near) {
+		interval = min_interval;
+		return;
+	}
+	interval *= 2;
+	if (interval > max_interval) interval = max_interval;
+}
+
+void CRefreshScheduler::setIntervals(long long min_interval, long long max_interval) {
+	this->min_interval = (min_interval > 0) ? min_interval : 1;
+	this->max_interval = (max_interval > this->min_interval) ? max_interval : this->min_interval;
+	if (interval < this->min_interval) interval = this->min_interval;
+	if (interval > this->max_interval) interval = this->max_interval;
+}
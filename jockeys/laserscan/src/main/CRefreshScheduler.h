@@ -0,0 +1,66 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Schedule the laser scans depending on the motion of the robot
+ * @file CRefreshScheduler.h
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 14, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#ifndef CREFRESHSCHEDULER_H_
+#define CREFRESHSCHEDULER_H_
+
+/**
+ * Decides when the next laser scan is due. While the robot moves, or while the last distance is short, every scan is
+ * done at the minimum interval. Otherwise the interval doubles after every scan up to the maximum interval, so a
+ * parked robot only takes a pair of images now and then and the camera and the processor are free for other jockeys.
+ * Any motion or a short distance immediately brings the interval back to the minimum.
+ */
+class CRefreshScheduler {
+public:
+	CRefreshScheduler();
+
+	//! Check if the next scan is due at time now, in microseconds
+	bool isDue(long long now);
+
+	//! Update the interval after a scan at time now, distance as given by CLaserScan::GetDistance
+	void update(long long now, bool moving, int distance);
+
+	//! Set the shortest and the longest interval between scans, in microseconds
+	void setIntervals(long long min_interval, long long max_interval);
+
+	//! Distances in cm below this value keep the scans at the minimum interval
+	inline void setNearDistance(int near_distance) { this->near_distance = near_distance; }
+
+	//! The current interval between scans, in microseconds
+	inline long long getInterval() { return interval; }
+
+	//! The interval between scans when idle, in microseconds
+	inline long long getMaxInterval() { return max_interval; }
+private:
+	long long min_interval;
+	long long max_interval;
+	long long interval;
+	//! Time of the last scan, 0 if there was none
+	long long last;
+	int near_distance;
+};
+
+#endif /* CREFRESHSCHEDULER_H_ */
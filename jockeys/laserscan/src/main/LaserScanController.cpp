@@ -26,8 +26,11 @@
 
 #include <LaserScanController.h>
 #include <CTextLog.h>
+#include <CStageStats.h>
+#include <messageSchema.h>
 
 #include <syslog.h> // LOG_DEBUG
+#include <algorithm>
 
 //! The name of the controller can be used for controller selection
 static const std::string NAME = "LaserScan";
@@ -35,13 +38,21 @@ static const std::string NAME = "LaserScan";
 //! Convenience function for printing to standard out
 #define DEBUG NAME << '[' << getpid() << "] " << __func__ << "(): "
 
-LaserScanController::LaserScanController(): scan(NULL), imageSem(new sem_t()), image_server(NULL), images(), patch(),
+LaserScanController::LaserScanController(): scan(NULL), frames(NULL), image_server(NULL), images(), patch(),
 		mosaic_image(NULL), streaming(false), motors(NULL), create_mosaic(true), initialized_periphery(false) {
 	images.resize(4);
 	log_level = LOG_INFO;
 	exclusive_camera = false;
 	semaphore_set = false;
 	calc_distance = true;
+	send_odometry = false;
+	send_scan = false;
+	scan_count = 0;
+	last_object = O_NOTHING;
+	last_object_time = 0;
+	scan_columns.resize(MAX_LASER_SCAN_ROWS);
+	scan_buffer.resize(laserScanMaxLength(MAX_LASER_SCAN_ROWS));
+	recorder = NULL;
 }
 
 LaserScanController::~LaserScanController() {
@@ -53,6 +64,35 @@ LaserScanController::~LaserScanController() {
 	delete scan;
 	std::cout << DEBUG << "Delete CMotors instance" << std::endl;
 	delete motors;
+	if (recorder != NULL) {
+		if (server != NULL) server->setTap(NULL, NULL);
+		delete recorder;
+	}
+}
+
+//! Called for every message of the jockey, on the IPC thread for the incoming ones
+static void recordMessage(int type, const void *data, int len, bool outgoing, void *log) {
+	((CStreamLog*)log)->append(STREAM_LOG_MESSAGE, type, data, len, 0, outgoing ? STREAM_LOG_OUTGOING : 0);
+}
+
+/**
+ * The laser vectors are recorded after every scan, also when they are not sent. The frames are only recorded while
+ * they are streamed, it is the mosaic or camera image that the visualiser shows.
+ *
+ * @param path               path of the log, the segments and index are path.0000, ... and path.idx
+ * @return                   false if the log cannot be created
+ */
+bool LaserScanController::record(const char *path) {
+	if (recorder == NULL) recorder = new CStreamLog();
+	if (!recorder->open(path)) {
+		std::cerr << DEBUG << "Cannot record to " << path << std::endl;
+		delete recorder;
+		recorder = NULL;
+		return false;
+	}
+	std::cout << DEBUG << "Record to " << path << std::endl;
+	if (server != NULL) server->setTap(recordMessage, recorder);
+	return true;
 }
 
 void LaserScanController::initRobotPeriphery() {
@@ -161,6 +201,8 @@ ObjectType LaserScanController::getDetectedObject() {
 	int distance;
 
 	scan->GetRecognizedObject(object, distance);
+	last_object = object;
+	last_object_time = scan->getCaptureTime();
 
 	printDetectedObject(object);
 
@@ -212,6 +254,7 @@ void LaserScanController::sendDetectedObject(const ObjectType object, MappedObje
 
 	// overwrite sender id
 	obj_position.mappedBy = robot_id;
+	obj_position.timestamp = last_object_time;
 
 	// set relative position
 	// assuming that phi is from -pi to +pi, and 0 at [x,y]=[+1,0].
@@ -219,12 +262,14 @@ void LaserScanController::sendDetectedObject(const ObjectType object, MappedObje
 //	obj_position.yPosition += std::cos(obj_position.phiPosition) * distance;
 
 	// set payload
-	msg.len = sizeof(struct MappedObjectPosition);
+	msg.len = sizeof(MappedObjectPositionWire);
 	msg.data = new uint8_t[msg.len];
-	memcpy(msg.data, &obj_position, msg.len);
+	packMappedObjectPosition(obj_position, msg.data);
 
 	// send message
+	CStageTimer timer(STAGE_SEND);
 	server->sendMessage(msg);
+	timer.stop();
 
 	// delete payload of message
 	if (msg.data != NULL) {
@@ -233,12 +278,101 @@ void LaserScanController::sendDetectedObject(const ObjectType object, MappedObje
 	std::cout << DEBUG << "Detection message of " << StrMapObjectType[obj_position.type] << std::endl;
 }
 
+void LaserScanController::enableStats(bool enable) {
+	std::cout << DEBUG << (enable ? "Enable" : "Disable") << " latency statistics" << std::endl;
+	CStageStats::stats().setEnabled(enable);
+}
+
+void LaserScanController::sendStats() {
+	CStageStats & stats = CStageStats::stats();
+	PipelineStats reply;
+	memset(&reply, 0, sizeof(reply));
+	reply.enabled = stats.isEnabled();
+	reply.frames = stats.getFrames();
+	reply.dropped = stats.getDropped();
+	for (int i = 0; i < STATS_PIPELINE_STAGES && i < PIPELINE_STAGES; i++) {
+		StageSummary summary;
+		stats.getSummary((PipelineStage)i, summary);
+		reply.stages[i].count = summary.count;
+		reply.stages[i].p50 = summary.p50;
+		reply.stages[i].p95 = summary.p95;
+		reply.stages[i].p99 = summary.p99;
+		reply.stages[i].max = summary.max;
+	}
+	server->sendMessage(MSG_STATS, &reply, sizeof(PipelineStats));
+}
+
+void LaserScanController::enableOdometry(bool enable) {
+	std::cout << DEBUG << (enable ? "Enable" : "Disable") << " laser odometry" << std::endl;
+	send_odometry = enable;
+	if (enable && scan != NULL) scan->getOdometry().reset();
+}
+
 /**
- * Just prints distance to an object or anything.
+ * The odometry is only updated by GetDistance, so the motion is the one between the last two ticks that calculated
+ * the distance. Without a scan object all fields are zero.
+ */
+void LaserScanController::sendOdometry() {
+	LaserOdometry reply;
+	memset(&reply, 0, sizeof(reply));
+	if (scan != NULL) {
+		CLaserOdometry & odometry = scan->getOdometry();
+		const LaserMotion & motion = odometry.getMotion();
+		reply.timestamp = motion.timestamp;
+		reply.scan = odometry.getScans();
+		reply.total = odometry.getTotal();
+		if (motion.valid) {
+			reply.forward = motion.forward;
+			reply.residual = motion.residual;
+			reply.matches = motion.matches;
+		}
+	}
+	server->sendMessage(MSG_LASER_ODOMETRY, &reply, sizeof(LaserOdometry));
+}
+
+void LaserScanController::enableScanStream(bool enable) {
+	std::cout << DEBUG << (enable ? "Start" : "Stop") << " streaming laser scans" << std::endl;
+	send_scan = enable;
+}
+
+/**
+ * A scan of 480 rows is a message of about 500 bytes, while a difference image is 900kB before compression. Rows
+ * beyond MAX_LASER_SCAN_ROWS are not sent.
+ *
+ * @param distance           distance of the scan as given by GetDistance
+ */
+void LaserScanController::sendScan(int distance) {
+	if (scan == NULL) return;
+	const std::vector<int> & vec = scan->getLaserVector();
+	LaserScanHeader header;
+	memset(&header, 0, sizeof(header));
+	header.timestamp = scan->getCaptureTime();
+	header.scan = scan_count++;
+	header.object = last_object;
+	header.distance = distance;
+	header.rows = std::min((int)vec.size(), MAX_LASER_SCAN_ROWS);
+	header.robustness = scan->getRobustness(vec);
+	for (int i = 0; i < header.rows; i++) {
+		scan_columns[i] = vec[i];
+	}
+	int len = packLaserScan(header, &scan_columns[0], &scan_buffer[0]);
+	if (recorder != NULL) recorder->append(STREAM_LOG_SCAN, 0, &scan_buffer[0], len, header.timestamp);
+	if (!send_scan) return;
+	CStageTimer timer(STAGE_SEND);
+	server->sendMessage(MSG_LASER_SCAN, &scan_buffer[0], len);
+}
+
+/**
+ * Just prints distance to an object or anything. The ticks in between the scans that the scheduler of the laser scan
+ * allows return immediately, so the main loop keeps handling messages while the camera and the processor are idle.
  */
 void LaserScanController::tick() {
 	if (!initialized()) return;
 
+	CRefreshScheduler & scheduler = scan->getScheduler();
+	long long now = CStageStats::now();
+	if (!scheduler.isDue(now)) return;
+
 	int distance = 0;
 
 	if (streaming) {
@@ -266,9 +400,22 @@ void LaserScanController::tick() {
 		} else if (distance > 0) {
 			std::cout << DEBUG << "Distance: " << distance << " cm" << std::endl;
 		}
+		if (send_odometry) {
+			sendOdometry();
+		}
+		if (send_scan || recorder != NULL) {
+			sendScan(distance);
+		}
+	}
+
+	bool moving = (motors != NULL) && motors->isMoving();
+	scheduler.update(now, moving, distance);
+	if (log_level >= LOG_DEBUG) {
+		std::cout << DEBUG << "Next scan in " << scheduler.getInterval() / 1000 << " ms" << std::endl;
 	}
 
 	if (streaming) {
+		CStageTimer timer(STAGE_SEND);
 
 		if (create_mosaic) {
 			assert(mosaic_image != NULL);
@@ -291,18 +438,14 @@ void LaserScanController::tick() {
 			mosaic_image = images[2];
 		}
 
-		if (sem_post(imageSem) == -1) {
-			std::cerr << DEBUG << "Fail to sem_post image semaphore" << std::endl;
-		} else {
-			//			if (log_level >= LOG_DEBUG)
-			int value;
-			sem_getvalue(imageSem, &value);
-			std::cout << DEBUG << "Signaled CImageServer through incrementing semaphore to " << value << std::endl;
+		// copied into the back frame, the image server sends from its own snapshot and never holds up the scan
+		frames->publish(mosaic_image);
+		if (recorder != NULL) {
+			recorder->appendFrame(0, mosaic_image->data, mosaic_image->getwidth(), mosaic_image->getheight(),
+					mosaic_image->getbpp(), frames->latest());
 		}
+		if (log_level >= LOG_DEBUG) std::cout << DEBUG << "Published frame " << frames->latest() << std::endl;
 	}
-
-	// every 0.1 seconds
-	usleep(100000);
 }
 
 void LaserScanController::pause() {
@@ -352,9 +495,12 @@ void LaserScanController::startVideoStream(std::string port) {
 		}
 	}
 
-	sem_init(imageSem, 0, 0); // do not send first image, only at sem_post, see below
+	// the image server keeps running after a stop, so it keeps its frames as well
+	if (frames == NULL) {
+		frames = new CFramePublisher(mosaic_image->getwidth(), mosaic_image->getheight(), mosaic_image->getbpp());
+	}
 
-	image_server = new CImageServer(imageSem, mosaic_image);
+	image_server = new CImageServer(frames);
 	image_server->initServer(port.c_str());
 
 	// does not always work, so just disable for now
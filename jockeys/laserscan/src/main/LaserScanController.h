@@ -32,6 +32,7 @@
 #include <CLaserScan.h>
 #include <CImageServer.h>
 #include <CRawImage.h>
+#include <CStreamLog.h>
 #include <CMotors.h>
 
 #include <semaphore.h>
@@ -80,15 +81,36 @@ public:
 
 	void printDetectedObject(ObjectType object);
 
+	//! Enable or disable the latency statistics of the pipeline
+	void enableStats(bool enable);
+
+	//! Reply to MSG_STATS_REQ with the latencies of all stages since the statistics were enabled
+	void sendStats();
+
+	//! Send MSG_LASER_ODOMETRY after every scan, enabling it starts the odometry from zero
+	void enableOdometry(bool enable);
+
+	//! Send the motion between the last two scans as MSG_LASER_ODOMETRY
+	void sendOdometry();
+
+	//! Send MSG_LASER_SCAN after every scan, a compact alternative to streaming the difference images
+	void enableScanStream(bool enable);
+
+	//! Send the laser vector of the last scan with its distance and classification as MSG_LASER_SCAN
+	void sendScan(int distance);
+
 	void motorCommand(MotorCommand &motorCommand);
 
+	//! Record all messages, every laser vector and the streamed frames to a CStreamLog at path
+	bool record(const char *path);
+
 	inline void setCameraExclusive(bool exclusive = true) { exclusive_camera = exclusive; }
 
 	inline void calcDistance(bool calc_distance) { this->calc_distance = calc_distance ; }
 private:
 	CLaserScan *scan;
 
-	sem_t *imageSem;
+	CFramePublisher *frames;
 
 	CImageServer* image_server;
 
@@ -113,6 +135,25 @@ private:
 	bool exclusive_camera;
 
 	bool calc_distance;
+
+	bool send_odometry;
+
+	bool send_scan;
+
+	//! Number of MSG_LASER_SCAN messages that are sent
+	uint32_t scan_count;
+
+	//! Last object type of getDetectedObject, sent with every scan
+	ObjectType last_object;
+	//! Capture time of the scan last_object was recognized in, sent with the detected object
+	long long last_object_time;
+
+	//! The columns and the message of sendScan, allocated once
+	std::vector<int16_t> scan_columns;
+	std::vector<uint8_t> scan_buffer;
+
+	//! NULL if nothing is recorded
+	CStreamLog *recorder;
 };
 
 
@@ -34,6 +34,8 @@
  **********************************************************************************************************************/
 
 #include <LaserScanController.h>
+#include <CStageStats.h>
+#include <CImageWriter.h>
 
 /***********************************************************************************************************************
  * Most important configuration parameters
@@ -96,6 +98,12 @@ int main(int argc, char **argv) {
 	controller.parsePort(argc, argv);
 	controller.initServer();
 
+	// use an environmental variable STREAM_LOG to record the run, for example STREAM_LOG=/data/log/laserscan
+	char *str_stream_log = getenv("STREAM_LOG");
+	if (str_stream_log) {
+		controller.record(str_stream_log);
+	}
+
 	std::string cam_port = "10002";
 	if (argc >= 3) {
 		cam_port = std::string(argv[2]);
@@ -120,6 +128,8 @@ int main(int argc, char **argv) {
 	CMessage message;
 	bool quitController = false;
 	bool runController = false;
+	// after MSG_STANDBY look for MSG_START every few ms instead of every half second
+	bool standby = false;
 
 	UbiPosition position_before;
 	UbiPosition position_after;
@@ -133,8 +143,8 @@ int main(int argc, char **argv) {
 
 	while (!quitController){
 
-		usleep(50000);
-		if (!runController)
+		usleep((standby && !runController) ? STANDBY_POLL_PERIOD : 50000);
+		if (!runController && !standby)
 			usleep(450000);
 
 		message = controller.getMessage();
@@ -196,6 +206,11 @@ int main(int argc, char **argv) {
 			controller.motorCommand(motorCommand);
 			break;
 		}
+		case MSG_STANDBY: {
+			standby = (message.len < 1 || message.data[0] != 0);
+			controller.acknowledge();
+			break;
+		}
 		case MSG_STOP: {
 			runController = false;
 			controller.pause();
@@ -299,6 +314,27 @@ int main(int argc, char **argv) {
 			std::cout << DEBUG << "Waiting for redirected ZigBee messages over ethernet" << std::endl;
 			break;
 		}
+		case MSG_STATS_REQ: {
+			if (message.len == 1) {
+				controller.enableStats(message.data[0]);
+			}
+			controller.sendStats();
+			break;
+		}
+		case MSG_LASER_SCAN_STREAM: {
+			if (message.len == 1) {
+				controller.enableScanStream(message.data[0]);
+			}
+			break;
+		}
+		case MSG_LASER_ODOMETRY_REQ: {
+			if (message.len == 1) {
+				controller.enableOdometry(message.data[0]);
+			} else {
+				controller.sendOdometry();
+			}
+			break;
+		}
 		case MSG_QUIT: {
 			runController = true;
 			controller.pause();
@@ -309,6 +345,9 @@ int main(int argc, char **argv) {
 
 		}
 	}
+	CImageWriter::writer().flush();
+	CImageWriter::writer().printStatistics();
+	CStageStats::stats().printStatistics();
 	return EXIT_SUCCESS;
 }
 
@@ -0,0 +1,359 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Run the line detection of laserscan over directories of recorded images
+ * @file linebench.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 14, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Testing
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+/***********************************************************************************************************************
+ * Jockey framework includes
+ **********************************************************************************************************************/
+
+#include <CRawImage.h>
+#include <DetectLineModuleExt.h>
+
+/***********************************************************************************************************************
+ * Implementation
+ **********************************************************************************************************************/
+
+//! The same size as the images of DetectLineModuleExt
+#define IMAGE_WIDTH 640
+#define IMAGE_HEIGHT 480
+
+//! Points at the border of the image are most often just artifacts, as in DetectLineModuleExt::loadImage
+#define IMAGE_MARGIN 2
+
+#define MAX_WORKERS 64
+
+//! The lines that are found in one image
+struct LineResult {
+	bool loaded;
+	int points;
+	int steps;
+	int lines;
+	int hits[ACCUMULATOR_TOP_CELLS];
+	double r[ACCUMULATOR_TOP_CELLS];
+	double theta[ACCUMULATOR_TOP_CELLS];
+};
+
+//! Parameters of the transform, the same for all workers
+struct LineParameters {
+	HoughTransformType type;
+	int size;
+	int maxSteps;
+	int minHits;
+	float dominance;
+	uint32_t seed;
+};
+
+//! The work that is shared by all workers, an image is taken by increasing next under the lock
+struct LineQueue {
+	const std::vector<std::string> *files;
+	std::vector<LineResult> *results;
+	const LineParameters *parameters;
+	pthread_mutex_t lock;
+	int next;
+};
+
+typedef dobots::Hough<DecPoint, dobots::DenseAccumulator<DecPoint> > LineHough;
+
+/**
+ * A worker has its own transform, image and point buffers, so nothing is allocated per image once the buffers have
+ * grown to the largest image, and the workers only share the queue.
+ */
+class LineWorker {
+public:
+	LineWorker(const LineParameters & parameters): image(IMAGE_WIDTH, IMAGE_HEIGHT, 3) {
+		ISize input;
+		input.x = IMAGE_WIDTH;
+		input.y = IMAGE_HEIGHT;
+		ASize size;
+		size.x = parameters.size;
+		size.y = parameters.size;
+		hough = new LineHough(input, size);
+		hough->setType(parameters.type);
+		// only the hits are needed to get the lines, so the votes are not kept
+		hough->getAccumulator()->setKeepSupport(false);
+	}
+
+	~LineWorker() {
+		delete hough;
+	}
+
+	//! Load an image and detect its lines
+	void process(const std::string & file, const LineParameters & parameters, uint32_t seed, LineResult & result);
+
+	pthread_t thread;
+	LineQueue *queue;
+private:
+	//! Every pixel that is not black is a point, as in DetectLineModuleExt::loadImage
+	void loadPoints();
+
+	CRawImage image;
+	LineHough *hough;
+	std::vector<DecPoint> points;
+	std::vector<DecPoint*> references;
+};
+
+void LineWorker::loadPoints() {
+	points.clear();
+	references.clear();
+	VALUE_TYPE *data = image.data;
+	for (int i = IMAGE_MARGIN; i < (IMAGE_WIDTH - IMAGE_MARGIN); ++i) {
+		for (int j = IMAGE_MARGIN; j < (IMAGE_HEIGHT - IMAGE_MARGIN); ++j) {
+			VALUE_TYPE *pixel = data + (j * IMAGE_WIDTH + i) * 3;
+			if (pixel[0] || pixel[1] || pixel[2]) points.push_back(DecPoint(i,j));
+		}
+	}
+	// the references are taken after all points are added, the vector can move its points while it grows
+	for (int p = 0; p < (int)points.size(); ++p) references.push_back(&points[p]);
+}
+
+/**
+ * The transform is seeded per image, so the results do not depend on the worker or on the order in which the workers
+ * take the images.
+ *
+ * @param file               bitmap of 640x480
+ * @param parameters         parameters of the transform
+ * @param seed               seed of the randomized transform for this image
+ * @param result             the lines with the most hits
+ */
+void LineWorker::process(const std::string & file, const LineParameters & parameters, uint32_t seed,
+		LineResult & result) {
+	memset(&result, 0, sizeof(result));
+	if (!image.loadBmp(file.c_str())) return;
+	result.loaded = true;
+	loadPoints();
+	result.points = points.size();
+
+	hough->clear();
+	hough->getAccumulator()->Reset();
+	hough->seed(seed);
+	hough->addPoints(references);
+	result.steps = hough->doTransform(parameters.maxSteps, parameters.minHits, parameters.dominance);
+
+	dobots::DenseAccumulator<DecPoint> & accumulator = *hough->getAccumulator();
+	for (int rank = 0; rank < ACCUMULATOR_TOP_CELLS; ++rank) {
+		int hits = accumulator.getTopHits(rank);
+		if (hits < parameters.minHits) break;
+		result.hits[rank] = hits;
+		hough->transform(accumulator.getTopCoord(rank), result.r[rank], result.theta[rank]);
+		result.lines++;
+	}
+}
+
+void *work(void *arg) {
+	LineWorker *worker = (LineWorker*)arg;
+	LineQueue & queue = *worker->queue;
+	while (true) {
+		pthread_mutex_lock(&queue.lock);
+		int index = queue.next++;
+		pthread_mutex_unlock(&queue.lock);
+		if (index >= (int)queue.files->size()) break;
+		worker->process((*queue.files)[index], *queue.parameters, queue.parameters->seed + index,
+				(*queue.results)[index]);
+	}
+	return NULL;
+}
+
+/**
+ * Add all bitmaps in a directory, sorted by name, so recordings of saveNumberedBmp are in the order of recording.
+ *
+ * @param directory          directory with images
+ * @param files              the bitmaps that are found
+ * @return                   success (0), failure (-1)
+ */
+int listImages(const char *directory, std::vector<std::string> & files) {
+	DIR *dir = opendir(directory);
+	if (dir == NULL) {
+		fprintf(stderr, "Cannot open directory %s\n", directory);
+		return -1;
+	}
+	std::vector<std::string> names;
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		size_t length = strlen(entry->d_name);
+		if (length < 4 || strcmp(entry->d_name + length - 4, ".bmp") != 0) continue;
+		names.push_back(entry->d_name);
+	}
+	closedir(dir);
+	std::sort(names.begin(), names.end());
+	for (int i = 0; i < (int)names.size(); ++i) {
+		files.push_back(std::string(directory) + "/" + names[i]);
+	}
+	return 0;
+}
+
+/**
+ * Write a line "file,points,steps,rank,hits,r,theta" for every line that is found, and a line with rank -1 for an
+ * image without lines, so every image is in the output. Images that could not be loaded are left out.
+ *
+ * @param fileName           output file
+ * @param files              the images
+ * @param results            the lines of each image
+ * @return                   success (0), failure (-1)
+ */
+int writeResults(const char *fileName, const std::vector<std::string> & files,
+		const std::vector<LineResult> & results) {
+	FILE *file = fopen(fileName, "w");
+	if (file == NULL) {
+		fprintf(stderr, "Cannot open output %s\n", fileName);
+		return -1;
+	}
+	fprintf(file, "file,points,steps,rank,hits,r,theta\n");
+	for (int i = 0; i < (int)files.size(); ++i) {
+		const LineResult & result = results[i];
+		if (!result.loaded) continue;
+		if (result.lines == 0) {
+			fprintf(file, "%s,%i,%i,-1,0,0,0\n", files[i].c_str(), result.points, result.steps);
+			continue;
+		}
+		for (int rank = 0; rank < result.lines; ++rank) {
+			fprintf(file, "%s,%i,%i,%i,%i,%.2f,%.4f\n", files[i].c_str(), result.points, result.steps, rank,
+					result.hits[rank], result.r[rank], result.theta[rank]);
+		}
+	}
+	fclose(file);
+	return 0;
+}
+
+void usage(const char *name) {
+	printf("Usage: %s [options] <directory> [<directory> ...]\n", name);
+	printf("Detects the lines in all .bmp files of the directories, pixels that are not black are points\n");
+	printf("  -j workers  number of threads (default the number of processors, at most %i)\n", MAX_WORKERS);
+	printf("  -o file     output as CSV (default lines.csv)\n");
+	printf("  -S          use the standard transform instead of the randomized transform\n");
+	printf("  -a size     size of the square accumulator (default %i)\n", ACCUMULATOR_SIZE_X);
+	printf("  -s steps    maximum number of samples of the randomized transform (default 1000)\n");
+	printf("  -m hits     minimum number of hits of a line (default 6)\n");
+	printf("  -d ratio    stop sampling when the best line has this ratio of the hits of the second (default 2)\n");
+	printf("  -r seed     seed of the randomized transform (default 1)\n");
+}
+
+/**
+ * All images are processed with the same parameters, so a parameter sweep is a loop over calls of this binary. The
+ * timing includes loading the images, because that is what a sweep waits for.
+ */
+int main(int argc, char **argv) {
+	LineParameters parameters;
+	parameters.type = RANDOMIZED_HOUGH;
+	parameters.size = ACCUMULATOR_SIZE_X;
+	parameters.maxSteps = 1000;
+	parameters.minHits = 6;
+	parameters.dominance = 2;
+	parameters.seed = 1;
+	int workers = sysconf(_SC_NPROCESSORS_ONLN);
+	const char *output = "lines.csv";
+
+	int option;
+	while ((option = getopt(argc, argv, "j:o:Sa:s:m:d:r:h")) != -1) {
+		switch (option) {
+		case 'j': workers = atoi(optarg); break;
+		case 'o': output = optarg; break;
+		case 'S': parameters.type = HOUGH; break;
+		case 'a': parameters.size = atoi(optarg); break;
+		case 's': parameters.maxSteps = atoi(optarg); break;
+		case 'm': parameters.minHits = atoi(optarg); break;
+		case 'd': parameters.dominance = atof(optarg); break;
+		case 'r': parameters.seed = strtoul(optarg, NULL, 10); break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (optind >= argc || parameters.size < 2) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (workers < 1) workers = 1;
+	if (workers > MAX_WORKERS) workers = MAX_WORKERS;
+
+	std::vector<std::string> files;
+	for (int i = optind; i < argc; ++i) {
+		if (listImages(argv[i], files) < 0) return EXIT_FAILURE;
+	}
+	if (files.empty()) {
+		fprintf(stderr, "No .bmp files found\n");
+		return EXIT_FAILURE;
+	}
+	if (workers > (int)files.size()) workers = files.size();
+
+	printf("Detect lines in %i images with %i workers, %s transform\n", (int)files.size(), workers,
+			parameters.type == HOUGH ? "standard" : "randomized");
+
+	std::vector<LineResult> results(files.size());
+	LineQueue queue;
+	queue.files = &files;
+	queue.results = &results;
+	queue.parameters = &parameters;
+	queue.next = 0;
+	pthread_mutex_init(&queue.lock, NULL);
+
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+	std::vector<LineWorker*> pool;
+	for (int w = 0; w < workers; ++w) {
+		LineWorker *worker = new LineWorker(parameters);
+		worker->queue = &queue;
+		if (pthread_create(&worker->thread, NULL, work, worker) != 0) {
+			fprintf(stderr, "Cannot create worker %i, continue with %i workers\n", w, w);
+			delete worker;
+			break;
+		}
+		pool.push_back(worker);
+	}
+	// without any worker the main thread does the work
+	if (pool.empty()) {
+		LineWorker worker(parameters);
+		worker.queue = &queue;
+		work(&worker);
+	}
+	for (int w = 0; w < (int)pool.size(); ++w) {
+		pthread_join(pool[w]->thread, NULL);
+		delete pool[w];
+	}
+	gettimeofday(&end, NULL);
+	pthread_mutex_destroy(&queue.lock);
+
+	int loaded = 0;
+	for (int i = 0; i < (int)results.size(); ++i) {
+		if (results[i].loaded) loaded++;
+	}
+	double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+	printf("Processed %i of %i images in %.3f s, %.1f images/s\n", loaded, (int)files.size(), elapsed,
+			elapsed > 0 ? loaded / elapsed : 0.0);
+
+	if (writeResults(output, files, results) < 0) return EXIT_FAILURE;
+	printf("Wrote the lines to %s\n", output);
+	return EXIT_SUCCESS;
+}
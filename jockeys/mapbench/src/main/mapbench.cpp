@@ -0,0 +1,476 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Drive the map of the mapping jockey with a simulated robot
+ * @file mapbench.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 14, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Testing
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <math.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <vector>
+
+/***********************************************************************************************************************
+ * Jockey framework includes
+ **********************************************************************************************************************/
+
+#include <Map.h>
+
+/***********************************************************************************************************************
+ * Implementation
+ **********************************************************************************************************************/
+
+// the switches and the measurement errors of Map.cpp
+extern bool PRINT_MEASUREDPOS, PRINT_MATRICES, PRINT_LAND_MARKS, PRINT_ROB_POS, PRINT_MPTC;
+extern double MEASUREMENT_XERROR, MEASUREMENT_YERROR, MEASUREMENT_PHIERROR, MEASUREMENT_ZERROR;
+extern double DOCK_MINIMAL_Z_POS_ONGROUND;
+
+//! Distance the robot drives in a step and how fast it turns, in m and rad
+#define STEP_DISTANCE 0.01
+#define STEP_TURN 0.05
+
+//! The camera sees a landmark between these distances and within this angle of the heading
+#define VIEW_NEAR 0.3
+#define VIEW_FAR 2.0
+#define VIEW_ANGLE 0.5
+
+//! Landmarks nearer than TOLERANCE of Map are taken for one, so by default they are further apart
+#define SPACING 1.5
+
+//! Distance between the wheels that Map uses for the Scout, as b in Map.cpp
+#define WHEEL_BASE 0.12
+
+//! Landmarks per row of the latency table
+#define BUCKET 10
+
+//! Random numbers that are the same on every machine, xorshift with Box-Muller for the normal ones
+struct Random {
+	uint32_t state;
+	Random(uint32_t seed): state(seed ? seed : 1) {}
+	inline double uniform() {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return (state + 0.5) / 4294967296.0;
+	}
+	inline double normal() {
+		return sqrt(-2 * log(uniform())) * cos(2 * M_PI * uniform());
+	}
+};
+
+struct Landmark {
+	double x, y, z;
+};
+
+struct Parameters {
+	RobotBase::RobotType type;
+	int steps;
+	int landmarks;
+	double arena;
+	int interval;
+	uint32_t seed;
+	int submapLandmarks;
+	double submapDistance;
+	//! Factor on the standard deviation of the odometry noise, 1 is what Map assumes
+	double noise;
+};
+
+//! Latency of the steps with the same number of landmarks / BUCKET
+struct Bucket {
+	int filters, predictions;
+	double filterTime, filterMax, predictionTime;
+	long rss;
+};
+
+static double now() {
+	struct timeval time;
+	gettimeofday(&time, NULL);
+	return time.tv_sec * 1000000.0 + time.tv_usec;
+}
+
+//! Resident memory in kB, from /proc, 0 if it can not be read
+static long residentMemory() {
+	FILE *file = fopen("/proc/self/statm", "r");
+	if (file == NULL) return 0;
+	long size = 0, resident = 0;
+	if (fscanf(file, "%ld %ld", &size, &resident) != 2) resident = 0;
+	fclose(file);
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static double normalize(double angle) {
+	while (angle > M_PI) angle -= 2 * M_PI;
+	while (angle < -M_PI) angle += 2 * M_PI;
+	return angle;
+}
+
+/**
+ * The inverse of Map::convertCameraMeasurement*, from the position of a landmark relative to the robot to what the
+ * camera of the robot would report. For the ActiveWheel the hinge is given in robpos[5] as in the jockey.
+ */
+static void toCamera(float *measured, RobotBase::RobotType type, double hinge) {
+	switch (type) {
+	case RobotBase::SCOUTBOT:
+		measured[0] -= 0.049;
+		measured[1] += 0.018;
+		measured[3] -= 0.09;
+		break;
+	case RobotBase::KABOT:
+		measured[0] -= 0.053;
+		measured[1] += 0.021;
+		measured[3] -= 0.084;
+		break;
+	case RobotBase::ACTIVEWHEEL: {
+		double a = 0.006, b = 0.09, c = 0.03, d = 0.05;
+		double alfa = -M_PI + (M_PI / 2.0 - hinge / 2.0);
+		double otoceneY = sin(hinge / 2) * d - measured[1];
+		double otoceneZ = measured[3] - (c + b * sin((M_PI / 2) - (hinge / 2)) + a * cos((M_PI / 2) - (hinge / 2)));
+		measured[0] -= 0.04;
+		measured[1] = -(cos(alfa) * otoceneY + sin(alfa) * otoceneZ);
+		measured[2] = -measured[2];
+		measured[3] = -sin(alfa) * otoceneY + cos(alfa) * otoceneZ;
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+/**
+ * Noise of the odometry of one step with the variances Map::calculateOdometryCovariance* expects, so a consistent
+ * filter has a NEES of about 3. The Scout has the noise on the distances of its wheels, the others on the pose.
+ */
+static void odometryNoise(RobotBase::RobotType type, Random &random, double noise, double dx, double dy, double dphi,
+		double &ndx, double &ndy, double &ndphi, double &dl, double &dr, double phi) {
+	double ds = sqrt(dx * dx + dy * dy);
+	dl = ds - dphi * WHEEL_BASE / 2;
+	dr = ds + dphi * WHEEL_BASE / 2;
+	double kx = 0, kphi = 0;
+	switch (type) {
+	case RobotBase::ACTIVEWHEEL: kx = 0.01; kphi = 0.00015; break;
+	case RobotBase::KABOT: kx = 0.000075321; kphi = 0.05; break;
+	case RobotBase::SCOUTBOT: {
+		double sigma = (dl == 0 && dr == 0) ? 0 : noise * sqrt(0.0000092871);
+		dl += sigma * random.normal();
+		dr += sigma * random.normal();
+		double nds = (dl + dr) / 2;
+		ndphi = (dr - dl) / WHEEL_BASE;
+		ndx = nds * cos(phi + ndphi / 2);
+		ndy = nds * sin(phi + ndphi / 2);
+		return;
+	}
+	default: break;
+	}
+	ndx = dx + noise * sqrt(fabs(dx) * kx) * random.normal();
+	ndy = dy + noise * sqrt(fabs(dy) * kx) * random.normal();
+	ndphi = dphi + noise * sqrt(fabs(dphi) * kphi) * random.normal();
+}
+
+//! e'*inverse(S)*e for a symmetric 3x3 S
+static double nees3(const double e[3], const double S[3][3]) {
+	double c00 = S[1][1] * S[2][2] - S[1][2] * S[2][1];
+	double c01 = S[1][2] * S[2][0] - S[1][0] * S[2][2];
+	double c02 = S[1][0] * S[2][1] - S[1][1] * S[2][0];
+	double det = S[0][0] * c00 + S[0][1] * c01 + S[0][2] * c02;
+	if (!(det > 0)) return NAN;
+	double inv[3][3];
+	inv[0][0] = c00 / det;
+	inv[0][1] = (S[0][2] * S[2][1] - S[0][1] * S[2][2]) / det;
+	inv[0][2] = (S[0][1] * S[1][2] - S[0][2] * S[1][1]) / det;
+	inv[1][0] = c01 / det;
+	inv[1][1] = (S[0][0] * S[2][2] - S[0][2] * S[2][0]) / det;
+	inv[1][2] = (S[0][2] * S[1][0] - S[0][0] * S[1][2]) / det;
+	inv[2][0] = c02 / det;
+	inv[2][1] = (S[0][1] * S[2][0] - S[0][0] * S[2][1]) / det;
+	inv[2][2] = (S[0][0] * S[1][1] - S[0][1] * S[1][0]) / det;
+	double result = 0;
+	for (int i = 0; i < 3; ++i)
+		for (int j = 0; j < 3; ++j)
+			result += e[i] * inv[i][j] * e[j];
+	return result;
+}
+
+void usage(const char *name) {
+	printf("Usage: %s [options]\n", name);
+	printf("Drives Map with a simulated robot among landmarks and reports latency, consistency and memory\n");
+	printf("  -t type     robot, activewheel, kabot or scout (default kabot)\n");
+	printf("  -n steps    steps of %.2f m or turns of %.2f rad (default 5000)\n", STEP_DISTANCE, STEP_TURN);
+	printf("  -l number   landmarks in the arena (default 40)\n");
+	printf("  -a size     side of the square arena in m (default %.1f m for every landmark)\n", SPACING);
+	printf("  -i steps    steps between two camera measurements (default 2)\n");
+	printf("  -r seed     seed of the trajectory and the noise (default 1)\n");
+	printf("  -m number   close a submap after this many landmarks (default 0, no submaps)\n");
+	printf("  -d meter    close a submap after this distance (default 0)\n");
+	printf("  -e factor   on the odometry noise, 1 is the noise Map assumes (default 1)\n");
+	printf("  -o file     every step as CSV\n");
+	printf("  -v          keep the output of Map\n");
+}
+
+/**
+ * The trajectory and the noise only depend on the seed, so two builds of Map see exactly the same input, only the
+ * latencies differ from run to run. The pose filter writes back is dropped, as CMotors overwrites it with its own
+ * odometry on the next getPosition. The robot drives straight and turns away from the walls and at random.
+ */
+int main(int argc, char **argv) {
+	Parameters parameters;
+	parameters.type = RobotBase::KABOT;
+	parameters.steps = 5000;
+	parameters.landmarks = 40;
+	parameters.arena = 0;
+	parameters.interval = 2;
+	parameters.seed = 1;
+	parameters.submapLandmarks = 0;
+	parameters.submapDistance = 0;
+	parameters.noise = 1;
+	const char *output = NULL;
+	bool verbose = false;
+
+	int option;
+	while ((option = getopt(argc, argv, "t:n:l:a:i:r:m:d:e:o:vh")) != -1) {
+		switch (option) {
+		case 't':
+			if (!strcmp(optarg, "activewheel")) parameters.type = RobotBase::ACTIVEWHEEL;
+			else if (!strcmp(optarg, "kabot")) parameters.type = RobotBase::KABOT;
+			else if (!strcmp(optarg, "scout")) parameters.type = RobotBase::SCOUTBOT;
+			else {
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'n': parameters.steps = atoi(optarg); break;
+		case 'l': parameters.landmarks = atoi(optarg); break;
+		case 'a': parameters.arena = atof(optarg); break;
+		case 'i': parameters.interval = atoi(optarg); break;
+		case 'r': parameters.seed = strtoul(optarg, NULL, 10); break;
+		case 'm': parameters.submapLandmarks = atoi(optarg); break;
+		case 'd': parameters.submapDistance = atof(optarg); break;
+		case 'e': parameters.noise = atof(optarg); break;
+		case 'o': output = optarg; break;
+		case 'v': verbose = true; break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	int side = (parameters.landmarks > 0) ? (int) ceil(sqrt((double) parameters.landmarks)) : 1;
+	if (parameters.arena == 0) parameters.arena = side * SPACING;
+	if (parameters.steps < 1 || parameters.landmarks < 1 || parameters.arena <= 1 || parameters.interval < 1
+			|| parameters.noise < 0) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (!verbose) {
+		PRINT_MEASUREDPOS = PRINT_MATRICES = PRINT_LAND_MARKS = PRINT_ROB_POS = PRINT_MPTC = false;
+	}
+	FILE *csv = NULL;
+	if (output != NULL) {
+		csv = fopen(output, "w");
+		if (csv == NULL) {
+			fprintf(stderr, "Cannot open output %s\n", output);
+			return EXIT_FAILURE;
+		}
+		fprintf(csv, "step,landmarks,filter_us,error,nees,rss_kb\n");
+	}
+
+	Random random(parameters.seed);
+	// the landmarks on a jittered grid, every fourth a dock that is higher
+	std::vector<Landmark> landmarks(parameters.landmarks);
+	double spacing = parameters.arena / side;
+	for (int i = 0; i < parameters.landmarks; ++i) {
+		landmarks[i].x = ((i % side) + 0.25 + 0.5 * random.uniform()) * spacing;
+		landmarks[i].y = ((i / side) + 0.25 + 0.5 * random.uniform()) * spacing;
+		landmarks[i].z = (i % 4 == 3) ? DOCK_MINIMAL_Z_POS_ONGROUND + 0.1 : 0.1;
+	}
+
+	// the true pose of the robot and its odometry, as CMotors keeps it
+	double pose[3] = { parameters.arena / 2, parameters.arena / 2, 0 };
+	double robpos[10];
+	memset(robpos, 0, sizeof(robpos));
+	memcpy(robpos, pose, sizeof(pose));
+	Map map(robpos, parameters.type, 1);
+	map.setSubmapLimits(parameters.submapLandmarks, parameters.submapDistance);
+
+	std::vector<Bucket> buckets;
+	double neesSum = 0, errorSum = 0;
+	int neesCount = 0, measurements = 0;
+	int turning = 0;
+	double start = now();
+	for (int step = 0; step < parameters.steps; ++step) {
+		// keep turning while the robot looks at a wall, and now and then at random
+		double ahead[2] = { pose[0] + 0.3 * cos(pose[2]), pose[1] + 0.3 * sin(pose[2]) };
+		bool wall = ahead[0] < 0 || ahead[1] < 0 || ahead[0] > parameters.arena || ahead[1] > parameters.arena;
+		if (turning == 0 && (wall || random.uniform() < 0.005)) {
+			turning = (random.uniform() < 0.5) ? 1 : -1;
+		} else if (turning != 0 && !wall && random.uniform() < 0.1) {
+			turning = 0;
+		}
+		double dx = 0, dy = 0, dphi = 0;
+		if (turning != 0) {
+			dphi = turning * STEP_TURN;
+		} else {
+			dx = STEP_DISTANCE * cos(pose[2]);
+			dy = STEP_DISTANCE * sin(pose[2]);
+		}
+		double ndx, ndy, ndphi, dl, dr;
+		odometryNoise(parameters.type, random, parameters.noise, dx, dy, dphi, ndx, ndy, ndphi, dl, dr, robpos[2]);
+		pose[0] += dx;
+		pose[1] += dy;
+		pose[2] = normalize(pose[2] + dphi);
+		robpos[0] += ndx;
+		robpos[1] += ndy;
+		robpos[2] = normalize(robpos[2] + ndphi);
+		robpos[3] += dl;
+		robpos[4] += dr;
+
+		// the nearest landmark in view, measured relative to the robot
+		int seen = -1;
+		double nearest = VIEW_FAR;
+		float measured[4];
+		for (int i = 0; i < parameters.landmarks && step % parameters.interval == 0; ++i) {
+			double rx = landmarks[i].x - pose[0], ry = landmarks[i].y - pose[1];
+			double fx = cos(pose[2]) * rx + sin(pose[2]) * ry;
+			double fy = -sin(pose[2]) * rx + cos(pose[2]) * ry;
+			double distance = sqrt(fx * fx + fy * fy);
+			if (distance > VIEW_NEAR && distance < nearest && fabs(atan2(fy, fx)) < VIEW_ANGLE) {
+				nearest = distance;
+				seen = i;
+				measured[0] = fx + sqrt(MEASUREMENT_XERROR) * random.normal();
+				measured[1] = fy + sqrt(MEASUREMENT_YERROR) * random.normal();
+				measured[2] = normalize(-pose[2] + sqrt(MEASUREMENT_PHIERROR) * random.normal());
+				measured[3] = landmarks[i].z + sqrt(MEASUREMENT_ZERROR) * 0.1 * random.normal();
+			}
+		}
+
+		int bucket = map.mapSize / BUCKET;
+		if ((int) buckets.size() <= bucket) {
+			Bucket empty;
+			memset(&empty, 0, sizeof(empty));
+			buckets.resize(bucket + 1, empty);
+		}
+		double time;
+		if (seen >= 0) {
+			toCamera(measured, parameters.type, robpos[5]);
+			double odometry[3] = { robpos[0], robpos[1], robpos[2] };
+			double begin = now();
+			map.filter(robpos, measured);
+			time = now() - begin;
+			memcpy(robpos, odometry, sizeof(odometry));
+			buckets[bucket].filters++;
+			buckets[bucket].filterTime += time;
+			if (time > buckets[bucket].filterMax) buckets[bucket].filterMax = time;
+			measurements++;
+		} else {
+			double begin = now();
+			map.odometryChange(robpos);
+			time = now() - begin;
+			buckets[bucket].predictions++;
+			buckets[bucket].predictionTime += time;
+		}
+		long rss = residentMemory();
+		if (rss > buckets[bucket].rss) buckets[bucket].rss = rss;
+
+		double error[3] = { gsl_matrix_get(map.state, 0, 0) - pose[0], gsl_matrix_get(map.state, 1, 0) - pose[1],
+				normalize(gsl_matrix_get(map.state, 2, 0) - pose[2]) };
+		double S[3][3];
+		for (int i = 0; i < 3; ++i)
+			for (int j = 0; j < 3; ++j)
+				S[i][j] = map.P.get(i, j);
+		double nees = nees3(error, S);
+		if (!isnan(nees)) {
+			neesSum += nees;
+			neesCount++;
+		}
+		errorSum += sqrt(error[0] * error[0] + error[1] * error[1]);
+		if (csv != NULL) {
+			fprintf(csv, "%i,%i,%.1f,%.4f,%.3f,%ld\n", step, map.mapSize, seen >= 0 ? time : 0.0,
+					sqrt(error[0] * error[0] + error[1] * error[1]), nees, rss);
+		}
+	}
+	double elapsed = (now() - start) / 1000000.0;
+
+	// the landmarks against the nearest true landmark, with the x, y part of their covariance
+	double landmarkNees = 0, landmarkError = 0;
+	int landmarkCount = 0;
+	double checksum = 0;
+	for (int i = 0; i < map.mapSize; ++i) {
+		MappedObjectPosition mapped = map.getMappedPosition(i);
+		float upper[10];
+		map.getCovariance(i, upper);
+		int best = 0;
+		double bestDistance = INFINITY;
+		for (int j = 0; j < parameters.landmarks; ++j) {
+			double distance = hypot(landmarks[j].x - mapped.xPosition, landmarks[j].y - mapped.yPosition);
+			if (distance < bestDistance) {
+				bestDistance = distance;
+				best = j;
+			}
+		}
+		double ex = mapped.xPosition - landmarks[best].x, ey = mapped.yPosition - landmarks[best].y;
+		double sxx = upper[0], sxy = upper[1], syy = upper[4];
+		double det = sxx * syy - sxy * sxy;
+		if (det > 0) {
+			landmarkNees += (syy * ex * ex - 2 * sxy * ex * ey + sxx * ey * ey) / det;
+			landmarkCount++;
+		}
+		landmarkError += bestDistance;
+		checksum += mapped.xPosition + 2 * mapped.yPosition;
+	}
+
+	printf("%s, %i steps, %i measurements, %i landmarks in a %.1f m arena, seed %u\n",
+			parameters.type == RobotBase::ACTIVEWHEEL ? "ActiveWheel" :
+			parameters.type == RobotBase::SCOUTBOT ? "Scout" : "KaBot", parameters.steps, measurements,
+			parameters.landmarks, parameters.arena, parameters.seed);
+	printf("%-10s %8s %10s %10s %12s %10s %8s\n", "landmarks", "filters", "filter_us", "max_us", "predictions",
+			"predict_us", "rss_kB");
+	for (int i = 0; i < (int) buckets.size(); ++i) {
+		Bucket &b = buckets[i];
+		if (b.filters == 0 && b.predictions == 0) continue;
+		printf("%4i-%-5i %8i %10.1f %10.1f %12i %10.1f %8ld\n", i * BUCKET, i * BUCKET + BUCKET - 1, b.filters,
+				b.filters ? b.filterTime / b.filters : 0.0, b.filterMax, b.predictions,
+				b.predictions ? b.predictionTime / b.predictions : 0.0, b.rss);
+	}
+	printf("Mapped %i landmarks in %i submaps, %.3f s\n", map.mapSize, map.getSubmapCount() + 1, elapsed);
+	printf("Pose: mean error %.4f m, mean NEES %.2f (about 3 if consistent)\n", errorSum / parameters.steps,
+			neesCount ? neesSum / neesCount : 0.0);
+	printf("Landmarks: mean error %.4f m, mean NEES %.2f (about 2 if consistent)\n",
+			map.mapSize ? landmarkError / map.mapSize : 0.0, landmarkCount ? landmarkNees / landmarkCount : 0.0);
+	printf("Checksum of the landmarks %.9f\n", checksum);
+
+	// mergeMap writes /flash/map.map on the robot, elsewhere it only fails to
+	double begin = now();
+	map.mergeMap();
+	printf("mergeMap: %i landmarks in %.1f us\n", map.mapSize, now() - begin);
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	printf("Peak resident memory %ld kB\n", usage.ru_maxrss);
+	if (csv != NULL) {
+		fclose(csv);
+		printf("Wrote every step to %s\n", output);
+	}
+	return EXIT_SUCCESS;
+}
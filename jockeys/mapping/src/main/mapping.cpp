@@ -11,11 +11,17 @@
 #include "termios.h"
 #include <CMessageServer.h>
 #include <CTimer.h>
+#include <CLatencyTrace.h>
+#include <CPositionHistory.h>
 #include <signal.h>
 #include <messageDataType.h>
+#include <messageSchema.h>
 #include <CMotors.h>
 #include <Map.h>
 #include <Mapping.h>
+#include <FilterService.h>
+#include <OccupancyGrid.h>
+#include <FrontierTracker.h>
 #include <CLeds.h>
 #include <wapi/wapi.h>
 #include <iostream>
@@ -60,12 +66,38 @@ int wait_no_moving = WAIT_FOR_NO_MOVING;
 
 //actions hadlers
 Map* slamMap = NULL;
+//! Runs the filter of slamMap, everything else that uses slamMap locks it first
+FilterService* filterService = NULL;
 Mapping* mapProcedure = NULL;
 bool stop = false;
 DetectedBlob* detectedBlob = NULL;
+//! Capture time of detectedBlob in us, 0 if the camera did not send it
+uint64_t detectedBlobTime = 0;
+//! Capture time of the last frame that was measured while the robot moved, each frame is measured once then
+uint64_t measuredBlobTime = 0;
 UbiPosition* ubiposition = NULL;
 UbiPosition* initialUbiPosition = NULL;
 UbiPosition* endingUbiPosition = NULL;
+//! The Ubisense fixes with the time they came in, the position of the motors starts from the estimate of now
+CPositionHistory ubiHistory;
+#if OCCUPANCY_TILE != OCCUPANCY_WIRE_TILE
+#error "A tile of the occupancy grid has to be sent as it is"
+#endif
+
+//! Free and occupied space from the laser scans, in the frame of the odometry, only used by the main loop
+OccupancyGrid occupancy;
+//! The frontiers of the grid, updated after every scan
+FrontierTracker frontiers(occupancy);
+
+/**
+ * MAP_SUBMAP_LANDMARKS=n and MAP_SUBMAP_DISTANCE=m close the submap of the filter after n landmarks or m travelled,
+ * which keeps an update within the cost of one submap on a large arena.
+ */
+void configureSubmaps(Map *map) {
+	char* landmarks = getenv("MAP_SUBMAP_LANDMARKS");
+	char* distance = getenv("MAP_SUBMAP_DISTANCE");
+	map->setSubmapLimits(landmarks != NULL ? atoi(landmarks) : 0, distance != NULL ? atof(distance) : 0);
+}
 
 void interrupt_signal_handler(int signal) {
 	if (signal == SIGINT) {
@@ -124,7 +156,19 @@ void initialize() {
 	motor->setSpeeds(0, 0);
 	std::cout << DEBUGSTRING << "after motor init" << std::endl;
 	usleep(20000);
+	if (filterService != NULL) {
+		delete filterService;
+		filterService = NULL;
+	}
 	slamMap = new Map(motor->getPosition(), robot_type,myID);
+	configureSubmaps(slamMap);
+	// MAP_RESUME=/flash/map.map continues with the landmarks the jockey had before it was restarted
+	char* resume = getenv("MAP_RESUME");
+	if (resume != NULL) {
+		slamMap->resume(resume);
+	}
+	filterService = new FilterService(slamMap);
+	filterService->start();
 }
 bool isPossible(DetectedBlob* detectedBlob) {
 	return (detectedBlob->x < 8 && detectedBlob->x > -8 && detectedBlob->y < 8
@@ -132,26 +176,203 @@ bool isPossible(DetectedBlob* detectedBlob) {
 			&& detectedBlob->z > -4);
 }
 
+/**
+ * The odometry at the time the camera captured detectedBlob, the odometry of now is later by the detection and the
+ * message, which the robot drove on meanwhile. False if the frame is older than the history of the motors.
+ */
+bool blobPosition(double *position) {
+	motor->getPosition(position);
+	if (detectedBlobTime == 0) return true;
+	return motor->getPositionAt(detectedBlobTime, position);
+}
+
+//! Objects in one MSG_MAP_SNAPSHOT over ZigBee, so a part of the map stays within a small radio frame
+#define MAP_SNAPSHOT_ZIGBEE_OBJECTS 4
+
+//! Version of the map that was last broadcast by sendMap, the next broadcast only has the changes after it
+unsigned int broadcastVersion = 0;
+
+/**
+ * Send the objects that changed after version since as MSG_MAP_SNAPSHOT, in parts of at most max_objects objects
+ * (0 for all in one). Over ZigBee every part is a broadcast to the other robots, otherwise it goes to CEquids. The
+ * caller holds the lock of the filter, so the pose of MAP_SNAPSHOT_POSE is the one of the state that is sent.
+ */
+void sendMapSnapshot(unsigned int since, uint8_t flags, int max_objects, bool zigbee) {
+	if (slamMap == NULL) return;
+	// a new map starts counting again
+	if (since > slamMap->version) since = 0;
+	if (since == 0 || slamMap->rebuiltAfter(since)) {
+		since = 0;
+		flags |= MAP_SNAPSHOT_FULL;
+	}
+	std::vector<int> changed;
+	for (int var = 0; var < slamMap->mapSize; ++var) {
+		if (since == 0 || slamMap->changedSince(var, since)) changed.push_back(var);
+	}
+	// a request is always answered, a broadcast without changes is not worth a frame
+	if (zigbee && changed.empty()) return;
+	if (max_objects <= 0) max_objects = changed.size();
+	int first = 0;
+	do {
+		int count = changed.size() - first;
+		if (count > max_objects) count = max_objects;
+		// over the ZigBee the snapshot is built behind room for the envelope, so it is not copied again to send it
+		int envelope = zigbee ? ZB_ENVELOPE_HEADER : 0;
+		std::vector<uint8_t> buffer(envelope + mapSnapshotLength(count, flags));
+		uint8_t *snapshot = &buffer[envelope];
+		MapSnapshotHeaderWire *header = (MapSnapshotHeaderWire*) snapshot;
+		header->version = MapSnapshotHeaderWire::VERSION;
+		header->flags = flags;
+		header->robot = myID;
+		header->map_version = slamMap->version;
+		header->since = since;
+		header->first = first;
+		header->count = count;
+		header->total = changed.size();
+		for (int i = 0; i < count; ++i) {
+			MappedObjectPosition pos = slamMap->getMappedPosition(changed[first + i]);
+			pos.mappedBy = myID;
+			packMappedObjectPosition(pos, mapSnapshotObject(snapshot, i));
+			if (flags & MAP_SNAPSHOT_COVARIANCE) {
+				float upper[10];
+				slamMap->getCovariance(changed[first + i], upper);
+				MapCovarianceWire *covariance = mapSnapshotCovariance(snapshot, count, i);
+				for (int j = 0; j < 10; ++j) covariance->upper[j] = upper[j];
+			}
+		}
+		if (flags & MAP_SNAPSHOT_POSE) {
+			MapPoseWire *pose = mapSnapshotPose(snapshot, count, flags);
+			double *position = slamMap->getRobotPosition();
+			pose->x = position[0];
+			pose->y = position[1];
+			pose->phi = position[2];
+			for (int j = 0; j < 3; ++j) pose->variance[j] = slamMap->P.get(j, j);
+		}
+		printf("sending %d of %d map objects from %d, version %u since %u\n", count, (int) changed.size(), first,
+				slamMap->version, since);
+		if (zigbee) {
+			uint64_t broadcast = Ubitag::BROADCAST;
+			CMessage::packZBHeader(&buffer[0], broadcast, MSG_MAP_SNAPSHOT);
+			message_server->sendMessage(MSG_ZIGBEE_MSG, &buffer[0], buffer.size());
+			// the radio needs some time between two frames
+			if (first + count < (int) changed.size()) usleep(200000);
+		} else {
+			message_server->sendMessage(MSG_MAP_SNAPSHOT, &buffer[0], buffer.size());
+		}
+		first += count;
+	} while (first < (int) changed.size());
+}
+
+//! Broadcast the changes of the map since the last broadcast to the other robots
 void sendMap(){
 	if(slamMap!=NULL){
-	for (int var = 0; var < slamMap->mapSize; ++var) {
-		MappedObjectPosition pos = slamMap->getMappedPosition(var);
-		pos.mappedBy = myID;
-
-		CMessage packedMessage;
-		uint64_t broadcast = Ubitag::BROADCAST;
-		printf("packing object num %d \n",var);
-		packedMessage = CMessage::packToZBMessage(
-				broadcast, MSG_MAP_DATA,
-				&pos,
-				sizeof(MappedObjectPosition));
-		printf("sending object num %d \n",var);
-
-		message_server->sendMessage(MSG_ZIGBEE_MSG,
-				packedMessage.data, packedMessage.len);
-		usleep(200000);
+		sendMapSnapshot(broadcastVersion, MAP_SNAPSHOT_POSE, MAP_SNAPSHOT_ZIGBEE_OBJECTS, true);
+		broadcastVersion = slamMap->version;
+	}
+}
+
+//! Range of the laser in m, further the calibration of the columns does not hold, see CLaserScan::GetDistance
+#define OCCUPANCY_LASER_RANGE 0.4
+//! The laser is this far in front of the centre of the robot, in m
+#define OCCUPANCY_LASER_OFFSET 0.05
+//! Only every so many rows of the laser vector is a ray, neighbouring rows mostly fall in the same cells
+#define OCCUPANCY_ROW_STEP 8
+//! Columns within which the fit of CLaserScan::GetDistance of a column to a distance in cm is valid
+#define OCCUPANCY_COLUMN_MIN 150
+#define OCCUPANCY_COLUMN_MAX 300
+
+/**
+ * Every row of the laser vector looks in its own direction, from -fov/2 at the first row to fov/2 at the last one,
+ * OCCUPANCY_LASER_FOV in radians, 0.8 by default, negative if the rows go the other way round. The column of the laser
+ * in a row is converted to a distance with the fit of CLaserScan::GetDistance, a row beyond the fit has not seen an
+ * obstacle within the range of the laser. The pose is the one of the odometry at the capture of the scan.
+ */
+void insertLaserScan(const CMessage & message) {
+	static int16_t columns[MAX_LASER_SCAN_ROWS];
+	static float bearings[MAX_LASER_SCAN_ROWS], ranges[MAX_LASER_SCAN_ROWS];
+	static double fov = 0;
+	if (fov == 0) {
+		char* text = getenv("OCCUPANCY_LASER_FOV");
+		fov = (text != NULL && atof(text) != 0) ? atof(text) : 0.8;
+	}
+	LaserScanHeader header;
+	if (motor == NULL || !unpackLaserScan(message.data, message.len, header, columns) || header.rows < 2) return;
+	double pose[5];
+	motor->getPosition(pose);
+	if (!motor->getPositionAt(header.timestamp, pose)) return;
+	int count = 0;
+	for (int row = 0; row < header.rows; row += OCCUPANCY_ROW_STEP) {
+		int column = columns[row];
+		if (column < OCCUPANCY_COLUMN_MIN) continue;
+		bearings[count] = ((double) row / (header.rows - 1) - 0.5) * fov;
+		if (column > OCCUPANCY_COLUMN_MAX) {
+			ranges[count] = OCCUPANCY_LASER_RANGE;
+		} else {
+			ranges[count] = (68.157 - 0.688 * column + 0.0019176 * column * column) / 100.0;
+		}
+		count++;
+	}
+	double x = pose[0] + OCCUPANCY_LASER_OFFSET * cos(pose[2]);
+	double y = pose[1] + OCCUPANCY_LASER_OFFSET * sin(pose[2]);
+	occupancy.insertScan(x, y, pose[2], bearings, ranges, count, OCCUPANCY_LASER_RANGE);
+	frontiers.update();
+}
+
+//! Send the frontier to explore next from the pose of the odometry as MSG_FRONTIER, the robot is expected to go there
+void sendFrontier() {
+	FrontierWire wire;
+	memset(&wire, 0, sizeof(wire));
+	wire.version = FrontierWire::VERSION;
+	wire.robot = myID;
+	double targetX = 0, targetY = 0;
+	int gain = 0;
+	if (motor != NULL && frontiers.pick(motor->getPosition()[0], motor->getPosition()[1], true, targetX, targetY,
+			gain)) {
+		wire.found = 1;
+		wire.x = targetX;
+		wire.y = targetY;
+		wire.phi = atan2(targetY - motor->getPosition()[1], targetX - motor->getPosition()[0]);
+		wire.gain = (gain < 0xFFFF) ? gain : 0xFFFF;
 	}
+	wire.clusters = frontiers.getClusterCount();
+	message_server->sendMessage(MSG_FRONTIER, (uint8_t*) &wire, sizeof(wire));
+}
+
+//! Send the tiles of the occupancy grid that changed after version since as MSG_OCCUPANCY, in parts
+void sendOccupancy(uint32_t since) {
+	uint8_t flags = 0;
+	if (since > occupancy.getVersion()) since = 0;
+	if (since == 0 || occupancy.clearedAfter(since)) {
+		since = 0;
+		flags |= OCCUPANCY_FULL;
 	}
+	std::vector<const OccupancyGrid::Tile*> changed;
+	occupancy.changedSince(since, changed);
+	int first = 0;
+	do {
+		int count = changed.size() - first;
+		if (count > OCCUPANCY_MAX_TILES) count = OCCUPANCY_MAX_TILES;
+		std::vector<uint8_t> buffer(occupancyLength(count));
+		OccupancyHeaderWire *header = (OccupancyHeaderWire*) &buffer[0];
+		header->version = OccupancyHeaderWire::VERSION;
+		header->flags = flags;
+		header->robot = myID;
+		header->grid_version = occupancy.getVersion();
+		header->since = since;
+		header->cell_mm = (uint16_t) (OCCUPANCY_CELL * 1000 + 0.5);
+		header->first = first;
+		header->count = count;
+		header->total = changed.size();
+		for (int i = 0; i < count; ++i) {
+			const OccupancyGrid::Tile *tile = changed[first + i];
+			OccupancyTileWire *wire = occupancyTile(&buffer[0], i);
+			wire->tx = tile->tx;
+			wire->ty = tile->ty;
+			memcpy(wire->cells, tile->cells, sizeof(wire->cells));
+		}
+		message_server->sendMessage(MSG_OCCUPANCY, &buffer[0], buffer.size());
+		first += count;
+	} while (first < (int) changed.size());
 }
 
 void readMessages() {
@@ -159,6 +380,11 @@ void readMessages() {
 	messagee = message_server->getMessage();
 
 	if (messagee.type != MSG_NONE) {
+		// the filter thread may be in an update, the map messages wait for it
+		bool mapMessage = (messagee.type == MSG_MAP_DATA || messagee.type == MSG_MAP_SNAPSHOT_REQ
+				|| messagee.type == MSG_MAP_SNAPSHOT || messagee.type == MSG_GET_ALL_MAPPED_OBJS
+				|| messagee.type == MSG_GET_NEAREST_MAPPED_OBJECT_OF_TYPE_TO_POS) && filterService != NULL;
+		if (mapMessage) filterService->lock();
 		switch (messagee.type) {
 		case MSG_INIT: {
 			std::cout << DEBUGSTRING << "message init" << std::endl;
@@ -225,7 +451,8 @@ void readMessages() {
 
 			if (messagee.len != 0) {
 				DetectedBlobWSize* detected = new DetectedBlobWSize();
-				memcpy(detected, messagee.data, sizeof(DetectedBlobWSize));
+				memcpy(detected, messagee.data,
+						messagee.len < (int) sizeof(DetectedBlobWSize) ? messagee.len : sizeof(DetectedBlobWSize));
 				if (detectedBlob != NULL) {
 					delete detectedBlob;
 					detectedBlob = NULL;
@@ -235,6 +462,10 @@ void readMessages() {
 				detectedBlob->y = detected->detectedBlob.y;
 				detectedBlob->z = detected->detectedBlob.z;
 				detectedBlob->phi = detected->detectedBlob.phi;
+				detectedBlobTime = detected->timestamp;
+				// the next speeds are set because of this frame, see CLatencyTrace.h
+				traceFollow(detectedBlobTime);
+				delete detected;
 				/*
 				 printf("detected blob MAPPING x:%f y:%f z:%f phi:%f \n",
 				 detected->detectedBlob.x, detected->detectedBlob.y,
@@ -269,6 +500,7 @@ void readMessages() {
 			}
 			//	printf("after ubiposition receive\n");
 			memcpy(ubiposition, messagee.data, sizeof(UbiPosition));
+			ubiHistory.push(ubiposition->x, ubiposition->y, ubiposition->z, CTimer::now(), ubiposition->time_stamp);
 			//	printf("robot position: %f %f %f %d \n", ubiposition->x, ubiposition->y,ubiposition->z, ubiposition->time_stamp);
 
 		}
@@ -276,7 +508,10 @@ void readMessages() {
 			break;
 		case MSG_MAP_DATA: {
 			MappedObjectPosition mapedObject;
-			memcpy(&mapedObject, messagee.data, sizeof(MappedObjectPosition));
+			if (!unpackMappedObjectPosition(messagee.data, messagee.len, mapedObject)) {
+				printf("map data of length %d is not a known version\n", messagee.len);
+				break;
+			}
 			printf("received object type %d pos %f %f %f %f id %d robid %d\n",mapedObject.type,mapedObject.xPosition,
 					mapedObject.yPosition,	mapedObject.phiPosition,mapedObject.zPosition,mapedObject.map_id,mapedObject.mappedBy);
 			printf("received map data from %d of type %d\n",mapedObject.mappedBy,mapedObject.type);
@@ -292,10 +527,62 @@ void readMessages() {
 		}
 			;
 			break;
+		case MSG_MAP_SNAPSHOT_REQ: {
+			const MapSnapshotRequestWire *request = wireView<MapSnapshotRequestWire>(messagee.data, messagee.len);
+			if (request == NULL) {
+				sendMapSnapshot(0, 0, 0, false);
+			} else {
+				uint8_t flags = request->flags & (MAP_SNAPSHOT_COVARIANCE | MAP_SNAPSHOT_POSE);
+				sendMapSnapshot(request->since, flags, 0, false);
+			}
+		}
+			;
+			break;
+		case MSG_MAP_SNAPSHOT: {
+			const MapSnapshotHeaderWire *snapshot = mapSnapshotView(messagee.data, messagee.len);
+			if (snapshot == NULL) {
+				printf("map snapshot of length %d is not a known version\n", messagee.len);
+				break;
+			}
+			int robot = snapshot->robot;
+			if (robot == myID) break;
+			printf("received %d map objects of robot %d, version %u\n", (int) snapshot->count, robot,
+					(uint32_t) snapshot->map_version);
+			if ((snapshot->flags & MAP_SNAPSHOT_FULL) && snapshot->first == 0) {
+				slamMap->clearOtherRobotObjects(robot);
+			}
+			for (int i = 0; i < snapshot->count; ++i) {
+				MappedObjectPosition mapedObject;
+				if (unpackMappedObjectPosition(mapSnapshotObject(messagee.data, i), sizeof(MappedObjectPositionWire),
+						mapedObject)) {
+					// once mapping ended every object is folded into the merged map as it arrives
+					slamMap->addOtherRobotsObjects(mapedObject);
+				}
+			}
+		}
+			;
+			break;
+		case MSG_LASER_SCAN: {
+			insertLaserScan(messagee);
+		}
+			;
+			break;
+		case MSG_OCCUPANCY_REQ: {
+			const OccupancyRequestWire *request = wireView<OccupancyRequestWire>(messagee.data, messagee.len);
+			sendOccupancy(request != NULL ? (uint32_t) request->since : 0);
+		}
+			;
+			break;
+		case MSG_FRONTIER_REQ: {
+			sendFrontier();
+		}
+			;
+			break;
 		case MSG_GET_ALL_MAPPED_OBJS: {
 				for (int var = 0; var < slamMap->mapSize; ++var) {
 					MappedObjectPosition mapedObject = slamMap->getMappedPosition(var);
-					message_server->sendMessage(MSG_MAP_DATA,&mapedObject,sizeof(MappedObjectPosition));
+					uint8_t wire[sizeof(MappedObjectPositionWire)];
+					message_server->sendMessage(MSG_MAP_DATA,wire,packMappedObjectPosition(mapedObject, wire));
 				}
 				}
 					;
@@ -307,7 +594,8 @@ void readMessages() {
 					int num =slamMap->nearestTypeID(nearestTo);
 					if(num != -1){
 						MappedObjectPosition mapedObject =  slamMap->getMappedPosition(num);
-						message_server->sendMessage(MSG_MAP_DATA,&mapedObject,sizeof(MappedObjectPosition));
+						uint8_t wire[sizeof(MappedObjectPositionWire)];
+						message_server->sendMessage(MSG_MAP_DATA,wire,packMappedObjectPosition(mapedObject, wire));
 					}
 				}
 					;
@@ -315,6 +603,7 @@ void readMessages() {
 		default:
 			break;
 		}
+		if (mapMessage) filterService->unlock();
 	}
 
 }
@@ -403,17 +692,26 @@ int main(int argc, char **argv) {
 			} else {
 				if (initialUbiPosition == NULL) {
 					//initialize motor position
+					PositionFix now;
+					ubiHistory.getPositionAt(CTimer::now(), now);
 					printf("%sInitial position: %f %f ..........\n", debug_str.c_str(),
-							ubiposition->x, ubiposition->y);
-					motor->setMotorPosition(ubiposition->x, ubiposition->y, 0);
+							now.x, now.y);
+					motor->setMotorPosition(now.x, now.y, 0);
 					printf("%sAfter motor: %f %f ..........\n", debug_str.c_str(),
 							motor->getPosition()[0], motor->getPosition()[1]);
+					// the scans so far are in the frame of the odometry before it was set
+					occupancy.clear();
+					frontiers.clear();
 					if(mapProcedure == NULL){
 					mapProcedure = new Mapping(motor);
+					mapProcedure->setFrontiers(&frontiers);
 					}
 
 					if(slamMap==NULL){
 					slamMap = new Map(motor->getPosition(), robot_type,myID);
+					configureSubmaps(slamMap);
+					filterService = new FilterService(slamMap);
+					filterService->start();
 					}
 					usleep(10000);
 
@@ -503,7 +801,9 @@ int main(int argc, char **argv) {
 							float measuredCirclePos[4] = { detectedBlob->x,
 									detectedBlob->y, detectedBlob->phi,
 									detectedBlob->z };
-							slamMap->filter(motor->getPosition(),
+							double capturePosition[10];
+							blobPosition(capturePosition);
+							filterService->measurement(capturePosition,
 									measuredCirclePos);
 							seeBlob = true;
 							}else{
@@ -511,27 +811,43 @@ int main(int argc, char **argv) {
 							mapProcedure->wait_stopped += 10; //add to mapping motion to wait longer if robot see something and want stabilized image
 							}
 						} else {
-							slamMap->odometryChange(motor->getPosition());
+							filterService->odometry(motor->getPosition());
 						}
 					} else {
 						wait_no_moving = WAIT_FOR_NO_MOVING; //set to max if robot is moving again
-						slamMap->odometryChange(motor->getPosition());
+						// with the capture time the pose of the frame is known while moving, each frame is measured once
+						double capturePosition[10];
+						if (detectedBlob != NULL && detectedBlobTime != 0 && detectedBlobTime != measuredBlobTime
+								&& isPossible(detectedBlob) && blobPosition(capturePosition)) {
+							float measuredCirclePos[4] = { detectedBlob->x,
+									detectedBlob->y, detectedBlob->phi,
+									detectedBlob->z };
+							filterService->measurement(capturePosition,
+									measuredCirclePos);
+							measuredBlobTime = detectedBlobTime;
+						} else {
+							filterService->odometry(motor->getPosition());
+						}
 					}
+					// the pose the filter predicted for the last measurement goes back into the odometry
+					double correction[3] = { 0, 0, 0 };
+					filterService->applyCorrection(correction);
+					motor->correctPosition(correction[0], correction[1], correction[2]);
 
 					//test whether map is enough sized
 					if ((mapProcedure->runs < MINIMAL_RUNS
 							|| mapProcedure->wait_stopped > 0) || (!mapProcedure->closedLoop)) {
-						if (slamMap->newDetected) {
-							slamMap->newDetected = false;
+						if (filterService->takeNewDetected()) {
 							mapProcedure->wait_stopped += 40;
+							filterService->lock();
 							sendMap();
+							filterService->unlock();
 						}
-						if (slamMap->seeAfterLongTime) {
-							slamMap->seeAfterLongTime = false;
+						if (filterService->takeSeeAfterLongTime()) {
 							mapProcedure->wait_stopped += 100;
 						}
 
-						mapProcedure->doMappingMotion(seeBlob,slamMap);
+						mapProcedure->doMappingMotion(seeBlob,filterService->getPose());
 				//		printf("%d\n", mapProcedure->wait_stopped);
 					} else {
 
@@ -541,6 +857,9 @@ int main(int argc, char **argv) {
 
 						message_server->sendMessage(MSG_MAP_COMPLETE, NULL, 0);
 						std::cout << DEBUGSTRING << " Map sended " << std::endl;
+						// what the filter still has to do belongs in the map that is merged
+						filterService->flush();
+						filterService->lock();
 						slamMap->mappingEnded = true;
 						slamMap->mergeMap();
 						sendMap();
@@ -585,6 +904,7 @@ int main(int argc, char **argv) {
 						}
 
 						std::cout << DEBUGSTRING << " Map end " << std::endl;
+						filterService->unlock();
 					}
 				}
 			}
@@ -609,6 +929,8 @@ int main(int argc, char **argv) {
 
 	delete motor;
 	delete ubiposition;
+	// the filter thread uses the map until it is stopped
+	delete filterService;
 	delete slamMap;
 	delete mapProcedure;
 	delete message_server;
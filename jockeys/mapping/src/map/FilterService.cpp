@@ -0,0 +1,199 @@
+/*
+ * FilterService.cpp
+ *
+ * The EKF of a Map on a thread of its own
+ */
+
+#include "FilterService.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+//! How long the thread waits for input before it checks whether it should stop, in ms
+#define FILTER_POLL 100
+
+static long long filterTime() {
+	struct timeval time;
+	gettimeofday(&time, NULL);
+	return (long long) time.tv_sec * 1000000 + time.tv_usec;
+}
+
+FilterService::FilterService(Map *map): map(map), running(false), head(0), tail(0), sequence(0), newDetected(0),
+		seeAfterLongTime(0), dropped(0), slowest(0) {
+	pthread_mutex_init(&mapMutex, NULL);
+	pthread_mutex_init(&correctionMutex, NULL);
+	sem_init(&work, 0, 0);
+	memset(correction, 0, sizeof(correction));
+	memset(&pose, 0, sizeof(pose));
+	publish();
+}
+
+FilterService::~FilterService() {
+	stop();
+	sem_destroy(&work);
+	pthread_mutex_destroy(&correctionMutex);
+	pthread_mutex_destroy(&mapMutex);
+}
+
+int FilterService::start() {
+	if (running) return 0;
+	running = true;
+	if (pthread_create(&thread, NULL, &FilterService::run, this) != 0) {
+		fprintf(stderr, "Could not start the filter thread\n");
+		running = false;
+		return -1;
+	}
+	return 0;
+}
+
+//! What is still in the queue is processed first
+void FilterService::stop() {
+	if (!running) return;
+	flush();
+	running = false;
+	sem_post(&work);
+	pthread_join(thread, NULL);
+}
+
+bool FilterService::push(const Input &input) {
+	if (head - tail >= FILTER_QUEUE) {
+		dropped++;
+		return false;
+	}
+	queue[head % FILTER_QUEUE] = input;
+	// the entry has to be complete before the thread can see it
+	__sync_synchronize();
+	head = head + 1;
+	sem_post(&work);
+	return true;
+}
+
+bool FilterService::odometry(const double *robpos) {
+	Input input;
+	input.measurement = false;
+	memcpy(input.robpos, robpos, sizeof(input.robpos));
+	return push(input);
+}
+
+bool FilterService::measurement(const double *robpos, const float *measured) {
+	Input input;
+	input.measurement = true;
+	memcpy(input.robpos, robpos, sizeof(input.robpos));
+	memcpy(input.measured, measured, sizeof(input.measured));
+	return push(input);
+}
+
+void* FilterService::run(void *service) {
+	((FilterService*) service)->filterLoop();
+	return NULL;
+}
+
+void FilterService::filterLoop() {
+	while (running || tail != head) {
+		struct timespec timeout;
+		clock_gettime(CLOCK_REALTIME, &timeout);
+		timeout.tv_nsec += FILTER_POLL * 1000000L;
+		if (timeout.tv_nsec >= 1000000000L) {
+			timeout.tv_sec++;
+			timeout.tv_nsec -= 1000000000L;
+		}
+		if (sem_timedwait(&work, &timeout) != 0 && errno != EINTR && tail == head) continue;
+		while (tail != head) {
+			__sync_synchronize();
+			Input input = queue[tail % FILTER_QUEUE];
+
+			long long start = filterTime();
+			pthread_mutex_lock(&mapMutex);
+			if (input.measurement) {
+				double robpos[10];
+				memcpy(robpos, input.robpos, sizeof(robpos));
+				map->filter(robpos, input.measured);
+				pthread_mutex_lock(&correctionMutex);
+				for (int i = 0; i < 3; ++i) correction[i] += robpos[i] - input.robpos[i];
+				pthread_mutex_unlock(&correctionMutex);
+			} else {
+				map->odometryChange(input.robpos);
+			}
+			if (map->newDetected) {
+				map->newDetected = false;
+				newDetected = 1;
+			}
+			if (map->seeAfterLongTime) {
+				map->seeAfterLongTime = false;
+				seeAfterLongTime = 1;
+			}
+			publish();
+			pthread_mutex_unlock(&mapMutex);
+			long duration = (long) (filterTime() - start);
+			if (duration > slowest) slowest = duration;
+			// only now the entry is free again, and flush() knows it is processed
+			__sync_synchronize();
+			tail = tail + 1;
+		}
+	}
+}
+
+//! Called with mapMutex, or before the thread runs
+void FilterService::publish() {
+	sequence = sequence + 1;
+	__sync_synchronize();
+	pose.x = gsl_matrix_get(map->state, 0, 0);
+	pose.y = gsl_matrix_get(map->state, 1, 0);
+	pose.phi = gsl_matrix_get(map->state, 2, 0);
+	for (int i = 0; i < 3; ++i) pose.variance[i] = map->P.get(i, i);
+	pose.landmarks = map->mapSize;
+	if (map->mapSize > 0) {
+		MappedObjectPosition first = map->getMappedPosition(0);
+		pose.firstX = first.xPosition;
+		pose.firstY = first.yPosition;
+	}
+	pose.mapVersion = map->version;
+	pose.updates++;
+	__sync_synchronize();
+	sequence = sequence + 1;
+}
+
+PoseSnapshot FilterService::getPose() {
+	PoseSnapshot result;
+	unsigned int before, after;
+	do {
+		before = sequence;
+		__sync_synchronize();
+		result = pose;
+		__sync_synchronize();
+		after = sequence;
+	} while ((before & 1) || before != after);
+	return result;
+}
+
+void FilterService::applyCorrection(double *robpos) {
+	pthread_mutex_lock(&correctionMutex);
+	for (int i = 0; i < 3; ++i) {
+		robpos[i] += correction[i];
+		correction[i] = 0;
+	}
+	pthread_mutex_unlock(&correctionMutex);
+}
+
+bool FilterService::takeNewDetected() {
+	return __sync_lock_test_and_set(&newDetected, 0) != 0;
+}
+
+bool FilterService::takeSeeAfterLongTime() {
+	return __sync_lock_test_and_set(&seeAfterLongTime, 0) != 0;
+}
+
+void FilterService::flush() {
+	while (running && tail != head) usleep(1000);
+}
+
+void FilterService::lock() {
+	pthread_mutex_lock(&mapMutex);
+}
+
+void FilterService::unlock() {
+	pthread_mutex_unlock(&mapMutex);
+}
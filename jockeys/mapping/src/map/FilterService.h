@@ -0,0 +1,111 @@
+/*
+ * FilterService.h
+ *
+ * Runs the EKF of a Map on a thread of its own, so a measurement update that gets slow with many landmarks does not
+ * hold up the motion control of the main loop.
+ */
+#include "Map.h"
+#include <pthread.h>
+#include <semaphore.h>
+
+#ifndef FILTERSERVICE_H_
+#define FILTERSERVICE_H_
+
+//! Odometry and measurements that can wait for the filter thread, a power of two
+#define FILTER_QUEUE 32
+
+//! The pose of the robot after the last update of the filter, with what motion control needs of the map
+struct PoseSnapshot {
+	double x, y, phi;
+	//! Variances of x, y and phi
+	double variance[3];
+	int landmarks;
+	//! Position of the first landmark, the mapping motion closes its loop on it, valid if there are landmarks
+	double firstX, firstY;
+	unsigned int mapVersion;
+	//! Inputs the filter processed, it grows with every snapshot
+	unsigned int updates;
+};
+
+/**
+ * The main loop puts odometry and measurements in a queue without waiting, it is a ring with a single producer, the
+ * main loop, and a single consumer, the filter thread, so it needs no lock. The thread runs odometryChange and filter
+ * and publishes a PoseSnapshot under a sequence counter, so getPose() never waits for an update either. Everything
+ * else that uses the map, the messages and the merge, takes lock() first. Odometry only carries the absolute position
+ * of the motors, so an odometry entry that does not fit in the queue is dropped without loss, the next one covers it.
+ */
+class FilterService {
+public:
+	FilterService(Map *map);
+	~FilterService();
+
+	int start();
+	void stop();
+
+	//! Queue the odometry of the motors, robpos as for Map::odometryChange
+	bool odometry(const double *robpos);
+	//! Queue a measurement with the odometry at which it was made, as for Map::filter
+	bool measurement(const double *robpos, const float *measured);
+
+	//! The last published pose, without waiting for the filter
+	PoseSnapshot getPose();
+
+	/**
+	 * Map::filter writes the predicted pose back into the position of the motors, the thread keeps the difference it
+	 * made, this adds it to the motor position given and clears it. Call it from the thread that owns the motors.
+	 */
+	void applyCorrection(double *robpos);
+
+	//! Map::newDetected and Map::seeAfterLongTime of the updates since the last call, they are cleared on reading
+	bool takeNewDetected();
+	bool takeSeeAfterLongTime();
+
+	//! Wait until the queue is processed
+	void flush();
+
+	//! For everything outside of the filter thread that uses the map
+	void lock();
+	void unlock();
+
+	inline long getDropped() { return dropped; }
+	//! Slowest update in us
+	inline long getSlowest() { return slowest; }
+
+private:
+	struct Input {
+		bool measurement;
+		double robpos[10];
+		float measured[4];
+	};
+
+	static void* run(void *service);
+	void filterLoop();
+	bool push(const Input &input);
+	void publish();
+
+	Map *map;
+	pthread_t thread;
+	volatile bool running;
+	pthread_mutex_t mapMutex;
+	sem_t work;
+
+	Input queue[FILTER_QUEUE];
+	//! Written by the main loop only, the next free entry
+	volatile unsigned int head;
+	//! Written by the filter thread only, the next entry to process
+	volatile unsigned int tail;
+
+	//! Odd while the thread writes pose
+	volatile unsigned int sequence;
+	PoseSnapshot pose;
+
+	pthread_mutex_t correctionMutex;
+	double correction[3];
+	volatile int newDetected;
+	volatile int seeAfterLongTime;
+
+	long dropped;
+	long slowest;
+};
+
+#endif /* FILTERSERVICE_H_ */
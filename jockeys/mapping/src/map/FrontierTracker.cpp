@@ -0,0 +1,124 @@
+/*
+ * FrontierTracker.cpp
+ *
+ * Frontiers between the free and the unknown space of the occupancy grid
+ */
+
+#include "FrontierTracker.h"
+#include <cmath>
+
+static inline bool isUnknown(int8_t value) {
+	return value >= -OCCUPANCY_SURE && value <= OCCUPANCY_SURE;
+}
+
+//! Cell i, j of a tile, unknown for a tile that is not there
+static inline int8_t cellOf(const OccupancyGrid::Tile *tile, int i, int j) {
+	return (tile != NULL) ? tile->cells[j * OCCUPANCY_TILE + i] : 0;
+}
+
+FrontierTracker::FrontierTracker(const OccupancyGrid & grid): grid(grid) {
+}
+
+void FrontierTracker::clear() {
+	clusters.clear();
+	order.clear();
+}
+
+void FrontierTracker::update() {
+	const std::vector<Key> & changed = grid.getScanTiles();
+	std::set<Key> tiles;
+	for (size_t i = 0; i < changed.size(); ++i) {
+		int tx = changed[i].first, ty = changed[i].second;
+		tiles.insert(Key(tx, ty));
+		tiles.insert(Key(tx - 1, ty));
+		tiles.insert(Key(tx + 1, ty));
+		tiles.insert(Key(tx, ty - 1));
+		tiles.insert(Key(tx, ty + 1));
+	}
+	for (std::set<Key>::const_iterator i = tiles.begin(); i != tiles.end(); ++i) {
+		updateTile(*i);
+	}
+}
+
+/**
+ * The number of times a cluster was driven to is kept when its tile changes, a frontier the robot could not reach
+ * changes a little with every scan from a distance.
+ */
+void FrontierTracker::updateTile(const Key & key) {
+	int picks = 0;
+	std::map<Key, Cluster>::iterator found = clusters.find(key);
+	if (found != clusters.end()) {
+		picks = found->second.picks;
+		order.erase(std::make_pair(-found->second.cells, key));
+		clusters.erase(found);
+	}
+	const OccupancyGrid::Tile *tile = grid.tile(key.first, key.second);
+	if (tile == NULL) return;
+	const OccupancyGrid::Tile *left = grid.tile(key.first - 1, key.second);
+	const OccupancyGrid::Tile *right = grid.tile(key.first + 1, key.second);
+	const OccupancyGrid::Tile *below = grid.tile(key.first, key.second - 1);
+	const OccupancyGrid::Tile *above = grid.tile(key.first, key.second + 1);
+	const int last = OCCUPANCY_TILE - 1;
+	int frontier[OCCUPANCY_TILE_CELLS];
+	int count = 0, sumI = 0, sumJ = 0;
+	for (int j = 0; j < OCCUPANCY_TILE; ++j) {
+		for (int i = 0; i < OCCUPANCY_TILE; ++i) {
+			int c = j * OCCUPANCY_TILE + i;
+			if (tile->cells[c] >= -OCCUPANCY_SURE) continue;
+			if (isUnknown(i > 0 ? tile->cells[c - 1] : cellOf(left, last, j))
+					|| isUnknown(i < last ? tile->cells[c + 1] : cellOf(right, 0, j))
+					|| isUnknown(j > 0 ? tile->cells[c - OCCUPANCY_TILE] : cellOf(below, i, last))
+					|| isUnknown(j < last ? tile->cells[c + OCCUPANCY_TILE] : cellOf(above, i, 0))) {
+				frontier[count++] = c;
+				sumI += i;
+				sumJ += j;
+			}
+		}
+	}
+	if (count < FRONTIER_MIN_CELLS) return;
+	// the centroid of a curved frontier can be in the unknown or behind a wall, the cell nearest to it is not
+	double ci = (double) sumI / count, cj = (double) sumJ / count;
+	int nearest = frontier[0];
+	double best = -1;
+	for (int f = 0; f < count; ++f) {
+		double di = frontier[f] % OCCUPANCY_TILE - ci, dj = frontier[f] / OCCUPANCY_TILE - cj;
+		if (best < 0 || di * di + dj * dj < best) {
+			best = di * di + dj * dj;
+			nearest = frontier[f];
+		}
+	}
+	Cluster & cluster = clusters[key];
+	cluster.cells = count;
+	cluster.x = (key.first * OCCUPANCY_TILE + nearest % OCCUPANCY_TILE + 0.5) * OCCUPANCY_CELL;
+	cluster.y = (key.second * OCCUPANCY_TILE + nearest / OCCUPANCY_TILE + 0.5) * OCCUPANCY_CELL;
+	cluster.picks = picks;
+	if (picks < FRONTIER_MAX_PICKS) order.insert(std::make_pair(-count, key));
+}
+
+/**
+ * The score of a cluster is its number of cells minus FRONTIER_DISTANCE_COST for every m to it, so the number of cells
+ * is an upper bound of the score and the search stops at the first cluster that is not larger than the best score.
+ */
+bool FrontierTracker::pick(double x, double y, bool drive, double & targetX, double & targetY, int & gain) {
+	std::set<std::pair<int, Key> >::iterator best = order.end();
+	double bestScore = 0;
+	for (std::set<std::pair<int, Key> >::iterator i = order.begin(); i != order.end(); ++i) {
+		int cells = -i->first;
+		if (best != order.end() && cells <= bestScore) break;
+		const Cluster & cluster = clusters[i->second];
+		double distance = hypot(cluster.x - x, cluster.y - y);
+		if (distance < FRONTIER_MIN_DISTANCE) continue;
+		double score = cells - FRONTIER_DISTANCE_COST * distance;
+		if (best == order.end() || score > bestScore) {
+			best = i;
+			bestScore = score;
+		}
+	}
+	if (best == order.end()) return false;
+	Cluster & cluster = clusters[best->second];
+	targetX = cluster.x;
+	targetY = cluster.y;
+	gain = cluster.cells;
+	if (drive && ++cluster.picks >= FRONTIER_MAX_PICKS) order.erase(best);
+	return true;
+}
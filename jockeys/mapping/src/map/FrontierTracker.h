@@ -0,0 +1,70 @@
+/*
+ * FrontierTracker.h
+ *
+ * Frontiers between the free and the unknown space of the occupancy grid, kept up to date scan by scan, and the one
+ * that is the best to explore next.
+ */
+#include "OccupancyGrid.h"
+#include <map>
+#include <set>
+
+#ifndef FRONTIERTRACKER_H_
+#define FRONTIERTRACKER_H_
+
+//! A tile with fewer frontier cells is not worth a drive, those are mostly the frayed ends of single rays
+#define FRONTIER_MIN_CELLS 4
+//! Frontier cells that one m of driving is worth
+#define FRONTIER_DISTANCE_COST 20.0
+//! A frontier that was driven to this often without the laser resolving it is given up, it cannot be reached
+#define FRONTIER_MAX_PICKS 3
+//! A frontier closer than this in m is where the robot already is
+#define FRONTIER_MIN_DISTANCE 0.1
+
+/**
+ * A frontier cell is a free cell next to an unknown one, and the frontier cells of a tile form one cluster. After a
+ * scan only the tiles the scan changed are looked at again, together with their four neighbours of which the cells at
+ * the border may have lost their unknown neighbour, so a scan costs a few tiles instead of the whole grid.
+ *
+ * The clusters are ordered by their number of cells, the most a drive there can gain. The best target trades this gain
+ * against the distance, and is found by going down the order until the gain of the next cluster cannot beat the best
+ * score so far. With a few large clusters on top that is a few steps in a balanced tree, instead of a pass over all.
+ */
+class FrontierTracker {
+public:
+	FrontierTracker(const OccupancyGrid & grid);
+
+	//! Forget all clusters, when the grid is cleared
+	void clear();
+
+	//! Look again at the tiles that the last scan of the grid changed
+	void update();
+
+	/**
+	 * The best target from x, y in the frame of the grid, false if no frontier is left. If drive is set the robot
+	 * will drive there, and a cluster that it drove to FRONTIER_MAX_PICKS times is given up.
+	 */
+	bool pick(double x, double y, bool drive, double & targetX, double & targetY, int & gain);
+
+	//! Clusters that can still be picked
+	inline int getClusterCount() const { return order.size(); }
+private:
+	typedef std::pair<int, int> Key;
+
+	struct Cluster {
+		int cells;
+		//! The frontier cell nearest to the centroid of the cluster, a cell the robot can stand on
+		double x, y;
+		int picks;
+	};
+
+	//! Find the frontier cells of the tile with index tx, ty again
+	void updateTile(const Key & key);
+
+	const OccupancyGrid & grid;
+	//! All clusters, also the ones that are given up, so a change of their tile does not bring them back
+	std::map<Key, Cluster> clusters;
+	//! The clusters that can be picked, by descending number of cells
+	std::set<std::pair<int, Key> > order;
+};
+
+#endif /* FRONTIERTRACKER_H_ */
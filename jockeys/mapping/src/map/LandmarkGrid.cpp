@@ -0,0 +1,107 @@
+/*
+ * LandmarkGrid.cpp
+ *
+ * Uniform grid over the x, y positions of the landmarks
+ */
+
+#include "LandmarkGrid.h"
+#include <algorithm>
+#include <cmath>
+#include <climits>
+
+//! Cells further out are clamped, they only happen for a landmark that is far off anyway
+#define LANDMARK_GRID_LIMIT 1000000
+
+LandmarkGrid::LandmarkGrid(double cell) {
+	this->cell = (cell > 0) ? cell : LANDMARK_GRID_CELL;
+	clear();
+}
+
+void LandmarkGrid::clear() {
+	cells.clear();
+	entries.clear();
+	count = 0;
+	minx = miny = INT_MAX;
+	maxx = maxy = INT_MIN;
+}
+
+int LandmarkGrid::index(double coordinate) const {
+	double i = floor(coordinate / cell);
+	// NaN ends up in the first cell
+	if (!(i >= -LANDMARK_GRID_LIMIT)) return -LANDMARK_GRID_LIMIT;
+	if (i > LANDMARK_GRID_LIMIT) return LANDMARK_GRID_LIMIT;
+	return (int) i;
+}
+
+void LandmarkGrid::unlink(int id) {
+	std::map<Cell, std::vector<int> >::iterator found = cells.find(entries[id].cell);
+	if (found == cells.end()) return;
+	std::vector<int> &ids = found->second;
+	ids.erase(std::remove(ids.begin(), ids.end(), id), ids.end());
+	if (ids.empty()) cells.erase(found);
+}
+
+void LandmarkGrid::insert(int id, MapObjectType type, double x, double y) {
+	if (id < 0) return;
+	if ((int) entries.size() <= id) {
+		Entry unused;
+		unused.used = false;
+		entries.resize(id + 1, unused);
+	}
+	Entry &entry = entries[id];
+	if (entry.used) {
+		unlink(id);
+	} else {
+		entry.used = true;
+		count++;
+	}
+	entry.cell.type = type;
+	entry.cell.cx = index(x);
+	entry.cell.cy = index(y);
+	cells[entry.cell].push_back(id);
+	minx = std::min(minx, entry.cell.cx);
+	maxx = std::max(maxx, entry.cell.cx);
+	miny = std::min(miny, entry.cell.cy);
+	maxy = std::max(maxy, entry.cell.cy);
+}
+
+void LandmarkGrid::move(int id, double x, double y) {
+	if (id < 0 || id >= (int) entries.size() || !entries[id].used) return;
+	const Cell &current = entries[id].cell;
+	if (current.cx == index(x) && current.cy == index(y)) return;
+	insert(id, (MapObjectType) current.type, x, y);
+}
+
+void LandmarkGrid::query(MapObjectType type, double x, double y, double radius, std::vector<int> &ids) const {
+	if (count == 0) return;
+	int x0 = std::max(index(x - radius), minx), x1 = std::min(index(x + radius), maxx);
+	int y0 = std::max(index(y - radius), miny), y1 = std::min(index(y + radius), maxy);
+	if (x0 > x1 || y0 > y1) return;
+	size_t first = ids.size();
+	Cell key;
+	key.type = type;
+	if ((long long) (x1 - x0 + 1) * (y1 - y0 + 1) > (long long) cells.size()) {
+		// a large square has more cells than there are in use, walk those instead
+		key.cx = INT_MIN;
+		key.cy = INT_MIN;
+		std::map<Cell, std::vector<int> >::const_iterator i = cells.lower_bound(key);
+		for (; i != cells.end() && i->first.type == type; ++i) {
+			if (i->first.cx < x0 || i->first.cx > x1 || i->first.cy < y0 || i->first.cy > y1) continue;
+			ids.insert(ids.end(), i->second.begin(), i->second.end());
+		}
+	} else {
+		for (key.cx = x0; key.cx <= x1; ++key.cx) {
+			for (key.cy = y0; key.cy <= y1; ++key.cy) {
+				std::map<Cell, std::vector<int> >::const_iterator found = cells.find(key);
+				if (found != cells.end()) ids.insert(ids.end(), found->second.begin(), found->second.end());
+			}
+		}
+	}
+	std::sort(ids.begin() + first, ids.end());
+}
+
+bool LandmarkGrid::covers(double x, double y, double radius) const {
+	if (count == 0) return true;
+	return index(x - radius) <= minx && index(x + radius) >= maxx && index(y - radius) <= miny
+			&& index(y + radius) >= maxy;
+}
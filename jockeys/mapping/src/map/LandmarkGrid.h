@@ -0,0 +1,70 @@
+/*
+ * LandmarkGrid.h
+ *
+ * Uniform grid over the x, y positions of the landmarks, so the landmarks near a position can be found without
+ * looking at all of them.
+ */
+#include <messageDataType.h>
+#include <vector>
+#include <map>
+
+#ifndef LANDMARKGRID_H_
+#define LANDMARKGRID_H_
+
+//! Side of a cell in m, about the distance at which two landmarks are taken for the same one
+#define LANDMARK_GRID_CELL 0.5
+
+/**
+ * Every entry has an id, its type and the cell of its last position. The cells are kept per type, so a query only
+ * sees entries of the type it asks for. A query returns the entries of all cells that touch the square around the
+ * position, the caller still checks the distance, so the grid can never change which landmark is chosen. Moving an
+ * entry within its cell costs nothing, only the entries that cross into another cell are rebinned.
+ */
+class LandmarkGrid {
+public:
+	LandmarkGrid(double cell = LANDMARK_GRID_CELL);
+
+	//! Forget all entries
+	void clear();
+
+	//! Add the entry id of the given type at x, y, an entry that is there already is moved
+	void insert(int id, MapObjectType type, double x, double y);
+
+	//! Move the entry id to x, y, nothing happens if it was not inserted
+	void move(int id, double x, double y);
+
+	//! Append the ids of type in the cells within radius of x, y to ids, in increasing order
+	void query(MapObjectType type, double x, double y, double radius, std::vector<int> &ids) const;
+
+	//! True if the entries of a query with this radius would be all entries of the grid
+	bool covers(double x, double y, double radius) const;
+
+	inline int size() const { return count; }
+
+private:
+	struct Cell {
+		int type, cx, cy;
+		inline bool operator<(const Cell &other) const {
+			if (type != other.type) return type < other.type;
+			if (cx != other.cx) return cx < other.cx;
+			return cy < other.cy;
+		}
+	};
+
+	struct Entry {
+		bool used;
+		Cell cell;
+	};
+
+	int index(double coordinate) const;
+	void unlink(int id);
+
+	double cell;
+	std::map<Cell, std::vector<int> > cells;
+	std::vector<Entry> entries;
+	int count;
+	//! Cells the entries ever were in, it does not shrink, which only makes covers() more careful
+	int minx, maxx, miny, maxy;
+};
+
+#endif /* LANDMARKGRID_H_ */
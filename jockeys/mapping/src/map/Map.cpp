@@ -6,10 +6,19 @@
  */
 
 #include "Map.h"
+#include "SmallMatrix.h"
+#include <algorithm>
+#include <climits>
 #include <stdio.h>
 #include <cmath>
 #include <cstring>
 #include "CTimer.h"
+#include "MapFile.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
 //13 32
 using namespace std;
 bool PRINT_MEASUREDPOS = false;
@@ -44,6 +53,8 @@ double TOLERANCEPHI = 0.2;
 double addP = 0.2;
 double hL = 0.01;
 double hR = 0.01;
+//! Wheel distances of one step of the Scout that differ less than this, in m, are driving straight
+#define SCOUT_STRAIGHT 1e-6
 double b = 0.12;
 double *odometry_covariance = new double[3];
 CTimer timermap;
@@ -69,6 +80,12 @@ Map::Map(double* odometr, RobotBase::RobotType robot_type, int myID) {
 	printf("map pos %f %f %f\n", odometry[0], odometry[1], odometry[2]);
 
 	this->mapSize = 0;
+	this->version = 0;
+	this->rebuiltVersion = 0;
+	this->submapLandmarks = 0;
+	this->submapDistance = 0;
+	this->submapTravelled = 0;
+	memcpy(this->submapOrigin, this->odometry, sizeof(this->submapOrigin));
 	/*	this->R = gsl_matrix_calloc (3, 3);
 	 gsl_matrix_set(this->R,0, 0, ODOMETRY_XERROR);
 	 gsl_matrix_set(this->R,1,1, ODOMETRY_YERROR);
@@ -81,26 +98,21 @@ Map::Map(double* odometr, RobotBase::RobotType robot_type, int myID) {
 	gsl_matrix_set(this->Q, 2, 2, MEASUREMENT_PHIERROR);
 	gsl_matrix_set(this->Q, 3, 3, MEASUREMENT_ZERROR);
 
-	//initiate robot state to odometry position
-	this->state = gsl_matrix_calloc(3, 1);
+	//initiate robot state to odometry position, covariance P to null 3x3 matrix
+	this->state = this->predstate = NULL;
+	this->stateBlock = this->predstateBlock = NULL;
+	this->capacity = 0;
+	this->predP_HtBlock = this->KBlock = NULL;
+	this->hWork = gsl_matrix_alloc(4, 7);
+	this->innovationWork = gsl_matrix_alloc(4, 4);
+	this->differenceWork = gsl_matrix_alloc(4, 1);
+	resizeState(3);
 	gsl_matrix_set(this->state, 0, 0, this->odometry[0]);
 	gsl_matrix_set(this->state, 1, 0, this->odometry[1]);
 	gsl_matrix_set(this->state, 2, 0, this->odometry[2]);
+	gsl_matrix_set_zero(this->predstate);
 
 	mappedObjectTypes.push_back(ROBOT);
-
-	this->predstate = gsl_matrix_calloc(3, 1);
-	//initiate covariance P to null 3x3 matrix
-	this->P = gsl_matrix_calloc(3, 3);
-	//zmeneno
-	gsl_matrix_set(this->P, 0, 0, 0);
-	gsl_matrix_set(this->P, 1, 1, 0);
-	gsl_matrix_set(this->P, 2, 2, 0);
-	this->predP = gsl_matrix_calloc(3, 3);
-	//zmeneno
-	gsl_matrix_set(this->predP, 0, 0, 0);
-	gsl_matrix_set(this->predP, 1, 1, 0);
-	gsl_matrix_set(this->predP, 2, 2, 0);
 	this->time = time;
 	this->newDetected = false;
 	printf("Map initialized\n");
@@ -109,12 +121,223 @@ Map::Map(double* odometr, RobotBase::RobotType robot_type, int myID) {
 }
 
 Map::~Map() {
-	gsl_matrix_free(this->state);
-	gsl_matrix_free(this->P);
+	gsl_matrix_free(this->stateBlock);
+	gsl_matrix_free(this->predstateBlock);
+	gsl_matrix_free(this->predP_HtBlock);
+	gsl_matrix_free(this->KBlock);
+	gsl_matrix_free(this->hWork);
+	gsl_matrix_free(this->innovationWork);
+	gsl_matrix_free(this->differenceWork);
 	gsl_matrix_free(this->Q);
 
 }
 
+/**
+ * A new landmark used to allocate all four matrices again and copy the old covariance over element by element, which
+ * is quadratic in the size of the map for every landmark. Now the state vectors are views on blocks with room to spare
+ * and P reserves the same room, so growing within the room only means zeroing the new elements, and the room doubles
+ * when it is used up. The columns of P stay where they are when it grows, so it is copied as one block then.
+ * Shrinking, for mergeMap, keeps the room.
+ */
+void Map::resizeState(int newsize) {
+	int oldsize = (this->state == NULL) ? 0 : this->state->size1;
+	int keep = (oldsize < newsize) ? oldsize : newsize;
+	if (newsize > this->capacity) {
+		int newcapacity = (this->capacity > 0) ? this->capacity : 4 * MAP_INITIAL_LANDMARKS + 3;
+		while (newcapacity < newsize) {
+			newcapacity *= 2;
+		}
+		gsl_matrix *newstate = gsl_matrix_alloc(newcapacity, 1);
+		gsl_matrix *newpredstate = gsl_matrix_alloc(newcapacity, 1);
+		if (keep > 0) {
+			gsl_matrix_view to = gsl_matrix_submatrix(newstate, 0, 0, keep, 1);
+			gsl_matrix_memcpy(&to.matrix, this->state);
+			to = gsl_matrix_submatrix(newpredstate, 0, 0, keep, 1);
+			gsl_matrix_memcpy(&to.matrix, this->predstate);
+		}
+		if (this->stateBlock != NULL) {
+			gsl_matrix_free(this->stateBlock);
+			gsl_matrix_free(this->predstateBlock);
+		}
+		this->stateBlock = newstate;
+		this->predstateBlock = newpredstate;
+		this->P.reserve(newcapacity);
+		// the workspaces of the measurement update do not keep anything between two updates
+		if (this->predP_HtBlock != NULL) {
+			gsl_matrix_free(this->predP_HtBlock);
+			gsl_matrix_free(this->KBlock);
+		}
+		this->predP_HtBlock = gsl_matrix_alloc(newcapacity, 4);
+		this->KBlock = gsl_matrix_alloc(newcapacity, 4);
+		this->capacity = newcapacity;
+	}
+	if (newsize > keep) {
+		gsl_matrix_view part = gsl_matrix_submatrix(this->stateBlock, keep, 0, newsize - keep, 1);
+		gsl_matrix_set_zero(&part.matrix);
+		part = gsl_matrix_submatrix(this->predstateBlock, keep, 0, newsize - keep, 1);
+		gsl_matrix_set_zero(&part.matrix);
+	}
+	this->P.resize(newsize);
+	this->stateView = gsl_matrix_submatrix(this->stateBlock, 0, 0, newsize, 1);
+	this->predstateView = gsl_matrix_submatrix(this->predstateBlock, 0, 0, newsize, 1);
+	this->state = &this->stateView.matrix;
+	this->predstate = &this->predstateView.matrix;
+}
+
+void Map::setSubmapLimits(int landmarks, double distance) {
+	this->submapLandmarks = landmarks;
+	this->submapDistance = distance;
+	if (landmarks > 0 || distance > 0) {
+		printf("submap closed after %d landmarks or %f m\n", landmarks, distance);
+	}
+}
+
+double Map::landmarkElement(int ithLM, int element) {
+	if (landmarkSlots[ithLM] == -1) return storedLandmarks[ithLM].position[element];
+	return gsl_matrix_get(this->state, rowOf(ithLM) + element, 0);
+}
+
+double Map::landmarkVariance(int ithLM, int row, int col) {
+	if (landmarkSlots[ithLM] == -1) return storedLandmarks[ithLM].covariance[row][col];
+	return this->P.get(rowOf(ithLM) + row, rowOf(ithLM) + col);
+}
+
+int Map::addSlot(int ithLM) {
+	if ((int) landmarkSlots.size() <= ithLM) {
+		landmarkSlots.resize(ithLM + 1, -1);
+		storedLandmarks.resize(ithLM + 1);
+	}
+	landmarkSlots[ithLM] = slotLandmarks.size();
+	slotLandmarks.push_back(ithLM);
+	resizeState(filterSize());
+	return rowOf(ithLM);
+}
+
+/**
+ * The landmark comes back with the covariance it had when its submap was closed and no correlation with the robot or
+ * the landmarks of this submap, like a landmark after mergeMap. The next update correlates it again.
+ */
+void Map::activate(int ithLM) {
+	StoredLandmark &stored = storedLandmarks[ithLM];
+	std::vector<int> &members = submaps[stored.submap].landmarks;
+	members.erase(std::remove(members.begin(), members.end(), ithLM), members.end());
+	int row = addSlot(ithLM);
+	for (int i = 0; i < 4; ++i) {
+		gsl_matrix_set(this->state, row + i, 0, stored.position[i]);
+		gsl_matrix_set(this->predstate, row + i, 0, stored.position[i]);
+		for (int j = i; j < 4; ++j) {
+			this->P.set(row + i, row + j, stored.covariance[i][j]);
+		}
+	}
+}
+
+/**
+ * The map is kept in global coordinates, so a stored landmark needs no transform to be sent or merged. The robot
+ * keeps its pose and variances, only its correlations with the stored landmarks are dropped, which is what bounds the
+ * filter to the landmarks of one submap. The transform between the origins is kept with the submap.
+ */
+void Map::closeSubmap() {
+	if (slotLandmarks.empty()) {
+		// nothing to store, the submap only starts again from here
+		for (int i = 0; i < 3; ++i) submapOrigin[i] = gsl_matrix_get(this->state, i, 0);
+		submapTravelled = 0;
+		return;
+	}
+	Submap submap;
+	memcpy(submap.origin, this->submapOrigin, sizeof(submap.origin));
+	double dx = gsl_matrix_get(this->state, 0, 0) - submapOrigin[0];
+	double dy = gsl_matrix_get(this->state, 1, 0) - submapOrigin[1];
+	submap.transform[0] = cos(submapOrigin[2]) * dx + sin(submapOrigin[2]) * dy;
+	submap.transform[1] = -sin(submapOrigin[2]) * dx + cos(submapOrigin[2]) * dy;
+	submap.transform[2] = normalizeAngle(gsl_matrix_get(this->state, 2, 0) - submapOrigin[2]);
+	for (int slot = 0; slot < (int) slotLandmarks.size(); ++slot) {
+		int ithLM = slotLandmarks[slot];
+		StoredLandmark &stored = storedLandmarks[ithLM];
+		int row = rowOf(ithLM);
+		for (int i = 0; i < 4; ++i) {
+			stored.position[i] = gsl_matrix_get(this->state, row + i, 0);
+			for (int j = 0; j < 4; ++j) {
+				stored.covariance[i][j] = this->P.get(row + i, row + j);
+			}
+		}
+		stored.submap = submaps.size();
+		landmarkSlots[ithLM] = -1;
+		submap.landmarks.push_back(ithLM);
+	}
+	slotLandmarks.clear();
+	resizeState(3);
+	gsl_matrix_memcpy(this->predstate, this->state);
+	submaps.push_back(submap);
+	for (int i = 0; i < 3; ++i) submapOrigin[i] = gsl_matrix_get(this->state, i, 0);
+	submapTravelled = 0;
+	printf("submap %d closed with %d landmarks\n", (int) submaps.size() - 1, (int) submap.landmarks.size());
+}
+
+void Map::checkSubmap() {
+	if ((submapLandmarks > 0 && (int) slotLandmarks.size() >= submapLandmarks)
+			|| (submapDistance > 0 && submapTravelled >= submapDistance)) {
+		closeSubmap();
+	}
+}
+
+void Map::resetSlots() {
+	landmarkSlots.resize(this->mapSize);
+	slotLandmarks.resize(this->mapSize);
+	for (int var = 0; var < this->mapSize; ++var) {
+		landmarkSlots[var] = slotLandmarks[var] = var;
+	}
+	storedLandmarks.resize(this->mapSize);
+	submaps.clear();
+	for (int i = 0; i < 3; ++i) submapOrigin[i] = gsl_matrix_get(this->state, i, 0);
+	submapTravelled = 0;
+}
+
+/**
+ * Cholesky factor S=L*L' of the 4x4 innovation covariance S, unrolled, it is always 4x4. The lower triangle of L is
+ * stored row by row in l, but with the reciprocal of the diagonal, so the solves do not divide. Returns false if S is
+ * not positive definite.
+ */
+static bool cholesky4(const gsl_matrix *S, double l[10]) {
+	double d = gsl_matrix_get(S, 0, 0);
+	if (!(d > 0)) return false;
+	double l00 = sqrt(d), i00 = 1.0 / l00;
+	double l10 = gsl_matrix_get(S, 1, 0) * i00;
+	double l20 = gsl_matrix_get(S, 2, 0) * i00;
+	double l30 = gsl_matrix_get(S, 3, 0) * i00;
+	d = gsl_matrix_get(S, 1, 1) - l10 * l10;
+	if (!(d > 0)) return false;
+	double i11 = 1.0 / sqrt(d);
+	double l21 = (gsl_matrix_get(S, 2, 1) - l20 * l10) * i11;
+	double l31 = (gsl_matrix_get(S, 3, 1) - l30 * l10) * i11;
+	d = gsl_matrix_get(S, 2, 2) - l20 * l20 - l21 * l21;
+	if (!(d > 0)) return false;
+	double i22 = 1.0 / sqrt(d);
+	double l32 = (gsl_matrix_get(S, 3, 2) - l30 * l20 - l31 * l21) * i22;
+	d = gsl_matrix_get(S, 3, 3) - l30 * l30 - l31 * l31 - l32 * l32;
+	if (!(d > 0)) return false;
+	double i33 = 1.0 / sqrt(d);
+	l[0] = i00;
+	l[1] = l10; l[2] = i11;
+	l[3] = l20; l[4] = l21; l[5] = i22;
+	l[6] = l30; l[7] = l31; l[8] = l32; l[9] = i33;
+	return true;
+}
+
+/**
+ * Solve x*S=b for the row b, which is S*x'=b' as S is symmetric, with the factor of cholesky4: L*y=b' forward and
+ * L'*x'=y backward.
+ */
+static inline void solve4(const double l[10], const double *b, double *x) {
+	double y0 = b[0] * l[0];
+	double y1 = (b[1] - l[1] * y0) * l[2];
+	double y2 = (b[2] - l[3] * y0 - l[4] * y1) * l[5];
+	double y3 = (b[3] - l[6] * y0 - l[7] * y1 - l[8] * y2) * l[9];
+	x[3] = y3 * l[9];
+	x[2] = (y2 - l[8] * x[3]) * l[5];
+	x[1] = (y1 - l[4] * x[2] - l[7] * x[3]) * l[2];
+	x[0] = (y0 - l[1] * x[1] - l[3] * x[2] - l[6] * x[3]) * l[0];
+}
+
 void Map::filter(double robpos[], float measuredpos[]) {
 
 	int timechanged = this->time - time;
@@ -141,10 +364,11 @@ void Map::filter(double robpos[], float measuredpos[]) {
 
 //	printf("%1.10f , %1.10f , %1.10f\n",changedx,changedy,changedphi);
 	memcpy(this->odometry, robpos, 10 * sizeof(double));
+	submapTravelled += sqrt(changedx * changedx + changedy * changedy);
 
 	gsl_matrix_memcpy(this->predstate, this->state);
 
-	int pocetprvku = this->mapSize * 4 + 3;
+	int pocetprvku = filterSize();
 	gsl_matrix_set(this->predstate, 0, 0,
 			gsl_matrix_get(this->state, 0, 0) + (changedx));
 	gsl_matrix_set(this->predstate, 1, 0,
@@ -154,9 +378,7 @@ void Map::filter(double robpos[], float measuredpos[]) {
 	gsl_matrix_set(this->predstate, 2, 0,
 			normalizeAngle(gsl_matrix_get(this->predstate, 2, 0)));
 
-	//6    predP=G*P*G' + F'*R*F'
-
-	gsl_matrix_memcpy(this->predP, this->P);
+	//6    predP=G*P*G' + F'*R*F', in place in P, as the update starts from predP and P is not needed any more
 
 	//robpos[3] je dL
 	//robpos[4] je dR
@@ -169,19 +391,11 @@ void Map::filter(double robpos[], float measuredpos[]) {
 	 double sigma2phi = (2/(b*b))*ODOMETRY_DR_VARIANCE;
 	 */
 
-	gsl_matrix_set(this->predP, 0, 0,
-			gsl_matrix_get(this->P, 0, 0) + odometry_covariance[0]);
-	gsl_matrix_set(this->predP, 1, 1,
-			gsl_matrix_get(this->P, 1, 1) + odometry_covariance[1]);
-	gsl_matrix_set(this->predP, 2, 2,
-			gsl_matrix_get(this->P, 2, 2) + odometry_covariance[2]);
-	//	printMatrix(this->predP);
+	this->P.addDiagonal(0, odometry_covariance, 3);
 
 	if (PRINT_MATRICES) {
-		printf("P:\n");
-		printMatrix(this->P);
 		printf("predP:\n");
-		printMatrix(this->predP);
+		printMatrix(this->P);
 		printf("predState:\n");
 		printMatrix(this->predstate);
 
@@ -210,16 +424,21 @@ void Map::filter(double robpos[], float measuredpos[]) {
 	float vzdalenost;
 	float vzdalenostold = 10;
 	int var;
-	for (var = 0; var < this->mapSize; ++var) {
+	// only the circles near the measurement are candidates, in the order of the map like before the grid
+	std::vector<int> candidates;
+	landmarkGrid.query(NORMAL_CIRCLE, measuredToCenterX, measuredToCenterY, TOLERANCE, candidates);
+	landmarkGrid.query(DOCK_CIRCLE, measuredToCenterX, measuredToCenterY, TOLERANCE, candidates);
+	landmarkGrid.query(DOCK_CIRCLE_ORGANISM, measuredToCenterX, measuredToCenterY, TOLERANCE, candidates);
+	std::sort(candidates.begin(), candidates.end());
+	for (int candidate = 0; candidate < (int) candidates.size(); ++candidate) {
+		var = candidates[candidate];
 		float vzdalenost = pow(
 				pow(
 						measuredToCenterX
-								- gsl_matrix_get(this->predstate, var * 4 + 3,
-										0), 2)
+								- landmarkElement(var, 0), 2)
 						+ pow(
 								measuredToCenterY
-										- gsl_matrix_get(this->predstate,
-												var * 4 + 4, 0), 2), 0.5);
+										- landmarkElement(var, 1), 2), 0.5);
 		if ((this->mappedObjectTypes[var + 1] == NORMAL_CIRCLE
 				|| this->mappedObjectTypes[var + 1] == DOCK_CIRCLE|| this->mappedObjectTypes[var + 1] == DOCK_CIRCLE_ORGANISM)
 				&& vzdalenost < TOLERANCE) {
@@ -243,6 +462,11 @@ void Map::filter(double robpos[], float measuredpos[]) {
 			}
 		}
 	}
+	// a landmark of a closed submap that is seen again goes back into the filter
+	if (!mapatoNEobsahuje && landmarkSlots[pozicevmape] == -1) {
+		activate(pozicevmape);
+		pocetprvku = filterSize();
+	}
 	//odometry phi just for shorter write
 	double predictedPhi = gsl_matrix_get(this->predstate, 2, 0);
 
@@ -263,176 +487,121 @@ void Map::filter(double robpos[], float measuredpos[]) {
 			printf("velikost mapy %d \n", this->mapSize);
 
 		}
-		int oldsize = 4 * (this->mapSize - 1) + 3;
-		int newsize = 4 * (this->mapSize) + 3;
+		int oldsize = filterSize();
+		addSlot(pozicevmape);
+		int newsize = filterSize();
 		pocetprvku = newsize;
-		gsl_matrix *newstate = gsl_matrix_alloc(newsize, 1);
-		gsl_matrix *newpredstate = gsl_matrix_alloc(newsize, 1);
-		gsl_matrix *newP = gsl_matrix_calloc(newsize, newsize);
-		gsl_matrix *newpredP = gsl_matrix_calloc(newsize, newsize);
-		int var, var2;
-		for (var = 0; var < oldsize; ++var) {
-			gsl_matrix_set(newstate, var, 0,
-					gsl_matrix_get(this->state, var, 0));
-			gsl_matrix_set(newpredstate, var, 0,
-					gsl_matrix_get(this->predstate, var, 0));
-			for (var2 = 0; var2 < oldsize; ++var2) {
-				gsl_matrix_set(newP, var, var2,
-						gsl_matrix_get(this->P, var, var2));
-				gsl_matrix_set(newpredP, var, var2,
-						gsl_matrix_get(this->predP, var, var2));
-			}
-		}
 
-		//setting new state and predicted state values
-		int i = 0;
-		gsl_matrix_set(newstate, pozicevmape * 4 + 3, 0, measuredToCenterX);
-		gsl_matrix_set(newpredstate, pozicevmape * 4 + 3, 0, measuredToCenterX);
-		gsl_matrix_set(newstate, pozicevmape * 4 + 4, 0, measuredToCenterY);
-		gsl_matrix_set(newpredstate, pozicevmape * 4 + 4, 0, measuredToCenterY);
+		//setting new state and predicted state values, the new slot starts at oldsize
+		gsl_matrix_set(this->state, oldsize, 0, measuredToCenterX);
+		gsl_matrix_set(this->predstate, oldsize, 0, measuredToCenterX);
+		gsl_matrix_set(this->state, oldsize + 1, 0, measuredToCenterY);
+		gsl_matrix_set(this->predstate, oldsize + 1, 0, measuredToCenterY);
 
-		gsl_matrix_set(newstate, pozicevmape * 4 + 5, 0, measuredToCenterPHI);
-		gsl_matrix_set(newpredstate, pozicevmape * 4 + 5, 0,
+		gsl_matrix_set(this->state, oldsize + 2, 0, measuredToCenterPHI);
+		gsl_matrix_set(this->predstate, oldsize + 2, 0,
 				measuredToCenterPHI);
-		gsl_matrix_set(newstate, pozicevmape * 4 + 6, 0, measuredToCenterZ);
-		gsl_matrix_set(newpredstate, pozicevmape * 4 + 6, 0, measuredToCenterZ);
+		gsl_matrix_set(this->state, oldsize + 3, 0, measuredToCenterZ);
+		gsl_matrix_set(this->predstate, oldsize + 3, 0, measuredToCenterZ);
+		landmarkGrid.insert(pozicevmape, mappedObjectTypes[pozicevmape + 1], measuredToCenterX, measuredToCenterY);
 
 		if (PRINT_MATRICES) {
 			printf("new state:\n");
-			printMatrix(newstate);
+			printMatrix(this->state);
 			printf("new predictedstate:\n");
-			printMatrix(newpredstate);
+			printMatrix(this->predstate);
 		}
-		i = 0;
 
-		gsl_matrix *Pll = gsl_matrix_calloc(4, 4);
-		gsl_matrix *Plx = gsl_matrix_calloc(4, oldsize);
 		//jacoby matrix of measuredToCenter=g(robpos,measuredpos) by robpos
-		gsl_matrix *Gr = gsl_matrix_calloc(4, 3);
+		Matrix43 Gr;
+		Gr.zero();
 		////jacoby matrix of measuredToCenter=g(robpos,measuredpos) by measuredpos
-		gsl_matrix *Gw = gsl_matrix_calloc(4, 4);
+		Matrix44 Gw;
+		Gw.zero();
 
 		//setting parts of jacobian Gr which is derivation of relative position by robot
-		gsl_matrix_set(Gr, 0, 0, 1);
-		gsl_matrix_set(Gr, 1, 1, 1);
-		gsl_matrix_set(Gr, 0, 2,
-				-sin(predictedPhi) * measuredpos[0]
-						- cos(predictedPhi) * measuredpos[1]);
-		gsl_matrix_set(Gr, 1, 2,
-				cos(predictedPhi) * measuredpos[0]
-						- sin(predictedPhi) * measuredpos[1]);
-		gsl_matrix_set(Gr, 2, 2, 1);
+		Gr(0, 0) = 1;
+		Gr(1, 1) = 1;
+		Gr(0, 2) = -sin(predictedPhi) * measuredpos[0]
+				- cos(predictedPhi) * measuredpos[1];
+		Gr(1, 2) = cos(predictedPhi) * measuredpos[0]
+				- sin(predictedPhi) * measuredpos[1];
+		Gr(2, 2) = 1;
 		//setting parts of jacobian Gw which is derivation of relative position by mapped position
-		gsl_matrix_set(Gw, 0, 0, cos(predictedPhi));
-		gsl_matrix_set(Gw, 0, 1, -sin(predictedPhi));
-		gsl_matrix_set(Gw, 1, 0, sin(predictedPhi));
-		gsl_matrix_set(Gw, 1, 1, cos(predictedPhi));
-		gsl_matrix_set(Gw, 2, 2, 1);
-		gsl_matrix_set(Gw, 3, 3, 1);
+		Gw(0, 0) = cos(predictedPhi);
+		Gw(0, 1) = -sin(predictedPhi);
+		Gw(1, 0) = sin(predictedPhi);
+		Gw(1, 1) = cos(predictedPhi);
+		Gw(2, 2) = 1;
+		Gw(3, 3) = 1;
 
 		if (PRINT_MATRICES) {
 			printf("Q:\n");
 			printMatrix(this->Q);
 			printf("Gr:\n");
-			printMatrix(Gr);
+			gsl_matrix_view GrView = Gr.view();
+			printMatrix(&GrView.matrix);
 			printf("Gw:\n");
-			printMatrix(Gw);
+			gsl_matrix_view GwView = Gw.view();
+			printMatrix(&GwView.matrix);
 
 			printf("predictedP:\n");
-			printMatrix(predP);
-		}
-
-		//Pll=Gr*predictedP(0:2,0:2)*Gr'+Gw*R*Gw'
-		gsl_matrix *Gw_Q = gsl_matrix_calloc(4, 4);
-		//Gw*Q
-
-		gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, Gw, this->Q, 0.0, Gw_Q);
-		gsl_matrix *Gw_Q_Gwt = gsl_matrix_calloc(4, 4);
-		//Gw*Q*Gw'
-		gsl_blas_dgemm(CblasNoTrans, CblasTrans, 1.0, Gw_Q, Gw, 0.0, Gw_Q_Gwt);
-		gsl_matrix *Gr_predP = gsl_matrix_calloc(4, 3);
-		//submatrix of P
-		gsl_matrix_view P0_20_2 = gsl_matrix_submatrix(this->predP, 0, 0, 3, 3);
-		//Gr*predictedP(0:2,0:2)
-		gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, Gr, &P0_20_2.matrix,
-				0.0, Gr_predP);
-		gsl_matrix *Gr_predP_Grt = gsl_matrix_calloc(4, 4);
-		//Gw*R*Gw'
-
-		gsl_blas_dgemm(CblasNoTrans, CblasTrans, 1.0, Gr_predP, Gr, 0.0,
-				Gr_predP_Grt);
-		//Pll=Gr*predictedP(0:2,0:2)*Gr'+Gw*Q*Gw'
-		gsl_matrix_add(Pll, Gr_predP_Grt);
-		gsl_matrix_add(Pll, Gw_Q_Gwt);
-
-		gsl_matrix_view P0_20_end = gsl_matrix_submatrix(this->predP, 0, 0, 3,
-				oldsize);
-		gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, Gr, &P0_20_end.matrix,
-				0.0, Plx);
-		if (PRINT_MATRICES) {
-			printf("Plx:\n");
-			printMatrix(Plx);
-			printf("Pll:\n");
-			printMatrix(Pll);
+			printMatrix(this->P);
 		}
 
-		//setting new covariance and predicted covariance values
-		for (var = 0; var < 4; ++var) {
-
-			for (var2 = 0; var2 < oldsize; ++var2) {
-				gsl_matrix_set(newpredP, oldsize + var, var2,
-						gsl_matrix_get(Plx, var, var2));
-				gsl_matrix_set(newpredP, var2, var + oldsize,
-						gsl_matrix_get(Plx, var, var2));
-			}
-
-			for (var2 = 0; var2 < 4; ++var2) {
-				gsl_matrix_set(newpredP, var + oldsize, var2 + oldsize,
-						gsl_matrix_get(Pll, var, var2));
-			}
-
+		//Pll=Gr*predictedP(0:2,0:2)*Gr'+Gw*Q*Gw', all on the stack
+		Matrix33 predP_rr;
+		for (int i = 0; i < 3; ++i)
+			for (int j = 0; j < 3; ++j)
+				predP_rr(i, j) = this->P.get(i, j);
+		Matrix44 q;
+		q.load(this->Q);
+		Matrix44 Pll = multiplyTransposed(Gr * predP_rr, Gr);
+		Pll += multiplyTransposed(Gw * q, Gw);
+
+		//Plx=Gr*predictedP(0:2,:) goes straight into the new columns of P, which are its new rows as well
+		Vector3 column;
+		covariance_t *newColumns[4];
+		for (int var2 = 0; var2 < 4; ++var2) newColumns[var2] = this->P.column(oldsize + var2);
+		for (var = 0; var < oldsize; ++var) {
+			for (int i = 0; i < 3; ++i) column(i, 0) = this->P.get(i, var);
+			Vector4 row = Gr * column;
+			for (int var2 = 0; var2 < 4; ++var2) newColumns[var2][var] = (covariance_t) row(var2, 0);
 		}
+		for (int i = 0; i < 4; ++i)
+			for (int j = i; j < 4; ++j)
+				this->P.set(oldsize + i, oldsize + j, Pll(i, j));
 		if (PRINT_MATRICES) {
+			printf("Pll:\n");
+			gsl_matrix_view PllView = Pll.view();
+			printMatrix(&PllView.matrix);
 			printf("newpredP:\n");
-			printMatrix(newpredP);
-			printf("newP:\n");
-			printMatrix(newP);
+			printMatrix(this->P);
 		}
 
-		//dealocationg old matrices
-		gsl_matrix_free(this->state);
-		gsl_matrix_free(this->predstate);
-		gsl_matrix_free(this->P);
-		gsl_matrix_free(this->predP);
-		gsl_matrix_free(Gr);
-		gsl_matrix_free(Gw);
-		gsl_matrix_free(Gw_Q);
-		gsl_matrix_free(Gw_Q_Gwt);
-		gsl_matrix_free(Gr_predP);
-		gsl_matrix_free(Gr_predP_Grt);
-		gsl_matrix_free(Pll);
-		gsl_matrix_free(Plx);
-		//setting new matrices
-		this->state = newstate;
-		this->predstate = newpredstate;
-		this->P = newP;
-		this->predP = newpredP;
-
 		gsl_matrix_memcpy(this->state, this->predstate);
-		gsl_matrix_memcpy(this->P, this->predP);
 
+		touch(pozicevmape);
+		checkSubmap();
 		return;
 	}
 
-	//creating kalmans gain matrix
-	gsl_matrix *K = gsl_matrix_calloc(pocetprvku, 4);
-	//creating jacobi matrix enlarged to size of state
-	gsl_matrix *H = gsl_matrix_calloc(4, pocetprvku);
+	/*
+	 * The measurement only depends on the robot pose (columns 0..2 of H) and on the landmark that is seen (columns
+	 * rowOf(pozicevmape)..+3), so H is kept as the 4x7 matrix h of these columns and only the matching columns of predP
+	 * are used. With predP symmetric H*predP is predP_Ht', so the update of the covariance is the rank 4 correction
+	 * P=predP-K*predP_Ht', which costs O(n^2) instead of the O(n^3) of (I-K*H)*predP. The matrices are workspaces of
+	 * the map, so nothing is allocated here. predP is P, it is updated in place.
+	 */
+	int landmark = rowOf(pozicevmape);
+	gsl_matrix *h = this->hWork;
+	gsl_matrix_set_zero(h);
+	gsl_matrix_view hr = gsl_matrix_submatrix(h, 0, 0, 4, 3);
+	gsl_matrix_view hl = gsl_matrix_submatrix(h, 0, 3, 4, 4);
 
-	//creating jacobi matrix enlarged to size of state
-	double rozdilx = gsl_matrix_get(this->predstate, pozicevmape * 4 + 3, 0)
+	double rozdilx = gsl_matrix_get(this->predstate, landmark, 0)
 			- gsl_matrix_get(this->predstate, 0, 0);
-	double rozdily = gsl_matrix_get(this->predstate, pozicevmape * 4 + 4, 0)
+	double rozdily = gsl_matrix_get(this->predstate, landmark + 1, 0)
 			- gsl_matrix_get(this->predstate, 1, 0);
 	if (PRINT_MATRICES) {
 		printf("rozdilx:\n %2.6f \n", rozdilx);
@@ -440,58 +609,70 @@ void Map::filter(double robpos[], float measuredpos[]) {
 		printf("predictedPhi:\n %2.6f \n", predictedPhi);
 	}
 
-	gsl_matrix_set(H, 0, 0, -cos(-predictedPhi));
-	gsl_matrix_set(H, 1, 0, -sin(-predictedPhi));
-	gsl_matrix_set(H, 0, 1, sin(-predictedPhi));
-	gsl_matrix_set(H, 1, 1, -cos(-predictedPhi));
-	gsl_matrix_set(H, 0, 2,
+	gsl_matrix_set(h, 0, 0, -cos(-predictedPhi));
+	gsl_matrix_set(h, 1, 0, -sin(-predictedPhi));
+	gsl_matrix_set(h, 0, 1, sin(-predictedPhi));
+	gsl_matrix_set(h, 1, 1, -cos(-predictedPhi));
+	gsl_matrix_set(h, 0, 2,
 			sin(-predictedPhi) * rozdilx + cos(-predictedPhi) * rozdily);
-	gsl_matrix_set(H, 1, 2,
+	gsl_matrix_set(h, 1, 2,
 			-cos(-predictedPhi) * rozdilx + sin(-predictedPhi) * rozdily);
-	gsl_matrix_set(H, 2, 2, -1);
-	gsl_matrix_set(H, 0, 4 * pozicevmape + 3, cos(-predictedPhi));
-	gsl_matrix_set(H, 1, 4 * pozicevmape + 3, sin(-predictedPhi));
-	gsl_matrix_set(H, 0, 4 * pozicevmape + 4, -sin(-predictedPhi));
-	gsl_matrix_set(H, 1, 4 * pozicevmape + 4, cos(-predictedPhi));
-	gsl_matrix_set(H, 2, 4 * pozicevmape + 5, 1);
-	gsl_matrix_set(H, 2, 4 * pozicevmape + 5, 1);
-	gsl_matrix_set(H, 3, 4 * pozicevmape + 6, 1);
+	gsl_matrix_set(h, 2, 2, -1);
+	gsl_matrix_set(h, 0, 3, cos(-predictedPhi));
+	gsl_matrix_set(h, 1, 3, sin(-predictedPhi));
+	gsl_matrix_set(h, 0, 4, -sin(-predictedPhi));
+	gsl_matrix_set(h, 1, 4, cos(-predictedPhi));
+	gsl_matrix_set(h, 2, 5, 1);
+	gsl_matrix_set(h, 3, 6, 1);
 	if (PRINT_MATRICES) {
-		printf("H:\n");
-		printMatrix(H);
-	}
-	//K=(predictedP*(H'))/(H*predictedP*(H')+Q);
-	gsl_matrix *predP_Ht = gsl_matrix_calloc(pocetprvku, 4);
-	//predictedP*(H')
-	gsl_blas_dgemm(CblasNoTrans, CblasTrans, 1.0, this->predP, H, 0.0,
-			predP_Ht);
-	gsl_matrix *H_predP_Ht_Q = gsl_matrix_calloc(4, 4);
-	//H*predictedP*(H')
-	gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, H, predP_Ht, 0.0,
+		printf("H (robot and landmark columns):\n");
+		printMatrix(h);
+	}
+	//predictedP*(H')=predictedP(:,robot)*hr'+predictedP(:,landmark)*hl', row by row from the 7 columns of predP
+	gsl_matrix_view predP_Ht_view = gsl_matrix_submatrix(this->predP_HtBlock, 0, 0, pocetprvku, 4);
+	gsl_matrix *predP_Ht = &predP_Ht_view.matrix;
+	for (var = 0; var < pocetprvku; ++var) {
+		double columns[7];
+		for (int i = 0; i < 3; ++i) columns[i] = this->P.get(var, i);
+		for (int i = 0; i < 4; ++i) columns[3 + i] = this->P.get(var, landmark + i);
+		double *row = gsl_matrix_ptr(predP_Ht, var, 0);
+		for (int k = 0; k < 4; ++k) {
+			const double *hk = gsl_matrix_const_ptr(h, k, 0);
+			double sum = 0;
+			for (int i = 0; i < 7; ++i) sum += columns[i] * hk[i];
+			row[k] = sum;
+		}
+	}
+	//H*predictedP*(H')+Q, only the robot and landmark rows of predictedP*(H') are needed
+	gsl_matrix *H_predP_Ht_Q = this->innovationWork;
+	gsl_matrix_memcpy(H_predP_Ht_Q, this->Q);
+	gsl_matrix_view predP_Ht_r = gsl_matrix_submatrix(predP_Ht, 0, 0, 3, 4);
+	gsl_matrix_view predP_Ht_l = gsl_matrix_submatrix(predP_Ht, landmark, 0, 4, 4);
+	gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, &hr.matrix, &predP_Ht_r.matrix, 1.0,
+			H_predP_Ht_Q);
+	gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, &hl.matrix, &predP_Ht_l.matrix, 1.0,
 			H_predP_Ht_Q);
-	//H*predictedP*(H')+Q
-	gsl_matrix_add(H_predP_Ht_Q, this->Q);
-	//(H*predictedP*(H')+Q)^-1
 	if (PRINT_MATRICES) {
 		printf("H_predP_Ht_Q:\n");
 		printMatrix(H_predP_Ht_Q);
 	}
-	gsl_matrix *invers = gsl_matrix_calloc(4, 4);
-	gsl_permutation * permut = gsl_permutation_alloc(4);
-	int s;
-	gsl_linalg_LU_decomp(H_predP_Ht_Q, permut, &s);
-	gsl_linalg_LU_invert(H_predP_Ht_Q, permut, invers);
-	if (PRINT_MATRICES) {
-		printf("invers:\n");
-		printMatrix(invers);
+	//K=(predictedP*(H'))/(H*predictedP*(H')+Q), solved row by row with the Cholesky factor instead of an inverse
+	double chol[10];
+	if (!cholesky4(H_predP_Ht_Q, chol)) {
+		printf("innovation covariance is not positive definite, measurement ignored\n");
+		gsl_matrix_memcpy(this->state, this->predstate);
+		return;
+	}
+	gsl_matrix_view K_view = gsl_matrix_submatrix(this->KBlock, 0, 0, pocetprvku, 4);
+	gsl_matrix *K = &K_view.matrix;
+	for (var = 0; var < pocetprvku; ++var) {
+		solve4(chol, gsl_matrix_ptr(predP_Ht, var, 0), gsl_matrix_ptr(K, var, 0));
 	}
-
-	gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, predP_Ht, invers, 0.0, K);
 	if (PRINT_MATRICES) {
 		printf("K:\n");
 		printMatrix(K);
 	}
-	gsl_matrix *difference = gsl_matrix_alloc(4, 1);
+	gsl_matrix *difference = this->differenceWork;
 	gsl_matrix_set(difference, 0, 0,
 			measuredpos[0]
 					- (cos(-predictedPhi) * (rozdilx)
@@ -503,11 +684,11 @@ void Map::filter(double robpos[], float measuredpos[]) {
 	gsl_matrix_set(difference, 2, 0,
 			measuredpos[2]
 					- (normalizeAngle(
-							gsl_matrix_get(this->predstate, 4 * pozicevmape + 5,
+							gsl_matrix_get(this->predstate, landmark + 2,
 									0) - predictedPhi)));
 	gsl_matrix_set(difference, 3, 0,
 			measuredpos[3]
-					- gsl_matrix_get(this->predstate, 4 * pozicevmape + 6, 0));
+					- gsl_matrix_get(this->predstate, landmark + 3, 0));
 
 	if (PRINT_MATRICES) {
 
@@ -515,59 +696,26 @@ void Map::filter(double robpos[], float measuredpos[]) {
 		printMatrix(difference);
 	}
 
-	gsl_matrix *newP = gsl_matrix_calloc(mapSize * 4 + 3, mapSize * 4 + 3);
-	gsl_matrix_memcpy(this->state, this->predstate);
-	for (var = 0; var < mapSize * 4 + 3; ++var) {
-		//P=I
-		gsl_matrix_set(newP, var, var, 1);
-	}
-
-	gsl_matrix *K_difference = gsl_matrix_calloc(mapSize * 4 + 3, 1);
-	//K*difference
-	gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, K, difference, 0.0,
-			K_difference);
 	//state=predictedstate+K*difference
+	gsl_matrix_memcpy(this->state, this->predstate);
+	gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, K, difference, 1.0,
+			this->state);
 	if (PRINT_MATRICES) {
 		printf("predictedstate:\n");
 		printMatrix(this->predstate);
-		printf("K_difference:\n");
-		printMatrix(K_difference);
 	}
-	gsl_matrix_add(this->state, K_difference);
 
-	gsl_matrix *K_H = gsl_matrix_calloc(mapSize * 4 + 3, mapSize * 4 + 3);
-	if (PRINT_MATRICES) {
-		printf("newP");
-		printMatrix(newP);
-		printf("K_H:\n");
-		printMatrix(K_H);
-	}
-	//K*H
-	gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, K, H, 0.0, K_H);
-	//P=I-K*H
-	gsl_matrix_sub(newP, K_H);
-	if (PRINT_MATRICES) {
-		printf("newP");
-		printMatrix(newP);
-
-	}
-	//P=(I-K*H)*predP
-	gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, newP, this->predP, 0.0,
-			this->P);
+	//P=(I-K*H)*predP=predP-K*(predP*H')', only the upper triangle
+	this->P.subtractProduct(K, predP_Ht);
 
 	if (PRINT_MATRICES) {
 		printf("P:\n");
 		printMatrix(this->P);
-		printf("predP:\n");
-		printMatrix(this->predP);
 	}
 
-	gsl_matrix_free(newP);
-	gsl_matrix_free(K_difference);
-	gsl_matrix_free(K);
-	gsl_matrix_free(K_H);
-	gsl_matrix_free(predP_Ht);
-	gsl_matrix_free(difference);
+	// the update moves every landmark a bit, only the one that is seen changes enough to be sent again
+	touch(pozicevmape);
+	updateGrid();
 	if (PRINT_ROB_POS) {
 		//printf("robot pos\n");
 		printf("ROBPOS=[ROBPOS [%2.7f ; %2.7f ; %2.7f ; 1 ]]; \n",
@@ -575,8 +723,7 @@ void Map::filter(double robpos[], float measuredpos[]) {
 				gsl_matrix_get(this->state, 1, 0),
 				gsl_matrix_get(this->state, 2, 0));
 		printf("ROBUNCERT=[ROBUNCERT [%2.7f ; %2.7f ; %2.7f]];\n",
-				gsl_matrix_get(this->P, 0, 0), gsl_matrix_get(this->P, 1, 1),
-				gsl_matrix_get(this->P, 2, 2));
+				this->P.get(0, 0), this->P.get(1, 1), this->P.get(2, 2));
 	}
 	if (PRINT_LAND_MARKS) {
 		//printf("velikost mapy je:%d",this->mapSize);
@@ -584,20 +731,16 @@ void Map::filter(double robpos[], float measuredpos[]) {
 //		printf("Psize %d %d \n", this->P->size1, this->P->size2);
 		for (var = 0; var <= this->mapSize - 1; ++var) {
 			printf("LM%d=[LM%d [%2.7f ; %2.7f ; %2.7f ; %2.7f]]; \n", var, var,
-					gsl_matrix_get(this->state, var * 4 + 3, 0),
-					gsl_matrix_get(this->state, var * 4 + 4, 0),
-					gsl_matrix_get(this->state, var * 4 + 5, 0),
-					gsl_matrix_get(this->state, var * 4 + 6, 0));
+					landmarkElement(var, 0), landmarkElement(var, 1),
+					landmarkElement(var, 2), landmarkElement(var, 3));
 			printf(
 					"LM%dUNCERT=[LM%dUNCERT [%2.7f ; %2.7f ; %2.7f ; %2.7f]]; \n",
-					var, var, gsl_matrix_get(this->P, var * 4 + 3, var * 4 + 3),
-					gsl_matrix_get(this->P, var * 4 + 4, var * 4 + 4),
-					gsl_matrix_get(this->P, var * 4 + 5, var * 4 + 5),
-					gsl_matrix_get(this->P, var * 4 + 6, var * 4 + 6));
+					var, var, landmarkVariance(var, 0, 0), landmarkVariance(var, 1, 1),
+					landmarkVariance(var, 2, 2), landmarkVariance(var, 3, 3));
 		}
 
 	}
-
+	checkSubmap();
 }
 
 void Map::odometryChange(double robpos[]) {
@@ -612,6 +755,7 @@ void Map::odometryChange(double robpos[]) {
 	//printf("DR=%f\n",robpos[4]);
 
 	memcpy(this->odometry, robpos, 10 * sizeof(double));
+	submapTravelled += sqrt(changedx * changedx + changedy * changedy);
 	gsl_matrix_set(this->state, 0, 0,
 			gsl_matrix_get(this->state, 0, 0) + (changedx));
 	gsl_matrix_set(this->state, 1, 0,
@@ -630,101 +774,188 @@ void Map::odometryChange(double robpos[]) {
 	 double sigma2phi = (2/(b*b))*ODOMETRY_D_VARIANCE;
 	 */
 
-	gsl_matrix_set(this->P, 0, 0,
-			gsl_matrix_get(this->P, 0, 0) + odometry_covariance[0]);
-	gsl_matrix_set(this->P, 1, 1,
-			gsl_matrix_get(this->P, 1, 1) + odometry_covariance[1]);
-	gsl_matrix_set(this->P, 2, 2,
-			gsl_matrix_get(this->P, 2, 2) + odometry_covariance[2]);
+	this->P.addDiagonal(0, odometry_covariance, 3);
 	if (PRINT_ROB_POS) {
 		printf("ROBPOS=[ROBPOS [%2.7f ; %2.7f ; %2.7f ; 0 ]]; \n",
 				gsl_matrix_get(this->state, 0, 0),
 				gsl_matrix_get(this->state, 1, 0),
 				gsl_matrix_get(this->state, 2, 0));
 		printf("ROBUNCERT=[ROBUNCERT [%2.7f ; %2.7f ; %2.7f]];\n",
-				gsl_matrix_get(this->P, 0, 0), gsl_matrix_get(this->P, 1, 1),
-				gsl_matrix_get(this->P, 2, 2));
+				this->P.get(0, 0), this->P.get(1, 1), this->P.get(2, 2));
 
 	}
 	if (PRINT_LAND_MARKS) {
 		//printf("velikost mapy je:%d",this->mapSize);
 		for (var = 0; var < this->mapSize ; ++var) {
 			printf("LM%d=[LM%d [%2.7f ; %2.7f ; %2.7f ; %2.7f ]]; \n", var, var,
-					gsl_matrix_get(this->state, var * 4 + 3, 0),
-					gsl_matrix_get(this->state, var * 4 + 4, 0),
-					gsl_matrix_get(this->state, var * 4 + 5, 0),
-					gsl_matrix_get(this->state, var * 4 + 6, 0));
+					landmarkElement(var, 0), landmarkElement(var, 1),
+					landmarkElement(var, 2), landmarkElement(var, 3));
 			printf(
 					"LM%dUNCERT=[LM%dUNCERT [%2.7f ; %2.7f ; %2.7f ; %2.7f ]]; \n",
-					var, var, gsl_matrix_get(this->P, var * 4 + 3, var * 4 + 3),
-					gsl_matrix_get(this->P, var * 4 + 4, var * 4 + 4),
-					gsl_matrix_get(this->P, var * 4 + 5, var * 4 + 5),
-					gsl_matrix_get(this->P, var * 4 + 6, var * 4 + 6));
+					var, var, landmarkVariance(var, 0, 0), landmarkVariance(var, 1, 1),
+					landmarkVariance(var, 2, 2), landmarkVariance(var, 3, 3));
 		}
 
 	}
+	checkSubmap();
 }
 
+/**
+ * The file is mapped and checked, the state and the covariance are then filled from it without parsing anything. The
+ * caller frees the state and deletes the covariance of the result, they are NULL if the file could not be read.
+ */
 MapData Map::readFromFile(const char* filename) {
-	FILE * file;
 	MapData data;
-	if (file = fopen(filename, "rb")) {
-
-		int mmap = 0;
-		int nmap = 0;
-		int mcov = 0;
-		int ncov = 0;
-		fscanf(file, "%u\n", &mmap);
-		fscanf(file, "%u\n\n", &nmap);
-		gsl_matrix * map = gsl_matrix_alloc(mmap, nmap);
-		gsl_matrix_fscanf(file, map);
-		fscanf(file, "\n%u\n", &mcov);
-		fscanf(file, "%u\n", &ncov);
-		gsl_matrix * covariance = gsl_matrix_alloc(mcov, ncov);
-		gsl_matrix_fscanf(file, covariance);
-		fscanf(file, "\n");
-		int typeSize = (mmap - 3) / 4 + 1;
-		std::vector<MapObjectType> mappedTypes;
-		for (int var = 0; var < typeSize; ++var) {
-			fscanf(file, "%lu\n", &mappedTypes[var]);
-		}
-		fclose(file);
-		data.map = map;
-		data.covariance = covariance;
-		data.mappedObjectTypes = mappedTypes;
+	data.map = NULL;
+	data.covariance = NULL;
+	int fd = open(filename, O_RDONLY);
+	struct stat info;
+	if (fd < 0 || fstat(fd, &info) != 0 || info.st_size < (off_t) sizeof(MapFileHeader)) {
+		printf("can not read map from file %s \n", filename);
+		if (fd >= 0) close(fd);
 		return data;
-	} else {
-		printf("can not read matrix from file %s \n", filename);
-		data.map = NULL;
-		data.covariance = NULL;
+	}
+	void *address = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (address == MAP_FAILED) {
+		printf("can not map file %s \n", filename);
 		return data;
 	}
-
+	const char *file = (const char*) address;
+	const MapFileHeader *header = (const MapFileHeader*) file;
+	uint32_t n = header->size;
+	size_t value = (header->flags & MAP_FILE_FLOAT) ? sizeof(float) : sizeof(double);
+	if (header->magic != MAP_FILE_MAGIC || header->version != MAP_FILE_VERSION
+			|| header->file_size != (uint32_t) info.st_size || n < 3 || (n - 3) % 4 != 0
+			|| header->types != (n - 3) / 4 + 1 || header->state_offset % 8 != 0
+			|| header->covariance_offset % 8 != 0
+			|| header->types_offset + header->types > info.st_size
+			|| header->state_offset + (size_t) n * sizeof(double) > (size_t) info.st_size
+			|| header->covariance_offset + mapFileTriangle(n) * value > (size_t) info.st_size) {
+		printf("%s is not a map file of version %d \n", filename, MAP_FILE_VERSION);
+		munmap(address, info.st_size);
+		return data;
+	}
+	for (uint32_t var = 0; var < header->types; ++var) {
+		data.mappedObjectTypes.push_back((MapObjectType) (uint8_t) file[header->types_offset + var]);
+	}
+	data.map = gsl_matrix_alloc(n, 1);
+	memcpy(data.map->data, file + header->state_offset, n * sizeof(double));
+	data.covariance = new PackedCovariance();
+	data.covariance->resize(n);
+	const double *upper = (const double*) (file + header->covariance_offset);
+	const float *upperf = (const float*) upper;
+	uint32_t index = 0;
+	for (uint32_t row = 0; row < n; ++row) {
+		for (uint32_t col = row; col < n; ++col, ++index) {
+			data.covariance->set(row, col, (header->flags & MAP_FILE_FLOAT) ? upperf[index] : upper[index]);
+		}
+	}
+	munmap(address, info.st_size);
+	return data;
 }
 
-int Map::writeToFile(const char* filename, MapData data) {
-	FILE * file;
-	if (file = fopen(filename, "wb")) {
-		fprintf(file, "%lu\n", data.map->size1);
-		fprintf(file, "%lu\n\n", data.map->size2);
-		gsl_matrix_fprintf(file, data.map, "%g");
-		fprintf(file, "\n");
-		fprintf(file, "%lu\n", data.covariance->size1);
-		fprintf(file, "%lu\n\n", data.covariance->size2);
-		gsl_matrix_fprintf(file, data.covariance, "%g");
-		fprintf(file, "\n");
-		for (int var = 0; var < data.mappedObjectTypes.size(); ++var) {
-			fprintf(file, "%lu\n", data.mappedObjectTypes[var]);
+/**
+ * The file is written next to filename and renamed when it is complete, so a robot that is switched off while it
+ * writes still has the previous map. With single the covariance is stored as float, which halves the file.
+ */
+int Map::writeToFile(const char* filename, MapData data, bool single) {
+	uint32_t n = data.map->size1;
+	MapFileHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = MAP_FILE_MAGIC;
+	header.version = MAP_FILE_VERSION;
+	header.flags = single ? MAP_FILE_FLOAT : 0;
+	header.size = n;
+	header.types = data.mappedObjectTypes.size();
+	header.types_offset = sizeof(MapFileHeader);
+	header.state_offset = mapFileAlign(header.types_offset + header.types);
+	header.covariance_offset = mapFileAlign(header.state_offset + n * sizeof(double));
+	header.file_size = header.covariance_offset + mapFileTriangle(n) * (single ? sizeof(float) : sizeof(double));
+
+	std::string temporary = std::string(filename) + ".tmp";
+	FILE * file = fopen(temporary.c_str(), "wb");
+	if (file == NULL) {
+		printf("can not write map to file %s \n", filename);
+		return 1;
+	}
+	// the header, the types and the state are small, they go through one buffer up to the covariance
+	std::vector<char> head(header.covariance_offset, 0);
+	memcpy(&head[0], &header, sizeof(header));
+	for (uint32_t var = 0; var < header.types; ++var) {
+		head[header.types_offset + var] = (char) data.mappedObjectTypes[var];
+	}
+	for (uint32_t var = 0; var < n; ++var) {
+		double element = gsl_matrix_get(data.map, var, 0);
+		memcpy(&head[header.state_offset + var * sizeof(double)], &element, sizeof(double));
+	}
+	bool written = (fwrite(&head[0], 1, head.size(), file) == head.size());
+	// P stores the upper triangle by columns, the file has it by rows, a row is gathered into one buffer
+	std::vector<double> rowd(single ? 0 : n);
+	std::vector<float> rowf(single ? n : 0);
+	for (uint32_t row = 0; row < n && written; ++row) {
+		if (single) {
+			for (uint32_t col = row; col < n; ++col) rowf[col - row] = (float) data.covariance->get(row, col);
+			written = (fwrite(&rowf[0], sizeof(float), n - row, file) == n - row);
+		} else {
+			for (uint32_t col = row; col < n; ++col) rowd[col - row] = data.covariance->get(row, col);
+			written = (fwrite(&rowd[0], sizeof(double), n - row, file) == n - row);
 		}
-		fprintf(file, "\n");
-		fclose(file);
-		return 0;
-	} else {
-		printf("can not write matrix to file %s \n", filename);
+	}
+	written = (fclose(file) == 0) && written;
+	if (!written || rename(temporary.c_str(), filename) != 0) {
+		printf("can not write map to file %s \n", filename);
+		remove(temporary.c_str());
 		return 1;
 	}
+	return 0;
+}
 
+/**
+ * The landmarks, their types and their covariance come from the file, the robot keeps the pose and the variances it
+ * has now, without correlations to the landmarks, as it may have been moved while the jockey was not running.
+ */
+bool Map::resume(const char* filename) {
+	MapData data = readFromFile(filename);
+	if (data.map == NULL) return false;
+	int n = data.map->size1;
+	this->mapSize = (n - 3) / 4;
+	resetSlots();
+	resizeState(n);
+	gsl_matrix_view landmarks = gsl_matrix_submatrix(data.map, 3, 0, n - 3, 1);
+	gsl_matrix_view stateLandmarks = gsl_matrix_submatrix(this->state, 3, 0, n - 3, 1);
+	if (n > 3) {
+		gsl_matrix_memcpy(&stateLandmarks.matrix, &landmarks.matrix);
+		for (int col = 3; col < n; ++col) {
+			const covariance_t *from = data.covariance->column(col);
+			covariance_t *to = this->P.column(col);
+			for (int row = 0; row < 3; ++row) to[row] = 0;
+			for (int row = 3; row <= col; ++row) to[row] = from[row];
+		}
+	}
+	gsl_matrix_memcpy(this->predstate, this->state);
+	mappedObjectTypes = data.mappedObjectTypes;
+	mappedObjectTypes[0] = ROBOT;
+	landmarkGrid.clear();
+	for (int var = 0; var < this->mapSize; ++var) {
+		landmarkGrid.insert(var, mappedObjectTypes[var + 1], gsl_matrix_get(this->state, var * 4 + 3, 0),
+				gsl_matrix_get(this->state, var * 4 + 4, 0));
+	}
+	mergeMembers.clear();
+	mergeVersions.clear();
+	mergedObjects.clear();
+	landmarkVersions.clear();
+	rebuiltVersion = ++this->version;
+	gsl_matrix_free(data.map);
+	delete data.covariance;
+	printf("resumed %d landmarks from %s\n", this->mapSize, filename);
+	// the landmarks of the file are seen again one by one, like those of a closed submap
+	if (submapLandmarks > 0 || submapDistance > 0) {
+		closeSubmap();
+	}
+	return true;
 }
+
 void Map::printMatrix(gsl_matrix *matrix) {
 	int var, var2;
 	for (var = 0; var < matrix->size1; ++var) {
@@ -734,6 +965,14 @@ void Map::printMatrix(gsl_matrix *matrix) {
 		printf("\n");
 	}
 }
+void Map::printMatrix(const PackedCovariance &matrix) {
+	for (int var = 0; var < matrix.size(); ++var) {
+		for (int var2 = 0; var2 < matrix.size(); ++var2) {
+			printf("%1.4e ", matrix.get(var, var2));
+		}
+		printf("\n");
+	}
+}
 void Map::printArray(double *array, int lenght) {
 	int var;
 	for (var = 0; var < lenght; ++var) {
@@ -892,7 +1131,8 @@ void Map::calculateOdometryCovarianceKB(double dX, double dY, double dPHI) {
 void Map::calculateOdometryCovarianceS(double dL, double dR,
 		double changedphi) {
 	double ODOMETRY_D_VARIANCE = (dL == 0 && dR == 0) ? 0 : 0.0000092871;
-	if (dL != dR) {
+	// the arc divides by the square of dR-dL, a difference of the rounding of the wheel distances is a straight line
+	if (fabs(dR - dL) > SCOUT_STRAIGHT) {
 		//printf("different dL and dR\n");
 		double dRmindLna2 = pow(dR - dL, 2);
 		double dLpdRl2dRmindL = (dL + dR) / (2 * (dR - dL));
@@ -966,24 +1206,20 @@ void Map::calculateOdometryCovarianceS(double dL, double dR,
 MappedObjectPosition Map::getMappedPosition(int ithLM) {
 	//ithLM is from 0 to mapsize-1
 	MappedObjectPosition mappedObject;
+	mappedObject.timestamp = 0;
 	if (ithLM < this->mapSize && ithLM > -1) {
 
 		mappedObject.type = mappedObjectTypes[ithLM + 1];
 		mappedObject.map_id = ithLM;
 		mappedObject.mappedBy = robotID;
-		mappedObject.xPosition = gsl_matrix_get(this->state, ithLM * 4 + 3, 0);
-		mappedObject.yPosition = gsl_matrix_get(this->state, ithLM * 4 + 4, 0);
-		mappedObject.phiPosition = gsl_matrix_get(this->state, ithLM * 4 + 5,
-				0);
-		mappedObject.zPosition = gsl_matrix_get(this->state, ithLM * 4 + 6, 0);
-		mappedObject.xUncertainty = gsl_matrix_get(this->P, ithLM * 4 + 3,
-				ithLM * 4 + 3);
-		mappedObject.yUncertainty = gsl_matrix_get(this->P, ithLM * 4 + 4,
-				ithLM * 4 + 4);
-		mappedObject.phiUncertainty = gsl_matrix_get(this->P, ithLM * 4 + 5,
-				ithLM * 4 + 5);
-		mappedObject.zUncertainty = gsl_matrix_get(this->P, ithLM * 4 + 6,
-				ithLM * 4 + 6);
+		mappedObject.xPosition = landmarkElement(ithLM, 0);
+		mappedObject.yPosition = landmarkElement(ithLM, 1);
+		mappedObject.phiPosition = landmarkElement(ithLM, 2);
+		mappedObject.zPosition = landmarkElement(ithLM, 3);
+		mappedObject.xUncertainty = landmarkVariance(ithLM, 0, 0);
+		mappedObject.yUncertainty = landmarkVariance(ithLM, 1, 1);
+		mappedObject.phiUncertainty = landmarkVariance(ithLM, 2, 2);
+		mappedObject.zUncertainty = landmarkVariance(ithLM, 3, 3);
 	} else {
 
 		mappedObject.type = UNIDENTIFIED;
@@ -992,14 +1228,12 @@ MappedObjectPosition Map::getMappedPosition(int ithLM) {
 	return mappedObject;
 }
 
+//! The array belongs to the map, it was a local array that was gone by the time the caller read it
 double* Map::getRobotPosition() {
-	double* pointer;
-	double robotposition[3];
-	robotposition[0] = gsl_matrix_get(this->state, 0, 0);
-	robotposition[1] = gsl_matrix_get(this->state, 1, 0);
-	robotposition[2] = gsl_matrix_get(this->state, 2, 0);
-	pointer = robotposition;
-	return pointer;
+	robotPosition[0] = gsl_matrix_get(this->state, 0, 0);
+	robotPosition[1] = gsl_matrix_get(this->state, 1, 0);
+	robotPosition[2] = gsl_matrix_get(this->state, 2, 0);
+	return robotPosition;
 }
 
 /**
@@ -1010,19 +1244,32 @@ int Map::nearestTypeID(NearestObjectOfTypeToThisPosition nearestTo) {
 	double dist = DBL_MAX;
 	int var;
 	double position[2] = { nearestTo.xPosition, nearestTo.yPosition };
-	for (var = 0; var < this->mapSize; ++var) {
-
-		MappedObjectPosition actualObj = this->getMappedPosition(var);
-      if (actualObj.xPosition<10.0) {
-		   printf("triing object type %d on pos %f %f \n", actualObj.type,
-				actualObj.xPosition, actualObj.yPosition);
-		   double actual[2] = { actualObj.xPosition, actualObj.yPosition };
-		   double actualdist = euclideanDistance(position, actual);
-		   if (actualObj.type == nearestTo.type && actualdist < dist) {
-			   dist = actualdist;
-			   num = var;
-		   }
-      }
+	// search the grid in growing squares, the nearest object is known once it is within the square
+	std::vector<int> candidates;
+	for (double radius = LANDMARK_GRID_CELL; ; radius *= 2) {
+		candidates.clear();
+		landmarkGrid.query(nearestTo.type, nearestTo.xPosition, nearestTo.yPosition, radius, candidates);
+		num = -1;
+		dist = DBL_MAX;
+		for (int candidate = 0; candidate < (int) candidates.size(); ++candidate) {
+			var = candidates[candidate];
+			MappedObjectPosition actualObj = this->getMappedPosition(var);
+			if (actualObj.xPosition < 10.0) {
+				double actual[2] = { actualObj.xPosition, actualObj.yPosition };
+				double actualdist = euclideanDistance(position, actual);
+				if (actualObj.type == nearestTo.type && actualdist < dist) {
+					dist = actualdist;
+					num = var;
+				}
+			}
+		}
+		if ((num != -1 && dist <= radius)
+				|| landmarkGrid.covers(nearestTo.xPosition, nearestTo.yPosition, radius)) {
+			break;
+		}
+	}
+	if (num != -1) {
+		printf("nearest object of type %d is %d at distance %f\n", nearestTo.type, num, dist);
 	}
 	return num;
 }
@@ -1034,87 +1281,51 @@ int Map::saveObjectToMap(MappedObjectPosition position) {
 	printf("adding object type %d pos %f %f %f %f id %d robid %d\n",position.type,position.xPosition,position.yPosition,
 			position.phiPosition,position.zPosition,position.map_id,position.mappedBy);
 	mappedObjectTypes.push_back(position.type);
-	int oldsize = 4 * (this->mapSize - 1) + 3;
-	int newsize = 4 * (this->mapSize) + 3;
-	gsl_matrix *newstate = gsl_matrix_alloc(newsize, 1);
-	gsl_matrix *newpredstate = gsl_matrix_alloc(newsize, 1);
-	gsl_matrix *newP = gsl_matrix_calloc(newsize, newsize);
-	gsl_matrix *newpredP = gsl_matrix_calloc(newsize, newsize);
-	int var, var2;
+	touch(pozicevmape);
+	addSlot(pozicevmape);
 
-	gsl_matrix_set(newstate, pozicevmape * 4 + 3, 0, position.xPosition);
-	gsl_matrix_set(newpredstate, pozicevmape * 4 + 3, 0, position.xPosition);
-	gsl_matrix_set(newstate, pozicevmape * 4 + 4, 0, position.yPosition);
-	gsl_matrix_set(newpredstate, pozicevmape * 4 + 4, 0, position.yPosition);
-	gsl_matrix_set(newstate, pozicevmape * 4 + 5, 0, position.phiPosition);
-	gsl_matrix_set(newpredstate, pozicevmape * 4 + 5, 0, position.phiPosition);
-	gsl_matrix_set(newstate, pozicevmape * 4 + 6, 0, position.zPosition);
-	gsl_matrix_set(newpredstate, pozicevmape * 4 + 6, 0, position.zPosition);
-
-	if (position.xUncertainty > 0 && position.xUncertainty < 0.05) {
-		gsl_matrix_set(newP, pozicevmape * 4 + 3, pozicevmape * 4 + 3,
-				position.xUncertainty);
-		gsl_matrix_set(newpredP, pozicevmape * 4 + 3, pozicevmape * 4 + 3,
-				position.xUncertainty);
-	} else {
-		gsl_matrix_set(newP, pozicevmape * 4 + 3, pozicevmape * 4 + 3, 0.05);
-		gsl_matrix_set(newpredP, pozicevmape * 4 + 3, pozicevmape * 4 + 3,
-				0.05);
-	}
-	if (position.yUncertainty > 0 && position.yUncertainty < 0.05) {
-		gsl_matrix_set(newP, pozicevmape * 4 + 4, pozicevmape * 4 + 4,
-				position.yUncertainty);
-		gsl_matrix_set(newpredP, pozicevmape * 4 + 4, pozicevmape * 4 + 4,
-				position.yUncertainty);
-	} else {
-		gsl_matrix_set(newP, pozicevmape * 4 + 4, pozicevmape * 4 + 4, 0.05);
-		gsl_matrix_set(newpredP, pozicevmape * 4 + 4, pozicevmape * 4 + 4,
-				0.05);
-	}
-	if (position.phiUncertainty > 0 && position.phiUncertainty < 0.6) {
-		gsl_matrix_set(newP, pozicevmape * 4 + 5, pozicevmape * 4 + 5,
-				position.phiUncertainty);
-		gsl_matrix_set(newpredP, pozicevmape * 4 + 5, pozicevmape * 4 + 5,
-				position.phiUncertainty);
-	} else {
-		gsl_matrix_set(newP, pozicevmape * 4 + 5, pozicevmape * 4 + 5, 0.6);
-		gsl_matrix_set(newpredP, pozicevmape * 4 + 5, pozicevmape * 4 + 5, 0.6);
-	}
-	if (position.zUncertainty > 0 && position.zUncertainty < 0.05) {
-		gsl_matrix_set(newP, pozicevmape * 4 + 6, pozicevmape * 4 + 6,
-				position.zUncertainty);
-		gsl_matrix_set(newpredP, pozicevmape * 4 + 6, pozicevmape * 4 + 6,
-				position.zUncertainty);
-	} else {
-		gsl_matrix_set(newP, pozicevmape * 4 + 6, pozicevmape * 4 + 6, 0.05);
-		gsl_matrix_set(newpredP, pozicevmape * 4 + 6, pozicevmape * 4 + 6,
-				0.05);
-	}
-
-	for (var = 0; var < oldsize; ++var) {
-		gsl_matrix_set(newstate, var, 0, gsl_matrix_get(this->state, var, 0));
-		gsl_matrix_set(newpredstate, var, 0,
-				gsl_matrix_get(this->predstate, var, 0));
-		for (var2 = 0; var2 < oldsize; ++var2) {
-			gsl_matrix_set(newP, var, var2, gsl_matrix_get(this->P, var, var2));
-			gsl_matrix_set(newpredP, var, var2,
-					gsl_matrix_get(this->predP, var, var2));
+	setLandmark(pozicevmape, position, false);
+
+	return pozicevmape;
+}
+
+/**
+ * An independent landmark has no correlation with the robot and the other landmarks anymore, like all landmarks after
+ * a full mergeMap, the averaged variances would not fit the correlations the filter built up.
+ */
+void Map::setLandmark(int ithLM, MappedObjectPosition position, bool independent) {
+	mappedObjectTypes[ithLM + 1] = position.type;
+	landmarkGrid.insert(ithLM, position.type, position.xPosition, position.yPosition);
+	double element[4] = { position.xPosition, position.yPosition, position.phiPosition, position.zPosition };
+	// a variance that is not given or too large gets the limit
+	double variance[4] = { position.xUncertainty, position.yUncertainty, position.phiUncertainty, position.zUncertainty };
+	const double limit[4] = { 0.05, 0.05, 0.6, 0.05 };
+	for (int i = 0; i < 4; ++i) {
+		if (!(variance[i] > 0 && variance[i] < limit[i])) variance[i] = limit[i];
+	}
+	if (landmarkSlots[ithLM] == -1) {
+		StoredLandmark &stored = storedLandmarks[ithLM];
+		for (int i = 0; i < 4; ++i) {
+			stored.position[i] = element[i];
+			if (independent) {
+				for (int j = 0; j < 4; ++j) stored.covariance[i][j] = 0;
+			}
+			stored.covariance[i][i] = variance[i];
 		}
+		return;
+	}
+	int first = rowOf(ithLM);
+	if (independent) {
+		this->P.clear(first, 4);
+	}
+	for (int i = 0; i < 4; ++i) {
+		gsl_matrix_set(this->state, first + i, 0, element[i]);
+		gsl_matrix_set(this->predstate, first + i, 0, element[i]);
+		this->P.set(first + i, first + i, variance[i]);
 	}
-//dealocating old matrices
-	gsl_matrix_free(this->state);
-	gsl_matrix_free(this->predstate);
-	gsl_matrix_free(this->P);
-	gsl_matrix_free(this->predP);
-//setting new matrices
-	this->state = newstate;
-	this->predstate = newpredstate;
-	this->P = newP;
-	this->predP = newpredP;
-
 }
 
-void Map::addOtherRobotsObjects(MappedObjectPosition position) {
+void Map::addOtherRobotsObjects(MappedObjectPosition position, bool merge) {
 	bool foundRobot = false;
 	for (int var = 0; var < otherMapData.size(); ++var) {
 		bool foundObject = false;
@@ -1124,6 +1335,8 @@ void Map::addOtherRobotsObjects(MappedObjectPosition position) {
 					++var2) {
 				if (otherMapData[var].mappedObjects[var2].map_id
 						== position.map_id) {
+					// a later snapshot of the same object replaces it
+					otherMapData[var].mappedObjects[var2] = position;
 					foundObject = true;
 					break;
 				}
@@ -1143,8 +1356,152 @@ void Map::addOtherRobotsObjects(MappedObjectPosition position) {
 	}
 	printf("addOtherRobotsObjects type %d pos %f %f %f %f id %d robid %d\n",position.type,position.xPosition,
 			position.yPosition,	position.phiPosition,position.zPosition,position.map_id,position.mappedBy);
-	if (mappingEnded) {
-		mergeMap();
+	if (mappingEnded && merge) {
+		foldObject(position);
+	}
+}
+
+bool Map::isCircle(MapObjectType type) {
+	return type == NORMAL_CIRCLE || type == DOCK_CIRCLE || type == DOCK_CIRCLE_ORGANISM;
+}
+
+/**
+ * The incremental form of mergeMap. Every landmark keeps the objects that were averaged into it, about one per robot,
+ * so a new object only has to find its landmark in the grid and the landmark is averaged again from these few objects,
+ * the rest of the map is not touched apart from the correlations of the landmark, which are cleared. A later version of an object of the same robot replaces its earlier
+ * one. This robot counts with the landmark as it is in the state, refreshed whenever the filter changed it since the
+ * last merge, like mergeMap takes the current state. An object without a landmark near it becomes a new one.
+ */
+void Map::foldObject(MappedObjectPosition position) {
+	if ((int) mergeMembers.size() < this->mapSize) {
+		mergeMembers.resize(this->mapSize);
+		mergeVersions.resize(this->mapSize, 0);
+	}
+	std::pair<int, int> key(position.mappedBy, position.map_id);
+	int landmark = -1;
+	std::map<std::pair<int, int>, int>::iterator known = mergedObjects.find(key);
+	if (known != mergedObjects.end()) {
+		landmark = known->second;
+		removeMember(landmark, position.mappedBy, position.map_id);
+		double pos[2] = { position.xPosition, position.yPosition };
+		double mapped[2] = { landmarkElement(landmark, 0), landmarkElement(landmark, 1) };
+		// an object that moved away from its landmark is associated again
+		if (!isCircle(position.type) || euclideanDistance(pos, mapped) >= TOLERANCE) {
+			refold(landmark);
+			landmark = -1;
+		}
+		mergedObjects.erase(known);
+	}
+	if (landmark == -1 && isCircle(position.type)) {
+		std::vector<int> candidates;
+		landmarkGrid.query(NORMAL_CIRCLE, position.xPosition, position.yPosition, TOLERANCE, candidates);
+		landmarkGrid.query(DOCK_CIRCLE, position.xPosition, position.yPosition, TOLERANCE, candidates);
+		landmarkGrid.query(DOCK_CIRCLE_ORGANISM, position.xPosition, position.yPosition, TOLERANCE, candidates);
+		std::sort(candidates.begin(), candidates.end());
+		float vzdalenostold = TOLERANCE;
+		for (int candidate = 0; candidate < (int) candidates.size(); ++candidate) {
+			int var = candidates[candidate];
+			MappedObjectPosition mapped = getMappedPosition(var);
+			float vzdalenost = pow(pow(mapped.xPosition - position.xPosition, 2)
+					+ pow(mapped.yPosition - position.yPosition, 2), 0.5);
+			// the objects of one robot are never the same object
+			if (vzdalenost < vzdalenostold && memberOf(var, position.mappedBy) == -1) {
+				vzdalenostold = vzdalenost;
+				landmark = var;
+			}
+		}
+	}
+	if (landmark == -1) {
+		printf("merging object of robot %d as a new landmark\n", position.mappedBy);
+		landmark = saveObjectToMap(position);
+		mergeMembers.resize(this->mapSize);
+		mergeVersions.resize(this->mapSize, 0);
+		mergeMembers[landmark].push_back(position);
+		mergeVersions[landmark] = this->version;
+	} else {
+		// the own estimate of this robot, the first time or when the filter moved the landmark since
+		if (mergeMembers[landmark].empty() || changedSince(landmark, mergeVersions[landmark])) {
+			removeMember(landmark, this->robotID, -1);
+			mergeMembers[landmark].push_back(getMappedPosition(landmark));
+		}
+		mergeMembers[landmark].push_back(position);
+		refold(landmark);
+	}
+	mergedObjects[key] = landmark;
+}
+
+int Map::memberOf(int ithLM, int robot) {
+	std::vector<MappedObjectPosition> &members = mergeMembers[ithLM];
+	for (int var = 0; var < (int) members.size(); ++var) {
+		if (members[var].mappedBy == robot) return var;
+	}
+	return -1;
+}
+
+//! A map_id of -1 removes all objects of the robot, mergeMap can average two objects of one robot into a landmark
+void Map::removeMember(int ithLM, int robot, int map_id) {
+	std::vector<MappedObjectPosition> &members = mergeMembers[ithLM];
+	for (int var = (int) members.size() - 1; var >= 0; --var) {
+		if (members[var].mappedBy == robot && (map_id == -1 || members[var].map_id == map_id)) {
+			members.erase(members.begin() + var);
+		}
+	}
+}
+
+//! Average the members of a landmark into the state, a landmark without members keeps its position
+void Map::refold(int ithLM) {
+	if (mergeMembers[ithLM].empty()) return;
+	setLandmark(ithLM, averagePositions(mergeMembers[ithLM]), true);
+	touch(ithLM);
+	mergeVersions[ithLM] = this->version;
+}
+
+void Map::clearOtherRobotObjects(int robot) {
+	for (int var = 0; var < otherMapData.size(); ++var) {
+		if (otherMapData[var].robotID == robot) {
+			otherMapData[var].mappedObjects.clear();
+		}
+	}
+	// the landmarks keep their position, the objects of the new snapshot are associated with them again
+	std::map<std::pair<int, int>, int>::iterator first = mergedObjects.lower_bound(std::make_pair(robot, INT_MIN));
+	std::map<std::pair<int, int>, int>::iterator last = first;
+	for (; last != mergedObjects.end() && last->first.first == robot; ++last) {
+		removeMember(last->second, robot, -1);
+		refold(last->second);
+	}
+	mergedObjects.erase(first, last);
+}
+
+/**
+ * A measurement update moves all landmarks of the filter, but hardly ever out of their cell, so this is a check per
+ * landmark. The stored ones do not move.
+ */
+void Map::updateGrid() {
+	for (int slot = 0; slot < (int) slotLandmarks.size(); ++slot) {
+		int var = slotLandmarks[slot];
+		landmarkGrid.move(var, gsl_matrix_get(this->state, rowOf(var), 0), gsl_matrix_get(this->state, rowOf(var) + 1, 0));
+	}
+}
+
+void Map::touch(int ithLM) {
+	if (ithLM < 0 || ithLM >= this->mapSize) return;
+	if ((int) landmarkVersions.size() < this->mapSize) {
+		landmarkVersions.resize(this->mapSize, 0);
+	}
+	landmarkVersions[ithLM] = ++this->version;
+}
+
+bool Map::changedSince(int ithLM, unsigned int since) {
+	if (since < rebuiltVersion) return true;
+	return ithLM >= 0 && ithLM < (int) landmarkVersions.size() && landmarkVersions[ithLM] > since;
+}
+
+void Map::getCovariance(int ithLM, float *upper) {
+	int i = 0;
+	for (int row = 0; row < 4; ++row) {
+		for (int col = row; col < 4; ++col) {
+			upper[i++] = landmarkVariance(ithLM, row, col);
+		}
 	}
 }
 
@@ -1189,31 +1546,16 @@ void Map::mergeMap() {
 	}
 	printf("if \n");
 	//delete actual map before merging
-	int oldsize = 4 * (this->mapSize - 1) + 3;
-	int newsize = 3;
 	this->mapSize = 0;
-	gsl_matrix *newstate = gsl_matrix_alloc(newsize, 1);
-	gsl_matrix *newpredstate = gsl_matrix_alloc(newsize, 1);
-	gsl_matrix *newP = gsl_matrix_calloc(newsize, newsize);
-	gsl_matrix *newpredP = gsl_matrix_calloc(newsize, newsize);
-	for (int var = 0; var < newsize; ++var) {
-		gsl_matrix_set(newstate, var, 0, gsl_matrix_get(this->state, var, 0));
-		gsl_matrix_set(newpredstate, var, 0,
-				gsl_matrix_get(this->predstate, var, 0));
-		for (int var2 = 0; var2 < newsize; ++var2) {
-			gsl_matrix_set(newP, var, var2, gsl_matrix_get(this->P, var, var2));
-			gsl_matrix_set(newpredP, var, var2,
-					gsl_matrix_get(this->predP, var, var2));
-		}
-	}
-	gsl_matrix_free(this->state);
-	gsl_matrix_free(this->predstate);
-	gsl_matrix_free(this->P);
-	gsl_matrix_free(this->predP);
-	this->state = newstate;
-	this->predstate = newpredstate;
-	this->P = newP;
-	this->predP = newpredP;
+	resetSlots();
+	landmarkGrid.clear();
+	mergeMembers.clear();
+	mergeVersions.clear();
+	mergedObjects.clear();
+	landmarkVersions.clear();
+	rebuiltVersion = ++this->version;
+	// only the robot stays, the room for the landmarks is kept for the merged ones
+	resizeState(3);
 	mappedObjectTypes.clear();
 	mappedObjectTypes.push_back(ROBOT);
 	printf("after deleting mapped my map \n");
@@ -1226,7 +1568,17 @@ void Map::mergeMap() {
 	}
 	printf("initialize alreadyLooped to false \n");
 	//bool myBoolArray[velikos][maxMapped] = {{ 0 }};
+	//all mapped objects of all robots, the id of an object is its index in alreadyLooped
+	LandmarkGrid objectGrid;
+	for (int var = 0; var < velikos; ++var) {
+		for (int var2 = 0; var2 < otherMapData[var].mappedObjects.size(); ++var2) {
+			MappedObjectPosition &object = otherMapData[var].mappedObjects[var2];
+			objectGrid.insert(var * maxMapped + var2, object.type, object.xPosition, object.yPosition);
+		}
+	}
 	std::vector<MappedObjectPosition> averaged;
+	//the objects of every averaged position, they are kept for foldObject
+	std::vector<std::vector<MappedObjectPosition> > averagedMembers;
 	//loop throught different robot maps
 	for (int var = 0; var < otherMapData.size(); ++var) {
 		//loop throught robots landmarks
@@ -1240,28 +1592,26 @@ void Map::mergeMap() {
 			std::vector<MappedObjectPosition> sameObjects;	// vector for save same objects
 			sameObjects.push_back(otherMapData[var].mappedObjects[var2]);
 			alreadyLooped[var * maxMapped + var2] = true; //set that this object was already looped and tried for marging
-				for (int var3 = 0; var3 < otherMapData.size(); ++var3) {
-					if (var3 != var) {
-						printf("not same robots %d %d \n",otherMapData[var].robotID,otherMapData[var3].robotID);
-						//here do not test same robots map
-						//loop through other robots mapped objects
-						for (int var4 = 0;
-								var4 < otherMapData[var3].mappedObjects.size();
-								++var4) {
-							if (!alreadyLooped[var3 * maxMapped + var4]) {
-								//here if this object was not previously looped
-								//test if object are same
-								if (areSame(
-										otherMapData[var].mappedObjects[var2],
-										otherMapData[var3].mappedObjects[var4])) {
-									sameObjects.push_back(
-											otherMapData[var3].mappedObjects[var4]);
-									MappedObjectPosition pos = otherMapData[var3].mappedObjects[var4];
-									printf("adding object from robot %d on pos %f %f %f type %d \n",otherMapData[var3].robotID,pos.xPosition,pos.yPosition,pos.phiPosition,pos.type);
-									alreadyLooped[var3 * maxMapped + var4] =
-											true;
-								}
-							}
+				// areSame only accepts circles within TOLERANCE, so only those are asked from the grid, ordered by
+				// robot and object like the loops over all pairs were
+				MappedObjectPosition &object = otherMapData[var].mappedObjects[var2];
+				std::vector<int> candidates;
+				objectGrid.query(NORMAL_CIRCLE, object.xPosition, object.yPosition, TOLERANCE, candidates);
+				objectGrid.query(DOCK_CIRCLE, object.xPosition, object.yPosition, TOLERANCE, candidates);
+				objectGrid.query(DOCK_CIRCLE_ORGANISM, object.xPosition, object.yPosition, TOLERANCE, candidates);
+				std::sort(candidates.begin(), candidates.end());
+				for (int candidate = 0; candidate < (int) candidates.size(); ++candidate) {
+					int var3 = candidates[candidate] / maxMapped;
+					int var4 = candidates[candidate] % maxMapped;
+					//here do not test same robots map
+					if (var3 != var && !alreadyLooped[var3 * maxMapped + var4]) {
+						//here if this object was not previously looped
+						//test if object are same
+						if (areSame(object, otherMapData[var3].mappedObjects[var4])) {
+							sameObjects.push_back(otherMapData[var3].mappedObjects[var4]);
+							MappedObjectPosition pos = otherMapData[var3].mappedObjects[var4];
+							printf("adding object from robot %d on pos %f %f %f type %d \n",otherMapData[var3].robotID,pos.xPosition,pos.yPosition,pos.phiPosition,pos.type);
+							alreadyLooped[var3 * maxMapped + var4] = true;
 						}
 					}
 				}
@@ -1270,31 +1620,42 @@ void Map::mergeMap() {
 			printf("averagepos type %d pos %f %f %f %f id %d robid %d\n",averagepos.type,averagepos.xPosition,
 					averagepos.yPosition,	averagepos.phiPosition,averagepos.zPosition,averagepos.map_id,averagepos.mappedBy);
 			averaged.push_back(averagepos);
+			averagedMembers.push_back(sameObjects);
 
 			}
 		}
 	}
 
+	mergeMembers.resize(averaged.size());
+	mergeVersions.resize(averaged.size(), 0);
 	for (int var = 0; var < averaged.size(); ++var) {
 		printf("adding to map \n");
-		saveObjectToMap(averaged[var]);
+		int landmark = saveObjectToMap(averaged[var]);
+		mergeMembers[landmark] = averagedMembers[var];
+		mergeVersions[landmark] = this->version;
+		for (int var2 = 0; var2 < averagedMembers[var].size(); ++var2) {
+			MappedObjectPosition &member = averagedMembers[var][var2];
+			if (member.mappedBy != this->robotID) {
+				mergedObjects[std::make_pair(member.mappedBy, member.map_id)] = landmark;
+			}
+		}
 	}
 	for (int var = 0; var < this->mapSize; ++var) {
 		printf("LM%d=[LM%d [%2.7f ; %2.7f ; %2.7f ; %2.7f ]]; \n", var, var,
-							gsl_matrix_get(this->state, var * 4 + 3, 0),
-							gsl_matrix_get(this->state, var * 4 + 4, 0),
-							gsl_matrix_get(this->state, var * 4 + 5, 0),
-							gsl_matrix_get(this->state, var * 4 + 6, 0));
+							landmarkElement(var, 0), landmarkElement(var, 1),
+							landmarkElement(var, 2), landmarkElement(var, 3));
 		printf("LM%dUNCERT=[LM%dUNCERT [%2.7f ; %2.7f ; %2.7f ; %2.7f ]]; \n",
-							var, var, gsl_matrix_get(this->P, var * 4 + 3, var * 4 + 3),
-							gsl_matrix_get(this->P, var * 4 + 4, var * 4 + 4),
-							gsl_matrix_get(this->P, var * 4 + 5, var * 4 + 5),
-							gsl_matrix_get(this->P, var * 4 + 6, var * 4 + 6));
+							var, var, landmarkVariance(var, 0, 0), landmarkVariance(var, 1, 1),
+							landmarkVariance(var, 2, 2), landmarkVariance(var, 3, 3));
 	}
 
-	MapData data = { this->state, this->P ,this->mappedObjectTypes};
+	MapData data = { this->state, &this->P ,this->mappedObjectTypes};
 	writeToFile("/flash/map.map", data);
 	delete[] alreadyLooped;
+	// the merged landmarks have no correlations, they go back into the filter when they are seen
+	if (submapLandmarks > 0 || submapDistance > 0) {
+		closeSubmap();
+	}
 }
 
 bool Map::areSame(MappedObjectPosition mappedObject1,
@@ -1323,6 +1684,10 @@ MappedObjectPosition Map::averagePositions(
 	returnPos.yPosition = 0;
 	returnPos.zPosition = 0;
 	returnPos.phiPosition = 0;
+	returnPos.xUncertainty = 0;
+	returnPos.yUncertainty = 0;
+	returnPos.zUncertainty = 0;
+	returnPos.phiUncertainty = 0;
 	double sum_of_koeffs_x = 0;
 	double sum_of_koeffs_y = 0;
 	double sum_of_koeffs_z = 0;
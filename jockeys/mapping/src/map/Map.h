@@ -12,16 +12,22 @@
 #include <cmath.h>
 #include <float.h>
 #include <vector>
+#include <map>
 #include <messageDataType.h>
 #include <CMessage.h>
+#include "LandmarkGrid.h"
+#include "PackedCovariance.h"
 
 #ifndef MARK_H_
 #define MARK_H_
 
+//! Number of landmarks the state and covariance have room for initially, the room doubles when it is used up
+#define MAP_INITIAL_LANDMARKS 8
+
 using namespace std;
 typedef struct MapData {
 	gsl_matrix * map;
-	gsl_matrix * covariance;
+	PackedCovariance * covariance;
 	std::vector<MapObjectType> mappedObjectTypes;
 } MapData;
 
@@ -42,14 +48,30 @@ public:
 	int robotID;
 	void filter(double*, float*);
 	void odometryChange(double*);
+	//! Read a map file of writeToFile, the matrices of the result are NULL if that fails
 	MapData readFromFile(const char* filename);
-	int writeToFile(const char* filename, MapData data);
+	//! Write the state, the covariance and the types to a binary map file, see MapFile.h
+	int writeToFile(const char* filename, MapData data, bool single = false);
+	//! Continue with the landmarks of a map file, returns false if it could not be read
+	bool resume(const char* filename);
 	MappedObjectPosition getMappedPosition(int ithLM);
 	double* getRobotPosition();
 	int nearestTypeID(NearestObjectOfTypeToThisPosition nearestTo);
 	int saveObjectToMap(MappedObjectPosition position);
-	void addOtherRobotsObjects(MappedObjectPosition mappedObject);
-	gsl_matrix *P;
+	//! Add or update an object of another robot, fold it into the merged map if merge is set and mapping ended
+	void addOtherRobotsObjects(MappedObjectPosition mappedObject, bool merge = true);
+	//! Forget the objects of another robot, before a full MSG_MAP_SNAPSHOT of it is added
+	void clearOtherRobotObjects(int robot);
+	//! Incremented with every change of a landmark
+	unsigned int version;
+	//! True if the ith landmark changed after the given version of the map, see MSG_MAP_SNAPSHOT
+	bool changedSince(int ithLM, unsigned int since);
+	//! True if the landmarks were renumbered after the given version, so only a full snapshot is valid
+	inline bool rebuiltAfter(unsigned int since) { return since < rebuiltVersion; }
+	//! The upper triangle of the covariance of x, y, phi and z of the ith landmark, row by row, 10 values
+	void getCovariance(int ithLM, float *upper);
+	//! The covariance of the state, which is also the predicted covariance between the prediction and the update
+	PackedCovariance P;
 	bool newDetected;
 	bool seeAfterLongTime;
 	static void convertCameraMeasurementS(float *);
@@ -59,12 +81,18 @@ public:
 	static void convertCameraMeasurementAW(float *, float);
 	void mergeMap();
 	bool mappingEnded;
+	/**
+	 * Close the active submap after it has landmarks landmarks, or after the robot travelled distance m in it, 0 for
+	 * no limit. Without limits, which is the default, there is only one submap and nothing changes.
+	 */
+	void setSubmapLimits(int landmarks, double distance);
+	//! Submaps that were closed
+	inline int getSubmapCount() { return submaps.size(); }
 private:
 //	double **actualMeasured;
 	//chyba odometrie robota
 	//gsl_matrix *R;
 	RobotBase::RobotType robot_type;
-	gsl_matrix *predP;
 	//chyba měření kamerou
 	gsl_matrix *Q;
 	double *odometry;
@@ -76,6 +104,7 @@ private:
 	double normalizeAngleDiff(double);
 	int minIndex(double*, int);
 	void printMatrix(gsl_matrix*);
+	void printMatrix(const PackedCovariance&);
 	void printArray(double *, int);
 
 	void calculateOdometryCovariance(double changedx, double changedy,
@@ -86,6 +115,90 @@ private:
 	bool areSame(MappedObjectPosition mappedObject1,MappedObjectPosition mappedObject2);
 	MappedObjectPosition averagePositions(std::vector<MappedObjectPosition> sameObjects);
 	std::vector<OtherRobotMap> otherMapData;
+	//! Version of the map at which each landmark last changed
+	std::vector<unsigned int> landmarkVersions;
+	//! Version at which mergeMap renumbered the landmarks, a delta since an older version is a full map
+	unsigned int rebuiltVersion;
+	void touch(int ithLM);
+
+	//! The landmarks by type and position, for the data association, nearestTypeID and mergeMap
+	LandmarkGrid landmarkGrid;
+	//! Move the landmarks in the grid to their positions in state
+	void updateGrid();
+
+	//! Set position and variances of a landmark, independent also clears its correlations
+	void setLandmark(int ithLM, MappedObjectPosition position, bool independent);
+	static bool isCircle(MapObjectType type);
+	//! Merge one object of another robot into the map, without the full mergeMap
+	void foldObject(MappedObjectPosition position);
+	//! Index in mergeMembers of the object of robot in the landmark, -1 if it has none
+	int memberOf(int ithLM, int robot);
+	void removeMember(int ithLM, int robot, int map_id);
+	void refold(int ithLM);
+	//! The objects the merge averaged into each landmark, the own one has mappedBy robotID
+	std::vector<std::vector<MappedObjectPosition> > mergeMembers;
+	//! Version of the map at which each landmark was last averaged
+	std::vector<unsigned int> mergeVersions;
+	//! Landmark of each object of another robot, by robot and map_id
+	std::map<std::pair<int, int>, int> mergedObjects;
+
+	//! Make room for newsize state elements, the elements that were there keep their values, new rows and columns
+	//! of the covariances are zero
+	void resizeState(int newsize);
+	//! The allocated matrices, state and predstate are views on their upper part
+	gsl_matrix *stateBlock, *predstateBlock;
+	gsl_matrix_view stateView, predstateView;
+	//! Number of state elements the blocks and P have room for
+	int capacity;
+	//! Returned by getRobotPosition
+	double robotPosition[3];
+	//! Workspaces of the measurement update in filter, the two blocks have a row for every state element of capacity
+	gsl_matrix *predP_HtBlock, *KBlock, *hWork, *innovationWork, *differenceWork;
+
+	/**
+	 * The filter only has the robot and the landmarks of the active submap, mapSize counts all landmarks. A landmark
+	 * keeps its number for good, its slot is where it is in the state, landmark slot i has the rows 4i+3 to 4i+6.
+	 */
+	std::vector<int> landmarkSlots;
+	//! Landmark of every slot of the state
+	std::vector<int> slotLandmarks;
+	//! A landmark that is not in the filter, as it was when its submap was closed
+	struct StoredLandmark {
+		double position[4];
+		double covariance[4][4];
+		//! The submap it belongs to
+		int submap;
+	};
+	//! By landmark, only valid for the landmarks without slot
+	std::vector<StoredLandmark> storedLandmarks;
+	struct Submap {
+		//! Pose of the robot when the submap was started
+		double origin[3];
+		//! Pose of the robot when it was closed relative to origin, which is the origin of the next submap
+		double transform[3];
+		std::vector<int> landmarks;
+	};
+	std::vector<Submap> submaps;
+	int submapLandmarks;
+	double submapDistance;
+	double submapOrigin[3];
+	double submapTravelled;
+	inline int filterSize() { return 4 * slotLandmarks.size() + 3; }
+	//! First row of a landmark in the state, it has to have a slot
+	inline int rowOf(int ithLM) { return 4 * landmarkSlots[ithLM] + 3; }
+	//! Element 0 to 3, x, y, phi or z, of a landmark, in the state or stored
+	double landmarkElement(int ithLM, int element);
+	double landmarkVariance(int ithLM, int row, int col);
+	//! Give a landmark the next slot and make room for it, returns its first row
+	int addSlot(int ithLM);
+	//! Move a stored landmark into the filter again, without correlations
+	void activate(int ithLM);
+	//! Store the landmarks of the filter and start a new submap with only the robot
+	void closeSubmap();
+	//! Close the submap when it reached a limit
+	void checkSubmap();
+	//! Forget the submaps, every landmark gets the slot of its number
+	void resetSlots();
 
 };
 
@@ -0,0 +1,44 @@
+/*
+ * MapFile.h
+ *
+ * Layout of the binary map file of Map::writeToFile. The file is written on the robot and read back on the robot, so
+ * everything is in the byte order of the robot, which is checked with the magic, and the values can be used straight
+ * from a read only mmap of the file.
+ */
+#include <stdint.h>
+
+#ifndef MAPFILE_H_
+#define MAPFILE_H_
+
+#define MAP_FILE_MAGIC 0x504d5145 // "EQMP" on a little endian robot
+#define MAP_FILE_VERSION 1
+
+//! The covariance is stored as float instead of double
+#define MAP_FILE_FLOAT 0x1
+
+/**
+ * The header is followed by the table of the types of the map, one byte per entry with the robot first, the state as
+ * doubles, and the upper triangle of the covariance row by row, n*(n+1)/2 values for a state of n elements. The
+ * offsets are from the start of the file, the state and the covariance start at a multiple of 8.
+ */
+struct MapFileHeader {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t flags;
+	uint32_t size;              //!< Elements of the state, 3 for the robot and 4 for each landmark
+	uint32_t types;             //!< Entries in the type table
+	uint32_t types_offset;
+	uint32_t state_offset;
+	uint32_t covariance_offset;
+	uint32_t file_size;         //!< Bytes of the whole file, a file that was cut off is not loaded
+};
+
+static inline uint32_t mapFileAlign(uint32_t offset) {
+	return (offset + 7) & ~7u;
+}
+
+static inline uint32_t mapFileTriangle(uint32_t size) {
+	return size * (size + 1) / 2;
+}
+
+#endif /* MAPFILE_H_ */
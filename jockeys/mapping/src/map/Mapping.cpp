@@ -12,10 +12,13 @@
 #define MINIMUM_SEE_BLOB_REQ 20
 #define DRIVE_FORWARD_COUNT 5
 #define DRIVE_FORWARD_DIST 0.5
+//! Every so many runs the loop is closed on the first landmark instead of exploring the best frontier
+#define CLOSE_LOOP_RUNS 3
 
 Mapping::Mapping(CMotors* motors) {
 	// TODO Auto-generated constructor stub
 	this->motor = motors;
+	this->frontiers = NULL;
 	this->actualState = START_MAPPING;
 	this->wait_stopped = IMAGE_WAIT_COUNT;
 	this->stai_in_motion = TURNING_COUNT;
@@ -37,7 +40,7 @@ Mapping::~Mapping() {
 /**
  * Do mapping pseudo random map procedure in constant sequence - drive forward -> turn around start -> turn around end -> turn rand angle -> drive forward .....
  */
-void Mapping::doMappingMotion(bool seeBlob, Map* slamMap) {
+void Mapping::doMappingMotion(bool seeBlob, const PoseSnapshot &pose) {
 
 	if (seeBlob) {
 		seedSameBlob += 1;
@@ -96,11 +99,16 @@ void Mapping::doMappingMotion(bool seeBlob, Map* slamMap) {
 
 				this->turnToDirectionAngle = randFromTO(-M_PI, M_PI);
 */
-				if(slamMap->mapSize>0){
-				double *pos = slamMap->getRobotPosition();
-				MappedObjectPosition firstLM = slamMap->getMappedPosition(0);
-				this->turnToDirectionAngle = atan2(firstLM.yPosition -pos[1] ,firstLM.xPosition -pos[0]);
+				// the grid is in the frame of the odometry
+				double x = motor->getPosition()[0], y = motor->getPosition()[1], targetX, targetY;
+				int gain;
+				bool explore = frontiers != NULL && frontiers->pick(x, y, false, targetX, targetY, gain);
+				if(pose.landmarks>0 && (!explore || this->runs % CLOSE_LOOP_RUNS == 0)){
+				this->turnToDirectionAngle = atan2(pose.firstY - pose.y, pose.firstX - pose.x);
 				printf("closing loop on angle %f \n",turnToDirectionAngle);
+				}else if(explore){
+				this->turnToDirectionAngle = atan2(targetY - y, targetX - x);
+				printf("exploring unknown space on angle %f \n",turnToDirectionAngle);
 				}else{
 				this->closedLoop = true;
 				}
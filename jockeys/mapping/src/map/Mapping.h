@@ -10,6 +10,8 @@
 #include "../motor/CMotors.h"
 #include "../common/cmath.h"
 #include "./Map.h"
+#include "./FilterService.h"
+#include "./FrontierTracker.h"
 
 class Mapping {
 public:
@@ -22,7 +24,10 @@ public:
 	};
 	Mapping(CMotors* motors);
 	virtual ~Mapping();
-	void doMappingMotion(bool seeBlob,Map* slamMap);
+	//! pose is the last snapshot of the filter, motion control does not wait for the map
+	void doMappingMotion(bool seeBlob, const PoseSnapshot &pose);
+	//! Turn towards the best frontier of the occupancy grid after a turn around, NULL to only close the loop
+	inline void setFrontiers(FrontierTracker *tracker) { frontiers = tracker; }
 	int wait_stopped; // wait stopped until wait_stopped==0
 	int seedSameBlob;
 	int image_wait_count;
@@ -33,6 +38,7 @@ public:
 	bool closedLoop;
 private:
 	CMotors* motor;
+	FrontierTracker* frontiers;
 	double lastPosition[5]; //for storing position of robot in previous important position
 
 	int stai_in_motion; // continue turning until ==0
@@ -0,0 +1,169 @@
+/*
+ * OccupancyGrid.cpp
+ *
+ * Dense map of the free and the occupied space around the robot, built from the laser scans
+ */
+
+#include "OccupancyGrid.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+//! Cells further out are clamped, a pose that far off is broken anyway
+#define OCCUPANCY_LIMIT 1000000
+
+//! Index of the tile of a cell, rounded down for negative cells as well
+static inline int tileIndex(int c) {
+	return (c >= 0) ? c / OCCUPANCY_TILE : -((-c - 1) / OCCUPANCY_TILE) - 1;
+}
+
+OccupancyGrid::OccupancyGrid(): last(NULL), version(0), clearedVersion(0), changed(false) {
+}
+
+OccupancyGrid::~OccupancyGrid() {
+	clear();
+}
+
+void OccupancyGrid::clear() {
+	for (std::map<std::pair<int, int>, Tile*>::iterator i = tiles.begin(); i != tiles.end(); ++i) {
+		delete i->second;
+	}
+	tiles.clear();
+	scanTiles.clear();
+	last = NULL;
+	// a version is never used twice, a delta against a version before this one has to be a full grid
+	clearedVersion = ++version;
+}
+
+int OccupancyGrid::index(double coordinate) {
+	double i = floor(coordinate / OCCUPANCY_CELL);
+	// NaN ends up in the first cell
+	if (!(i >= -OCCUPANCY_LIMIT)) return -OCCUPANCY_LIMIT;
+	if (i > OCCUPANCY_LIMIT) return OCCUPANCY_LIMIT;
+	return (int) i;
+}
+
+OccupancyGrid::Tile *OccupancyGrid::tileOf(int cx, int cy, bool create) {
+	int tx = tileIndex(cx), ty = tileIndex(cy);
+	if (last != NULL && last->tx == tx && last->ty == ty) return last;
+	std::map<std::pair<int, int>, Tile*>::iterator found = tiles.find(std::make_pair(tx, ty));
+	if (found != tiles.end()) {
+		last = found->second;
+	} else if (create) {
+		Tile *tile = new Tile;
+		tile->tx = tx;
+		tile->ty = ty;
+		tile->version = 0;
+		memset(tile->cells, 0, sizeof(tile->cells));
+		tiles[std::make_pair(tx, ty)] = tile;
+		last = tile;
+	} else {
+		return NULL;
+	}
+	return last;
+}
+
+const OccupancyGrid::Tile *OccupancyGrid::findTile(int cx, int cy) const {
+	std::map<std::pair<int, int>, Tile*>::const_iterator found = tiles.find(std::make_pair(tileIndex(cx),
+			tileIndex(cy)));
+	return (found != tiles.end()) ? found->second : NULL;
+}
+
+const OccupancyGrid::Tile *OccupancyGrid::tile(int tx, int ty) const {
+	std::map<std::pair<int, int>, Tile*>::const_iterator found = tiles.find(std::make_pair(tx, ty));
+	return (found != tiles.end()) ? found->second : NULL;
+}
+
+int8_t OccupancyGrid::cell(double x, double y) const {
+	int cx = index(x), cy = index(y);
+	const Tile *tile = findTile(cx, cy);
+	if (tile == NULL) return 0;
+	return tile->cells[(cy - tile->ty * OCCUPANCY_TILE) * OCCUPANCY_TILE + cx - tile->tx * OCCUPANCY_TILE];
+}
+
+/**
+ * The tile is only looked up again when the line crosses into the next one, which for a ray of the laser of a few
+ * dozen cells happens at most a few times.
+ */
+void OccupancyGrid::traceRay(int cx0, int cy0, int cx1, int cy1, bool hit) {
+	int dx = abs(cx1 - cx0), sx = (cx0 < cx1) ? 1 : -1;
+	int dy = -abs(cy1 - cy0), sy = (cy0 < cy1) ? 1 : -1;
+	int err = dx + dy;
+	int cx = cx0, cy = cy0;
+	Tile *tile = NULL;
+	while (true) {
+		if (tile == NULL || tileIndex(cx) != tile->tx || tileIndex(cy) != tile->ty) {
+			tile = tileOf(cx, cy, true);
+		}
+		bool end = (cx == cx1 && cy == cy1);
+		int8_t &value = tile->cells[(cy - tile->ty * OCCUPANCY_TILE) * OCCUPANCY_TILE + cx - tile->tx * OCCUPANCY_TILE];
+		int updated = value + ((end && hit) ? OCCUPANCY_HIT : OCCUPANCY_MISS);
+		if (updated > OCCUPANCY_CLAMP) updated = OCCUPANCY_CLAMP;
+		if (updated < -OCCUPANCY_CLAMP) updated = -OCCUPANCY_CLAMP;
+		if (updated != value) {
+			value = (int8_t) updated;
+			// the tile is part of the delta of the version this scan ends in
+			if (tile->version != version + 1) {
+				tile->version = version + 1;
+				scanTiles.push_back(std::make_pair(tile->tx, tile->ty));
+			}
+			changed = true;
+		}
+		if (end) break;
+		int e2 = 2 * err;
+		if (e2 >= dy) {
+			err += dy;
+			cx += sx;
+		}
+		if (e2 <= dx) {
+			err += dx;
+			cy += sy;
+		}
+	}
+}
+
+/**
+ * The end points of all rays are computed first, in a loop of multiplications and additions over flat arrays that the
+ * compiler turns into vector instructions, with the rotation of the pose applied to the sine and cosine of every
+ * bearing. Only then the rays are walked, one after the other, so the tiles they share stay in the cache.
+ */
+void OccupancyGrid::insertScan(double x, double y, double phi, const float *bearings, const float *ranges, int count,
+		float max_range) {
+	if (count > OCCUPANCY_MAX_RAYS) count = OCCUPANCY_MAX_RAYS;
+	if (count <= 0) return;
+	// the bearings of the rows of the laser are the same in every scan, their sines and cosines are kept
+	if ((int) bearingCache.size() != count || memcmp(&bearingCache[0], bearings, count * sizeof(float)) != 0) {
+		bearingCache.assign(bearings, bearings + count);
+		bearingCos.resize(count);
+		bearingSin.resize(count);
+		for (int i = 0; i < count; ++i) {
+			bearingCos[i] = cosf(bearings[i]);
+			bearingSin[i] = sinf(bearings[i]);
+		}
+	}
+	endX.resize(count);
+	endY.resize(count);
+	float c = cos(phi), s = sin(phi);
+	float ox = x, oy = y;
+	const float *bc = &bearingCos[0], *bs = &bearingSin[0];
+	float *ex = &endX[0], *ey = &endY[0];
+	for (int i = 0; i < count; ++i) {
+		float range = (ranges[i] < max_range) ? ranges[i] : max_range;
+		ex[i] = ox + range * (c * bc[i] - s * bs[i]);
+		ey[i] = oy + range * (s * bc[i] + c * bs[i]);
+	}
+	int cx0 = index(x), cy0 = index(y);
+	changed = false;
+	scanTiles.clear();
+	for (int i = 0; i < count; ++i) {
+		if (!(ranges[i] > 0)) continue;
+		traceRay(cx0, cy0, index(ex[i]), index(ey[i]), ranges[i] < max_range);
+	}
+	if (changed) version++;
+}
+
+void OccupancyGrid::changedSince(uint32_t since, std::vector<const Tile*> & changed) const {
+	for (std::map<std::pair<int, int>, Tile*>::const_iterator i = tiles.begin(); i != tiles.end(); ++i) {
+		if (since == 0 || i->second->version > since) changed.push_back(i->second);
+	}
+}
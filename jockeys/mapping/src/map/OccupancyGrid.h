@@ -0,0 +1,105 @@
+/*
+ * OccupancyGrid.h
+ *
+ * Dense map of the free and the occupied space around the robot, built from the laser scans in the frame of the
+ * odometry, in tiles that are only allocated where the laser looked.
+ */
+#include <stdint.h>
+#include <map>
+#include <vector>
+
+#ifndef OCCUPANCYGRID_H_
+#define OCCUPANCYGRID_H_
+
+//! Cells along a side of a tile, a tile of int8_t cells is 256 bytes, a few cache lines
+#define OCCUPANCY_TILE 16
+#define OCCUPANCY_TILE_CELLS (OCCUPANCY_TILE * OCCUPANCY_TILE)
+//! Side of a cell in m
+#define OCCUPANCY_CELL 0.05
+
+//! Log-odds added for a cell a ray ends in and for a cell a ray passes, saturated at OCCUPANCY_CLAMP
+#define OCCUPANCY_HIT 12
+#define OCCUPANCY_MISS -4
+#define OCCUPANCY_CLAMP 100
+//! A cell above this log-odds is occupied, one below the negative is free, the others are unknown
+#define OCCUPANCY_SURE 20
+
+//! Most rays in one scan
+#define OCCUPANCY_MAX_RAYS 640
+
+/**
+ * Every cell is an int8_t log-odds that the cell is occupied, 0 is unknown. Cells are kept in tiles of 16x16, row by
+ * row, and a ray walks its cells with a Bresenham line that only looks up the tile again when it crosses into another
+ * one, so almost every step is an increment within the same 256 bytes. A tile remembers the version of the grid at
+ * which it last changed, so the tiles that changed since a version can be sent as a delta.
+ */
+class OccupancyGrid {
+public:
+	OccupancyGrid();
+	~OccupancyGrid();
+
+	//! Forget all tiles
+	void clear();
+
+	/**
+	 * Insert a scan taken at pose x, y, phi of the sensor. The rays have a bearing relative to phi and a range in m,
+	 * a ray with a range of at least max_range did not hit anything and only clears the cells up to max_range, a ray
+	 * with a range of 0 or less is skipped.
+	 */
+	void insertScan(double x, double y, double phi, const float *bearings, const float *ranges, int count,
+			float max_range);
+
+	//! Log-odds of the cell at x, y, 0 for unknown
+	int8_t cell(double x, double y) const;
+
+	//! Incremented with every scan that changed a cell
+	inline uint32_t getVersion() const { return version; }
+
+	inline int getTileCount() const { return tiles.size(); }
+
+	//! True if the grid was cleared after the given version, so only all tiles are a valid delta
+	inline bool clearedAfter(uint32_t since) const { return since < clearedVersion; }
+
+	//! A tile as it is sent, tx and ty are its index, the tile has the cells from tx*OCCUPANCY_TILE on
+	struct Tile {
+		int tx, ty;
+		uint32_t version;
+		int8_t cells[OCCUPANCY_TILE_CELLS];
+	};
+
+	//! Append the tiles that changed after version since to changed, all tiles for 0
+	void changedSince(uint32_t since, std::vector<const Tile*> & changed) const;
+
+	//! The tile with the index tx, ty, NULL if the laser never looked there
+	const Tile *tile(int tx, int ty) const;
+
+	//! The index of the tiles in which the last scan changed a cell
+	inline const std::vector<std::pair<int, int> > & getScanTiles() const { return scanTiles; }
+
+private:
+	//! Cell index of a coordinate
+	static int index(double coordinate);
+
+	//! The tile with the cell cx, cy, allocated if it is not there and create is set
+	Tile *tileOf(int cx, int cy, bool create);
+	const Tile *findTile(int cx, int cy) const;
+
+	//! Walk the cells from cx0, cy0 to cx1, cy1, the last one gets a hit if hit is set, the others a miss
+	void traceRay(int cx0, int cy0, int cx1, int cy1, bool hit);
+
+	std::map<std::pair<int, int>, Tile*> tiles;
+	//! The tile of the last lookup, a ray mostly stays in it
+	Tile *last;
+	uint32_t version;
+	uint32_t clearedVersion;
+	//! A cell of the current scan changed, the version is incremented at its end
+	bool changed;
+	std::vector<std::pair<int, int> > scanTiles;
+
+	//! End points of the rays of a scan, computed in one loop before the rays are walked
+	std::vector<float> endX, endY;
+	//! The bearings of the last scan, with their cosines and sines
+	std::vector<float> bearingCache, bearingCos, bearingSin;
+};
+
+#endif /* OCCUPANCYGRID_H_ */
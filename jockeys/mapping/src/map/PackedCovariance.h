@@ -0,0 +1,96 @@
+/*
+ * PackedCovariance.h
+ *
+ * The covariance of the filter, of which only the upper triangle is stored. A state of n elements needs n*(n+1)/2
+ * values instead of the n*n of a gsl_matrix, and with MAP_COVARIANCE_FLOAT they are float instead of double, which
+ * together is about a quarter of the memory.
+ */
+#include <gsl/gsl_matrix.h>
+#include <vector>
+
+#ifndef PACKEDCOVARIANCE_H_
+#define PACKEDCOVARIANCE_H_
+
+//! Define MAP_COVARIANCE_FLOAT to store the covariance as float, the kernels still compute in double
+#ifdef MAP_COVARIANCE_FLOAT
+typedef float covariance_t;
+#else
+typedef double covariance_t;
+#endif
+
+/**
+ * The upper triangle is stored column by column, like the packed storage of LAPACK: column j has the elements 0 to j
+ * and starts at j*(j+1)/2. Where an element is does not depend on the size, so growing only appends columns and
+ * shrinking only drops them, nothing is moved.
+ */
+class PackedCovariance {
+public:
+	PackedCovariance(): n(0) {
+	}
+
+	inline int size() const { return n; }
+
+	//! Room for capacity elements, so growing up to there does not reallocate
+	inline void reserve(int capacity) { values.reserve(triangle(capacity)); }
+
+	//! The elements that were there keep their values, the new rows and columns are zero
+	inline void resize(int size) {
+		values.resize(triangle(size), 0);
+		n = size;
+	}
+
+	//! The elements 0 to j of column j, which are also the elements 0 to j of row j
+	inline covariance_t *column(int j) { return &values[triangle(j)]; }
+	inline const covariance_t *column(int j) const { return &values[triangle(j)]; }
+
+	inline double get(int i, int j) const { return (i <= j) ? values[triangle(j) + i] : values[triangle(i) + j]; }
+	inline void set(int i, int j, double value) {
+		if (i <= j) values[triangle(j) + i] = (covariance_t) value;
+		else values[triangle(i) + j] = (covariance_t) value;
+	}
+
+	//! The prediction of the filter, which adds the odometry covariance to the variances of the robot pose
+	inline void addDiagonal(int first, const double *add, int count) {
+		for (int i = first; i < first + count; ++i) {
+			covariance_t &element = values[triangle(i) + i];
+			element = (covariance_t) (element + add[i - first]);
+		}
+	}
+
+	//! Zero the rows, and so the columns, first to first+count-1 of the covariance
+	void clear(int first, int count) {
+		for (int j = first; j < n; ++j) {
+			covariance_t *c = column(j);
+			// a column of the rows is zero as a whole, a later one only in the rows
+			int from = (j < first + count) ? 0 : first;
+			int to = (j < first + count) ? j : first + count - 1;
+			for (int i = from; i <= to; ++i) c[i] = 0;
+		}
+	}
+
+	/**
+	 * The update of the filter P=P-a*b', with a and b workspaces of n rows and a*b' symmetric, which K*(P*H')' is. Only
+	 * the upper triangle of the product is computed, half of the work of the full product, and P stays symmetric
+	 * without the averaging that the full product needed against the rounding errors.
+	 */
+	void subtractProduct(const gsl_matrix *a, const gsl_matrix *b) {
+		int k = a->size2;
+		for (int j = 0; j < n; ++j) {
+			covariance_t *c = column(j);
+			const double *bj = b->data + j * b->tda;
+			const double *ai = a->data;
+			for (int i = 0; i <= j; ++i, ai += a->tda) {
+				double sum = 0;
+				for (int l = 0; l < k; ++l) sum += ai[l] * bj[l];
+				c[i] = (covariance_t) (c[i] - sum);
+			}
+		}
+	}
+private:
+	static inline size_t triangle(int size) { return (size_t) size * (size + 1) / 2; }
+
+	std::vector<covariance_t> values;
+	int n;
+};
+
+#endif /* PACKEDCOVARIANCE_H_ */
@@ -0,0 +1,94 @@
+/*
+ * SmallMatrix.h
+ *
+ * Matrices with their size fixed at compile time, for the Jacobians of the EKF. They live on the stack, and the
+ * products are loops of known length the compiler unrolls, which makes them a lot cheaper for a 4x3 times 3x3 than a
+ * heap gsl_matrix and a call to gsl_blas_dgemm.
+ */
+#include <gsl/gsl_matrix.h>
+
+#ifndef SMALLMATRIX_H_
+#define SMALLMATRIX_H_
+
+template<int R, int C>
+struct SmallMatrix {
+	double m[R][C];
+
+	inline double & operator()(int i, int j) { return m[i][j]; }
+	inline double operator()(int i, int j) const { return m[i][j]; }
+
+	inline void zero() {
+		for (int i = 0; i < R; ++i)
+			for (int j = 0; j < C; ++j)
+				m[i][j] = 0;
+	}
+
+	//! Copy the block of source that starts at row, col
+	inline void load(const gsl_matrix *source, int row = 0, int col = 0) {
+		for (int i = 0; i < R; ++i)
+			for (int j = 0; j < C; ++j)
+				m[i][j] = gsl_matrix_get(source, row + i, col + j);
+	}
+
+	//! Copy into the block of target that starts at row, col
+	inline void store(gsl_matrix *target, int row = 0, int col = 0) const {
+		for (int i = 0; i < R; ++i)
+			for (int j = 0; j < C; ++j)
+				gsl_matrix_set(target, row + i, col + j, m[i][j]);
+	}
+
+	//! A gsl view on the matrix, for printMatrix, valid as long as the matrix is
+	inline gsl_matrix_view view() { return gsl_matrix_view_array(&m[0][0], R, C); }
+
+	inline SmallMatrix<C, R> transposed() const {
+		SmallMatrix<C, R> result;
+		for (int i = 0; i < R; ++i)
+			for (int j = 0; j < C; ++j)
+				result.m[j][i] = m[i][j];
+		return result;
+	}
+
+	inline SmallMatrix<R, C> & operator+=(const SmallMatrix<R, C> &other) {
+		for (int i = 0; i < R; ++i)
+			for (int j = 0; j < C; ++j)
+				m[i][j] += other.m[i][j];
+		return *this;
+	}
+};
+
+//! a*b
+template<int R, int K, int C>
+inline SmallMatrix<R, C> operator*(const SmallMatrix<R, K> &a, const SmallMatrix<K, C> &b) {
+	SmallMatrix<R, C> result;
+	for (int i = 0; i < R; ++i)
+		for (int j = 0; j < C; ++j) {
+			double sum = 0;
+			for (int k = 0; k < K; ++k)
+				sum += a.m[i][k] * b.m[k][j];
+			result.m[i][j] = sum;
+		}
+	return result;
+}
+
+//! a*b' without building the transpose
+template<int R, int K, int C>
+inline SmallMatrix<R, C> multiplyTransposed(const SmallMatrix<R, K> &a, const SmallMatrix<C, K> &b) {
+	SmallMatrix<R, C> result;
+	for (int i = 0; i < R; ++i)
+		for (int j = 0; j < C; ++j) {
+			double sum = 0;
+			for (int k = 0; k < K; ++k)
+				sum += a.m[i][k] * b.m[j][k];
+			result.m[i][j] = sum;
+		}
+	return result;
+}
+
+typedef SmallMatrix<3, 3> Matrix33;
+typedef SmallMatrix<4, 4> Matrix44;
+typedef SmallMatrix<3, 4> Matrix34;
+typedef SmallMatrix<4, 3> Matrix43;
+typedef SmallMatrix<3, 1> Vector3;
+typedef SmallMatrix<4, 1> Vector4;
+
+#endif /* SMALLMATRIX_H_ */
@@ -0,0 +1,196 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Registry and runner of microbenchmarks, in the style of Google Benchmark
+ * @file CBenchmark.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Testing
+ */
+
+#include <CBenchmark.h>
+
+#include <stdio.h>
+#include <time.h>
+#include <algorithm>
+
+//! The run that finds the number of iterations stops growing them at this many
+#define BENCHMARK_MAX_ITERATIONS 1000000000L
+
+//! Registered in a function, so it exists before the first BENCHMARK of any file is registered
+static std::vector<CBenchmark*> & registry() {
+	static std::vector<CBenchmark*> benchmarks;
+	return benchmarks;
+}
+
+static int64_t clockTime(clockid_t clock) {
+	struct timespec time;
+	clock_gettime(clock, &time);
+	return (int64_t)time.tv_sec * 1000000000LL + time.tv_nsec;
+}
+
+/***********************************************************************************************************************
+ * CBenchmarkState
+ **********************************************************************************************************************/
+
+CBenchmarkState::CBenchmarkState(long iterations, int argument): wall(0), cpu(0), items(0), bytes(0),
+		total(iterations), done(0), argument(argument), paused(true), wall_start(0), cpu_start(0) {
+}
+
+void CBenchmarkState::start() {
+	resume();
+}
+
+void CBenchmarkState::stop() {
+	pause();
+}
+
+void CBenchmarkState::pause() {
+	if (paused) return;
+	wall += clockTime(CLOCK_MONOTONIC) - wall_start;
+	cpu += clockTime(CLOCK_PROCESS_CPUTIME_ID) - cpu_start;
+	paused = true;
+}
+
+void CBenchmarkState::resume() {
+	if (!paused) return;
+	paused = false;
+	cpu_start = clockTime(CLOCK_PROCESS_CPUTIME_ID);
+	wall_start = clockTime(CLOCK_MONOTONIC);
+}
+
+/***********************************************************************************************************************
+ * CBenchmark
+ **********************************************************************************************************************/
+
+CBenchmark::CBenchmark(const char *name, BenchmarkFunction function): name(name), function(function) {
+}
+
+CBenchmark *CBenchmark::add(const char *name, BenchmarkFunction function) {
+	CBenchmark *benchmark = new CBenchmark(name, function);
+	registry().push_back(benchmark);
+	return benchmark;
+}
+
+CBenchmark *CBenchmark::arg(int argument) {
+	arguments.push_back(argument);
+	return this;
+}
+
+CBenchmark *CBenchmark::range(int start, int limit, int multiplier) {
+	for (long argument = start; argument <= limit; argument *= (multiplier > 1 ? multiplier : 2)) {
+		arguments.push_back((int)argument);
+		if (argument == 0) break;
+	}
+	return this;
+}
+
+std::string CBenchmark::fullName(int index) const {
+	if (arguments.empty()) return name;
+	char argument[16];
+	snprintf(argument, sizeof(argument), "/%i", arguments[index]);
+	return name + argument;
+}
+
+CBenchmarkState CBenchmark::runOnce(BenchmarkFunction function, long iterations, int argument) {
+	CBenchmarkState state(iterations, argument);
+	function(state);
+	// a benchmark that returns without a last call to keepRunning() is stopped here
+	state.pause();
+	return state;
+}
+
+void CBenchmark::list() {
+	std::vector<CBenchmark*> & benchmarks = registry();
+	for (size_t b = 0; b < benchmarks.size(); ++b) {
+		int runs = benchmarks[b]->arguments.empty() ? 1 : benchmarks[b]->arguments.size();
+		for (int r = 0; r < runs; ++r) printf("%s\n", benchmarks[b]->fullName(r).c_str());
+	}
+}
+
+/**
+ * The iterations grow until a run takes the minimum time, by at most ten times per step, which is the number that the
+ * repetitions use. The time per iteration of the fastest repetition is what a benchmark costs without interference of
+ * other processes, the mean shows how much it varies.
+ */
+int CBenchmark::runAll(const std::string & filter, double minimum, int repetitions, bool csv) {
+	if (repetitions < 1) repetitions = 1;
+	int64_t minimum_ns = (int64_t)(minimum * 1e9);
+	if (csv) {
+		printf("name,iterations,time_ns,min_time_ns,cpu_ns,items_per_second,bytes_per_second,label\n");
+	} else {
+		printf("%-40s %14s %14s %14s %12s  %s\n", "Benchmark", "Time(ns)", "Min(ns)", "CPU(ns)", "Iterations",
+				"Rate");
+		printf("%s\n", std::string(112, '-').c_str());
+	}
+	int count = 0;
+	std::vector<CBenchmark*> & benchmarks = registry();
+	for (size_t b = 0; b < benchmarks.size(); ++b) {
+		CBenchmark & benchmark = *benchmarks[b];
+		int runs = benchmark.arguments.empty() ? 1 : benchmark.arguments.size();
+		for (int r = 0; r < runs; ++r) {
+			std::string name = benchmark.fullName(r);
+			if (!filter.empty() && name.find(filter) == std::string::npos) continue;
+			int argument = benchmark.arguments.empty() ? 0 : benchmark.arguments[r];
+
+			long iterations = 1;
+			CBenchmarkState state = runOnce(benchmark.function, iterations, argument);
+			while (state.wall < minimum_ns && iterations < BENCHMARK_MAX_ITERATIONS) {
+				double factor = state.wall > 0 ? 1.4 * minimum_ns / state.wall : 10;
+				factor = std::max(2.0, std::min(10.0, factor));
+				iterations = (long)(iterations * factor);
+				state = runOnce(benchmark.function, iterations, argument);
+			}
+
+			double total = 0, fastest = 0, cpu = 0, items = 0, bytes = 0;
+			for (int repetition = 0; repetition < repetitions; ++repetition) {
+				if (repetition > 0) state = runOnce(benchmark.function, iterations, argument);
+				double time = (double)state.wall / iterations;
+				total += time;
+				cpu += (double)state.cpu / iterations;
+				if (repetition == 0 || time < fastest) fastest = time;
+				if (state.wall > 0) {
+					items += state.items * 1e9 / state.wall;
+					bytes += state.bytes * 1e9 / state.wall;
+				}
+			}
+			total /= repetitions;
+			cpu /= repetitions;
+			items /= repetitions;
+			bytes /= repetitions;
+
+			if (csv) {
+				printf("%s,%li,%.1f,%.1f,%.1f,%.1f,%.1f,%s\n", name.c_str(), iterations, total, fastest, cpu, items,
+						bytes, state.label.c_str());
+			} else {
+				char rate[32] = "";
+				if (bytes > 0) {
+					snprintf(rate, sizeof(rate), "%.1f MB/s", bytes / 1e6);
+				} else if (items > 0) {
+					snprintf(rate, sizeof(rate), "%.3g items/s", items);
+				}
+				printf("%-40s %14.1f %14.1f %14.1f %12li  %s %s\n", name.c_str(), total, fastest, cpu, iterations, rate,
+						state.label.c_str());
+			}
+			fflush(stdout);
+			count++;
+		}
+	}
+	return count;
+}
@@ -0,0 +1,161 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Registry and runner of microbenchmarks, in the style of Google Benchmark
+ * @file CBenchmark.h
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Testing
+ */
+
+#ifndef CBENCHMARK_H_
+#define CBENCHMARK_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+ * A benchmark is a function that does its setup, then repeats the code under test while keepRunning() is true, and
+ * then cleans up:
+ *
+ *   static void imageAverage(CBenchmarkState & state) {
+ *   	CRawImage a(640, 480, 3), b(640, 480, 3);
+ *   	while (state.keepRunning()) a.average(b);
+ *   	state.setBytesProcessed(state.iterations() * 640 * 480 * 3);
+ *   }
+ *   BENCHMARK(imageAverage);
+ *   BENCHMARK(houghStandard)->arg(100)->arg(1000);
+ *
+ * Only the time between the first call of keepRunning() and the one that returns false is measured, less the time
+ * between pause() and resume(). The runner doubles the iterations until a run takes the minimum time, and then
+ * repeats that run. A benchmark with arguments is run once for every argument, it gets it with range().
+ */
+
+class CBenchmarkState {
+public:
+	CBenchmarkState(long iterations, int argument);
+
+	//! True as long as there are iterations to do, starts the clock at the first call and stops it at the last one
+	inline bool keepRunning() {
+		if (done == 0) start();
+		if (done < total) {
+			done++;
+			return true;
+		}
+		stop();
+		return false;
+	}
+
+	//! The number of iterations of this run
+	inline long iterations() const { return total; }
+
+	//! The argument of this run, 0 if the benchmark has none
+	inline int range() const { return argument; }
+
+	//! Leave the setup of an iteration out of the time
+	void pause();
+
+	void resume();
+
+	//! For a rate in items/s next to the time
+	inline void setItemsProcessed(int64_t items) { this->items = items; }
+
+	//! For a rate in MB/s next to the time
+	inline void setBytesProcessed(int64_t bytes) { this->bytes = bytes; }
+
+	//! A short text after the results, such as the name of the kernels that are used
+	inline void setLabel(const std::string & label) { this->label = label; }
+
+	//! Wall and process time of the run in ns
+	int64_t wall;
+	int64_t cpu;
+	int64_t items;
+	int64_t bytes;
+	std::string label;
+
+private:
+	void start();
+
+	void stop();
+
+	long total;
+	long done;
+	int argument;
+	bool paused;
+	int64_t wall_start;
+	int64_t cpu_start;
+};
+
+typedef void (*BenchmarkFunction)(CBenchmarkState & state);
+
+class CBenchmark {
+public:
+	//! Register a benchmark, the BENCHMARK macro calls this before main()
+	static CBenchmark *add(const char *name, BenchmarkFunction function);
+
+	//! Run the benchmark also with this argument, the first one replaces the run without argument
+	CBenchmark *arg(int argument);
+
+	//! Run the benchmark with start, start*multiplier, ..., up to and including limit
+	CBenchmark *range(int start, int limit, int multiplier = 8);
+
+	/**
+	 * Run all benchmarks of which the name contains filter, every one at least minimum seconds, repeated repetitions
+	 * times. The results go to standard out, as a table or as CSV. Returns the number of runs.
+	 */
+	static int runAll(const std::string & filter, double minimum, int repetitions, bool csv);
+
+	//! Print the names of the benchmarks, with their arguments
+	static void list();
+
+private:
+	CBenchmark(const char *name, BenchmarkFunction function);
+
+	//! A run of iterations, with the argument
+	static CBenchmarkState runOnce(BenchmarkFunction function, long iterations, int argument);
+
+	//! The name with the argument, if any, as "name/argument"
+	std::string fullName(int index) const;
+
+	std::string name;
+	BenchmarkFunction function;
+	std::vector<int> arguments;
+};
+
+//! Keep the compiler from optimizing away a result that is not used otherwise
+template <typename T>
+inline void benchmarkKeep(T const & value) {
+	asm volatile("" : : "g"(&value) : "memory");
+}
+
+//! Make the compiler assume that all memory is read and written here, so stores before it are not left out
+inline void benchmarkClobber() {
+	asm volatile("" : : : "memory");
+}
+
+#define BENCHMARK_CONCAT2(a, b) a##b
+#define BENCHMARK_CONCAT(a, b) BENCHMARK_CONCAT2(a, b)
+
+//! Register a function as benchmark, ->arg() and ->range() can be appended
+#define BENCHMARK(function) \
+	static CBenchmark *BENCHMARK_CONCAT(benchmark_, __LINE__) __attribute__((unused)) = \
+		CBenchmark::add(#function, function)
+
+#endif /* CBENCHMARK_H_ */
@@ -0,0 +1,140 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Microbenchmarks of Art of the fusion bridle on synthetic clusters
+ * @file benchArt.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Testing
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+/***********************************************************************************************************************
+ * Jockey framework includes
+ **********************************************************************************************************************/
+
+#include <CBenchmark.h>
+#include <art.h>
+
+/***********************************************************************************************************************
+ * Implementation
+ **********************************************************************************************************************/
+
+//! Inputs that are learned and classified per iteration, and the clusters they are drawn around
+#define ART_INPUTS 256
+#define ART_CLUSTERS 16
+#define ART_VIGILANCE 0.75f
+
+/**
+ * Inputs in [0,1] of size values each, around one of ART_CLUSTERS random centres, with the same values on every
+ * machine.
+ */
+static void clusters(std::vector<ART_TYPE> & inputs, int count, int size) {
+	uint32_t state = 1;
+	std::vector<ART_TYPE> centres(ART_CLUSTERS * size);
+	inputs.resize(count * size);
+	for (size_t i = 0; i < centres.size(); ++i) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		centres[i] = 0.1f + 0.8f * (state >> 8) / 16777216.0f;
+	}
+	for (int i = 0; i < count; ++i) {
+		for (int j = 0; j < size; ++j) {
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+			ART_TYPE noise = 0.1f * ((state >> 8) / 16777216.0f - 0.5f);
+			inputs[i * size + j] = centres[(i % ART_CLUSTERS) * size + j] + noise;
+		}
+	}
+}
+
+//! A network that learns ART_INPUTS inputs from scratch, the argument is the size of an input
+static void artLearn(CBenchmarkState & state) {
+	int size = state.range();
+	std::vector<ART_TYPE> inputs;
+	clusters(inputs, ART_INPUTS, size);
+	std::vector<int> choices(ART_INPUTS);
+	int prototypes = 0;
+	while (state.keepRunning()) {
+		state.pause();
+		Art *art = new Art(false, true, true);
+		art->setVigilance(ART_VIGILANCE);
+		art->setTestMatch(false);
+		state.resume();
+		art->classifyBatch(&inputs[0], ART_INPUTS, size, &choices[0]);
+		state.pause();
+		prototypes = art->getPrototypeCount();
+		delete art;
+		state.resume();
+	}
+	state.setItemsProcessed((int64_t)state.iterations() * ART_INPUTS);
+	char label[32];
+	snprintf(label, sizeof(label), "%i prototypes", prototypes);
+	state.setLabel(label);
+}
+BENCHMARK(artLearn)->arg(8)->arg(64);
+
+//! Classify ART_INPUTS inputs with a network that learned them already, without learning
+static void artClassify(CBenchmarkState & state) {
+	int size = state.range();
+	std::vector<ART_TYPE> inputs;
+	clusters(inputs, ART_INPUTS, size);
+	std::vector<int> choices(ART_INPUTS);
+	Art art(false, true, true);
+	art.setVigilance(ART_VIGILANCE);
+	art.setTestMatch(false);
+	art.classifyBatch(&inputs[0], ART_INPUTS, size, &choices[0]);
+	art.setTestMatch(true);
+	while (state.keepRunning()) {
+		art.classifyBatch(&inputs[0], ART_INPUTS, size, &choices[0]);
+		benchmarkKeep(choices[0]);
+	}
+	state.setItemsProcessed((int64_t)state.iterations() * ART_INPUTS);
+}
+BENCHMARK(artClassify)->arg(8)->arg(64);
+
+//! The same as artClassify, one input at a time through classifyInput() as the fusion jockey does
+static void artClassifyInput(CBenchmarkState & state) {
+	int size = state.range();
+	std::vector<ART_TYPE> inputs;
+	clusters(inputs, ART_INPUTS, size);
+	std::vector<int> choices(ART_INPUTS);
+	Art art(false, true, true);
+	art.setVigilance(ART_VIGILANCE);
+	art.setTestMatch(false);
+	art.classifyBatch(&inputs[0], ART_INPUTS, size, &choices[0]);
+	art.setTestMatch(true);
+	std::vector<ART_ASPECT> aspects(ART_INPUTS);
+	for (int i = 0; i < ART_INPUTS; ++i) {
+		aspects[i].assign(inputs.begin() + i * size, inputs.begin() + (i + 1) * size);
+	}
+	while (state.keepRunning()) {
+		for (int i = 0; i < ART_INPUTS; ++i) {
+			ART_DISTRIBUTED_CLASS *result = art.classifyInput(aspects[i]);
+			benchmarkKeep(result);
+		}
+	}
+	state.setItemsProcessed((int64_t)state.iterations() * ART_INPUTS);
+}
+BENCHMARK(artClassifyInput)->arg(8)->arg(64);
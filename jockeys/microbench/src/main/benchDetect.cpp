@@ -0,0 +1,146 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Microbenchmarks of CCircleDetect on a synthetic pattern
+ * @file benchDetect.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Testing
+ */
+
+#include <string.h>
+
+/***********************************************************************************************************************
+ * Jockey framework includes
+ **********************************************************************************************************************/
+
+#include <CBenchmark.h>
+#include <CRawImage.h>
+#include <CCircleDetect.h>
+
+/***********************************************************************************************************************
+ * Implementation
+ **********************************************************************************************************************/
+
+#define IMAGE_WIDTH 640
+#define IMAGE_HEIGHT 480
+
+//! The mapping pattern of cameradetection, its diameter in pixels in the image
+#define OUTER_DIAMETER 0.19
+#define INNER_DIAMETER 0.1
+#define PATTERN_PIXELS 60
+
+/**
+ * A white frame with a black ring around a white disc at [x,y], with a gradient over the background so the threshold
+ * matters. The pattern is far from the top left corner, so a search from scratch scans most of the frame.
+ */
+static void drawPattern(CRawImage & image, int x, int y) {
+	float outer = PATTERN_PIXELS / 2.0f, inner = outer * INNER_DIAMETER / OUTER_DIAMETER;
+	for (int j = 0; j < IMAGE_HEIGHT; ++j) {
+		for (int i = 0; i < IMAGE_WIDTH; ++i) {
+			float distance = sqrtf((i - x) * (i - x) + (j - y) * (j - y));
+			VALUE_TYPE value = 160 + (i + j) * 80 / (IMAGE_WIDTH + IMAGE_HEIGHT);
+			if (distance < outer && distance >= inner) value = 20;
+			VALUE_TYPE *pixel = image.data + (j * IMAGE_WIDTH + i) * 3;
+			pixel[0] = pixel[1] = pixel[2] = value;
+		}
+	}
+}
+
+/**
+ * A frame with the pattern, and the original to restore it from, the detector makes the inner circle of a pattern it
+ * finds black. The copy is not timed.
+ */
+struct PatternFrame {
+	CRawImage image, original;
+
+	PatternFrame(): image(IMAGE_WIDTH, IMAGE_HEIGHT, 3), original(IMAGE_WIDTH, IMAGE_HEIGHT, 3) {
+		drawPattern(original, 3 * IMAGE_WIDTH / 4, 3 * IMAGE_HEIGHT / 4);
+		restore();
+	}
+
+	inline void restore() {
+		memcpy(image.data, original.data, IMAGE_WIDTH * IMAGE_HEIGHT * 3);
+	}
+
+	inline void restore(CBenchmarkState & state) {
+		state.pause();
+		restore();
+		state.resume();
+	}
+};
+
+//! The argument is the backend, 0 for the flood fill and 1 for the runs
+static void configure(CCircleDetect & detector, int backend) {
+	detector.setBackend(backend == 1 ? SEG_RUNS : SEG_FLOOD_FILL);
+}
+
+//! Follow a pattern that is where it was in the last frame, which is what the detector does most of the time
+static void detectTracked(CBenchmarkState & state) {
+	PatternFrame frame;
+	CCircleDetect detector(IMAGE_WIDTH, IMAGE_HEIGHT, INNER_DIAMETER / OUTER_DIAMETER);
+	configure(detector, state.range());
+	SSegment segment;
+	memset(&segment, 0, sizeof(segment));
+	segment = detector.findSegment(&frame.image, segment);
+	while (state.keepRunning()) {
+		frame.restore(state);
+		segment = detector.findSegment(&frame.image, segment);
+		benchmarkKeep(segment);
+	}
+	state.setItemsProcessed(state.iterations());
+	state.setLabel(segment.valid ? "found" : "not found");
+}
+BENCHMARK(detectTracked)->arg(0)->arg(1);
+
+//! Search the whole frame every time, as after the pattern got lost
+static void detectLost(CBenchmarkState & state) {
+	PatternFrame frame;
+	CCircleDetect detector(IMAGE_WIDTH, IMAGE_HEIGHT, INNER_DIAMETER / OUTER_DIAMETER);
+	configure(detector, state.range());
+	SSegment lost, segment;
+	memset(&lost, 0, sizeof(lost));
+	memset(&segment, 0, sizeof(segment));
+	while (state.keepRunning()) {
+		frame.restore(state);
+		segment = detector.findSegment(&frame.image, lost);
+		benchmarkKeep(segment);
+	}
+	state.setItemsProcessed(state.iterations());
+	state.setLabel(segment.valid ? "found" : "not found");
+}
+BENCHMARK(detectLost)->arg(0)->arg(1);
+
+//! The same as detectLost, with the search in the decimated image first
+static void detectPyramid(CBenchmarkState & state) {
+	PatternFrame frame;
+	CCircleDetect detector(IMAGE_WIDTH, IMAGE_HEIGHT, INNER_DIAMETER / OUTER_DIAMETER);
+	detector.setPyramid(state.range());
+	SSegment lost, segment;
+	memset(&lost, 0, sizeof(lost));
+	memset(&segment, 0, sizeof(segment));
+	while (state.keepRunning()) {
+		frame.restore(state);
+		segment = detector.findSegment(&frame.image, lost);
+		benchmarkKeep(segment);
+	}
+	state.setItemsProcessed(state.iterations());
+	state.setLabel(segment.valid ? "found" : "not found");
+}
+BENCHMARK(detectPyramid)->arg(1)->arg(2);
@@ -0,0 +1,92 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Microbenchmarks of CHistogram and CMultiHistogram of the common bridle
+ * @file benchHistogram.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Testing
+ */
+
+/***********************************************************************************************************************
+ * Jockey framework includes
+ **********************************************************************************************************************/
+
+#include <CBenchmark.h>
+#include <CHistogram.h>
+#include <CMultiHistogram.h>
+
+/***********************************************************************************************************************
+ * Implementation
+ **********************************************************************************************************************/
+
+//! The infrared sensors of CLeds, which keep a histogram each
+#define HISTOGRAM_CHANNELS 8
+
+//! A push into a full sliding window and the statistics after it, as CLeds does per reading, the argument is the window
+static void histogramPush(CBenchmarkState & state) {
+	CHistogram<int, float> histogram;
+	histogram.set_sliding_window(state.range());
+	int value = 0;
+	for (int i = 0; i < state.range(); ++i) histogram.push(i & 0xFF);
+	while (state.keepRunning()) {
+		histogram.push(value++ & 0xFF);
+		float average = histogram.average();
+		float variance = histogram.variance();
+		benchmarkKeep(average);
+		benchmarkKeep(variance);
+	}
+	state.setItemsProcessed(state.iterations());
+}
+BENCHMARK(histogramPush)->range(10, 1000, 10);
+
+//! The same for floats, where the sums are compensated
+static void histogramPushFloat(CBenchmarkState & state) {
+	CHistogram<float, float> histogram;
+	histogram.set_sliding_window(state.range());
+	float value = 0;
+	for (int i = 0; i < state.range(); ++i) histogram.push(i * 0.01f);
+	while (state.keepRunning()) {
+		value += 0.01f;
+		histogram.push(value);
+		float average = histogram.average();
+		float variance = histogram.variance();
+		benchmarkKeep(average);
+		benchmarkKeep(variance);
+	}
+	state.setItemsProcessed(state.iterations());
+}
+BENCHMARK(histogramPushFloat)->range(10, 1000, 10);
+
+//! A reading of all sensors into the histograms of one CMultiHistogram, the argument is the window
+static void histogramMulti(CBenchmarkState & state) {
+	CMultiHistogram<int, float> histograms(state.range());
+	histograms.add(HISTOGRAM_CHANNELS);
+	int value = 0;
+	while (state.keepRunning()) {
+		for (int i = 0; i < HISTOGRAM_CHANNELS; ++i) {
+			histograms.push(i, (value + i) & 0xFF);
+			float average = histograms.average(i);
+			benchmarkKeep(average);
+		}
+		value++;
+	}
+	state.setItemsProcessed((int64_t)state.iterations() * HISTOGRAM_CHANNELS);
+}
+BENCHMARK(histogramMulti)->range(10, 1000, 10);
@@ -0,0 +1,129 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Microbenchmarks of the Hough transform of laserscan on synthetic laser lines
+ * @file benchHough.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Testing
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+/***********************************************************************************************************************
+ * Jockey framework includes
+ **********************************************************************************************************************/
+
+#include <CBenchmark.h>
+#include <DetectLineModuleExt.h>
+
+/***********************************************************************************************************************
+ * Implementation
+ **********************************************************************************************************************/
+
+#define IMAGE_WIDTH 640
+#define IMAGE_HEIGHT 480
+//! The size of the Hough space, as the default of linebench
+#define HOUGH_SIZE 100
+
+typedef dobots::Hough<DecPoint, dobots::DenseAccumulator<DecPoint> > LineHough;
+
+/**
+ * The points of two laser lines, a long and a short one, and one point in ten scattered over the image, as the laser
+ * gives on a wall with a box in front of it. The argument is the number of points.
+ */
+struct LinePoints {
+	std::vector<DecPoint> points;
+	std::vector<DecPoint*> references;
+
+	LinePoints(int count) {
+		uint32_t state = 1;
+		for (int i = 0; i < count; ++i) {
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+			int x, y;
+			if (i % 10 == 9) {
+				x = state % IMAGE_WIDTH;
+				y = (state >> 10) % IMAGE_HEIGHT;
+			} else if (i % 3 == 2) {
+				x = IMAGE_WIDTH / 2 + (state % (IMAGE_WIDTH / 4));
+				y = 100 + x / 3 + (int)((state >> 20) % 3);
+			} else {
+				x = state % IMAGE_WIDTH;
+				y = 300 - x / 8 + (int)((state >> 20) % 3);
+			}
+			points.push_back(DecPoint(x, y));
+		}
+		// the references are taken after all points are added, the vector can move its points while it grows
+		for (size_t p = 0; p < points.size(); ++p) references.push_back(&points[p]);
+	}
+};
+
+static LineHough *createHough(HoughTransformType type) {
+	ISize input;
+	input.x = IMAGE_WIDTH;
+	input.y = IMAGE_HEIGHT;
+	ASize size;
+	size.x = HOUGH_SIZE;
+	size.y = HOUGH_SIZE;
+	LineHough *hough = new LineHough(input, size);
+	hough->setType(type);
+	hough->getAccumulator()->setKeepSupport(false);
+	return hough;
+}
+
+//! Every point votes for every angle, the time only depends on the number of points
+static void houghStandard(CBenchmarkState & state) {
+	LinePoints cloud(state.range());
+	LineHough *hough = createHough(HOUGH);
+	while (state.keepRunning()) {
+		hough->clear();
+		hough->getAccumulator()->Reset();
+		hough->addPoints(cloud.references);
+		hough->doTransform(1, 0, 1);
+		benchmarkKeep(hough->getAccumulator()->getTopHits(0));
+	}
+	state.setItemsProcessed((int64_t)state.iterations() * state.range());
+	delete hough;
+}
+BENCHMARK(houghStandard)->range(100, 6400);
+
+//! Pairs of points vote until one line dominates, seeded the same for every iteration
+static void houghRandomized(CBenchmarkState & state) {
+	LinePoints cloud(state.range());
+	LineHough *hough = createHough(RANDOMIZED_HOUGH);
+	int steps = 0;
+	while (state.keepRunning()) {
+		hough->clear();
+		hough->getAccumulator()->Reset();
+		hough->seed(1);
+		hough->addPoints(cloud.references);
+		steps = hough->doTransform(10000, 20, 2);
+		benchmarkKeep(steps);
+	}
+	state.setItemsProcessed((int64_t)state.iterations() * state.range());
+	char label[32];
+	snprintf(label, sizeof(label), "%i steps", steps);
+	state.setLabel(label);
+	delete hough;
+}
+BENCHMARK(houghRandomized)->range(100, 6400);
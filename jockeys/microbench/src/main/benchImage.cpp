@@ -0,0 +1,179 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Microbenchmarks of CRawImage and CImageManip
+ * @file benchImage.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Testing
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+/***********************************************************************************************************************
+ * Jockey framework includes
+ **********************************************************************************************************************/
+
+#include <CBenchmark.h>
+#include <CRawImage.h>
+#include <CImageManip.h>
+
+/***********************************************************************************************************************
+ * Implementation
+ **********************************************************************************************************************/
+
+//! The size of the frames of the camera
+#define IMAGE_WIDTH 640
+#define IMAGE_HEIGHT 480
+
+//! The same noise on every machine, so the kernels see the same branches
+static void fillNoise(CRawImage & image, uint32_t seed) {
+	uint32_t state = seed ? seed : 1;
+	int size = image.getwidth() * image.getheight() * image.getbpp();
+	for (int i = 0; i < size; ++i) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		image.data[i] = state >> 24;
+	}
+}
+
+//! A laser line a few pixels wide at a different column in every row, on top of the image without laser
+static void drawLaser(const CRawImage & background, CRawImage & image) {
+	int width = image.getwidth(), height = image.getheight();
+	memcpy(image.data, background.data, width * height * 3);
+	for (int y = 0; y < height; ++y) {
+		int x = width / 4 + (y * 7) % (width / 2);
+		for (int dx = 0; dx < 3; ++dx) {
+			VALUE_TYPE *pixel = image.data + (y * width + x + dx) * 3;
+			pixel[0] = 255;
+			pixel[1] /= 2;
+			pixel[2] /= 2;
+		}
+	}
+}
+
+static void imageAverage(CBenchmarkState & state) {
+	CRawImage image(IMAGE_WIDTH, IMAGE_HEIGHT, 3), other(IMAGE_WIDTH, IMAGE_HEIGHT, 3);
+	fillNoise(image, 1);
+	fillNoise(other, 2);
+	while (state.keepRunning()) {
+		image.average(other);
+		benchmarkClobber();
+	}
+	state.setBytesProcessed((int64_t)state.iterations() * IMAGE_WIDTH * IMAGE_HEIGHT * 3);
+}
+BENCHMARK(imageAverage);
+
+static void imageMonochrome(CBenchmarkState & state) {
+	CRawImage image(IMAGE_WIDTH, IMAGE_HEIGHT, 3), grey(IMAGE_WIDTH, IMAGE_HEIGHT, 1);
+	fillNoise(image, 1);
+	while (state.keepRunning()) {
+		image.makeMonochrome(&grey);
+		benchmarkClobber();
+	}
+	state.setBytesProcessed((int64_t)state.iterations() * IMAGE_WIDTH * IMAGE_HEIGHT * 3);
+}
+BENCHMARK(imageMonochrome);
+
+//! The argument is the number of bytes per pixel, 1 for grey and 3 for colour
+static void imageCompress(CBenchmarkState & state) {
+	int bpp = state.range();
+	CRawImage image(IMAGE_WIDTH, IMAGE_HEIGHT, bpp), half(IMAGE_WIDTH / 2, IMAGE_HEIGHT / 2, bpp);
+	fillNoise(image, 1);
+	while (state.keepRunning()) {
+		image.compress(half.getView(), true);
+		benchmarkClobber();
+	}
+	state.setBytesProcessed((int64_t)state.iterations() * IMAGE_WIDTH * IMAGE_HEIGHT * bpp);
+}
+BENCHMARK(imageCompress)->arg(1)->arg(3);
+
+static void imageBrightness(CBenchmarkState & state) {
+	CRawImage image(IMAGE_WIDTH, IMAGE_HEIGHT, 3);
+	fillNoise(image, 1);
+	while (state.keepRunning()) {
+		double brightness = image.getOverallBrightness(true);
+		benchmarkKeep(brightness);
+	}
+	state.setBytesProcessed((int64_t)state.iterations() * IMAGE_WIDTH * IMAGE_HEIGHT * 3 / 2);
+}
+BENCHMARK(imageBrightness);
+
+static void manipDiffRed(CBenchmarkState & state) {
+	CRawImage background(IMAGE_WIDTH, IMAGE_HEIGHT, 3), laser(IMAGE_WIDTH, IMAGE_HEIGHT, 3);
+	CRawImage diff(IMAGE_WIDTH, IMAGE_HEIGHT, 3);
+	fillNoise(background, 1);
+	drawLaser(background, laser);
+	CImageManip manip(CS_RGB);
+	while (state.keepRunning()) {
+		manip.diff_red(&laser, &background, &diff);
+		benchmarkClobber();
+	}
+	state.setBytesProcessed((int64_t)state.iterations() * IMAGE_WIDTH * IMAGE_HEIGHT * 3 * 2);
+	state.setLabel(manip.getKernelName());
+}
+BENCHMARK(manipDiffRed);
+
+static void manipDiffRgb(CBenchmarkState & state) {
+	CRawImage background(IMAGE_WIDTH, IMAGE_HEIGHT, 3), laser(IMAGE_WIDTH, IMAGE_HEIGHT, 3);
+	CRawImage diff(IMAGE_WIDTH, IMAGE_HEIGHT, 3);
+	fillNoise(background, 1);
+	drawLaser(background, laser);
+	CImageManip manip(CS_RGB);
+	while (state.keepRunning()) {
+		manip.diff_rgb(&laser, &background, &diff);
+		benchmarkClobber();
+	}
+	state.setBytesProcessed((int64_t)state.iterations() * IMAGE_WIDTH * IMAGE_HEIGHT * 3 * 2);
+	state.setLabel(manip.getKernelName());
+}
+BENCHMARK(manipDiffRgb);
+
+static void manipRedVector(CBenchmarkState & state) {
+	CRawImage background(IMAGE_WIDTH, IMAGE_HEIGHT, 3), laser(IMAGE_WIDTH, IMAGE_HEIGHT, 3);
+	fillNoise(background, 1);
+	drawLaser(background, laser);
+	CImageManip manip(CS_RGB);
+	std::vector<int> vec;
+	while (state.keepRunning()) {
+		manip.red_vector(laser.getView(), background.getView(), 10, 10, 100, 50, vec);
+		benchmarkKeep(vec[0]);
+	}
+	state.setBytesProcessed((int64_t)state.iterations() * IMAGE_WIDTH * IMAGE_HEIGHT * 3 * 2);
+	state.setLabel(manip.getKernelName());
+}
+BENCHMARK(manipRedVector);
+
+//! The argument is the step of the grid
+static void manipMotion(CBenchmarkState & state) {
+	CRawImage image1(IMAGE_WIDTH, IMAGE_HEIGHT, 3), image2(IMAGE_WIDTH, IMAGE_HEIGHT, 3);
+	fillNoise(image1, 1);
+	fillNoise(image2, 2);
+	CImageManip manip(CS_RGB);
+	while (state.keepRunning()) {
+		int motion = manip.motion(image1.getView(), image2.getView(), state.range());
+		benchmarkKeep(motion);
+	}
+	state.setItemsProcessed((int64_t)state.iterations() * (IMAGE_WIDTH / state.range()) *
+			(IMAGE_HEIGHT / state.range()));
+}
+BENCHMARK(manipMotion)->arg(1)->arg(8);
@@ -0,0 +1,119 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Microbenchmarks of the filter of Map of the mapping jockey
+ * @file benchMap.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Testing
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+/***********************************************************************************************************************
+ * Jockey framework includes
+ **********************************************************************************************************************/
+
+#include <CBenchmark.h>
+#include <Map.h>
+
+/***********************************************************************************************************************
+ * Implementation
+ **********************************************************************************************************************/
+
+// the switches of Map.cpp that print at every update
+extern bool PRINT_MEASUREDPOS, PRINT_MATRICES, PRINT_LAND_MARKS, PRINT_ROB_POS, PRINT_MPTC;
+
+//! Distance between the landmarks, further apart than the TOLERANCE of Map so they are not taken for one
+#define LANDMARK_SPACING 1.5
+
+/**
+ * The measurement of landmark i as the camera of a Scout at the origin would give it, see toCamera() of mapbench. The
+ * landmarks are on a circle around the robot, so all of them are in view.
+ */
+static void measure(int i, int count, float *measured) {
+	double radius = LANDMARK_SPACING * count / (2 * M_PI);
+	if (radius < 1) radius = 1;
+	double angle = 2 * M_PI * i / count;
+	measured[0] = radius * cos(angle) - 0.049;
+	measured[1] = radius * sin(angle) + 0.018;
+	measured[2] = 0;
+	measured[3] = 0.1 - 0.09;
+}
+
+/**
+ * A map with the robot at the origin that has seen count landmarks, the argument. Map::filter() changes the pose it
+ * is given to the estimate, the odometry is put back before the next call, as mapbench does.
+ */
+struct MapFixture {
+	double robpos[10];
+	Map *map;
+
+	MapFixture(int count) {
+		PRINT_MEASUREDPOS = PRINT_MATRICES = PRINT_LAND_MARKS = PRINT_ROB_POS = PRINT_MPTC = false;
+		memset(robpos, 0, sizeof(robpos));
+		map = new Map(robpos, RobotBase::SCOUTBOT, 1);
+		for (int i = 0; i < count; ++i) observe(i, count);
+	}
+
+	~MapFixture() {
+		delete map;
+	}
+
+	inline void observe(int i, int count) {
+		float measured[4];
+		measure(i, count, measured);
+		double odometry[3] = { robpos[0], robpos[1], robpos[2] };
+		map->filter(robpos, measured);
+		memcpy(robpos, odometry, sizeof(odometry));
+	}
+};
+
+//! An update of the filter with a landmark that is on the map, the argument is the number of landmarks
+static void mapFilter(CBenchmarkState & state) {
+	int count = state.range();
+	MapFixture fixture(count);
+	int i = 0;
+	while (state.keepRunning()) {
+		fixture.observe(i, count);
+		if (++i == count) i = 0;
+	}
+	state.setItemsProcessed(state.iterations());
+	char label[32];
+	snprintf(label, sizeof(label), "%i landmarks", fixture.map->mapSize);
+	state.setLabel(label);
+}
+BENCHMARK(mapFilter)->range(4, 64, 4);
+
+//! A prediction from the odometry alone, the argument is the number of landmarks
+static void mapPredict(CBenchmarkState & state) {
+	int count = state.range();
+	MapFixture fixture(count);
+	while (state.keepRunning()) {
+		// both wheels a mm forward
+		fixture.robpos[0] += 0.001;
+		fixture.robpos[3] += 0.001;
+		fixture.robpos[4] += 0.001;
+		fixture.map->odometryChange(fixture.robpos);
+	}
+	state.setItemsProcessed(state.iterations());
+}
+BENCHMARK(mapPredict)->range(4, 64, 4);
@@ -0,0 +1,81 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Run the microbenchmarks of the bridles and the image, laser, fusion and map code of the jockeys
+ * @file microbench.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Testing
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string>
+
+/***********************************************************************************************************************
+ * Jockey framework includes
+ **********************************************************************************************************************/
+
+#include <CBenchmark.h>
+
+/***********************************************************************************************************************
+ * Implementation
+ **********************************************************************************************************************/
+
+static void usage(const char *name) {
+	printf("Usage: %s [options] [filter]\n", name);
+	printf("Runs the benchmarks of which the name contains filter, or all of them. The benchmarks are in the files\n");
+	printf("bench*.cpp, they use synthetic input, so they need no files and give the same work on every machine.\n");
+	printf("  -t seconds  minimum time of a run (default 0.5)\n");
+	printf("  -r count    repetitions of a run, the mean and the fastest are reported (default 3)\n");
+	printf("  -c          write CSV instead of a table\n");
+	printf("  -l          list the benchmarks\n");
+	printf("Build with TARGET_PLATFORM=HOST to run them on a workstation, for example under perf:\n");
+	printf("  perf record -g %s detect && perf report\n", name);
+}
+
+int main(int argc, char **argv) {
+	double minimum = 0.5;
+	int repetitions = 3;
+	bool csv = false;
+
+	int option;
+	while ((option = getopt(argc, argv, "t:r:clh")) != -1) {
+		switch (option) {
+		case 't': minimum = atof(optarg); break;
+		case 'r': repetitions = atoi(optarg); break;
+		case 'c': csv = true; break;
+		case 'l':
+			CBenchmark::list();
+			return EXIT_SUCCESS;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	std::string filter = (optind < argc) ? argv[optind] : "";
+
+	int runs = CBenchmark::runAll(filter, minimum, repetitions, csv);
+	if (runs == 0) {
+		fprintf(stderr, "No benchmark matches \"%s\", see -l\n", filter.c_str());
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
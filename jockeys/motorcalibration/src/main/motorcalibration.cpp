@@ -15,6 +15,9 @@
 #include <messageDataType.h>
 #include <CMotors.h>
 #include <CMotorsCalib.h>
+#include <COdometryFit.h>
+#include <COdometryEvaluation.h>
+#include <messageSchema.h>
 #include <Map.h>
 #include <Mapping.h>
 
@@ -30,8 +33,12 @@
 #define UBISENCE_POSITION_CHANNEL 55
 #define UBISENCE_MESSAGE_SERVER_CHANNEL 56
 #define DEBUGSTRING NAME << '[' << getpid() << "] " << __func__ << "(): "
+#define CALIB_FILE "/flash/motorCALIB.dat"
+#define CALIB_LOG "/flash/motorCALIB.log"
+//! Period of the main loop in us while the run of the fit is logged
+#define FIT_PERIOD 10000
 typedef enum {
-	WAIT = 0, CALIBRATION
+	WAIT = 0, CALIBRATION, EVALUATION
 } ActualCalibrationState;
 
 using namespace std;
@@ -56,6 +63,21 @@ Mapping* mapProcedure = NULL;
 bool stop = false;
 DetectedBlob* detectedBlob = NULL;
 
+//! With MOTOR_CALIBRATION_FIT set, a short run is logged and the odometry fitted to it, instead of CMotorsCalib
+bool fitMode = false;
+COdometryFit* odometryFit = NULL;
+int loggedSpeeds[3];
+//! With MOTOR_CALIBRATION_EVALUATE set, the calibration, also one that was read, is test driven before it is sent
+bool evaluateMode = false;
+COdometryEvaluation* evaluation = NULL;
+MotorCalibMethod calibrationMethod = CALIB_ONLINE;
+float fitResidual = 0;
+int myID = -1;
+//! The run of the fit and the test drive of the evaluation: forward, turn in calibrated speeds, duration in ms, short
+//! so the landmark stays in sight
+static const float fitRun[][3] = { { 1, 0, 1500 }, { -1, 0, 1500 }, { 0, 1, 600 }, { 0, -1, 600 },
+		{ 1, 0.5, 1000 }, { -1, -0.5, 1000 } };
+
 void interrupt_signal_handler(int signal) {
 	if (signal == SIGINT) {
 //RobotBase::MSPReset();
@@ -91,6 +113,11 @@ void initialize() {
 				<< std::endl;
 	}
 
+	char* robotID = getenv("sr_id");
+	if (robotID != NULL) {
+		myID = atoi(robotID);
+	}
+
 	std::cout << "Timer inicialization" << std::endl;
 	timer = new CTimer();
 	timer->start();
@@ -139,7 +166,12 @@ void readMessages() {
 			break;
 		case MSG_START: {
 
-			if (motor_calibration->readCalibResult()) {
+			bool stored = motor_calibration->readCalibResult();
+			if (stored) {
+				calibrationMethod = CALIB_STORED;
+				fitResidual = 0;
+			}
+			if (stored && !evaluateMode) {
 				printf("calibration succesfully readed: %e %e %e %d\n",
 						motor->odometry_koef1, motor->odometry_koef2,
 						motor->odometry_koef3,motor->calibratedSpeed);
@@ -160,12 +192,12 @@ void readMessages() {
 					usleep(10000);
 				}
 				leds->color(LC_ORANGE);
-				actualTask = CALIBRATION;
+				actualTask = stored ? EVALUATION : CALIBRATION;
 				if (robot_type == RobotBase::ACTIVEWHEEL) {
 					ActiveWheel *bot = (ActiveWheel*) robot;
 					printf("changing hinge \n");
 					bot->MoveHingeToAngle(8.3);
-					motor->getPosition()[5] = 163.4/180.0*M_PI;; //setting hinge to 160°
+					motor->setHinge(163.4/180.0*M_PI); //setting hinge to 160°
 					usleep(500000);
 
 				}
@@ -176,6 +208,16 @@ void readMessages() {
 			;
 			break;
 		case MSG_STOP: {
+			if (odometryFit != NULL) {
+				motor->stopMotion();
+				delete odometryFit;
+				odometryFit = NULL;
+			}
+			if (evaluation != NULL) {
+				motor->stopMotion();
+				delete evaluation;
+				evaluation = NULL;
+			}
 			motor->setSpeeds(0, 0);
 			leds->color(LC_RED);
 			robot->pauseSPI(true);
@@ -208,7 +250,8 @@ void readMessages() {
 			if (messagee.len != 0) {
 
 				DetectedBlobWSize* detected = new DetectedBlobWSize();
-				memcpy(detected, messagee.data, sizeof(DetectedBlobWSize));
+				memcpy(detected, messagee.data,
+						messagee.len < (int) sizeof(DetectedBlobWSize) ? messagee.len : sizeof(DetectedBlobWSize));
 				if (detectedBlob != NULL) {
 					delete detectedBlob;
 				}
@@ -230,6 +273,20 @@ void readMessages() {
 							robot_type);
 					printf("detected blob MC %f %f %f %f \n", conv[0], conv[1],
 							conv[3], conv[2]);
+					if (odometryFit != NULL) {
+						// the blob belongs to the speeds at the capture of the frame, not at its arrival
+						int blobTime = timer->getTime();
+						if (detected->timestamp != 0) {
+							struct timeval now;
+							gettimeofday(&now, NULL);
+							long long age = (long long) now.tv_sec * 1000000 + now.tv_usec - detected->timestamp;
+							if (age > 0) blobTime -= (int) (age / 1000);
+						}
+						odometryFit->addBlob(blobTime, conv);
+					}
+					if (evaluation != NULL) {
+						evaluation->addBlob(detected->timestamp, conv);
+					}
 				}
 
 			} else {
@@ -244,6 +301,113 @@ void readMessages() {
 	}
 }
 
+/**
+ * Waits for the landmark, drives fitRun with it in sight while the speeds and the measurements are logged, and fits
+ * the odometry to the log. If the fit fails the online calibration of CMotorsCalib takes over.
+ */
+void calibrateByFit() {
+	if (odometryFit == NULL) {
+		if (detectedBlob == NULL) {
+			motor->setSpeeds(0, 0);
+			return;
+		}
+		MotorCalibResult start = { motor->odometry_koef1, motor->odometry_koef2,
+				motor->odometry_koef3, motor->calibratedSpeed };
+		odometryFit = new COdometryFit(robot_type, motor->getPosition()[5], start);
+		odometryFit->addSpeeds(timer->getTime(), motor->actualspeed1, motor->actualspeed2, motor->actualspeed3);
+		loggedSpeeds[0] = motor->actualspeed1;
+		loggedSpeeds[1] = motor->actualspeed2;
+		loggedSpeeds[2] = motor->actualspeed3;
+		for (unsigned int i = 0; i < sizeof(fitRun) / sizeof(fitRun[0]); i++) {
+			motor->queueMotion(motor->motion(fitRun[i][0] * motor->calibratedSpeed,
+					fitRun[i][1] * motor->calibratedSpeed, fitRun[i][2] * 1000));
+		}
+		return;
+	}
+	if (motor->actualspeed1 != loggedSpeeds[0] || motor->actualspeed2 != loggedSpeeds[1]
+			|| motor->actualspeed3 != loggedSpeeds[2]) {
+		loggedSpeeds[0] = motor->actualspeed1;
+		loggedSpeeds[1] = motor->actualspeed2;
+		loggedSpeeds[2] = motor->actualspeed3;
+		odometryFit->addSpeeds(timer->getTime(), loggedSpeeds[0], loggedSpeeds[1], loggedSpeeds[2]);
+	}
+	if (!motor->motionDone()) {
+		return;
+	}
+	odometryFit->saveLog(CALIB_LOG);
+	if (odometryFit->fit()) {
+		motor->calibrate(odometryFit->getResult());
+		odometryFit->saveResult(CALIB_FILE);
+		motor_calibration->successful = true;
+		calibrationMethod = CALIB_FIT;
+		fitResidual = odometryFit->getResidual();
+	} else {
+		printf("falling back to the online calibration\n");
+		fitMode = false;
+	}
+	delete odometryFit;
+	odometryFit = NULL;
+}
+
+//! Send the calibration to the action selection, after the report of its test drive in the evaluation mode
+void sendCalibResult() {
+	MotorCalibResult calibres = { motor->odometry_koef1, motor->odometry_koef2, motor->odometry_koef3,
+			motor->calibratedSpeed };
+	message_server->sendMessage(MSG_MOTOR_CALIBRATION_RESULT, &calibres, sizeof(MotorCalibResult));
+}
+
+/**
+ * Waits for the landmark and drives fitRun with it in sight, with the calibration that was just made or read. The
+ * action selection broadcasts the report, so that the reports of all robots can be collected at one place.
+ */
+void evaluateCalibration() {
+	if (evaluation == NULL) {
+		if (detectedBlob == NULL) {
+			motor->setSpeeds(0, 0);
+			return;
+		}
+		evaluation = new COdometryEvaluation(motor);
+		for (unsigned int i = 0; i < sizeof(fitRun) / sizeof(fitRun[0]); i++) {
+			motor->queueMotion(motor->motion(fitRun[i][0] * motor->calibratedSpeed,
+					fitRun[i][1] * motor->calibratedSpeed, fitRun[i][2] * 1000));
+		}
+		return;
+	}
+	evaluation->update();
+	if (!motor->motionDone()) {
+		return;
+	}
+	MotorCalibReport report;
+	report.robot = myID;
+	report.robot_type = robot_type;
+	report.method = calibrationMethod;
+	report.result.odometry_koef1 = motor->odometry_koef1;
+	report.result.odometry_koef2 = motor->odometry_koef2;
+	report.result.odometry_koef3 = motor->odometry_koef3;
+	report.result.calibratedSpeed = motor->calibratedSpeed;
+	report.fit_residual = fitResidual;
+	evaluation->evaluate(report);
+	delete evaluation;
+	evaluation = NULL;
+	uint8_t buffer[sizeof(MotorCalibReportWire)];
+	int len = packMotorCalibReport(report, buffer);
+	message_server->sendMessage(MSG_MOTOR_CALIBRATION_REPORT, buffer, len);
+	sendCalibResult();
+	actualTask = WAIT;
+}
+
+//! Fit a log of an earlier run, on the robot or on a PC
+int fitLog(const char *log, const char *result) {
+	COdometryFit fit;
+	if (!fit.loadLog(log) || !fit.fit()) {
+		return 1;
+	}
+	MotorCalibResult calibres = fit.getResult();
+	printf("calibrated: %e %e %e %d\n", calibres.odometry_koef1, calibres.odometry_koef2,
+			calibres.odometry_koef3, calibres.calibratedSpeed);
+	return fit.saveResult(result) ? 0 : 1;
+}
+
 /**
  * Initializes 
  */
@@ -252,10 +416,17 @@ int main(int argc, char **argv) {
 	a.sa_handler = &interrupt_signal_handler;
 	sigaction(SIGINT, &a, NULL);
 
+	if (argc > 2 && std::string(argv[1]) == "fit") {
+		return fitLog(argv[2], argc > 3 ? argv[3] : CALIB_FILE);
+	}
+	fitMode = getenv("MOTOR_CALIBRATION_FIT") != NULL;
+	evaluateMode = getenv("MOTOR_CALIBRATION_EVALUATE") != NULL;
+
 	if (argc > 1) {
 		portMS = std::string(argv[1]);
 	} else {
 		std::cout << DEBUG << "Usage: message_server_port_number" << std::endl;
+		std::cout << DEBUG << "   or: fit calibration_log [calibration_file]" << std::endl;
 		return 1;
 	}
 
@@ -303,22 +474,32 @@ int main(int argc, char **argv) {
 			motor->setMotorSpeedsKB(0,0);
 			usleep(10000000);
 */
-			motor_calibration->calibrate(detectedBlob);
+			if (fitMode) {
+				calibrateByFit();
+			} else {
+				motor_calibration->calibrate(detectedBlob);
+				calibrationMethod = CALIB_ONLINE;
+				fitResidual = 0;
+			}
 #if defined(DEBUGODOCALIB)
 			printf("calib state: %d \n", motor_calibration->calibstate);
 			printf("filter iteration: %d \n",motor_calibration->filteriteration );
 #endif
 			if (motor_calibration->successful) {
-				actualTask = WAIT;
-				MotorCalibResult calibres = { motor->odometry_koef1,
-						motor->odometry_koef2, motor->odometry_koef3,
-						motor->calibratedSpeed };
-				message_server->sendMessage(MSG_MOTOR_CALIBRATION_RESULT,
-						&calibres, sizeof(MotorCalibResult));
+				if (evaluateMode) {
+					actualTask = EVALUATION;
+				} else {
+					actualTask = WAIT;
+					sendCalibResult();
+				}
 			}
 			//usleep(2000000);
 		}
 			break;
+		case EVALUATION: {
+			evaluateCalibration();
+		}
+			break;
 		case WAIT: {
 			usleep(100000);
 		}
@@ -327,7 +508,7 @@ int main(int argc, char **argv) {
 			usleep(100000);
 			break;
 		}
-		usleep(100000);
+		usleep(odometryFit != NULL || evaluation != NULL ? FIT_PERIOD : 100000);
 	}
 
 	motor->setMotorPosition(0, 0, 0);
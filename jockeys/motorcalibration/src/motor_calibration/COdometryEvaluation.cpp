@@ -0,0 +1,122 @@
+/*
+ * COdometryEvaluation.cpp
+ *
+ * Evaluation of a calibration of the odometry by a test drive in sight of a landmark.
+ */
+
+#include "COdometryEvaluation.h"
+#include <cstdio>
+#include <cmath>
+#include <sys/time.h>
+
+static double normalizeAngle(double angle) {
+	while (angle >= M_PI)
+		angle -= 2 * M_PI;
+	while (angle < -M_PI)
+		angle += 2 * M_PI;
+	return angle;
+}
+
+COdometryEvaluation::COdometryEvaluation(CMotors *motor) {
+	this->motor = motor;
+	double pose[10];
+	motor->getPosition(pose);
+	last[0] = pose[0];
+	last[1] = pose[1];
+	last[2] = pose[2];
+	distance = 0;
+	rotation = 0;
+}
+
+COdometryEvaluation::~COdometryEvaluation() {
+}
+
+void COdometryEvaluation::update() {
+	double pose[10];
+	motor->getPosition(pose);
+	distance += hypot(pose[0] - last[0], pose[1] - last[1]);
+	rotation += fabs(normalizeAngle(pose[2] - last[2]));
+	last[0] = pose[0];
+	last[1] = pose[1];
+	last[2] = pose[2];
+}
+
+//! The same geometry as the residuals of COdometryFit, the other way round
+void COdometryEvaluation::addBlob(long long time, const float *measured) {
+	double pose[10];
+	motor->getPosition(pose);
+	if (time != 0) motor->getPositionAt(time, pose);
+	double c = cos(pose[2]);
+	double s = sin(pose[2]);
+	Observation observation;
+	observation.landmark[0] = pose[0] + c * measured[0] - s * measured[1];
+	observation.landmark[1] = pose[1] + s * measured[0] + c * measured[1];
+	observation.landmark[2] = normalizeAngle(pose[2] + measured[2]);
+	observation.distance = distance;
+	observation.rotation = rotation;
+	observations.push_back(observation);
+}
+
+//! The angle is averaged as a unit vector, so that it does not jump at pi
+void COdometryEvaluation::mean(int first, int count, double *result) {
+	double sx = 0, sy = 0, sc = 0, ss = 0;
+	for (int i = first; i < first + count; i++) {
+		sx += observations[i].landmark[0];
+		sy += observations[i].landmark[1];
+		sc += cos(observations[i].landmark[2]);
+		ss += sin(observations[i].landmark[2]);
+	}
+	result[0] = sx / count;
+	result[1] = sy / count;
+	result[2] = atan2(ss, sc);
+}
+
+bool COdometryEvaluation::evaluate(MotorCalibReport & report) {
+	int count = observations.size();
+	report.observations = count;
+	report.distance = distance;
+	report.rotation = rotation;
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	report.timestamp = (uint64_t) now.tv_sec * 1000000 + now.tv_usec;
+	if (count < EVALUATION_MIN_OBSERVATIONS) {
+		printf("only %d measurements of the landmark, %d needed for an evaluation\n", count,
+				EVALUATION_MIN_OBSERVATIONS);
+		report.residual = report.max_residual = report.angle_residual = 0;
+		report.drift = report.angle_drift = 0;
+		return false;
+	}
+
+	double center[3];
+	mean(0, count, center);
+	double sum = 0, sumAngle = 0, largest = 0;
+	for (int i = 0; i < count; i++) {
+		double d = hypot(observations[i].landmark[0] - center[0], observations[i].landmark[1] - center[1]);
+		double a = normalizeAngle(observations[i].landmark[2] - center[2]);
+		sum += d * d;
+		sumAngle += a * a;
+		if (d > largest) largest = d;
+	}
+	report.residual = sqrt(sum / count);
+	report.max_residual = largest;
+	report.angle_residual = sqrt(sumAngle / count);
+
+	double start[3], end[3];
+	mean(0, EVALUATION_ENDS, start);
+	mean(count - EVALUATION_ENDS, EVALUATION_ENDS, end);
+	double driven = 0, turned = 0;
+	for (int i = 0; i < EVALUATION_ENDS; i++) {
+		driven += observations[count - 1 - i].distance - observations[i].distance;
+		turned += observations[count - 1 - i].rotation - observations[i].rotation;
+	}
+	driven /= EVALUATION_ENDS;
+	turned /= EVALUATION_ENDS;
+	double moved = hypot(end[0] - start[0], end[1] - start[1]);
+	double rotated = fabs(normalizeAngle(end[2] - start[2]));
+	report.drift = driven > 0 ? moved / driven : 0;
+	report.angle_drift = turned > 0 ? rotated / turned : 0;
+	printf("evaluation of %d measurements: residual %f m (max %f), %f rad, drift %f m/m, %f rad/rad over %f m, %f rad\n",
+			count, report.residual, report.max_residual, report.angle_residual, report.drift, report.angle_drift,
+			distance, rotation);
+	return true;
+}
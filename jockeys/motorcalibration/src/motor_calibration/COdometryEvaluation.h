@@ -0,0 +1,57 @@
+/*
+ * COdometryEvaluation.h
+ *
+ * Evaluation of a calibration of the odometry by a test drive in sight of a landmark.
+ */
+
+#include <CMotors.h>
+#include <messageDataType.h>
+#include <vector>
+
+#ifndef ODOMETRYEVALUATION_H_
+#define ODOMETRYEVALUATION_H_
+
+//! Fewer measurements of the landmark do not give a report
+#define EVALUATION_MIN_OBSERVATIONS 10
+//! Measurements averaged for the landmark at the start and at the end of the test drive
+#define EVALUATION_ENDS 3
+
+/**
+ * The landmark is fixed, so every measurement of it during the test drive, put into the world from the pose of the
+ * odometry at the capture of the frame, should give the same position. The spread of those positions is the residual
+ * of the calibration, and how far the landmark moves from the start to the end of the test drive is the drift of the
+ * odometry.
+ */
+class COdometryEvaluation {
+public:
+	COdometryEvaluation(CMotors *motor);
+	virtual ~COdometryEvaluation();
+	//! Follow the odometry for the distance and rotation of the test drive, call it in the loop of the test drive
+	void update();
+	//! A measurement of the landmark, converted to the robot: x, y, phi and z, from a frame captured at time in us
+	void addBlob(long long time, const float *measured);
+	inline int getObservations() const { return observations.size(); }
+	/**
+	 * Fill the statistics of the test drive into report, the fields of the calibration and the robot are left as they
+	 * are. False if there are fewer than EVALUATION_MIN_OBSERVATIONS measurements.
+	 */
+	bool evaluate(MotorCalibReport & report);
+private:
+	struct Observation {
+		//! The landmark in the world, x, y in m and phi in rad
+		double landmark[3];
+		//! Driven and turned from the start of the test drive until the measurement
+		double distance;
+		double rotation;
+	};
+	CMotors *motor;
+	std::vector<Observation> observations;
+	double last[3];
+	double distance;
+	double rotation;
+
+	//! The mean of count observations from first on
+	void mean(int first, int count, double *result);
+};
+
+#endif /* ODOMETRYEVALUATION_H_ */
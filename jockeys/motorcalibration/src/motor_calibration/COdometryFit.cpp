@@ -0,0 +1,365 @@
+/*
+ * COdometryFit.cpp
+ *
+ * Calibration of the odometry by a least squares fit over a logged run, instead of the stops of CMotorsCalib.
+ */
+
+#include "COdometryFit.h"
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+
+//! The deviations of a measurement in x, y and phi, the ones the filter of CMotorsCalib assumes
+static const double sigma[3] = { 0.0141, 0.122, 0.2 };
+
+static double normalizeAngle(double angle) {
+	while (angle >= M_PI)
+		angle -= 2 * M_PI;
+	while (angle < -M_PI)
+		angle += 2 * M_PI;
+	return angle;
+}
+
+//! Solve a x = b for a small n by Gauss elimination with partial pivoting, the solution is left in b
+static bool solve(double *a, double *b, int n) {
+	for (int i = 0; i < n; i++) {
+		int pivot = i;
+		for (int j = i + 1; j < n; j++) {
+			if (fabs(a[j * n + i]) > fabs(a[pivot * n + i])) pivot = j;
+		}
+		if (a[pivot * n + i] == 0) return false;
+		if (pivot != i) {
+			for (int k = 0; k < n; k++) {
+				double t = a[i * n + k];
+				a[i * n + k] = a[pivot * n + k];
+				a[pivot * n + k] = t;
+			}
+			double t = b[i];
+			b[i] = b[pivot];
+			b[pivot] = t;
+		}
+		for (int j = i + 1; j < n; j++) {
+			double f = a[j * n + i] / a[i * n + i];
+			for (int k = i; k < n; k++) {
+				a[j * n + k] -= f * a[i * n + k];
+			}
+			b[j] -= f * b[i];
+		}
+	}
+	for (int i = n - 1; i >= 0; i--) {
+		for (int k = i + 1; k < n; k++) {
+			b[i] -= a[i * n + k] * b[k];
+		}
+		b[i] /= a[i * n + i];
+	}
+	return true;
+}
+
+COdometryFit::COdometryFit() {
+	this->robot_type = RobotBase::UNKNOWN;
+	this->hinge = 0;
+	memset(&result, 0, sizeof(result));
+	residual = 0;
+}
+
+COdometryFit::COdometryFit(RobotBase::RobotType robot_type, double hinge, MotorCalibResult start) {
+	this->robot_type = robot_type;
+	this->hinge = hinge;
+	this->result = start;
+	residual = 0;
+}
+
+COdometryFit::~COdometryFit() {
+}
+
+void COdometryFit::addSpeeds(int time, int speed1, int speed2, int speed3) {
+	SpeedRecord record;
+	record.time = time;
+	record.speed[0] = speed1;
+	record.speed[1] = speed2;
+	record.speed[2] = speed3;
+	speeds.push_back(record);
+}
+
+void COdometryFit::addBlob(int time, const float *measured) {
+	BlobRecord record;
+	record.time = time;
+	memcpy(record.measured, measured, 4 * sizeof(float));
+	blobs.push_back(record);
+}
+
+/**
+ * The first line holds the robot, the hinge and the coefficients the fit starts from, then a line per change of the
+ * speeds and per measurement, in the order of time:
+ *
+ *   robot <type> <hinge> <koef1> <koef2> <koef3> <calibrated speed>
+ *   speed <ms> <speed1> <speed2> <speed3>
+ *   blob <ms> <x> <y> <phi> <z>
+ */
+bool COdometryFit::saveLog(const char *file) {
+	FILE *log = fopen(file, "w");
+	if (log == NULL) {
+		printf("can not write calibration log %s\n", file);
+		return false;
+	}
+	fprintf(log, "robot %d %f %e %e %e %d\n", robot_type, hinge, result.odometry_koef1, result.odometry_koef2,
+			result.odometry_koef3, result.calibratedSpeed);
+	size_t s = 0, b = 0;
+	while (s < speeds.size() || b < blobs.size()) {
+		if (b == blobs.size() || (s < speeds.size() && speeds[s].time <= blobs[b].time)) {
+			fprintf(log, "speed %d %d %d %d\n", speeds[s].time, speeds[s].speed[0], speeds[s].speed[1],
+					speeds[s].speed[2]);
+			s++;
+		} else {
+			fprintf(log, "blob %d %f %f %f %f\n", blobs[b].time, blobs[b].measured[0], blobs[b].measured[1],
+					blobs[b].measured[2], blobs[b].measured[3]);
+			b++;
+		}
+	}
+	fclose(log);
+	return true;
+}
+
+bool COdometryFit::loadLog(const char *file) {
+	FILE *log = fopen(file, "r");
+	if (log == NULL) {
+		printf("can not read calibration log %s\n", file);
+		return false;
+	}
+	int type;
+	if (fscanf(log, " robot %d %le %e %e %e %d", &type, &hinge, &result.odometry_koef1, &result.odometry_koef2,
+			&result.odometry_koef3, &result.calibratedSpeed) != 6) {
+		printf("calibration log %s does not start with the robot\n", file);
+		fclose(log);
+		return false;
+	}
+	robot_type = (RobotBase::RobotType) type;
+	speeds.clear();
+	blobs.clear();
+	char word[16];
+	while (fscanf(log, " %15s", word) == 1) {
+		if (strcmp(word, "speed") == 0) {
+			SpeedRecord record;
+			if (fscanf(log, "%d %d %d %d", &record.time, &record.speed[0], &record.speed[1], &record.speed[2]) != 4)
+				break;
+			speeds.push_back(record);
+		} else if (strcmp(word, "blob") == 0) {
+			BlobRecord record;
+			if (fscanf(log, "%d %f %f %f %f", &record.time, &record.measured[0], &record.measured[1],
+					&record.measured[2], &record.measured[3]) != 5)
+				break;
+			blobs.push_back(record);
+		} else {
+			printf("unknown record %s in calibration log\n", word);
+			break;
+		}
+	}
+	fclose(log);
+	return true;
+}
+
+//! The same format as CMotorsCalib writes and CMotors::readCalibResult() reads
+bool COdometryFit::saveResult(const char *file) {
+	FILE *calib = fopen(file, "wb");
+	if (calib == NULL) {
+		printf("can not write calibresults to file \n");
+		return false;
+	}
+	fprintf(calib, "%e\n%e\n%e\n%d\n", result.odometry_koef1, result.odometry_koef2, result.odometry_koef3,
+			result.calibratedSpeed);
+	fclose(calib);
+	return true;
+}
+
+//! The models of CMotors::countOdometryTime*, with the coefficients as parameters
+void COdometryFit::step(const double *koef, const int *speed, double timediff, double *pose) {
+	switch (robot_type) {
+	case RobotBase::SCOUTBOT: {
+		double dl = koef[0] * speed[0] * timediff;
+		double dr = -koef[1] * speed[1] * timediff;
+		double dphi = (dl - dr) / koef[2];
+		if (dl == dr || dl == -dr) {
+			pose[0] += (dl + dr) / 2.0 * cos(pose[2] + dphi);
+			pose[1] += (dl + dr) / 2.0 * sin(pose[2] + dphi);
+		} else {
+			double centric = (koef[2] * (dr + dl)) / (2 * (dr - dl));
+			pose[0] += -centric * (sin(pose[2] + dphi) - sin(pose[2]));
+			pose[1] += centric * (cos(pose[2] + dphi) - cos(pose[2]));
+		}
+		pose[2] += dphi;
+	}
+		break;
+	case RobotBase::KABOT: {
+		double dfront = timediff * koef[0] * speed[0];
+		double drear = timediff * koef[0] * speed[1];
+		double r = 0.3713;
+		pose[0] += dfront * cos(pose[2] + koef[1]) + drear * cos(pose[2] - koef[1]);
+		pose[1] += dfront * sin(pose[2] + koef[1]) + drear * sin(pose[2] - koef[1]);
+		pose[2] += (dfront * sin(pose[2] + koef[1]) - drear * sin(pose[2] - koef[1])) * r;
+	}
+		break;
+	case RobotBase::ACTIVEWHEEL: {
+		double delta = 0.523598776;
+		double L12 = 0.1051 * koef[2];
+		double L3 = (2 * sin(0.5 * hinge) * 0.105 - 0.05254) * koef[2];
+		double D = 2 * cos(delta) * (L12 + L3 * sin(delta));
+		double ld = koef[0] * timediff * (-speed[0]);
+		double pd = koef[0] * timediff * (-speed[1]);
+		double h = koef[1] * timediff * (-speed[2]);
+		double phi = pose[2];
+		double dx = ((-L12 * sin(phi) - L3 * cos(delta - phi)) * ld + (L12 * sin(phi) - L3 * cos(delta + phi)) * pd
+				+ (2 * L12 * cos(delta) * cos(phi)) * h) / D;
+		double dy = ((L12 * cos(phi) + L3 * sin(delta - phi)) * ld + (-L12 * cos(phi) - L3 * sin(delta + phi)) * pd
+				+ (2 * L12 * cos(delta) * sin(phi)) * h) / D;
+		double dphi = (cos(delta) * ld + cos(delta) * pd + sin(2 * delta) * h) / D;
+		double pok = 0.1575 - 0.105;
+		pose[0] += -dx + sin(phi) * pok - sin(phi + dphi) * pok;
+		pose[1] += -dy - cos(phi) * pok + cos(phi + dphi) * pok;
+		pose[2] += dphi;
+	}
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * The odometry is replayed from the first measurement on, the robot starts there at the origin, facing x. The
+ * landmark is at param[3], param[4] with heading param[5] in that frame.
+ */
+void COdometryFit::residuals(const double *param, double *error) {
+	double pose[3] = { 0, 0, 0 };
+	int speed[3] = { 0, 0, 0 };
+	size_t s = 0;
+	int time = blobs[0].time;
+	for (size_t b = 0; b < blobs.size(); b++) {
+		for (;;) {
+			while (s < speeds.size() && speeds[s].time <= time) {
+				memcpy(speed, speeds[s].speed, sizeof(speed));
+				s++;
+			}
+			if (time >= blobs[b].time) break;
+			int until = blobs[b].time;
+			if (s < speeds.size() && speeds[s].time < until) until = speeds[s].time;
+			while (time < until) {
+				int timediff = until - time < FIT_STEP ? until - time : FIT_STEP;
+				step(param, speed, timediff, pose);
+				time += timediff;
+			}
+		}
+		double dx = param[3] - pose[0];
+		double dy = param[4] - pose[1];
+		double c = cos(pose[2]);
+		double si = sin(pose[2]);
+		error[3 * b] = (c * dx + si * dy - blobs[b].measured[0]) / sigma[0];
+		error[3 * b + 1] = (-si * dx + c * dy - blobs[b].measured[1]) / sigma[1];
+		error[3 * b + 2] = normalizeAngle(param[5] - pose[2] - blobs[b].measured[2]) / sigma[2];
+	}
+}
+
+double COdometryFit::cost(const double *error, int count) {
+	double sum = 0;
+	for (int i = 0; i < count; i++) {
+		sum += error[i] * error[i];
+	}
+	return sum;
+}
+
+/**
+ * Levenberg-Marquardt over the coefficients and the landmark, with a Jacobian by differences. The coefficients differ
+ * by orders of magnitude, so they are fitted as multiples of the ones the fit starts from. The KaBot model does not
+ * use odometry_koef3, it stays as it is.
+ */
+bool COdometryFit::fit() {
+	if (blobs.size() < FIT_MIN_OBSERVATIONS) {
+		printf("only %d measurements of the landmark, %d needed for a fit\n", (int) blobs.size(),
+				FIT_MIN_OBSERVATIONS);
+		return false;
+	}
+	int count = 3 * blobs.size();
+	double scale[6] = { result.odometry_koef1, result.odometry_koef2, result.odometry_koef3, 1, 1, 1 };
+	double param[6] = { result.odometry_koef1, result.odometry_koef2, result.odometry_koef3,
+			blobs[0].measured[0], blobs[0].measured[1], blobs[0].measured[2] };
+	int index[6];
+	int n = 0;
+	for (int j = 0; j < 6; j++) {
+		if (j == 2 && robot_type == RobotBase::KABOT) continue;
+		if (scale[j] == 0) {
+			printf("can not fit from a coefficient of zero\n");
+			return false;
+		}
+		index[n++] = j;
+	}
+
+	std::vector<double> error(count), trial(count), jacobian(n * count);
+	residuals(param, &error[0]);
+	double current = cost(&error[0], count);
+	double lambda = 1e-3;
+	for (int iteration = 0; iteration < FIT_ITERATIONS && lambda < 1e10; iteration++) {
+		for (int k = 0; k < n; k++) {
+			int j = index[k];
+			double h = 1e-6 * fabs(scale[j]);
+			double saved = param[j];
+			param[j] += h;
+			residuals(param, &trial[0]);
+			param[j] = saved;
+			for (int i = 0; i < count; i++) {
+				jacobian[k * count + i] = (trial[i] - error[i]) / 1e-6;
+			}
+		}
+		double normal[36], gradient[6];
+		for (int k = 0; k < n; k++) {
+			gradient[k] = 0;
+			for (int i = 0; i < count; i++) {
+				gradient[k] -= jacobian[k * count + i] * error[i];
+			}
+			for (int l = 0; l < n; l++) {
+				double sum = 0;
+				for (int i = 0; i < count; i++) {
+					sum += jacobian[k * count + i] * jacobian[l * count + i];
+				}
+				normal[k * n + l] = sum;
+			}
+		}
+		bool improved = false;
+		while (!improved && lambda < 1e10) {
+			double a[36], delta[6], next[6];
+			memcpy(a, normal, sizeof(a));
+			memcpy(delta, gradient, sizeof(delta));
+			for (int k = 0; k < n; k++) {
+				a[k * n + k] *= 1 + lambda;
+			}
+			memcpy(next, param, sizeof(next));
+			if (solve(a, delta, n)) {
+				for (int k = 0; k < n; k++) {
+					next[index[k]] += delta[k] * fabs(scale[index[k]]);
+				}
+				residuals(next, &trial[0]);
+				double tried = cost(&trial[0], count);
+				if (tried < current) {
+					improved = true;
+					if (current - tried < 1e-10 * current) iteration = FIT_ITERATIONS;
+					memcpy(param, next, sizeof(param));
+					error.swap(trial);
+					current = tried;
+					lambda /= 10;
+				}
+			}
+			if (!improved) lambda *= 10;
+		}
+	}
+	residual = sqrt(current / count);
+	printf("fit of %d measurements: %e %e %e, landmark at %f %f %f, residual %f\n", (int) blobs.size(), param[0],
+			param[1], param[2], param[3], param[4], param[5], residual);
+	for (int k = 0; k < 3; k++) {
+		// a coefficient that changes sign or does not come out as a number means the log did not hold enough motion
+		if (!(param[k] * scale[k] > 0)) {
+			printf("fit of the odometry failed\n");
+			return false;
+		}
+	}
+	result.odometry_koef1 = param[0];
+	result.odometry_koef2 = param[1];
+	result.odometry_koef3 = param[2];
+	return true;
+}
@@ -0,0 +1,70 @@
+/*
+ * COdometryFit.h
+ *
+ * Calibration of the odometry by a least squares fit over a logged run, instead of the stops of CMotorsCalib.
+ */
+
+#include <CMotors.h>
+#include <vector>
+
+#ifndef ODOMETRYFIT_H_
+#define ODOMETRYFIT_H_
+
+//! Largest step in ms of the odometry replayed by the fit
+#define FIT_STEP 10
+//! Fewer measurements of the landmark do not give a fit
+#define FIT_MIN_OBSERVATIONS 15
+#define FIT_ITERATIONS 100
+
+/**
+ * Batch calibration of the odometry. The speeds of the wheels and the measurements of one landmark are logged over a
+ * whole run, and the coefficients of the odometry are solved for at once: the odometry is replayed from the log with
+ * trial coefficients, and Levenberg-Marquardt moves the coefficients, and the position of the landmark, until the
+ * landmark seen from the replayed poses matches the measurements best in the least squares sense.
+ *
+ * The robot does not have to stop for the measurements, so a run of a few seconds does what the stops of the online
+ * calibration of CMotorsCalib do in minutes. The log is a text file, so the fit can also be done on a PC.
+ */
+class COdometryFit {
+public:
+	COdometryFit();
+	COdometryFit(RobotBase::RobotType robot_type, double hinge, MotorCalibResult start);
+	virtual ~COdometryFit();
+	//! The speeds of the wheels, as CMotors::actualspeed1 to 3, from time in ms on
+	void addSpeeds(int time, int speed1, int speed2, int speed3);
+	//! A measurement of the landmark at time in ms, converted to the robot: x, y, phi and z
+	void addBlob(int time, const float *measured);
+	bool saveLog(const char *file);
+	bool loadLog(const char *file);
+	//! Fit the coefficients, false if there are too few measurements or the fit does not make sense
+	bool fit();
+	//! The coefficients, the fitted ones after fit(), in the file format of CMotors::readCalibResult()
+	inline MotorCalibResult getResult() const { return result; }
+	bool saveResult(const char *file);
+	inline int getObservations() const { return blobs.size(); }
+	//! Root mean square of the weighted residuals after fit()
+	inline double getResidual() const { return residual; }
+private:
+	struct SpeedRecord {
+		int time;
+		int speed[3];
+	};
+	struct BlobRecord {
+		int time;
+		float measured[4];
+	};
+	RobotBase::RobotType robot_type;
+	double hinge;
+	MotorCalibResult result;
+	double residual;
+	std::vector<SpeedRecord> speeds;
+	std::vector<BlobRecord> blobs;
+
+	//! The residuals of all measurements for the koefficients and the landmark in param
+	void residuals(const double *param, double *error);
+	//! Advance pose by timediff in ms with the model of CMotors for robot_type
+	void step(const double *koef, const int *speed, double timediff, double *pose);
+	double cost(const double *error, int count);
+};
+
+#endif /* ODOMETRYFIT_H_ */
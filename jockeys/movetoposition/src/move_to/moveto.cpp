@@ -1,287 +1,441 @@
-/*
- * moveto.cpp
- *
- *  Created on: Jul 15, 2013
- *      Author: replicator
- */
-
-#include "moveto.h"
-
-float xKonc;
-float yKonc;
-float phiKonc;
-float xPoc;
-float yPoc;
-float beta;
-float phiActual;
-float phiWanted;
-float rUhel;
-int P;
-bool goalSet = false;
-
-move_to::move_to(CMotors* motors, RobotBase::RobotType robot_type) {
-	// TODO Auto-generated constructor stub
-	motor = motors;
-	typ = robot_type;
-	alreadyTurned = false;
-}
-
-move_to::~move_to() {
-	// TODO Auto-generated destructor stub
-}
-
-int sign(float a) {
-	if (a > 0)
-		return +1;
-	if (a < 0)
-		return -1;
-	return 0;
-}
-
-int move_to::getTurn(float xPoc, float yPoc, float xKonc, float yKonc) {
-	float smerniceX = xPoc - xKonc;
-	float smerniceY = yPoc - yKonc;
-	float normalaX = smerniceY;
-	float normalaY = -smerniceX;
-	//fprintf(stdout, "pred motorama\n");
-	float x = motor->getPosition()[0];
-	float y = motor->getPosition()[1];
-	//fprintf(stdout,"return %i",sign(normalaX*x + normalaY*y));
-	return sign(normalaX * x + normalaY * y);
-}
-
-int move_to::move(RobotPosition f, UbiPosition u) {
-	int toReturn=0;
-//	if (goalSet == false) {
-	xKonc = f.x;
-	yKonc = f.y;
-	phiKonc = f.phi;
-	xPoc = u.x;
-	yPoc = u.y;
-	beta = atan2(yKonc - yPoc, xKonc - xPoc);
-//		goalSet = true;
-//	}
-	phiActual = motor->getPosition()[2];
-	if (phiActual >= M_PI)
-		phiActual -= 2 * M_PI;
-	if (phiActual < -M_PI)
-		phiActual += 2 * M_PI;
-	printf("cil: %f %f %f aktual: %f %f phi aktual %f beta %f\n", xKonc, yKonc,
-			phiKonc, u.x, u.y, phiActual, beta);
-	//motor->setMotorPosition(u.x, u.y, phiActual);
-
-	if (std::abs(u.x - f.x) > 0.15 || std::abs(u.y - f.y) > 0.15) {
-		//int smer = getTurn(xPoc, yPoc, xKonc, yKonc);
-		//fprintf(stdout, "smer : %i\n", smer);
-		rUhel = phiActual - beta;
-		if (rUhel >= M_PI)
-			rUhel -= 2 * M_PI;
-		if (rUhel < -M_PI)
-			rUhel += 2 * M_PI;
-		P = (int) 80 * rUhel;
-		if (P > 60)
-			P = 60;
-		if (P < -60)
-			P = -60;
-		printf("setspeeeeeed: %i uhel: %f \n", P, rUhel);
-		switch (typ) {
-		case RobotBase::ACTIVEWHEEL: {
-			if (abs(P) > 40) {
-				motor->setSpeeds(0, -P);
-				toReturn = 2;
-				printf("tunrning on position \n");
-			} else {
-            if (abs(P)>15) {
-				  motor->setSpeeds(60, -P*2);
-            } else {
-              motor->setSpeeds(60, -P*3);
-            }               
-				toReturn = 0;
-			}
-
-		}
-			break;
-		case RobotBase::SCOUTBOT: {
-			//P = P;
-         if (abs(P)>50) {
-            motor->setSpeeds(50,P);
-         } else if (abs(P)>20) {
-            motor->setSpeeds(42,P);
-         } else {
-			   motor->setSpeeds(36, P);
-         }
-			toReturn= 0;
-		}
-			break;
-		}
-
-	} else {
-		motor->setSpeeds(0, 0);
-		toReturn = 1;
-	}
-
-	return toReturn;
-
-//
-//	float beta = std::atan2(y - motor->getPosition()[1],
-//			x - motor->getPosition()[0]);
-//
-//	float vzd = std::sqrt(x * x + y * y);
-//	float vzdActual = vzd
-//			- std::sqrt(
-//					motor->getPosition()[0] * motor->getPosition()[0]
-//							+ motor->getPosition()[1]
-//									* motor->getPosition()[1]);
-//	float betaActual = std::atan2(y - motor->getPosition()[1],
-//			x - motor->getPosition()[0]);
-	//fprintf(stdout,"vzd : %f\n",vzd);
-	//fprintf(stdout,"vzdActual : %f\n",vzdActual);
-//	float vzdUjeta = std::sqrt(
-//			motor->getPosition()[0] * motor->getPosition()[0]
-//					+ motor->getPosition()[1] * motor->getPosition()[1]);
-
-//	fprintf(stdout, "x: %f y: %f phi : %f\n", motor->getPosition()[0],
-//			motor->getPosition()[1], motor->getPosition()[2]);
-	//pocatecni otoceni
-//	fprintf(stdout, "beta: %f, phiActual %f \n", beta, phiActual);
-//	if (std::abs(std::abs(beta) - std::abs(phiActual)) > 0.16
-//			&& (std::abs(std::abs(motor->getPosition()[0]) - std::abs(x)) > 0.05
-//					|| std::abs(std::abs(motor->getPosition()[1]) - std::abs(y))
-//							> 0.05)) { // >0.08  && !alreadyTurned
-//		fprintf(stdout, "pocOtoceni \n");
-//		int P;
-//		if (std::abs(std::abs(beta) - std::abs(phiActual)) > 0.2)
-//			P = 40; //P=40
-//		else
-//			P = 130 * std::abs(std::abs(beta) - std::abs(phiActual));
-//
-//		//motor->setSpeeds(P,sign(phiActual-phi)*(100-P));
-//		if (P < 41) {
-//			motor->setSpeeds(0, -sign(phiActual - beta) * P);
-//			//motor->setSpeeds(0,-sign(phiActual-beta)*P);
-//		} else {
-//			fprintf(stdout, "ses debil\n");
-//		}
-//
-//		phiActual = motor->getPosition()[2];
-//		//usleep(50000);
-//	} else if (std::abs(std::abs(motor->getPosition()[0]) - std::abs(x)) > 0.04
-//			|| std::abs(std::abs(motor->getPosition()[1]) - std::abs(y))
-//					> 0.04) { //vzdUjeta<vzd
-//		alreadyTurned = true;
-//		fprintf(stdout, "jizda \n");
-//
-//		int P = 40;
-//		if (vzdActual > 0.05)
-//			P = 40;
-//		else
-//			P = 40 * std::abs(vzdActual);
-//		if (P < 35)
-//			P = 35;
-//		//motor->setSpeeds(P,sign(phiActual-phi)*(100-P));
-//		if (P < 41) {
-//			int smer = getTurn(xPoc, yPoc, x, y);
-//			fprintf(stdout, "smer : %i\n", smer);
-//
-//			motor->setSpeeds(P, smer * 30);
-//		} else {
-//			fprintf(stdout, "ses debil\n");
-//		}
-//		//fprintf(stdout,"vzd : %f\n",vzd);
-//		//fprintf(stdout,"vzsActual : %f\n",vzdActual);
-//		//fprintf(stdout,"vzdUjeta : %f\n",vzdUjeta);
-//
-//		//fprintf(stdout,"x: %f\n",motor->getPosition()[0]);
-//		//fprintf(stdout,"y : %f\n",motor->getPosition()[1]);
-//		vzdUjeta = std::sqrt(
-//				motor->getPosition()[0] * motor->getPosition()[0]
-//						+ motor->getPosition()[1] * motor->getPosition()[1]);
-//
-//		vzdActual = std::sqrt(
-//				(x - motor->getPosition()[0]) * (x - motor->getPosition()[0])
-//						+ (y - motor->getPosition()[1])
-//								* (y - motor->getPosition()[1]));
-//		//usleep(5000);
-//	} else if (std::abs(std::abs(phi) - std::abs(phiActual)) > 0.16) {
-//
-//		int P;
-//		if (std::abs(std::abs(phi) - std::abs(phiActual)) > 0.2)
-//			P = 40;
-//		else
-//			P = 130 * std::abs(std::abs(phi) - std::abs(phiActual));
-//
-//		//motor->setSpeeds(P,sign(phiActual-phi)*(100-P));
-//		if (P < 41) {
-//			motor->setSpeeds(0, sign(phi - phiActual) * P);
-//		} else {
-//			fprintf(stdout, "ses debil\n");
-//		}
-//		fprintf(stdout, "koncOtoceni %f > 0.08\n rychlost otaceni %f",
-//				std::abs(std::abs(phi) - std::abs(phiActual)),
-//				sign(phi - phiActual) * P);
-//		fprintf(stdout, "x: %f\n", motor->getPosition()[0]);
-//		fprintf(stdout, "y : %f\n", motor->getPosition()[1]);
-//
-//	} else {
-//		motor->setSpeeds(0, 0);
-//		fprintf(stdout, "x: %f\n", motor->getPosition()[0]);
-//		fprintf(stdout, "y : %f\n", motor->getPosition()[1]);
-//		//usleep(50000);
-//		alreadyTurned = false;
-//		return 1;
-//	}
-//	return 0;
-
-}
-
-int move_to::turn(RobotPosition f) {
-	phiActual = motor->getPosition()[2];
-	if (phiActual >= M_PI)
-		phiActual -= 2 * M_PI;
-	if (phiActual < -M_PI)
-		phiActual += 2 * M_PI;
-	phiWanted = f.phi;
-	if (phiWanted >= M_PI)
-		phiWanted -= 2 * M_PI;
-	if (phiWanted < -M_PI)
-		phiWanted += 2 * M_PI;
-
-	rUhel = phiActual - phiWanted;
-	if (rUhel >= M_PI)
-		rUhel -= 2 * M_PI;
-	if (rUhel < -M_PI)
-		rUhel += 2 * M_PI;
-	P = 1;
-	printf("turning actual: %f wanted %f rUhel: %f PI: %f\n", phiActual, phiWanted,rUhel,M_PI);
-
-//	if(rUhel<1){
-//		P = std::abs(rUhel);
-//	}
-//	if(P < 0.5){
-//		P = 0.5;
-//	}
-
-	if (std::abs(rUhel) > 0.17) {
-		printf("nedotoceno\n");
-		printf("tocim rychlosti %i, rozdil %f\n",(int)P*sign(rUhel)*motor->calibratedSpeed, rUhel);
-
-		switch (typ) {
-		case RobotBase::ACTIVEWHEEL: {
-			motor->setSpeeds(0, (int)-P*sign(rUhel)*motor->calibratedSpeed);
-		}
-			break;
-		case RobotBase::SCOUTBOT: {
-			motor->setSpeeds(0, (int)-P*sign(rUhel)*motor->calibratedSpeed*0.7);
-		}
-			break;
-		}
-		return 0;
-	} else {
-		printf("dotoceno\n");
-		motor->setSpeeds(0, 0);
-		usleep(5000);
-		return 1;
-
-	}
-}
-
+/*
+ * moveto.cpp
+ *
+ *  Created on: Jul 15, 2013
+ *      Author: replicator
+ */
+
+#include "moveto.h"
+#include <sys/time.h>
+#include <unistd.h>
+
+float xKonc;
+float yKonc;
+float phiKonc;
+float xPoc;
+float yPoc;
+float beta;
+float phiActual;
+float phiWanted;
+float rUhel;
+int P;
+bool goalSet = false;
+
+static long long controlTime() {
+	struct timeval time;
+	gettimeofday(&time, NULL);
+	return (long long) time.tv_sec * 1000000 + time.tv_usec;
+}
+
+static double normalizeAngle(double angle) {
+	while (angle >= M_PI)
+		angle -= 2 * M_PI;
+	while (angle < -M_PI)
+		angle += 2 * M_PI;
+	return angle;
+}
+
+move_to::move_to(CMotors* motors, RobotBase::RobotType robot_type) {
+	motor = motors;
+	typ = robot_type;
+	alreadyTurned = false;
+	historyHead = 0;
+	historySize = 0;
+	delay = 0;
+	positionKnown = false;
+	headingKnown = false;
+	active = false;
+	onPosition = 0;
+	turned = 0;
+	pthread_mutex_init(&poseMutex, NULL);
+	running = true;
+	if (pthread_create(&controlThread, NULL, &move_to::runControl, this) != 0) {
+		fprintf(stderr, "move_to: could not start the control thread\n");
+		running = false;
+	}
+}
+
+move_to::~move_to() {
+	if (running) {
+		running = false;
+		pthread_join(controlThread, NULL);
+	}
+	pthread_mutex_destroy(&poseMutex);
+}
+
+void move_to::start(RobotPosition goal) {
+	active = false;
+	finalPosition = goal;
+	onPosition = 0;
+	turned = 0;
+	__sync_synchronize();
+	active = true;
+}
+
+void move_to::halt() {
+	active = false;
+	// the control thread may be in a step, wait for it to end before the wheels stop
+	pthread_mutex_lock(&poseMutex);
+	pthread_mutex_unlock(&poseMutex);
+	motor->setSpeeds(0, 0);
+}
+
+void move_to::setDelay(int delay) {
+	this->delay = delay;
+}
+
+void* move_to::runControl(void *mover) {
+	((move_to*) mover)->controlLoop();
+	return NULL;
+}
+
+/**
+ * Like the odometry of CMotors the loop wakes up at fixed times, so the control law sees a fixed period, which its
+ * gains are tuned for.
+ */
+void move_to::controlLoop() {
+	long long next = controlTime();
+	while (running) {
+		next += MOVETO_PERIOD;
+		long long now = controlTime();
+		if (next > now) {
+			usleep(next - now);
+		} else if (now - next > 10 * MOVETO_PERIOD) {
+			next = now;
+		}
+		control();
+	}
+}
+
+void move_to::control() {
+	double pose[10];
+	pthread_mutex_lock(&poseMutex);
+	motor->getPosition(pose);
+	record(controlTime(), pose);
+	if (active) {
+		if (!headingKnown) {
+			// drive ahead, two fixes far enough apart give the heading
+			if (typ == RobotBase::ACTIVEWHEEL) {
+				motor->setSpeeds(60, 0);
+			} else {
+				motor->setSpeeds(45, 0);
+			}
+		} else if (onPosition != 1) {
+			onPosition = move(finalPosition, pose);
+		} else if (turned == 0) {
+			turned = turn(finalPosition, pose);
+			if (turned == 1) active = false;
+		}
+	}
+	pthread_mutex_unlock(&poseMutex);
+}
+
+void move_to::record(long long time, const double *pose) {
+	history[historyHead].time = time;
+	history[historyHead].x = pose[0];
+	history[historyHead].y = pose[1];
+	history[historyHead].phi = pose[2];
+	historyHead = (historyHead + 1) % MOVETO_HISTORY;
+	if (historySize < MOVETO_HISTORY) historySize++;
+}
+
+//! The newest recorded pose that is not later than time, or the oldest one if all are
+void move_to::poseAt(long long time, PoseStamp & result) {
+	if (historySize == 0) {
+		double pose[10];
+		motor->getPosition(pose);
+		result.time = controlTime();
+		result.x = pose[0];
+		result.y = pose[1];
+		result.phi = pose[2];
+		return;
+	}
+	int i = (historyHead + MOVETO_HISTORY - 1) % MOVETO_HISTORY;
+	for (int n = 1; n < historySize && history[i].time > time; n++) {
+		i = (i + MOVETO_HISTORY - 1) % MOVETO_HISTORY;
+	}
+	result = history[i];
+}
+
+//! Correct the odometry and everything recorded of it, so a later fix is not corrected twice
+void move_to::correct(double dx, double dy, double dphi) {
+	motor->correctPosition(dx, dy, dphi);
+	for (int i = 0; i < historySize; i++) {
+		history[i].x += dx;
+		history[i].y += dy;
+		history[i].phi += dphi;
+	}
+	anchorOdometry.x += dx;
+	anchorOdometry.y += dy;
+	anchorOdometry.phi += dphi;
+}
+
+/**
+ * The heading follows from the direction the robot travelled between two fixes, against the direction it travelled in
+ * its odometry, it is only measured when the odometry moved as well, so a fix that jumps while the robot turns on the
+ * spot does not spin the heading.
+ */
+void move_to::fix(UbiPosition u) {
+	PoseStamp then;
+	pthread_mutex_lock(&poseMutex);
+	poseAt(controlTime() - (long long) delay * 1000, then);
+	if (!positionKnown) {
+		correct(u.x - then.x, u.y - then.y, 0);
+		anchor = u;
+		anchorOdometry = then;
+		anchorOdometry.x = u.x;
+		anchorOdometry.y = u.y;
+		positionKnown = true;
+		pthread_mutex_unlock(&poseMutex);
+		return;
+	}
+	correct(MOVETO_GAIN_POSITION * (u.x - then.x), MOVETO_GAIN_POSITION * (u.y - then.y), 0);
+	then.x += MOVETO_GAIN_POSITION * (u.x - then.x);
+	then.y += MOVETO_GAIN_POSITION * (u.y - then.y);
+	double travelled = hypot(u.x - anchor.x, u.y - anchor.y);
+	if (travelled > MOVETO_HEADING_BASE) {
+		double odometryTravelled = hypot(then.x - anchorOdometry.x, then.y - anchorOdometry.y);
+		if (odometryTravelled > MOVETO_HEADING_BASE / 2) {
+			double error = normalizeAngle(atan2(u.y - anchor.y, u.x - anchor.x)
+					- atan2(then.y - anchorOdometry.y, then.x - anchorOdometry.x));
+			if (headingKnown) {
+				correct(0, 0, MOVETO_GAIN_HEADING * error);
+			} else {
+				correct(0, 0, error);
+				printf("heading from Ubisense %f\n", then.phi + error);
+				headingKnown = true;
+			}
+		}
+		anchor = u;
+		poseAt(controlTime() - (long long) delay * 1000, anchorOdometry);
+	}
+	pthread_mutex_unlock(&poseMutex);
+}
+
+int sign(float a) {
+	if (a > 0)
+		return +1;
+	if (a < 0)
+		return -1;
+	return 0;
+}
+
+int move_to::getTurn(float xPoc, float yPoc, float xKonc, float yKonc) {
+	float smerniceX = xPoc - xKonc;
+	float smerniceY = yPoc - yKonc;
+	float normalaX = smerniceY;
+	float normalaY = -smerniceX;
+	//fprintf(stdout, "pred motorama\n");
+	float x = motor->getPosition()[0];
+	float y = motor->getPosition()[1];
+	//fprintf(stdout,"return %i",sign(normalaX*x + normalaY*y));
+	return sign(normalaX * x + normalaY * y);
+}
+
+//! One step of the control law on the fused pose, called every MOVETO_PERIOD
+int move_to::move(const RobotPosition & f, const double *pose) {
+	int toReturn=0;
+	xKonc = f.x;
+	yKonc = f.y;
+	phiKonc = f.phi;
+	xPoc = pose[0];
+	yPoc = pose[1];
+	beta = atan2(yKonc - yPoc, xKonc - xPoc);
+	phiActual = normalizeAngle(pose[2]);
+
+	if (std::abs(xPoc - f.x) > 0.15 || std::abs(yPoc - f.y) > 0.15) {
+		//int smer = getTurn(xPoc, yPoc, xKonc, yKonc);
+		//fprintf(stdout, "smer : %i\n", smer);
+		rUhel = phiActual - beta;
+		if (rUhel >= M_PI)
+			rUhel -= 2 * M_PI;
+		if (rUhel < -M_PI)
+			rUhel += 2 * M_PI;
+		P = (int) 80 * rUhel;
+		if (P > 60)
+			P = 60;
+		if (P < -60)
+			P = -60;
+		switch (typ) {
+		case RobotBase::ACTIVEWHEEL: {
+			if (abs(P) > 40) {
+				motor->setSpeeds(0, -P);
+				toReturn = 2;
+			} else {
+            if (abs(P)>15) {
+				  motor->setSpeeds(60, -P*2);
+            } else {
+              motor->setSpeeds(60, -P*3);
+            }               
+				toReturn = 0;
+			}
+
+		}
+			break;
+		case RobotBase::SCOUTBOT: {
+			//P = P;
+         if (abs(P)>50) {
+            motor->setSpeeds(50,P);
+         } else if (abs(P)>20) {
+            motor->setSpeeds(42,P);
+         } else {
+			   motor->setSpeeds(36, P);
+         }
+			toReturn= 0;
+		}
+			break;
+		}
+
+	} else {
+		motor->setSpeeds(0, 0);
+		printf("on position (%f, %f)\n", xPoc, yPoc);
+		toReturn = 1;
+	}
+
+	return toReturn;
+
+//
+//	float beta = std::atan2(y - motor->getPosition()[1],
+//			x - motor->getPosition()[0]);
+//
+//	float vzd = std::sqrt(x * x + y * y);
+//	float vzdActual = vzd
+//			- std::sqrt(
+//					motor->getPosition()[0] * motor->getPosition()[0]
+//							+ motor->getPosition()[1]
+//									* motor->getPosition()[1]);
+//	float betaActual = std::atan2(y - motor->getPosition()[1],
+//			x - motor->getPosition()[0]);
+	//fprintf(stdout,"vzd : %f\n",vzd);
+	//fprintf(stdout,"vzdActual : %f\n",vzdActual);
+//	float vzdUjeta = std::sqrt(
+//			motor->getPosition()[0] * motor->getPosition()[0]
+//					+ motor->getPosition()[1] * motor->getPosition()[1]);
+
+//	fprintf(stdout, "x: %f y: %f phi : %f\n", motor->getPosition()[0],
+//			motor->getPosition()[1], motor->getPosition()[2]);
+	//pocatecni otoceni
+//	fprintf(stdout, "beta: %f, phiActual %f \n", beta, phiActual);
+//	if (std::abs(std::abs(beta) - std::abs(phiActual)) > 0.16
+//			&& (std::abs(std::abs(motor->getPosition()[0]) - std::abs(x)) > 0.05
+//					|| std::abs(std::abs(motor->getPosition()[1]) - std::abs(y))
+//							> 0.05)) { // >0.08  && !alreadyTurned
+//		fprintf(stdout, "pocOtoceni \n");
+//		int P;
+//		if (std::abs(std::abs(beta) - std::abs(phiActual)) > 0.2)
+//			P = 40; //P=40
+//		else
+//			P = 130 * std::abs(std::abs(beta) - std::abs(phiActual));
+//
+//		//motor->setSpeeds(P,sign(phiActual-phi)*(100-P));
+//		if (P < 41) {
+//			motor->setSpeeds(0, -sign(phiActual - beta) * P);
+//			//motor->setSpeeds(0,-sign(phiActual-beta)*P);
+//		} else {
+//			fprintf(stdout, "ses debil\n");
+//		}
+//
+//		phiActual = motor->getPosition()[2];
+//		//usleep(50000);
+//	} else if (std::abs(std::abs(motor->getPosition()[0]) - std::abs(x)) > 0.04
+//			|| std::abs(std::abs(motor->getPosition()[1]) - std::abs(y))
+//					> 0.04) { //vzdUjeta<vzd
+//		alreadyTurned = true;
+//		fprintf(stdout, "jizda \n");
+//
+//		int P = 40;
+//		if (vzdActual > 0.05)
+//			P = 40;
+//		else
+//			P = 40 * std::abs(vzdActual);
+//		if (P < 35)
+//			P = 35;
+//		//motor->setSpeeds(P,sign(phiActual-phi)*(100-P));
+//		if (P < 41) {
+//			int smer = getTurn(xPoc, yPoc, x, y);
+//			fprintf(stdout, "smer : %i\n", smer);
+//
+//			motor->setSpeeds(P, smer * 30);
+//		} else {
+//			fprintf(stdout, "ses debil\n");
+//		}
+//		//fprintf(stdout,"vzd : %f\n",vzd);
+//		//fprintf(stdout,"vzsActual : %f\n",vzdActual);
+//		//fprintf(stdout,"vzdUjeta : %f\n",vzdUjeta);
+//
+//		//fprintf(stdout,"x: %f\n",motor->getPosition()[0]);
+//		//fprintf(stdout,"y : %f\n",motor->getPosition()[1]);
+//		vzdUjeta = std::sqrt(
+//				motor->getPosition()[0] * motor->getPosition()[0]
+//						+ motor->getPosition()[1] * motor->getPosition()[1]);
+//
+//		vzdActual = std::sqrt(
+//				(x - motor->getPosition()[0]) * (x - motor->getPosition()[0])
+//						+ (y - motor->getPosition()[1])
+//								* (y - motor->getPosition()[1]));
+//		//usleep(5000);
+//	} else if (std::abs(std::abs(phi) - std::abs(phiActual)) > 0.16) {
+//
+//		int P;
+//		if (std::abs(std::abs(phi) - std::abs(phiActual)) > 0.2)
+//			P = 40;
+//		else
+//			P = 130 * std::abs(std::abs(phi) - std::abs(phiActual));
+//
+//		//motor->setSpeeds(P,sign(phiActual-phi)*(100-P));
+//		if (P < 41) {
+//			motor->setSpeeds(0, sign(phi - phiActual) * P);
+//		} else {
+//			fprintf(stdout, "ses debil\n");
+//		}
+//		fprintf(stdout, "koncOtoceni %f > 0.08\n rychlost otaceni %f",
+//				std::abs(std::abs(phi) - std::abs(phiActual)),
+//				sign(phi - phiActual) * P);
+//		fprintf(stdout, "x: %f\n", motor->getPosition()[0]);
+//		fprintf(stdout, "y : %f\n", motor->getPosition()[1]);
+//
+//	} else {
+//		motor->setSpeeds(0, 0);
+//		fprintf(stdout, "x: %f\n", motor->getPosition()[0]);
+//		fprintf(stdout, "y : %f\n", motor->getPosition()[1]);
+//		//usleep(50000);
+//		alreadyTurned = false;
+//		return 1;
+//	}
+//	return 0;
+
+}
+
+int move_to::turn(const RobotPosition & f, const double *pose) {
+	phiActual = normalizeAngle(pose[2]);
+	phiWanted = normalizeAngle(f.phi);
+	rUhel = normalizeAngle(phiActual - phiWanted);
+	P = 1;
+
+//	if(rUhel<1){
+//		P = std::abs(rUhel);
+//	}
+//	if(P < 0.5){
+//		P = 0.5;
+//	}
+
+	if (std::abs(rUhel) > 0.17) {
+		switch (typ) {
+		case RobotBase::ACTIVEWHEEL: {
+			motor->setSpeeds(0, (int)-P*sign(rUhel)*motor->calibratedSpeed);
+		}
+			break;
+		case RobotBase::SCOUTBOT: {
+			motor->setSpeeds(0, (int)-P*sign(rUhel)*motor->calibratedSpeed*0.7);
+		}
+			break;
+		}
+		return 0;
+	} else {
+		printf("dotoceno\n");
+		motor->setSpeeds(0, 0);
+		return 1;
+
+	}
+}
+
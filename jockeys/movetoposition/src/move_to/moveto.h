@@ -7,17 +7,51 @@
 #include "../motor/CMotors.h"
 #include <IRobot.h>
 #include <cmath>
+#include <pthread.h>
 #include "../eth/messageDataType.h"
 
 #ifndef MOVETO_H_
 #define MOVETO_H_
 
+//! Period of the control loop in us
+#define MOVETO_PERIOD 20000
+//! Odometry poses kept to match the delayed Ubisense fixes, a bit more than a second
+#define MOVETO_HISTORY 64
+//! Weight of a Ubisense fix against the odometry, for the position and for the heading
+#define MOVETO_GAIN_POSITION 0.3
+#define MOVETO_GAIN_HEADING 0.5
+//! Distance in m between two fixes before their direction corrects the heading
+#define MOVETO_HEADING_BASE 0.04
+
+/**
+ * Drives the robot to a position and turns it to the heading of that position.
+ *
+ * The pose is the odometry of CMotors, corrected by the Ubisense fixes with a complementary filter: a fix pulls the
+ * position towards it with MOVETO_GAIN_POSITION, and the direction between two fixes pulls the heading towards it with
+ * MOVETO_GAIN_HEADING. A fix arrives late, so it is compared with the odometry at the time it was taken, not with the
+ * current one. The first fixes set the pose outright, until then the robot drives ahead.
+ *
+ * The control law runs on a thread of its own every MOVETO_PERIOD on the fused pose, so the robot steers between two
+ * fixes as well, the jockey only starts it, passes the fixes and polls the state.
+ */
 class move_to {
 public:
 	move_to(CMotors* motors,RobotBase::RobotType robot_type);
 	virtual ~move_to();
-	int move(RobotPosition,UbiPosition);
-	int turn(RobotPosition);
+	//! Drive to the position on the control thread and turn to its heading there
+	void start(RobotPosition goal);
+	//! Stop the control and the wheels
+	void halt();
+	//! Fuse a Ubisense fix into the pose
+	void fix(UbiPosition u);
+	//! The time in ms a fix is behind the odometry
+	void setDelay(int delay);
+	//! 0 on the way, 1 on the position, 2 turning on the spot to face the position
+	inline int getOnPosition() const { return onPosition; }
+	//! 1 when turned to the heading of the position
+	inline int getTurned() const { return turned; }
+	//! The first fixes gave a position and a heading
+	inline bool hasPose() const { return headingKnown; }
 	int getTurn(float xPoc,float yPoc, float xKonc,float yKonc);
 private:
 	CMotors* motor;
@@ -26,6 +60,37 @@ private:
 	RobotPosition finalPosition;
 	//int lastAvoid;
 	//CTimer* timer;
+
+	int move(const RobotPosition & f, const double *pose);
+	int turn(const RobotPosition & f, const double *pose);
+
+	struct PoseStamp {
+		long long time;
+		double x, y, phi;
+	};
+	//! Odometry of the last periods, with the corrections added, only used with poseMutex
+	PoseStamp history[MOVETO_HISTORY];
+	int historyHead;
+	int historySize;
+	pthread_mutex_t poseMutex;
+	void record(long long time, const double *pose);
+	void poseAt(long long time, PoseStamp & result);
+	void correct(double dx, double dy, double dphi);
+	int delay;
+	bool positionKnown;
+	volatile bool headingKnown;
+	//! The fix the heading is measured from and the odometry at its time
+	UbiPosition anchor;
+	PoseStamp anchorOdometry;
+
+	pthread_t controlThread;
+	volatile bool running;
+	volatile bool active;
+	volatile int onPosition;
+	volatile int turned;
+	static void* runControl(void *mover);
+	void controlLoop();
+	void control();
 };
 
 #endif /* MOVETO_H_ */
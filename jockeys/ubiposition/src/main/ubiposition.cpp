@@ -63,6 +63,8 @@ CMessage messagee;
 int error = 0;
 std::string portMS;
 bool stop;
+//! The count of the history of the last fix that was sent
+uint32_t sentCount = 0;
 
 /**
  * If the user presses Ctrl+C, this can be used to do memory deallocation or a last communication with the MSPs.
@@ -153,8 +155,10 @@ int main(int argc, char **argv) {
 		readMessages();
 		switch (actualTask) {
 		case SEND_POSITION: {
-			if (ubisencePositionServer->validPosition) {
-
+			// the same fix is not sent again, so the receivers can take every message as a new sample
+			uint32_t count = ubisencePositionServer->getHistory().getCount();
+			if (ubisencePositionServer->validPosition && count != sentCount) {
+				sentCount = count;
 				UbiPosition posit = ubisencePositionServer->getPosition();
 #ifdef __DEBUG__
 					std::cout << DEBUG << "position is " << posit.x << ',' << posit.y << ',' << posit.z << ',' << posit.time_stamp << std::endl;
@@ -6,6 +6,8 @@
  */
 
 #include "CUbisencePosition.h"
+#include <CTimer.h>
+#include <string.h>
 #define WAIT_PROGRAM_uS 250000
 #define WAIT_FOR_COORDINATES_TIMEOUT_MS 5000
 
@@ -17,6 +19,7 @@ CUbisencePosition::CUbisencePosition() {
 	stop = true;
 	validPosition = false;
 	threadFinished = false;
+	lastStamp = 0;
 	thread = NULL;
 }
 
@@ -37,6 +40,14 @@ void* connectLoopUP(void *serv) {
 				WAIT_FOR_COORDINATES_TIMEOUT_MS);
 		sem_post(&ubisencePosition->dataSem);
 		if (WAPI::WAPI_OK == wapi_error) {
+			// only this thread writes the coordinates, a fix that is the same as the last one is not a new sample
+			uint32_t stamp = ubisencePosition->coordinates->getTimestamp();
+			if (stamp != ubisencePosition->lastStamp || !ubisencePosition->getHistory().getCount()) {
+				ubisencePosition->getHistory().push(ubisencePosition->coordinates->getX() / 1000.0,
+						ubisencePosition->coordinates->getY() / 1000.0,
+						ubisencePosition->coordinates->getZ() / 1000.0, CTimer::now(), stamp);
+				ubisencePosition->lastStamp = stamp;
+			}
 			ubisencePosition->validPosition = true;
 			//cout << "Position: " << ubisencePosition->coordinates->toString() << endl;
 			usleep(WAIT_PROGRAM_uS);
@@ -87,11 +98,21 @@ void CUbisencePosition::stopServer() {
 
 UbiPosition CUbisencePosition::getPosition() {
 	UbiPosition position;
-	sem_wait(&this->dataSem);
-	position.x = this->coordinates->getX() / 1000.0;
-	position.y = this->coordinates->getY() / 1000.0;
-	position.z = this->coordinates->getZ() / 1000.0;
-	position.time_stamp = this->coordinates->getTimestamp();
-	sem_post(&this->dataSem);
+	PositionFix fix;
+	if (!history.getLatest(fix)) memset(&fix, 0, sizeof(fix));
+	position.x = fix.x;
+	position.y = fix.y;
+	position.z = fix.z;
+	position.time_stamp = fix.stamp;
 	return position;
 }
+
+bool CUbisencePosition::getPositionAt(int64_t time, UbiPosition & position) {
+	PositionFix fix;
+	if (!history.getPositionAt(time, fix)) return false;
+	position.x = fix.x;
+	position.y = fix.y;
+	position.z = fix.z;
+	position.time_stamp = fix.stamp;
+	return true;
+}
@@ -15,6 +15,7 @@
 #include <pthread.h>
 #include <wapi/wapi.h>
 #include <messageDataType.h>
+#include <CPositionHistory.h>
 using namespace std;
 using namespace wapi;
 
@@ -26,14 +27,22 @@ public:
 	virtual ~CUbisencePosition();
 	int initServer(const int channel);
 	void stopServer();
+	//! The last fix, read without waiting for the thread that polls the tag
 	UbiPosition getPosition();
+	//! The position interpolated or extrapolated to a time in ns on the monotonic clock, see CPositionHistory
+	bool getPositionAt(int64_t time, UbiPosition & position);
+	//! The fixes with the time they came in, also to see whether a new one came in, see CPositionHistory::getCount
+	inline CPositionHistory & getHistory() { return history; }
 	bool validPosition;
 	bool threadFinished;
 	WAPI* wapi;
 	Coordinates* coordinates;
 	sem_t dataSem;
 	bool stop;
+	//! Time stamp of the last fix that was added to the history
+	uint32_t lastStamp;
 private:
+	CPositionHistory history;
 	pthread_t* thread;
 	Ubitag* own_ubitag;
 };
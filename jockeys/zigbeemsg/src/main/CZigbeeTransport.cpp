@@ -0,0 +1,364 @@
+/*
+ * File name: CZigbeeTransport.cpp
+ * Date:      2013/10/14
+ * Author:    Anne C. van Rossum
+ */
+
+#include "CZigbeeTransport.h"
+#include <CMessage.h>
+#include <messageSchema.h>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ZIGBEE_FRAME_MAGIC0 'Z'
+#define ZIGBEE_FRAME_MAGIC1 'T'
+//! The frame holds one fragment of a message instead of a batch of whole messages
+#define ZIGBEE_FRAME_FRAGMENT 0x01
+//! The frame holds coordination messages and is repeated
+#define ZIGBEE_FRAME_CONTROL 0x02
+//! Frames remembered per sender to drop the copies
+#define ZIGBEE_DELIVERED_HISTORY 32
+
+/**
+ * A batch frame is the header followed by messages, each one preceded by its length in a byte. A fragment frame is
+ * the header, ZigbeeFragmentWire and a part of a message, all fragments of a message have the frame number of the
+ * header in common.
+ */
+struct ZigbeeFrameWire {
+	uint8_t magic[2];
+	uint8_t flags;
+	le<uint16_t> sender;
+	le<uint16_t> frame;
+} __attribute__((packed));
+
+struct ZigbeeFragmentWire {
+	uint8_t index;
+	uint8_t count;
+} __attribute__((packed));
+
+//! The largest message that fits in a batch frame, larger ones are fragmented
+static const int BatchPayload = ZIGBEE_MTU - sizeof(ZigbeeFrameWire) - 1;
+static const int FragmentPayload = ZIGBEE_MTU - sizeof(ZigbeeFrameWire) - sizeof(ZigbeeFragmentWire);
+//! In the format of CMessage::packToZBMessage
+static const int MessageHeader = ZB_ENVELOPE_HEADER;
+
+CZigbeeTransport::CZigbeeTransport(ZigbeeSendFunction send, ZigbeeDeliverFunction deliver, void *context)
+{
+	this->send = send;
+	this->deliver = deliver;
+	this->context = context;
+	last_served = 0;
+	tokens = ZIGBEE_BURST_BYTES;
+	tokens_at = now();
+	// robots start at different times, a collision only matters for fragments that are in flight at the same time
+	sender = (uint16_t)((getpid() * 2654435761u) ^ tokens_at);
+	next_frame = (uint16_t)(tokens_at >> 4);
+	memset(&stats, 0, sizeof(stats));
+}
+
+long long CZigbeeTransport::now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+bool CZigbeeTransport::isControl(int type)
+{
+	switch (type) {
+	case MSG_NEED_ORG:
+	case MSG_HELP_ORG:
+	case MSG_HELP_ACP:
+	case MSG_ORG_STATE:
+	case MSG_MY_ZIGBEE_ID:
+		return true;
+	default:
+		return false;
+	}
+}
+
+bool CZigbeeTransport::enqueue(const uint8_t *message, int len)
+{
+	if (message == NULL || len < MessageHeader) {
+		fprintf(stderr, "ZigBee message of %i bytes is too short\n", len);
+		return false;
+	}
+	if (len > 255 * FragmentPayload) {
+		fprintf(stderr, "ZigBee message of %i bytes does not fit in %i fragments\n", len, 255);
+		return false;
+	}
+	uint64_t destination;
+	int type;
+	memcpy(&destination, message, sizeof(uint64_t));
+	memcpy(&type, message + sizeof(uint64_t), sizeof(int));
+
+	Destination & queue = destinations[destination];
+	if ((int)(queue.control.size() + queue.bulk.size()) >= ZIGBEE_QUEUE_DEPTH) {
+		std::deque<Pending> & victim = queue.bulk.empty() ? queue.control : queue.bulk;
+		queue.queued_bytes -= victim.front().bytes.size() + 1;
+		victim.pop_front();
+		stats.dropped++;
+	}
+
+	Pending pending;
+	pending.bytes.assign(message, message + len);
+	pending.queued = now();
+	queue.queued_bytes += len + 1;
+	(isControl(type) ? queue.control : queue.bulk).push_back(pending);
+	stats.messages++;
+	return true;
+}
+
+bool CZigbeeTransport::pending() const
+{
+	if (!repeats.empty()) return true;
+	for (std::map<uint64_t, Destination>::const_iterator i = destinations.begin(); i != destinations.end(); ++i) {
+		if (!i->second.control.empty() || !i->second.bulk.empty() || !i->second.frames.empty()) return true;
+	}
+	return false;
+}
+
+void CZigbeeTransport::fragment(Destination & queue, const std::vector<uint8_t> & message, bool control)
+{
+	int count = (message.size() + FragmentPayload - 1) / FragmentPayload;
+	uint16_t frame = next_frame++;
+	for (int index = 0; index < count; index++) {
+		int offset = index * FragmentPayload;
+		int part = std::min<int>(FragmentPayload, message.size() - offset);
+		Frame result;
+		result.control = control;
+		result.bytes.resize(sizeof(ZigbeeFrameWire) + sizeof(ZigbeeFragmentWire) + part);
+		ZigbeeFrameWire *header = (ZigbeeFrameWire*) &result.bytes[0];
+		header->magic[0] = ZIGBEE_FRAME_MAGIC0;
+		header->magic[1] = ZIGBEE_FRAME_MAGIC1;
+		header->flags = ZIGBEE_FRAME_FRAGMENT | (control ? ZIGBEE_FRAME_CONTROL : 0);
+		header->sender = sender;
+		header->frame = frame;
+		ZigbeeFragmentWire *position = (ZigbeeFragmentWire*) (header + 1);
+		position->index = index;
+		position->count = count;
+		memcpy(position + 1, &message[offset], part);
+		queue.frames.push_back(result);
+	}
+	stats.fragments += count;
+}
+
+/**
+ * Turn the queued messages of a destination into frames. Nothing is built while the only messages are bulk data
+ * that is younger than ZIGBEE_BATCH_DELAY_MS and does not fill a frame yet, more may follow to share the frame.
+ */
+void CZigbeeTransport::build(Destination & queue, long long time)
+{
+	if (queue.control.empty()) {
+		if (queue.bulk.empty()) return;
+		if (time - queue.bulk.front().queued < ZIGBEE_BATCH_DELAY_MS && queue.queued_bytes < BatchPayload + 1) return;
+	}
+
+	bool control = !queue.control.empty();
+	std::deque<Pending> & first = control ? queue.control : queue.bulk;
+	if ((int)first.front().bytes.size() > BatchPayload) {
+		queue.queued_bytes -= first.front().bytes.size() + 1;
+		fragment(queue, first.front().bytes, control);
+		first.pop_front();
+		return;
+	}
+
+	Frame result;
+	result.control = control;
+	result.bytes.resize(sizeof(ZigbeeFrameWire));
+	ZigbeeFrameWire *header = (ZigbeeFrameWire*) &result.bytes[0];
+	header->magic[0] = ZIGBEE_FRAME_MAGIC0;
+	header->magic[1] = ZIGBEE_FRAME_MAGIC1;
+	header->flags = control ? ZIGBEE_FRAME_CONTROL : 0;
+	header->sender = sender;
+	header->frame = next_frame++;
+
+	// coordination first, then bulk data as long as it fits, a large message waits for a frame of its own
+	std::deque<Pending> *sources[2] = { &queue.control, &queue.bulk };
+	for (int s = 0; s < 2; s++) {
+		std::deque<Pending> & source = *sources[s];
+		while (!source.empty() && (int)(result.bytes.size() + 1 + source.front().bytes.size()) <= ZIGBEE_MTU) {
+			const std::vector<uint8_t> & bytes = source.front().bytes;
+			result.bytes.push_back((uint8_t) bytes.size());
+			result.bytes.insert(result.bytes.end(), bytes.begin(), bytes.end());
+			queue.queued_bytes -= bytes.size() + 1;
+			source.pop_front();
+		}
+		if (!source.empty()) break;
+	}
+	queue.frames.push_back(result);
+}
+
+bool CZigbeeTransport::transmit(uint64_t destination, const std::vector<uint8_t> & frame)
+{
+	tokens -= frame.size();
+	stats.frames++;
+	stats.bytes += frame.size();
+	if (!send(destination, &frame[0], frame.size(), context)) {
+		stats.dropped++;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Repeated copies go first, then the coordination frames of every destination and then the rest, one frame per
+ * destination per round. It stops as soon as the token bucket does not hold the next frame, the frame stays queued.
+ */
+void CZigbeeTransport::poll()
+{
+	long long time = now();
+	tokens += (time - tokens_at) * (double) ZIGBEE_RATE_BYTES_PER_S / 1000;
+	if (tokens > ZIGBEE_BURST_BYTES) tokens = ZIGBEE_BURST_BYTES;
+	tokens_at = time;
+
+	for (std::map<uint32_t, Reassembly>::iterator i = reassembly.begin(); i != reassembly.end();) {
+		if (time - i->second.started > ZIGBEE_REASSEMBLY_TIMEOUT_MS) {
+			stats.incomplete++;
+			reassembly.erase(i++);
+		} else {
+			++i;
+		}
+	}
+
+	for (std::deque<Repeat>::iterator i = repeats.begin(); i != repeats.end();) {
+		if (i->due > time) {
+			++i;
+			continue;
+		}
+		if (tokens < i->bytes.size()) return;
+		transmit(i->destination, i->bytes);
+		stats.repeats++;
+		if (--i->copies > 0) {
+			i->due = time + ZIGBEE_CONTROL_REPEAT_MS;
+			++i;
+		} else {
+			i = repeats.erase(i);
+		}
+	}
+
+	if (destinations.empty()) return;
+	bool sent = true;
+	while (sent) {
+		sent = false;
+		for (int pass = 0; pass < 2; pass++) {
+			std::map<uint64_t, Destination>::iterator start = destinations.upper_bound(last_served);
+			if (start == destinations.end()) start = destinations.begin();
+			std::map<uint64_t, Destination>::iterator i = start;
+			do {
+				Destination & queue = i->second;
+				if (queue.frames.empty()) build(queue, time);
+				if (!queue.frames.empty() && (pass == 1 || queue.frames.front().control)) {
+					const Frame & frame = queue.frames.front();
+					if (tokens < frame.bytes.size()) return;
+					transmit(i->first, frame.bytes);
+					bool fragmented = ((const ZigbeeFrameWire*) &frame.bytes[0])->flags & ZIGBEE_FRAME_FRAGMENT;
+					if (frame.control && !fragmented && ZIGBEE_CONTROL_COPIES > 1) {
+						Repeat repeat;
+						repeat.destination = i->first;
+						repeat.due = time + ZIGBEE_CONTROL_REPEAT_MS;
+						repeat.copies = ZIGBEE_CONTROL_COPIES - 1;
+						repeat.bytes = frame.bytes;
+						repeats.push_back(repeat);
+					}
+					queue.frames.pop_front();
+					last_served = i->first;
+					sent = true;
+				}
+				if (++i == destinations.end()) i = destinations.begin();
+			} while (i != start);
+		}
+	}
+}
+
+bool CZigbeeTransport::seen(uint16_t sender, uint16_t frame) const
+{
+	std::map<uint16_t, std::deque<uint16_t> >::const_iterator history = delivered.find(sender);
+	if (history == delivered.end()) return false;
+	for (std::deque<uint16_t>::const_iterator i = history->second.begin(); i != history->second.end(); ++i) {
+		if (*i == frame) return true;
+	}
+	return false;
+}
+
+void CZigbeeTransport::remember(uint16_t sender, uint16_t frame)
+{
+	std::deque<uint16_t> & history = delivered[sender];
+	history.push_back(frame);
+	if (history.size() > ZIGBEE_DELIVERED_HISTORY) history.pop_front();
+}
+
+void CZigbeeTransport::receive(const uint8_t *frame, int len)
+{
+	const ZigbeeFrameWire *header = (const ZigbeeFrameWire*) frame;
+	if (len < (int) sizeof(ZigbeeFrameWire) || header->magic[0] != ZIGBEE_FRAME_MAGIC0 || header->magic[1] != ZIGBEE_FRAME_MAGIC1) {
+		stats.received++;
+		deliver(frame, len, context);
+		return;
+	}
+	uint16_t from = header->sender;
+	uint16_t number = header->frame;
+	const uint8_t *payload = frame + sizeof(ZigbeeFrameWire);
+	int remaining = len - sizeof(ZigbeeFrameWire);
+
+	if (header->flags & ZIGBEE_FRAME_FRAGMENT) {
+		const ZigbeeFragmentWire *position = (const ZigbeeFragmentWire*) payload;
+		if (remaining < (int) sizeof(ZigbeeFragmentWire) || position->index >= position->count) {
+			fprintf(stderr, "Malformed ZigBee fragment of %i bytes\n", len);
+			return;
+		}
+		if (seen(from, number)) {
+			stats.duplicates++;
+			return;
+		}
+		uint32_t key = ((uint32_t) from << 16) | number;
+		std::map<uint32_t, Reassembly>::iterator i = reassembly.find(key);
+		if (i == reassembly.end()) {
+			Reassembly fresh;
+			fresh.parts.resize(position->count);
+			fresh.missing = position->count;
+			fresh.started = now();
+			i = reassembly.insert(std::make_pair(key, fresh)).first;
+		}
+		Reassembly & message = i->second;
+		if ((int) message.parts.size() != position->count || !message.parts[position->index].empty()) {
+			stats.duplicates++;
+			return;
+		}
+		message.parts[position->index].assign(payload + sizeof(ZigbeeFragmentWire), frame + len);
+		if (--message.missing > 0) return;
+
+		std::vector<uint8_t> whole;
+		for (unsigned int p = 0; p < message.parts.size(); p++) {
+			whole.insert(whole.end(), message.parts[p].begin(), message.parts[p].end());
+		}
+		reassembly.erase(i);
+		remember(from, number);
+		stats.received++;
+		deliver(&whole[0], whole.size(), context);
+		return;
+	}
+
+	// check the whole batch first, a frame of an older robot could start with the magic bytes by chance
+	int offset = 0;
+	while (offset < remaining) {
+		offset += 1 + payload[offset];
+	}
+	if (offset != remaining) {
+		stats.received++;
+		deliver(frame, len, context);
+		return;
+	}
+	if (seen(from, number)) {
+		stats.duplicates++;
+		return;
+	}
+	remember(from, number);
+	for (offset = 0; offset < remaining; offset += 1 + payload[offset]) {
+		stats.received++;
+		deliver(payload + offset + 1, payload[offset], context);
+	}
+}
@@ -0,0 +1,148 @@
+/*
+ * File name: CZigbeeTransport.h
+ * Date:      2013/10/14
+ * Author:    Anne C. van Rossum
+ */
+
+#ifndef __CZIGBEETRANSPORT_H__
+#define __CZIGBEETRANSPORT_H__
+
+#include <stdint.h>
+#include <deque>
+#include <map>
+#include <vector>
+
+//! Bytes of a frame handed to the radio, what is left of an 802.15.4 frame after the headers of the WAPI
+#define ZIGBEE_MTU 96
+//! A small message waits this long for others to the same robot before it goes out in a frame of its own
+#define ZIGBEE_BATCH_DELAY_MS 20
+//! Sustained rate of the token bucket, all destinations share the radio
+#define ZIGBEE_RATE_BYTES_PER_S 2500
+//! Bytes that can be sent at once after the radio was idle, at least one frame
+#define ZIGBEE_BURST_BYTES (4 * ZIGBEE_MTU)
+//! Messages queued per destination, if it is full the oldest bulk message is dropped
+#define ZIGBEE_QUEUE_DEPTH 32
+//! A message of which not every fragment arrived within this time is dropped
+#define ZIGBEE_REASSEMBLY_TIMEOUT_MS 2000
+//! Frames with coordination messages are sent this many times, the receiver drops the copies
+#define ZIGBEE_CONTROL_COPIES 2
+#define ZIGBEE_CONTROL_REPEAT_MS 150
+
+//! Hands a frame to the radio, returns false if it could not be sent
+typedef bool (*ZigbeeSendFunction)(uint64_t destination, const uint8_t *frame, int len, void *context);
+//! Gets every received message in the format of CMessage::packToZBMessage
+typedef void (*ZigbeeDeliverFunction)(const uint8_t *message, int len, void *context);
+
+struct CZigbeeTransportStats
+{
+	unsigned int messages;
+	unsigned int frames;
+	unsigned int fragments;
+	unsigned int repeats;
+	unsigned int dropped;
+	unsigned int received;
+	unsigned int duplicates;
+	unsigned int incomplete;
+	long long bytes;
+};
+
+/**
+ * Sits between the MSG_ZIGBEE_MSG messages of the jockeys and the radio. Every destination Ubitag has its own queue.
+ * Small messages to the same destination are batched into one frame, a message that waits ZIGBEE_BATCH_DELAY_MS or
+ * fills a frame is sent. Messages larger than a frame are split into fragments and put back together by the receiver.
+ * A token bucket keeps the frames of all destinations within ZIGBEE_RATE_BYTES_PER_S.
+ *
+ * Coordination messages (see isControl) skip the batching delay, are sent before any bulk data and are repeated, so
+ * a MSG_ORG_STATE still arrives while map snapshots fill the queues. A frame that does not start with the magic bytes
+ * comes from a robot without this transport and is delivered as it is.
+ */
+class CZigbeeTransport
+{
+public:
+	CZigbeeTransport(ZigbeeSendFunction send, ZigbeeDeliverFunction deliver, void *context);
+
+	//! Queue a message in the format of CMessage::packToZBMessage, false if it is malformed or too large
+	bool enqueue(const uint8_t *message, int len);
+
+	//! Build and send the frames that are due, call it often
+	void poll();
+
+	//! Pass a frame from the radio, the messages in it are handed to deliver
+	void receive(const uint8_t *frame, int len);
+
+	//! True if messages are waiting, so the caller should not sleep long
+	bool pending() const;
+
+	//! Coordination between robots, never delayed or dropped for bulk data
+	static bool isControl(int type);
+
+	//! Monotonic time in milliseconds
+	static long long now();
+
+	inline const CZigbeeTransportStats & getStats() const { return stats; }
+
+private:
+	struct Pending {
+		std::vector<uint8_t> bytes;
+		long long queued;
+	};
+
+	struct Frame {
+		std::vector<uint8_t> bytes;
+		bool control;
+	};
+
+	struct Destination {
+		std::deque<Pending> control;
+		std::deque<Pending> bulk;
+		//! Frames that are built and wait for tokens
+		std::deque<Frame> frames;
+		//! Bytes the queued messages take in a batch frame
+		int queued_bytes;
+		Destination() : queued_bytes(0) {}
+	};
+
+	struct Repeat {
+		uint64_t destination;
+		long long due;
+		int copies;
+		std::vector<uint8_t> bytes;
+	};
+
+	struct Reassembly {
+		std::vector<std::vector<uint8_t> > parts;
+		int missing;
+		long long started;
+	};
+
+	void build(Destination & queue, long long time);
+	void fragment(Destination & queue, const std::vector<uint8_t> & message, bool control);
+	bool transmit(uint64_t destination, const std::vector<uint8_t> & frame);
+	bool seen(uint16_t sender, uint16_t frame) const;
+	void remember(uint16_t sender, uint16_t frame);
+
+	ZigbeeSendFunction send;
+	ZigbeeDeliverFunction deliver;
+	void *context;
+
+	std::map<uint64_t, Destination> destinations;
+	//! Destination after which the next round starts, so a busy robot does not starve the others
+	uint64_t last_served;
+	std::deque<Repeat> repeats;
+
+	double tokens;
+	long long tokens_at;
+
+	//! Identifies this robot in the frames, fragments of different robots with the same frame number are not mixed
+	uint16_t sender;
+	uint16_t next_frame;
+
+	//! Key is sender << 16 | frame
+	std::map<uint32_t, Reassembly> reassembly;
+	//! The last frames delivered per sender, to drop repeated copies
+	std::map<uint16_t, std::deque<uint16_t> > delivered;
+
+	CZigbeeTransportStats stats;
+};
+
+#endif /* __CZIGBEETRANSPORT_H__ */
@@ -11,6 +11,7 @@
 
 #include "wapi/wapi.h"
 #include "CMessageServer.h"
+#include "CZigbeeTransport.h"
 #define NAME "ZigBee"
 #define WAIT_TO_IDENTITY_TIMEOUT_S 1
 #define RECEIVE_MESSAGE_TIMEOUT_MS 5000
@@ -60,29 +61,33 @@ int zigbeeInit(WAPI *wapi)
 	return wapi_error==WAPI::WAPI_OK;
 }
 
-int zigbeeSend(WAPI *wapi, const uint8_t *data, int len) {
-	int wapi_error;
+//! The ZigBee transport hands complete frames to this function, context is the WAPI
+bool zigbeeSend(uint64_t destination, const uint8_t *frame, int len, void *context) {
+	WAPI *wapi = (WAPI*) context;
+	int wapi_error = WAPI::WAPI_OK;
 
 	if (len > 0) {
 		Message send_msg;
-		Ubitag* ubi_brd;
-		uint64_t ubi_destination;
-		if (len > sizeof(uint64_t)) {
-			memcpy(&ubi_destination, data, sizeof(uint64_t));
-
-			ubi_brd = new Ubitag(ubi_destination);
-			printf("sending message to: %lld\n", (long long)ubi_destination);
-			send_msg.SetDestination(*ubi_brd);
-			send_msg.SetHops(0);
-			send_msg.SetSignalStrength(0);
-			send_msg.SetChannel(ZIGBEE_CHANNEL);
-			send_msg.SetData((const char*)data, len);
-			wapi_error = wapi->send(send_msg);
+		Ubitag ubi_destination(destination);
+		printf("sending frame of %i bytes to: %lld\n", len, (long long)destination);
+		send_msg.SetDestination(ubi_destination);
+		send_msg.SetHops(0);
+		send_msg.SetSignalStrength(0);
+		send_msg.SetChannel(ZIGBEE_CHANNEL);
+		send_msg.SetData((const char*)frame, len);
+		wapi_error = wapi->send(send_msg);
+		if (wapi_error != WAPI::WAPI_OK) {
+			fprintf(stderr, "WAPI error %i sending frame len %i\n", wapi_error, len);
 		}
 	}
 	return wapi_error == WAPI::WAPI_OK;
 }
 
+//! Every message the ZigBee transport received goes to the jockey framework as it was packed by the sender
+void zigbeeDeliver(const uint8_t *message, int len, void *context) {
+	server->sendMessage(MSG_ZIGBEE_MSG, (void*) message, len);
+}
+
 int main(int argc, char **argv) {
 	struct sigaction a;
 	WAPI wapi(0);
@@ -116,6 +121,7 @@ int main(int argc, char **argv) {
 	printf("%sInit server finished\n", debug_str.c_str());
 
 	wapi_init = zigbeeInit(&wapi);
+	CZigbeeTransport transport(&zigbeeSend, &zigbeeDeliver, &wapi);
 
 	CMessage message;
 	message.type = MSG_NONE;
@@ -156,11 +162,12 @@ int main(int argc, char **argv) {
 			}
 			if (wapi_init) {
 
-				CMessage unpacked = CMessage::unpackZBMessage(message);
-				printf("try to send message %d over zigbee with size %d\n", unpacked.type,message.len);
+				ZBEnvelope envelope;
+				message.viewZBMessage(envelope);
+				printf("try to send message %d over zigbee with size %d\n", envelope.type, message.len);
 
-				if (!zigbeeSend(&wapi, message.data, message.len)) {
-					fprintf(stderr, "WAPI error sending message len %i\n",
+				if (!transport.enqueue(message.data, message.len)) {
+					fprintf(stderr, "Cannot queue ZigBee message len %i\n",
 							message.len);
 				}
 			}
@@ -181,16 +188,22 @@ int main(int argc, char **argv) {
 			if (WAPI::WAPI_OK == wapi_error) {
 				std::cout << "!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!" << std::endl;
 				std::cout << "Received zigbee message" << std::endl;
-				server->sendMessage(MSG_ZIGBEE_MSG, (void*) receive_msg.Data(),
-						receive_msg.Size());
+				transport.receive((const uint8_t*) receive_msg.Data(), receive_msg.Size());
 			}
+			transport.poll();
 		}
 
 		if (message.type == MSG_NONE && wapi_error != WAPI::WAPI_OK) {
-			usleep(50000); // check every 0.02 second or do something usefull
+			// queued messages have to go out within the batching delay
+			usleep(transport.pending() ? ZIGBEE_BATCH_DELAY_MS * 1000 / 4 : 50000);
 		}
 	}
 
+	const CZigbeeTransportStats & stats = transport.getStats();
+	printf("%sZigBee messages %u sent in %u frames (%u fragments, %u repeats, %lld bytes), %u dropped, "
+			"%u received, %u duplicates, %u incomplete\n", debug_str.c_str(), stats.messages, stats.frames,
+			stats.fragments, stats.repeats, stats.bytes, stats.dropped, stats.received, stats.duplicates,
+			stats.incomplete);
 	printf("Stopping Zigbee Messenger\n");
 	return 0;
 }
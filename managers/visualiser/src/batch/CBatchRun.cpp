@@ -0,0 +1,266 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Process recorded runs without a window, as fast as the logs can be read
+ * @file CBatchRun.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#include "CBatchRun.h"
+#include "CMessage.h"
+#include "messageDataType.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//! Create directory path if it is not there yet
+static bool makeDirectory(const std::string & path)
+{
+	if (mkdir(path.c_str(), 0755) == 0 || errno == EEXIST) return true;
+	fprintf(stderr, "Can not create %s: %s\n", path.c_str(), strerror(errno));
+	return false;
+}
+
+static FILE *openOutput(const std::string & path, const char *columns)
+{
+	FILE *file = fopen(path.c_str(), "w");
+	if (file == NULL) {
+		fprintf(stderr, "Can not write %s: %s\n", path.c_str(), strerror(errno));
+		return NULL;
+	}
+	fprintf(file, "%s\n", columns);
+	return file;
+}
+
+CBatchRun::CBatchRun()
+{
+	learned = false;
+	memset(&stats, 0, sizeof(stats));
+	segments = poses = scans = objects = NULL;
+}
+
+CBatchRun::~CBatchRun()
+{
+	closeFiles();
+}
+
+void CBatchRun::learnColor(unsigned char rgb[3])
+{
+	recognition.learnPixel(rgb);
+	learned = true;
+}
+
+bool CBatchRun::openFiles(const char *output)
+{
+	std::string dir(output);
+	if (!makeDirectory(dir)) return false;
+	segments = openOutput(dir + "/segments.csv", "timestamp,channel,frame_id,x,y,size");
+	poses = openOutput(dir + "/poses.csv", "timestamp,robot,x,y,phi");
+	scans = openOutput(dir + "/scans.csv", "timestamp,scan,object,distance,robustness");
+	objects = openOutput(dir + "/map.csv", "robot,map_id,type,x,y,axis0,axis1,angle");
+	return segments != NULL && poses != NULL && scans != NULL && objects != NULL;
+}
+
+void CBatchRun::closeFiles()
+{
+	FILE **files[4] = { &segments, &poses, &scans, &objects };
+	for (int i = 0; i < 4; i++) {
+		if (*files[i] != NULL) fclose(*files[i]);
+		*files[i] = NULL;
+	}
+}
+
+/**
+ * The log is read without waiting (speed 0), and its records point into the mapped segments, so a frame is only copied
+ * once, into the image that the recognition works on.
+ */
+bool CBatchRun::process(const char *path, const char *output)
+{
+	uint64_t start = streamLogTime();
+	CStreamReplay replay;
+	if (!replay.open(path)) {
+		fprintf(stderr, "Can not open the log %s\n", path);
+		return false;
+	}
+	if (!openFiles(output)) {
+		closeFiles();
+		return false;
+	}
+	StreamLogEntry entry;
+	while (replay.next(entry, 0)) {
+		stats.records++;
+		switch (entry.type) {
+		case STREAM_LOG_FRAME:
+			processFrame(entry);
+			break;
+		case STREAM_LOG_MESSAGE:
+			if (entry.channel == MSG_MAP_SNAPSHOT) processSnapshot(entry);
+			break;
+		case STREAM_LOG_SCAN:
+			processScan(entry);
+			break;
+		}
+	}
+	writeMap();
+	closeFiles();
+	replay.close();
+	stats.seconds = (streamLogTime() - start) / 1000000.0f;
+	writeSummary(output);
+	return true;
+}
+
+void CBatchRun::processFrame(const StreamLogEntry & entry)
+{
+	ImageFrameHeader header;
+	if (entry.length < IMAGE_FRAME_HEADER_LENGTH || !unpackImageFrameHeader(entry.data, header)) return;
+	if (header.encoding != IMAGE_ENCODING_RAW || IMAGE_FRAME_HEADER_LENGTH + header.length > entry.length) return;
+	stats.frames++;
+	if (!learned) return;
+	int pixels = header.width * header.height;
+	if (header.bpp != 3 || pixels > RECOGNITION_MAX_PIXELS || (int) header.length < pixels * 3) {
+		stats.skippedFrames++;
+		return;
+	}
+	image.resize(header.width, header.height, 3);
+	if (image.size != pixels * 3) {
+		stats.skippedFrames++;
+		return;
+	}
+	memcpy(image.data, entry.data + IMAGE_FRAME_HEADER_LENGTH, pixels * 3);
+	recognition.findSegment(&image);
+	const SSegment & segment = recognition.getSegment();
+	if (segment.size > 0) stats.segments++;
+	fprintf(segments, "%llu,%i,%u,%i,%i,%i\n", (unsigned long long) entry.timestamp, entry.channel, header.frame_id,
+			segment.x, segment.y, segment.size);
+}
+
+void CBatchRun::processSnapshot(const StreamLogEntry & entry)
+{
+	const MapSnapshotHeaderWire *snapshot = mapSnapshotView(entry.data, entry.length);
+	if (snapshot == NULL) return;
+	// only a snapshot with a pose can move its robot
+	int robot = snapshot->robot;
+	std::map<int, MapRobot>::const_iterator before = map.getRobots().find(robot);
+	bool posed = (before != map.getRobots().end() && before->second.posed);
+	float x = posed ? before->second.x : 0, y = posed ? before->second.y : 0, phi = posed ? before->second.phi : 0;
+	if (map.applySnapshot(entry.data, entry.length) < 0) return;
+	stats.snapshots++;
+	const MapRobot & after = map.getRobots().find(robot)->second;
+	if (after.posed && (!posed || after.x != x || after.y != y || after.phi != phi)) {
+		fprintf(poses, "%llu,%i,%g,%g,%g\n", (unsigned long long) entry.timestamp, robot, after.x, after.y, after.phi);
+	}
+}
+
+void CBatchRun::processScan(const StreamLogEntry & entry)
+{
+	LaserScanHeader header;
+	int16_t columns[MAX_LASER_SCAN_ROWS];
+	if (!unpackLaserScan(entry.data, entry.length, header, columns)) return;
+	stats.scans++;
+	fprintf(scans, "%llu,%u,%i,%i,%g\n", (unsigned long long) header.timestamp, header.scan, header.object,
+			header.distance, header.robustness);
+}
+
+void CBatchRun::writeMap()
+{
+	const std::map<Map::Key, MapObject> & mapped = map.getObjects();
+	for (std::map<Map::Key, MapObject>::const_iterator i = mapped.begin(); i != mapped.end(); ++i) {
+		const MappedObjectPosition & position = i->second.position;
+		const MapEllipse & ellipse = i->second.ellipse;
+		fprintf(objects, "%i,%i,%i,%g,%g,%g,%g,%g\n", i->first.first, i->first.second, (int) position.type,
+				position.xPosition, position.yPosition, ellipse.axis[0], ellipse.axis[1], ellipse.angle);
+	}
+}
+
+void CBatchRun::writeSummary(const char *output)
+{
+	std::string path = std::string(output) + "/summary.txt";
+	FILE *file = fopen(path.c_str(), "w");
+	if (file == NULL) return;
+	fprintf(file, "records %u\nframes %u\nskipped_frames %u\nsegments %u\nsnapshots %u\nscans %u\nobjects %u\n"
+			"seconds %.3f\n", stats.records, stats.frames, stats.skippedFrames, stats.segments, stats.snapshots,
+			stats.scans, (unsigned int) map.getObjects().size(), stats.seconds);
+	fclose(file);
+}
+
+CBatch::CBatch(const char *output, const std::vector<std::string> & logs): output(output), logs(logs)
+{
+	learned = false;
+	next = 0;
+	failed = 0;
+	for (unsigned int i = 0; i < logs.size(); i++) {
+		std::string name = logs[i].substr(logs[i].find_last_of('/') + 1);
+		for (unsigned int j = 0; j < i; j++) {
+			if (logs[j].substr(logs[j].find_last_of('/') + 1) != name) continue;
+			char suffix[16];
+			snprintf(suffix, sizeof(suffix), "-%u", i);
+			name += suffix;
+			break;
+		}
+		outputs.push_back(std::string(output) + "/" + name);
+	}
+}
+
+void CBatch::learnColor(unsigned char rgb[3])
+{
+	memcpy(color, rgb, 3);
+	learned = true;
+}
+
+void* CBatch::work(void *ptr)
+{
+	CBatch *batch = (CBatch*)ptr;
+	int i;
+	while ((i = __sync_fetch_and_add(&batch->next, 1)) < (int) batch->logs.size()) {
+		// the recognition has buffers of a few MB, one per run is allocated on the heap and not on this stack
+		CBatchRun *run = new CBatchRun();
+		if (batch->learned) run->learnColor(batch->color);
+		if (run->process(batch->logs[i].c_str(), batch->outputs[i].c_str())) {
+			const SBatchStats & stats = run->getStats();
+			printf("%s: %u records, %u frames, %u segments, %u snapshots, %u scans in %.1f s\n",
+					batch->logs[i].c_str(), stats.records, stats.frames, stats.segments, stats.snapshots, stats.scans,
+					stats.seconds);
+		} else {
+			__sync_fetch_and_add(&batch->failed, 1);
+		}
+		delete run;
+	}
+	return NULL;
+}
+
+int CBatch::run(int threads)
+{
+	if (!makeDirectory(output)) return logs.size();
+	if (threads < 1) threads = 1;
+	if (threads > (int) logs.size()) threads = logs.size();
+	std::vector<pthread_t> workers(threads);
+	int started = 0;
+	for (int i = 0; i < threads; i++) {
+		if (pthread_create(&workers[started], NULL, work, this) == 0) started++;
+	}
+	// without any thread the runs are processed here, one after the other
+	if (started == 0) work(this);
+	for (int i = 0; i < started; i++) pthread_join(workers[i], NULL);
+	return failed;
+}
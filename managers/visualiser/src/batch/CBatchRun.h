@@ -0,0 +1,133 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Process recorded runs without a window, as fast as the logs can be read
+ * @file CBatchRun.h
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#ifndef CBATCHRUN_H_
+#define CBATCHRUN_H_
+
+#include "CStreamLog.h"
+#include "CRecognition.h"
+#include "Map.h"
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+//! What a run found, also written as summary.txt
+struct SBatchStats
+{
+	unsigned int records;
+	unsigned int frames;
+	//! Frames that are not 24 bits or larger than CRecognition can hold, they are counted but not recognised
+	unsigned int skippedFrames;
+	//! Frames with a segment of the learned colour
+	unsigned int segments;
+	unsigned int snapshots;
+	unsigned int scans;
+	float seconds;
+};
+
+/**
+ * One run is one log of CStreamLog, as the visualiser (STREAM_LOG) or a jockey recorded it. Every record is handed to
+ * the same processing as in the live visualiser, but nothing is drawn and the replay does not wait: the frames go
+ * through CRecognition::findSegment if a colour is learned, the MSG_MAP_SNAPSHOT messages are applied to a Map, and the
+ * laser scans are decoded. The results are written as text files into the output directory of the run:
+ *
+ * - segments.csv: timestamp, channel (the robot), frame_id, x, y and size of the largest segment of every frame
+ * - poses.csv: timestamp, robot, x, y and phi, every time a snapshot moves a robot
+ * - scans.csv: timestamp, scan, object, distance and robustness of every laser scan
+ * - map.csv: robot, map_id, type, x, y and the half axes and angle of the ellipse of the objects at the end
+ * - summary.txt: the counters of SBatchStats
+ *
+ * A run has its own recognition and map, so several runs are processed in parallel on their own threads without
+ * sharing anything, see CBatch.
+ */
+class CBatchRun
+{
+public:
+	CBatchRun();
+	~CBatchRun();
+
+	//! Recognise this colour in the frames, without it the frames are only counted
+	void learnColor(unsigned char rgb[3]);
+
+	//! Process the log at path into directory output, which is created, false if either can not be opened
+	bool process(const char *path, const char *output);
+
+	inline const SBatchStats & getStats() const { return stats; }
+
+private:
+	void processFrame(const StreamLogEntry & entry);
+	void processSnapshot(const StreamLogEntry & entry);
+	void processScan(const StreamLogEntry & entry);
+	void writeMap();
+	void writeSummary(const char *output);
+	bool openFiles(const char *output);
+	void closeFiles();
+
+	CRecognition recognition;
+	bool learned;
+	CRawImage image;
+	Map map;
+	SBatchStats stats;
+
+	FILE *segments;
+	FILE *poses;
+	FILE *scans;
+	FILE *objects;
+};
+
+/**
+ * The runs of a batch, given as a list of logs, are handed out to BATCH_THREADS worker threads (or as many as there
+ * are processors), every worker takes the next log that is not taken yet. The output of a log goes into a directory
+ * named after it within the output directory of the batch.
+ */
+class CBatch
+{
+public:
+	CBatch(const char *output, const std::vector<std::string> & logs);
+
+	//! Recognise this colour in the frames of all runs, BATCH_COLOR=r,g,b sets it from the command line
+	void learnColor(unsigned char rgb[3]);
+
+	//! Process all runs with threads workers, returns the number of runs that failed
+	int run(int threads);
+
+private:
+	static void* work(void *batch);
+
+	std::string output;
+	std::vector<std::string> logs;
+	//! Output directory of every log, unique also if two logs have the same name
+	std::vector<std::string> outputs;
+	unsigned char color[3];
+	bool learned;
+
+	//! Index of the next log to take, taken with __sync_fetch_and_add
+	int next;
+	int failed;
+};
+
+#endif /* CBATCHRUN_H_ */
@@ -0,0 +1,157 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Collect the calibrations of the odometry of many robots into one report
+ * @file CCalibReport.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#include "CCalibReport.h"
+#include "messageSchema.h"
+
+#include <math.h>
+
+//! In the order of RobotBase::RobotType
+static const char* StrRobotType[] = { "unknown", "KaBot", "ActiveWheel", "Scout" };
+
+//! In the order of MotorCalibMethod
+static const char* StrCalibMethod[] = { "online", "fit", "stored" };
+
+CCalibReport::Statistic::Statistic() {
+	count = 0;
+	sum = squares = 0;
+	min = max = 0;
+}
+
+void CCalibReport::Statistic::add(double value) {
+	if (count == 0 || value < min) min = value;
+	if (count == 0 || value > max) max = value;
+	count++;
+	sum += value;
+	squares += value * value;
+}
+
+double CCalibReport::Statistic::mean() const {
+	return count > 0 ? sum / count : 0;
+}
+
+double CCalibReport::Statistic::deviation() const {
+	if (count < 2) return 0;
+	double variance = (squares - sum * sum / count) / (count - 1);
+	return variance > 0 ? sqrt(variance) : 0;
+}
+
+CCalibReport::CCalibReport() {
+}
+
+/**
+ * The messenger of a robot may send a message more than once, a report of a robot with the timestamp of one that is
+ * there already is such a copy.
+ */
+bool CCalibReport::add(int from, const uint8_t *data, int len) {
+	MotorCalibReport report;
+	if (!unpackMotorCalibReport(data, len, report)) return false;
+	if (report.robot < 0) report.robot = from;
+	Robot & robot = robots[report.robot];
+	for (unsigned int i = 0; i < robot.reports.size(); i++) {
+		if (robot.reports[i].timestamp == report.timestamp) return true;
+	}
+	robot.robot_type = report.robot_type;
+	robot.reports.push_back(report);
+	if (report.observations > 0) {
+		robot.residual.add(report.residual);
+		robot.drift.add(report.drift);
+		robot.angle_drift.add(report.angle_drift);
+	}
+	const MotorCalibResult & first = robot.reports[0].result;
+	const float koef[3] = { report.result.odometry_koef1, report.result.odometry_koef2, report.result.odometry_koef3 };
+	const float start[3] = { first.odometry_koef1, first.odometry_koef2, first.odometry_koef3 };
+	for (int i = 0; i < 3; i++) {
+		robot.koef[i].add(start[i] != 0 ? koef[i] / start[i] - 1 : 0);
+	}
+	return true;
+}
+
+/**
+ * The residual and the drift are the mean over the rounds and the worst round, in mm and mm per m driven. The change of
+ * the coefficients is the largest of the three, in percent of the first round, as the deviation over the rounds and
+ * as the difference between the first and the last round.
+ */
+void CCalibReport::printRobot(FILE *out, int robot, const Robot & data) const {
+	const MotorCalibReport & last = data.reports.back();
+	const MotorCalibResult & first = data.reports[0].result;
+	const float koef[3] = { last.result.odometry_koef1, last.result.odometry_koef2, last.result.odometry_koef3 };
+	const float start[3] = { first.odometry_koef1, first.odometry_koef2, first.odometry_koef3 };
+	double spread = 0, change = 0;
+	for (int i = 0; i < 3; i++) {
+		double lastChange = start[i] != 0 ? fabs(koef[i] / start[i] - 1) : 0;
+		if (data.koef[i].deviation() > spread) spread = data.koef[i].deviation();
+		if (lastChange > change) change = lastChange;
+	}
+	int type = data.robot_type >= 0 && data.robot_type < 4 ? data.robot_type : 0;
+	int method = last.method >= 0 && last.method < 3 ? last.method : 0;
+	fprintf(out, "%5d %-11s %6d %-6s %10.3e %10.3e %10.3e %7.2f %7.2f %7.1f %7.1f %7.1f %7.1f %7.2f\n", robot,
+			StrRobotType[type], (int) data.reports.size(), StrCalibMethod[method], last.result.odometry_koef1,
+			last.result.odometry_koef2, last.result.odometry_koef3, 100 * spread, 100 * change,
+			1000 * data.residual.mean(), 1000 * data.residual.max, 1000 * data.drift.mean(), 1000 * data.drift.max,
+			100 * data.angle_drift.mean());
+}
+
+void CCalibReport::print(FILE *out) const {
+	fprintf(out, "%5s %-11s %6s %-6s %10s %10s %10s %7s %7s %7s %7s %7s %7s %7s\n", "robot", "type", "rounds",
+			"method", "koef1", "koef2", "koef3", "spread%", "change%", "res mm", "max mm", "mm/m", "max", "rot %");
+	Statistic residual, drift, angle_drift;
+	int rounds = 0;
+	for (std::map<int, Robot>::const_iterator i = robots.begin(); i != robots.end(); ++i) {
+		printRobot(out, i->first, i->second);
+		rounds += i->second.reports.size();
+		for (unsigned int j = 0; j < i->second.reports.size(); j++) {
+			const MotorCalibReport & report = i->second.reports[j];
+			if (report.observations == 0) continue;
+			residual.add(report.residual);
+			drift.add(report.drift);
+			angle_drift.add(report.angle_drift);
+		}
+	}
+	fprintf(out, "%d robots, %d rounds: residual %.1f +- %.1f mm, drift %.1f +- %.1f mm/m (max %.1f), rotation %.2f "
+			"+- %.2f %%\n", (int) robots.size(), rounds, 1000 * residual.mean(), 1000 * residual.deviation(),
+			1000 * drift.mean(), 1000 * drift.deviation(), 1000 * drift.max, 100 * angle_drift.mean(),
+			100 * angle_drift.deviation());
+}
+
+bool CCalibReport::write(const char *path) const {
+	FILE *file = fopen(path, "w");
+	if (file == NULL) return false;
+	print(file);
+	fprintf(file, "\n#robot type method timestamp koef1 koef2 koef3 speed fit_residual observations residual "
+			"max_residual angle_residual distance rotation drift angle_drift\n");
+	for (std::map<int, Robot>::const_iterator i = robots.begin(); i != robots.end(); ++i) {
+		for (unsigned int j = 0; j < i->second.reports.size(); j++) {
+			const MotorCalibReport & r = i->second.reports[j];
+			fprintf(file, "%d %d %d %llu %e %e %e %d %f %d %f %f %f %f %f %f %f\n", r.robot, r.robot_type, r.method,
+					(unsigned long long) r.timestamp, r.result.odometry_koef1, r.result.odometry_koef2,
+					r.result.odometry_koef3, r.result.calibratedSpeed, r.fit_residual, r.observations, r.residual,
+					r.max_residual, r.angle_residual, r.distance, r.rotation, r.drift, r.angle_drift);
+		}
+	}
+	fclose(file);
+	return true;
+}
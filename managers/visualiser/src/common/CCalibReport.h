@@ -0,0 +1,82 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Collect the calibrations of the odometry of many robots into one report
+ * @file CCalibReport.h
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 15, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#ifndef CCALIBREPORT_H_
+#define CCALIBREPORT_H_
+
+#include "messageDataType.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <map>
+#include <vector>
+
+/**
+ * Every robot that runs motorcalibration with MOTOR_CALIBRATION_EVALUATE broadcasts a MSG_MOTOR_CALIBRATION_REPORT
+ * after the test drive of its calibration. The reports of all robots are kept here per robot, over as many rounds of
+ * calibration as there are, so that a robot whose odometry drifts, or whose coefficients change from round to round,
+ * stands out from the others.
+ */
+class CCalibReport {
+public:
+	CCalibReport();
+	/**
+	 * Add a MSG_MOTOR_CALIBRATION_REPORT, from is the robot it came from, which counts if the report does not know its
+	 * robot. False if the message is not a report, a report that was already added is skipped and true.
+	 */
+	bool add(int from, const uint8_t *data, int len);
+	inline int getRobots() const { return robots.size(); }
+	//! One line per robot and one for all of them together
+	void print(FILE *out) const;
+	//! Replace the file at path by the report, and by every report received as a line of its own
+	bool write(const char *path) const;
+private:
+	struct Statistic {
+		int count;
+		double sum;
+		double squares;
+		double min;
+		double max;
+		Statistic();
+		void add(double value);
+		double mean() const;
+		double deviation() const;
+	};
+	struct Robot {
+		int robot_type;
+		std::vector<MotorCalibReport> reports;
+		Statistic residual;
+		Statistic drift;
+		Statistic angle_drift;
+		//! Of the coefficients, relative to the ones of the first round
+		Statistic koef[3];
+	};
+	std::map<int, Robot> robots;
+
+	void printRobot(FILE *out, int robot, const Robot & data) const;
+};
+
+#endif /* CCALIBREPORT_H_ */
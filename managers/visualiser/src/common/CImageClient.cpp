@@ -5,7 +5,12 @@
 
 CImageClient::CImageClient()
 {
-	totalReceived = 0;
+	streamReceived = 0;
+	payload = NULL;
+	streamSynced = false;
+	memset(&frameHeader, 0, sizeof(frameHeader));
+	overlay.frame_id = 0;
+	overlay.count = 0;
 }
 
 
@@ -72,33 +77,155 @@ int CImageClient::sendMessage(CMessage message)
   return result;
 }
 
-int CImageClient::checkForImage(CRawImage* image)
+int CImageClient::requestImage()
+{
+  return sendSmallMessage(CM_FRAME);
+}
+
+int CImageClient::startStream(int fps, int encoding, int decimation, int bpp)
 {
-  char data[image->size];
-  int result = 1;
+  streamRequest.version = IMAGE_STREAM_VERSION;
+  streamRequest.fps = fps;
+  streamRequest.encoding = encoding;
+  streamRequest.decimation = decimation;
+  streamRequest.bpp = bpp;
+  uint8_t request[1 + IMAGE_STREAM_REQUEST_LENGTH];
+  request[0] = CM_STREAM;
+  packImageStreamRequest(streamRequest, &request[1]);
+  // the server starts every stream with a key frame
+  streamSynced = false;
+  int len = send(socketNumber,request,sizeof(request),MSG_NOSIGNAL);
+  if (len != (int)sizeof(request)){
+	  fprintf(stderr,"Send problem %s\n",strerror(errno));
+	  return -1;
+  }
+  return 0;
+}
 
-  int lengthReceived = 0;
-  int errcount = 0;
-  while (errcount < 5 && totalReceived != image->size){
-	  lengthReceived = recv(socketNumber,&data[totalReceived],image->size-totalReceived,NETWORK_BLOCK); 
-	  if (lengthReceived < 0){
-		  usleep(10000);
-		  errcount++;
-		  result = 0;
-	  }else{
-		  totalReceived += lengthReceived;
+int CImageClient::stopStream()
+{
+  // the frames that are on their way still have to be read with checkForImage
+  return sendSmallMessage(CM_STOP);
+}
+
+int CImageClient::checkForImage(CRawImage* image)
+{
+  int result = 0;
+  bool scale = false;
+  while (true){
+	  if (streamReceived < IMAGE_FRAME_HEADER_LENGTH){
+		  int lengthReceived = recv(socketNumber,&frameHeaderData[streamReceived],IMAGE_FRAME_HEADER_LENGTH-streamReceived,NETWORK_BLOCK);
+		  if (lengthReceived == 0) return -1;
+		  if (lengthReceived < 0) break;
+		  streamReceived += lengthReceived;
+		  if (streamReceived < IMAGE_FRAME_HEADER_LENGTH) continue;
+		  if (!unpackImageFrameHeader(frameHeaderData, frameHeader)){
+			  fprintf(stderr,"Not a frame of an image stream, disconnect\n");
+			  streamReceived = 0;
+			  return -1;
+		  }
+		  if (!(frameHeader.flags & IMAGE_FRAME_OVERLAY)) frameHeader.overlay = 0;
+		  if (frameHeader.overlay > IMAGE_OVERLAY_MAX_LENGTH){
+			  fprintf(stderr,"Frame %u has an overlay of %u bytes, disconnect\n",frameHeader.frame_id,
+					  frameHeader.overlay);
+			  streamReceived = 0;
+			  return -1;
+		  }
+		  // a raw colour frame goes straight into the image, everything else is decoded first
+		  if (frameHeader.encoding == IMAGE_ENCODING_RAW && frameHeader.decimation <= 1 && frameHeader.bpp == 3){
+			  image->resize(frameHeader.width,frameHeader.height,frameHeader.bpp);
+			  payload = image->data;
+		  } else {
+			  if (streamBuffer.size() < frameHeader.length) streamBuffer.resize(frameHeader.length);
+			  payload = streamBuffer.empty() ? NULL : &streamBuffer[0];
+		  }
+		  if (payload == image->data && (int)frameHeader.length != image->size){
+			  fprintf(stderr,"Frame %u has %u bytes for %ix%ix%i pixels, disconnect\n",frameHeader.frame_id,
+					  frameHeader.length,frameHeader.width,frameHeader.height,frameHeader.bpp);
+			  streamReceived = 0;
+			  return -1;
+		  }
+	  }
+	  int end = IMAGE_FRAME_HEADER_LENGTH + frameHeader.length;
+	  int wanted = end - streamReceived;
+	  if (wanted > 0){
+		  int lengthReceived = recv(socketNumber,&payload[streamReceived-IMAGE_FRAME_HEADER_LENGTH],wanted,NETWORK_BLOCK);
+		  if (lengthReceived == 0) return -1;
+		  if (lengthReceived < 0) break;
+		  streamReceived += lengthReceived;
+		  if (lengthReceived < wanted) continue;
+	  }
+	  // the overlay follows the payload
+	  wanted = end + frameHeader.overlay - streamReceived;
+	  if (wanted > 0){
+		  int lengthReceived = recv(socketNumber,&overlayData[streamReceived-end],wanted,NETWORK_BLOCK);
+		  if (lengthReceived == 0) return -1;
+		  if (lengthReceived < 0) break;
+		  streamReceived += lengthReceived;
+		  if (lengthReceived < wanted) continue;
+	  }
+	  // a complete frame
+	  streamReceived = 0;
+	  if (payload == image->data){
+		  unpackImageOverlay(overlayData,frameHeader.overlay,overlay);
+		  result = 1;
+		  scale = false;
+		  continue;
+	  }
+	  bool key = (frameHeader.flags & IMAGE_FRAME_KEY) != 0;
+	  int frameSize = frameHeader.width * frameHeader.height * frameHeader.bpp;
+	  if (frameSize <= 0) continue;
+	  if (key) streamFrame.assign(frameSize, 0);
+	  if (!key && (!streamSynced || (int)streamFrame.size() != frameSize)) continue;
+	  bool ok;
+	  if (frameHeader.encoding == IMAGE_ENCODING_RAW){
+		  ok = ((int)frameHeader.length == frameSize);
+		  if (ok) memcpy(&streamFrame[0],payload,frameSize);
+	  } else {
+		  ok = decodeDeltaRLE(payload,frameHeader.length,&streamFrame[0],frameSize,key);
+	  }
+	  streamSynced = ok;
+	  if (ok){
+		  unpackImageOverlay(overlayData,frameHeader.overlay,overlay);
+		  result = 1;
+		  scale = true;
+		  scaledHeader = frameHeader;
+	  } else {
+		  // asking again makes the server start over with a key frame
+		  fprintf(stderr,"Could not decode frame %u, restart stream\n",frameHeader.frame_id);
+		  startStream(streamRequest.fps,streamRequest.encoding,streamRequest.decimation,streamRequest.bpp);
 	  }
   }
-  fprintf(stderr,"Received %i %i\n",totalReceived,image->size);
-  if (totalReceived==image->size){
-	  memcpy(image->data,data,image->size);
-	  totalReceived = 0;
-  } else {
-	  result = 0;
+  if (scale){
+	  // scale the decimated frame back up to the resolution of the camera, grey goes into every channel
+	  const ImageFrameHeader &h = scaledHeader;
+	  int decimation = h.decimation > 0 ? h.decimation : 1;
+	  image->resize(h.width * decimation, h.height * decimation, 3);
+	  for (int y = 0; y < image->height; y++){
+		  int sy = y / decimation;
+		  for (int x = 0; x < image->width; x++){
+			  int sx = x / decimation;
+			  const uint8_t *pixel = &streamFrame[(sy * h.width + sx) * h.bpp];
+			  unsigned char *dst = &image->data[(y * image->width + x) * image->bpp];
+			  for (int c = 0; c < image->bpp; c++) dst[c] = pixel[h.bpp == 1 ? 0 : c];
+		  }
+	  }
   }
   return result;
 }
 
+int CImageClient::waitForImage(int timeout)
+{
+  struct pollfd fd;
+  fd.fd = socketNumber;
+  fd.events = POLLIN;
+  fd.revents = 0;
+  int result = poll(&fd,1,timeout);
+  if (result < 0 && errno == EINTR) return 0;
+  if (result > 0 && (fd.revents & (POLLERR | POLLNVAL))) return -1;
+  return result;
+}
+
 int CImageClient::disconnectServer()
 {
   return close(socketNumber);
@@ -11,7 +11,10 @@
 #include <errno.h>
 #include "CRawImage.h"
 #include "CMessage.h"
+#include "imageStream.h"
+#include <vector>
 #include <unistd.h>
+#include <poll.h>
 /**
 @author Tom Krajnik
 */
@@ -24,12 +27,46 @@ public:
     int sendMessage(CMessage message);
     int sendSmallMessage(unsigned char message);
     int connectServer(const char * ip,const char* port);
+    //! Ask for a single frame, it comes with an ImageFrameHeader, just like the frames of a stream
+    int requestImage();
+    /**
+     * Read the frames that arrived, requested or streamed, without blocking. The image takes the resolution of the
+     * frames, raw colour frames are received straight into it, others are decoded and scaled up. Use the same image
+     * every call, a frame can arrive over several calls. Returns 1 if image holds a new frame, 0 if not, and -1 if the
+     * connection is lost.
+     */
     int checkForImage(CRawImage* image);
+    //! Block until data arrives, for at most timeout ms, 1 if checkForImage has something to read, 0 if not, -1 on an error
+    int waitForImage(int timeout);
+
+    //! Ask the server to push frames at fps instead of answering requests, see imageStream.h
+    int startStream(int fps, int encoding = IMAGE_ENCODING_DELTA_RLE, int decimation = 2, int bpp = 1);
+    //! Go back to request/response
+    int stopStream();
+    //! The header of the last frame that was decoded
+    inline const ImageFrameHeader & getFrameHeader() { return frameHeader; }
+    //! What the robot found in the last frame that was decoded, in pixels of the camera, empty if it sent nothing
+    inline const ImageOverlay & getOverlay() { return overlay; }
     int disconnectServer();
 
 private:
     int socketNumber;
-    int totalReceived;
+
+    ImageStreamRequest streamRequest;
+    //! A delta frame can only be applied to the frame before it, after an error the client waits for a key frame
+    bool streamSynced;
+    std::vector<uint8_t> streamBuffer;
+    int streamReceived;
+    uint8_t frameHeaderData[IMAGE_FRAME_HEADER_LENGTH];
+    ImageFrameHeader frameHeader;
+    //! Where the payload of the current frame goes, the image itself or streamBuffer
+    unsigned char *payload;
+    //! The overlay after the payload of the current frame, it is unpacked when the frame is complete
+    uint8_t overlayData[IMAGE_OVERLAY_MAX_LENGTH];
+    ImageOverlay overlay;
+    //! The frame that is in streamFrame
+    ImageFrameHeader scaledHeader;
+    std::vector<uint8_t> streamFrame;
 };
 
 #endif
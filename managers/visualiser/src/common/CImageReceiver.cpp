@@ -0,0 +1,200 @@
+#include "CImageReceiver.h"
+#include <sys/time.h>
+
+static long long receiverTime()
+{
+	struct timeval time;
+	gettimeofday(&time, NULL);
+	return (long long)time.tv_sec * 1000000 + time.tv_usec;
+}
+
+CImageReceiver::CImageReceiver(const char *ip, const char *port, bool stream, int fps): ip(ip), port(port),
+		stream(stream), fps(fps)
+{
+	running = false;
+	image = new CRawImage();
+	tile = new CRawImage();
+	tileWidth = 320;
+	tileHeight = 240;
+	tileValid = false;
+	tileOverlay.frame_id = 0;
+	tileOverlay.count = 0;
+	memset(&stats, 0, sizeof(stats));
+	stats.age = -1;
+	lastFrame = 0;
+	recorder = NULL;
+	recorder_channel = 0;
+	pthread_mutex_init(&imageMutex, NULL);
+	pthread_mutex_init(&tileMutex, NULL);
+}
+
+CImageReceiver::~CImageReceiver()
+{
+	stop();
+	delete tile;
+	delete image;
+	pthread_mutex_destroy(&tileMutex);
+	pthread_mutex_destroy(&imageMutex);
+}
+
+int CImageReceiver::start()
+{
+	if (running) return 0;
+	running = true;
+	if (pthread_create(&thread, NULL, &CImageReceiver::run, this) != 0){
+		fprintf(stderr,"Could not start the image receiver of %s\n",ip.c_str());
+		running = false;
+		return -1;
+	}
+	return 0;
+}
+
+//! A robot that does not answer a connect can keep the thread for as long as the connect times out
+void CImageReceiver::stop()
+{
+	if (!running) return;
+	running = false;
+	pthread_join(thread, NULL);
+}
+
+void* CImageReceiver::run(void *receiver)
+{
+	((CImageReceiver*)receiver)->receive();
+	return NULL;
+}
+
+void CImageReceiver::receive()
+{
+	bool connected = false;
+	bool requested = false;
+	int wait = 0;
+	while (running){
+		if (!connected){
+			// sleep in small steps, so stop() does not have to wait for the next attempt
+			if (wait > 0){
+				usleep(RECEIVER_POLL * 1000);
+				wait -= RECEIVER_POLL;
+				continue;
+			}
+			if (client.connectServer(ip.c_str(), port.c_str()) < 0){
+				client.disconnectServer();
+				wait = RECEIVER_RETRY;
+				continue;
+			}
+			connected = true;
+			requested = false;
+			if (stream) client.startStream(fps);
+			pthread_mutex_lock(&tileMutex);
+			stats.connected = true;
+			pthread_mutex_unlock(&tileMutex);
+		}
+		if (!stream && !requested){
+			requested = (client.requestImage() >= 0);
+		}
+		int ready = client.waitForImage(RECEIVER_POLL);
+		if (ready == 0) continue;
+		pthread_mutex_lock(&imageMutex);
+		int result = (ready < 0) ? -1 : client.checkForImage(image);
+		pthread_mutex_unlock(&imageMutex);
+		if (result > 0){
+			requested = false;
+			frameReceived();
+		} else if (result < 0){
+			fprintf(stderr,"Lost the image server of %s, reconnect\n",ip.c_str());
+			client.disconnectServer();
+			connected = false;
+			wait = RECEIVER_RETRY;
+			pthread_mutex_lock(&tileMutex);
+			stats.connected = false;
+			pthread_mutex_unlock(&tileMutex);
+		}
+	}
+	if (connected) client.disconnectServer();
+}
+
+/**
+ * Only the receiver thread writes the image, so it is read here without imageMutex. The tile is scaled with nearest
+ * neighbour, the GUI shows it as it is.
+ */
+void CImageReceiver::frameReceived()
+{
+	long long now = receiverTime();
+	const ImageFrameHeader &header = client.getFrameHeader();
+	// with the timestamp of the robot, so a replay has the timing of the camera and not that of the WiFi
+	if (recorder != NULL) {
+		recorder->appendFrame(recorder_channel, image->data, image->width, image->height, image->bpp, header.frame_id,
+				header.timestamp);
+	}
+	pthread_mutex_lock(&tileMutex);
+	tile->resize(tileWidth, tileHeight, 3);
+	for (int y = 0; y < tile->height; y++){
+		int sy = y * image->height / tile->height;
+		for (int x = 0; x < tile->width; x++){
+			int sx = x * image->width / tile->width;
+			const unsigned char *pixel = &image->data[(sy * image->width + sx) * image->bpp];
+			unsigned char *dst = &tile->data[(y * tile->width + x) * 3];
+			dst[0] = pixel[0];
+			dst[1] = pixel[1];
+			dst[2] = pixel[2];
+		}
+	}
+	tileValid = true;
+	// the arms of a cross and the numbers keep their size, so they stay readable in a small tile
+	const ImageOverlay &overlay = client.getOverlay();
+	tileOverlay.frame_id = overlay.frame_id;
+	tileOverlay.count = overlay.count;
+	for (int i = 0; i < overlay.count; i++){
+		ImageOverlayPrimitive primitive = overlay.primitives[i];
+		primitive.x0 = primitive.x0 * tile->width / image->width;
+		primitive.y0 = primitive.y0 * tile->height / image->height;
+		if (primitive.type == OVERLAY_LINE || primitive.type == OVERLAY_BOX){
+			primitive.x1 = primitive.x1 * tile->width / image->width;
+			primitive.y1 = primitive.y1 * tile->height / image->height;
+		}
+		tileOverlay.primitives[i] = primitive;
+	}
+	if (lastFrame > 0 && now > lastFrame){
+		float rate = 1000000.0f / (now - lastFrame);
+		stats.fps = (stats.frames > 1) ? 0.8f * stats.fps + 0.2f * rate : rate;
+	}
+	lastFrame = now;
+	stats.frames++;
+	int latency = (int)((now - (long long)header.timestamp) / 1000);
+	stats.latency = (stats.frames > 1) ? (4 * stats.latency + latency) / 5 : latency;
+	pthread_mutex_unlock(&tileMutex);
+}
+
+void CImageReceiver::setTileSize(int width, int height)
+{
+	pthread_mutex_lock(&tileMutex);
+	tileWidth = width;
+	tileHeight = height;
+	pthread_mutex_unlock(&tileMutex);
+}
+
+CRawImage* CImageReceiver::lockTile()
+{
+	pthread_mutex_lock(&tileMutex);
+	return tileValid ? tile : NULL;
+}
+
+void CImageReceiver::unlockTile()
+{
+	pthread_mutex_unlock(&tileMutex);
+}
+
+SReceiverStats CImageReceiver::getStats()
+{
+	pthread_mutex_lock(&tileMutex);
+	SReceiverStats result = stats;
+	if (lastFrame > 0) result.age = (int)((receiverTime() - lastFrame) / 1000);
+	pthread_mutex_unlock(&tileMutex);
+	return result;
+}
+
+void CImageReceiver::saveBmp()
+{
+	pthread_mutex_lock(&imageMutex);
+	image->saveBmp();
+	pthread_mutex_unlock(&imageMutex);
+}
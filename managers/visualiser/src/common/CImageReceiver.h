@@ -0,0 +1,89 @@
+#ifndef CIMAGERECEIVER_H
+#define CIMAGERECEIVER_H
+
+#include "CImageClient.h"
+#include "CStreamLog.h"
+#include <pthread.h>
+#include <string>
+
+//! Time between two attempts to connect to a robot, in ms
+#define RECEIVER_RETRY 2000
+//! How long the receiver thread waits for data before it checks whether it should stop, in ms
+#define RECEIVER_POLL 100
+
+struct SReceiverStats
+{
+	bool connected;
+	//! Frames received since the start
+	unsigned int frames;
+	//! Frames per second, averaged over the last few frames
+	float fps;
+	//! From the publish timestamp of the robot to the end of the decoding here, in ms, assumes synchronised clocks
+	int latency;
+	//! Since the last frame, in ms, -1 before the first frame
+	int age;
+};
+
+/**
+ * Receives the images of one robot on its own thread, so a slow or unreachable robot does not hold up the GUI or the
+ * other robots. The thread connects (and reconnects) to the image server, streams or requests frames, decodes them, and
+ * scales every frame down to the size of the tile the GUI shows it in. The GUI only takes the small tile under a lock,
+ * together with the overlay the robot sent along with the frame, which is scaled to the tile as well.
+ */
+class CImageReceiver
+{
+public:
+	//! With stream the robot pushes compressed frames at fps, otherwise the next raw frame is requested after the last
+	CImageReceiver(const char *ip, const char *port, bool stream = true, int fps = 5);
+	~CImageReceiver();
+
+	int start();
+	void stop();
+
+	//! The size the frames are scaled to, takes effect with the next frame
+	void setTileSize(int width, int height);
+	//! The last scaled frame, NULL before the first frame, call unlockTile() when done with it
+	CRawImage* lockTile();
+	void unlockTile();
+	//! The overlay of the last frame in pixels of the tile, only while the tile is locked
+	inline const ImageOverlay & getTileOverlay() { return tileOverlay; }
+
+	SReceiverStats getStats();
+	//! Save the last frame in full resolution
+	void saveBmp();
+
+	inline const std::string & getAddress() { return ip; }
+
+	//! Record every frame as it is shown into log, channel tells the robots apart, call before start()
+	inline void setRecorder(CStreamLog *log, uint8_t channel) { recorder = log; recorder_channel = channel; }
+
+private:
+	static void* run(void *receiver);
+	void receive();
+	void frameReceived();
+
+	std::string ip, port;
+	bool stream;
+	int fps;
+
+	CImageClient client;
+	pthread_t thread;
+	bool running;
+
+	//! Written by the receiver thread only, under imageMutex
+	CRawImage *image;
+	pthread_mutex_t imageMutex;
+
+	CRawImage *tile;
+	int tileWidth, tileHeight;
+	bool tileValid;
+	ImageOverlay tileOverlay;
+	SReceiverStats stats;
+	long long lastFrame;
+
+	CStreamLog *recorder;
+	uint8_t recorder_channel;
+	pthread_mutex_t tileMutex;
+};
+
+#endif
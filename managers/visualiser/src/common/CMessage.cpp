@@ -62,6 +62,33 @@ const char* StrMessage[] = {
 		"I can help to create organism",
 		"Help accepted",
 		"My ZigBee Identity",
+		"Pipeline statistics REQ",
+		"Pipeline statistics",
+		"Camera batch mode",
+		"Camera detected batch",
+		"Laser odometry REQ",
+		"Laser odometry",
+		"Laser scan stream",
+		"Laser scan",
+		"Subscribe",
+		"Unsubscribe",
+		"Map snapshot REQ",
+		"Map snapshot",
+		"Ping",
+		"Pong",
+		"IPC stats",
+		"Fusion object",
+		"Motor calibration report",
+		"Memory stats",
+		"Standby",
+		"OrgState",
+		"OrganismCommand",
+		"Heartbeat",
+		"Trace dump",
+		"Occupancy request",
+		"Occupancy",
+		"Frontier request",
+		"Frontier",
 		"MSG_NUMBER"
 };
 
@@ -108,6 +135,23 @@ void CMessage::set(const CMessage *msg) {
 	}
 }
 
+bool CMessage::viewZBMessage(ZBEnvelope &envelope) const {
+	if (data == NULL || len < (int)ZB_ENVELOPE_HEADER) {
+		envelope.ubitag = 0;
+		envelope.type = MSG_NONE;
+		envelope.data = NULL;
+		envelope.len = 0;
+		return false;
+	}
+	int type;
+	memcpy(&envelope.ubitag, data, sizeof(uint64_t));
+	memcpy(&type, data + sizeof(uint64_t), sizeof(int));
+	envelope.type = (TMessageType)type;
+	envelope.len = len - ZB_ENVELOPE_HEADER;
+	envelope.data = (envelope.len > 0) ? data + ZB_ENVELOPE_HEADER : NULL;
+	return true;
+}
+
 CMessage CMessage::packToZBMessage(uint64_t ubitag, int type, void *data,
 		int len) {
 	//printf("packing to ZB message \n");
@@ -99,11 +99,50 @@ typedef enum
 	MSG_HELP_ORG,
 	MSG_HELP_ACP,
 	MSG_MY_ZIGBEE_ID,
+	MSG_STATS_REQ, // optional payload of one byte, 1 to enable and 0 to disable the latency statistics
+	MSG_STATS, // payload is PipelineStats
+	MSG_CAM_BATCH_MODE, // payload of one byte, 1 to send MSG_CAM_DETECTED_BATCH instead of the blob messages
+	MSG_CAM_DETECTED_BATCH, // payload is a DetectionBatchHeader with its arrays, see packDetectionBatch
+	MSG_LASER_ODOMETRY_REQ, // optional payload of one byte, 1 to send MSG_LASER_ODOMETRY after every scan, 0 to stop
+	MSG_LASER_ODOMETRY, // payload is LaserOdometry
+	MSG_LASER_SCAN_STREAM, // payload of one byte, 1 to send MSG_LASER_SCAN after every scan, 0 to stop
+	MSG_LASER_SCAN, // payload is a LaserScanHeader with the delta-encoded laser vector, see packLaserScan
+	MSG_SUBSCRIBE, // payload is one byte per message type that CEquids should publish to the sender
+	MSG_UNSUBSCRIBE, // payload is one byte per message type to stop publishing to the sender
+	MSG_MAP_SNAPSHOT_REQ, // payload is a MapSnapshotRequestWire, answered with MSG_MAP_SNAPSHOT
+	MSG_MAP_SNAPSHOT, // payload is a MapSnapshotHeaderWire with its objects, see packMapSnapshot
+	MSG_PING, // any payload, a jockey that understands it answers with a MSG_PONG with the same payload
+	MSG_PONG, // the payload of the MSG_PING it answers
+	MSG_IPC_STATS, // no payload asks for the counters of the IPC connections, the answer has the same type, see IPCStatsHeaderWire
+	MSG_FUSION_OBJECT, // payload is a FusionObject, a laser scan and a camera frame of the same moment classified by CFusion
+	MSG_MOTOR_CALIBRATION_REPORT, // payload is a MotorCalibReportWire, a calibration of the odometry and its test drive
+	MSG_MEM_STATS, // no payload asks for the memory of the process and its subsystems, answered with a MemStatsHeaderWire
+	MSG_STANDBY, // get ready to be started within milliseconds, optional uint8_t 0 leaves the standby again
+	MSG_ORG_STATE, // payload is an OrganismStateHeaderWire with its entries, the recruitment table, see CRecruitment
+	MSG_ORGANISM_COMMAND, // payload is an OrganismCommandHeaderWire with its setpoints, one for all modules of an organism
+	MSG_HEARTBEAT, // payload is a HeartbeatWire, sent by CController::run(), CEquids restarts a jockey that stops it
+	MSG_TRACE_DUMP, // no payload asks for the latency records of the process, answered with a TraceDumpHeaderWire
+	MSG_OCCUPANCY_REQ, // payload is an OccupancyRequestWire, answered with MSG_OCCUPANCY
+	MSG_OCCUPANCY, // payload is an OccupancyHeaderWire with its tiles, see occupancyTile
+	MSG_FRONTIER_REQ, // no payload asks the mapping jockey where to explore next, answered with MSG_FRONTIER
+	MSG_FRONTIER, // payload is a FrontierWire, the next target to explore
 	TOTAL_NUMBER_OF_MESSAGES // for debugging
 } TMessageType;
 
 extern const char* StrMessage[];
 
+//! Bytes in front of the inner message of a MSG_ZIGBEE_MSG: the Ubitag of the other robot and the inner type as int
+#define ZB_ENVELOPE_HEADER (sizeof(uint64_t) + sizeof(int))
+
+//! The inner message of a MSG_ZIGBEE_MSG as it is in the buffer of the CMessage, see the copy in the bridles
+struct ZBEnvelope
+{
+	uint64_t ubitag;
+	TMessageType type;
+	const uint8_t *data;
+	int len;
+};
+
 class CMessage
 {
 public:
@@ -112,6 +151,8 @@ public:
 	void set(const ELolMessage*msg);
 	void set(const CMessage *msg);
 	const char* getStrType();
+	//! View the inner message of a MSG_ZIGBEE_MSG without a copy, false if it is shorter than its envelope
+	bool viewZBMessage(ZBEnvelope &envelope) const;
 	static CMessage unpackZBMessage(CMessage ZBmessage);
 	static CMessage packToZBMessage(uint64_t ubitag, int type, void *data,	int len);
 	int fromRobot;
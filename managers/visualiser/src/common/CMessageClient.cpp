@@ -1,16 +1,136 @@
 #include "CMessageClient.h"
 
 #define NETWORK_BLOCK MSG_WAITALL
+//! Snapshots that are not taken by the GUI yet, beyond this they are dropped
+#define MAP_SNAPSHOT_QUEUE 64
 
 CMessageClient::CMessageClient() //: mySocket(-1)
 {
 	printf("Create message client\n");
+	pthread_mutex_init(&scanMutex, NULL);
+	scanLength = 0;
+	scanReceived = false;
+	statsLength = 0;
+	memLength = 0;
+	mapDropped = 0;
 }
 
 
 CMessageClient::~CMessageClient()
 {
 	printf("Deallocate message client\n");
+	jockey_IPC.SetReconnect(false);
+	pthread_mutex_destroy(&scanMutex);
+}
+
+void CMessageClient::receive(const ELolMessage *msg, void *connection, void *user_ptr)
+{
+	CMessageClient *client = (CMessageClient*)user_ptr;
+	if (msg->command == MSG_IPC_STATS) {
+		if (ipcStatsView(msg->data, msg->length) == NULL || msg->length > sizeof(client->statsData)) {
+			fprintf(stderr,"IPC stats of %i bytes are not valid\n", msg->length);
+			return;
+		}
+		pthread_mutex_lock(&client->scanMutex);
+		memcpy(client->statsData, msg->data, msg->length);
+		client->statsLength = msg->length;
+		pthread_mutex_unlock(&client->scanMutex);
+		return;
+	}
+	if (msg->command == MSG_MEM_STATS) {
+		if (memStatsView(msg->data, msg->length) == NULL || msg->length > sizeof(client->memData)) {
+			fprintf(stderr,"Memory stats of %i bytes are not valid\n", msg->length);
+			return;
+		}
+		pthread_mutex_lock(&client->scanMutex);
+		memcpy(client->memData, msg->data, msg->length);
+		client->memLength = msg->length;
+		pthread_mutex_unlock(&client->scanMutex);
+		return;
+	}
+	if (msg->command == MSG_MAP_SNAPSHOT) {
+		pthread_mutex_lock(&client->scanMutex);
+		if (client->mapSnapshots.size() < MAP_SNAPSHOT_QUEUE) {
+			client->mapSnapshots.push_back(std::vector<uint8_t>(msg->data, msg->data + msg->length));
+		} else {
+			client->mapDropped++;
+		}
+		pthread_mutex_unlock(&client->scanMutex);
+		return;
+	}
+	if (msg->command != MSG_LASER_SCAN) return;
+	if (msg->length > sizeof(client->scanData)) {
+		fprintf(stderr,"Laser scan of %i bytes is too long\n", msg->length);
+		return;
+	}
+	pthread_mutex_lock(&client->scanMutex);
+	memcpy(client->scanData, msg->data, msg->length);
+	client->scanLength = msg->length;
+	client->scanReceived = true;
+	pthread_mutex_unlock(&client->scanMutex);
+}
+
+bool CMessageClient::checkForScan(LaserScanHeader & header, int16_t *columns)
+{
+	pthread_mutex_lock(&scanMutex);
+	bool result = scanReceived;
+	if (scanReceived) {
+		result = unpackLaserScan(scanData, scanLength, header, columns);
+		if (!result) fprintf(stderr,"Laser scan of %i bytes is not valid\n", scanLength);
+		scanReceived = false;
+	}
+	pthread_mutex_unlock(&scanMutex);
+	return result;
+}
+
+bool CMessageClient::requestIPCStats()
+{
+	return jockey_IPC.SendData(MSG_IPC_STATS, NULL, 0);
+}
+
+int CMessageClient::checkForIPCStats(uint8_t *buffer)
+{
+	pthread_mutex_lock(&scanMutex);
+	int len = statsLength;
+	if (len > 0) memcpy(buffer, statsData, len);
+	statsLength = 0;
+	pthread_mutex_unlock(&scanMutex);
+	return len;
+}
+
+bool CMessageClient::requestMemStats()
+{
+	return jockey_IPC.SendData(MSG_MEM_STATS, NULL, 0);
+}
+
+int CMessageClient::checkForMemStats(uint8_t *buffer)
+{
+	pthread_mutex_lock(&scanMutex);
+	int len = memLength;
+	if (len > 0) memcpy(buffer, memData, len);
+	memLength = 0;
+	pthread_mutex_unlock(&scanMutex);
+	return len;
+}
+
+bool CMessageClient::requestMapSnapshot(uint32_t since, uint8_t flags)
+{
+	MapSnapshotRequestWire request;
+	request.version = MapSnapshotRequestWire::VERSION;
+	request.flags = flags;
+	request.since = since;
+	return jockey_IPC.SendData(MSG_MAP_SNAPSHOT_REQ, (uint8_t*)&request, sizeof(request));
+}
+
+int CMessageClient::checkForMapSnapshots(std::vector<std::vector<uint8_t> > & snapshots)
+{
+	snapshots.clear();
+	pthread_mutex_lock(&scanMutex);
+	snapshots.swap(mapSnapshots);
+	int dropped = mapDropped;
+	mapDropped = 0;
+	pthread_mutex_unlock(&scanMutex);
+	return dropped;
 }
 
 int CMessageClient::sendMessage(CMessage* msg)
@@ -35,6 +155,9 @@ int CMessageClient::sendMessage(CMessage* msg)
 int CMessageClient::init(const char *ip,const char* port,bool requirements[])
 {
 	int p = atoi(port);
+	jockey_IPC.SetCallback(receive, this);
+	// the robot is reached over the wireless network, the connection comes back by itself when the link drops
+	jockey_IPC.SetReconnect(true);
 	bool success = jockey_IPC.Start(ip, p, false);
 	if (!success) {
 		fprintf(stderr,"Could not create a connection!\n");
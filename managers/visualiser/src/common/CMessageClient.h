@@ -12,6 +12,10 @@
 #include <string.h>
 
 #include <ipc.h>
+#include <pthread.h>
+#include <vector>
+#include "messageDataType.h"
+#include "messageSchema.h"
 
 /**
 @author Tom Krajnik
@@ -26,7 +30,49 @@ public:
 //  int checkForData(double odo[],bool but[],int rotat[]);
   int sendMessage(CMessage* message);
 
+  //! Get the last MSG_LASER_SCAN of the jockey, false if there is no new one since the last call
+  bool checkForScan(LaserScanHeader & header, int16_t *columns);
+
+  //! Ask the jockey for the counters of its IPC connections, the answer is kept until checkForIPCStats
+  bool requestIPCStats();
+
+  //! Copy the last MSG_IPC_STATS into buffer, which holds IPC_STATS_MAX_LENGTH bytes, returns
+  //! its length or 0 if there is no new one since the last call
+  int checkForIPCStats(uint8_t *buffer);
+
+  //! Ask the jockey for its resident size and the buffers of its subsystems, the answer is kept until checkForMemStats
+  bool requestMemStats();
+
+  //! Copy the last MSG_MEM_STATS into buffer, which holds MEM_STATS_MAX_LENGTH bytes, returns its length or 0 if
+  //! there is no new one since the last call
+  int checkForMemStats(uint8_t *buffer);
+
+  //! Ask the jockey for the objects of its map that changed since version since, with flags of MAP_SNAPSHOT_*
+  bool requestMapSnapshot(uint32_t since, uint8_t flags);
+
+  //! Move the MSG_MAP_SNAPSHOT messages that arrived since the last call into snapshots, in the order they arrived,
+  //! returns the number that were dropped because the queue was full, after which only a full snapshot is complete
+  int checkForMapSnapshots(std::vector<std::vector<uint8_t> > & snapshots);
+
 private:
+  //! Called by the IPC thread for every message of the jockey, only the last MSG_LASER_SCAN is kept
+  static void receive(const ELolMessage *msg, void *connection, void *user_ptr);
+
+  pthread_mutex_t scanMutex;
+  uint8_t scanData[sizeof(LaserScanHeader) + 3 * MAX_LASER_SCAN_ROWS];
+  int scanLength;
+  bool scanReceived;
+
+  uint8_t statsData[IPC_STATS_MAX_LENGTH];
+  int statsLength;
+
+  uint8_t memData[MEM_STATS_MAX_LENGTH];
+  int memLength;
+
+  //! Unlike a scan, every snapshot is a delta that counts, so they are queued up to MAP_SNAPSHOT_QUEUE
+  std::vector<std::vector<uint8_t> > mapSnapshots;
+  int mapDropped;
+
 //  int checkForInts(int data[],unsigned int len);
 //  int checkForBools(bool data[],unsigned int len);
 //  int checkForDoubles(double data[],unsigned int len);
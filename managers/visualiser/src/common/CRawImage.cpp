@@ -19,6 +19,7 @@ CRawImage::CRawImage()
 	height = 480;
 	bpp= 3;
 	size = bpp*width*height;
+	capacity = size;
 	data = (unsigned char*)calloc(size,sizeof(unsigned char));
 	header[18] = width%256;
 	header[19] = width/256;
@@ -45,6 +46,27 @@ CRawImage::~CRawImage()
 	free(data);
 }
 
+void CRawImage::resize(int w, int h, int b)
+{
+	if (w == width && h == height && b == bpp) return;
+	int newSize = b*w*h;
+	if (newSize > capacity){
+		unsigned char* newData = (unsigned char*)calloc(newSize,sizeof(unsigned char));
+		if (newData == NULL) return;
+		free(data);
+		data = newData;
+		capacity = newSize;
+	}
+	width = w;
+	height = h;
+	bpp = b;
+	size = newSize;
+	header[18] = width%256;
+	header[19] = width/256;
+	header[22] = height%256;
+	header[23] = height/256;
+}
+
 void CRawImage::swap()
 {
   unsigned char* newData = (unsigned char*)calloc(size,sizeof(unsigned char));
@@ -61,13 +83,31 @@ void CRawImage::swap()
   free(newData);
 }
 
+/**
+ * The rows go bottom up and with the blue channel first into one buffer, which is written in one go, so the image is
+ * not swapped and swapped back as before. The widths of the cameras are a multiple of 4, so the rows need no padding.
+ */
 void CRawImage::saveBmp(const char* inName)
 {
 	FILE* file = fopen(inName,"wb");
-	swap();
+	if (file == NULL){
+		fprintf(stderr,"Could not open %s for writing\n",inName);
+		return;
+	}
+	unsigned char* buffer = (unsigned char*)malloc(size);
+	int span = width*bpp;
+	for (int j = 0;j<height;j++){
+		const unsigned char* src = &data[span*(height-1-j)];
+		unsigned char* dst = &buffer[span*j];
+		for (int i = 0;i<span;i+=3){
+			dst[i] = src[i+2];
+			dst[i+1] = src[i+1];
+			dst[i+2] = src[i];
+		}
+	}
 	fwrite(header,54,1,file);
-	fwrite(data,size,1,file);
-	swap();
+	fwrite(buffer,size,1,file);
+	free(buffer);
 	fclose(file);
 }
 
@@ -15,6 +15,8 @@ public:
 
   CRawImage();
   ~CRawImage();
+  //! Change the dimensions, the buffer only grows, so a stream that switches back and forth does not reallocate
+  void resize(int width, int height, int bpp);
   void saveBmp(const char* name);
   void saveBmp();
   bool loadBmp(const char* name);
@@ -33,6 +35,7 @@ public:
   int palette;
   int size;
   int bpp;
+  int capacity;
 
   unsigned char* data;
   int numSaved;
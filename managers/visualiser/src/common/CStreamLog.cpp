@@ -0,0 +1,348 @@
+/**
+ * 456789------------------------------------------------------------------------------------------------------------120
+ *
+ * @brief Record frames, messages and laser vectors of a run in one log and play them back later
+ * @file CStreamLog.cpp
+ *
+ * This file is created at Almende B.V. and Distributed Organisms B.V. It is open-source software and belongs to a
+ * larger suite of software that is meant for research on self-organization principles and multi-agent systems where
+ * learning algorithms are an important aspect.
+ *
+ * This software is published under the GNU Lesser General Public license (LGPL).
+ *
+ * It is not possible to add usage restrictions to an open-source license. Nevertheless, we personally strongly object
+ * against this software being used for military purposes, factory farming, animal experimentation, and "Universal
+ * Declaration of Human Rights" violations.
+ *
+ * Copyright (c) 2013 Anne C. van Rossum <anne@almende.org>
+ *
+ * @author    Anne C. van Rossum
+ * @date      Oct 14, 2013
+ * @project   Replicator
+ * @company   Almende B.V.
+ * @company   Distributed Organisms B.V.
+ * @case      Sensor fusion
+ */
+
+#include "CStreamLog.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define STREAM_LOG_ALIGN(n) (((n) + 7) & ~7u)
+
+uint64_t streamLogTime() {
+	struct timeval time;
+	gettimeofday(&time, NULL);
+	return (uint64_t)time.tv_sec * 1000000 + time.tv_usec;
+}
+
+static std::string segmentName(const std::string &path, int segment) {
+	char name[16];
+	snprintf(name, sizeof(name), ".%04i", segment);
+	return path + name;
+}
+
+CStreamLog::CStreamLog(): segment_size(STREAM_LOG_SEGMENT_SIZE), segment(-1), segment_fd(-1), map(NULL), mapped(0),
+		used(0), index_fd(-1), sequence(0) {
+	pthread_mutex_init(&mutex, NULL);
+}
+
+CStreamLog::~CStreamLog() {
+	close();
+	pthread_mutex_destroy(&mutex);
+}
+
+bool CStreamLog::open(const char *path, uint32_t segment_size) {
+	close();
+	pthread_mutex_lock(&mutex);
+	this->path = path;
+	this->segment_size = segment_size;
+	segment = -1;
+	sequence = 0;
+	index.clear();
+	index_fd = ::open((this->path + ".idx").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	bool result = (index_fd >= 0) && newSegment(0);
+	if (index_fd < 0) fprintf(stderr, "CStreamLog: cannot create the index of %s: %s\n", path, strerror(errno));
+	pthread_mutex_unlock(&mutex);
+	if (!result) close();
+	return result;
+}
+
+void CStreamLog::close() {
+	pthread_mutex_lock(&mutex);
+	closeSegment();
+	if (index_fd >= 0) {
+		flushIndex();
+		::close(index_fd);
+		index_fd = -1;
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * Only called with the mutex held. The index is flushed first, so it never refers to a segment that is not complete.
+ */
+bool CStreamLog::newSegment(uint32_t needed) {
+	closeSegment();
+	flushIndex();
+	segment++;
+	long page = sysconf(_SC_PAGESIZE);
+	uint32_t size = std::max(segment_size, needed);
+	size = (size + page - 1) / page * page;
+	std::string name = segmentName(path, segment);
+	segment_fd = ::open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (segment_fd < 0 || ftruncate(segment_fd, size) < 0) {
+		fprintf(stderr, "CStreamLog: cannot create segment %s: %s\n", name.c_str(), strerror(errno));
+		closeSegment();
+		return false;
+	}
+	void *address = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, segment_fd, 0);
+	if (address == MAP_FAILED) {
+		fprintf(stderr, "CStreamLog: cannot map segment %s: %s\n", name.c_str(), strerror(errno));
+		closeSegment();
+		return false;
+	}
+	map = (uint8_t*)address;
+	mapped = size;
+	used = 0;
+	return true;
+}
+
+void CStreamLog::closeSegment() {
+	if (map != NULL) {
+		munmap(map, mapped);
+		map = NULL;
+	}
+	if (segment_fd >= 0) {
+		if (ftruncate(segment_fd, used) < 0) {
+			fprintf(stderr, "CStreamLog: cannot cut segment %i: %s\n", segment, strerror(errno));
+		}
+		::close(segment_fd);
+		segment_fd = -1;
+	}
+	mapped = used = 0;
+}
+
+void CStreamLog::flushIndex() {
+	if (index_fd < 0 || index.empty()) return;
+	ssize_t length = index.size() * sizeof(StreamLogIndex);
+	if (write(index_fd, &index[0], length) != length) {
+		fprintf(stderr, "CStreamLog: cannot write the index: %s\n", strerror(errno));
+	}
+	index.clear();
+}
+
+bool CStreamLog::append(uint8_t type, uint8_t channel, const void *data, uint32_t length, uint64_t timestamp,
+		uint16_t flags) {
+	return append(type, channel, NULL, 0, data, length, timestamp, flags);
+}
+
+bool CStreamLog::appendFrame(uint8_t channel, const uint8_t *pixels, int width, int height, int bpp,
+		uint32_t frame_id, uint64_t timestamp) {
+	if (timestamp == 0) timestamp = streamLogTime();
+	ImageFrameHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = IMAGE_STREAM_MAGIC;
+	header.version = IMAGE_STREAM_VERSION;
+	header.encoding = IMAGE_ENCODING_RAW;
+	header.flags = IMAGE_FRAME_KEY;
+	header.bpp = bpp;
+	header.frame_id = frame_id;
+	header.timestamp = timestamp;
+	header.width = width;
+	header.height = height;
+	header.length = width * height * bpp;
+	header.decimation = 1;
+	uint8_t packed[IMAGE_FRAME_HEADER_LENGTH];
+	packImageFrameHeader(header, packed);
+	return append(STREAM_LOG_FRAME, channel, packed, IMAGE_FRAME_HEADER_LENGTH, pixels, header.length, timestamp, 0);
+}
+
+bool CStreamLog::append(uint8_t type, uint8_t channel, const void *head, uint32_t head_length, const void *data,
+		uint32_t length, uint64_t timestamp, uint16_t flags) {
+	if (timestamp == 0) timestamp = streamLogTime();
+	uint32_t payload = head_length + length;
+	uint32_t total = sizeof(StreamLogRecord) + STREAM_LOG_ALIGN(payload);
+	pthread_mutex_lock(&mutex);
+	if (map == NULL || (used + total > mapped && !newSegment(total))) {
+		pthread_mutex_unlock(&mutex);
+		return false;
+	}
+	StreamLogRecord *record = (StreamLogRecord*)(map + used);
+	record->magic = STREAM_LOG_MAGIC;
+	record->type = type;
+	record->channel = channel;
+	record->flags = flags;
+	record->length = payload;
+	record->sequence = sequence++;
+	record->timestamp = timestamp;
+	uint8_t *dst = map + used + sizeof(StreamLogRecord);
+	if (head_length > 0) memcpy(dst, head, head_length);
+	if (length > 0) memcpy(dst + head_length, data, length);
+
+	StreamLogIndex entry;
+	entry.timestamp = timestamp;
+	entry.segment = segment;
+	entry.offset = used;
+	entry.length = payload;
+	entry.type = type;
+	entry.channel = channel;
+	entry.flags = flags;
+	index.push_back(entry);
+	used += total;
+	if (index.size() >= STREAM_LOG_INDEX_FLUSH) flushIndex();
+	pthread_mutex_unlock(&mutex);
+	return true;
+}
+
+CStreamReplay::CStreamReplay(): position(0), started(false), start_time(0), start_timestamp(0) {
+}
+
+CStreamReplay::~CStreamReplay() {
+	close();
+}
+
+bool CStreamReplay::open(const char *path) {
+	close();
+	this->path = path;
+	uint32_t segment = 0, offset = 0;
+	FILE *file = fopen((this->path + ".idx").c_str(), "rb");
+	if (file != NULL) {
+		StreamLogIndex entry;
+		while (fread(&entry, sizeof(entry), 1, file) == 1) {
+			index.push_back(entry);
+		}
+		fclose(file);
+	}
+	if (!index.empty()) {
+		const StreamLogIndex &last = index.back();
+		segment = last.segment;
+		offset = last.offset + sizeof(StreamLogRecord) + STREAM_LOG_ALIGN(last.length);
+	}
+	scan(segment, offset);
+	if (index.empty()) {
+		fprintf(stderr, "CStreamReplay: no records in %s\n", path);
+		return false;
+	}
+	printf("CStreamReplay: %i records in %i segments of %s\n", (int)index.size(), (int)index.back().segment + 1, path);
+	return true;
+}
+
+void CStreamReplay::close() {
+	for (int i = 0; i < (int)maps.size(); i++) {
+		if (maps[i] != NULL) munmap((void*)maps[i], sizes[i]);
+	}
+	maps.clear();
+	sizes.clear();
+	index.clear();
+	rewind();
+}
+
+const uint8_t* CStreamReplay::mapSegment(uint32_t segment, uint32_t &size) {
+	while (maps.size() <= segment) {
+		maps.push_back(NULL);
+		sizes.push_back(0);
+		int number = maps.size() - 1;
+		int fd = ::open(segmentName(path, number).c_str(), O_RDONLY);
+		if (fd < 0) continue;
+		struct stat info;
+		if (fstat(fd, &info) == 0 && info.st_size > 0) {
+			void *address = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+			if (address != MAP_FAILED) {
+				maps[number] = (const uint8_t*)address;
+				sizes[number] = info.st_size;
+			}
+		}
+		::close(fd);
+	}
+	size = sizes[segment];
+	return maps[segment];
+}
+
+/**
+ * A segment that was not closed has its full size, the rest of it is zeros, so the walk stops at the first record
+ * without the magic.
+ */
+void CStreamReplay::scan(uint32_t segment, uint32_t offset) {
+	for (;; segment++, offset = 0) {
+		uint32_t size;
+		const uint8_t *map = mapSegment(segment, size);
+		if (map == NULL) break;
+		while (offset + sizeof(StreamLogRecord) <= size) {
+			const StreamLogRecord *record = (const StreamLogRecord*)(map + offset);
+			uint32_t total = sizeof(StreamLogRecord) + STREAM_LOG_ALIGN(record->length);
+			if (record->magic != STREAM_LOG_MAGIC || offset + total > size) break;
+			StreamLogIndex entry;
+			entry.timestamp = record->timestamp;
+			entry.segment = segment;
+			entry.offset = offset;
+			entry.length = record->length;
+			entry.type = record->type;
+			entry.channel = record->channel;
+			entry.flags = record->flags;
+			index.push_back(entry);
+			offset += total;
+		}
+	}
+}
+
+bool CStreamReplay::next(StreamLogEntry &entry, float speed, int type) {
+	while (position < (int)index.size()) {
+		const StreamLogIndex &record = index[position++];
+		if (type >= 0 && record.type != type) continue;
+		uint32_t size;
+		const uint8_t *map = mapSegment(record.segment, size);
+		if (map == NULL || record.offset + sizeof(StreamLogRecord) + record.length > size) continue;
+		if (!started) {
+			started = true;
+			start_time = streamLogTime();
+			start_timestamp = record.timestamp;
+		} else if (speed > 0 && record.timestamp > start_timestamp) {
+			uint64_t due = start_time + (uint64_t)((record.timestamp - start_timestamp) / speed);
+			uint64_t now = streamLogTime();
+			if (due > now) usleep(due - now);
+		}
+		entry.type = record.type;
+		entry.channel = record.channel;
+		entry.flags = record.flags;
+		entry.length = record.length;
+		entry.timestamp = record.timestamp;
+		entry.data = map + record.offset + sizeof(StreamLogRecord);
+		return true;
+	}
+	return false;
+}
+
+bool CStreamReplay::nextFrame(ImageFrameHeader &header, const uint8_t *&pixels, float speed) {
+	StreamLogEntry entry;
+	while (next(entry, speed, STREAM_LOG_FRAME)) {
+		if (entry.length < IMAGE_FRAME_HEADER_LENGTH) continue;
+		if (!unpackImageFrameHeader(entry.data, header)) continue;
+		if (header.encoding != IMAGE_ENCODING_RAW || IMAGE_FRAME_HEADER_LENGTH + header.length > entry.length) continue;
+		pixels = entry.data + IMAGE_FRAME_HEADER_LENGTH;
+		return true;
+	}
+	return false;
+}
+
+void CStreamReplay::rewind() {
+	position = 0;
+	started = false;
+}
+
+static bool earlier(const StreamLogIndex &entry, uint64_t timestamp) {
+	return entry.timestamp < timestamp;
+}
+
+void CStreamReplay::seek(uint64_t timestamp) {
+	position = std::lower_bound(index.begin(), index.end(), timestamp, earlier) - index.begin();
+	started = false;
+}
@@ -42,3 +42,37 @@ uint8_t crc8_bytes(uint8_t crc, const uint8_t *buffer, uint8_t len)
 		crc = crc8_byte(crc, *buffer++);
 	return crc;
 }
+
+// crc8_slices[k][x] is the CRC of byte x followed by k zero bytes, the CRC is linear so 8 bytes are a xor of 8 lookups
+static uint8_t crc8_slices[8][256];
+static volatile int crc8_slices_ready = 0;
+
+static void crc8_init_slices(void)
+{
+	for (int x = 0; x < 256; x++)
+	{
+		crc8_slices[0][x] = crc8_table[x];
+		for (int k = 1; k < 8; k++)
+			crc8_slices[k][x] = crc8_table[crc8_slices[k - 1][x]];
+	}
+	// every caller computes the same tables, so a second thread that gets here as well does no harm
+	__sync_synchronize();
+	crc8_slices_ready = 1;
+}
+
+uint8_t crc8_block(uint8_t crc, const uint8_t *buffer, uint32_t len)
+{
+	if (!crc8_slices_ready)
+		crc8_init_slices();
+	while (len >= 8)
+	{
+		crc = crc8_slices[7][crc ^ buffer[0]] ^ crc8_slices[6][buffer[1]] ^ crc8_slices[5][buffer[2]] ^
+			crc8_slices[4][buffer[3]] ^ crc8_slices[3][buffer[4]] ^ crc8_slices[2][buffer[5]] ^
+			crc8_slices[1][buffer[6]] ^ crc8_slices[0][buffer[7]];
+		buffer += 8;
+		len -= 8;
+	}
+	while (len--)
+		crc = crc8_byte(crc, *buffer++);
+	return crc;
+}
@@ -8,6 +8,8 @@
 extern const uint8_t crc8_table[];
 
 uint8_t crc8_bytes(uint8_t crc, const uint8_t *buffer, uint8_t len);
+// Same as crc8_bytes for any length, 8 bytes per step
+uint8_t crc8_block(uint8_t crc, const uint8_t *buffer, uint32_t len);
 static inline uint8_t crc8_byte(uint8_t crc, uint8_t data) { return crc8_table[crc ^ data]; }
 
 #endif 
@@ -10,13 +10,16 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/time.h> //FD_SET, FD_ISSET, FD_ZERO macros
+#include <sys/uio.h>
 #include <netdb.h>
 #include <unistd.h>
 #include <sstream>
 #include <iostream>
 #include <errno.h>
 #include "ipc.h"
+#include "lzcodec.h"
 
 namespace IPC{
 
@@ -27,6 +30,22 @@ namespace IPC{
     fd=-1;}\
 }
 
+//no Nagle delay for the small messages, and a peer that is gone without closing the connection is noticed
+static void Tune(int fd)
+{
+    int flag = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &flag, sizeof(flag));
+#ifdef TCP_KEEPIDLE
+    int idle = IPCKEEPALIVEIDLE;
+    int interval = 1;
+    int count = IPCKEEPALIVECOUNT;
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+#endif
+}
+
 #define Shutdown(fd, val){\
     if(fd>=0){\
     printf("\tshutdown socket %d (line %d)\n", fd, __LINE__);\
@@ -45,30 +64,110 @@ Connection::Connection()
     connected = true;
     BQInit(&txq, txbuffer, IPCTXBUFFERSIZE);
     pthread_mutex_init(&mutex_txq, NULL);
+    pthread_cond_init(&cond_txq, NULL);
     user_data = NULL;
     transmiting_thread_running = false;
     receiving_thread_running = false;
+    transmiting_thread_started = false;
+    redialing = false;
+    dropped = 0;
+    inflatebuffer = NULL;
+    inflatesize = 0;
 }
 Connection::~Connection()
 {
     //clean up
+    pthread_mutex_lock(&mutex_txq);
     connected = false;
+    redialing = false;
+    pthread_cond_broadcast(&cond_txq);
+    pthread_mutex_unlock(&mutex_txq);
+    if(transmiting_thread_started)
+    {
+        Shutdown(sockfds, 2); //a transmiting thread blocked in writev returns with an error
+        pthread_join(transmiting_thread, NULL);
+    }
     Close(sockfds);
+    pthread_cond_destroy(&cond_txq);
+    pthread_mutex_destroy(&mutex_txq);
+    delete [] inflatebuffer;
 }
 
 bool Connection::Start()
 {
     pthread_create(&receiving_thread, 0, Receiving, this);
-    //pthread_create(&transmiting_thread, 0, Transmiting, this);
+    transmiting_thread_started = (pthread_create(&transmiting_thread, 0, Transmiting, this) == 0);
     return true;
 }
 
 void Connection::Disconnect()
 {
+    pthread_mutex_lock(&mutex_txq);
     connected = false;
+    redialing = false;
+    pthread_cond_broadcast(&cond_txq);
+    pthread_mutex_unlock(&mutex_txq);
     Shutdown(sockfds, 2); //this will stops each connections, so their transmit and receiver thread will quit
 }
 
+bool Connection::Lost()
+{
+    connected = false;
+    redialing = ipc && ((IPC*)ipc)->Redials();
+    //the other thread may still wait in read or writev on the socket
+    if(redialing)
+        shutdown(sockfds, SHUT_RDWR);
+    pthread_cond_broadcast(&cond_txq);
+    return redialing;
+}
+
+/**
+ * The queue starts empty on the new socket, a message that was partly written to the lost one can not be finished.
+ */
+bool Connection::Redial()
+{
+    IPC *owner = (IPC*)ipc;
+    int delay = IPCREDIALMIN;
+    int waited = 0;
+    while(owner->Redials())
+    {
+        usleep(delay * 1000);
+        waited += delay;
+        int fd = owner->Dial();
+        if(fd >= 0)
+        {
+            Tune(fd);
+            parseContext.state = (EParseState)0;
+            pthread_mutex_lock(&mutex_txq);
+            int old = sockfds;
+            sockfds = fd;
+            BQClear(&txq);
+            connected = true;
+            redialing = false;
+            pthread_cond_broadcast(&cond_txq);
+            pthread_mutex_unlock(&mutex_txq);
+            Close(old);
+            printf("%s reconnected to %s:%d after %i ms\n", owner->Name(), inet_ntoa(addr.sin_addr),
+                    ntohs(addr.sin_port), waited);
+            return true;
+        }
+        delay = (delay * 2 < IPCREDIALMAX) ? delay * 2 : IPCREDIALMAX;
+    }
+    pthread_mutex_lock(&mutex_txq);
+    redialing = false;
+    pthread_cond_broadcast(&cond_txq);
+    pthread_mutex_unlock(&mutex_txq);
+    return false;
+}
+
+int Connection::Pending()
+{
+    pthread_mutex_lock(&mutex_txq);
+    int count = BQCount(&txq);
+    pthread_mutex_unlock(&mutex_txq);
+    return count;
+}
+
 
 IPC::IPC()
 {
@@ -80,6 +179,9 @@ IPC::IPC()
     callback = NULL;
     user_data = NULL;
     monitoring_thread_running = false;
+    reconnect = false;
+    dialing = false;
+    memset(&peer, 0, sizeof(peer));
 }
 
 IPC::~IPC()
@@ -107,6 +209,7 @@ bool IPC::Start(const char* h, int p, bool s)
 
     printf("Restart IPC %s to %s:%d\n", name, h, p);
     port = p;
+    dialing = true;
     server = s;
     if(h)
         host=strdup(h);
@@ -170,7 +273,12 @@ void * Connection::Receiving(void * p)
         if (received <= 0) 
         {
             printf("Connection lost %d : %d -- terminating\n",ptr->sockfds, received);
-            ptr->connected = false;
+            pthread_mutex_lock(&ptr->mutex_txq);
+            bool redial = ptr->Lost();
+            pthread_mutex_unlock(&ptr->mutex_txq);
+            //a client that reconnects continues with the new socket
+            if(redial && ptr->Redial())
+                continue;
             break;
         }
         else
@@ -180,6 +288,14 @@ void * Connection::Receiving(void * p)
             {
                 parsed += ElolmsgParse(&ptr->parseContext, rx_buffer + parsed, received - parsed);
                 ELolMessage* msg = ElolmsgParseDone(&ptr->parseContext);
+                ELolMessage inflated;
+                if(msg!=NULL && (msg->counter & IPCFLAGCOMPRESSED))
+                {
+                    if(ptr->Inflate(msg, inflated))
+                        msg = &inflated;
+                    else
+                        msg = NULL;
+                }
                 if(msg!=NULL && ptr->callback)
                 {
                     // printf("received data from %s : %d\n",inet_ntoa(ptr->addr.sin_addr),ntohs(ptr->addr.sin_port));
@@ -202,29 +318,46 @@ void * Connection::Transmiting(void *p)
 {
     Connection * ptr = (Connection*)p;
     printf(" (%d) %s create transmiting thread for  %s:%d\n", ptr->sockfds, ((IPC*)ptr->ipc)->Name(), inet_ntoa(ptr->addr.sin_addr), ntohs(ptr->addr.sin_port));
-    uint8_t txBuf[IPCBLOCKSIZE];
+    struct iovec iov[2];
 
     ptr->transmiting_thread_running = true;
 
-    while(ptr->connected)
+    pthread_mutex_lock(&ptr->mutex_txq);
+    while(ptr->connected || ptr->redialing)
     {
-        pthread_mutex_lock(&ptr->mutex_txq);
-        if(BQCount(&ptr->txq) > 0 )
+        int count = BQCount(&ptr->txq);
+        if(ptr->redialing || count == 0)
         {
-            register int byteCount = BQPopBytes(&ptr->txq, txBuf, IPCBLOCKSIZE);
-
-            int n = write(ptr->sockfds, txBuf, byteCount);
-            if(n<0)
-            {
-                ptr->connected = false;
-                printf("write error %d\n", n);
-                break;
-            }
+            pthread_cond_wait(&ptr->cond_txq, &ptr->mutex_txq);
+            continue;
         }
+
+        //everything that is queued is at most two parts of the ring, write them with a single call
+        int head = ptr->txq.end - ptr->txq.read;
+        iov[0].iov_base = ptr->txq.read;
+        iov[0].iov_len = (count < head) ? count : head;
+        iov[1].iov_base = ptr->txq.buffer;
+        iov[1].iov_len = count - iov[0].iov_len;
         pthread_mutex_unlock(&ptr->mutex_txq);
 
-        usleep(100000);
+        //SendData only appends behind these bytes, so they are written without holding the lock
+        int n = writev(ptr->sockfds, iov, (iov[1].iov_len > 0) ? 2 : 1);
+
+        pthread_mutex_lock(&ptr->mutex_txq);
+        if(n<0)
+        {
+            if(errno == EINTR)
+                continue;
+            printf("write error %d, %i is %s\n", n, errno, strerror(errno));
+            //the receiving thread dials again, the queue is written to the new socket
+            if(ptr->Lost())
+                continue;
+            break;
+        }
+        BQRemove(&ptr->txq, n);
     }
+    BQClear(&ptr->txq);
+    pthread_mutex_unlock(&ptr->mutex_txq);
 
     printf(" (%d) %s exit transmiting thread for %s:%d\n",ptr->sockfds, ((IPC*)ptr->ipc)->Name(),  inet_ntoa(ptr->addr.sin_addr), ntohs(ptr->addr.sin_port));
     ptr->transmiting_thread_running = false;
@@ -298,6 +431,7 @@ bool IPC::StartServer(int port)
         else
         {
             printf("accept connection from %s:%d\n", inet_ntoa(client.sin_addr), ntohs(client.sin_port));
+            Tune(clientsockfd);
             Connection *conn = new Connection;
             conn->sockfds = clientsockfd;
             conn->addr = client;
@@ -315,43 +449,49 @@ bool IPC::StartServer(int port)
     return true;
 }
 
+/**
+ * The jockey may still be starting, so the first attempts follow each other quickly and the wait doubles up to
+ * IPCREDIALMAX, until IPCCONNECTTIMEOUT has passed.
+ */
 bool IPC::ConnectToServer(const char * host, int port)
 {
-    struct sockaddr_in serv_addr;
     struct hostent *server;
-    int err;
-    int num=0;
     server = gethostbyname(host);
 
     printf("Trying to connect to Server [%s:%d]\n", host, port);
 
-    int clientsockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (clientsockfd < 0) 
+    if (server == NULL)
     {
-        printf("ERROR opening socket, exit monitor thread\n");
+        printf("ERROR unknown host %s\n", host);
         return false;
     }
-    bzero((char *) &serv_addr, sizeof(serv_addr));
-    serv_addr.sin_family = AF_INET;
-    bcopy((char *)server->h_addr, (char *)&serv_addr.sin_addr.s_addr, server->h_length);
-    serv_addr.sin_port = htons(port);
-    err=connect(clientsockfd,(struct sockaddr *) &serv_addr,sizeof(serv_addr));
-    while (err<0 && num++<10) {
+    bzero((char *) &peer, sizeof(peer));
+    peer.sin_family = AF_INET;
+    bcopy((char *)server->h_addr, (char *)&peer.sin_addr.s_addr, server->h_length);
+    peer.sin_port = htons(port);
+
+    int delay = IPCREDIALMIN;
+    int waited = 0;
+    int clientsockfd = Dial();
+    while (clientsockfd < 0 && waited < IPCCONNECTTIMEOUT) {
        printf("ERROR connecting, %i = %s\n", errno, strerror(errno));
-       sleep(1);
-       err=connect(clientsockfd,(struct sockaddr *) &serv_addr,sizeof(serv_addr));
+       usleep(delay * 1000);
+       waited += delay;
+       delay = (delay * 2 < IPCREDIALMAX) ? delay * 2 : IPCREDIALMAX;
+       clientsockfd = Dial();
     }
-    if (err < 0) 
+    if (clientsockfd < 0) 
     {
         printf("ERROR connecting, abort %i is %s\n", errno, strerror(errno));
         return false;
     }
     printf("Success to connect to Server [%s:%d] @ %d\n", host, port, clientsockfd);
+    Tune(clientsockfd);
 
     Connection *conn = new Connection;
     conn->ipc = this;
     conn->sockfds = clientsockfd;
-    conn->addr = serv_addr;
+    conn->addr = peer;
     conn->connected = true;
     conn->SetCallback(callback, user_data);
     connections.push_back(conn);
@@ -376,6 +516,44 @@ bool IPC::ConnectToServer(const char * host, int port)
     return true;
 }
 
+int IPC::Dial()
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *) &peer, sizeof(peer)) < 0)
+    {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+bool Connection::Inflate(const ELolMessage *msg, ELolMessage &inflated)
+{
+    if(msg->length < 4)
+        return false;
+    const uint8_t *data = msg->data;
+    uint32_t size = data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+    if(size > IPCLOLBUFFERSIZE)
+        return false;
+    if(inflatesize < (int)size)
+    {
+        delete [] inflatebuffer;
+        inflatebuffer = new uint8_t[size];
+        inflatesize = size;
+    }
+    if(lzDecompress(data + 4, msg->length - 4, inflatebuffer, size) != (int)size)
+        return false;
+    inflated = *msg;
+    inflated.counter = msg->counter & ~IPCFLAGCOMPRESSED;
+    inflated.length = size;
+    inflated.data = inflatebuffer;
+    return true;
+}
+
 bool Connection::SendData(const uint8_t type, uint8_t *data, int data_size)
 {
     //printf("Send data [%s] to %s:%d\n", message_names[type], inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
@@ -385,26 +563,30 @@ bool Connection::SendData(const uint8_t type, uint8_t *data, int data_size)
 #else
     ElolmsgInit(&msg, type, data, data_size);
 #endif
+    msg.counter = IPCFLAGINFLATES;
     int len = ElolmsgSerializedSize(&msg);
-    uint8_t buf[len];
-    ElolmsgSerialize(&msg, buf);
-
-    /*
-     pthread_mutex_lock(&mutex_txq);
-    int write = BQSize(&txq) - BQCount(&txq);
-    if (len < write)
-        write = len;
-    BQPushBytes(&txq, buf, write);       
-
-    pthread_mutex_unlock(&mutex_txq);
-    */
-    int n = write(sockfds, buf, len);
-    if(n<0) {
-       connected = false;
-       printf("write error %d, %i is %s\n", n, errno, strerror(errno));
+    //the payload goes straight from the caller into the queue, between its header and checksum
+    uint8_t header[ELOLVAROVERHEAD - 1];
+    ElolmsgSerializeHeader(&msg, header);
+    uint8_t checksum = ElolmsgChecksum(data, data_size);
+
+    //never block the caller on the socket, the transmiting thread writes the queue
+    pthread_mutex_lock(&mutex_txq);
+    bool queued = connected && len <= (int)(BQSize(&txq) - BQCount(&txq));
+    if(queued)
+    {
+        BQPushBytes(&txq, header, sizeof(header));
+        BQPushBytes(&txq, data, data_size);
+        BQPushBytes(&txq, &checksum, 1);
+        pthread_cond_signal(&cond_txq);
+    }
+    else if(connected && (dropped++ % 100) == 0)
+    {
+        printf("tx queue full (%i bytes pending), dropped %u messages to %s:%d\n", BQCount(&txq), dropped,
+                inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
     }
-    
-    return n == len;
+    pthread_mutex_unlock(&mutex_txq);
+    return queued;
 
 }
 
@@ -414,8 +596,8 @@ bool IPC::SendData(const uint8_t type, uint8_t *data, int data_size)
     for(unsigned int i=0; i< connections.size(); i++)
     {
         if(connections[i] && connections[i]->connected) {
-            connections[i]->SendData(type, data, data_size);
-            success = true;
+            if(connections[i]->SendData(type, data, data_size))
+                success = true;
         }
     }
     return success;
@@ -474,6 +656,7 @@ int IPC::BrokenConnections()
 void IPC::Stop()
 {
     monitoring_thread_running = false;
+    dialing = false;
     if(sockfd >=0)
     {
         Shutdown(sockfd, 2); //this will stops all connections, so monitor thread will quit
@@ -23,6 +23,19 @@
 #define IPCLOLBUFFERSIZE 65535 
 #define IPCTXBUFFERSIZE 65535 
 #define IPCBLOCKSIZE 10240 
+//a client dials again after this many milliseconds, the wait doubles after every failure up to IPCREDIALMAX
+#define IPCREDIALMIN 10
+#define IPCREDIALMAX 1000
+//ConnectToServer gives up after this many milliseconds
+#define IPCCONNECTTIMEOUT 10000
+//a silent peer is probed after this many seconds, it is lost when IPCKEEPALIVECOUNT probes a second apart fail
+#define IPCKEEPALIVEIDLE 2
+#define IPCKEEPALIVECOUNT 3
+//flags in the counter byte of the header of a variable message, as in the IPC of the bridles
+//the payload is compressed, see lzcodec.h, its first 4 bytes are the size of the message, little-endian
+#define IPCFLAGCOMPRESSED 0x01
+//the sender takes compressed messages, every message of the visualiser has it, so a robot compresses its maps for it
+#define IPCFLAGINFLATES 0x02
 
 namespace IPC{
 
@@ -37,7 +50,12 @@ class Connection
         inline void SetCallback(Callback c, void * u) {callback = c; user_data = u;}
         bool connected;
 
+        //queue the message for the transmiting thread, false if it does not fit in the queue
         bool SendData(const uint8_t type, uint8_t *data, int len);
+        //bytes queued but not yet written to the socket
+        int Pending();
+        //messages that did not fit in the queue since the connection was created
+        inline unsigned int Dropped() {return dropped;}
         bool Start();
         void Disconnect();
         
@@ -53,12 +71,26 @@ class Connection
         pthread_t transmiting_thread;
         static void * Receiving(void *ptr);
         static void * Transmiting(void *ptr);
+        //the socket is lost, called with mutex_txq locked, true if the connection is dialed again
+        bool Lost();
+        //dial until the connection is back, false if its IPC stopped reconnecting, called by the receiving thread
+        bool Redial();
+        //decompress a message that arrived compressed, false if it is corrupt
+        bool Inflate(const ELolMessage *msg, ELolMessage &inflated);
         ELolParseContext parseContext;
+        //kept for the next compressed message
+        uint8_t *inflatebuffer;
+        int inflatesize;
         Callback callback;
         void * user_data;
         ByteQueue txq;
         uint8_t txbuffer[IPCTXBUFFERSIZE];
         pthread_mutex_t mutex_txq;
+        pthread_cond_t cond_txq;
+        bool transmiting_thread_started;
+        //lost but dialed again, the transmiting thread waits for the new socket instead of quitting
+        bool redialing;
+        unsigned int dropped;
 
 };
 
@@ -76,6 +108,8 @@ class IPC
         bool SendData(const uint32_t dest, const uint8_t type, uint8_t * data, int len);
         int BrokenConnections();
         inline void SetCallback(Callback c, void * u) {callback = c; user_data = u;}
+        //a client dials again when its connection is lost, with the threads of the connection it had
+        inline void SetReconnect(bool r) {reconnect = r;}
         inline bool Server(){return server;}
         std::vector<Connection*> *Connections(){ return &connections;}
 
@@ -83,12 +117,16 @@ class IPC
         const char * Name(){return name;};
 
     private:
+        friend class Connection;
         char * name;
 
         static void * Monitoring(void *ptr);
         static void * Listening(void *ptr);
         bool StartServer(int port);
         bool ConnectToServer(const char * host, int port);
+        //a single attempt to connect to peer, returns the socket or -1
+        int Dial();
+        inline bool Redials() {return !server && reconnect && dialing;}
         int RemoveBrokenConnections();
 
         int sockfd;
@@ -99,6 +137,10 @@ class IPC
         pthread_t listening_thread;
         std::vector<Connection*> connections;
         bool monitoring_thread_running;
+        //set by SetReconnect, dialing is cleared by Stop
+        bool reconnect;
+        bool dialing;
+        sockaddr_in peer;
         
         Callback callback;
         void * user_data;
@@ -0,0 +1 @@
+../../../../bridles/eth/messageDataType.h
\ No newline at end of file
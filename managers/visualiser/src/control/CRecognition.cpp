@@ -7,8 +7,9 @@ CRecognition::CRecognition()
 {
 	colorArray = (unsigned char*)calloc(sizeof(unsigned char),COLOR_PRECISION*COLOR_PRECISION*COLOR_PRECISION);
 	segmentArray = (SSegment*)calloc(sizeof(SSegment),MAX_SEGMENTS);
-	stack = (int*)malloc(1024*768*sizeof(int));
-	buffer = (int*)malloc(1024*768*sizeof(int));
+	stack = (int*)malloc(RECOGNITION_MAX_PIXELS*sizeof(int));
+	buffer = (int*)malloc(RECOGNITION_MAX_PIXELS*sizeof(int));
+	classes = (unsigned char*)malloc(RECOGNITION_MAX_PIXELS);
 	if (buffer == NULL)fprintf(stderr,"Not enough memory for buffer\n");
 	int i = 0;
 	memset(learned,0,sizeof(unsigned char)*3);
@@ -17,12 +18,16 @@ CRecognition::CRecognition()
 	learned[1] = 10;
 	learned[2] = 60;
 	tolerance = 30; 
+	model = MODEL_NONE;
+	numAdded = 0;
 	debug = false; 
+	memset(&segment,0,sizeof(segment));
 	fprintf(stderr,"Recognition successfully initialized.\n");
 }
 
 CRecognition::~CRecognition()
 {
+	free(classes);
 	free(stack);
 	free(buffer);
 	free(segmentArray);
@@ -35,6 +40,7 @@ void CRecognition::increaseTolerance()
 	tolerance+=5;
 	if (tolerance > 400) tolerance = 400;
 	fprintf(stdout,"Tolerance: %i\n",tolerance);
+	buildColorMap();
 }
 
 //snizi prah t, toleranci podobnosti vzorovemu pixelu
@@ -43,12 +49,64 @@ void CRecognition::decreaseTolerance()
 	tolerance-=5;
 	if (tolerance < 0) tolerance = 0;
 	fprintf(stdout,"Tolerance: %i\n",tolerance);
+	buildColorMap();
 }
 
 //smaze indexovaci tabulku
 void CRecognition::resetColorMap()
 {
 	memset(colorArray,0,COLOR_PRECISION*COLOR_PRECISION*COLOR_PRECISION);
+	model = MODEL_NONE;
+	numAdded = 0;
+}
+
+/*
+ * The table is only correct for the tolerance it was built with, so it is built again when the tolerance changes. For
+ * the RGB model every added pixel in turn becomes the learned one, as it was when it was added.
+ */
+void CRecognition::buildColorMap()
+{
+	if (model == MODEL_NONE) return;
+	unsigned char last[3];
+	memcpy(last,learned,3);
+	memset(colorArray,0,COLOR_PRECISION*COLOR_PRECISION*COLOR_PRECISION);
+	int passes = (model == MODEL_RGB) ? numAdded : 1;
+	unsigned char u[3];
+	for (int p = 0;p<passes;p++){
+		if (model == MODEL_RGB) memcpy(learned,addedPixels[p],3);
+		int i = 0;
+		for (int r=0;r<COLOR_PRECISION;r++){
+			u[0] = r*COLOR_STEP+COLOR_STEP/2;
+			for (int g=0;g<COLOR_PRECISION;g++){
+				u[1] = g*COLOR_STEP+COLOR_STEP/2;
+				for (int b=0;b<COLOR_PRECISION;b++,i++){
+					u[2] = b*COLOR_STEP+COLOR_STEP/2;
+					if (model == MODEL_HSV){
+						colorArray[i] = evaluatePixel3(u);
+					}else if (evaluatePixel2(u) > 0){
+						colorArray[i] = 1;
+					}
+				}
+			}
+		}
+	}
+	memcpy(learned,last,3);
+}
+
+void CRecognition::classifyRow(const unsigned char *rgb, int count, unsigned char *classes)
+{
+	const unsigned char *table = colorArray;
+	int i = 0;
+	// four pixels per iteration, the lookups do not depend on each other
+	for (;i+4<=count;i+=4,rgb+=12){
+		classes[i]   = table[COLOR_INDEX(rgb[0],rgb[1],rgb[2])];
+		classes[i+1] = table[COLOR_INDEX(rgb[3],rgb[4],rgb[5])];
+		classes[i+2] = table[COLOR_INDEX(rgb[6],rgb[7],rgb[8])];
+		classes[i+3] = table[COLOR_INDEX(rgb[9],rgb[10],rgb[11])];
+	}
+	for (;i<count;i++,rgb+=3){
+		classes[i] = table[COLOR_INDEX(rgb[0],rgb[1],rgb[2])];
+	}
 }
 
 void CRecognition::addPixel(unsigned char* a)
@@ -59,14 +117,22 @@ void CRecognition::addPixel(unsigned char* a)
 	rgbToHsv(learned[0],learned[1],learned[2],&learnedHue,&learnedSaturation,&learnedValue);
 
 	//z daneho vzoru vytvori indexovaci tabulku
+	if (model != MODEL_RGB) resetColorMap();
+	model = MODEL_RGB;
+	if (numAdded < MAX_ADDED_PIXELS){
+		memcpy(addedPixels[numAdded++],learned,3);
+	}else{
+		memcpy(addedPixels[MAX_ADDED_PIXELS-1],learned,3);
+	}
+	//the bins of the pixels added before are still set, only those of the new one have to be added
 	unsigned char u[3];
-	for (int r=0;r<256;r+=4){
-		u[0] = r;
-		for (int g=0;g<256;g+=4){
-			u[1] = g;
-			for (int b=0;b<256;b+=4){
-				u[2] = b;
-				int i = ((r/COLOR_STEP)*COLOR_PRECISION+g/COLOR_STEP)*COLOR_PRECISION+b/COLOR_STEP;
+	for (int r=0;r<COLOR_PRECISION;r++){
+		u[0] = r*COLOR_STEP+COLOR_STEP/2;
+		for (int g=0;g<COLOR_PRECISION;g++){
+			u[1] = g*COLOR_STEP+COLOR_STEP/2;
+			for (int b=0;b<COLOR_PRECISION;b++){
+				u[2] = b*COLOR_STEP+COLOR_STEP/2;
+				int i = (r*COLOR_PRECISION+g)*COLOR_PRECISION+b;
 				if (evaluatePixel2(u) > 0) colorArray[i] = 1;
 			}
 		}
@@ -83,25 +149,15 @@ void CRecognition::learnPixel(unsigned char* a)
 	rgbToHsv(learned[0],learned[1],learned[2],&learnedHue,&learnedSaturation,&learnedValue);
 
 	//z daneho vzoru vytvori indexovaci tabulku
-	unsigned char u[3];
-	for (int r=0;r<256;r+=COLOR_STEP){
-		u[0] = r;
-		for (int g=0;g<256;g+=COLOR_STEP){
-			u[1] = g;
-			for (int b=0;b<256;b+=COLOR_STEP){
-				u[2] = b;
-				int i = ((r/COLOR_STEP)*COLOR_PRECISION+g/COLOR_STEP)*COLOR_PRECISION+b/COLOR_STEP;
-				colorArray[i] = evaluatePixel3(u);
-			}
-		}
-	}
+	model = MODEL_HSV;
+	buildColorMap();
 	fprintf(stdout,"Learned RGB: %i %i %i, HSV: %i %i %i\n",learned[0],learned[1],learned[2],learnedHue,learnedSaturation,learnedValue);
 }
 
 //vrati podobnost pixelu metodou indexovaci tabulky - metoda z dilu IV
 int CRecognition::evaluatePixelFast(unsigned char *a)
 {
-	int b = ((a[0]/COLOR_STEP)*COLOR_PRECISION+a[1]/COLOR_STEP)*COLOR_PRECISION+a[2]/COLOR_STEP;
+	int b = COLOR_INDEX(a[0],a[1],a[2]);
 	return colorArray[b];
 }
 
@@ -218,7 +274,7 @@ SPixelPosition CRecognition::findPath(CRawImage* image)
 SPixelPosition CRecognition::findSegment(CRawImage* image)
 {
 	CTimer timer;
-	fprintf(stdout,"T0:%i\n",timer.getTime());timer.reset();timer.start();
+	if (debug) {fprintf(stdout,"T0:%i\n",timer.getTime());timer.reset();timer.start();}
 	SPixelPosition result;
 	result.x = 320;
 	result.y = 240;
@@ -229,13 +285,14 @@ SPixelPosition CRecognition::findSegment(CRawImage* image)
 	int numSegments = 0;
 	int len = image->width*image->height;
 
-	fprintf(stdout,"T1:%i\n",timer.getTime());timer.reset();timer.start();
+	if (debug) {fprintf(stdout,"T1:%i\n",timer.getTime());timer.reset();timer.start();}
 	//oznacime oblasti s hledanou barvou
+	classifyRow(image->data,len,classes);
 	for (int i = 0;i<len;i++){
-		 buffer[i] = -evaluatePixelFast(&image->data[3*i]);
+		 buffer[i] = -classes[i];
 	}
 
-	fprintf(stdout,"T2:%i\n",timer.getTime());timer.reset();timer.start();
+	if (debug) {fprintf(stdout,"T2:%i\n",timer.getTime());timer.reset();timer.start();}
 	//'ukrojime' okraje obrazu
 	int pos =  (image->height-1)*image->width;
 	for (int i = 0;i<image->width;i++){
@@ -246,7 +303,7 @@ SPixelPosition CRecognition::findSegment(CRawImage* image)
 		buffer[image->width*i] = 0;	
 		buffer[image->width*i+image->width-1] = 0;
 	}
-	fprintf(stdout,"T3:%i\n",timer.getTime());timer.reset();timer.start();
+	if (debug) {fprintf(stdout,"T3:%i\n",timer.getTime());timer.reset();timer.start();}
 	//zacneme prohledavani
 	int position = 0; 
 	for (int i = 0;i<len;i++){
@@ -286,7 +343,7 @@ SPixelPosition CRecognition::findSegment(CRawImage* image)
 		}
 	}
 
-	fprintf(stdout,"T4:%i\n",timer.getTime());timer.reset();timer.start();
+	if (debug) {fprintf(stdout,"T4:%i\n",timer.getTime());timer.reset();timer.start();}
 	//Najde nejvetsi segment
 	int maxSize = 0;
 	int index = 0;
@@ -300,9 +357,11 @@ SPixelPosition CRecognition::findSegment(CRawImage* image)
 	if (debug) fprintf(stdout,"Largest segment is %i %i %i %i\n",index,segmentArray[index].size,segmentArray[index].x,segmentArray[index].y);
 
 	//a spocte jeho stred
+	memset(&segment,0,sizeof(segment));
 	if (maxSize > 20){
 		result.x = segmentArray[index].x;
 		result.y = segmentArray[index].y;
+		segment = segmentArray[index];
 	} 
 
 	//vykreslime vysledek
@@ -315,7 +374,7 @@ SPixelPosition CRecognition::findSegment(CRawImage* image)
 			image->data[i*3+(j+2)%3] = 255;
 		}
 	}
-	fprintf(stdout,"T5:%i\n",timer.getTime());timer.reset();timer.start();
+	if (debug) {fprintf(stdout,"T5:%i\n",timer.getTime());timer.reset();timer.start();}
 	return result;
 }
 
@@ -324,26 +383,28 @@ SPixelPosition CRecognition::findMean(CRawImage* image)
 {
 	//priprava promennych pro vypocet
 	SPixelPosition result;
-	float sumX,sumY,eval,sumEval;
-	sumX=sumY=eval=sumEval=0;
-	int step = 1;
+	float sumX,sumY;
+	long long rowX,rowY,sumEval;
+	rowX=rowY=sumEval=0;
 	int yconst = image->width;
 
-	//vlastni vypocet
-	for (int y = 0;y<image->height;y+=step){
+	//vlastni vypocet, a row at a time
+	for (int y = 0;y<image->height;y++){
 		yconst = image->width*y;
-		for (int x = 0;x<image->width;x+=step){
-			//vyhodnoceni podobnosti pixelu
-			eval=evaluatePixelFast(&image->data[3*(x+yconst)]);
+		classifyRow(&image->data[3*yconst],image->width,classes);
+		int count = 0;
+		for (int x = 0;x<image->width;x++){
+			if (classes[x] == 0) continue;
 			//vybarveni vysledku v obraze
-			if (eval == 1){
-				for (int i = 0;i<3;i++) image->data[3*(x+yconst)+i]=255-learned[i];
-			}
-			sumEval +=eval;
-			sumX = sumX + x*eval;
-			sumY = sumY + y*eval;
+			for (int i = 0;i<3;i++) image->data[3*(x+yconst)+i]=255-learned[i];
+			count++;
+			rowX += x;
 		}
+		sumEval += count;
+		rowY += (long long)y*count;
 	}
+	sumX = rowX;
+	sumY = rowY;
 	//pokud byl nalezen alespon jeden pixel, je proveden vypocer teziste 
 	if (sumEval > 0){
 		sumX = sumX/sumEval;
@@ -13,6 +13,14 @@
 #define MAX_SEGMENTS 10000
 #define COLOR_PRECISION 32
 #define COLOR_STEP 8
+//! log2 of COLOR_STEP, a pixel is looked up by shifting its channels
+#define COLOR_SHIFT 3
+//! The bin of a pixel in the table
+#define COLOR_INDEX(r,g,b) (((((r)>>COLOR_SHIFT)*COLOR_PRECISION+((g)>>COLOR_SHIFT))*COLOR_PRECISION)+((b)>>COLOR_SHIFT))
+//! Pixels that addPixel remembers, so the table can be built again with another tolerance
+#define MAX_ADDED_PIXELS 64
+//! The largest image the buffers of findSegment hold
+#define RECOGNITION_MAX_PIXELS (1024*768)
 
 typedef struct{
 	int x;
@@ -38,7 +46,11 @@ public:
   void increaseTolerance();
   void decreaseTolerance();
   void resetColorMap();
+  //! Classify count consecutive RGB pixels with the table, 1 for the learned colour, 0 for anything else
+  void classifyRow(const unsigned char *rgb, int count, unsigned char *classes);
   SPixelPosition findPath(CRawImage* image);
+  //! The largest segment of the last findSegment, with its centre, size 0 if none was big enough
+  inline const SSegment & getSegment() const { return segment; }
 
 private:
   int tolerance;  
@@ -46,13 +58,21 @@ private:
   float evaluatePixel2(unsigned char* a);
   float evaluatePixel3(unsigned char* a);
   int evaluatePixelFast(unsigned char *a);
+  //! Fill the table from the model, its bins are evaluated at their centres
+  void buildColorMap();
   void rgbToHsv(unsigned char r, unsigned char  g, unsigned char b, unsigned int *h, unsigned char *s, unsigned char *v );
 
   unsigned char learned[3];
   unsigned int learnedHue;
   unsigned char learnedSaturation,learnedValue;
   unsigned char *colorArray;
+  //! The model the table is built from: nothing, the pixels of addPixel (RGB), or the pixel of learnPixel (HSV)
+  enum {MODEL_NONE, MODEL_RGB, MODEL_HSV} model;
+  unsigned char addedPixels[MAX_ADDED_PIXELS][3];
+  int numAdded;
+  unsigned char *classes;
   SSegment *segmentArray;
+  SSegment segment;
   bool debug;
   int *stack;
   int *buffer;
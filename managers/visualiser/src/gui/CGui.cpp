@@ -1,11 +1,45 @@
 #include "CGui.h"
+#include "CMessage.h"
 
 #define THICK_CROSS
 
+//! The 3x5 pixels of the digits, a row per 3 bits, top row first
+static const unsigned short digits[10] = {
+	075557, 022222, 071747, 071717, 055711, 074717, 074757, 071111, 075757, 075717
+};
+#define DIGIT_SCALE 2
+
+//! Pixels per m of the map at the start, it zooms out when an object is outside the layer
+#define MAP_SCALE 80.0f
+//! It does not zoom out further, objects beyond are not shown
+#define MAP_MIN_SCALE 5.0f
+//! The markers of the objects and the heading of a robot reach this many pixels beyond the ellipse
+#define MAP_MARGIN 12
+//! When the changes cover more of the layer than this share, all of it is drawn again in one go
+#define MAP_FULL_SHARE 0.5f
+
+//! The objects and the pose of every robot have their own colour, the ellipses are a darker shade of it
+static const Uint8 robotColors[6][3] = {
+	{ 255, 64, 64 }, { 64, 255, 64 }, { 64, 128, 255 }, { 255, 255, 64 }, { 255, 64, 255 }, { 64, 255, 255 }
+};
+
+//! The shades of EOverlayColor
+static const Uint8 overlayColors[OVERLAY_COLOR_COUNT][3] = {
+	{ 255, 0, 0 }, { 0, 255, 0 }, { 64, 64, 255 }, { 255, 255, 0 }, { 0, 255, 255 }, { 255, 0, 255 }, { 255, 255, 255 }
+};
+
+static inline bool overlaps(const SDL_Rect & a, const SDL_Rect & b)
+{
+	return a.x < b.x + b.w && b.x < a.x + a.w && a.y < b.y + b.h && b.y < a.y + a.h;
+}
+
 CGui::CGui()
 {
   SDL_Init(SDL_INIT_VIDEO);
   screen = NULL;
+  mapLayer = NULL;
+  mapScale = MAP_SCALE;
+  mapShown = false;
   screen = SDL_SetVideoMode(1240,480,24,SDL_SWSURFACE); 
   if (screen == NULL)fprintf(stderr,"Couldn't set SDL video mode: %s\r\n",SDL_GetError());
   SDL_WM_SetCaption("Robot revue vision system","Robot revue vision system");
@@ -13,6 +47,34 @@ CGui::CGui()
 
 CGui::~CGui()
 {
+	for (std::map<CRawImage*, SImageSlot>::iterator i = slots.begin(); i != slots.end(); ++i) {
+		SDL_FreeSurface(i->second.surface);
+	}
+	if (mapLayer != NULL) SDL_FreeSurface(mapLayer);
+}
+
+SDL_Surface* CGui::surfaceOf(CRawImage *image)
+{
+	SImageSlot &slot = slots[image];
+	if (slot.surface != NULL && slot.data == image->data && slot.width == image->width && slot.height == image->height
+			&& slot.bpp == image->bpp) return slot.surface;
+	if (slot.surface != NULL) SDL_FreeSurface(slot.surface);
+	slot.surface = SDL_CreateRGBSurfaceFrom(image->data,image->width,image->height,image->bpp*8,image->bpp*image->width,0x000000ff,0x0000ff00,0x00ff0000,0x00000000);
+	slot.data = image->data;
+	slot.width = image->width;
+	slot.height = image->height;
+	slot.bpp = image->bpp;
+	return slot.surface;
+}
+
+void CGui::markDirty(int x, int y, int w, int h)
+{
+	SDL_Rect rect;
+	rect.x = x;
+	rect.y = y;
+	rect.w = w;
+	rect.h = h;
+	dirty.push_back(rect);
 }
 
 void CGui::initJockeys(int jockey_count)
@@ -39,9 +101,353 @@ void CGui::drawImage(CRawImage* image)
 	rect.y = 0;
 	rect.w = 640;
 	rect.h = 480;
-	SDL_Surface *imageSDL = SDL_CreateRGBSurfaceFrom(image->data,image->width,image->height,image->bpp*8,image->bpp*image->width,0x000000ff,0x0000ff00,0x00ff0000,0x00000000);
+	SDL_Surface *imageSDL = surfaceOf(image);
 	if (imageSDL != NULL && SDL_BlitSurface(imageSDL, NULL, screen, &rect)==0) result = 0;
-	SDL_FreeSurface(imageSDL);
+	markDirty(300, 0, 640, 480);
+	mapShown = false;
+}
+
+/**
+ * The tiles fill the 640x480 of the camera image in a grid that is as square as possible. Every receiver scales its
+ * frames to the tile size on its own thread, here they are only copied to the screen, with the overlay of the robot
+ * on top. Green is frames per second, yellow is the latency in ms, a red bar on top means the robot is not connected,
+ * a grey one that its last frame is older than a second.
+ */
+void CGui::drawMosaic(std::vector<CImageReceiver*> & receivers)
+{
+	int count = receivers.size();
+	if (count == 0) return;
+	int columns = 1;
+	while (columns * columns < count) columns++;
+	int rows = (count + columns - 1) / columns;
+	int tileWidth = 640 / columns;
+	int tileHeight = 480 / rows;
+
+	SDL_Rect rect;
+	rect.x = 300;
+	rect.y = 0;
+	rect.w = 640;
+	rect.h = 480;
+	SDL_FillRect(screen, &rect, SDL_MapRGB(screen->format, 0, 0, 0));
+	for (int i = 0; i < count; i++) {
+		CImageReceiver *receiver = receivers[i];
+		receiver->setTileSize(tileWidth, tileHeight);
+		int x = 300 + (i % columns) * tileWidth;
+		int y = (i / columns) * tileHeight;
+
+		CRawImage *tile = receiver->lockTile();
+		if (tile != NULL) {
+			SDL_Rect src;
+			src.x = 0;
+			src.y = 0;
+			src.w = tile->width < tileWidth ? tile->width : tileWidth;
+			src.h = tile->height < tileHeight ? tile->height : tileHeight;
+			rect.x = x;
+			rect.y = y;
+			// the tile can get a new buffer with the next frame, so its surface is checked while it is locked
+			SDL_Surface *imageSDL = surfaceOf(tile);
+			if (imageSDL != NULL) SDL_BlitSurface(imageSDL, &src, screen, &rect);
+			drawOverlay(receiver->getTileOverlay(), x, y, src.w, src.h);
+		}
+		receiver->unlockTile();
+
+		SReceiverStats stats = receiver->getStats();
+		if (!stats.connected || stats.age < 0 || stats.age > 1000) {
+			rect.x = x;
+			rect.y = y;
+			rect.w = tileWidth;
+			rect.h = 3;
+			Uint32 color = stats.connected ? SDL_MapRGB(screen->format, 128, 128, 128) : SDL_MapRGB(screen->format, 255, 0, 0);
+			SDL_FillRect(screen, &rect, color);
+		}
+		int ty = y + tileHeight - 6 * DIGIT_SCALE;
+		int tx = drawNumber(x + 2, ty, (int)(stats.fps + 0.5f), SDL_MapRGB(screen->format, 0, 255, 0));
+		drawNumber(tx + 3 * DIGIT_SCALE, ty, stats.latency, SDL_MapRGB(screen->format, 255, 255, 0));
+	}
+	markDirty(300, 0, 640, 480);
+	mapShown = false;
+}
+
+int CGui::drawNumber(int x, int y, int value, Uint32 color)
+{
+	char text[12];
+	snprintf(text, sizeof(text), "%i", value < 0 ? 0 : value);
+	SDL_Rect rect;
+	rect.w = DIGIT_SCALE;
+	rect.h = DIGIT_SCALE;
+	for (const char *c = text; *c != 0; c++) {
+		unsigned short glyph = digits[*c - '0'];
+		for (int row = 0; row < 5; row++) {
+			for (int column = 0; column < 3; column++) {
+				if (!(glyph & (1 << ((4 - row) * 3 + 2 - column)))) continue;
+				rect.x = x + column * DIGIT_SCALE;
+				rect.y = y + row * DIGIT_SCALE;
+				SDL_FillRect(screen, &rect, color);
+			}
+		}
+		x += 4 * DIGIT_SCALE;
+	}
+	return x;
+}
+
+/**
+ * The clip rectangle of the screen keeps the primitives within the tile, SDL_FillRect respects it.
+ */
+void CGui::drawOverlay(const ImageOverlay & overlay, int x, int y, int width, int height)
+{
+	SDL_Rect clip;
+	clip.x = x;
+	clip.y = y;
+	clip.w = width;
+	clip.h = height;
+	SDL_SetClipRect(screen, &clip);
+	for (int i = 0; i < overlay.count; i++) {
+		const ImageOverlayPrimitive & p = overlay.primitives[i];
+		const Uint8 *rgb = overlayColors[p.color < OVERLAY_COLOR_COUNT ? p.color : OVERLAY_WHITE];
+		Uint32 color = SDL_MapRGB(screen->format, rgb[0], rgb[1], rgb[2]);
+		int x0 = x + p.x0, y0 = y + p.y0;
+		switch (p.type) {
+		case OVERLAY_LINE:
+			drawLine(x0, y0, x + p.x1, y + p.y1, color);
+			break;
+		case OVERLAY_CROSS:
+			drawLine(x0 - p.x1, y0, x0 + p.x1, y0, color);
+			drawLine(x0, y0 - p.x1, x0, y0 + p.x1, color);
+			break;
+		case OVERLAY_BOX:
+			drawLine(x0, y0, x + p.x1, y0, color);
+			drawLine(x0, y + p.y1, x + p.x1, y + p.y1, color);
+			drawLine(x0, y0, x0, y + p.y1, color);
+			drawLine(x + p.x1, y0, x + p.x1, y + p.y1, color);
+			break;
+		case OVERLAY_NUMBER:
+			drawNumber(x0, y0, p.x1, color);
+			break;
+		}
+	}
+	SDL_SetClipRect(screen, NULL);
+}
+
+//! A horizontal or vertical line is a single rectangle, any other is drawn pixel by pixel along its longest axis
+void CGui::drawLine(int x0, int y0, int x1, int y1, Uint32 color)
+{
+	SDL_Rect rect;
+	if (x0 == x1 || y0 == y1) {
+		rect.x = x0 < x1 ? x0 : x1;
+		rect.y = y0 < y1 ? y0 : y1;
+		rect.w = abs(x1 - x0) + 1;
+		rect.h = abs(y1 - y0) + 1;
+		SDL_FillRect(screen, &rect, color);
+		return;
+	}
+	int steps = abs(x1 - x0) > abs(y1 - y0) ? abs(x1 - x0) : abs(y1 - y0);
+	rect.w = 1;
+	rect.h = 1;
+	for (int i = 0; i <= steps; i++) {
+		rect.x = x0 + (x1 - x0) * i / steps;
+		rect.y = y0 + (y1 - y0) * i / steps;
+		SDL_FillRect(screen, &rect, color);
+	}
+}
+
+/**
+ * Draw the laser vector in place of the camera image, every row at the column where the laser is seen, in the colour
+ * of the LEDs of the laserscan jockey for the object type (CLaserScan.h). The bar at the bottom is the robustness.
+ */
+void CGui::drawScan(const LaserScanHeader & header, const int16_t *columns)
+{
+	SDL_Rect rect;
+	rect.x = 300;
+	rect.y = 0;
+	rect.w = 640;
+	rect.h = 480;
+	SDL_FillRect(screen, &rect, SDL_MapRGB(screen->format, 0, 0, 0));
+
+	Uint32 color = SDL_MapRGB(screen->format, 255, 0, 0);
+	if (header.object == VOCAB4('w','a','l','l')) color = SDL_MapRGB(screen->format, 0, 255, 0);
+	if (header.object == VOCAB4('s','t','e','p') || header.object == VOCAB4('S','T','E','P'))
+		color = SDL_MapRGB(screen->format, 255, 165, 0);
+	for (int i = 0; i < header.rows && i < 480; i++) {
+		if (columns[i] <= 0 || columns[i] >= 640) continue;
+		rect.x = 300 + columns[i] - 1;
+		rect.y = i;
+		rect.w = 3;
+		rect.h = 1;
+		SDL_FillRect(screen, &rect, color);
+	}
+
+	rect.x = 300;
+	rect.y = 474;
+	rect.w = (Uint16)(640 * header.robustness);
+	rect.h = 6;
+	SDL_FillRect(screen, &rect, SDL_MapRGB(screen->format, 128, 128, 128));
+	markDirty(300, 0, 640, 480);
+	mapShown = false;
+	printf("Laser scan %i: distance %i cm, robustness %.2f\n", header.scan, header.distance, header.robustness);
+}
+
+SDL_Rect CGui::mapRect(const MapArea & area)
+{
+	// y goes up in the map and down on the screen, an area far outside is clamped before it is rounded
+	float x0 = 320 + area.x0 * mapScale - MAP_MARGIN, x1 = 320 + area.x1 * mapScale + MAP_MARGIN + 1;
+	float y0 = 240 - area.y1 * mapScale - MAP_MARGIN, y1 = 240 - area.y0 * mapScale + MAP_MARGIN + 1;
+	x0 = x0 < 0 ? 0 : (x0 > 640 ? 640 : x0);
+	x1 = x1 < 0 ? 0 : (x1 > 640 ? 640 : x1);
+	y0 = y0 < 0 ? 0 : (y0 > 480 ? 480 : y0);
+	y1 = y1 < 0 ? 0 : (y1 > 480 ? 480 : y1);
+	SDL_Rect rect;
+	rect.x = (Sint16) x0;
+	rect.y = (Sint16) y0;
+	rect.w = (Uint16) ((int) x1 - (int) x0);
+	rect.h = (Uint16) ((int) y1 - (int) y0);
+	return rect;
+}
+
+void CGui::fillLayer(int x, int y, int w, int h, Uint32 color)
+{
+	SDL_Rect rect;
+	rect.x = x;
+	rect.y = y;
+	rect.w = w;
+	rect.h = h;
+	SDL_FillRect(mapLayer, &rect, color);
+}
+
+void CGui::drawEllipse(float x, float y, const MapEllipse & ellipse, Uint32 color)
+{
+	float a0 = ellipse.axis[0] * mapScale, a1 = ellipse.axis[1] * mapScale;
+	if (a0 < 1 && a1 < 1) return;
+	// about a point per pixel of the circumference
+	int steps = (int) (2 * M_PI * (a0 > a1 ? a0 : a1)) + 8;
+	if (steps > 720) steps = 720;
+	float c = cos(ellipse.angle), s = sin(ellipse.angle);
+	for (int i = 0; i < steps; i++) {
+		float t = 2 * M_PI * i / steps;
+		float u = a0 * cos(t), v = a1 * sin(t);
+		fillLayer((int) floor(x + c * u - s * v + 0.5f), (int) floor(y - s * u - c * v + 0.5f), 1, 1, color);
+	}
+}
+
+/**
+ * The layer is clipped to rect, so everything that overlaps it can be drawn whole. The objects are found by their area,
+ * which is the same one the map records when they change, so an object that is drawn again is drawn within the rect.
+ */
+void CGui::drawMapRect(Map & map, SDL_Rect & rect)
+{
+	SDL_SetClipRect(mapLayer, &rect);
+	fillLayer(rect.x, rect.y, rect.w, rect.h, SDL_MapRGB(mapLayer->format, 0, 0, 0));
+	Uint32 grey = SDL_MapRGB(mapLayer->format, 96, 96, 96);
+	fillLayer(320 - MAP_MARGIN / 2, 240, MAP_MARGIN + 1, 1, grey);
+	fillLayer(320, 240 - MAP_MARGIN / 2, 1, MAP_MARGIN + 1, grey);
+
+	const std::map<Map::Key, MapObject> & objects = map.getObjects();
+	for (std::map<Map::Key, MapObject>::const_iterator i = objects.begin(); i != objects.end(); ++i) {
+		const MappedObjectPosition & position = i->second.position;
+		MapArea area = Map::areaOf(position.xPosition, position.yPosition, i->second.ellipse);
+		if (!overlaps(mapRect(area), rect)) continue;
+		const Uint8 *rgb = robotColors[(i->first.first % 6 + 6) % 6];
+		float x = 320 + position.xPosition * mapScale, y = 240 - position.yPosition * mapScale;
+		drawEllipse(x, y, i->second.ellipse, SDL_MapRGB(mapLayer->format, rgb[0] / 2, rgb[1] / 2, rgb[2] / 2));
+		Uint32 color = SDL_MapRGB(mapLayer->format, rgb[0], rgb[1], rgb[2]);
+		int px = (int) floor(x + 0.5f), py = (int) floor(y + 0.5f);
+		if (position.type == DOCK_CIRCLE || position.type == DOCK_CIRCLE_ORGANISM) {
+			// a dock is an open square
+			fillLayer(px - 3, py - 3, 7, 1, color);
+			fillLayer(px - 3, py + 3, 7, 1, color);
+			fillLayer(px - 3, py - 3, 1, 7, color);
+			fillLayer(px + 3, py - 3, 1, 7, color);
+		} else if (position.type == NORMAL_CIRCLE) {
+			fillLayer(px - 2, py - 2, 5, 5, color);
+		} else {
+			fillLayer(px - 1, py - 1, 3, 3, color);
+		}
+	}
+
+	const std::map<int, MapRobot> & robots = map.getRobots();
+	for (std::map<int, MapRobot>::const_iterator i = robots.begin(); i != robots.end(); ++i) {
+		const MapRobot & robot = i->second;
+		if (!robot.posed || !overlaps(mapRect(Map::areaOf(robot.x, robot.y, robot.ellipse)), rect)) continue;
+		const Uint8 *rgb = robotColors[(i->first % 6 + 6) % 6];
+		float x = 320 + robot.x * mapScale, y = 240 - robot.y * mapScale;
+		drawEllipse(x, y, robot.ellipse, SDL_MapRGB(mapLayer->format, rgb[0] / 2, rgb[1] / 2, rgb[2] / 2));
+		Uint32 white = SDL_MapRGB(mapLayer->format, 255, 255, 255);
+		int px = (int) floor(x + 0.5f), py = (int) floor(y + 0.5f);
+		fillLayer(px - 3, py - 3, 7, 7, SDL_MapRGB(mapLayer->format, rgb[0], rgb[1], rgb[2]));
+		for (int k = 4; k < MAP_MARGIN; k++) {
+			int hx = (int) floor(x + cos(robot.phi) * k + 0.5f), hy = (int) floor(y - sin(robot.phi) * k + 0.5f);
+			fillLayer(hx, hy, 1, 1, white);
+		}
+	}
+	SDL_SetClipRect(mapLayer, NULL);
+}
+
+/**
+ * The layer keeps the map as it was drawn. The map records the areas its snapshots changed, before and after, and only
+ * these are cleared and drawn again, then copied to the screen, so a map that grows or a robot that moves costs as
+ * much as what moved, not the whole map. The layer is drawn again as a whole only when it zooms out, which happens when
+ * an object falls outside it, or when most of it changed anyway.
+ */
+void CGui::drawMap(Map & map)
+{
+	bool full = false;
+	if (mapLayer == NULL) {
+		SDL_PixelFormat *format = screen->format;
+		mapLayer = SDL_CreateRGBSurface(SDL_SWSURFACE, 640, 480, format->BitsPerPixel, format->Rmask, format->Gmask,
+				format->Bmask, format->Amask);
+		if (mapLayer == NULL) return;
+		full = true;
+	}
+	mapChanges.clear();
+	map.takeChanges(mapChanges);
+	float scale = mapScale;
+	for (unsigned int i = 0; i < mapChanges.size(); i++) {
+		const MapArea & area = mapChanges[i];
+		float extent = fabs(area.x0) > fabs(area.x1) ? fabs(area.x0) : fabs(area.x1);
+		float height = fabs(area.y0) > fabs(area.y1) ? fabs(area.y0) : fabs(area.y1);
+		if (height * 320 / 240 > extent) extent = height * 320 / 240;
+		while (scale > MAP_MIN_SCALE && extent * scale > 320 - MAP_MARGIN) scale *= 0.5f;
+	}
+	if (scale != mapScale) {
+		mapScale = scale;
+		full = true;
+	}
+	std::vector<SDL_Rect> rects;
+	int pixels = 0;
+	for (unsigned int i = 0; i < mapChanges.size() && !full; i++) {
+		SDL_Rect rect = mapRect(mapChanges[i]);
+		if (rect.w == 0 || rect.h == 0) continue;
+		rects.push_back(rect);
+		pixels += rect.w * rect.h;
+	}
+	if (full || pixels > MAP_FULL_SHARE * 640 * 480) {
+		rects.clear();
+		SDL_Rect rect;
+		rect.x = 0;
+		rect.y = 0;
+		rect.w = 640;
+		rect.h = 480;
+		rects.push_back(rect);
+	}
+	for (unsigned int i = 0; i < rects.size(); i++) drawMapRect(map, rects[i]);
+
+	// after the camera or the laser the whole layer is copied, it is still up to date
+	if (!mapShown) {
+		rects.clear();
+		SDL_Rect rect;
+		rect.x = 0;
+		rect.y = 0;
+		rect.w = 640;
+		rect.h = 480;
+		rects.push_back(rect);
+		mapShown = true;
+	}
+	for (unsigned int i = 0; i < rects.size(); i++) {
+		SDL_Rect src = rects[i];
+		SDL_Rect dst = rects[i];
+		dst.x += 300;
+		SDL_BlitSurface(mapLayer, &src, screen, &dst);
+		markDirty(rects[i].x + 300, rects[i].y, rects[i].w, rects[i].h);
+	}
 }
 
 void CGui::drawStatus(bool *status)
@@ -61,13 +467,16 @@ void CGui::drawStatus(bool *status)
 		rect.x = (i/10)*940;
 		rect.y = (i%10)*48;
 		CRawImage* image=jockeyArray[i];
-		SDL_Surface *imageSDL = SDL_CreateRGBSurfaceFrom(image->data,image->width,image->height,image->bpp*8,image->bpp*image->width,0x000000ff,0x0000ff00,0x00ff0000,0x00000000);
+		SDL_Surface *imageSDL = surfaceOf(image);
 		if (imageSDL != NULL && SDL_BlitSurface(imageSDL, NULL, screen, &rect)==0) result = 0;
-		SDL_FreeSurface(imageSDL);
 	}
+	markDirty(0, 0, 300, 480);
+	markDirty(940, 0, 300, 480);
 }
 
 void CGui::update()
 {
-  SDL_UpdateRect(screen,0,0,0,0);
+  if (dirty.empty()) return;
+  SDL_UpdateRects(screen,dirty.size(),&dirty[0]);
+  dirty.clear();
 }
@@ -2,8 +2,13 @@
 #define __CGUI_H__
 
 #include "CRawImage.h"
+#include "CImageReceiver.h"
+#include "messageDataType.h"
+#include "Map.h"
 #include <math.h>
 #include <SDL/SDL.h>
+#include <vector>
+#include <map>
 
 class CGui
 {
@@ -12,11 +17,49 @@ public:
   ~CGui();
 
   void drawImage(CRawImage* image);
+  //! Tile the images of all robots in place of the camera image, with frame rate and latency in the corner of every tile
+  void drawMosaic(std::vector<CImageReceiver*> & receivers);
+  void drawScan(const LaserScanHeader & header, const int16_t *columns);
+  //! Draw the maps of the robots in place of the camera image, only what changed since the last call is drawn again
+  void drawMap(Map & map);
   void drawStatus(bool *status);
   void initJockeys(int jockey_count);
   void update();
   
 private:
+  /**
+   * SDL 1.2 has no textures, so this is the closest to a streaming texture: a surface that shares the pixels of the
+   * image and is only created again when the image gets another buffer or size.
+   */
+  struct SImageSlot
+  {
+    SDL_Surface *surface;
+    unsigned char *data;
+    int width, height, bpp;
+  };
+  SDL_Surface* surfaceOf(CRawImage *image);
+  //! Only the parts of the screen that were drawn on are updated
+  void markDirty(int x, int y, int w, int h);
+  std::map<CRawImage*, SImageSlot> slots;
+  std::vector<SDL_Rect> dirty;
+  //! Small digits without a font library, returns the x after the last digit
+  int drawNumber(int x, int y, int value, Uint32 color);
+  //! The overlay of a frame over its tile at x, y, see imageStream.h, nothing is drawn outside the tile
+  void drawOverlay(const ImageOverlay & overlay, int x, int y, int width, int height);
+  void drawLine(int x0, int y0, int x1, int y1, Uint32 color);
+
+  //! The map as it was last drawn, the area of the camera image is copied from it
+  SDL_Surface *mapLayer;
+  //! Pixels per m of the map, the centre of the layer is 0, 0
+  float mapScale;
+  //! The screen shows the layer, nothing was drawn over it since
+  bool mapShown;
+  std::vector<MapArea> mapChanges;
+  SDL_Rect mapRect(const MapArea & area);
+  //! Draw everything of the map that is within rect of the layer
+  void drawMapRect(Map & map, SDL_Rect & rect);
+  void drawEllipse(float x, float y, const MapEllipse & ellipse, Uint32 color);
+  void fillLayer(int x, int y, int w, int h, Uint32 color);
   SDL_Surface *screen;
   CRawImage *jockeyArray[20];
   CRawImage  activeArray[20];
@@ -1,6 +1,10 @@
 #include <stdlib.h>
-#include "CImageClient.h"
+#include "CImageReceiver.h"
+#include "CStreamLog.h"
+#include "CCalibReport.h"
 #include "CGui.h"
+#include "Map.h"
+#include "CBatchRun.h"
 #include "CTimer.h"
 #include <signal.h>
 #include <vector>
@@ -8,29 +12,36 @@
 #include <iostream>
 #include <fstream>
 #include <CMessageClient.h>
+#include "messageDataType.h"
 
 
 int i = 0;
 int numSaved = 0;
 bool stop = false;
-CGui gui;
+//! Without a window (headless) the streams are only recorded and the map is only kept, gui is NULL then
+bool headless = false;
+CGui *gui = NULL;
 SDL_Event event;
 CMessage message;
 const int MAX_MESSAGE_SIZE=32;
-CRawImage *image;
+//! One per robot, the first robot is also the one that is controlled
+std::vector<CImageReceiver*> receivers;
+//! The GUI is redrawn every GUI_PERIOD us, the keys and the zigbee are handled every SLOW_PERIOD us
+#define GUI_PERIOD 40000
+#define SLOW_PERIOD 500000
+//! Messages of the zigbee handled per SLOW_PERIOD, with many robots one per period falls behind
+#define ZIGBEE_MESSAGES 16
 Uint8 lastKeys[1000];
 Uint8* keys;
 int keyNumber = 1000;
 
 ZigBee *zigbee = NULL;
 
-struct MotorCommand {
-	int16_t forward;
-	int16_t radius;
-} __attribute__((packed));
-
 MotorCommand motorCommand;
 
+//! The maps of all robots, of the controlled one over the command connection and of the others over the zigbee
+Map map;
+
 void processKeys(CMessageClient *cmd_client)
 {
 	SDL_PumpEvents();
@@ -102,12 +113,19 @@ void processKeys(CMessageClient *cmd_client)
 	if (keys[SDLK_n])  recognition->decreaseTolerance();
 	if (keys[SDLK_l]) recognition->loadColorMap();
 	if (keys[SDLK_s]) recognition->saveColorMap();*/
-	if (keys[SDLK_RETURN])image->saveBmp();
+	if (keys[SDLK_RETURN]) {
+		for (unsigned int i = 0; i < receivers.size(); i++) receivers[i]->saveBmp();
+	}
 	memcpy(lastKeys,keys,keyNumber);
 }
 
 void interrupt_signal_handler(int signal) {
 	if (signal == SIGINT) {
+		// without a window there are no keys, the first interrupt ends the loop so the log is closed properly
+		if (headless && !stop) {
+			stop = true;
+			return;
+		}
 		//RobotBase::MSPReset();
 		exit(0);
 	}
@@ -157,6 +175,31 @@ void write_jockeys(std::vector<vocab_t> & jockey_ids) {
 	jockey_ids.push_back(id);
 }
 
+/**
+ * Process the logs of runs without a window, as fast as they can be read, into output, see CBatchRun. BATCH_COLOR=r,g,b
+ * is the colour to recognise in the frames, BATCH_THREADS the number of runs processed at the same time.
+ */
+int runBatch(const char *output, const std::vector<std::string> & logs)
+{
+	CBatch batch(output, logs);
+	char *str_color = getenv("BATCH_COLOR");
+	if (str_color) {
+		int r, g, b;
+		if (sscanf(str_color, "%i,%i,%i", &r, &g, &b) == 3) {
+			unsigned char rgb[3] = { (unsigned char)r, (unsigned char)g, (unsigned char)b };
+			batch.learnColor(rgb);
+		} else {
+			std::cerr << "BATCH_COLOR should be r,g,b, the frames are only counted" << std::endl;
+		}
+	}
+	int threads = sysconf(_SC_NPROCESSORS_ONLN);
+	char *str_threads = getenv("BATCH_THREADS");
+	if (str_threads) threads = atoi(str_threads);
+	int failed = batch.run(threads);
+	if (failed > 0) std::cerr << failed << " of " << logs.size() << " runs failed" << std::endl;
+	return (failed > 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 //#define STORE_IMAGES_ANYWAY
 
 int main(int argc,char* argv[])
@@ -165,12 +208,30 @@ int main(int argc,char* argv[])
 	a.sa_handler = &interrupt_signal_handler;
 	sigaction(SIGINT, &a, NULL);
 
+	if (argc >= 2 && std::string(argv[1]) == "batch") {
+		if (argc < 4) {
+			std::cerr << "Usage: " << argv[0] << " batch OUTPUT_DIR LOG [LOG...]" << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		return runBatch(argv[2], std::vector<std::string>(argv + 3, argv + argc));
+	}
+
 	std::string ip_address, command_port, image_port;
+	std::vector<std::string> camera_addresses;
 	if (argc < 4) {
-		std::cerr << "Usage: " << argv[0] << " IP_ADDRESS COMMAND_PORT IMAGE_PORT [ZIGBEE]" << std::endl;
+		std::cerr << "Usage: " << argv[0] << " IP_ADDRESS[,IP_ADDRESS...] COMMAND_PORT IMAGE_PORT [zigbee,control,camera,stream,laser,map,headless]" << std::endl;
+		std::cerr << "       " << argv[0] << " batch OUTPUT_DIR LOG [LOG...]" << std::endl;
+		std::cerr << "With several addresses the cameras of all robots are shown, the first one is controlled" << std::endl;
+		std::cerr << "Headless records to STREAM_LOG without a window, BATCH_OUTPUT processes the log at the end" << std::endl;
 		exit(EXIT_FAILURE);
 	} else {
-		ip_address = std::string(argv[1]);
+		std::string addresses = std::string(argv[1]);
+		ip_address = addresses.substr(0, addresses.find(','));
+		std::stringstream ss(addresses);
+		std::string address;
+		while (getline(ss, address, ',')) {
+			if (!address.empty()) camera_addresses.push_back(address);
+		}
 		command_port = std::string(argv[2]);
 		image_port = std::string(argv[3]);
 	}
@@ -182,7 +243,8 @@ int main(int argc,char* argv[])
 	int id = ip_address_int[3];
 	std::cout << "Connect to robot with id " << id << std::endl;
 
-	bool enable_zigbee = false; bool enable_control = false; bool enable_camera = false;
+	bool enable_zigbee = false; bool enable_control = false; bool enable_camera = false; bool enable_laser = false;
+	bool enable_stream = false; bool enable_map = false;
 	if (argc == 5) {
 		std::string arg5 = std::string(argv[4]);
 		if (arg5.find("zigbee") != std::string::npos) {
@@ -194,7 +256,26 @@ int main(int argc,char* argv[])
 		if (arg5.find("camera") != std::string::npos) {
 			enable_camera = true;
 		}
+		// the camera pushes compressed frames instead of sending a raw frame per request
+		if (arg5.find("stream") != std::string::npos) {
+			enable_camera = true;
+			enable_stream = true;
+		}
+		// the laser scans are received over the command connection
+		if (arg5.find("laser") != std::string::npos) {
+			enable_control = true;
+			enable_laser = true;
+		}
+		// the map is asked over the command connection, the broadcasts of the other robots come over the zigbee
+		if (arg5.find("map") != std::string::npos) {
+			enable_control = true;
+			enable_map = true;
+		}
+		if (arg5.find("headless") != std::string::npos) {
+			headless = true;
+		}
 	}
+	if (!headless) gui = new CGui();
 
 	bool requirements[0]; // none
 
@@ -230,18 +311,56 @@ int main(int argc,char* argv[])
 		msg.len = 0;
 		cmd_client.sendMessage(&msg);
 
+		if (enable_laser) {
+			std::cout << "Send MSG_LASER_SCAN_STREAM" << std::endl;
+			uint8_t on = 1;
+			msg.type = MSG_LASER_SCAN_STREAM;
+			msg.data = &on;
+			msg.len = 1;
+			cmd_client.sendMessage(&msg);
+			msg.data = NULL;
+			msg.len = 0;
+		}
+
 		// sleep 2 seconds
 		sleep(3);
 	}
 
-	CImageClient* client = new CImageClient();
+	// use an environmental variable STREAM_LOG to record the frames of all robots and the laser scans
+	CStreamLog *recorder = NULL;
+	char *str_stream_log = getenv("STREAM_LOG");
+	if (str_stream_log) {
+		recorder = new CStreamLog();
+		if (recorder->open(str_stream_log)) {
+			std::cout << "Record to " << str_stream_log << std::endl;
+		} else {
+			delete recorder;
+			recorder = NULL;
+		}
+	}
+	if (headless && recorder == NULL) std::cerr << "Headless without STREAM_LOG, nothing is kept" << std::endl;
+
+	if (enable_camera) {
+		for (unsigned int i = 0; i < camera_addresses.size(); i++) {
+			std::cout << "Receive images from " << camera_addresses[i] << ":" << image_port << std::endl;
+			CImageReceiver *receiver = new CImageReceiver(camera_addresses[i].c_str(), image_port.c_str(), enable_stream);
+			// the channel of the frames is the robot, in the order of the addresses
+			if (recorder != NULL) receiver->setRecorder(recorder, i);
+			receiver->start();
+			receivers.push_back(receiver);
+		}
+	}
 
 	std::cout << "Quick test, this should be MSG_ACTIVE_JOCKEYS: \"" << StrMessage[MSG_ACTIVE_JOCKEYS] << "\" to get active jockeys list" << std::endl;
 
+	// use an environmental variable CALIB_REPORT to keep the report of the calibrations of all robots in a file
+	CCalibReport calibReport;
+	char *str_calib_report = getenv("CALIB_REPORT");
+
 	std::vector<vocab_t> jockey_ids;
 	write_jockeys(jockey_ids);
 	int jockey_count = jockey_ids.size();
-	gui.initJockeys(jockey_count);
+	if (gui != NULL) gui->initJockeys(jockey_count);
 	bool status[jockey_count];
 	for (int i = 0; i < jockey_ids.size(); i++) {
 		status[i] = false;
@@ -251,75 +370,106 @@ int main(int argc,char* argv[])
 	message.type = MSG_NONE;
 	message.data = NULL;
 	message.len = 0;
-	image = new CRawImage();
 	int runs=0;
+	int slow_period = SLOW_PERIOD / GUI_PERIOD;
 
 	int zigb_request_count = 10;
 	int zigb_request = zigb_request_count;
 
-	int cam_request_count = 20;
-	int cam_request = cam_request_count;
+	std::vector<std::vector<uint8_t> > snapshots;
+	//! The robot of the map of the command connection, -1 until its first snapshot
+	int mapRobot = -1;
+	//! After dropped snapshots the deltas do not add up, the whole map is asked again
+	bool mapComplete = false;
 
-	bool connected = false;
 	while (stop == false) {
-		if (enable_camera) {
-			if (!connected) {
-				if (!--cam_request) {
-					std::cout << "Connect to image port on the image server: " << image_port.c_str() << std::endl;
-					int error = client->connectServer(ip_address.c_str(),image_port.c_str());
-					if (error < 0) {
-						std::cerr << "Could not connect to image port on the image server, try next time" << std::endl;
-						cam_request = cam_request_count;
-					} else {
-						connected = true;
-					}
+		// the receivers connect and decode on their own threads, so the mosaic is redrawn at full rate
+		if (enable_camera && gui != NULL) {
+			gui->drawMosaic(receivers);
+		}
+
+		if (enable_laser) {
+			LaserScanHeader scan;
+			int16_t columns[MAX_LASER_SCAN_ROWS];
+			if (cmd_client.checkForScan(scan, columns)) {
+				if (gui != NULL) gui->drawScan(scan, columns);
+				if (recorder != NULL) {
+					uint8_t buffer[laserScanMaxLength(MAX_LASER_SCAN_ROWS)];
+					int len = packLaserScan(scan, columns, buffer);
+					recorder->append(STREAM_LOG_SCAN, 0, buffer, len, scan.timestamp);
 				}
 			}
 		}
 
-		message = zigbee->readMessage();
-		if (message.type == MSG_ACTIVE_JOCKEYS) {
-			std::cout << "Got message back about active jockeys" << std::endl;
-			if (message.fromRobot != id) {
-				std::cout << "Message is from another robot" << std::endl;
-			} else {
-				std::cout << "Message is for us" << std::endl;
-				int len = message.len;
-				if (len == 0) {
-					std::cout << "No jockeys active" << std::endl;
+		if (enable_map) {
+			if (cmd_client.checkForMapSnapshots(snapshots) > 0) mapComplete = false;
+			for (unsigned int s = 0; s < snapshots.size(); s++) {
+				int robot = map.applySnapshot(&snapshots[s][0], snapshots[s].size());
+				if (robot >= 0) mapRobot = robot;
+				if (recorder != NULL) {
+					recorder->append(STREAM_LOG_MESSAGE, MSG_MAP_SNAPSHOT, &snapshots[s][0], snapshots[s].size());
+				}
+			}
+			if (gui != NULL) gui->drawMap(map);
+		}
+
+		if (gui != NULL) gui->update();
+		usleep(GUI_PERIOD);
+		if (++runs % slow_period != 0) continue;
+
+		if (enable_map) {
+			// only what changed since the version of which everything arrived is sent again
+			uint32_t since = (mapComplete && mapRobot >= 0) ? map.versionOf(mapRobot) : 0;
+			if (cmd_client.requestMapSnapshot(since, MAP_SNAPSHOT_COVARIANCE | MAP_SNAPSHOT_POSE)) mapComplete = true;
+		}
+
+		for (int m = 0; zigbee != NULL && m < ZIGBEE_MESSAGES; m++) {
+			message = zigbee->readMessage();
+			if (message.type == MSG_NONE) break;
+			if (message.type == MSG_MOTOR_CALIBRATION_REPORT) {
+				// every robot broadcasts its report, not only the one that is controlled
+				if (calibReport.add(message.fromRobot, message.data, message.len)) {
+					calibReport.print(stdout);
+					if (str_calib_report) calibReport.write(str_calib_report);
+				}
+			}
+			if (message.type == MSG_MAP_SNAPSHOT && enable_map) {
+				map.applySnapshot(message.data, message.len);
+				if (recorder != NULL) recorder->append(STREAM_LOG_MESSAGE, MSG_MAP_SNAPSHOT, message.data, message.len);
+			}
+			if (message.type == MSG_ACTIVE_JOCKEYS) {
+				std::cout << "Got message back about active jockeys" << std::endl;
+				if (message.fromRobot != id) {
+					std::cout << "Message is from another robot" << std::endl;
 				} else {
-					std::cout << "Message length = " << len << std::endl;
-					int int_len = ((len * sizeof(char)) / sizeof(int));
-					std::cout << "Number of jockeys active: " << int_len << std::endl;
-					int *jockey_arr = (int*)message.data;
-					for (int i = 0; i < jockey_ids.size(); i++) {
-						status[i] = false;
-					}
-					for (int a = 0; a < int_len; a++) {
+					std::cout << "Message is for us" << std::endl;
+					int len = message.len;
+					if (len == 0) {
+						std::cout << "No jockeys active" << std::endl;
+					} else {
+						std::cout << "Message length = " << len << std::endl;
+						int int_len = ((len * sizeof(char)) / sizeof(int));
+						std::cout << "Number of jockeys active: " << int_len << std::endl;
+						int *jockey_arr = (int*)message.data;
 						for (int i = 0; i < jockey_ids.size(); i++) {
-							if (jockey_ids[i] == jockey_arr[a]) {
-								std::cout << "Jockeys with id " << a << " and index " << i << " active" << std::endl;
-								status[i] = true;
+							status[i] = false;
+						}
+						for (int a = 0; a < int_len; a++) {
+							for (int i = 0; i < jockey_ids.size(); i++) {
+								if (jockey_ids[i] == jockey_arr[a]) {
+									std::cout << "Jockeys with id " << a << " and index " << i << " active" << std::endl;
+									status[i] = true;
+								}
 							}
 						}
 					}
+					std::cout << "Update gui status" << std::endl;
+					if (gui != NULL) gui->drawStatus(status);
 				}
-				std::cout << "Update gui status" << std::endl;
-				gui.drawStatus(status);
-			}
-		}
-
-		if (connected) {
-			//		client->sendMessage(message);
-			client->sendSmallMessage(0);
-			int result = client->checkForImage(image);
-			if (result) {
-				//message.type = MSG_GET_IMAGE;
-				gui.drawImage(image);
 			}
 		}
 
-		if (!--zigb_request) {
+		if (zigbee != NULL && !--zigb_request) {
 			//fill the status HERE
 			message.type = MSG_ACTIVE_JOCKEYS;
 			message.data = NULL;
@@ -330,8 +480,6 @@ int main(int argc,char* argv[])
 				zigb_request = zigb_request_count;
 			} else {
 				std::cout << "Zigbee request not successfully sent" << std::endl;
-				client->disconnectServer();
-				connected = false;
 			}
 		}
 
@@ -341,15 +489,20 @@ int main(int argc,char* argv[])
 		//		client->sendMessage();
 
 #ifdef STORE_IMAGES_ANYWAY
-		image->saveBmp();
+		for (unsigned int i = 0; i < receivers.size(); i++) receivers[i]->saveBmp();
 #endif
-		gui.update();
-		if (enable_control) {
+		if (enable_control && gui != NULL) {
 			processKeys(&cmd_client);
 		}
-		usleep(500000);
-		runs++;
 	}
-	delete client;
+	for (unsigned int i = 0; i < receivers.size(); i++) delete receivers[i];
+	bool recorded = (recorder != NULL);
+	delete recorder;
+	delete gui;
+	// the headless run is processed as a batch of one, from the log that was just closed
+	char *str_batch_output = getenv("BATCH_OUTPUT");
+	if (headless && str_batch_output != NULL && recorded) {
+		return runBatch(str_batch_output, std::vector<std::string>(1, std::string(str_stream_log)));
+	}
 	return EXIT_SUCCESS;
 }
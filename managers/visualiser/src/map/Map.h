@@ -4,50 +4,80 @@
  *  Created on: 15.11.2012
  *      Author: robert
  */
-#include <gsl/gsl_matrix.h>
-#include <gsl/gsl_blas.h>
-#include <gsl/gsl_cblas.h>
-#include <gsl/gsl_linalg.h>
+#include <stdint.h>
+#include <map>
+#include <vector>
+#include "messageDataType.h"
+#include "messageSchema.h"
 
 #ifndef MARK_H_
 #define MARK_H_
 
-using namespace std;
-typedef struct MapData {
-		gsl_matrix * map;
-		gsl_matrix * covariance;
-	} MapData;
+//! The uncertainty ellipses are drawn at this many standard deviations
+#define MAP_ELLIPSE_SIGMA 2.0
 
+//! A rectangle of the map in m, x0 < x1 and y0 < y1
+struct MapArea {
+	float x0, y0, x1, y1;
+};
+
+//! The half axes in m of the uncertainty ellipse of x and y, and the angle of the first axis
+struct MapEllipse {
+	float axis[2];
+	float angle;
+};
+
+struct MapObject {
+	MappedObjectPosition position;
+	MapEllipse ellipse;
+};
+
+struct MapRobot {
+	//! The last pose of MAP_SNAPSHOT_POSE, valid if posed
+	float x, y, phi;
+	MapEllipse ellipse;
+	bool posed;
+	//! Version of the map of the robot of which all parts arrived, changes are asked since this one
+	uint32_t version;
+};
+
+/**
+ * The maps of the robots as the visualiser shows them. The robots run the filter, here only their MSG_MAP_SNAPSHOT
+ * messages are applied: the objects of a snapshot replace the ones with the same robot and map_id, a full snapshot
+ * first removes all objects of its robot, and a pose moves the robot. Every change records the area it covers before
+ * and after it, so a view only draws those again instead of the whole map.
+ */
 class Map {
 public:
-	Map(double*,int);
+	typedef std::pair<int, int> Key;
+
+	Map();
 	virtual ~Map();
-	gsl_matrix *state;
-	gsl_matrix *predstate;
-	int velikostmapy;
-	static double PI;
-	void filter(double*,double*,int);
-	MapData readFromFile(const char* filename);
-	int writeToFile(const char* filename,MapData data);
+
+	//! Apply a MSG_MAP_SNAPSHOT, returns the robot of its map or -1 if it is not a snapshot this version understands
+	int applySnapshot(const uint8_t *data, int len);
+
+	//! Version of the map of robot to ask the changes since, 0 for a robot of which nothing arrived yet
+	uint32_t versionOf(int robot) const;
+
+	//! Move the areas that changed since the last call into areas
+	void takeChanges(std::vector<MapArea> & areas);
+
+	//! The area an object or a robot covers, the ellipse and the position itself
+	static MapArea areaOf(float x, float y, const MapEllipse & ellipse);
+
+	inline const std::map<Key, MapObject> & getObjects() const { return objects; }
+	inline const std::map<int, MapRobot> & getRobots() const { return robots; }
 private:
-//	double **actualMeasured;
-	//chyba odometrie robota
-	gsl_matrix *R;
-	gsl_matrix *P;
-	gsl_matrix *predP;
-	gsl_matrix *secondAngle;
-	//chyba měření kamerou
-	gsl_matrix *Q;
-	double *odometry;
-	int time;
-	// sign is of {-1,1}
-	int sign;
-	double normalizeAngle(double );
-	double normalizeAngleDiff(double);
-	int minIndex(double* ,int );
-	void printMatrix(gsl_matrix*);
-	void printArray(double *,int );
+	//! The ellipse of the covariance a, b; b, c of x and y
+	static MapEllipse ellipseOf(float a, float b, float c);
+	static bool sameEllipse(const MapEllipse & a, const MapEllipse & b);
+	void change(const MapArea & area);
 
+	//! By robot and map_id
+	std::map<Key, MapObject> objects;
+	std::map<int, MapRobot> robots;
+	std::vector<MapArea> changes;
 };
 
 #endif /* MARK_H_ */